@@ -0,0 +1,175 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("batchcommand.cpp")
+
+#include "batchcommand.h"
+#include "cliclient.h"
+#include "makecommand.h"
+#include "output.h"
+#include <QRegularExpression>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace
+{
+    // BatchRunner runs the commands read from stdin in order, one at a time.
+    // Each command waits for the prior command to complete, so their output is
+    // not interleaved.
+    class BatchRunner : public QObject
+    {
+    public:
+        BatchRunner(QCoreApplication &app, CliClient &client);
+
+    public:
+        // Queue a command line read from stdin
+        void addLine(const QString &line);
+        // Stdin has ended - exit once the queued commands have completed
+        void endInput();
+
+    private:
+        void runNext();
+        void commandComplete(int exitCode);
+
+    private:
+        QCoreApplication &_app;
+        CliClient &_client;
+        std::deque<QString> _pendingLines;
+        bool _running, _inputEnded;
+        // Exit code of the last command that failed, or Success
+        int _exitCode;
+    };
+
+    BatchRunner::BatchRunner(QCoreApplication &app, CliClient &client)
+        : _app{app}, _client{client}, _running{false}, _inputEnded{false},
+          _exitCode{CliExitCode::Success}
+    {
+        // Commands are only run while connected.  If the connection is lost,
+        // DaemonConnection reconnects, and the remaining commands run once it
+        // is reestablished.
+        QObject::connect(&_client.connection(), &DaemonConnection::connectedChanged,
+                         this, [this](bool connected)
+        {
+            if(connected)
+                runNext();
+        });
+    }
+
+    void BatchRunner::addLine(const QString &line)
+    {
+        _pendingLines.push_back(line);
+        runNext();
+    }
+
+    void BatchRunner::endInput()
+    {
+        _inputEnded = true;
+        runNext();
+    }
+
+    void BatchRunner::runNext()
+    {
+        while(!_running && !_pendingLines.empty())
+        {
+            if(!_client.connection().isConnected())
+                return; // Resumes when the connection is established
+
+            QStringList params = _pendingLines.front().split(QRegularExpression{QStringLiteral("\\s+")},
+                                                             QString::SplitBehavior::SkipEmptyParts);
+            _pendingLines.pop_front();
+            // Ignore blank lines and comments
+            if(params.isEmpty() || params[0].startsWith('#'))
+                continue;
+
+            qInfo() << "Running batch command:" << params;
+            _running = true;
+            try
+            {
+                // Unstable commands aren't available in batch mode
+                CliCommand &command = getCommand(false, params[0]);
+                command.execBatch(params, _client,
+                                  [this](int exitCode){commandComplete(exitCode);});
+            }
+            catch(const Error &error)
+            {
+                qInfo() << "Batch command error" << error;
+                commandComplete(CliCommand::mapErrorCode(error.code()));
+            }
+        }
+
+        if(!_running && _pendingLines.empty() && _inputEnded)
+            _app.exit(_exitCode);
+    }
+
+    void BatchRunner::commandComplete(int exitCode)
+    {
+        qInfo() << "Batch command completed with exit code" << exitCode;
+        if(exitCode != CliExitCode::Success)
+            _exitCode = exitCode;
+        _running = false;
+        // Commands can complete synchronously (from execBatch() itself, or by
+        // throwing), so run the next command asynchronously
+        QMetaObject::invokeMethod(this, [this](){runNext();}, Qt::QueuedConnection);
+    }
+}
+
+void BatchCommand::printHelp(const QString &name)
+{
+    outln() << "usage:" << name;
+    outln() << "Reads commands from stdin (one per line) and runs them over one daemon connection.";
+    outln() << "Commands are given without the leading 'piactl', such as 'get connectionstate'.";
+    outln() << "The get, set, connect, disconnect, and resetsettings commands can be used.";
+    outln() << "Values for 'get' are fetched from the daemon when each command runs.";
+    outln() << "Blank lines and lines beginning with '#' are ignored.";
+    outln() << "Exits when stdin is closed, with the exit code of the last command that failed (or 0).";
+}
+
+int BatchCommand::exec(const QStringList &params, QCoreApplication &app)
+{
+    checkNoParams(params);
+
+    CliClient client;
+    // Values are fetched on demand, so the daemon doesn't need to send any
+    // changes.
+    client.connection().subscribe({{QStringLiteral("state"), QJsonArray{}}});
+
+    BatchRunner runner{app, client};
+
+    // Read stdin on a separate thread, since it can't be read asynchronously
+    // on all platforms.  The thread only exits at the end of input, and the
+    // application event loop doesn't exit until the end of input is processed,
+    // so the thread is done by the time exec() returns.
+    std::thread stdinReader{[&runner]()
+    {
+        std::string line;
+        while(std::getline(std::cin, line))
+        {
+            QString lineStr = QString::fromStdString(line);
+            QMetaObject::invokeMethod(&runner, [&runner, lineStr]()
+                {runner.addLine(lineStr);}, Qt::QueuedConnection);
+        }
+        QMetaObject::invokeMethod(&runner, [&runner](){runner.endInput();},
+                                  Qt::QueuedConnection);
+    }};
+
+    int exitCode = app.exec();
+    stdinReader.join();
+    return exitCode;
+}
@@ -45,3 +45,21 @@ void CliClient::checkFirstConnected(bool connected)
         emit firstConnected();
     }
 }
+
+Async<void> CliClient::refreshProperties(const QJsonObject &properties)
+{
+    return _connection.call(QStringLiteral("getProperties"), QJsonArray{properties})
+        ->then(this, [this](const QJsonValue &result)
+        {
+            const QJsonObject &values = result.toObject();
+            QJsonObject::const_iterator it;
+#define AssignObject(name) \
+            if((it = values.find(QStringLiteral(#name))) != values.end() && it.value().isObject()) _connection.name.assign(it.value().toObject())
+
+            AssignObject(data);
+            AssignObject(account);
+            AssignObject(settings);
+            AssignObject(state);
+#undef AssignObject
+        });
+}
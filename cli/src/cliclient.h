@@ -36,6 +36,12 @@ public:
 public:
     DaemonConnection &connection() {return _connection;}
 
+    // Fetch the current values of specific properties with the daemon's
+    // getProperties RPC, and apply them to the connection's objects.  The
+    // properties are specified as for DaemonConnection::subscribe().  Used in
+    // batch mode, which doesn't keep the connection's objects up to date.
+    Async<void> refreshProperties(const QJsonObject &properties);
+
 private:
     void checkFirstConnected(bool connected);
 
@@ -25,6 +25,7 @@
 #include "cliclient.h"
 #include "util.h"
 #include <QElapsedTimer>
+#include <algorithm>
 #include <unordered_map>
 
 namespace
@@ -51,6 +52,8 @@ namespace
             "This command requires a logged in account"}},
         {Error::Code::DaemonRPCUnknownSetting, {CliExitCode::UnknownSetting,
             "Request rejected, unknown property name"}},
+        {Error::Code::DaemonRPCNotConnected, {CliExitCode::NotConnected,
+            "This command requires a VPN connection"}},
     };
 }
 
@@ -61,6 +64,11 @@ void CliTimeout::setTimeout(std::chrono::seconds timeout)
     _timeout = timeout;
 }
 
+void CliTimeout::ensureTimeout(std::chrono::seconds minimum)
+{
+    _timeout = std::max(_timeout, minimum);
+}
+
 CliTimeout::CliTimeout(QCoreApplication &app)
     : _app{app}
 {
@@ -176,6 +184,30 @@ QJsonValue CliCommand::execOneShot(QCoreApplication &app,
     return rpcValue;
 }
 
+void CliCommand::callBatchRpc(CliClient &client, const QString &rpcMethod,
+                              const QJsonArray &rpcArgs,
+                              std::function<void(int)> complete)
+{
+    client.connection().call(rpcMethod, rpcArgs)
+        ->notify(&client, [rpcMethod, complete = std::move(complete)](const Error &error, const QJsonValue &)
+        {
+            if(error)
+                complete(traceRpcError(error));
+            else
+            {
+                qInfo() << "Daemon accepted" << rpcMethod << "RPC";
+                complete(CliExitCode::Success);
+            }
+        });
+}
+
+void CliCommand::execBatch(const QStringList &params, CliClient &,
+                           std::function<void(int)> complete)
+{
+    errln() << "Command can't be used in batch mode:" << params[0];
+    complete(CliExitCode::InvalidArgs);
+}
+
 void TrivialRpcCommand::printHelp(const QString &)
 {
     outln() << _description;
@@ -189,3 +221,10 @@ int TrivialRpcCommand::exec(const QStringList &params, QCoreApplication &app)
     execOneShot(app, _method, {});
     return CliExitCode::Success;
 }
+
+void TrivialRpcCommand::execBatch(const QStringList &params, CliClient &client,
+                                  std::function<void(int)> complete)
+{
+    checkNoParams(params);
+    callBatchRpc(client, _method, {}, std::move(complete));
+}
@@ -25,6 +25,9 @@
 #include <QJsonArray>
 #include <QElapsedTimer>
 #include <chrono>
+#include <functional>
+
+class CliClient;
 
 // Exit codes that can be returned from the CLI app.  Exit codes are limited to
 // the range 0-127, so we can't return any arbitrary Error::Code value.
@@ -40,6 +43,7 @@ enum CliExitCode : int
     RequiresClient,
     NotLoggedIn,
     UnknownSetting,
+    NotConnected,
     OtherError = 127,
 };
 
@@ -59,6 +63,10 @@ public:
     // Set the timeout specified by the user on the command line.  This can't be
     // used once any CliTimeouts have been created.
     static void setTimeout(std::chrono::seconds timeout);
+    // Raise the timeout to at least 'minimum' for a command that's known to
+    // take longer; a longer timeout specified by the user is kept.  Like
+    // setTimeout(), this can't be used once any CliTimeouts have been created.
+    static void ensureTimeout(std::chrono::seconds minimum);
 
 public:
     CliTimeout(QCoreApplication &app);
@@ -106,6 +114,13 @@ protected:
     QJsonValue execOneShot(QCoreApplication &app, const QString &rpcMethod,
                            const QJsonArray &rpcArgs);
 
+    // Issue a daemon RPC for a command in batch mode, and call 'complete' with
+    // the resulting exit code.  Errors are traced and printed like
+    // execOneShot().
+    void callBatchRpc(CliClient &client, const QString &rpcMethod,
+                      const QJsonArray &rpcArgs,
+                      std::function<void(int)> complete);
+
 public:
     // Print the command's help text.
     virtual void printHelp(const QString &name) = 0;
@@ -117,6 +132,17 @@ public:
     // params always contains at least the command name (ensured by
     // makeCommand() / cliMain().)
     virtual int exec(const QStringList &params, QCoreApplication &app) = 0;
+
+    // Execute the command in batch mode, using the batch's existing daemon
+    // connection.  'params' is the same as for exec().  When the command is
+    // done, it calls 'complete' with its exit code (possibly before
+    // execBatch() returns).  execBatch() can also throw an Error if the
+    // parameters are not valid.
+    //
+    // The default implementation prints an error; commands that don't support
+    // batch mode (such as 'monitor') don't override it.
+    virtual void execBatch(const QStringList &params, CliClient &client,
+                           std::function<void(int)> complete);
 };
 
 // Model of a trivial RPC command with no params and no result
@@ -129,6 +155,8 @@ public:
 public:
     virtual void printHelp(const QString &name) override;
     virtual int exec(const QStringList &params, QCoreApplication &app) override;
+    virtual void execBatch(const QStringList &params, CliClient &client,
+                           std::function<void(int)> complete) override;
 private:
     QString _method, _description;
 };
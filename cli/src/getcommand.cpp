@@ -29,6 +29,7 @@
 namespace GetSetType
 {
     const QString connectionState{QStringLiteral("connectionstate")};
+    const QString connectionTiming{QStringLiteral("connectiontiming")};
     const QString debugLogging{QStringLiteral("debuglogging")};
     const QString portForward{QStringLiteral("portforward")};
     const QString region{QStringLiteral("region")};
@@ -119,6 +120,7 @@ namespace
         // important to ensure that the possible values are displayed in help
         {GetSetType::connectionState, {QStringLiteral("VPN connection state"),
             qEnumValues<VpnState::State>()}},
+        {GetSetType::connectionTiming, {QStringLiteral("Time spent in each phase of the last VPN connection"), {}}},
         {GetSetType::debugLogging, {QStringLiteral("State of debug logging setting"), {}}},
         {GetSetType::portForward, {QStringLiteral("Forwarded port number if available, or the status of the request to forward a port"),
             qEnumValues<DaemonState::PortForwardState>(QStringLiteral("[forwarded port]"))}},
@@ -163,6 +165,9 @@ namespace
     private:
         template<class MonitorFunctor>
         void connectValueSignals(CliClient &client, MonitorFunctor func);
+        // Subscribe to the properties used by renderValue(), so the daemon
+        // doesn't send changes in anything else
+        void subscribeValue(CliClient &client);
 
     private:
         const QString _type;
@@ -204,6 +209,7 @@ namespace
                 outln() << _lastValue;
             }
         });
+        subscribeValue(client);
     }
 
     // Render a line representing a location, for either "get location" or
@@ -219,6 +225,21 @@ namespace
         {
             return client.connection().state.connectionState();
         }
+        else if(type == GetSetType::connectionTiming)
+        {
+            const auto &phases = client.connection().state.connectionPhases();
+            if(phases.isEmpty())
+                return QStringLiteral("Unknown");
+            QStringList phaseTimes;
+            quint64 total = 0;
+            for(const auto &phase : phases)
+            {
+                phaseTimes.push_back(QStringLiteral("%1=%2ms").arg(phase.phase()).arg(phase.duration()));
+                total += phase.duration();
+            }
+            phaseTimes.push_back(QStringLiteral("total=%1ms").arg(total));
+            return phaseTimes.join(' ');
+        }
         else if(type == GetSetType::debugLogging)
         {
             // The debugLogging setting is actually an arbitrary set of filters,
@@ -270,6 +291,11 @@ namespace
             QObject::connect(&client.connection().state, &DaemonState::connectionStateChanged,
                              this, func);
         }
+        else if(_type == GetSetType::connectionTiming)
+        {
+            QObject::connect(&client.connection().state, &DaemonState::connectionPhasesChanged,
+                             this, func);
+        }
         else if(_type  == GetSetType::debugLogging)
         {
             QObject::connect(&client.connection().settings, &DaemonSettings::debugLoggingChanged,
@@ -304,6 +330,40 @@ namespace
         }
     }
 
+    // Get the daemon properties used to render a type, in the form used by
+    // DaemonConnection::subscribe() and CliClient::refreshProperties()
+    QJsonObject getTypeProperties(const QString &type)
+    {
+        auto properties = [](const QString &object, const QString &property)
+        {
+            return QJsonObject{{object, QJsonArray{property}}};
+        };
+
+        if(type == GetSetType::connectionState)
+            return properties(QStringLiteral("state"), QStringLiteral("connectionState"));
+        else if(type == GetSetType::connectionTiming)
+            return properties(QStringLiteral("state"), QStringLiteral("connectionPhases"));
+        else if(type == GetSetType::debugLogging)
+            return properties(QStringLiteral("settings"), QStringLiteral("debugLogging"));
+        else if(type == GetSetType::portForward)
+            return properties(QStringLiteral("state"), QStringLiteral("forwardedPort"));
+        else if(type == GetSetType::region)
+            return properties(QStringLiteral("state"), QStringLiteral("vpnLocations"));
+        else if(type == GetSetType::regions)
+            return properties(QStringLiteral("state"), QStringLiteral("groupedLocations"));
+        else if(type == GetSetType::vpnIp)
+            return properties(QStringLiteral("state"), QStringLiteral("externalVpnIp"));
+
+        // exec() prevents this by checking the type with checkParams()
+        Q_ASSERT(false);
+        return {};
+    }
+
+    void ValuePrinter::subscribeValue(CliClient &client)
+    {
+        client.connection().subscribe(getTypeProperties(_type));
+    }
+
     // Check get/monitor parameters.  Prints an error and throws if the
     // parameters are not valid
     void checkParams(const QStringList &params, const std::map<QString, SupportedType> &types)
@@ -320,27 +380,12 @@ namespace
             throw Error{HERE, Error::Code::CliInvalidArgs};
         }
     }
-}
-
-void GetCommand::printHelp(const QString &name)
-{
-    outln() << "usage:" << name << "<type>";
-    outln() << "Get information from the PIA daemon.";
-    printSupportedTypes(_getSupportedTypes);
-}
-
-int GetCommand::exec(const QStringList &params, QCoreApplication &app)
-{
-    checkParams(params, _getSupportedTypes);
 
-    CliClient client;
-    CliTimeout timeout{app};
-    QObject localConnState{};
-
-    QObject::connect(&client, &CliClient::firstConnected, &localConnState, [&]()
+    // Print the value for 'get' from the connection's current state
+    void printGetValue(CliClient &client, const QString &type)
     {
         // Handle types only supported by 'get' specifically
-        if(params[1] == GetSetType::regions)
+        if(type == GetSetType::regions)
         {
             // Print locations in the default order they're listed in the
             // client - by country and latency
@@ -356,14 +401,54 @@ int GetCommand::exec(const QStringList &params, QCoreApplication &app)
             }
         }
         else
-            outln() << ValuePrinter::renderValue(client, params[1]);
+            outln() << ValuePrinter::renderValue(client, type);
+    }
+}
 
+void GetCommand::printHelp(const QString &name)
+{
+    outln() << "usage:" << name << "<type>";
+    outln() << "Get information from the PIA daemon.";
+    printSupportedTypes(_getSupportedTypes);
+}
+
+int GetCommand::exec(const QStringList &params, QCoreApplication &app)
+{
+    checkParams(params, _getSupportedTypes);
+
+    CliClient client;
+    CliTimeout timeout{app};
+    QObject localConnState{};
+
+    QObject::connect(&client, &CliClient::firstConnected, &localConnState, [&]()
+    {
+        printGetValue(client, params[1]);
         app.exit(CliExitCode::Success);
     });
 
     return app.exec();
 }
 
+void GetCommand::execBatch(const QStringList &params, CliClient &client,
+                           std::function<void(int)> complete)
+{
+    checkParams(params, _getSupportedTypes);
+
+    // Fetch just the properties needed for this type
+    QString type = params[1];
+    client.refreshProperties(getTypeProperties(type))
+        ->notify(&client, [&client, type, complete = std::move(complete)](const Error &error)
+        {
+            if(error)
+                complete(traceRpcError(error));
+            else
+            {
+                printGetValue(client, type);
+                complete(CliExitCode::Success);
+            }
+        });
+}
+
 
 void MonitorCommand::printHelp(const QString &name)
 {
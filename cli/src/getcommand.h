@@ -46,6 +46,8 @@ class GetCommand : public CliCommand
 public:
     virtual void printHelp(const QString &name) override;
     virtual int exec(const QStringList &params, QCoreApplication &app) override;
+    virtual void execBatch(const QStringList &params, CliClient &client,
+                           std::function<void(int)> complete) override;
 };
 
 // "monitor" is similar to "get" - it displays specific values supported by the
@@ -22,7 +22,9 @@
 #include "makecommand.h"
 #include "output.h"
 #include "applysettings.h"
+#include "batchcommand.h"
 #include "getcommand.h"
+#include "selftestcommand.h"
 #include "setcommand.h"
 #include "watchcommand.h"
 #include "brand.h"
@@ -42,11 +44,13 @@ const QString checkCalloutDescription =
 using CommandMap = std::map<QString, std::shared_ptr<CliCommand>>;
 const CommandMap stableCommands
 {
+    {"batch", std::make_shared<BatchCommand>()},
     {"connect", std::make_shared<TrivialRpcCommand>("connectVPN", connectDescription)},
     {"disconnect", std::make_shared<TrivialRpcCommand>("disconnectVPN", disconnectDescription)},
     {"get", std::make_shared<GetCommand>()},
     {"monitor", std::make_shared<MonitorCommand>()},
     {"resetsettings", std::make_shared<TrivialRpcCommand>("resetSettings", resetSettingsDescription)},
+    {"selftest", std::make_shared<SelfTestCommand>()},
     {"set", std::make_shared<SetCommand>()}
 };
 
@@ -0,0 +1,76 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("selftestcommand.cpp")
+
+#include "selftestcommand.h"
+#include "output.h"
+#include <QJsonObject>
+
+namespace
+{
+    // The test takes several seconds - the latency probes, then a download
+    // that may take a few seconds to begin
+    const std::chrono::seconds selfTestTimeout{15};
+
+    void printLatency(const char *label, const QJsonValue &latency)
+    {
+        if(latency.isDouble())
+            outln() << label << QString::number(latency.toDouble(), 'f', 1) << "ms";
+        else
+            outln() << label << "unavailable";
+    }
+}
+
+void SelfTestCommand::printHelp(const QString &name)
+{
+    outln() << "usage:" << name;
+    outln() << "Measures the VPN connection from inside the tunnel - the latency to the";
+    outln() << "VPN gateway and a short download - and compares it to the latency measured";
+    outln() << "before connecting.  The VPN must be connected.";
+}
+
+int SelfTestCommand::exec(const QStringList &params, QCoreApplication &app)
+{
+    checkNoParams(params);
+    CliTimeout::ensureTimeout(selfTestTimeout);
+    QJsonObject result = execOneShot(app, QStringLiteral("runSelfTest"), {}).toObject();
+
+    outln() << "Location:" << result.value(QStringLiteral("location")).toString();
+    const auto &preTunnelLatency = result.value(QStringLiteral("preTunnelLatency"));
+    const auto &tunnelLatency = result.value(QStringLiteral("tunnelLatency"));
+    printLatency("Latency before connecting:", preTunnelLatency);
+    printLatency("Latency through the tunnel:", tunnelLatency);
+    if(preTunnelLatency.isDouble() && tunnelLatency.isDouble())
+    {
+        double added = tunnelLatency.toDouble() - preTunnelLatency.toDouble();
+        outln() << "Latency added by the VPN:" << QString::number(added, 'f', 1) << "ms";
+    }
+
+    const auto &downloadRate = result.value(QStringLiteral("downloadRate"));
+    if(downloadRate.isDouble())
+    {
+        // Rate is in bytes per second; show megabits per second
+        double mbps = downloadRate.toDouble() * 8 / 1000000.0;
+        outln() << "Download rate:" << QString::number(mbps, 'f', 1) << "Mbps";
+    }
+    else
+        outln() << "Download rate: unavailable";
+
+    return CliExitCode::Success;
+}
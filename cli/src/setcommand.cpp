@@ -93,6 +93,23 @@ namespace
         Q_ASSERT(false);
         throw Error{HERE, Error::Code::CliInvalidArgs};
     }
+
+    // Check 'set' parameters.  Prints an error and throws if the parameters
+    // are not valid.
+    void checkParams(const QStringList &params)
+    {
+        if(params.length() != 3)
+        {
+            errln() << "Usage:" << params[0] << "<type> <value>";
+            throw Error{HERE, Error::Code::CliInvalidArgs};
+        }
+
+        if(_setSupportedTypes.count(params[1]) == 0)
+        {
+            errln() << "Unknown type:" << params[1];
+            throw Error{HERE, Error::Code::CliInvalidArgs};
+        }
+    }
 }
 
 void SetCommand::printHelp(const QString &name)
@@ -107,17 +124,7 @@ void SetCommand::printHelp(const QString &name)
 
 int SetCommand::exec(const QStringList &params, QCoreApplication &app)
 {
-    if(params.length() != 3)
-    {
-        errln() << "Usage:" << params[0] << "<type> <value>";
-        throw Error{HERE, Error::Code::CliInvalidArgs};
-    }
-
-    if(_setSupportedTypes.count(params[1]) == 0)
-    {
-        errln() << "Unknown type:" << params[1];
-        throw Error{HERE, Error::Code::CliInvalidArgs};
-    }
+    checkParams(params);
 
     // 'set' isn't implemented with a one-shot RPC because we need the daemon
     // state to validate the location choice before creating the RPC payload
@@ -158,3 +165,40 @@ int SetCommand::exec(const QStringList &params, QCoreApplication &app)
 
     return app.exec();
 }
+
+void SetCommand::execBatch(const QStringList &params, CliClient &client,
+                           std::function<void(int)> complete)
+{
+    checkParams(params);
+
+    // 'set region' needs the current locations to find the location ID; the
+    // batch connection doesn't keep them up to date.
+    QJsonObject properties;
+    if(params[1] == GetSetType::region)
+        properties.insert(QStringLiteral("data"), QJsonArray{QStringLiteral("locations")});
+
+    client.refreshProperties(properties)
+        ->notify(&client, [this, &client, params, complete = std::move(complete)](const Error &error)
+        {
+            if(error)
+            {
+                complete(traceRpcError(error));
+                return;
+            }
+
+            QJsonArray rpcArgs;
+            try
+            {
+                rpcArgs = buildRpcArgs(client, params);
+            }
+            catch(const Error &error)
+            {
+                qWarning() << "Failing with error:" << error;
+                // Most of these already printed a message in buildRpcArgs()
+                complete(mapErrorCode(error.code()));
+                return;
+            }
+            callBatchRpc(client, QStringLiteral("applySettings"), rpcArgs,
+                         std::move(complete));
+        });
+}
@@ -30,6 +30,8 @@ class SetCommand : public CliCommand
 public:
     virtual void printHelp(const QString &name) override;
     virtual int exec(const QStringList &params, QCoreApplication &app) override;
+    virtual void execBatch(const QStringList &params, CliClient &client,
+                           std::function<void(int)> complete) override;
 };
 
 #endif
@@ -22,6 +22,8 @@
 #include "watchcommand.h"
 #include "cliclient.h"
 #include "output.h"
+#include <QElapsedTimer>
+#include <unordered_map>
 #include <unordered_set>
 
 class JsonChangePrinter : public QObject
@@ -64,6 +66,156 @@ const std::unordered_set<QString> JsonChangePrinter::propertyBlacklist{
     QStringLiteral("groupedLocations")
 };
 
+// Prints changes in specific properties as newline-delimited JSON, along with
+// throughput/latency samples for each bandwidth measurement interval.  Each
+// line is one JSON object with a "time" - a monotonic timestamp in
+// milliseconds, using the same clock as DaemonState::connectionTimestamp.
+//
+// Property changes are printed as:
+//   {"time":..., "object":"state", "property":"connectionState", "value":...}
+// Samples are printed when a new interval measurement is received:
+//   {"time":..., "sample":{"interval":5, "received":..., "sent":..., "latency":...}}
+// - interval: length of the measurement interval in seconds
+// - received/sent: bytes received/sent during the interval
+// - latency: latency of the connected region in milliseconds, or null
+class NdjsonPrinter : public QObject
+{
+    Q_OBJECT
+
+private:
+    static qint64 monotonicTime()
+    {
+        QElapsedTimer timer;
+        timer.start();
+        return timer.msecsSinceReference();
+    }
+
+public:
+    // The properties are given as an object mapping object names to arrays of
+    // property names, like DaemonConnection::subscribe().
+    NdjsonPrinter(CliClient &client, const QJsonObject &properties)
+        : _client{client}
+    {
+        QJsonObject subscriptions{properties};
+
+        watchObject(client.connection().data, QStringLiteral("data"), properties);
+        watchObject(client.connection().account, QStringLiteral("account"), properties);
+        watchObject(client.connection().settings, QStringLiteral("settings"), properties);
+        watchObject(client.connection().state, QStringLiteral("state"), properties);
+
+        // The samples need these properties too (even if they're not printed)
+        auto addSubscription = [&](const QString &object, const QString &property)
+        {
+            QJsonArray objectProperties = subscriptions.value(object).toArray();
+            if(!objectProperties.contains(property))
+                objectProperties.push_back(property);
+            subscriptions.insert(object, objectProperties);
+        };
+        addSubscription(QStringLiteral("state"), QStringLiteral("intervalMeasurements"));
+        addSubscription(QStringLiteral("state"), QStringLiteral("connectedConfig"));
+        addSubscription(QStringLiteral("settings"), QStringLiteral("bandwidthSampleInterval"));
+        client.connection().subscribe(subscriptions);
+
+        connect(&client.connection().state, &DaemonState::intervalMeasurementsChanged,
+                this, &NdjsonPrinter::printSample);
+    }
+
+private:
+    void watchObject(const NativeJsonObject &obj, const QString &name,
+                     const QJsonObject &properties)
+    {
+        std::unordered_set<QString> &watched = _watchedProperties[&obj];
+        for(const auto &property : properties.value(name).toArray())
+            watched.insert(property.toString());
+
+        connect(&obj, &NativeJsonObject::propertyChanged, this,
+                [this, &obj, name](const QString &propName)
+                {
+                    // The daemon sends all properties before it handles the
+                    // subscription, ignore the ones we're not watching.
+                    const auto &watched = _watchedProperties[&obj];
+                    if(!watched.count(propName))
+                        return;
+
+                    printLine({{QStringLiteral("object"), name},
+                               {QStringLiteral("property"), propName},
+                               {QStringLiteral("value"), obj.get(propName)}});
+                });
+    }
+
+    void printSample()
+    {
+        const DaemonState &state = _client.connection().state;
+        const auto &measurements = state.intervalMeasurements();
+        // Nothing to print when the measurements are cleared (disconnected)
+        if(measurements.isEmpty())
+            return;
+
+        QJsonValue latency{QJsonValue::Null};
+        const auto &pLocation = state.connectedConfig().vpnLocation();
+        if(pLocation && pLocation->latency())
+            latency = pLocation->latency().get();
+
+        const auto &last = measurements.last();
+        QJsonObject sample
+        {
+            {QStringLiteral("interval"), static_cast<int>(_client.connection().settings.bandwidthSampleInterval())},
+            {QStringLiteral("received"), static_cast<double>(last.received())},
+            {QStringLiteral("sent"), static_cast<double>(last.sent())},
+            {QStringLiteral("latency"), latency}
+        };
+        printLine({{QStringLiteral("sample"), sample}});
+    }
+
+    void printLine(QJsonObject line)
+    {
+        line.insert(QStringLiteral("time"), monotonicTime());
+        outln() << QJsonDocument{line}.toJson(QJsonDocument::JsonFormat::Compact);
+    }
+
+private:
+    CliClient &_client;
+    std::unordered_map<const NativeJsonObject*, std::unordered_set<QString>> _watchedProperties;
+};
+
+namespace
+{
+    const QString ndjsonFormat{QStringLiteral("ndjson")};
+
+    // Properties printed in ndjson format if none are specified
+    QJsonObject defaultNdjsonProperties()
+    {
+        return {{QStringLiteral("state"), QJsonArray{QStringLiteral("connectionState"),
+                                                     QStringLiteral("externalVpnIp"),
+                                                     QStringLiteral("forwardedPort")}}};
+    }
+
+    // Parse properties given as "<object>.<property>".  Prints an error and
+    // throws if any are not valid.
+    QJsonObject parseProperties(const QStringList &params)
+    {
+        QJsonObject properties;
+        for(const auto &param : params)
+        {
+            int dot = param.indexOf('.');
+            QString object = param.left(dot);
+            QString property = param.mid(dot+1);
+            if(dot <= 0 || property.isEmpty() ||
+               (object != QStringLiteral("data") && object != QStringLiteral("account") &&
+                object != QStringLiteral("settings") && object != QStringLiteral("state")))
+            {
+                errln() << "Invalid property:" << param
+                    << "- expected <object>.<property>, where object is data, account, settings, or state";
+                throw Error{HERE, Error::Code::CliInvalidArgs};
+            }
+            QJsonArray objectProperties = properties.value(object).toArray();
+            objectProperties.push_back(property);
+            properties.insert(object, objectProperties);
+        }
+        return properties;
+    }
+}
+
 void WatchCommand::printHelp(const QString &name)
 {
     outln() << "usage:" << name;
@@ -74,11 +226,32 @@ void WatchCommand::printHelp(const QString &name)
     outln() << "  - group: Group where change occurred: settings, state, or data";
     outln() << "  - change-object: JSON object containing changed properties";
     outln() << "This command continues to run until terminated.";
+    outln();
+    outln() << "usage:" << name << ndjsonFormat << "[<object>.<property>...]";
+    outln() << "Prints changes in the specified properties as newline-delimited JSON";
+    outln() << "The daemon only sends changes in these properties (default: some common state properties)";
+    outln() << "Each line is a JSON object with a monotonic 'time' in milliseconds and either:";
+    outln() << "  - object, property, value: A property change";
+    outln() << "  - sample: Throughput (bytes per interval) and latency for each measurement interval";
 }
 
 int WatchCommand::exec(const QStringList &params, QCoreApplication &app)
 {
-    checkNoParams(params);
+    if(params.length() > 1)
+    {
+        if(params[1] != ndjsonFormat)
+        {
+            errln() << "Unknown format:" << params[1];
+            throw Error{HERE, Error::Code::CliInvalidArgs};
+        }
+
+        QJsonObject properties = params.length() > 2 ?
+            parseProperties(params.mid(2)) : defaultNdjsonProperties();
+
+        CliClient client;
+        NdjsonPrinter printer{client, properties};
+        return app.exec();
+    }
 
     CliClient client;
 
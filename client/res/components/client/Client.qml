@@ -76,6 +76,12 @@ QtObject {
     NativeClient.resetSettings()
   }
 
+  // Tell the client whether any of its windows are visible; it becomes idle
+  // shortly after they're all hidden (see ClientState.idle)
+  function setWindowsVisible(windowsVisible) {
+    NativeClient.setWindowsVisible(windowsVisible)
+  }
+
   function localeUpperCase(text) {
     return NativeClient.localeUpperCase(text)
   }
@@ -27,4 +27,6 @@ QtObject {
   readonly property bool quietLaunch: NativeClient.state.quietLaunch
   readonly property bool usingSafeGraphics: NativeClient.state.usingSafeGraphics
   readonly property bool winIsElevated: NativeClient.state.winIsElevated
+  readonly property bool idle: NativeClient.state.idle
+  readonly property bool background: NativeClient.state.background
 }
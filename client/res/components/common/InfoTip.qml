@@ -285,8 +285,9 @@ Item {
         //
         // By handling the width this way, we compute it when the InfoTip is
         // shown, and we still recompute it if the text or lanugage changes
-        // while it's visible.  One downside is that we unnecessarily lose the
-        // computed value when the tip is hidden, but that's not a big cost.
+        // while it's visible.  The computed value is lost when the tip is
+        // hidden, but BalanceText caches results, so showing it again is
+        // cheap.
         if(!visible)
           return maxWidth
 
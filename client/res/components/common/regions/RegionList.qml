@@ -31,7 +31,7 @@ Item {
 
   property string sortGroupName
   property alias regionListLabel: regionListView.regionListLabel
-  property alias regionFilter: regionListView.regionFilter
+  property alias service: regionListView.service
   property alias serviceLocations: regionListView.serviceLocations
   property alias portForwardEnabled: regionListView.portForwardEnabled
   property alias canFavorite: regionListView.canFavorite
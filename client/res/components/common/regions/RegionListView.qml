@@ -27,6 +27,7 @@ import "../../settings/stores"
 import "qrc:/javascript/keyutil.js" as KeyUtil
 import "qrc:/javascript/util.js" as Util
 import PIA.NativeAcc 1.0 as NativeAcc
+import PIA.RegionModel 1.0
 
 // RegionListView is used to select a region from the list of available regions.
 // It's used to select the VPN region, as well as the Shadowsocks region.
@@ -42,9 +43,9 @@ Rectangle {
 
   // Customization properties
 
-  // Specify a function used to filter regions.  The functor is passed a
-  // ServerLocation and returns true/false to include or exclude a region.
-  property var regionFilter
+  // The service that regions must have to be displayed - "vpn" (all regions)
+  // or "shadowsocks".  See RegionModel.service.
+  property string service: "vpn"
 
   // The service locations for this list view - includes best/chosen locations
   property var serviceLocations
@@ -145,11 +146,11 @@ Rectangle {
       }
       Repeater {
         id: regionsRepeater
-        model: displayRegionsArray
+        model: regionModel
         delegate: RegionDelegate {
-          region: modelData.region
-          regionCountry: modelData.regionCountry
-          regionChildren: modelData.regionChildren
+          region: model.region
+          regionCountry: model.regionCountry
+          regionChildren: model.regionChildren
           portForwardEnabled: regionListView.portForwardEnabled
           serviceLocations: regionListView.serviceLocations
           canFavorite: regionListView.canFavorite
@@ -349,139 +350,29 @@ Rectangle {
     return false
   }
 
-  function matchesSearchTerm(value) {
-    return value.toLowerCase().indexOf(searchTerm.toLowerCase()) >= 0
-  }
-
-  // Filter the 'countries' object from DaemonState.groupedLocations,
-  // which is an array of CountryLocations (which has a 'locations' property,
-  // which is an array of locations).
-  //
-  // - Single regions or regions in a group are included if the region name
-  //   contains the search string
-  // - An entire group is included if the group name contains the search string
-  function filterCountryLocations() {
-    var countries = Daemon.state.groupedLocations
-    if(!searchTerm && !regionFilter)
-      return countries
-
-    var filteredCountries = []
-    for(var i=0; i<countries.length; ++i) {
-      // Filter the locations in this country using the region filter.  This
-      // could cause a country group to become a single location (which affects
-      // the search term matching below)
-      var filteredLocations = countries[i].locations
-      if(regionFilter)
-        filteredLocations = filteredLocations.filter(regionFilter)
-
-      if(filteredLocations.length <= 0)
-        continue  // Nothing to display in this country
-
-      // If the country contains exactly one region, just include it if the
-      // region's name matches.  Don't look at the country name, because we
-      // don't display it for single regions.
-      if(filteredLocations.length === 1) {
-        if(matchesSearchTerm(Daemon.getLocationName(filteredLocations[0])))
-          filteredCountries.push({locations: filteredLocations})
-      }
-      // The country contains more than one region.  If the country name
-      // matches, include everything.
-      else if(matchesSearchTerm(Daemon.getCountryName(filteredLocations[0].country)))
-        filteredCountries.push({locations: filteredLocations})
-      // The country has more than one region, and the country name doesn't
-      // match.  Filter the individual regions.
-      else {
-        var filteredRegions = countries[i].locations.filter(function(loc) {
-          return matchesSearchTerm(Daemon.getLocationName(loc))
-        })
-        // If at least one region matched, include the country with the filtered
-        // regions
-        if(filteredRegions.length > 0)
-          filteredCountries.push({locations: filteredRegions})
-      }
-    }
-
-    return filteredCountries
-  }
-
-  function localeCompareRegions(first, second) {
-    return first.localeCompare(second, Client.state.activeLanguage.locale)
-  }
-
-  function countrySortName(country) {
-    if(country.locations.length === 1)
-      return Daemon.getLocationName(country.locations[0]).toLowerCase()
-    return Daemon.getCountryName(country.locations[0].country).toLowerCase()
-  }
-
-  // Sort the (possibly filtered) country locations by name.
-  function sortCountriesByName(countries) {
-    // Sort the country groups by either the country name or single-region name.
-    // Sort a copy of the array because this could be the actual array from
-    // DaemonState.
-    countries = countries.slice()
-    countries.sort(function(first, second) {
-      return localeCompareRegions(countrySortName(first), countrySortName(second))
-    })
-
-    // Sort each country's regions
-    for(var i=0; i<countries.length; ++i) {
-      // Again, duplicate the array we're about to slice, and here we have to
-      // create a new country object too
-      countries[i] = {locations: countries[i].locations.slice()}
-      countries[i].locations.sort(function(first, second) {
-        return localeCompareRegions(Daemon.getLocationName(first).toLowerCase(),
-                              Daemon.getLocationName(second).toLowerCase())
-      })
+  // The regions displayed, filtered and sorted in RegionModel.  RegionModel
+  // updates individual rows when the daemon state changes (such as latency
+  // measurements), so the delegates aren't recreated.
+  RegionModel {
+    id: regionModel
+    sortKey: regionListView.sortKey.currentValue
+    service: regionListView.service
+    searchTerm: regionListView.searchTerm
+    locale: Client.state.activeLanguage ? Client.state.activeLanguage.locale : ""
+    // Localized names used for searching and sorting
+    locationNames: {
+      var names = {}
+      var locations = Daemon.data.locations
+      for(var locId in locations)
+        names[locId] = Daemon.getLocationName(locations[locId])
+      return names
     }
-
-    return countries
-  }
-
-  // Build an array of regions from the country map.
-  function buildRegionArray(countries) {
-    var result = []
-    for(var i=0; i<countries.length; ++i) {
-      var rlist = countries[i].locations
-      var countryId = rlist[0].country.toLowerCase()
-      // Single location
-      if (rlist.length === 1) {
-        result.push({
-                      region: rlist[0],
-                      regionCountry: countryId,
-                      regionChildren: []
-                    })
-      }
-      // Group of locations in a country
-      else {
-        var subregions = rlist.map(function(rgn) {
-          return {
-            subregion: rgn
-          }});
-
-        // Country groups have a null region (they don't represent a single
-        // location).
-        result.push({
-                      region: null,
-                      regionCountry: countryId,
-                      regionChildren: subregions
-                    })
-      }
+    countryNames: {
+      var names = {}
+      for(var countryCode in Daemon.data.countryNames)
+        names[countryCode] = Daemon.getCountryName(countryCode)
+      return names
     }
-    return result
-  }
-
-  property var displayRegionsArray: {
-    // Get the filtered country locations
-    var countries = filterCountryLocations()
-
-    // If sorting by name, re-sort the countries and their locations.
-    // (If sorting by latency, Daemon has already sorted them.)
-    if(sortKey.currentValue === "name")
-      countries = sortCountriesByName(countries)
-
-    // Build the actual model into a list with children
-    return buildRegionArray(countries)
   }
 
   // Build a flat tabular representation of the contents that we use for
@@ -523,7 +414,7 @@ Rectangle {
                 regionItem: regionAuto})
 
     // The accessibility table is built from the actual items that represent the
-    // regions, not the displayRegionsArray, so it can include references to the
+    // regions, not the RegionModel rows, so it can include references to the
     // row items.  These are used to build the accessibility elements in
     // NativeAcc.Table.rows.
     //
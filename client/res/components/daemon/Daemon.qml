@@ -129,6 +129,11 @@ QtObject {
   function stopSnooze() {
     call ("stopSnooze", arguments);
   }
+  // Add/modify rules (keyed by path) and remove rules by path, without sending
+  // the whole rule list
+  function updateSplitTunnelRules(rules, removePaths) {
+    call("updateSplitTunnelRules", [rules, removePaths || []]);
+  }
 
   // Get the name of a location.
   // Returns the location's localized name if possible, otherwise the name
@@ -42,14 +42,18 @@ QtObject {
   readonly property string auth: NativeDaemon.settings.auth
   readonly property string serverCertificate: NativeDaemon.settings.serverCertificate
   readonly property string windowsIpMethod: NativeDaemon.settings.windowsIpMethod
+  readonly property string linuxFirewallBackend: NativeDaemon.settings.linuxFirewallBackend
   readonly property string proxy: NativeDaemon.settings.proxy
   readonly property var proxyCustom: NativeDaemon.settings.proxyCustom
   readonly property string proxyShadowsocksLocation: NativeDaemon.settings.proxyShadowsocksLocation
   readonly property bool automaticTransport: NativeDaemon.settings.automaticTransport
+  readonly property int bandwidthSampleInterval: NativeDaemon.settings.bandwidthSampleInterval
   readonly property var debugLogging: NativeDaemon.settings.debugLogging
   readonly property string updateChannel: NativeDaemon.settings.updateChannel
   readonly property string betaUpdateChannel: NativeDaemon.settings.betaUpdateChannel
   readonly property bool offerBetaUpdates: NativeDaemon.settings.offerBetaUpdates
+  readonly property bool backgroundUpdateDownload: NativeDaemon.settings.backgroundUpdateDownload
+  readonly property int backgroundUpdateRateLimit: NativeDaemon.settings.backgroundUpdateRateLimit
   readonly property bool splitTunnelEnabled: NativeDaemon.settings.splitTunnelEnabled
   readonly property var splitTunnelRules: NativeDaemon.settings.splitTunnelRules
 
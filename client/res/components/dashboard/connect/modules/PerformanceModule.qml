@@ -21,11 +21,13 @@ import QtQuick.Controls 2.3
 import QtQuick.Window 2.3
 import QtQuick.Layouts 1.3
 import "../../../../javascript/app.js" as App
+import "../../../client"
 import "../../../common"
 import "../../../core"
 import "../../../daemon"
 import "../../../theme"
 import PIA.NativeHelpers 1.0
+import PIA.BandwidthChart 1.0
 import PIA.NativeAcc 1.0 as NativeAcc
 
 MovableModule {
@@ -38,15 +40,6 @@ MovableModule {
   tileName: uiTr("Performance tile")
   NativeAcc.Group.name: tileName
 
-  readonly property double maxOnChart: {
-    // The maximum on the chart must be at least 1 so we can divide by it to
-    // scale the bars.  This works correctly if all bars have height 0; they use
-    // the 1-pixel minimum height.
-    var max = 1
-    for(var i=0; i<Daemon.state.intervalMeasurements.length; ++i)
-      max = Math.max(max, Daemon.state.intervalMeasurements[i].received)
-    return max
-  }
   readonly property int limitItems: 32
   readonly property int barWidth: 8
   // The last measurement from intervalMeasurements if any measurement is
@@ -58,7 +51,7 @@ MovableModule {
   }
 
   // Length of an interval in seconds
-  readonly property int intervalSec: 5
+  readonly property int intervalSec: Daemon.settings.bandwidthSampleInterval
 
   // Current timestamp, ticks on 1 second intervals while connected.  Uses the
   // same monotonic clock as Daemon.state.connectionTimestamp.
@@ -68,11 +61,12 @@ MovableModule {
   // ticks.  The actual duration is computed from the connection and current
   // timestamps, instead of explicitly ticking it 1 second every timer interval,
   // so it won't be affected by drift, missed timers due to system load, etc.
+  // The timer doesn't run while the client is idle, since nothing is shown.
   Timer {
     id: durationTimer
     interval: 1000
     repeat: true
-    running: Daemon.state.connectionTimestamp > 0
+    running: !Client.state.idle && Daemon.state.connectionTimestamp > 0
     onTriggered: currentTimestamp = NativeHelpers.getMonotonicTime()
     onRunningChanged: {
       // When the timer starts (due to the connection being established, or due
@@ -99,7 +93,7 @@ MovableModule {
   function formatMbps(val) {
     // val contains number of bytes, convert to number of bits
     val *= 8
-    // Intevals are 5 seconds long
+    // Convert to bits per second
     val /= intervalSec
 
     // Low values are rounded down to 0 Mbps. Show anything below 0.5 Mbps as kbps
@@ -179,9 +173,20 @@ MovableModule {
       }
     }
 
-    // The bars are laid out statically (they don't depend on the interval
+    // The bars are drawn natively; this covers the same area as barsList.
+    BandwidthChart {
+      anchors.fill: barsList
+      barCount: limitItems
+      barWidth: performanceModule.barWidth
+      highlightIndex: barsList.highlightBarIndex
+      barColor: Theme.dashboard.performanceChartBarInactive
+      highlightColor: Theme.dashboard.performanceChartBarActive
+    }
+
+    // The bar items are laid out statically (they don't depend on the interval
     // measurements model) so we don't get new cursor-enter events when the
-    // measurements change.
+    // measurements change.  They provide hover, keyboard, and screen reader
+    // interaction for the bars; BandwidthChart draws them.
     RowLayout {
       id: barsList
 
@@ -318,15 +323,6 @@ MovableModule {
               chartWrapper.forceActiveFocus(Qt.MouseFocusReason)
             }
           }
-          Rectangle {
-            color: index === barsList.highlightBarIndex ? Theme.dashboard.performanceChartBarActive : Theme.dashboard.performanceChartBarInactive
-            // Show at least 1 px for each bar
-            height: Math.max(1, parent.height * bytesReceived / maxOnChart)
-            width: barWidth / 2
-            x: barWidth / 4
-            y: parent.height - height
-            visible: hasMeasurement
-          }
         }
       }
     }
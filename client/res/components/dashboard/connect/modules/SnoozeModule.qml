@@ -18,6 +18,7 @@
 
 import QtQuick 2.9
 import QtQuick.Controls 2.3
+import "../../../client"
 import "../../../common"
 import "../../../core"
 import "../../../daemon"
@@ -107,8 +108,9 @@ MovableModule {
 
   Timer {
     id: remainingTimeCalculator
-    // Run timer only when in "snoozed" state and connection is down
-    running: connState.snoozeState === connState.snoozeDisconnected
+    // Run timer only when in "snoozed" state and connection is down, and the
+    // client isn't idle (nothing is shown while idle)
+    running: !Client.state.idle && connState.snoozeState === connState.snoozeDisconnected
     repeat: true
     interval: 1000
     function calculateRemainingTime () {
@@ -122,6 +124,11 @@ MovableModule {
     onTriggered: {
       calculateRemainingTime();
     }
+    // Catch up right away when resuming after being idle
+    onRunningChanged: {
+      if(running)
+        calculateRemainingTime();
+    }
   }
 
   readonly property int adjustButtonWidth: 30
@@ -70,6 +70,12 @@ QtObject {
 
   }
 
+  // The client becomes idle when none of its windows are visible
+  readonly property bool windowsVisible: (dashboard.window && dashboard.window.visible) ||
+                                         wSettings.visible || wDevTools.visible ||
+                                         wChangeLog.visible || wOnboarding.visible
+  onWindowsVisibleChanged: Client.setWindowsVisible(windowsVisible)
+
   property Connections showDashboardHandler: Connections {
     target: NativeHelpers
     onDashboardOpenRequested: dashboard.window.showDashboard(trayManager.getIconMetrics())
@@ -109,6 +115,7 @@ QtObject {
 
   Component.onCompleted: {
     TrayIcon.dashboard = dashboard.window
+    Client.setWindowsVisible(windowsVisible)
 
     if(!Client.state.quietLaunch && !Client.state.firstRunFlag) {
       // Not a quiet launch or first run - initially show the dashboard near the tray icon
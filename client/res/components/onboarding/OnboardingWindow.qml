@@ -31,6 +31,7 @@ SecondaryWindow {
   title: uiTr("Quick Tour")
 
   function showOnboarding () {
+    pageLoader.active = true
     onboardingWindow.open();
   }
 
@@ -41,9 +42,16 @@ SecondaryWindow {
 
   visible: false
 
-  PageController {
-      id: pageController
-      width: contentLogicalWidth
-      height: contentLogicalHeight
+  // The tour is rarely shown, so its pages aren't created until it's opened
+  Loader {
+    id: pageLoader
+    active: false
+    width: contentLogicalWidth
+    height: contentLogicalHeight
+    sourceComponent: Component {
+      PageController {
+        id: pageController
+      }
+    }
   }
 }
@@ -109,7 +109,9 @@ SecondaryWindow {
     },
     {
       name: 'help',
-      component: "HelpPage.qml"
+      component: "HelpPage.qml",
+      // Handles reinstall notifications, so it must exist even when hidden
+      eager: true
     }
   ]
 
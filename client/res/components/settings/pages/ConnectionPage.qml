@@ -150,6 +150,38 @@ Page {
         //: is if you have trouble connecting.
         info: uiTr("Determines how addresses are configured on the TAP adapter.  If you have trouble connecting, a different method may be more reliable.")
       }
+
+      DropdownInput {
+        label: uiTr("Network Driver")
+        visible: Qt.platform.os === 'windows'
+        setting: DaemonSetting { name: "windowsDriver" }
+        model: [
+          //: "TAP" is the name of the TAP-Windows network adapter driver.
+          //: This probably is not translated for most languages.
+          { name: uiTr("TAP"), value: "tap" },
+          //: "WinTUN" is the name of a network adapter driver.  This
+          //: probably is not translated for most languages.
+          { name: uiTr("WinTUN"), value: "wintun" }
+        ]
+        //: Description of the network driver choices for Windows.
+        info: uiTr("WinTUN can be much faster than TAP, but requires a WinTUN adapter to be installed.  If none is found, TAP is used.")
+      }
+
+      DropdownInput {
+        label: uiTr("Data Channel")
+        visible: Qt.platform.os === 'linux'
+        setting: DaemonSetting { name: "linuxDataChannel" }
+        model: [
+          //: The data channel (packet encryption) runs in the OpenVPN
+          //: process.
+          { name: uiTr("OpenVPN Process"), value: "userspace" },
+          //: The data channel runs in the kernel using the ovpn-dco module
+          //: ("data channel offload").
+          { name: uiTr("Kernel (DCO)"), value: "dco" }
+        ]
+        //: Description of the data channel choices for Linux.
+        info: uiTr("Running the data channel in the kernel can be much faster, but requires the ovpn-dco kernel module.  If it is not available, the OpenVPN process is used.")
+      }
     }
 
     ColumnLayout {
@@ -160,6 +192,9 @@ Page {
         label: uiTr("Data Encryption")
         setting: DaemonSetting { name: "cipher" }
         model: [
+          //: Automatic cipher choice - the fastest cipher on this computer
+          //: is used.
+          { name: uiTr("Automatic"), value: "auto" },
           { name: "AES-128 (GCM)", value: "AES-128-GCM" },
           { name: "AES-128 (CBC)", value: "AES-128-CBC" },
           { name: "AES-256 (GCM)", value: "AES-256-GCM" },
@@ -244,6 +279,14 @@ Page {
         }
       }
 
+      CheckboxInput {
+        label: uiTr("Fail Over to Standby Region")
+        setting: DaemonSetting { name: "standbyFailover" }
+        //: Tip for the standby failover setting.  This only applies when the
+        //: region is set to "Auto".
+        info: uiTr("When connected to an automatic region, switch to the next-best region right away if the connection to the server is lost.")
+      }
+
       Item {
         Layout.fillHeight: true // spacer
       }
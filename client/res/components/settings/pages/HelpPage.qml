@@ -166,6 +166,12 @@ Page {
       }
     }
 
+    CheckboxInput {
+      label: uiTr("Download Updates in Background")
+      info: uiTr("Download new versions in the background so they're ready to install.")
+      setting: DaemonSetting { name: "backgroundUpdateDownload" }
+    }
+
 
     // Spacer between groups
     Item {
@@ -216,9 +216,7 @@ Page {
         id: shadowsocksRegionList
         width: parent.width
         implicitHeight: 300
-        regionFilter: function(serverLocation) {
-          return !!serverLocation.shadowsocks
-        }
+        service: "shadowsocks"
         // Don't use shadowsocksLocations directly since the chosen location
         // isn't applied until the user clicks OK
         property var chosenLocation // assigned in updateAndOpen() or onRegionSelected()
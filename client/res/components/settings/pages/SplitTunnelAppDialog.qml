@@ -84,8 +84,33 @@ OverlayDialog {
     })
   }
   property int browseAppSelectedIndex: -1
+  // The path of the selected app - the app list can be updated while the
+  // dialog is open (partial scan results are replaced by the complete
+  // results), so this keeps the same app selected.
+  property string browseAppSelectedPath
+  onBrowseAppSelectedIndexChanged: {
+    if(browseAppSelectedIndex >= 0 && browseAppSelectedIndex < scannedApplications.length)
+      browseAppSelectedPath = scannedApplications[browseAppSelectedIndex].path
+    else
+      browseAppSelectedPath = ""
+  }
+  onScannedApplicationsChanged: {
+    var newIndex = -1
+    if(browseAppSelectedPath) {
+      for(var i=0; i<scannedApplications.length; ++i) {
+        if(scannedApplications[i].path === browseAppSelectedPath) {
+          newIndex = i
+          break
+        }
+      }
+    }
+    browseAppSelectedIndex = newIndex
+  }
 
   readonly property bool applicationScanRunning: SplitTunnelManager.scanActive
+  // Partial results are shown while the scan is still running, the spinner
+  // is only shown until some apps are found
+  readonly property bool showScanSpinner: applicationScanRunning && scannedApplications.length === 0
   readonly property var webkitApps: [
         "/Applications/Safari.app",
         "/Applications/Mail.app",
@@ -103,14 +128,13 @@ OverlayDialog {
       }
       return;
     }
-    var rules= JSON.parse(JSON.stringify(Daemon.settings.splitTunnelRules))
+    var rules = Daemon.settings.splitTunnelRules
 
     // Check if the app that was added is a webkit app
     if(webkitApps.indexOf(path) >= 0) {
       // If a rule listing for webkit apps is not already available, then add it
       if(rules.findIndex(item => {return item.path === SplitTunnelManager.macWebkitFrameworkPath}) === -1) {
-        rules.push({path: SplitTunnelManager.macWebkitFrameworkPath, mode: "exclude", linkTarget: ""});
-        Daemon.applySettings({splitTunnelRules: rules});
+        Daemon.updateSplitTunnelRules([{path: SplitTunnelManager.macWebkitFrameworkPath, mode: "exclude", linkTarget: ""}]);
         return;
       }
     } else {
@@ -128,8 +152,7 @@ OverlayDialog {
         mode: "exclude"
       };
 
-      rules.push(rule);
-      Daemon.applySettings({splitTunnelRules: rules});
+      Daemon.updateSplitTunnelRules([rule]);
     }
 
   }
@@ -257,7 +280,7 @@ OverlayDialog {
         // Loading indicator
         Item {
           anchors.fill: parent
-          visible: applicationScanRunning
+          visible: showScanSpinner
 
           Image {
             id: spinnerImage
@@ -268,7 +291,7 @@ OverlayDialog {
 
             RotationAnimator {
               target: spinnerImage
-              running: applicationScanRunning
+              running: showScanSpinner
               from: 0;
               to: 360;
               duration: 1000
@@ -279,7 +302,7 @@ OverlayDialog {
 
         ThemedScrollView {
           id: scannedAppScrollView
-          visible: !applicationScanRunning
+          visible: !showScanSpinner
           ScrollBar.vertical.policy: ScrollBar.AlwaysOn
           label: uiTr("Applications")
           anchors.fill: parent
@@ -50,21 +50,17 @@ SplitTunnelRowBase {
   property int highlightColumn: -1
 
   function removeFromSplitTunnelRules() {
-    var updatedRules = Daemon.settings.splitTunnelRules.filter(function(rule) {
-      return rule.path !== appPath
-    })
-
-    Daemon.applySettings({splitTunnelRules: updatedRules});
+    Daemon.updateSplitTunnelRules([], [appPath]);
   }
 
   function changeSplitTunnelMode(newMode) {
-    var updatedRules = JSON.parse(JSON.stringify(Daemon.settings.splitTunnelRules));
-    var appRule = updatedRules.find(rule => rule.path === appPath);
-    appRule.mode = newMode;
-
-    console.log(JSON.stringify(updatedRules));
+    var appRule = Daemon.settings.splitTunnelRules.find(rule => rule.path === appPath);
+    if(!appRule)
+      return;
+    var updatedRule = JSON.parse(JSON.stringify(appRule));
+    updatedRule.mode = newMode;
 
-    Daemon.applySettings({splitTunnelRules: updatedRules});
+    Daemon.updateSplitTunnelRules([updatedRule]);
   }
 
   function keyboardShowModePopup() {
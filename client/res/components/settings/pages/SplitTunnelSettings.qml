@@ -105,12 +105,28 @@ Rectangle {
         Repeater {
           id: appRuleRepeater
           model: Daemon.settings.splitTunnelRules
+          // App names are read asynchronously; request them whenever the
+          // rules change.
+          function inspectRules() {
+            SplitTunnelManager.inspectApps(Daemon.settings.splitTunnelRules.map(function(rule) {
+              return rule.path
+            }))
+          }
+          onModelChanged: inspectRules()
+          Component.onCompleted: inspectRules()
           delegate: SplitTunnelAppRow {
             Layout.fillWidth: true
             showAppIcons: Qt.platform.os !== 'linux'
             appPath: modelData.path
             appMode: modelData.mode
-            appName: SplitTunnelManager.getNameFromPath(appPath)
+            // Show the file name until the app has been inspected
+            appName: {
+              var info = SplitTunnelManager.appInfo[appPath]
+              if(info)
+                return info.name
+              var parts = appPath.split(/[\\/]/)
+              return parts[parts.length-1]
+            }
 
             highlightColumn: {
               // If the highlighted row is this row, apply the highlight
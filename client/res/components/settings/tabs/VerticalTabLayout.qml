@@ -21,6 +21,7 @@ import QtQuick.Controls 2.3
 import QtQuick.Layouts 1.3
 import QtQuick.Window 2.10
 import "../pages"
+import "../../client"
 import "../../theme"
 import "../../common"
 import "../../core"
@@ -188,17 +189,46 @@ FocusScope {
           model: pages
           delegate: Component {
             Loader {
+              // Pages are created the first time they're shown, which keeps
+              // them out of client startup.  Pages marked 'eager' are created
+              // immediately since they handle notifications while hidden.
+              property bool shown: false
+              active: !!modelData.eager || shown
               source: "../pages/" + modelData.component
               width: parent.width
               height: parent.height
             }
           }
+          onItemAdded: {
+            if(index === stack.currentIndex)
+              item.shown = true
+          }
+          // In background mode, unload the pages that were shown (they're
+          // recreated when shown again).  The current page is reloaded as
+          // soon as the client leaves background mode, so it's ready when the
+          // window is shown.
+          property Connections backgroundHandler: Connections {
+            target: Client.state
+            onBackgroundChanged: {
+              for(var i = 0; i < pageContentRepeater.count; ++i) {
+                var page = pageContentRepeater.itemAt(i)
+                if(page)
+                  page.shown = !Client.state.background && i === stack.currentIndex
+              }
+            }
+          }
           Layout.fillWidth: true
           Layout.fillHeight: true
         }
         // When the current index changes, focus the new page to ensure that the
         // old page loses focus
-        onCurrentIndexChanged: pageContentRepeater.itemAt(currentIndex).focus = true
+        onCurrentIndexChanged: {
+          var page = pageContentRepeater.itemAt(currentIndex)
+          if(page) {
+            page.shown = true
+            page.focus = true
+          }
+        }
       }
     }
   }
@@ -0,0 +1,199 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("appiconcache.cpp")
+
+#include "appiconcache.h"
+#include "path.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QUrl>
+
+#if defined(Q_OS_WIN)
+#include "win/win_com.h"
+#endif
+
+namespace
+{
+    // Size limit of the memory cache.  The app list shows icons for a few
+    // hundred apps at most, this is much larger than their scaled icons.
+    const int memoryCacheKiB{32 * 1024};
+    // If the disk cache has more files than this, it's cleared.  Old entries
+    // aren't otherwise removed when apps are updated.
+    const int diskCacheMaxFiles{4000};
+}
+
+// Response for an icon request.  The worker thread can't refer to the response
+// directly, since QML may destroy it if the request is canceled.  Instead, they
+// share a Pending object, which the response clears when it's destroyed.
+class CachedAppIconProvider::Response : public QQuickImageResponse
+{
+public:
+    struct Pending
+    {
+        QMutex _mutex;
+        Response *_pResponse;
+    };
+
+public:
+    Response() : _pPending{std::make_shared<Pending>()}
+    {
+        _pPending->_pResponse = this;
+    }
+    ~Response() override
+    {
+        QMutexLocker lock{&_pPending->_mutex};
+        _pPending->_pResponse = nullptr;
+    }
+
+public:
+    const std::shared_ptr<Pending> &pending() const {return _pPending;}
+
+    // Complete the response with the loaded image (on the response's thread)
+    void complete(QImage image)
+    {
+        _image = std::move(image);
+        emit finished();
+    }
+
+    QQuickTextureFactory *textureFactory() const override
+    {
+        return QQuickTextureFactory::textureFactoryForImage(_image);
+    }
+
+private:
+    std::shared_ptr<Pending> _pPending;
+    QImage _image;
+};
+
+CachedAppIconProvider::CachedAppIconProvider(std::unique_ptr<QQuickImageProvider> pSource)
+    : _pSource{std::move(pSource)}
+{
+    Q_ASSERT(_pSource); // Ensured by caller
+    _memoryCache.setMaxCost(memoryCacheKiB);
+
+    // This is queued before any icon requests, so it occurs before any icons
+    // are loaded.
+    _workerThread.queueOnThread([this]()
+    {
+#if defined(Q_OS_WIN)
+        // The Windows icon provider uses shell COM objects to read links.
+        // COM initializer is parented to the worker thread's object owner so
+        // it's destroyed before the thread terminates.
+        new WinComInit{&_workerThread.objectOwner()};
+#endif
+        pruneDiskCache();
+    });
+}
+
+QString CachedAppIconProvider::cacheKey(const QString &path,
+                                        const QSize &requestedSize) const
+{
+    // Paths that aren't files (such as UWP app families) just have a 0 size
+    // and modification time
+    QFileInfo info{path};
+    qint64 mtime = info.exists() ? info.lastModified().toMSecsSinceEpoch() : 0;
+    return QStringLiteral("%1|%2|%3|%4x%5").arg(path).arg(mtime)
+        .arg(info.size()).arg(requestedSize.width()).arg(requestedSize.height());
+}
+
+QString CachedAppIconProvider::diskCachePath(const QString &key) const
+{
+    QByteArray keyHash = QCryptographicHash::hash(key.toUtf8(),
+                                                  QCryptographicHash::Sha1);
+    return Path::ClientDataDir / "iconcache" / QString::fromLatin1(keyHash.toHex() + ".png");
+}
+
+void CachedAppIconProvider::pruneDiskCache()
+{
+    QDir cacheDir{Path::ClientDataDir / "iconcache"};
+    if(cacheDir.exists() && cacheDir.count() > diskCacheMaxFiles)
+    {
+        qInfo() << "Clearing icon cache with" << cacheDir.count() << "entries";
+        cacheDir.removeRecursively();
+    }
+    if(!cacheDir.mkpath(QStringLiteral(".")))
+        qWarning() << "Unable to create icon cache directory" << cacheDir.path();
+}
+
+QImage CachedAppIconProvider::loadIcon(const QString &id, const QSize &requestedSize)
+{
+    // Qt doesn't decode the id after extracting it from the URI.  (The source
+    // provider is given the original id, it decodes it itself.)
+    QString key = cacheKey(QUrl::fromPercentEncoding(id.toUtf8()), requestedSize);
+
+    if(const QImage *pCached = _memoryCache.object(key))
+        return *pCached;
+
+    QImage image;
+    QString diskPath = diskCachePath(key);
+    if(!image.load(diskPath, "PNG"))
+    {
+        QSize size;
+        image = _pSource->requestPixmap(id, &size, requestedSize).toImage();
+        // Don't cache failures, the source may be able to load the icon later
+        if(!image.isNull() && !image.save(diskPath, "PNG"))
+            qWarning() << "Unable to write icon cache file for" << key;
+    }
+
+    if(!image.isNull())
+    {
+        int cost = std::max(1, static_cast<int>(image.sizeInBytes() / 1024));
+        _memoryCache.insert(key, new QImage{image}, cost);
+    }
+    return image;
+}
+
+QQuickImageResponse *CachedAppIconProvider::requestImageResponse(const QString &id,
+                                                                 const QSize &requestedSize)
+{
+    Response *pResponse = new Response{};
+    std::shared_ptr<Response::Pending> pPending = pResponse->pending();
+
+    _workerThread.queueOnThread([this, id, requestedSize, pPending]()
+    {
+        // If the response was already destroyed, don't bother loading it
+        {
+            QMutexLocker lock{&pPending->_mutex};
+            if(!pPending->_pResponse)
+                return;
+        }
+
+        QImage image{loadIcon(id, requestedSize)};
+
+        // Queue the result to the response's thread.  The lock ensures the
+        // response isn't destroyed while queuing; if it's destroyed afterward,
+        // Qt discards the queued call.
+        QMutexLocker lock{&pPending->_mutex};
+        Response *pResponse = pPending->_pResponse;
+        if(pResponse)
+        {
+            QMetaObject::invokeMethod(pResponse,
+                [pResponse, image = std::move(image)]() mutable
+                {
+                    pResponse->complete(std::move(image));
+                }, Qt::ConnectionType::QueuedConnection);
+        }
+    });
+
+    return pResponse;
+}
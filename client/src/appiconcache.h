@@ -0,0 +1,73 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("appiconcache.h")
+
+#ifndef APPICONCACHE_H
+#define APPICONCACHE_H
+
+#include "thread.h"
+#include <QQuickAsyncImageProvider>
+#include <QCache>
+#include <QImage>
+#include <memory>
+
+// CachedAppIconProvider wraps a platform app icon provider (see
+// SplitTunnelManager::installImageHandler()) with a memory cache and a disk
+// cache of the scaled icons.
+//
+// Icons are loaded asynchronously on a worker thread, so the app list can be
+// created and scrolled without waiting for icon extraction.  The platform
+// provider is only used from that thread.
+//
+// Cache entries are keyed by the app path, the size and modification time of
+// that file (if it's a file), and the requested icon size, so icons are
+// reloaded if the app is updated.
+class CachedAppIconProvider : public QQuickAsyncImageProvider
+{
+public:
+    class Response;
+
+public:
+    explicit CachedAppIconProvider(std::unique_ptr<QQuickImageProvider> pSource);
+
+private:
+    QString cacheKey(const QString &path, const QSize &requestedSize) const;
+    QString diskCachePath(const QString &key) const;
+    // Remove the disk cache if it has grown too large (on the worker thread)
+    void pruneDiskCache();
+    // Load an icon (on the worker thread)
+    QImage loadIcon(const QString &id, const QSize &requestedSize);
+
+public:
+    QQuickImageResponse *requestImageResponse(const QString &id,
+                                              const QSize &requestedSize) override;
+
+private:
+    // The platform icon provider
+    std::unique_ptr<QQuickImageProvider> _pSource;
+    // Memory cache of loaded icons, used only on the worker thread.  Costs are
+    // in KiB.
+    QCache<QString, QImage> _memoryCache;
+    // Icons are loaded on this thread.  This is last so the thread is stopped
+    // before the other members are destroyed.
+    RunningWorkerThread _workerThread;
+};
+
+#endif
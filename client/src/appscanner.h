@@ -37,7 +37,14 @@ public:
     virtual void scanApplications () = 0;
 
 signals:
+    // Partial results are available - the applications found so far.  This
+    // may be emitted any number of times before applicationScanComplete(), so
+    // the app list can be shown while the rest of the scan finishes.
+    void applicationScanProgress(const QJsonArray &applications);
     void applicationScanComplete(const QJsonArray &applications);
+    // The installed applications may have changed since the last scan (on
+    // platforms that can detect it).  Another scan will pick up the changes.
+    void applicationsChanged();
 };
 
 class DummyAppIconProvider: public QQuickImageProvider
@@ -22,10 +22,52 @@
 #include "balancetext.h"
 #include <QTextLayout>
 #include <QGuiApplication>
+#include <QCache>
 #include <cmath>
 
 namespace BalanceText {
 
+namespace
+{
+    // Key for cached balanced widths.  The font is identified by its key
+    // (which includes the pixel size), since the application font could change
+    // at runtime.  The width is bucketed to whole pixels - the result is only
+    // accurate to ~2 px anyway, and sizes computed by QML layouts often differ
+    // by tiny fractions.
+    struct BalanceCacheKey
+    {
+        QString text;
+        QString fontKey;
+        int widthBucket;
+
+        bool operator==(const BalanceCacheKey &other) const
+        {
+            return widthBucket == other.widthBucket &&
+                text == other.text && fontKey == other.fontKey;
+        }
+    };
+
+    uint qHash(const BalanceCacheKey &key, uint seed = 0)
+    {
+        seed = ::qHash(key.text, seed);
+        seed = ::qHash(key.fontKey, seed);
+        return ::qHash(key.widthBucket, seed);
+    }
+
+    // Maximum number of balanced widths retained.  There are only a few dozen
+    // texts that are balanced, but each can be measured in several languages
+    // and widths.
+    const int balanceCacheSize = 256;
+
+    // Balanced widths computed so far, shared by all callers.  This is only
+    // used from the GUI thread (QTextLayout requires a GUI application anyway).
+    QCache<BalanceCacheKey, double> &balanceCache()
+    {
+        static QCache<BalanceCacheKey, double> cache{balanceCacheSize};
+        return cache;
+    }
+}
+
 // Compute the underhang cost for a line pair.  Compares the lines' lengths and
 // applies either the underhang or overhang factor as appropriate.
 //
@@ -198,11 +240,9 @@ double reduceUnderhang(double minWidth, double maxWidth, QTextLayout &layout)
     return minWidth;
 }
 
-double balanceWrappedText(double maxWidth, int fontPixelSize,
-                          const QString &text)
+double balanceWrappedTextUncached(double maxWidth, const QFont &font,
+                                  const QString &text)
 {
-    QFont font = QGuiApplication::font();
-    font.setPixelSize(fontPixelSize);
     QTextLayout layout{text, font};
 
     // Get the minimum text height (at the maximum width)
@@ -312,4 +352,23 @@ double balanceWrappedText(double maxWidth, int fontPixelSize,
     return balancedWidth;
 }
 
+double balanceWrappedText(double maxWidth, int fontPixelSize,
+                          const QString &text)
+{
+    QFont font = QGuiApplication::font();
+    font.setPixelSize(fontPixelSize);
+
+    // Measure at the bucketed width, so the result depends only on the key.
+    int widthBucket = static_cast<int>(std::floor(maxWidth));
+    BalanceCacheKey key{text, font.key(), widthBucket};
+
+    auto &cache = balanceCache();
+    if(double *pCachedWidth = cache.object(key))
+        return *pCachedWidth;
+
+    double balancedWidth = balanceWrappedTextUncached(widthBucket, font, text);
+    cache.insert(key, new double{balancedWidth});
+    return balancedWidth;
+}
+
 }
@@ -56,7 +56,9 @@ namespace BalanceText {
 // This computation typically takes around 20-50 ms (roughly measured on a
 // Win 10 VM).  This is fast enough for InfoTip to do the computation just
 // before it's shown, but slow enough that it shouldn't be recomputed and
-// stored all the time for InfoTips that aren't visible.
+// stored all the time for InfoTips that aren't visible.  Results are cached
+// (by text, font, and whole-pixel maxWidth), so showing the same tip again is
+// cheap.  This must only be called on the GUI thread.
 //
 // Note that the measured result could vary by platform, as different platforms
 // have different default hinting modes (the text appearance really does vary
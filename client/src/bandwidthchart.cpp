@@ -0,0 +1,223 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("bandwidthchart.cpp")
+
+#include "bandwidthchart.h"
+#include "client.h"
+#include <QSGGeometryNode>
+#include <QSGVertexColorMaterial>
+#include <algorithm>
+
+namespace
+{
+    const int defaultBarCount{32};
+
+    // Build a premultiplied vertex color, as QSGVertexColorMaterial expects
+    QSGGeometry::ColoredPoint2D coloredPoint(float x, float y, const QColor &color)
+    {
+        QSGGeometry::ColoredPoint2D point;
+        int alpha = color.alpha();
+        point.set(x, y, static_cast<uchar>(color.red() * alpha / 255),
+                  static_cast<uchar>(color.green() * alpha / 255),
+                  static_cast<uchar>(color.blue() * alpha / 255),
+                  static_cast<uchar>(alpha));
+        return point;
+    }
+}
+
+BandwidthChart::BandwidthChart()
+    : _samples(defaultBarCount), _sampleStart{0}, _sampleCount{0},
+      _barWidth{8.0}, _highlightIndex{-1}
+{
+    setFlag(QQuickItem::ItemHasContents);
+    connect(&g_daemonState, &DaemonState::intervalMeasurementsChanged, this,
+            &BandwidthChart::onMeasurementsChanged);
+    _lastMeasurements = g_daemonState.intervalMeasurements();
+    resetSamples(_lastMeasurements);
+}
+
+void BandwidthChart::onMeasurementsChanged()
+{
+    const auto &measurements = g_daemonState.intervalMeasurements();
+    int newSize = measurements.size();
+    int lastSize = _lastMeasurements.size();
+
+    // If the previous measurements are a prefix of the new ones (with one new
+    // sample), or the new measurements dropped the oldest sample and added
+    // one, just append the new sample.
+    int dropped = -1;
+    if(newSize == lastSize + 1)
+        dropped = 0;
+    else if(newSize == lastSize && newSize > 0)
+        dropped = 1;
+
+    if(dropped >= 0 &&
+       std::equal(_lastMeasurements.begin() + dropped, _lastMeasurements.end(),
+                  measurements.begin()))
+    {
+        appendSample(measurements.last().received());
+    }
+    else
+        resetSamples(measurements);
+
+    _lastMeasurements = measurements;
+    update();
+}
+
+void BandwidthChart::resetSamples(const QList<IntervalBandwidth> &measurements)
+{
+    _sampleStart = 0;
+    _sampleCount = 0;
+    int first = std::max(0, measurements.size() - _samples.size());
+    for(int i = first; i < measurements.size(); ++i)
+        appendSample(measurements[i].received());
+}
+
+void BandwidthChart::appendSample(quint64 received)
+{
+    if(_samples.isEmpty())
+        return;
+
+    if(_sampleCount == _samples.size())
+    {
+        // Full - replace the oldest sample
+        _samples[_sampleStart] = received;
+        _sampleStart = (_sampleStart + 1) % _samples.size();
+    }
+    else
+    {
+        _samples[(_sampleStart + _sampleCount) % _samples.size()] = received;
+        ++_sampleCount;
+    }
+}
+
+quint64 BandwidthChart::sampleAt(int age) const
+{
+    Q_ASSERT(age >= 0 && age < _sampleCount);
+    return _samples[(_sampleStart + _sampleCount - 1 - age) % _samples.size()];
+}
+
+void BandwidthChart::geometryChanged(const QRectF &newGeometry,
+                                     const QRectF &oldGeometry)
+{
+    QQuickItem::geometryChanged(newGeometry, oldGeometry);
+    if(newGeometry.size() != oldGeometry.size())
+        update();
+}
+
+QSGNode *BandwidthChart::updatePaintNode(QSGNode *pOldNode,
+                                         UpdatePaintNodeData *)
+{
+    auto pNode = static_cast<QSGGeometryNode*>(pOldNode);
+    if(!pNode)
+    {
+        pNode = new QSGGeometryNode{};
+        auto pGeometry = new QSGGeometry{QSGGeometry::defaultAttributes_ColoredPoint2D(), 0};
+        pGeometry->setDrawingMode(QSGGeometry::DrawTriangles);
+        pNode->setGeometry(pGeometry);
+        pNode->setFlag(QSGNode::OwnsGeometry);
+        pNode->setMaterial(new QSGVertexColorMaterial{});
+        pNode->setFlag(QSGNode::OwnsMaterial);
+    }
+
+    // The maximum on the chart must be at least 1 so we can divide by it to
+    // scale the bars.  This works correctly if all bars have height 0; they use
+    // the 1-pixel minimum height.
+    quint64 maxOnChart{1};
+    for(int i = 0; i < _sampleCount; ++i)
+        maxOnChart = std::max(maxOnChart, sampleAt(i));
+
+    // Two triangles per bar
+    QSGGeometry *pGeometry = pNode->geometry();
+    if(pGeometry->vertexCount() != _sampleCount * 6)
+        pGeometry->allocate(_sampleCount * 6);
+    QSGGeometry::ColoredPoint2D *pVertices = pGeometry->vertexDataAsColoredPoint2D();
+
+    float chartWidth = static_cast<float>(width());
+    float chartHeight = static_cast<float>(height());
+    float slotWidth = static_cast<float>(_barWidth);
+    for(int i = 0; i < _sampleCount; ++i)
+    {
+        // Show at least 1 px for each bar
+        float barHeight = std::max(1.0f, chartHeight * sampleAt(i) / maxOnChart);
+        float left = chartWidth - (i + 1) * slotWidth + slotWidth / 4;
+        float right = left + slotWidth / 2;
+        float top = chartHeight - barHeight;
+        const QColor &color = (i == _highlightIndex) ? _highlightColor : _barColor;
+
+        QSGGeometry::ColoredPoint2D *pBar = pVertices + i * 6;
+        pBar[0] = coloredPoint(left, top, color);
+        pBar[1] = coloredPoint(right, top, color);
+        pBar[2] = coloredPoint(left, chartHeight, color);
+        pBar[3] = pBar[1];
+        pBar[4] = coloredPoint(right, chartHeight, color);
+        pBar[5] = pBar[2];
+    }
+    pNode->markDirty(QSGNode::DirtyGeometry);
+
+    return pNode;
+}
+
+void BandwidthChart::setBarCount(int barCount)
+{
+    barCount = std::max(0, barCount);
+    if(barCount == _samples.size())
+        return;
+
+    _samples.resize(barCount);
+    resetSamples(_lastMeasurements);
+    emit barCountChanged();
+    update();
+}
+
+void BandwidthChart::setBarWidth(double barWidth)
+{
+    if(barWidth == _barWidth)
+        return;
+    _barWidth = barWidth;
+    emit barWidthChanged();
+    update();
+}
+
+void BandwidthChart::setHighlightIndex(int highlightIndex)
+{
+    if(highlightIndex == _highlightIndex)
+        return;
+    _highlightIndex = highlightIndex;
+    emit highlightIndexChanged();
+    update();
+}
+
+void BandwidthChart::setBarColor(const QColor &barColor)
+{
+    if(barColor == _barColor)
+        return;
+    _barColor = barColor;
+    emit barColorChanged();
+    update();
+}
+
+void BandwidthChart::setHighlightColor(const QColor &highlightColor)
+{
+    if(highlightColor == _highlightColor)
+        return;
+    _highlightColor = highlightColor;
+    emit highlightColorChanged();
+    update();
+}
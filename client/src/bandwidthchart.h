@@ -0,0 +1,105 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("bandwidthchart.h")
+
+#ifndef BANDWIDTHCHART_H
+#define BANDWIDTHCHART_H
+
+#include "settings.h"
+#include <QQuickItem>
+#include <QColor>
+#include <QVector>
+
+// BandwidthChart draws the bars of the performance chart with a single
+// scene graph geometry node, instead of creating a QML Rectangle per bar.
+//
+// It observes DaemonState::intervalMeasurements() directly.  The daemon sends
+// the whole list each interval, but it's usually the previous list with one
+// new sample (and possibly the oldest sample dropped), so BandwidthChart
+// detects that and appends the new sample to its ring buffer.  The geometry
+// is only rebuilt when a sample arrives or the item is resized, never per
+// frame.
+//
+// The bars are laid out right-to-left - index 0 is the newest sample at the
+// right edge, like the bar items in PerformanceModule.  Each bar occupies
+// barWidth, and is drawn half that width in the center of its slot.
+class BandwidthChart : public QQuickItem
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("bandwidthchart")
+
+public:
+    // Number of bars shown - the most recent samples are kept
+    Q_PROPERTY(int barCount READ barCount WRITE setBarCount NOTIFY barCountChanged)
+    // Width of each bar's slot
+    Q_PROPERTY(double barWidth READ barWidth WRITE setBarWidth NOTIFY barWidthChanged)
+    // Index of the highlighted bar (0 is the newest), or -1 for none
+    Q_PROPERTY(int highlightIndex READ highlightIndex WRITE setHighlightIndex NOTIFY highlightIndexChanged)
+    Q_PROPERTY(QColor barColor READ barColor WRITE setBarColor NOTIFY barColorChanged)
+    Q_PROPERTY(QColor highlightColor READ highlightColor WRITE setHighlightColor NOTIFY highlightColorChanged)
+
+public:
+    BandwidthChart();
+
+signals:
+    void barCountChanged();
+    void barWidthChanged();
+    void highlightIndexChanged();
+    void barColorChanged();
+    void highlightColorChanged();
+
+private:
+    void onMeasurementsChanged();
+    // Reset the ring buffer to the last barCount samples from measurements
+    void resetSamples(const QList<IntervalBandwidth> &measurements);
+    void appendSample(quint64 received);
+    // Get a sample by age - 0 is the newest sample
+    quint64 sampleAt(int age) const;
+
+    virtual void geometryChanged(const QRectF &newGeometry,
+                                 const QRectF &oldGeometry) override;
+    virtual QSGNode *updatePaintNode(QSGNode *pOldNode,
+                                     UpdatePaintNodeData *) override;
+
+public:
+    int barCount() const {return _samples.size();}
+    void setBarCount(int barCount);
+    double barWidth() const {return _barWidth;}
+    void setBarWidth(double barWidth);
+    int highlightIndex() const {return _highlightIndex;}
+    void setHighlightIndex(int highlightIndex);
+    const QColor &barColor() const {return _barColor;}
+    void setBarColor(const QColor &barColor);
+    const QColor &highlightColor() const {return _highlightColor;}
+    void setHighlightColor(const QColor &highlightColor);
+
+private:
+    // Ring buffer of received byte counts.  The size is barCount; _sampleStart
+    // is the index of the oldest sample and _sampleCount is the number of
+    // valid samples.
+    QVector<quint64> _samples;
+    int _sampleStart, _sampleCount;
+    // The last measurements observed - used to detect appended samples
+    QList<IntervalBandwidth> _lastMeasurements;
+    double _barWidth;
+    int _highlightIndex;
+    QColor _barColor, _highlightColor;
+};
+
+#endif
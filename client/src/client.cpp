@@ -24,6 +24,7 @@
 #include "path.h"
 #include "trayiconmanager.h"
 #include "nativehelpers.h"
+#include "bandwidthchart.h"
 #include "circlemousearea.h"
 #include "draghandle.h"
 #include "focuscue.h"
@@ -39,6 +40,9 @@
 #include "brand.h"
 #include "nativeacc/nativeacc.h"
 #include "splittunnelmanager.h"
+#include "regionmodel.h"
+#include "startuptrace.h"
+#include "tracing.h"
 
 #if defined(Q_OS_MACOS)
 #include "mac/mac_loginitem.h"
@@ -59,9 +63,13 @@
 #include <QFile>
 #include <QFont>
 #include <QFontDatabase>
+#include <QPixmapCache>
 #include <QPointer>
 #include <QProcess>
 #include <QQmlContext>
+#include <QQuickWindow>
+#include <QResource>
+#include <QSet>
 #include <QTimer>
 #include <QtGlobal>
 
@@ -130,6 +138,57 @@ bool ClientTranslator::load(const QLocale &locale)
                              QStringLiteral(":/translations"));
 }
 
+namespace
+{
+    // Time that all windows must be hidden before the client becomes idle.
+    // This avoids churning subscriptions when the dashboard is just briefly
+    // hidden.
+    const std::chrono::seconds idleDelay{10};
+
+    // Time that the client must be idle before it enters background mode and
+    // releases memory.  Reloading the settings pages takes a moment, so this
+    // is much longer than idleDelay.
+    const std::chrono::minutes backgroundDelay{2};
+    // Time to wait after entering background mode before releasing the QML
+    // caches, so the unloaded pages have been destroyed first
+    const std::chrono::seconds resourceReleaseDelay{1};
+
+    // Time to wait for more settings changes before writing
+    // clientsettings.json.
+    const std::chrono::seconds settingsWriteDelay{1};
+
+    // Daemon properties that the client doesn't receive while idle.  These
+    // change frequently while connected and are only displayed in windows -
+    // the tray icon, tray menu and notifications don't use them.
+    const QHash<QString, QSet<QString>> &idleExcludedProperties()
+    {
+        static const QHash<QString, QSet<QString>> excluded
+        {
+            {QStringLiteral("state"), {QStringLiteral("bytesReceived"),
+                                       QStringLiteral("bytesSent"),
+                                       QStringLiteral("intervalMeasurements"),
+                                       QStringLiteral("shadowsocksLocations")}}
+        };
+        return excluded;
+    }
+
+    // Add the properties of a daemon object to an idle subscription
+    void addIdleSubscription(QJsonObject &subscriptions, const QString &objectName,
+                             const NativeJsonObject &object)
+    {
+        const auto &excluded = idleExcludedProperties().value(objectName);
+        QJsonArray properties;
+        auto m = object.metaObject();
+        for(int i = m->propertyOffset(), c = m->propertyCount(); i < c; ++i)
+        {
+            QString property = QLatin1String(m->property(i).name());
+            if(!excluded.contains(property))
+                properties.push_back(property);
+        }
+        subscriptions.insert(objectName, properties);
+    }
+}
+
 const QString ClientInterface::_pseudotranslationLocale{QStringLiteral("ro")};
 const QString ClientInterface::_pseudotranslationRtlLocale{QStringLiteral("ps")};
 
@@ -139,6 +198,20 @@ ClientInterface::ClientInterface(bool hasExistingSettingsFile,
 {
     _settings.readJsonObject(initialSettings);
 
+    _idleTimer.setSingleShot(true);
+    _idleTimer.setInterval(msec(idleDelay));
+    connect(&_idleTimer, &QTimer::timeout, this, [this](){setIdle(true);});
+
+    _backgroundTimer.setSingleShot(true);
+    _backgroundTimer.setInterval(msec(backgroundDelay));
+    connect(&_backgroundTimer, &QTimer::timeout, this,
+            [this](){setBackground(true);});
+
+    _settingsWriteTimer.setSingleShot(true);
+    _settingsWriteTimer.setInterval(msec(settingsWriteDelay));
+    connect(&_settingsWriteTimer, &QTimer::timeout, this,
+            &ClientInterface::queueSettingsWrite);
+
     _state.firstRunFlag(!hasExistingSettingsFile);
     _state.quietLaunch(quietLaunch);
 
@@ -188,6 +261,10 @@ ClientInterface::ClientInterface(bool hasExistingSettingsFile,
         case GraphicsMode::PersistSafe:
             _settings.disableHardwareGraphics(true);
             writeSettings();
+            // Persist this right away - if the client is crashing due to
+            // graphics issues, it might not survive until the write timer
+            // elapses.
+            flushSettings();
             Q_FALLTHROUGH();
         case GraphicsMode::Safe:
             _state.usingSafeGraphics(true);
@@ -223,11 +300,46 @@ ClientInterface::~ClientInterface()
     QCoreApplication *pApp = QCoreApplication::instance();
     Q_ASSERT(pApp); // Ensured by clientMain(); Client outlives QCoreApplication
     pApp->removeTranslator(&_currentTranslation);
+    flushSettings();
 }
 
 void ClientInterface::writeSettings()
 {
-    writeProperties(_settings.toJsonObject(), Path::ClientSettingsDir, "clientsettings.json");
+    // Don't restart the timer if it's already running, so a steady stream of
+    // changes can't postpone the write indefinitely.
+    if(!_settingsWriteTimer.isActive())
+        _settingsWriteTimer.start();
+}
+
+void ClientInterface::queueSettingsWrite()
+{
+    // Snapshot the settings on this thread; the worker only sees the copy.
+    QJsonObject settingsJson = _settings.toJsonObject();
+    _settingsWriteThread.queueOnThread([settingsJson]()
+    {
+        writePropertiesAtomic(settingsJson, Path::ClientSettingsDir,
+                              "clientsettings.json");
+    });
+}
+
+void ClientInterface::writeDaemonStateCache(const QJsonObject &cache)
+{
+    _settingsWriteThread.queueOnThread([cache]()
+    {
+        writePropertiesCacheAtomic(cache, Path::ClientSettingsDir,
+                                   "daemonstate.cache");
+    });
+}
+
+void ClientInterface::flushSettings()
+{
+    if(_settingsWriteTimer.isActive())
+    {
+        _settingsWriteTimer.stop();
+        queueSettingsWrite();
+    }
+    // Wait for any queued writes to finish.
+    _settingsWriteThread.invokeOnThread([](){});
 }
 
 void ClientInterface::addKnownLanguage(QVector<ClientLanguage> &languages,
@@ -245,6 +357,7 @@ void ClientInterface::addKnownLanguage(QVector<ClientLanguage> &languages,
 }
 
 void ClientInterface::addCheckedLanguage(QVector<ClientLanguage> &languages,
+                                         const QSet<QFontDatabase::WritingSystem> &supportedSystems,
                                          const QString &locale,
                                          const QString &nativeName,
                                          const QString &englishName,
@@ -255,7 +368,7 @@ void ClientInterface::addCheckedLanguage(QVector<ClientLanguage> &languages,
     newLang.locale(locale);
     newLang.rtlMirror(rtlMirror);
 
-    if(!QFontDatabase{}.families(writingSystem).isEmpty())
+    if(supportedSystems.contains(writingSystem))
     {
         // This script is supported, use the native name and allow this language
         newLang.displayName(nativeName);
@@ -277,29 +390,36 @@ void ClientInterface::loadLanguages()
     // ClientState::languages()
     QVector<ClientLanguage> languages;
 
+    // Query the supported writing systems once.  Each QFontDatabase query
+    // walks all installed font families, which is slow on systems with many
+    // fonts, and this is on the startup path.
+    QSet<QFontDatabase::WritingSystem> supportedSystems;
+    for(auto writingSystem : QFontDatabase{}.writingSystems())
+        supportedSystems.insert(writingSystem);
+
     // This is the order the languages appear in the UI.
     // The 'u' prefixes on the name strings are required for MSVC - even with
     // '/utf-8' something in the QStringLiteral macro still causes these to be
     // interpreted as Windows-1252 otherwise.
     addKnownLanguage(languages, QStringLiteral("en-US"), QStringLiteral(u"English"));
-    addCheckedLanguage(languages, QStringLiteral("zh-Hans"), QStringLiteral(u"简体中文"), QStringLiteral("Simplified Chinese"), QFontDatabase::WritingSystem::SimplifiedChinese);
-    addCheckedLanguage(languages, QStringLiteral("zh-Hant"), QStringLiteral(u"繁體中文"), QStringLiteral("Traditional Chinese"), QFontDatabase::WritingSystem::TraditionalChinese);
+    addCheckedLanguage(languages, supportedSystems, QStringLiteral("zh-Hans"), QStringLiteral(u"简体中文"), QStringLiteral("Simplified Chinese"), QFontDatabase::WritingSystem::SimplifiedChinese);
+    addCheckedLanguage(languages, supportedSystems, QStringLiteral("zh-Hant"), QStringLiteral(u"繁體中文"), QStringLiteral("Traditional Chinese"), QFontDatabase::WritingSystem::TraditionalChinese);
     addKnownLanguage(languages, QStringLiteral("da"), QStringLiteral(u"Dansk"));
     addKnownLanguage(languages, QStringLiteral("nl"), QStringLiteral(u"Nederlands"));
     addKnownLanguage(languages, QStringLiteral("fr"), QStringLiteral(u"Français"));
     addKnownLanguage(languages, QStringLiteral("de"), QStringLiteral(u"Deutsch"));
     addKnownLanguage(languages, QStringLiteral("it"), QStringLiteral(u"Italiano"));
-    addCheckedLanguage(languages, QStringLiteral("ja"), QStringLiteral(u"日本語"), QStringLiteral("Japanese"), QFontDatabase::WritingSystem::Japanese);
-    addCheckedLanguage(languages, QStringLiteral("ko"), QStringLiteral(u"한국어"), QStringLiteral("Korean"), QFontDatabase::WritingSystem::Korean);
+    addCheckedLanguage(languages, supportedSystems, QStringLiteral("ja"), QStringLiteral(u"日本語"), QStringLiteral("Japanese"), QFontDatabase::WritingSystem::Japanese);
+    addCheckedLanguage(languages, supportedSystems, QStringLiteral("ko"), QStringLiteral(u"한국어"), QStringLiteral("Korean"), QFontDatabase::WritingSystem::Korean);
     addKnownLanguage(languages, QStringLiteral("nb"), QStringLiteral(u"Norsk (Bokmål)"));
     addKnownLanguage(languages, QStringLiteral("pl"), QStringLiteral(u"Polski"));
     addKnownLanguage(languages, QStringLiteral("pt-BR"), QStringLiteral(u"Português (Brasil)"));
     addKnownLanguage(languages, QStringLiteral("ru"), QStringLiteral(u"Русский"));
     addKnownLanguage(languages, QStringLiteral("es-MX"), QStringLiteral(u"Español (México)"));
     addKnownLanguage(languages, QStringLiteral("sv"), QStringLiteral("Svenska"));
-    addCheckedLanguage(languages, QStringLiteral("th"), QStringLiteral(u"ไทย"), QStringLiteral("Thai"), QFontDatabase::WritingSystem::Thai);
+    addCheckedLanguage(languages, supportedSystems, QStringLiteral("th"), QStringLiteral(u"ไทย"), QStringLiteral("Thai"), QFontDatabase::WritingSystem::Thai);
     addKnownLanguage(languages, QStringLiteral("tr"), QStringLiteral(u"Türkçe"));
-    addCheckedLanguage(languages, QStringLiteral("ar"), QStringLiteral(u"العربية"), QStringLiteral("Arabic"), QFontDatabase::WritingSystem::Arabic, true);
+    addCheckedLanguage(languages, supportedSystems, QStringLiteral("ar"), QStringLiteral(u"العربية"), QStringLiteral("Arabic"), QFontDatabase::WritingSystem::Arabic, true);
 
     // Only add the pseudolocalization languages in debug builds.  Their .ts
     // files are excluded from release builds.
@@ -428,9 +548,9 @@ bool ClientInterface::applySettings(const QJsonObject &settings)
     if(!success)
         qWarning() << "Not all settings applied:" << *_settings.error();
 
-    // Write out the new settings.
-    // Unlike Daemon, we don't need to defer this and batch writes, client
-    // settings aren't changed rapidly like DaemonData.
+    // Write out the new settings.  This is batched - some settings (like
+    // favorites or dashboard layout) can change several times in quick
+    // succession.
     writeSettings();
 
     return success;
@@ -487,6 +607,57 @@ QString ClientInterface::localeUpperCase(const QString &text) const
 #endif
 }
 
+void ClientInterface::setWindowsVisible(bool windowsVisible)
+{
+    if(windowsVisible)
+    {
+        _idleTimer.stop();
+        setIdle(false);
+    }
+    else if(!_state.idle() && !_idleTimer.isActive())
+        _idleTimer.start();
+}
+
+void ClientInterface::setIdle(bool idle)
+{
+    if(idle == _state.idle())
+        return;
+
+    qInfo() << (idle ? "Entering" : "Leaving") << "idle mode";
+    _state.idle(idle);
+
+    if(idle)
+        _backgroundTimer.start();
+    else
+    {
+        _backgroundTimer.stop();
+        setBackground(false);
+    }
+
+    // Only receive the properties needed for the tray while idle.  When
+    // leaving idle mode, the daemon sends the current values of everything.
+    if(idle)
+    {
+        QJsonObject subscriptions;
+        addIdleSubscription(subscriptions, QStringLiteral("data"), g_daemonConnection->data);
+        addIdleSubscription(subscriptions, QStringLiteral("account"), g_daemonAccount);
+        addIdleSubscription(subscriptions, QStringLiteral("settings"), g_daemonSettings);
+        addIdleSubscription(subscriptions, QStringLiteral("state"), g_daemonState);
+        g_daemonConnection->subscribe(subscriptions);
+    }
+    else
+        g_daemonConnection->unsubscribe();
+}
+
+void ClientInterface::setBackground(bool background)
+{
+    if(background == _state.background())
+        return;
+
+    qInfo() << (background ? "Entering" : "Leaving") << "background mode";
+    _state.background(background);
+}
+
 void ClientInterface::migrateFromDaemon(const DaemonSettings &daemonSettings)
 {
     if(_settings.migrateDaemonSettings())
@@ -549,10 +720,12 @@ Client::Client(bool hasExistingSettingsFile, const QJsonObject &initialSettings,
     // to the JS Error class.
     qmlRegisterUncreatableType<Error>("PIA.Error", 1, 0, "NativeError", "Can't create Error from QML");
 
+    qmlRegisterType<BandwidthChart>("PIA.BandwidthChart", 1, 0, "BandwidthChart");
     qmlRegisterType<CircleMouseArea>("PIA.CircleMouseArea", 1, 0, "CircleMouseArea");
     qmlRegisterType<FocusCue>("PIA.FocusCue", 1, 0, "FocusCue");
     qmlRegisterType<DragHandle>("PIA.DragHandle", 1, 0, "DragHandle");
     qmlRegisterType<FlexValidator>("PIA.FlexValidator", 1, 0, "FlexValidator");
+    qmlRegisterType<RegionModel>("PIA.RegionModel", 1, 0, "RegionModel");
 
     qmlRegisterSingletonType<DaemonInterface>("PIA.NativeDaemon", 1, 0, "NativeDaemon",
         [](auto, auto) -> QObject* {return &Client::instance()->_daemonInterface;});
@@ -586,6 +759,9 @@ Client::Client(bool hasExistingSettingsFile, const QJsonObject &initialSettings,
         else
             g_logger->configure(true, *value);
     });
+    connect(&g_daemonSettings, &DaemonSettings::binaryDebugLogChanged, this, []() {
+        g_logger->setBinaryFormat(g_daemonSettings.binaryDebugLog());
+    });
 
     connect(g_logger, &Logger::configurationChanged, this, [](bool logToFile, const QStringList& filters) {
         if (!logToFile)
@@ -619,6 +795,45 @@ Client::Client(bool hasExistingSettingsFile, const QJsonObject &initialSettings,
     // necessary
     connect(&_clientInterface, &ClientInterface::retranslate, this,
             &Client::retranslate);
+
+    // QML unloads content when entering background mode; release the caches
+    // once that content has been destroyed
+    connect(_clientInterface.get_state(), &ClientState::backgroundChanged, this,
+            [this]()
+            {
+                if(_clientInterface.get_state()->background())
+                {
+                    QTimer::singleShot(msec(resourceReleaseDelay), this,
+                                       &Client::releaseResources);
+                }
+            });
+}
+
+void Client::releaseResources()
+{
+    // Nothing to do if a window was shown again in the meantime
+    if(!_clientInterface.get_state()->background())
+        return;
+
+    qInfo() << "Releasing QML resources in background mode";
+    // Collect the objects destroyed by the unloaded content first, so their
+    // components are no longer referenced and can be trimmed
+    _engine.collectGarbage();
+    _engine.trimComponentCache();
+    QPixmapCache::clear();
+    // Hidden windows can drop their scene graph textures and nodes; they're
+    // recreated when the window is shown.  The dashboard is kept warm though,
+    // it's revealed from the tray and recreating its scene graph would delay
+    // that noticeably.
+    for(QWindow *pWindow : QGuiApplication::topLevelWindows())
+    {
+        QQuickWindow *pQuickWindow = qobject_cast<QQuickWindow*>(pWindow);
+        if(pQuickWindow && !pQuickWindow->isVisible() &&
+           pQuickWindow != _nativeHelpers.dashboardWindow())
+        {
+            pQuickWindow->releaseResources();
+        }
+    }
 }
 
 Client::~Client()
@@ -633,11 +848,30 @@ Client::~Client()
     pGlobalContext->setContextObject(nullptr);
 }
 
+void Client::addResourceFont(const QString &path)
+{
+    // If the resource is stored uncompressed, register the font directly from
+    // the resource data.  This avoids reading the whole file into a new buffer
+    // the way addApplicationFont() does; the resource data is mapped with the
+    // executable and remains valid for the life of the process.
+    QResource fontResource{path};
+    if(fontResource.isValid() && !fontResource.isCompressed())
+    {
+        QByteArray fontData = QByteArray::fromRawData(reinterpret_cast<const char*>(fontResource.data()),
+                                                      static_cast<int>(fontResource.size()));
+        if(QFontDatabase::addApplicationFontFromData(fontData) >= 0)
+            return;
+    }
+
+    if(QFontDatabase::addApplicationFont(path) < 0)
+        qWarning() << "Unable to load font" << path;
+}
+
 void Client::setupFonts()
 {
-    QFontDatabase::addApplicationFont(":/extra/fonts/Roboto-Regular.ttf");
-    QFontDatabase::addApplicationFont(":/extra/fonts/Roboto-Bold.ttf");
-    QFontDatabase::addApplicationFont(":/extra/fonts/Roboto-Light.ttf");
+    addResourceFont(QStringLiteral(":/extra/fonts/Roboto-Regular.ttf"));
+    addResourceFont(QStringLiteral(":/extra/fonts/Roboto-Bold.ttf"));
+    addResourceFont(QStringLiteral(":/extra/fonts/Roboto-Light.ttf"));
 
     QFont roboto("Roboto");
     roboto.setPixelSize(13);
@@ -652,6 +886,12 @@ void Client::openDashboard()
 
 void Client::notifyExit()
 {
+    // Keep the daemon's latest values for the next launch, and make sure any
+    // pending settings changes are written before we exit.
+    if(daemon() && daemon()->isConnected())
+        _clientInterface.writeDaemonStateCache(daemon()->cachedState());
+    _clientInterface.flushSettings();
+
     if(daemon() && daemon()->isConnected())
     {
         // We're connected to a daemon and about to notify exit.  If the
@@ -742,6 +982,7 @@ void Client::notifyExitAndWait()
 
 void Client::loadQml(const QString &qmlResource)
 {
+    TraceSpan span{"client", QStringLiteral("Load %1").arg(qmlResource)};
     auto prevRootCount = _engine.rootObjects().size();
     _engine.load(QUrl(qmlResource));
     if (_engine.rootObjects().size() == prevRootCount)
@@ -754,17 +995,45 @@ void Client::loadQml(const QString &qmlResource)
 void Client::createSplashScreen()
 {
     loadQml(QStringLiteral("qrc:/components/main-splash.qml"));
+    StartupTrace::mark(StartupTrace::Milestone::SplashShown);
 }
 
 void Client::createMainWindow()
 {
     SplitTunnelManager::installImageHandler(&_engine);
     loadQml(QStringLiteral("qrc:/components/main.qml"));
+    // The dashboard frame is loaded synchronously by main.qml, so it's ready
+    // once the load completes.
+    StartupTrace::mark(StartupTrace::Milestone::DashboardReady);
+}
+
+bool Client::loadDaemonStateCache()
+{
+    TraceSpan span{"client", QStringLiteral("Load daemon state cache")};
+    auto cache = loadPropertiesCache(Path::ClientSettingsDir, "daemonstate.cache");
+    if(!cache)
+        return false;
+    _daemon->assignCachedState(*cache);
+    return true;
 }
 
 void Client::init()
 {
-    createSplashScreen();
+    TraceSpan span{"client", QStringLiteral("Client::init")};
+
+    // If the last launch cached the daemon's state, show the main UI with it
+    // right away; the daemon's values replace it once the connection
+    // completes.  Settings that still need to be migrated from the daemon have
+    // to come from the daemon itself, so wait for the connection in that case.
+    if(!_clientInterface.get_settings()->migrateDaemonSettings() &&
+       loadDaemonStateCache())
+    {
+        qInfo() << "Loaded cached daemon state, loading UI";
+        _mainUiLoaded = true;
+        createMainWindow();
+    }
+    else
+        createSplashScreen();
 
     connect(_daemon, &DaemonConnection::socketConnected, this, [](qintptr socketFd)
         {
@@ -784,6 +1053,13 @@ void Client::daemonConnectedChanged(bool connected)
     // client connection
     if(connected)
     {
+        // DaemonConnection becomes connected when the first data arrives
+        StartupTrace::mark(StartupTrace::Milestone::DaemonData);
+
+        // Update the cached state for the next launch, in case this client
+        // doesn't exit normally.
+        _clientInterface.writeDaemonStateCache(_daemon->cachedState());
+
         // Can't be active or have an in-flight request, because this would have
         // been preceded by a change with connected=false which resets these
         Q_ASSERT(!_notifyActivateResult);
@@ -29,6 +29,7 @@
 #include "settings.h"
 #include "nativehelpers.h"
 #include "preconnectstatus.h"
+#include "thread.h"
 
 #include <QFontDatabase>
 #include <QObject>
@@ -169,15 +170,33 @@ public:
     ClientSettings *get_settings() {return &_settings;}
     ClientState *get_state() {return &_state;}
 
+    // Write any pending settings change now, and wait for any queued writes to
+    // complete.  Called when the client is exiting so the last changes aren't
+    // lost.
+    void flushSettings();
+
+    // Persist a snapshot of the daemon's values for the next launch (see
+    // DaemonConnection::cachedState()).  This is written on
+    // _settingsWriteThread, so flushSettings() waits for it too.
+    void writeDaemonStateCache(const QJsonObject &cache);
+
 private:
+    // Schedule a write of the client settings.  Writes are batched by
+    // _settingsWriteTimer, then written atomically on _settingsWriteThread.
     void writeSettings();
+    // Queue a write of the current settings to _settingsWriteThread now.
+    void queueSettingsWrite();
     // Add a language that uses a script supported by the embedded Roboto font
     // (so it's always available)
     void addKnownLanguage(QVector<ClientLanguage> &languages,
                           const QString &locale, const QString &displayName,
                           bool rtlMirror = false);
-    // Add a language that uses a script other than Latin.
+    // Add a language that uses a script other than Latin.  The language is
+    // available if writingSystem is in supportedSystems (the writing systems
+    // supported by installed fonts, which are queried once by
+    // loadLanguages()).
     void addCheckedLanguage(QVector<ClientLanguage> &languages,
+                            const QSet<QFontDatabase::WritingSystem> &supportedSystems,
                             const QString &locale, const QString &nativeName,
                             const QString &englishName,
                             QFontDatabase::WritingSystem writingSystem,
@@ -186,6 +205,8 @@ private:
     QString matchOsLanguage(const QString &osLang);
     QString getFirstRunLanguage();
     void setTranslation(const QString &locale);
+    void setIdle(bool idle);
+    void setBackground(bool background);
 
 public:
     // Apply changes to client-side settings.
@@ -199,6 +220,11 @@ public:
     // necessary.)
     Q_INVOKABLE QString localeUpperCase(const QString &text) const;
 
+    // Tell the client whether any of its windows are visible.  The client
+    // becomes idle a short time after all windows are hidden, and stops being
+    // idle as soon as any window is shown again (see ClientState::idle).
+    Q_INVOKABLE void setWindowsVisible(bool windowsVisible);
+
     // If migrateDaemonSettings==true, migrate values from DaemonSettings.
     void migrateFromDaemon(const DaemonSettings &daemonSettings);
 
@@ -212,6 +238,16 @@ private:
     ClientSettings _settings;
     ClientState _state;
     ClientTranslator _currentTranslation;
+    // Delays entering the idle state after windows are hidden
+    QTimer _idleTimer;
+    // Delays entering background mode after becoming idle
+    QTimer _backgroundTimer;
+    // Batches settings writes - changes like window positions or favorites can
+    // come in bursts, and each write would otherwise hit the disk.
+    QTimer _settingsWriteTimer;
+    // Settings are written on this thread so the GUI thread never waits on
+    // disk I/O.  Writes are queued in order, so the last one always wins.
+    RunningWorkerThread _settingsWriteThread;
 };
 
 class Client : public QObject, public Singleton<Client>
@@ -254,9 +290,17 @@ public:
     IMPLEMENT_NOTIFICATIONS(Client)
 
 private:
+    // Register an application font from a Qt resource
+    void addResourceFont(const QString &path);
     void loadQml(const QString &qmlResource);
     void createSplashScreen();
     void createMainWindow();
+    // Assign the daemon state cached by the last launch, if there is one.
+    // Returns true if it was loaded.
+    bool loadDaemonStateCache();
+    // Release QML engine and scene graph resources that can be recreated
+    // when the windows are shown again (in background mode)
+    void releaseResources();
 
 signals:
     void retranslate();
@@ -292,7 +336,8 @@ private:
     // false      | nullptr               | inactive - ready to exit
     bool _activated;
     // The main UI is loaded after the daemon connection is established (the
-    // first time) and the client activates itself.  Once we've loaded the UI,
+    // first time) and the client activates itself, or at startup if the
+    // daemon's state was cached by the last launch.  Once we've loaded the UI,
     // don't do it again even if the daemon connection is lost and
     // re-established.
     bool _mainUiLoaded;
@@ -222,6 +222,16 @@ public:
     // Whether the client has been UAC-elevated on Windows.  This triggers a
     // warning in the UI.
     JsonField(bool, winIsElevated, false)
+    // Whether the client is idle - none of its windows have been visible for a
+    // little while.  While idle, the client doesn't receive daemon properties
+    // that are only displayed in its windows, and QML content suspends
+    // periodic updates.
+    JsonField(bool, idle, false)
+    // Whether the client is in background mode - it has been idle for a longer
+    // time.  In background mode, settings pages are unloaded and the QML
+    // engine's caches are released to reduce memory usage.  The client leaves
+    // background mode along with idle mode as soon as a window is shown.
+    JsonField(bool, background, false)
 };
 
 #endif
@@ -39,7 +39,45 @@
 
 namespace
 {
-    QString getIconForState(NativeTray::IconState icon, const QString &iconSet)
+    // Icon sizes commonly requested by tray hosts, at 1x and 2x scale.  The
+    // tray icons are pre-scaled to these sizes so the host's requests are just
+    // served from the QIcon.
+    const int trayIconSizes[]{16, 22, 24, 32, 44, 48, 64};
+
+    const NativeTray::IconState allIconStates[]
+    {
+        NativeTray::IconState::Alert,
+        NativeTray::IconState::Disconnected,
+        NativeTray::IconState::Connected,
+        NativeTray::IconState::Disconnecting,
+        NativeTray::IconState::Connecting,
+        NativeTray::IconState::Snoozed
+    };
+
+    // Decode an icon resource and pre-scale it to the tray icon sizes
+    QIcon renderTrayIcon(const QString &resource)
+    {
+        QPixmap source{resource};
+        QIcon icon;
+        if(source.isNull())
+        {
+            qWarning() << "Unable to load tray icon" << resource;
+            return icon;
+        }
+
+        for(int size : trayIconSizes)
+        {
+            if(size < source.width() || size < source.height())
+            {
+                icon.addPixmap(source.scaled(size, size, Qt::KeepAspectRatio,
+                                             Qt::SmoothTransformation));
+            }
+        }
+        icon.addPixmap(source);
+        return icon;
+    }
+
+    QString getIconResourceForState(NativeTray::IconState icon, const QString &iconSet)
     {
         QString baseName;
         if(iconSet == QStringLiteral("dark"))
@@ -87,31 +125,31 @@ namespace
     }
 }
 
-TrayIconShim::TrayIconShim(const QString &iconPath)
-    : _lastIconPath{iconPath}
+TrayIconShim::TrayIconShim(const QIcon &icon)
+    : _lastIcon{icon}
 {
 }
 
-void TrayIconShim::setIcon(const QString &iconPath)
+void TrayIconShim::setIcon(const QIcon &icon)
 {
-    _lastIconPath = iconPath;
+    _lastIcon = icon;
     if(_pTrayIcon)
-        _pTrayIcon->setIcon(QIcon{iconPath});
+        _pTrayIcon->setIcon(icon);
 }
 
 void TrayIconShim::showMessage(const QString &title, const QString &message,
-                               const QString &iconPath)
+                               const QIcon &icon)
 {
     Q_ASSERT(!message.isEmpty());   // Can't be empty, would indicate empty queue
 
     if(_pTrayIcon)
-        _pTrayIcon->showMessage(title, message, QIcon{iconPath});
+        _pTrayIcon->showMessage(title, message, icon);
     else
     {
         // Queue the message and show it when the icon is created
         _queuedMsgTitle = title;
         _queuedMsg = message;
-        _queuedMsgIcon = iconPath;
+        _queuedMsgIcon = icon;
     }
 }
 
@@ -127,29 +165,30 @@ void TrayIconShim::create(QMenu &menu)
     // Destroy the old icon (if there is one) before creating the new one
     _pTrayIcon.reset();
     // Create the new icon and set invariant state
-    _pTrayIcon.reset(new QSystemTrayIcon{QIcon{_lastIconPath}});
+    _pTrayIcon.reset(new QSystemTrayIcon{_lastIcon});
     _pTrayIcon->setVisible(true);
     _pTrayIcon->setContextMenu(&menu);
     QObject::connect(_pTrayIcon.data(), &QSystemTrayIcon::activated, this,
                      &TrayIconShim::activated);
     // Restore stored state
-    _pTrayIcon->setIcon(QIcon{_lastIconPath});
+    _pTrayIcon->setIcon(_lastIcon);
     _pTrayIcon->setToolTip(_lastToolTip);
 
     // If there's a queued message, show it
     if(!_queuedMsg.isEmpty())
     {
-        _pTrayIcon->showMessage(_queuedMsgTitle, _queuedMsg, QIcon{_queuedMsgIcon});
+        _pTrayIcon->showMessage(_queuedMsgTitle, _queuedMsg, _queuedMsgIcon);
         _queuedMsgTitle.clear();
         _queuedMsg.clear();
-        _queuedMsgIcon.clear();
+        _queuedMsgIcon = {};
     }
 }
 
 NativeTrayQt::NativeTrayQt(IconState initialIcon, const QString &iconSet)
-    : _trayIcon{getIconForState(initialIcon, iconSet)}
+    : _trayIcon{getStateIcon(initialIcon, iconSet)}
 {
     _lastIconSet = iconSet;
+    preloadStateIcons(iconSet);
     connect(&_trayIcon, &TrayIconShim::activated, this,
             &NativeTrayQt::onTrayActivated);
     // Handle menu items clicked
@@ -452,10 +491,29 @@ QRect NativeTrayQt::guessGeometry() const
     return iconGuess;
 }
 
+const QIcon &NativeTrayQt::getStateIcon(IconState icon, const QString &iconSet)
+{
+    QString resource = getIconResourceForState(icon, iconSet);
+    auto itIcon = _stateIcons.find(resource);
+    if(itIcon == _stateIcons.end())
+        itIcon = _stateIcons.insert(resource, renderTrayIcon(resource));
+    return *itIcon;
+}
+
+void NativeTrayQt::preloadStateIcons(const QString &iconSet)
+{
+    for(auto state : allIconStates)
+        getStateIcon(state, iconSet);
+}
+
 void NativeTrayQt::setIconState(IconState icon, const QString &iconSet)
 {
-    _lastIconSet = iconSet;
-    _trayIcon.setIcon(getIconForState(icon, iconSet));
+    if(iconSet != _lastIconSet)
+    {
+        _lastIconSet = iconSet;
+        preloadStateIcons(iconSet);
+    }
+    _trayIcon.setIcon(getStateIcon(icon, iconSet));
 }
 
 void NativeTrayQt::showNotification(IconState icon, const QString &title,
@@ -463,7 +521,7 @@ void NativeTrayQt::showNotification(IconState icon, const QString &title,
 {
     // Use the product name if the subtitle is empty.
     const QString &message = subtitle.isEmpty() ? QStringLiteral(PIA_PRODUCT_NAME) : subtitle;
-    _trayIcon.showMessage(title, message, getIconForState(icon, _lastIconSet));
+    _trayIcon.showMessage(title, message, getStateIcon(icon, _lastIconSet));
 }
 
 void NativeTrayQt::hideNotification()
@@ -53,15 +53,15 @@ public:
     // TrayIconShim does not initially create a system tray icon; call create()
     // to create it.  (Icon and tool tip changes are still stored before the
     // icon is created.)
-    TrayIconShim(const QString &iconPath);
+    TrayIconShim(const QIcon &icon);
 
 public:
-    // Change the current icon - pass a path to an icon resource
-    void setIcon(const QString &iconPath);
+    // Change the current icon
+    void setIcon(const QIcon &icon);
     // Show a message - see QSystemTrayIcon::showMessage().  message cannot be
     // empty.
     void showMessage(const QString &title, const QString &message,
-                     const QString &iconPath);
+                     const QIcon &icon);
     void setToolTip(const QString &toolTip);
 
     // (Re)create the underlying QSystemTrayIcon.  Pass the QMenu again; other
@@ -77,12 +77,14 @@ private:
     // recreating the icon
     // The menu isn't stored; NativeTrayQt keeps the QMenu around anyway so it
     // just passes the menu to recreate()
-    QString _lastIconPath, _lastToolTip;
+    QIcon _lastIcon;
+    QString _lastToolTip;
     // If a message is shown before the icon is created, it's queued here to be
     // shown in create().  Only one message can be queued; subsequent messages
     // overwrite the queue.
     // An empty _queuedMsg indicates that there is no queued message.
-    QString _queuedMsgTitle, _queuedMsg, _queuedMsgIcon;
+    QString _queuedMsgTitle, _queuedMsg;
+    QIcon _queuedMsgIcon;
 };
 
 // NativeTrayQt is an implementation of NativeTray using Qt's QSystemTrayIcon.
@@ -100,6 +102,11 @@ private:
     void onDestroyTimeout();
     void onTrayActivated(QSystemTrayIcon::ActivationReason reason);
     void setMenuItems(QMenu *menu, const NativeMenuItem::List &items);
+    // Get the icon for a state, rendering it the first time it's used
+    const QIcon &getStateIcon(IconState icon, const QString &iconSet);
+    // Render the icons for all states in an icon set, so state changes don't
+    // have to decode or scale any images
+    void preloadStateIcons(const QString &iconSet);
 
     // Guess a geometry for the tray icon based on desktop environment.
     // The StatusNotifierItem interface doesn't provide any geoemtry info, but
@@ -126,6 +133,9 @@ private:
     QString _lastIconSet;
     QHash<QString, QSharedPointer<QMenu>> _submenus;
     QHash<QString, QIcon> _menuIcons;
+    // Rendered tray icons by resource path.  Must be declared before
+    // _trayIcon, which is initialized with one of these icons.
+    QHash<QString, QIcon> _stateIcons;
     // When running on startup, this timer is used to create the icon after
     // 5s to work around a Qt bug.
     QTimer _createTimer;
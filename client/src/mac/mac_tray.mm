@@ -70,6 +70,12 @@ public:
 private:
     NSMenu* createMenu(const NativeMenuItem::List& items);
     QRect getScreenBound() const;
+    // Get the image for a tray icon state, loading it the first time it's used
+    NSImage *getStateIcon(const QString &baseName, bool templateImg,
+                          IconState icon);
+    // Load the images for all states with a given base name, so state changes
+    // don't have to decode any images
+    void preloadStateIcons(const QString &baseName, bool templateImg);
 
 public:
     virtual void setIconState(IconState icon, const QString &iconSet) override;
@@ -110,6 +116,11 @@ private:
     NSMenu *_pTrayMenu = nullptr;
     // Menu icon cache.
     QHash<QString, NSImage*> _icons;
+    // Tray icon cache by resource path.
+    QHash<QString, NSImage*> _stateIcons;
+    // Base name of the last icons shown; used to preload the other states
+    // when the theme changes.
+    QString _lastBaseName;
 };
 
 std::unique_ptr<NativeTray> createNativeTrayMac(NativeTray::IconState initialIcon, const QString &initialIconSet)
@@ -350,9 +361,12 @@ namespace
 
 
 
-    NSImage *loadIconForState(NativeTray::IconState icon, const QString &iconSet)
+    // Get the base name of the icon resources for an icon set - also indicates
+    // whether the images are template images.  For the 'auto' theme, this
+    // checks the OS theme.
+    QString getIconBaseName(const QString &iconSet, bool &templateImg)
     {
-        bool templateImg = false;
+        templateImg = false;
         QString baseName;
         // Make sure the theme name is sane; ensures a sane fallback to 'auto'
         // if an invalid theme name is present in settings
@@ -372,6 +386,11 @@ namespace
         else
             baseName = QStringLiteral("dark");  // Light mode - use dark icons
 
+        return baseName;
+    }
+
+    QString getIconResource(const QString &baseName, NativeTray::IconState icon)
+    {
         QString stateName;
         switch(icon)
         {
@@ -405,7 +424,7 @@ namespace
         // must exist
         Q_ASSERT(QFile::exists(resource));
 
-        return loadNativeImage(resource, templateImg);
+        return resource;
     }
 
     // Map an NSPoint from native coordinates to Qt coordinates.
@@ -483,7 +502,10 @@ NativeTrayMac::NativeTrayMac(NativeTray::IconState initialIcon, const QString &i
     _pStatusItem = [_pStatusBar statusItemWithLength:NSSquareStatusItemLength];
 
     // Create a status bar button
-    NSImage *pInitialIcon = loadIconForState(initialIcon, initialIconSet);
+    bool templateImg{false};
+    _lastBaseName = getIconBaseName(initialIconSet, templateImg);
+    preloadStateIcons(_lastBaseName, templateImg);
+    NSImage *pInitialIcon = getStateIcon(_lastBaseName, templateImg, initialIcon);
     // This is the default frame that would have been used by
     // NSButton.buttonWithImage:target:action:.  It doesn't really matter since
     // the button will be bounded by the status item.
@@ -614,10 +636,36 @@ QRect NativeTrayMac::getScreenBound() const
     return qtBounds.toRect();
 }
 
+NSImage *NativeTrayMac::getStateIcon(const QString &baseName, bool templateImg,
+                                     IconState icon)
+{
+    QString resource = getIconResource(baseName, icon);
+    auto itIcon = _stateIcons.find(resource);
+    if(itIcon == _stateIcons.end())
+        itIcon = _stateIcons.insert(resource, loadNativeImage(resource, templateImg));
+    return *itIcon;
+}
+
+void NativeTrayMac::preloadStateIcons(const QString &baseName, bool templateImg)
+{
+    for(auto state : {IconState::Alert, IconState::Disconnected,
+                      IconState::Connected, IconState::Disconnecting,
+                      IconState::Connecting, IconState::Snoozed})
+    {
+        getStateIcon(baseName, templateImg, state);
+    }
+}
+
 void NativeTrayMac::setIconState(IconState icon, const QString &iconSet)
 {
-    NSImage *pIconImage = loadIconForState(icon, iconSet);
-    _pButton.image = pIconImage;
+    bool templateImg{false};
+    QString baseName = getIconBaseName(iconSet, templateImg);
+    if(baseName != _lastBaseName)
+    {
+        _lastBaseName = baseName;
+        preloadStateIcons(baseName, templateImg);
+    }
+    _pButton.image = getStateIcon(baseName, templateImg, icon);
 }
 
 void NativeTrayMac::showNotification(IconState, const QString &title,
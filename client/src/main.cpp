@@ -32,6 +32,7 @@ void dummyClientMain() {}
 #include "semversion.h"
 #include "version.h"
 #include "appsingleton.h"
+#include "startuptrace.h"
 
 #include "clientlib.h"
 
@@ -93,6 +94,7 @@ bool winShouldUseSoftwareBackend()
 
 int clientMain(int argc, char *argv[])
 {
+    StartupTrace::begin();
     Path::initializePreApp();
 
     // We never use Qt's built-in high-DPI scaling.  On Windows, it has a number
@@ -177,17 +177,8 @@ void TableAttached::onTableCreated()
         if(row.pAccElement)
             row.pAccElement->setRange(rowIdx, 1, 0, 0);
 
-        // Sized to match columns by setColumns/setRows
-        Q_ASSERT(row.cells.size() == _columnDefs.size());
-        colIdx = 0;
-        for(auto &column : _columnDefs)
-        {
-            Q_ASSERT(!row.cells[colIdx]);
-            row.cells[colIdx] = createCellElement(column, row);
-            ++colIdx;
-        }
-
-        setRowCellSpans(rowIdx, row);
+        // The cells are created when they're needed
+        Q_ASSERT(!row.cellsCreated);
 
         ++rowIdx;
     }
@@ -201,8 +192,8 @@ void TableAttached::onTableDestroyed()
     // definitions from QML were not valid.
     for(auto &row : _rowDefs)
     {
-        for(auto &pCell : row.cells)
-            pCell.reset();
+        row.cells.clear();
+        row.cellsCreated = false;
         row.pAccElement.reset();
     }
     for(auto &column : _columnDefs)
@@ -212,30 +203,55 @@ void TableAttached::onTableDestroyed()
     // the focus delegate.
 }
 
-TableCellImpl *TableAttached::getCellImpl(int row, int column) const
+const TableAttached::RowDef *TableAttached::ensureRowCells(int row) const
 {
     // For some reason Qt likes to use signed indices; negatives never make any
     // sense.
-    if(row < 0 || column < 0)
+    if(row < 0)
         return nullptr;
 
     unsigned rowIdx = static_cast<unsigned>(row);
-    unsigned colIdx = static_cast<unsigned>(column);
-
     if(rowIdx >= _rowDefs.size())
         return nullptr;
 
-    const auto &rowDef = _rowDefs[rowIdx];
+    const RowDef &rowDef = _rowDefs[rowIdx];
+    // If the table doesn't exist, there are no cells to create; don't mark them
+    // created so they're created if the table is created later.
+    if(rowDef.cellsCreated || !accExists())
+        return &rowDef;
+
+    // Creating the cells doesn't change the table's logical content, it just
+    // creates the elements representing it.
+    TableAttached &self = const_cast<TableAttached&>(*this);
+    RowDef &mutableRow = self._rowDefs[rowIdx];
+    mutableRow.cells.reserve(_columnDefs.size());
+    for(const auto &column : _columnDefs)
+        mutableRow.cells.push_back(self.createCellElement(column, mutableRow));
+    mutableRow.cellsCreated = true;
+    setRowCellSpans(row, mutableRow);
 
-    if(colIdx >= rowDef.cells.size())
+    return &rowDef;
+}
+
+TableCellImpl *TableAttached::getCellImpl(int row, int column) const
+{
+    if(column < 0)
+        return nullptr;
+
+    const RowDef *pRowDef = ensureRowCells(row);
+    if(!pRowDef)
+        return nullptr;
+
+    unsigned colIdx = static_cast<unsigned>(column);
+    if(colIdx >= pRowDef->cells.size())
         return nullptr;
 
     // nullptr entries are spanned by the previous cell, so walk backward until
     // we find a valid cell.  If there aren't any, stop on 0 and just return
     // nullptr.
-    while(!rowDef.cells[colIdx] && colIdx > 0)
+    while(!pRowDef->cells[colIdx] && colIdx > 0)
         --colIdx;
-    return rowDef.cells[colIdx].get();
+    return pRowDef->cells[colIdx].get();
 }
 
 void TableAttached::updateFocusDelegateCell()
@@ -328,10 +344,17 @@ void TableAttached::setColumns(const QJSValue &columns)
     }
 
     // Rebuild the rows' cell lists by pulling out the cells that still exist
-    // and creating new cells.
+    // and creating new cells.  Rows whose cells haven't been created yet don't
+    // need anything; they'll be created with the new columns.
     int rowIdx = 0;
     for(auto &row : _rowDefs)
     {
+        if(!row.cellsCreated)
+        {
+            ++rowIdx;
+            continue;
+        }
+
         // Create a new cell array of the new size in row.cells.
         // Any elements that we don't take from the old array will be destroyed
         // by the OwnedCellPtrs.
@@ -419,13 +442,10 @@ void TableAttached::setRows(const QJSValue &rows)
         if(itOldRow != oldRows.end())
         {
             newRow.cells = std::move(itOldRow->second.cells);
+            newRow.cellsCreated = itOldRow->second.cellsCreated;
             newRow.pAccElement = std::move(itOldRow->second.pAccElement);
             oldRows.erase(itOldRow);
         }
-        else
-        {
-            newRow.cells.resize(_columnDefs.size());
-        }
 
         // Reattach or recreate the row element
         if(newRow.pAccDef)
@@ -436,15 +456,21 @@ void TableAttached::setRows(const QJSValue &rows)
                 newRow.pAccElement->setRange(rowIdx, 1, 0, 0);
         }
 
-        // Reattach or recreate the cells
-        for(unsigned cellIdx=0; cellIdx<_columnDefs.size(); ++cellIdx)
+        // If the row's cells have been created, reattach or recreate them.
+        // Otherwise, they're created when they're needed.
+        if(newRow.cellsCreated)
         {
-            if(!reattachCellElement(_columnDefs[cellIdx], newRow, newRow.cells[cellIdx]))
-                newRow.cells[cellIdx] = createCellElement(_columnDefs[cellIdx], newRow);
-        }
+            // Sized to match columns by setColumns()/ensureRowCells()
+            Q_ASSERT(newRow.cells.size() == _columnDefs.size());
+            for(unsigned cellIdx=0; cellIdx<_columnDefs.size(); ++cellIdx)
+            {
+                if(!reattachCellElement(_columnDefs[cellIdx], newRow, newRow.cells[cellIdx]))
+                    newRow.cells[cellIdx] = createCellElement(_columnDefs[cellIdx], newRow);
+            }
 
-        // Update the elements' indices and spans
-        setRowCellSpans(rowIdx, newRow);
+            // Update the elements' indices and spans
+            setRowCellSpans(rowIdx, newRow);
+        }
     }
 
     emit rowsChanged();
@@ -476,23 +502,18 @@ void TableAttached::setNavigateCol(int navigateCol)
 
 QList<QAccessibleInterface*> TableAttached::getRowCells(int row) const
 {
-    if(row < 0)
+    const RowDef *pRowDef = ensureRowCells(row);
+    if(!pRowDef)
         return {};
-    unsigned rowIdx = static_cast<unsigned>(row);
-    if(rowIdx < _rowDefs.size())
-    {
-        const auto &rowDef = _rowDefs[rowIdx];
 
-        QList<QAccessibleInterface*> cells;
-        cells.reserve(rowDef.cells.size());
-        for(const auto &pCell : rowDef.cells)
-        {
-            if(pCell)
-                cells.push_back(pCell.get());
-        }
-        return cells;
+    QList<QAccessibleInterface*> cells;
+    cells.reserve(pRowDef->cells.size());
+    for(const auto &pCell : pRowDef->cells)
+    {
+        if(pCell)
+            cells.push_back(pCell.get());
     }
-    return {};
+    return cells;
 }
 
 QAccessibleInterface *TableAttached::getRowOutlineParent(int row) const
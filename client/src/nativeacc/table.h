@@ -79,6 +79,13 @@ public:
 // NativeAcc::Table::CellRole values.  These model different types of values that are
 // displayed in cells.  All cell roles have the 'name' and 'item' properties
 // (see AccessibleTableCell).  Some cell roles define additional properties.
+//
+// The row and column elements are always created (they're the table's
+// children), but cell elements are created on demand - a row's cells are
+// created the first time any of them is queried by an accessibility client.
+// Screen readers usually only query the rows around the cursor, so this avoids
+// creating an element for every cell of a long table.  Once created, a row's
+// cells are kept (and reattached) as long as a row with that ID exists.
 class TableAttached : public AccessibleItem, public QAccessibleTableInterface,
                       public AccessibleTableFiller
 {
@@ -152,7 +159,11 @@ private:
         //
         // Individual cells can be nullptr, which means that row does not have
         // that cell, and the prior cell spans it instead.
+        //
+        // The cells are only created when they're first needed - until then,
+        // cellsCreated is false and cells is empty.
         MoveVector<OwnedCellPtr> cells;
+        bool cellsCreated{false};
         // The accessibility element for the row itself, which is owned by the
         // QML code.
         QPointer<TableRow> pAccDef;
@@ -192,6 +203,12 @@ private:
     // Set the indices and spans for all cells in a row.
     void setRowCellSpans(int rowIndex, const RowDef &row) const;
 
+    // Create the cell elements for a row if they haven't been created yet.
+    // This doesn't change the table's logical content, so it's used by the
+    // const accessors that return cells.  Returns the row, or nullptr if the
+    // row index is not valid.
+    const RowDef *ensureRowCells(int row) const;
+
     // Handle the table being created
     void onTableCreated();
 
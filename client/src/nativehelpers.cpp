@@ -25,6 +25,8 @@
 #include "path.h"
 #include "version.h"
 #include "brand.h"
+#include "tracing.h"
+#include "startuptrace.h"
 
 #include <QProcess>
 #include <QStringList>
@@ -171,6 +173,27 @@ void NativeHelpers::initDashboardPopup(QWindow *pDashboard)
 #if defined(Q_OS_MACOS)
     macSetAllWorkspaces(*pDashboard);
 #endif
+
+    // Measure the time from showing the dashboard to its first frame.  The
+    // dashboard is recreated when the frame style changes, so stop observing
+    // the old one.
+    if(_pDashboard)
+        disconnect(_pDashboard, nullptr, this, nullptr);
+    _pDashboard = qobject_cast<QQuickWindow*>(pDashboard);
+    if(_pDashboard)
+    {
+        connect(_pDashboard, &QWindow::visibleChanged, this,
+                &NativeHelpers::onDashboardVisibleChanged);
+        // frameSwapped is emitted on the render thread
+        connect(_pDashboard, &QQuickWindow::frameSwapped, this,
+                &StartupTrace::endDashboardReveal, Qt::QueuedConnection);
+    }
+}
+
+void NativeHelpers::onDashboardVisibleChanged(bool visible)
+{
+    if(visible)
+        StartupTrace::beginDashboardReveal();
 }
 
 void NativeHelpers::initDecoratedWindow(QWindow *pWindow)
@@ -354,7 +377,22 @@ void NativeHelpers::loadDummyCrashDll(const QString &dllName)
 
 void NativeHelpers::startLogUploader(const QString &diagnosticsFile)
 {
-    startSupportTool("logs", diagnosticsFile);
+    QStringList diagFiles;
+    if(!diagnosticsFile.isEmpty())
+    {
+        diagFiles.push_back(diagnosticsFile);
+        // The daemon writes its trace alongside the diagnostics file.  (The
+        // support tool ignores it if it doesn't exist.)
+        diagFiles.push_back(Tracer::diagnosticsTracePath(diagnosticsFile));
+    }
+
+    // Write the client's own trace too; it's written even if the daemon
+    // couldn't write diagnostics.
+    const QString clientTraceFile = Path::ClientDataDir / "client_trace.json";
+    if(Tracer::writeChromeTrace(clientTraceFile))
+        diagFiles.push_back(clientTraceFile);
+
+    startSupportTool("logs", diagFiles);
 }
 
 void NativeHelpers::wipeLogFile()
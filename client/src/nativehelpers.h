@@ -26,6 +26,8 @@
 #include <QWindow>
 #include <QQmlApplicationEngine>
 #include <QQuickItem>
+#include <QQuickWindow>
+#include <QPointer>
 
 #ifdef Q_OS_WIN
 #include <QWinEventNotifier>
@@ -118,7 +120,8 @@ public:
 // #endif
 
     // Start the log uploader tool.  Pass the path to the diagnostics file if
-    // one was written (or an empty string if not).
+    // one was written (or an empty string if not).  The daemon's trace file
+    // and the client's trace are included too.
     // Most of the time, use Client.startLogUploader() instead, which requests
     // to the daemon to write the diagnostic file.
     Q_INVOKABLE void startLogUploader(const QString &diagnosticsFile);
@@ -177,6 +180,11 @@ public:
 
     void requestDashboardReopen();
 
+    // The dashboard window most recently passed to initDashboardPopup() (if it
+    // still exists).  Client keeps this window's resources loaded in
+    // background mode so it can be revealed quickly from the tray.
+    QQuickWindow *dashboardWindow() const {return _pDashboard.data();}
+
     Q_INVOKABLE void openSecurityPreferencesMac();
 
     Q_INVOKABLE void checkAppDeactivate();
@@ -201,6 +209,7 @@ private:
     QString reinstallTapStatus() const { return _reinstallTapStatus; }
     QString reinstallWfpCalloutStatus() const {return _reinstallWfpCalloutStatus;}
     bool runInTerminal(const QString &command, bool quitAfterRun = false);
+    void onDashboardVisibleChanged(bool visible);
 
     // Reinstall a Windows driver
     void reinstallDriver(Driver type, const wchar_t *commandParams);
@@ -218,6 +227,8 @@ private:
     // Status of WFP callout driver reinstallation (or installation if this is
     // the first time)
     QString _reinstallWfpCalloutStatus;
+    // The current dashboard window, see dashboardWindow()
+    QPointer<QQuickWindow> _pDashboard;
 };
 
 #endif // MAC_INSTALL_H
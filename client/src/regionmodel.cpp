@@ -0,0 +1,348 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("regionmodel.cpp")
+
+#include "regionmodel.h"
+#include "client.h"
+#include <algorithm>
+
+RegionModel::RegionModel()
+    : _sortKey{QStringLiteral("latency")}, _service{QStringLiteral("vpn")}
+{
+    _collator.setCaseSensitivity(Qt::CaseInsensitive);
+    connect(&g_daemonState, &DaemonState::groupedLocationsChanged, this,
+            &RegionModel::onLocationsChanged);
+    connect(&g_daemonState, &NativeJsonObject::nestedPropertyChanged, this,
+            &RegionModel::onStateNestedPropertyChanged);
+    connect(g_client->getInterface()->get_state(), &ClientState::idleChanged,
+            this, &RegionModel::onIdleChanged);
+    updateRows();
+}
+
+void RegionModel::onLocationsChanged()
+{
+    // Latency updates keep changing the locations, but the list isn't shown
+    // while the client is idle.  Catch up when it's no longer idle.
+    if(g_client->getInterface()->get_state()->idle())
+        _updateWhenActive = true;
+    else
+        updateRows();
+}
+
+void RegionModel::onIdleChanged()
+{
+    if(_updateWhenActive && !g_client->getInterface()->get_state()->idle())
+    {
+        _updateWhenActive = false;
+        updateRows();
+    }
+}
+
+void RegionModel::onStateNestedPropertyChanged(const QString &name)
+{
+    // A patch from the daemon usually changes many locations at once, and
+    // each one is signaled individually.  Update once after the whole patch
+    // is applied.
+    if(name == QStringLiteral("groupedLocations") && !_updateQueued)
+    {
+        _updateQueued = true;
+        QMetaObject::invokeMethod(this, [this]()
+            {
+                _updateQueued = false;
+                onLocationsChanged();
+            }, Qt::QueuedConnection);
+    }
+}
+
+QString RegionModel::getLocationName(const ServerLocation &location) const
+{
+    QString name = _locationNames.value(location.id()).toString();
+    if(!name.isEmpty())
+        return name;
+    return location.name().isEmpty() ? location.id() : location.name();
+}
+
+QString RegionModel::getCountryName(const QString &countryCode) const
+{
+    QString name = _countryNames.value(countryCode.toLower()).toString();
+    if(!name.isEmpty())
+        return name;
+    return countryCode.toUpper();
+}
+
+bool RegionModel::matchesSearch(const QString &value) const
+{
+    return value.contains(_searchTerm, Qt::CaseInsensitive);
+}
+
+bool RegionModel::hasService(const ServerLocation &location) const
+{
+    if(_service == QStringLiteral("shadowsocks"))
+        return !!location.shadowsocks();
+    // All regions have VPN
+    return true;
+}
+
+QString RegionModel::rowSortName(const Row &row) const
+{
+    // Single regions are displayed (and sorted) by region name; the country
+    // name isn't displayed for them.
+    if(row.locations.size() == 1)
+        return getLocationName(*row.locations.front());
+    return getCountryName(row.country);
+}
+
+auto RegionModel::buildRows() const -> QVector<Row>
+{
+    QVector<Row> rows;
+    for(const auto &countryLocations : g_daemonState.groupedLocations())
+    {
+        // Filter by service first - this could cause a country group to become
+        // a single location, which affects the search term matching.
+        QVector<QSharedPointer<ServerLocation>> serviceLocations;
+        for(const auto &pLocation : countryLocations.locations())
+        {
+            if(pLocation && hasService(*pLocation))
+                serviceLocations.push_back(pLocation);
+        }
+
+        if(serviceLocations.isEmpty())
+            continue;   // Nothing to display in this country
+
+        Row row{serviceLocations.front()->country().toLower(), {}, {}};
+        // For a single region, just check the region's name.  Don't look at
+        // the country name, because we don't display it for single regions.
+        if(serviceLocations.size() == 1)
+        {
+            if(matchesSearch(getLocationName(*serviceLocations.front())))
+                row.locations = std::move(serviceLocations);
+        }
+        // For a group, include everything if the country name matches
+        else if(matchesSearch(getCountryName(row.country)))
+            row.locations = std::move(serviceLocations);
+        // Otherwise, include the regions that match
+        else
+        {
+            for(const auto &pLocation : serviceLocations)
+            {
+                if(matchesSearch(getLocationName(*pLocation)))
+                    row.locations.push_back(pLocation);
+            }
+        }
+
+        if(!row.locations.isEmpty())
+            rows.push_back(std::move(row));
+    }
+
+    // The daemon already sorts by latency.  When sorting by name, sort each
+    // country's regions, then the countries.
+    if(_sortKey == QStringLiteral("name"))
+    {
+        auto nameLess = [this](const QString &first, const QString &second)
+        {
+            return _collator.compare(first, second) < 0;
+        };
+        for(auto &row : rows)
+        {
+            std::stable_sort(row.locations.begin(), row.locations.end(),
+                [&](const QSharedPointer<ServerLocation> &first,
+                    const QSharedPointer<ServerLocation> &second)
+                {
+                    return nameLess(getLocationName(*first), getLocationName(*second));
+                });
+        }
+        std::stable_sort(rows.begin(), rows.end(),
+            [&](const Row &first, const Row &second)
+            {
+                return nameLess(rowSortName(first), rowSortName(second));
+            });
+    }
+
+    for(auto &row : rows)
+    {
+        for(const auto &pLocation : row.locations)
+            row.locationsJson.push_back(pLocation->toJsonObject());
+    }
+
+    return rows;
+}
+
+void RegionModel::updateRows()
+{
+    QVector<Row> newRows = buildRows();
+
+    QSet<QString> newCountries;
+    for(const auto &row : newRows)
+        newCountries.insert(row.country);
+
+    // Remove rows that are no longer displayed
+    for(int i=_rows.size()-1; i>=0; --i)
+    {
+        if(!newCountries.contains(_rows[i].country))
+        {
+            beginRemoveRows({}, i, i);
+            _rows.remove(i);
+            endRemoveRows();
+        }
+    }
+
+    // Move or insert rows into their new positions, and update any rows whose
+    // locations changed.  Rows before i are already in their final position.
+    for(int i=0; i<newRows.size(); ++i)
+    {
+        if(i >= _rows.size() || _rows[i].country != newRows[i].country)
+        {
+            int existing = i+1;
+            while(existing < _rows.size() && _rows[existing].country != newRows[i].country)
+                ++existing;
+
+            if(existing >= _rows.size())
+            {
+                beginInsertRows({}, i, i);
+                _rows.insert(i, std::move(newRows[i]));
+                endInsertRows();
+                continue;
+            }
+
+            beginMoveRows({}, existing, existing, {}, i);
+            _rows.move(existing, i);
+            endMoveRows();
+        }
+
+        if(_rows[i].locationsJson != newRows[i].locationsJson)
+        {
+            _rows[i] = std::move(newRows[i]);
+            emit dataChanged(index(i), index(i));
+        }
+    }
+
+    // All rows not in newRows were removed initially
+    Q_ASSERT(_rows.size() == newRows.size());
+}
+
+int RegionModel::rowCount(const QModelIndex &parent) const
+{
+    // This is a flat list - no children for any row
+    if(parent.isValid())
+        return 0;
+    return _rows.size();
+}
+
+QVariant RegionModel::data(const QModelIndex &index, int role) const
+{
+    if(!index.isValid() || index.row() < 0 || index.row() >= _rows.size())
+        return {};
+
+    const Row &row = _rows[index.row()];
+    switch(role)
+    {
+        case RegionRole:
+            if(row.locationsJson.size() == 1)
+                return row.locationsJson.first().toObject();
+            return {};
+        case RegionCountryRole:
+            return row.country;
+        case RegionChildrenRole:
+        {
+            QJsonArray children;
+            if(row.locationsJson.size() > 1)
+            {
+                for(const auto &location : row.locationsJson)
+                    children.push_back(QJsonObject{{QStringLiteral("subregion"), location}});
+            }
+            return children;
+        }
+        default:
+            return {};
+    }
+}
+
+QHash<int, QByteArray> RegionModel::roleNames() const
+{
+    return {
+        {RegionRole, QByteArrayLiteral("region")},
+        {RegionCountryRole, QByteArrayLiteral("regionCountry")},
+        {RegionChildrenRole, QByteArrayLiteral("regionChildren")}
+    };
+}
+
+void RegionModel::setSortKey(const QString &sortKey)
+{
+    if(sortKey != _sortKey)
+    {
+        _sortKey = sortKey;
+        emit sortKeyChanged();
+        updateRows();
+    }
+}
+
+void RegionModel::setService(const QString &service)
+{
+    if(service != _service)
+    {
+        _service = service;
+        emit serviceChanged();
+        updateRows();
+    }
+}
+
+void RegionModel::setSearchTerm(const QString &searchTerm)
+{
+    if(searchTerm != _searchTerm)
+    {
+        _searchTerm = searchTerm;
+        emit searchTermChanged();
+        updateRows();
+    }
+}
+
+void RegionModel::setLocale(const QString &locale)
+{
+    if(locale != _locale)
+    {
+        _locale = locale;
+        _collator.setLocale(QLocale{_locale});
+        _collator.setCaseSensitivity(Qt::CaseInsensitive);
+        emit localeChanged();
+        updateRows();
+    }
+}
+
+void RegionModel::setLocationNames(const QVariantMap &locationNames)
+{
+    // QML re-evaluates the names whenever the locations change (including
+    // latency updates), ignore it if the names are the same
+    if(locationNames != _locationNames)
+    {
+        _locationNames = locationNames;
+        emit locationNamesChanged();
+        updateRows();
+    }
+}
+
+void RegionModel::setCountryNames(const QVariantMap &countryNames)
+{
+    if(countryNames != _countryNames)
+    {
+        _countryNames = countryNames;
+        emit countryNamesChanged();
+        updateRows();
+    }
+}
@@ -0,0 +1,147 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("regionmodel.h")
+
+#ifndef REGIONMODEL_H
+#define REGIONMODEL_H
+
+#include "settings.h"
+#include <QAbstractListModel>
+#include <QCollator>
+#include <QJsonArray>
+
+// RegionModel provides the rows displayed by RegionListView.  Each row is a
+// country - either a single region, or a group of regions in that country.
+//
+// The rows are built directly from DaemonState::groupedLocations(), then
+// filtered by service and search term and sorted by name or latency.  When the
+// daemon state changes, RegionModel diffs the new rows against the existing
+// ones and emits row insertions, removals, moves, and dataChanged() for the
+// individual rows that changed.  Latency updates just update (or move) the
+// affected rows, so the views' delegates are not recreated.  (Latency updates
+// are usually applied in place to the ServerLocations, which is observed with
+// NativeJsonObject::nestedPropertyChanged().)
+//
+// Display names are localized in QML (from the location metadata), so they are
+// provided by QML in locationNames and countryNames.
+class RegionModel : public QAbstractListModel
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("regionmodel")
+
+public:
+    enum Role : int
+    {
+        // The ServerLocation (as a JSON object) for a single region, or null
+        // for a country group
+        RegionRole = Qt::UserRole,
+        // The lowercase country code (for both single regions and groups)
+        RegionCountryRole,
+        // Array of objects with 'subregion' (the ServerLocation) for a country
+        // group, or an empty array for a single region.
+        RegionChildrenRole,
+    };
+
+public:
+    // Sort order - "latency" (the daemon's order) or "name"
+    Q_PROPERTY(QString sortKey READ sortKey WRITE setSortKey NOTIFY sortKeyChanged)
+    // Service required for a region to be listed - "vpn" (all regions) or
+    // "shadowsocks"
+    Q_PROPERTY(QString service READ service WRITE setService NOTIFY serviceChanged)
+    // Search term; regions are listed if their name contains the search term.
+    // Country groups are listed in their entirety if the country name matches.
+    Q_PROPERTY(QString searchTerm READ searchTerm WRITE setSearchTerm NOTIFY searchTermChanged)
+    // Locale used to sort by name
+    Q_PROPERTY(QString locale READ locale WRITE setLocale NOTIFY localeChanged)
+    // Localized location names by location ID.  Locations not found here use
+    // the server-provided name, or the ID as a last resort.
+    Q_PROPERTY(QVariantMap locationNames READ locationNames WRITE setLocationNames NOTIFY locationNamesChanged)
+    // Localized country names by lowercase country code.  Countries not found
+    // here use the uppercase country code.
+    Q_PROPERTY(QVariantMap countryNames READ countryNames WRITE setCountryNames NOTIFY countryNamesChanged)
+
+private:
+    struct Row
+    {
+        // Lowercase country code, identifies the row
+        QString country;
+        // Locations displayed in this row, in display order
+        QVector<QSharedPointer<ServerLocation>> locations;
+        // JSON representation of the locations, used to provide the row data
+        // and to detect changes.  (The ServerLocations can be modified in
+        // place by DaemonConnection, so they can't be compared directly.)
+        QJsonArray locationsJson;
+    };
+
+public:
+    RegionModel();
+
+private:
+    QString getLocationName(const ServerLocation &location) const;
+    QString getCountryName(const QString &countryCode) const;
+    bool matchesSearch(const QString &value) const;
+    bool hasService(const ServerLocation &location) const;
+    QString rowSortName(const Row &row) const;
+    QVector<Row> buildRows() const;
+    // Rebuild the rows and apply the differences to the model
+    void updateRows();
+    void onLocationsChanged();
+    void onStateNestedPropertyChanged(const QString &name);
+    void onIdleChanged();
+
+public:
+    // QAbstractItemModel overrides
+    virtual int rowCount(const QModelIndex &parent = {}) const override;
+    virtual QVariant data(const QModelIndex &index, int role) const override;
+    virtual QHash<int, QByteArray> roleNames() const override;
+
+    const QString &sortKey() const {return _sortKey;}
+    void setSortKey(const QString &sortKey);
+    const QString &service() const {return _service;}
+    void setService(const QString &service);
+    const QString &searchTerm() const {return _searchTerm;}
+    void setSearchTerm(const QString &searchTerm);
+    const QString &locale() const {return _locale;}
+    void setLocale(const QString &locale);
+    const QVariantMap &locationNames() const {return _locationNames;}
+    void setLocationNames(const QVariantMap &locationNames);
+    const QVariantMap &countryNames() const {return _countryNames;}
+    void setCountryNames(const QVariantMap &countryNames);
+
+signals:
+    void sortKeyChanged();
+    void serviceChanged();
+    void searchTermChanged();
+    void localeChanged();
+    void locationNamesChanged();
+    void countryNamesChanged();
+
+private:
+    QString _sortKey, _service, _searchTerm, _locale;
+    QVariantMap _locationNames, _countryNames;
+    QCollator _collator;
+    QVector<Row> _rows;
+    // Set while an update is queued for nested changes in DaemonState
+    bool _updateQueued = false;
+    // Set when the locations changed while the client was idle
+    bool _updateWhenActive = false;
+};
+
+#endif
@@ -19,6 +19,7 @@
 #include "common.h"
 #include "client.h"
 #include "splittunnelmanager.h"
+#include "appiconcache.h"
 #include "path.h"
 #include "semversion.h"
 
@@ -30,6 +31,7 @@
 #include "mac/mac_constants.h"
 #elif defined(Q_OS_WIN)
 #include "win/win_appscanner.h"
+#include "win/win_com.h"
 #include "win/win_linkreader.h"
 #include <VersionHelpers.h>
 #elif defined(Q_OS_LINUX)
@@ -39,18 +41,33 @@
 void SplitTunnelManager::installImageHandler(QQmlApplicationEngine *engine)
 {
 #if defined(Q_OS_MAC)
-    engine->addImageProvider(QStringLiteral("appicon"), new MacAppIconProvider);
+    std::unique_ptr<QQuickImageProvider> pProvider{new MacAppIconProvider};
 #elif defined(Q_OS_WIN)
-    engine->addImageProvider(QStringLiteral("appicon"), createWinAppIconProvider().release());
+    std::unique_ptr<QQuickImageProvider> pProvider{createWinAppIconProvider()};
 #else
-    engine->addImageProvider(QStringLiteral("appicon"), new DummyAppIconProvider);
+    std::unique_ptr<QQuickImageProvider> pProvider{new DummyAppIconProvider};
 #endif
+    // All platforms' icons are cached and loaded asynchronously
+    engine->addImageProvider(QStringLiteral("appicon"),
+                             new CachedAppIconProvider{std::move(pProvider)});
 }
 
 SplitTunnelManager::SplitTunnelManager()
 {
     _appScanner = AppScanner::create();
+    connect(_appScanner.get(), &AppScanner::applicationScanProgress, this, &SplitTunnelManager::applicationScanProgressed);
     connect(_appScanner.get(), &AppScanner::applicationScanComplete, this, &SplitTunnelManager::applicationScanCompleted);
+    connect(_appScanner.get(), &AppScanner::applicationsChanged, this, &SplitTunnelManager::applicationsChanged);
+
+#if defined(Q_OS_WIN)
+    // Reading app names uses shell COM objects.  The COM initializer is
+    // parented to the worker thread's object owner so it's destroyed before
+    // the thread terminates.
+    _inspectThread.queueOnThread([this]()
+    {
+        new WinComInit{&_inspectThread.objectOwner()};
+    });
+#endif
 }
 
 void SplitTunnelManager::scanApplications(bool force)
@@ -58,7 +75,9 @@ void SplitTunnelManager::scanApplications(bool force)
     if((force || _needsScan) && !_scanActive){
         _scanActive = true;
         emit scanActiveChanged(_scanActive);
-        _appScanner->scanApplications();
+        // If a refresh is already in progress, it'll complete this scan
+        if(!_refreshActive)
+            _appScanner->scanApplications();
     }
 }
 
@@ -105,6 +124,76 @@ QString SplitTunnelManager::readWinLinkTarget(const QString &path) const
     return {};
 }
 
+void SplitTunnelManager::inspectApps(const QStringList &paths)
+{
+    _inspectPaths = paths;
+
+    // Drop results for apps that are no longer listed
+    bool removed = false;
+    for(auto itInfo = _appInfo.begin(); itInfo != _appInfo.end();)
+    {
+        if(paths.contains(itInfo.key()))
+            ++itInfo;
+        else
+        {
+            itInfo = _appInfo.erase(itInfo);
+            removed = true;
+        }
+    }
+    if(removed)
+        emit appInfoChanged();
+
+    // Reading names can be slow (Windows shell links, macOS bundles), so do it
+    // on the worker thread.  Even paths that already have results are
+    // inspected again in case the app changed; the worker's cache makes this
+    // cheap when it hasn't.
+    _inspectThread.queueOnThread([this, paths]()
+    {
+        QJsonObject results;
+        for(const auto &path : paths)
+            results.insert(path, inspectApp(path));
+        QMetaObject::invokeMethod(this, [this, results]()
+            {inspectionCompleted(results);},
+            Qt::ConnectionType::QueuedConnection);
+    });
+}
+
+QJsonObject SplitTunnelManager::inspectApp(const QString &path)
+{
+    // Paths that aren't files (such as UWP app families) just have a 0
+    // modification time
+    QFileInfo info{path};
+    qint64 mtime = info.exists() ? info.lastModified().toMSecsSinceEpoch() : 0;
+    QString key = QStringLiteral("%1|%2").arg(path).arg(mtime);
+
+    auto itCached = _inspectCache.find(key);
+    if(itCached != _inspectCache.end())
+        return itCached.value();
+
+    QJsonObject result{{QStringLiteral("name"), getNameFromPath(path)},
+                       {QStringLiteral("valid"), validateCustomPath(path)}};
+    _inspectCache.insert(key, result);
+    return result;
+}
+
+void SplitTunnelManager::inspectionCompleted(const QJsonObject &results)
+{
+    bool changed = false;
+    for(auto itResult = results.begin(); itResult != results.end(); ++itResult)
+    {
+        // Ignore apps that were removed while this was in progress
+        if(!_inspectPaths.contains(itResult.key()))
+            continue;
+        if(_appInfo.value(itResult.key()) != itResult.value())
+        {
+            _appInfo.insert(itResult.key(), itResult.value());
+            changed = true;
+        }
+    }
+    if(changed)
+        emit appInfoChanged();
+}
+
 QString SplitTunnelManager::getLinuxNetClsPath() const
 {
 #if defined(Q_OS_LINUX)
@@ -123,11 +212,54 @@ QString SplitTunnelManager::getMacWebkitFrameworkPath() const
 #endif
 }
 
+void SplitTunnelManager::applicationScanProgressed(const QJsonArray &applications)
+{
+    // Keep showing the prior list during a refresh rather than dropping the
+    // entries that aren't found yet
+    if(_refreshActive && !_scanActive)
+        return;
+    // Show the partial results, but the scan is still active
+    _scannedApplications = applications;
+    emit applicationListChanged(_scannedApplications);
+}
+
 void SplitTunnelManager::applicationScanCompleted(const QJsonArray &applications)
 {
     _scannedApplications = applications;
     _needsScan = false;
-    _scanActive = false;
-    emit scanActiveChanged(_scanActive);
+    _refreshActive = false;
+    if(_scanActive)
+    {
+        _scanActive = false;
+        emit scanActiveChanged(_scanActive);
+    }
     emit applicationListChanged(_scannedApplications);
+
+    if(_refreshPending)
+    {
+        _refreshPending = false;
+        applicationsChanged();
+    }
+}
+
+void SplitTunnelManager::applicationsChanged()
+{
+    _needsScan = true;
+    // If a scan is already running, it might have missed the changes, so
+    // refresh again once it's done
+    if(_scanActive || _refreshActive)
+    {
+        _refreshPending = true;
+        return;
+    }
+    // If the apps haven't been listed yet, the first scan will find the
+    // changes
+    if(_scannedApplications.isEmpty())
+        return;
+
+    // Refresh the list in the background so it's current the next time it's
+    // shown.  Links that are unchanged reuse their names from the scan index.
+    qInfo() << "Applications changed, refreshing app list";
+    _refreshActive = true;
+    _appScanner->scanApplications();
 }
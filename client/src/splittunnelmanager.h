@@ -19,6 +19,7 @@
 #include "common.h"
 #include "appscanner.h"
 #include "clientsettings.h"
+#include "thread.h"
 
 #include <QQmlApplicationEngine>
 
@@ -38,6 +39,12 @@ private:
     QJsonArray _scannedApplications;
     bool _needsScan = true;
     bool _scanActive = false;
+    // A scan started by applicationsChanged() (to refresh an app list that
+    // was already shown) is in progress.  Its partial results aren't shown,
+    // and it doesn't set scanActive unless a scan is requested meanwhile.
+    bool _refreshActive = false;
+    // Applications changed during a scan, refresh again when it completes
+    bool _refreshPending = false;
 
 public:
     static void installImageHandler (QQmlApplicationEngine *engine);
@@ -48,9 +55,18 @@ public:
     // On Windows only, read the target of a shell link.  Returns an empty
     // string on other platforms.  (See SplitTunnelRule::linkTarget.)
     Q_INVOKABLE QString readWinLinkTarget(const QString &path) const;
+    // Inspect the executables at these paths on a worker thread, and publish
+    // their names and validity in appInfo when done.  Results are cached by
+    // path and modification time, so unchanged apps aren't inspected again.
+    // Paths not in the list are removed from appInfo.
+    Q_INVOKABLE void inspectApps(const QStringList &paths);
 
     Q_PROPERTY(QJsonArray scannedApplications READ getScannedApplications NOTIFY applicationListChanged)
     Q_PROPERTY(bool scanActive READ getScanActive NOTIFY scanActiveChanged)
+    // Inspection results from inspectApps() - maps each path to an object
+    // with 'name' (string) and 'valid' (bool).  Paths that haven't been
+    // inspected yet are not present.
+    Q_PROPERTY(QJsonObject appInfo READ getAppInfo NOTIFY appInfoChanged)
     Q_PROPERTY(QString linuxNetClsPath READ getLinuxNetClsPath CONSTANT)
     Q_PROPERTY(QString macWebkitFrameworkPath READ getMacWebkitFrameworkPath CONSTANT)
 
@@ -63,19 +79,38 @@ public:
         return _scanActive;
     }
 
+    const QJsonObject &getAppInfo() const {return _appInfo;}
+
     QString getLinuxNetClsPath() const;
 
     QString getMacWebkitFrameworkPath () const;
 
 protected:
+    void applicationScanProgressed (const QJsonArray &applications);
     void applicationScanCompleted (const QJsonArray &applications);
+    void applicationsChanged();
+
+private:
+    // Inspect one app on the worker thread, using _inspectCache
+    QJsonObject inspectApp(const QString &path);
+    // Merge inspection results on the main thread
+    void inspectionCompleted(const QJsonObject &results);
 
 signals:
     void applicationListChanged(QJsonArray scannedApplications);
     void scanActiveChanged(bool scanActive);
+    void appInfoChanged();
 
 private:
     nullable_t<QJsonArray> _splitTunnelErrors;
+    // Paths requested by the last inspectApps() call; results for other paths
+    // are discarded when they arrive.
+    QStringList _inspectPaths;
+    QJsonObject _appInfo;
+    // Inspection results keyed by "path|mtime"; only used on _inspectThread.
+    QHash<QString, QJsonObject> _inspectCache;
+    // Last so it's stopped before the other members are destroyed
+    RunningWorkerThread _inspectThread;
 };
 
 #endif
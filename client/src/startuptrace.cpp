@@ -0,0 +1,91 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("startuptrace.cpp")
+
+#include "startuptrace.h"
+#include "tracing.h"
+
+namespace
+{
+    const char *milestoneName(StartupTrace::Milestone milestone)
+    {
+        switch(milestone)
+        {
+            case StartupTrace::Milestone::SplashShown:
+                return "splash shown";
+            case StartupTrace::Milestone::DaemonData:
+                return "first daemon data";
+            case StartupTrace::Milestone::DashboardReady:
+                return "dashboard ready";
+        }
+        return "unknown";
+    }
+}
+
+QElapsedTimer StartupTrace::_timer;
+QVector<qint64> StartupTrace::_milestoneTimes;
+qint64 StartupTrace::_revealStart{-1};
+
+void StartupTrace::begin()
+{
+    // Logging isn't set up yet this early, so this doesn't log anything; the
+    // milestones are logged relative to this point.
+    _timer.start();
+    _milestoneTimes.clear();
+}
+
+void StartupTrace::mark(Milestone milestone)
+{
+    // Ignore milestones reached again later (reconnecting to the daemon, etc.)
+    // and milestones out of order (which would mean begin() wasn't called).
+    int index = static_cast<int>(milestone);
+    if(!_timer.isValid() || _milestoneTimes.size() != index)
+        return;
+
+    qint64 elapsed = _timer.elapsed();
+    qint64 previous = _milestoneTimes.isEmpty() ? 0 : _milestoneTimes.last();
+    _milestoneTimes.push_back(elapsed);
+    Tracer::instant("client", QString::fromLatin1(milestoneName(milestone)));
+    qInfo().nospace() << milestoneName(milestone) << " at " << elapsed
+        << " ms (+" << (elapsed - previous) << " ms)";
+
+    if(milestone == Milestone::DashboardReady)
+    {
+        qInfo().nospace() << "Startup: splash " << _milestoneTimes[0]
+            << " ms, daemon data " << _milestoneTimes[1] << " ms, dashboard "
+            << _milestoneTimes[2] << " ms";
+    }
+}
+
+void StartupTrace::beginDashboardReveal()
+{
+    _revealStart = Tracer::now();
+}
+
+void StartupTrace::endDashboardReveal()
+{
+    if(_revealStart < 0)
+        return;
+
+    qint64 duration = Tracer::now() - _revealStart;
+    Tracer::complete("client", QStringLiteral("dashboard reveal"), _revealStart,
+                     duration);
+    _revealStart = -1;
+    qInfo().nospace() << "Dashboard revealed in " << (duration / 1000) << " ms";
+}
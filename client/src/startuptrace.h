@@ -0,0 +1,66 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("startuptrace.h")
+
+#ifndef STARTUPTRACE_H
+#define STARTUPTRACE_H
+
+#include <QElapsedTimer>
+#include <QVector>
+
+// StartupTrace records the time taken to reach each milestone of client
+// startup, and logs a summary once the dashboard is ready.  This is logged on
+// every launch so cold start regressions show up in ordinary diagnostics.
+//
+// The milestones are always reached in this order; each is only recorded the
+// first time it's reached.
+class StartupTrace
+{
+    CLASS_LOGGING_CATEGORY("startup")
+
+public:
+    enum class Milestone
+    {
+        SplashShown,
+        DaemonData,
+        DashboardReady,
+    };
+
+public:
+    // Start the trace - called first thing in clientMain(), as the nearest
+    // portable approximation of process start.
+    static void begin();
+    // Record a milestone.  Has no effect if it was already recorded.
+    static void mark(Milestone milestone);
+
+    // Measure the time taken to reveal the dashboard - begin when it's shown
+    // (such as from a tray click) and end when its next frame is presented.
+    // Traced and logged for every reveal, not just the first one.
+    static void beginDashboardReveal();
+    static void endDashboardReveal();
+
+private:
+    static QElapsedTimer _timer;
+    static QVector<qint64> _milestoneTimes;
+    // Tracer::now() timestamp when the pending reveal began, or -1 if there
+    // isn't one
+    static qint64 _revealStart;
+};
+
+#endif
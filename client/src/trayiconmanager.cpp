@@ -35,12 +35,25 @@ TrayMetrics::TrayMetrics(const QRect &trayIconBound, const QRect &screenBound,
 {
 }
 
+namespace
+{
+    // Changes to the native tray icon are applied after this delay, so bursts
+    // of changes (such as the icon, tooltip and menu all changing due to one
+    // state change) update the native icon once.
+    const std::chrono::milliseconds nativeUpdateDelay{100};
+}
+
 TrayIconManager::TrayIconManager(QObject *parent)
-    : NativeTrayIconState{parent}, _icon{IconState::Disconnected}
+    : NativeTrayIconState{parent}, _icon{IconState::Disconnected},
+      _iconPending{false}, _toolTipPending{false}, _menuItemsPending{false}
 {
     auto settings = Client::instance()->getInterface()->get_settings();
     _iconSet = settings->iconSet();
     _pTrayIcon = NativeTray::create(_icon, _iconSet);
+    _nativeUpdateTimer.setSingleShot(true);
+    _nativeUpdateTimer.setInterval(msec(nativeUpdateDelay));
+    connect(&_nativeUpdateTimer, &QTimer::timeout, this,
+            &TrayIconManager::applyNativeUpdates);
     connect(_pTrayIcon.get(), &NativeTray::leftClicked, this,
             &TrayIconManager::onLeftClicked);
     connect(_pTrayIcon.get(), &NativeTray::menuItemSelected, this,
@@ -54,9 +67,9 @@ void TrayIconManager::setIcon(IconState iconState)
 {
     if(iconState != _icon)
     {
-        Q_ASSERT(_pTrayIcon);   // Class invariant
         _icon = iconState;
-        _pTrayIcon->setIconState(iconState, _iconSet);
+        _iconPending = true;
+        scheduleNativeUpdate();
         emit iconChanged();
     }
 }
@@ -66,7 +79,8 @@ void TrayIconManager::setToolTip(const QString& toolTip)
     if (toolTip != _toolTip)
     {
         _toolTip = toolTip;
-        _pTrayIcon->setToolTip(toolTip);
+        _toolTipPending = true;
+        scheduleNativeUpdate();
         emit toolTipChanged();
     }
 }
@@ -75,6 +89,8 @@ void TrayIconManager::showMessage(IconState notificationIcon,
                                   const QString &title,
                                   const QString &subtitle)
 {
+    // Bring the icon up to date first so it's consistent with the message
+    applyNativeUpdates();
     _pTrayIcon->showNotification(notificationIcon, title, subtitle);
 }
 
@@ -88,8 +104,37 @@ void TrayIconManager::setMenuItems(const QJsonArray& items)
     if (items != _menuItems)
     {
         _menuItems = items;
+        _menuItemsPending = true;
+        scheduleNativeUpdate();
+    }
+}
+
+void TrayIconManager::scheduleNativeUpdate()
+{
+    if(!_nativeUpdateTimer.isActive())
+        _nativeUpdateTimer.start();
+}
+
+void TrayIconManager::applyNativeUpdates()
+{
+    Q_ASSERT(_pTrayIcon);   // Class invariant
+
+    _nativeUpdateTimer.stop();
+    if(_iconPending)
+    {
+        _iconPending = false;
+        _pTrayIcon->setIconState(_icon, _iconSet);
+    }
+    if(_toolTipPending)
+    {
+        _toolTipPending = false;
+        _pTrayIcon->setToolTip(_toolTip);
+    }
+    if(_menuItemsPending)
+    {
+        _menuItemsPending = false;
         NativeMenuItem::List list;
-        if (json_cast(items, list))
+        if (json_cast(_menuItems, list))
             _pTrayIcon->setMenuItems(list);
     }
 }
@@ -155,8 +200,8 @@ void TrayIconManager::onIconSetChanged()
     auto settings = Client::instance()->getInterface()->get_settings();
     if(settings->iconSet() != _iconSet)
     {
-        Q_ASSERT(_pTrayIcon);   // Class invariant
         _iconSet = settings->iconSet();
-        _pTrayIcon->setIconState(_icon, _iconSet);
+        _iconPending = true;
+        scheduleNativeUpdate();
     }
 }
@@ -24,6 +24,7 @@
 
 #include <QObject>
 #include <QRect>
+#include <QTimer>
 #include "nativetray.h"
 
 // TrayMetrics contains the information about the tray icon that the dashboard
@@ -79,6 +80,10 @@ private:
     std::unique_ptr<NativeTray> _pTrayIcon;
     QJsonArray _menuItems;
     QString _iconSet;
+    // Changes are applied to the native tray icon in batches; these indicate
+    // which values have changed since they were last applied.
+    QTimer _nativeUpdateTimer;
+    bool _iconPending, _toolTipPending, _menuItemsPending;
 
 public:
     explicit TrayIconManager(QObject *parent = nullptr);
@@ -103,6 +108,8 @@ public:
 private:
     std::unique_ptr<TrayMetrics> buildIconMetrics(const QRect &iconBound,
                                                   qreal screenScale) const;
+    void scheduleNativeUpdate();
+    void applyNativeUpdates();
 
 signals:
     // The tray icon was clicked.  Includes a TrayMetrics containing the icon
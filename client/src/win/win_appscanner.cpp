@@ -30,7 +30,10 @@
 #include <QtWin>
 #include <QDirIterator>
 #include <QMutex>
+#include <QFile>
+#include <QJsonDocument>
 #include <array>
+#include <limits>
 #include <variant>
 #include <cstddef>
 #include <ShlObj.h>
@@ -183,6 +186,17 @@ namespace
         return folderNames;
     }
 
+    // LinkScanner keeps an index of the shortcuts it has read, keyed by path
+    // and validated using the link's modification time.  Reading a link's
+    // target and finding the localized names are the slow parts of a scan;
+    // these are skipped for links that haven't changed since the last scan.
+    //
+    // The index is a JSON object mapping link paths to objects with:
+    // - "mtime": link modification time (ms since epoch)
+    // - "target": canonical target path, or "" if the link can't be used
+    // - "args": argument length (absent if not known)
+    // - "name"/"folders": display name and folder names (absent if the link
+    //   hadn't been shown yet)
     class LinkScanner
     {
     public:
@@ -198,27 +212,42 @@ namespace
         };
 
     public:
-        LinkScanner();
+        // Create LinkScanner with the index from a prior scan (can be empty).
+        LinkScanner(QJsonObject priorIndex);
 
     private:
         std::wstring canonicalizePath(const wchar_t *pPath);
+        // Read a link's canonical target and argument length - returns an
+        // empty target if the link can't be used.
+        std::wstring readLinkTarget(const QFileInfo &link, std::size_t &argsLength);
         void readLink(const QString &baseFolderPath, const QFileInfo &link);
 
     public:
         void scanDirectory(REFKNOWNFOLDERID folderId);
+        // After scanning folders, get every folder that was scanned
+        // (including subdirectories with no links), so they can be watched.
+        const QStringList &scannedFolders() const {return _scannedFolders;}
         // After scanning folders, build the JSON array of apps.
-        QJsonArray buildAppsArray() const;
+        QJsonArray buildAppsArray();
+        // Get the index after scanning - contains the links found by this
+        // scan.
+        const QJsonObject &index() const {return _index;}
 
     private:
         WinLinkReader _reader;
+        // Index from the prior scan, and the index being built by this scan
+        QJsonObject _priorIndex, _index;
         // Canonicalized app installation directory (used to exclude PIA itself)
         std::wstring _piaBasePath;
         // Map of found apps by the target name.  Keys are the _canonicalize_
         // target paths.
         std::unordered_map<std::wstring, ScannedApp> _apps;
+        // Folders scanned by scanDirectory()
+        QStringList _scannedFolders;
     };
 
-    LinkScanner::LinkScanner()
+    LinkScanner::LinkScanner(QJsonObject priorIndex)
+        : _priorIndex{std::move(priorIndex)}
     {
         // Native separators to match canonicalized paths
         QString instDirNative = QDir::toNativeSeparators(Path::InstallationDir);
@@ -256,19 +285,19 @@ namespace
         return canonicalPath;
     }
 
-    void LinkScanner::readLink(const QString &baseFolderPath, const QFileInfo &link)
+    std::wstring LinkScanner::readLinkTarget(const QFileInfo &link, std::size_t &argsLength)
     {
         if(!_reader.loadLink(link.filePath()))
-            return;
+            return {};
 
         std::wstring targetPath = _reader.getLinkTarget(link.filePath());
         if(targetPath.empty())
-            return;
+            return {};
 
         // Canonicalize the target path
         std::wstring canonicalTarget{canonicalizePath(targetPath.c_str())};
         if(canonicalTarget.empty())
-            return; // Traced by canonicalizePath()
+            return {}; // Traced by canonicalizePath()
 
         // QStringView provides endsWith()
         QStringView canonicalQstr{canonicalTarget.c_str(), static_cast<qsizetype>(canonicalTarget.size())};
@@ -277,12 +306,49 @@ namespace
         if(!canonicalQstr.endsWith(QStringLiteral(".exe"), Qt::CaseSensitivity::CaseInsensitive) ||
            canonicalQstr.startsWith(_piaBasePath.c_str(), Qt::CaseSensitivity::CaseInsensitive))
         {
-            return; // Not an executable, can't do anything with this.
+            return {}; // Not an executable, can't do anything with this.
         }
 
         // Get the argument length - if it fails that's fine, just use the
         // default max value
-        std::size_t argsLength = _reader.getArgsLength(link.filePath());
+        argsLength = _reader.getArgsLength(link.filePath());
+        return canonicalTarget;
+    }
+
+    void LinkScanner::readLink(const QString &baseFolderPath, const QFileInfo &link)
+    {
+        const QString &linkPath = link.filePath();
+        double mtime = static_cast<double>(link.lastModified().toMSecsSinceEpoch());
+
+        std::wstring canonicalTarget;
+        std::size_t argsLength{std::numeric_limits<std::size_t>::max()};
+        QJsonObject entry = _priorIndex.value(linkPath).toObject();
+        QString priorTarget = entry.value(QStringLiteral("target")).toString();
+        // Use the prior result if the link hasn't changed (and the target
+        // still exists, in case an app was removed without its shortcut)
+        if(!entry.isEmpty() && entry.value(QStringLiteral("mtime")).toDouble() == mtime &&
+           (priorTarget.isEmpty() || QFileInfo::exists(priorTarget)))
+        {
+            canonicalTarget = priorTarget.toStdWString();
+            const auto &argsValue = entry.value(QStringLiteral("args"));
+            if(argsValue.isDouble())
+                argsLength = static_cast<std::size_t>(argsValue.toInt());
+        }
+        else
+        {
+            canonicalTarget = readLinkTarget(link, argsLength);
+            // This is a new or changed link; the display name and folders
+            // will be found again if it's shown
+            entry = {};
+            entry.insert(QStringLiteral("mtime"), mtime);
+            entry.insert(QStringLiteral("target"), QString::fromStdWString(canonicalTarget));
+            if(argsLength != std::numeric_limits<std::size_t>::max())
+                entry.insert(QStringLiteral("args"), static_cast<int>(argsLength));
+        }
+        _index.insert(linkPath, entry);
+
+        if(canonicalTarget.empty())
+            return;
 
         // Do we already have an app for this target?
         auto itExistingApp = _apps.find(canonicalTarget);
@@ -331,9 +397,17 @@ namespace
             dirIter.next();
             readLink(folderPath, dirIter.fileInfo());
         }
+
+        // Directory watches aren't recursive, so find all the subdirectories
+        // too
+        _scannedFolders.push_back(folderPath);
+        QDirIterator subdirIter{folderPath, QDir::Filter::Dirs|QDir::Filter::NoDotAndDotDot,
+                                QDirIterator::IteratorFlag::Subdirectories};
+        while(subdirIter.hasNext())
+            _scannedFolders.push_back(subdirIter.next());
     }
 
-    QJsonArray LinkScanner::buildAppsArray() const
+    QJsonArray LinkScanner::buildAppsArray()
     {
         QJsonArray appsArray;
         for(const auto &app : _apps)
@@ -343,14 +417,31 @@ namespace
             // of backslashes).  ::PathRelativePathToW() also fails.
             QString linkPath = QDir::toNativeSeparators(app.second._link.filePath());
 
-            QString displayName{getLinkDisplayName(app.second._link, linkPath)};
-            // Windows apps are frequently cluttered with shortcuts to "help",
-            // "uninstall", etc. that don't make much sense if they're sorted
-            // away from the app they correspond to.  We can't reliably filter
-            // these out, but sort apps using folder names to keep them
-            // together in the list.
-            // In the future, we might display these folder names in some way.
-            QStringList folders{getFolderNames(app.second._basePath, linkPath)};
+            // Use the names from the index if they were found for this
+            // version of the link
+            QJsonObject entry = _index.value(app.second._link.filePath()).toObject();
+            QString displayName = entry.value(QStringLiteral("name")).toString();
+            QStringList folders;
+            if(!displayName.isEmpty())
+            {
+                for(const auto &folder : entry.value(QStringLiteral("folders")).toArray())
+                    folders.push_back(folder.toString());
+            }
+            else
+            {
+                displayName = getLinkDisplayName(app.second._link, linkPath);
+                // Windows apps are frequently cluttered with shortcuts to
+                // "help", "uninstall", etc. that don't make much sense if
+                // they're sorted away from the app they correspond to.  We
+                // can't reliably filter these out, but sort apps using folder
+                // names to keep them together in the list.
+                // In the future, we might display these folder names in some
+                // way.
+                folders = getFolderNames(app.second._basePath, linkPath);
+                entry.insert(QStringLiteral("name"), displayName);
+                entry.insert(QStringLiteral("folders"), QJsonArray::fromStringList(folders));
+                _index.insert(app.second._link.filePath(), entry);
+            }
             appsArray.append(SystemApplication{linkPath, std::move(displayName),
                                                std::move(folders)}.toJsonObject());
         }
@@ -591,22 +682,47 @@ namespace
 void WinAppScanner::scanOnThread(WinAppScanner *pScanner)
 {
     QJsonArray nativeApps;
+    QStringList scannedFolders;
 
     try
     {
-        LinkScanner scanner;
+        // Load the index from the last scan, if there is one
+        QJsonObject priorIndex;
+        QFile indexFile{Path::ClientAppScanIndexFile};
+        if(indexFile.open(QIODevice::ReadOnly))
+            priorIndex = QJsonDocument::fromJson(indexFile.readAll()).object();
+        indexFile.close();
+
+        LinkScanner scanner{std::move(priorIndex)};
 
         // Scan programs in the global start menu
         scanner.scanDirectory(FOLDERID_CommonPrograms);
         // Scan programs in this user's start menu
         scanner.scanDirectory(FOLDERID_Programs);
         nativeApps = scanner.buildAppsArray();
+        scannedFolders = scanner.scannedFolders();
+
+        // Save the index for the next scan.  This only contains the links
+        // found by this scan, so removed links are dropped.
+        if(indexFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            indexFile.write(QJsonDocument{scanner.index()}.toJson(QJsonDocument::Compact));
+        else
+            qWarning() << "Unable to write app scan index" << Path::ClientAppScanIndexFile;
     }
     catch(const Error &ex)
     {
         qWarning() << "Unable to scan applications:" << ex;
     }
 
+    // The native apps can be shown now; UWP apps take longer to find since
+    // the daemon has to inspect them
+    QMetaObject::invokeMethod(pScanner,
+        [pScanner, nativeApps, scannedFolders = std::move(scannedFolders)]()
+        {
+            pScanner->updateWatchDirs(scannedFolders);
+            emit pScanner->applicationScanProgress(nativeApps);
+        }, Qt::ConnectionType::QueuedConnection);
+
     auto uwpApps = getWinRtSupport().getUwpApps();
 
     // Finished scanning the applications, finalize and emit on main thread
@@ -619,6 +735,13 @@ void WinAppScanner::scanOnThread(WinAppScanner *pScanner)
 
 WinAppScanner::WinAppScanner()
 {
+    _folderChangeTimer.setSingleShot(true);
+    _folderChangeTimer.setInterval(2000);
+    connect(&_folderChangeTimer, &QTimer::timeout, this,
+            &WinAppScanner::applicationsChanged);
+    connect(&_folderWatcher, &QFileSystemWatcher::directoryChanged, this,
+            [this](){_folderChangeTimer.start();});
+
     // Initialize COM on the worker thread.
     _workerThread.invokeOnThread([this]()
     {
@@ -636,6 +759,26 @@ void WinAppScanner::scanApplications()
     _workerThread.queueOnThread([this](){scanOnThread(this);});
 }
 
+void WinAppScanner::updateWatchDirs(const QStringList &dirs)
+{
+    QStringList oldDirs = _folderWatcher.directories();
+    QStringList removedDirs, addedDirs;
+    for(const auto &dir : oldDirs)
+    {
+        if(!dirs.contains(dir))
+            removedDirs.push_back(dir);
+    }
+    for(const auto &dir : dirs)
+    {
+        if(!oldDirs.contains(dir))
+            addedDirs.push_back(dir);
+    }
+    if(!removedDirs.isEmpty())
+        _folderWatcher.removePaths(removedDirs);
+    if(!addedDirs.isEmpty())
+        _folderWatcher.addPaths(addedDirs);
+}
+
 void WinAppScanner::completeScan(QJsonArray nativeApps,
                                  std::vector<EnumeratedUwpApp> uwpApps)
 {
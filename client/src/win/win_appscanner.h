@@ -25,6 +25,8 @@
 #include "../appscanner.h"
 #include "../../extras/winrtsupport/src/winrtsupport.h"
 #include "../thread.h"
+#include <QFileSystemWatcher>
+#include <QTimer>
 
 class WinAppScanner : public AppScanner
 {
@@ -46,11 +48,17 @@ private:
     // apps and add them, which must occur on the main thread.
     void completeScan(QJsonArray nativeApps,
                       std::vector<EnumeratedUwpApp> uwpApps);
+    // Watch the Start Menu folders found by the last scan.  Changes to them
+    // signal applicationsChanged() (after a short delay, since installers
+    // usually create or remove several links).
+    void updateWatchDirs(const QStringList &dirs);
 
 public:
     virtual void scanApplications() override;
 
 private:
+    QFileSystemWatcher _folderWatcher;
+    QTimer _folderChangeTimer;
     RunningWorkerThread _workerThread;
 };
 
@@ -0,0 +1,349 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("clientapi.cpp")
+
+#include "clientapi.h"
+#include "brand.h"
+#include "daemonconnection.h"
+#include "path.h"
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <memory>
+#include <thread>
+
+namespace
+{
+    // Key of a property in pia_client::_values - "object/property"
+    QString propertyKey(const QString &object, const QString &property)
+    {
+        return object + QLatin1Char('/') + property;
+    }
+
+    struct Watch
+    {
+        QString object;
+        QString property;
+        pia_change_callback callback;
+        void *context;
+    };
+}
+
+// The client's state is shared between the caller's threads (which only read
+// _values/_watchedKeys/_connected under _mutex) and the client thread, which
+// owns the DaemonConnection.
+struct pia_client
+{
+    CLASS_LOGGING_CATEGORY("clientapi")
+
+public:
+    pia_client() : _connected{false}, _pLoop{nullptr}, _pConnection{nullptr} {}
+
+    // Start the client thread and wait for it to connect its signals
+    void start();
+    // Stop the client thread and wait for it to exit
+    void stop();
+
+    bool isConnected();
+    pia_result watch(const QString &object, const QString &property,
+                     pia_change_callback callback, void *context);
+    // Get the last value received for a property.  Objects and arrays are
+    // stored as empty values of that type, since they can't be read anyway.
+    pia_result getValue(const char *object, const char *property, QJsonValue &value);
+
+private:
+    // Body of the client thread
+    void run(std::promise<void> &started);
+    // Store the current value of a property (on the client thread)
+    void storeValue(const QString &objectName, const NativeJsonObject &object,
+                    const QString &property);
+    void connectObject(const QString &objectName, NativeJsonObject &object);
+
+private:
+    std::thread _thread;
+
+    QMutex _mutex;
+    QHash<QString, QJsonValue> _values;
+    QSet<QString> _watchedKeys;
+    bool _connected;
+
+    // These are only used on the client thread
+    QEventLoop *_pLoop;
+    DaemonConnection *_pConnection;
+    QVector<Watch> _watches;
+};
+
+void pia_client::start()
+{
+    std::promise<void> started;
+    auto startedFuture = started.get_future();
+    _thread = std::thread{[this, &started](){run(started);}};
+    startedFuture.wait();
+}
+
+void pia_client::stop()
+{
+    QMetaObject::invokeMethod(_pLoop, &QEventLoop::quit, Qt::QueuedConnection);
+    _thread.join();
+}
+
+void pia_client::run(std::promise<void> &started)
+{
+    // Hosts that don't use Qt don't have an application object.  Qt requires
+    // one for event loops, so create one on this thread and set up the paths
+    // like the other client executables do.
+    static int dummyArgc{1};
+    static char dummyArg0[]{BRAND_CODE "-clientapi"};
+    static char *dummyArgv[]{dummyArg0, nullptr};
+    std::unique_ptr<QCoreApplication> pApp;
+    if(!QCoreApplication::instance())
+    {
+        Path::initializePreApp();
+        pApp.reset(new QCoreApplication{dummyArgc, dummyArgv});
+        Path::initializePostApp();
+    }
+
+    QEventLoop loop;
+    DaemonConnection connection;
+    _pLoop = &loop;
+    _pConnection = &connection;
+
+    connectObject(QStringLiteral("data"), connection.data);
+    connectObject(QStringLiteral("account"), connection.account);
+    connectObject(QStringLiteral("settings"), connection.settings);
+    connectObject(QStringLiteral("state"), connection.state);
+    QObject::connect(&connection, &DaemonConnection::connectedChanged, &loop,
+        [this](bool connected)
+        {
+            QMutexLocker lock{&_mutex};
+            _connected = connected;
+        });
+    QObject::connect(&connection, &DaemonConnection::error, &loop,
+        [](const Error &error){qWarning() << error.errorString();});
+
+    connection.connectToDaemon();
+    started.set_value();
+
+    loop.exec();
+
+    _pConnection = nullptr;
+    _pLoop = nullptr;
+}
+
+void pia_client::connectObject(const QString &objectName, NativeJsonObject &object)
+{
+    // Start with the default values - properties that the daemon doesn't
+    // change from their defaults never emit a change.
+    const QJsonObject &defaults = object.toJsonObject();
+    for(auto itProperty = defaults.begin(); itProperty != defaults.end(); ++itProperty)
+        storeValue(objectName, object, itProperty.key());
+
+    QObject::connect(&object, &NativeJsonObject::propertyChanged, _pLoop,
+        [this, objectName, &object](const QString &property)
+        {
+            storeValue(objectName, object, property);
+            const QByteArray &objectUtf8 = objectName.toUtf8();
+            const QByteArray &propertyUtf8 = property.toUtf8();
+            for(const auto &watch : _watches)
+            {
+                if(watch.callback && watch.object == objectName && watch.property == property)
+                    watch.callback(watch.context, objectUtf8.data(), propertyUtf8.data());
+            }
+        });
+}
+
+void pia_client::storeValue(const QString &objectName, const NativeJsonObject &object,
+                            const QString &property)
+{
+    QJsonValue value = object.get(property);
+    if(value.isObject())
+        value = QJsonObject{};
+    else if(value.isArray())
+        value = QJsonArray{};
+    QMutexLocker lock{&_mutex};
+    _values.insert(propertyKey(objectName, property), value);
+}
+
+bool pia_client::isConnected()
+{
+    QMutexLocker lock{&_mutex};
+    return _connected;
+}
+
+pia_result pia_client::watch(const QString &object, const QString &property,
+                             pia_change_callback callback, void *context)
+{
+    // Callbacks run on the client thread, and they can watch other properties
+    auto connectionType = QThread::currentThread() == _pLoop->thread() ?
+        Qt::DirectConnection : Qt::BlockingQueuedConnection;
+    QMetaObject::invokeMethod(_pLoop, [&]()
+        {
+            _watches.push_back({object, property, callback, context});
+
+            QHash<QString, QJsonArray> watchedProperties;
+            for(const auto &watch : _watches)
+            {
+                QJsonArray &properties = watchedProperties[watch.object];
+                if(!properties.contains(watch.property))
+                    properties.append(watch.property);
+            }
+            QJsonObject subscriptions;
+            for(auto itObject = watchedProperties.begin(); itObject != watchedProperties.end(); ++itObject)
+                subscriptions.insert(itObject.key(), itObject.value());
+            _pConnection->subscribe(subscriptions);
+
+            QMutexLocker lock{&_mutex};
+            _watchedKeys.insert(propertyKey(object, property));
+        }, connectionType);
+    return PIA_OK;
+}
+
+pia_result pia_client::getValue(const char *object, const char *property, QJsonValue &value)
+{
+    if(!object || !property)
+        return PIA_ERROR_INVALID;
+
+    const QString &key = propertyKey(QString::fromUtf8(object), QString::fromUtf8(property));
+    QMutexLocker lock{&_mutex};
+    if(!_watchedKeys.isEmpty() && !_watchedKeys.contains(key))
+        return PIA_ERROR_NOT_WATCHED;
+    auto itValue = _values.find(key);
+    if(itValue == _values.end() || itValue->isUndefined())
+        return PIA_ERROR_NOT_FOUND;
+    value = itValue.value();
+    return value.isNull() ? PIA_ERROR_NULL : PIA_OK;
+}
+
+pia_client *pia_client_create(void)
+{
+    try
+    {
+        std::unique_ptr<pia_client> pClient{new pia_client{}};
+        pClient->start();
+        return pClient.release();
+    }
+    catch(const std::exception &ex)
+    {
+        qWarning() << "Can't start client API thread:" << ex.what();
+        return nullptr;
+    }
+}
+
+void pia_client_destroy(pia_client *client)
+{
+    if(!client)
+        return;
+    client->stop();
+    delete client;
+}
+
+int pia_client_is_connected(pia_client *client)
+{
+    return client && client->isConnected();
+}
+
+pia_result pia_client_watch(pia_client *client, const char *object,
+                            const char *property, pia_change_callback callback,
+                            void *context)
+{
+    if(!client || !object || !property)
+        return PIA_ERROR_INVALID;
+    return client->watch(QString::fromUtf8(object), QString::fromUtf8(property),
+                         callback, context);
+}
+
+pia_result pia_client_get_bool(pia_client *client, const char *object,
+                               const char *property, int *value)
+{
+    if(!client || !value)
+        return PIA_ERROR_INVALID;
+    QJsonValue jsonValue;
+    pia_result result = client->getValue(object, property, jsonValue);
+    if(result != PIA_OK)
+        return result;
+    if(!jsonValue.isBool())
+        return PIA_ERROR_TYPE;
+    *value = jsonValue.toBool();
+    return PIA_OK;
+}
+
+pia_result pia_client_get_int64(pia_client *client, const char *object,
+                                const char *property, int64_t *value)
+{
+    if(!client || !value)
+        return PIA_ERROR_INVALID;
+    QJsonValue jsonValue;
+    pia_result result = client->getValue(object, property, jsonValue);
+    if(result != PIA_OK)
+        return result;
+    // JSON numbers are doubles; only accept integral values that fit
+    double number = jsonValue.toDouble();
+    if(!jsonValue.isDouble() || std::trunc(number) != number ||
+       number < static_cast<double>(std::numeric_limits<int64_t>::min()) ||
+       number >= static_cast<double>(std::numeric_limits<int64_t>::max()))
+    {
+        return PIA_ERROR_TYPE;
+    }
+    *value = static_cast<int64_t>(number);
+    return PIA_OK;
+}
+
+pia_result pia_client_get_double(pia_client *client, const char *object,
+                                 const char *property, double *value)
+{
+    if(!client || !value)
+        return PIA_ERROR_INVALID;
+    QJsonValue jsonValue;
+    pia_result result = client->getValue(object, property, jsonValue);
+    if(result != PIA_OK)
+        return result;
+    if(!jsonValue.isDouble())
+        return PIA_ERROR_TYPE;
+    *value = jsonValue.toDouble();
+    return PIA_OK;
+}
+
+pia_result pia_client_get_string(pia_client *client, const char *object,
+                                 const char *property, char *buffer,
+                                 size_t *size)
+{
+    if(!client || !size || (!buffer && *size))
+        return PIA_ERROR_INVALID;
+    QJsonValue jsonValue;
+    pia_result result = client->getValue(object, property, jsonValue);
+    if(result != PIA_OK)
+        return result;
+    if(!jsonValue.isString())
+        return PIA_ERROR_TYPE;
+
+    const QByteArray &utf8 = jsonValue.toString().toUtf8();
+    size_t bufferSize = *size;
+    *size = static_cast<size_t>(utf8.size()) + 1;
+    if(bufferSize < *size)
+        return PIA_ERROR_BUFFER;
+    std::memcpy(buffer, utf8.constData(), *size);   // Includes the terminator
+    return PIA_OK;
+}
@@ -0,0 +1,138 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+// This header is plain C so it can be used by integrations that don't use Qt
+// or C++ - it intentionally doesn't include common.h.
+#ifndef CLIENTAPI_H
+#define CLIENTAPI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(DYNAMIC_CLIENTLIB) || !defined(BUILD_CLIENTLIB)
+    #ifdef _WIN32
+        #ifdef BUILD_CLIENTLIB
+            #define PIA_CLIENTAPI_EXPORT __declspec(dllexport)
+        #else
+            #define PIA_CLIENTAPI_EXPORT __declspec(dllimport)
+        #endif
+    #else
+        #define PIA_CLIENTAPI_EXPORT __attribute__((visibility("default")))
+    #endif
+#else
+    #define PIA_CLIENTAPI_EXPORT
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// C API for reading the daemon's state without a Qt event loop or JSON
+// parsing, for monitoring agents and other integrations.
+//
+// A pia_client connects to the daemon on its own thread (running its own
+// QCoreApplication if the process doesn't have one), and reconnects
+// automatically if the connection is lost.  Properties are identified by
+// their object ("data", "account", "settings", or "state") and name, as in
+// the CLI and the daemon's JSON notifications.
+//
+// Only scalar properties (booleans, numbers, and strings) can be read with
+// this API.  The getters can be called from any thread and never wait for the
+// daemon; they return the values most recently received.
+//
+// Properties are watched with pia_client_watch().  Until a property is
+// watched, all properties are received from the daemon.  Once any property is
+// watched, only the watched properties are received (see the daemon's
+// "subscribe" RPC), and the others can't be read.
+
+typedef struct pia_client pia_client;
+
+typedef enum pia_result
+{
+    PIA_OK = 0,
+    // Invalid arguments (such as a NULL client or property name)
+    PIA_ERROR_INVALID = -1,
+    // The property doesn't exist, or no value has been received yet
+    PIA_ERROR_NOT_FOUND = -2,
+    // The property's value is null
+    PIA_ERROR_NULL = -3,
+    // The property's value doesn't have the requested type
+    PIA_ERROR_TYPE = -4,
+    // The buffer is too small for the string value; the required size is
+    // returned
+    PIA_ERROR_BUFFER = -5,
+    // Other properties are being watched, so this one isn't received
+    PIA_ERROR_NOT_WATCHED = -6,
+} pia_result;
+
+// Called on the client's thread when a watched property changes.  'object' and
+// 'property' are UTF-8 and are only valid during the call.  The callback can
+// read and watch properties, but it must not call pia_client_destroy().
+typedef void (*pia_change_callback)(void *context, const char *object,
+                                    const char *property);
+
+// Create a client and start connecting to the daemon.  Returns NULL if the
+// client couldn't be started.
+PIA_CLIENTAPI_EXPORT pia_client *pia_client_create(void);
+// Disconnect from the daemon and destroy the client.  No callbacks are called
+// after this returns.
+PIA_CLIENTAPI_EXPORT void pia_client_destroy(pia_client *client);
+
+// Whether the client is currently connected to the daemon and has received
+// its state (nonzero if connected).
+PIA_CLIENTAPI_EXPORT int pia_client_is_connected(pia_client *client);
+
+// Watch a property - it will be received from the daemon, and if 'callback'
+// isn't NULL, it's called each time the property changes.  A property can be
+// watched more than once with different callbacks.
+PIA_CLIENTAPI_EXPORT pia_result pia_client_watch(pia_client *client,
+                                                 const char *object,
+                                                 const char *property,
+                                                 pia_change_callback callback,
+                                                 void *context);
+
+// Read a boolean property.
+PIA_CLIENTAPI_EXPORT pia_result pia_client_get_bool(pia_client *client,
+                                                    const char *object,
+                                                    const char *property,
+                                                    int *value);
+// Read an integer property.  Numbers that aren't integers are PIA_ERROR_TYPE.
+PIA_CLIENTAPI_EXPORT pia_result pia_client_get_int64(pia_client *client,
+                                                     const char *object,
+                                                     const char *property,
+                                                     int64_t *value);
+// Read any numeric property.
+PIA_CLIENTAPI_EXPORT pia_result pia_client_get_double(pia_client *client,
+                                                      const char *object,
+                                                      const char *property,
+                                                      double *value);
+// Read a string property as UTF-8.  On input, *size is the size of 'buffer';
+// on output, it's the size of the value including the terminating null
+// character.  If the buffer is too small, PIA_ERROR_BUFFER is returned and
+// nothing is written, so the caller can retry with a larger buffer.
+PIA_CLIENTAPI_EXPORT pia_result pia_client_get_string(pia_client *client,
+                                                      const char *object,
+                                                      const char *property,
+                                                      char *buffer,
+                                                      size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
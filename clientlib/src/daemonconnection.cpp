@@ -20,14 +20,186 @@
 #line SOURCE_FILE("daemonconnection.cpp")
 
 #include "daemonconnection.h"
+#include "version.h"
+#include "tracing.h"
+
+namespace
+{
+    // Decode a value sent in the columnar locations encoding (see
+    // encodeLocationsColumns()); other values are returned unchanged.
+    QJsonValue decodeLocationColumnsValue(const QString &object, const QString &property,
+                                          const QJsonValue &value)
+    {
+        if(!isLocationColumns(value))
+            return value;
+
+        if(object == QStringLiteral("data") && property == QStringLiteral("locations"))
+        {
+            QJsonObject locations;
+            if(decodeLocationsColumns(value.toObject(), locations))
+                return locations;
+        }
+        else if(object == QStringLiteral("state") && property == QStringLiteral("groupedLocations"))
+        {
+            QJsonArray groupedLocations;
+            if(decodeGroupedLocationsColumns(value.toObject(), groupedLocations))
+                return groupedLocations;
+        }
+        qWarning() << "Could not decode columnar value of" << object << property;
+        return value;
+    }
+
+    // Decode the columnar locations lists in a "data" or "patch"
+    // notification's parameter object, so the rest of the decoder (and
+    // DaemonConnection) only see the normal form.
+    QJsonObject decodeLocationColumns(const QJsonObject &params, bool isPatch)
+    {
+        QJsonObject result{params};
+        for(auto itObject = result.begin(); itObject != result.end(); ++itObject)
+        {
+            if(isPatch)
+            {
+                QJsonArray objectPatch = itObject.value().toArray();
+                for(auto itOp = objectPatch.begin(); itOp != objectPatch.end(); ++itOp)
+                {
+                    QJsonObject patchOp = itOp->toObject();
+                    auto itValue = patchOp.find(QStringLiteral("value"));
+                    if(itValue == patchOp.end() || !isLocationColumns(itValue.value()))
+                        continue;
+                    const auto &path = jsonPointerSplit(patchOp.value(QStringLiteral("path")).toString());
+                    if(path.size() != 1)
+                        continue;
+                    *itValue = decodeLocationColumnsValue(itObject.key(), path.first(), itValue.value());
+                    *itOp = patchOp;
+                }
+                *itObject = objectPatch;
+            }
+            else
+            {
+                QJsonObject properties = itObject.value().toObject();
+                for(auto itProperty = properties.begin(); itProperty != properties.end(); ++itProperty)
+                {
+                    if(isLocationColumns(itProperty.value()))
+                        *itProperty = decodeLocationColumnsValue(itObject.key(), itProperty.key(), itProperty.value());
+                }
+                *itObject = properties;
+            }
+        }
+        return result;
+    }
+}
+
+void DaemonMessageDecoder::decodeMessage(const QByteArray &msg)
+{
+    QJsonDocument json;
+    try
+    {
+        json = parseJsonRPCDocument(msg);
+    }
+    catch (const Error& error)
+    {
+        qWarning(error);
+        return;
+    }
+
+    // Batches are responses to calls, those are handled normally
+    if(json.isObject())
+    {
+        QJsonObject message = json.object();
+        const QString &method = message.value(QStringLiteral("method")).toString();
+        QJsonArray params = message.value(QStringLiteral("params")).toArray();
+        if(method == QStringLiteral("data") && params.size() == 1 && params[0].isObject())
+        {
+            params[0] = prepareData(decodeLocationColumns(params[0].toObject(), false));
+            message.insert(QStringLiteral("params"), params);
+            json.setObject(message);
+        }
+        else if(method == QStringLiteral("patch") && params.size() == 1 && params[0].isObject())
+        {
+            params[0] = decodeLocationColumns(params[0].toObject(), true);
+            params.append(preparePatch(params[0].toObject()));
+            message.insert(QStringLiteral("params"), params);
+            json.setObject(message);
+        }
+    }
+
+    emit messageDecoded(json);
+}
+
+QJsonObject DaemonMessageDecoder::prepareData(const QJsonObject &data)
+{
+    QJsonObject changedData;
+    for(auto itObject = data.begin(); itObject != data.end(); ++itObject)
+    {
+        if(!itObject.value().isObject())
+            continue;   // Ignored by DaemonConnection::RPC_data()
+
+        const QJsonObject &properties = itObject.value().toObject();
+        QJsonObject &values = _values[itObject.key()];
+        QJsonObject changedProperties;
+        for(auto itProperty = properties.begin(); itProperty != properties.end(); ++itProperty)
+        {
+            auto itValue = values.find(itProperty.key());
+            if(itValue == values.end() || itValue.value() != itProperty.value())
+            {
+                changedProperties.insert(itProperty.key(), itProperty.value());
+                values.insert(itProperty.key(), itProperty.value());
+            }
+        }
+        changedData.insert(itObject.key(), changedProperties);
+    }
+    return changedData;
+}
+
+QJsonObject DaemonMessageDecoder::preparePatch(const QJsonObject &patch)
+{
+    QJsonObject patchedValues;
+    for(auto itObject = patch.begin(); itObject != patch.end(); ++itObject)
+    {
+        if(!itObject.value().isArray())
+            continue;   // Ignored by DaemonConnection::RPC_patch()
+
+        // Group the operations by the property they affect, so a failure only
+        // affects that property
+        QHash<QString, QJsonArray> propertyPatches;
+        for(const auto &patchOp : itObject.value().toArray())
+        {
+            const auto &segments = jsonPointerSplit(patchOp.toObject().value(QStringLiteral("path")).toString());
+            if(!segments.isEmpty())
+                propertyPatches[segments.first()].append(patchOp);
+        }
+
+        QJsonObject &values = _values[itObject.key()];
+        QJsonObject patchedProperties;
+        for(auto itProperty = propertyPatches.begin(); itProperty != propertyPatches.end(); ++itProperty)
+        {
+            QJsonValue patched{QJsonObject{{itProperty.key(), values.value(itProperty.key())}}};
+            if(!applyJsonPatch(patched, itProperty.value()))
+            {
+                // DaemonConnection will apply this patch itself (and log the
+                // failure).  Forget the value, it's no longer known.
+                values.remove(itProperty.key());
+                continue;
+            }
+            const QJsonValue &value = patched.toObject().value(itProperty.key());
+            values.insert(itProperty.key(), value);
+            patchedProperties.insert(itProperty.key(), value);
+        }
+        patchedValues.insert(itObject.key(), patchedProperties);
+    }
+    return patchedValues;
+}
 
 DaemonConnection::DaemonConnection(QObject* parent)
     : QObject(parent)
     , _ipc(nullptr)
+    , _pDecoder(nullptr)
     , _connected(false)
+    , _tracingConnect(false)
 {
     _rpc = new ClientSideInterface(&_methods, this);
     _methods.add({ QStringLiteral("data"), this, &DaemonConnection::RPC_data });
+    _methods.add({ QStringLiteral("patch"), this, &DaemonConnection::RPC_patch });
     _connectionTimer.setSingleShot(true);
     connect(&_connectionTimer, &QTimer::timeout, this, [this]() {
         if (!_connected) socketError(QStringLiteral("Timeout waiting for daemon connection"));
@@ -67,19 +239,86 @@ void DaemonConnection::connectToDaemon()
 
     _connectionTimer.start(abandonTimeout);
 
+    // The attempt ends when the first data arrives or the connection is lost
+    Tracer::asyncBegin("client", QStringLiteral("Connect to daemon"), 0);
+    _tracingConnect = true;
+
     _ipc = new ThreadedLocalIPCConnection(this);
 
+    // Parse and prepare messages on the socket thread - "data" notifications
+    // in particular can be large.
+    _ipc->_socketThread.invokeOnThread([this]()
+    {
+        _pDecoder = new DaemonMessageDecoder{&_ipc->_socketThread.objectOwner()};
+    });
+    connect(_ipc->_pConnection, &ClientIPCConnection::messageReceived, _pDecoder,
+            &DaemonMessageDecoder::decodeMessage);
+
     connect(_ipc, &IPCConnection::connected, this, &DaemonConnection::socketConnected);
+    connect(_ipc, &IPCConnection::connected, this, &DaemonConnection::onSocketConnected);
     connect(_ipc, &IPCConnection::disconnected, this, &DaemonConnection::socketDisconnected);
     connect(_ipc, &IPCConnection::error, this, &DaemonConnection::socketError);
 
-    connect(_ipc, &IPCConnection::messageReceived, _rpc, &ClientSideInterface::processMessage);
+    connect(_pDecoder, &DaemonMessageDecoder::messageDecoded, _rpc, &ClientSideInterface::processDocument);
     connect(_rpc, &ClientSideInterface::messageReady, _ipc, &IPCConnection::sendMessage);
     connect(_ipc, &IPCConnection::messageError, _rpc, &ClientSideInterface::requestSendError);
 
     _ipc->connectToServer();
 }
 
+QJsonObject DaemonConnection::cachedState() const
+{
+    // Only take the properties listed from these objects
+    auto selectProperties = [](const NativeJsonObject &object,
+                               std::initializer_list<QString> properties)
+    {
+        QJsonObject selected;
+        for(const auto &property : properties)
+            selected.insert(property, object.get(property));
+        return selected;
+    };
+
+    QJsonObject settingsJson = settings.toJsonObject();
+    settingsJson.remove(QStringLiteral("proxyCustom"));
+
+    return {
+        {QStringLiteral("data"), data.toJsonObject()},
+        {QStringLiteral("account"), selectProperties(account, {
+            QStringLiteral("loggedIn"), QStringLiteral("username"),
+            QStringLiteral("plan"), QStringLiteral("active"),
+            QStringLiteral("expired"), QStringLiteral("expirationTime"),
+            QStringLiteral("daysRemaining")})},
+        {QStringLiteral("settings"), settingsJson},
+        {QStringLiteral("state"), selectProperties(state, {
+            QStringLiteral("vpnLocations"), QStringLiteral("shadowsocksLocations"),
+            QStringLiteral("groupedLocations")})}
+    };
+}
+
+void DaemonConnection::assignCachedState(const QJsonObject &cache)
+{
+    Q_ASSERT(!_connected);
+
+    QJsonObject::const_iterator it;
+#define AssignObject(name) \
+    if ((it = cache.find(QStringLiteral(#name))) != cache.end() && it.value().isObject()) this->name.assign(it.value().toObject())
+
+    AssignObject(data);
+    AssignObject(account);
+    AssignObject(settings);
+    AssignObject(state);
+#undef AssignObject
+}
+
+bool DaemonConnection::readStateChannel(StateChannelValues &values)
+{
+    // The channel is only valid while connected - a daemon that isn't running
+    // (or has restarted) may have left an image that's no longer updated.
+    if(!_connected)
+        return false;
+    return _stateChannel.read(values);
+}
+
 void DaemonConnection::RPC_data(const QJsonObject &data)
 {
     QJsonObject::const_iterator it;
@@ -95,16 +334,161 @@ void DaemonConnection::RPC_data(const QJsonObject &data)
     if (!_connected && _ipc->isConnected())
     {
         _connectionTimer.stop();
+        endConnectTrace();
         emit connectedChanged(_connected = true);
     }
 }
 
+void DaemonConnection::RPC_patch(const QJsonObject &patch, const QJsonObject &values)
+{
+    auto applyPatch = [&patch, &values](NativeJsonObject &object, const QString &name)
+    {
+        auto itPatch = patch.find(name);
+        if(itPatch == patch.end() || !itPatch.value().isArray())
+            return;
+        const QJsonArray &objectPatch = itPatch.value().toArray();
+
+        // Operations that just set a property of a nested object (such as the
+        // latency of one ServerLocation) are applied to that object in place,
+        // so only that object's change signals are emitted.  This is only
+        // possible if all operations for that top-level property can be applied
+        // this way.
+        struct NestedChange
+        {
+            QString topProperty;
+            NativeJsonObject *pParent;
+            QString property;
+            QJsonValue value;
+        };
+        QVector<NestedChange> nestedChanges;
+        QSet<QString> nestedProperties, replacedProperties;
+        QJsonArray replacePatch;
+        for(const auto &patchOp : objectPatch)
+        {
+            const QJsonObject &opObject = patchOp.toObject();
+            const auto &segments = jsonPointerSplit(opObject.value(QStringLiteral("path")).toString());
+            const QString &op = opObject.value(QStringLiteral("op")).toString();
+            NativeJsonObject *pParent = nullptr;
+            if(segments.size() > 1 &&
+               (op == QStringLiteral("replace") || op == QStringLiteral("add")))
+            {
+                pParent = object.findNestedParent(segments);
+            }
+
+            if(pParent)
+            {
+                nestedChanges.push_back({segments.first(), pParent, segments.back(), opObject.value(QStringLiteral("value"))});
+                nestedProperties.insert(segments.first());
+            }
+            else if(!segments.isEmpty())
+                replacedProperties.insert(segments.first());
+        }
+        // If any operation for a property can't be applied in place, apply
+        // them all by replacing the property
+        nestedProperties -= replacedProperties;
+        for(const auto &patchOp : objectPatch)
+        {
+            const auto &segments = jsonPointerSplit(patchOp.toObject().value(QStringLiteral("path")).toString());
+            if(segments.isEmpty() || !nestedProperties.contains(segments.first()))
+                replacePatch.append(patchOp);
+        }
+
+        // Use the property values already patched by DaemonMessageDecoder.
+        // If any couldn't be prepared, start with the current values of those
+        // properties and apply the patch to them.  Then assign all the results
+        // at once (so the change is observed atomically, like RPC_data()).
+        if(!replacePatch.isEmpty())
+        {
+            const QJsonObject &preparedValues = values.value(name).toObject();
+            QJsonObject properties, unpreparedProperties;
+            QJsonArray unpreparedPatch;
+            for(const auto &property : replacedProperties)
+            {
+                auto itValue = preparedValues.find(property);
+                if(itValue != preparedValues.end())
+                    properties.insert(property, itValue.value());
+                else
+                    unpreparedProperties.insert(property, object.get(property));
+            }
+            for(const auto &patchOp : replacePatch)
+            {
+                const auto &segments = jsonPointerSplit(patchOp.toObject().value(QStringLiteral("path")).toString());
+                if(segments.isEmpty() || unpreparedProperties.contains(segments.first()))
+                    unpreparedPatch.append(patchOp);
+            }
+
+            if(!unpreparedPatch.isEmpty())
+            {
+                QJsonValue patchedProperties{unpreparedProperties};
+                if(!applyJsonPatch(patchedProperties, unpreparedPatch))
+                    qWarning() << "Not all changes could be applied to" << name;
+                const QJsonObject &patchedObject = patchedProperties.toObject();
+                for(auto itProperty = patchedObject.begin(); itProperty != patchedObject.end(); ++itProperty)
+                    properties.insert(itProperty.key(), itProperty.value());
+            }
+            object.assign(properties);
+        }
+
+        // The nested objects weren't affected by the assign() above, since
+        // their top-level properties were not replaced.
+        for(const auto &change : nestedChanges)
+        {
+            if(!nestedProperties.contains(change.topProperty))
+                continue;   // Applied by replacing the property above
+            if(!change.pParent->set(change.property, change.value))
+                qWarning() << "Could not apply nested change to" << change.property << "in" << name;
+        }
+    };
+
+    applyPatch(data, QStringLiteral("data"));
+    applyPatch(account, QStringLiteral("account"));
+    applyPatch(settings, QStringLiteral("settings"));
+    applyPatch(state, QStringLiteral("state"));
+}
+
 void DaemonConnection::RPC_error(const QJsonObject& errorObject)
 {
     Error e(errorObject);
     emit error(e);
 }
 
+void DaemonConnection::onSocketConnected()
+{
+    // Tell the daemon which optional protocol features we support.  Until this
+    // is processed, the daemon sends full "data" notifications, which are
+    // still handled normally.
+    _rpc->call(QStringLiteral("handshake"), QStringLiteral(PIA_VERSION),
+               QJsonArray{QStringLiteral("dataPatch"), QStringLiteral("binaryPayload"),
+                          QStringLiteral("locationColumns")})
+        ->notify(this, [](const Error &error, const QJsonValue &daemonVersion)
+        {
+            if(error)
+                qWarning() << "Handshake with daemon failed:" << error;
+            else
+                qInfo() << "Connected to daemon version" << daemonVersion.toString();
+        });
+    if(!_subscriptions.isEmpty())
+        _rpc->post(QStringLiteral("subscribe"), _subscriptions);
+}
+
+void DaemonConnection::subscribe(const QJsonObject &subscriptions)
+{
+    _subscriptions = subscriptions;
+    if(_ipc && _ipc->isConnected())
+        _rpc->post(QStringLiteral("subscribe"), _subscriptions);
+}
+
+void DaemonConnection::unsubscribe()
+{
+    if(_subscriptions.isEmpty())
+        return;
+    _subscriptions = {};
+    // If we're not connected, nothing to do - the daemon sends all properties
+    // to a new connection that doesn't subscribe.
+    if(_ipc && _ipc->isConnected())
+        _rpc->post(QStringLiteral("unsubscribe"));
+}
+
 void DaemonConnection::socketDisconnected()
 {
     if (_ipc)
@@ -113,9 +497,15 @@ void DaemonConnection::socketDisconnected()
         disconnect(_ipc, nullptr, this, nullptr);
         disconnect(_ipc, nullptr, _rpc, nullptr);
         disconnect(_rpc, nullptr, _ipc, nullptr);
+        // The decoder is destroyed along with the socket thread
+        disconnect(_pDecoder, nullptr, _rpc, nullptr);
+        // A new daemon creates a new state channel
+        _stateChannel.close();
+        _pDecoder = nullptr;
         _ipc->deleteLater();
         _ipc = nullptr;
     }
+    endConnectTrace();
     // Reject any requests that were sent before the connection was lost
     _rpc->connectionLost();
     if (_connected)
@@ -126,6 +516,15 @@ void DaemonConnection::socketDisconnected()
         connectToDaemon();
 }
 
+void DaemonConnection::endConnectTrace()
+{
+    if(_tracingConnect)
+    {
+        Tracer::asyncEnd("client", QStringLiteral("Connect to daemon"), 0);
+        _tracingConnect = false;
+    }
+}
+
 void DaemonConnection::socketError(const QString &errorString)
 {
     emit error(Error(HERE, Error::DaemonConnectionError, { errorString }));
@@ -26,9 +26,45 @@
 #include "ipc.h"
 #include "jsonrpc.h"
 #include "settings.h"
+#include "statechannel.h"
 #include <QObject>
 #include <QTimer>
 
+// DaemonMessageDecoder runs on the IPC connection's socket thread.  It parses
+// the messages from the daemon, and prepares the "data" and "patch"
+// notifications so DaemonConnection only has to assign the resulting values
+// on the main thread:
+// - locations lists sent in the columnar encoding ("locationColumns") are
+//   decoded to their normal form
+// - properties in "data" notifications that are unchanged from the last value
+//   received are removed
+// - "patch" notifications are applied to the last values received, and the
+//   resulting property values are added as a second parameter
+//
+// A new decoder is created for each connection, so it starts with no values.
+class CLIENTLIB_EXPORT DaemonMessageDecoder : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("daemonconnection")
+
+public:
+    using QObject::QObject;
+
+private:
+    QJsonObject prepareData(const QJsonObject &data);
+    QJsonObject preparePatch(const QJsonObject &patch);
+
+public:
+    void decodeMessage(const QByteArray &msg);
+
+signals:
+    void messageDecoded(const QJsonDocument &json);
+
+private:
+    // The last values received for each object ("data", "state", etc.)
+    QHash<QString, QJsonObject> _values;
+};
+
 // Handle the native connection to the daemon, as well as storing its state.
 class CLIENTLIB_EXPORT DaemonConnection : public QObject
 {
@@ -40,6 +76,26 @@ public:
     void connectToDaemon();
     bool isConnected() const { return _connected; }
 
+    // Snapshot of the daemon's values that the client persists between
+    // launches, so the UI can be shown before the daemon connection completes.
+    // This has all of DaemonData and DaemonSettings (except the custom proxy
+    // credentials), the location lists from DaemonState, and the account's
+    // login status - no credentials or connection status are included, those
+    // would be misleading or sensitive if shown before the daemon reports
+    // them.
+    QJsonObject cachedState() const;
+    // Assign a snapshot from cachedState() saved by a prior launch.  This can
+    // only be used before connecting; the first "data" notification from the
+    // daemon replaces all of these values.
+    void assignCachedState(const QJsonObject &cache);
+
+    // Read the latest connection state, byte counts, interval measurements,
+    // and forwarded port from the daemon's shared memory state channel (see
+    // StateChannelReader).  These are the same values as in DaemonState, but
+    // they can be polled at any rate without waiting for notifications.
+    // Returns false if the channel isn't available; use DaemonState then.
+    bool readStateChannel(StateChannelValues &values);
+
 // Information gathered from the daemon to display in the client
 public:
     // List of server locations and certificate info
@@ -69,14 +125,30 @@ public slots:
         _rpc->postWithParams(method, params);
     }
 
+    // Send the calls and posts made between beginBatch() and sendBatch() in
+    // one message (see RemoteNotificationInterface::beginBatch())
+    void beginBatch() { _rpc->beginBatch(); }
+    void sendBatch() { _rpc->sendBatch(); }
+
     // Any daemon RPC function which needs to be accessed from native code
     // can be added as a shorthand here.
 
+    // Receive changes only in specific properties (see
+    // Daemon::RPC_subscribe()).  The subscription is sent again whenever the
+    // connection is reestablished.
+    void subscribe(const QJsonObject &subscriptions);
+    // Receive changes in all properties again (see Daemon::RPC_unsubscribe()).
+    // The daemon sends the current values of all properties.
+    void unsubscribe();
+
 protected slots:
     void RPC_data(const QJsonObject& data);
+    // 'values' are the patched property values from DaemonMessageDecoder
+    void RPC_patch(const QJsonObject& patch, const QJsonObject& values);
     void RPC_error(const QJsonObject& errorObject);
 
 protected slots:
+    void onSocketConnected();
     void socketDisconnected();
     void socketError(const QString& errorString);
 
@@ -89,12 +161,22 @@ signals:
     void connectedChanged(bool isConnected);
     void error(const Error& error);
 
+private:
+    void endConnectTrace();
+
 private:
     LocalMethodRegistry _methods;
-    ClientIPCConnection* _ipc;
+    ThreadedLocalIPCConnection* _ipc;
+    // Decoder for the current connection, lives on _ipc's socket thread
+    DaemonMessageDecoder* _pDecoder;
     ClientSideInterface* _rpc;
     QTimer _connectionTimer;
     bool _connected;
+    // Whether the trace span for the current connection attempt is open
+    bool _tracingConnect;
+    // Subscriptions from subscribe(), empty if the client hasn't subscribed
+    QJsonObject _subscriptions;
+    StateChannelReader _stateChannel;
 };
 
 #endif
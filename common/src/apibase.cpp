@@ -18,6 +18,70 @@
 
 #include "apibase.h"
 #include "brand.h"
+#include <algorithm>
+
+namespace
+{
+    // Number of consecutive failed attempts that opens a base URI's circuit
+    const unsigned circuitFailureThreshold{5};
+    // Cooldown the first time a circuit opens; doubled each time a probe
+    // fails, up to the maximum.
+    const std::chrono::milliseconds circuitInitialCooldown{std::chrono::seconds{30}};
+    const std::chrono::milliseconds circuitMaxCooldown{std::chrono::minutes{5}};
+}
+
+QHash<QString, ApiCircuitBreaker::CircuitState> ApiCircuitBreaker::_circuits;
+
+bool ApiCircuitBreaker::isOpen(const QString &baseUri)
+{
+    auto itCircuit = _circuits.constFind(baseUri);
+    if(itCircuit == _circuits.constEnd())
+        return false;
+    return itCircuit->_consecutiveFailures >= circuitFailureThreshold &&
+        !itCircuit->_openUntil.hasExpired();
+}
+
+void ApiCircuitBreaker::attemptFailed(const QString &baseUri)
+{
+    CircuitState &circuit = _circuits[baseUri];
+    ++circuit._consecutiveFailures;
+    if(circuit._consecutiveFailures < circuitFailureThreshold)
+        return;
+
+    // If the circuit is already open, this was an attempt that began before
+    // it opened; don't extend the cooldown.
+    if(circuit._consecutiveFailures > circuitFailureThreshold &&
+       !circuit._openUntil.hasExpired())
+    {
+        return;
+    }
+
+    // Open the circuit - or reopen it with a longer cooldown if a probe
+    // failed.
+    if(circuit._consecutiveFailures == circuitFailureThreshold)
+        circuit._cooldown = circuitInitialCooldown;
+    else
+        circuit._cooldown = std::min(circuit._cooldown * 2, circuitMaxCooldown);
+    circuit._openUntil.setRemainingTime(circuit._cooldown);
+    qWarning() << "API base" << baseUri << "failed"
+        << circuit._consecutiveFailures << "consecutive attempts, skipping it for"
+        << traceMsec(circuit._cooldown);
+}
+
+void ApiCircuitBreaker::attemptSucceeded(const QString &baseUri)
+{
+    auto itCircuit = _circuits.find(baseUri);
+    if(itCircuit == _circuits.end())
+        return;
+    if(itCircuit->_consecutiveFailures >= circuitFailureThreshold)
+        qInfo() << "API base" << baseUri << "is reachable again";
+    _circuits.erase(itCircuit);
+}
+
+void ApiCircuitBreaker::reset()
+{
+    _circuits.clear();
+}
 
 ApiBaseData::ApiBaseData(std::vector<QString> baseUris)
     : _baseUris{std::move(baseUris)}, _nextStartIndex{0}
@@ -30,7 +94,7 @@ ApiBaseData::ApiBaseData(std::vector<QString> baseUris)
     }
 }
 
-const QString &ApiBaseData::getUri(unsigned index)
+const QString &ApiBaseData::getUri(unsigned index) const
 {
     Q_ASSERT(index < _baseUris.size());   // Guaranteed by caller
     return _baseUris[index];
@@ -73,7 +137,20 @@ ApiBaseSequence::ApiBaseSequence(QSharedPointer<ApiBaseData> pData)
 const QString &ApiBaseSequence::getNextUri()
 {
     Q_ASSERT(_pData);   // Class invariant
-    _currentBaseUri = (_currentBaseUri + 1) % _pData->getUriCount();
+    unsigned uriCount = _pData->getUriCount();
+    unsigned nextBaseUri = (_currentBaseUri + 1) % uriCount;
+    // Skip base URIs that are failing if another is available.  If they're
+    // all failing, just use the next one normally.
+    for(unsigned i=0; i<uriCount; ++i)
+    {
+        unsigned candidate = (_currentBaseUri + 1 + i) % uriCount;
+        if(!ApiCircuitBreaker::isOpen(_pData->getUri(candidate)))
+        {
+            nextBaseUri = candidate;
+            break;
+        }
+    }
+    _currentBaseUri = nextBaseUri;
     return _pData->getUri(_currentBaseUri);
 }
 
@@ -83,6 +160,12 @@ void ApiBaseSequence::attemptSucceeded()
     _pData->attemptSucceeded(_currentBaseUri);
 }
 
+void ApiBaseSequence::attemptSucceeded(unsigned baseUriIndex)
+{
+    Q_ASSERT(_pData);   // Class invariant
+    _pData->attemptSucceeded(baseUriIndex);
+}
+
 namespace ApiBases
 {
     ApiBase piaApi
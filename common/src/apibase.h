@@ -22,9 +22,57 @@
 #ifndef APIBASE_H
 #define APIBASE_H
 
+#include <QDeadlineTimer>
+#include <QHash>
 #include <QSharedPointer>
+#include <chrono>
 #include <vector>
 
+// ApiCircuitBreaker tracks recent failures of each API base URI.  This is
+// process-wide, so all requests to a base URI share its state, even if they
+// use different ApiBase objects.
+//
+// After several consecutive failed attempts to a base URI, its circuit
+// "opens" for a cooldown period.  While it's open, ApiBaseSequence skips that
+// URI if others are available, and NetworkTaskWithRetry fails attempts to it
+// without making a request.  Once the cooldown elapses, the next attempt is
+// allowed through as a probe - if it fails, the circuit opens again with a
+// longer cooldown, and if it succeeds, the circuit closes.
+//
+// Like ApiBase, this is not thread-safe; all API requests are made on the
+// main thread.
+class COMMON_EXPORT ApiCircuitBreaker
+{
+    CLASS_LOGGING_CATEGORY("apiclient")
+
+public:
+    // Check if the circuit for a base URI is currently open (the base URI
+    // should not be used).
+    static bool isOpen(const QString &baseUri);
+    // Record a failed attempt to a base URI (a network error or rate limiting)
+    static void attemptFailed(const QString &baseUri);
+    // Record an attempt that reached a base URI - the request succeeded, or
+    // the server responded with an error that isn't due to the server's
+    // availability (such as an auth error).
+    static void attemptSucceeded(const QString &baseUri);
+    // Close all circuits.  Used when the network changes, since failures on
+    // the prior network don't indicate much about the new one.
+    static void reset();
+
+private:
+    struct CircuitState
+    {
+        // Count of consecutive failed attempts
+        unsigned _consecutiveFailures{0};
+        // Cooldown applied the most recent time the circuit opened
+        std::chrono::milliseconds _cooldown{0};
+        // When the current cooldown ends (if the circuit is open)
+        QDeadlineTimer _openUntil;
+    };
+
+    static QHash<QString, CircuitState> _circuits;
+};
+
 // Data used by both ApiBase and ApiBaseSequence - the actual base URIs and the
 // last successful one.
 // Note that this is not currently thread-safe; all API requests of any kind are
@@ -37,7 +85,7 @@ public:
 public:
     unsigned getNextStartIndex() const {return _nextStartIndex;}
     unsigned getUriCount() const {return _baseUris.size();}
-    const QString &getUri(unsigned index);
+    const QString &getUri(unsigned index) const;
     void attemptSucceeded(unsigned successIndex);
 
 private:
@@ -54,8 +102,18 @@ public:
     ApiBaseSequence(QSharedPointer<ApiBaseData> pData);
 
 public:
+    // Get the next base URI to attempt.  Base URIs whose circuits are open
+    // (see ApiCircuitBreaker) are skipped, unless all of them are open.
     const QString &getNextUri();
+    // Index of the base URI most recently returned by getNextUri()
+    unsigned getCurrentIndex() const {return _currentBaseUri;}
+    unsigned getUriCount() const {return _pData->getUriCount();}
+    const QString &getUri(unsigned index) const {return _pData->getUri(index);}
     void attemptSucceeded();
+    // Indicate that an attempt on a specific base URI succeeded (used when
+    // attempts are hedged, the successful attempt might not be the most
+    // recent one)
+    void attemptSucceeded(unsigned baseUriIndex);
 
 private:
     const QSharedPointer<ApiBaseData> _pData;
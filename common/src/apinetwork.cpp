@@ -20,10 +20,15 @@
 #line SOURCE_FILE("apinetwork.cpp")
 
 #include "apinetwork.h"
+#include "apibase.h"
 #include <testshim.h>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QUrl>
 #include <algorithm>
 
 ApiNetwork::ApiNetwork()
+    : _stats{}
 {
     // By default, Qt Bearer Management will try to poll network interfaces
     // every 10 seconds.  We don't care about this functionality (it doesn't
@@ -44,6 +49,74 @@ ApiNetwork::ApiNetwork()
 void ApiNetwork::setProxy(const QNetworkProxy &proxy)
 {
     getAccessManager().setProxy(proxy);
+
+    // QNetworkAccessManager caches connections for reuse, but if we connect or
+    // disconnect from the VPN, these connections break.  If QNetworkManager
+    // uses a cached connection that's broken, we end up waiting for the
+    // request to time out.  Clear them whenever the network changes.  (There
+    // is no way to disable connection caching in QNetworkAccessManager.)
+    //
+    // The TLS session tickets are kept, so new connections can still resume
+    // their sessions.
+    getAccessManager().clearConnectionCache();
+    ++_stats.connectionResets;
+
+    // Failures on the prior network don't say much about the API bases'
+    // availability on the new one.
+    ApiCircuitBreaker::reset();
+}
+
+QSslConfiguration ApiNetwork::getSslConfiguration(const QString &host) const
+{
+    QSslConfiguration sslConfig{QSslConfiguration::defaultConfiguration()};
+    sslConfig.setAllowedNextProtocols({QSslConfiguration::ALPNProtocolHTTP2,
+                                       QSslConfiguration::NextProtocolHttp1_1});
+    // Session persistence is disabled by default, it's needed to get the
+    // session ticket from the connection and reuse it later.
+    sslConfig.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    QByteArray ticket = _sessionTickets.value(host);
+    if(!ticket.isEmpty())
+        sslConfig.setSessionTicket(ticket);
+    return sslConfig;
+}
+
+void ApiNetwork::prepareRequest(QNetworkRequest &request) const
+{
+    request.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, true);
+    if(request.url().scheme() == QStringLiteral("https"))
+        request.setSslConfiguration(getSslConfiguration(request.url().host()));
+}
+
+void ApiNetwork::trackReply(QNetworkReply &reply)
+{
+    ++_stats.requests;
+
+    QString host = reply.url().host();
+    connect(&reply, &QNetworkReply::encrypted, this, [this, host]()
+    {
+        ++_stats.handshakes;
+        if(_sessionTickets.contains(host))
+            ++_stats.resumptionsOffered;
+    });
+    connect(&reply, &QNetworkReply::finished, this, [this, pReply = &reply, host]()
+    {
+        QByteArray ticket = pReply->sslConfiguration().sessionTicket();
+        if(!ticket.isEmpty())
+            _sessionTickets.insert(host, ticket);
+    });
+}
+
+void ApiNetwork::prewarm(const QString &baseUri)
+{
+    QUrl url{baseUri};
+    if(url.scheme() != QStringLiteral("https") || url.host().isEmpty())
+        return;
+
+    qInfo() << "Opening connection to" << url.host() << "ahead of API requests";
+    getAccessManager().connectToHostEncrypted(url.host(),
+                                              static_cast<quint16>(url.port(443)),
+                                              getSslConfiguration(url.host()));
+    ++_stats.prewarms;
 }
 
 QNetworkAccessManager &ApiNetwork::getAccessManager() const
@@ -24,6 +24,27 @@
 
 #include <QNetworkAccessManager>
 #include <QNetworkConfigurationManager>
+#include <QHash>
+#include <QSslConfiguration>
+
+class QNetworkReply;
+class QNetworkRequest;
+
+// Totals for API requests made through ApiNetwork, used for diagnostics.
+struct ApiNetworkStats
+{
+    // Requests prepared with prepareRequest()
+    quint64 requests;
+    // TLS handshakes performed for those requests (requests on connections
+    // that were already open don't handshake)
+    quint64 handshakes;
+    // Handshakes that offered a session ticket from a prior connection
+    quint64 resumptionsOffered;
+    // Times the connection cache was cleared due to a network change
+    quint64 connectionResets;
+    // Connections opened ahead of time by prewarm()
+    quint64 prewarms;
+};
 
 // ApiNetwork keeps track of the local network address that we need to use for
 // API requests (such as server lists, web API, port forwarding/MACE).
@@ -35,23 +56,48 @@
 class COMMON_EXPORT ApiNetwork : public QObject, public AutoSingleton<ApiNetwork>
 {
     Q_OBJECT
+    CLASS_LOGGING_CATEGORY("apinetwork")
 
 public:
     // Initially, ApiNetwork uses any network interface.
     ApiNetwork();
 
 public:
-    // Set the proxy configuration.
+    // Set the proxy configuration.  This is done when the VPN connection
+    // state changes, so it also clears cached connections, which may have
+    // been broken by the network change.
     void setProxy(const QNetworkProxy &proxy);
 
     // Get the shared QNetworkAccessManager.  This object remains valid until
     // static destruction.
     QNetworkAccessManager &getAccessManager() const;
 
+    // Prepare an API request - allows HTTP/2, and offers the TLS session
+    // ticket from the last connection to the same host so the handshake can
+    // resume that session.  Pass the resulting reply to trackReply().
+    void prepareRequest(QNetworkRequest &request) const;
+    // Observe a reply to a request from prepareRequest() to keep its TLS
+    // session ticket and count handshakes.
+    void trackReply(QNetworkReply &reply);
+
+    // Open a connection to an API base URI ahead of time, so the next request
+    // doesn't have to wait for the TCP and TLS handshakes.
+    void prewarm(const QString &baseUri);
+
+    const ApiNetworkStats &stats() const {return _stats;}
+
+private:
+    QSslConfiguration getSslConfiguration(const QString &host) const;
+
 private:
     // The QNetworkAccessManager used for all connections.  Dynamically
     // allocated so it can be mocked in unit tests.
     std::unique_ptr<QNetworkAccessManager> _pAccessManager;
+    // The most recent TLS session ticket from each API host.  These remain
+    // valid across network changes (they're only meaningful to the server),
+    // so they're kept when the connection cache is cleared.
+    QHash<QString, QByteArray> _sessionTickets;
+    ApiNetworkStats _stats;
 };
 
 #endif
@@ -21,6 +21,7 @@
 
 #include "apiretry.h"
 #include <QElapsedTimer>
+#include <QRandomGenerator>
 #include <QRegularExpression>
 
 void ApiResource::trace(QDebug &dbg) const
@@ -111,18 +112,33 @@ private:
 
 namespace
 {
-    // Minimum interval between the first and second attempt.  (Compounded with
-    // backoffFactor to determine subsequent intervals.)
+    // Minimum interval between the first and second attempt.  (Also the
+    // minimum for any later interval.)
     const std::chrono::seconds _initialInterval{1};
-    // Backoff factor for later retries.  The per-attempt interval is multiplied
-    // by this factor for each attempt (up to _maxInterval).
-    const int backoffFactor{2};
+    // Backoff factor for later retries.  Each per-attempt interval is chosen
+    // randomly between _initialInterval and the prior interval multiplied by
+    // this factor (up to _maxInterval) - "decorrelated jitter".
+    const int backoffFactor{3};
     // Maximum interval between attempts.
     const std::chrono::seconds _maxInterval{30};
+
+    // Choose the next backoff interval following priorInterval
+    std::chrono::milliseconds nextJitteredInterval(std::chrono::milliseconds priorInterval)
+    {
+        const std::chrono::milliseconds minInterval{_initialInterval};
+        std::chrono::milliseconds upperBound{priorInterval * backoffFactor};
+        if(upperBound > _maxInterval)
+            upperBound = _maxInterval;
+        if(upperBound <= minInterval)
+            return minInterval;
+        return std::chrono::milliseconds{QRandomGenerator::global()->bounded(
+            msec32(minInterval), msec32(upperBound) + 1)};
+    }
 }
 
 TimedApiRetry::TimedApiRetry(const std::chrono::seconds &maxAttemptTime)
-    : _priorRequestDelay{0}, _nextRequestInterval{_initialInterval},
+    : _priorRequestDelay{0},
+      _nextRequestInterval{nextJitteredInterval(_initialInterval)},
       _maxAttemptTime{maxAttemptTime}, _attemptCount{0}
 {
 }
@@ -180,9 +196,79 @@ auto TimedApiRetry::beginNextAttempt(const ApiResource &resource)
     }
 
     // Update the next interval
-    _nextRequestInterval *= backoffFactor;
-    if(_nextRequestInterval > _maxInterval)
-        _nextRequestInterval = _maxInterval;
+    _nextRequestInterval = nextJitteredInterval(_nextRequestInterval);
+
+    _priorRequestDelay = thisRequestDelay;
+    return _priorRequestDelay;
+}
+
+// Backoff retry strategy.
+//
+// Limits to a maximum number of attempts like CountedApiRetry.  The first few
+// attempts have no delay, so we fail over to alternate base URIs quickly.
+// After that, attempts are delayed with a randomized backing-off interval, so
+// clients that are failing at the same time don't retry in lockstep.
+//
+// Like TimedApiRetry, the interval is applied from the beginning of the prior
+// attempt, so an attempt that took a long time to fail might not need any
+// delay.
+class COMMON_EXPORT BackoffApiRetry : public ApiRetry
+{
+public:
+    BackoffApiRetry(unsigned maxAttempts, unsigned immediateAttempts);
+
+public:
+    virtual nullable_t<std::chrono::milliseconds> beginNextAttempt(const ApiResource &resource) override;
+
+private:
+    unsigned _maxAttempts, _immediateAttempts, _attemptCount;
+    // Time since the most recent attempt began
+    QElapsedTimer _thisAttemptTime;
+    // Actual delay that we returned for the prior request
+    std::chrono::milliseconds _priorRequestDelay;
+    // Interval to apply to the next delayed attempt
+    std::chrono::milliseconds _nextRequestInterval;
+};
+
+BackoffApiRetry::BackoffApiRetry(unsigned maxAttempts, unsigned immediateAttempts)
+    : _maxAttempts{maxAttempts}, _immediateAttempts{immediateAttempts},
+      _attemptCount{0}, _priorRequestDelay{0},
+      _nextRequestInterval{nextJitteredInterval(_initialInterval)}
+{
+}
+
+auto BackoffApiRetry::beginNextAttempt(const ApiResource &resource)
+    -> nullable_t<std::chrono::milliseconds>
+{
+    if(_attemptCount >= _maxAttempts)
+    {
+        qWarning() << "Request for resource" << resource
+            << "failed after" << _attemptCount << "attempts";
+        return {};
+    }
+
+    std::chrono::milliseconds priorElapsed{0};
+    if(_thisAttemptTime.isValid())
+        priorElapsed = std::chrono::milliseconds{_thisAttemptTime.restart()} - _priorRequestDelay;
+    else
+        _thisAttemptTime.start();
+
+    ++_attemptCount;
+
+    std::chrono::milliseconds thisRequestDelay{0};
+    if(_attemptCount > _immediateAttempts)
+    {
+        if(_nextRequestInterval > priorElapsed)
+            thisRequestDelay = _nextRequestInterval - priorElapsed;
+        qInfo() << "Attempt" << (_attemptCount-1) << "for resource" << resource
+            << "failed, retry after" << traceMsec(thisRequestDelay);
+        _nextRequestInterval = nextJitteredInterval(_nextRequestInterval);
+    }
+    else if(_attemptCount > 1)
+    {
+        qInfo() << "Attempt" << (_attemptCount-1) << "for resource" << resource
+            << "failed, retry";
+    }
 
     _priorRequestDelay = thisRequestDelay;
     return _priorRequestDelay;
@@ -197,3 +283,9 @@ std::unique_ptr<ApiRetry> ApiRetries::timed(std::chrono::seconds maxAttemptTime)
 {
     return std::make_unique<TimedApiRetry>(maxAttemptTime);
 }
+
+std::unique_ptr<ApiRetry> ApiRetries::backoff(unsigned maxAttempts,
+                                              unsigned immediateAttempts)
+{
+    return std::make_unique<BackoffApiRetry>(maxAttempts, immediateAttempts);
+}
@@ -56,6 +56,12 @@ inline COMMON_EXPORT QDebug &operator<<(QDebug &dbg, const ApiResource &val)
 //   (With limit=1, there will be no retries.)
 // - A "timed" retry strategy limits to a maximum time since the first request
 //   and uses a backing-off delay for successive requests.
+// - A "backoff" retry strategy limits to a fixed number of attempts, but uses
+//   a backing-off delay after the first few attempts.
+//
+// The backing-off delays are randomized ("decorrelated jitter"), so clients
+// that began retrying at the same time - such as when the API was
+// unreachable - don't keep retrying in lockstep.
 //
 // These are used by NetworkTaskWithRetry.
 class COMMON_EXPORT ApiRetry
@@ -87,6 +93,13 @@ namespace ApiRetries
     // Create a timed retry strategy with timing factors tuned for the VPN IP
     // address request.
     std::unique_ptr<ApiRetry> COMMON_EXPORT timed(std::chrono::seconds maxAttemptTime);
+
+    // Create a backoff retry strategy with the given number of attempts.  The
+    // first immediateAttempts attempts have no delay (normally one for each
+    // base URI, so failing over to another base URI is quick); later attempts
+    // back off with a randomized delay.
+    std::unique_ptr<ApiRetry> COMMON_EXPORT backoff(unsigned maxAttempts,
+                                                    unsigned immediateAttempts);
 };
 
 #endif
@@ -22,12 +22,118 @@
 #include "async.h"
 
 #include <QMutex>
+#include <array>
 
 // If we guarantee that all Tasks will be owned/managed by the main thread, this mutex is unnecessary
 static QMutex g_taskMutex;
 static NodeList<BaseTask> g_taskList;
 static uint g_taskIndex = 0;
 
+namespace
+{
+    // Cache of freed task blocks for one thread, bucketed by size.  Blocks
+    // come from the global operator new, so a block freed on a different
+    // thread than it was allocated on just moves to that thread's cache.
+    class TaskBlockCache
+    {
+    public:
+        enum : std::size_t
+        {
+            Granularity = 16,
+            MaxBlockSize = 512,
+            BucketCount = MaxBlockSize / Granularity,
+            // Limit the number of blocks kept per size, so a burst of tasks
+            // doesn't permanently hold memory
+            MaxCachedBlocks = 64,
+        };
+
+    private:
+        struct FreeBlock
+        {
+            FreeBlock *pNext;
+        };
+
+        static std::size_t bucket(std::size_t size)
+        {
+            return (size + Granularity - 1) / Granularity - 1;
+        }
+
+    public:
+        TaskBlockCache() : _free{}, _counts{} {}
+        ~TaskBlockCache();
+
+        void *allocate(std::size_t size);
+        void release(void *pBlock, std::size_t size);
+
+    private:
+        std::array<FreeBlock*, BucketCount> _free;
+        std::array<std::size_t, BucketCount> _counts;
+    };
+
+    // Set once this thread's cache is destroyed during thread exit; any tasks
+    // destroyed after that go straight to the global operators.  This is
+    // trivially destructible, so it's still valid at that point.
+    thread_local bool t_cacheDestroyed = false;
+    thread_local TaskBlockCache t_cache;
+
+    TaskBlockCache::~TaskBlockCache()
+    {
+        t_cacheDestroyed = true;
+        for(FreeBlock *pBlock : _free)
+        {
+            while(pBlock)
+            {
+                FreeBlock *pNext = pBlock->pNext;
+                ::operator delete(pBlock);
+                pBlock = pNext;
+            }
+        }
+    }
+
+    void *TaskBlockCache::allocate(std::size_t size)
+    {
+        std::size_t i = bucket(size);
+        if(FreeBlock *pBlock = _free[i])
+        {
+            _free[i] = pBlock->pNext;
+            --_counts[i];
+            return pBlock;
+        }
+        return ::operator new((i + 1) * Granularity);
+    }
+
+    void TaskBlockCache::release(void *pBlock, std::size_t size)
+    {
+        std::size_t i = bucket(size);
+        if(_counts[i] >= MaxCachedBlocks)
+        {
+            ::operator delete(pBlock);
+            return;
+        }
+        FreeBlock *pFree = static_cast<FreeBlock*>(pBlock);
+        pFree->pNext = _free[i];
+        _free[i] = pFree;
+        ++_counts[i];
+    }
+}
+
+void *BaseTask::operator new(std::size_t size)
+{
+    if(size > TaskBlockCache::MaxBlockSize || t_cacheDestroyed)
+        return ::operator new(size);
+    return t_cache.allocate(size);
+}
+
+void BaseTask::operator delete(void *pBlock, std::size_t size)
+{
+    if(!pBlock)
+        return;
+    if(size > TaskBlockCache::MaxBlockSize || t_cacheDestroyed)
+        ::operator delete(pBlock);
+    else
+        t_cache.release(pBlock, size);
+}
+
 static inline const QMetaMethod& taskFinishedSignal()
 {
     static QMetaMethod signal = QMetaMethod::fromSignal(&BaseTask::finished);
@@ -29,6 +29,7 @@
 #include <QPointer>
 
 #include <atomic>
+#include <cstddef>
 
 /*
 
@@ -179,6 +180,17 @@ or the task can expire unexpectedly. (The 'notify' function does this for
 you if the recipient is a Task object.)
 
 
+--- Coroutines ---
+
+Tasks can't be awaited with C++20 coroutines; the Linux build is C++14 and
+Windows/Mac are C++17, and coroutine support in the toolchains we use
+would still require a separate experimental header per compiler.  Long
+flows should be written as a custom Task<T> (see above) holding the flow's
+state in one object, with each step as a member function - this is the
+closest equivalent to a coroutine frame, and abandoning the task cancels
+the whole flow.
+
+
 */
 
 
@@ -335,6 +347,13 @@ private:
 public:
     virtual ~BaseTask() override;
 
+    // Tasks are allocated from a per-thread cache of recycled blocks.  Most
+    // tasks are short-lived links in a then() chain, so this avoids a trip to
+    // the general-purpose allocator for most of them.  (Sizes larger than the
+    // cache handles use the global operators.)
+    static void *operator new(std::size_t size);
+    static void operator delete(void *pBlock, std::size_t size);
+
     // Mainly for testing: resets the counter for "naming" tasks.
     static void resetTaskIndex();
     // Get the number of live tasks.
@@ -113,6 +113,7 @@ public:
         DaemonRPCDaemonInactive,    // RPC rejected because no active client is connected
         DaemonRPCNotLoggedIn,   // RPC rejected because the user has not logged in
         DaemonRPCUnknownSetting,    // RPC rejected due to unknown setting property
+        DaemonRPCNotConnected,  // RPC rejected because the VPN is not connected
 
         // Network adapter errors (can be thrown by Daemon implementations)
         NetworkAdapterNotFound = 1600,
@@ -30,29 +30,376 @@
 #include <QDir>
 #include <QFile>
 #include <QFileSystemWatcher>
+#include <QHash>
 #include <QMutex>
 #include <QMutexLocker>
+#include <QSaveFile>
 #include <QTextStream>
 #include <QThread>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
 
 
 #if defined(QT_DEBUG) && defined(Q_OS_WIN)
 extern "C" Q_DECL_IMPORT void __stdcall OutputDebugStringW(const wchar_t *str);
 #endif
 
+namespace
+{
+    // Per-category rate limits, configured with filter rules like
+    // "openvpn.stdout.ratelimit=50" (messages per second).  The category can
+    // begin or end with '*' like Qt's rules, and later rules take precedence;
+    // a rate of 0 removes the limit.
+    //
+    // Each category has a token bucket holding up to one second of messages.
+    // Messages beyond that are dropped and counted; the count is reported with
+    // the next message that's allowed.  Critical and fatal messages are never
+    // dropped.
+    class LogRateLimiter
+    {
+    private:
+        struct Rule
+        {
+            QString pattern;
+            unsigned rate;
+        };
+
+        struct Bucket
+        {
+            unsigned rate;
+            double tokens;
+            std::chrono::steady_clock::time_point lastRefill;
+            quint64 suppressed;
+        };
+
+        static const QString ruleSuffix;
+
+    public:
+        LogRateLimiter() : _hasRules{false} {}
+
+    public:
+        // Take the rate limit rules from a list of filter rules; returns the
+        // remaining rules for QLoggingCategory
+        QStringList applyRules(const QStringList &filters)
+        {
+            QStringList qtFilters;
+            std::vector<Rule> rules;
+            for(const QString &filter : filters)
+            {
+                int eq = filter.indexOf('=');
+                QString key = filter.left(eq).trimmed();
+                if(eq < 0 || !key.endsWith(ruleSuffix))
+                {
+                    qtFilters.push_back(filter);
+                    continue;
+                }
+                bool ok = false;
+                unsigned rate = filter.midRef(eq+1).trimmed().toUInt(&ok);
+                if(ok)
+                    rules.push_back({key.left(key.size() - ruleSuffix.size()), rate});
+            }
+
+            std::lock_guard<std::mutex> lock{_mutex};
+            _rules = std::move(rules);
+            _buckets.clear();
+            _hasRules.store(!_rules.empty(), std::memory_order_relaxed);
+            return qtFilters;
+        }
+
+        // Check whether a message can be logged.  If it can, suppressed is set
+        // to the number of messages dropped since the last one.
+        bool allow(const char *category, QtMsgType type, quint64 &suppressed)
+        {
+            suppressed = 0;
+            if(!_hasRules.load(std::memory_order_relaxed) || !category ||
+               type == QtCriticalMsg || type == QtFatalMsg)
+            {
+                return true;
+            }
+
+            std::lock_guard<std::mutex> lock{_mutex};
+            auto itBucket = _buckets.find(category);
+            if(itBucket == _buckets.end())
+                itBucket = _buckets.insert(category, {findRate(category), 0, {}, 0});
+            Bucket &bucket = itBucket.value();
+            if(!bucket.rate)
+                return true;
+
+            auto now = std::chrono::steady_clock::now();
+            if(bucket.lastRefill == std::chrono::steady_clock::time_point{})
+                bucket.tokens = bucket.rate;
+            else
+            {
+                std::chrono::duration<double> elapsed{now - bucket.lastRefill};
+                bucket.tokens = std::min<double>(bucket.rate,
+                                                 bucket.tokens + elapsed.count() * bucket.rate);
+            }
+            bucket.lastRefill = now;
+
+            if(bucket.tokens < 1.0)
+            {
+                ++bucket.suppressed;
+                return false;
+            }
+            bucket.tokens -= 1.0;
+            suppressed = std::exchange(bucket.suppressed, 0);
+            return true;
+        }
+
+    private:
+        unsigned findRate(const char *category) const
+        {
+            QString name{QLatin1String{category}};
+            for(auto itRule = _rules.rbegin(); itRule != _rules.rend(); ++itRule)
+            {
+                if(matches(itRule->pattern, name))
+                    return itRule->rate;
+            }
+            return 0;
+        }
+
+        static bool matches(const QString &pattern, const QString &name)
+        {
+            bool prefix = pattern.endsWith('*');
+            bool suffix = pattern.startsWith('*');
+            if(prefix && suffix)
+                return name.contains(pattern.midRef(1, pattern.size()-2));
+            if(prefix)
+                return name.startsWith(pattern.leftRef(pattern.size()-1));
+            if(suffix)
+                return name.endsWith(pattern.midRef(1));
+            return name == pattern;
+        }
+
+    private:
+        std::atomic<bool> _hasRules;
+        std::mutex _mutex;
+        std::vector<Rule> _rules;
+        // Buckets are found by the category's name pointer; the logging
+        // macros pass each category's static name
+        QHash<const char*, Bucket> _buckets;
+    };
+
+    const QString LogRateLimiter::ruleSuffix{QStringLiteral(".ratelimit")};
+}
+
 // These globals are needed as they're used in Logger::initialize (before Logger::Logger)
 namespace
 {
     QMutex g_logMutex(QMutex::Recursive);
+    // Serializes stderr/debugger output.  This is separate from g_logMutex so
+    // logging threads don't wait for the log writer's disk I/O.
+    QMutex g_outputMutex;
     QDateTime g_startTime;
-    bool g_logToStdErr = false;
+    std::atomic<bool> g_logToStdErr{false};
+    LogRateLimiter g_rateLimiter;
 }
 
 // The log limit in bytes
 const qint64 logFileLimit = 4000000;
 
+// Suffix of a rotated log that is waiting to be compressed
+const QString pendingCompressionSuffix = QStringLiteral(".1");
+
+// Interval at which queued log lines are written when nothing requests an
+// earlier write
+const std::chrono::milliseconds logFlushInterval{250};
+
+// Queue of log entries waiting to be written by the log writer thread.  Any
+// thread can push entries without locking; the writer takes the whole queue
+// at once.
+template<class Item>
+class LogQueue
+{
+private:
+    struct Node
+    {
+        Item item;
+        Node *pNext;
+    };
+
+public:
+    LogQueue() : _pHead{nullptr} {}
+    ~LogQueue() {takeAll([](Item &&){});}
+
+    Q_DISABLE_COPY(LogQueue)
+
+public:
+    void push(Item item)
+    {
+        Node *pNode = new Node{std::move(item), _pHead.load(std::memory_order_relaxed)};
+        while(!_pHead.compare_exchange_weak(pNode->pNext, pNode,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed))
+        {
+        }
+    }
+
+    // Take all queued entries; func is called with each one in the order they
+    // were pushed
+    template<class Func>
+    void takeAll(Func &&func)
+    {
+        // The list is newest-first; reverse it
+        Node *pNode = _pHead.exchange(nullptr, std::memory_order_acquire);
+        Node *pOldest = nullptr;
+        while(pNode)
+        {
+            Node *pNext = pNode->pNext;
+            pNode->pNext = pOldest;
+            pOldest = pNode;
+            pNode = pNext;
+        }
+
+        while(pOldest)
+        {
+            func(std::move(pOldest->item));
+            Node *pNext = pOldest->pNext;
+            delete pOldest;
+            pOldest = pNext;
+        }
+    }
+
+private:
+    std::atomic<Node*> _pHead;
+};
+
+// A message queued for the binary log.  Nothing is formatted when the message
+// is logged; the writer encodes it.  The category and file are the static
+// strings provided by the logging macros, they're interned by address.
+struct BinaryLogRecord
+{
+    // UTC timestamp, ms since the epoch
+    qint64 timestamp;
+    const char *category;
+    const char *file;
+    int line;
+    quint16 threadId;
+    QtMsgType type;
+    QString message;
+};
+
+// Binary log format:
+//
+// The file begins with binaryLogMagic.  Each record is a kind byte, the
+// payload length (varint), and the payload.  Varints are unsigned LEB128.
+//
+// - CategoryDef / FileDef: id (varint), name (UTF-8, rest of payload)
+// - Message: timestamp (varint, ms since epoch UTC), type (1 byte), thread
+//   ID (2 bytes LE), category ID, file ID, line (varints), message (UTF-8,
+//   rest of payload)
+//
+// ID 0 is "none"; other IDs are defined before their first use in each log
+// session.  A later definition of an ID replaces the earlier one.
+namespace
+{
+namespace BinaryLog
+{
+    const char magic[] = "PIALOGB1";
+    const int magicLength = sizeof(magic) - 1;
+
+    enum RecordKind : quint8
+    {
+        CategoryDef = 1,
+        FileDef = 2,
+        Message = 3,
+    };
+
+    void appendVarint(QByteArray &out, quint64 value)
+    {
+        while(value >= 0x80)
+        {
+            out.append(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.append(static_cast<char>(value));
+    }
+
+    bool readVarint(const char *&pData, const char *pEnd, quint64 &value)
+    {
+        value = 0;
+        for(int shift = 0; pData != pEnd && shift < 64; shift += 7)
+        {
+            quint8 byte = static_cast<quint8>(*pData++);
+            value |= static_cast<quint64>(byte & 0x7F) << shift;
+            if(!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    void appendRecord(QByteArray &out, RecordKind kind, const QByteArray &payload)
+    {
+        out.append(static_cast<char>(kind));
+        appendVarint(out, static_cast<quint64>(payload.size()));
+        out.append(payload);
+    }
+
+    // Encodes records for one log session, defining each category and file
+    // the first time it's used
+    class Encoder
+    {
+    public:
+        Encoder() = default;
+
+    public:
+        // Forget the definitions; used when starting a new file or session
+        void reset() {_categories.clear(); _files.clear();}
+
+        void encode(QByteArray &out, const BinaryLogRecord &record)
+        {
+            quint64 categoryId = intern(out, _categories, CategoryDef, record.category);
+            quint64 fileId = intern(out, _files, FileDef, record.file);
+
+            _payload.resize(0);
+            appendVarint(_payload, static_cast<quint64>(std::max<qint64>(record.timestamp, 0)));
+            _payload.append(static_cast<char>(record.type));
+            _payload.append(static_cast<char>(record.threadId & 0xFF));
+            _payload.append(static_cast<char>(record.threadId >> 8));
+            appendVarint(_payload, categoryId);
+            appendVarint(_payload, fileId);
+            appendVarint(_payload, static_cast<quint64>(std::max(record.line, 0)));
+            _payload.append(record.message.toUtf8());
+            appendRecord(out, Message, _payload);
+        }
+
+    private:
+        quint64 intern(QByteArray &out, QHash<const char*, quint64> &ids,
+                       RecordKind defKind, const char *name)
+        {
+            if(!name)
+                return 0;
+            auto itId = ids.find(name);
+            if(itId != ids.end())
+                return itId.value();
+
+            quint64 id = static_cast<quint64>(ids.size()) + 1;
+            ids.insert(name, id);
+            QByteArray def;
+            appendVarint(def, id);
+            def.append(name);
+            appendRecord(out, defKind, def);
+            return id;
+        }
+
+    private:
+        QHash<const char*, quint64> _categories, _files;
+        // Reused for each message payload
+        QByteArray _payload;
+    };
+}
+}
+
 class LoggerPrivate
 {
     CLASS_LOGGING_CATEGORY("logger")
@@ -62,19 +409,31 @@ class LoggerPrivate
     Logger * const q_ptr;
 
     LoggerPrivate(Logger* logger, const Path &logFilePath);
+    ~LoggerPrivate();
 
     QFile logFile;
     qint64 logSize;
     QStringList filters;
     QFileSystemWatcher watcher;
     Path logFilePath;
+    // Whether the binary format is used for the log file.  This is set under
+    // g_logMutex, but the logging handler reads it from any thread.
+    std::atomic<bool> binaryFormat;
+    // Encodes the binary log for the currently open file
+    BinaryLog::Encoder binaryEncoder;
 
     static const QString defaultFilters;
     static const QString disabledFilters;
 
     // Use fileName != "" as the "should log to file" flag
     bool logToFile() const { return !logFile.fileName().isEmpty(); }
+    // Path of the log file for the current format
+    QString activeLogFilePath() const;
 
+    // Apply base filter rules followed by the configured filters.  Rate limit
+    // rules are taken by the rate limiter; the rest are applied to
+    // QLoggingCategory.
+    static void applyFilterRules(const QString &baseFilters, const QStringList &filters);
     // Read debug.txt and update config
     void readDebugFile(bool watchingDirectory = false);
     // Write current filters to debug.txt (will create file)
@@ -85,11 +444,93 @@ class LoggerPrivate
     bool openLogFile(bool newSession = true);
     // Helper to write a pre-formatted chunk of lines to the log file
     void writeToLogFile(const QString& lines);
+    // Write encoded binary records to the log file
+    void writeToLogFile(const QByteArray &records);
+    // Start a binary log file (or the part appended by a new session) -
+    // writes the header if the file is empty and resets the encoder
+    void beginBinaryLog();
+    // Rotate or truncate the log file if it has exceeded the limit
+    void checkLogSize();
+
+    // Log lines are written to the file on a writer thread, so logging
+    // doesn't wait for disk I/O.  Lines are written in batches every
+    // logFlushInterval, or immediately for warnings and errors.
+    LogQueue<QString> pendingLines;
+    // Messages for the binary log are queued unformatted
+    LogQueue<BinaryLogRecord> pendingRecords;
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+    // Set (under wakeMutex) to wake the writer thread early, or to stop it
+    bool flushRequested;
+    bool stopWriter;
+    std::thread writerThread;
+
+    // Queue lines to be written to the log file.  If flushNow is set, the
+    // writer is woken to write them immediately.
+    void queueLines(QString lines, bool flushNow);
+    void queueRecord(BinaryLogRecord record, bool flushNow);
+    // Wake the writer to write queued entries now
+    void requestFlush();
+    // Write all queued lines now (on the calling thread)
+    void flushPendingLines();
+    void writerMain();
+
+    // When the log is rotated, the previous .old file is compressed into
+    // generation 1 on this thread, after shifting the older generations.
+    std::thread compressThread;
+
+    // Rotate the full log file to the .old file, and start compressing the
+    // previous .old file.  Returns false if the .old file can't be replaced.
+    bool rotateLogFile();
+    // Wait for a previous compression to finish, if one is running
+    void waitForCompression();
+    // Shift the compressed generations and compress pendingPath as
+    // generation 1 (runs on compressThread)
+    static void compressGenerations(const QString &logFilePath,
+                                    const QString &pendingPath);
 
     // Wipe log file and backup log file if exists
     void wipeLogFile();
 };
 
+namespace
+{
+    void appendLE32(QByteArray &out, quint32 value)
+    {
+        for(int i=0; i<4; ++i)
+            out.append(static_cast<char>((value >> (i*8)) & 0xFF));
+    }
+
+    // Write data to targetPath as a gzip file.  The raw deflate data is
+    // wrapped with a gzip header and trailer so the result can be read with
+    // any standard tool.
+    bool writeGzipFile(const QString &targetPath, const QByteArray &data)
+    {
+        QByteArray deflateData = deflateRaw(data, 9);
+        if(deflateData.isEmpty())
+            return false;
+
+        QByteArray gzipData;
+        gzipData.reserve(deflateData.size() + 18);
+        // Magic, deflate method, no flags, no mtime, max compression, unknown OS
+        static const char header[]{'\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 2, '\xff'};
+        gzipData.append(header, sizeof(header));
+        gzipData.append(deflateData);
+        appendLE32(gzipData, crc32(data));
+        appendLE32(gzipData, static_cast<quint32>(data.size()));
+
+        QSaveFile target{targetPath};
+        if(!target.open(QIODevice::WriteOnly))
+            return false;
+        if(target.write(gzipData) != gzipData.size())
+        {
+            target.cancelWriting();
+            return false;
+        }
+        return target.commit();
+    }
+}
+
 // This is the default "base" filterset applied when logging to disk is enabled.
 //
 // It is _not_ the same thing as the filterset applied in
@@ -203,7 +644,7 @@ void Logger::configure(bool logToFile, const QStringList& filters)
         if (filters != d->filters)
         {
             d->filters = filters;
-            QLoggingCategory::setFilterRules((logToFile ? d->defaultFilters : d->disabledFilters) + filters.join('\n'));
+            d->applyFilterRules(logToFile ? d->defaultFilters : d->disabledFilters, filters);
             changed = true;
             if (logToFile)
                 writeDebugFile = true;
@@ -223,13 +664,46 @@ void Logger::configure(bool logToFile, const QStringList& filters)
         emit configurationChanged(d->logToFile(), d->filters);
 }
 
+bool Logger::binaryFormat() const
+{
+    Q_D(Logger);
+    return d->binaryFormat;
+}
+
+void Logger::setBinaryFormat(bool binaryFormat)
+{
+    Q_D(Logger);
+    bool success = true;
+    {
+        QMutexLocker lock(&g_logMutex);
+        if (binaryFormat == d->binaryFormat)
+            return;
+
+        // Write anything queued in the current format to the current file
+        d->flushPendingLines();
+        d->binaryFormat = binaryFormat;
+        if (d->logToFile())
+        {
+            d->logFile.close();
+            success = d->openLogFile();
+        }
+    }
+    if (!success)
+        qError() << "Unable to open log file for writing:" << d->activeLogFilePath();
+}
+
 
 LoggerPrivate::LoggerPrivate(Logger* logger, const Path &logFilePath)
     : q_ptr(logger)
     , logSize(0)
     , logFilePath{logFilePath}
+    , binaryFormat{false}
+    , flushRequested{false}
+    , stopWriter{false}
 {
-    QLoggingCategory::setFilterRules(disabledFilters + filters.join('\n'));
+    writerThread = std::thread{[this](){writerMain();}};
+
+    applyFilterRules(disabledFilters, filters);
 
     QObject::connect(&watcher, &QFileSystemWatcher::directoryChanged, logger, [this]() { readDebugFile(true); });
     QObject::connect(&watcher, &QFileSystemWatcher::fileChanged, logger, [this]() { readDebugFile(false); });
@@ -252,6 +726,86 @@ LoggerPrivate::LoggerPrivate(Logger* logger, const Path &logFilePath)
         watcher.addPath(Path::DebugFile.parent());
 }
 
+LoggerPrivate::~LoggerPrivate()
+{
+    waitForCompression();
+    {
+        std::lock_guard<std::mutex> lock{wakeMutex};
+        stopWriter = true;
+    }
+    wakeCondition.notify_one();
+    writerThread.join();
+    // Write anything queued after the writer's last batch
+    flushPendingLines();
+}
+
+void LoggerPrivate::queueLines(QString lines, bool flushNow)
+{
+    pendingLines.push(std::move(lines));
+    if(flushNow)
+        requestFlush();
+}
+
+void LoggerPrivate::queueRecord(BinaryLogRecord record, bool flushNow)
+{
+    pendingRecords.push(std::move(record));
+    if(flushNow)
+        requestFlush();
+}
+
+void LoggerPrivate::requestFlush()
+{
+    {
+        std::lock_guard<std::mutex> lock{wakeMutex};
+        flushRequested = true;
+    }
+    wakeCondition.notify_one();
+}
+
+void LoggerPrivate::flushPendingLines()
+{
+    // Take the lines while holding g_logMutex, so batches taken by different
+    // threads are written in order
+    QMutexLocker lock{&g_logMutex};
+    QString batch;
+    pendingLines.takeAll([&](QString &&lines){batch += lines;});
+    QByteArray records;
+    pendingRecords.takeAll([&](BinaryLogRecord &&record)
+    {
+        binaryEncoder.encode(records, record);
+    });
+
+    // Entries queued in the other format raced with a format change; they're
+    // dropped rather than writing text into a binary log or vice versa.
+    if(binaryFormat)
+    {
+        if(!records.isEmpty())
+            writeToLogFile(records);
+    }
+    else if(!batch.isEmpty())
+        writeToLogFile(batch);
+}
+
+void LoggerPrivate::writerMain()
+{
+    std::unique_lock<std::mutex> lock{wakeMutex};
+    while(!stopWriter)
+    {
+        wakeCondition.wait_for(lock, logFlushInterval,
+                               [this](){return flushRequested || stopWriter;});
+        flushRequested = false;
+        lock.unlock();
+        flushPendingLines();
+        lock.lock();
+    }
+}
+
+void LoggerPrivate::applyFilterRules(const QString &baseFilters, const QStringList &filters)
+{
+    QStringList qtFilters = g_rateLimiter.applyRules(filters);
+    QLoggingCategory::setFilterRules(baseFilters + qtFilters.join('\n'));
+}
+
 void LoggerPrivate::readDebugFile(bool watchingDirectory)
 {
     Q_Q(Logger);
@@ -276,7 +830,7 @@ void LoggerPrivate::readDebugFile(bool watchingDirectory)
         if (filterLines != filters)
         {
             filters = filterLines;
-            QLoggingCategory::setFilterRules((logToFile() ? defaultFilters : disabledFilters) + filterString);
+            applyFilterRules(logToFile() ? defaultFilters : disabledFilters, filterLines);
             changed = true;
         }
         g_logMutex.unlock();
@@ -300,7 +854,7 @@ void LoggerPrivate::readDebugFile(bool watchingDirectory)
         if (!filters.empty())
         {
             filters.clear();
-            QLoggingCategory::setFilterRules(disabledFilters);
+            applyFilterRules(disabledFilters, {});
             changed = true;
         }
         g_logMutex.unlock();
@@ -338,13 +892,31 @@ void LoggerPrivate::removeDebugFile()
     }
 }
 
+QString LoggerPrivate::activeLogFilePath() const
+{
+    if(binaryFormat)
+        return logFilePath + binaryLogSuffix;
+    return logFilePath;
+}
+
 bool LoggerPrivate::openLogFile(bool newSession)
 {
-    logFile.setFileName(logFilePath);
-    if (logFile.open(QFile::WriteOnly | QFile::Append | QFile::Text))
+    logFile.setFileName(activeLogFilePath());
+    // The binary log must not be opened in text mode, which would translate
+    // line endings on Windows
+    QIODevice::OpenMode mode = QFile::WriteOnly | QFile::Append;
+    if(!binaryFormat)
+        mode |= QFile::Text;
+    if (logFile.open(mode))
     {
         logSize = logFile.size();
-        if (newSession)
+        if(binaryFormat)
+        {
+            beginBinaryLog();
+            if(newSession)
+                qInfo() << "Starting log session (v" PIA_VERSION ")";
+        }
+        else if (newSession)
         {
             if (logSize != 0)
             {
@@ -368,46 +940,138 @@ void LoggerPrivate::writeToLogFile(const QString& lines)
         QTextStream(&logFile) << lines;
         logFile.flush();
         logSize += lines.size();
+        checkLogSize();
+    }
+}
 
-        if(logSize > logFileLimit) {
-            Path oldFilePath = logFilePath + oldFileSuffix;
-            QFileInfo oldFileInfo(oldFilePath);
+void LoggerPrivate::writeToLogFile(const QByteArray &records)
+{
+    if (logFile.isOpen())
+    {
+        logFile.write(records);
+        logFile.flush();
+        logSize += records.size();
+        checkLogSize();
+    }
+}
 
-            if(oldFileInfo.exists()) {
-                if(oldFileInfo.isWritable()) {
-                    QFile::remove(oldFilePath);
-                }
-                else {
-                    // If we cannot create a new backup file, or it cannot
-                    // be deleted, clear the existing file.
-                    logFile.resize(0);
-                    logFile.seek(0);
-                    logSize = 0;
-                    return;
-                }
-            }
-            // Copy the file to the old file
-            // This also automatically closes the old file
-            logFile.rename(oldFilePath);
+void LoggerPrivate::beginBinaryLog()
+{
+    if(logSize == 0)
+    {
+        logFile.write(BinaryLog::magic, BinaryLog::magicLength);
+        logSize += BinaryLog::magicLength;
+    }
+    // Categories and files are defined again for each file and session, so
+    // each one can be decoded on its own
+    binaryEncoder.reset();
+}
 
-            // Create and use a new log file
-            openLogFile(false);
-        }
+void LoggerPrivate::checkLogSize()
+{
+    if(logSize > logFileLimit && !rotateLogFile()) {
+        // If we cannot create a new backup file, or it cannot
+        // be deleted, clear the existing file.
+        logFile.resize(0);
+        logFile.seek(0);
+        logSize = 0;
+        if(binaryFormat)
+            beginBinaryLog();
+    }
+}
+
+bool LoggerPrivate::rotateLogFile()
+{
+    QString activePath = activeLogFilePath();
+    Path oldFilePath = activePath + oldFileSuffix;
+    QFileInfo oldFileInfo(oldFilePath);
+    QString pendingPath = activePath + pendingCompressionSuffix;
+
+    // The last rotation's compression is normally finished long before the
+    // log fills up again, but it has to be done before reusing pendingPath.
+    waitForCompression();
+
+    bool compressOld = false;
+    if(oldFileInfo.exists()) {
+        if(!oldFileInfo.isWritable())
+            return false;
+        // Move the old file aside to be compressed.  If that fails, just
+        // replace it like a single-generation rotation.
+        QFile::remove(pendingPath);
+        compressOld = QFile::rename(oldFilePath, pendingPath);
+        if(!compressOld)
+            QFile::remove(oldFilePath);
+    }
+
+    // Copy the file to the old file
+    // This also automatically closes the old file
+    logFile.rename(oldFilePath);
+
+    // Create and use a new log file
+    openLogFile(false);
+
+    if(compressOld)
+    {
+        compressThread = std::thread{&LoggerPrivate::compressGenerations,
+                                     activePath, pendingPath};
     }
+    return true;
+}
+
+void LoggerPrivate::waitForCompression()
+{
+    if(compressThread.joinable())
+        compressThread.join();
+}
+
+void LoggerPrivate::compressGenerations(const QString &logFilePath,
+                                        const QString &pendingPath)
+{
+    // Shift the existing generations up, dropping the oldest
+    QFile::remove(compressedLogFilePath(logFilePath, compressedLogGenerations));
+    for(int generation = compressedLogGenerations-1; generation >= 1; --generation)
+    {
+        QString source = compressedLogFilePath(logFilePath, generation);
+        if(QFile::exists(source))
+            QFile::rename(source, compressedLogFilePath(logFilePath, generation+1));
+    }
+
+    QFile pendingFile{pendingPath};
+    if(!pendingFile.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "Unable to read rotated log file" << pendingPath;
+        return;
+    }
+    QByteArray data = pendingFile.readAll();
+    pendingFile.close();
+
+    if(!writeGzipFile(compressedLogFilePath(logFilePath, 1), data))
+        qWarning() << "Unable to compress rotated log file" << pendingPath;
+    // Remove the uncompressed file either way, the log generations must not
+    // grow without bound if compression fails
+    pendingFile.remove();
 }
 
 void LoggerPrivate::wipeLogFile()
 {
-    Path oldFilePath = logFilePath + oldFileSuffix;
     if(logToFile()) {
         qWarning () << "Tried to wipe logfile while logging still enabled.";
         return;
     }
-    if(QFile::exists(logFilePath)) {
-        QFile::remove(logFilePath);
-    }
-    if(QFile::exists(oldFilePath)) {
-        QFile::remove(oldFilePath);
+    waitForCompression();
+    // Wipe the text and binary logs, either could have been written
+    for(const QString &path : {QString{logFilePath}, QString{logFilePath + binaryLogSuffix}})
+    {
+        QString oldFilePath = path + oldFileSuffix;
+        if(QFile::exists(path)) {
+            QFile::remove(path);
+        }
+        if(QFile::exists(oldFilePath)) {
+            QFile::remove(oldFilePath);
+        }
+        QFile::remove(path + pendingCompressionSuffix);
+        for(int generation = 1; generation <= compressedLogGenerations; ++generation)
+            QFile::remove(compressedLogFilePath(path, generation));
     }
 }
 
@@ -443,26 +1107,33 @@ static void renderLocation(QTextStream& s, const char* file, int line)
     }
 }
 
-static QString buildLogFilePrefix(QDateTime now, QtMsgType type,
-                                  const QMessageLogContext &context)
+// Thread ID shown in the log file - the current thread ID folded to 16 bits
+static quint16 logThreadId()
 {
-    QString prefix;
-    QTextStream s(&prefix, QIODevice::WriteOnly);
-
     auto tid = reinterpret_cast<quintptr>(QThread::currentThreadId());
     tid ^= tid >> 16;
 #if QT_POINTER_SIZE > 4
     tid ^= tid >> 32;
 #endif
+    return static_cast<quint16>(tid);
+}
+
+static QString buildLogFilePrefix(const QDateTime &now, quint16 threadId,
+                                  QtMsgType type, const char *category,
+                                  const char *file, int line)
+{
+    QString prefix;
+    QTextStream s(&prefix, QIODevice::WriteOnly);
+
     char tidHex[8];
-    std::sprintf(tidHex, "%04x", (quint16)tid);
+    std::sprintf(tidHex, "%04x", threadId);
 
     s << now.toString("[yyyy-MM-dd hh:mm:ss.zzz]");
 
     s << '[' << tidHex << ']';
-    if (context.category)
-        s << '[' << QLatin1String(context.category) << ']';
-    renderLocation(s, context.file, context.line);
+    if (category)
+        s << '[' << QLatin1String(category) << ']';
+    renderLocation(s, file, line);
     renderMsgType(s, type);
 
     return prefix;
@@ -496,50 +1167,89 @@ static QString buildDebugOutputPrefix(QDateTime now, QtMsgType type,
     return prefix;
 }
 
-void Logger::loggingHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
+void Logger::loggingHandler(QtMsgType type, const QMessageLogContext &context, const QString &message)
 {
     // Override with simpler endl; gets converted by text file handling anyway
     const char endl = '\n';
 
-    QDateTime now{QDateTime::currentDateTimeUtc()};
-    QString logPrefix{buildLogFilePrefix(now, type, context)};
-    QString outputPrefix{buildDebugOutputPrefix(now, type, context)};
-
-    QString logLines;
-    QString outputLines;
+    // Drop messages over the category's rate limit before doing anything else.
+    // When messages were dropped, report that with the next one.
+    quint64 suppressed;
+    if (!g_rateLimiter.allow(context.category, type, suppressed))
+        return;
+    QString suppressedMessage;
+    if (suppressed)
     {
-        QTextStream logStream(&logLines, QIODevice::WriteOnly);
-        QTextStream outputStream(&outputLines, QIODevice::WriteOnly);
-        for (const auto& line : msg.splitRef('\n'))
-        {
-            logStream << logPrefix << ' ' << line << endl;
-            outputStream << outputPrefix << ' ' << line << endl;
-        }
+        suppressedMessage = QStringLiteral("(%1 messages suppressed by rate limit)\n").arg(suppressed) + message;
     }
+    const QString &msg = suppressed ? suppressedMessage : message;
+
+    QDateTime now{QDateTime::currentDateTimeUtc()};
 
     Logger* self = Logger::instance();
     LoggerPrivate* const d = self ? self->d_func() : nullptr;
 
-    g_logMutex.lock();
-
+    // Only format the lines for each output that's actually used
 #if defined(QT_DEBUG) && defined(Q_OS_WIN)
-    if (isDebuggerPresent())
-    {
-        ::OutputDebugStringW(qUtf16Printable(outputLines));
-    }
-    else
+    bool debuggerOutput = isDebuggerPresent();
+#else
+    const bool debuggerOutput = false;
 #endif
+    if (debuggerOutput || g_logToStdErr)
     {
-        if(g_logToStdErr)
+        QString outputPrefix{buildDebugOutputPrefix(now, type, context)};
+        QString outputLines;
+        {
+            QTextStream outputStream(&outputLines, QIODevice::WriteOnly);
+            for (const auto& line : msg.splitRef('\n'))
+                outputStream << outputPrefix << ' ' << line << endl;
+        }
+
+        g_outputMutex.lock();
+#if defined(QT_DEBUG) && defined(Q_OS_WIN)
+        if (debuggerOutput)
+        {
+            ::OutputDebugStringW(qUtf16Printable(outputLines));
+        }
+        else
+#endif
+        {
             QTextStream(stderr, QIODevice::WriteOnly) << outputLines;
+        }
+        g_outputMutex.unlock();
     }
+
+    // Write to the log file on the writer thread.  Write warnings and errors
+    // right away, they're often followed by a crash or exit.
     if (d)
     {
-        d->writeToLogFile(logLines);
+        bool flushNow = type != QtDebugMsg && type != QtInfoMsg;
+        if (d->binaryFormat)
+        {
+            // The binary log is encoded by the writer; nothing is formatted
+            // here
+            d->queueRecord({now.toMSecsSinceEpoch(), context.category,
+                            context.file, context.line, logThreadId(), type,
+                            msg},
+                           flushNow);
+        }
+        else
+        {
+            QString logPrefix{buildLogFilePrefix(now, logThreadId(), type,
+                                                 context.category, context.file,
+                                                 context.line)};
+            QString logLines;
+            {
+                QTextStream logStream(&logLines, QIODevice::WriteOnly);
+                for (const auto& line : msg.splitRef('\n'))
+                    logStream << logPrefix << ' ' << line << endl;
+            }
+            d->queueLines(std::move(logLines), flushNow);
+        }
+        if (type == QtFatalMsg)
+            d->flushPendingLines();
     }
 
-    g_logMutex.unlock();
-
     // Failure to queue arguments is a programming error (and hard to debug),
     // assert to provide a way to debug it.
     Q_ASSERT(!msg.startsWith("QObject::connect: Cannot queue arguments of type"));
@@ -554,6 +1264,93 @@ void Logger::loggingHandler(QtMsgType type, const QMessageLogContext &context, c
     }
 }
 
+QByteArray renderBinaryLog(const QByteArray &data)
+{
+    const char *pData = data.constData();
+    const char *pEnd = pData + data.size();
+    if(data.size() < BinaryLog::magicLength ||
+       std::memcmp(pData, BinaryLog::magic, BinaryLog::magicLength) != 0)
+    {
+        return {};
+    }
+    pData += BinaryLog::magicLength;
+
+    QHash<quint64, QByteArray> categories, files;
+    QString text;
+    QTextStream s{&text, QIODevice::WriteOnly};
+    const char endl = '\n';
+    while(pData != pEnd)
+    {
+        quint8 kind = static_cast<quint8>(*pData++);
+        quint64 length;
+        if(!BinaryLog::readVarint(pData, pEnd, length) ||
+           length > static_cast<quint64>(pEnd - pData))
+        {
+            break;  // Truncated, render what was read
+        }
+        const char *pRecord = pData;
+        const char *pRecordEnd = pData + length;
+        pData = pRecordEnd;
+
+        quint64 id;
+        switch(kind)
+        {
+        case BinaryLog::CategoryDef:
+        case BinaryLog::FileDef:
+            if(BinaryLog::readVarint(pRecord, pRecordEnd, id))
+            {
+                auto &names = (kind == BinaryLog::CategoryDef) ? categories : files;
+                names.insert(id, QByteArray{pRecord, static_cast<int>(pRecordEnd - pRecord)});
+            }
+            break;
+        case BinaryLog::Message:
+        {
+            quint64 timestamp, categoryId, fileId, line;
+            if(!BinaryLog::readVarint(pRecord, pRecordEnd, timestamp) ||
+               pRecordEnd - pRecord < 3)
+            {
+                break;
+            }
+            auto type = static_cast<QtMsgType>(static_cast<quint8>(pRecord[0]));
+            quint16 threadId = static_cast<quint8>(pRecord[1]) |
+                static_cast<quint16>(static_cast<quint8>(pRecord[2]) << 8);
+            pRecord += 3;
+            if(!BinaryLog::readVarint(pRecord, pRecordEnd, categoryId) ||
+               !BinaryLog::readVarint(pRecord, pRecordEnd, fileId) ||
+               !BinaryLog::readVarint(pRecord, pRecordEnd, line))
+            {
+                break;
+            }
+            // Unknown IDs (0, or a definition that was lost) render like a
+            // message without that information
+            auto itCategory = categories.find(categoryId);
+            auto itFile = files.find(fileId);
+            QString prefix{buildLogFilePrefix(QDateTime::fromMSecsSinceEpoch(static_cast<qint64>(timestamp), Qt::UTC),
+                                              threadId, type,
+                                              itCategory == categories.end() ? nullptr : itCategory->constData(),
+                                              itFile == files.end() ? nullptr : itFile->constData(),
+                                              static_cast<int>(line))};
+            QString message{QString::fromUtf8(pRecord, static_cast<int>(pRecordEnd - pRecord))};
+            for(const auto &messageLine : message.splitRef('\n'))
+                s << prefix << ' ' << messageLine << endl;
+            break;
+        }
+        default:
+            // Unknown record kinds are skipped, they're length-prefixed
+            break;
+        }
+    }
+    s.flush();
+    return text.toUtf8();
+}
+
+void Logger::flushPending()
+{
+    Logger* self = Logger::instance();
+    if (self)
+        self->d_func()->flushPendingLines();
+}
+
 void QCustomMessageLogger::fatal(const Error& e)
 {
     auto str = e.errorString().toUtf8();
@@ -583,3 +1380,12 @@ void QCustomMessageLogger::debug(const Error& e)
 #endif
 
 const QString oldFileSuffix = QStringLiteral(".old");
+
+const QString binaryLogSuffix = QStringLiteral(".bin");
+
+const int compressedLogGenerations = 4;
+
+QString compressedLogFilePath(const QString &logFilePath, int generation)
+{
+    return logFilePath + QStringLiteral(".%1.gz").arg(generation);
+}
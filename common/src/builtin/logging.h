@@ -66,16 +66,61 @@ inline QDebug operator<<(QDebug d, const CodeLocation &location)
         << location.file << ":" << location.line;
 }
 
+// Each QLoggingCategory caches whether each message type is enabled in an
+// atomic flag; Qt updates these when the filter rules change (which happens
+// in Logger::configure()).  The message type is a template parameter so each
+// log site tests the right flag inline rather than calling
+// QLoggingCategory::isEnabled(), and types disabled at compile time (such as
+// QT_NO_DEBUG_OUTPUT) evaluate to a constant.
 class COMMON_EXPORT LogEnableHelper
 {
     const QLoggingCategory* const _cat;
 public:
     explicit LogEnableHelper(const QLoggingCategory* cat) : _cat(cat) {}
-    static LogEnableHelper test(const QLoggingCategory* cat, QtMsgType type) { return LogEnableHelper(cat && cat->isEnabled(type) ? cat : nullptr); }
+    template<QtMsgType type>
+    static bool isEnabled(const QLoggingCategory &cat);
+    template<QtMsgType type>
+    static LogEnableHelper test(const QLoggingCategory* cat) { return LogEnableHelper(cat && isEnabled<type>(*cat) ? cat : nullptr); }
     operator bool() const { return !_cat; } // evaluate to false if we have a category
     const char* name() const { return _cat->categoryName(); }
 };
 
+template<>
+inline bool LogEnableHelper::isEnabled<QtDebugMsg>(const QLoggingCategory &cat)
+{
+#if defined(QT_NO_DEBUG_OUTPUT)
+    Q_UNUSED(cat);
+    return false;
+#else
+    return cat.isDebugEnabled();
+#endif
+}
+template<>
+inline bool LogEnableHelper::isEnabled<QtInfoMsg>(const QLoggingCategory &cat)
+{
+#if defined(QT_NO_INFO_OUTPUT)
+    Q_UNUSED(cat);
+    return false;
+#else
+    return cat.isInfoEnabled();
+#endif
+}
+template<>
+inline bool LogEnableHelper::isEnabled<QtWarningMsg>(const QLoggingCategory &cat)
+{
+#if defined(QT_NO_WARNING_OUTPUT)
+    Q_UNUSED(cat);
+    return false;
+#else
+    return cat.isWarningEnabled();
+#endif
+}
+template<>
+inline bool LogEnableHelper::isEnabled<QtCriticalMsg>(const QLoggingCategory &cat)
+{
+    return cat.isCriticalEnabled();
+}
+
 // Custom subclass to handle the qDebug(exception) syntax for logging
 // exceptions with their original location context.
 //
@@ -139,7 +184,7 @@ public:
 #undef qCInfo
 #undef qCDebug
 
-#define LOG_IMPL(type, category) if (auto __cat = LogEnableHelper::test(&category(), type)) {} else QCustomMessageLogger(LOG_FILE, LOG_LINE, LOG_FUNC, __cat.name())
+#define LOG_IMPL(type, category) if (auto __cat = LogEnableHelper::test<type>(&category())) {} else QCustomMessageLogger(LOG_FILE, LOG_LINE, LOG_FUNC, __cat.name())
 
 #define qFatal    QCustomMessageLogger(LOG_FILE, LOG_LINE, LOG_FUNC, currentLoggingCategory().categoryName()).fatal
 
@@ -156,6 +201,15 @@ public:
 #define qCError   qCCritical
 #define qError    qCritical
 
+// Test whether a message type is enabled for the current category (or a given
+// category).  The log macros above already skip formatting their arguments
+// when disabled; use these to also skip preparing data that's only used for
+// logging.
+#define qCDebugEnabled(category) LogEnableHelper::isEnabled<QtDebugMsg>(category())
+#define qCInfoEnabled(category)  LogEnableHelper::isEnabled<QtInfoMsg>(category())
+#define qDebugEnabled()          qCDebugEnabled(currentLoggingCategory)
+#define qInfoEnabled()           qCInfoEnabled(currentLoggingCategory)
+
 #ifdef QT_DEBUG
 #define qFatalIfRelease qCritical
 #else
@@ -253,6 +307,11 @@ public:
     static void initialize(bool logToStdErr);
     static void enableStdErr(bool logToStdErr);
 
+    // Log lines are written to the log file asynchronously.  Write any lines
+    // that are still queued now - used by the crash handler so the log is
+    // complete when it's collected.
+    static void flushPending();
+
     // Instantiate the singleton in the main thread after QCoreApplication has been created.
     explicit Logger(const Path &logFilePath);
 
@@ -266,6 +325,14 @@ public:
     void wipeLogFile ();
 
     Q_SLOT void configure(bool logToFile, const QStringList& filters);
+
+    // Write the log file in a compact binary format rather than text.
+    // Messages are queued without formatting and encoded by the log writer,
+    // with categories and source files stored as IDs.  The binary log is
+    // written beside the text log (with binaryLogSuffix) and rotated the same
+    // way; renderBinaryLog() converts it to the text format.
+    bool binaryFormat() const;
+    void setBinaryFormat(bool binaryFormat);
     Q_SIGNAL void configurationChanged(bool logToFile, const QStringList& filters);
 
 private:
@@ -277,4 +344,17 @@ private:
 // Replace daemon.log with daemon.log.old
 extern COMMON_EXPORT const QString oldFileSuffix;
 
+// The binary log is written to daemon.log.bin (see Logger::setBinaryFormat())
+extern COMMON_EXPORT const QString binaryLogSuffix;
+
+// Render the content of a binary log file as text, in the same format as the
+// text log.  If the data is truncated, the complete records are rendered.
+// Returns an empty array if the data isn't a binary log.
+COMMON_EXPORT QByteArray renderBinaryLog(const QByteArray &data);
+
+// Older logs are compressed with gzip as daemon.log.1.gz (newest) through
+// daemon.log.<compressedLogGenerations>.gz (oldest)
+extern COMMON_EXPORT const int compressedLogGenerations;
+COMMON_EXPORT QString compressedLogFilePath(const QString &logFilePath, int generation);
+
 #endif // BUILTIN_LOGGING_H
@@ -52,6 +52,7 @@ Path Path::OpenVPNExecutable;
 Path Path::OpenVPNConfigFile;
 Path Path::OpenVPNUpDownScript;
 Path Path::HnsdExecutable;
+Path Path::HnsdDataDir;
 Path Path::SsLocalExecutable;
 #ifdef Q_OS_WIN
 Path Path::TapDriverDir;
@@ -69,6 +70,9 @@ Path Path::ClientDataDir;
 Path Path::ClientSettingsDir;
 Path Path::ClientLogFile;
 Path Path::CliLogFile;
+#ifdef Q_OS_WIN
+Path Path::ClientAppScanIndexFile;
+#endif
 #ifdef Q_OS_MAC
 Path Path::ClientUpdateDir;
 Path Path::ClientLaunchAgentPlist;
@@ -204,11 +208,15 @@ void Path::initializePostApp()
     ClientExecutable = ExecutableDir / BRAND_CODE "-client";
 #endif
     DaemonUpdateDir = DaemonDataDir / "update";
+    HnsdDataDir = DaemonDataDir / "hnsd";
 
 #ifdef PIA_CLIENT
     ClientDataDir = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
     ClientLogFile = ClientDataDir / "client.log";
     CliLogFile = ClientDataDir / "cli.log";
+#ifdef Q_OS_WIN
+    ClientAppScanIndexFile = ClientDataDir / "appscan.json";
+#endif
 #ifdef Q_OS_MAC
     ClientUpdateDir = ClientDataDir / "update";
     ClientLaunchAgentPlist = Path{QStandardPaths::writableLocation(QStandardPaths::HomeLocation)} / "Library/LaunchAgents/" BRAND_IDENTIFIER ".client.plist";
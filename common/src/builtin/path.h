@@ -145,6 +145,10 @@ public:
     // macOS & Linux: <ExecutableDir>/pia-hnsd
     static Path HnsdExecutable;
 
+    // hnsd chain state, kept across restarts (if hnsd supports --prefix)
+    // All: <DaemonDataDir>/hnsd
+    static Path HnsdDataDir;
+
     // ss-local executable (Shadowsocks local client)
     // Windows: <ExecutableDir>/pia-ss-local.exe
     // macOS & Linux: <ExecutableDir>/pia-ss-local
@@ -191,6 +195,13 @@ public:
     // All: <ClientDataDir>/cli.log
     static Path CliLogFile;
 
+#ifdef Q_OS_WIN
+    // Per-user index of scanned Start Menu shortcuts, used to skip reading
+    // shortcuts that haven't changed when scanning for split tunnel apps
+    // Windows: <ClientDataDir>/appscan.json
+    static Path ClientAppScanIndexFile;
+#endif
+
 #ifdef Q_OS_MAC
     // Update directory used by client to decompress installer.  Only used on
     // Mac, because the Mac download is a compressed app bundle.  On Windows and
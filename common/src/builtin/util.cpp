@@ -43,6 +43,7 @@
 #include <QDateTime>
 #include <QTextCodec>
 #include <QElapsedTimer>
+#include <array>
 
 #ifdef QT_DEBUG
 # if defined(Q_OS_WIN)
@@ -127,6 +128,38 @@ int waitForExitCode(QProcess& process)
 }
 
 
+quint32 crc32(const QByteArray &data, quint32 crc)
+{
+    static const auto table = []()
+    {
+        std::array<quint32, 256> t;
+        for(quint32 i=0; i<t.size(); ++i)
+        {
+            quint32 c = i;
+            for(int k=0; k<8; ++k)
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    crc ^= 0xFFFFFFFFu;
+    for(char b : data)
+        crc = table[(crc ^ static_cast<quint8>(b)) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+QByteArray deflateRaw(const QByteArray &data, int compressionLevel)
+{
+    QByteArray zlibData = qCompress(data, compressionLevel);
+    // 4-byte length + 2-byte zlib header before the deflate data, 4-byte
+    // Adler-32 after it
+    if(zlibData.size() < 10)
+        return {};
+    return zlibData.mid(6, zlibData.size() - 10);
+}
+
+
 void throwIfEnumCastFailed(bool result, const char* name)
 {
     if (!result)
@@ -134,7 +167,7 @@ void throwIfEnumCastFailed(bool result, const char* name)
 }
 
 
-void startSupportTool (const QString &mode, const QString &diagFile)
+void startSupportTool (const QString &mode, const QStringList &diagFiles)
 {
 #ifdef PIA_CLIENT
     QProcess crashReportProcess;
@@ -146,8 +179,11 @@ void startSupportTool (const QString &mode, const QString &diagFile)
     args << "--log" << Path::CliLogFile;
     args << "--log" << Path::ConfigLogFile;
     args << "--log" << Path::UpdownLogFile;
-    if(!diagFile.isEmpty())
-        args << "--file" << diagFile;
+    for(const auto &diagFile : diagFiles)
+    {
+        if(!diagFile.isEmpty())
+            args << "--file" << diagFile;
+    }
     args << "--client-crashes" << Path::ClientDataDir / "crashes";
     args << "--daemon-crashes" << Path::DaemonDataDir / "crashes";
     args << "--client-settings" << Path::ClientSettingsDir / "clientsettings.json";
@@ -184,6 +220,8 @@ bool DumpCallback(const char *dump_dir,
 
     QString path = QString::fromUtf8(dump_dir) + QLatin1String("/") + QString::fromUtf8(minidump_id) + ".dmp";
     qDebug("%s, dump path: %s\n", succeeded ? "Succeed to write minidump" : "Failed to write minidump", qPrintable(path));
+    // Make sure the log is complete before the support tool collects it
+    Logger::flushPending();
 
 
     if(succeeded) {
@@ -210,6 +248,8 @@ bool DumpCallback(const wchar_t* dump_dir,
 
     QString path = QString::fromWCharArray(dump_dir) + QLatin1String("/") + QString::fromWCharArray(minidump_id) + ".dmp";
     qDebug("%s, dump path: %s\n", succeeded ? "Succeed to write minidump" : "Failed to write minidump", qPrintable(path));
+    // Make sure the log is complete before the support tool collects it
+    Logger::flushPending();
 
     if(succeeded) {
         startSupportTool("crash", {});
@@ -222,6 +262,8 @@ bool DumpCallback(const google_breakpad::MinidumpDescriptor& descriptor,
                                     void* context,
                   bool succeeded) {
     qDebug("%s, dump path: %s\n", succeeded ? "Succeed to write minidump" : "Failed to write minidump", descriptor.path());
+    // Make sure the log is complete before the support tool collects it
+    Logger::flushPending();
 
     if(succeeded) {
 #if defined(PIA_DAEMON)
@@ -234,8 +276,15 @@ bool DumpCallback(const google_breakpad::MinidumpDescriptor& descriptor,
 }
 #endif
 
+#if defined(Q_OS_LINUX)
+// Size limit applied to minimal dumps on Linux.  When the estimated dump size
+// exceeds this, Breakpad truncates the stacks of all but the first few
+// threads.  (The crashing thread's stack is always included in full.)
+const off_t minimalDumpSizeLimit = 512 * 1024;
+#endif
+
 // Initialize crash reporting. Please ensure Path is initialized before this
-void initCrashReporting()
+void initCrashReporting(bool minimalDumps)
 {
     if(isDebuggerPresent())
     {
@@ -243,7 +292,7 @@ void initCrashReporting()
         return;
     }
 
-    qInfo() << "Initializing crash handler";
+    qInfo() << "Initializing crash handler, minimal dumps:" << minimalDumps;
 
     Path::CrashReportDir.mkpath();
     // Create a pointer to exception handler. Since only one object
@@ -253,11 +302,23 @@ void initCrashReporting()
                                           /*FilterCallback*/ 0,
                                           DumpCallback, /*context*/ 0, true, NULL);
 #elif defined(Q_OS_WIN)
+    // MiniDumpNormal only captures thread stacks and the module list.  The
+    // standard dump also includes memory referenced from the stacks, which is
+    // helpful for inspecting locals but considerably larger.
+    MINIDUMP_TYPE dumpType = MiniDumpNormal;
+    if(!minimalDumps)
+        dumpType = static_cast<MINIDUMP_TYPE>(MiniDumpWithIndirectlyReferencedMemory);
     new google_breakpad::ExceptionHandler(QString(Path::CrashReportDir).toStdWString(), /*FilterCallback*/ 0,
                                           DumpCallback, /*context*/ 0,
-                                          google_breakpad::ExceptionHandler::HANDLER_ALL);
+                                          google_breakpad::ExceptionHandler::HANDLER_ALL,
+                                          dumpType,
+                                          static_cast<const wchar_t*>(nullptr), // No pipe - dump in-process
+                                          /*custom_info*/ nullptr);
 #elif defined(Q_OS_LINUX)
-    new google_breakpad::ExceptionHandler(google_breakpad::MinidumpDescriptor(QString(Path::CrashReportDir).toStdString()),
+    google_breakpad::MinidumpDescriptor descriptor{QString(Path::CrashReportDir).toStdString()};
+    if(minimalDumps)
+        descriptor.set_size_limit(minimalDumpSizeLimit);
+    new google_breakpad::ExceptionHandler(descriptor,
                                                             /*FilterCallback*/ 0,
                                                             DumpCallback,
                                                             /*context*/ 0,
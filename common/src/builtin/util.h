@@ -924,6 +924,17 @@ inline bool NodeList<T>::contains(const Node<T>* node) const
 COMMON_EXPORT int waitForExitCode(class QProcess& process);
 
 
+// CRC-32, as used by gzip and zip files (reflected polynomial 0xEDB88320).
+// Pass the result of a previous call as 'crc' to continue a checksum over
+// multiple blocks of data.
+COMMON_EXPORT quint32 crc32(const QByteArray &data, quint32 crc = 0);
+
+// Compress data to a raw deflate stream, as used in gzip and zip files.
+// (qCompress() produces a zlib stream with a length prefix; this strips the
+// extra framing.)  Returns an empty QByteArray if compression fails.
+COMMON_EXPORT QByteArray deflateRaw(const QByteArray &data, int compressionLevel);
+
+
 // Mixin to grant ability to queue asynchronous notifications to oneself,
 // with multiple requests to the same notification being coalesced into
 // single invocations, and with the ability to cancel outstanding requests.
@@ -1019,8 +1030,8 @@ COMMON_EXPORT bool isDebuggerPresent();
 
 // Start the support tool in a given "mode"
 // currently the only supported values for mode is "logs" and "crash".
-// Pass the path to the diagnostics file if one was written.
-COMMON_EXPORT void startSupportTool(const QString &mode, const QString &diagFile);
+// Pass the paths to the diagnostics and trace files if they were written.
+COMMON_EXPORT void startSupportTool(const QString &mode, const QStringList &diagFiles);
 
 // Set the default QTextCodec::codecForLocale() to UTF-8.
 //
@@ -1048,7 +1059,10 @@ COMMON_EXPORT void startSupportTool(const QString &mode, const QString &diagFile
 COMMON_EXPORT void setUtf8LocaleCodec();
 
 #ifdef PIA_CRASH_REPORTING
-COMMON_EXPORT void initCrashReporting ();
+// Initialize crash reporting.  If minimalDumps is set, dumps are limited to
+// the thread stacks and the memory they reference, so they stay small enough
+// to upload quickly even from processes with many threads.
+COMMON_EXPORT void initCrashReporting (bool minimalDumps = true);
 // Monitor for dumps from the daemon to automatically start the support tool
 COMMON_EXPORT void monitorDaemonDumps();
 
@@ -0,0 +1,165 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("eventloopwatchdog.cpp")
+
+#include "eventloopwatchdog.h"
+#include "metrics.h"
+#include "tracing.h"
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+
+namespace
+{
+    // The watched thread, if a watchdog is running.  Activity only records
+    // names on this thread.
+    std::atomic<QThread*> _pWatchedThread{nullptr};
+    // The current activity; guarded by _activityMutex since the watcher thread
+    // reads it.
+    QMutex _activityMutex;
+    QString _currentActivity;
+
+    // Number of heartbeats per threshold interval
+    const int beatsPerThreshold = 4;
+}
+
+EventLoopWatchdog::Activity::Activity(QString name)
+    : _active{_pWatchedThread.load() == QThread::currentThread()}
+{
+    if(_active)
+    {
+        QMutexLocker lock{&_activityMutex};
+        _previous = std::move(_currentActivity);
+        _currentActivity = std::move(name);
+    }
+}
+
+EventLoopWatchdog::Activity::~Activity()
+{
+    if(_active)
+    {
+        QMutexLocker lock{&_activityMutex};
+        _currentActivity = std::move(_previous);
+    }
+}
+
+EventLoopWatchdog::EventLoopWatchdog(std::chrono::milliseconds threshold)
+    : _threshold{threshold}, _lastBeatMs{0}, _stopWatcher{false},
+      _stallReported{false}
+{
+    _beatTimer.setInterval(msec(_threshold) / beatsPerThreshold);
+    connect(&_beatTimer, &QTimer::timeout, this, &EventLoopWatchdog::onBeat);
+}
+
+EventLoopWatchdog::~EventLoopWatchdog()
+{
+    stop();
+}
+
+void EventLoopWatchdog::start()
+{
+    if(_watcherThread.joinable())
+        return;
+
+    _pWatchedThread = thread();
+    _lastBeatMs = nowMs();
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _stopWatcher = false;
+        _stallReported = false;
+    }
+    _beatTimer.start();
+    _watcherThread = std::thread{[this](){watcherMain();}};
+}
+
+void EventLoopWatchdog::stop()
+{
+    if(!_watcherThread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _stopWatcher = true;
+    }
+    _wakeCondition.notify_one();
+    _watcherThread.join();
+    _beatTimer.stop();
+    _pWatchedThread = nullptr;
+}
+
+QString EventLoopWatchdog::currentActivity()
+{
+    QMutexLocker lock{&_activityMutex};
+    return _currentActivity;
+}
+
+qint64 EventLoopWatchdog::nowMs()
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void EventLoopWatchdog::onBeat()
+{
+    qint64 now = nowMs();
+    qint64 lateMs = now - _lastBeatMs.exchange(now) - _beatTimer.interval();
+
+    bool stallReported;
+    QString stallActivity;
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        stallReported = _stallReported;
+        _stallReported = false;
+        stallActivity = std::move(_stallActivity);
+        _stallActivity = {};
+    }
+
+    if(lateMs <= _threshold.count() && !stallReported)
+        return;
+
+    if(stallActivity.isEmpty())
+        stallActivity = QStringLiteral("unknown");
+    qWarning() << "Event loop stalled for" << lateMs << "ms during" << stallActivity;
+    Tracer::complete("daemon", QStringLiteral("Event loop stall: %1").arg(stallActivity),
+                     Tracer::now() - lateMs * 1000, lateMs * 1000);
+    Metrics::Labels activityLabels{{QStringLiteral("activity"), stallActivity}};
+    Metrics::increment(QStringLiteral("pia_event_loop_stalls"), activityLabels);
+    Metrics::observe(QStringLiteral("pia_event_loop_stall_seconds"),
+                     lateMs / 1000.0, activityLabels);
+}
+
+void EventLoopWatchdog::watcherMain()
+{
+    const auto checkInterval = _threshold / beatsPerThreshold;
+    std::unique_lock<std::mutex> lock{_mutex};
+    while(!_wakeCondition.wait_for(lock, checkInterval, [this](){return _stopWatcher;}))
+    {
+        qint64 sinceBeatMs = nowMs() - _lastBeatMs;
+        if(_stallReported || sinceBeatMs - msec(checkInterval) <= _threshold.count())
+            continue;
+
+        // The event loop is stalled - report the current activity now, since
+        // it may not ever finish.
+        _stallReported = true;
+        _stallActivity = currentActivity();
+        qWarning() << "Event loop has not run for" << sinceBeatMs
+            << "ms, current activity:"
+            << (_stallActivity.isEmpty() ? QStringLiteral("unknown") : _stallActivity);
+    }
+}
@@ -0,0 +1,108 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("eventloopwatchdog.h")
+
+#ifndef EVENTLOOPWATCHDOG_H
+#define EVENTLOOPWATCHDOG_H
+
+#include <QString>
+#include <QTimer>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// EventLoopWatchdog detects stalls in the event loop of the thread that
+// creates it (the daemon's main thread).
+//
+// A timer on the watched thread records a heartbeat several times per
+// threshold, and a watcher thread checks the heartbeat.  When the heartbeat
+// is late by more than the threshold, the watcher logs the stall along with
+// the current activity (see EventLoopWatchdog::Activity) - the stall is still
+// in progress at that point, so this identifies the work that's blocking the
+// event loop, even if it never finishes.  When the event loop resumes, the
+// total duration is logged, traced, and recorded in Metrics
+// (pia_event_loop_stalls_total and pia_event_loop_stall_seconds).
+class COMMON_EXPORT EventLoopWatchdog : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("watchdog")
+
+public:
+    // Activity names the work being done on the watched thread for the
+    // lifetime of the Activity object; it's reported if the event loop stalls
+    // during that time.  Activities can be nested; the innermost one is
+    // reported.  This costs nothing if no watchdog is running, and it has no
+    // effect on other threads.
+    //
+    //   EventLoopWatchdog::Activity activity{QStringLiteral("RPC ") + method};
+    class COMMON_EXPORT Activity
+    {
+    public:
+        Activity(QString name);
+        ~Activity();
+
+    private:
+        Activity(const Activity &) = delete;
+        Activity &operator=(const Activity &) = delete;
+
+    private:
+        bool _active;
+        QString _previous;
+    };
+
+public:
+    EventLoopWatchdog(std::chrono::milliseconds threshold);
+    ~EventLoopWatchdog();
+
+public:
+    // Start or stop watching.  start() has no effect if the watchdog is
+    // already running.
+    void start();
+    void stop();
+
+    // Name of the current activity on the watched thread - empty if nothing
+    // has been named.
+    static QString currentActivity();
+
+private:
+    static qint64 nowMs();
+    void onBeat();
+    void watcherMain();
+
+private:
+    const std::chrono::milliseconds _threshold;
+    QTimer _beatTimer;
+    // Time of the last heartbeat (nowMs())
+    std::atomic<qint64> _lastBeatMs;
+
+    // Guarded by _mutex:
+    std::mutex _mutex;
+    std::condition_variable _wakeCondition;
+    bool _stopWatcher;
+    // Activity reported by the watcher for the current stall, and whether it's
+    // been reported; reset by the next heartbeat.
+    bool _stallReported;
+    QString _stallActivity;
+
+    std::thread _watcherThread;
+};
+
+#endif
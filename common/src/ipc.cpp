@@ -21,12 +21,14 @@
 
 #include "ipc.h"
 #include "path.h"
+#include "metrics.h"
 
 #include <QtEndian>
 #include <QByteArray>
 #include <QDataStream>
 #include <QString>
 #include <QUuid>
+#include <cstring>
 
 #if defined(PIA_DAEMON) || defined(UNIT_TEST)
 
@@ -78,14 +80,46 @@ namespace
 #endif
 
 static quint32_be PIA_LOCAL_SOCKET_MAGIC { 0xFFACCE55 }; // Note first 0xFF character (always invalid in UTF-8)
+// Tag for messages with a binary payload.  Binary payloads may contain 0xFF,
+// so the receiver does not scan them for the start of the next message.
+static quint32_be PIA_LOCAL_SOCKET_BINARY_MAGIC { 0xFFACCE56 };
 
-// Scan for the start of a (possible) magic value.
+// Payloads in Qt's binary JSON format are sent with the binary tag; all
+// other payloads are UTF-8.
+static bool isBinaryPayload(const QByteArray &data)
+{
+    return data.startsWith("qbjs");
+}
+
+// Scan for the start of a (possible) magic value.  memchr() is vectorized by
+// the C runtime on all our platforms, which matters since every byte of a text
+// payload is scanned.
 static const char* scanForMagic(const char* begin, const char* end)
 {
-    while (begin != end)
+    return static_cast<const char*>(std::memchr(begin, 0xFF, static_cast<std::size_t>(end - begin)));
+}
+
+// Scan for a complete or partial magic tag while resynchronizing.  Unlike
+// scanForMagic(), a 0xFF that isn't followed by the rest of a tag is skipped,
+// so garbage containing many 0xFF bytes is skipped in one pass instead of
+// rechecking the header at each one.  A 0xFF less than a tag's length from the
+// end is returned, since the rest of the tag may not have arrived yet.
+static const char* scanForTag(const char* begin, const char* end)
+{
+    // The tags differ only in the last byte, see PIA_LOCAL_SOCKET_MAGIC
+    static const unsigned char tagPrefix[]{0xFF, 0xAC, 0xCE};
+    while(const char *candidate = scanForMagic(begin, end))
     {
-        if (*begin == (char)0xFF) return begin;
-        ++begin;
+        auto available = end - candidate;
+        if(available < 4)
+            return candidate;
+        if(std::memcmp(candidate, tagPrefix, sizeof(tagPrefix)) == 0 &&
+           (static_cast<unsigned char>(candidate[3]) == 0x55 ||
+            static_cast<unsigned char>(candidate[3]) == 0x56))
+        {
+            return candidate;
+        }
+        begin = candidate + 1;
     }
     return nullptr;
 }
@@ -152,7 +186,7 @@ void LocalSocketIPCServer::stop()
 
 LocalSocketIPCConnection::LocalSocketIPCConnection(QLocalSocket *socket, QObject *parent)
     : ClientIPCConnection(parent), _socket(socket), _payloadReceived(0),
-      _error(false)
+      _payloadBinary(false), _error(false), _resyncSkipped(-1)
 {
     connect(socket, QOverload<QLocalSocket::LocalSocketError>::of(&QLocalSocket::error), this, [this](QLocalSocket::LocalSocketError e) {
         _error = true;
@@ -169,6 +203,7 @@ LocalSocketIPCConnection::LocalSocketIPCConnection(QLocalSocket *socket, QObject
         _socket = nullptr;
     });
     connect(socket, &QLocalSocket::readyRead, this, &LocalSocketIPCConnection::onReadReady);
+    connect(socket, &QLocalSocket::bytesWritten, this, &LocalSocketIPCConnection::bytesWritten);
 }
 
 LocalSocketIPCConnection::LocalSocketIPCConnection(QObject *parent)
@@ -211,11 +246,16 @@ bool LocalSocketIPCConnection::isError()
     return !_socket || _error;
 }
 
+qint64 LocalSocketIPCConnection::bytesToWrite()
+{
+    return _socket ? _socket->bytesToWrite() : 0;
+}
+
 void LocalSocketIPCConnection::writeMessage(const QByteArray &data, QDataStream& stream)
 {
     auto byteOrder = stream.byteOrder();
     stream.setByteOrder(QDataStream::BigEndian);
-    stream << PIA_LOCAL_SOCKET_MAGIC;
+    stream << (isBinaryPayload(data) ? PIA_LOCAL_SOCKET_BINARY_MAGIC : PIA_LOCAL_SOCKET_MAGIC);
     stream.setByteOrder(QDataStream::LittleEndian);
     stream << data;
     stream.setByteOrder(byteOrder);
@@ -248,6 +288,8 @@ void LocalSocketIPCConnection::sendMessage(const QByteArray &data)
         writeMessage(data, stream);
     }
     _socket->flush();
+    Metrics::increment(QStringLiteral("pia_ipc_messages_sent"));
+    Metrics::increment(QStringLiteral("pia_ipc_sent_bytes"), {}, data.size());
 }
 
 void LocalSocketIPCConnection::onReadReady()
@@ -268,26 +310,29 @@ void LocalSocketIPCConnection::onReadReady()
                 return;
             }
 
-            if (header.tag != PIA_LOCAL_SOCKET_MAGIC)
-            {
-                qWarning() << "Invalid message: missing or incorrect magic tag";
-                // Keep going below
-            }
+            // Only the first invalid header is traced when resynchronizing,
+            // the rest are just garbage being skipped
+            const char *invalidReason = nullptr;
+            if (header.tag != PIA_LOCAL_SOCKET_MAGIC && header.tag != PIA_LOCAL_SOCKET_BINARY_MAGIC)
+                invalidReason = "Invalid message: missing or incorrect magic tag";
             else if (header.size < 2)
-            {
-                qWarning() << "Invalid message: payload too small";
-                // Keep going below
-            }
+                invalidReason = "Invalid message: payload too small";
             else if (header.size > 1024 * 1024)
-            {
-                qWarning() << "Invalid message: payload too large";
-                // Keep going below
-            }
+                invalidReason = "Invalid message: payload too large";
             else
             {
+                if (_resyncSkipped >= 0)
+                {
+                    qInfo() << "Resynchronized after skipping" << _resyncSkipped << "bytes";
+                    Metrics::increment(QStringLiteral("pia_ipc_resyncs"));
+                    Metrics::increment(QStringLiteral("pia_ipc_resync_skipped_bytes"), {}, _resyncSkipped);
+                    _resyncSkipped = -1;
+                }
+
                 // Reserve buffer for payload.
                 _payload.resize((int)header.size);
                 _payloadReceived = 0;
+                _payloadBinary = (header.tag == PIA_LOCAL_SOCKET_BINARY_MAGIC);
                 _socket->skip(sizeof(header));
 
                 // Continue loop; will start reading payload next.
@@ -296,10 +341,17 @@ void LocalSocketIPCConnection::onReadReady()
 
             // Invalid message; scan ahead for valid tag
             {
+                if (_resyncSkipped < 0)
+                {
+                    qWarning() << invalidReason;
+                    _resyncSkipped = 0;
+                }
+
                 // Skip one character so we don't find the current (bad) message
                 _socket->skip(1);
+                ++_resyncSkipped;
 
-                char tmp[1000];
+                char tmp[16384];
                 auto len = _socket->peek(tmp, sizeof(tmp));
                 if (len < 4)
                 {
@@ -310,14 +362,35 @@ void LocalSocketIPCConnection::onReadReady()
                 // Skip forward until next tag (if found) or until next earliest
                 // possible tag (if not found). On the next iteration of the loop,
                 // the new location will be checked (if possible).
-                auto magic = scanForMagic(tmp, tmp + len);
-                _socket->skip(magic ? (magic - tmp) : len);
+                auto magic = scanForTag(tmp, tmp + len);
+                auto skip = magic ? (magic - tmp) : len;
+                _socket->skip(skip);
+                _resyncSkipped += skip;
             }
         }
         else if (_payloadReceived < _payload.size())
         {
             // We are currently receiving the payload of a packet.
 
+            // Binary payloads can't be scanned for a truncated message, so
+            // read them directly without peeking first.
+            if (_payloadBinary)
+            {
+                auto read = _socket->read(_payload.data() + _payloadReceived, _payload.size() - _payloadReceived);
+                if (read < 0)
+                {
+                    qCritical() << "Local socket read error";
+                    return;
+                }
+                if (read == 0)
+                {
+                    // Not enough data avilable yet; wait for next readyRead.
+                    return;
+                }
+                _payloadReceived += read;
+                continue;
+            }
+
             auto read = _socket->peek(_payload.data() + _payloadReceived, _payload.size() - _payloadReceived);
             if (read < 0)
             {
@@ -329,7 +402,7 @@ void LocalSocketIPCConnection::onReadReady()
                 // Not enough data avilable yet; wait for next readyRead.
                 return;
             }
-            // Check for start of magic tag, indicating a truncated message
+            // Check for start of magic tag, indicating a truncated message.
             auto magic = scanForMagic(_payload.data() + _payloadReceived, _payload.data() + _payloadReceived + read);
             if (magic)
             {
@@ -346,10 +419,16 @@ void LocalSocketIPCConnection::onReadReady()
         }
         else
         {
-            // We have finished reading a packet.
-            emit messageReceived(_payload);
-            _payload.resize(0);
+            // We have finished reading a packet.  Hand off the payload buffer
+            // itself rather than copying it; receivers may keep it (it's
+            // queued across threads by ThreadedLocalIPCConnection), so a new
+            // buffer is allocated for the next payload.
+            QByteArray payload;
+            payload.swap(_payload);
             _payloadReceived = 0;
+            Metrics::increment(QStringLiteral("pia_ipc_messages_received"));
+            Metrics::increment(QStringLiteral("pia_ipc_received_bytes"), {}, payload.size());
+            emit messageReceived(payload);
         }
     }
 }
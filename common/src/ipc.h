@@ -71,6 +71,10 @@ public:
 
     virtual bool isConnected() = 0;
     virtual bool isError() { return false; }
+    // Number of bytes queued by sendMessage() that haven't been written to the
+    // underlying transport yet.  A growing count means the peer has stopped
+    // reading.
+    virtual qint64 bytesToWrite() { return 0; }
 public slots:
     virtual void sendMessage(const QByteArray &msg) = 0;
     virtual void close() = 0;
@@ -82,6 +86,9 @@ signals:
     void error(const QString& errorString);
     // A message queued for sending with sendMessage() could not be sent.
     void messageError(const Error &error, const QByteArray &msg);
+    // Some queued data was written to the transport (bytesToWrite() has
+    // decreased).
+    void bytesWritten();
 };
 
 // IPC connection for use in clients.  In addition to IPCConnection, has
@@ -129,7 +136,9 @@ class COMMON_EXPORT LocalSocketIPCConnection : public ClientIPCConnection
     Q_OBJECT
 
 public:
-    // Just serialize a message into a raw buffer.
+    // Just serialize a message into a raw buffer.  Payloads in Qt's binary
+    // JSON format are tagged as binary, since they can contain bytes that
+    // would otherwise look like the start of a new message.
     static void writeMessage(const QByteArray &data, QDataStream &stream);
 
 private:
@@ -145,6 +154,7 @@ public:
 
     virtual bool isConnected() override;
     virtual bool isError() override;
+    virtual qint64 bytesToWrite() override;
 
 #ifdef UNIT_TEST
     virtual void sendRawMessage(const QByteArray& msg) override;
@@ -161,7 +171,12 @@ private:
     class QLocalSocket* _socket;
     QByteArray _payload;
     int _payloadReceived;
+    // Whether the payload being received is binary (see writeMessage())
+    bool _payloadBinary;
     bool _error;
+    // While resynchronizing after an invalid message header, the number of
+    // bytes skipped so far; -1 otherwise
+    qint64 _resyncSkipped;
 
     friend class LocalSocketIPCServer;
 };
@@ -25,6 +25,13 @@
 
 #include <QJsonDocument>
 #include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
 
 
 bool json_cast(const QJsonValue &from, bool &to) { return from.isBool() && ((to = from.toBool()), true); }
@@ -51,7 +58,9 @@ bool json_cast(const QJsonValue &from, float &to)
 NativeJsonObject::NativeJsonObject(UnknownPropertyBehavior unknownPropertyBehavior, QObject *parent)
     : QObject(parent),
       _saveUnknownProperties(unknownPropertyBehavior == SaveUnknownProperties),
-      _pDeferredChanges{nullptr}
+      _pDeferredChanges{nullptr},
+      _pFields{nullptr},
+      _revision{0}
 {
 }
 
@@ -87,48 +96,124 @@ QStringList NativeJsonObject::choices(const QString*, const std::initializer_lis
     return result;
 }
 
-template<typename T>
-QJsonValue NativeJsonObject::getInternal(const char* asciiName, const T& name) const
+struct NativeJsonObject::FieldTable
 {
-    auto m = this->metaObject();
-    auto pi = m->indexOfProperty(asciiName);
-    if (pi >= m->propertyOffset())
+    // Names and property indices of the fields, in declaration order (the
+    // position in this vector is the field ID)
+    QVector<std::pair<QString, int>> fields;
+    // Field IDs by name
+    QHash<QString, int> ids;
+};
+
+auto NativeJsonObject::fields() const -> const FieldTable &
+{
+    if(_pFields)
+        return *_pFields;
+
+    // Tables are never removed, and unordered_map's elements are stable, so
+    // the table can be referenced without holding the mutex.
+    static QMutex tablesMutex;
+    static std::unordered_map<const QMetaObject*, FieldTable> tables;
+
+    const QMetaObject *m = metaObject();
+    QMutexLocker lock{&tablesMutex};
+    auto itTable = tables.find(m);
+    if(itTable == tables.end())
     {
-        auto p = m->property(pi);
-        return QJsonValue::fromVariant(p.read(this));
+        itTable = tables.emplace(m, FieldTable{}).first;
+        FieldTable &table = itTable->second;
+        for (int i = m->propertyOffset(), c = m->propertyCount(); i < c; i++)
+        {
+            QString name = QLatin1String(m->property(i).name());
+            table.ids.insert(name, table.fields.size());
+            table.fields.push_back({name, i});
+        }
     }
+    _pFields = &itTable->second;
+    return *_pFields;
+}
+
+int NativeJsonObject::fieldIndex(const QString &name) const
+{
+    int id = fieldId(name);
+    return id >= 0 ? fields().fields[id].second : -1;
+}
+
+int NativeJsonObject::fieldCount() const
+{
+    return fields().fields.size();
+}
+
+int NativeJsonObject::fieldId(const QString &name) const
+{
+    return fields().ids.value(name, -1);
+}
+
+const QString &NativeJsonObject::fieldName(int id) const
+{
+    return fields().fields[id].first;
+}
+
+QJsonValue NativeJsonObject::getField(int id) const
+{
+    return readField(fields().fields[id].second);
+}
+
+QJsonValue NativeJsonObject::readField(int index) const
+{
+    // JsonField properties are QJsonValues, so moc reads them into a
+    // QJsonValue directly.
+    QJsonValue value;
+    void *argv[] = {&value};
+    QMetaObject::metacall(const_cast<NativeJsonObject*>(this),
+                          QMetaObject::ReadProperty, index, argv);
+    return value;
+}
+
+void NativeJsonObject::writeField(int index, const QJsonValue &value)
+{
+    // Same arguments as QMetaProperty::write(); moc only uses the first
+    int status = -1;
+    int flags = 0;
+    void *argv[] = {const_cast<QJsonValue*>(&value), nullptr, &status, &flags};
+    QMetaObject::metacall(this, QMetaObject::WriteProperty, index, argv);
+}
+
+void NativeJsonObject::resetField(int index)
+{
+    void *argv[] = {nullptr};
+    QMetaObject::metacall(this, QMetaObject::ResetProperty, index, argv);
+}
+
+QJsonValue NativeJsonObject::getInternal(const QString& name) const
+{
+    int index = fieldIndex(name);
+    if (index >= 0)
+        return readField(index);
     else
-    {
         return _other.value(name);
-    }
 }
 QJsonValue NativeJsonObject::get(const char *name) const
 {
-    return getInternal(name, QLatin1String(name));
+    return getInternal(QString::fromLatin1(name));
 }
 QJsonValue NativeJsonObject::get(const QLatin1String &name) const
 {
-    return getInternal(name.data(), name);
+    return getInternal(QString{name});
 }
 QJsonValue NativeJsonObject::get(const QString &name) const
 {
-    return getInternal(qUtf8Printable(name), name);
+    return getInternal(name);
 }
 
-template<typename T>
-bool NativeJsonObject::setInternal(const char* asciiName, const T& name, const QJsonValue& value)
+bool NativeJsonObject::setInternal(const QString& name, const QJsonValue& value)
 {
     clearError();
-    auto m = this->metaObject();
-    auto pi = m->indexOfProperty(asciiName);
-    if (pi >= m->propertyOffset())
+    int index = fieldIndex(name);
+    if (index >= 0)
     {
-        auto p = m->property(pi);
-        if (!p.write(this, value.toVariant()))
-        {
-            _error = JsonFieldError(HERE, name, p.typeName(), jsonValueString(value));
-            return false;
-        }
+        // The JsonField setter sets _error if the value can't be converted
+        writeField(index, value);
         return error() == nullptr;
     }
     else if (_saveUnknownProperties)
@@ -151,30 +236,28 @@ bool NativeJsonObject::setInternal(const char* asciiName, const T& name, const Q
 }
 bool NativeJsonObject::set(const char *name, const QJsonValue &value)
 {
-    return setInternal(name, QLatin1String(name), value);
+    return setInternal(QString::fromLatin1(name), value);
 }
 bool NativeJsonObject::set(const QLatin1String &name, const QJsonValue &value)
 {
-    return setInternal(name.data(), name, value);
+    return setInternal(QString{name}, value);
 }
 bool NativeJsonObject::set(const QString &name, const QJsonValue &value)
 {
-    return setInternal(qUtf8Printable(name), name, value);
+    return setInternal(name, value);
 }
 
 bool NativeJsonObject::isKnownProperty(const char *name) const
 {
-    auto m = this->metaObject();
-    return m->indexOfProperty(name) >= m->propertyOffset();
+    return fieldIndex(QString::fromLatin1(name)) >= 0;
 }
 bool NativeJsonObject::isKnownProperty(const QLatin1String &name) const
 {
-    return isKnownProperty(name.data());
+    return fieldIndex(QString{name}) >= 0;
 }
 bool NativeJsonObject::isKnownProperty(const QString &name) const
 {
-    auto m = this->metaObject();
-    return m->indexOfProperty(qUtf8Printable(name)) >= m->propertyOffset();
+    return fieldIndex(name) >= 0;
 }
 
 bool NativeJsonObject::assign(const QJsonObject &properties)
@@ -194,7 +277,7 @@ bool NativeJsonObject::assign(const QJsonObject &properties)
     {
         auto key = it.key();
         auto value = it.value();
-        setInternal(qUtf8Printable(key), key, value);
+        setInternal(key, value);
         if (!error && _error) error = std::move(_error);
     }
 
@@ -216,37 +299,31 @@ bool NativeJsonObject::assign(const QJsonObject &properties)
 void NativeJsonObject::reset()
 {
     clearError();
-    auto m = this->metaObject();
-    for (int i = m->propertyOffset(), c = m->propertyCount(); i < c; i++)
-    {
-        auto p = m->property(i);
-        p.reset(this);
-    }
+    for (const auto &field : fields().fields)
+        resetField(field.second);
     QJsonObject empty;
     _other.swap(empty);
+    if (!empty.isEmpty())
+        ++_revision;
     for (auto it = empty.begin(); it != empty.end(); ++it)
     {
         emit unknownPropertyChanged(it.key());
         emit propertyChanged(it.key());
     }
 }
-template<typename T>
-void NativeJsonObject::resetInternal(const char* asciiName, const T& name)
+void NativeJsonObject::resetInternal(const QString& name)
 {
     clearError();
-    auto m = this->metaObject();
-    auto pi = m->indexOfProperty(asciiName);
-    if (pi >= m->propertyOffset())
-    {
-        auto p = m->property(pi);
-        p.reset(this);
-    }
+    int index = fieldIndex(name);
+    if (index >= 0)
+        resetField(index);
     else
     {
         auto it = _other.find(name);
         if (it != _other.end())
         {
             _other.erase(it);
+            ++_revision;
             emit unknownPropertyChanged(name);
             emit propertyChanged(name);
         }
@@ -255,6 +332,8 @@ void NativeJsonObject::resetInternal(const char* asciiName, const T& name)
 
 void NativeJsonObject::emitPropertyChange(DeferredChange change)
 {
+    // The value has already changed, even if the signal is deferred
+    ++_revision;
     if(_pDeferredChanges)
     {
         // Deferring during assign(), store it
@@ -271,35 +350,74 @@ void NativeJsonObject::emitPropertyChange(DeferredChange change)
     }
 }
 
+void NativeJsonObject::untrackNested(const QString &name)
+{
+    auto itField = _nestedFields.find(name);
+    if(itField == _nestedFields.end())
+        return;
+    // Connections to nested objects that were already destroyed are no longer
+    // valid; disconnect() just ignores them.
+    for(const auto &connection : itField->_connections)
+        disconnect(connection);
+    _nestedFields.erase(itField);
+}
+
+NativeJsonObject *NativeJsonObject::findNestedParent(const QStringList &path)
+{
+    if(path.isEmpty())
+        return nullptr;
+
+    // Properties of this object can always be set.  Nested objects can only
+    // be modified in place if they're held by QSharedPointer.
+    JsonNestedObject current{this, true};
+    int segment = 0;
+    while(segment < path.size()-1)
+    {
+        auto itField = current.pObject->_nestedFields.find(path[segment]);
+        if(itField == current.pObject->_nestedFields.end())
+            return nullptr;
+        int consumed = 0;
+        current = itField->_lookup(path.mid(segment+1), consumed);
+        if(!current.pObject)
+            return nullptr;
+        segment += 1 + consumed;
+    }
+
+    // The path must end with a property of the object found (not a container
+    // element, etc.)
+    if(segment != path.size()-1 || !current.shared ||
+       !current.pObject->isKnownProperty(path.back()))
+    {
+        return nullptr;
+    }
+    return current.pObject;
+}
+
 void NativeJsonObject::reset(const char* name)
 {
-    resetInternal(name, QLatin1String(name));
+    resetInternal(QString::fromLatin1(name));
 }
 void NativeJsonObject::reset(const QLatin1String& name)
 {
-    resetInternal(name.data(), name);
+    resetInternal(QString{name});
 }
 void NativeJsonObject::reset(const QString& name)
 {
-    resetInternal(qUtf8Printable(name), name);
+    resetInternal(name);
 }
 void NativeJsonObject::reset(const QStringList& properties)
 {
     for (const QString& name : properties)
     {
-        resetInternal(qUtf8Printable(name), name);
+        resetInternal(name);
     }
 }
 
 QJsonObject NativeJsonObject::toJsonObject() const
 {
     QJsonObject result = _other;
-    auto m = this->metaObject();
-    for (int i = m->propertyOffset(), c = m->propertyCount(); i < c; i++)
-    {
-        auto p = m->property(i);
-        result.insert(QLatin1String(p.name()), QJsonValue::fromVariant(p.read(this)));
-    }
+    for (const auto &field : fields().fields)
+        result.insert(field.first, readField(field.second));
     return result;
 }
 
@@ -314,6 +432,46 @@ const Error *NativeJsonObject::error() const
     return _error.ptr();
 }
 
+bool JsonChangeSet::add(const QString &name)
+{
+    int id = _object.fieldId(name);
+    if(id < 0)
+    {
+        int size = _unknown.size();
+        _unknown.insert(name);
+        return _unknown.size() > size;
+    }
+
+    if(_fields.isEmpty())
+        _fields.resize(_object.fieldCount());
+    if(_fields.testBit(id))
+        return false;
+    _fields.setBit(id);
+    ++_fieldCount;
+    return true;
+}
+
+QJsonObject JsonChangeSet::takeValues()
+{
+    QJsonObject values;
+    for(int id = 0; _fieldCount > 0 && id < _fields.size(); ++id)
+    {
+        if(_fields.testBit(id))
+        {
+            values.insert(_object.fieldName(id), _object.getField(id));
+            _fields.clearBit(id);
+            --_fieldCount;
+        }
+    }
+    for(const auto &name : _unknown)
+    {
+        const QJsonValue &value = _object.get(name);
+        values.insert(name, value.isUndefined() ? QJsonValue::Null : value);
+    }
+    _unknown.clear();
+    return values;
+}
+
 
 QString jsonValueString(const QJsonValue &value)
 {
@@ -321,6 +479,220 @@ QString jsonValueString(const QJsonValue &value)
     return str.mid(1, str.length() - 2);
 }
 
+QString jsonPointerEscape(const QString &segment)
+{
+    QString escaped{segment};
+    escaped.replace(QLatin1Char('~'), QStringLiteral("~0"));
+    escaped.replace(QLatin1Char('/'), QStringLiteral("~1"));
+    return escaped;
+}
+
+QStringList jsonPointerSplit(const QString &pointer)
+{
+    if(pointer.isEmpty())
+        return {};
+
+    QStringList segments = pointer.split(QLatin1Char('/'));
+    // A non-empty pointer always starts with '/', so the first segment is
+    // always empty.
+    segments.removeFirst();
+    for(auto &segment : segments)
+    {
+        // Order matters, "~01" is "~1", not "/"
+        segment.replace(QStringLiteral("~1"), QStringLiteral("/"));
+        segment.replace(QStringLiteral("~0"), QStringLiteral("~"));
+    }
+    return segments;
+}
+
+namespace
+{
+    const QString patchOpAdd{QStringLiteral("add")};
+    const QString patchOpRemove{QStringLiteral("remove")};
+    const QString patchOpReplace{QStringLiteral("replace")};
+
+    QJsonObject makePatchOp(const QString &op, const QString &path,
+                            const QJsonValue &value = QJsonValue::Undefined)
+    {
+        QJsonObject patchOp{{QStringLiteral("op"), op},
+                            {QStringLiteral("path"), path}};
+        if(!value.isUndefined())
+            patchOp.insert(QStringLiteral("value"), value);
+        return patchOp;
+    }
+
+    // Apply one patch operation to the value identified by segments[idx...]
+    // within 'target'.
+    bool applyPatchOp(QJsonValue &target, const QStringList &segments, int idx,
+                      const QString &op, const QJsonValue &value)
+    {
+        if(idx == segments.size())
+        {
+            // The root can be replaced, but not removed
+            if(op == patchOpRemove)
+                return false;
+            target = value;
+            return true;
+        }
+
+        const QString &segment = segments[idx];
+        bool lastSegment = (idx + 1 == segments.size());
+
+        if(target.isObject())
+        {
+            QJsonObject object = target.toObject();
+            // Release target's reference so 'object' can be modified in place
+            // instead of detaching a copy
+            target = QJsonValue{};
+            bool success = true;
+            // Removing a member that's already absent is fine, the result is
+            // the same.
+            if(lastSegment && op == patchOpRemove)
+                object.remove(segment);
+            else
+            {
+                auto itMember = object.find(segment);
+                // Intermediate members have to exist.  The last member is
+                // inserted if it doesn't exist, even for "replace".
+                if(itMember == object.end() && !lastSegment)
+                    success = false;
+                else
+                {
+                    QJsonValue member = (itMember == object.end()) ? QJsonValue{} : itMember.value();
+                    success = applyPatchOp(member, segments, idx+1, op, value);
+                    object.insert(segment, member);
+                }
+            }
+            target = std::move(object);
+            return success;
+        }
+
+        if(target.isArray())
+        {
+            QJsonArray array = target.toArray();
+            target = QJsonValue{};
+            // "-" refers to the position after the last element
+            bool validIndex = true;
+            int index = array.size();
+            if(segment != QStringLiteral("-"))
+                index = segment.toInt(&validIndex);
+            bool success = validIndex && index >= 0 && index <= array.size();
+            if(success)
+            {
+                if(lastSegment && op == patchOpAdd)
+                    array.insert(index, value);
+                else if(index == array.size())
+                    success = false;    // No such element
+                else if(lastSegment && op == patchOpRemove)
+                    array.removeAt(index);
+                else
+                {
+                    QJsonValue element = array.at(index);
+                    success = applyPatchOp(element, segments, idx+1, op, value);
+                    array.replace(index, element);
+                }
+            }
+            target = std::move(array);
+            return success;
+        }
+
+        // Can't traverse into any other type
+        return false;
+    }
+}
+
+void buildJsonPatch(const QString &path, const QJsonValue &oldValue,
+                    const QJsonValue &newValue, QJsonArray &patch)
+{
+    if(oldValue == newValue)
+        return;
+
+    if(oldValue.isObject() && newValue.isObject())
+    {
+        const QJsonObject &oldObject = oldValue.toObject();
+        const QJsonObject &newObject = newValue.toObject();
+        for(auto itNew = newObject.begin(); itNew != newObject.end(); ++itNew)
+        {
+            QString memberPath = path + QLatin1Char('/') + jsonPointerEscape(itNew.key());
+            auto itOld = oldObject.find(itNew.key());
+            if(itOld == oldObject.end())
+                patch.append(makePatchOp(patchOpAdd, memberPath, itNew.value()));
+            else
+                buildJsonPatch(memberPath, itOld.value(), itNew.value(), patch);
+        }
+        for(auto itOld = oldObject.begin(); itOld != oldObject.end(); ++itOld)
+        {
+            if(!newObject.contains(itOld.key()))
+            {
+                patch.append(makePatchOp(patchOpRemove,
+                                         path + QLatin1Char('/') + jsonPointerEscape(itOld.key())));
+            }
+        }
+        return;
+    }
+
+    if(oldValue.isArray() && newValue.isArray())
+    {
+        const QJsonArray &oldArray = oldValue.toArray();
+        const QJsonArray &newArray = newValue.toArray();
+        // If elements were removed from the front and possibly appended to the
+        // end (a sliding window of samples, for example), remove and append
+        // those elements instead of replacing the whole array.  (An array that
+        // only grew is still replaced.)
+        for(int shift=1; shift<oldArray.size(); ++shift)
+        {
+            int overlap = oldArray.size() - shift;
+            if(overlap > newArray.size())
+                continue;
+            if(!std::equal(oldArray.begin() + shift, oldArray.end(), newArray.begin()))
+                continue;
+            for(int i=0; i<shift; ++i)
+                patch.append(makePatchOp(patchOpRemove, path + QStringLiteral("/0")));
+            for(int i=overlap; i<newArray.size(); ++i)
+                patch.append(makePatchOp(patchOpAdd, path + QStringLiteral("/-"), newArray.at(i)));
+            return;
+        }
+        // Elements are only compared by index if the length is the same;
+        // inserting or removing an element would shift all later elements
+        // anyway.
+        if(oldArray.size() == newArray.size())
+        {
+            for(int i=0; i<newArray.size(); ++i)
+            {
+                buildJsonPatch(path + QLatin1Char('/') + QString::number(i),
+                               oldArray.at(i), newArray.at(i), patch);
+            }
+            return;
+        }
+    }
+
+    patch.append(makePatchOp(patchOpReplace, path, newValue));
+}
+
+bool applyJsonPatch(QJsonValue &target, const QJsonArray &patch)
+{
+    bool success = true;
+    for(const auto &opValue : patch)
+    {
+        const QJsonObject &patchOp = opValue.toObject();
+        const QString &op = patchOp.value(QStringLiteral("op")).toString();
+        if(op != patchOpAdd && op != patchOpRemove && op != patchOpReplace)
+        {
+            qWarning() << "Unsupported patch operation" << op;
+            success = false;
+            continue;
+        }
+        const auto &segments = jsonPointerSplit(patchOp.value(QStringLiteral("path")).toString());
+        if(!applyPatchOp(target, segments, 0, op, patchOp.value(QStringLiteral("value"))))
+        {
+            qWarning() << "Unable to apply patch operation" << op << "to"
+                << patchOp.value(QStringLiteral("path")).toString();
+            success = false;
+        }
+    }
+    return success;
+}
+
 bool json_cast(const QJsonValue &from, NativeJsonObject &to)
 {
     if (!from.isObject()) return false;
@@ -333,36 +705,152 @@ bool json_cast(const NativeJsonObject &from, QJsonValue &to)
     return true;
 }
 
-bool readProperties(NativeJsonObject& object, const Path &settingsDir,
-                    const char* filename)
+namespace
+{
+    // Header of a binary property cache (see readPropertiesCache()).  Fields
+    // are little-endian.
+    struct PropertiesCacheHeader
+    {
+        char magic[4];
+        quint32 version;
+        // Size of the binary JSON document following the header
+        quint32 size;
+    };
+    const char propertiesCacheMagic[4]{'P', 'I', 'A', 'C'};
+    // Increment if the layout changes.  The binary JSON format itself is
+    // versioned by Qt and is validated when it's loaded.
+    const quint32 propertiesCacheVersion = 1;
+}
+
+nullable_t<QJsonObject> loadPropertiesFile(const Path &settingsDir, const char *filename)
 {
     SCOPE_LOGGING_CATEGORY("json.settings");
-    bool readExistingFile = false;
 
     QFile file(settingsDir / filename);
     if (!file.open(QFile::ReadOnly | QFile::Text))
     {
         qWarning() << "Unable to read from" << filename;
-        return readExistingFile;
+        return {};
     }
     QJsonParseError error;
     QJsonDocument json = QJsonDocument::fromJson(file.readAll(), &error);
     if (error.error != QJsonParseError::NoError)
+    {
         qWarning() << "File" << filename << "is not a valid JSON document:" << error.errorString();
-    else if (!json.isObject())
+        return {};
+    }
+    if (!json.isObject())
+    {
         qWarning() << "File" << filename << "did not contain settings";
-    else if (!object.assign(json.object())) {
+        return {};
+    }
+    return json.object();
+}
+
+bool assignProperties(NativeJsonObject &object, const nullable_t<QJsonObject> &properties,
+                      const char *filename)
+{
+    SCOPE_LOGGING_CATEGORY("json.settings");
+
+    if (!properties)
+        return false;
+    if (!object.assign(*properties))
+    {
         // Even if all properties could not be assigned
         // we still did read from an existing file.
-        readExistingFile = true;
         qWarning() << "Not all properties from" << filename << "could be assigned";
     }
-    else {
-        readExistingFile = true;
+    else
         qDebug() << "Successfully read" << filename;
+    return true;
+}
+
+bool readProperties(NativeJsonObject& object, const Path &settingsDir,
+                    const char* filename)
+{
+    return assignProperties(object, loadPropertiesFile(settingsDir, filename), filename);
+}
+
+nullable_t<QJsonObject> loadPropertiesCache(const Path &settingsDir, const char *filename)
+{
+    SCOPE_LOGGING_CATEGORY("json.settings");
+
+    QFile file(settingsDir / filename);
+    if (!file.open(QFile::ReadOnly))
+    {
+        qInfo() << "No cache in" << filename;
+        return {};
+    }
+
+    PropertiesCacheHeader header;
+    qint64 fileSize = file.size();
+    if (fileSize < static_cast<qint64>(sizeof(header)))
+    {
+        qWarning() << "Cache" << filename << "is truncated";
+        return {};
+    }
+    const uchar *pData = file.map(0, fileSize);
+    if (!pData)
+    {
+        qWarning() << "Unable to map cache" << filename << "-" << file.errorString();
+        return {};
     }
 
-    return readExistingFile;
+    std::memcpy(&header, pData, sizeof(header));
+    quint32 version = qFromLittleEndian(header.version);
+    quint32 size = qFromLittleEndian(header.size);
+    if (std::memcmp(header.magic, propertiesCacheMagic, sizeof(header.magic)) != 0 ||
+        version != propertiesCacheVersion)
+    {
+        qInfo() << "Cache" << filename << "is from a different version";
+        return {};
+    }
+    qint64 payloadSize = fileSize - static_cast<qint64>(sizeof(header));
+    if (static_cast<qint64>(size) != payloadSize)
+    {
+        qWarning() << "Cache" << filename << "has size" << size
+            << "but contains" << payloadSize << "bytes";
+        return {};
+    }
+
+    // fromBinaryData() validates the document and copies it, so nothing
+    // refers to the mapping once it's loaded.
+    const auto &payload = QByteArray::fromRawData(reinterpret_cast<const char*>(pData + sizeof(header)),
+                                                  static_cast<int>(size));
+    QJsonDocument json = QJsonDocument::fromBinaryData(payload, QJsonDocument::Validate);
+    if (!json.isObject())
+    {
+        qWarning() << "Cache" << filename << "is not valid";
+        return {};
+    }
+    return json.object();
+}
+
+bool readPropertiesCache(NativeJsonObject &object, const Path &settingsDir,
+                         const char *filename)
+{
+    return assignProperties(object, loadPropertiesCache(settingsDir, filename), filename);
+}
+
+void writePropertiesCacheAtomic(const QJsonObject &object, const Path &settingsDir,
+                                const char *filename)
+{
+    SCOPE_LOGGING_CATEGORY("json.settings");
+
+    const QByteArray &payload = QJsonDocument(object).toBinaryData();
+    PropertiesCacheHeader header;
+    std::memcpy(header.magic, propertiesCacheMagic, sizeof(header.magic));
+    header.version = qToLittleEndian(propertiesCacheVersion);
+    header.size = qToLittleEndian(static_cast<quint32>(payload.size()));
+
+    QSaveFile file(settingsDir.mkpath() / filename);
+    if (file.open(QFile::WriteOnly)
+            && file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header)
+            && file.write(payload) == payload.size()
+            && file.commit())
+        qDebug() << "Successfully wrote" << filename;
+    else
+        qCritical() << "Unable to write" << filename << "-" << file.errorString();
 }
 
 void writeProperties(const QJsonObject& object, const Path &settingsDir,
@@ -377,3 +865,17 @@ void writeProperties(const QJsonObject& object, const Path &settingsDir,
     else
         qCritical() << "Unable to write" << filename;
 }
+
+void writePropertiesAtomic(const QJsonObject& object, const Path &settingsDir,
+                           const char* filename)
+{
+    SCOPE_LOGGING_CATEGORY("json.settings");
+
+    QSaveFile file(settingsDir.mkpath() / filename);
+    if (file.open(QFile::WriteOnly | QFile::Text)
+            && 0 < file.write(QJsonDocument(object).toJson(QJsonDocument::Compact))
+            && file.commit())
+        qDebug() << "Successfully wrote" << filename;
+    else
+        qCritical() << "Unable to write" << filename << "-" << file.errorString();
+}
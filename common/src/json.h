@@ -27,6 +27,7 @@
 #include <exception>
 #include <limits>
 
+#include <QBitArray>
 #include <QHash>
 #include <QJsonArray>
 #include <QJsonObject>
@@ -262,6 +263,55 @@ template<typename To, typename From> static inline To json_cast(const From& from
 COMMON_EXPORT QString jsonValueString(const QJsonValue& value);
 
 
+// Escape a single segment of a JSON pointer (RFC 6901), i.e. "~" -> "~0" and
+// "/" -> "~1".
+COMMON_EXPORT QString jsonPointerEscape(const QString& segment);
+// Split a JSON pointer into its unescaped segments.  The empty pointer (which
+// refers to the whole document) produces an empty list.
+COMMON_EXPORT QStringList jsonPointerSplit(const QString& pointer);
+
+// Build a set of JSON patch operations (the "add", "remove", and "replace"
+// operations from RFC 6902) that transform 'oldValue' into 'newValue', and
+// append them to 'patch'.  'path' is the JSON pointer to the values being
+// compared.
+//
+// Objects and arrays of equal length are compared member-by-member, so a
+// change to one nested field produces one small operation.  Any other change
+// replaces the whole value.  Nothing is appended if the values are equal.
+//
+// Every operation produced sets its target to the final value, so applying
+// the patch to a value that already reflects some of the changes is harmless.
+COMMON_EXPORT void buildJsonPatch(const QString& path, const QJsonValue& oldValue,
+                                  const QJsonValue& newValue, QJsonArray& patch);
+
+// Apply a patch created by buildJsonPatch() to 'target'.  Returns false if
+// any operation could not be applied (the remaining operations are still
+// applied).
+COMMON_EXPORT bool applyJsonPatch(QJsonValue& target, const QJsonArray& patch);
+
+
+// An object found in a field of a NativeJsonObject by
+// NativeJsonObject::findNestedParent().
+struct JsonNestedObject
+{
+    NativeJsonObject *pObject;
+    // Whether the object is held by a QSharedPointer.  Objects held by value
+    // (directly in a field, or in a container) can be navigated through, but
+    // they can't be modified in place, since the container might be
+    // implicitly shared with other copies.
+    bool shared;
+};
+
+// Whether a field type can contain NativeJsonObjects - either directly, in a
+// QSharedPointer, or in a container of them.  Nested objects in these fields
+// are tracked by NativeJsonObject::trackNested().
+template<class T> struct HasNestedJsonObjects : std::is_base_of<NativeJsonObject, T> {};
+template<class T> struct HasNestedJsonObjects<QSharedPointer<T>> : HasNestedJsonObjects<T> {};
+template<class T> struct HasNestedJsonObjects<QVector<T>> : HasNestedJsonObjects<T> {};
+template<class T> struct HasNestedJsonObjects<QList<T>> : HasNestedJsonObjects<T> {};
+template<class K, class T> struct HasNestedJsonObjects<QHash<K, T>> : HasNestedJsonObjects<T> {};
+template<class K, class T> struct HasNestedJsonObjects<QMap<K, T>> : HasNestedJsonObjects<T> {};
+
 // Base class for a QJsonObject-like class with fields accessible natively
 // as well as via Qt properties. All properties must be convertible to/from
 // QJsonValue via json_cast, and the reflected Qt properties are always
@@ -287,6 +337,17 @@ private:
         std::function<void()> _specificSignal;
         const QString _name; // for propertyChanged()
     };
+
+    // A field containing nested NativeJsonObjects (see trackNested())
+    struct NestedField
+    {
+        // Find an object in the field's value from the path segments following
+        // the field name.  Sets 'consumed' to the number of segments used to
+        // locate the object (container keys/indices).
+        std::function<JsonNestedObject(const QStringList &keys, int &consumed)> _lookup;
+        // Connections to the nested objects' change signals
+        QVector<QMetaObject::Connection> _connections;
+    };
 protected:
     enum UnknownPropertyBehavior { DiscardUnknownProperties, SaveUnknownProperties };
 
@@ -319,14 +380,38 @@ public:
     static QStringList choices(const QString*, const QStringList &valid) {return valid;}
 
 private:
-    template<typename T> QJsonValue getInternal(const char* asciiName, const T& name) const;
-    template<typename T> bool setInternal(const char* asciiName, const T& name, const QJsonValue& value);
-    template<typename T> void resetInternal(const char* asciiName, const T& name);
+    // The JsonField properties of the most-derived class, built once per
+    // class from its meta-object.  Defined in json.cpp.
+    struct FieldTable;
+    const FieldTable &fields() const;
+    // Property index of a JsonField, or -1 if there is no such field
+    int fieldIndex(const QString &name) const;
+    // Read, write, or reset a field by property index.  These call the
+    // get_/set_/reset_ accessors generated by JsonField directly through the
+    // meta-object, without looking up the property or converting to QVariant.
+    QJsonValue readField(int index) const;
+    void writeField(int index, const QJsonValue &value);
+    void resetField(int index);
+
+    QJsonValue getInternal(const QString& name) const;
+    bool setInternal(const QString& name, const QJsonValue& value);
+    void resetInternal(const QString& name);
 
 protected:
     // Used by JsonField to either emit a change now or store it during assign()
     void emitPropertyChange(DeferredChange change);
 
+    // Used by JsonField when a field's value is replaced.  If the field can
+    // contain NativeJsonObjects, connects to their change signals so changes
+    // in those objects emit nestedPropertyChanged() for this field, and
+    // records how to find them for findNestedParent().
+    template<class T> void trackNested(const QString &name, const T &value);
+
+private:
+    template<class T> void trackNestedImpl(const QString &name, const T &value, std::true_type);
+    template<class T> void trackNestedImpl(const QString &, const T &, std::false_type) {}
+    void untrackNested(const QString &name);
+
 public:
     // Get any property by name (as a QJsonValue).
     QJsonValue get(const char* name) const;
@@ -343,6 +428,15 @@ public:
     bool set(const QLatin1String& name, const QJsonValue& value);
     bool set(const QString& name, const QJsonValue& value);
 
+    // JsonFields are also identified by an ID - their index in declaration
+    // order - so they can be tracked without storing their names (see
+    // JsonChangeSet).
+    int fieldCount() const;
+    // ID of a field, or -1 if it's not a known property
+    int fieldId(const QString& name) const;
+    const QString &fieldName(int id) const;
+    QJsonValue getField(int id) const;
+
     // Check if a given property name is a known property.
     bool isKnownProperty(const char* name) const;
     bool isKnownProperty(const QLatin1String& name) const;
@@ -370,9 +464,29 @@ public:
     // Return the last error, or nullptr if there was no error.
     const Error* error() const;
 
+    // Incremented whenever any property of this object changes (not including
+    // changes within nested objects).  Used to cache values derived from the
+    // object, like ServerLocation::cachedJson().
+    quint64 revision() const {return _revision;}
+
+    // Find the object containing the property identified by 'path' (the
+    // segments of a JSON pointer relative to this object), so a nested
+    // property can be modified in place.  For example, ["locations", "us_east",
+    // "latency"] finds the "us_east" ServerLocation in DaemonData.
+    //
+    // Returns nullptr if the path doesn't refer to a known property of this
+    // object or of an object held by QSharedPointer in one of its fields
+    // (including in containers of them).
+    NativeJsonObject *findNestedParent(const QStringList &path);
+
 signals:
     void propertyChanged(const QString& name);
     void unknownPropertyChanged(const QString& name);
+    // A property of an object nested in the field 'name' changed (such as
+    // one ServerLocation in DaemonData::locations).  The field itself still
+    // refers to the same objects, so nameChanged() and propertyChanged() are
+    // not emitted, but its JSON value has changed.
+    void nestedPropertyChanged(const QString& name);
 
 protected:
     nullable_t<Error> _error;   // Set by JsonField
@@ -381,6 +495,37 @@ private:
     const bool _saveUnknownProperties;
     // When set, change signals are being deferred during a call to assign()
     QVector<DeferredChange> *_pDeferredChanges;
+    // Fields currently containing nested NativeJsonObjects
+    QHash<QString, NestedField> _nestedFields;
+    // This class's FieldTable, found on first use (the most-derived class's
+    // meta-object isn't available during construction)
+    mutable const FieldTable *_pFields;
+    quint64 _revision;
+};
+
+
+// A set of changed properties of one NativeJsonObject.  JsonFields are
+// tracked by ID in a bit array, so adding a change doesn't allocate; only
+// unknown properties (see NativeJsonObject::SaveUnknownProperties) are tracked
+// by name.
+class COMMON_EXPORT JsonChangeSet
+{
+public:
+    JsonChangeSet(const NativeJsonObject &object) : _object{object}, _fieldCount{0} {}
+
+public:
+    // Add a property by name; returns true if it wasn't already in the set.
+    bool add(const QString &name);
+    bool empty() const {return _fieldCount == 0 && _unknown.isEmpty();}
+    // Get the current values of the changed properties (undefined values
+    // become null), and clear the set.
+    QJsonObject takeValues();
+
+private:
+    const NativeJsonObject &_object;
+    QBitArray _fields;
+    int _fieldCount;
+    QSet<QString> _unknown;
 };
 
 
@@ -417,12 +562,12 @@ private:
 // called for a property that shouldn't have it (although not a very good one).)
 #define JsonField(type, name, defaultValue, ...) \
     public: const type& name() const { return _##name; } \
-    public: void name(const type& value) { clearError(); if (_##name != value) { if (validate(value,##__VA_ARGS__)) { _##name = value; emitPropertyChange({[this](){emit name##Changed();}, QStringLiteral(#name)}); } else { _error = JsonFieldError(HERE, QStringLiteral(#name), QStringLiteral(#type)); } } } \
+    public: void name(const type& value) { clearError(); if (_##name != value) { if (validate(value,##__VA_ARGS__)) { _##name = value; trackNested(QStringLiteral(#name), _##name); emitPropertyChange({[this](){emit name##Changed();}, QStringLiteral(#name)}); } else { _error = JsonFieldError(HERE, QStringLiteral(#name), QStringLiteral(#type)); } } } \
     signals: Q_SIGNAL void name##Changed(); \
     public: QJsonValue get_##name() const { QJsonValue value; if (!json_cast(name(), value)) { qCritical() << "Unable to convert field " #name " to JSON"; } return value; } \
     public: void set_##name(const QJsonValue& value) { clearError(); type actual; if (!json_cast(value, actual)) { _error = JsonFieldError(HERE, QStringLiteral(#name), QStringLiteral(#type), jsonValueString(value)); } else name(actual); } \
     public: static type default_##name() { return defaultValue; } \
-    public: void reset_##name() { type value = default_##name(); if (_##name != value) { _##name = std::move(value); emitPropertyChange({[this](){emit name##Changed();}, QStringLiteral(#name)}); } } \
+    public: void reset_##name() { type value = default_##name(); if (_##name != value) { _##name = std::move(value); trackNested(QStringLiteral(#name), _##name); emitPropertyChange({[this](){emit name##Changed();}, QStringLiteral(#name)}); } } \
     private: type _##name = default_##name(); \
     public: static auto choices_##name(decltype(choices(static_cast<type*>(nullptr),##__VA_ARGS__)) c = choices(static_cast<type*>(nullptr),##__VA_ARGS__)) {return c;} \
     Q_PROPERTY(QJsonValue name READ get_##name WRITE set_##name NOTIFY name##Changed RESET reset_##name FINAL)
@@ -449,6 +594,144 @@ inline bool NativeJsonObject::validate(const T& value, const std::initializer_li
     return false;
 }
 
+// Visit the NativeJsonObjects nested in a field value (used by trackNested())
+template<class T, class Func>
+inline std::enable_if_t<std::is_base_of<NativeJsonObject, T>::value> forEachNestedJsonObject(const T &value, Func &&func)
+{
+    func(value);
+}
+template<class T, class Func>
+inline std::enable_if_t<!std::is_base_of<NativeJsonObject, T>::value> forEachNestedJsonObject(const T &, Func &&) {}
+template<class T, class Func>
+inline void forEachNestedJsonObject(const QSharedPointer<T> &pValue, Func &&func)
+{
+    if(pValue)
+        forEachNestedJsonObject(*pValue, func);
+}
+template<class Container, class Func>
+inline void forEachNestedJsonObjectIn(const Container &values, Func &&func)
+{
+    for(const auto &value : values)
+        forEachNestedJsonObject(value, func);
+}
+template<class T, class Func>
+inline void forEachNestedJsonObject(const QVector<T> &values, Func &&func) {forEachNestedJsonObjectIn(values, func);}
+template<class T, class Func>
+inline void forEachNestedJsonObject(const QList<T> &values, Func &&func) {forEachNestedJsonObjectIn(values, func);}
+template<class K, class T, class Func>
+inline void forEachNestedJsonObject(const QHash<K, T> &values, Func &&func) {forEachNestedJsonObjectIn(values, func);}
+template<class K, class T, class Func>
+inline void forEachNestedJsonObject(const QMap<K, T> &values, Func &&func) {forEachNestedJsonObjectIn(values, func);}
+
+// Find a NativeJsonObject in a field value using the path segments following
+// the field name - container keys or indices are consumed from 'keys'.
+// (Used by NativeJsonObject::findNestedParent().)
+template<class T>
+inline std::enable_if_t<std::is_base_of<NativeJsonObject, T>::value, JsonNestedObject>
+    findNestedJsonObject(const T &value, const QStringList &, int &)
+{
+    // The object is held by value; it can't be modified in place
+    return {const_cast<T*>(&value), false};
+}
+template<class T>
+inline std::enable_if_t<!std::is_base_of<NativeJsonObject, T>::value, JsonNestedObject>
+    findNestedJsonObject(const T &, const QStringList &, int &)
+{
+    return {nullptr, false};
+}
+template<class T>
+inline JsonNestedObject findNestedJsonObject(const QSharedPointer<T> &pValue,
+                                             const QStringList &keys, int &consumed)
+{
+    if(!pValue)
+        return {nullptr, false};
+    JsonNestedObject result = findNestedJsonObject(*pValue, keys, consumed);
+    // The pointed-to object itself was found, it's shared
+    if(result.pObject == pValue.data())
+        result.shared = true;
+    return result;
+}
+template<class Value>
+inline JsonNestedObject findNestedJsonObjectElement(const Value *pElement,
+                                                    const QStringList &keys, int &consumed)
+{
+    if(!pElement)
+        return {nullptr, false};
+    // Consumed the key for this element
+    int elementConsumed = 0;
+    JsonNestedObject result = findNestedJsonObject(*pElement, keys.mid(1), elementConsumed);
+    consumed = 1 + elementConsumed;
+    return result;
+}
+template<class T>
+inline JsonNestedObject findNestedJsonObject(const QVector<T> &values,
+                                             const QStringList &keys, int &consumed)
+{
+    bool validIndex = false;
+    int index = keys.isEmpty() ? -1 : keys.front().toInt(&validIndex);
+    if(!validIndex || index < 0 || index >= values.size())
+        return {nullptr, false};
+    return findNestedJsonObjectElement(&values.at(index), keys, consumed);
+}
+template<class T>
+inline JsonNestedObject findNestedJsonObject(const QList<T> &values,
+                                             const QStringList &keys, int &consumed)
+{
+    bool validIndex = false;
+    int index = keys.isEmpty() ? -1 : keys.front().toInt(&validIndex);
+    if(!validIndex || index < 0 || index >= values.size())
+        return {nullptr, false};
+    return findNestedJsonObjectElement(&values.at(index), keys, consumed);
+}
+template<class T>
+inline JsonNestedObject findNestedJsonObject(const QHash<QString, T> &values,
+                                             const QStringList &keys, int &consumed)
+{
+    if(keys.isEmpty())
+        return {nullptr, false};
+    auto itValue = values.constFind(keys.front());
+    return findNestedJsonObjectElement(itValue == values.constEnd() ? nullptr : &itValue.value(),
+                                       keys, consumed);
+}
+template<class T>
+inline JsonNestedObject findNestedJsonObject(const QMap<QString, T> &values,
+                                             const QStringList &keys, int &consumed)
+{
+    if(keys.isEmpty())
+        return {nullptr, false};
+    auto itValue = values.constFind(keys.front());
+    return findNestedJsonObjectElement(itValue == values.constEnd() ? nullptr : &itValue.value(),
+                                       keys, consumed);
+}
+
+template<class T>
+inline void NativeJsonObject::trackNested(const QString &name, const T &value)
+{
+    trackNestedImpl(name, value, HasNestedJsonObjects<T>{});
+}
+
+template<class T>
+void NativeJsonObject::trackNestedImpl(const QString &name, const T &value, std::true_type)
+{
+    untrackNested(name);
+
+    NestedField &field = _nestedFields[name];
+    // 'value' is the field itself, so it remains valid until the field is
+    // replaced (which tracks the new value)
+    field._lookup = [&value](const QStringList &keys, int &consumed)
+    {
+        return findNestedJsonObject(value, keys, consumed);
+    };
+    forEachNestedJsonObject(value, [&](const NativeJsonObject &nested)
+    {
+        auto emitNested = [this, name](){emit nestedPropertyChanged(name);};
+        field._connections.push_back(connect(&nested, &NativeJsonObject::propertyChanged,
+                                             this, emitNested));
+        field._connections.push_back(connect(&nested, &NativeJsonObject::nestedPropertyChanged,
+                                             this, emitNested));
+    });
+}
+
 //Contextually convert a QJsonValue to a type expected as a function parameter.
 //
 //For example:
@@ -634,7 +917,46 @@ class Path;
 // Returns false if a new file was created, 'true' if an existing file is found
 COMMON_EXPORT bool readProperties(NativeJsonObject &object, const Path &settingsDir,
                                   const char *filename);
+// readProperties() and readPropertiesCache() (below) are also split into
+// loading and assigning steps, so the files can be loaded on worker threads
+// and assigned later.  The load functions return nullptr if the file can't be
+// loaded (and trace the reason); they can be used from any thread.
+COMMON_EXPORT nullable_t<QJsonObject> loadPropertiesFile(const Path &settingsDir,
+                                                         const char *filename);
+// Assign loaded properties, returning true if any were loaded (even if not
+// all could be assigned), like readProperties().
+COMMON_EXPORT bool assignProperties(NativeJsonObject &object,
+                                    const nullable_t<QJsonObject> &properties,
+                                    const char *filename);
 COMMON_EXPORT void writeProperties(const QJsonObject &object, const Path &settingsDir,
                                    const char *filename);
+// Write the properties to a temporary file and then replace the JSON file, so
+// the file is never left partially written.  Since the file is replaced, any
+// permissions applied to it specifically are lost (on Windows, the replacement
+// has the directory's inherited ACL).  Use writeProperties() for files with
+// restricted permissions.
+//
+// This can be used from any thread.
+COMMON_EXPORT void writePropertiesAtomic(const QJsonObject &object, const Path &settingsDir,
+                                         const char *filename);
+
+// Read or write a binary cache of the properties.  The cache is Qt's binary
+// JSON format behind a small versioned header, so it can be loaded without
+// parsing JSON text - the file is memory-mapped, validated, and the object is
+// assigned from the binary document directly.
+//
+// The cache is only an optimization; the JSON file is still written for
+// migration (older versions and installers read it) and for debugging.
+// readPropertiesCache() returns false if the cache is missing, from a
+// different cache version, or invalid, in which case the caller should read
+// the JSON file instead.
+COMMON_EXPORT bool readPropertiesCache(NativeJsonObject &object, const Path &settingsDir,
+                                       const char *filename);
+COMMON_EXPORT nullable_t<QJsonObject> loadPropertiesCache(const Path &settingsDir,
+                                                          const char *filename);
+// Like writePropertiesAtomic(), the cache is replaced atomically, and this
+// can be used from any thread.
+COMMON_EXPORT void writePropertiesCacheAtomic(const QJsonObject &object, const Path &settingsDir,
+                                              const char *filename);
 
 #endif // JSON_H
@@ -24,21 +24,39 @@
 #include "openssl.h"
 #include <QNetworkReply>
 #include <QDir>
+#include <QCryptographicHash>
+#include <QJsonObject>
+#include <QSaveFile>
+
+namespace
+{
+    // Keys in the cache file
+    const QString cacheEtagKey{QStringLiteral("etag")};
+    const QString cacheLastModifiedKey{QStringLiteral("lastModified")};
+    const QString cachePayloadKey{QStringLiteral("payload")};
+
+    QByteArray payloadHash(const QByteArray &payload)
+    {
+        return QCryptographicHash::hash(payload, QCryptographicHash::Sha256);
+    }
+}
 
 JsonRefresher::JsonRefresher(QString name, ApiBase &apiBaseUris,
                              QString resource,
                              std::chrono::milliseconds initialInterval,
                              std::chrono::milliseconds refreshInterval,
-                             QByteArray signatureKey)
+                             QByteArray signatureKey, QString cachePath)
     : _name{std::move(name)}, _apiBaseUris{apiBaseUris},
       _resource{std::move(resource)},
       _initialInterval{std::move(initialInterval)},
       _refreshInterval{std::move(refreshInterval)},
-      _signatureKey{std::move(signatureKey)}
+      _signatureKey{std::move(signatureKey)},
+      _cachePath{std::move(cachePath)}
 {
-    connect(&_refreshTimer, &QTimer::timeout, this,
+    connect(&_refreshTimer, &ServiceTimer::timeout, this,
             &JsonRefresher::refreshTimerElapsed);
     _refreshTimer.setInterval(static_cast<int>(_initialInterval.count()));
+    readCacheFile();
 }
 
 JsonRefresher::~JsonRefresher()
@@ -53,19 +71,26 @@ void JsonRefresher::refreshTimerElapsed()
         return;
     }
 
-    // Fetch the resource.  Try each possible base URI one time.
-    Async<QByteArray> pBodyTask = Async<QByteArray>{new NetworkTaskWithRetry{
+    // Fetch the resource.  Try each possible base URI one time.  If we have a
+    // cached payload, only fetch the resource if it has changed.
+    HttpCacheValidators validators;
+    if(!_cachedPayload.isEmpty())
+        validators = _cachedValidators;
+    NetworkTaskWithRetry *pRequest = new NetworkTaskWithRetry{
                                         QNetworkAccessManager::GetOperation,
                                         _apiBaseUris, _resource,
                                         ApiRetries::counted(_apiBaseUris.getUriCount()),
-                                        {}, {}}};
+                                        {}, {}, {}, std::move(validators)};
+    Async<QByteArray> pBodyTask = Async<QByteArray>{pRequest};
     // Use next() instead of notify() so we can abandon the task (if the
     // JsonRefresher is stopped) by dropping our reference to the outermost
     // task.
     // Note that the stored task refers to the void result of our callback, not
     // to the QByteArray result of the body task.
+    // The body task is kept alive by this continuation, so it's valid to use
+    // pRequest in the callback.
     _pFetchTask = pBodyTask->next(this,
-            [this](const Error& error, const QByteArray& body)
+            [this, pRequest](const Error& error, const QByteArray& body)
             {
                 // We shouldn't get this signal if we're not running; we abandon
                 // tasks when stopped.
@@ -81,14 +106,67 @@ void JsonRefresher::refreshTimerElapsed()
                 {
                     qWarning() << "Could not retrieve" << _name << "due to error:" << error;
                 }
+                else if(pRequest->notModified())
+                {
+                    qInfo() << "Using cached" << _name << "- not modified";
+                    HttpCacheValidators validators = pRequest->responseValidators();
+                    if(validators.isEmpty())
+                        validators = _cachedValidators;
+                    emitReply(_cachedPayload, std::move(validators));
+                }
                 else
                 {
-                    emitReply(body);
+                    emitReply(body, pRequest->responseValidators());
                 }
             });
 }
 
-QJsonDocument JsonRefresher::readReply(QByteArray responsePayload) const
+void JsonRefresher::readCacheFile()
+{
+    if(_cachePath.isEmpty())
+        return;
+
+    QFile cacheFile{_cachePath};
+    if(!cacheFile.open(QFile::ReadOnly))
+        return;    // Normal if nothing has been cached yet
+
+    const auto &cacheObj = QJsonDocument::fromJson(cacheFile.readAll()).object();
+    QByteArray payload = QByteArray::fromBase64(cacheObj.value(cachePayloadKey).toString().toLatin1());
+    if(payload.isEmpty())
+    {
+        qWarning() << "Ignoring invalid cache file for" << _name;
+        return;
+    }
+
+    _cachedPayload = std::move(payload);
+    _cachedValidators.etag = cacheObj.value(cacheEtagKey).toString().toLatin1();
+    _cachedValidators.lastModified = cacheObj.value(cacheLastModifiedKey).toString().toLatin1();
+    qInfo() << "Loaded cached" << _name << "-" << _cachedPayload.size() << "bytes";
+}
+
+void JsonRefresher::writeCacheFile() const
+{
+    if(_cachePath.isEmpty())
+        return;
+
+    QJsonObject cacheObj
+    {
+        {cacheEtagKey, QString::fromLatin1(_cachedValidators.etag)},
+        {cacheLastModifiedKey, QString::fromLatin1(_cachedValidators.lastModified)},
+        {cachePayloadKey, QString::fromLatin1(_cachedPayload.toBase64())}
+    };
+
+    QSaveFile cacheFile{_cachePath};
+    if(!cacheFile.open(QFile::WriteOnly) ||
+       cacheFile.write(QJsonDocument{cacheObj}.toJson(QJsonDocument::Compact)) < 0 ||
+       !cacheFile.commit())
+    {
+        qWarning() << "Unable to write cache file for" << _name << "-"
+            << cacheFile.errorString();
+    }
+}
+
+QJsonDocument JsonRefresher::readReply(const QByteArray &responsePayload) const
 {
     // The response can optionally contain a GPG signature appended to the
     // end after a double newline. If one exists, verify that it matches
@@ -97,6 +175,7 @@ QJsonDocument JsonRefresher::readReply(QByteArray responsePayload) const
     // '}' or ']').
 
     QByteArray signature;
+    int jsonLength = responsePayload.length();
     if (!responsePayload.isEmpty() && (responsePayload.at(0) == '{' || responsePayload.at(0) == '['))
     {
         const char endCh = responsePayload.at(0) + 2; // ==('}'-'{')==(']'-'[')
@@ -106,10 +185,13 @@ QJsonDocument JsonRefresher::readReply(QByteArray responsePayload) const
             if (end + 2 >= responsePayload.length() || responsePayload.at(end + 1) != '\n' || responsePayload.at(end + 2) != '\n')
                 qWarning() << "Nonstandard appended data found after JSON response for" << _name;
             signature = QByteArray::fromBase64(responsePayload.mid(end + 1));
-            responsePayload.truncate(end + 1);
+            jsonLength = end + 1;
         }
     }
 
+    // Refer to the JSON content in place rather than copying it
+    const QByteArray jsonPayload = QByteArray::fromRawData(responsePayload.constData(), jsonLength);
+
     // If a key was supplied, check that there is a valid signature.
     if (!_signatureKey.isNull())
     {
@@ -118,11 +200,11 @@ QJsonDocument JsonRefresher::readReply(QByteArray responsePayload) const
             qError() << "Missing signature in response for" << _name;
             return {};
         }
-        if (!verifySignature(_signatureKey, signature, responsePayload))
+        if (!verifySignature(_signatureKey, signature, jsonPayload))
         {
             // Urgh; piaproxy.net alters content in-transit without re-signing it...
             // Make a single educated guess what the original content was.
-            if (!verifySignature(_signatureKey, signature, QByteArray(responsePayload).replace(".piaproxy.net", ".privateinternetaccess.com")))
+            if (!verifyProxiedSignature(signature, jsonPayload))
             {
                 qError() << "Invalid signature in response for" << _name;
                 return {};
@@ -137,13 +219,13 @@ QJsonDocument JsonRefresher::readReply(QByteArray responsePayload) const
 
     // Parse the JSON response
     QJsonParseError parseError;
-    const auto &jsonDoc = QJsonDocument::fromJson(responsePayload,
+    const auto &jsonDoc = QJsonDocument::fromJson(jsonPayload,
                                                          &parseError);
     if(jsonDoc.isNull())
     {
         qWarning() << "Could not parse" << _name << "due to error:"
             << parseError.error << "at position" << parseError.offset;
-        qWarning() << "Retrieved JSON:" << responsePayload;
+        qWarning() << "Retrieved JSON:" << jsonPayload;
         return {};
     }
 
@@ -151,11 +233,55 @@ QJsonDocument JsonRefresher::readReply(QByteArray responsePayload) const
     return jsonDoc;
 }
 
-void JsonRefresher::emitReply(QByteArray responsePayload)
+bool JsonRefresher::verifyProxiedSignature(const QByteArray &signature,
+                                           const QByteArray &jsonPayload) const
+{
+    const QByteArray proxyDomain{QByteArrayLiteral(".piaproxy.net")};
+    const QByteArray originalDomain{QByteArrayLiteral(".privateinternetaccess.com")};
+
+    // Feed the verifier the payload with the proxy domain replaced, without
+    // building a modified copy of the payload.
+    SignatureVerifier verifier{_signatureKey};
+    int pos = 0;
+    int match = jsonPayload.indexOf(proxyDomain);
+    while(match >= 0)
+    {
+        verifier.update(jsonPayload.constData() + pos, match - pos);
+        verifier.update(originalDomain);
+        pos = match + proxyDomain.size();
+        match = jsonPayload.indexOf(proxyDomain, pos);
+    }
+    verifier.update(jsonPayload.constData() + pos, jsonPayload.size() - pos);
+    return verifier.verifyFinal(signature);
+}
+
+void JsonRefresher::emitReply(QByteArray responsePayload,
+                              HttpCacheValidators validators)
 {
-    QJsonDocument doc{readReply(std::move(responsePayload))};
+    QByteArray hash = payloadHash(responsePayload);
+    if(!_loadedPayloadHash.isEmpty() && hash == _loadedPayloadHash)
+    {
+        // Nothing has changed, there's no need to verify, parse, and apply
+        // the payload again.  This still counts as a successful load.
+        qInfo() << "Payload for" << _name << "has not changed";
+        if(!validators.isEmpty() && (validators.etag != _cachedValidators.etag ||
+                                     validators.lastModified != _cachedValidators.lastModified))
+        {
+            _cachedValidators = std::move(validators);
+            writeCacheFile();
+        }
+        loadSucceeded();
+        return;
+    }
+
+    QJsonDocument doc{readReply(responsePayload)};
     if(!doc.isNull())
+    {
+        _emittedPayload = std::move(responsePayload);
+        _emittedPayloadHash = std::move(hash);
+        _emittedValidators = std::move(validators);
         emit contentLoaded(doc);
+    }
 }
 
 // This member function is a variant of start() but allows for initial data
@@ -275,4 +401,17 @@ void JsonRefresher::loadSucceeded()
     {
         _refreshTimer.setInterval(static_cast<int>(_refreshInterval.count()));
     }
+
+    // If this was for a payload that was just emitted, it becomes the cached
+    // payload.
+    if(!_emittedPayloadHash.isEmpty())
+    {
+        _cachedPayload = std::move(_emittedPayload);
+        _cachedValidators = std::move(_emittedValidators);
+        _loadedPayloadHash = std::move(_emittedPayloadHash);
+        _emittedPayload.clear();
+        _emittedPayloadHash.clear();
+        _emittedValidators = {};
+        writeCacheFile();
+    }
 }
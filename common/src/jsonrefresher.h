@@ -24,12 +24,13 @@
 
 #include "apibase.h"
 #include "async.h"
+#include "networktaskwithretry.h"
+#include "servicetimer.h"
 #include "testshim.h"
 #include <QObject>
 #include <QJsonDocument>
 #include <QByteArray>
 #include <QSharedPointer>
-#include <QTimer>
 
 
 // Periodically loads a JSON payload over HTTP(S).
@@ -42,6 +43,11 @@
 // that URI will be the first one tried for subsequent attempts.
 //
 // The JSON payload is expected to have a GPG signature if signatureKey is set.
+//
+// Once a payload has been loaded successfully (see loadSucceeded()), later
+// requests are conditional, and a payload that hasn't changed is not emitted
+// again.  If cachePath is set, the last successful payload and its cache
+// validators are stored there so this also applies across restarts.
 class COMMON_EXPORT JsonRefresher : public QObject
 {
     Q_OBJECT
@@ -53,17 +59,28 @@ public:
     JsonRefresher(QString name, ApiBase &apiBaseUris, QString resource,
                   std::chrono::milliseconds initialInterval,
                   std::chrono::milliseconds refreshInterval,
-                  QByteArray signatureKey = {});
+                  QByteArray signatureKey = {}, QString cachePath = {});
     ~JsonRefresher();
 
 private:
     void refreshTimerElapsed();
+    // Load the cached payload from _cachePath, if there is one
+    void readCacheFile();
+    // Store the cached payload in _cachePath
+    void writeCacheFile() const;
     // Read a reply payload into a QJsonDocument, including validating the
     // signature if a key is configured on this JsonRefresher.  If the response
     // can't be read for any reason, returns a null QJsonDocument.
-    QJsonDocument readReply(QByteArray responsePayload) const;
-    // Read a reply, and emit it to contentLoaded() if successful.
-    void emitReply(QByteArray responsePayload);
+    QJsonDocument readReply(const QByteArray &responsePayload) const;
+    // Verify the signature of a payload that may have been altered by
+    // piaproxy.net, by checking it with the original domain restored.
+    bool verifyProxiedSignature(const QByteArray &signature,
+                                const QByteArray &jsonPayload) const;
+    // Read a reply, and emit it to contentLoaded() if successful.  If the
+    // payload is the same as the last one that was loaded successfully, it's
+    // not emitted again.
+    void emitReply(QByteArray responsePayload,
+                   HttpCacheValidators validators = {});
 
 public:
     // Start trying to load the resource.
@@ -114,11 +131,26 @@ public:
     ApiBase &_apiBaseUris;
     QString _resource;
     std::chrono::milliseconds _initialInterval, _refreshInterval;
-    QTimer _refreshTimer;
+    ServiceTimer _refreshTimer;
     // If a fetch task is ongoing, it's held here.  Dropping this reference
     // abandons the task.
     Async<void> _pFetchTask;
     QByteArray _signatureKey;
+    QString _cachePath;
+    // The last payload that was loaded successfully (or read from the cache
+    // file), and the cache validators from the response that provided it.
+    // Requests are conditional when a cached payload is present; if the
+    // server says it hasn't changed, the cached payload is used.
+    QByteArray _cachedPayload;
+    HttpCacheValidators _cachedValidators;
+    // Hash of the payload most recently loaded successfully in this run.
+    // (Not set by reading the cache file, since that payload hasn't been
+    // emitted yet.)
+    QByteArray _loadedPayloadHash;
+    // The payload most recently emitted by contentLoaded() - this becomes
+    // the cached payload if loadSucceeded() is called.
+    QByteArray _emittedPayload, _emittedPayloadHash;
+    HttpCacheValidators _emittedValidators;
 };
 
 #endif
@@ -20,17 +20,61 @@
 #line SOURCE_FILE("jsonrpc.cpp")
 
 #include "jsonrpc.h"
+#include "eventloopwatchdog.h"
+#include <QElapsedTimer>
+#include <QTimer>
+#include <algorithm>
+
+namespace
+{
+    // Qt's binary JSON format starts with this tag (QJsonDocument::BinaryFormatTag)
+    const char binaryJsonTag[] = "qbjs";
+}
+
+QByteArray encodeJsonRPCMessage(const QJsonObject &msg, JsonRPCEncoding encoding)
+{
+    // The binary format is Qt's internal representation of JSON values, so
+    // this is just a copy
+    if (encoding == JsonRPCEncoding::Binary)
+        return QJsonDocument(msg).toBinaryData();
+    return QJsonDocument(msg).toJson(QJsonDocument::Compact);
+}
+
+QByteArray encodeJsonRPCMessage(const QJsonArray &batch, JsonRPCEncoding encoding)
+{
+    if (encoding == JsonRPCEncoding::Binary)
+        return QJsonDocument(batch).toBinaryData();
+    return QJsonDocument(batch).toJson(QJsonDocument::Compact);
+}
+
+QJsonDocument parseJsonRPCDocument(const QByteArray &msg) throws(Error)
+{
+    QJsonDocument json;
+    if (msg.startsWith(binaryJsonTag))
+    {
+        json = QJsonDocument::fromBinaryData(msg, QJsonDocument::Validate);
+        if (json.isNull())
+            throw JsonRPCParseError(HERE, "invalid binary message");
+    }
+    else
+    {
+        QJsonParseError error;
+        json = QJsonDocument::fromJson(msg, &error);
+        if (error.error != QJsonParseError::NoError)
+            throw JsonRPCParseError(HERE, error.errorString());
+    }
+    if (json.isArray() && json.array().isEmpty())
+        throw JsonRPCInvalidRequestError(HERE, "empty batch");
+    else if (!json.isArray() && !json.isObject())
+        throw JsonRPCInvalidRequestError(HERE, "unrecognized message");
+    return json;
+}
 
 QJsonObject parseJsonRPCMessage(const QByteArray &msg) throws(Error)
 {
-    QJsonParseError error;
-    QJsonDocument json = QJsonDocument::fromJson(msg, &error);
-    if (error.error != QJsonParseError::NoError)
-        throw JsonRPCParseError(HERE, error.errorString());
+    QJsonDocument json = parseJsonRPCDocument(msg);
     if (json.isArray())
         throw JsonRPCInvalidRequestError(HERE, "batch messages not supported");
-    else if (!json.isObject())
-        throw JsonRPCInvalidRequestError(HERE, "unrecognized message");
     return json.object();
 }
 
@@ -108,6 +152,10 @@ LocalMethodRegistry::~LocalMethodRegistry()
 void LocalMethodRegistry::add(const LocalMethod &method)
 {
     _methods.insert(method.name(), method);
+    if (method.priority() == LocalMethod::Priority::Background)
+        _backgroundMethods.insert(method.name());
+    else
+        _backgroundMethods.remove(method.name());
 }
 
 void LocalMethodRegistry::add(const std::initializer_list<LocalMethod> &methods)
@@ -117,13 +165,95 @@ void LocalMethodRegistry::add(const std::initializer_list<LocalMethod> &methods)
         add(method);
 }
 
+const std::array<qint64, 10> RpcLatencyHistogram::bucketBoundsMs{{1, 5, 10, 25, 50, 100, 250, 500, 1000, 5000}};
+
+void RpcLatencyHistogram::add(qint64 latencyNs)
+{
+    auto itBound = std::lower_bound(bucketBoundsMs.begin(), bucketBoundsMs.end(),
+                                    latencyNs, [](qint64 boundMs, qint64 ns)
+                                    {
+                                        return boundMs * 1000000 < ns;
+                                    });
+    ++buckets[static_cast<std::size_t>(itBound - bucketBoundsMs.begin())];
+    ++count;
+    sumNs += latencyNs;
+    maxNs = std::max(maxNs, latencyNs);
+}
+
 Async<QJsonValue> LocalMethodRegistry::invoke(const QString &method, const QJsonArray &params)
 {
     auto it = _methods.find(method);
-    if (it != _methods.end())
-        return (*it)(params);
-    else
+    if (it == _methods.end())
         return Async<QJsonValue>::reject(JsonRPCMethodNotFoundError(HERE, method));
+
+    if (!_backgroundMethods.contains(method))
+        return dispatch(method, *it, params);
+
+    auto pResult = Async<QJsonValue>::create();
+    _deferredCalls.push_back({method, params, pResult});
+    // Start dispatching if this is the only deferred call; otherwise it's
+    // dispatched after the ones ahead of it
+    if (_deferredCalls.size() == 1)
+        QTimer::singleShot(0, this, &LocalMethodRegistry::dispatchDeferred);
+    return pResult;
+}
+
+void LocalMethodRegistry::dispatchDeferred()
+{
+    if (_deferredCalls.empty())
+        return;
+
+    DeferredCall call = std::move(_deferredCalls.front());
+    _deferredCalls.pop_front();
+    // The next one waits for the next iteration, so requests received in the
+    // meantime are dispatched first
+    if (!_deferredCalls.empty())
+        QTimer::singleShot(0, this, &LocalMethodRegistry::dispatchDeferred);
+
+    auto it = _methods.find(call.method);
+    if (it == _methods.end())
+    {
+        call.pResult->reject(JsonRPCMethodNotFoundError(HERE, call.method));
+        return;
+    }
+    auto task = dispatch(call.method, *it, call.params);
+    if (task)
+        call.pResult->resolve(task);
+    else
+        call.pResult->reject(JsonRPCInternalError(HERE, "Async method returned null"));
+}
+
+Async<QJsonValue> LocalMethodRegistry::dispatch(const QString &method,
+                                                const MethodFunc &func,
+                                                const QJsonArray &params)
+{
+    QElapsedTimer callTime;
+    callTime.start();
+    Async<QJsonValue> task;
+    {
+        EventLoopWatchdog::Activity activity{QStringLiteral("RPC ") + method};
+        task = func(params);
+    }
+    RpcMethodStats &stats = _methodStats[method];
+    ++stats.calls;
+    stats.dispatch.add(callTime.nsecsElapsed());
+
+    if (!task)
+        return task;
+
+    // Record the completion time when the result is available.  (For
+    // synchronous methods, this happens right away.)
+    return task->next(this, [this, method, callTime](const Error &error, const QJsonValue &result)
+    {
+        RpcMethodStats &stats = _methodStats[method];
+        stats.completion.add(callTime.nsecsElapsed());
+        if (error)
+        {
+            ++stats.errors;
+            throw error;
+        }
+        return result;
+    });
 }
 
 LocalNotificationInterface::LocalNotificationInterface(LocalMethodRegistry *registry, QObject *parent)
@@ -136,7 +266,14 @@ bool LocalNotificationInterface::processMessage(const QByteArray &msg)
 {
     try
     {
-        return processRequest(parseJsonRPCMessage(msg));
+        QJsonDocument json = parseJsonRPCDocument(msg);
+        if (json.isObject())
+            return processRequest(json.object());
+
+        bool success = true;
+        for (const auto &request : json.array())
+            success = processRequest(request.toObject()) && success;
+        return success;
     }
     catch (const Error& error)
     {
@@ -170,11 +307,33 @@ bool LocalNotificationInterface::processRequest(const QJsonObject &request)
     }
 }
 
+// Responses to a batch request are collected until the last request in the
+// batch has been handled, then they're all sent in one batch response.
+struct LocalCallInterface::PendingBatch
+{
+    QJsonArray responses;
+    // Number of requests in the batch that haven't been handled yet, plus one
+    // while the requests are still being dispatched
+    int pending;
+};
+
 bool LocalCallInterface::processMessage(const QByteArray &msg)
 {
     try
     {
-        return processRequest(parseJsonRPCMessage(msg));
+        QJsonDocument json = parseJsonRPCDocument(msg);
+        if (json.isObject())
+            return processRequest(json.object());
+
+        const QJsonArray &requests = json.array();
+        auto pBatch = QSharedPointer<PendingBatch>::create();
+        pBatch->pending = requests.size() + 1;
+        qInfo() << "Processing batch of" << requests.size() << "requests";
+        bool success = true;
+        for (const auto &request : requests)
+            success = processRequest(request.toObject(), pBatch) && success;
+        finishBatchRequest(pBatch);
+        return success;
     }
     catch (const Error& error)
     {
@@ -185,6 +344,11 @@ bool LocalCallInterface::processMessage(const QByteArray &msg)
 }
 
 bool LocalCallInterface::processRequest(const QJsonObject &request)
+{
+    return processRequest(request, {});
+}
+
+bool LocalCallInterface::processRequest(const QJsonObject &request, const QSharedPointer<PendingBatch> &pBatch)
 {
     auto id = request[QLatin1String("id")];
     QString method;
@@ -206,13 +370,13 @@ bool LocalCallInterface::processRequest(const QJsonObject &request)
         {
             // The task is kept alive by the capture of 'task', and will be
             // disposed either when it finishes, or when we are destroyed.
-            task->notify(this, [this, id](const Error& error, const QJsonValue& result) {
+            task->notify(this, [this, id, pBatch](const Error& error, const QJsonValue& result) {
                 if (id.isUndefined())
-                    return;
-                if (error)
-                    respondWithError(id, error);
+                    finishBatchRequest(pBatch);
+                else if (error)
+                    respondWithError(id, error, pBatch);
                 else
-                    respondWithResult(id, result);
+                    respondWithResult(id, result, pBatch);
             });
         }
         else
@@ -224,26 +388,54 @@ bool LocalCallInterface::processRequest(const QJsonObject &request)
     {
         qWarning(error);
         if (!id.isUndefined())
-            respondWithError(id, error);
+            respondWithError(id, error, pBatch);
+        else
+            finishBatchRequest(pBatch);
         return false;
     }
     catch (const std::exception& e)
     {
         qWarning() << "Caught exception in RPC invoke:" << e.what();
         if (!id.isUndefined())
-            respondWithError(id, UnknownError(HERE, QString::fromLocal8Bit(e.what())));
+            respondWithError(id, UnknownError(HERE, QString::fromLocal8Bit(e.what())), pBatch);
+        else
+            finishBatchRequest(pBatch);
         return false;
     }
     catch (...)
     {
         qWarning() << "Caught unknown exception in RPC invoke";
         if (!id.isUndefined())
-            respondWithError(id, UnknownError(HERE));
+            respondWithError(id, UnknownError(HERE), pBatch);
+        else
+            finishBatchRequest(pBatch);
         return false;
     }
 }
 
-void LocalCallInterface::respondWithResult(const QJsonValue &id, const QJsonValue &result)
+void LocalCallInterface::respond(const QJsonObject &response, const QSharedPointer<PendingBatch> &pBatch)
+{
+    if (pBatch)
+    {
+        pBatch->responses.append(response);
+        finishBatchRequest(pBatch);
+    }
+    else
+        emit messageReady(encodeJsonRPCMessage(response, _encoding));
+}
+
+void LocalCallInterface::finishBatchRequest(const QSharedPointer<PendingBatch> &pBatch)
+{
+    if (!pBatch)
+        return;
+    Q_ASSERT(pBatch->pending > 0);
+    // Send the responses once all requests have been handled.  If the batch
+    // only contained notifications, nothing is sent.
+    if (--pBatch->pending == 0 && !pBatch->responses.isEmpty())
+        emit messageReady(encodeJsonRPCMessage(pBatch->responses, _encoding));
+}
+
+void LocalCallInterface::respondWithResult(const QJsonValue &id, const QJsonValue &result, const QSharedPointer<PendingBatch> &pBatch)
 {
     // Indicate success, but don't trace the result (can't clean the result for
     // tracing since we don't know anything about the request semantics)
@@ -253,22 +445,22 @@ void LocalCallInterface::respondWithResult(const QJsonValue &id, const QJsonValu
         { QStringLiteral("id"), id },
         { QStringLiteral("result"), result.isUndefined() ? QJsonValue::Null : result },
     };
-    emit messageReady(QJsonDocument(msg).toJson(QJsonDocument::Compact));
+    respond(msg, pBatch);
 }
 
-void LocalCallInterface::respondWithError(const QJsonValue &id, const Error &error)
+void LocalCallInterface::respondWithError(const QJsonValue &id, const Error &error, const QSharedPointer<PendingBatch> &pBatch)
 {
-    respondWithError(id, error.toJsonObject());
+    respondWithError(id, error.toJsonObject(), pBatch);
 }
 
-void LocalCallInterface::respondWithError(const QJsonValue &id, const QJsonObject &error)
+void LocalCallInterface::respondWithError(const QJsonValue &id, const QJsonObject &error, const QSharedPointer<PendingBatch> &pBatch)
 {
     qInfo() << "Request" << id << "- responding with error" << error;
     QJsonObject msg;
     msg[QStringLiteral("jsonrpc")] = QStringLiteral("2.0");
     msg[QStringLiteral("id")] = (id.isString() || id.isDouble()) ? id : QJsonValue(QJsonValue::Null);
     msg[QStringLiteral("error")] = error;
-    emit messageReady(QJsonDocument(msg).toJson(QJsonDocument::Compact));
+    respond(msg, pBatch);
 }
 
 void RemoteNotificationInterface::postWithParams(const QString& method, const QJsonArray& params)
@@ -276,7 +468,7 @@ void RemoteNotificationInterface::postWithParams(const QString& method, const QJ
     request(QJsonValue::Undefined, method, params);
 }
 
-void RemoteNotificationInterface::request(const QJsonValue &id, const QString &method, const QJsonArray &params)
+static QJsonObject buildJsonRPCRequest(const QJsonValue &id, const QString &method, const QJsonArray &params)
 {
     QJsonObject msg;
     msg[QStringLiteral("jsonrpc")] = QStringLiteral("2.0");
@@ -284,7 +476,43 @@ void RemoteNotificationInterface::request(const QJsonValue &id, const QString &m
         msg[QStringLiteral("id")] = id;
     msg[QStringLiteral("method")] = method;
     msg[QStringLiteral("params")] = params;
-    emit messageReady(QJsonDocument(msg).toJson(QJsonDocument::Compact));
+    return msg;
+}
+
+QByteArray encodeJsonRPCNotification(const QString &method, const QJsonArray &params, JsonRPCEncoding encoding)
+{
+    return encodeJsonRPCMessage(buildJsonRPCRequest(QJsonValue::Undefined, method, params), encoding);
+}
+
+void RemoteNotificationInterface::beginBatch()
+{
+    Q_ASSERT(!_batching);
+    _batching = true;
+}
+
+void RemoteNotificationInterface::sendBatch()
+{
+    Q_ASSERT(_batching);
+    _batching = false;
+
+    QJsonArray batch;
+    batch.swap(_batch);
+    if (batch.isEmpty())
+        return;
+    // A batch of one is just sent as a plain request
+    if (batch.size() == 1)
+        emit messageReady(encodeJsonRPCMessage(batch[0].toObject(), _encoding));
+    else
+        emit messageReady(encodeJsonRPCMessage(batch, _encoding));
+}
+
+void RemoteNotificationInterface::request(const QJsonValue &id, const QString &method, const QJsonArray &params)
+{
+    QJsonObject msg = buildJsonRPCRequest(id, method, params);
+    if (_batching)
+        _batch.append(msg);
+    else
+        emit messageReady(encodeJsonRPCMessage(msg, _encoding));
 }
 
 double RemoteCallInterface::getNextId()
@@ -306,7 +534,14 @@ bool RemoteCallInterface::processMessage(const QByteArray &msg)
 {
     try
     {
-        return processResponse(parseJsonRPCMessage(msg));
+        QJsonDocument json = parseJsonRPCDocument(msg);
+        if (json.isObject())
+            return processResponse(json.object());
+
+        bool success = true;
+        for (const auto &response : json.array())
+            success = processResponse(response.toObject()) && success;
+        return success;
     }
     catch (const Error& error)
     {
@@ -380,18 +615,23 @@ void RemoteCallInterface::requestSendError(const Error &error, const QByteArray
 {
     try
     {
-        const auto &request = parseJsonRPCMessage(msg);
-        double id;
-        if(!getId(request, id))
-            return;
+        QJsonDocument json = parseJsonRPCDocument(msg);
+        // If this was a batch, reject all calls in the batch
+        const QJsonArray &requests = json.isArray() ? json.array() : QJsonArray{json.object()};
+        for (const auto &request : requests)
+        {
+            double id;
+            if(!getId(request.toObject(), id))
+                continue;
 
-        // Look up the task
-        QWeakPointer<Task<QJsonValue>> weakTask = _responses.take(id);
-        auto pTask = weakTask.toStrongRef();
+            // Look up the task
+            QWeakPointer<Task<QJsonValue>> weakTask = _responses.take(id);
+            auto pTask = weakTask.toStrongRef();
 
-        // If the task is still around, reject it
-        if (pTask)
-            pTask->reject(error);
+            // If the task is still around, reject it
+            if (pTask)
+                pTask->reject(error);
+        }
     }
     catch (const Error& error)
     {
@@ -451,8 +691,7 @@ bool ClientSideInterface::processMessage(const QByteArray &msg)
 {
     try
     {
-        QJsonObject object = parseJsonRPCMessage(msg);
-        return RemoteCallInterface::processResponse(object) || _local.processRequest(object);
+        return processDocument(parseJsonRPCDocument(msg));
     }
     catch (const Error& error)
     {
@@ -461,6 +700,21 @@ bool ClientSideInterface::processMessage(const QByteArray &msg)
     }
 }
 
+bool ClientSideInterface::processDocument(const QJsonDocument &json)
+{
+    if (json.isObject())
+    {
+        QJsonObject object = json.object();
+        return RemoteCallInterface::processResponse(object) || _local.processRequest(object);
+    }
+
+    // Batches received by the client are responses to a batch of calls
+    bool success = true;
+    for (const auto &response : json.array())
+        success = RemoteCallInterface::processResponse(response.toObject()) && success;
+    return success;
+}
+
 #endif
 
 #if defined(PIA_DAEMON) || defined(UNIT_TEST)
@@ -471,6 +725,12 @@ ServerSideInterface::ServerSideInterface(LocalMethodRegistry *methods, QObject *
     connect(&_local, &LocalCallInterface::messageReady, this, &ServerSideInterface::messageReady);
 }
 
+void ServerSideInterface::setEncoding(JsonRPCEncoding encoding)
+{
+    RemoteNotificationInterface::setEncoding(encoding);
+    _local.setEncoding(encoding);
+}
+
 bool ServerSideInterface::processMessage(const QByteArray &msg)
 {
     return _local.processMessage(msg);
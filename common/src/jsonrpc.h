@@ -34,10 +34,32 @@
 #include <QObject>
 #include <QSet>
 
+#include <array>
 #include <cmath>
+#include <deque>
 #include <initializer_list>
 
 
+// Encodings for JSON-RPC messages.  Text (compact UTF-8 JSON) is understood
+// by all peers.  Qt's binary JSON format is much cheaper to encode and decode,
+// but it's only sent to peers that have indicated support for it.
+// parseJsonRPCMessage() accepts either encoding.
+enum class JsonRPCEncoding
+{
+    Text,
+    Binary,
+};
+
+COMMON_EXPORT QByteArray encodeJsonRPCMessage(const QJsonObject& msg, JsonRPCEncoding encoding);
+COMMON_EXPORT QByteArray encodeJsonRPCMessage(const QJsonArray& batch, JsonRPCEncoding encoding);
+// Encode a complete notification message.  This is equivalent to
+// RemoteNotificationInterface::postWithParams(), but the result can be sent to
+// any number of connections.
+COMMON_EXPORT QByteArray encodeJsonRPCNotification(const QString& method, const QJsonArray& params, JsonRPCEncoding encoding);
+// Parse a message that may be a single message (an object) or a batch (a
+// non-empty array).
+COMMON_EXPORT QJsonDocument parseJsonRPCDocument(const QByteArray& msg) throws(Error);
+// Parse a single message; batches are rejected
 COMMON_EXPORT QJsonObject parseJsonRPCMessage(const QByteArray& msg) throws(Error);
 COMMON_EXPORT void parseJsonRPCRequest(const QJsonObject& request, QString& method, QJsonArray& params) throws(Error);
 
@@ -91,12 +113,27 @@ struct LocalMethodWrapper<Async<void>, ArgsTuple>
 //
 class COMMON_EXPORT LocalMethod
 {
+public:
+    // Scheduling class of a method, see LocalMethodRegistry::invoke().
+    enum class Priority
+    {
+        // Dispatched as soon as the request is received.  Most methods are
+        // cheap to dispatch and should use this.
+        Normal,
+        // Heavy methods (diagnostics, app scans, etc.) are deferred so
+        // requests that have already been received run first, and only one
+        // is dispatched per event loop iteration.
+        Background,
+    };
+
+private:
     typedef std::function<Async<QJsonValue>(const QJsonArray&)> Func;
 
     Func _fn;
     QString _name;
     int _paramCount;
     QJsonArray _defaultArguments;
+    Priority _priority = Priority::Normal;
 
 public:
     template<typename Result, typename... Args>
@@ -114,7 +151,11 @@ public:
     template<typename... Args>
     LocalMethod& defaultArguments(Args&&... args) { _defaultArguments = QJsonArray { json_cast<QJsonValue>(args)... }; return *this; }
 
+    // Set the method's scheduling class
+    LocalMethod& priority(Priority priority) { _priority = priority; return *this; }
+
     const QString& name() const { return _name; }
+    Priority priority() const { return _priority; }
 
     // Invoke the registered function, catching any Errors or exceptions
     // and converting them to rejected Async Tasks.
@@ -148,6 +189,36 @@ private:
 
 // Class to handle the set of local functions to expose via JSON-RPC.
 //
+// Histogram of RPC latencies, used by RpcMethodStats.
+struct COMMON_EXPORT RpcLatencyHistogram
+{
+    // Upper bounds of the histogram buckets in milliseconds.  There's one more
+    // bucket for latencies above the last bound.
+    static const std::array<qint64, 10> bucketBoundsMs;
+
+    // Number of latencies in each bucket (not cumulative)
+    std::array<quint64, bucketBoundsMs.size()+1> buckets{};
+    quint64 count{0};
+    // Total and largest latencies in nanoseconds
+    qint64 sumNs{0};
+    qint64 maxNs{0};
+
+    void add(qint64 latencyNs);
+};
+
+// Call statistics for one RPC method, see LocalMethodRegistry::methodStats().
+struct COMMON_EXPORT RpcMethodStats
+{
+    // Calls that have been dispatched, and those that were rejected
+    quint64 calls{0};
+    quint64 errors{0};
+    // Time spent in the method handler itself - this blocks the event loop
+    RpcLatencyHistogram dispatch;
+    // Time until the method's result was available, including async
+    // completion (such as API requests for RPC_login)
+    RpcLatencyHistogram completion;
+};
+
 class COMMON_EXPORT LocalMethodRegistry : public QObject
 {
     Q_OBJECT
@@ -161,10 +232,40 @@ public:
     void add(const std::initializer_list<LocalMethod>& methods);
 
 public:
+    // Invoke a method.  Normal methods are dispatched immediately.
+    // Background methods are queued and dispatched from the event loop, one
+    // per iteration, so requests that were already received (such as
+    // connecting or disconnecting right after requesting diagnostics) don't
+    // wait behind them.  Either way, the result is provided asynchronously.
     Async<QJsonValue> invoke(const QString& method, const QJsonArray& params);
 
+    // Call statistics for each method that has been invoked.  Calls to
+    // unknown methods aren't included.
+    const QHash<QString, RpcMethodStats> &methodStats() const {return _methodStats;}
+
 private:
-    QHash<QString, std::function<Async<QJsonValue>(const QJsonArray&)>> _methods;
+    using MethodFunc = std::function<Async<QJsonValue>(const QJsonArray&)>;
+
+    // Dispatch a method now and record its statistics
+    Async<QJsonValue> dispatch(const QString& method, const MethodFunc& func,
+                               const QJsonArray& params);
+    // Dispatch the next deferred call
+    void dispatchDeferred();
+
+private:
+    struct DeferredCall
+    {
+        QString method;
+        QJsonArray params;
+        Async<QJsonValue> pResult;
+    };
+
+    QHash<QString, MethodFunc> _methods;
+    // Methods that use Priority::Background
+    QSet<QString> _backgroundMethods;
+    // Background calls waiting to be dispatched, in order
+    std::deque<DeferredCall> _deferredCalls;
+    QHash<QString, RpcMethodStats> _methodStats;
 };
 
 
@@ -199,17 +300,33 @@ class COMMON_EXPORT LocalCallInterface : public LocalNotificationInterface
 public:
     using LocalNotificationInterface::LocalNotificationInterface;
 
+    // Set the encoding used for responses (text by default)
+    void setEncoding(JsonRPCEncoding encoding) { _encoding = encoding; }
+
 public slots:
+    // Batches are handled by processMessage(); each request in the batch is
+    // invoked in order, and the responses are sent in one batch once all of
+    // them have completed.
     virtual bool processMessage(const QByteArray& msg) override;
     virtual bool processRequest(const QJsonObject& request) override;
 
 protected:
-    void respondWithResult(const QJsonValue& id, const QJsonValue& result);
-    void respondWithError(const QJsonValue& id, const Error& error);
-    void respondWithError(const QJsonValue& id, const QJsonObject& error);
+    struct PendingBatch;
+
+    bool processRequest(const QJsonObject& request, const QSharedPointer<PendingBatch> &pBatch);
+    // Send a response, or add it to the pending batch if there is one
+    void respond(const QJsonObject &response, const QSharedPointer<PendingBatch> &pBatch);
+    // One request in a batch has been handled (has no effect if pBatch is null)
+    void finishBatchRequest(const QSharedPointer<PendingBatch> &pBatch);
+    void respondWithResult(const QJsonValue& id, const QJsonValue& result, const QSharedPointer<PendingBatch> &pBatch = {});
+    void respondWithError(const QJsonValue& id, const Error& error, const QSharedPointer<PendingBatch> &pBatch = {});
+    void respondWithError(const QJsonValue& id, const QJsonObject& error, const QSharedPointer<PendingBatch> &pBatch = {});
 
 signals:
     void messageReady(const QByteArray& response);
+
+private:
+    JsonRPCEncoding _encoding = JsonRPCEncoding::Text;
 };
 
 
@@ -229,11 +346,31 @@ public:
 
     void postWithParams(const QString& method, const QJsonArray& params);
 
+    // Set the encoding used for outgoing messages (text by default)
+    void setEncoding(JsonRPCEncoding encoding) { _encoding = encoding; }
+
+    // Collect requests into a batch.  After beginBatch(), calls and
+    // notifications are held until sendBatch(), which sends all of them in one
+    // JSON-RPC batch message.  The remote end handles the whole batch at once
+    // and sends the responses together, so N calls cost only one round trip.
+    //
+    // Only send batches to peers that support them (older daemons reject
+    // batches).
+    void beginBatch();
+    void sendBatch();
+
 protected:
     void request(const QJsonValue& id, const QString& method, const QJsonArray& params);
 
 signals:
     void messageReady(const QByteArray& msg);
+
+protected:
+    JsonRPCEncoding _encoding = JsonRPCEncoding::Text;
+
+private:
+    bool _batching = false;
+    QJsonArray _batch;
 };
 
 
@@ -285,6 +422,9 @@ public:
 
 public slots:
     virtual bool processMessage(const QByteArray& msg) override;
+    // Process a message that was already parsed (such as by
+    // parseJsonRPCDocument() on another thread)
+    bool processDocument(const QJsonDocument& json);
 
 private:
     LocalNotificationInterface _local;
@@ -300,6 +440,9 @@ class COMMON_EXPORT ServerSideInterface : public RemoteNotificationInterface
 public:
     explicit ServerSideInterface(LocalMethodRegistry* methods, QObject* parent = nullptr);
 
+    // Set the encoding for both notifications and responses
+    void setEncoding(JsonRPCEncoding encoding);
+
 public slots:
     bool processMessage(const QByteArray& msg);
 
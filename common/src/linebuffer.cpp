@@ -21,32 +21,77 @@
 
 #include "linebuffer.h"
 
+#include <QMetaMethod>
+#include <cstring>
+
+namespace
+{
+    // Storage reserved for the buffer.  This is kept when the buffer empties,
+    // and it's larger than most chunks of process output.
+    const int initialCapacity = 4096;
+}
+
+LineBuffer::LineBuffer()
+    : _start{0}, _scanPos{0}
+{
+    _buffer.reserve(initialCapacity);
+}
+
 void LineBuffer::append(const QByteArray &data)
 {
-    _buffer += data;
+    // Compact the buffer if the unconsumed data is less than half of it, so
+    // consumed data doesn't build up.  This moves the partial line in place.
+    if(_start > 0 && _start >= _buffer.size() - _start)
+    {
+        _buffer.remove(0, _start);
+        _scanPos -= _start;
+        _start = 0;
+    }
+    _buffer.append(data);
 
-    int lineStartPos = 0;
-    int lineEndPos = _buffer.indexOf('\n', lineStartPos);
-    while(lineEndPos >= 0)
+    bool copyLines = isSignalConnected(QMetaMethod::fromSignal(&LineBuffer::lineComplete));
+    const char *pBuffer = _buffer.constData();
+    const char *pEnd = pBuffer + _buffer.size();
+    const char *pLineStart = pBuffer + _start;
+    const char *pScan = pBuffer + _scanPos;
+    while(const char *pLineEnd = static_cast<const char*>(std::memchr(pScan, '\n', pEnd - pScan)))
     {
-        int lineTrimmedEnd = lineEndPos;
-        if(lineEndPos > lineStartPos && _buffer[lineEndPos-1] == '\r')
-            --lineTrimmedEnd;
+        const char *pTrimmedEnd = pLineEnd;
+        if(pTrimmedEnd > pLineStart && pTrimmedEnd[-1] == '\r')
+            --pTrimmedEnd;
 
-        QByteArray line = _buffer.mid(lineStartPos, lineTrimmedEnd - lineStartPos);
-        emit lineComplete(line);
+        int lineLength = static_cast<int>(pTrimmedEnd - pLineStart);
+        QByteArray ownedLine;
+        if(copyLines)
+            ownedLine = QByteArray{pLineStart, lineLength};
+        emit lineView(QByteArray::fromRawData(pLineStart, lineLength));
+        if(copyLines)
+            emit lineComplete(ownedLine);
 
-        lineStartPos = lineEndPos + 1;
-        lineEndPos = _buffer.indexOf('\n', lineStartPos);
+        // A slot may reset the buffer (such as when the process exits); the
+        // remaining data was discarded in that case.
+        if(_buffer.isEmpty())
+            return;
+
+        pLineStart = pScan = pLineEnd + 1;
     }
 
-    // lineStartPos is now the beginning of the last partial line in the buffer.
-    // If the buffer content ended with '\n', it's the length of the buffer, so
-    // this empties the buffer.
-    _buffer = _buffer.mid(lineStartPos);
+    // pLineStart is now the beginning of the last partial line in the buffer.
+    // If the buffer content ended with '\n', it's the end of the buffer, so
+    // the buffer is emptied (keeping its storage).
+    _start = static_cast<int>(pLineStart - pBuffer);
+    _scanPos = _buffer.size();
+    if(_start == _buffer.size())
+    {
+        _buffer.resize(0);
+        _start = _scanPos = 0;
+    }
 }
 
 QByteArray LineBuffer::reset()
 {
-    return std::exchange(_buffer, QByteArray{});
+    QByteArray partialLine = _buffer.mid(_start);
+    _buffer.resize(0);
+    _start = _scanPos = 0;
+    return partialLine;
 }
@@ -27,12 +27,20 @@
 // Any partial line that remains on destruction (a partial line that wasn't
 // terminated with a line break) is ignored.  If the process is restarted,
 // reset() can be used to reset the buffer.
+//
+// Completed lines are found with memchr() and emitted in place.  The buffer
+// is only compacted once the consumed data makes up most of it, and its
+// storage is kept, so steady output doesn't allocate for each chunk or line.
 class COMMON_EXPORT LineBuffer : public QObject
 {
     Q_OBJECT
 
 public:
-    // Add data to the buffer; emits lineComplete() for completed lines.
+    LineBuffer();
+
+public:
+    // Add data to the buffer; emits lineView() and lineComplete() for
+    // completed lines.
     void append(const QByteArray &data);
 
     // Reset the buffer; returns the partial line left in the buffer (if there
@@ -40,11 +48,22 @@ public:
     QByteArray reset();
 
 signals:
-    // A completed line was read
+    // A completed line was read.  'line' refers directly to the buffer's data,
+    // it is only valid during the signal; consumers that parse or convert the
+    // line in place should use this.  (It must not be used with a queued
+    // connection.)
+    void lineView(const QByteArray &line);
+    // A completed line was read; 'line' owns its data.  The line is only
+    // copied if this signal is connected.
     void lineComplete(const QByteArray &line);
 
 private:
     QByteArray _buffer;
+    // Start of the unconsumed data in _buffer
+    int _start;
+    // Position where scanning for the next line break resumes (the partial
+    // line before it has already been scanned)
+    int _scanPos;
 };
 
 #endif
@@ -0,0 +1,288 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("metrics.cpp")
+
+#include "metrics.h"
+#include <QLocale>
+#include <QMutex>
+#include <QMutexLocker>
+#include <atomic>
+
+namespace
+{
+    enum class MetricType
+    {
+        Counter,
+        Gauge,
+        Summary,
+        Histogram,
+    };
+
+    struct MetricSample
+    {
+        double value = 0.0;   // Counter/gauge value, or summary/histogram sum
+        quint64 count = 0;    // Summary/histogram count
+        // Histograms only - the labels (to render with "le"), bucket bounds,
+        // and the non-cumulative bucket counts
+        Metrics::Labels labels;
+        QVector<double> bucketBounds;
+        QVector<quint64> bucketCounts;
+    };
+
+    struct MetricFamily
+    {
+        MetricType type;
+        // Samples by rendered label set (see renderLabels())
+        QMap<QByteArray, MetricSample> samples;
+    };
+
+    std::atomic<bool> _enabled{false};
+    QMutex _mutex;
+    QMap<QString, MetricFamily> _families;
+
+    // Render a label set, like {method="connectVPN"}.  Empty if there are no
+    // labels.
+    QByteArray renderLabels(const Metrics::Labels &labels)
+    {
+        if(labels.isEmpty())
+            return {};
+
+        QByteArray rendered{"{"};
+        for(auto itLabel = labels.begin(); itLabel != labels.end(); ++itLabel)
+        {
+            if(itLabel != labels.begin())
+                rendered += ',';
+            rendered += itLabel.key().toUtf8();
+            rendered += "=\"";
+            for(char c : itLabel.value().toUtf8())
+            {
+                switch(c)
+                {
+                    case '\\':
+                        rendered += "\\\\";
+                        break;
+                    case '"':
+                        rendered += "\\\"";
+                        break;
+                    case '\n':
+                        rendered += "\\n";
+                        break;
+                    default:
+                        rendered += c;
+                        break;
+                }
+            }
+            rendered += '"';
+        }
+        rendered += '}';
+        return rendered;
+    }
+
+    // Get the sample for a metric; returns nullptr if the family already exists
+    // with a different type.  _mutex must be locked.
+    MetricSample *getSample(const QString &name, MetricType type,
+                            const Metrics::Labels &labels)
+    {
+        auto itFamily = _families.find(name);
+        if(itFamily == _families.end())
+            itFamily = _families.insert(name, MetricFamily{type, {}});
+        else if(itFamily->type != type)
+        {
+            qWarning() << "Metric" << name << "was already recorded with a different type";
+            return nullptr;
+        }
+        return &itFamily->samples[renderLabels(labels)];
+    }
+
+    // Render a value with the shortest representation that round-trips
+    QString valueString(double value)
+    {
+        return QString::number(value, 'g', QLocale::FloatingPointShortest);
+    }
+
+    void renderValue(QByteArray &text, double value)
+    {
+        text += valueString(value).toLatin1();
+    }
+}
+
+void Metrics::setEnabled(bool enabled)
+{
+    QMutexLocker lock{&_mutex};
+    _enabled = enabled;
+    if(!enabled)
+        _families.clear();
+}
+
+bool Metrics::enabled()
+{
+    return _enabled;
+}
+
+void Metrics::increment(const QString &name, const Labels &labels, double amount)
+{
+    if(!_enabled)
+        return;
+    QMutexLocker lock{&_mutex};
+    if(MetricSample *pSample = getSample(name, MetricType::Counter, labels))
+        pSample->value += amount;
+}
+
+void Metrics::setCounter(const QString &name, double total, const Labels &labels)
+{
+    if(!_enabled)
+        return;
+    QMutexLocker lock{&_mutex};
+    if(MetricSample *pSample = getSample(name, MetricType::Counter, labels))
+        pSample->value = total;
+}
+
+void Metrics::setGauge(const QString &name, double value, const Labels &labels)
+{
+    if(!_enabled)
+        return;
+    QMutexLocker lock{&_mutex};
+    if(MetricSample *pSample = getSample(name, MetricType::Gauge, labels))
+        pSample->value = value;
+}
+
+void Metrics::clearGauge(const QString &name)
+{
+    QMutexLocker lock{&_mutex};
+    auto itFamily = _families.find(name);
+    if(itFamily != _families.end() && itFamily->type == MetricType::Gauge)
+        itFamily->samples.clear();
+}
+
+void Metrics::observe(const QString &name, double value, const Labels &labels)
+{
+    if(!_enabled)
+        return;
+    QMutexLocker lock{&_mutex};
+    if(MetricSample *pSample = getSample(name, MetricType::Summary, labels))
+    {
+        pSample->value += value;
+        ++pSample->count;
+    }
+}
+
+void Metrics::setHistogram(const QString &name,
+                           const QVector<double> &bucketBounds,
+                           const QVector<quint64> &bucketCounts, double sum,
+                           const Labels &labels)
+{
+    Q_ASSERT(bucketCounts.size() == bucketBounds.size() + 1);
+    if(!_enabled)
+        return;
+    QMutexLocker lock{&_mutex};
+    if(MetricSample *pSample = getSample(name, MetricType::Histogram, labels))
+    {
+        pSample->value = sum;
+        pSample->count = 0;
+        for(quint64 bucketCount : bucketCounts)
+            pSample->count += bucketCount;
+        pSample->labels = labels;
+        pSample->bucketBounds = bucketBounds;
+        pSample->bucketCounts = bucketCounts;
+    }
+}
+
+QByteArray Metrics::openMetricsText()
+{
+    QByteArray text;
+
+    QMutexLocker lock{&_mutex};
+    for(auto itFamily = _families.begin(); itFamily != _families.end(); ++itFamily)
+    {
+        const QByteArray &name = itFamily.key().toUtf8();
+        const MetricFamily &family = itFamily.value();
+
+        text += "# TYPE ";
+        text += name;
+        switch(family.type)
+        {
+            case MetricType::Counter:
+                text += " counter\n";
+                break;
+            case MetricType::Gauge:
+                text += " gauge\n";
+                break;
+            case MetricType::Summary:
+                text += " summary\n";
+                break;
+            case MetricType::Histogram:
+                text += " histogram\n";
+                break;
+        }
+
+        for(auto itSample = family.samples.begin(); itSample != family.samples.end(); ++itSample)
+        {
+            const QByteArray &labels = itSample.key();
+            const MetricSample &sample = itSample.value();
+            switch(family.type)
+            {
+                case MetricType::Counter:
+                    text += name + "_total" + labels + ' ';
+                    renderValue(text, sample.value);
+                    text += '\n';
+                    break;
+                case MetricType::Gauge:
+                    text += name + labels + ' ';
+                    renderValue(text, sample.value);
+                    text += '\n';
+                    break;
+                case MetricType::Histogram:
+                {
+                    // Bucket counts are cumulative in OpenMetrics
+                    Labels bucketLabels{sample.labels};
+                    quint64 cumulativeCount = 0;
+                    for(int i=0; i<sample.bucketCounts.size(); ++i)
+                    {
+                        cumulativeCount += sample.bucketCounts[i];
+                        if(i < sample.bucketBounds.size())
+                        {
+                            bucketLabels[QStringLiteral("le")] =
+                                valueString(sample.bucketBounds[i]);
+                        }
+                        else
+                            bucketLabels[QStringLiteral("le")] = QStringLiteral("+Inf");
+                        text += name + "_bucket" + renderLabels(bucketLabels) + ' ' +
+                            QByteArray::number(cumulativeCount) + '\n';
+                    }
+                }
+                    // Then _count and _sum, like a summary
+                    Q_FALLTHROUGH();
+                case MetricType::Summary:
+                    text += name + "_count" + labels + ' ' + QByteArray::number(sample.count) + '\n';
+                    text += name + "_sum" + labels + ' ';
+                    renderValue(text, sample.value);
+                    text += '\n';
+                    break;
+            }
+        }
+    }
+    text += "# EOF\n";
+    return text;
+}
+
+const QByteArray &Metrics::contentType()
+{
+    static const QByteArray type{"application/openmetrics-text; version=1.0.0; charset=utf-8"};
+    return type;
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("metrics.h")
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QByteArray>
+#include <QMap>
+#include <QString>
+#include <QVector>
+
+// Metrics collects runtime statistics - counters, gauges, and summaries - and
+// renders them in the OpenMetrics text format (which Prometheus also accepts).
+// The daemon serves these from its opt-in metrics endpoint (MetricsServer).
+//
+// A metric family is identified by its name, and each sample in the family by
+// its labels.  Family names don't include the "_total" suffix for counters or
+// the "_count"/"_sum"/"_bucket" suffixes for summaries and histograms; those
+// are added when rendering.
+// A family's type is set by the first value recorded for it.
+//
+// Nothing is recorded unless metrics are enabled, so the instrumented code can
+// record metrics unconditionally.  All methods are thread-safe.
+class COMMON_EXPORT Metrics
+{
+public:
+    using Labels = QMap<QString, QString>;
+
+public:
+    // Enable or disable recording.  Disabling also discards all recorded
+    // values.
+    static void setEnabled(bool enabled);
+    static bool enabled();
+
+    // Add to a counter
+    static void increment(const QString &name, const Labels &labels = {},
+                          double amount = 1.0);
+    // Set a counter to a total that's accumulated elsewhere
+    static void setCounter(const QString &name, double total,
+                           const Labels &labels = {});
+    // Set a gauge to a value
+    static void setGauge(const QString &name, double value,
+                         const Labels &labels = {});
+    // Remove all samples of a gauge family (used for gauges whose label sets
+    // change, like per-region values)
+    static void clearGauge(const QString &name);
+    // Record an observation for a summary (rendered as a count and sum)
+    static void observe(const QString &name, double value,
+                        const Labels &labels = {});
+    // Set a histogram that's accumulated elsewhere.  bucketCounts has the
+    // (non-cumulative) count for each upper bound in bucketBounds, followed by
+    // the count for values above the last bound.
+    static void setHistogram(const QString &name,
+                             const QVector<double> &bucketBounds,
+                             const QVector<quint64> &bucketCounts, double sum,
+                             const Labels &labels = {});
+
+    // Render all metrics in the OpenMetrics text format, sorted by name.
+    static QByteArray openMetricsText();
+    // Content type for openMetricsText()
+    static const QByteArray &contentType();
+};
+
+#endif
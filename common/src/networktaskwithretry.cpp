@@ -24,6 +24,7 @@
 #include <QTimer>
 #include <QNetworkRequest>
 #include <QNetworkReply>
+#include <algorithm>
 
 namespace
 {
@@ -31,6 +32,14 @@ namespace
     const std::chrono::seconds requestTimeout{5};
 
     const QByteArray authHeaderName{QByteArrayLiteral("Authorization")};
+    const QByteArray ifNoneMatchHeaderName{QByteArrayLiteral("If-None-Match")};
+    const QByteArray ifModifiedSinceHeaderName{QByteArrayLiteral("If-Modified-Since")};
+    const QByteArray etagHeaderName{QByteArrayLiteral("ETag")};
+    const QByteArray lastModifiedHeaderName{QByteArrayLiteral("Last-Modified")};
+
+    // HTTP status indicating that the resource hasn't changed since the
+    // response that provided the cache validators
+    const int httpStatusNotModified{304};
 
     // Set the authorization header on a QNetworkRequest
     void setAuth(QNetworkRequest &request, const QByteArray &authHeaderVal)
@@ -44,11 +53,16 @@ NetworkTaskWithRetry::NetworkTaskWithRetry(QNetworkAccessManager::Operation verb
                                            QString resource,
                                            std::unique_ptr<ApiRetry> pRetryStrategy,
                                            const QJsonDocument &data,
-                                           QByteArray authHeaderVal)
+                                           QByteArray authHeaderVal,
+                                           std::chrono::milliseconds hedgeDelay,
+                                           HttpCacheValidators cacheValidators)
     : _verb{std::move(verb)}, _baseUriSequence{apiBaseUris.beginAttempt()},
       _pRetryStrategy{std::move(pRetryStrategy)}, _resource{std::move(resource)},
       _data{(data.isNull() ? QByteArray() : data.toJson())},
-      _authHeaderVal{std::move(authHeaderVal)},
+      _authHeaderVal{std::move(authHeaderVal)}, _nextAttemptId{0},
+      _attemptScheduled{false}, _attemptsExhausted{false},
+      _hedgeDelay{hedgeDelay}, _cacheValidators{std::move(cacheValidators)},
+      _response{false, {}},
       _worstRetriableError{Error::Code::ApiNetworkError}
 {
     Q_ASSERT(_pRetryStrategy);
@@ -57,101 +71,190 @@ NetworkTaskWithRetry::NetworkTaskWithRetry(QNetworkAccessManager::Operation verb
              _verb == QNetworkAccessManager::Operation::PostOperation ||
              _verb == QNetworkAccessManager::Operation::HeadOperation);
 
+    // Hedging only makes sense with more than one base URI
+    if(apiBaseUris.getUriCount() < 2)
+        _hedgeDelay = {};
+    _hedgeTimer.setSingleShot(true);
+    connect(&_hedgeTimer, &QTimer::timeout, this,
+            &NetworkTaskWithRetry::onHedgeTimeout);
+
     scheduleNextAttempt();
 }
 
 NetworkTaskWithRetry::~NetworkTaskWithRetry()
 {
-
+    abortPendingAttempts();
 }
 
 void NetworkTaskWithRetry::scheduleNextAttempt()
 {
     Q_ASSERT(_pRetryStrategy);  // Class invariant
 
-    nullable_t<std::chrono::milliseconds> nextDelay = _pRetryStrategy->beginNextAttempt(_resource);
+    nullable_t<std::chrono::milliseconds> nextDelay;
+    if(!_attemptsExhausted)
+        nextDelay = _pRetryStrategy->beginNextAttempt(_resource);
     if(!nextDelay)
     {
+        _attemptsExhausted = true;
+        // If hedged attempts are still in progress, wait for them
+        if(!_pendingAttempts.empty())
+            return;
         qWarning() << "Request for resource" << _resource
             << "failed, returning error" << _worstRetriableError;
         reject({HERE, _worstRetriableError});
         return;
     }
 
+    _attemptScheduled = true;
     QTimer::singleShot(nextDelay->count(), this, &NetworkTaskWithRetry::executeNextAttempt);
 }
 
 void NetworkTaskWithRetry::executeNextAttempt()
 {
+    _attemptScheduled = false;
+
+    const QString &baseUri = _baseUriSequence.getNextUri();
+
+    // If this base URI is failing (and there were no others to use), fail the
+    // attempt without making a request.  The retry strategy still applies, so
+    // a later attempt can probe it once its cooldown elapses.
+    if(ApiCircuitBreaker::isOpen(baseUri))
+    {
+        qWarning() << "Skipping attempt for" << _resource << "-" << baseUri
+            << "has been failing";
+        if(_pendingAttempts.empty())
+            scheduleNextAttempt();
+        return;
+    }
+
+    quint64 attemptId = _nextAttemptId++;
+    auto pResponse = QSharedPointer<ResponseInfo>::create();
+    _pendingAttempts.push_back({attemptId, _baseUriSequence.getCurrentIndex(),
+                                sendRequest(baseUri, pResponse), pResponse});
+
     // Handle the request
-    sendRequest()
-            ->notify(this, [this](const Error& error, const QByteArray& body) {
-
-                // Release this task; it's no longer needed
-                _pNetworkReply.reset();
-
-                // Check for errors
-                if (error)
-                {
-                    // Auth errors can't be retried.
-                    if (error.code() == Error::ApiUnauthorizedError)
-                    {
-                        reject(error);
-                        return;
-                    }
-
-                    // A rate limiting error is worse than a network error - set the worst
-                    // retriable error, but keep trying in case another API endpoint gives us
-                    // 200 or 401.
-                    // (Otherwise, leave the worst error alone, it might already be set to a
-                    // rate limiting error by a prior attempt.)
-                    if (error.code() == Error::ApiRateLimitedError)
-                        _worstRetriableError = Error::Code::ApiRateLimitedError;
-
-                    qWarning() << "Attempt for" << _resource
-                        << "failed with error" << error;
-
-                    // Retry if we still have attempts left.
-                    scheduleNextAttempt();
-                }
-                else
-                {
-                    _baseUriSequence.attemptSucceeded();
-                    resolve(body);
-                }
+    _pendingAttempts.back()._pNetworkReply
+            ->notify(this, [this, attemptId](const Error& error, const QByteArray& body) {
+                onAttemptFinished(attemptId, error, body);
             });
+
+    // If hedging, begin another attempt if this one doesn't finish in time.
+    // Don't hedge beyond the number of base URIs, that would just repeat a
+    // base URI that's already pending.
+    if(_hedgeDelay.count() > 0 && !_attemptsExhausted &&
+       _pendingAttempts.size() < _baseUriSequence.getUriCount())
+    {
+        _hedgeTimer.start(msec32(_hedgeDelay));
+    }
+}
+
+void NetworkTaskWithRetry::onHedgeTimeout()
+{
+    // Nothing to do if an attempt is already scheduled (the pending attempt
+    // failed and a retry is coming up anyway)
+    if(_attemptScheduled || !isPending())
+        return;
+
+    qInfo() << "Request for" << _resource << "hasn't finished after"
+        << traceMsec(_hedgeDelay) << "- hedging with another attempt";
+    scheduleNextAttempt();
+}
+
+void NetworkTaskWithRetry::onAttemptFinished(quint64 attemptId,
+                                             const Error &error,
+                                             const QByteArray &body)
+{
+    auto itAttempt = std::find_if(_pendingAttempts.begin(), _pendingAttempts.end(),
+        [attemptId](const PendingAttempt &attempt){return attempt._id == attemptId;});
+    // Ignore attempts that were aborted
+    if(itAttempt == _pendingAttempts.end())
+        return;
+
+    unsigned baseUriIndex = itAttempt->_baseUriIndex;
+    QSharedPointer<ResponseInfo> pResponse = itAttempt->_pResponse;
+    // Release this task; it's no longer needed
+    _pendingAttempts.erase(itAttempt);
+
+    const QString &baseUri = _baseUriSequence.getUri(baseUriIndex);
+
+    // Check for errors
+    if (error)
+    {
+        // Auth errors can't be retried.
+        if (error.code() == Error::ApiUnauthorizedError)
+        {
+            // The API base is reachable, the request just can't succeed
+            ApiCircuitBreaker::attemptSucceeded(baseUri);
+            abortPendingAttempts();
+            reject(error);
+            return;
+        }
+
+        // A rate limiting error is worse than a network error - set the worst
+        // retriable error, but keep trying in case another API endpoint gives us
+        // 200 or 401.
+        // (Otherwise, leave the worst error alone, it might already be set to a
+        // rate limiting error by a prior attempt.)
+        if (error.code() == Error::ApiRateLimitedError)
+            _worstRetriableError = Error::Code::ApiRateLimitedError;
+
+        qWarning() << "Attempt for" << _resource
+            << "failed with error" << error;
+        ApiCircuitBreaker::attemptFailed(baseUri);
+
+        // Retry if we still have attempts left.  If a hedged attempt is still
+        // in progress, or the next attempt is already scheduled, there's
+        // nothing to do yet.
+        if(_pendingAttempts.empty() && !_attemptScheduled)
+        {
+            _hedgeTimer.stop();
+            scheduleNextAttempt();
+        }
+    }
+    else
+    {
+        _hedgeTimer.stop();
+        abortPendingAttempts();
+        _baseUriSequence.attemptSucceeded(baseUriIndex);
+        ApiCircuitBreaker::attemptSucceeded(baseUri);
+        _response = *pResponse;
+        resolve(body);
+    }
 }
 
-Async<QByteArray> NetworkTaskWithRetry::sendRequest()
+void NetworkTaskWithRetry::abortPendingAttempts()
+{
+    // Take the attempts first - rejecting them invokes onAttemptFinished(),
+    // which ignores them since they're no longer pending.  Dropping the
+    // request tasks releases their replies, which aborts the requests.
+    std::vector<PendingAttempt> abortedAttempts;
+    abortedAttempts.swap(_pendingAttempts);
+    for(auto &attempt : abortedAttempts)
+    {
+        if(attempt._pNetworkReply)
+            attempt._pNetworkReply->reject();
+    }
+}
+
+Async<QByteArray> NetworkTaskWithRetry::sendRequest(const QString &baseUri,
+                                                    QSharedPointer<ResponseInfo> pResponse)
 {
     // Use ApiNetwork's QNetworkAccessManager, this binds us to the VPN
     // interface when connected (important when we do not route the default
     // gateway into the VPN).
     QNetworkAccessManager &networkManager = ApiNetwork::instance()->getAccessManager();
 
-    // Clear the connection cache for every request.
-    //
-    // QNetworkManager caches connections for reuse, but if we connect or
-    // disconnect from the VPN, these connections break.  If QNetworkManager
-    // uses a cached connection that's broken, we end up waiting the full
-    // 10 seconds before the request is aborted.
-    //
-    // The cost of waiting for a bad cached connection to time out is a lot
-    // higher than the cost of establishing a new connection, so clear them
-    // every time.  (There is no way to disable connection caching in
-    // QNetworkAccessManager.)
-    //
-    // In principle, we could try to do this only when the connection state
-    // changes, but it would have to be cleared any time the OpenVPNProcess
-    // state changes, which doesn't always cause a state transition in
-    // VPNConnection.  The cost of failing to clear the cache is pretty high,
-    // but the cost of clearing it an extra time is pretty small, so such an
-    // optimization probably would be too complex to make sense.
-    networkManager.clearConnectionCache();
-
-    QNetworkRequest request(_baseUriSequence.getNextUri() + _resource);
+    // Cached connections are cleared by ApiNetwork when the network changes
+    // (see ApiNetwork::setProxy()), so requests can reuse connections (and
+    // HTTP/2 streams) to the API hosts otherwise.
+    QNetworkRequest request(baseUri + _resource);
+    ApiNetwork::instance()->prepareRequest(request);
     if (!_authHeaderVal.isEmpty())
         setAuth(request, _authHeaderVal);
+    if (!_cacheValidators.etag.isEmpty())
+        request.setRawHeader(ifNoneMatchHeaderName, _cacheValidators.etag);
+    if (!_cacheValidators.lastModified.isEmpty())
+        request.setRawHeader(ifModifiedSinceHeaderName, _cacheValidators.lastModified);
 
     // The URL for each request is logged to indicate if there is trouble with
     // specific API URLs, etc.  The resources we request don't contain any
@@ -183,6 +286,7 @@ Async<QByteArray> NetworkTaskWithRetry::sendRequest()
     // in (e.g. abort->finished->delete is not currently safe). This way
     // we don't have to delay the entire finished signal to stay safe.
     QSharedPointer<QNetworkReply> reply(replyPtr, &QObject::deleteLater);
+    ApiNetwork::instance()->trackReply(*reply);
 
     // Abort the request if it doesn't complete within a certain interval
     QTimer::singleShot(std::chrono::milliseconds(requestTimeout).count(), reply.get(), &QNetworkReply::abort);
@@ -190,7 +294,7 @@ Async<QByteArray> NetworkTaskWithRetry::sendRequest()
     // Create a network task that resolves to the result of the request
     auto networkTask = Async<QByteArray>::create();
     ApiResource resource = _resource;
-    connect(reply.get(), &QNetworkReply::finished, networkTask.get(), [networkTask = networkTask.get(), reply, resource]
+    connect(reply.get(), &QNetworkReply::finished, networkTask.get(), [networkTask = networkTask.get(), reply, resource, pResponse]
     {
         auto keepAlive = networkTask->sharedFromThis();
 
@@ -233,6 +337,16 @@ Async<QByteArray> NetworkTaskWithRetry::sendRequest()
             return;
         }
 
+        pResponse->notModified = statusCode.toInt() == httpStatusNotModified;
+        pResponse->validators.etag = reply->rawHeader(etagHeaderName);
+        pResponse->validators.lastModified = reply->rawHeader(lastModifiedHeaderName);
+        if (pResponse->notModified)
+        {
+            qInfo() << "Resource" << resource << "has not been modified";
+            networkTask->resolve({});
+            return;
+        }
+
         networkTask->resolve(reply->readAll());
     });
 
@@ -27,7 +27,22 @@
 #include "apiretry.h"
 #include <QJsonDocument>
 #include <QNetworkAccessManager>
+#include <QSharedPointer>
+#include <QTimer>
+#include <chrono>
 #include <memory>
+#include <vector>
+
+// HTTP cache validators from a response.  These are sent with a later request
+// for the same resource to make it conditional - the server then only returns
+// the resource if it has changed.
+struct COMMON_EXPORT HttpCacheValidators
+{
+    QByteArray etag;
+    QByteArray lastModified;
+
+    bool isEmpty() const {return etag.isEmpty() && lastModified.isEmpty();}
+};
 
 // NetworkTaskWithRetry executes an API request until either it succeeds or
 // the maximum attempt count is reached.  It uses a NetworkReplyHandler for each
@@ -52,21 +67,63 @@ public:
     //
     // If authHeaderVal is not empty, it is applied as an authorization header
     // to each request.
+    //
+    // If hedgeDelay is nonzero, requests are hedged across the base URIs - if
+    // an attempt hasn't finished after hedgeDelay, the next attempt begins
+    // alongside it on the next base URI.  The first successful attempt is
+    // used, and the others are aborted.  Hedged attempts count toward the
+    // retry strategy's attempts.
+    //
+    // If cacheValidators is not empty, the request is conditional (using
+    // If-None-Match / If-Modified-Since).  If the server indicates that the
+    // resource hasn't changed, the task resolves with an empty body, and
+    // notModified() returns true.
     NetworkTaskWithRetry(QNetworkAccessManager::Operation verb,
                          ApiBase &apiBaseUris, QString resource,
                          std::unique_ptr<ApiRetry> pRetryStrategy,
-                         const QJsonDocument &data, QByteArray authHeaderVal);
+                         const QJsonDocument &data, QByteArray authHeaderVal,
+                         std::chrono::milliseconds hedgeDelay = {},
+                         HttpCacheValidators cacheValidators = {});
     ~NetworkTaskWithRetry();
 
+public:
+    // Once the task has resolved, indicates whether the server responded that
+    // the resource was not modified (only possible for conditional requests).
+    bool notModified() const {return _response.notModified;}
+    // Once the task has resolved, the cache validators from the successful
+    // response (if the server provided any).
+    const HttpCacheValidators &responseValidators() const {return _response.validators;}
+
 private:
-    // Schedule an attempt, or reject if all attempts have been used.
+    // Schedule an attempt, or reject if all attempts have been used (and none
+    // are still in progress).
     void scheduleNextAttempt();
 
     // Execute an attempt (used by scheduleNextAttempt())
     void executeNextAttempt();
 
-    // Create task to issue a single request and return its body.
-    Async<QByteArray> sendRequest();
+    // Hedge delay elapsed - begin another attempt alongside the pending ones
+    void onHedgeTimeout();
+
+    // Handle the result of an attempt
+    void onAttemptFinished(quint64 attemptId, const Error &error,
+                           const QByteArray &body);
+
+    // Abort all pending attempts (after one succeeds, or on an auth error)
+    void abortPendingAttempts();
+
+    // Details of a successful response besides the body
+    struct ResponseInfo
+    {
+        bool notModified;
+        HttpCacheValidators validators;
+    };
+
+    // Create task to issue a single request to a base URI and return its
+    // body.  The response details are stored in pResponse before the task
+    // resolves.
+    Async<QByteArray> sendRequest(const QString &baseUri,
+                                  QSharedPointer<ResponseInfo> pResponse);
 
 private:
     QNetworkAccessManager::Operation _verb;
@@ -75,7 +132,27 @@ private:
     ApiResource _resource;
     QByteArray _data;
     QByteArray _authHeaderVal;
-    Async<QByteArray> _pNetworkReply;
+    // An attempt that is in progress, and the index of the base URI it used.
+    struct PendingAttempt
+    {
+        quint64 _id;
+        unsigned _baseUriIndex;
+        Async<QByteArray> _pNetworkReply;
+        QSharedPointer<ResponseInfo> _pResponse;
+    };
+    // Attempts that are in progress - at most one unless hedging is enabled
+    std::vector<PendingAttempt> _pendingAttempts;
+    quint64 _nextAttemptId;
+    // Whether an attempt has been scheduled by scheduleNextAttempt() but not
+    // executed yet
+    bool _attemptScheduled;
+    // Whether the retry strategy has run out of attempts
+    bool _attemptsExhausted;
+    std::chrono::milliseconds _hedgeDelay;
+    QTimer _hedgeTimer;
+    HttpCacheValidators _cacheValidators;
+    // Details of the successful response
+    ResponseInfo _response;
     // ApiRateLimitedError is retriable but causes us to return that instead of
     // the generic error if we don't encounter an auth error.
     // This field keeps track of the worst retriable error we have seen, if we
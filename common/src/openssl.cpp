@@ -22,9 +22,11 @@
 #include "openssl.h"
 
 #include <QDir>
+#include <QElapsedTimer>
 #include <QLibrary>
 #include <QSslSocket>
 
+#include <algorithm>
 #include <cctype>
 
 // Check that a module path matches a certain library name, taking into
@@ -145,6 +147,8 @@ struct EVP_MD;
 struct ENGINE;
 struct BIO;
 struct EVP_PKEY;
+struct EVP_CIPHER;
+struct EVP_CIPHER_CTX;
 typedef int (*pem_password_cb)(char* buf, int size, int rwflag, void* u);
 
 
@@ -167,18 +171,31 @@ static int (*EVP_DigestVerifyInit)(EVP_MD_CTX* ctx, EVP_PKEY_CTX** pctx, const E
 static int (*EVP_DigestUpdate)(EVP_MD_CTX* ctx, const void* d, size_t cnt) = nullptr;
 static int (*EVP_DigestVerifyFinal)(EVP_MD_CTX* ctx, const unsigned char* sig, size_t siglen) = nullptr;
 
-
-static bool checkOpenSSL()
+// Used only by measureCipherThroughput(); these are optional
+static const EVP_CIPHER* (*EVP_get_cipherbyname)(const char* name) = nullptr;
+static const EVP_MD* (*EVP_get_digestbyname)(const char* name) = nullptr;
+static EVP_CIPHER_CTX* (*EVP_CIPHER_CTX_new)() = nullptr;
+static void (*EVP_CIPHER_CTX_free)(EVP_CIPHER_CTX* ctx) = nullptr;
+static int (*EVP_EncryptInit_ex)(EVP_CIPHER_CTX* ctx, const EVP_CIPHER* type, ENGINE* impl, const unsigned char* key, const unsigned char* iv) = nullptr;
+static int (*EVP_EncryptUpdate)(EVP_CIPHER_CTX* ctx, unsigned char* out, int* outl, const unsigned char* in, int inl) = nullptr;
+static int (*EVP_EncryptFinal_ex)(EVP_CIPHER_CTX* ctx, unsigned char* out, int* outl) = nullptr;
+static int (*EVP_DigestInit_ex)(EVP_MD_CTX* ctx, const EVP_MD* type, ENGINE* impl) = nullptr;
+static int (*EVP_DigestFinal_ex)(EVP_MD_CTX* ctx, unsigned char* md, unsigned int* s) = nullptr;
+static bool cipherFunctionsAvailable = false;
+
+// Used only by genCurve25519KeyPair(); these are optional (OpenSSL 1.1.1+)
+static EVP_PKEY_CTX* (*EVP_PKEY_CTX_new_id)(int id, ENGINE* e) = nullptr;
+static void (*EVP_PKEY_CTX_free)(EVP_PKEY_CTX* ctx) = nullptr;
+static int (*EVP_PKEY_keygen_init)(EVP_PKEY_CTX* ctx) = nullptr;
+static int (*EVP_PKEY_keygen)(EVP_PKEY_CTX* ctx, EVP_PKEY** ppkey) = nullptr;
+static int (*EVP_PKEY_get_raw_private_key)(const EVP_PKEY* pkey, unsigned char* priv, size_t* len) = nullptr;
+static int (*EVP_PKEY_get_raw_public_key)(const EVP_PKEY* pkey, unsigned char* pub, size_t* len) = nullptr;
+static bool curve25519FunctionsAvailable = false;
+enum : int { NID_X25519 = 1034 };
+
+
+static bool loadOpenSSL()
 {
-    static bool attempted = false, successful = false;
-
-    if (successful)
-        return true;
-    if (attempted)
-        return false;
-
-    attempted = true;
-
     // This triggers Qt to load OpenSSL dynamically.
     if (!QSslSocket::supportsSsl())
         return false;
@@ -212,16 +229,41 @@ static bool checkOpenSSL()
         RESOLVE_OPENSSL_FUNCTION(EVP_DigestUpdate);
         RESOLVE_OPENSSL_FUNCTION(EVP_DigestVerifyFinal);
 
+        cipherFunctionsAvailable =
+            TRY_RESOLVE_OPENSSL_FUNCTION(EVP_get_cipherbyname) &&
+            TRY_RESOLVE_OPENSSL_FUNCTION(EVP_get_digestbyname) &&
+            TRY_RESOLVE_OPENSSL_FUNCTION(EVP_CIPHER_CTX_new) &&
+            TRY_RESOLVE_OPENSSL_FUNCTION(EVP_CIPHER_CTX_free) &&
+            TRY_RESOLVE_OPENSSL_FUNCTION(EVP_EncryptInit_ex) &&
+            TRY_RESOLVE_OPENSSL_FUNCTION(EVP_EncryptUpdate) &&
+            TRY_RESOLVE_OPENSSL_FUNCTION(EVP_EncryptFinal_ex) &&
+            TRY_RESOLVE_OPENSSL_FUNCTION(EVP_DigestInit_ex) &&
+            TRY_RESOLVE_OPENSSL_FUNCTION(EVP_DigestFinal_ex);
+
+        curve25519FunctionsAvailable =
+            TRY_RESOLVE_OPENSSL_FUNCTION(EVP_PKEY_CTX_new_id) &&
+            TRY_RESOLVE_OPENSSL_FUNCTION(EVP_PKEY_CTX_free) &&
+            TRY_RESOLVE_OPENSSL_FUNCTION(EVP_PKEY_keygen_init) &&
+            TRY_RESOLVE_OPENSSL_FUNCTION(EVP_PKEY_keygen) &&
+            TRY_RESOLVE_OPENSSL_FUNCTION(EVP_PKEY_get_raw_private_key) &&
+            TRY_RESOLVE_OPENSSL_FUNCTION(EVP_PKEY_get_raw_public_key);
+
 #undef RESOLVE_OPENSSL_FUNCTION
 #undef TRY_RESOLVE_OPENSSL_FUNCTION
 
-        successful = true;
-
         return true;
     }
     return false;
 }
 
+static bool checkOpenSSL()
+{
+    // Signatures can be checked on worker threads, so OpenSSL is loaded only
+    // once, with a thread-safe static initializer.
+    static const bool successful = loadOpenSSL();
+    return successful;
+}
+
 static const EVP_MD* getMD(QCryptographicHash::Algorithm algorithm)
 {
     switch (algorithm)
@@ -247,34 +289,202 @@ static EVP_PKEY* createPublicKeyFromPem(const QByteArray& pem)
     return result;
 }
 
-bool verifySignature(const QByteArray& publicKeyPem, const QByteArray& signature, const QByteArray& data, QCryptographicHash::Algorithm hashAlgorithm)
+static void printErrors()
 {
-    // For the time being, treat OpenSSL errors (e.g. unable to find the
-    // library) as though the signature validated successfully.
-    const bool opensslError = true;
+    ERR_print_errors_cb([](const char* str, size_t len, void*) {
+        qWarning() << QLatin1String(str, static_cast<int>(len));
+        return 0;
+    }, nullptr);
+}
 
-    if (!checkOpenSSL()) return opensslError;
+SignatureVerifier::SignatureVerifier(const QByteArray &publicKeyPem,
+                                     QCryptographicHash::Algorithm hashAlgorithm)
+    : _pCtx{nullptr}, _opensslUnavailable{false}, _failed{true}
+{
+    if (!checkOpenSSL())
+    {
+        _opensslUnavailable = true;
+        return;
+    }
 
     auto md = getMD(hashAlgorithm);
-    if (!md) return false;
+    if (!md) return;
 
     EVP_PKEY* pkey = createPublicKeyFromPem(publicKeyPem);
-    if (!pkey) return false;
+    if (!pkey) return;
+    // The context holds its own reference to the key
     AT_SCOPE_EXIT(EVP_PKEY_free(pkey));
 
-    auto ctx = EVP_MD_CTX_new();
-    if (!ctx) return false;
-    AT_SCOPE_EXIT(EVP_MD_CTX_free(ctx));
+    _pCtx = EVP_MD_CTX_new();
+    if (!_pCtx) return;
 
-    if (1 == EVP_DigestVerifyInit(ctx, nullptr, md, nullptr, pkey) &&
-        1 == EVP_DigestUpdate(ctx, data.data(), static_cast<size_t>(data.size())) &&
-        1 == EVP_DigestVerifyFinal(ctx, reinterpret_cast<const unsigned char*>(signature.data()), static_cast<size_t>(signature.size())))
-        return true;
+    if (1 != EVP_DigestVerifyInit(_pCtx, nullptr, md, nullptr, pkey))
+    {
+        printErrors();
+        return;
+    }
 
-    ERR_print_errors_cb([](const char* str, size_t len, void*) {
-        qWarning() << QLatin1String(str, static_cast<int>(len));
-        return 0;
-    }, nullptr);
+    _failed = false;
+}
+
+SignatureVerifier::~SignatureVerifier()
+{
+    if (_pCtx)
+        EVP_MD_CTX_free(_pCtx);
+}
+
+void SignatureVerifier::update(const char *data, int size)
+{
+    if (_failed || _opensslUnavailable || size <= 0)
+        return;
+
+    if (1 != EVP_DigestUpdate(_pCtx, data, static_cast<size_t>(size)))
+    {
+        printErrors();
+        _failed = true;
+    }
+}
+
+bool SignatureVerifier::verifyFinal(const QByteArray &signature)
+{
+    // For the time being, treat OpenSSL errors (e.g. unable to find the
+    // library) as though the signature validated successfully.
+    if (_opensslUnavailable) return true;
+    if (_failed) return false;
 
+    // The context can't be updated again after this
+    _failed = true;
+    if (1 == EVP_DigestVerifyFinal(_pCtx, reinterpret_cast<const unsigned char*>(signature.data()), static_cast<size_t>(signature.size())))
+        return true;
+
+    printErrors();
     return false;
 }
+
+bool verifySignature(const QByteArray& publicKeyPem, const QByteArray& signature, const QByteArray& data, QCryptographicHash::Algorithm hashAlgorithm)
+{
+    SignatureVerifier verifier{publicKeyPem, hashAlgorithm};
+    verifier.update(data);
+    return verifier.verifyFinal(signature);
+}
+
+double measureCipherThroughput(const QString &cipher, const QString &auth,
+                               int durationMs)
+{
+    if (!checkOpenSSL() || !cipherFunctionsAvailable)
+        return 0.0;
+
+    const EVP_CIPHER *pCipher = EVP_get_cipherbyname(qPrintable(cipher));
+    if (!pCipher)
+    {
+        qWarning() << "Cipher" << cipher << "is not supported by OpenSSL";
+        return 0.0;
+    }
+    // GCM ciphers authenticate the data themselves; others use a separate
+    // HMAC, which is approximated by digesting each packet.
+    const EVP_MD *pAuth = nullptr;
+    if (!cipher.endsWith(QStringLiteral("GCM")) && auth != QStringLiteral("none"))
+    {
+        pAuth = EVP_get_digestbyname(qPrintable(auth));
+        if (!pAuth)
+        {
+            qWarning() << "Digest" << auth << "is not supported by OpenSSL";
+            return 0.0;
+        }
+    }
+
+    EVP_CIPHER_CTX *pCipherCtx = EVP_CIPHER_CTX_new();
+    if (!pCipherCtx) return 0.0;
+    AT_SCOPE_EXIT(EVP_CIPHER_CTX_free(pCipherCtx));
+    EVP_MD_CTX *pMdCtx = EVP_MD_CTX_new();
+    if (!pMdCtx) return 0.0;
+    AT_SCOPE_EXIT(EVP_MD_CTX_free(pMdCtx));
+
+    // Encrypt packets of a typical tunnel size.  The key and IV don't matter,
+    // but the output buffer needs room for one extra block.
+    enum : int {PacketSize = 1400, BlockPadding = 32};
+    const unsigned char key[32]{}, iv[16]{};
+    unsigned char packet[PacketSize]{};
+    unsigned char encrypted[PacketSize + BlockPadding];
+    unsigned char digest[64];
+
+    if (1 != EVP_EncryptInit_ex(pCipherCtx, pCipher, nullptr, key, iv))
+    {
+        printErrors();
+        return 0.0;
+    }
+
+    qint64 bytes = 0;
+    QElapsedTimer elapsed;
+    elapsed.start();
+    do
+    {
+        int outLen = 0, finalLen = 0;
+        // Start a new packet with the same key, like OpenVPN does for each
+        // packet
+        if (1 != EVP_EncryptInit_ex(pCipherCtx, nullptr, nullptr, nullptr, iv) ||
+            1 != EVP_EncryptUpdate(pCipherCtx, encrypted, &outLen, packet, PacketSize) ||
+            1 != EVP_EncryptFinal_ex(pCipherCtx, encrypted + outLen, &finalLen))
+        {
+            printErrors();
+            return 0.0;
+        }
+        if (pAuth)
+        {
+            unsigned int digestLen = 0;
+            if (1 != EVP_DigestInit_ex(pMdCtx, pAuth, nullptr) ||
+                1 != EVP_DigestUpdate(pMdCtx, encrypted, static_cast<size_t>(outLen + finalLen)) ||
+                1 != EVP_DigestFinal_ex(pMdCtx, digest, &digestLen))
+            {
+                printErrors();
+                return 0.0;
+            }
+        }
+        // Feed the output back in so the work can't be optimized out
+        std::copy(encrypted, encrypted + 16, packet);
+        bytes += PacketSize;
+    }
+    while (elapsed.elapsed() < durationMs);
+
+    return bytes * 1000.0 / std::max<qint64>(elapsed.elapsed(), 1);
+}
+
+bool genCurve25519KeyPair(QByteArray &publicKey, QByteArray &privateKey)
+{
+    if(!checkOpenSSL() || !curve25519FunctionsAvailable)
+    {
+        qWarning() << "Curve25519 key generation isn't supported by this OpenSSL";
+        return false;
+    }
+
+    EVP_PKEY_CTX *pCtx = EVP_PKEY_CTX_new_id(NID_X25519, nullptr);
+    if(!pCtx)
+    {
+        printErrors();
+        return false;
+    }
+    AT_SCOPE_EXIT(EVP_PKEY_CTX_free(pCtx));
+
+    EVP_PKEY *pKey = nullptr;
+    if(1 != EVP_PKEY_keygen_init(pCtx) || 1 != EVP_PKEY_keygen(pCtx, &pKey))
+    {
+        printErrors();
+        return false;
+    }
+    AT_SCOPE_EXIT(EVP_PKEY_free(pKey));
+
+    QByteArray pub(Curve25519KeySize, 0), priv(Curve25519KeySize, 0);
+    size_t pubLen = static_cast<size_t>(pub.size());
+    size_t privLen = static_cast<size_t>(priv.size());
+    if(1 != EVP_PKEY_get_raw_public_key(pKey, reinterpret_cast<unsigned char*>(pub.data()), &pubLen) ||
+       1 != EVP_PKEY_get_raw_private_key(pKey, reinterpret_cast<unsigned char*>(priv.data()), &privLen) ||
+       pubLen != static_cast<size_t>(pub.size()) || privLen != static_cast<size_t>(priv.size()))
+    {
+        printErrors();
+        return false;
+    }
+
+    publicKey = pub;
+    privateKey = priv;
+    return true;
+}
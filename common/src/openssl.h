@@ -25,7 +25,59 @@
 
 #include <QByteArray>
 #include <QCryptographicHash>
+#include <QString>
+
+struct EVP_MD_CTX;
+
+// Verify a signature over data that's provided incrementally.  Pass the data
+// to update() in any number of chunks, then check the signature with
+// verifyFinal().
+class COMMON_EXPORT SignatureVerifier
+{
+public:
+    SignatureVerifier(const QByteArray &publicKeyPem,
+                      QCryptographicHash::Algorithm hashAlgorithm = QCryptographicHash::Sha256);
+    ~SignatureVerifier();
+
+private:
+    SignatureVerifier(const SignatureVerifier &) = delete;
+    SignatureVerifier &operator=(const SignatureVerifier &) = delete;
+
+public:
+    void update(const char *data, int size);
+    void update(const QByteArray &data) {update(data.constData(), data.size());}
+
+    // Check the signature of all data passed to update().  The verifier can't
+    // be used after this.
+    bool verifyFinal(const QByteArray &signature);
+
+private:
+    EVP_MD_CTX *_pCtx;
+    // Set if OpenSSL couldn't be loaded; see verifySignature()
+    bool _opensslUnavailable;
+    // Set if initialization or an update failed
+    bool _failed;
+};
 
 bool COMMON_EXPORT verifySignature(const QByteArray& publicKeyPem, const QByteArray& signature, const QByteArray& data, QCryptographicHash::Algorithm hashAlgorithm = QCryptographicHash::Sha256);
 
+// Measure how fast OpenSSL can encrypt tunnel-sized packets with an OpenVPN
+// data channel cipher on this CPU, for roughly durationMs.  'auth' is the HMAC
+// digest used with non-GCM ciphers (ignored for GCM).  Returns bytes per
+// second, or 0 if the cipher can't be used.
+//
+// This blocks for the whole duration; call it on a worker thread.
+double COMMON_EXPORT measureCipherThroughput(const QString &cipher,
+                                             const QString &auth,
+                                             int durationMs = 100);
+
+// Size of raw Curve25519 (X25519) keys, as used by WireGuard
+enum : int { Curve25519KeySize = 32 };
+
+// Generate a Curve25519 (X25519) key pair for WireGuard.  The keys are the
+// raw 32-byte values (WireGuard's configuration uses them base64-encoded).
+// Returns false if the OpenSSL library doesn't support X25519 (it requires
+// OpenSSL 1.1.1 or later).
+bool COMMON_EXPORT genCurve25519KeyPair(QByteArray &publicKey, QByteArray &privateKey);
+
 #endif // OPENSSL_H
@@ -0,0 +1,244 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("servicetimer.cpp")
+
+#include "servicetimer.h"
+#include <QDateTime>
+#if defined(Q_OS_WIN)
+#include <Windows.h>
+#elif defined(Q_OS_MACOS)
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+namespace
+{
+    // Interval of the periodic resume check.  Timeouts after a resume also
+    // check, so this only matters when no timer is due at wake.
+    const std::chrono::seconds resumeCheckInterval{15};
+    // A suspend is detected if the wall clock advanced this much more than the
+    // unbiased clock.  (Clock adjustments could cause a spurious detection,
+    // which just staggers a few timeouts.)
+    const std::chrono::seconds minSuspendTime{10};
+    // How long after a resume timeouts are staggered, and the spacing between
+    // staggered timeouts
+    const std::chrono::seconds staggerDuration{60};
+    const std::chrono::milliseconds staggerInterval{2000};
+    // Internal timer wakeups this close to the deadline are treated as having
+    // reached it (coarse timers can fire slightly early)
+    const std::chrono::milliseconds deadlineTolerance{20};
+}
+
+std::chrono::milliseconds TimerService::unbiasedNow()
+{
+#if defined(Q_OS_WIN)
+    ULONGLONG unbiasedTime{0};
+    ::QueryUnbiasedInterruptTime(&unbiasedTime);
+    // 100-nanosecond units
+    return std::chrono::milliseconds{static_cast<qint64>(unbiasedTime / 10000)};
+#elif defined(Q_OS_MACOS)
+    static const mach_timebase_info_data_t timebase = []()
+    {
+        mach_timebase_info_data_t info{};
+        ::mach_timebase_info(&info);
+        return info;
+    }();
+    quint64 nanoseconds = ::mach_absolute_time() * timebase.numer / timebase.denom;
+    return std::chrono::milliseconds{static_cast<qint64>(nanoseconds / 1000000)};
+#else
+    timespec now{};
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+    return std::chrono::seconds{now.tv_sec} +
+        std::chrono::milliseconds{now.tv_nsec / 1000000};
+#endif
+}
+
+TimerService &TimerService::current()
+{
+    thread_local TimerService service;
+    return service;
+}
+
+TimerService::TimerService()
+    : _lastCheckUnbiased{unbiasedNow()},
+      _lastCheckWallMs{QDateTime::currentMSecsSinceEpoch()},
+      _staggerUntil{0}
+{
+    _staggerTimer.setInterval(msec32(staggerInterval));
+    connect(&_staggerTimer, &QTimer::timeout, this, &TimerService::deliverNext);
+
+    _resumeCheckTimer.setTimerType(Qt::TimerType::VeryCoarseTimer);
+    _resumeCheckTimer.setInterval(msec32(resumeCheckInterval));
+    connect(&_resumeCheckTimer, &QTimer::timeout, this, &TimerService::checkResume);
+    _resumeCheckTimer.start();
+}
+
+void TimerService::checkResume()
+{
+    std::chrono::milliseconds nowUnbiased = unbiasedNow();
+    qint64 nowWallMs = QDateTime::currentMSecsSinceEpoch();
+
+    std::chrono::milliseconds suspended{(nowWallMs - _lastCheckWallMs) -
+                                        (nowUnbiased - _lastCheckUnbiased).count()};
+    _lastCheckUnbiased = nowUnbiased;
+    _lastCheckWallMs = nowWallMs;
+
+    if(suspended >= minSuspendTime)
+    {
+        qInfo() << "System resumed after about" << traceMsec(suspended)
+            << "- staggering timers for" << traceMsec(staggerDuration);
+        _staggerUntil = nowUnbiased + staggerDuration;
+        emit resumed(suspended);
+    }
+}
+
+void TimerService::queueTimeout(ServiceTimer &timer)
+{
+    checkResume();
+
+    // An interval timer can elapse again while its last timeout is still
+    // waiting; it's only delivered once.
+    if(timer._timeoutQueued)
+        return;
+
+    // Deliver now unless we're staggering.  If earlier timeouts are still
+    // waiting, this one waits too, so they're delivered in order.
+    if(_staggered.empty() && unbiasedNow() >= _staggerUntil)
+    {
+        timer.deliverTimeout();
+        return;
+    }
+
+    timer._timeoutQueued = true;
+    _staggered.push_back(&timer);
+    if(!_staggerTimer.isActive())
+    {
+        // Deliver the first one now, it's not competing with anything yet
+        deliverNext();
+        if(!_staggered.empty())
+            _staggerTimer.start();
+    }
+}
+
+void TimerService::deliverNext()
+{
+    // Skip timers that were stopped or destroyed while waiting
+    while(!_staggered.empty())
+    {
+        QPointer<ServiceTimer> pTimer = _staggered.front();
+        _staggered.pop_front();
+        if(pTimer && pTimer->_timeoutQueued)
+        {
+            pTimer->deliverTimeout();
+            break;
+        }
+    }
+
+    if(_staggered.empty())
+        _staggerTimer.stop();
+}
+
+ServiceTimer::ServiceTimer(QObject *pParent)
+    : QObject{pParent}, _singleShot{false}, _active{false},
+      _timeoutQueued{false}, _interval{0}, _deadline{0}, _timer{this}
+{
+    _timer.setSingleShot(true);
+    _timer.setTimerType(Qt::TimerType::CoarseTimer);
+    connect(&_timer, &QTimer::timeout, this, &ServiceTimer::onTimerElapsed);
+    // Make sure the thread's TimerService exists, so it's watching for resumes
+    TimerService::current();
+}
+
+void ServiceTimer::setInterval(std::chrono::milliseconds interval)
+{
+    _interval = interval;
+    // Like QTimer, changing the interval of a running timer restarts it
+    if(_active)
+        start();
+}
+
+int ServiceTimer::interval() const
+{
+    return msec32(_interval);
+}
+
+void ServiceTimer::start()
+{
+    _active = true;
+    _timeoutQueued = false;
+    _deadline = TimerService::unbiasedNow() + _interval;
+    armTimer();
+}
+
+void ServiceTimer::start(std::chrono::milliseconds interval)
+{
+    _interval = interval;
+    start();
+}
+
+void ServiceTimer::stop()
+{
+    _active = false;
+    _timeoutQueued = false;
+    _timer.stop();
+}
+
+void ServiceTimer::armTimer()
+{
+    std::chrono::milliseconds remaining = _deadline - TimerService::unbiasedNow();
+    if(remaining < std::chrono::milliseconds::zero())
+        remaining = std::chrono::milliseconds::zero();
+    _timer.start(msec32(remaining));
+}
+
+void ServiceTimer::onTimerElapsed()
+{
+    // If the system was suspended, the internal timer may have counted the
+    // suspended time; wait for the rest of the unbiased interval.
+    if(TimerService::unbiasedNow() + deadlineTolerance < _deadline)
+    {
+        armTimer();
+        return;
+    }
+
+    // Schedule the next interval now (from the deadline, so intervals don't
+    // drift by the time spent waiting for a stagger slot).  If we fell far
+    // behind, don't try to catch up.
+    if(!_singleShot)
+    {
+        _deadline += _interval;
+        auto now = TimerService::unbiasedNow();
+        if(_deadline <= now)
+            _deadline = now + _interval;
+        armTimer();
+    }
+
+    TimerService::current().queueTimeout(*this);
+}
+
+void ServiceTimer::deliverTimeout()
+{
+    if(!_active)
+        return;
+    _timeoutQueued = false;
+    if(_singleShot)
+        _active = false;
+    emit timeout();
+}
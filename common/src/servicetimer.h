@@ -0,0 +1,145 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("servicetimer.h")
+
+#ifndef SERVICETIMER_H
+#define SERVICETIMER_H
+
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+#include <chrono>
+#include <deque>
+
+class ServiceTimer;
+
+// TimerService is the shared part of ServiceTimer; there's one for each thread
+// that uses ServiceTimers (in practice, the daemon's main thread).
+//
+// It detects system resumes by comparing the unbiased clock to the wall clock
+// (see unbiasedNow()), and for a while after a resume, it staggers the
+// ServiceTimer timeouts that are due, so the background work that became due
+// while suspended doesn't all start right at wake.
+class COMMON_EXPORT TimerService : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("timerservice");
+
+public:
+    // Time since an arbitrary epoch that doesn't advance while the system is
+    // suspended, on every platform:
+    // - Windows: QueryUnbiasedInterruptTime()
+    // - macOS: mach_absolute_time()
+    // - Linux: CLOCK_MONOTONIC
+    static std::chrono::milliseconds unbiasedNow();
+
+    // Get the TimerService for the current thread
+    static TimerService &current();
+
+private:
+    TimerService();
+
+public:
+    // Deliver a timeout for a ServiceTimer - now, or after a stagger delay if
+    // the system resumed recently.  The timer is called back with
+    // deliverTimeout() unless it's stopped or destroyed before then.
+    void queueTimeout(ServiceTimer &timer);
+
+signals:
+    // The system resumed after being suspended for about 'suspended'
+    void resumed(std::chrono::milliseconds suspended);
+
+private:
+    // Check whether a suspend has occurred since the last check
+    void checkResume();
+    void deliverNext();
+
+private:
+    // Unbiased and wall clock times of the last check
+    std::chrono::milliseconds _lastCheckUnbiased;
+    qint64 _lastCheckWallMs;
+    // Timeouts are staggered until this unbiased time
+    std::chrono::milliseconds _staggerUntil;
+    // Timers waiting for a stagger slot, and the timer delivering them
+    std::deque<QPointer<ServiceTimer>> _staggered;
+    QTimer _staggerTimer;
+    // Checks for resumes periodically even if no ServiceTimer is due
+    QTimer _resumeCheckTimer;
+};
+
+// ServiceTimer is a single-shot or interval timer for the daemon's periodic
+// background work - refreshing data, measuring latency, writing files.  It's
+// used like a QTimer, but:
+//
+// - Its interval is measured with TimerService::unbiasedNow(), so time spent
+//   suspended doesn't count on any platform.  (QTimer counts it on some
+//   platforms, which makes every timer that elapsed while suspended fire at
+//   wake.)
+// - It's a coarse timer, so the OS can coalesce its wakeups with other timers.
+// - Shortly after a resume, its timeouts are staggered by TimerService.
+//
+// Like QTimer, it belongs to the thread that creates it.
+class COMMON_EXPORT ServiceTimer : public QObject
+{
+    Q_OBJECT
+    friend class TimerService;
+
+public:
+    ServiceTimer(QObject *pParent = nullptr);
+
+public:
+    void setSingleShot(bool singleShot) {_singleShot = singleShot;}
+    bool isSingleShot() const {return _singleShot;}
+    void setInterval(std::chrono::milliseconds interval);
+    void setInterval(int msec) {setInterval(std::chrono::milliseconds{msec});}
+    int interval() const;
+    // Whether the timer is running (including while a staggered timeout is
+    // waiting to be delivered)
+    bool isActive() const {return _active;}
+
+    // Start or restart the timer (with a new interval in the overloads taking
+    // one)
+    void start();
+    void start(std::chrono::milliseconds interval);
+    void start(int msec) {start(std::chrono::milliseconds{msec});}
+    void stop();
+
+signals:
+    void timeout();
+
+private:
+    // Set _timer for the unbiased time remaining until _deadline
+    void armTimer();
+    void onTimerElapsed();
+    // Called by TimerService to deliver a queued timeout
+    void deliverTimeout();
+
+private:
+    bool _singleShot;
+    bool _active;
+    // Set while a timeout is queued with TimerService
+    bool _timeoutQueued;
+    std::chrono::milliseconds _interval;
+    // Unbiased time when the current interval elapses
+    std::chrono::milliseconds _deadline;
+    // Child of this object, so it follows it in moveToThread()
+    QTimer _timer;
+};
+
+#endif
@@ -24,7 +24,26 @@
 #include <QJsonDocument>
 #include <QRegularExpression>
 #include <QSharedPointer>
+#include <cmath>
 #include <iterator>
+#include <limits>
+
+namespace
+{
+    // WeightedLocationRanking - weight of the jitter added to the latency, and
+    // the score multipliers for a location with 100% loss / connection failure
+    const double rankingJitterWeight{2.0};
+    const double rankingLossPenalty{4.0};
+    const double rankingFailurePenalty{1.0};
+    // Largest discount for throughput (given to the location with the best
+    // throughput)
+    const double rankingThroughputDiscount{0.2};
+
+    // A new best location must be better than the previous one by both of
+    // these margins to replace it
+    const double bestLocationRelativeMargin{0.1};
+    const double bestLocationAbsoluteMargin{5.0};
+}
 
 QString ServerLocation::addressHost(const QString &address)
 {
@@ -47,6 +66,183 @@ quint16 ServerLocation::addressPort(const QString &address)
     return 0;
 }
 
+const QJsonObject &ServerLocation::cachedJson() const
+{
+    if(_cachedRevision != revision())
+    {
+        _cachedJson = toJsonObject();
+        _cachedRevision = revision();
+    }
+    return _cachedJson;
+}
+
+bool json_cast(const ServerLocation &from, QJsonValue &to)
+{
+    to = from.cachedJson();
+    return true;
+}
+
+namespace
+{
+    // Keys used by the columnar location encodings.  No region ID starts with
+    // '$', so an encoded locations map can't be mistaken for a real one.
+    const QString &columnsKey()
+    {
+        static const QString key{QStringLiteral("$columns")};
+        return key;
+    }
+    const QString &countKey()
+    {
+        static const QString key{QStringLiteral("count")};
+        return key;
+    }
+    const QString &groupSizesKey()
+    {
+        static const QString key{QStringLiteral("groupSizes")};
+        return key;
+    }
+
+    // Encode an array of location objects as columns.  All locations must
+    // have the same fields (this is always true for ServerLocation's JSON,
+    // which includes every field).
+    QJsonObject encodeColumns(const QJsonArray &locations)
+    {
+        QStringList keys;
+        if(!locations.isEmpty())
+            keys = locations.first().toObject().keys();
+
+        QVector<QJsonArray> columns;
+        columns.resize(keys.size());
+        for(const auto &location : locations)
+        {
+            if(!location.isObject())
+                return {};
+            const QJsonObject &locationObj = location.toObject();
+            if(locationObj.size() != keys.size())
+                return {};
+            for(int i=0; i<keys.size(); ++i)
+            {
+                auto itValue = locationObj.find(keys[i]);
+                if(itValue == locationObj.end())
+                    return {};
+                columns[i].append(itValue.value());
+            }
+        }
+
+        QJsonObject columnsObj;
+        for(int i=0; i<keys.size(); ++i)
+            columnsObj.insert(keys[i], columns[i]);
+        return {{columnsKey(), columnsObj}, {countKey(), locations.size()}};
+    }
+
+    bool decodeColumns(const QJsonObject &encoded, QJsonArray &locations)
+    {
+        const QJsonObject &columnsObj = encoded.value(columnsKey()).toObject();
+        int count = encoded.value(countKey()).toInt(-1);
+        if(count < 0)
+            return false;
+
+        QVector<QJsonObject> rows;
+        rows.resize(count);
+        for(auto itColumn = columnsObj.begin(); itColumn != columnsObj.end(); ++itColumn)
+        {
+            const QJsonArray &column = itColumn.value().toArray();
+            if(column.size() != count)
+                return false;
+            for(int i=0; i<count; ++i)
+                rows[i].insert(itColumn.key(), column[i]);
+        }
+
+        locations = {};
+        for(const auto &row : rows)
+            locations.append(row);
+        return true;
+    }
+}
+
+QJsonObject encodeLocationsColumns(const QJsonObject &locations)
+{
+    // The map keys aren't sent, they're the same as the regions' IDs
+    QJsonArray rows;
+    for(auto itLocation = locations.begin(); itLocation != locations.end(); ++itLocation)
+    {
+        if(itLocation.value().toObject().value(QStringLiteral("id")).toString() != itLocation.key())
+            return {};
+        rows.append(itLocation.value());
+    }
+    return encodeColumns(rows);
+}
+
+bool decodeLocationsColumns(const QJsonObject &encoded, QJsonObject &locations)
+{
+    QJsonArray rows;
+    if(!decodeColumns(encoded, rows))
+        return false;
+    locations = {};
+    for(const auto &row : rows)
+    {
+        const QJsonObject &rowObj = row.toObject();
+        locations.insert(rowObj.value(QStringLiteral("id")).toString(), rowObj);
+    }
+    return true;
+}
+
+QJsonObject encodeGroupedLocationsColumns(const QJsonArray &groupedLocations)
+{
+    // The countries' locations are concatenated; the group sizes split them up
+    // again
+    QJsonArray rows, groupSizes;
+    for(const auto &country : groupedLocations)
+    {
+        const QJsonObject &countryObj = country.toObject();
+        auto itLocations = countryObj.find(QStringLiteral("locations"));
+        if(countryObj.size() != 1 || itLocations == countryObj.end() ||
+           !itLocations.value().isArray())
+        {
+            return {};
+        }
+        const QJsonArray &countryLocations = itLocations.value().toArray();
+        for(const auto &location : countryLocations)
+            rows.append(location);
+        groupSizes.append(countryLocations.size());
+    }
+
+    QJsonObject encoded = encodeColumns(rows);
+    if(!encoded.isEmpty())
+        encoded.insert(groupSizesKey(), groupSizes);
+    return encoded;
+}
+
+bool decodeGroupedLocationsColumns(const QJsonObject &encoded, QJsonArray &groupedLocations)
+{
+    QJsonArray rows;
+    if(!decodeColumns(encoded, rows))
+        return false;
+
+    QJsonArray decoded;
+    int next = 0;
+    for(const auto &groupSize : encoded.value(groupSizesKey()).toArray())
+    {
+        int size = groupSize.toInt(-1);
+        if(size < 0 || size > rows.size() - next)
+            return false;
+        QJsonArray countryLocations;
+        for(int i=0; i<size; ++i)
+            countryLocations.append(rows[next+i]);
+        next += size;
+        decoded.append(QJsonObject{{QStringLiteral("locations"), countryLocations}});
+    }
+    if(next != rows.size())
+        return false;
+    groupedLocations = decoded;
+    return true;
+}
+
+bool isLocationColumns(const QJsonValue &value)
+{
+    return value.isObject() && value.toObject().value(columnsKey()).isObject();
+}
+
 void Transport::resolvePort(const ServerLocation &location)
 {
     if(port() != 0)
@@ -78,6 +274,8 @@ SplitTunnelRule::SplitTunnelRule()
 
 }
 
+const std::array<quint64, 7> ConnectionPhase::histogramBounds{{100, 250, 500, 1000, 2500, 5000, 10000}};
+
 DaemonSettings::DaemonSettings()
     : NativeJsonObject(SaveUnknownProperties)
 {
@@ -147,7 +345,11 @@ const QStringList DaemonSettings::defaultDebugLogging
     QStringLiteral("*.debug=true"),
     QStringLiteral("qt*.debug=false"),
     QStringLiteral("latency.*=false"),
-    QStringLiteral("qt.scenegraph.general*=true")
+    QStringLiteral("qt.scenegraph.general*=true"),
+    // Bound the noisiest categories (messages per second)
+    QStringLiteral("openvpn.stdout.ratelimit=50"),
+    QStringLiteral("iptables.stdout.ratelimit=50"),
+    QStringLiteral("ProcTracker.ratelimit=20")
 };
 
 QJsonValue DaemonSettings::getDefaultDebugLogging()
@@ -191,11 +393,42 @@ bool DaemonSettings::validateDNSSetting(const DaemonSettings::DNSSetting& settin
 
 #if defined(PIA_DAEMON) || defined(UNIT_TEST)
 
+namespace
+{
+    // Strings like the country codes repeat across hundreds of regions, but
+    // each one read from the JSON is a separate allocation.  StringPool hands
+    // out one shared (implicitly shared) QString for each distinct value.
+    class StringPool
+    {
+    public:
+        QString intern(const QString &value)
+        {
+            auto itValue = _strings.constFind(value);
+            if(itValue != _strings.constEnd())
+                return *itValue;
+            _strings.insert(value);
+            return value;
+        }
+
+    private:
+        QSet<QString> _strings;
+    };
+}
+
 ServerLocations updateServerLocations(const ServerLocations &existingLocations,
                                       const QJsonObject &serversObj)
 {
     ServerLocations newLocations;
 
+    // Seed the pool with the existing values, so new locations share strings
+    // with the unchanged locations that reuseUnchangedLocations() keeps
+    StringPool strings;
+    for(const auto &pExisting : existingLocations)
+    {
+        if(pExisting)
+            strings.intern(pExisting->country());
+    }
+
     // The safe regions to be used with 'connect auto'
     QVector<QString> safeAutoRegions{};
     try
@@ -255,7 +488,7 @@ ServerLocations updateServerLocations(const ServerLocations &existingLocations,
             //since they're stored as attributes of an object, not an array.
             pLocation->id(itAttr.key());
             pLocation->name(JsonCaster{serverObj.value(QStringLiteral("name"))});
-            pLocation->country(JsonCaster{serverObj.value(QStringLiteral("country"))});
+            pLocation->country(strings.intern(JsonCaster{serverObj.value(QStringLiteral("country"))}));
             pLocation->dns(JsonCaster{serverObj.value(QStringLiteral("dns"))});
             pLocation->portForward(JsonCaster{serverObj.value(QStringLiteral("port_forward"))});
             //The UDP and TCP connection addresses are objects in the source data,
@@ -313,6 +546,8 @@ ServerLocations updateShadowsocksLocations(const ServerLocations &existingLocati
         }
     }
 
+    // The Shadowsocks keys and ciphers are usually the same for all regions
+    StringPool strings;
     for(auto itAttr = shadowsocksObj.begin(); itAttr != shadowsocksObj.end(); ++itAttr)
     {
         // Do we have this region's data from the servers list?  We can't use
@@ -334,8 +569,8 @@ ServerLocations updateShadowsocksLocations(const ServerLocations &existingLocati
             QSharedPointer<ShadowsocksServer> pSsServer{new ShadowsocksServer{}};
             pSsServer->host(JsonCaster{ssRgnObj.value(QStringLiteral("host"))});
             pSsServer->port(JsonCaster{ssRgnObj.value(QStringLiteral("port"))});
-            pSsServer->key(JsonCaster{ssRgnObj.value(QStringLiteral("key"))});
-            pSsServer->cipher(JsonCaster{ssRgnObj.value(QStringLiteral("cipher"))});
+            pSsServer->key(strings.intern(JsonCaster{ssRgnObj.value(QStringLiteral("key"))}));
+            pSsServer->cipher(strings.intern(JsonCaster{ssRgnObj.value(QStringLiteral("cipher"))}));
 
             // Apply the new ShadowsocksServer; we can mutate this
             // ServerLocation because it's one that we just created above.
@@ -351,104 +586,319 @@ ServerLocations updateShadowsocksLocations(const ServerLocations &existingLocati
     return newLocations;
 }
 
-// Compare two locations or countries to sort them.
-// Sorts by latencies first, then country codes, then by IDs.
-// The "tiebreaking" fields (country codes / IDs) are fixed to ensure that we
-// sort regions the same way in all contexts.
-bool compareEntries(const ServerLocation &first, const ServerLocation &second)
-{
-    const Optional<double> &firstLatency = first.latency();
-    const Optional<double> &secondLatency = second.latency();
-    // Unknown latencies sort last
-    if(firstLatency && !secondLatency)
-        return true;    // *this < other
-    if(!firstLatency && secondLatency)
-        return false;   // *this > other
-
-    // If the latencies are known and different, compare them
-    if(firstLatency && firstLatency.get() != secondLatency.get())
-        return firstLatency.get() < secondLatency.get();
-
-    // Otherwise, the latencies are equivalent (both known and
-    // equal, or both unknown and unequal)
-    // Compare country codes.
-    auto countryComparison = first.country().compare(second.country(),
-                                                     Qt::CaseSensitivity::CaseInsensitive);
-    if(countryComparison != 0)
-        return countryComparison < 0;
+int reuseUnchangedLocations(const ServerLocations &existingLocations,
+                            ServerLocations &newLocations, bool *pPingChanged)
+{
+    int changedCount = 0;
+    bool pingChanged = false;
 
-    // Same latency and country, compare IDs.
-    return first.id().compare(second.id(), Qt::CaseSensitivity::CaseInsensitive) < 0;
+    for(auto itNew = newLocations.begin(); itNew != newLocations.end(); ++itNew)
+    {
+        const auto &pExisting = existingLocations.value(itNew.key());
+        if(!pExisting || !*itNew)
+        {
+            ++changedCount;
+            pingChanged = true;
+        }
+        else if(**itNew == *pExisting)
+        {
+            // Unchanged, keep the existing object
+            *itNew = pExisting;
+        }
+        else
+        {
+            ++changedCount;
+            if((*itNew)->ping() != pExisting->ping())
+                pingChanged = true;
+        }
+    }
+
+    // Count the locations that were removed
+    for(auto itExisting = existingLocations.begin(); itExisting != existingLocations.end(); ++itExisting)
+    {
+        if(!newLocations.contains(itExisting.key()))
+        {
+            ++changedCount;
+            pingChanged = true;
+        }
+    }
+
+    if(pPingChanged)
+        *pPingChanged = pingChanged;
+    return changedCount;
 }
 
 QVector<CountryLocations> buildGroupedLocations(const ServerLocations &locations)
 {
-    // Group the locations by country
-    QHash<QString, QVector<QSharedPointer<ServerLocation>>> countryGroups;
+    return NearestLocations{locations}.buildGroupedLocations();
+}
+
+LocationsMemoryStats measureLocationsMemory(const ServerLocations &locations)
+{
+    LocationsMemoryStats stats{locations.size(), 0, 0, 0};
+    // Shared strings are identified by their data pointer
+    QSet<const QChar*> counted;
+    QSet<const ShadowsocksServer*> countedShadowsocks;
+    auto countString = [&](const QString &value)
+    {
+        qint64 bytes = value.capacity() * static_cast<qint64>(sizeof(QChar));
+        stats.stringBytes += bytes;
+        if(!value.isEmpty() && !counted.contains(value.constData()))
+        {
+            counted.insert(value.constData());
+            stats.sharedBytes += bytes;
+        }
+    };
 
     for(const auto &pLocation : locations)
     {
-        Q_ASSERT(pLocation);
-        countryGroups[pLocation->country().toLower()].push_back(pLocation);
+        if(!pLocation)
+            continue;
+        stats.objectBytes += sizeof(ServerLocation);
+        countString(pLocation->id());
+        countString(pLocation->name());
+        countString(pLocation->country());
+        countString(pLocation->dns());
+        countString(pLocation->openvpnUDP());
+        countString(pLocation->openvpnTCP());
+        countString(pLocation->ping());
+        countString(pLocation->serial());
+        countString(pLocation->latencyMethod());
+        // Shadowsocks servers are shared objects too
+        const auto &pShadowsocks = pLocation->shadowsocks();
+        if(pShadowsocks && !countedShadowsocks.contains(pShadowsocks.data()))
+        {
+            countedShadowsocks.insert(pShadowsocks.data());
+            stats.objectBytes += sizeof(ShadowsocksServer);
+            countString(pShadowsocks->host());
+            countString(pShadowsocks->key());
+            countString(pShadowsocks->cipher());
+        }
     }
+    return stats;
+}
 
-    // Sort each countries' locations by latency, then id
-    for(auto &group : countryGroups)
-    {
-        std::sort(group.begin(), group.end(),
-            [](const auto &pFirst, const auto &pSecond)
-            {
-                Q_ASSERT(pFirst);
-                Q_ASSERT(pSecond);
+double LocationRanking::score(const ServerLocation &location) const
+{
+    if(!location.latency())
+        return std::numeric_limits<double>::infinity();
+    return location.latency().get();
+}
 
-                return compareEntries(*pFirst, *pSecond);
-            });
+WeightedLocationRanking::WeightedLocationRanking(DaemonData::LocationHistoryMap history)
+    : _history{std::move(history)}, _maxThroughput{0.0}
+{
+    for(const auto &locationHistory : _history)
+    {
+        if(locationHistory.throughput())
+            _maxThroughput = std::max(_maxThroughput, locationHistory.throughput().get());
     }
+}
+
+double WeightedLocationRanking::score(const ServerLocation &location) const
+{
+    double score = LocationRanking::score(location);
+    if(!std::isfinite(score))
+        return score;
 
-    // Create country groups from the sorted lists
-    QVector<CountryLocations> countries;
-    countries.reserve(countryGroups.size());
-    for(const auto &group : countryGroups)
+    if(location.jitter())
+        score += rankingJitterWeight * location.jitter().get();
+    if(location.loss())
+        score *= 1.0 + rankingLossPenalty * location.loss().get();
+
+    auto itHistory = _history.find(location.id());
+    if(itHistory != _history.end())
     {
-        countries.push_back({});
-        countries.last().locations(group);
+        if(itHistory->connectSuccess())
+            score *= 1.0 + rankingFailurePenalty * (1.0 - itHistory->connectSuccess().get());
+        if(itHistory->throughput() && _maxThroughput > 0.0)
+        {
+            score *= 1.0 - rankingThroughputDiscount *
+                itHistory->throughput().get() / _maxThroughput;
+        }
     }
+    return score;
+}
 
-    // Sort the countries by their lowest latency
-    std::sort(countries.begin(), countries.end(),
-        [](const auto &first, const auto &second)
-        {
-            // Consequence of above; countries created with at least 1 location
-            Q_ASSERT(!first.locations().isEmpty());
-            Q_ASSERT(!second.locations().isEmpty());
-            // Sort by the lowest latency for each country, then country code if
-            // the latencies are the same
-            const auto &pFirstNearest = first.locations().first();
-            const auto &pSecondNearest = second.locations().first();
-
-            Q_ASSERT(pFirstNearest);
-            Q_ASSERT(pSecondNearest);
-            return compareEntries(*pFirstNearest, *pSecondNearest);
-        });
+bool NearestLocations::ScoreOrder::operator()(const Entry &first,
+                                              const Entry &second) const
+{
+    Q_ASSERT(first.pLocation);
+    Q_ASSERT(second.pLocation);
+
+    // Unscored locations (infinite scores) compare equal to each other here,
+    // and sort last
+    if(first.score != second.score)
+        return first.score < second.score;
+
+    // Otherwise, compare country codes, then IDs.  The tiebreaking fields are
+    // fixed to ensure that we sort regions the same way in all contexts.
+    auto countryComparison = first.pLocation->country().compare(second.pLocation->country(),
+                                                                Qt::CaseSensitivity::CaseInsensitive);
+    if(countryComparison != 0)
+        return countryComparison < 0;
+    return first.pLocation->id().compare(second.pLocation->id(),
+                                         Qt::CaseSensitivity::CaseInsensitive) < 0;
+}
 
-    return countries;
+NearestLocations::NearestLocations()
+    : _pRanking{std::make_shared<LocationRanking>()}, _groupsBuilt{false}
+{
 }
 
 NearestLocations::NearestLocations(const ServerLocations &allLocations)
+    : NearestLocations{}
+{
+    reset(allLocations);
+}
+
+void NearestLocations::reset(const ServerLocations &allLocations)
+{
+    _locations.clear();
+    _scores.clear();
+    // Countries that no longer have any locations are dropped, so all groups
+    // are built again
+    _countries.clear();
+    _changedCountries.clear();
+    _groupsBuilt = false;
+    for(const auto &pLocation : allLocations)
+    {
+        Q_ASSERT(pLocation);
+        insert(pLocation);
+    }
+}
+
+void NearestLocations::setRanking(std::shared_ptr<const LocationRanking> pRanking)
+{
+    Q_ASSERT(pRanking);
+    _pRanking = std::move(pRanking);
+
+    LocationIndex oldLocations;
+    oldLocations.swap(_locations);
+    _scores.clear();
+    // Every location is rescored, which can reorder any country
+    for(auto &country : _countries)
+        country.locations.clear();
+    for(const auto &entry : oldLocations)
+        insert(entry.pLocation);
+}
+
+double NearestLocations::score(const ServerLocation &location) const
+{
+    return _pRanking->score(location);
+}
+
+auto NearestLocations::find(const QSharedPointer<ServerLocation> &pLocation)
+    -> LocationIndex::iterator
+{
+    auto itScore = _scores.find(pLocation.get());
+    if(itScore == _scores.end())
+        return _locations.end();
+    auto range = _locations.equal_range({*itScore, pLocation});
+    auto itLocation = std::find_if(range.first, range.second,
+        [&](const Entry &entry){return entry.pLocation == pLocation;});
+    return itLocation == range.second ? _locations.end() : itLocation;
+}
+
+auto NearestLocations::findId(const QString &id) const -> const Entry *
+{
+    auto itLocation = std::find_if(_locations.begin(), _locations.end(),
+        [&](const Entry &entry){return entry.pLocation->id() == id;});
+    return itLocation == _locations.end() ? nullptr : &*itLocation;
+}
+
+void NearestLocations::insert(const QSharedPointer<ServerLocation> &pLocation)
+{
+    double locationScore = score(*pLocation);
+    _locations.insert({locationScore, pLocation});
+    _scores.insert(pLocation.get(), locationScore);
+
+    const QString &countryKey = pLocation->country().toLower();
+    _countries[countryKey].locations.insert({locationScore, pLocation});
+    _changedCountries.insert(countryKey);
+}
+
+void NearestLocations::erase(LocationIndex::iterator itLocation)
+{
+    const Entry entry = *itLocation;
+    _locations.erase(itLocation);
+    _scores.remove(entry.pLocation.get());
+
+    const QString &countryKey = entry.pLocation->country().toLower();
+    auto itCountry = _countries.find(countryKey);
+    if(itCountry == _countries.end())
+        return;
+    LocationIndex &countryLocations = itCountry->locations;
+    auto range = countryLocations.equal_range(entry);
+    auto itCountryLocation = std::find_if(range.first, range.second,
+        [&](const Entry &countryEntry){return countryEntry.pLocation == entry.pLocation;});
+    if(itCountryLocation != range.second)
+        countryLocations.erase(itCountryLocation);
+    if(countryLocations.empty())
+        _countries.erase(itCountry);
+    _changedCountries.insert(countryKey);
+}
+
+void NearestLocations::updateLatency(const QSharedPointer<ServerLocation> &pLocation,
+                                     double latency)
+{
+    Q_ASSERT(pLocation);
+
+    // Remove the location while it's still in its current position, then put
+    // it back in its new position
+    auto itLocation = find(pLocation);
+    bool indexed = itLocation != _locations.end();
+    if(indexed)
+        erase(itLocation);
+    pLocation->latency(latency);
+    if(indexed)
+        insert(pLocation);
+}
+
+QVector<CountryLocations> NearestLocations::buildGroupedLocations()
 {
-    _locations.reserve(allLocations.size());
-    std::copy(allLocations.begin(), allLocations.end(),
-              std::back_inserter(_locations));
-    std::sort(_locations.begin(), _locations.end(),
-                   [](const auto &pFirst, const auto &pSecond) {
-                       Q_ASSERT(pFirst);
-                       Q_ASSERT(pSecond);
+    if(_groupsBuilt && _changedCountries.isEmpty())
+        return _groupedLocations;
+
+    // Each country's locations are already in order; rebuild the groups for
+    // the countries that changed.  (A country that's no longer present has
+    // nothing to rebuild.)
+    for(const auto &countryKey : _changedCountries)
+    {
+        auto itCountry = _countries.find(countryKey);
+        if(itCountry == _countries.end())
+            continue;
+        QVector<QSharedPointer<ServerLocation>> locations;
+        locations.reserve(static_cast<int>(itCountry->locations.size()));
+        for(const auto &entry : itCountry->locations)
+            locations.push_back(entry.pLocation);
+        itCountry->grouped.locations(locations);
+    }
+    _changedCountries.clear();
+
+    // The countries are ordered by their nearest location, which is the first
+    // location in each group.  There are far fewer countries than locations,
+    // so just sort them again.
+    QVector<const CountryGroup*> countries;
+    countries.reserve(_countries.size());
+    for(const auto &country : _countries)
+        countries.push_back(&country);
+    std::sort(countries.begin(), countries.end(),
+        [](const CountryGroup *pFirst, const CountryGroup *pSecond)
+        {
+            return ScoreOrder{}(*pFirst->locations.begin(), *pSecond->locations.begin());
+        });
 
-                       return compareEntries(*pFirst, *pSecond);
-                   });
+    _groupedLocations.clear();
+    _groupedLocations.reserve(countries.size());
+    for(const auto &pCountry : countries)
+        _groupedLocations.push_back(pCountry->grouped);
+    _groupsBuilt = true;
+    return _groupedLocations;
 }
 
-QSharedPointer<ServerLocation> NearestLocations::getNearestSafeVpnLocation(bool portForward) const
+QSharedPointer<ServerLocation> NearestLocations::getNearestSafeVpnLocation(bool portForward,
+                                                                           const QSharedPointer<ServerLocation> &pPrevious) const
 {
     if(_locations.empty())
     {
@@ -456,27 +906,55 @@ QSharedPointer<ServerLocation> NearestLocations::getNearestSafeVpnLocation(bool
         return {};
     }
 
+    const Entry *pResult = nullptr;
     // If port forwarding is on, then find fastest server that supports port forwarding
     if(portForward)
     {
         auto result = std::find_if(_locations.begin(), _locations.end(),
-            [](const auto &location)
+            [](const Entry &entry)
             {
-                return location->portForward() && location->isSafeForAutoConnect();
+                return entry.pLocation->portForward() && entry.pLocation->isSafeForAutoConnect();
             });
         if(result != _locations.end())
-            return *result;
+            pResult = &*result;
     }
 
     // otherwise just find the fastest 'safe' server
-    auto result = std::find_if(_locations.begin(), _locations.end(),
-        [](const auto &location) {return location->isSafeForAutoConnect();});
-    if(result != _locations.end())
-        return *result;
+    if(!pResult)
+    {
+        auto result = std::find_if(_locations.begin(), _locations.end(),
+            [](const Entry &entry) {return entry.pLocation->isSafeForAutoConnect();});
+        if(result != _locations.end())
+            pResult = &*result;
+    }
+
+    if(!pResult)
+    {
+        // We fall-back to the fastest region since we could not find a region meeting the above constraints
+        qWarning() << "Unable to find closest server location meeting constraints, falling back to fastest region";
+        pResult = &*_locations.begin();
+    }
+
+    // Keep the previous location if it's still present, meets the same
+    // constraints as the new result, and the new result isn't much better
+    if(pPrevious && pPrevious->id() != pResult->pLocation->id())
+    {
+        const Entry *pPreviousEntry = findId(pPrevious->id());
+        if(pPreviousEntry &&
+           (pPreviousEntry->pLocation->isSafeForAutoConnect() || !pResult->pLocation->isSafeForAutoConnect()) &&
+           (!portForward || pPreviousEntry->pLocation->portForward() || !pResult->pLocation->portForward()) &&
+           std::isfinite(pPreviousEntry->score))
+        {
+            double improvement = pPreviousEntry->score - pResult->score;
+            if(improvement < bestLocationAbsoluteMargin ||
+               improvement < pPreviousEntry->score * bestLocationRelativeMargin)
+            {
+                return pPreviousEntry->pLocation;
+            }
+        }
+    }
 
-    // We fall-back to the fastest region since we could not find a region meeting the above constraints
-    qWarning() << "Unable to find closest server location meeting constraints, falling back to fastest region";
-    return _locations.front();
+    return pResult->pLocation;
 }
 
 bool isDNSHandshake(const DaemonSettings::DNSSetting &setting)
@@ -485,6 +963,7 @@ bool isDNSHandshake(const DaemonSettings::DNSSetting &setting)
 }
 
 const QString hnsdLocalAddress{QStringLiteral("127.80.73.65")};
+const QString dnsCacheLocalAddress{QStringLiteral("127.80.73.67")};
 
 QStringList getDNSServers(const DaemonSettings::DNSSetting& setting)
 {
@@ -25,6 +25,9 @@
 
 #include "json.h"
 #include <QVector>
+#include <array>
+#include <memory>
+#include <set>
 
 // ShadowsocksServer describes a Shadowsocks endpoint in a location as obtained
 // from the Shadowsocks server list.
@@ -86,6 +89,9 @@ public:
         isSafeForAutoConnect(other.isSafeForAutoConnect());
         shadowsocks(other.shadowsocks());   // Share the object since it is not mutated
         latency(other.latency());
+        loss(other.loss());
+        jitter(other.jitter());
+        latencyMethod(other.latencyMethod());
     }
 
     bool operator==(const ServerLocation &other)
@@ -111,7 +117,9 @@ public:
             openvpnTCP() == other.openvpnTCP() && ping() == other.ping() &&
             serial() == other.serial() &&
             isSafeForAutoConnect() == other.isSafeForAutoConnect() &&
-            latency() == other.latency();
+            latency() == other.latency() && loss() == other.loss() &&
+            jitter() == other.jitter() &&
+            latencyMethod() == other.latencyMethod();
     }
 
     // Region ID - matches the key in ServerLocations.  This is provided by all
@@ -144,6 +152,16 @@ public:
     JsonField(QSharedPointer<ShadowsocksServer>, shadowsocks, {})
     // Latency measured by the daemon
     JsonField(Optional<double>, latency, {})
+    // Fraction of latency probes lost (0-1), measured by the daemon along with
+    // the latency
+    JsonField(Optional<double>, loss, {})
+    // Variation in the latency between measurements (ms), measured by the
+    // daemon along with the latency
+    JsonField(Optional<double>, jitter, {})
+    // How the latest latency measurement was taken - "udp" for UDP pings, or
+    // "tcp" if UDP pings were blocked and a TCP connection was timed instead.
+    // Empty if the location hasn't been measured.
+    JsonField(QString, latencyMethod, {}, {"", "udp", "tcp"})
 
 public:
     // Get the host/port parts of the UDP or TCP addresses.  Ports return 0 if
@@ -152,9 +170,27 @@ public:
     QString tcpHost() const {return addressHost(openvpnTCP());}
     quint16 udpPort() const {return addressPort(openvpnUDP());}
     quint16 tcpPort() const {return addressPort(openvpnTCP());}
+
+    // The location's JSON representation.  The same location object is
+    // referenced by many fields (the locations list, grouped locations,
+    // chosen/best/next locations, etc.), and it rarely changes once it's
+    // built, so it's serialized once and the (implicitly shared) result is
+    // reused until a property changes.  Not thread-safe, like the rest of
+    // ServerLocation.
+    const QJsonObject &cachedJson() const;
+
+private:
+    mutable QJsonObject _cachedJson;
+    // Revision of _cachedJson; ~0 if it hasn't been built yet
+    mutable quint64 _cachedRevision = ~quint64{0};
 };
 typedef QHash<QString, QSharedPointer<ServerLocation>> ServerLocations;
 
+// ServerLocations are serialized from their cached JSON (this is more specific
+// than json_cast(const NativeJsonObject&), so all of the container/pointer
+// casts find it).
+COMMON_EXPORT bool json_cast(const ServerLocation &from, QJsonValue &to);
+
 // Locations for a given country, sorted by latency (ties broken by id).
 class COMMON_EXPORT CountryLocations : public NativeJsonObject
 {
@@ -177,6 +213,23 @@ public:
     JsonField(QVector<QSharedPointer<ServerLocation>>, locations, {})
 };
 
+// Columnar encoding of the locations lists (the JSON forms of
+// DaemonData::locations and DaemonState::groupedLocations).  Each location
+// field is sent as one array holding that field's value for every location, so
+// the field names aren't repeated for each of the hundreds of regions.  Clients
+// opt in to receiving this with the "locationColumns" handshake feature.
+//
+// The encoders return an empty object if the value can't be encoded this way
+// (it's not well-formed, or the locations don't all have the same fields);
+// the value is sent as-is in that case.  The decoders return false if the
+// value isn't a valid encoding.
+COMMON_EXPORT QJsonObject encodeLocationsColumns(const QJsonObject &locations);
+COMMON_EXPORT bool decodeLocationsColumns(const QJsonObject &encoded, QJsonObject &locations);
+COMMON_EXPORT QJsonObject encodeGroupedLocationsColumns(const QJsonArray &groupedLocations);
+COMMON_EXPORT bool decodeGroupedLocationsColumns(const QJsonObject &encoded, QJsonArray &groupedLocations);
+// Check whether a value is one of the columnar encodings above.
+COMMON_EXPORT bool isLocationColumns(const QJsonValue &value);
+
 // Bandwidth measurements for one measurement interval, in bytes
 class COMMON_EXPORT IntervalBandwidth : public NativeJsonObject
 {
@@ -208,6 +261,137 @@ public:
     JsonField(quint64, sent, {})
 };
 
+// Traffic for the apps of one split tunnel rule mode, in bytes
+class COMMON_EXPORT SplitTunnelBandwidth : public NativeJsonObject
+{
+    Q_OBJECT
+public:
+    SplitTunnelBandwidth() {}
+    SplitTunnelBandwidth(const SplitTunnelBandwidth &other) {*this = other;}
+    SplitTunnelBandwidth &operator=(const SplitTunnelBandwidth &other)
+    {
+        mode(other.mode());
+        received(other.received());
+        sent(other.sent());
+        intervalReceived(other.intervalReceived());
+        intervalSent(other.intervalSent());
+        return *this;
+    }
+    bool operator==(const SplitTunnelBandwidth &other) const
+    {
+        return mode() == other.mode() && received() == other.received() &&
+            sent() == other.sent() &&
+            intervalReceived() == other.intervalReceived() &&
+            intervalSent() == other.intervalSent();
+    }
+    bool operator!=(const SplitTunnelBandwidth &other) const
+    {
+        return !(*this == other);
+    }
+
+    // The rule mode - same as SplitTunnelRule::mode ("exclude" or "include")
+    JsonField(QString, mode, {})
+    // Total traffic counted by the firewall - this resets if the firewall
+    // rules are reinstalled
+    JsonField(quint64, received, {})
+    JsonField(quint64, sent, {})
+    // Traffic during the last measurement interval
+    JsonField(quint64, intervalReceived, {})
+    JsonField(quint64, intervalSent, {})
+};
+
+// Time spent in one phase of a VPN connection attempt, along with a histogram
+// of the time spent in that phase over recent connections.
+class COMMON_EXPORT ConnectionPhase : public NativeJsonObject
+{
+    Q_OBJECT
+public:
+    // Upper bounds (ms) of the histogram buckets; the last bucket counts
+    // everything longer.
+    static const std::array<quint64, 7> histogramBounds;
+
+public:
+    ConnectionPhase() {}
+    ConnectionPhase(const QString &phaseVal, quint64 durationVal,
+                    const QVector<uint> &histogramVal)
+    {
+        phase(phaseVal);
+        duration(durationVal);
+        histogram(histogramVal);
+    }
+    ConnectionPhase(const ConnectionPhase &other) {*this = other;}
+    ConnectionPhase &operator=(const ConnectionPhase &other)
+    {
+        phase(other.phase());
+        duration(other.duration());
+        histogram(other.histogram());
+        return *this;
+    }
+    bool operator==(const ConnectionPhase &other) const
+    {
+        return phase() == other.phase() && duration() == other.duration() &&
+            histogram() == other.histogram();
+    }
+    bool operator!=(const ConnectionPhase &other) const
+    {
+        return !(*this == other);
+    }
+
+    // The OpenVPN state for this phase - "Connecting" (starting OpenVPN),
+    // "Resolve", "TCPConnect", "Wait", "Auth" (TLS handshake), "GetConfig"
+    // (config push), "AssignIP", or "AddRoutes"
+    JsonField(QString, phase, {})
+    // Time spent in this phase in the last connection (ms)
+    JsonField(quint64, duration, {})
+    // Number of recent connections that spent each amount of time in this
+    // phase - one count per bucket of histogramBounds, plus one for longer
+    // durations
+    JsonField(QVector<uint>, histogram, {})
+};
+
+// Result of an in-tunnel self test (see Daemon::RPC_runSelfTest()).  Any of the
+// measurements can be missing if they couldn't be made.  Comparing
+// tunnelLatency to preTunnelLatency shows the latency added inside the VPN,
+// which indicates whether slowness is due to the server or the user's link.
+class COMMON_EXPORT SelfTestResult : public NativeJsonObject
+{
+    Q_OBJECT
+public:
+    SelfTestResult() {}
+    SelfTestResult(const SelfTestResult &other) {*this = other;}
+    SelfTestResult &operator=(const SelfTestResult &other)
+    {
+        timestamp(other.timestamp());
+        location(other.location());
+        tunnelLatency(other.tunnelLatency());
+        preTunnelLatency(other.preTunnelLatency());
+        downloadRate(other.downloadRate());
+        return *this;
+    }
+    bool operator==(const SelfTestResult &other) const
+    {
+        return timestamp() == other.timestamp() && location() == other.location() &&
+            tunnelLatency() == other.tunnelLatency() &&
+            preTunnelLatency() == other.preTunnelLatency() &&
+            downloadRate() == other.downloadRate();
+    }
+    bool operator!=(const SelfTestResult &other) const
+    {
+        return !(*this == other);
+    }
+
+    // When the test finished (ms since the epoch, UTC)
+    JsonField(qint64, timestamp, 0)
+    // ID of the VPN location that was tested
+    JsonField(QString, location, {})
+    // Roundtrip time to the VPN gateway through the tunnel (ms)
+    JsonField(Optional<double>, tunnelLatency, {})
+    // Latency to the same location measured before connecting (ms)
+    JsonField(Optional<double>, preTunnelLatency, {})
+    // Rate of a short download through the tunnel (bytes per second)
+    JsonField(Optional<double>, downloadRate, {})
+};
+
 // Transport settings that might vary due to automatic failover.
 class COMMON_EXPORT Transport : public NativeJsonObject
 {
@@ -284,6 +468,40 @@ public:
     JsonField(QString, password, {})
 };
 
+// History of connections to a location, used to rank the locations (see
+// WeightedLocationRanking).
+class COMMON_EXPORT LocationHistory : public NativeJsonObject
+{
+    Q_OBJECT
+
+public:
+    LocationHistory() {}
+    LocationHistory(const LocationHistory &other) {*this = other;}
+    LocationHistory &operator=(const LocationHistory &other)
+    {
+        connectSuccess(other.connectSuccess());
+        throughput(other.throughput());
+        return *this;
+    }
+    bool operator==(const LocationHistory &other) const
+    {
+        return connectSuccess() == other.connectSuccess() &&
+            throughput() == other.throughput();
+    }
+    bool operator!=(const LocationHistory &other) const
+    {
+        return !(*this == other);
+    }
+
+    // Smoothed rate of successful connection attempts (0-1).  An attempt
+    // fails if it has trouble connecting (reaches StillConnecting or
+    // StillReconnecting).
+    JsonField(Optional<double>, connectSuccess, {})
+    // Smoothed peak throughput of connections that carried significant
+    // traffic (bytes per second in both directions)
+    JsonField(Optional<double>, throughput, {})
+};
+
 // Class encapsulating 'data' properties of the daemon; these are cached
 // and persist between daemon instances, and typically determine the
 // operating parameters of the PIA service, such as certificates and
@@ -325,6 +543,36 @@ public:
     JsonField(QVector<uint>, udpPorts,  QVector<uint>({1194, 8080, 9201, 53}))
     JsonField(QVector<uint>, tcpPorts,  QVector<uint>({443, 110, 80}))
 
+    // Transports that connected successfully after the preferred transport
+    // failed, keyed by network fingerprint (see TransportSelector in the
+    // daemon).  The next connection on the same network starts with that
+    // transport instead of working through the alternates again.
+    typedef QHash<QString, Transport> NetworkTransportMap;
+    JsonField(NetworkTransportMap, networkTransports, {})
+
+    // Tunnel MTUs found by probing after connecting, keyed by network
+    // fingerprint (see DaemonSettings::mtuDiscovery).  The next connection on
+    // the same network applies the MTU with mssfix.
+    typedef QHash<QString, uint> NetworkMtuMap;
+    JsonField(NetworkMtuMap, networkMtus, {})
+
+    // Encryption throughput of each data channel cipher on this CPU (bytes per
+    // second), measured once by the daemon.  Used to pick a cipher when
+    // DaemonSettings::cipher is "auto".
+    typedef QHash<QString, double> CipherThroughputMap;
+    JsonField(CipherThroughputMap, cipherThroughputs, {})
+
+    // Best throughput observed with each transport (bytes per second), by
+    // network fingerprint and then transport ("udp:8080").  Only recorded
+    // when DaemonSettings::cipher is "auto".
+    typedef QHash<QString, QHash<QString, double>> NetworkThroughputMap;
+    JsonField(NetworkThroughputMap, networkThroughputs, {})
+
+    // Connection history for each location, keyed by location ID.  Used to
+    // rank locations when DaemonSettings::locationRanking is "weighted".
+    typedef QHash<QString, LocationHistory> LocationHistoryMap;
+    JsonField(LocationHistoryMap, locationHistory, {})
+
 public:
     QStringList getCertificateAuthority(const QString& type);
 };
@@ -468,6 +716,10 @@ public:
     // values expressed in DaemonState.  (The client should only use this to set
     // a new choice.)
     JsonField(QString, location, QStringLiteral("auto"))
+    // How locations are ranked to find the best location for "auto" (see
+    // LocationRanking).  "latency" uses the latency alone; "weighted" also
+    // considers jitter, packet loss, and DaemonData::locationHistory.
+    JsonField(QString, locationRanking, QStringLiteral("weighted"), { "latency", "weighted" })
     JsonField(QString, protocol, QStringLiteral("udp"), { "udp", "tcp" })
     JsonField(QString, killswitch, QStringLiteral("auto"), { "on", "off", "auto" })
     // Whether to use the VPN as the default route.  This is a split tunnel
@@ -480,6 +732,7 @@ public:
     JsonField(bool, defaultRoute, true)
     JsonField(bool, blockIPv6, true) // block IPv6 traffic
     JsonField(DNSSetting, overrideDNS, QStringLiteral("pia"), validateDNSSetting) // use PIA DNS servers (symbolic name, array with 1-2 IPs, or empty string to use existing DNS)
+    JsonField(bool, dnsCache, false) // answer DNS from a local cache in the daemon (forwards to overrideDNS through the tunnel)
     JsonField(bool, allowLAN, true) // permits LAN traffic when connected/killswitched
     JsonField(bool, portForward, false) // forward a port through the VPN tunnel, see DaemonState::forwardedPort
     JsonField(bool, enableMACE, false) // Enable MACE Ad tracker
@@ -487,7 +740,14 @@ public:
     JsonField(uint, remotePortTCP, 0) // 0 == auto
     JsonField(uint, localPort, 0) // 0 == auto
     JsonField(uint, mtu, 0) // 0 == unspecified
-    JsonField(QString, cipher, QStringLiteral("AES-128-GCM"), { "AES-128-GCM", "AES-256-GCM", "AES-128-CBC", "AES-256-CBC", "none" })
+    // When mtu is unspecified, probe the tunnel MTU after connecting and apply
+    // it (with mssfix) on later connections to the same network.  See
+    // DaemonData::networkMtus.
+    JsonField(bool, mtuDiscovery, false)
+    // "auto" picks the fastest cipher on this CPU (see
+    // DaemonData::cipherThroughputs), and also lets throughput history pick
+    // the starting transport when automaticTransport is enabled.
+    JsonField(QString, cipher, QStringLiteral("AES-128-GCM"), { "auto", "AES-128-GCM", "AES-256-GCM", "AES-128-CBC", "AES-256-CBC", "none" })
     JsonField(QString, auth, QStringLiteral("SHA1"), { "SHA1", "SHA256", "none" })
     JsonField(QString, serverCertificate, QStringLiteral("RSA-2048"), { "ECDSA-256k1", "ECDSA-256r1", "ECDSA-521", "RSA-2048", "RSA-3072", "RSA-4096", "default" })
     // On Windows, the method to use to configure the TAP adapter's IP addresses
@@ -500,6 +760,28 @@ public:
     // incorrect"), and it depends on the DNS Client service to apply DNS
     // servers, which some users disable.
     JsonField(QString, windowsIpMethod, QStringLiteral("dhcp"), {"dhcp", "static"})
+    // On Windows, the virtual network adapter used by OpenVPN.
+    // - tap - the bundled TAP-Windows adapter
+    // - wintun - a WinTUN adapter, which uses ring buffers shared with the
+    //   driver instead of an IOCTL per packet.  Requires a WinTUN adapter to
+    //   be present, and OpenVPN 2.5 or later; the daemon falls back to TAP if
+    //   no WinTUN adapter is found.  WinTUN doesn't support DHCP, so the
+    //   static method is used regardless of windowsIpMethod.
+    JsonField(QString, windowsDriver, QStringLiteral("tap"), {"tap", "wintun"})
+    // On Linux, where OpenVPN's data channel (packet encryption) runs.
+    // - userspace - in the openvpn process, which reads and writes each
+    //   packet on the tun device
+    // - dco - in the kernel, using the ovpn-dco module (data channel offload).
+    //   Requires the module and an OpenVPN build with DCO support (2.6 or
+    //   later); the daemon falls back to userspace if either is missing.
+    //   OpenVPN itself also falls back for options DCO can't handle, such as
+    //   CBC ciphers.
+    JsonField(QString, linuxDataChannel, QStringLiteral("userspace"), {"userspace", "dco"})
+    // On Linux, how the killswitch firewall rules are applied.
+    // - iptables - use iptables chains (the split tunnel rules always use
+    //   iptables)
+    // - nftables - use native nftables tables, updated incrementally with nft
+    JsonField(QString, linuxFirewallBackend, QStringLiteral("iptables"), {"iptables", "nftables"})
 
     // Proxy setting
     //  - "none" - No proxy
@@ -515,13 +797,35 @@ public:
     // Shadowsocks proxy location - used when proxy is "shadowsocks", identifies
     // a PIA region or 'auto'.  Invalid locations are treated as 'auto'.
     JsonField(QString, proxyShadowsocksLocation, QStringLiteral("auto"))
+    // Start the Shadowsocks client as soon as the proxy is configured (while
+    // a client is active), so it's already listening when we connect.
+    JsonField(bool, prestartShadowsocks, true)
 
     // Automatically try alternate transport settings if the selected protocol/
     // port does not work.
     JsonField(bool, automaticTransport, true)
 
+    // Keep a standby location ready while connected to an automatic location
+    // (see ServiceLocations::standbyLocation), and fail over to it as soon as
+    // the connection is lost, instead of retrying the lost server first.
+    // Not used if the network itself was lost, or if a specific location is
+    // selected.
+    JsonField(bool, standbyFailover, false)
+
+    // Length (in seconds) of the intervals in
+    // DaemonState::intervalMeasurements.  This is OpenVPN's bytecount
+    // interval, which can't be less than 1 second.
+    JsonField(uint, bandwidthSampleInterval, 5, {1u, 2u, 5u})
+
     // Specify debug logging filter rules (null = disable logging to file)
     JsonField(Optional<QStringList>, debugLogging, nullptr)
+    // Write debug logs in the compact binary format (see
+    // Logger::setBinaryFormat()).  The support tool renders them as text.
+    JsonField(bool, binaryDebugLog, false)
+
+    // Port for the OpenMetrics endpoint on 127.0.0.1, which serves runtime
+    // statistics for scraping by Prometheus or similar tools.  0 disables it.
+    JsonField(uint, metricsPort, 0)
 
     // The "GA release" update channel from which we retrieve updates, such as
     // "release", "qa_release", etc.  Valid values are determined by the update
@@ -541,6 +845,12 @@ public:
     JsonField(QString, betaUpdateChannel,defaultReleaseChannelBeta)
     // Whether the user wants beta updates.
     JsonField(bool, offerBetaUpdates, false)
+    // Whether to download available updates in the background (while the VPN
+    // connection isn't changing), so installing them is instant.
+    JsonField(bool, backgroundUpdateDownload, false)
+    // Rate limit for background update downloads in KiB/s; 0 means no limit.
+    // (Downloads started by the user are never limited.)
+    JsonField(int, backgroundUpdateRateLimit, 256)
 
     // Whether split tunnel is enabled
     JsonField(bool, splitTunnelEnabled, false)
@@ -596,6 +906,7 @@ public:
         chosenLocation(other.chosenLocation());
         bestLocation(other.bestLocation());
         nextLocation(other.nextLocation());
+        standbyLocation(other.standbyLocation());
         return *this;
     }
 
@@ -603,7 +914,8 @@ public:
     {
         return compareLocationsValue(chosenLocation(), other.chosenLocation()) &&
             compareLocationsValue(bestLocation(), other.bestLocation()) &&
-            compareLocationsValue(nextLocation(), other.nextLocation());
+            compareLocationsValue(nextLocation(), other.nextLocation()) &&
+            compareLocationsValue(standbyLocation(), other.standbyLocation());
     }
     bool operator!=(const ServiceLocations &other) const
     {
@@ -634,6 +946,12 @@ public:
     //
     // Like 'chosenLocation', undefined if and only if no locations are known.
     JsonField(QSharedPointer<ServerLocation>, nextLocation, {})
+    // The location to fail over to if the connection to nextLocation is lost
+    // - the best location other than nextLocation (VPN service only).
+    //
+    // Undefined unless DaemonSettings::standbyFailover is enabled and the
+    // location is 'auto'.
+    JsonField(QSharedPointer<ServerLocation>, standbyLocation, {})
 };
 
 // Information about the current ongoing connection and the last successful
@@ -700,6 +1018,44 @@ public:
     JsonField(bool, proxyShadowsocksLocationAuto, false)
 };
 
+// Restart status of a helper process managed by the daemon (hnsd,
+// Shadowsocks, etc.)
+class COMMON_EXPORT HelperProcessStatus : public NativeJsonObject
+{
+    Q_OBJECT
+
+public:
+    HelperProcessStatus() {}
+    HelperProcessStatus(const HelperProcessStatus &other) {*this = other;}
+    HelperProcessStatus &operator=(const HelperProcessStatus &other)
+    {
+        restartCount(other.restartCount());
+        lastFailureCause(other.lastFailureCause());
+        halted(other.halted());
+        return *this;
+    }
+    bool operator==(const HelperProcessStatus &other) const
+    {
+        return restartCount() == other.restartCount() &&
+            lastFailureCause() == other.lastFailureCause() &&
+            halted() == other.halted();
+    }
+    bool operator!=(const HelperProcessStatus &other) const
+    {
+        return !(*this == other);
+    }
+
+    // Number of times the process has been restarted after failing since the
+    // daemon started
+    JsonField(int, restartCount, 0)
+    // Cause of the last failure - "Exit", "Crash", "Network", or "Config" -
+    // empty if it hasn't failed
+    JsonField(QString, lastFailureCause, {})
+    // Whether the process failed deterministically and is no longer being
+    // restarted (until its configuration changes or it's disabled)
+    JsonField(bool, halted, false)
+};
+
 // Class encapsulating 'state' properties of the daemon; these describe
 // the current state of the daemon and the VPN connection, and are not
 // saved to disk. These are combined with the 'data' object when passed
@@ -775,6 +1131,16 @@ public:
     JsonField(Optional<Transport>, chosenTransport, {})
     JsonField(Optional<Transport>, actualTransport, {})
 
+    // Time spent in each phase of the last successful connection attempt,
+    // with histograms over recent connections.  Phases that did not occur
+    // (such as TCPConnect for UDP) have a duration of 0.  Empty until a
+    // connection has been established.
+    JsonField(QVector<ConnectionPhase>, connectionPhases, {})
+
+    // Result of the last self test (see SelfTestResult), if one has been run.
+    // This is kept after disconnecting; the timestamp and location identify it.
+    JsonField(Optional<SelfTestResult>, selfTestResult, {})
+
     // Service locations chosen by the daemon, based on the chosen and best
     // locations, etc.
     //
@@ -832,6 +1198,13 @@ public:
     //
     // When not connected, this is an empty array.
     JsonField(QList<IntervalBandwidth>, intervalMeasurements, {})
+    // Traffic of split tunnel apps by rule mode, sampled with the interval
+    // measurements.  "exclude" apps' traffic bypasses the VPN; "include" apps'
+    // traffic is part of the VPN traffic above.
+    //
+    // Only provided on Linux, and only while connected with split tunnel
+    // enabled; otherwise this is an empty array.
+    JsonField(QVector<SplitTunnelBandwidth>, splitTunnelBandwidth, {})
     // Timestamp when the VPN connection was established - ms since system
     // startup, using a monotonic clock.  0 if we are not connected.
     //
@@ -842,6 +1215,21 @@ public:
     // enough time that the connection is still alive, it is not too surprising
     // that the connection duration would exclude the sleep time.
     JsonField(qint64, connectionTimestamp, {})
+    // Whether MACE was activated for the current connection.  MACE is
+    // activated before the Connected state is reported, so this is set when
+    // the connection is established (if MACE is enabled).  false if we are
+    // not connected or activation failed.
+    JsonField(bool, maceActive, false)
+    // Time taken to activate MACE for the current connection (ms), including
+    // retries.  This is set even if activation failed; 0 if we are not
+    // connected or MACE is not enabled.
+    JsonField(qint64, maceActivationTime, 0)
+    // Time from reaching the Connected state until all post-connect data is
+    // available (ms) - the VPN IP, and the forwarded port if port forwarding
+    // was requested.  This is when the connection appears "fully connected"
+    // to users.  0 until then, if we are not connected, or if the data wasn't
+    // available by the post-connect deadline.
+    JsonField(qint64, postConnectTime, 0)
 
     // These fields all indicate errors/warnings/notification conditions
     // detected by the Daemon that can potentially be displayed in the client.
@@ -917,6 +1305,15 @@ public:
     // once it syncs a block.  This can overlap with hnsdFailing if it also
     // crashes or restarts after this condition occurs.
     JsonField(qint64, hnsdSyncFailure, 0)
+    // Height of the last block synced by hnsd (0 if it isn't running or
+    // hasn't synced a block yet).  hnsd runs while Handshake is selected or
+    // while it syncs in the background ahead of a reconnect to use Handshake.
+    JsonField(int, hnsdSyncHeight, 0)
+
+    // Restart status of helper processes, keyed by name ("hnsd",
+    // "shadowsocks").  Processes that haven't failed aren't included.
+    typedef QHash<QString, HelperProcessStatus> HelperProcessStatusMap;
+    JsonField(HelperProcessStatusMap, helperProcesses, {})
 
     // The original gateway IP address before we activated the VPN
     JsonField(QString, originalGatewayIp, {})
@@ -972,15 +1369,106 @@ COMMON_EXPORT ServerLocations updateServerLocations(const ServerLocations &exist
 COMMON_EXPORT ServerLocations updateShadowsocksLocations(const ServerLocations &existingLocations,
                                                          const QJsonObject &shadowsocksObj);
 
+// Compare updated locations (from updateServerLocations() or
+// updateShadowsocksLocations()) to the existing locations.  Locations in
+// newLocations that are unchanged are replaced with the existing
+// ServerLocation objects, so the two collections compare equal when nothing
+// has changed, and only the changed locations are published to clients.
+//
+// Returns the number of locations that were added, removed, or changed.  If
+// pPingChanged is given, it's set to indicate whether any location was added
+// or removed or had its ping address change (LatencyTracker only needs to be
+// updated in that case).
+COMMON_EXPORT int reuseUnchangedLocations(const ServerLocations &existingLocations,
+                                          ServerLocations &newLocations,
+                                          bool *pPingChanged = nullptr);
+
 // Build the grouped and sorted locations from the flat locations.
 COMMON_EXPORT QVector<CountryLocations> buildGroupedLocations(const ServerLocations &locations);
 
+// Approximate memory used by a ServerLocations collection, for the daemon's
+// memory metrics.  String data shared between locations (see
+// updateServerLocations()) is counted once in sharedBytes, but for each
+// location that references it in stringBytes.
+struct LocationsMemoryStats
+{
+    int locations;
+    // Size of the ServerLocation objects themselves
+    qint64 objectBytes;
+    // String data referenced by the locations
+    qint64 stringBytes;
+    // String data actually allocated, counting shared strings once
+    qint64 sharedBytes;
+};
+COMMON_EXPORT LocationsMemoryStats measureLocationsMemory(const ServerLocations &locations);
+
+// LocationRanking scores locations for NearestLocations; lower scores rank
+// first.  The base ranking is the latency alone.  Locations that can't be
+// scored (no latency has been measured) get an infinite score and rank last.
+class COMMON_EXPORT LocationRanking
+{
+public:
+    virtual ~LocationRanking() = default;
+
+public:
+    virtual double score(const ServerLocation &location) const;
+};
+
+// WeightedLocationRanking combines the latency with the other measurements of
+// a location; the score is an "effective latency" in milliseconds:
+// - jitter is added to the latency
+// - packet loss and failed connection attempts inflate the score
+// - locations that have carried more traffic get a small discount, relative
+//   to the best throughput seen for any location
+class COMMON_EXPORT WeightedLocationRanking : public LocationRanking
+{
+public:
+    explicit WeightedLocationRanking(DaemonData::LocationHistoryMap history);
+
+public:
+    virtual double score(const ServerLocation &location) const override;
+
+private:
+    DaemonData::LocationHistoryMap _history;
+    double _maxThroughput;
+};
+
+// NearestLocations keeps the locations ordered by a LocationRanking, so the
+// nearest locations can be found without sorting again.  The index can be kept
+// and updated in place as measurements arrive.  Each location's score is
+// stored in the index, so a location's measurements can be changed freely, but
+// the index only reflects them once the location is rescored with
+// updateLatency() (or all locations are rescored by setRanking()).
 class COMMON_EXPORT NearestLocations
 {
 public:
+    NearestLocations();
     NearestLocations(const ServerLocations &locations);
 
 public:
+    // Replace all indexed locations.
+    void reset(const ServerLocations &locations);
+
+    // Change the ranking, and reorder all locations with it.
+    void setRanking(std::shared_ptr<const LocationRanking> pRanking);
+
+    // Set the latency of an indexed location, and move it to its new position
+    // in the index with its new score.  Other measurements used by the ranking
+    // (loss, jitter) can be set beforehand so they're scored together.  (If the
+    // location isn't in the index, this just sets the latency.)
+    void updateLatency(const QSharedPointer<ServerLocation> &pLocation,
+                       double latency);
+
+    // Score a location with the current ranking
+    double score(const ServerLocation &location) const;
+
+    // Build the grouped and sorted locations from the ordered locations; the
+    // same as ::buildGroupedLocations() but without sorting again.  The groups
+    // are kept up to date as locations move, so only the countries whose
+    // locations changed since the last call are rebuilt, and the others are
+    // the same CountryLocations values as last time.
+    QVector<CountryLocations> buildGroupedLocations();
+
     // Find the closest server location that is safe to use with 'connect auto'.
     // The safe servers are found in in the "auto_regions" server json. Note
     // that servers that do NOT appear in this list may still be connected to
@@ -989,7 +1477,14 @@ public:
     // If the portForward parameter is true, then prefer the closest location
     // that supports port forwarding.  (Still fall back to the closest location
     // if none support PF.)
-    QSharedPointer<ServerLocation> getNearestSafeVpnLocation(bool portForward) const;
+    //
+    // If the previous result is given, it's kept unless the new closest
+    // location is better by a significant margin, so the best location doesn't
+    // flap between locations that are nearly equal.  (It's still replaced if
+    // it no longer exists or doesn't meet the constraints that the new
+    // location meets.)
+    QSharedPointer<ServerLocation> getNearestSafeVpnLocation(bool portForward,
+                                                             const QSharedPointer<ServerLocation> &pPrevious = {}) const;
 
     // Find the closest server location that is safe and satisfies an arbitrary
     // predicate.  Does _not_ fall back if no locations satisfy the predicate.
@@ -999,18 +1494,61 @@ public:
     QSharedPointer<ServerLocation> getNearestSafeServiceLocation(LocationTestFunc isAllowedLocation) const
     {
         auto itResult = std::find_if(_locations.begin(), _locations.end(),
-            [&isAllowedLocation](const auto &pLocation)
+            [&isAllowedLocation](const Entry &entry)
             {
-                return pLocation && pLocation->isSafeForAutoConnect() &&
-                    isAllowedLocation(*pLocation);
+                return entry.pLocation && entry.pLocation->isSafeForAutoConnect() &&
+                    isAllowedLocation(*entry.pLocation);
             });
         if(itResult != _locations.end())
-            return *itResult;
+            return itResult->pLocation;
         return {};
     }
 
 private:
-    QVector<QSharedPointer<ServerLocation>> _locations;
+    struct Entry
+    {
+        double score;
+        QSharedPointer<ServerLocation> pLocation;
+    };
+    // Orders entries by score, then by country code and ID.  (A multiset is
+    // used, since the IDs are compared ignoring case.)
+    struct ScoreOrder
+    {
+        bool operator()(const Entry &first, const Entry &second) const;
+    };
+    using LocationIndex = std::multiset<Entry, ScoreOrder>;
+
+    // One country's locations, in the same order as the main index, and the
+    // grouped locations last built from them
+    struct CountryGroup
+    {
+        LocationIndex locations;
+        CountryLocations grouped;
+    };
+
+    // Find a specific location in the index (end() if it's not present)
+    LocationIndex::iterator find(const QSharedPointer<ServerLocation> &pLocation);
+    // Find an indexed location by ID (nullptr if it's not present)
+    const Entry *findId(const QString &id) const;
+    // Score a location and add it to the index and its country's group
+    void insert(const QSharedPointer<ServerLocation> &pLocation);
+    // Remove a location from the index and its country's group
+    void erase(LocationIndex::iterator itLocation);
+
+private:
+    std::shared_ptr<const LocationRanking> _pRanking;
+    LocationIndex _locations;
+    // Score of each indexed location, used to find it in the index
+    QHash<const ServerLocation*, double> _scores;
+    // Locations grouped by country, keyed by the lowercase country code
+    QHash<QString, CountryGroup> _countries;
+    // Countries whose locations have changed since the last
+    // buildGroupedLocations()
+    QSet<QString> _changedCountries;
+    // The result of the last buildGroupedLocations(), valid if _groupsBuilt
+    // is set and no countries have changed since then
+    QVector<CountryLocations> _groupedLocations;
+    bool _groupsBuilt;
 };
 
 // Check if a DNSSetting value is Handshake (used by VpnConnection to determine
@@ -1019,6 +1557,9 @@ COMMON_EXPORT bool isDNSHandshake(const DaemonSettings::DNSSetting &setting);
 
 extern COMMON_EXPORT const QString hnsdLocalAddress;
 
+// Loopback address of the daemon's DNS cache (see DaemonSettings::dnsCache)
+extern COMMON_EXPORT const QString dnsCacheLocalAddress;
+
 // Translate the DNS override setting into an actual list of DNS servers (empty
 // if DNS should not be overridden).
 COMMON_EXPORT QStringList getDNSServers(const DaemonSettings::DNSSetting& setting);
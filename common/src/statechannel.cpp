@@ -0,0 +1,251 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("statechannel.cpp")
+
+#include "statechannel.h"
+#include "brand.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The fields are atomics (accessed with relaxed ordering, between the
+// sequence number's acquire/release fences), so a reader racing with the
+// writer sees torn values at worst, which the sequence lock then discards.
+// They have to be lock-free, since the reader can't take the writer's locks.
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "State channel requires lock-free atomics");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "State channel requires lock-free atomics");
+
+struct StateChannelImage
+{
+    enum : quint32
+    {
+        Magic = 0x50534331, // 'PSC1'
+        // Increment when the layout changes
+        Version = 1,
+    };
+
+    // Written once before the image is published
+    quint32 magic;
+    quint32 version;
+    std::atomic<quint32> sequence;
+    std::atomic<quint64> bytesReceived;
+    std::atomic<quint64> bytesSent;
+    std::atomic<qint64> forwardedPort;
+    std::atomic<quint64> intervalCount;
+    std::atomic<quint64> intervals[StateChannelValues::MaxIntervals][2];
+    // Latin-1 connection state, nul-padded, packed 8 characters per word
+    std::atomic<quint64> connectionState[StateChannelValues::MaxConnectionState / 8];
+};
+
+namespace
+{
+#ifdef Q_OS_UNIX
+    // Name of the shared memory object.  macOS limits these to 31 characters.
+    const char stateChannelName[] = "/" BRAND_CODE "-state";
+#endif
+
+    // A reader gives up after this many attempts if the writer keeps updating
+    // the image.  Updates are tiny and infrequent, this should never happen.
+    enum : int { MaxReadAttempts = 64 };
+}
+
+StateChannelWriter::StateChannelWriter()
+    : _pImage{nullptr}
+{
+#ifdef Q_OS_UNIX
+    // Remove an image left by a daemon that didn't exit cleanly.  A new object
+    // is created each time, so clients still mapping the old one don't see
+    // this daemon's changes - they reopen the channel when they reconnect.
+    ::shm_unlink(stateChannelName);
+    int fd = ::shm_open(stateChannelName, O_RDWR|O_CREAT|O_EXCL, 0644);
+    if(fd < 0)
+    {
+        qWarning() << "Can't create state channel:" << qt_error_string(errno);
+        return;
+    }
+    // Clients are read-only; make sure the umask didn't remove their access.
+    if(::fchmod(fd, 0644) != 0 || ::ftruncate(fd, sizeof(StateChannelImage)) != 0)
+    {
+        qWarning() << "Can't size state channel:" << qt_error_string(errno);
+        ::close(fd);
+        ::shm_unlink(stateChannelName);
+        return;
+    }
+    void *pMapped = ::mmap(nullptr, sizeof(StateChannelImage), PROT_READ|PROT_WRITE,
+                           MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(pMapped == MAP_FAILED)
+    {
+        qWarning() << "Can't map state channel:" << qt_error_string(errno);
+        ::shm_unlink(stateChannelName);
+        return;
+    }
+
+    // New shared memory is zero-filled, so the atomics are already zero.
+    _pImage = reinterpret_cast<StateChannelImage*>(pMapped);
+    _pImage->magic = StateChannelImage::Magic;
+    _pImage->version = StateChannelImage::Version;
+    std::atomic_thread_fence(std::memory_order_release);
+    qInfo() << "Created state channel" << stateChannelName;
+#endif
+}
+
+StateChannelWriter::~StateChannelWriter()
+{
+#ifdef Q_OS_UNIX
+    if(_pImage)
+    {
+        ::munmap(_pImage, sizeof(StateChannelImage));
+        ::shm_unlink(stateChannelName);
+    }
+#endif
+}
+
+void StateChannelWriter::write(const StateChannelValues &values)
+{
+    if(!_pImage)
+        return;
+
+    // Odd sequence numbers indicate an update in progress
+    quint32 sequence = _pImage->sequence.load(std::memory_order_relaxed);
+    _pImage->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    _pImage->bytesReceived.store(values.bytesReceived, std::memory_order_relaxed);
+    _pImage->bytesSent.store(values.bytesSent, std::memory_order_relaxed);
+    _pImage->forwardedPort.store(values.forwardedPort, std::memory_order_relaxed);
+    std::size_t intervalCount = std::min(values.intervalCount, values.intervals.size());
+    _pImage->intervalCount.store(intervalCount, std::memory_order_relaxed);
+    for(std::size_t i = 0; i < intervalCount; ++i)
+    {
+        _pImage->intervals[i][0].store(values.intervals[i].received, std::memory_order_relaxed);
+        _pImage->intervals[i][1].store(values.intervals[i].sent, std::memory_order_relaxed);
+    }
+
+    char state[StateChannelValues::MaxConnectionState]{};
+    QByteArray stateLatin1 = values.connectionState.toLatin1();
+    std::memcpy(state, stateLatin1.data(),
+                std::min<std::size_t>(stateLatin1.size(), sizeof(state)));
+    for(std::size_t i = 0; i < sizeof(state) / 8; ++i)
+    {
+        quint64 word;
+        std::memcpy(&word, state + i * 8, sizeof(word));
+        _pImage->connectionState[i].store(word, std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_release);
+    _pImage->sequence.store(sequence + 2, std::memory_order_relaxed);
+}
+
+StateChannelReader::StateChannelReader()
+    : _pImage{nullptr}
+{
+}
+
+StateChannelReader::~StateChannelReader()
+{
+    close();
+}
+
+bool StateChannelReader::read(StateChannelValues &values)
+{
+#ifdef Q_OS_UNIX
+    if(!_pImage)
+    {
+        int fd = ::shm_open(stateChannelName, O_RDONLY, 0);
+        if(fd < 0)
+            return false;   // Daemon isn't running, or is an older version
+        struct stat fileStat{};
+        void *pMapped = MAP_FAILED;
+        if(::fstat(fd, &fileStat) == 0 &&
+           fileStat.st_size >= static_cast<off_t>(sizeof(StateChannelImage)))
+        {
+            pMapped = ::mmap(nullptr, sizeof(StateChannelImage), PROT_READ,
+                             MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if(pMapped == MAP_FAILED)
+            return false;
+
+        const StateChannelImage *pImage = reinterpret_cast<const StateChannelImage*>(pMapped);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(pImage->magic != StateChannelImage::Magic ||
+           pImage->version != StateChannelImage::Version)
+        {
+            qWarning() << "State channel has unexpected version" << pImage->version;
+            ::munmap(pMapped, sizeof(StateChannelImage));
+            return false;
+        }
+        _pImage = pImage;
+    }
+
+    for(int attempt = 0; attempt < MaxReadAttempts; ++attempt)
+    {
+        quint32 sequence = _pImage->sequence.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(sequence & 1)
+            continue;   // Update in progress
+
+        values.bytesReceived = _pImage->bytesReceived.load(std::memory_order_relaxed);
+        values.bytesSent = _pImage->bytesSent.load(std::memory_order_relaxed);
+        values.forwardedPort = static_cast<int>(_pImage->forwardedPort.load(std::memory_order_relaxed));
+        values.intervalCount = std::min<std::size_t>(_pImage->intervalCount.load(std::memory_order_relaxed),
+                                                     values.intervals.size());
+        for(std::size_t i = 0; i < values.intervalCount; ++i)
+        {
+            values.intervals[i].received = _pImage->intervals[i][0].load(std::memory_order_relaxed);
+            values.intervals[i].sent = _pImage->intervals[i][1].load(std::memory_order_relaxed);
+        }
+        char state[StateChannelValues::MaxConnectionState];
+        for(std::size_t i = 0; i < sizeof(state) / 8; ++i)
+        {
+            quint64 word = _pImage->connectionState[i].load(std::memory_order_relaxed);
+            std::memcpy(state + i * 8, &word, sizeof(word));
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(_pImage->sequence.load(std::memory_order_relaxed) == sequence)
+        {
+            values.connectionState = QString::fromLatin1(state, qstrnlen(state, sizeof(state)));
+            return true;
+        }
+    }
+    qWarning() << "Couldn't read state channel after" << MaxReadAttempts << "attempts";
+#else
+    Q_UNUSED(values);
+#endif
+    return false;
+}
+
+void StateChannelReader::close()
+{
+#ifdef Q_OS_UNIX
+    if(_pImage)
+        ::munmap(const_cast<StateChannelImage*>(_pImage), sizeof(StateChannelImage));
+#endif
+    _pImage = nullptr;
+}
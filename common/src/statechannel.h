@@ -0,0 +1,128 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("statechannel.h")
+
+#ifndef STATECHANNEL_H
+#define STATECHANNEL_H
+
+#include <QString>
+#include <array>
+
+struct StateChannelImage;
+
+// The state channel is a shared memory image of a few frequently-updated
+// DaemonState values.  The daemon writes it (StateChannelWriter), and clients
+// map it read-only (StateChannelReader), so graphs and the tray can poll these
+// values at any rate without any IPC.
+//
+// This is only an optional fast path - the daemon still sends all of these
+// values over its socket in the usual "data"/"patch" notifications.  Clients
+// must not depend on the channel; if it can't be read, they use DaemonState.
+//
+// Updates are protected by a sequence lock: the daemon increments the sequence
+// number before and after each update, and readers retry if they observe an
+// odd sequence number or if it changed while reading.
+//
+// The channel uses POSIX shared memory, so it's only implemented on macOS and
+// Linux; on Windows the writer and reader are never open.
+struct COMMON_EXPORT StateChannelValues
+{
+    enum : std::size_t
+    {
+        // Matches VPNConnection::MaxMeasurementIntervals
+        MaxIntervals = 32,
+        // Longest connection state stored (the longest state name is
+        // "DisconnectingToReconnect")
+        MaxConnectionState = 32,
+    };
+
+    struct Interval
+    {
+        quint64 received;
+        quint64 sent;
+    };
+
+    // DaemonState::connectionState
+    QString connectionState;
+    // DaemonState::bytesReceived / bytesSent
+    quint64 bytesReceived;
+    quint64 bytesSent;
+    // DaemonState::forwardedPort (including the PortForwardState values)
+    int forwardedPort;
+    // The last intervalCount values of DaemonState::intervalMeasurements,
+    // oldest first
+    std::size_t intervalCount;
+    std::array<Interval, MaxIntervals> intervals;
+};
+
+// The daemon's side of the state channel.  The shared memory is created when
+// the writer is constructed and removed when it's destroyed.
+class COMMON_EXPORT StateChannelWriter
+{
+    CLASS_LOGGING_CATEGORY("statechannel")
+
+public:
+    StateChannelWriter();
+    ~StateChannelWriter();
+
+private:
+    StateChannelWriter(const StateChannelWriter &) = delete;
+    StateChannelWriter &operator=(const StateChannelWriter &) = delete;
+
+public:
+    bool isOpen() const {return _pImage;}
+    // Publish new values.  Does nothing if the channel isn't open.
+    void write(const StateChannelValues &values);
+
+private:
+    StateChannelImage *_pImage;
+};
+
+// A client's side of the state channel.  The shared memory is mapped the
+// first time read() is called (and again after close()), so the reader can be
+// created before the daemon is running.
+class COMMON_EXPORT StateChannelReader
+{
+    CLASS_LOGGING_CATEGORY("statechannel")
+
+public:
+    StateChannelReader();
+    ~StateChannelReader();
+
+private:
+    StateChannelReader(const StateChannelReader &) = delete;
+    StateChannelReader &operator=(const StateChannelReader &) = delete;
+
+public:
+    // Read the current values.  Returns false if the channel isn't available
+    // (the daemon isn't running, or this platform doesn't support it), or if
+    // a consistent image couldn't be read because the daemon was writing
+    // continuously.
+    bool read(StateChannelValues &values);
+    // Unmap the shared memory.  A new daemon creates a new image, so this is
+    // called when the daemon connection is lost; the next read() maps the new
+    // one.
+    void close();
+
+private:
+    const StateChannelImage *_pImage;
+};
+
+#endif
@@ -22,12 +22,71 @@
 #ifndef THREAD_H
 #define THREAD_H
 
+#include "async.h"
 #include <QObject>
 #include <QThread>
+#include <memory>
+#include <type_traits>
+
+namespace impl
+{
+    template<class Result>
+    struct TaskInvoker
+    {
+        template<class Func>
+        static void invoke(Func &f, Async<Result> &pTask)
+        {
+            Result result = f();
+            QObject *pTaskObject = pTask.get();
+            QMetaObject::invokeMethod(pTaskObject, [pTask = std::move(pTask), result]()
+                                      {pTask->resolve(result);},
+                                      Qt::ConnectionType::QueuedConnection);
+        }
+    };
+
+    template<>
+    struct TaskInvoker<void>
+    {
+        template<class Func>
+        static void invoke(Func &f, Async<void> &pTask)
+        {
+            f();
+            QObject *pTaskObject = pTask.get();
+            QMetaObject::invokeMethod(pTaskObject, [pTask = std::move(pTask)]()
+                                      {pTask->resolve();},
+                                      Qt::ConnectionType::QueuedConnection);
+        }
+    };
+}
+
+// Invoke a functor on the current (worker) thread and deliver its result to a
+// task owned by another thread.  The task is resolved with the functor's
+// result, or rejected if it throws an Error.  The task is resolved by a queued
+// call on the task's own thread, since Tasks aren't thread-safe.
+//
+// pTask's reference is handed over to the queued call, so the task is never
+// released on the worker thread.
+template<class Func, class Result>
+void invokeForTask(Func &f, Async<Result> &pTask)
+{
+    try
+    {
+        // Only moves from pTask if f() returns normally
+        impl::TaskInvoker<Result>::invoke(f, pTask);
+    }
+    catch(const Error &error)
+    {
+        QObject *pTaskObject = pTask.get();
+        QMetaObject::invokeMethod(pTaskObject, [pTask = std::move(pTask), error]()
+                                  {pTask->reject(error);},
+                                  Qt::ConnectionType::QueuedConnection);
+    }
+}
 
 // RunningWorkerThread is a thread with a Qt event loop that is started and
 // stopped automatically. The caller can invoke a functor on the thread
-// synchronously by calling invokeOnThread().
+// synchronously by calling invokeOnThread(), or asynchronously with
+// invokeOnThreadAsync() / queueOnThread().
 class COMMON_EXPORT RunningWorkerThread : public QObject
 {
     Q_OBJECT
@@ -48,6 +107,27 @@ public:
         // invokeOnThread(), so it may not be valid at this point.
     }
 
+    // Invoke a functor asynchronously on the worker thread, and get its result
+    // with an Async<T> (Async<void> if the functor doesn't return anything).
+    // The task is resolved on the calling thread, which must have an event
+    // loop.  If the functor throws an Error, the task is rejected with it.
+    //
+    // Unlike invokeOnThread(), this doesn't stall the calling thread if the
+    // worker is busy.  The same caveats apply to captured state as for
+    // queueOnThread().
+    template<class Func, class Result = std::decay_t<decltype(std::declval<Func&>()())>>
+    Async<Result> invokeOnThreadAsync(Func f)
+    {
+        // The task lives on the calling thread; Tasks aren't thread-safe, so
+        // it's only ever resolved there (see invokeForTask()).
+        auto pTask = Async<Result>::create();
+        queueOnThread([pTask, f = std::move(f)]() mutable
+        {
+            invokeForTask(f, pTask);
+        });
+        return pTask;
+    }
+
     // Queue a functor to be invoked asynchronously on the worker thread.
     // Be careful with the state captured by the functor
     // - it must remain valid until either the functor completes or the thread
@@ -82,4 +162,43 @@ private:
     QObject *pThreadObject;
 };
 
+// SharedSnapshot publishes an immutable value from one thread (usually the
+// main thread) to any number of reader threads.  The publisher replaces the
+// whole value; readers take a reference to the current value and can keep
+// using it for as long as they need, even if a new value is published in the
+// meantime (the old value is destroyed when the last reader releases it).
+//
+// Readers never wait for the publisher or make cross-thread calls to get the
+// current value, but they only see a new value once it's published, so they
+// should load it each time they start a new operation rather than holding it
+// indefinitely.
+template<class T>
+class SharedSnapshot
+{
+public:
+    // Get the current value - nullptr if nothing has been published yet.
+    std::shared_ptr<const T> get() const
+    {
+        return std::atomic_load_explicit(&_pValue, std::memory_order_acquire);
+    }
+
+    // Publish a new value.  Once this returns, get() returns the new value on
+    // all threads.
+    void publish(T value)
+    {
+        std::shared_ptr<const T> pValue{std::make_shared<const T>(std::move(value))};
+        std::atomic_store_explicit(&_pValue, std::move(pValue), std::memory_order_release);
+    }
+
+    // Clear the value; get() returns nullptr again.
+    void clear()
+    {
+        std::atomic_store_explicit(&_pValue, std::shared_ptr<const T>{}, std::memory_order_release);
+    }
+
+private:
+    // Only accessed with the std::atomic_*() overloads for shared_ptr
+    std::shared_ptr<const T> _pValue;
+};
+
 #endif
@@ -0,0 +1,226 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("tracing.cpp")
+
+#include "tracing.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+namespace
+{
+    struct TraceEvent
+    {
+        char phase;
+        const char *category;
+        QString name;
+        qint64 timestamp;
+        qint64 duration;
+        quint64 id;
+        int threadId;
+    };
+
+    // Chrome traces identify threads with small integers; the native thread
+    // IDs can't be represented exactly in JSON on all platforms.  Just number
+    // threads in the order they first trace something.
+    int currentTraceThreadId()
+    {
+        static std::atomic<int> nextThreadId{1};
+        thread_local int threadId = nextThreadId++;
+        return threadId;
+    }
+
+    class TraceBuffer
+    {
+    public:
+        TraceBuffer() : _next{0} {_events.reserve(Tracer::DefaultCapacity);}
+
+    public:
+        void add(TraceEvent event)
+        {
+            event.threadId = currentTraceThreadId();
+
+            QMutexLocker lock{&_mutex};
+            if(_events.size() < _capacity)
+                _events.push_back(std::move(event));
+            else
+            {
+                _events[_next] = std::move(event);
+                _next = (_next + 1) % _capacity;
+            }
+        }
+
+        // Get the events in chronological order
+        QVector<TraceEvent> events() const
+        {
+            QMutexLocker lock{&_mutex};
+            QVector<TraceEvent> ordered;
+            ordered.reserve(_events.size());
+            for(int i=_next; i<_events.size(); ++i)
+                ordered.push_back(_events[i]);
+            for(int i=0; i<_next; ++i)
+                ordered.push_back(_events[i]);
+            return ordered;
+        }
+
+        void reset(int capacity)
+        {
+            QMutexLocker lock{&_mutex};
+            _events.clear();
+            _events.reserve(capacity);
+            _capacity = std::max(capacity, 1);
+            _next = 0;
+        }
+
+    private:
+        mutable QMutex _mutex;
+        QVector<TraceEvent> _events;
+        int _capacity{Tracer::DefaultCapacity};
+        // Once the buffer is full, the index of the oldest event (which is
+        // replaced by the next event)
+        int _next;
+    };
+
+    TraceBuffer &traceBuffer()
+    {
+        static TraceBuffer buffer;
+        return buffer;
+    }
+}
+
+qint64 Tracer::now()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::complete(const char *category, const QString &name,
+                      qint64 start, qint64 duration)
+{
+    traceBuffer().add({'X', category, name, start, duration, 0, 0});
+}
+
+void Tracer::instant(const char *category, const QString &name)
+{
+    traceBuffer().add({'i', category, name, now(), 0, 0, 0});
+}
+
+void Tracer::asyncBegin(const char *category, const QString &name, quint64 id)
+{
+    traceBuffer().add({'b', category, name, now(), 0, id, 0});
+}
+
+void Tracer::asyncEnd(const char *category, const QString &name, quint64 id)
+{
+    traceBuffer().add({'e', category, name, now(), 0, id, 0});
+}
+
+QJsonObject Tracer::chromeTrace()
+{
+    const auto pid = QCoreApplication::applicationPid();
+
+    QJsonArray traceEvents;
+    // Name the process so client and daemon traces can be told apart when
+    // loaded together
+    QString processName = QCoreApplication::applicationName();
+    if(processName.isEmpty())
+        processName = QFileInfo{QCoreApplication::applicationFilePath()}.fileName();
+    traceEvents.push_back(QJsonObject{
+        {QStringLiteral("ph"), QStringLiteral("M")},
+        {QStringLiteral("name"), QStringLiteral("process_name")},
+        {QStringLiteral("pid"), pid},
+        {QStringLiteral("args"), QJsonObject{{QStringLiteral("name"), processName}}}
+    });
+
+    for(const auto &event : traceBuffer().events())
+    {
+        QJsonObject eventObj{
+            {QStringLiteral("ph"), QString{QLatin1Char{event.phase}}},
+            {QStringLiteral("cat"), QLatin1String{event.category}},
+            {QStringLiteral("name"), event.name},
+            {QStringLiteral("ts"), event.timestamp},
+            {QStringLiteral("pid"), pid},
+            {QStringLiteral("tid"), event.threadId}
+        };
+        switch(event.phase)
+        {
+            case 'X':
+                eventObj.insert(QStringLiteral("dur"), event.duration);
+                break;
+            case 'i':
+                // Thread-scoped instant
+                eventObj.insert(QStringLiteral("s"), QStringLiteral("t"));
+                break;
+            case 'b':
+            case 'e':
+                // IDs are strings so they're exact regardless of size
+                eventObj.insert(QStringLiteral("id"), QString::number(event.id));
+                break;
+        }
+        traceEvents.push_back(eventObj);
+    }
+
+    return {
+        {QStringLiteral("traceEvents"), traceEvents},
+        {QStringLiteral("displayTimeUnit"), QStringLiteral("ms")}
+    };
+}
+
+bool Tracer::writeChromeTrace(const QString &path)
+{
+    QFile traceFile{path};
+    if(!traceFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qWarning() << "Unable to write trace to" << path << "-"
+            << traceFile.errorString();
+        return false;
+    }
+    traceFile.write(QJsonDocument{chromeTrace()}.toJson(QJsonDocument::Compact));
+    return true;
+}
+
+QString Tracer::diagnosticsTracePath(const QString &diagFile)
+{
+    QFileInfo diagInfo{diagFile};
+    return diagInfo.dir().filePath(diagInfo.completeBaseName() + QStringLiteral("_trace.json"));
+}
+
+void Tracer::reset(int capacity)
+{
+    traceBuffer().reset(capacity);
+}
+
+TraceSpan::TraceSpan(const char *category, QString name)
+    : _category{category}, _name{std::move(name)}, _start{Tracer::now()}
+{
+}
+
+TraceSpan::~TraceSpan()
+{
+    Tracer::complete(_category, _name, _start, Tracer::now() - _start);
+}
@@ -0,0 +1,96 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("tracing.h")
+
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <QJsonObject>
+
+// Tracer records a timeline of named events - spans, instants, and async
+// spans - in a fixed-size ring buffer.  This is cheap enough to leave enabled
+// all the time, and is intended for coarse events like startup steps and
+// connection attempts, not per-message tracing.
+//
+// The timeline is exported in the Chrome trace event format, which can be
+// loaded in chrome://tracing or Perfetto.  Timestamps are in microseconds on
+// the system monotonic clock, which is system-wide on all supported
+// platforms, so client and daemon traces line up when loaded together.
+//
+// All methods are thread-safe.
+class COMMON_EXPORT Tracer
+{
+public:
+    enum : int { DefaultCapacity = 4096 };
+
+public:
+    // Current timestamp (microseconds on the system monotonic clock)
+    static qint64 now();
+
+    // Record a complete span that started at 'start' and lasted 'duration'
+    // microseconds.  Usually TraceSpan is used instead.
+    static void complete(const char *category, const QString &name,
+                         qint64 start, qint64 duration);
+    // Record an instant event
+    static void instant(const char *category, const QString &name);
+    // Begin or end an async span - a span that isn't tied to one scope or
+    // thread.  The begin and end are matched by category, name and ID.
+    static void asyncBegin(const char *category, const QString &name, quint64 id);
+    static void asyncEnd(const char *category, const QString &name, quint64 id);
+
+    // Build a Chrome trace document containing the events currently in the
+    // buffer, oldest first.
+    static QJsonObject chromeTrace();
+    // Write chromeTrace() to a file.  Returns false (and traces a warning) if
+    // the file can't be written.
+    static bool writeChromeTrace(const QString &path);
+
+    // Path of the trace file that accompanies a diagnostics file - the daemon
+    // writes its trace here when writing diagnostics, and the client picks it
+    // up from here when starting the support tool.
+    static QString diagnosticsTracePath(const QString &diagFile);
+
+    // Discard all events and set the buffer capacity (used by unit tests)
+    static void reset(int capacity = DefaultCapacity);
+};
+
+// TraceSpan records a complete span covering its own lifetime.
+//
+//   void Daemon::start()
+//   {
+//       TraceSpan span{"daemon", QStringLiteral("Daemon::start")};
+//       ...
+//   }
+class COMMON_EXPORT TraceSpan
+{
+public:
+    TraceSpan(const char *category, QString name);
+    ~TraceSpan();
+
+private:
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const char *_category;
+    QString _name;
+    qint64 _start;
+};
+
+#endif
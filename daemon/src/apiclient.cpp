@@ -45,6 +45,10 @@ namespace
     // it should normally be at least apiBaseUris.size()
     const int apiAttempts{4};
 
+    // If an attempt for a retriable request hasn't finished after this long,
+    // begin another attempt on the next API base URI alongside it.
+    const std::chrono::milliseconds apiHedgeDelay{1500};
+
     static inline QJsonDocument parseJsonBody(const QByteArray& body)
     {
         QJsonParseError parseError;
@@ -67,27 +71,67 @@ ApiClient::ApiClient()
 Async<QByteArray> ApiClient::requestRetry(QNetworkAccessManager::Operation verb,
                                           ApiBase &apiBaseUris, const QString &apiPath,
                                           QString resource, unsigned maxAttempts,
-                                          const QJsonDocument &data, QByteArray auth)
+                                          const QJsonDocument &data, QByteArray auth,
+                                          std::chrono::milliseconds hedgeDelay)
 {
     return requestRetry(verb, apiBaseUris, apiPath, std::move(resource),
-                        ApiRetries::counted(maxAttempts), data,
-                        std::move(auth));
+                        ApiRetries::counted(maxAttempts),
+                        QStringLiteral("counted-%1").arg(maxAttempts), data,
+                        std::move(auth), hedgeDelay);
 }
 
 Async<QByteArray> ApiClient::requestRetry(QNetworkAccessManager::Operation verb,
                                           ApiBase &apiBaseUris, const QString &apiPath,
                                           QString resource,
                                           std::unique_ptr<ApiRetry> pRetryStrategy,
-                                          const QJsonDocument &data, QByteArray auth)
+                                          const QString &retryKey,
+                                          const QJsonDocument &data, QByteArray auth,
+                                          std::chrono::milliseconds hedgeDelay)
 {
     QString apiResource = apiPath + resource;
 
+    // Share an identical GET if one is in flight.  The ApiBase is identified
+    // by address, they're static objects.
+    QString flightKey;
+    if(verb == QNetworkAccessManager::Operation::GetOperation)
+    {
+        flightKey = QStringLiteral("%1 %2 %3 %4")
+            .arg(reinterpret_cast<quintptr>(&apiBaseUris))
+            .arg(retryKey, apiResource, QString::fromLatin1(auth.toBase64()));
+        Async<QByteArray> pInFlight{_inFlightGets.value(flightKey).toStrongRef()};
+        if(pInFlight && pInFlight->isPending())
+        {
+            qInfo() << "Sharing in-flight request for" << ApiResource{apiResource};
+            return pInFlight;
+        }
+    }
+
     // Create a retriable task to fetch the response body
-    return Async<NetworkTaskWithRetry>::create(verb, apiBaseUris,
+    Async<QByteArray> pRequest = Async<NetworkTaskWithRetry>::create(verb, apiBaseUris,
                                                apiResource,
                                                std::move(pRetryStrategy),
                                                data,
-                                               std::move(auth));
+                                               std::move(auth),
+                                               hedgeDelay);
+
+    if(!flightKey.isEmpty())
+    {
+        _inFlightGets.insert(flightKey, pRequest);
+        // Remove the entry once the request finishes (unless it has been
+        // replaced already)
+        connect(pRequest.get(), &BaseTask::finished, this,
+                [this, flightKey, pTask = pRequest.get()]()
+                {
+                    auto itFlight = _inFlightGets.find(flightKey);
+                    if(itFlight != _inFlightGets.end() &&
+                       (itFlight->isNull() || itFlight->data() == pTask))
+                    {
+                        _inFlightGets.erase(itFlight);
+                    }
+                });
+    }
+
+    return pRequest;
 }
 
 Async<QJsonDocument> ApiClient::get(QString resource, QByteArray auth)
@@ -103,7 +147,7 @@ Async<QJsonDocument> ApiClient::getRetry(QString resource, QByteArray auth)
 {
     return requestRetry(QNetworkAccessManager::Operation::GetOperation,
                         ApiBases::piaApi, apiBasePath, std::move(resource),
-                        apiAttempts, {}, std::move(auth))
+                        apiAttempts, {}, std::move(auth), apiHedgeDelay)
             ->then(parseJsonBody);
 }
 
@@ -119,9 +163,13 @@ Async<QJsonDocument> ApiClient::getIp(QString resource, QByteArray auth)
 
 Async<QJsonDocument> ApiClient::getIpRetry(QString resource, QByteArray auth)
 {
+    // There's only one base URI for this request, so back off after the
+    // first attempt.
     return requestRetry(QNetworkAccessManager::Operation::GetOperation,
                         ApiBases::piaIpAddrApi, apiBasePath,
-                        std::move(resource), apiAttempts,
+                        std::move(resource),
+                        ApiRetries::backoff(apiAttempts, ApiBases::piaIpAddrApi.getUriCount()),
+                        QStringLiteral("backoff-%1").arg(apiAttempts),
                         {}, std::move(auth))
             ->then(parseJsonBody);
 }
@@ -131,7 +179,7 @@ Async<QJsonDocument> ApiClient::getVpnIpRetry(QString resource, QByteArray auth)
     return requestRetry(QNetworkAccessManager::Operation::GetOperation,
                         ApiBases::piaIpAddrApi, apiBasePath,
                         std::move(resource), ApiRetries::timed(std::chrono::minutes{10}),
-                        {}, std::move(auth))
+                        QStringLiteral("timed-10m"), {}, std::move(auth))
             ->then(parseJsonBody);
 }
 
@@ -149,7 +197,7 @@ Async<QJsonDocument> ApiClient::postRetry(QString resource, const QJsonDocument
     return requestRetry(QNetworkAccessManager::Operation::PostOperation,
                         ApiBases::piaApi, apiBasePath,
                         std::move(resource), apiAttempts,
-                        data, std::move(auth))
+                        data, std::move(auth), apiHedgeDelay)
             ->then(parseJsonBody);
 }
 
@@ -165,7 +213,7 @@ Async<void> ApiClient::headRetry(QString resource, QByteArray auth)
 {
     return requestRetry(QNetworkAccessManager::Operation::HeadOperation,
                         ApiBases::piaApi, apiBasePath, std::move(resource),
-                        apiAttempts, {}, std::move(auth));
+                        apiAttempts, {}, std::move(auth), apiHedgeDelay);
 }
 
 Async<QJsonDocument> ApiClient::getForwardedPort(QString resource, QByteArray auth)
@@ -176,7 +224,7 @@ Async<QJsonDocument> ApiClient::getForwardedPort(QString resource, QByteArray au
     return requestRetry(QNetworkAccessManager::Operation::GetOperation,
                         ApiBases::piaPortForwardApi, QString{},
                         std::move(resource), ApiRetries::timed(std::chrono::minutes{3}),
-                        {}, std::move(auth))
+                        QStringLiteral("timed-3m"), {}, std::move(auth))
             ->then(parseJsonBody);
 }
 
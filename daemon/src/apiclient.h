@@ -27,8 +27,10 @@
 #include "apiretry.h"
 #include <QJsonDocument>
 #include <QNetworkReply>
+#include <QHash>
 #include <QPointer>
 #include <QSharedPointer>
+#include <chrono>
 #include <memory>
 
 // ApiClient is used to make requests to the PrivateInternetAccess client API.
@@ -44,19 +46,28 @@ public:
 
 private:
     // Create tasks to issue a request with retries and return its body (with
-    // a counted retry strategy)
+    // a counted retry strategy).  If hedgeDelay is nonzero, attempts are
+    // hedged across the base URIs (see NetworkTaskWithRetry).
     Async<QByteArray> requestRetry(QNetworkAccessManager::Operation verb,
                                    ApiBase &apiBaseUris, const QString &apiPath,
                                    QString resource, unsigned maxAttempts,
-                                   const QJsonDocument &data, QByteArray auth);
+                                   const QJsonDocument &data, QByteArray auth,
+                                   std::chrono::milliseconds hedgeDelay = {});
 
     // Create tasks to issue a request with retries and return its body (with
-    // any retry strategy)
+    // any retry strategy).
+    //
+    // GET requests are shared - if an identical GET is already in flight, its
+    // task is returned instead of issuing another request.  Requests are
+    // identical if they use the same API base, resource, auth, and retry
+    // strategy; retryKey describes the retry strategy for that purpose.
     Async<QByteArray> requestRetry(QNetworkAccessManager::Operation verb,
                                    ApiBase &apiBaseUris, const QString &apiPath,
                                    QString resource,
                                    std::unique_ptr<ApiRetry> pRetryStrategy,
-                                   const QJsonDocument &data, QByteArray auth);
+                                   const QString &retryKey,
+                                   const QJsonDocument &data, QByteArray auth,
+                                   std::chrono::milliseconds hedgeDelay = {});
 
 public:
     // Get an API resource, such as "geo" or "status".
@@ -72,7 +83,9 @@ public:
     // does not necessarily mean that the credentials were valid for all
     // requests.
     Async<QJsonDocument> get(QString resource, QByteArray auth = {});
-    // GET with retry.
+    // GET with retry.  The retry variants of get(), post(), and head() hedge
+    // their attempts across the API base URIs, so a blocked API host doesn't
+    // hold up the request until it times out.
     Async<QJsonDocument> getRetry(QString resource, QByteArray auth = {});
 
     // Do a GET request for a particular API resource that returns the user's
@@ -112,6 +125,10 @@ private:
     // Index of the last API base URL that was successful (used to start from
     // that base next time).
     unsigned _nextApiBaseUrl;
+    // GET requests that are in flight, keyed by the API base, resource, auth,
+    // and retry strategy.  These are weak references, the requests are
+    // abandoned normally if all of their consumers abandon them.
+    QHash<QString, QWeakPointer<Task<QByteArray>>> _inFlightGets;
 };
 
 
@@ -0,0 +1,150 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("commandexecutor.cpp")
+
+#include "commandexecutor.h"
+
+CommandExecutor::CommandExecutor(int maxConcurrent)
+    : _maxConcurrent{maxConcurrent}
+{
+    Q_ASSERT(_maxConcurrent > 0);
+}
+
+CommandExecutor::~CommandExecutor()
+{
+    // Kill anything still running.  Disconnect first so the finished()
+    // signal from the kill doesn't reenter finishCommand().
+    auto running = _running;
+    _running.clear();
+    for(auto itRunning = running.begin(); itRunning != running.end(); ++itRunning)
+    {
+        UidGidProcess *pProcess = itRunning.key();
+        pProcess->disconnect(this);
+        qWarning() << "Killing" << pProcess->program() << "- executor is shutting down";
+        pProcess->kill();
+        pProcess->waitForFinished(1000);
+        CommandResult result;
+        result.error = QProcess::Crashed;
+        itRunning.value()->pResult->resolve(std::move(result));
+        delete itRunning.value();
+        delete pProcess;
+    }
+
+    while(!_queue.isEmpty())
+    {
+        CommandResult result;
+        result.error = QProcess::FailedToStart;
+        _queue.dequeue().pResult->resolve(std::move(result));
+    }
+}
+
+Async<CommandResult> CommandExecutor::run(Command command)
+{
+    auto pResult = Async<CommandResult>::create();
+    _queue.enqueue({std::move(command), pResult});
+    startPending();
+    return pResult;
+}
+
+Async<CommandResult> CommandExecutor::run(const QString &program, const QStringList &arguments)
+{
+    Command command;
+    command.program = program;
+    command.arguments = arguments;
+    return run(std::move(command));
+}
+
+void CommandExecutor::startPending()
+{
+    while(_running.size() < _maxConcurrent && !_queue.isEmpty())
+        startCommand(_queue.dequeue());
+}
+
+void CommandExecutor::startCommand(PendingCommand pending)
+{
+    UidGidProcess *pProcess = new UidGidProcess;
+    RunningCommand *pRunning = new RunningCommand;
+    pRunning->pResult = pending.pResult;
+    _running.insert(pProcess, pRunning);
+
+    pProcess->setProgram(pending.command.program);
+    pProcess->setArguments(pending.command.arguments);
+#ifdef Q_OS_WIN
+    if(!pending.command.nativeArguments.isEmpty())
+        pProcess->setNativeArguments(pending.command.nativeArguments);
+#endif
+    pProcess->setUser(pending.command.user);
+    pProcess->setGroup(pending.command.group);
+
+    pRunning->timeout.setSingleShot(true);
+    pRunning->timeout.setInterval(msec32(pending.command.timeout));
+    connect(&pRunning->timeout, &QTimer::timeout, this, [pProcess, pRunning]()
+    {
+        qWarning() << "Command" << pProcess->program() << "timed out, killing it";
+        pRunning->timedOut = true;
+        pProcess->kill();
+        // finished() is emitted once it exits
+    });
+
+    connect(pProcess, &QProcess::errorOccurred, this, [this, pProcess](QProcess::ProcessError error)
+    {
+        // Most errors are followed by finished(), but a failure to start
+        // isn't
+        if(error == QProcess::FailedToStart)
+        {
+            qWarning() << "Failed to start" << pProcess->program() << "-"
+                << pProcess->errorString();
+            CommandResult result;
+            result.error = error;
+            finishCommand(pProcess, std::move(result));
+        }
+    });
+    connect(pProcess, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this,
+        [this, pProcess, pRunning](int exitCode, QProcess::ExitStatus exitStatus)
+        {
+            CommandResult result;
+            if(pRunning->timedOut)
+                result.error = QProcess::Timedout;
+            else if(exitStatus == QProcess::NormalExit)
+                result.exitCode = exitCode;
+            else
+                result.error = QProcess::Crashed;
+            result.standardOutput = pProcess->readAllStandardOutput();
+            result.standardError = pProcess->readAllStandardError();
+            finishCommand(pProcess, std::move(result));
+        });
+
+    pProcess->start(QProcess::ReadOnly);
+    pProcess->closeWriteChannel();
+    pRunning->timeout.start();
+}
+
+void CommandExecutor::finishCommand(UidGidProcess *pProcess, CommandResult result)
+{
+    RunningCommand *pRunning = _running.take(pProcess);
+    if(!pRunning)
+        return; // Already finished
+    pRunning->pResult->resolve(std::move(result));
+    delete pRunning;
+    // The process is still emitting a signal, delete it later
+    pProcess->deleteLater();
+
+    startPending();
+}
@@ -0,0 +1,123 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("commandexecutor.h")
+
+#ifndef COMMANDEXECUTOR_H
+#define COMMANDEXECUTOR_H
+
+#include "async.h"
+#include "processrunner.h"
+#include <QQueue>
+#include <chrono>
+
+// Result of a command run by CommandExecutor.
+struct CommandResult
+{
+    // The exit code; -1 if the process didn't exit normally (it couldn't be
+    // started, crashed, or timed out), like waitForExitCode().
+    int exitCode{-1};
+    // The error that occurred, if the process didn't exit normally.
+    // QProcess::UnknownError if there was no error.
+    QProcess::ProcessError error{QProcess::UnknownError};
+    QByteArray standardOutput;
+    QByteArray standardError;
+
+    bool succeeded() const {return exitCode == 0;}
+};
+
+// CommandExecutor runs short-lived helper commands asynchronously, without
+// waiting for them on the calling thread.  Each command is started with
+// UidGidProcess, so a user and group can be specified for the command.
+//
+// Up to maxConcurrent commands run at once; more commands are queued and
+// started in order as running commands finish.  Independent commands can be
+// started together to run concurrently; commands that depend on each other
+// should be chained with Async::next() instead.
+//
+// The result task always resolves (it isn't rejected if the command fails),
+// check CommandResult for the command's result.
+class CommandExecutor : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("commandexecutor")
+
+public:
+    struct Command
+    {
+        QString program;
+        QStringList arguments;
+#ifdef Q_OS_WIN
+        // On Windows, the complete command line can be set instead of
+        // 'arguments'; QProcess::start() explains this in detail.
+        QString nativeArguments;
+#endif
+        // User and group to run the command as; the daemon's user and group
+        // if empty.  (Only supported on Unix.)
+        QString user;
+        QString group;
+        // The command is killed if it doesn't finish within the timeout.
+        std::chrono::milliseconds timeout{std::chrono::seconds{30}};
+    };
+
+private:
+    struct PendingCommand
+    {
+        Command command;
+        Async<CommandResult> pResult;
+    };
+
+    struct RunningCommand
+    {
+        Async<CommandResult> pResult;
+        QTimer timeout;
+        bool timedOut{false};
+    };
+
+public:
+    explicit CommandExecutor(int maxConcurrent);
+    // Running commands are killed; their results resolve with
+    // QProcess::Crashed.  Queued commands resolve with FailedToStart.
+    ~CommandExecutor();
+
+private:
+    // Start queued commands if there's room
+    void startPending();
+    void startCommand(PendingCommand pending);
+    // Resolve a running command's result and clean it up
+    void finishCommand(UidGidProcess *pProcess, CommandResult result);
+
+public:
+    // Run a command.  The result task can be abandoned; the command still
+    // runs until it exits.
+    Async<CommandResult> run(Command command);
+    // Shortcut to run a command with just a program and arguments
+    Async<CommandResult> run(const QString &program, const QStringList &arguments);
+
+    int runningCount() const {return _running.size();}
+    int queuedCount() const {return _queue.size();}
+
+private:
+    const int _maxConcurrent;
+    // The running commands - owns the processes and RunningCommand objects
+    QHash<UidGidProcess*, RunningCommand*> _running;
+    QQueue<PendingCommand> _queue;
+};
+
+#endif
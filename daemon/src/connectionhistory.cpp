@@ -0,0 +1,314 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("connectionhistory.cpp")
+
+#include "connectionhistory.h"
+#include <QDateTime>
+#include <QHash>
+#include <QJsonObject>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+    const quint32 historyMagic = 0x48434950; // 'PICH'
+    const quint16 historyVersion = 1;
+
+    // Copy a string into a fixed-size NUL-padded field
+    template<std::size_t N>
+    void storeString(char (&field)[N], const QString &value)
+    {
+        QByteArray bytes = value.toUtf8();
+        std::memset(field, 0, N);
+        std::memcpy(field, bytes.data(), std::min<std::size_t>(N, bytes.size()));
+    }
+
+    template<std::size_t N>
+    QString loadString(const char (&field)[N])
+    {
+        return QString::fromUtf8(field, static_cast<int>(::strnlen(field, N)));
+    }
+
+    QString endReasonName(ConnectionHistory::EndReason reason)
+    {
+        switch(reason)
+        {
+        case ConnectionHistory::EndReason::InProgress:
+            return QStringLiteral("inProgress");
+        case ConnectionHistory::EndReason::Disconnected:
+            return QStringLiteral("disconnected");
+        case ConnectionHistory::EndReason::Reconnected:
+            return QStringLiteral("reconnected");
+        case ConnectionHistory::EndReason::ConnectionLost:
+            return QStringLiteral("connectionLost");
+        default:
+        case ConnectionHistory::EndReason::Unknown:
+            return QStringLiteral("unknown");
+        }
+    }
+}
+
+ConnectionHistory::ConnectionHistory(QString filePath)
+    : _filePath{std::move(filePath)}, _openAttempted{false},
+      _pHeader{nullptr}, _pRecords{nullptr}, _activeIndex{-1},
+      _baseReceivedBytes{0}, _baseSentBytes{0}
+{
+}
+
+bool ConnectionHistory::open()
+{
+    if(_openAttempted)
+        return _pHeader;
+    _openAttempted = true;
+
+    const qint64 fileSize = sizeof(FileHeader) + qint64{Capacity} * sizeof(Record);
+
+    _file.setFileName(_filePath);
+    if(!_file.open(QIODevice::ReadWrite))
+    {
+        qWarning() << "Can't open connection history" << _filePath << "-"
+            << _file.errorString();
+        return false;
+    }
+
+    // Check the existing header, if there is one
+    bool valid = false;
+    if(_file.size() == fileSize)
+    {
+        FileHeader header;
+        if(_file.read(reinterpret_cast<char*>(&header), sizeof(header)) == sizeof(header) &&
+           header.magic == historyMagic && header.version == historyVersion &&
+           header.recordSize == sizeof(Record) && header.capacity == Capacity &&
+           header.next < Capacity && header.count <= Capacity)
+        {
+            valid = true;
+        }
+    }
+
+    if(!valid)
+    {
+        qInfo() << "Creating new connection history file" << _filePath;
+        // Truncate first so the records are zero-filled when resized
+        if(!_file.resize(0) || !_file.resize(fileSize))
+        {
+            qWarning() << "Can't resize connection history -" << _file.errorString();
+            _file.close();
+            return false;
+        }
+    }
+
+    uchar *pData = _file.map(0, fileSize);
+    if(!pData)
+    {
+        qWarning() << "Can't map connection history -" << _file.errorString();
+        _file.close();
+        return false;
+    }
+
+    _pHeader = reinterpret_cast<FileHeader*>(pData);
+    _pRecords = pData + sizeof(FileHeader);
+
+    if(!valid)
+    {
+        *_pHeader = {};
+        _pHeader->magic = historyMagic;
+        _pHeader->version = historyVersion;
+        _pHeader->recordSize = sizeof(Record);
+        _pHeader->capacity = Capacity;
+    }
+    else
+    {
+        // Any session still in progress was left by a prior daemon that
+        // didn't end it
+        for(quint32 i=0; i<_pHeader->count; ++i)
+        {
+            Record &record = recordAt(i);
+            if(record.endReason == EndReason::InProgress)
+                record.endReason = EndReason::Unknown;
+        }
+    }
+
+    qInfo() << "Opened connection history with" << _pHeader->count << "sessions";
+    return true;
+}
+
+auto ConnectionHistory::recordAt(quint32 index) const -> Record &
+{
+    Q_ASSERT(_pRecords);
+    Q_ASSERT(index < Capacity);
+    return reinterpret_cast<Record*>(_pRecords)[index];
+}
+
+void ConnectionHistory::beginSession(const QString &regionId,
+                                     const QString &protocol, quint16 port,
+                                     const PhaseTimes &phaseTimes,
+                                     quint64 receivedBytes, quint64 sentBytes)
+{
+    if(!open())
+        return;
+
+    if(_activeIndex >= 0)
+        endSession(EndReason::Unknown);
+
+    quint32 index = _pHeader->next;
+    Record &record = recordAt(index);
+    record = {};
+    record.startTime = QDateTime::currentMSecsSinceEpoch();
+    record.endTime = record.startTime;
+    for(int i=0; i<PhaseCount; ++i)
+    {
+        record.phaseTimes[i] = static_cast<quint32>(
+            std::min<qint64>(std::max<qint64>(phaseTimes[i], 0),
+                             std::numeric_limits<quint32>::max()));
+    }
+    storeString(record.regionId, regionId);
+    storeString(record.protocol, protocol);
+    record.port = port;
+    record.endReason = EndReason::InProgress;
+
+    _pHeader->next = (index + 1) % Capacity;
+    if(_pHeader->count < Capacity)
+        ++_pHeader->count;
+    _activeIndex = index;
+    _baseReceivedBytes = receivedBytes;
+    _baseSentBytes = sentBytes;
+}
+
+void ConnectionHistory::updateSession(quint64 receivedBytes, quint64 sentBytes,
+                                      double peakThroughput)
+{
+    if(_activeIndex < 0)
+        return;
+
+    Record &record = recordAt(static_cast<quint32>(_activeIndex));
+    record.endTime = QDateTime::currentMSecsSinceEpoch();
+    record.receivedBytes = receivedBytes - std::min(receivedBytes, _baseReceivedBytes);
+    record.sentBytes = sentBytes - std::min(sentBytes, _baseSentBytes);
+    // The connection's peak is reset when OpenVPN restarts, keep the
+    // session's best
+    record.peakThroughput = std::max(record.peakThroughput, peakThroughput);
+}
+
+void ConnectionHistory::endSession(EndReason reason)
+{
+    if(_activeIndex < 0)
+        return;
+
+    Record &record = recordAt(static_cast<quint32>(_activeIndex));
+    record.endTime = QDateTime::currentMSecsSinceEpoch();
+    record.endReason = reason;
+    _activeIndex = -1;
+}
+
+QJsonArray ConnectionHistory::sessions(const QString &regionId,
+                                       qint64 sinceTime, int limit)
+{
+    QJsonArray result;
+    if(!open())
+        return result;
+
+    // Walk backward from the newest record
+    for(quint32 i=0; i<_pHeader->count; ++i)
+    {
+        if(limit > 0 && result.size() >= limit)
+            break;
+        const Record &record = recordAt((_pHeader->next + Capacity - 1 - i) % Capacity);
+        // Records are in start order, nothing older can match
+        if(record.startTime < sinceTime)
+            break;
+        QString recordRegion = loadString(record.regionId);
+        if(!regionId.isEmpty() && recordRegion != regionId)
+            continue;
+
+        QJsonArray phases;
+        for(int p=0; p<PhaseCount; ++p)
+            phases.push_back(static_cast<qint64>(record.phaseTimes[p]));
+        qint64 duration = record.endTime - record.startTime;
+        double averageThroughput = 0.0;
+        if(duration > 0)
+        {
+            averageThroughput = static_cast<double>(record.receivedBytes + record.sentBytes) *
+                1000.0 / duration;
+        }
+
+        result.push_back(QJsonObject{
+            {QStringLiteral("region"), recordRegion},
+            {QStringLiteral("start"), record.startTime},
+            {QStringLiteral("end"), record.endTime},
+            {QStringLiteral("protocol"), loadString(record.protocol)},
+            {QStringLiteral("port"), record.port},
+            {QStringLiteral("phaseTimes"), phases},
+            {QStringLiteral("received"), static_cast<qint64>(record.receivedBytes)},
+            {QStringLiteral("sent"), static_cast<qint64>(record.sentBytes)},
+            {QStringLiteral("averageThroughput"), averageThroughput},
+            {QStringLiteral("peakThroughput"), record.peakThroughput},
+            {QStringLiteral("endReason"), endReasonName(record.endReason)}
+        });
+    }
+    return result;
+}
+
+QJsonArray ConnectionHistory::regionSummaries(qint64 sinceTime)
+{
+    QJsonArray result;
+    if(!open())
+        return result;
+
+    struct Summary
+    {
+        int sessions;
+        int lost;
+        qint64 totalConnectTime;
+        double totalThroughput;
+    };
+    QHash<QString, Summary> summaries;
+    for(quint32 i=0; i<_pHeader->count; ++i)
+    {
+        const Record &record = recordAt((_pHeader->next + Capacity - 1 - i) % Capacity);
+        if(record.startTime < sinceTime)
+            break;
+        Summary &summary = summaries[loadString(record.regionId)];
+        ++summary.sessions;
+        if(record.endReason == EndReason::ConnectionLost)
+            ++summary.lost;
+        for(int p=0; p<PhaseCount; ++p)
+            summary.totalConnectTime += record.phaseTimes[p];
+        qint64 duration = record.endTime - record.startTime;
+        if(duration > 0)
+        {
+            summary.totalThroughput += static_cast<double>(record.receivedBytes + record.sentBytes) *
+                1000.0 / duration;
+        }
+    }
+
+    for(auto itSummary = summaries.begin(); itSummary != summaries.end(); ++itSummary)
+    {
+        const Summary &summary = itSummary.value();
+        result.push_back(QJsonObject{
+            {QStringLiteral("region"), itSummary.key()},
+            {QStringLiteral("sessions"), summary.sessions},
+            {QStringLiteral("connectionLost"), summary.lost},
+            {QStringLiteral("meanConnectTime"), static_cast<double>(summary.totalConnectTime) / summary.sessions},
+            {QStringLiteral("meanThroughput"), summary.totalThroughput / summary.sessions}
+        });
+    }
+    return result;
+}
@@ -0,0 +1,157 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("connectionhistory.h")
+
+#ifndef CONNECTIONHISTORY_H
+#define CONNECTIONHISTORY_H
+
+#include "openvpn.h"
+#include <QFile>
+#include <QJsonArray>
+#include <array>
+
+// ConnectionHistory keeps a rolling history of VPN connection sessions -
+// region, transport, connection phase timing, traffic, and how the session
+// ended - in a fixed-size binary ring file.
+//
+// The file is memory-mapped, and updates during a session (byte counts, the
+// end time) are just stores into the mapped record, so they're cheap enough to
+// do on every byte count update.  The OS writes the pages back; if the daemon
+// exits uncleanly, the open record is kept with whatever was last stored and
+// an "unknown" end reason.
+//
+// If the file can't be opened or mapped, the history is just disabled; it
+// never affects the connection itself.
+class ConnectionHistory
+{
+    CLASS_LOGGING_CATEGORY("connhistory");
+
+public:
+    // Number of sessions kept; the oldest is overwritten when it's full.
+    enum : quint32 { Capacity = 1024 };
+    // Number of connection phases timed - OpenVPN states from Connecting up to
+    // (but not including) Connected, same as VPNConnection::PhaseTimes
+    enum : int { PhaseCount = OpenVPNProcess::Connected - OpenVPNProcess::Connecting };
+    using PhaseTimes = std::array<qint64, PhaseCount>;
+
+    // How a session ended.  The values are stored in the file, don't
+    // renumber them.
+    enum class EndReason : quint8
+    {
+        // The session is still active
+        InProgress,
+        // The daemon exited without ending the session
+        Unknown,
+        // The user disconnected
+        Disconnected,
+        // The daemon reconnected to apply new settings
+        Reconnected,
+        // The connection was lost
+        ConnectionLost,
+    };
+
+private:
+    // The file starts with this header, followed by Capacity records.  The
+    // ring starts at 'next' when it's full, or at 0 otherwise.
+    struct FileHeader
+    {
+        quint32 magic;
+        quint16 version;
+        quint16 recordSize;
+        quint32 capacity;
+        quint32 next;
+        quint32 count;
+        quint32 reserved;
+    };
+
+    // A session record.  Fixed-size fields only, largest first so there's no
+    // padding between them.
+    struct Record
+    {
+        // Start and (last known) end of the session, ms since the epoch
+        qint64 startTime;
+        qint64 endTime;
+        quint64 receivedBytes;
+        quint64 sentBytes;
+        // Best interval throughput seen, bytes/second in both directions
+        double peakThroughput;
+        // Time spent in each connection phase for the attempt that connected
+        quint32 phaseTimes[PhaseCount];
+        // Region ID, NUL-padded (truncated if it's longer)
+        char regionId[32];
+        // Transport protocol, "udp" or "tcp", NUL-padded
+        char protocol[4];
+        quint16 port;
+        EndReason endReason;
+        quint8 reserved;
+    };
+
+public:
+    // The file isn't opened until it's first needed.
+    explicit ConnectionHistory(QString filePath);
+
+private:
+    // Open and map the file if it hasn't been yet.  If the file is missing or
+    // doesn't match the current format, it's recreated empty.  Returns false
+    // if the history is unavailable.
+    bool open();
+    Record &recordAt(quint32 index) const;
+
+public:
+    // Begin a new session when the VPN connects.  If a session was still
+    // active, it's ended with EndReason::Unknown.
+    //
+    // The byte counts are the connection's current totals - the session's
+    // traffic is counted from these.
+    void beginSession(const QString &regionId, const QString &protocol,
+                      quint16 port, const PhaseTimes &phaseTimes,
+                      quint64 receivedBytes, quint64 sentBytes);
+    // Update the active session with the connection's current traffic totals
+    // and peak throughput (also updates its end time).  Does nothing if no
+    // session is active.
+    void updateSession(quint64 receivedBytes, quint64 sentBytes,
+                       double peakThroughput);
+    // End the active session, if there is one.
+    void endSession(EndReason reason);
+
+    // Get stored sessions, newest first, optionally only those for one region
+    // and/or that started at or after sinceTime (ms since the epoch).  Returns
+    // at most 'limit' sessions if it's positive.
+    QJsonArray sessions(const QString &regionId, qint64 sinceTime,
+                        int limit);
+    // Summarize the stored sessions for each region (session count, sessions
+    // lost, mean connection time and throughput), for ranking regions.
+    QJsonArray regionSummaries(qint64 sinceTime);
+
+private:
+    QString _filePath;
+    QFile _file;
+    // Set once open() has been attempted, so a failure isn't retried (and
+    // logged) on every update.
+    bool _openAttempted;
+    FileHeader *_pHeader;
+    uchar *_pRecords;
+    // Index of the active session's record, or -1 if no session is active
+    qint64 _activeIndex;
+    // Connection's traffic totals when the active session began
+    quint64 _baseReceivedBytes, _baseSentBytes;
+};
+
+#endif
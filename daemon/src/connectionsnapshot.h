@@ -0,0 +1,51 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("connectionsnapshot.h")
+
+#ifndef CONNECTIONSNAPSHOT_H
+#define CONNECTIONSNAPSHOT_H
+
+#include "thread.h"
+#include <QHostAddress>
+#include <QStringList>
+
+// The parts of DaemonState describing the current VPN connection that are
+// needed by worker-thread components (the SOCKS server, etc.).  The daemon
+// publishes a new snapshot whenever these change (see
+// Daemon::publishConnectionSnapshot()), so workers can read the current values
+// directly instead of having them passed over with queued calls.
+struct ConnectionSnapshot
+{
+    // Whether the VPN is connected.  The tunnel fields are only meaningful
+    // when it is.
+    bool connected;
+    QString tunnelDeviceName;
+    QHostAddress tunnelDeviceLocalAddress;
+    QHostAddress tunnelDeviceRemoteAddress;
+    // DNS servers in use for the connection (empty if DNS is not overridden)
+    QStringList dnsServers;
+};
+
+// The current connection snapshot.  Published by the daemon on the main
+// thread; nullptr until the first snapshot is published (and in tests, where
+// there is no daemon).
+extern SharedSnapshot<ConnectionSnapshot> g_connectionSnapshot;
+
+#endif
@@ -29,6 +29,8 @@
 #include "brand.h"
 #include "util.h"
 #include "apinetwork.h"
+#include "tracing.h"
+#include "metrics.h"
 
 #include <QFile>
 #include <QNetworkReply>
@@ -39,6 +41,8 @@
 #include <QDir>
 #include <QDateTime>
 #include <QRegularExpression>
+#include <algorithm>
+#include <future>
 
 #if defined(Q_OS_WIN)
 #include <Windows.h>
@@ -46,7 +50,13 @@
 #include "win/win_util.h"
 #include <AclAPI.h>
 #include <AccCtrl.h>
+#include <Psapi.h>
 #pragma comment(lib, "advapi32.lib")
+#pragma comment(lib, "psapi.lib")
+#elif defined(Q_OS_MACOS)
+#include <mach/mach.h>
+#elif defined(Q_OS_LINUX)
+#include <unistd.h>
 #endif
 
 #ifdef Q_OS_WIN
@@ -56,6 +66,10 @@
 #pragma comment(lib, "advapi32.lib")
 #endif
 
+#ifdef Q_OS_LINUX
+#include "linux/linux_cgroups.h"
+#endif
+
 #ifndef UNIT_TEST
 // Hook global error reporting function into daemon instance
 void reportError(Error error)
@@ -75,6 +89,21 @@ namespace
     //After they're initially loaded, we refresh every 10 minutes
     const std::chrono::minutes regionsRefreshInterval{10};
 
+    // Event loop stalls longer than this are logged by the watchdog
+    const std::chrono::milliseconds eventLoopStallThreshold{500};
+
+    // Maximum number of helper commands run concurrently by _commandExecutor
+    const int maxConcurrentCommands{4};
+
+    // Weight of each new sample in the smoothed location history
+    const double locationHistoryWeight{0.3};
+    // Connections that never exceeded this throughput (bytes per second) were
+    // mostly idle; they don't say anything about the location's capacity
+    const double minRecordedThroughput{125000.0};
+
+    // Number of threads in the daemon's shared worker pool
+    const int workerPoolThreads{4};
+
     //Resource path used to retrieve regions
     const QString regionsResource{QStringLiteral("vpninfo/servers?version=1001&client=x-alpha")};
     const QString shadowsocksRegionsResource{QStringLiteral("vpninfo/shadowsocks_servers")};
@@ -91,6 +120,14 @@ namespace
         "-----END PUBLIC KEY-----"
     );
 
+    // Shadowsocks servers are probed again after this long (only when needed
+    // to pick the automatic location; see probeShadowsocksLocations())
+    const std::chrono::minutes shadowsocksProbeInterval{10};
+
+    // If the VPN IP and forwarded port aren't both available this long after
+    // connecting, the post-connect stage is reported as incomplete
+    const std::chrono::seconds postConnectDeadline{60};
+
     // Old default debug logging setting, 1.0 (and earlier) until 1.2-beta.2
     const QStringList debugLogging10{QStringLiteral("*.debug=true"),
                                      QStringLiteral("qt*.debug=false"),
@@ -103,6 +140,63 @@ namespace
                                        QStringLiteral("qt.*.debug=false"),
                                        QStringLiteral("qt.*.info=false"),
                                        QStringLiteral("qt.scenegraph.general*=true")};
+
+    // Work done by Daemon::RPC_applySettings() when specific settings change.
+    // Most subsystems observe the settings' change signals directly; these
+    // are the ones that are driven by the RPC itself.
+    enum SettingDependency : unsigned
+    {
+        ChosenLocations = 0x01,
+        LocationRanking = 0x02,
+        PortForwardLocation = 0x04,
+        PrestartShadowsocks = 0x08,
+    };
+
+    // Dependencies of each setting, keyed by the JsonField name.  Settings
+    // that aren't listed don't need any work from RPC_applySettings().
+    const QHash<QString, unsigned> &settingDependencies()
+    {
+        static const QHash<QString, unsigned> dependencies
+        {
+            {QStringLiteral("location"), SettingDependency::ChosenLocations},
+            {QStringLiteral("proxyShadowsocksLocation"), SettingDependency::ChosenLocations},
+            {QStringLiteral("locationRanking"), SettingDependency::LocationRanking},
+            {QStringLiteral("portForward"), SettingDependency::PortForwardLocation},
+            {QStringLiteral("standbyFailover"), SettingDependency::ChosenLocations},
+            {QStringLiteral("proxy"), SettingDependency::PrestartShadowsocks},
+            {QStringLiteral("prestartShadowsocks"), SettingDependency::PrestartShadowsocks},
+        };
+        return dependencies;
+    }
+
+    // Resident set size of the daemon process in bytes, or 0 if it can't be
+    // determined
+    qint64 processResidentBytes()
+    {
+#if defined(Q_OS_WIN)
+        PROCESS_MEMORY_COUNTERS counters{};
+        if(::GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof(counters)))
+            return static_cast<qint64>(counters.WorkingSetSize);
+#elif defined(Q_OS_MACOS)
+        mach_task_basic_info info{};
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+        if(::task_info(::mach_task_self(), MACH_TASK_BASIC_INFO,
+                       reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS)
+        {
+            return static_cast<qint64>(info.resident_size);
+        }
+#elif defined(Q_OS_LINUX)
+        // The second field of statm is the resident size in pages
+        QFile statm{QStringLiteral("/proc/self/statm")};
+        if(statm.open(QIODevice::ReadOnly))
+        {
+            const auto &fields = statm.readAll().split(' ');
+            if(fields.size() >= 2)
+                return fields[1].toLongLong() * ::sysconf(_SC_PAGESIZE);
+        }
+#endif
+        return 0;
+    }
 }
 
 static DaemonData::CertificateAuthorityMap createCertificateAuthorites()
@@ -136,6 +230,38 @@ static DaemonData::CertificateAuthorityMap createCertificateAuthorites()
     return certificateAuthorities;
 }
 
+namespace
+{
+    // DaemonData loaded by loadDaemonData(), and the file it was loaded from
+    struct LoadedProperties
+    {
+        nullable_t<QJsonObject> properties;
+        const char *filename;
+    };
+
+    // Load DaemonData from its binary cache if possible, which is much faster
+    // than parsing data.json (mostly the regions list).  data.json is still
+    // written for migration and debugging.  If data.json is newer (it was
+    // migrated by the installer, or an older version ran), the cache is stale
+    // and data.json is used.
+    //
+    // This runs on a worker thread during startup.
+    LoadedProperties loadDaemonData()
+    {
+        QFileInfo dataCacheInfo{Path::DaemonSettingsDir / "data.cache"};
+        QFileInfo dataJsonInfo{Path::DaemonSettingsDir / "data.json"};
+        bool dataCacheCurrent = dataCacheInfo.exists() &&
+            (!dataJsonInfo.exists() || dataJsonInfo.lastModified() <= dataCacheInfo.lastModified());
+        if(dataCacheCurrent)
+        {
+            auto cached = loadPropertiesCache(Path::DaemonSettingsDir, "data.cache");
+            if(cached)
+                return {std::move(cached), "data.cache"};
+        }
+        return {loadPropertiesFile(Path::DaemonSettingsDir, "data.json"), "data.json"};
+    }
+}
+
 void restrictAccountJson()
 {
     Path accountJsonPath = Path::DaemonSettingsDir / "account.json";
@@ -215,57 +341,106 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
     , _connection(new VPNConnection(this))
     , _regionRefresher{QStringLiteral("regions list"), ApiBases::piaApi,
                        regionsResource, regionsInitialLoadInterval,
-                       regionsRefreshInterval, serverListPublicKey}
+                       regionsRefreshInterval, serverListPublicKey,
+                       Path::DaemonDataDir / "regions_cache.json"}
     , _shadowsocksRefresher{QStringLiteral("Shadowsocks regions"),
                             ApiBases::piaApi, shadowsocksRegionsResource,
                             regionsInitialLoadInterval, regionsRefreshInterval,
-                            serverListPublicKey}
+                            serverListPublicKey,
+                            Path::DaemonDataDir / "shadowsocks_cache.json"}
     , _snoozeTimer(this)
+    , _metricsServer([this](){collectMetrics();})
+    , _eventLoopWatchdog(eventLoopStallThreshold)
+    , _commandExecutor(maxConcurrentCommands)
+    , _workerPool(workerPoolThreads)
+    , _dataChanges(_data)
+    , _accountChanges(_account)
+    , _settingsChanges(_settings)
+    , _stateChanges(_state)
+    , _notificationStats{0, 0}
     , _pendingSerializations(0)
+    , _connectionPeakThroughput{0.0}
+    , _writeQueued(false)
+    , _serializationQueue(_workerPool, QStringLiteral("serialization"),
+                          WorkerPool::Priority::High)
+    , _benchmarkQueue(_workerPool, QStringLiteral("benchmark"),
+                      WorkerPool::Priority::Background)
+    , _rpcQueue(_workerPool, QStringLiteral("rpc"), WorkerPool::Priority::Normal)
 {
 #ifdef PIA_CRASH_REPORTING
     initCrashReporting();
 #endif
 
-    // Load settings if they exist
-    readProperties(_data, Path::DaemonSettingsDir, "data.json");
+    // Load settings if they exist.  The files (and the CA certificates, used
+    // later) are independent, so they're loaded and parsed concurrently on
+    // worker threads; the results are assigned here in the usual order.
+    auto dataFuture = std::async(std::launch::async, &loadDaemonData);
+    auto accountFuture = std::async(std::launch::async, &loadPropertiesFile,
+                                    std::cref(Path::DaemonSettingsDir), "account.json");
+    auto settingsFuture = std::async(std::launch::async, &loadPropertiesFile,
+                                     std::cref(Path::DaemonSettingsDir), "settings.json");
+    auto caFuture = std::async(std::launch::async, &createCertificateAuthorites);
+
+    LoadedProperties loadedData = dataFuture.get();
+    assignProperties(_data, loadedData.properties, loadedData.filename);
     // Load account.json.  If it doesn't exist, write it out now so we can set
     // its permissions.
-    if(!readProperties(_account, Path::DaemonSettingsDir, "account.json"))
+    if(!assignProperties(_account, accountFuture.get(), "account.json"))
     {
         writeProperties(_account.toJsonObject(), Path::DaemonSettingsDir, "account.json");
         // Do this only when writing the file the first time, don't do it on
         // every daemon start in case the user overrides the permissions.
         restrictAccountJson();
     }
-    bool settingsFileRead = readProperties(_settings, Path::DaemonSettingsDir, "settings.json");
+    bool settingsFileRead = assignProperties(_settings, settingsFuture.get(), "settings.json");
 
     // Set up connections to write and notify changes to data objects.  Do this
     // before migrating settings, so we write out those changes immediately if
     // they occur.
     _serializationTimer.setSingleShot(true);
-    connect(&_serializationTimer, &QTimer::timeout, this, &Daemon::serialize);
+    connect(&_serializationTimer, &ServiceTimer::timeout, this, &Daemon::serialize);
 
     _accountRefreshTimer.setInterval(86400000);
     connect(&_accountRefreshTimer, &QTimer::timeout, this, &Daemon::refreshAccountInfo);
 
-    auto connectPropertyChanges = [this](NativeJsonObject &object, QSet<QString> Daemon::* pSet)
+    _postConnectDeadline.setSingleShot(true);
+    _postConnectDeadline.setInterval(msec32(postConnectDeadline));
+    connect(&_postConnectDeadline, &QTimer::timeout, this,
+            &Daemon::postConnectDeadlineElapsed);
+
+    auto connectPropertyChanges = [this](NativeJsonObject &object, JsonChangeSet Daemon::* pSet)
     {
-        connect(&object, &NativeJsonObject::propertyChanged, this,
-            [this, pSet](const QString& name)
+        auto addChange = [this, pSet](const QString& name)
             {
-                auto &set = (*this).*pSet;
-                int size = set.size();
-                set += name;
-                if (set.size() > size)
+                if (((*this).*pSet).add(name))
                     queueNotification(&Daemon::notifyChanges);
-            });
+            };
+        connect(&object, &NativeJsonObject::propertyChanged, this, addChange);
+        // Changes in nested objects (like the latency of one ServerLocation)
+        // are published too; notifyChanges() sends just the changed nested
+        // fields to clients that accept patches.
+        connect(&object, &NativeJsonObject::nestedPropertyChanged, this, addChange);
     };
     connectPropertyChanges(_data, &Daemon::_dataChanges);
     connectPropertyChanges(_account, &Daemon::_accountChanges);
     connectPropertyChanges(_settings, &Daemon::_settingsChanges);
     connectPropertyChanges(_state, &Daemon::_stateChanges);
 
+    connect(&_state, &DaemonState::connectionStateChanged, this, &Daemon::updateStateChannel);
+    connect(&_state, &DaemonState::bytesReceivedChanged, this, &Daemon::updateStateChannel);
+    connect(&_state, &DaemonState::bytesSentChanged, this, &Daemon::updateStateChannel);
+    connect(&_state, &DaemonState::forwardedPortChanged, this, &Daemon::updateStateChannel);
+    connect(&_state, &DaemonState::intervalMeasurementsChanged, this, &Daemon::updateStateChannel);
+    updateStateChannel();
+
+    // DaemonData changes are written to data.json.  Changes in nested objects
+    // aren't - those are latency measurements (see newLatencyMeasurements()),
+    // which are transient.
+    connect(&_data, &NativeJsonObject::propertyChanged, this, [this]()
+        {
+            _pendingSerializations |= 1;
+        });
+
     // Set up logging.  Do this before migrating settings so tracing from the
     // migration is written (if debug logging is enabled).
     connect(&_settings, &DaemonSettings::debugLoggingChanged, this, [this]() {
@@ -275,6 +450,9 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
         else
             g_logger->configure(true, *value);
     });
+    connect(&_settings, &DaemonSettings::binaryDebugLogChanged, this, [this]() {
+        g_logger->setBinaryFormat(_settings.binaryDebugLog());
+    });
     connect(g_logger, &Logger::configurationChanged, this, [this](bool logToFile, const QStringList& filters) {
         if (logToFile)
             _settings.debugLogging(filters);
@@ -297,17 +475,19 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
         _settings.debugLogging(g_logger->filters());
     else
         _settings.debugLogging(nullptr);
+    g_logger->setBinaryFormat(_settings.binaryDebugLog());
 
     // Migrate/upgrade any settings to the current daemon version
     upgradeSettings(settingsFileRead);
 
     // Build the sorted and grouped locations from the cached data
+    applyLocationRanking();
     rebuildLocations();
 
     // Check whether the host supports split tunnel and record errors
     checkSplitTunnelSupport();
 
-    g_data.certificateAuthorities(createCertificateAuthorites());
+    g_data.certificateAuthorities(caFuture.get());
 
     // If the client ID hasn't been set (or is somehow invalid), generate one
     if(!ClientId::isValidId(_account.clientId()))
@@ -320,12 +500,16 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
     _portForwarder = new PortForwarder(this, _account.clientId());
 
     #define RPC_METHOD(name, ...) LocalMethod(QStringLiteral(#name), this, &THIS_CLASS::RPC_##name)
-    _methodRegistry->add(RPC_METHOD(handshake));
+    _methodRegistry->add(RPC_METHOD(handshake).defaultArguments(QJsonArray{}));
+    _methodRegistry->add(RPC_METHOD(subscribe));
+    _methodRegistry->add(RPC_METHOD(unsubscribe));
+    _methodRegistry->add(RPC_METHOD(getProperties));
     _methodRegistry->add(RPC_METHOD(applySettings).defaultArguments(false));
     _methodRegistry->add(RPC_METHOD(resetSettings));
+    _methodRegistry->add(RPC_METHOD(updateSplitTunnelRules).defaultArguments(QJsonArray{}));
     _methodRegistry->add(RPC_METHOD(connectVPN));
-    _methodRegistry->add(RPC_METHOD(writeDiagnostics));
-    _methodRegistry->add(RPC_METHOD(writeDummyLogs));
+    _methodRegistry->add(RPC_METHOD(writeDiagnostics).priority(LocalMethod::Priority::Background));
+    _methodRegistry->add(RPC_METHOD(writeDummyLogs).priority(LocalMethod::Priority::Background));
     _methodRegistry->add(RPC_METHOD(disconnectVPN));
     _methodRegistry->add(RPC_METHOD(login));
     _methodRegistry->add(RPC_METHOD(logout));
@@ -338,14 +522,45 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
     _methodRegistry->add(RPC_METHOD(installKext));
     _methodRegistry->add(RPC_METHOD(startSnooze));
     _methodRegistry->add(RPC_METHOD(stopSnooze));
-    _methodRegistry->add(RPC_METHOD(inspectUwpApps));
+    _methodRegistry->add(RPC_METHOD(inspectUwpApps).priority(LocalMethod::Priority::Background));
     _methodRegistry->add(RPC_METHOD(checkCalloutState));
+    _methodRegistry->add(RPC_METHOD(runSelfTest).priority(LocalMethod::Priority::Background));
+    _methodRegistry->add(RPC_METHOD(startProfiler).defaultArguments(10));
+    _methodRegistry->add(RPC_METHOD(stopProfiler));
+    _methodRegistry->add(RPC_METHOD(getConnectionHistory).defaultArguments(QString{}, 0, 0)
+                                                             .priority(LocalMethod::Priority::Background));
     #undef RPC_METHOD
 
     connect(_connection, &VPNConnection::stateChanged, this, &Daemon::vpnStateChanged);
     connect(_connection, &VPNConnection::connectingStatus, this, &Daemon::vpnConnectingStatus);
     connect(_connection, &VPNConnection::error, this, &Daemon::vpnError);
     connect(_connection, &VPNConnection::byteCountsChanged, this, &Daemon::vpnByteCountsChanged);
+    connect(&_settings, &DaemonSettings::bandwidthSampleIntervalChanged, _connection,
+            &VPNConnection::updateByteCountInterval);
+    // VPNConnection::needsReconnect() only re-checks the connection settings
+    // and configuration when one of its inputs changes
+    connect(&_settings, &NativeJsonObject::propertyChanged, _connection,
+            &VPNConnection::connectionSettingChanged);
+    connect(&_settings, &NativeJsonObject::nestedPropertyChanged, _connection,
+            &VPNConnection::connectionSettingChanged);
+    for(NativeJsonObject *pLocations : std::initializer_list<NativeJsonObject*>{&_state.vpnLocations(), &_state.shadowsocksLocations()})
+    {
+        connect(pLocations, &NativeJsonObject::propertyChanged, _connection,
+                &VPNConnection::connectionLocationsChanged);
+        connect(pLocations, &NativeJsonObject::nestedPropertyChanged, _connection,
+                &VPNConnection::connectionLocationsChanged);
+    }
+    connect(_connection, &VPNConnection::connectionPhasesChanged, this,
+            [this](const QVector<ConnectionPhase> &phases)
+            {
+                _state.connectionPhases(phases);
+            });
+    connect(_connection, &VPNConnection::maceActivationFinished, this,
+            [this](bool active, std::chrono::milliseconds latency)
+            {
+                _state.maceActive(active);
+                _state.maceActivationTime(latency.count());
+            });
     connect(_connection, &VPNConnection::scannedOriginalNetwork, this, &Daemon::vpnScannedOriginalNetwork);
     connect(_connection, &VPNConnection::usingTunnelDevice, this,
         [this](QString deviceName, QString deviceLocalAddress, QString deviceRemoteAddress)
@@ -353,6 +568,7 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
             _state.tunnelDeviceName(deviceName);
             _state.tunnelDeviceLocalAddress(deviceLocalAddress);
             _state.tunnelDeviceRemoteAddress(deviceRemoteAddress);
+            publishConnectionSnapshot();
             queueApplyFirewallRules();
         });
     connect(_connection, &VPNConnection::hnsdSucceeded, this,
@@ -365,6 +581,13 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
             if(_state.hnsdFailing() == 0 && failureDuration >= std::chrono::seconds(10))
                 _state.hnsdFailing(QDateTime::currentMSecsSinceEpoch());
         });
+    connect(_connection, &VPNConnection::helperProcessStatusChanged, this,
+        [this](const QString &name, const HelperProcessStatus &status)
+        {
+            auto helperProcesses = _state.helperProcesses();
+            helperProcesses.insert(name, status);
+            _state.helperProcesses(helperProcesses);
+        });
     connect(_connection, &VPNConnection::hnsdSyncFailure, this,
         [this](bool failing)
         {
@@ -373,11 +596,21 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
             else if(_state.hnsdSyncFailure() == 0)
                 _state.hnsdSyncFailure(QDateTime::currentMSecsSinceEpoch());
         });
+    connect(_connection, &VPNConnection::hnsdSyncHeight, this,
+            [this](int height){_state.hnsdSyncHeight(height);});
 
     connect(&_latencyTracker, &LatencyTracker::newMeasurements, this,
             &Daemon::newLatencyMeasurements);
     // Pass the locations loaded from the cached data to LatencyTracker
     _latencyTracker.updateLocations(_data.locations());
+    // The chosen and favorite locations are always probed
+    connect(&_settings, &DaemonSettings::locationChanged, this,
+            &Daemon::updateLatencyPriorities);
+    connect(&_settings, &DaemonSettings::proxyShadowsocksLocationChanged, this,
+            &Daemon::updateLatencyPriorities);
+    connect(&_settings, &DaemonSettings::favoriteLocationsChanged, this,
+            &Daemon::updateLatencyPriorities);
+    updateLatencyPriorities();
     connect(_portForwarder, &PortForwarder::portForwardUpdated, this,
             &Daemon::portForwardUpdated);
 
@@ -405,6 +638,7 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
         _shadowsocksRefresher.startOrOverride(Path::DaemonSettingsDir / "shadowsocks_override.json",
                                               Path::ResourceDir / "shadowsocks.json",
                                               haveSsCache);
+        updatePrestartShadowsocks();
         _updateDownloader.run(true);
         queueNotification(&Daemon::reapplyFirewallRules);
     });
@@ -414,12 +648,22 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
         _regionRefresher.stop();
         _shadowsocksRefresher.stop();
         _latencyTracker.stop();
+        updatePrestartShadowsocks();
         queueNotification(&Daemon::RPC_disconnectVPN);
         queueNotification(&Daemon::reapplyFirewallRules);
     });
     connect(&_settings, &DaemonSettings::killswitchChanged, this, &Daemon::queueApplyFirewallRules);
     connect(&_settings, &DaemonSettings::allowLANChanged, this, &Daemon::queueApplyFirewallRules);
     connect(&_settings, &DaemonSettings::overrideDNSChanged, this, &Daemon::queueApplyFirewallRules);
+    // Once Handshake is selected, start syncing hnsd in the current connection
+    // so it's ready when the reconnect applies the setting.
+    auto applyHnsdBackgroundSync = [this]()
+    {
+        _connection->setHnsdBackgroundSync(isDNSHandshake(_settings.overrideDNS()));
+    };
+    connect(&_settings, &DaemonSettings::overrideDNSChanged, this, applyHnsdBackgroundSync);
+    applyHnsdBackgroundSync();
+    connect(&_settings, &DaemonSettings::linuxFirewallBackendChanged, this, &Daemon::queueApplyFirewallRules);
     connect(&_settings, &DaemonSettings::splitTunnelEnabledChanged, this, &Daemon::queueApplyFirewallRules);
     connect(&_settings, &DaemonSettings::splitTunnelRulesChanged, this, &Daemon::queueApplyFirewallRules);
     connect(&_account, &DaemonAccount::loggedInChanged, this, &Daemon::queueApplyFirewallRules);
@@ -429,6 +673,17 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
             [this](){_updateDownloader.setBetaUpdateChannel(_settings.betaUpdateChannel());});
     connect(&_settings, &DaemonSettings::offerBetaUpdatesChanged, this,
             [this](){_updateDownloader.enableBetaChannel(_settings.offerBetaUpdates());});
+    auto applyBackgroundUpdateDownload = [this]()
+    {
+        _updateDownloader.enableBackgroundDownload(_settings.backgroundUpdateDownload(),
+                                                   qint64{_settings.backgroundUpdateRateLimit()} * 1024);
+    };
+    connect(&_settings, &DaemonSettings::backgroundUpdateDownloadChanged, this,
+            applyBackgroundUpdateDownload);
+    connect(&_settings, &DaemonSettings::backgroundUpdateRateLimitChanged, this,
+            applyBackgroundUpdateDownload);
+    connect(&_settings, &DaemonSettings::metricsPortChanged, this,
+            &Daemon::applyMetricsPort);
     connect(&_updateDownloader, &UpdateDownloader::updateRefreshed, this,
             &Daemon::onUpdateRefreshed);
     connect(&_updateDownloader, &UpdateDownloader::downloadProgress, this,
@@ -440,6 +695,8 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
     _updateDownloader.setGaUpdateChannel(_settings.updateChannel());
     _updateDownloader.setBetaUpdateChannel(_settings.betaUpdateChannel());
     _updateDownloader.enableBetaChannel(_settings.offerBetaUpdates());
+    applyBackgroundUpdateDownload();
+    _updateDownloader.setNetworkIdle(true);
     _updateDownloader.reloadAvailableUpdates(Update{_data.gaChannelVersionUri(), _data.gaChannelVersion()},
                                              Update{_data.betaChannelVersionUri(), _data.betaChannelVersion()});
 
@@ -485,32 +742,87 @@ bool Daemon::isActive() const
     return _state.invalidClientExit() || hasActiveClient();
 }
 
-QString Daemon::RPC_handshake(const QString &version)
+QString Daemon::RPC_handshake(const QString &version, const QJsonArray &features)
 {
+    ClientConnection *pClient = ClientConnection::getInvokingClient();
+    if(pClient)
+    {
+        qInfo() << "Client" << pClient << "version" << version
+            << "supports features" << features;
+        pClient->setDataPatch(features.contains(QStringLiteral("dataPatch")));
+        pClient->setBinaryPayload(features.contains(QStringLiteral("binaryPayload")));
+        pClient->setLocationColumns(features.contains(QStringLiteral("locationColumns")));
+    }
     return QStringLiteral(PIA_VERSION);
 }
 
+void Daemon::RPC_subscribe(const QJsonObject &subscriptions)
+{
+    ClientConnection *pClient = ClientConnection::getInvokingClient();
+    if(pClient)
+    {
+        qInfo() << "Client" << pClient << "subscribed to" << subscriptions;
+        pClient->setSubscriptions(subscriptions);
+        updateActivityRates();
+    }
+}
+
+void Daemon::RPC_unsubscribe()
+{
+    ClientConnection *pClient = ClientConnection::getInvokingClient();
+    if(pClient && pClient->hasSubscriptions())
+    {
+        qInfo() << "Client" << pClient << "unsubscribed";
+        pClient->clearSubscriptions();
+        postAllProperties(pClient);
+        updateActivityRates();
+    }
+}
+
+void Daemon::updateActivityRates()
+{
+    // The interval measurements are only displayed in the client's windows
+    // (the bandwidth graph); idle clients unsubscribe from them.  The
+    // latencies are displayed in the same windows.
+    bool displayed = false;
+    for(ClientConnection *pClient : _clients)
+    {
+        if(pClient->isSubscribed(QStringLiteral("state"), QStringLiteral("intervalMeasurements")))
+        {
+            displayed = true;
+            break;
+        }
+    }
+
+    _connection->setReducedByteCountRate(!displayed);
+    _latencyTracker.setReducedRate(!displayed);
+}
+
 void Daemon::RPC_applySettings(const QJsonObject &settings, bool reconnectIfNeeded)
 {
-    // Filter sensitive settings for logging
-    QJsonObject logSettings{settings};
-    // Mask proxyCustom.username and proxyCustom.password if they're non-empty.
-    // Get the proxyCustom object - if logSettings doesn't have that value or it
-    // isn't an object, this returns an empty QJsonObject.
-    QJsonObject logSettingsProxyCustom = logSettings.value("proxyCustom").toObject();
-    if(!logSettingsProxyCustom.isEmpty())
-    {
-        // If 'username' and/or 'password' contain non-empty strings, mask them
-        auto userRef = logSettingsProxyCustom["username"];
-        if(!userRef.toString().isEmpty())
-            userRef = QStringLiteral("<masked>");
-        auto passRef = logSettingsProxyCustom["password"];
-        if(!passRef.toString().isEmpty())
-            passRef = QStringLiteral("<masked>");
-        // Apply the masked object to logSettings
-        logSettings["proxyCustom"] = logSettingsProxyCustom;
-    }
-    qDebug().noquote() << "Applying settings:" << QJsonDocument(logSettings).toJson(QJsonDocument::Compact);
+    // Filter sensitive settings for logging (only when debug logging is
+    // enabled, this copies and masks the whole settings object)
+    if(qDebugEnabled())
+    {
+        QJsonObject logSettings{settings};
+        // Mask proxyCustom.username and proxyCustom.password if they're non-empty.
+        // Get the proxyCustom object - if logSettings doesn't have that value or it
+        // isn't an object, this returns an empty QJsonObject.
+        QJsonObject logSettingsProxyCustom = logSettings.value("proxyCustom").toObject();
+        if(!logSettingsProxyCustom.isEmpty())
+        {
+            // If 'username' and/or 'password' contain non-empty strings, mask them
+            auto userRef = logSettingsProxyCustom["username"];
+            if(!userRef.toString().isEmpty())
+                userRef = QStringLiteral("<masked>");
+            auto passRef = logSettingsProxyCustom["password"];
+            if(!passRef.toString().isEmpty())
+                passRef = QStringLiteral("<masked>");
+            // Apply the masked object to logSettings
+            logSettings["proxyCustom"] = logSettingsProxyCustom;
+        }
+        qDebug().noquote() << "Applying settings:" << QJsonDocument(logSettings).toJson(QJsonDocument::Compact);
+    }
 
     // Prevent applying unknown settings.  Although Daemon does attempt to
     // preserve unknown settings for compatibility after a downgrade/upgrade,
@@ -531,28 +843,60 @@ void Daemon::RPC_applySettings(const QJsonObject &settings, bool reconnectIfNeed
         }
     }
 
-    bool success = _settings.assign(settings);
+    // Clients often send settings that haven't changed (the whole rule list,
+    // all defaults for a reset, etc.)  Only assign the settings that actually
+    // differ, and do only the work that depends on them - firewall, split
+    // tunnel, etc. are updated by the settings' own change signals, so they're
+    // already skipped for settings that don't affect them.
+    QJsonObject changedSettings;
+    unsigned dependencies = 0;
+    for(auto itSetting = settings.begin(); itSetting != settings.end(); ++itSetting)
+    {
+        if(_settings.get(itSetting.key()) != itSetting.value())
+        {
+            changedSettings.insert(itSetting.key(), itSetting.value());
+            dependencies |= settingDependencies().value(itSetting.key(), 0);
+        }
+    }
+    qDebug() << "Changed settings:" << changedSettings.keys();
+
+    bool success = _settings.assign(changedSettings);
 
-    // If the settings affect the location choices, recompute them.
-    if(settings.contains(QLatin1String("location")) || settings.contains(QLatin1String("proxyShadowsocksLocation")))
+    // Updating the nearest locations and the port forward location also
+    // recompute the chosen locations, only do that once.
+    bool chosenLocationsUpdated = false;
+    if(dependencies & SettingDependency::LocationRanking)
     {
-        qInfo() << "Location setting changed. Location:"
-            << settings.value(QLatin1String("location"))
-            << "- Shadowsocks location:" << settings.value(QLatin1String("proxyShadowsocksLocation"));
-        updateChosenLocations();
+        qInfo() << "Location ranking changed to:" << _settings.locationRanking();
+        applyLocationRanking();
+        updateNearestLocations();
+        chosenLocationsUpdated = true;
     }
 
-    if (settings.contains(QLatin1String("portForward")))
+    if(dependencies & SettingDependency::PortForwardLocation)
     {
-        qInfo() << "portForward setting changed to: " << settings.value(QLatin1String("portForward"));
+        qInfo() << "portForward setting changed to: " << _settings.portForward();
 
         // Toggling port forwarding may impact the bestLocation
-        NearestLocations nearest{_data.locations()};
-        _state.vpnLocations().bestLocation(nearest.getNearestSafeVpnLocation(_settings.portForward()));
+        _state.vpnLocations().bestLocation(_nearestLocations.getNearestSafeVpnLocation(_settings.portForward(),
+                                                                                       _state.vpnLocations().bestLocation()));
         // Without this a reconnect may re-use the previous auto location, not the updated one above
         updateChosenLocations();
+        chosenLocationsUpdated = true;
     }
 
+    // If the settings affect the location choices, recompute them.
+    if(dependencies & SettingDependency::ChosenLocations)
+    {
+        qInfo() << "Location setting changed. Location:" << _settings.location()
+            << "- Shadowsocks location:" << _settings.proxyShadowsocksLocation();
+        if(!chosenLocationsUpdated)
+            updateChosenLocations();
+    }
+
+    if(dependencies & SettingDependency::PrestartShadowsocks)
+        updatePrestartShadowsocks();
+
     // If applying the settings failed, we won't reconnect (ensures that
     // _state.needsReconnect() is still set before we throw)
     if (!success)
@@ -606,11 +950,68 @@ void Daemon::RPC_resetSettings()
     // Help page settings are not reset, as they were most likely changed for
     // troubleshooting.
     defaultsJson.remove(QStringLiteral("debugLogging"));
+    defaultsJson.remove(QStringLiteral("binaryDebugLog"));
     defaultsJson.remove(QStringLiteral("offerBetaUpdates"));
 
     RPC_applySettings(defaultsJson, false);
 }
 
+void Daemon::RPC_updateSplitTunnelRules(const QJsonArray &rules,
+                                        const QJsonArray &removePaths)
+{
+    const auto &currentRules = _settings.splitTunnelRules();
+    QSet<QString> removed;
+    for(const auto &path : removePaths)
+        removed.insert(path.toString());
+
+    // Index the updated rules by path; rules without a path can't be keyed
+    QHash<QString, QJsonObject> updates;
+    QStringList addedPaths;
+    for(const auto &ruleValue : rules)
+    {
+        QJsonObject rule = ruleValue.toObject();
+        QString path = rule.value(QLatin1String("path")).toString();
+        if(path.isEmpty())
+        {
+            qWarning() << "Reject split tunnel rule update, rule has no path:" << ruleValue;
+            throw Error{HERE, Error::Code::DaemonRPCUnknownSetting};
+        }
+        if(!updates.contains(path))
+            addedPaths.push_back(path);
+        updates.insert(path, std::move(rule));
+    }
+
+    // Keep the existing order; modified rules stay in place and new rules are
+    // appended in the order given
+    QJsonArray newRules;
+    int changedCount = updates.size();
+    for(const auto &rule : currentRules)
+    {
+        if(removed.contains(rule.path()))
+            continue;
+        auto itUpdate = updates.find(rule.path());
+        if(itUpdate != updates.end())
+        {
+            newRules.push_back(itUpdate.value());
+            updates.erase(itUpdate);
+        }
+        else
+            newRules.push_back(rule.toJsonObject());
+    }
+    changedCount -= updates.size();
+    for(const auto &path : addedPaths)
+    {
+        auto itUpdate = updates.find(path);
+        if(itUpdate != updates.end() && !removed.contains(path))
+            newRules.push_back(itUpdate.value());
+    }
+
+    qInfo() << "Updating split tunnel rules - modified:" << changedCount
+        << "- added:" << updates.size()
+        << "- removed:" << removed.size() << "- total:" << newRules.size();
+    RPC_applySettings({{QStringLiteral("splitTunnelRules"), newRules}}, false);
+}
+
 void Daemon::RPC_connectVPN()
 {
     // Cannot connect when no active client is connected (there'd be no way for
@@ -626,7 +1027,8 @@ void Daemon::RPC_connectVPN()
 }
 
 DiagnosticsFile::DiagnosticsFile(const QString &filePath)
-    : _diagFile{filePath}, _currentSize{0}
+    : _diagFile{filePath}, _currentSize{0},
+      _commandExecutor{MaxConcurrentCommands}
 {
     if(!_diagFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
     {
@@ -643,8 +1045,9 @@ QString DiagnosticsFile::diagnosticsCommandHeader(const QString &commandName)
     return QStringLiteral("\n/PIA_PART/%1\n").arg(commandName);
 }
 
-void DiagnosticsFile::logPart(const QString &title, QElapsedTimer &commandTime)
+void DiagnosticsFile::logPart(const QString &title, const QElapsedTimer &commandTime)
 {
+    _fileWriter.flush();
     qint64 newSize = _diagFile.size();
     qint64 partSize = newSize - _currentSize;
     _currentSize = newSize;
@@ -654,35 +1057,76 @@ void DiagnosticsFile::logPart(const QString &title, QElapsedTimer &commandTime)
         << partSize << "bytes";
 }
 
-void DiagnosticsFile::execAndWriteOutput(QProcess &cmd, const QString &commandName,
-                                         const ProcessOutputFunction &processOutput)
+void DiagnosticsFile::addCommand(const QString &commandName,
+                                 CommandExecutor::Command command,
+                                 const ProcessOutputFunction &processOutput)
 {
-    QElapsedTimer commandTime;
-    commandTime.start();
-
-    _fileWriter << diagnosticsCommandHeader(commandName);
+    Q_ASSERT(!_pFinished);  // Can't add parts after finish()
 
-    cmd.start();
-    // Only wait 5 seconds for each process.  Occasionally some commands might
+    // Only allow 5 seconds for each process.  Occasionally some commands might
     // time out, but it's confusing for users if this takes a long time due to
     // the current lack of feedback that we're preparing the report.
-    if(cmd.waitForFinished(5000))
+    command.timeout = std::chrono::seconds{5};
+
+    Part part;
+    part.title = commandName;
+    part.program = command.program;
+    part.processOutput = processOutput;
+    part.commandTime.start();
+    part.pResult = _commandExecutor.run(std::move(command));
+    _parts.push_back(std::move(part));
+
+    _parts.back().pResult->notify(this, [this](){writeCompletedParts();});
+}
+
+void DiagnosticsFile::writeCommandOutput(const Part &part)
+{
+    const CommandResult &result = part.pResult->result();
+
+    _fileWriter << diagnosticsCommandHeader(part.title);
+    if(result.error == QProcess::UnknownError)
     {
-        _fileWriter << "Exit code: " << cmd.exitCode() << endl;
+        _fileWriter << "Exit code: " << result.exitCode << endl;
         _fileWriter << "STDOUT: " << endl;
-        QByteArray output = cmd.readAllStandardOutput();
-        _fileWriter << (processOutput ? processOutput(output) : output) << endl;
+        _fileWriter << (part.processOutput ? part.processOutput(result.standardOutput) : result.standardOutput) << endl;
         _fileWriter << "STDERR: " << endl;
-        _fileWriter << cmd.readAllStandardError() << endl;
+        _fileWriter << result.standardError << endl;
     }
     else
     {
-        _fileWriter << "Failed to run command: " << cmd.program() << endl;
-        _fileWriter << qEnumToString(cmd.error()) << endl;
-        _fileWriter << cmd.errorString() << endl;
+        _fileWriter << "Failed to run command: " << part.program << endl;
+        _fileWriter << qEnumToString(result.error) << endl;
     }
+}
 
-    logPart(commandName, commandTime);
+void DiagnosticsFile::writeCompletedParts()
+{
+    while(!_parts.empty())
+    {
+        const Part &part = _parts.front();
+        if(part.pResult)
+        {
+            if(!part.pResult->isFinished())
+                break;  // Wait for this command to write anything else
+            writeCommandOutput(part);
+        }
+        else
+        {
+            _fileWriter << diagnosticsCommandHeader(part.title);
+            _fileWriter << part.text << endl;
+        }
+        // For commands, this is the time the command took, including any
+        // time it was queued.  Only the size is really important for logging a
+        // text part, but log the time too for consistency.
+        logPart(part.title, part.commandTime);
+        _parts.pop_front();
+    }
+
+    if(_parts.empty() && _pFinished && _pFinished->isPending())
+    {
+        _fileWriter.flush();
+        _pFinished->resolve();
+    }
 }
 
 void DiagnosticsFile::writeCommand(const QString &commandName,
@@ -690,10 +1134,10 @@ void DiagnosticsFile::writeCommand(const QString &commandName,
                                    const QStringList &args,
                                    const ProcessOutputFunction &processOutput)
 {
-    QProcess cmd;
-    cmd.setArguments(args);
-    cmd.setProgram(command);
-    execAndWriteOutput(cmd, commandName, processOutput);
+    CommandExecutor::Command cmd;
+    cmd.program = command;
+    cmd.arguments = args;
+    addCommand(commandName, std::move(cmd), processOutput);
 }
 
 #ifdef Q_OS_WIN
@@ -705,28 +1149,35 @@ void DiagnosticsFile::writeCommand(const QString &commandName,
                                    const QString &nativeArgs,
                                    const ProcessOutputFunction &processOutput)
 {
-    QProcess cmd;
-    cmd.setNativeArguments(nativeArgs);
-    cmd.setProgram(command);
-    execAndWriteOutput(cmd, commandName, processOutput);
+    CommandExecutor::Command cmd;
+    cmd.program = command;
+    cmd.nativeArguments = nativeArgs;
+    addCommand(commandName, std::move(cmd), processOutput);
 }
 #endif
 
 void DiagnosticsFile::writeText(const QString &title, const QString &text)
 {
-    QElapsedTimer commandTime;
-    commandTime.start();
+    Q_ASSERT(!_pFinished);  // Can't add parts after finish()
 
-    _fileWriter << diagnosticsCommandHeader(title);
-    _fileWriter << text << endl;
+    Part part;
+    part.title = title;
+    part.text = text;
+    part.commandTime.start();
+    _parts.push_back(std::move(part));
+    // Write it now if nothing is pending before it
+    writeCompletedParts();
+}
 
-    // Only the size is really important for logging a text part, but log the
-    // time too for consistency (the time to generate the text isn't included,
-    // but it can be calculated from the log timestamps)
-    logPart(title, commandTime);
+Async<void> DiagnosticsFile::finish()
+{
+    Q_ASSERT(!_pFinished);  // Only call finish() once
+    _pFinished = Async<void>::create();
+    writeCompletedParts();
+    return _pFinished;
 }
 
-QJsonValue Daemon::RPC_writeDiagnostics()
+Async<QJsonValue> Daemon::RPC_writeDiagnostics()
 {
     // Diagnostics can only be written when debug logging is enabled
     if(!_settings.debugLogging())
@@ -739,8 +1190,9 @@ QJsonValue Daemon::RPC_writeDiagnostics()
 
     Path::DaemonDiagnosticsDir.mkpath();
 
-    // Clean old diagnostics files, leave the last 5 (arbitrarily).
-    Path::DaemonDiagnosticsDir.cleanDirFiles(5);
+    // Clean old diagnostics files, leave the last 5 (arbitrarily).  Each one
+    // consists of a diagnostics file and a trace file.
+    Path::DaemonDiagnosticsDir.cleanDirFiles(10);
 
     // Generate a file name for the current diagnostics.
     // A unique name is used each time to make sure that any submitted report
@@ -750,8 +1202,15 @@ QJsonValue Daemon::RPC_writeDiagnostics()
     const auto &diagFileName = nowUtc.toString(QStringLiteral("'diag_'yyyyMMdd'_'hhmmsszzz'.txt'"));
     const auto &diagFilePath = Path::DaemonDiagnosticsDir / diagFileName;
 
-    DiagnosticsFile file{diagFilePath};
+    // The file is deleted later, since the last reference is released by the
+    // finish() continuation (in a signal from the file)
+    QSharedPointer<DiagnosticsFile> pFile{new DiagnosticsFile{diagFilePath},
+                                         &QObject::deleteLater};
+    DiagnosticsFile &file = *pFile;
 
+    // The platform commands are started here and run concurrently; the rest
+    // of the parts below are captured now and written once the preceding
+    // commands complete.
     writePlatformDiagnostics(file);
 
     auto writePrettyJson = [&file](const QString &title, QJsonObject object, QStringList keysToRemove={}) {
@@ -759,14 +1218,76 @@ QJsonValue Daemon::RPC_writeDiagnostics()
         file.writeText(title, QJsonDocument(object).toJson(QJsonDocument::Indented));
     };
 
+    file.writeText("Client notifications", QStringLiteral("Clients: %1\nBytes encoded: %2\nBytes sent: %3")
+        .arg(_clients.size()).arg(_notificationStats.bytesEncoded)
+        .arg(_notificationStats.bytesSent));
+
+    // RPC methods, slowest dispatch (time blocking the event loop) first
+    const auto &methodStats = _methodRegistry->methodStats();
+    QStringList rpcMethods = methodStats.keys();
+    std::sort(rpcMethods.begin(), rpcMethods.end(),
+              [&methodStats](const QString &first, const QString &second)
+              {
+                  return methodStats[first].dispatch.sumNs > methodStats[second].dispatch.sumNs;
+              });
+    QString rpcText;
+    for(const auto &method : rpcMethods)
+    {
+        const RpcMethodStats &stats = methodStats[method];
+        auto avgMs = [](const RpcLatencyHistogram &histogram)
+        {
+            return histogram.count ? histogram.sumNs / 1.0e6 / histogram.count : 0.0;
+        };
+        rpcText += QStringLiteral("%1: %2 calls, %3 errors; dispatch avg %4 ms, max %5 ms; completion avg %6 ms, max %7 ms\n")
+            .arg(method).arg(stats.calls).arg(stats.errors)
+            .arg(avgMs(stats.dispatch), 0, 'f', 2)
+            .arg(stats.dispatch.maxNs / 1.0e6, 0, 'f', 2)
+            .arg(avgMs(stats.completion), 0, 'f', 2)
+            .arg(stats.completion.maxNs / 1.0e6, 0, 'f', 2);
+    }
+    file.writeText("RPC methods", rpcText.isEmpty() ? QStringLiteral("No calls") : rpcText);
+
+    SocksServerStats socksStats;
+    if(_socksServer.stats(socksStats))
+    {
+        file.writeText("SOCKS server", QStringLiteral("Connections: %1 (%2 open)\nBytes relayed: %3\nRead pauses: %4\nPeak buffered bytes: %5")
+            .arg(socksStats.connections).arg(socksStats.activeConnections)
+            .arg(socksStats.bytesRelayed).arg(socksStats.readPauses)
+            .arg(socksStats.peakBufferedBytes));
+    }
+    else
+        file.writeText("SOCKS server", QStringLiteral("Not running"));
+
+    const ApiNetworkStats &apiStats = ApiNetwork::instance()->stats();
+    file.writeText("API network", QStringLiteral("Requests: %1\nTLS handshakes: %2 (%3 offered session resumption)\nConnection resets: %4\nPrewarmed connections: %5")
+        .arg(apiStats.requests).arg(apiStats.handshakes)
+        .arg(apiStats.resumptionsOffered).arg(apiStats.connectionResets)
+        .arg(apiStats.prewarms));
+
+    // Folded stacks from the sampling profiler, if it has been started; these
+    // can be rendered directly as a flame graph
+    const QString &profilerStacks = _profiler.foldedStacks();
+    file.writeText("Profiler samples", profilerStacks.isEmpty() ? QStringLiteral("Not sampled") : profilerStacks);
+
+    // The trace timeline is written as a separate Chrome trace file so it can
+    // be loaded directly in a trace viewer.  The client finds it with
+    // Tracer::diagnosticsTracePath() to include it in the support tool payload.
+    const auto &traceFilePath = Tracer::diagnosticsTracePath(diagFilePath);
+    if(Tracer::writeChromeTrace(traceFilePath))
+        file.writeText("Trace", traceFilePath);
+    else
+        file.writeText("Trace", QStringLiteral("Unable to write trace"));
+
     writePrettyJson("DaemonState", _state.toJsonObject(), { "groupedLocations", "externalIp", "externalVpnIp", "forwardedPort" });
     // The custom proxy setting is removed because it may contain the proxy
     // credentials.
     writePrettyJson("DaemonSettings", _settings.toJsonObject(), { "proxyCustom" });
 
-    qInfo() << "Finished writing diagnostics file" << diagFilePath;
-
-    return QJsonValue{diagFilePath};
+    return file.finish()->then(this, [pFile, diagFilePath]()
+    {
+        qInfo() << "Finished writing diagnostics file" << diagFilePath;
+        return QJsonValue{diagFilePath};
+    });
 }
 
 void Daemon::RPC_writeDummyLogs()
@@ -855,6 +1376,35 @@ void Daemon::RPC_notifyClientDeactivate()
         emit lastClientDisconnected();
 }
 
+void Daemon::RPC_startProfiler(int intervalMs)
+{
+    if(!_settings.debugLogging())
+    {
+        qInfo() << "Not starting profiler, logging is not enabled";
+        throw Error{HERE, Error::Code::DaemonRPCDiagnosticsNotEnabled};
+    }
+
+    // Keep the interval within a sensible range; the default is 10 ms
+    std::chrono::milliseconds interval{qBound(1, intervalMs, 1000)};
+    if(!_profiler.start(interval))
+        throw Error{HERE, Error::Code::Unknown};
+}
+
+void Daemon::RPC_stopProfiler()
+{
+    _profiler.stop();
+}
+
+QJsonObject Daemon::RPC_getConnectionHistory(const QString &regionId,
+                                             qint64 sinceTime, int limit)
+{
+    ConnectionHistory &history = _connection->connectionHistory();
+    return QJsonObject{
+        {QStringLiteral("sessions"), history.sessions(regionId, sinceTime, limit)},
+        {QStringLiteral("regions"), history.regionSummaries(sinceTime)}
+    };
+}
+
 void Daemon::RPC_startSnooze(qint64 seconds)
 {
   _snoozeTimer.startSnooze(seconds);
@@ -871,7 +1421,7 @@ QJsonValue Daemon::RPC_installKext()
     throw Error{HERE, Error::Code::Unknown};
 }
 
-QJsonValue Daemon::RPC_inspectUwpApps(const QJsonArray &)
+Async<QJsonValue> Daemon::RPC_inspectUwpApps(const QJsonArray &)
 {
     // Not implemented; overridden on Windows with implementation
     throw Error{HERE, Error::Code::Unknown};
@@ -883,6 +1433,55 @@ void Daemon::RPC_checkCalloutState()
     throw Error{HERE, Error::Code::Unknown};
 }
 
+Async<QJsonValue> Daemon::RPC_runSelfTest()
+{
+    if(_connection->state() != VPNConnection::State::Connected)
+    {
+        qInfo() << "Not running self test, VPN is not connected";
+        throw Error{HERE, Error::Code::DaemonRPCNotConnected};
+    }
+
+    if(_pSelfTestTask)
+    {
+        qInfo() << "Self test is already running";
+        return _pSelfTestTask;
+    }
+
+    // Valid in the Connected state
+    Q_ASSERT(_state.connectedConfig().vpnLocation());
+    const ServerLocation &location = *_state.connectedConfig().vpnLocation();
+    QString locationId = location.id();
+    // The connected config's location was copied when connecting, so this is
+    // the latency that was measured before the tunnel was up
+    Optional<double> preTunnelLatency = location.latency();
+
+    qInfo() << "Starting self test for location" << locationId;
+    _pSelfTestTask = Async<QJsonValue>::create();
+    _pSelfTest = new SelfTest{this, QHostAddress{_state.tunnelDeviceLocalAddress()},
+                              QHostAddress{_state.tunnelDeviceRemoteAddress()},
+                              _data.gaChannelVersionUri()};
+    connect(_pSelfTest.data(), &SelfTest::finished, this,
+        [this, locationId, preTunnelLatency](const SelfTest::Result &result)
+        {
+            SelfTestResult testResult;
+            testResult.timestamp(QDateTime::currentMSecsSinceEpoch());
+            testResult.location(locationId);
+            testResult.tunnelLatency(result.tunnelLatency);
+            testResult.preTunnelLatency(preTunnelLatency);
+            testResult.downloadRate(result.downloadRate);
+            _state.selfTestResult(testResult);
+
+            if(_pSelfTest)
+                _pSelfTest->deleteLater();
+            _pSelfTest = nullptr;
+            auto pTask = std::move(_pSelfTestTask);
+            _pSelfTestTask.reset();
+            if(pTask)
+                pTask->resolve(testResult.toJsonObject());
+        });
+    return _pSelfTestTask;
+}
+
 Async<void> Daemon::RPC_login(const QString& username, const QString& password)
 {
     return ApiClient::instance()
@@ -952,11 +1551,14 @@ void Daemon::start()
 {
     // Perform any startup actions such as listening on sockets and setting
     // up timers here, then emit started().
+    TraceSpan span{"daemon", QStringLiteral("Daemon::start")};
 
     _server = new LocalSocketIPCServer(this);
     connect(_server, &IPCServer::newConnection, this, &Daemon::clientConnected);
     connect(_rpc, &RemoteNotificationInterface::messageReady, _server, &IPCServer::sendMessageToAllClients);
     _server->listen();
+    applyMetricsPort();
+    _eventLoopWatchdog.start();
 
     connect(&_account, &DaemonAccount::loggedInChanged, this, [this]() {
         if (_account.loggedIn())
@@ -970,6 +1572,25 @@ void Daemon::start()
         refreshAccountInfo();
     }
 
+    // Measure the ciphers for the "auto" cipher setting if that hasn't been
+    // done on this machine yet.  The results don't change, so this is only
+    // done once.
+    if (_data.cipherThroughputs().isEmpty())
+    {
+        _benchmarkQueue.run([](){return VPNConnection::benchmarkCiphers();})
+            ->notify(this, [this](const Error &err, const DaemonData::CipherThroughputMap &throughputs)
+            {
+                if (err)
+                    qWarning() << "Unable to measure ciphers:" << err;
+                else if (!throughputs.isEmpty())
+                {
+                    _data.cipherThroughputs(throughputs);
+                    qInfo() << "Automatic cipher is"
+                        << VPNConnection::selectAutoCipher(throughputs);
+                }
+            });
+    }
+
     qInfo() << "Daemon started and waiting for connections...";
 
     _started = true;
@@ -984,6 +1605,10 @@ void Daemon::stop()
         qInfo() << "Daemon stopping...";
     _stopping = true;
 
+    // Don't keep Shadowsocks running, it's stopped when the connection is
+    // disconnected
+    updatePrestartShadowsocks();
+
     // Perform any necessary actions before the message loop can be stopped
     // here, then emit stopped().
 
@@ -993,6 +1618,9 @@ void Daemon::stop()
         return;
     }
 
+    _metricsServer.stop();
+    _eventLoopWatchdog.stop();
+
     qInfo() << "Daemon cleanly stopped";
 
     _started = false;
@@ -1003,6 +1631,7 @@ void Daemon::clientConnected(IPCConnection* connection)
 {
     auto client = new ClientConnection(connection, _methodRegistry, this);
     _clients.insert(connection, client);
+    updateActivityRates();
     qInfo() << "New client" << client << "connected, total client count now"
         << _clients.size() << "- have active client:" << hasActiveClient();
     // No need to check if this is the first client, new clients are initially
@@ -1011,6 +1640,7 @@ void Daemon::clientConnected(IPCConnection* connection)
         _clients.remove(connection);
         qInfo() << "Client" << client << "disconnected, total client count now"
             << _clients.size() << "- have active client:" << hasActiveClient();
+        updateActivityRates();
         // If the client was active, this exit is unexpected (assume the client
         // crashed).  If this would have caused the daemon to deactivate, set
         // invalidClientExit() to remain active.
@@ -1024,12 +1654,80 @@ void Daemon::clientConnected(IPCConnection* connection)
         }
     });
 
+    // A client that fell behind missed some data notifications, bring it up
+    // to date.
+    connect(client, &ClientConnection::caughtUp, this, [this, client]()
+    {
+        postAllProperties(client);
+    });
+
+    postAllProperties(client);
+}
+
+static QJsonObject encodeLocationColumns(const QJsonObject &params, bool isPatch);
+
+QJsonObject Daemon::snapshotObject(const QString &name, const NativeJsonObject &object,
+                                   const JsonChangeSet &changes)
+{
+    // If changes are waiting for notifyChanges(), the cached value may be
+    // stale, and it would be invalidated shortly anyway - just read the
+    // current value.
+    if(!changes.empty())
+    {
+        invalidateSnapshot(name);
+        return object.toJsonObject();
+    }
+
+    auto itObject = _snapshotObjects.find(name);
+    if(itObject == _snapshotObjects.end())
+        itObject = _snapshotObjects.insert(name, object.toJsonObject());
+    return itObject.value();
+}
+
+void Daemon::invalidateSnapshot(const QString &name)
+{
+    _snapshotObjects.remove(name);
+    for(auto &binaryMessages : _snapshotMessages)
+    {
+        for(auto &message : binaryMessages)
+            message.clear();
+    }
+}
+
+void Daemon::postAllProperties(ClientConnection *client)
+{
+    bool binary = client->getBinaryPayload();
+    bool columns = client->getLocationColumns();
+    QByteArray &cachedMessage = _snapshotMessages[binary][columns];
+    if(!client->hasSubscriptions() && !cachedMessage.isEmpty())
+    {
+        _notificationStats.bytesSent += cachedMessage.size();
+        client->sendMessage(cachedMessage);
+        return;
+    }
+
     QJsonObject all;
-    all.insert(QStringLiteral("data"), g_data.toJsonObject());
-    all.insert(QStringLiteral("account"), g_account.toJsonObject());
-    all.insert(QStringLiteral("settings"), g_settings.toJsonObject());
-    all.insert(QStringLiteral("state"), g_state.toJsonObject());
-    client->post(QStringLiteral("data"), all);
+    all.insert(QStringLiteral("data"), snapshotObject(QStringLiteral("data"), g_data, _dataChanges));
+    all.insert(QStringLiteral("account"), snapshotObject(QStringLiteral("account"), g_account, _accountChanges));
+    all.insert(QStringLiteral("settings"), snapshotObject(QStringLiteral("settings"), g_settings, _settingsChanges));
+    all.insert(QStringLiteral("state"), snapshotObject(QStringLiteral("state"), g_state, _stateChanges));
+
+    // Subscribed clients get their own filtered snapshot; it isn't cached.
+    if(client->hasSubscriptions())
+        all = client->filterData(all);
+    if(columns)
+        all = encodeLocationColumns(all, false);
+    QByteArray message = encodeJsonRPCNotification(QStringLiteral("data"),
+                                                   QJsonArray{all},
+                                                   binary ? JsonRPCEncoding::Binary : JsonRPCEncoding::Text);
+    _notificationStats.bytesEncoded += message.size();
+    _notificationStats.bytesSent += message.size();
+
+    // Cache the message only if every object came from the snapshot cache -
+    // if any had pending changes, the next notifyChanges() would discard it.
+    if(!client->hasSubscriptions() && _snapshotObjects.size() == 4)
+        cachedMessage = message;
+    client->sendMessage(message);
 }
 
 QJsonObject getProperties(const NativeJsonObject& object, const QSet<QString>& properties)
@@ -1043,47 +1741,256 @@ QJsonObject getProperties(const NativeJsonObject& object, const QSet<QString>& p
     return result;
 }
 
-void Daemon::notifyChanges()
+QJsonObject Daemon::RPC_getProperties(const QJsonObject &properties)
 {
-    QJsonObject all;
-    if (!_dataChanges.empty())
+    QJsonObject result;
+    auto addObject = [&](const QString &name, const NativeJsonObject &object)
+    {
+        auto itProperties = properties.find(name);
+        if(itProperties == properties.end())
+            return;
+        QSet<QString> propertyNames;
+        for(const auto &property : itProperties.value().toArray())
+        {
+            if(property.isString())
+                propertyNames.insert(property.toString());
+        }
+        result.insert(name, getProperties(object, propertyNames));
+    };
+
+    addObject(QStringLiteral("data"), g_data);
+    addObject(QStringLiteral("account"), g_account);
+    addObject(QStringLiteral("settings"), g_settings);
+    addObject(QStringLiteral("state"), g_state);
+    return result;
+}
+
+// Build the patch operations for one changed property, relative to the
+// object containing that property.  If the patch would be larger than the
+// property's value (many nested fields changed), the value is just replaced.
+static void buildPropertyPatch(const QString &property, const QJsonValue &oldValue,
+                               const QJsonValue &newValue, QJsonArray &patch)
+{
+    QString path = QLatin1Char('/') + jsonPointerEscape(property);
+    QJsonArray propertyPatch;
+    buildJsonPatch(path, oldValue, newValue, propertyPatch);
+
+    if(propertyPatch.size() > 1)
+    {
+        auto patchSize = QJsonDocument{propertyPatch}.toJson(QJsonDocument::Compact).size();
+        auto valueSize = QJsonDocument{QJsonArray{newValue}}.toJson(QJsonDocument::Compact).size();
+        if(patchSize >= valueSize)
+        {
+            propertyPatch = QJsonArray{};
+            propertyPatch.append(QJsonObject{{QStringLiteral("op"), QStringLiteral("replace")},
+                                             {QStringLiteral("path"), path},
+                                             {QStringLiteral("value"), newValue}});
+        }
+    }
+
+    for(const auto &patchOp : propertyPatch)
+        patch.append(patchOp);
+}
+
+// Replace a complete value of one of the locations lists with its columnar
+// encoding (for clients using "locationColumns").  Other values, and values
+// that can't be encoded, are returned unchanged.
+static QJsonValue encodeLocationColumnsValue(const QString &object, const QString &property,
+                                             const QJsonValue &value)
+{
+    QJsonObject encoded;
+    if(object == QStringLiteral("data") && property == QStringLiteral("locations"))
+        encoded = encodeLocationsColumns(value.toObject());
+    else if(object == QStringLiteral("state") && property == QStringLiteral("groupedLocations"))
+        encoded = encodeGroupedLocationsColumns(value.toArray());
+    if(encoded.isEmpty())
+        return value;
+    return encoded;
+}
+
+// Encode the locations lists in a "data" or "patch" notification's parameter
+// object.  In patches, only operations that replace the whole property are
+// affected; nested operations (such as a latency change) are already small and
+// apply to the decoded value on the client.
+static QJsonObject encodeLocationColumns(const QJsonObject &params, bool isPatch)
+{
+    QJsonObject result{params};
+    for(auto itObject = result.begin(); itObject != result.end(); ++itObject)
     {
-        all.insert(QStringLiteral("data"), getProperties(_data, std::exchange(_dataChanges, {})));
-        _pendingSerializations |= 1;
+        if(isPatch)
+        {
+            QJsonArray objectPatch = itObject.value().toArray();
+            for(auto itOp = objectPatch.begin(); itOp != objectPatch.end(); ++itOp)
+            {
+                QJsonObject patchOp = itOp->toObject();
+                const auto &path = jsonPointerSplit(patchOp.value(QStringLiteral("path")).toString());
+                auto itValue = patchOp.find(QStringLiteral("value"));
+                if(path.size() == 1 && itValue != patchOp.end())
+                {
+                    *itValue = encodeLocationColumnsValue(itObject.key(), path.first(), itValue.value());
+                    *itOp = patchOp;
+                }
+            }
+            *itObject = objectPatch;
+        }
+        else
+        {
+            QJsonObject properties = itObject.value().toObject();
+            for(auto itProperty = properties.begin(); itProperty != properties.end(); ++itProperty)
+                *itProperty = encodeLocationColumnsValue(itObject.key(), itProperty.key(), itProperty.value());
+            *itObject = properties;
+        }
     }
+    return result;
+}
+
+void Daemon::notifyChanges()
+{
+    EventLoopWatchdog::Activity activity{QStringLiteral("Daemon::notifyChanges")};
+    bool havePatchClients = std::any_of(_clients.begin(), _clients.end(),
+        [](const ClientConnection *pClient){return pClient->getDataPatch();});
+
+    QJsonObject all, patch;
+    auto publishChanges = [&](const QString &name, JsonChangeSet &changes)
+    {
+        QJsonObject changedProperties = changes.takeValues();
+        invalidateSnapshot(name);
+        QJsonObject &published = _publishedValues[name];
+        QJsonArray objectPatch;
+        for(auto itProperty = changedProperties.begin(); itProperty != changedProperties.end(); ++itProperty)
+        {
+            // If this property hasn't been published yet, the old value is
+            // undefined, so the patch replaces the whole value.
+            if(havePatchClients)
+            {
+                buildPropertyPatch(itProperty.key(), published.value(itProperty.key()),
+                                   itProperty.value(), objectPatch);
+            }
+            published.insert(itProperty.key(), itProperty.value());
+        }
+        all.insert(name, changedProperties);
+        if(!objectPatch.isEmpty())
+            patch.insert(name, objectPatch);
+    };
+
+    // _pendingSerializations for DaemonData is set as the changes occur
+    if (!_dataChanges.empty())
+        publishChanges(QStringLiteral("data"), _dataChanges);
     if (!_accountChanges.empty())
     {
-        all.insert(QStringLiteral("account"), getProperties(_account, std::exchange(_accountChanges, {})));
+        publishChanges(QStringLiteral("account"), _accountChanges);
         _pendingSerializations |= 2;
     }
     if (!_settingsChanges.empty())
     {
-        all.insert(QStringLiteral("settings"), getProperties(_settings, std::exchange(_settingsChanges, {})));
+        publishChanges(QStringLiteral("settings"), _settingsChanges);
         _pendingSerializations |= 4;
     }
     if (!_stateChanges.empty())
     {
-        all.insert(QStringLiteral("state"), getProperties(_state, std::exchange(_stateChanges, {})));
+        publishChanges(QStringLiteral("state"), _stateChanges);
     }
     serialize();
-    _rpc->post(QStringLiteral("data"), all);
+
+    // If all clients take the same full, text-encoded data, and none of them
+    // are backlogged, broadcast it
+    bool broadcast = true;
+    for(auto pClient : _clients)
+    {
+        if(pClient->updateBacklogged() || pClient->getDataPatch() ||
+           pClient->getBinaryPayload() || pClient->getLocationColumns() ||
+           pClient->hasSubscriptions())
+        {
+            broadcast = false;
+        }
+    }
+    if(broadcast)
+    {
+        QByteArray message = encodeJsonRPCNotification(QStringLiteral("data"),
+                                                       QJsonArray{all},
+                                                       JsonRPCEncoding::Text);
+        _notificationStats.bytesEncoded += message.size();
+        _notificationStats.bytesSent += message.size() * _clients.size();
+        _server->sendMessageToAllClients(message);
+        return;
+    }
+
+    // Otherwise, there are up to eight variations of the message (full or
+    // patch, text or binary, standard or columnar locations).  Encode each one
+    // only once, when the first client needs it.
+    QByteArray messages[2][2][2];
+    auto sendMessage = [&](ClientConnection *pClient, bool isPatch)
+    {
+        QByteArray &message = messages[isPatch][pClient->getBinaryPayload()][pClient->getLocationColumns()];
+        if(message.isEmpty())
+        {
+            QJsonObject params = isPatch ? patch : all;
+            if(pClient->getLocationColumns())
+                params = encodeLocationColumns(params, isPatch);
+            message = encodeJsonRPCNotification(isPatch ? QStringLiteral("patch") : QStringLiteral("data"),
+                                                QJsonArray{params},
+                                                pClient->getBinaryPayload() ? JsonRPCEncoding::Binary : JsonRPCEncoding::Text);
+            _notificationStats.bytesEncoded += message.size();
+        }
+        _notificationStats.bytesSent += message.size();
+        pClient->sendMessage(message);
+    };
+
+    // Subscribed clients get their own filtered message
+    auto sendFiltered = [&](ClientConnection *pClient, bool isPatch)
+    {
+        QJsonObject params = isPatch ? pClient->filterPatch(patch) : pClient->filterData(all);
+        if(params.isEmpty())
+            return;
+        if(pClient->getLocationColumns())
+            params = encodeLocationColumns(params, isPatch);
+        QByteArray message = encodeJsonRPCNotification(isPatch ? QStringLiteral("patch") : QStringLiteral("data"),
+                                                       QJsonArray{params},
+                                                       pClient->getBinaryPayload() ? JsonRPCEncoding::Binary : JsonRPCEncoding::Text);
+        _notificationStats.bytesEncoded += message.size();
+        _notificationStats.bytesSent += message.size();
+        pClient->sendMessage(message);
+    };
+
+    for(auto pClient : _clients)
+    {
+        // Backlogged clients get a snapshot of all values once they catch up
+        if(pClient->isBacklogged())
+            pClient->dropDataNotification();
+        else if(pClient->hasSubscriptions())
+            sendFiltered(pClient, pClient->getDataPatch());
+        else if(!pClient->getDataPatch())
+            sendMessage(pClient, false);
+        // Nothing to send if the changes had no effect on the values
+        else if(!patch.isEmpty())
+            sendMessage(pClient, true);
+    }
 }
 
 void Daemon::serialize()
 {
+    EventLoopWatchdog::Activity activity{QStringLiteral("Daemon::serialize")};
     if (_pendingSerializations)
     {
         if (!_serializationTimer.isActive())
         {
+            // Snapshot the objects here; they're written by the
+            // serialization thread.
             if (_pendingSerializations & 1)
-                writeProperties(_data.toJsonObject(), Path::DaemonSettingsDir, "data.json");
+            {
+                QJsonObject data = _data.toJsonObject();
+                queueWrite("data.cache", data, WriteMode::BinaryCache);
+                queueWrite("data.json", std::move(data), WriteMode::Atomic);
+            }
+            // account.json is written in place to preserve its restricted
+            // permissions (see restrictAccountJson())
             if (_pendingSerializations & 2)
-                writeProperties(_account.toJsonObject(), Path::DaemonSettingsDir, "account.json");
+                queueWrite("account.json", _account.toJsonObject(), WriteMode::InPlace);
             if (_pendingSerializations & 4)
             {
                 QJsonObject settings = _settings.toJsonObject();
                 settings.remove(QStringLiteral("debugLogging"));
-                writeProperties(settings, Path::DaemonSettingsDir, "settings.json");
+                queueWrite("settings.json", std::move(settings), WriteMode::Atomic);
             }
             _pendingSerializations = 0;
             _serializationTimer.start(5000);
@@ -1091,6 +1998,59 @@ void Daemon::serialize()
     }
 }
 
+void Daemon::queueWrite(const char *filename, QJsonObject object, WriteMode mode)
+{
+    QMutexLocker lock{&_pendingWritesMutex};
+    _pendingWrites.insert(filename, {std::move(object), mode});
+    // If the thread hasn't started writing the pending snapshots yet, it'll
+    // pick this one up too.
+    if(!std::exchange(_writeQueued, true))
+        _serializationQueue.queue([this](){writePending();});
+}
+
+void Daemon::writePending()
+{
+    QHash<QByteArray, PendingWrite> pendingWrites;
+    {
+        QMutexLocker lock{&_pendingWritesMutex};
+        pendingWrites.swap(_pendingWrites);
+        _writeQueued = false;
+    }
+
+    // Binary caches are written after the JSON files, so a cache is never
+    // older than the JSON file it was written with (see Daemon::Daemon()).
+    for(bool caches : {false, true})
+    {
+        for(auto itWrite = pendingWrites.begin(); itWrite != pendingWrites.end(); ++itWrite)
+        {
+            if((itWrite->mode == WriteMode::BinaryCache) != caches)
+                continue;
+            const char *filename = itWrite.key().constData();
+            switch(itWrite->mode)
+            {
+                case WriteMode::InPlace:
+                    writeProperties(itWrite->object, Path::DaemonSettingsDir, filename);
+                    break;
+                case WriteMode::Atomic:
+                    writePropertiesAtomic(itWrite->object, Path::DaemonSettingsDir, filename);
+                    break;
+                case WriteMode::BinaryCache:
+                    writePropertiesCacheAtomic(itWrite->object, Path::DaemonSettingsDir, filename);
+                    break;
+            }
+        }
+    }
+}
+
+void Daemon::publishConnectionSnapshot()
+{
+    g_connectionSnapshot.publish({_connection->state() == VPNConnection::State::Connected,
+                                  _state.tunnelDeviceName(),
+                                  QHostAddress{_state.tunnelDeviceLocalAddress()},
+                                  QHostAddress{_state.tunnelDeviceRemoteAddress()},
+                                  getDNSServers(_connection->dnsServers())});
+}
+
 void Daemon::vpnStateChanged(VPNConnection::State state,
                              const ConnectionConfig &connectingConfig,
                              const ConnectionConfig &connectedConfig,
@@ -1105,10 +2065,35 @@ void Daemon::vpnStateChanged(VPNConnection::State state,
 
     if (!_connection->needsReconnect())
         _state.needsReconnect(false);
+    const QString previousState = _state.connectionState();
     _state.connectionState(qEnumToString(state));
     _state.chosenTransport(chosenTransport);
     _state.actualTransport(actualTransport);
 
+    // Record the outcome of connection attempts and the throughput of
+    // connections in the location history.
+    if(state != VPNConnection::State::Connected && !_throughputLocation.isEmpty())
+    {
+        if(_connectionPeakThroughput >= minRecordedThroughput)
+            recordLocationThroughput(_throughputLocation, _connectionPeakThroughput);
+        _throughputLocation.clear();
+        _connectionPeakThroughput = 0.0;
+    }
+    if(state == VPNConnection::State::Connected && connectedConfig.vpnLocation() &&
+        _throughputLocation.isEmpty())
+    {
+        recordConnectOutcome(connectedConfig.vpnLocation()->id(), true);
+        _throughputLocation = connectedConfig.vpnLocation()->id();
+        _connectionPeakThroughput = 0.0;
+    }
+    else if((state == VPNConnection::State::StillConnecting ||
+             state == VPNConnection::State::StillReconnecting) &&
+            connectingConfig.vpnLocation() &&
+            previousState != _state.connectionState())
+    {
+        recordConnectOutcome(connectingConfig.vpnLocation()->id(), false);
+    }
+
     // Populate a ConnectionInfo in DaemonState from VPNConnection's ConnectionConfig
     auto populateConnection = [](ConnectionInfo &info, const ConnectionConfig &config)
     {
@@ -1151,9 +2136,14 @@ void Daemon::vpnStateChanged(VPNConnection::State state,
 
     queueNotification(&Daemon::reapplyFirewallRules);
 
-    // Latency measurements only make sense when we're not connected to the VPN
+    // Latency measurements are taken when we're not connected to the VPN.
+    // While connected, they can continue if the probes can be bound to the
+    // original interface, so they don't go through the tunnel.  (The daemon's
+    // traffic is always permitted by the firewall.)  They're stopped while
+    // connecting, since the network is changing.
     if(state == VPNConnection::State::Disconnected && isActive())
     {
+        _latencyTracker.setProbeInterface({}, {});
         _latencyTracker.start();
         // Kick off a region refresh so we typically rotate servers on a
         // reconnect.  Usually the request right after connecting covers this,
@@ -1162,9 +2152,25 @@ void Daemon::vpnStateChanged(VPNConnection::State state,
         _regionRefresher.refresh();
         _shadowsocksRefresher.refresh();
     }
+    else if(state == VPNConnection::State::Connected && isActive() &&
+            !_state.originalInterfaceIp().isEmpty() &&
+            LatencyTracker::canProbeInterface(_state.originalInterface()))
+    {
+#ifdef Q_OS_WIN
+        // The interface name isn't known on Windows, the local address is
+        // sufficient
+        _latencyTracker.setProbeInterface({}, QHostAddress{_state.originalInterfaceIp()});
+#else
+        _latencyTracker.setProbeInterface(_state.originalInterface(),
+                                          QHostAddress{_state.originalInterfaceIp()});
+#endif
+        _latencyTracker.start();
+    }
     else
         _latencyTracker.stop();
 
+    publishConnectionSnapshot();
+
     // Update ApiNetwork and PortForwarder.
     if(state == VPNConnection::State::Connected)
     {
@@ -1178,7 +2184,9 @@ void Daemon::vpnStateChanged(VPNConnection::State state,
         }
         else
         {
-            _socksServer.start(tunnelLocalAddr, _state.tunnelDeviceName());
+            // Resolve names requested through the proxy with the VPN's DNS
+            _socksServer.start(tunnelLocalAddr, _state.tunnelDeviceName(),
+                               getDNSServers(_connection->dnsServers()));
             if(!_socksServer.port())
             {
                 qWarning() << "SOCKS proxy failed to start";
@@ -1189,21 +2197,37 @@ void Daemon::vpnStateChanged(VPNConnection::State state,
                 QNetworkProxy localProxy{QNetworkProxy::ProxyType::Socks5Proxy,
                                          QStringLiteral("127.0.0.1"),
                                          _socksServer.port()};
-                // This proxy does not support hostname lookup, UDP, or
+                // This proxy supports hostname lookup and UDP, but not
                 // listening
-                localProxy.setCapabilities(QNetworkProxy::TunnelingCapability);
+                localProxy.setCapabilities(QNetworkProxy::TunnelingCapability |
+                                           QNetworkProxy::UdpTunnelingCapability |
+                                           QNetworkProxy::HostNameLookupCapability);
                 localProxy.setUser(QString::fromLatin1(SocksConnection::username));
                 localProxy.setPassword(QString::fromLatin1(_socksServer.password()));
                 ApiNetwork::instance()->setProxy(localProxy);
             }
         }
 
-        // Figure out if the connected location supports PF
+        // Figure out if the connected location supports PF.  This is done as
+        // soon as the API proxy is set up (the request has to go through the
+        // tunnel), ahead of the prewarm and refreshes below, so the port
+        // forward request is dispatched first.
         Q_ASSERT(connectedConfig.vpnLocation());    // Guarantee by VPNConnection, valid in this state
         if(connectedConfig.vpnLocation()->portForward())
-            _portForwarder->updateConnectionState(PortForwarder::State::ConnectedSupported);
+        {
+            _portForwarder->updateConnectionState(PortForwarder::State::ConnectedSupported,
+                                                  connectedConfig.vpnLocation()->id());
+        }
         else
-            _portForwarder->updateConnectionState(PortForwarder::State::ConnectedUnsupported);
+        {
+            _portForwarder->updateConnectionState(PortForwarder::State::ConnectedUnsupported,
+                                                  connectedConfig.vpnLocation()->id());
+        }
+
+        // The refreshes below and any pending account requests will use the
+        // new connection; open it now so the handshakes are done by the time
+        // they're issued.
+        ApiNetwork::instance()->prewarm(ApiBases::piaApi.beginAttempt().getNextUri());
 
         // Perform a refresh immediately after connect so we get a new IP on reconnect.
         _regionRefresher.refresh();
@@ -1216,11 +2240,6 @@ void Daemon::vpnStateChanged(VPNConnection::State state,
         _portForwarder->updateConnectionState(PortForwarder::State::Disconnected);
     }
 
-    if(state == VPNConnection::State::Connected && _settings.enableMACE())
-    {
-        _connection->activateMACE();
-    }
-
     // If the connection is in any state other than Connected:
     // - clear the VPN IP address - it's no longer valid
     // - reset the connection timestamp
@@ -1230,11 +2249,28 @@ void Daemon::vpnStateChanged(VPNConnection::State state,
     {
         _state.externalVpnIp({});
         _state.connectionTimestamp(0);
+        _state.maceActive(false);
+        _state.maceActivationTime(0);
+        _state.postConnectTime(0);
+        _postConnectTimer.invalidate();
+        _postConnectDeadline.stop();
         // Discard any ongoing request to get the VPN IP.  (If it hasn't
         // completed yet, we're abandoning it, but it might also have
         // completed.)
         _pVpnIpRequest.abandon();
 
+        // Abandon a self test, the VPN connection it was measuring is gone
+        if(_pSelfTest)
+        {
+            _pSelfTest->deleteLater();
+            _pSelfTest = nullptr;
+        }
+        if(_pSelfTestTask)
+        {
+            _pSelfTestTask->reject(Error{HERE, Error::Code::DaemonRPCNotConnected});
+            _pSelfTestTask.reset();
+        }
+
         // Clear warnings that are only valid in the Connected state
         _state.hnsdFailing(0);
         _state.hnsdSyncFailure(0);
@@ -1246,11 +2282,17 @@ void Daemon::vpnStateChanged(VPNConnection::State state,
         monotonicTimer.start();
         _state.connectionTimestamp(monotonicTimer.msecsSinceReference());
 
+        // The port forward request was already dispatched above; the VPN IP
+        // request runs concurrently with it.  Time both of them from here.
+        _postConnectTimer.start();
+        _postConnectDeadline.start();
+
         // Get the user's VPN IP address now that we're connected
         _pVpnIpRequest = ApiClient::instance()
                 ->getVpnIpRetry(QStringLiteral("status"))
                 ->then(this, [this](const QJsonDocument& json) {
                     _state.externalVpnIp(json[QStringLiteral("ip")].toString());
+                    checkPostConnectComplete();
                 })
                 ->except(this, [this](const Error& err) {
                     qWarning() << "Couldn't get VPN IP address due to error:" << err;
@@ -1267,6 +2309,7 @@ void Daemon::vpnStateChanged(VPNConnection::State state,
         _state.tunnelDeviceName({});
         _state.tunnelDeviceLocalAddress({});
         _state.tunnelDeviceRemoteAddress({});
+        publishConnectionSnapshot();
         // The original network configuration is not meaningful when not
         // connected; we don't have any way to know if it changes.  (When
         // connected, we rely on the VPN connection breaking to know when it
@@ -1284,6 +2327,11 @@ void Daemon::vpnStateChanged(VPNConnection::State state,
         _state.openVpnAuthFailed(0);
     }
 
+    // Background update downloads only occur while the connection isn't
+    // changing
+    _updateDownloader.setNetworkIdle(state == VPNConnection::State::Connected ||
+                                     state == VPNConnection::State::Disconnected);
+
     // Indicate unexpected loss of connection
     if(state == VPNConnection::State::Interrupted)
         _state.connectionLost(QDateTime::currentMSecsSinceEpoch());
@@ -1343,6 +2391,34 @@ void Daemon::vpnByteCountsChanged()
     _state.bytesReceived(_connection->bytesReceived());
     _state.bytesSent(_connection->bytesSent());
     _state.intervalMeasurements(_connection->intervalMeasurements());
+    updateSplitTunnelBandwidth();
+
+    if(!_throughputLocation.isEmpty() && !_state.intervalMeasurements().isEmpty())
+    {
+        const auto &last = _state.intervalMeasurements().last();
+        double throughput = static_cast<double>(last.received() + last.sent()) /
+            std::max(_settings.bandwidthSampleInterval(), 1u);
+        _connectionPeakThroughput = std::max(_connectionPeakThroughput, throughput);
+    }
+}
+
+void Daemon::updateStateChannel()
+{
+    if(!_stateChannel.isOpen())
+        return;
+
+    StateChannelValues values{};
+    values.connectionState = _state.connectionState();
+    values.bytesReceived = _state.bytesReceived();
+    values.bytesSent = _state.bytesSent();
+    values.forwardedPort = _state.forwardedPort();
+    // Keep the most recent intervals if there are more than the channel holds
+    const auto &intervals = _state.intervalMeasurements();
+    values.intervalCount = std::min<std::size_t>(intervals.size(), values.intervals.size());
+    auto itInterval = intervals.end() - static_cast<int>(values.intervalCount);
+    for(std::size_t i = 0; i < values.intervalCount; ++i, ++itInterval)
+        values.intervals[i] = {itInterval->received(), itInterval->sent()};
+    _stateChannel.write(values);
 }
 
 // Find original gateway IP and interface
@@ -1364,22 +2440,20 @@ void Daemon::newLatencyMeasurements(const LatencyTracker::Latencies &measurement
 
     for(const auto &measurement : measurements)
     {
-        // Look for a ServerLocation with this ID, and set its latency.
-        // There can only be one location with this ID - the locations are sent
-        // as attributes of a JSON object, and the JSON parser won't load more
-        // than one value for the same attribute name.
-        auto itLocation = std::find_if(_data.locations().begin(),
-                                       _data.locations().end(),
-                                       [&](const auto &pLocation)
-                                       {
-                                           return pLocation->id() == measurement.first;
-                                       });
-        // If the location still exists, store the new latency.
-        if(itLocation != _data.locations().end())
+        // Look for a ServerLocation with this ID, and set its latency.  The
+        // locations are keyed by ID.
+        const auto &pLocation = _data.locations().value(measurement.id);
+        // If the location still exists, store the new latency.  This moves it
+        // to its new position in the nearest locations index.
+        if(pLocation)
         {
-            // Get pointer from iterator-to-pointer
-            const auto &pLocation = *itLocation;
-            pLocation->latency(static_cast<double>(measurement.second.count()));
+            // The loss and jitter are set first so the ranking scores them
+            // along with the latency.
+            pLocation->loss(measurement.loss);
+            pLocation->jitter(static_cast<double>(measurement.jitter.count()));
+            pLocation->latencyMethod(measurement.method == LatencyTracker::ProbeMethod::Tcp ?
+                                     QStringLiteral("tcp") : QStringLiteral("udp"));
+            _nearestLocations.updateLatency(pLocation, static_cast<double>(measurement.latency.count()));
 
             // We applied at least one measurement, rebuild the grouped
             // locations and trigger updates
@@ -1389,18 +2463,13 @@ void Daemon::newLatencyMeasurements(const LatencyTracker::Latencies &measurement
 
     if(locationsChanged)
     {
-        // Rebuild the grouped locations, since the locations changed
-        rebuildLocations();
-
-        // At the moment, Daemon only detects changes in properties of
-        // DaemonData itself, not properties of nested objects.  As a
-        // workaround, emit the change notifications here so the latency change
-        // is detected and propagated to clients.
+        // Rebuild the grouped locations, since the locations changed.  The
+        // index is already up to date.
         //
-        // Daemon doesn't actually listen to locationsChanged, but emit it too
-        // in case anything else does
-        emit _data.locationsChanged();
-        emit _data.propertyChanged(QStringLiteral("locations"));
+        // The latency changes themselves are published to clients as nested
+        // changes in DaemonData::locations and the DaemonState locations
+        // containing the same ServerLocation objects.
+        updateNearestLocations();
     }
 }
 
@@ -1411,6 +2480,36 @@ void Daemon::portForwardUpdated(int port, bool needsReconnect)
 
     qInfo() << "Forwarded port updated to" << port;
     _state.forwardedPort(port);
+    checkPostConnectComplete();
+}
+
+void Daemon::checkPostConnectComplete()
+{
+    if(!_postConnectTimer.isValid())
+        return;
+    // Still waiting on the VPN IP or a port forward request
+    if(_state.externalVpnIp().isEmpty() ||
+       _state.forwardedPort() == DaemonState::PortForwardState::Attempting)
+    {
+        return;
+    }
+
+    qint64 elapsed = _postConnectTimer.elapsed();
+    _postConnectTimer.invalidate();
+    _postConnectDeadline.stop();
+    _state.postConnectTime(elapsed);
+    qInfo() << "Post-connect data available after" << elapsed << "ms";
+}
+
+void Daemon::postConnectDeadlineElapsed()
+{
+    if(!_postConnectTimer.isValid())
+        return;
+    _postConnectTimer.invalidate();
+    qWarning() << "Post-connect data not available after"
+        << traceMsec(postConnectDeadline) << "- VPN IP:"
+        << (_state.externalVpnIp().isEmpty() ? "pending" : "found")
+        << "- forwarded port:" << _state.forwardedPort();
 }
 
 void Daemon::updateSupportedVpnPorts(const QJsonObject &serversObj)
@@ -1435,6 +2534,7 @@ void Daemon::updateSupportedVpnPorts(const QJsonObject &serversObj)
 
 void Daemon::regionsLoaded(const QJsonDocument &regionsJsonDoc)
 {
+    EventLoopWatchdog::Activity activity{QStringLiteral("Daemon::regionsLoaded")};
     const auto &serversObj = regionsJsonDoc.object();
 
     // update the available port numbers for udp/tcp
@@ -1453,32 +2553,58 @@ void Daemon::regionsLoaded(const QJsonDocument &regionsJsonDoc)
         return;
     }
 
+    // A load succeeded, tell JsonRefresher to switch to the long interval
+    _regionRefresher.loadSucceeded();
+
+    // The regions list rarely changes much.  Keep the existing objects for
+    // unchanged regions so only the changes are published, and skip the
+    // updates below entirely if nothing changed.
+    bool pingChanged{false};
+    int changedCount = reuseUnchangedLocations(_data.locations(), newLocations,
+                                               &pingChanged);
+    if(changedCount == 0)
+    {
+        qInfo() << "Regions list has not changed";
+        return;
+    }
+    qInfo() << "Regions list changed for" << changedCount << "regions";
+
     // The data were loaded successfully, store it in DaemonData
     _data.locations(newLocations);
 
     // Update the grouped locations too
     rebuildLocations();
 
-    //Update the locations in LatencyTracker
-    _latencyTracker.updateLocations(newLocations);
-
-    // A load succeeded, tell JsonRefresher to switch to the long interval
-    _regionRefresher.loadSucceeded();
+    //Update the locations in LatencyTracker if any ping addresses changed
+    if(pingChanged)
+        _latencyTracker.updateLocations(newLocations);
 }
 
 void Daemon::shadowsocksRegionsLoaded(const QJsonDocument &shadowsocksRegionsJsonDoc)
 {
+    EventLoopWatchdog::Activity activity{QStringLiteral("Daemon::shadowsocksRegionsLoaded")};
     const auto &shadowsocksRegionsObj = shadowsocksRegionsJsonDoc.object();
 
     // Build new ServerLocations
     auto newLocations = updateShadowsocksLocations(_data.locations(),
                                                    shadowsocksRegionsObj);
+    _shadowsocksRefresher.loadSucceeded();
+
+    // Like regionsLoaded(), only apply the changes
+    int changedCount = reuseUnchangedLocations(_data.locations(), newLocations);
+    if(changedCount == 0)
+    {
+        qInfo() << "Shadowsocks regions have not changed";
+        return;
+    }
+    qInfo() << "Shadowsocks servers changed for" << changedCount << "regions";
+    // Probe the new servers the next time a location is picked
+    _shadowsocksProbeAge.invalidate();
+
     _data.locations(newLocations);
 
     // Rebuild grouped locations and consequent location state
     rebuildLocations();
-
-    _shadowsocksRefresher.loadSucceeded();
 }
 
 void Daemon::refreshAccountInfo()
@@ -1563,7 +2689,7 @@ void Daemon::resetAccountInfo()
     _account.assign(blank);
 }
 
-void Daemon::reapplyFirewallRules()
+FirewallParams Daemon::buildFirewallParams(bool expectConnected, bool &killswitchEnabled)
 {
     FirewallParams params {};
 
@@ -1573,7 +2699,7 @@ void Daemon::reapplyFirewallRules()
     if(_state.connectingConfig().vpnLocation())
         pConnSettings = &_state.connectingConfig();
     // If the VPN is enabled, have we connected since it was enabled?
-    if(_state.vpnEnabled() && _state.connectedConfig().vpnLocation())
+    if(_state.vpnEnabled() && (expectConnected || _state.connectedConfig().vpnLocation()))
     {
         // Yes, we have connected
         params.hasConnected = true;
@@ -1583,7 +2709,7 @@ void Daemon::reapplyFirewallRules()
             pConnSettings = &_state.connectedConfig();
     }
 
-    bool killswitchEnabled = false;
+    killswitchEnabled = false;
     // If the daemon is not active (no client is connected) or the user is not
     // logged in to an account, we do not apply the KS.
     if (!isActive() || !_account.loggedIn())
@@ -1594,9 +2720,15 @@ void Daemon::reapplyFirewallRules()
         killswitchEnabled = params.hasConnected;
 
     const bool vpnActive = _state.vpnEnabled();
+    const bool connected = expectConnected || _connection->state() == VPNConnection::State::Connected;
 
     // only update our DNS firewall rules when not connected
-    params.dnsServers = getDNSServers(_connection->state() == VPNConnection::State::Connected ? _connection->dnsServers() : _settings.overrideDNS());
+    params.dnsServers = getDNSServers(connected ? _connection->dnsServers() : _settings.overrideDNS());
+    // When the DNS cache is in use, the OS only talks to the cache; the cache's
+    // own upstream queries are permitted by allowPIA.  (While connecting, this
+    // is already known for the current attempt.)
+    if(connected && _connection->dnsCacheActive())
+        params.dnsServers = QStringList{dnsCacheLocalAddress};
     params.adapter = _connection->networkAdapter();
 
     if(_settings.splitTunnelEnabled())
@@ -1610,7 +2742,8 @@ void Daemon::reapplyFirewallRules()
 
     for(const auto &rule : _settings.splitTunnelRules())
     {
-        qInfo() << "split tunnel rule:" << rule.path() << rule.mode();
+        if(!expectConnected)
+            qInfo() << "split tunnel rule:" << rule.path() << rule.mode();
         // Ignore anything with a rule type we don't recognize
         if(rule.mode() == QStringLiteral("exclude"))
             params.excludeApps.push_back(rule.path());
@@ -1638,7 +2771,18 @@ void Daemon::reapplyFirewallRules()
     params.allowLAN = _settings.allowLAN() && (params.blockAll || params.blockIPv6);
     params.blockDNS = !params.dnsServers.isEmpty() && vpnActive && params.hasConnected;
     params.allowPIA = params.allowLoopback = (params.blockAll || params.blockIPv6 || params.blockDNS);
-    params.allowHnsd = params.blockDNS && isDNSHandshake(_connection->dnsServers());
+    params.allowHnsd = params.blockDNS && (isDNSHandshake(_connection->dnsServers()) ||
+                                           _connection->hnsdEnabled());
+
+    return params;
+}
+
+void Daemon::reapplyFirewallRules()
+{
+    EventLoopWatchdog::Activity activity{QStringLiteral("Daemon::reapplyFirewallRules")};
+
+    bool killswitchEnabled = false;
+    FirewallParams params = buildFirewallParams(false, killswitchEnabled);
 
     qInfo() << "Reapplying firewall rules;"
             << "state:" << qEnumToString(_connection->state())
@@ -1653,6 +2797,100 @@ void Daemon::reapplyFirewallRules()
     applyFirewallRules(params);
 
     _state.killswitchEnabled(killswitchEnabled);
+
+    // While connecting, let the backend stage the rules for the Connected
+    // state now, so the transition is just a swap of the enabled anchors.
+    if(_state.vpnEnabled() && _state.connectingConfig().vpnLocation())
+    {
+        bool nextKillswitchEnabled = false;
+        prepareFirewallRules(params, buildFirewallParams(true, nextKillswitchEnabled));
+    }
+}
+
+void Daemon::applyMetricsPort()
+{
+    // The port is applied by start(); ignore changes before that (such as
+    // while migrating settings).
+    if(!_server)
+        return;
+
+    uint port = _settings.metricsPort();
+    if(port == 0 || port > 65535)
+        _metricsServer.stop();
+    else
+        _metricsServer.start(static_cast<quint16>(port));
+}
+
+void Daemon::collectMetrics()
+{
+    Metrics::setGauge(QStringLiteral("pia_bytes_received"),
+                      static_cast<double>(_state.bytesReceived()));
+    Metrics::setGauge(QStringLiteral("pia_bytes_sent"),
+                      static_cast<double>(_state.bytesSent()));
+    Metrics::setGauge(QStringLiteral("pia_vpn_connected"),
+                      _connection->state() == VPNConnection::State::Connected ? 1 : 0);
+    Metrics::clearGauge(QStringLiteral("pia_vpn_connection_state"));
+    Metrics::setGauge(QStringLiteral("pia_vpn_connection_state"), 1,
+                      {{QStringLiteral("state"), _state.connectionState()}});
+
+    // IPC queue depth - bytes queued to clients that haven't been written yet
+    qint64 queuedBytes = 0;
+    for(IPCConnection *pConnection : _clients.keys())
+        queuedBytes += pConnection->bytesToWrite();
+    Metrics::setGauge(QStringLiteral("pia_ipc_clients"), _clients.size());
+    Metrics::setGauge(QStringLiteral("pia_ipc_queued_bytes"),
+                      static_cast<double>(queuedBytes));
+
+    // Memory - the process's resident size, and the approximate size of the
+    // region data, which is the largest structure the daemon holds
+    Metrics::setGauge(QStringLiteral("pia_process_resident_bytes"),
+                      static_cast<double>(processResidentBytes()));
+    const auto &regionStats = measureLocationsMemory(_data.locations());
+    const Metrics::Labels regionLabels{{QStringLiteral("subsystem"), QStringLiteral("regions")}};
+    Metrics::setGauge(QStringLiteral("pia_memory_objects"), regionStats.locations,
+                      regionLabels);
+    Metrics::setGauge(QStringLiteral("pia_memory_bytes"),
+                      static_cast<double>(regionStats.objectBytes + regionStats.sharedBytes),
+                      regionLabels);
+    // The difference between these shows how much the string sharing saves
+    Metrics::setGauge(QStringLiteral("pia_region_string_bytes"),
+                      static_cast<double>(regionStats.stringBytes),
+                      {{QStringLiteral("kind"), QStringLiteral("referenced")}});
+    Metrics::setGauge(QStringLiteral("pia_region_string_bytes"),
+                      static_cast<double>(regionStats.sharedBytes),
+                      {{QStringLiteral("kind"), QStringLiteral("allocated")}});
+    Metrics::setGauge(QStringLiteral("pia_memory_objects"),
+                      _state.groupedLocations().size(),
+                      {{QStringLiteral("subsystem"), QStringLiteral("region_groups")}});
+    Metrics::setGauge(QStringLiteral("pia_memory_bytes"), static_cast<double>(queuedBytes),
+                      {{QStringLiteral("subsystem"), QStringLiteral("ipc_queue")}});
+
+    // RPC call counts and latency histograms
+    QVector<double> bucketBounds;
+    bucketBounds.reserve(static_cast<int>(RpcLatencyHistogram::bucketBoundsMs.size()));
+    for(qint64 boundMs : RpcLatencyHistogram::bucketBoundsMs)
+        bucketBounds.push_back(boundMs / 1000.0);
+    auto setRpcHistogram = [&bucketBounds](const QString &name,
+                                           const RpcLatencyHistogram &histogram,
+                                           const Metrics::Labels &labels)
+    {
+        QVector<quint64> bucketCounts{histogram.buckets.begin(), histogram.buckets.end()};
+        Metrics::setHistogram(name, bucketBounds, bucketCounts,
+                              histogram.sumNs / 1.0e9, labels);
+    };
+    const auto &methodStats = _methodRegistry->methodStats();
+    for(auto itMethod = methodStats.begin(); itMethod != methodStats.end(); ++itMethod)
+    {
+        Metrics::Labels methodLabels{{QStringLiteral("method"), itMethod.key()}};
+        Metrics::setCounter(QStringLiteral("pia_rpc_calls"),
+                            static_cast<double>(itMethod->calls), methodLabels);
+        Metrics::setCounter(QStringLiteral("pia_rpc_errors"),
+                            static_cast<double>(itMethod->errors), methodLabels);
+        setRpcHistogram(QStringLiteral("pia_rpc_dispatch_seconds"),
+                        itMethod->dispatch, methodLabels);
+        setRpcHistogram(QStringLiteral("pia_rpc_duration_seconds"),
+                        itMethod->completion, methodLabels);
+    }
 }
 
 void Daemon::checkSplitTunnelSupport()
@@ -1671,9 +2909,9 @@ void Daemon::checkSplitTunnelSupport()
 #endif
 
 #ifdef Q_OS_LINUX
-    // This cgroup must be mounted in this location for this feature.
-    QFileInfo cgroupFile(Path::ParentVpnExclusionsFile);
-    if(!cgroupFile.exists())
+    // Either the net_cls cgroup must be mounted in its usual location, or
+    // a cgroup v2 hierarchy must be available for this feature.
+    if(!LinuxCGroups::isSupported())
         errors.push_back(QStringLiteral("cgroups_invalid"));
 
     // iptables 1.6.1 is required.
@@ -1873,17 +3111,75 @@ void Daemon::upgradeSettings(bool existingSettingsFile)
 }
 
 void Daemon::rebuildLocations()
+{
+    _nearestLocations.reset(_data.locations());
+    updateNearestLocations();
+}
+
+void Daemon::applyLocationRanking()
+{
+    if(_settings.locationRanking() == QStringLiteral("weighted"))
+        _nearestLocations.setRanking(std::make_shared<WeightedLocationRanking>(_data.locationHistory()));
+    else
+        _nearestLocations.setRanking(std::make_shared<LocationRanking>());
+}
+
+void Daemon::recordConnectOutcome(const QString &locationId, bool success)
+{
+    auto history = _data.locationHistory();
+    LocationHistory &entry = history[locationId];
+    double sample = success ? 1.0 : 0.0;
+    if(entry.connectSuccess())
+        sample = locationHistoryWeight * sample + (1.0 - locationHistoryWeight) * entry.connectSuccess().get();
+    entry.connectSuccess(sample);
+    qInfo() << "Connection" << (success ? "succeeded" : "had trouble") << "for"
+        << locationId << "- success rate now" << sample;
+    _data.locationHistory(history);
+
+    applyLocationRanking();
+    updateNearestLocations();
+}
+
+void Daemon::recordLocationThroughput(const QString &locationId, double throughput)
+{
+    auto history = _data.locationHistory();
+    LocationHistory &entry = history[locationId];
+    if(entry.throughput())
+        throughput = locationHistoryWeight * throughput + (1.0 - locationHistoryWeight) * entry.throughput().get();
+    entry.throughput(throughput);
+    qInfo() << "Throughput for" << locationId << "now" << throughput;
+    _data.locationHistory(history);
+
+    applyLocationRanking();
+    updateNearestLocations();
+}
+
+void Daemon::updateNearestLocations()
 {
     // Update the grouped locations from the new stored locations
-    _state.groupedLocations(buildGroupedLocations(_data.locations()));
+    _state.groupedLocations(_nearestLocations.buildGroupedLocations());
 
-    // Pick the best location
-    NearestLocations nearest{_data.locations()};
-    _state.vpnLocations().bestLocation(nearest.getNearestSafeVpnLocation(_settings.portForward()));
+    // Pick the best location.  The current best location is kept if the new
+    // one is only marginally better, so it doesn't flap between similar
+    // locations (causing needsReconnect churn).
+    _state.vpnLocations().bestLocation(_nearestLocations.getNearestSafeVpnLocation(_settings.portForward(),
+                                                                                   _state.vpnLocations().bestLocation()));
 
     updateChosenLocations();
 }
 
+void Daemon::updateLatencyPriorities()
+{
+    QSet<QString> priorityLocations;
+    for(const auto &favorite : _settings.favoriteLocations())
+        priorityLocations.insert(favorite);
+    if(_settings.location() != QLatin1String("auto"))
+        priorityLocations.insert(_settings.location());
+    if(_settings.proxyShadowsocksLocation() != QLatin1String("auto"))
+        priorityLocations.insert(_settings.proxyShadowsocksLocation());
+    _latencyTracker.setPriorityLocations(priorityLocations);
+}
+
 void Daemon::updateChosenLocations()
 {
     // Find the user's chosen location (nullptr if it's 'auto' or doesn't exist)
@@ -1911,22 +3207,47 @@ void Daemon::updateChosenLocations()
 
     // The best Shadowsocks location depends on the next VPN location
     auto pNextLocation = _state.vpnLocations().nextLocation();
+
+    // Find the standby location - the best location other than the next one,
+    // preferring port forwarding locations if port forwarding is enabled
+    QSharedPointer<ServerLocation> pStandbyLocation;
+    if(_settings.standbyFailover() && pNextLocation &&
+       !_state.vpnLocations().chosenLocation())
+    {
+        const QString &nextId = pNextLocation->id();
+        if(_settings.portForward())
+        {
+            pStandbyLocation = _nearestLocations.getNearestSafeServiceLocation(
+                [&](const ServerLocation &loc){ return loc.id() != nextId && loc.portForward(); });
+        }
+        if(!pStandbyLocation)
+        {
+            pStandbyLocation = _nearestLocations.getNearestSafeServiceLocation(
+                [&](const ServerLocation &loc){ return loc.id() != nextId; });
+        }
+    }
+    _state.vpnLocations().standbyLocation(pStandbyLocation);
     if(!pNextLocation)
     {
         // No locations are known, can't do anything else.
         _state.shadowsocksLocations().bestLocation({});
         _state.shadowsocksLocations().chosenLocation({});
+        updatePrestartShadowsocks();
         return;
     }
 
-    // If the next location has SS, use that, that will add the least latency
-    if(pNextLocation->shadowsocks())
+    // Use the location with the fastest proxy server if they've been probed.
+    // Otherwise, if the next location has SS, use that, that will add the
+    // least latency
+    auto pFastestSsLocation = getFastestShadowsocksLocation();
+    if(pFastestSsLocation)
+        _state.shadowsocksLocations().bestLocation(pFastestSsLocation);
+    else if(pNextLocation->shadowsocks())
         _state.shadowsocksLocations().bestLocation(pNextLocation);
     else
     {
-        NearestLocations nearest{_data.locations()};
         // If no SS locations are known, this is set to nullptr
-        _state.shadowsocksLocations().bestLocation(nearest.getNearestSafeServiceLocation(
+        _state.shadowsocksLocations().bestLocation(_nearestLocations.getNearestSafeServiceLocation(
             [](auto loc){ return loc.shadowsocks(); }));
     }
 
@@ -1935,6 +3256,83 @@ void Daemon::updateChosenLocations()
         _state.shadowsocksLocations().nextLocation(_state.shadowsocksLocations().chosenLocation());
     else
         _state.shadowsocksLocations().nextLocation(_state.shadowsocksLocations().bestLocation());
+
+    updatePrestartShadowsocks();
+}
+
+void Daemon::updatePrestartShadowsocks()
+{
+    probeShadowsocksLocations();
+
+    // Only keep Shadowsocks running while a client is active and the proxy is
+    // configured; it's not needed otherwise.
+    if(isActive() && !_stopping && _settings.prestartShadowsocks() &&
+       _settings.proxy() == QStringLiteral("shadowsocks"))
+    {
+        _connection->prestartShadowsocks(_state.shadowsocksLocations().nextLocation());
+    }
+    else
+        _connection->prestartShadowsocks({});
+}
+
+void Daemon::probeShadowsocksLocations()
+{
+    if(_pShadowsocksProbe || !isActive() || _stopping ||
+       _settings.proxy() != QStringLiteral("shadowsocks") ||
+       _settings.proxyShadowsocksLocation() != QLatin1String("auto") ||
+       _connection->state() != VPNConnection::State::Disconnected)
+    {
+        return;
+    }
+    if(_shadowsocksProbeAge.isValid() &&
+       _shadowsocksProbeAge.elapsed() < msec(shadowsocksProbeInterval))
+    {
+        return;
+    }
+
+    std::vector<ProxyProbe::Endpoint> endpoints;
+    for(const auto &pLocation : _data.locations())
+    {
+        if(!pLocation || !pLocation->shadowsocks() || !pLocation->isSafeForAutoConnect())
+            continue;
+        const auto &pSsServer = pLocation->shadowsocks();
+        endpoints.push_back({pLocation->id(),
+                             ConnectionConfig::parseIpv4Host(pSsServer->host()),
+                             static_cast<quint16>(pSsServer->port())});
+    }
+    if(endpoints.empty())
+        return;
+
+    ProxyProbe *pProbe = new ProxyProbe{endpoints};
+    _pShadowsocksProbe = pProbe;
+    connect(pProbe, &ProxyProbe::finished, this,
+        [this, pProbe](const ProxyProbe::Latencies &latencies)
+        {
+            pProbe->deleteLater();
+            _pShadowsocksProbe = nullptr;
+            _shadowsocksLatencies = latencies;
+            _shadowsocksProbeAge.start();
+            updateChosenLocations();
+        });
+}
+
+QSharedPointer<ServerLocation> Daemon::getFastestShadowsocksLocation() const
+{
+    QSharedPointer<ServerLocation> pFastest;
+    std::chrono::milliseconds fastestLatency{};
+    for(auto itLatency = _shadowsocksLatencies.begin(); itLatency != _shadowsocksLatencies.end(); ++itLatency)
+    {
+        // The location must still exist and have Shadowsocks
+        auto pLocation = _data.locations().value(itLatency.key());
+        if(!pLocation || !pLocation->shadowsocks() || !pLocation->isSafeForAutoConnect())
+            continue;
+        if(!pFastest || itLatency.value() < fastestLatency)
+        {
+            pFastest = std::move(pLocation);
+            fastestLatency = itLatency.value();
+        }
+    }
+    return pFastest;
 }
 
 void Daemon::onUpdateRefreshed(const Update &availableUpdate,
@@ -1986,27 +3384,30 @@ void Daemon::onUpdateDownloadFailed(const QString &version, bool error)
 
 void Daemon::logCommand(const QString &cmd, const QStringList &args)
 {
-    qInfo() << cmd << args;
+    CommandExecutor::Command command;
+    command.program = cmd;
+    command.arguments = args;
+    // This is strictly for diagnostics, only allow ~1 second
+    command.timeout = std::chrono::seconds{1};
 
-    QProcess proc;
-    proc.setProgram(cmd);
-    proc.setArguments(args);
-
-    proc.start();
-    // This is strictly for diagnostics, only wait ~1 second to avoid blocking
-    // the daemon for very long
-    if(proc.waitForFinished(1000))
-    {
-        qInfo() << "status:" << proc.exitStatus() << "- code:" << proc.exitCode();
-        qInfo() << "stdout:";
-        qInfo().noquote() << proc.readAllStandardOutput();
-        qInfo() << "stderr:";
-        qInfo().noquote() << proc.readAllStandardError();
-    }
-    else
-    {
-        qInfo() << "Failed to execute - status:" << proc.exitStatus() << "- code:" << proc.exitCode();
-    }
+    // The output is logged when the command finishes; the daemon doesn't wait
+    // for it
+    _commandExecutor.run(std::move(command))
+        ->notify(this, [cmd, args](const Error &, const CommandResult &result)
+        {
+            if(result.error == QProcess::UnknownError)
+            {
+                qInfo() << cmd << args << "- code:" << result.exitCode;
+                qInfo() << "stdout:";
+                qInfo().noquote() << result.standardOutput;
+                qInfo() << "stderr:";
+                qInfo().noquote() << result.standardError;
+            }
+            else
+            {
+                qInfo() << cmd << args << "- failed to execute:" << result.error;
+            }
+        });
 }
 
 void Daemon::logRoutingTable()
@@ -2040,6 +3441,12 @@ ClientConnection::ClientConnection(IPCConnection *connection, LocalMethodRegistr
     , _connection(connection)
     , _rpc(new ServerSideInterface(registry, this))
     , _active(false)
+    , _dataPatch(false)
+    , _binaryPayload(false)
+    , _locationColumns(false)
+    , _hasSubscriptions(false)
+    , _backlogged(false)
+    , _droppedNotifications(0)
     , _state(Connected)
 {
     auto setDisconnected = [this]() {
@@ -2060,9 +3467,132 @@ ClientConnection::ClientConnection(IPCConnection *connection, LocalMethodRegistr
       _rpc->processMessage(msg);
     });
     connect(_rpc, &ServerSideInterface::messageReady, _connection, &IPCConnection::sendMessage);
+    connect(_connection, &IPCConnection::bytesWritten, this, &ClientConnection::checkCaughtUp);
 }
 ClientConnection* ClientConnection::_invokingClient = nullptr;
 
+namespace
+{
+    // If more than this many bytes are waiting to be sent to a client, it's
+    // considered backlogged.  This is a few complete snapshots of all
+    // properties, so a client that's just briefly busy isn't affected.
+    const qint64 clientBacklogLimit = 4 * 1024 * 1024;
+}
+
+bool ClientConnection::updateBacklogged()
+{
+    if(!_backlogged && _connection &&
+       _connection->bytesToWrite() > clientBacklogLimit)
+    {
+        qWarning() << "Client" << this << "has" << _connection->bytesToWrite()
+            << "unsent bytes, dropping data notifications until it catches up";
+        _backlogged = true;
+    }
+    return _backlogged;
+}
+
+void ClientConnection::checkCaughtUp()
+{
+    if(_backlogged && _connection && _connection->bytesToWrite() == 0)
+    {
+        _backlogged = false;
+        qInfo() << "Client" << this << "caught up, dropped"
+            << _droppedNotifications << "data notifications in total";
+        emit caughtUp();
+    }
+}
+
+void ClientConnection::setBinaryPayload(bool binaryPayload)
+{
+    _binaryPayload = binaryPayload;
+    _rpc->setEncoding(binaryPayload ? JsonRPCEncoding::Binary : JsonRPCEncoding::Text);
+}
+
+void ClientConnection::setSubscriptions(const QJsonObject &subscriptions)
+{
+    _subscriptions.clear();
+    for(auto itObject = subscriptions.begin(); itObject != subscriptions.end(); ++itObject)
+    {
+        QSet<QString> &properties = _subscriptions[itObject.key()];
+        for(const auto &property : itObject.value().toArray())
+        {
+            if(property.isString())
+                properties.insert(property.toString());
+        }
+    }
+    _hasSubscriptions = true;
+}
+
+void ClientConnection::clearSubscriptions()
+{
+    _subscriptions.clear();
+    _hasSubscriptions = false;
+}
+
+bool ClientConnection::isSubscribed(const QString &objectName, const QString &property) const
+{
+    if(!_hasSubscriptions)
+        return true;
+    auto itSubscription = _subscriptions.find(objectName);
+    return itSubscription != _subscriptions.end() && itSubscription->contains(property);
+}
+
+QJsonObject ClientConnection::filterData(const QJsonObject &data) const
+{
+    if(!_hasSubscriptions)
+        return data;
+
+    QJsonObject result;
+    for(auto itObject = data.begin(); itObject != data.end(); ++itObject)
+    {
+        auto itSubscription = _subscriptions.find(itObject.key());
+        if(itSubscription == _subscriptions.end())
+            continue;
+        QJsonObject properties = itObject.value().toObject();
+        QJsonObject filtered;
+        for(const auto &property : *itSubscription)
+        {
+            auto itProperty = properties.find(property);
+            if(itProperty != properties.end())
+                filtered.insert(property, itProperty.value());
+        }
+        if(!filtered.isEmpty())
+            result.insert(itObject.key(), filtered);
+    }
+    return result;
+}
+
+QJsonObject ClientConnection::filterPatch(const QJsonObject &patch) const
+{
+    if(!_hasSubscriptions)
+        return patch;
+
+    QJsonObject result;
+    for(auto itObject = patch.begin(); itObject != patch.end(); ++itObject)
+    {
+        auto itSubscription = _subscriptions.find(itObject.key());
+        if(itSubscription == _subscriptions.end())
+            continue;
+        QJsonArray filtered;
+        for(const auto &patchOp : itObject.value().toArray())
+        {
+            // The first path segment is the property name
+            QStringList path = jsonPointerSplit(patchOp.toObject().value(QStringLiteral("path")).toString());
+            if(!path.isEmpty() && itSubscription->contains(path.front()))
+                filtered.append(patchOp);
+        }
+        if(!filtered.isEmpty())
+            result.insert(itObject.key(), filtered);
+    }
+    return result;
+}
+
+void ClientConnection::sendMessage(const QByteArray &msg)
+{
+    if(_connection)
+        _connection->sendMessage(msg);
+}
+
 void ClientConnection::disconnect()
 {
     if (_state < Disconnecting)
@@ -25,19 +25,32 @@
 
 #include "settings.h"
 #include "async.h"
+#include "commandexecutor.h"
+#include "connectionsnapshot.h"
 #include "jsonrpc.h"
+#include "eventloopwatchdog.h"
 #include "latencytracker.h"
+#include "metricsserver.h"
 #include "portforwarder.h"
+#include "sampleprofiler.h"
+#include "selftest.h"
+#include "servicetimer.h"
 #include "socksserverthread.h"
+#include "statechannel.h"
 #include "updatedownloader.h"
 #include "vpn.h"
 #include "apiclient.h"
+#include "thread.h"
+#include "workerpool.h"
 
 #include <QCoreApplication>
 #include <QHash>
+#include <QMutex>
 #include <QSet>
 #include <QTimer>
 #include <QNetworkAccessManager>
+#include <QElapsedTimer>
+#include <deque>
 
 
 class IPCConnection;
@@ -60,6 +73,8 @@ public:
 
     template<typename... Args>
     void post(const QString& name, Args&&... args) { _rpc->post(name, std::forward<Args>(args)...); }
+    // Send a message that was already encoded (see encodeJsonRPCNotification())
+    void sendMessage(const QByteArray &msg);
 
     // Daemon distinguishes between two types of client connections so it knows
     // whether to disconnect the VPN on a client exit, and to handle client
@@ -87,16 +102,77 @@ public:
     bool getActive() const {return _active;}
     void setActive(bool active) {_active = active;}
 
+    // Whether the client applies incremental "patch" notifications instead of
+    // full "data" notifications.  Clients opt in with RPC_handshake(); clients
+    // that never call it receive full property values.
+    bool getDataPatch() const {return _dataPatch;}
+    void setDataPatch(bool dataPatch) {_dataPatch = dataPatch;}
+
+    // Whether messages to the client use the binary JSON encoding (also opted
+    // into with RPC_handshake()).
+    bool getBinaryPayload() const {return _binaryPayload;}
+    void setBinaryPayload(bool binaryPayload);
+
+    // Whether the locations lists are sent to the client in their columnar
+    // encoding (see encodeLocationsColumns(); also opted into with
+    // RPC_handshake()).
+    bool getLocationColumns() const {return _locationColumns;}
+    void setLocationColumns(bool locationColumns) {_locationColumns = locationColumns;}
+
+    // Properties the client has subscribed to with RPC_subscribe().  Until it
+    // subscribes, it receives changes in all properties.  Once it does, it
+    // only receives the subscribed properties; objects that aren't listed are
+    // not sent at all.
+    bool hasSubscriptions() const {return _hasSubscriptions;}
+    void setSubscriptions(const QJsonObject &subscriptions);
+    // Remove the subscriptions; the client receives all properties again.
+    void clearSubscriptions();
+    // Whether the client receives a property - true for all properties if it
+    // hasn't subscribed.
+    bool isSubscribed(const QString &objectName, const QString &property) const;
+    // Filter a "data" notification's parameter object down to the subscribed
+    // properties.  (Returns the object unchanged if the client hasn't
+    // subscribed.)
+    QJsonObject filterData(const QJsonObject &data) const;
+    // Filter a "patch" notification's parameter object down to operations on
+    // subscribed properties.
+    QJsonObject filterPatch(const QJsonObject &patch) const;
+
+    // Whether the client has fallen too far behind in reading messages.  Data
+    // notifications to a backlogged client are dropped rather than queued
+    // without bound; once it has read everything that is queued, it emits
+    // caughtUp() and gets a full snapshot of the current values.
+    //
+    // updateBacklogged() checks the amount of unsent data and returns the new
+    // backlogged state.
+    bool isBacklogged() const {return _backlogged;}
+    bool updateBacklogged();
+    // Count a data notification that was dropped due to the backlog.
+    void dropDataNotification() {++_droppedNotifications;}
+
     void disconnect();
 
 signals:
     void disconnected();
+    void caughtUp();
+
+private:
+    void checkCaughtUp();
 
 private:
     IPCConnection* _connection;
     static ClientConnection *_invokingClient;
     ServerSideInterface* _rpc;
     bool _active;
+    bool _dataPatch;
+    bool _binaryPayload;
+    bool _locationColumns;
+    bool _hasSubscriptions;
+    // Subscribed property names, keyed by object name
+    QHash<QString, QSet<QString>> _subscriptions;
+    bool _backlogged;
+    // Total number of data notifications dropped for this client
+    quint64 _droppedNotifications;
     State _state;
 };
 
@@ -153,15 +229,61 @@ struct FirewallParams
     OriginalNetworkScan splitTunnelNetScan;
     QVector<QString> excludeApps; // Apps to exclude if VPN exemptions are enabled
     QVector<QString> vpnOnlyApps; // Apps to force on the VPN
+
+    // Compare all parameters - used by the platform implementations to skip
+    // rules that haven't changed since they were last applied.
+    bool operator==(const FirewallParams &other) const
+    {
+        return dnsServers == other.dnsServers && adapter == other.adapter &&
+            blockAll == other.blockAll && allowVPN == other.allowVPN &&
+            allowDHCP == other.allowDHCP && blockIPv6 == other.blockIPv6 &&
+            allowLAN == other.allowLAN && blockDNS == other.blockDNS &&
+            allowPIA == other.allowPIA && allowLoopback == other.allowLoopback &&
+            allowHnsd == other.allowHnsd && hasConnected == other.hasConnected &&
+            defaultRoute == other.defaultRoute &&
+            enableSplitTunnel == other.enableSplitTunnel &&
+            splitTunnelNetScan == other.splitTunnelNetScan &&
+            excludeApps == other.excludeApps && vpnOnlyApps == other.vpnOnlyApps;
+    }
+    bool operator!=(const FirewallParams &other) const
+    {
+        return !(*this == other);
+    }
 };
 Q_DECLARE_METATYPE(FirewallParams)
 
-class DiagnosticsFile
+// DiagnosticsFile writes the parts of a diagnostics file.  Commands are run
+// concurrently, but the parts are written in the order they were added, each
+// one as soon as it and all preceding parts are complete.  The daemon does not
+// wait for the commands; use finish() to find out when the file is complete.
+//
+// DiagnosticsFile must be kept alive until finish() completes.
+class DiagnosticsFile : public QObject
 {
+    Q_OBJECT
+
 public:
     // Function type for processing command output for diagnostics.
     using ProcessOutputFunction = std::function<QByteArray(const QByteArray&)>;
 
+private:
+    // Maximum number of diagnostic commands run at once
+    enum : int { MaxConcurrentCommands = 4 };
+
+    // A part that has been added; written once it's complete.
+    struct Part
+    {
+        QString title;
+        // For commands - the result, the program (for errors), and the output
+        // processing function.  pResult is null for text parts.
+        Async<CommandResult> pResult;
+        QString program;
+        ProcessOutputFunction processOutput;
+        // For text parts - the text
+        QString text;
+        QElapsedTimer commandTime;
+    };
+
 public:
     DiagnosticsFile(const QString &filePath);
 
@@ -170,11 +292,17 @@ private:
 
     // Log the time and size of the part that was just written (updates
     // _currentSize).
-    void logPart(const QString &title, QElapsedTimer &commandTime);
+    void logPart(const QString &title, const QElapsedTimer &commandTime);
+
+    // Start a command and add its part
+    void addCommand(const QString &commandName, CommandExecutor::Command command,
+                    const ProcessOutputFunction &processOutput);
+
+    // Write the output of a completed command part
+    void writeCommandOutput(const Part &part);
 
-    // Execute a QProcess and write the output as a file part
-    void execAndWriteOutput(QProcess &cmd, const QString &commandName,
-                            const ProcessOutputFunction &processOutput);
+    // Write the completed parts at the front of _parts
+    void writeCompletedParts();
 
 public:
     // Write the result of a command as a file part
@@ -193,10 +321,18 @@ public:
     // Write a text blob as a file part
     void writeText(const QString &title, const QString &text);
 
+    // No more parts will be added.  The result resolves once all parts have
+    // been written.
+    Async<void> finish();
+
 private:
     QFile _diagFile;
     QTextStream _fileWriter;
     qint64 _currentSize;
+    CommandExecutor _commandExecutor;
+    std::deque<Part> _parts;
+    // Created by finish()
+    Async<void> _pFinished;
 };
 
 class Daemon;
@@ -253,6 +389,17 @@ public:
 
 protected:
     virtual void applyFirewallRules(const FirewallParams& params) {}
+    // While connecting, called after applyFirewallRules() with the rules
+    // expected once the connection is established.  Backends can stage
+    // anything that doesn't affect the current rules, so the transition to
+    // Connected changes as little as possible.  Nothing in 'next' can take
+    // effect yet, it's only a prediction.
+    virtual void prepareFirewallRules(const FirewallParams &current,
+                                      const FirewallParams &next) {}
+    // Sample split tunnel traffic into DaemonState::splitTunnelBandwidth.
+    // Called for each bandwidth measurement while connected; platforms that
+    // can't count split tunnel traffic don't implement it.
+    virtual void updateSplitTunnelBandwidth() {}
 
 protected:
     const QStringList& arguments() const { return _arguments; }
@@ -276,11 +423,38 @@ protected:
 protected:
     // RPC functions
 
-    QString RPC_handshake(const QString& version);
+    // Handshake with a client.  'features' lists optional protocol features
+    // supported by the client:
+    // - "dataPatch" - the client applies "patch" notifications containing
+    //   JSON patch operations, instead of receiving full "data" notifications
+    // - "binaryPayload" - the client accepts messages in Qt's binary JSON
+    //   encoding (starting with the response to this handshake)
+    QString RPC_handshake(const QString& version, const QJsonArray &features);
+    // Subscribe the client to changes in specific properties only.  The object
+    // maps object names ("data", "account", "settings", "state") to arrays of
+    // property names, such as {"state": ["connectionState"]}.  Replaces any
+    // prior subscriptions.
+    void RPC_subscribe(const QJsonObject &subscriptions);
+    // Remove the client's subscriptions, so it receives changes in all
+    // properties again.  The client is sent the current values of all
+    // properties, since it missed changes in the unsubscribed ones.
+    void RPC_unsubscribe();
+    // Get the current values of specific properties, without waiting for (or
+    // depending on) the data notifications.  Takes the same object as
+    // RPC_subscribe(); returns an object with the same keys containing the
+    // properties' values, such as {"state": {"connectionState": "Connected"}}.
+    // Unknown properties are null, unknown objects are ignored.
+    QJsonObject RPC_getProperties(const QJsonObject &properties);
     void RPC_applySettings(const QJsonObject& settings, bool reconnectIfNeeded = false);
     void RPC_resetSettings();
+    // Add, modify, or remove individual split tunnel rules, keyed by path,
+    // without sending the whole rule list.  Each rule in 'rules' replaces the
+    // existing rule with the same path, or is appended if there isn't one.
+    // Rules with paths in 'removePaths' are removed.  The result is applied
+    // like RPC_applySettings({splitTunnelRules: ...}).
+    void RPC_updateSplitTunnelRules(const QJsonArray &rules, const QJsonArray &removePaths);
     void RPC_connectVPN();
-    QJsonValue RPC_writeDiagnostics();
+    Async<QJsonValue> RPC_writeDiagnostics();
     void RPC_writeDummyLogs();
     void RPC_crash();
     void RPC_disconnectVPN();
@@ -296,6 +470,21 @@ protected:
     Async<QJsonValue> RPC_downloadUpdate();
     // Cancel an update download that is ongoing
     void RPC_cancelDownloadUpdate();
+    // Run an in-tunnel self test while connected (see SelfTest).  The result
+    // is returned and stored in DaemonState::selfTestResult.  If a test is
+    // already running, this returns its result when it finishes.
+    Async<QJsonValue> RPC_runSelfTest();
+    // Start or stop sampling the daemon's main thread (see SampleProfiler).
+    // The samples collected are included by RPC_writeDiagnostics().  Like
+    // diagnostics, this requires debug logging to be enabled.
+    void RPC_startProfiler(int intervalMs);
+    void RPC_stopProfiler();
+    // Get the stored connection sessions (newest first) and a summary of them
+    // for each region.  The sessions can be limited to one region, to those
+    // started at or after 'sinceTime' (ms since the epoch), and to at most
+    // 'limit' sessions; the defaults return everything.
+    QJsonObject RPC_getConnectionHistory(const QString &regionId,
+                                         qint64 sinceTime, int limit);
 
     // These RPCs are platform-specific; platform daemons override them with
     // implementation.
@@ -313,7 +502,7 @@ protected:
     // - wwa: Array of UWP package family IDs as above representing WWA apps.
     //
     // Apps that can't be identified are omitted from the results.
-    virtual QJsonValue RPC_inspectUwpApps(const QJsonArray &familyIds);
+    virtual Async<QJsonValue> RPC_inspectUwpApps(const QJsonArray &familyIds);
     // Do a manual check of the WFP callout driver state if SCM notifications
     // aren't being used.  (Used when pia-service.exe is invoked to install the
     // callout driver, it signals the running service to re-check the state.)
@@ -343,15 +532,47 @@ public slots:
     // Request that the daemon stop and exit.
     virtual void stop();
 
+protected:
+    // Post the complete current values of all properties to a client as a
+    // "data" notification.
+    void postAllProperties(ClientConnection *client);
+    // Get the current value of one of the published objects for the
+    // full-state snapshot, using the cached value from _snapshotObjects when
+    // it is still current.
+    QJsonObject snapshotObject(const QString &name, const NativeJsonObject &object,
+                               const JsonChangeSet &changes);
+    // Discard the cached snapshot of one published object (and the encoded
+    // snapshot messages) when notifyChanges() publishes changes to it.
+    void invalidateSnapshot(const QString &name);
+
 protected slots:
     void clientConnected(IPCConnection* connection);
     void notifyChanges();
     void serialize();
+    // Queue a snapshot to be written by _serializationQueue
+    enum class WriteMode
+    {
+        // Write the JSON file in place (preserves its permissions)
+        InPlace,
+        // Replace the JSON file atomically (see writePropertiesAtomic())
+        Atomic,
+        // Replace a binary cache atomically (see writePropertiesCacheAtomic())
+        BinaryCache,
+    };
+    void queueWrite(const char *filename, QJsonObject object, WriteMode mode);
+    // Write the queued snapshots (on _serializationQueue)
+    void writePending();
     void vpnStateChanged(VPNConnection::State state,
                          const ConnectionConfig &connectingConfig,
                          const ConnectionConfig &connectedConfig,
                          const nullable_t<Transport> &chosenTransport,
                          const nullable_t<Transport> &actualTransport);
+    // Publish the current connection information to worker threads (see
+    // g_connectionSnapshot).
+    void publishConnectionSnapshot();
+    // Publish the current values of the DaemonState fields in the shared
+    // memory state channel (see StateChannelWriter).
+    void updateStateChannel();
     void vpnConnectingStatus(TransportSelector::Status connectingStatus);
     void vpnError(const Error& error);
     void vpnByteCountsChanged();
@@ -362,6 +583,10 @@ protected slots:
     void shadowsocksRegionsLoaded(const QJsonDocument &shadowsocksRegionsJsonDoc);
 
     void refreshAccountInfo();
+    // Build the firewall parameters for the current state.  With
+    // expectConnected, builds them as if the connection being attempted had
+    // connected instead (see prepareFirewallRules()).
+    FirewallParams buildFirewallParams(bool expectConnected, bool &killswitchEnabled);
     void reapplyFirewallRules();
 
 
@@ -369,10 +594,42 @@ private:
     // Rebuild all location-based data (location lists, chosen/best/next
     // locations, etc.)  Used when the entire location list changes.
     void rebuildLocations();
+    // Rebuild the grouped locations and location selections from the nearest
+    // locations index.  Used when latencies change (the index is updated as
+    // each measurement is applied).
+    void updateNearestLocations();
+    // Check whether all post-connect data has been found (see
+    // DaemonState::postConnectTime), and record the time if so.
+    void checkPostConnectComplete();
+    // The post-connect deadline elapsed before all data was found.
+    void postConnectDeadlineElapsed();
+    // Apply the location ranking chosen by _settings.locationRanking() (with
+    // the current _data.locationHistory()) to _nearestLocations.  Does not
+    // update the location selections; call updateNearestLocations() after.
+    void applyLocationRanking();
+    // Record a connection attempt's outcome or a connection's peak throughput
+    // in _data.locationHistory(), and re-rank the locations.
+    void recordConnectOutcome(const QString &locationId, bool success);
+    void recordLocationThroughput(const QString &locationId, double throughput);
     // Rebuild the chosen/best/next location selections (without rebuilding the
     // entire list).  Used when data changes that affect the location
     // selections.
     void updateChosenLocations();
+    // Tell VPNConnection whether to keep Shadowsocks running while
+    // disconnected (see DaemonSettings::prestartShadowsocks)
+    void updatePrestartShadowsocks();
+    // Probe the servers of all Shadowsocks locations in parallel, if the
+    // automatic Shadowsocks location is used and the last results are stale.
+    // Only done while disconnected, since the probes would otherwise go
+    // through the tunnel.  updateChosenLocations() prefers the location with
+    // the lowest proxy latency.
+    void probeShadowsocksLocations();
+    // The Shadowsocks location with the lowest proxy latency from the last
+    // probe, or nullptr if none are known.
+    QSharedPointer<ServerLocation> getFastestShadowsocksLocation() const;
+    // Pass the chosen and favorite locations to LatencyTracker, which probes
+    // them on every measurement interval.
+    void updateLatencyPriorities();
     void onUpdateRefreshed(const Update &availableUpdate,
                            const Update &gaUpdate, const Update &betaUpdate);
     void onUpdateDownloadProgress(const QString &version, int progress);
@@ -380,6 +637,15 @@ private:
                                   const QString &installerPath);
     void onUpdateDownloadFailed(const QString &version, bool error);
     void updateSupportedVpnPorts(const QJsonObject &serversObj);
+    // Start or stop the metrics endpoint based on DaemonSettings::metricsPort
+    void applyMetricsPort();
+    // Update sampled metrics before MetricsServer renders them
+    void collectMetrics();
+    // Reduce the byte count and latency measurement rates while no client is
+    // displaying them (no clients, or only idle clients showing the tray),
+    // and restore them when one is.  Called when clients connect, disconnect,
+    // or change their subscriptions.
+    void updateActivityRates();
 
     void checkSplitTunnelSupport();
 
@@ -408,25 +674,112 @@ protected:
     SocksServerThread _socksServer;
     UpdateDownloader _updateDownloader;
     SnoozeTimer _snoozeTimer;
+    MetricsServer _metricsServer;
+    EventLoopWatchdog _eventLoopWatchdog;
+    SampleProfiler _profiler;
+    // Runs helper commands that the daemon doesn't need to wait for
+    CommandExecutor _commandExecutor;
+    // Threads shared by the daemon's subsystems for background work.  Work is
+    // submitted through WorkerQueues, which must be declared after this.
+    WorkerPool _workerPool;
 
     DaemonData _data;
     DaemonAccount _account;
     DaemonSettings _settings;
     DaemonState _state;
 
-    QSet<QString> _dataChanges;
-    QSet<QString> _accountChanges;
-    QSet<QString> _settingsChanges;
-    QSet<QString> _stateChanges;
+    // All of _data.locations(), ordered by latency.  Rebuilt by
+    // rebuildLocations() when the locations change, and updated in place by
+    // newLatencyMeasurements().
+    NearestLocations _nearestLocations;
+
+    // Connect latency of each Shadowsocks location's server (by location ID)
+    // from the last probeShadowsocksLocations(), when it was done, and the
+    // probe if one is running
+    ProxyProbe::Latencies _shadowsocksLatencies;
+    QElapsedTimer _shadowsocksProbeAge;
+    QPointer<ProxyProbe> _pShadowsocksProbe;
+
+    JsonChangeSet _dataChanges;
+    JsonChangeSet _accountChanges;
+    JsonChangeSet _settingsChanges;
+    JsonChangeSet _stateChanges;
+
+    // The last value of each property published to clients, keyed by object
+    // name ("data", "state", etc.)  Patches sent to clients are built from
+    // these values, so they're updated on every notification.
+    QHash<QString, QJsonObject> _publishedValues;
+
+    // Shared memory image of the frequently-updated DaemonState values, which
+    // local clients can read without waiting for notifications.
+    StateChannelWriter _stateChannel;
+
+    // Full-state snapshot sent by postAllProperties() to clients that connect
+    // or catch up.  Each object's value is cached until notifyChanges()
+    // publishes a change to it, and the encoded "data" messages for clients
+    // without subscriptions are cached (by [binary][locationColumns]) until
+    // any object changes, so a burst of reconnecting clients doesn't
+    // serialize the whole state once per client.
+    QHash<QString, QJsonObject> _snapshotObjects;
+    QByteArray _snapshotMessages[2][2];
+
+    // Sizes of the data/patch notifications encoded and sent to clients.  Each
+    // message is encoded once no matter how many clients receive it, so with
+    // many clients bytesSent is much larger than bytesEncoded.  These are
+    // written to diagnostics.
+    struct
+    {
+        quint64 bytesEncoded;
+        quint64 bytesSent;
+    } _notificationStats;
 
     unsigned int _pendingSerializations;
-    QTimer _serializationTimer;
+
+    // Location of the current connection, and the peak throughput observed
+    // on it (bytes per second, both directions).  Recorded in the location
+    // history when the connection ends.
+    QString _throughputLocation;
+    double _connectionPeakThroughput;
+    ServiceTimer _serializationTimer;
+
+    // Snapshots of the JSON files waiting to be written on
+    // _serializationQueue, keyed by file name.  A newer snapshot replaces one
+    // that hasn't been written yet.
+    struct PendingWrite
+    {
+        QJsonObject object;
+        WriteMode mode;
+    };
+    QMutex _pendingWritesMutex;
+    QHash<QByteArray, PendingWrite> _pendingWrites;
+    bool _writeQueued;
+    // The JSON files are written on the worker pool so a slow disk doesn't
+    // stall the daemon's event loop.  This is declared after the pending
+    // writes, so any remaining writes are finished before they're destroyed.
+    WorkerQueue _serializationQueue;
+    // Measures the data channel ciphers for DaemonData::cipherThroughputs;
+    // only used once, the first time the daemon starts
+    WorkerQueue _benchmarkQueue;
+    // Heavy work done by background RPC methods (see
+    // LocalMethod::Priority::Background), such as scanning app manifests
+    WorkerQueue _rpcQueue;
 
     QTimer _accountRefreshTimer;
 
     // Ongoing attempt to get the VPN IP address.  This can retry for a long
     // time, so we discard it if we leave the Connected state.
     Async<void> _pVpnIpRequest;
+
+    // Times the post-connect stage (see DaemonState::postConnectTime); valid
+    // while the stage is still pending.  The requests in the stage all retry
+    // on their own, the deadline only ends the measurement.
+    QElapsedTimer _postConnectTimer;
+    QTimer _postConnectDeadline;
+
+    // Ongoing self test and the task for its RPC result, if a test is running.
+    // The test is abandoned if we leave the Connected state.
+    QPointer<SelfTest> _pSelfTest;
+    Async<QJsonValue> _pSelfTestTask;
 };
 
 #define g_daemon (Daemon::instance())
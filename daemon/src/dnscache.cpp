@@ -0,0 +1,597 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("dnscache.cpp")
+
+#include "dnscache.h"
+#include "settings.h"
+#include "socksserver.h"
+#include <QRandomGenerator>
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+    const quint16 dnsPort{53};
+
+    // Maximum number of cached responses
+    const int maxCacheEntries{2048};
+    // Maximum TTLs used for positive and negative responses, and the TTL used
+    // for negative responses that don't include an SOA record (seconds)
+    const quint32 maxPositiveTtl{3600};
+    const quint32 maxNegativeTtl{300};
+    const quint32 defaultNegativeTtl{60};
+
+    // Names served from the cache at least this many times are prefetched
+    // when less than 1/prefetchFraction of their TTL remains
+    const int prefetchMinHits{2};
+    const qint64 prefetchFraction{10};
+    // Number of popular names remembered to prefetch on the next connection
+    const int popularNameCount{32};
+
+    // Send an upstream query again after this long without a response; each
+    // server is tried this many times
+    const std::chrono::milliseconds upstreamRetryTime{1000};
+    const int upstreamAttemptsPerServer{2};
+    const std::chrono::milliseconds pendingCheckInterval{250};
+    // TCP relays are closed after this long
+    const std::chrono::seconds tcpRelayTimeout{10};
+
+    enum : int
+    {
+        HeaderSize = 12,
+        RcodeNoError = 0,
+        RcodeNameError = 3,
+        TypeOpt = 41,
+    };
+
+    quint16 readU16(const QByteArray &msg, int pos)
+    {
+        return static_cast<quint16>((static_cast<quint8>(msg[pos]) << 8) |
+                                    static_cast<quint8>(msg[pos+1]));
+    }
+
+    quint32 readU32(const QByteArray &msg, int pos)
+    {
+        return (static_cast<quint32>(readU16(msg, pos)) << 16) | readU16(msg, pos+2);
+    }
+
+    void writeU16(QByteArray &msg, int pos, quint16 value)
+    {
+        msg[pos] = static_cast<char>(value >> 8);
+        msg[pos+1] = static_cast<char>(value & 0xFF);
+    }
+
+    void writeU32(QByteArray &msg, int pos, quint32 value)
+    {
+        writeU16(msg, pos, static_cast<quint16>(value >> 16));
+        writeU16(msg, pos+2, static_cast<quint16>(value & 0xFFFF));
+    }
+
+    // Get the normalized question of a message (lowercase name, type, and
+    // class), and the offset following the question.  Returns an empty key if
+    // the message doesn't have exactly one valid question.
+    QByteArray parseQuestion(const QByteArray &msg, int &questionEnd)
+    {
+        if(msg.size() < HeaderSize || readU16(msg, 4) != 1)
+            return {};
+
+        QByteArray key;
+        int pos = HeaderSize;
+        while(true)
+        {
+            if(pos >= msg.size())
+                return {};
+            int length = static_cast<quint8>(msg[pos]);
+            // The question is the first name in the message, it's never
+            // compressed
+            if(length & 0xC0)
+                return {};
+            key.append(static_cast<char>(length));
+            ++pos;
+            if(length == 0)
+                break;
+            if(pos + length > msg.size())
+                return {};
+            key.append(msg.mid(pos, length).toLower());
+            pos += length;
+        }
+        if(pos + 4 > msg.size())
+            return {};
+        key.append(msg.mid(pos, 4));
+        questionEnd = pos + 4;
+        return key;
+    }
+
+    // Skip a (possibly compressed) name.  Returns the offset following it, or
+    // -1 if the name is invalid.
+    int skipName(const QByteArray &msg, int pos)
+    {
+        while(pos < msg.size())
+        {
+            int length = static_cast<quint8>(msg[pos]);
+            if((length & 0xC0) == 0xC0)
+                return pos + 2 <= msg.size() ? pos + 2 : -1;
+            if(length & 0xC0)
+                return -1;  // Reserved label types
+            pos += 1 + length;
+            if(length == 0)
+                return pos;
+        }
+        return -1;
+    }
+
+    // Find the TTL fields of a response's records, and determine how long to
+    // cache it (seconds).  Returns 0 if the response shouldn't be cached.
+    quint32 parseResponseTtl(const QByteArray &msg, int questionEnd,
+                             std::vector<int> &ttlOffsets)
+    {
+        // Truncated responses are retried over TCP, don't cache them
+        if(static_cast<quint8>(msg[2]) & 0x02)
+            return 0;
+        int rcode = static_cast<quint8>(msg[3]) & 0x0F;
+        if(rcode != RcodeNoError && rcode != RcodeNameError)
+            return 0;
+
+        const int counts[3]{readU16(msg, 6), readU16(msg, 8), readU16(msg, 10)};
+        // Minimum TTLs of the answer and authority sections
+        quint32 sectionTtls[2]{std::numeric_limits<quint32>::max(),
+                               std::numeric_limits<quint32>::max()};
+        int pos = questionEnd;
+        for(int section = 0; section < 3; ++section)
+        {
+            for(int i = 0; i < counts[section]; ++i)
+            {
+                pos = skipName(msg, pos);
+                if(pos < 0 || pos + 10 > msg.size())
+                    return 0;
+                quint16 type = readU16(msg, pos);
+                quint32 ttl = readU32(msg, pos + 4);
+                quint16 dataLength = readU16(msg, pos + 8);
+                // The OPT pseudo-record's "TTL" holds EDNS flags
+                if(type != TypeOpt)
+                {
+                    ttlOffsets.push_back(pos + 4);
+                    if(section < 2)
+                        sectionTtls[section] = std::min(sectionTtls[section], ttl);
+                }
+                pos += 10 + dataLength;
+                if(pos > msg.size())
+                    return 0;
+            }
+        }
+
+        if(rcode == RcodeNoError && counts[0] > 0)
+            return std::min(sectionTtls[0], maxPositiveTtl);
+        // Negative response - use the SOA TTL from the authority section
+        if(sectionTtls[1] == std::numeric_limits<quint32>::max())
+            return defaultNegativeTtl;
+        return std::min(sectionTtls[1], maxNegativeTtl);
+    }
+}
+
+DnsCache::DnsCache()
+    : _hits{0}, _misses{0}
+{
+    _clock.start();
+    _pendingTimer.setInterval(msec32(pendingCheckInterval));
+    connect(&_pendingTimer, &QTimer::timeout, this, &DnsCache::checkPending);
+    connect(&_listenSocket, &QUdpSocket::readyRead, this, &DnsCache::onClientReadyRead);
+    connect(&_upstreamSocket, &QUdpSocket::readyRead, this, &DnsCache::onUpstreamReadyRead);
+    connect(&_tcpServer, &QTcpServer::newConnection, this, &DnsCache::onTcpConnection);
+}
+
+DnsCache::~DnsCache()
+{
+    stop();
+}
+
+bool DnsCache::listen()
+{
+    if(isListening())
+        return true;
+
+#ifdef Q_OS_MACOS
+    // Loopback addresses other than 127.0.0.1 have to be aliased on lo0
+    ::shellExecute(QStringLiteral("ifconfig lo0 alias %1 up").arg(dnsCacheLocalAddress));
+#endif
+
+    QHostAddress listenAddress{dnsCacheLocalAddress};
+    if(!_listenSocket.bind(listenAddress, dnsPort))
+    {
+        qWarning() << "Unable to listen on" << listenAddress << "-"
+            << _listenSocket.errorString();
+        return false;
+    }
+    // UDP still works if TCP can't be bound, only truncated responses are
+    // affected
+    if(!_tcpServer.listen(listenAddress, dnsPort))
+    {
+        qWarning() << "Unable to listen for TCP on" << listenAddress << "-"
+            << _tcpServer.errorString();
+    }
+    qInfo() << "Listening on" << listenAddress;
+    return true;
+}
+
+void DnsCache::setUpstream(QHostAddress bindAddress, QString bindInterface,
+                           QStringList servers)
+{
+    std::vector<QHostAddress> serverAddresses;
+    for(const auto &server : servers)
+    {
+        QHostAddress address{server};
+        if(address.protocol() == QAbstractSocket::NetworkLayerProtocol::IPv4Protocol)
+            serverAddresses.push_back(address);
+    }
+    // Responses from other servers can't be reused
+    if(serverAddresses != _servers)
+    {
+        rememberPopularNames();
+        _servers = std::move(serverAddresses);
+    }
+
+    clearUpstream();
+    _bindAddress = std::move(bindAddress);
+    _bindInterface = std::move(bindInterface);
+    bindToVpn(_upstreamSocket, _bindAddress, _bindInterface);
+    qInfo() << "Forwarding to" << servers << "from" << _bindAddress;
+
+    prefetchPopularNames();
+}
+
+void DnsCache::clearUpstream()
+{
+    _pending.clear();
+    _pendingKeys.clear();
+    _pendingTimer.stop();
+    _upstreamSocket.abort();
+    _bindAddress.clear();
+    _bindInterface.clear();
+}
+
+void DnsCache::stop()
+{
+    clearUpstream();
+    if(!isListening())
+        return;
+
+    qInfo() << "Stopping - answered" << _hits << "queries from the cache,"
+        << _misses << "upstream";
+    rememberPopularNames();
+    _servers.clear();
+    _listenSocket.close();
+    _tcpServer.close();
+
+#ifdef Q_OS_MACOS
+    ::shellExecute(QStringLiteral("ifconfig lo0 -alias %1").arg(dnsCacheLocalAddress));
+#endif
+}
+
+void DnsCache::onClientReadyRead()
+{
+    while(_listenSocket.hasPendingDatagrams())
+    {
+        QByteArray msg;
+        msg.resize(static_cast<int>(std::max<qint64>(_listenSocket.pendingDatagramSize(), 0)));
+        Client client{};
+        qint64 read = _listenSocket.readDatagram(msg.data(), msg.size(),
+                                                 &client.address, &client.port);
+        if(read < HeaderSize)
+            continue;
+        msg.resize(static_cast<int>(read));
+
+        // Only standard queries are handled (QR clear, opcode QUERY)
+        if(static_cast<quint8>(msg[2]) & 0xF8)
+            continue;
+        int questionEnd;
+        QByteArray key = parseQuestion(msg, questionEnd);
+        if(key.isEmpty())
+            continue;
+        client.queryId = readU16(msg, 0);
+
+        if(serveCached(key, client))
+        {
+            ++_hits;
+            continue;
+        }
+        ++_misses;
+        forward(key, msg, &client);
+    }
+}
+
+bool DnsCache::serveCached(const QByteArray &key, const Client &client)
+{
+    auto itEntry = _cache.find(key);
+    if(itEntry == _cache.end())
+        return false;
+
+    qint64 now = _clock.elapsed();
+    if(now >= itEntry->expiresMs)
+    {
+        _cache.erase(itEntry);
+        return false;
+    }
+
+    // Reply with the client's query ID, and deduct the time the response has
+    // been cached from its TTLs
+    QByteArray response = itEntry->response;
+    writeU16(response, 0, client.queryId);
+    quint32 age = static_cast<quint32>((now - itEntry->storedMs) / 1000);
+    for(int offset : itEntry->ttlOffsets)
+    {
+        quint32 ttl = readU32(response, offset);
+        writeU32(response, offset, ttl > age ? ttl - age : 0);
+    }
+    _listenSocket.writeDatagram(response, client.address, client.port);
+
+    // Refresh popular names shortly before they expire so they stay cached
+    ++itEntry->hits;
+    qint64 lifetime = itEntry->expiresMs - itEntry->storedMs;
+    if(itEntry->hits >= prefetchMinHits &&
+       (itEntry->expiresMs - now) * prefetchFraction < lifetime)
+    {
+        QByteArray query = itEntry->query;
+        forward(key, query, nullptr);
+    }
+    return true;
+}
+
+void DnsCache::forward(const QByteArray &key, const QByteArray &query,
+                       const Client *pClient)
+{
+    // If this name is already being looked up, just wait for that response
+    auto itPendingKey = _pendingKeys.find(key);
+    if(itPendingKey != _pendingKeys.end())
+    {
+        if(pClient)
+            _pending[itPendingKey.value()].clients.push_back(*pClient);
+        return;
+    }
+
+    // Can't forward while reconnecting, etc. - the client will retry
+    if(_servers.empty() || _bindAddress.isNull())
+        return;
+
+    // Use a random ID for each upstream query so responses are hard to spoof
+    quint16 upstreamId;
+    do
+    {
+        upstreamId = static_cast<quint16>(QRandomGenerator::global()->generate());
+    }
+    while(_pending.contains(upstreamId));
+
+    Pending pending;
+    pending.key = key;
+    pending.query = query;
+    writeU16(pending.query, 0, upstreamId);
+    if(pClient)
+        pending.clients.push_back(*pClient);
+
+    auto itPending = _pending.insert(upstreamId, std::move(pending));
+    _pendingKeys.insert(key, upstreamId);
+    sendPending(itPending.value());
+    if(!_pendingTimer.isActive())
+        _pendingTimer.start();
+}
+
+void DnsCache::sendPending(Pending &pending)
+{
+    Q_ASSERT(!_servers.empty());    // Checked by callers
+    const auto &server = _servers[static_cast<std::size_t>(pending.attempts) % _servers.size()];
+    ++pending.attempts;
+    pending.sentMs = _clock.elapsed();
+    _upstreamSocket.writeDatagram(pending.query, server, dnsPort);
+}
+
+void DnsCache::checkPending()
+{
+    qint64 now = _clock.elapsed();
+    int maxAttempts = upstreamAttemptsPerServer * static_cast<int>(_servers.size());
+    auto itPending = _pending.begin();
+    while(itPending != _pending.end())
+    {
+        if(now - itPending->sentMs < msec(upstreamRetryTime))
+            ++itPending;
+        else if(itPending->attempts >= maxAttempts)
+        {
+            qInfo() << "No response after" << itPending->attempts
+                << "attempts, dropping query";
+            _pendingKeys.remove(itPending->key);
+            itPending = _pending.erase(itPending);
+        }
+        else
+        {
+            sendPending(itPending.value());
+            ++itPending;
+        }
+    }
+
+    if(_pending.isEmpty())
+        _pendingTimer.stop();
+}
+
+void DnsCache::onUpstreamReadyRead()
+{
+    while(_upstreamSocket.hasPendingDatagrams())
+    {
+        QByteArray msg;
+        msg.resize(static_cast<int>(std::max<qint64>(_upstreamSocket.pendingDatagramSize(), 0)));
+        QHostAddress sender;
+        quint16 senderPort;
+        qint64 read = _upstreamSocket.readDatagram(msg.data(), msg.size(),
+                                                   &sender, &senderPort);
+        if(read < HeaderSize || senderPort != dnsPort ||
+           std::find(_servers.begin(), _servers.end(), sender) == _servers.end())
+        {
+            continue;
+        }
+        msg.resize(static_cast<int>(read));
+
+        // Must be a response to a pending query for the same question
+        if(!(static_cast<quint8>(msg[2]) & 0x80))
+            continue;
+        auto itPending = _pending.find(readU16(msg, 0));
+        if(itPending == _pending.end())
+            continue;
+        int questionEnd;
+        QByteArray key = parseQuestion(msg, questionEnd);
+        if(key != itPending->key)
+            continue;
+
+        Pending pending = std::move(itPending.value());
+        _pending.erase(itPending);
+        _pendingKeys.remove(pending.key);
+
+        for(const auto &client : pending.clients)
+        {
+            QByteArray reply = msg;
+            writeU16(reply, 0, client.queryId);
+            _listenSocket.writeDatagram(reply, client.address, client.port);
+        }
+        storeResponse(key, questionEnd, pending.query, msg);
+    }
+}
+
+void DnsCache::storeResponse(const QByteArray &key, int questionEnd,
+                             const QByteArray &query, const QByteArray &response)
+{
+    std::vector<int> ttlOffsets;
+    quint32 ttl = parseResponseTtl(response, questionEnd, ttlOffsets);
+    if(ttl == 0)
+    {
+        _cache.remove(key);
+        return;
+    }
+
+    qint64 now = _clock.elapsed();
+    if(_cache.size() >= maxCacheEntries && !_cache.contains(key))
+    {
+        // Drop expired entries; if that's not enough, drop the entry that
+        // expires soonest
+        auto itEntry = _cache.begin();
+        while(itEntry != _cache.end())
+        {
+            if(itEntry->expiresMs <= now)
+                itEntry = _cache.erase(itEntry);
+            else
+                ++itEntry;
+        }
+        if(_cache.size() >= maxCacheEntries)
+        {
+            auto itSoonest = std::min_element(_cache.begin(), _cache.end(),
+                [](const Entry &first, const Entry &second)
+                {
+                    return first.expiresMs < second.expiresMs;
+                });
+            _cache.erase(itSoonest);
+        }
+    }
+
+    // Keep the hit count of an entry that's being refreshed
+    Entry &entry = _cache[key];
+    entry.response = response;
+    entry.ttlOffsets = std::move(ttlOffsets);
+    entry.query = query;
+    entry.storedMs = now;
+    entry.expiresMs = now + static_cast<qint64>(ttl) * 1000;
+}
+
+void DnsCache::rememberPopularNames()
+{
+    std::vector<const Entry*> entries;
+    for(const auto &entry : _cache)
+    {
+        if(entry.hits > 0)
+            entries.push_back(&entry);
+    }
+
+    // If nothing was served from the cache, keep the names from before
+    if(!entries.empty())
+    {
+        std::sort(entries.begin(), entries.end(),
+            [](const Entry *pFirst, const Entry *pSecond)
+            {
+                return pFirst->hits > pSecond->hits;
+            });
+        if(entries.size() > static_cast<std::size_t>(popularNameCount))
+            entries.resize(static_cast<std::size_t>(popularNameCount));
+
+        _popularQueries.clear();
+        for(const Entry *pEntry : entries)
+            _popularQueries.push_back(pEntry->query);
+    }
+    _cache.clear();
+}
+
+void DnsCache::prefetchPopularNames()
+{
+    int prefetched = 0;
+    for(const auto &query : _popularQueries)
+    {
+        int questionEnd;
+        QByteArray key = parseQuestion(query, questionEnd);
+        if(!key.isEmpty() && !_cache.contains(key))
+        {
+            forward(key, query, nullptr);
+            ++prefetched;
+        }
+    }
+    if(prefetched)
+        qInfo() << "Prefetching" << prefetched << "popular names";
+}
+
+void DnsCache::onTcpConnection()
+{
+    while(QTcpSocket *pClient = _tcpServer.nextPendingConnection())
+    {
+        if(_servers.empty() || _bindAddress.isNull())
+        {
+            pClient->abort();
+            pClient->deleteLater();
+            continue;
+        }
+
+        // Relay the connection to the first server.  The upstream socket is
+        // owned by the client socket, both are destroyed when either side
+        // closes.
+        QTcpSocket *pUpstream = new QTcpSocket{pClient};
+        bindToVpn(*pUpstream, _bindAddress, _bindInterface);
+        connect(pClient, &QTcpSocket::readyRead, pUpstream, [pClient, pUpstream]()
+        {
+            if(pUpstream->state() == QAbstractSocket::SocketState::ConnectedState)
+                pUpstream->write(pClient->readAll());
+        });
+        connect(pUpstream, &QTcpSocket::connected, pClient, [pClient, pUpstream]()
+        {
+            pUpstream->write(pClient->readAll());
+        });
+        connect(pUpstream, &QTcpSocket::readyRead, pClient, [pClient, pUpstream]()
+        {
+            pClient->write(pUpstream->readAll());
+        });
+        connect(pClient, &QTcpSocket::disconnected, pClient, &QObject::deleteLater);
+        connect(pUpstream, &QTcpSocket::disconnected, pClient, &QTcpSocket::disconnectFromHost);
+        connect(pUpstream, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error),
+                pClient, &QObject::deleteLater);
+        QTimer::singleShot(msec32(tcpRelayTimeout), pClient, &QObject::deleteLater);
+
+        pUpstream->connectToHost(_servers.front(), dnsPort);
+    }
+}
@@ -0,0 +1,154 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("dnscache.h")
+
+#ifndef DNSCACHE_H
+#define DNSCACHE_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QHostAddress>
+#include <QPointer>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QUdpSocket>
+#include <vector>
+
+// DnsCache is a caching DNS forwarder used when DaemonSettings::dnsCache is
+// enabled.  It listens on dnsCacheLocalAddress:53 (the address given to the OS
+// as its DNS server while connected), and forwards queries through the tunnel
+// to the configured DNS servers, using the same bind logic as SocksServer.
+//
+// Each lookup that would otherwise cross the tunnel is answered locally while
+// the answer's TTL lasts.  Negative answers (NXDOMAIN / no data) are cached
+// too, for their SOA TTL (capped at a few minutes).  Names that are looked up
+// frequently are prefetched shortly before they expire, and the most popular
+// names are prefetched again when forwarding resumes on a new connection.
+//
+// Concurrent queries for the same name are coalesced into one upstream query.
+// TCP queries (retries of truncated responses) are relayed upstream without
+// caching.
+class DnsCache : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("dnscache")
+
+private:
+    struct Client
+    {
+        QHostAddress address;
+        quint16 port;
+        quint16 queryId;
+    };
+
+    // A cached response
+    struct Entry
+    {
+        // The response, as received (including its original ID)
+        QByteArray response;
+        // Offsets of the TTL fields in the response, adjusted when the
+        // response is served from the cache
+        std::vector<int> ttlOffsets;
+        // The query that produced it (used to prefetch it)
+        QByteArray query;
+        // Time (from _clock) the response was stored and when it expires
+        qint64 storedMs{0}, expiresMs{0};
+        // Number of times the response was served from the cache
+        int hits{0};
+    };
+
+    // An upstream query
+    struct Pending
+    {
+        QByteArray key;
+        // The query as sent upstream (with the upstream ID)
+        QByteArray query;
+        // Clients waiting for the response - empty for prefetches
+        std::vector<Client> clients;
+        // Number of times the query has been sent, and when it was last sent
+        int attempts{0};
+        qint64 sentMs{0};
+    };
+
+public:
+    DnsCache();
+    ~DnsCache();
+
+public:
+    // Start listening on dnsCacheLocalAddress:53.  Returns true if the cache
+    // is listening (including if it was already listening); false if the
+    // address couldn't be bound.
+    bool listen();
+    // Forward queries through the tunnel - bindAddress/bindInterface are the
+    // tunnel's local address and interface, servers are the DNS servers to
+    // forward to.  The cache is cleared if the servers change.
+    void setUpstream(QHostAddress bindAddress, QString bindInterface,
+                     QStringList servers);
+    // Stop forwarding queries (while reconnecting, etc.).  Queries that
+    // aren't answered from the cache are dropped; clients will retry.
+    void clearUpstream();
+    // Stop listening and forwarding.  The most popular names are still
+    // remembered to prefetch on the next connection.
+    void stop();
+
+    bool isListening() const {return _listenSocket.state() == QAbstractSocket::SocketState::BoundState;}
+
+private:
+    void onClientReadyRead();
+    void onUpstreamReadyRead();
+    void onTcpConnection();
+    void checkPending();
+    // Serve a query from the cache if possible.  Returns true if it was
+    // served.
+    bool serveCached(const QByteArray &key, const Client &client);
+    // Forward a query upstream, or add the client to a pending query for the
+    // same key.  If pClient is nullptr, this is a prefetch.
+    void forward(const QByteArray &key, const QByteArray &query,
+                 const Client *pClient);
+    void sendPending(Pending &pending);
+    void storeResponse(const QByteArray &key, int questionEnd,
+                       const QByteArray &query, const QByteArray &response);
+    // Remember the most popular cached names for prefetching, then clear the
+    // cache
+    void rememberPopularNames();
+    void prefetchPopularNames();
+
+private:
+    QUdpSocket _listenSocket;
+    QTcpServer _tcpServer;
+    QUdpSocket _upstreamSocket;
+    QHostAddress _bindAddress;
+    QString _bindInterface;
+    std::vector<QHostAddress> _servers;
+    QElapsedTimer _clock;
+    QTimer _pendingTimer;
+    // Cached responses by key (normalized question)
+    QHash<QByteArray, Entry> _cache;
+    // Upstream queries by upstream ID, and the ID of the pending query for
+    // each key
+    QHash<quint16, Pending> _pending;
+    QHash<QByteArray, quint16> _pendingKeys;
+    // Queries for the most popular names of the last connection
+    QList<QByteArray> _popularQueries;
+    quint64 _hits, _misses;
+};
+
+#endif
@@ -20,63 +20,217 @@
 #line SOURCE_FILE("latencytracker.cpp")
 
 #include "latencytracker.h"
+#include "metrics.h"
+#ifdef Q_OS_LINUX
+#include "linux/linux_latencyprobe.h"
+#endif
+#include <QFile>
 #include <algorithm>
+#include <cmath>
+
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
 
 namespace
 {
     const std::chrono::minutes latencyRefreshInterval{1};
+    //Refresh interval used with setReducedRate() - the latencies are only
+    //needed to pick the automatic location then
+    const std::chrono::minutes latencyReducedRefreshInterval{5};
     const std::chrono::seconds latencyEchoTimeout{10};
     const std::chrono::milliseconds latencyBatchInterval{100};
 
-    //The number of measurements that LatencyHistory stores
-    const int measurementHistoryCount{5};
+    //Number of probes sent to each location on each refresh interval, and the
+    //spacing between them.  (New locations are measured with one probe so
+    //they get a measurement quickly.)
+    const int latencyBurstProbeCount{3};
+    const std::chrono::seconds latencyBurstSpacing{1};
+
+    //The nearest few locations are probed on every interval, along with the
+    //priority locations, since they're the candidates for the best location.
+    const int latencyNearestProbeCount{10};
+    //Other locations back off up to this many intervals when their latency
+    //is stable
+    const int latencyMaxProbeInterval{16};
+    //A measurement is "stable" if it's within this many milliseconds or this
+    //fraction of the current aggregate latency, whichever is more
+    const std::chrono::milliseconds latencyStableThreshold{10};
+    const double latencyStableFraction{0.1};
+    //Limit on the packets sent per second of the refresh interval.  (The
+    //locations are probed in one burst, this limits the size of the burst.)
+    //Overdue locations that don't fit are probed on the next interval.
+    const int latencyMaxProbeRate{2};
+
+    //Weight of each new measurement in the EWMA
+    const double latencyEwmaWeight{0.25};
+    //Gain used to smooth jitter (RFC 3550 section 6.4.1)
+    const double latencyJitterGain{1.0 / 16.0};
 
     RegisterMetaType<std::chrono::milliseconds> rxChronoMilliseconds;
     RegisterMetaType<LatencyTracker::Latencies> rxLatencies;
 }
 
+LatencyHistory::LatencyHistory(Aggregate aggregate)
+    : _aggregate{aggregate}, _lastMeasurements{}, _next{0}, _count{0}, _sum{0},
+      _ewma{0.0}, _jitter{0.0}
+{
+}
+
 std::chrono::milliseconds LatencyHistory::updateLatency(std::chrono::milliseconds newMeasurement)
 {
-    //If we already have the maximum number of entries, discard the oldest one.
-    if(_lastMeasurements.size() >= measurementHistoryCount)
+    //Update the EWMA and jitter from the previous measurement, if there is one.
+    if(_count > 0)
     {
-        _lastMeasurements.pop_front();
+        int lastIdx = (_next + HistoryCount - 1) % HistoryCount;
+        double delta = std::abs(static_cast<double>((newMeasurement - _lastMeasurements[lastIdx]).count()));
+        _jitter += (delta - _jitter) * latencyJitterGain;
+        _ewma += (newMeasurement.count() - _ewma) * latencyEwmaWeight;
     }
+    else
+        _ewma = static_cast<double>(newMeasurement.count());
+
+    //If we already have the maximum number of entries, the oldest one is
+    //overwritten.
+    if(_count == HistoryCount)
+        _sum -= _lastMeasurements[_next];
+    else
+        ++_count;
 
     //Store the new one.
-    _lastMeasurements.push_back(newMeasurement);
+    _lastMeasurements[_next] = newMeasurement;
+    _sum += newMeasurement;
+    _next = (_next + 1) % HistoryCount;
+
+    switch(_aggregate)
+    {
+        default:
+        case Aggregate::Mean:
+            return mean();
+        case Aggregate::Median:
+            return median();
+        case Aggregate::Ewma:
+            return ewma();
+    }
+}
 
-    //Compute the average latency over these measurements.
+std::chrono::milliseconds LatencyHistory::mean() const
+{
     //An average is probably the best way to aggregate these (as opposed to min/
     //max/etc.), because it'll reduce the effect of anomalous measurements at
     //either end of the spectrum.
-    std::chrono::milliseconds sum = std::accumulate(_lastMeasurements.begin(),
-                                                    _lastMeasurements.end(),
-                                                    std::chrono::milliseconds{0});
+    if(_count == 0)
+        return {};
+    return _sum / _count;
+}
+
+std::chrono::milliseconds LatencyHistory::median() const
+{
+    if(_count == 0)
+        return {};
+    //The history is tiny, so just select the median from a copy
+    std::array<std::chrono::milliseconds, HistoryCount> measurements{_lastMeasurements};
+    auto itMedian = measurements.begin() + _count / 2;
+    std::nth_element(measurements.begin(), itMedian, measurements.begin() + _count);
+    return *itMedian;
+}
 
-    return sum / _lastMeasurements.size();
+std::chrono::milliseconds LatencyHistory::ewma() const
+{
+    return std::chrono::milliseconds{static_cast<std::chrono::milliseconds::rep>(std::round(_ewma))};
+}
+
+std::chrono::milliseconds LatencyHistory::jitter() const
+{
+    return std::chrono::milliseconds{static_cast<std::chrono::milliseconds::rep>(std::round(_jitter))};
 }
 
 LatencyTracker::LatencyTracker()
 {
     _measureTrigger.setInterval(std::chrono::milliseconds(latencyRefreshInterval).count());
-    connect(&_measureTrigger, &QTimer::timeout, this,
+    connect(&_measureTrigger, &ServiceTimer::timeout, this,
             &LatencyTracker::onMeasureTrigger);
 }
 
 void LatencyTracker::onMeasureTrigger()
 {
-    //Measure all known addresses (if there are any)
-    //This vector of PingLocations could in principle be built with _locations
-    //and stored, but it shouldn't be a significant cost to just build it here.
+    //Find the nearest locations measured so far; these are always probed
+    //(along with the priority locations).
+    QVector<QPair<std::chrono::milliseconds, QString>> measuredLocations;
+    measuredLocations.reserve(_locations.size());
+    for(auto itLocation = _locations.begin(); itLocation != _locations.end();
+        ++itLocation)
+    {
+        if(itLocation->latency.count() > 0)
+            measuredLocations.push_back({itLocation->latency.mean(), itLocation.key()});
+    }
+    auto nearestEnd = measuredLocations.begin() + std::min(latencyNearestProbeCount, measuredLocations.size());
+    std::partial_sort(measuredLocations.begin(), nearestEnd, measuredLocations.end());
+    QSet<QString> alwaysProbe{_priorityLocations};
+    for(auto itNearest = measuredLocations.begin(); itNearest != nearestEnd; ++itNearest)
+        alwaysProbe.insert(itNearest->second);
+
+    const int maxProbes = latencyMaxProbeRate * std::chrono::seconds{latencyRefreshInterval}.count();
+
+    //Probe the priority/nearest locations first, then any other locations
+    //that are due, up to the limit.  Locations that are due but don't fit
+    //remain due for the next interval.
     QVector<PingLocation> measureLocations;
-    measureLocations.reserve(_locations.size());
+    QVector<PingLocation> dueLocations;
     for(auto itLocation = _locations.begin(); itLocation != _locations.end();
         ++itLocation)
     {
-        measureLocations.push_back({itLocation.key(), itLocation->pingAddress});
+        if(alwaysProbe.contains(itLocation.key()))
+        {
+            measureLocations.push_back({itLocation.key(), itLocation->pingAddress,
+                                        itLocation->tcpAddress});
+            itLocation->intervalsUntilProbe = itLocation->probeInterval;
+        }
+        else if(--itLocation->intervalsUntilProbe <= 0)
+            dueLocations.push_back({itLocation.key(), itLocation->pingAddress,
+                                    itLocation->tcpAddress});
     }
-    beginMeasurement(measureLocations);
+    for(const auto &location : dueLocations)
+    {
+        if(measureLocations.size() >= maxProbes)
+            break;
+        measureLocations.push_back(location);
+        auto &locationData = _locations[location.id];
+        locationData.intervalsUntilProbe = locationData.probeInterval;
+    }
+
+    qInfo() << "Probing" << measureLocations.size() << "of"
+        << _locations.size() << "locations -" << dueLocations.size()
+        << "were due, plus" << alwaysProbe.size() << "priority locations";
+    beginMeasurement(measureLocations, latencyBurstProbeCount);
+}
+
+void LatencyTracker::updateProbeInterval(LocationData &location,
+                                         std::chrono::milliseconds newMeasurement)
+{
+    //The first measurement can't be compared to anything
+    if(location.latency.count() == 0)
+        return;
+
+    auto current = location.latency.mean();
+    auto threshold = std::max(latencyStableThreshold,
+                              std::chrono::milliseconds{static_cast<std::chrono::milliseconds::rep>(current.count() * latencyStableFraction)});
+    auto difference = newMeasurement > current ? newMeasurement - current : current - newMeasurement;
+    if(difference <= threshold)
+        location.probeInterval = std::min(location.probeInterval * 2, latencyMaxProbeInterval);
+    else
+        location.probeInterval = 1;
+    //Don't wait longer than the new interval
+    location.intervalsUntilProbe = std::min(location.intervalsUntilProbe,
+                                            location.probeInterval);
+}
+
+void LatencyTracker::setPriorityLocations(const QSet<QString> &locationIds)
+{
+    _priorityLocations = locationIds;
 }
 
 void LatencyTracker::onNewMeasurements(const Latencies &measurements)
@@ -86,15 +240,31 @@ void LatencyTracker::onNewMeasurements(const Latencies &measurements)
     for(const auto &measurement : measurements)
     {
         // Find this location
-        auto itLocation = _locations.find(measurement.first);
+        auto itLocation = _locations.find(measurement.id);
         // If it was found, store it and get the new aggregated value.  If it's
         // no longer present, there's nothing to do.
         if(itLocation != _locations.end())
         {
+            updateProbeInterval(*itLocation, measurement.latency);
+            // Smooth the loss the same way as the latency EWMA; the first
+            // measurement just sets it
+            if(itLocation->latency.count() == 0)
+                itLocation->loss = measurement.loss;
+            else
+                itLocation->loss += latencyEwmaWeight * (measurement.loss - itLocation->loss);
             // Store the new latency measurement, and get the current aggregate
             // value.
-            auto aggregateLatency = itLocation->latency.updateLatency(measurement.second);
-            aggregatedMeasurements.push_back({measurement.first, aggregateLatency});
+            auto aggregateLatency = itLocation->latency.updateLatency(measurement.latency);
+            aggregatedMeasurements.push_back({measurement.id, aggregateLatency,
+                                              measurement.median,
+                                              itLocation->loss,
+                                              itLocation->latency.jitter(),
+                                              measurement.method});
+            Metrics::Labels regionLabels{{QStringLiteral("region"), measurement.id}};
+            Metrics::setGauge(QStringLiteral("pia_region_latency_seconds"),
+                              aggregateLatency.count() / 1000.0, regionLabels);
+            Metrics::setGauge(QStringLiteral("pia_region_loss_ratio"),
+                              itLocation->loss, regionLabels);
         }
     }
 
@@ -113,17 +283,19 @@ void LatencyTracker::measureNewLocations()
         if(!itLocation->pingAttempted)
         {
             itLocation->pingAttempted = true;
-            newLocations.push_back({itLocation.key(), itLocation->pingAddress});
+            newLocations.push_back({itLocation.key(), itLocation->pingAddress,
+                                    itLocation->tcpAddress});
         }
     }
 
     if(!newLocations.empty())
     {
-        beginMeasurement(newLocations);
+        beginMeasurement(newLocations, 1);
     }
 }
 
-void LatencyTracker::beginMeasurement(const QVector<PingLocation> &locations)
+void LatencyTracker::beginMeasurement(const QVector<PingLocation> &locations,
+                                      int probeCount)
 {
     //If there's at least one address to measure, start a measurement.
     if(!locations.empty())
@@ -132,20 +304,27 @@ void LatencyTracker::beginMeasurement(const QVector<PingLocation> &locations)
         // interference between activity on the main thread and the events that
         // have to be measured to calculate latency.
         //
-        // This is a blocking call over to the worker thread, but we don't do
-        // any long-running operations on the worker thread, so this is fine.
-        // Latency batches also time out before another batch would be
-        // scheduled, so there shouldn't be any activity at all on the worker
-        // thread when this is called.
-        _measurementThread.invokeOnThread([&]()
+        // This doesn't block the main thread; there's nothing we need back
+        // from the worker thread, the batch reports its results with
+        // newMeasurements().  The locations are copied into the functor since
+        // it runs after this function returns.
+        _measurementThread.invokeOnThreadAsync([this, locations, probeCount,
+                                                interfaceName = _probeInterfaceName,
+                                                localAddress = _probeLocalAddress]()
         {
             //Create a LatencyBatch; parent it to this object so it is cleaned up if
             //LatencyTracker is destroyed
             LatencyBatch *pNewBatch = new LatencyBatch{locations,
-                                                       &_measurementThread.objectOwner()};
+                                                       &_measurementThread.objectOwner(),
+                                                       probeCount, interfaceName,
+                                                       localAddress};
             //Forward newMeasurements signals from this new batch
             connect(pNewBatch, &LatencyBatch::newMeasurements, this,
                     &LatencyTracker::onNewMeasurements);
+        })->notify(this, [](const Error &error)
+        {
+            if(error)
+                qWarning() << "Unable to begin latency measurement:" << error;
         });
     }
 }
@@ -165,7 +344,9 @@ void LatencyTracker::updateLocations(const ServerLocations &serverLocations)
         //have been attempted yet if we don't find this location in
         //oldLocations
         auto itNewLocation = _locations.insert(pLocation->id(),
-                                               {pLocation->ping(), {}, false});
+                                               {pLocation->ping(),
+                                                pLocation->openvpnTCP(), {},
+                                                false, 1, 1, 0.0});
 
         //Did we have this location before?
         auto itOldLocation = oldLocations.find(pLocation->id());
@@ -173,8 +354,10 @@ void LatencyTracker::updateLocations(const ServerLocations &serverLocations)
         {
             //It existed, so preserve its latency measurements
             itNewLocation->latency = std::move(itOldLocation->latency);
-            //Preserve pingAttempted
+            //Preserve pingAttempted and the probe schedule
             itNewLocation->pingAttempted = itOldLocation->pingAttempted;
+            itNewLocation->probeInterval = itOldLocation->probeInterval;
+            itNewLocation->intervalsUntilProbe = itOldLocation->intervalsUntilProbe;
         }
     }
 
@@ -199,26 +382,77 @@ void LatencyTracker::stop()
     _measureTrigger.stop();
 }
 
+void LatencyTracker::setReducedRate(bool reduced)
+{
+    auto interval = reduced ? std::chrono::milliseconds(latencyReducedRefreshInterval) :
+        std::chrono::milliseconds(latencyRefreshInterval);
+    if(_measureTrigger.interval() == interval.count())
+        return;
+
+    qInfo() << (reduced ? "Reducing" : "Restoring") << "latency measurement rate";
+    //This restarts the timer if measurements are running
+    _measureTrigger.setInterval(interval);
+}
+
+void LatencyTracker::setProbeInterface(const QString &interfaceName,
+                                       const QHostAddress &localAddress)
+{
+    if(interfaceName == _probeInterfaceName && localAddress == _probeLocalAddress)
+        return;
+    qInfo() << "Binding latency probes to interface" << interfaceName
+        << "- address" << localAddress;
+    _probeInterfaceName = interfaceName;
+    _probeLocalAddress = localAddress;
+}
+
+bool LatencyTracker::canProbeInterface(const QString &interfaceName)
+{
+#ifdef Q_OS_LINUX
+    //The effective rp_filter mode is the higher of the 'all' and interface
+    //values; 1 is strict, 2 is loose.
+    auto readRpFilter = [](const QString &confName)
+    {
+        QFile rpFilter{QStringLiteral("/proc/sys/net/ipv4/conf/%1/rp_filter").arg(confName)};
+        if(!rpFilter.open(QIODevice::ReadOnly))
+            return 0;
+        return rpFilter.readAll().trimmed().toInt();
+    };
+    int mode = std::max(readRpFilter(QStringLiteral("all")), readRpFilter(interfaceName));
+    if(mode == 1)
+    {
+        qInfo() << "Can't bind latency probes to" << interfaceName
+            << "- strict reverse path filtering is enabled";
+        return false;
+    }
+#else
+    Q_UNUSED(interfaceName);
+#endif
+    return true;
+}
+
 LatencyBatch::LatencyBatch(const QVector<LatencyTracker::PingLocation> &locations,
-                           QObject *pParent)
-    : QObject{pParent}
+                           QObject *pParent, int probeCount,
+                           const QString &interfaceName,
+                           const QHostAddress &localAddress)
+    : QObject{pParent},
+#ifdef Q_OS_LINUX
+      _pNativeProbe{nullptr},
+#endif
+      _anyEchoReceived{false},
+      _probeCount{std::max(probeCount, 1)},
+      _interfaceName{interfaceName},
+      _localAddress{localAddress}
 {
     _batchTimer.setInterval(std::chrono::milliseconds(latencyBatchInterval).count());
     _batchTimer.setSingleShot(true);
     connect(&_batchTimer, &QTimer::timeout, this,
             &LatencyBatch::onBatchElapsed);
 
-    //Receive echo responses in this slot
-    connect(&_udpSocket, &QUdpSocket::readyRead, this,
-            &LatencyBatch::onDatagramReady);
-
-    //Bind a port so we can receive the echoes.  This binds on all interfaces.
-    _udpSocket.bind();
+    _roundTimer.setInterval(std::chrono::milliseconds(latencyBurstSpacing).count());
+    connect(&_roundTimer, &QTimer::timeout, this,
+            &LatencyBatch::sendProbeRound);
 
-    //Start the timer before sending the ping packets
-    _timeSincePing.start();
-
-    //Ping each address.
+    //Determine the addresses to ping.
     for(const auto &location : locations)
     {
         QHostAddress host;
@@ -226,27 +460,146 @@ LatencyBatch::LatencyBatch(const QVector<LatencyTracker::PingLocation> &location
         if(parsePingAddress(location.pingAddress, host, port))
         {
             //This address is valid, so put it in the pending replies.
-            _pendingReplies.insert({host, port}, location.id);
-
-            //Send a one-byte datagram to this address
-            _udpSocket.writeDatagram({1, 0x61}, host, port);
+            _pendingReplies.insert({host, port}, {location.id, {}, -1,
+                                                  location.tcpAddress});
         }
     }
 
-
-    if(_pendingReplies.size() >= 1)
-    {
-        //We sent at least one ping, so start the timeout timer.
-        QTimer::singleShot(std::chrono::milliseconds(latencyEchoTimeout).count(), this,
-                           &LatencyBatch::onTimeoutElapsed);
-    }
-    else
+    if(_pendingReplies.size() < 1)
     {
         //Nothing was sent, so there's nothing to do.
         //Creating the LatencyBatch still succeeds, but destroy it immediately
         //since there is nothing to do.
         deleteLater();
+        return;
+    }
+
+#ifdef Q_OS_LINUX
+    //The native probe only handles IPv4, which all ping addresses are today.
+    bool allIpv4 = true;
+    for(auto itReply = _pendingReplies.begin(); itReply != _pendingReplies.end(); ++itReply)
+    {
+        if(itReply.key().first.protocol() != QAbstractSocket::IPv4Protocol)
+        {
+            allIpv4 = false;
+            break;
+        }
+    }
+
+    if(allIpv4)
+    {
+        _pNativeProbe = new LinuxLatencyProbe{this};
+        if(_pNativeProbe->isOpen())
+        {
+            bindToInterface(_pNativeProbe->socketDescriptor());
+            connect(_pNativeProbe, &LinuxLatencyProbe::echoReceived, this,
+                [this](const QHostAddress &host, quint16 port,
+                       std::chrono::nanoseconds readDelay)
+                {
+                    //The echo was received readDelay before now
+                    onEchoReceived(host, port,
+                                   std::chrono::nanoseconds{_timeSincePing.nsecsElapsed()} - readDelay);
+                });
+        }
+        else
+        {
+            delete _pNativeProbe;
+            _pNativeProbe = nullptr;
+        }
+    }
+
+    if(!_pNativeProbe)
+        openSocket();
+#else
+    openSocket();
+#endif
+
+    //Start the timer before sending the ping packets
+    _timeSincePing.start();
+    sendProbeRound();
+    if(_probeCount > 1)
+        _roundTimer.start();
+
+    //We sent at least one ping, so start the timeout timer.  The timeout
+    //starts from the last probe round.
+    auto timeout = std::chrono::milliseconds(latencyEchoTimeout) +
+        std::chrono::milliseconds(latencyBurstSpacing) * (_probeCount - 1);
+    QTimer::singleShot(timeout.count(), this, &LatencyBatch::onTimeoutElapsed);
+}
+
+void LatencyBatch::openSocket()
+{
+    //Receive echo responses in this slot
+    connect(&_udpSocket, &QUdpSocket::readyRead, this,
+            &LatencyBatch::onDatagramReady);
+
+    //Bind a port so we can receive the echoes.  This binds on all interfaces,
+    //unless the probes are bound to a local address.
+    if(_localAddress.isNull())
+        _udpSocket.bind();
+    else
+        _udpSocket.bind(_localAddress);
+    bindToInterface(_udpSocket.socketDescriptor());
+}
+
+bool LatencyBatch::bindToInterface(qintptr sockFd)
+{
+    if(_interfaceName.isEmpty() || sockFd < 0)
+        return true;
+
+#if defined(Q_OS_LINUX)
+    //The socket is routed out this interface regardless of the VPN's routes
+    const QByteArray name = _interfaceName.toLocal8Bit();
+    if(::setsockopt(static_cast<int>(sockFd), SOL_SOCKET, SO_BINDTODEVICE,
+                    name.data(), static_cast<socklen_t>(name.size())) < 0)
+    {
+        qWarning() << "Unable to bind latency probes to" << _interfaceName
+            << "-" << errno << qPrintable(qt_error_string(errno));
+        return false;
+    }
+#elif defined(Q_OS_MACOS)
+    unsigned index = ::if_nametoindex(qPrintable(_interfaceName));
+    if(index == 0 ||
+       ::setsockopt(static_cast<int>(sockFd), IPPROTO_IP, IP_BOUND_IF,
+                    &index, sizeof(index)) < 0)
+    {
+        qWarning() << "Unable to bind latency probes to" << _interfaceName
+            << "-" << errno << qPrintable(qt_error_string(errno));
+        return false;
     }
+#endif
+    //On Windows, binding the local address is sufficient
+    return true;
+}
+
+void LatencyBatch::sendProbeRound()
+{
+    _roundSendTimes.push_back(std::chrono::nanoseconds{_timeSincePing.nsecsElapsed()});
+    if(_roundSendTimes.size() >= _probeCount)
+        _roundTimer.stop();
+
+#ifdef Q_OS_LINUX
+    if(_pNativeProbe)
+    {
+        QVector<LinuxLatencyProbe::Target> targets;
+        targets.reserve(_pendingReplies.size());
+        for(auto itReply = _pendingReplies.begin(); itReply != _pendingReplies.end(); ++itReply)
+            targets.push_back(itReply.key());
+        if(_pNativeProbe->sendProbes(targets))
+            return;
+
+        //Any echoes for earlier rounds are lost, but the remaining rounds can
+        //still be measured.
+        qWarning() << "Native latency probe failed, using UDP socket";
+        delete _pNativeProbe;
+        _pNativeProbe = nullptr;
+        openSocket();
+    }
+#endif
+
+    //Ping each address - send a one-byte datagram
+    for(auto itReply = _pendingReplies.begin(); itReply != _pendingReplies.end(); ++itReply)
+        _udpSocket.writeDatagram({1, 0x61}, itReply.key().first, itReply.key().second);
 }
 
 void LatencyBatch::emitBatchedMeasurements()
@@ -259,12 +612,33 @@ void LatencyBatch::emitBatchedMeasurements()
     }
 }
 
+auto LatencyBatch::completeLocation(QHash<HostPortKey, PendingLocation>::iterator itLocation)
+    -> QHash<HostPortKey, PendingLocation>::iterator
+{
+    auto roundtrips = itLocation->roundtrips;
+    //There must be at least one measurement
+    Q_ASSERT(!roundtrips.isEmpty());
+    std::sort(roundtrips.begin(), roundtrips.end());
+    auto median = roundtrips[roundtrips.size() / 2];
+    if(roundtrips.size() % 2 == 0)
+        median = (median + roundtrips[roundtrips.size() / 2 - 1]) / 2;
+    double loss = 1.0 - static_cast<double>(roundtrips.size()) / _probeCount;
+
+    // Store a measurement for this host
+    _batchedMeasurements.push_back({itLocation->id, roundtrips.front(), median,
+                                    loss, std::chrono::milliseconds{0},
+                                    LatencyTracker::ProbeMethod::Udp});
+
+    //This host has been measured, so remove it from _pendingReplies
+    return _pendingReplies.erase(itLocation);
+}
+
 void LatencyBatch::onDatagramReady()
 {
-    //Get the roundtrip latency measurement now, before doing anything else.
-    //(The packet has already arrived at this point, so any work we do later in
-    //this function isn't part of the latency measurement.)
-    std::chrono::milliseconds roundtripLatency{_timeSincePing.elapsed()};
+    //Get the receive time now, before doing anything else.  (The packet has
+    //already arrived at this point, so any work we do later in this function
+    //isn't part of the latency measurement.)
+    std::chrono::nanoseconds receivedAt{_timeSincePing.nsecsElapsed()};
 
     QHostAddress senderHost;
     quint16 senderPort;
@@ -280,6 +654,13 @@ void LatencyBatch::onDatagramReady()
     //If the datagram was read successfully but contained more than 0 bytes,
     //this is fine, the data are ignored.
 
+    onEchoReceived(senderHost, senderPort, receivedAt);
+}
+
+void LatencyBatch::onEchoReceived(const QHostAddress &senderHost,
+                                  quint16 senderPort,
+                                  std::chrono::nanoseconds receivedAt)
+{
     //Look up this host in the pending replies.  Look for any possible
     //equivalent address - for example, an IPv4 address could now be represented
     //as an IPv4-mapped IPv6 address.
@@ -299,12 +680,24 @@ void LatencyBatch::onDatagramReady()
     if(itHostPendingReply == _pendingReplies.end())
         return;
 
-    // Store a measurement for this host
-    _batchedMeasurements.push_back({itHostPendingReply.value(),
-                                    roundtripLatency});
+    _anyEchoReceived = true;
 
-    //This host has been measured, so remove it from _pendingReplies
-    _pendingReplies.erase(itHostPendingReply);
+    //Echoes don't identify the probe they answer, so match each echo to the
+    //most recent probe round.  The rounds are spaced further apart than the
+    //roundtrip time to any location in practice.  If the latest round was
+    //already answered, this is a duplicate (or a late echo), ignore it.
+    int round = _roundSendTimes.size() - 1;
+    if(itHostPendingReply->lastAnsweredRound >= round)
+        return;
+    itHostPendingReply->lastAnsweredRound = round;
+    auto roundtrip = std::chrono::duration_cast<std::chrono::milliseconds>(receivedAt - _roundSendTimes[round]);
+    itHostPendingReply->roundtrips.push_back(std::max(roundtrip, std::chrono::milliseconds{0}));
+
+    //If there are more rounds to send, wait for them
+    if(round + 1 < _probeCount)
+        return;
+
+    completeLocation(itHostPendingReply);
 
     //If there are no pending echoes left, this LatencyBatch is done
     if(_pendingReplies.empty())
@@ -330,24 +723,122 @@ void LatencyBatch::onDatagramReady()
 
 void LatencyBatch::onTimeoutElapsed()
 {
+    //Locations that answered some of the probes are still measured, with the
+    //lost probes counted
+    auto itPending = _pendingReplies.begin();
+    while(itPending != _pendingReplies.end())
+    {
+        if(itPending->roundtrips.isEmpty())
+            ++itPending;
+        else
+            itPending = completeLocation(itPending);
+    }
+
     if(_pendingReplies.size() > 0)
     {
         qDebug() << "Did not receive echoes from" << _pendingReplies.size()
                  << "addresses";
     }
 
-    for(const auto &locationId : _pendingReplies)
+    for(const auto &pending : _pendingReplies)
     {
-        qInfo() << "Location" << locationId
+        qInfo() << "Location" << pending.id
                 << "did not respond to latency ping";
     }
 
+    _roundTimer.stop();
+
+    //If nothing answered at all, UDP is probably blocked on this network.
+    //Time TCP connections to the locations instead, so they still get a
+    //measurement.
+    if(!_anyEchoReceived && beginTcpFallback())
+        return;
+
     // Nothing left to do.  Emit any remaining measurements, then destroy this
     // LatencyBatch
     emitBatchedMeasurements();
     deleteLater();
 }
 
+bool LatencyBatch::beginTcpFallback()
+{
+    for(const auto &pending : _pendingReplies)
+    {
+        QHostAddress host;
+        quint16 port;
+        if(!parsePingAddress(pending.tcpAddress, host, port))
+            continue;
+
+        auto pSocket = new QTcpSocket{this};
+        //Bind the same way as the UDP probes, so the connection is routed the
+        //same way
+        if(!_localAddress.isNull() || !_interfaceName.isEmpty())
+        {
+            pSocket->bind(_localAddress.isNull() ? QHostAddress{QHostAddress::AnyIPv4} : _localAddress);
+            bindToInterface(pSocket->socketDescriptor());
+        }
+
+        //The handshake completes one roundtrip after the SYN is sent
+        std::chrono::nanoseconds startedAt{_timeSincePing.nsecsElapsed()};
+        connect(pSocket, &QTcpSocket::connected, this,
+            [this, pSocket, id = pending.id, startedAt]()
+            {
+                std::chrono::nanoseconds connectedAt{_timeSincePing.nsecsElapsed()};
+                auto roundtrip = std::chrono::duration_cast<std::chrono::milliseconds>(connectedAt - startedAt);
+                _batchedMeasurements.push_back({id, roundtrip, roundtrip, 0.0,
+                                                std::chrono::milliseconds{0},
+                                                LatencyTracker::ProbeMethod::Tcp});
+                finishTcpProbe(pSocket);
+            });
+        connect(pSocket, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error),
+                this, [this, pSocket](){finishTcpProbe(pSocket);});
+        _tcpProbes.insert(pSocket);
+        pSocket->connectToHost(host, port);
+    }
+
+    if(_tcpProbes.isEmpty())
+        return false;
+
+    qInfo() << "No UDP echoes received, measuring latency to"
+        << _tcpProbes.size() << "locations with TCP connections";
+    _pendingReplies.clear();
+    QTimer::singleShot(std::chrono::milliseconds(latencyEchoTimeout).count(),
+                       this, &LatencyBatch::onTcpTimeoutElapsed);
+    return true;
+}
+
+void LatencyBatch::finishTcpProbe(QTcpSocket *pSocket)
+{
+    //Ignore signals from a socket that was already finished (abort() can
+    //emit an error)
+    if(!_tcpProbes.remove(pSocket))
+        return;
+
+    pSocket->abort();
+    pSocket->deleteLater();
+
+    if(_tcpProbes.isEmpty())
+    {
+        emitBatchedMeasurements();
+        deleteLater();
+    }
+    else if(!_batchTimer.isActive())
+        _batchTimer.start();
+}
+
+void LatencyBatch::onTcpTimeoutElapsed()
+{
+    if(_tcpProbes.isEmpty())
+        return;
+
+    qInfo() << "Did not connect to" << _tcpProbes.size()
+        << "locations for TCP latency measurement";
+    //Abort the remaining attempts; the last one destroys the batch
+    const auto remaining = _tcpProbes;
+    for(QTcpSocket *pSocket : remaining)
+        finishTcpProbe(pSocket);
+}
+
 void LatencyBatch::onBatchElapsed()
 {
     emitBatchedMeasurements();
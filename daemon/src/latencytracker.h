@@ -24,13 +24,21 @@
 
 #include "thread.h"
 #include "settings.h"
+#include "servicetimer.h"
 #include <QObject>
 #include <QElapsedTimer>
 #include <QHostAddress>
+#include <QSet>
+#include <QTcpSocket>
 #include <QTimer>
 #include <QUdpSocket>
+#include <array>
 #include <chrono>
 
+#ifdef Q_OS_LINUX
+class LinuxLatencyProbe;
+#endif
+
 //Key for a map/set containing both a host address and a port number.  (Used in
 //both LatencyTracker and unit tests.)
 using HostPortKey = QPair<QHostAddress, quint16>;
@@ -38,22 +46,58 @@ using HostPortKey = QPair<QHostAddress, quint16>;
 //LatencyHistory queues up latency measurements for a particular remote host.
 //As measurements are taken, they're queued up in LatencyHistory, which
 //computes a latency value based on those measurements.
+//
+//The last few measurements are kept in a fixed-size ring buffer, and the
+//aggregates are maintained as each measurement is added, so adding a
+//measurement doesn't allocate or rescan the whole history.
 class LatencyHistory
 {
     CLASS_LOGGING_CATEGORY("latency");
 
+public:
+    //The number of measurements that LatencyHistory stores
+    enum : int { HistoryCount = 5 };
+
+    //The aggregate returned by updateLatency().
+    enum class Aggregate
+    {
+        //Mean of the stored measurements (the default)
+        Mean,
+        //Median of the stored measurements (ignores outliers entirely)
+        Median,
+        //Exponentially-weighted moving average of all measurements
+        Ewma,
+    };
+
+public:
+    LatencyHistory(Aggregate aggregate = Aggregate::Mean);
+
 public:
     //Add a new measurement and calculate the current latency based on all
     //recent measurements.
     std::chrono::milliseconds updateLatency(std::chrono::milliseconds newMeasurement);
 
+    //Individual aggregates of the measurements.  These are 0 if no
+    //measurements have been taken.
+    std::chrono::milliseconds mean() const;
+    std::chrono::milliseconds median() const;
+    std::chrono::milliseconds ewma() const;
+    //Jitter - smoothed mean deviation between consecutive measurements (as
+    //computed in RFC 3550)
+    std::chrono::milliseconds jitter() const;
+
+    int count() const {return _count;}
+
 private:
-    //The last few measurements are stored here.  Qt doesn't have a deque,
-    //which would probably be ideal, but a QList should be OK.  It'll still have
-    //to copy the entire array when we run out of space in the back of its
-    //buffer, but it'll probably do better than a vector since it won't have to
-    //do it every time we delete something from the front.
-    QList<std::chrono::milliseconds> _lastMeasurements;
+    Aggregate _aggregate;
+    //The last few measurements; _next is the next slot to be written, and
+    //_count is the number of valid measurements.
+    std::array<std::chrono::milliseconds, HistoryCount> _lastMeasurements;
+    int _next, _count;
+    //Sum of the valid measurements in _lastMeasurements
+    std::chrono::milliseconds _sum;
+    //The EWMA and jitter are kept in fractional milliseconds
+    double _ewma, _jitter;
 };
 
 //LatencyTracker takes measurements of the latency to each location's "ping"
@@ -77,10 +121,20 @@ private:
     struct LocationData
     {
         QString pingAddress;
+        //OpenVPN TCP address, used to measure latency if UDP pings are blocked
+        QString tcpAddress;
         LatencyHistory latency;
         //Locations can sit in _locations without having been attempted if
         //measurements are not enabled.
         bool pingAttempted;
+        //Number of measurement intervals between probes of this location when
+        //it's not a priority location.  This doubles each time a measurement
+        //is stable, up to a limit, and resets when it changes significantly.
+        int probeInterval;
+        //Remaining intervals until this location is probed again
+        int intervalsUntilProbe;
+        //Smoothed fraction of probes lost (0-1)
+        double loss;
     };
 
 public:
@@ -88,10 +142,44 @@ public:
     {
         QString id;
         QString pingAddress;
+        //"<host>:<port>" to time TCP connections to if no UDP echoes are
+        //received at all.  Optional; if it's empty, there's no fallback.
+        QString tcpAddress;
     };
 
-    // Group of latency measurements - location IDs and latency values.
-    using Latencies = QVector<QPair<QString, std::chrono::milliseconds>>;
+    // How a measurement was taken
+    enum class ProbeMethod
+    {
+        // UDP echo from the location's ping address
+        Udp,
+        // TCP connection to the location's OpenVPN TCP address, used when
+        // none of the UDP pings in a batch were answered (UDP is probably
+        // blocked by the network)
+        Tcp,
+    };
+
+    // Latency measurement for one location.
+    struct Measurement
+    {
+        QString id;
+        // From LatencyBatch, the minimum roundtrip time of the probes that
+        // were answered.  From LatencyTracker, the aggregate latency from the
+        // location's history.
+        std::chrono::milliseconds latency;
+        // Median roundtrip time of the probes that were answered
+        std::chrono::milliseconds median;
+        // Fraction of the probes that were not answered (0-1).  From
+        // LatencyTracker, this is smoothed over the location's history.
+        double loss;
+        // From LatencyTracker, the jitter of the location's history.  Not
+        // measured by LatencyBatch (always 0).
+        std::chrono::milliseconds jitter;
+        // How the latest measurement was taken
+        ProbeMethod method;
+    };
+
+    // Group of latency measurements
+    using Latencies = QVector<Measurement>;
 
 public:
     //LatencyTracker begins with measurements stopped - call start() to enable
@@ -115,8 +203,14 @@ private:
     //attempted yet
     void measureNewLocations();
 
-    //Begin a new measurement for a set of ping addresses
-    void beginMeasurement(const QVector<PingLocation> &locations);
+    //Begin a new measurement for a set of ping addresses, sending probeCount
+    //probes to each address
+    void beginMeasurement(const QVector<PingLocation> &locations,
+                          int probeCount);
+
+    //Update a location's probe interval after a new measurement.
+    void updateProbeInterval(LocationData &location,
+                             std::chrono::milliseconds newMeasurement);
 
 public:
     //Daemon passes the current set of locations to this method.
@@ -126,6 +220,12 @@ public:
     //measured whenever measurements are re-enabled.
     void updateLocations(const ServerLocations &serverLocations);
 
+    //Set the locations that are always probed on every measurement interval,
+    //such as the chosen and favorite locations.  The nearest few locations are
+    //also always probed.  Other locations are probed less often if their
+    //latency is stable.
+    void setPriorityLocations(const QSet<QString> &locationIds);
+
     //Enable latency measurements.
     //
     //If they were already enabled, this has no effect.  If they weren't
@@ -140,13 +240,33 @@ public:
     //in progress.)
     void stop();
 
+    //Measure less often when no client is displaying the latencies (only the
+    //tray is present).  If measurements are running, the interval restarts.
+    void setReducedRate(bool reduced);
+
+    //Bind latency probes to a network interface and local address, so they go
+    //out the physical interface instead of the VPN tunnel.  While connected,
+    //this keeps the tunnel's own roundtrip out of other regions' latencies.
+    //Pass an empty name and null address to use the routing table again.
+    //
+    //Takes effect for the next measurement.  On Windows, only the local
+    //address is used (the strong host model sends from that interface).
+    void setProbeInterface(const QString &interfaceName,
+                           const QHostAddress &localAddress);
+
+    //Whether probes bound to an interface would receive their echoes.  On
+    //Linux, strict reverse path filtering drops echoes received on an
+    //interface that isn't the route back to the server (the VPN routes
+    //everything while connected).
+    static bool canProbeInterface(const QString &interfaceName);
+
 private:
     // Measurement batches are executed on this thread.
     RunningWorkerThread _measurementThread;
-    //This QTimer triggers when we need to refresh the measurements for all
+    //This timer triggers when we need to refresh the measurements for all
     //servers.  This timer is running if and only if measurements have been
     //started.
-    QTimer _measureTrigger;
+    ServiceTimer _measureTrigger;
     //All locations received from the last call to updateLocations() are
     //held here.  The rest of the location list isn't stored; we only keep track
     //of the distinct addresses that are pinged.
@@ -156,6 +276,11 @@ private:
     //Values are LocationData objects, which contain the location's ping address
     //and its LatencyHistory.
     QHash<QString, LocationData> _locations;
+    //Location IDs from setPriorityLocations()
+    QSet<QString> _priorityLocations;
+    //Interface and local address for probes from setProbeInterface()
+    QString _probeInterfaceName;
+    QHostAddress _probeLocalAddress;
 };
 
 Q_DECLARE_METATYPE(std::chrono::milliseconds);
@@ -170,6 +295,16 @@ Q_DECLARE_METATYPE(LatencyTracker::Latencies);
 // calculates the measured latency.  Groups of measurements are emitted in the
 // newMeasurements signal, which LatencyTracker forwards on.
 //
+// In burst mode (probeCount > 1), several probes are sent to each address,
+// spaced apart within the batch.  Each location's measurement reports the
+// minimum and median roundtrip times and the fraction of probes lost, so one
+// lost packet doesn't lose the measurement for the whole refresh interval.
+//
+// If the timeout elapses without a single echo from any address, UDP is
+// probably blocked by the network.  In that case, LatencyBatch times a TCP
+// connection to each location's OpenVPN TCP address instead (one attempt per
+// location), and those measurements are reported with ProbeMethod::Tcp.
+//
 // Once all measurements are received, or if the timeout time elapses,
 // LatencyBatch destroys itself.
 class LatencyBatch : public QObject
@@ -181,9 +316,14 @@ public:
     using Latencies = LatencyTracker::Latencies;
 
 public:
-    //Create LatencyBatch with the locations that will be checked.
+    //Create LatencyBatch with the locations that will be checked, and the
+    //number of probes to send to each location.  If an interface and/or local
+    //address are given, the probes are bound to them (see
+    //LatencyTracker::setProbeInterface()).
     LatencyBatch(const QVector<LatencyTracker::PingLocation> &locations,
-                 QObject *pParent);
+                 QObject *pParent, int probeCount = 1,
+                 const QString &interfaceName = {},
+                 const QHostAddress &localAddress = {});
 
 signals:
     // This signal is emitted when new measurements have been calculated.
@@ -195,13 +335,50 @@ signals:
     // also can't figure out a type alias)
     void newMeasurements(const LatencyTracker::Latencies &measurements);
 
+private:
+    struct PendingLocation
+    {
+        //Location ID that we received in the constructor
+        QString id;
+        //Roundtrip times of the probes that have been answered
+        QVector<std::chrono::milliseconds> roundtrips;
+        //Last probe round that was answered, -1 if none have been
+        int lastAnsweredRound;
+        //TCP fallback address from the PingLocation
+        QString tcpAddress;
+    };
+
 private:
     void emitBatchedMeasurements();
+    //Bind the QUdpSocket to send pings and receive echoes (used when the
+    //native probe isn't available)
+    void openSocket();
+    //Bind a socket to _interfaceName, if there is one.  Returns false if
+    //this fails.
+    bool bindToInterface(qintptr sockFd);
+    //Store the measurement for a location that has been probed, and remove it
+    //from _pendingReplies.
+    QHash<HostPortKey, PendingLocation>::iterator
+        completeLocation(QHash<HostPortKey, PendingLocation>::iterator itLocation);
+    //Start timing TCP connections to the pending locations that have a TCP
+    //address.  Returns false if there weren't any.
+    bool beginTcpFallback();
+    //A TCP connection attempt finished (connected or failed); clean up the
+    //socket and destroy the batch if it was the last one.
+    void finishTcpProbe(QTcpSocket *pSocket);
 
 private slots:
+    //Send one probe to each pending address
+    void sendProbeRound();
     //When the UDP socket has a datagram ready, it signals this slot.
     void onDatagramReady();
+    //An echo was received from a host.  receivedAt is the time it was
+    //received, relative to _timeSincePing.
+    void onEchoReceived(const QHostAddress &senderHost, quint16 senderPort,
+                        std::chrono::nanoseconds receivedAt);
     void onTimeoutElapsed();
+    //The TCP fallback connections have timed out
+    void onTcpTimeoutElapsed();
     // The batch timer has elapsed, process the batched measurements
     void onBatchElapsed();
 
@@ -209,11 +386,31 @@ private:
     //This timer measures the elapsed time since the pings were sent, which is
     //used to calculate latency when the echoes are received.
     QElapsedTimer _timeSincePing;
-    //This UDP socket is used to send pings and receive echoes.
+    //This UDP socket is used to send pings and receive echoes, unless the
+    //native probe is used.
     QUdpSocket _udpSocket;
-    //This map holds the addresses that we haven't heard echoes from yet.
-    //Values are the location IDs that we received in the constructor.
-    QHash<HostPortKey, QString> _pendingReplies;
+#ifdef Q_OS_LINUX
+    //On Linux, the pings are sent with sendmmsg() and the echoes are
+    //timestamped by the kernel, so our own event loop delays aren't included
+    //in the measurements.  Owned by this object; null if it's not used.
+    LinuxLatencyProbe *_pNativeProbe;
+#endif
+    //This map holds the addresses that we haven't heard all echoes from yet.
+    QHash<HostPortKey, PendingLocation> _pendingReplies;
+    //Whether any echo has been received by this batch
+    bool _anyEchoReceived;
+    //TCP connection attempts in progress for the fallback.  The sockets are
+    //owned by this object.
+    QSet<QTcpSocket*> _tcpProbes;
+    //Number of probes sent to each address
+    int _probeCount;
+    //Interface and local address that the probes are bound to, if any
+    QString _interfaceName;
+    QHostAddress _localAddress;
+    //Times that each probe round was sent, relative to _timeSincePing
+    QVector<std::chrono::nanoseconds> _roundSendTimes;
+    //Triggers each probe round after the first in burst mode
+    QTimer _roundTimer;
     // This QTimer is used to batch up new measurements.
     // We batch them and report them in groups to reduce the amount of changes
     // broadcast to clients and the number of events that have to be processed
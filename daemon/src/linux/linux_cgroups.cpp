@@ -0,0 +1,221 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("linux/linux_cgroups.cpp")
+
+#include "linux_cgroups.h"
+#include "brand.h"
+#include "path.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <linux/bpf.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+    const QString kExclusionsDirName{BRAND_CODE "vpnexclusions"};
+    const QString kVpnOnlyDirName{BRAND_CODE "vpnonly"};
+    const QString kProcsFileName{QStringLiteral("cgroup.procs")};
+
+    int bpf(int cmd, bpf_attr &attr)
+    {
+        return static_cast<int>(::syscall(__NR_bpf, cmd, &attr, sizeof(attr)));
+    }
+
+    // Load a BPF_PROG_TYPE_CGROUP_SOCK program that sets the socket's mark.
+    // It's small enough to assemble by hand, so there's no dependency on
+    // libbpf or an eBPF compiler.  Returns the program fd, or -1.
+    int loadMarkProgram(quint32 mark)
+    {
+        const bpf_insn program[]
+        {
+            // r2 = mark
+            {BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_2, 0, 0, static_cast<__s32>(mark)},
+            // ((struct bpf_sock *)r1)->mark = r2
+            {BPF_STX | BPF_MEM | BPF_W, BPF_REG_1, BPF_REG_2,
+             static_cast<__s16>(offsetof(bpf_sock, mark)), 0},
+            // return 1 (allow the socket)
+            {BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, 1},
+            {BPF_JMP | BPF_EXIT, 0, 0, 0, 0},
+        };
+        static const char license[] = "GPL";
+
+        bpf_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.prog_type = BPF_PROG_TYPE_CGROUP_SOCK;
+        attr.insns = static_cast<__u64>(reinterpret_cast<std::uintptr_t>(program));
+        attr.insn_cnt = sizeof(program) / sizeof(program[0]);
+        attr.license = static_cast<__u64>(reinterpret_cast<std::uintptr_t>(license));
+        // expected_attach_type is left 0 - the kernel defaults it to
+        // BPF_CGROUP_INET_SOCK_CREATE for this program type, and kernels
+        // older than 4.17 reject unknown nonzero fields.
+        return bpf(BPF_PROG_LOAD, attr);
+    }
+}
+
+const QString &LinuxCGroups::cGroup2Root()
+{
+    static const QString root = []() -> QString
+    {
+        QFile mounts{QStringLiteral("/proc/self/mounts")};
+        if(!mounts.open(QIODevice::ReadOnly | QIODevice::Text))
+            return {};
+        // Each line is "<device> <mount point> <type> <options> 0 0"
+        for(const QByteArray &line : mounts.readAll().split('\n'))
+        {
+            const QList<QByteArray> fields = line.split(' ');
+            if(fields.size() >= 3 && fields[2] == "cgroup2")
+                return QString::fromLocal8Bit(fields[1]);
+        }
+        return {};
+    }();
+    return root;
+}
+
+bool LinuxCGroups::useCGroup2()
+{
+    // Prefer net_cls if it's mounted; it's what we've always used.
+    static const bool result = !QFileInfo::exists(Path::ParentVpnExclusionsFile) &&
+        !cGroup2Root().isEmpty();
+    return result;
+}
+
+bool LinuxCGroups::isSupported()
+{
+    return useCGroup2() || QFileInfo::exists(Path::ParentVpnExclusionsFile);
+}
+
+QString LinuxCGroups::exclusionsFile()
+{
+    if(useCGroup2())
+        return QDir{cGroup2Root()}.filePath(kExclusionsDirName + '/' + kProcsFileName);
+    return Path::VpnExclusionsFile;
+}
+
+QString LinuxCGroups::vpnOnlyFile()
+{
+    if(useCGroup2())
+        return QDir{cGroup2Root()}.filePath(kVpnOnlyDirName + '/' + kProcsFileName);
+    return Path::VpnOnlyFile;
+}
+
+QString LinuxCGroups::parentFile()
+{
+    if(useCGroup2())
+        return QDir{cGroup2Root()}.filePath(kProcsFileName);
+    return Path::ParentVpnExclusionsFile;
+}
+
+QString LinuxCGroups::procsFileForPid(pid_t pid)
+{
+    if(!useCGroup2())
+        return {};
+
+    QFile cgroupFile{QStringLiteral("/proc/%1/cgroup").arg(pid)};
+    if(!cgroupFile.open(QIODevice::ReadOnly | QIODevice::Text))
+        return {};
+    // The v2 hierarchy is the line "0::<path>"
+    for(const QByteArray &line : cgroupFile.readAll().split('\n'))
+    {
+        if(!line.startsWith("0::"))
+            continue;
+        QString path = QString::fromLocal8Bit(line.mid(3));
+        // If it's already in one of our cgroups, we don't know the original
+        if(path.endsWith('/' + kExclusionsDirName) || path.endsWith('/' + kVpnOnlyDirName))
+            return {};
+        return QDir{cGroup2Root() + path}.filePath(kProcsFileName);
+    }
+    return {};
+}
+
+bool LinuxCGroups::attachMarkProgram(const QString &cGroupDir, quint32 mark)
+{
+    if(!QDir{}.mkpath(cGroupDir))
+    {
+        qWarning() << "Unable to create cgroup" << cGroupDir;
+        return false;
+    }
+
+    int programFd = loadMarkProgram(mark);
+    if(programFd == -1)
+    {
+        qWarning() << "Unable to load socket mark program:" << errno
+            << qPrintable(qt_error_string(errno));
+        return false;
+    }
+
+    bool result = false;
+    int cGroupFd = ::open(QFile::encodeName(cGroupDir).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(cGroupFd == -1)
+    {
+        qWarning() << "Unable to open cgroup" << cGroupDir << "-" << errno
+            << qPrintable(qt_error_string(errno));
+    }
+    else
+    {
+        bpf_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.target_fd = static_cast<__u32>(cGroupFd);
+        attr.attach_bpf_fd = static_cast<__u32>(programFd);
+        attr.attach_type = BPF_CGROUP_INET_SOCK_CREATE;
+        // No flags - replaces a program left by a prior daemon instance
+        attr.attach_flags = 0;
+        if(bpf(BPF_PROG_ATTACH, attr) == -1)
+        {
+            qWarning() << "Unable to attach socket mark program to" << cGroupDir
+                << "-" << errno << qPrintable(qt_error_string(errno));
+        }
+        else
+        {
+            qInfo().nospace() << "Attached socket mark program to " << cGroupDir
+                << ", mark 0x" << QString::number(mark, 16);
+            result = true;
+        }
+        ::close(cGroupFd);
+    }
+
+    // The cgroup holds a reference to the attached program
+    ::close(programFd);
+    return result;
+}
+
+void LinuxCGroups::detachMarkProgram(const QString &cGroupDir)
+{
+    int cGroupFd = ::open(QFile::encodeName(cGroupDir).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(cGroupFd == -1)
+        return; // Nothing to detach
+
+    bpf_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.target_fd = static_cast<__u32>(cGroupFd);
+    attr.attach_type = BPF_CGROUP_INET_SOCK_CREATE;
+    // ENOENT just means there was no program attached
+    if(bpf(BPF_PROG_DETACH, attr) == -1 && errno != ENOENT)
+    {
+        qWarning() << "Unable to detach socket mark program from" << cGroupDir
+            << "-" << errno << qPrintable(qt_error_string(errno));
+    }
+    ::close(cGroupFd);
+}
@@ -0,0 +1,76 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("linux/linux_cgroups.h")
+
+#ifndef LINUX_CGROUPS_H
+#define LINUX_CGROUPS_H
+
+#include <QString>
+#include <sys/types.h>
+
+// LinuxCGroups selects how split tunnel classifies processes.
+//
+// The net_cls cgroup v1 controller is used when it's available.  Each of our
+// cgroups has a classid, and iptables marks packets with "-m cgroup".
+//
+// Hosts that only have the cgroup v2 (unified) hierarchy have no net_cls.
+// There, our cgroups are created in the cgroup2 hierarchy instead, and an eBPF
+// program attached to each one sets the mark of every socket created in
+// it.  Sockets are marked when they're created, so policy routing applies from
+// their first packet, and children of a process in the cgroup are always
+// classified.  There's no iptables marking step.
+//
+// Either way, processes are still put in the cgroups by ProcTracker in
+// response to exec events.
+class LinuxCGroups
+{
+    CLASS_LOGGING_CATEGORY("cgroups")
+
+public:
+    // Whether the cgroup v2 classifier is used.  This is determined once.
+    static bool useCGroup2();
+    // Whether either classifier can be used
+    static bool isSupported();
+
+    // The cgroup.procs files for the excluded and VPN-only cgroups, and the
+    // one used to remove a process from those cgroups when its original
+    // cgroup isn't known.
+    static QString exclusionsFile();
+    static QString vpnOnlyFile();
+    static QString parentFile();
+
+    // With cgroup v2, return the cgroup.procs file of the cgroup containing
+    // pid.  Processes are returned to their original cgroup when they're
+    // removed, since other software (systemd) manages the v2 hierarchy.
+    // Returns an empty string if it can't be read, or with net_cls.
+    static QString procsFileForPid(pid_t pid);
+
+    // Create a cgroup v2 directory if needed and attach a program that sets
+    // 'mark' on sockets created in it.  Replaces a program attached by a
+    // prior daemon instance.
+    static bool attachMarkProgram(const QString &cGroupDir, quint32 mark);
+    static void detachMarkProgram(const QString &cGroupDir);
+
+private:
+    // Mount point of the cgroup2 hierarchy, or an empty string if it's not
+    // mounted
+    static const QString &cGroup2Root();
+};
+
+#endif
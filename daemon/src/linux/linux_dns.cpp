@@ -0,0 +1,317 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("linux/linux_dns.cpp")
+
+#include "linux_dns.h"
+#include "path.h"
+#include <QDBusArgument>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusMetaType>
+#include <QFile>
+#include <QFileInfo>
+#include <QHostAddress>
+#include <QProcess>
+#include <QStandardPaths>
+#include <linux/fs.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// D-Bus types used by systemd-resolved's SetLinkDNS() - a(iay) - and
+// SetLinkDomains() - a(sb)
+struct ResolvedLinkDns
+{
+    qint32 family;
+    QByteArray address;
+};
+Q_DECLARE_METATYPE(ResolvedLinkDns)
+
+struct ResolvedLinkDomain
+{
+    QString domain;
+    bool routingOnly;
+};
+Q_DECLARE_METATYPE(ResolvedLinkDomain)
+
+QDBusArgument &operator<<(QDBusArgument &arg, const ResolvedLinkDns &dns)
+{
+    arg.beginStructure();
+    arg << dns.family << dns.address;
+    arg.endStructure();
+    return arg;
+}
+
+const QDBusArgument &operator>>(const QDBusArgument &arg, ResolvedLinkDns &dns)
+{
+    arg.beginStructure();
+    arg >> dns.family >> dns.address;
+    arg.endStructure();
+    return arg;
+}
+
+QDBusArgument &operator<<(QDBusArgument &arg, const ResolvedLinkDomain &domain)
+{
+    arg.beginStructure();
+    arg << domain.domain << domain.routingOnly;
+    arg.endStructure();
+    return arg;
+}
+
+const QDBusArgument &operator>>(const QDBusArgument &arg, ResolvedLinkDomain &domain)
+{
+    arg.beginStructure();
+    arg >> domain.domain >> domain.routingOnly;
+    arg.endStructure();
+    return arg;
+}
+
+namespace
+{
+    const QString resolvConfPath{QStringLiteral("/etc/resolv.conf")};
+    const QString resolvconfLinkPath{QStringLiteral("/run/resolvconf/resolv.conf")};
+    // Timeout for each D-Bus call and resolvconf invocation
+    const std::chrono::seconds dnsCallTimeout{5};
+
+    enum class DnsMethod
+    {
+        SystemdResolved,
+        Resolvconf,
+        ResolvConfFile,
+    };
+
+    DnsMethod detectDnsMethod()
+    {
+        QString target = QFileInfo{resolvConfPath}.canonicalFilePath();
+        // If the symlink target has "systemd" in the path, assume
+        // systemd-resolved is in control
+        if(target.contains(QLatin1String("systemd")))
+            return DnsMethod::SystemdResolved;
+        // There are many ways resolvconf can be used, but we only support it
+        // when there's a symlink to /run/resolvconf.  Everything else falls
+        // back to overwriting /etc/resolv.conf.
+        if(target == resolvconfLinkPath &&
+           !QStandardPaths::findExecutable(QStringLiteral("resolvconf")).isEmpty())
+        {
+            return DnsMethod::Resolvconf;
+        }
+        return DnsMethod::ResolvConfFile;
+    }
+
+    Path resolvConfBackupPath() {return Path::DaemonDataDir / "pia.resolv.conf";}
+
+    QString resolvconfInterface(const QString &tunnelDevice)
+    {
+        return tunnelDevice + QStringLiteral(".openvpn");
+    }
+
+    bool isImmutable(const QString &path)
+    {
+        int fd = ::open(qPrintable(path), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+            return false;
+        int flags{0};
+        bool immutable = ::ioctl(fd, FS_IOC_GETFLAGS, &flags) == 0 &&
+            (flags & FS_IMMUTABLE_FL);
+        ::close(fd);
+        return immutable;
+    }
+
+    bool callResolved(const QString &method, const QList<QVariant> &args)
+    {
+        static const bool typesRegistered = []()
+        {
+            qDBusRegisterMetaType<ResolvedLinkDns>();
+            qDBusRegisterMetaType<QList<ResolvedLinkDns>>();
+            qDBusRegisterMetaType<ResolvedLinkDomain>();
+            qDBusRegisterMetaType<QList<ResolvedLinkDomain>>();
+            return true;
+        }();
+        Q_UNUSED(typesRegistered);
+
+        auto call = QDBusMessage::createMethodCall(QStringLiteral("org.freedesktop.resolve1"),
+                                                   QStringLiteral("/org/freedesktop/resolve1"),
+                                                   QStringLiteral("org.freedesktop.resolve1.Manager"),
+                                                   method);
+        call.setArguments(args);
+        QDBusMessage reply = QDBusConnection::systemBus().call(call, QDBus::Block,
+                                                                msec32(dnsCallTimeout));
+        if(reply.type() == QDBusMessage::ErrorMessage)
+        {
+            qWarning() << method << "failed:" << reply.errorName()
+                << reply.errorMessage();
+            return false;
+        }
+        return true;
+    }
+
+    bool runResolvconf(const QStringList &args, const QByteArray &input)
+    {
+        QProcess resolvconf;
+        resolvconf.start(QStringLiteral("resolvconf"), args);
+        if(!input.isEmpty())
+            resolvconf.write(input);
+        resolvconf.closeWriteChannel();
+        if(!resolvconf.waitForFinished(msec32(dnsCallTimeout)) ||
+           resolvconf.exitStatus() != QProcess::NormalExit ||
+           resolvconf.exitCode() != 0)
+        {
+            qWarning() << "resolvconf" << args << "failed:"
+                << resolvconf.exitCode() << resolvconf.errorString()
+                << resolvconf.readAllStandardError();
+            return false;
+        }
+        return true;
+    }
+
+    QByteArray buildResolvConf(const QStringList &dnsServers)
+    {
+        QByteArray content;
+        for(const auto &server : dnsServers)
+            content += "nameserver " + server.toLatin1() + "\n";
+        return content;
+    }
+}
+
+bool LinuxDns::applyDns(const QString &tunnelDevice, const QStringList &dnsServers)
+{
+    qInfo() << "Applying DNS servers" << dnsServers << "for" << tunnelDevice;
+
+    switch(detectDnsMethod())
+    {
+        case DnsMethod::SystemdResolved:
+        {
+            int linkIndex = static_cast<int>(::if_nametoindex(qPrintable(tunnelDevice)));
+            if(!linkIndex)
+            {
+                qWarning() << "Unable to identify tunnel interface" << tunnelDevice;
+                return false;
+            }
+
+            QList<ResolvedLinkDns> servers;
+            for(const auto &server : dnsServers)
+            {
+                QHostAddress address{server};
+                quint32 ipv4 = address.toIPv4Address();
+                QByteArray bytes(4, 0);
+                for(int i = 0; i < 4; ++i)
+                    bytes[i] = static_cast<char>((ipv4 >> (24 - 8*i)) & 0xFF);
+                servers.push_back({AF_INET, bytes});
+            }
+            // Set DNS servers on the tunnel interface, then force the tunnel
+            // interface to handle all DNS queries
+            return callResolved(QStringLiteral("SetLinkDNS"),
+                                {linkIndex, QVariant::fromValue(servers)}) &&
+                callResolved(QStringLiteral("SetLinkDomains"),
+                             {linkIndex, QVariant::fromValue(QList<ResolvedLinkDomain>{{QStringLiteral("."), true}})});
+        }
+        case DnsMethod::Resolvconf:
+        {
+            // Add dummy (link-local) addresses - Ubuntu 16.04's resolvconf
+            // needs 3 addresses, or it falls back to the original DNS
+            // configuration for the 3rd, which could cause leaks
+            QStringList servers = dnsServers;
+            servers << QStringLiteral("169.254.12.97") << QStringLiteral("169.254.12.98");
+            return runResolvconf({QStringLiteral("-a"), resolvconfInterface(tunnelDevice)},
+                                 buildResolvConf(servers.mid(0, 3)));
+        }
+        default:
+        case DnsMethod::ResolvConfFile:
+        {
+            if(isImmutable(resolvConfPath))
+            {
+                qWarning() << "Failed to update DNS servers:" << resolvConfPath
+                    << "was set +i (immutable)";
+                return false;
+            }
+
+            // Only back it up if there isn't a backup already, otherwise we'd
+            // replace a backup that may be the only copy remaining (if the
+            // backup wasn't restored due to a crash, etc.)
+            QFile backup{resolvConfBackupPath()};
+            if(!backup.exists())
+            {
+                qInfo() << "Backing up" << resolvConfPath << "to" << backup.fileName();
+                QFile original{resolvConfPath};
+                if(!original.open(QIODevice::ReadOnly) ||
+                   !backup.open(QIODevice::WriteOnly) ||
+                   backup.write(original.readAll()) < 0 || !backup.flush())
+                {
+                    qWarning() << "Unable to back up" << resolvConfPath << "-"
+                        << original.errorString() << backup.errorString();
+                    return false;
+                }
+                ::fsync(backup.handle());
+            }
+
+            // Write through the existing file (don't replace it), like the
+            // redirection in the old script did
+            QFile resolvConf{resolvConfPath};
+            if(!resolvConf.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+               resolvConf.write(buildResolvConf(dnsServers)) < 0)
+            {
+                qWarning() << "Unable to write" << resolvConfPath << "-"
+                    << resolvConf.errorString();
+                return false;
+            }
+            return true;
+        }
+    }
+}
+
+void LinuxDns::restoreDns(const QString &tunnelDevice)
+{
+    switch(detectDnsMethod())
+    {
+        case DnsMethod::SystemdResolved:
+            // Nothing to do, the link configuration goes away with the link
+            break;
+        case DnsMethod::Resolvconf:
+            if(!tunnelDevice.isEmpty())
+            {
+                qInfo() << "Resetting resolvconf configuration for" << tunnelDevice;
+                runResolvconf({QStringLiteral("-d"), resolvconfInterface(tunnelDevice)}, {});
+            }
+            break;
+        default:
+        case DnsMethod::ResolvConfFile:
+        {
+            QFile backup{resolvConfBackupPath()};
+            if(!backup.exists())
+                break;
+            qInfo() << "Restoring" << resolvConfPath << "from backup";
+            QFile resolvConf{resolvConfPath};
+            if(!backup.open(QIODevice::ReadOnly) ||
+               !resolvConf.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+               resolvConf.write(backup.readAll()) < 0)
+            {
+                qWarning() << "Unable to restore" << resolvConfPath << "-"
+                    << backup.errorString() << resolvConf.errorString();
+                break;
+            }
+            resolvConf.close();
+            backup.close();
+            backup.remove();
+            break;
+        }
+    }
+}
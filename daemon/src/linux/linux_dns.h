@@ -0,0 +1,57 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("linux/linux_dns.h")
+
+#ifndef LINUX_DNS_H
+#define LINUX_DNS_H
+
+#include <QString>
+#include <QStringList>
+
+// LinuxDns applies the DNS servers for the tunnel from the daemon.  This used
+// to be done by the OpenVPN updown script, which forked several shells and
+// tools on each connection, and reported errors with a magic string that had
+// to be scraped from the OpenVPN output.
+//
+// The method depends on what manages /etc/resolv.conf, as before:
+// - systemd-resolved: the servers are set on the tunnel link with the
+//   SetLinkDNS/SetLinkDomains D-Bus methods.  resolved removes them when the
+//   link goes away.
+// - resolvconf (when /etc/resolv.conf links to /run/resolvconf): an interface
+//   configuration is added with 'resolvconf -a'.
+// - otherwise: /etc/resolv.conf is backed up and overwritten, and restored
+//   afterward.  The backup is made only once, so a backup left by a crash
+//   isn't overwritten with our configuration.
+class LinuxDns
+{
+    CLASS_LOGGING_CATEGORY("linux.dns")
+
+public:
+    // Apply DNS servers for the tunnel interface.  Returns false if they
+    // couldn't be applied (the connection should fail with
+    // Error::OpenVPNDNSConfigError).
+    static bool applyDns(const QString &tunnelDevice, const QStringList &dnsServers);
+    // Restore the DNS configuration after the tunnel interface goes down.
+    // tunnelDevice is the device passed to applyDns(), or an empty string if
+    // it isn't known (only a resolv.conf backup is restored then).
+    static void restoreDns(const QString &tunnelDevice);
+};
+
+#endif
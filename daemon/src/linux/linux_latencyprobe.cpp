@@ -0,0 +1,198 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("linux/linux_latencyprobe.cpp")
+
+#include "linux_latencyprobe.h"
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    //Number of echoes read by each recvmmsg() call
+    enum : int { RecvBatchSize = 32 };
+
+    //Get the time from 'start' to 'end'
+    std::chrono::nanoseconds elapsed(const timespec &start, const timespec &end)
+    {
+        return std::chrono::seconds{end.tv_sec - start.tv_sec} +
+            std::chrono::nanoseconds{end.tv_nsec - start.tv_nsec};
+    }
+}
+
+LinuxLatencyProbe::LinuxLatencyProbe(QObject *pParent)
+    : QObject{pParent}, _sockFd{-1}
+{
+    _sockFd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(_sockFd < 0)
+    {
+        qWarning() << "Unable to open latency socket:" << errno
+            << qPrintable(qt_error_string(errno));
+        return;
+    }
+
+    int enable = 1;
+    if(::setsockopt(_sockFd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0)
+    {
+        //Not fatal, echoes will be timestamped when they're read instead
+        qWarning() << "Unable to enable receive timestamps:" << errno
+            << qPrintable(qt_error_string(errno));
+    }
+
+    _readNotifier = new QSocketNotifier(_sockFd, QSocketNotifier::Read, this);
+    connect(_readNotifier, &QSocketNotifier::activated, this,
+            &LinuxLatencyProbe::onReadable);
+}
+
+LinuxLatencyProbe::~LinuxLatencyProbe()
+{
+    //Destroy the notifier before the socket is closed
+    delete _readNotifier;
+    if(_sockFd >= 0)
+        ::close(_sockFd);
+}
+
+bool LinuxLatencyProbe::sendProbes(const QVector<Target> &targets)
+{
+    if(!isOpen() || targets.isEmpty())
+        return false;
+
+    static char pingData{0x61};
+    iovec pingIov{&pingData, sizeof(pingData)};
+
+    std::vector<sockaddr_in> addrs(targets.size());
+    std::vector<mmsghdr> msgs(targets.size());
+    for(int i=0; i<targets.size(); ++i)
+    {
+        Q_ASSERT(targets[i].first.protocol() == QAbstractSocket::IPv4Protocol);
+        addrs[i] = {};
+        addrs[i].sin_family = AF_INET;
+        addrs[i].sin_addr.s_addr = htonl(targets[i].first.toIPv4Address());
+        addrs[i].sin_port = htons(targets[i].second);
+
+        msgs[i] = {};
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov = &pingIov;
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    //sendmmsg() can send fewer messages than requested, keep going until
+    //everything is sent or it fails
+    std::size_t sent = 0;
+    while(sent < msgs.size())
+    {
+        int result = ::sendmmsg(_sockFd, msgs.data() + sent,
+                                msgs.size() - sent, 0);
+        if(result < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            //Skip a message that can't be sent (for example, a network
+            //unreachable error), the rest might still work
+            qWarning() << "Unable to send latency ping to"
+                << targets[static_cast<int>(sent)].first << "-" << errno
+                << qPrintable(qt_error_string(errno));
+            ++sent;
+            continue;
+        }
+        sent += static_cast<std::size_t>(result);
+    }
+
+    return true;
+}
+
+void LinuxLatencyProbe::onReadable()
+{
+    sockaddr_in srcAddrs[RecvBatchSize];
+    //Echoes aren't expected to contain any data, read just one byte
+    char data[RecvBatchSize];
+    iovec iovs[RecvBatchSize];
+    alignas(cmsghdr) char control[RecvBatchSize][CMSG_SPACE(sizeof(timespec))];
+    mmsghdr msgs[RecvBatchSize];
+
+    int received = RecvBatchSize;
+    //Drain the socket; stop once recvmmsg() returns less than a full batch
+    while(received == RecvBatchSize)
+    {
+        for(int i=0; i<RecvBatchSize; ++i)
+        {
+            iovs[i] = {&data[i], 1};
+            msgs[i] = {};
+            msgs[i].msg_hdr.msg_name = &srcAddrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(srcAddrs[i]);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = control[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+        }
+
+        received = ::recvmmsg(_sockFd, msgs, RecvBatchSize, MSG_DONTWAIT,
+                              nullptr);
+        if(received < 0)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                qWarning() << "Unable to receive latency echoes:" << errno
+                    << qPrintable(qt_error_string(errno));
+            }
+            return;
+        }
+
+        //SO_TIMESTAMPNS uses CLOCK_REALTIME
+        timespec readTime{};
+        ::clock_gettime(CLOCK_REALTIME, &readTime);
+
+        for(int i=0; i<received; ++i)
+        {
+            msghdr &hdr = msgs[i].msg_hdr;
+            if(hdr.msg_namelen < sizeof(sockaddr_in) ||
+               srcAddrs[i].sin_family != AF_INET)
+            {
+                continue;
+            }
+
+            //Any echo without a kernel timestamp has no known delay
+            timespec recvTime = readTime;
+            for(cmsghdr *pCmsg = CMSG_FIRSTHDR(&hdr); pCmsg;
+                pCmsg = CMSG_NXTHDR(&hdr, pCmsg))
+            {
+                if(pCmsg->cmsg_level == SOL_SOCKET &&
+                   pCmsg->cmsg_type == SCM_TIMESTAMPNS)
+                {
+                    std::memcpy(&recvTime, CMSG_DATA(pCmsg), sizeof(recvTime));
+                }
+            }
+
+            //The realtime clock could have been stepped between the two
+            //timestamps; don't report a bogus negative delay
+            auto readDelay = std::max(elapsed(recvTime, readTime),
+                                      std::chrono::nanoseconds{0});
+
+            emit echoReceived(QHostAddress{ntohl(srcAddrs[i].sin_addr.s_addr)},
+                              ntohs(srcAddrs[i].sin_port), readDelay);
+        }
+    }
+}
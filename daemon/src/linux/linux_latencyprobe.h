@@ -0,0 +1,79 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("linux/linux_latencyprobe.h")
+
+#ifndef LINUX_LATENCYPROBE_H
+#define LINUX_LATENCYPROBE_H
+
+#include <QHostAddress>
+#include <QObject>
+#include <QPair>
+#include <QPointer>
+#include <QSocketNotifier>
+#include <QVector>
+#include <chrono>
+
+// LinuxLatencyProbe sends latency pings with one sendmmsg() call and reads
+// the echoes with recvmmsg().
+//
+// The socket has SO_TIMESTAMPNS enabled, so each echo's receive time comes
+// from the kernel rather than from when the event loop got around to reading
+// it.  This keeps our own event-loop and scheduling delays out of the latency
+// measurements.
+//
+// Only IPv4 is supported; LatencyBatch falls back to QUdpSocket otherwise.
+class LinuxLatencyProbe : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("latency");
+
+public:
+    using Target = QPair<QHostAddress, quint16>;
+
+public:
+    LinuxLatencyProbe(QObject *pParent);
+    ~LinuxLatencyProbe();
+
+public:
+    // Whether the socket was opened successfully.
+    bool isOpen() const {return _sockFd >= 0;}
+    // The socket, so it can be bound to an interface; -1 if it isn't open.
+    int socketDescriptor() const {return _sockFd;}
+
+    // Send a one-byte ping to each target.  All targets must be IPv4
+    // addresses.  Returns false if no pings could be sent.
+    bool sendProbes(const QVector<Target> &targets);
+
+signals:
+    // An echo was received from a host.  'readDelay' is the time between the
+    // kernel's receive timestamp for the echo and when it was read, so the
+    // receiver can subtract it from its own clock.
+    void echoReceived(const QHostAddress &host, quint16 port,
+                      std::chrono::nanoseconds readDelay);
+
+private:
+    void onReadable();
+
+private:
+    int _sockFd;
+    QPointer<QSocketNotifier> _readNotifier;
+};
+
+#endif
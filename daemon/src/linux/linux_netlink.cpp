@@ -0,0 +1,154 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("linux/linux_netlink.cpp")
+
+#include "linux_netlink.h"
+#include <linux/genetlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+
+void NetlinkRequest::addAttr(quint16 type, const void *pValue, std::size_t len)
+{
+    std::size_t offset = NLMSG_ALIGN(header()->nlmsg_len);
+    _data.resize(offset + NLA_ALIGN(NLA_HDRLEN + len));
+    auto pAttr = reinterpret_cast<nlattr*>(_data.data() + offset);
+    pAttr->nla_type = type;
+    pAttr->nla_len = static_cast<quint16>(NLA_HDRLEN + len);
+    if(len)
+        std::memcpy(_data.data() + offset + NLA_HDRLEN, pValue, len);
+    header()->nlmsg_len = static_cast<quint32>(offset + NLA_HDRLEN + len);
+}
+
+std::size_t NetlinkRequest::beginNested(quint16 type)
+{
+    std::size_t offset = NLMSG_ALIGN(header()->nlmsg_len);
+    addAttr(type | NLA_F_NESTED, nullptr, 0);
+    return offset;
+}
+
+void NetlinkRequest::endNested(std::size_t offset)
+{
+    auto pAttr = reinterpret_cast<nlattr*>(_data.data() + offset);
+    pAttr->nla_len = static_cast<quint16>(header()->nlmsg_len - offset);
+}
+
+NetlinkSocket::NetlinkSocket(int protocol)
+    : _fd{::socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol)},
+      _nextSeq{1}
+{
+    if(_fd < 0)
+    {
+        qWarning() << "Unable to open netlink socket:" << errno
+            << qPrintable(qt_error_string(errno));
+    }
+}
+
+NetlinkSocket::~NetlinkSocket()
+{
+    if(_fd >= 0)
+        ::close(_fd);
+}
+
+int NetlinkSocket::perform(NetlinkRequest &request, const MessageFunc &onMessage)
+{
+    if(_fd < 0)
+        return EBADF;
+
+    nlmsghdr *pRequest = request.header();
+    pRequest->nlmsg_seq = _nextSeq++;
+    // Always request an acknowledgement.  Dumps end with NLMSG_DONE instead
+    // (the kernel doesn't acknowledge them), but the dump flags can't be used
+    // to tell them apart - NLM_F_DUMP includes NLM_F_ROOT, which has the same
+    // value as NLM_F_REPLACE.
+    pRequest->nlmsg_flags |= NLM_F_ACK;
+
+    if(::send(_fd, pRequest, pRequest->nlmsg_len, 0) < 0)
+        return errno;
+
+    std::vector<unsigned char> buffer(16384);
+    while(true)
+    {
+        ssize_t len = ::recv(_fd, buffer.data(), buffer.size(), 0);
+        if(len < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return errno;
+        }
+
+        int remaining = static_cast<int>(len);
+        for(auto pMsg = reinterpret_cast<const nlmsghdr*>(buffer.data());
+            NLMSG_OK(pMsg, remaining); pMsg = NLMSG_NEXT(pMsg, remaining))
+        {
+            if(pMsg->nlmsg_seq != pRequest->nlmsg_seq)
+                continue;   // Stale reply to an earlier request
+            if(pMsg->nlmsg_type == NLMSG_DONE)
+                return 0;
+            if(pMsg->nlmsg_type == NLMSG_ERROR)
+            {
+                auto pErr = reinterpret_cast<const nlmsgerr*>(NLMSG_DATA(pMsg));
+                return -pErr->error;    // 0 for an acknowledgement
+            }
+            if(onMessage)
+                onMessage(*pMsg);
+        }
+    }
+}
+
+quint16 NetlinkSocket::resolveGenericFamily(const char *name)
+{
+    genlmsghdr header{};
+    header.cmd = CTRL_CMD_GETFAMILY;
+    header.version = 1;
+    NetlinkRequest request{GENL_ID_CTRL, NLM_F_REQUEST, header};
+    request.addString(CTRL_ATTR_FAMILY_NAME, name);
+
+    quint16 familyId{0};
+    int err = perform(request, [&familyId](const nlmsghdr &msg)
+    {
+        forEachNetlinkAttr(reinterpret_cast<const char*>(NLMSG_DATA(&msg)) + GENL_HDRLEN,
+                           static_cast<int>(msg.nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN)),
+                           [&familyId](quint16 type, const void *pData, int len)
+                           {
+                               if(type == CTRL_ATTR_FAMILY_ID && len >= static_cast<int>(sizeof(familyId)))
+                                   std::memcpy(&familyId, pData, sizeof(familyId));
+                           });
+    });
+    if(err && err != ENOENT)
+        qWarning() << "Unable to resolve netlink family" << name << "-" << err;
+    return err ? 0 : familyId;
+}
+
+void forEachNetlinkAttr(const void *pAttrs, int len,
+                        const std::function<void(quint16, const void*, int)> &onAttr)
+{
+    auto pAttr = reinterpret_cast<const nlattr*>(pAttrs);
+    while(len >= static_cast<int>(NLA_HDRLEN) && pAttr->nla_len >= NLA_HDRLEN &&
+          pAttr->nla_len <= len)
+    {
+        onAttr(pAttr->nla_type & NLA_TYPE_MASK,
+               reinterpret_cast<const char*>(pAttr) + NLA_HDRLEN,
+               pAttr->nla_len - NLA_HDRLEN);
+        int attrSpace = NLA_ALIGN(pAttr->nla_len);
+        len -= attrSpace;
+        pAttr = reinterpret_cast<const nlattr*>(reinterpret_cast<const char*>(pAttr) + attrSpace);
+    }
+}
@@ -0,0 +1,108 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("linux/linux_netlink.h")
+
+#ifndef LINUX_NETLINK_H
+#define LINUX_NETLINK_H
+
+#include <linux/netlink.h>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+// A netlink request - the netlink header, the family-specific header, and
+// any number of attributes (which can be nested).
+class NetlinkRequest
+{
+public:
+    template<class Header>
+    NetlinkRequest(quint16 type, quint16 flags, const Header &header)
+        : _data(NLMSG_SPACE(sizeof(Header)))
+    {
+        auto pMsg = reinterpret_cast<nlmsghdr*>(_data.data());
+        pMsg->nlmsg_len = NLMSG_LENGTH(sizeof(Header));
+        pMsg->nlmsg_type = type;
+        pMsg->nlmsg_flags = flags;
+        std::memcpy(NLMSG_DATA(pMsg), &header, sizeof(Header));
+    }
+
+public:
+    void addAttr(quint16 type, const void *pValue, std::size_t len);
+    void addU16(quint16 type, quint16 value) {addAttr(type, &value, sizeof(value));}
+    void addU32(quint16 type, quint32 value) {addAttr(type, &value, sizeof(value));}
+    // Add a null-terminated string attribute
+    void addString(quint16 type, const QByteArray &value)
+    {
+        addAttr(type, value.constData(), static_cast<std::size_t>(value.size()) + 1);
+    }
+
+    // Begin a nested attribute; attributes added until the matching
+    // endNested() are contained in it.  Returns the offset to pass to
+    // endNested().
+    std::size_t beginNested(quint16 type);
+    void endNested(std::size_t offset);
+
+    nlmsghdr *header() {return reinterpret_cast<nlmsghdr*>(_data.data());}
+
+private:
+    std::vector<unsigned char> _data;
+};
+
+// A netlink socket that can perform requests.  Each request waits for its
+// acknowledgement (or the end of a dump).
+class NetlinkSocket
+{
+    CLASS_LOGGING_CATEGORY("linux.netlink")
+
+public:
+    using MessageFunc = std::function<void(const nlmsghdr &)>;
+
+public:
+    // 'protocol' is the netlink family, such as NETLINK_ROUTE or
+    // NETLINK_GENERIC
+    explicit NetlinkSocket(int protocol);
+    ~NetlinkSocket();
+    NetlinkSocket(const NetlinkSocket &) = delete;
+    NetlinkSocket &operator=(const NetlinkSocket &) = delete;
+
+public:
+    // Send a request and wait for the result.  For dump requests, and for
+    // requests that reply with a message, onMessage is called for each
+    // message received.  Returns 0 if the request succeeded, or a (positive)
+    // errno value.
+    int perform(NetlinkRequest &request, const MessageFunc &onMessage = {});
+
+    // Resolve a generic netlink family's ID by name (NETLINK_GENERIC sockets
+    // only).  Returns 0 if the family isn't registered (such as when the
+    // kernel module providing it isn't loaded).
+    quint16 resolveGenericFamily(const char *name);
+
+private:
+    int _fd;
+    quint32 _nextSeq;
+};
+
+// Iterate the attributes following a family-specific header in a netlink
+// message (or the attributes nested in another attribute) - calls
+// onAttr(type, pData, len) for each attribute.
+void forEachNetlinkAttr(const void *pAttrs, int len,
+                        const std::function<void(quint16, const void*, int)> &onAttr);
+
+#endif
@@ -0,0 +1,433 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("linux/linux_routing.cpp")
+
+#include "linux_routing.h"
+#include "linux_netlink.h"
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QRegularExpression>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/fib_rules.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    // Files listing routing table names, in the order iproute2 reads them
+    const char *const kRtTablesFiles[]
+    {
+        "/etc/iproute2/rt_tables",
+        "/usr/share/iproute2/rt_tables",
+        "/usr/lib/iproute2/rt_tables",
+    };
+    const char *const kRtTablesDirs[]
+    {
+        "/etc/iproute2/rt_tables.d",
+        "/usr/share/iproute2/rt_tables.d",
+    };
+    const char kRouteFlushFile[]{"/proc/sys/net/ipv4/route/flush"};
+
+    // The fields of a rule that LinuxRouting::Rule describes
+    struct RuleFields
+    {
+        quint32 source; // Network byte order; 0 if there's no source selector
+        quint32 fwmark;
+        quint32 table;
+        quint32 priority;
+        int suppressPrefixLength;
+
+        bool operator==(const RuleFields &other) const
+        {
+            return source == other.source && fwmark == other.fwmark &&
+                table == other.table && priority == other.priority &&
+                suppressPrefixLength == other.suppressPrefixLength;
+        }
+    };
+
+    NetlinkRequest buildRuleRequest(quint16 type, quint16 flags, const RuleFields &fields)
+    {
+        fib_rule_hdr header{};
+        header.family = AF_INET;
+        header.action = FR_ACT_TO_TBL;
+        header.table = static_cast<quint8>(fields.table < 256 ? fields.table : RT_TABLE_UNSPEC);
+        if(fields.source)
+            header.src_len = 32;
+
+        NetlinkRequest request{type, flags, header};
+        request.addU32(FRA_TABLE, fields.table);
+        request.addU32(FRA_PRIORITY, fields.priority);
+        if(fields.source)
+            request.addAttr(FRA_SRC, &fields.source, sizeof(fields.source));
+        if(fields.fwmark)
+        {
+            request.addU32(FRA_FWMARK, fields.fwmark);
+            request.addU32(FRA_FWMASK, 0xFFFFFFFF);
+        }
+        if(fields.suppressPrefixLength >= 0)
+            request.addU32(FRA_SUPPRESS_PREFIXLEN, static_cast<quint32>(fields.suppressPrefixLength));
+        return request;
+    }
+
+    // Parse a rule from a rule dump.  Returns false for rules that can't be
+    // described by RuleFields (other families or actions).
+    bool parseRule(const nlmsghdr &msg, RuleFields &fields)
+    {
+        if(msg.nlmsg_type != RTM_NEWRULE)
+            return false;
+        auto pHeader = reinterpret_cast<const fib_rule_hdr*>(NLMSG_DATA(&msg));
+        if(pHeader->family != AF_INET || pHeader->action != FR_ACT_TO_TBL)
+            return false;
+
+        fields = {0, 0, pHeader->table, 0, -1};
+        int attrLen = static_cast<int>(msg.nlmsg_len - NLMSG_LENGTH(sizeof(fib_rule_hdr)));
+        auto pAttr = reinterpret_cast<const rtattr*>(reinterpret_cast<const char*>(pHeader) +
+                                                     NLMSG_ALIGN(sizeof(fib_rule_hdr)));
+        for(; RTA_OK(pAttr, attrLen); pAttr = RTA_NEXT(pAttr, attrLen))
+        {
+            switch(pAttr->rta_type)
+            {
+                case FRA_SRC:
+                    if(pHeader->src_len == 32)
+                        std::memcpy(&fields.source, RTA_DATA(pAttr), sizeof(fields.source));
+                    else
+                        return false;   // Subnet selectors aren't used by us
+                    break;
+                case FRA_FWMARK:
+                    std::memcpy(&fields.fwmark, RTA_DATA(pAttr), sizeof(fields.fwmark));
+                    break;
+                case FRA_TABLE:
+                    std::memcpy(&fields.table, RTA_DATA(pAttr), sizeof(fields.table));
+                    break;
+                case FRA_PRIORITY:
+                    std::memcpy(&fields.priority, RTA_DATA(pAttr), sizeof(fields.priority));
+                    break;
+                case FRA_SUPPRESS_PREFIXLEN:
+                {
+                    quint32 suppress{0};
+                    std::memcpy(&suppress, RTA_DATA(pAttr), sizeof(suppress));
+                    fields.suppressPrefixLength = static_cast<int>(suppress);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+        return true;
+    }
+
+    // Get the table ID of a route message, from either the header or the
+    // RTA_TABLE attribute
+    quint32 routeTable(const nlmsghdr &msg)
+    {
+        auto pRoute = reinterpret_cast<const rtmsg*>(NLMSG_DATA(&msg));
+        quint32 table{pRoute->rtm_table};
+        int attrLen = static_cast<int>(RTM_PAYLOAD(&msg));
+        for(auto pAttr = RTM_RTA(pRoute); RTA_OK(pAttr, attrLen);
+            pAttr = RTA_NEXT(pAttr, attrLen))
+        {
+            if(pAttr->rta_type == RTA_TABLE)
+                std::memcpy(&table, RTA_DATA(pAttr), sizeof(table));
+        }
+        return table;
+    }
+
+    // Parse a routing table names file into tableIds
+    void readRtTablesFile(const QString &path, QHash<QString, quint32> &tableIds)
+    {
+        QFile file{path};
+        if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+            return;
+
+        static const QRegularExpression lineRegex
+        {
+            QStringLiteral(R"(^\s*(0x[0-9a-fA-F]+|[0-9]+)\s+(\S+))")
+        };
+        while(!file.atEnd())
+        {
+            QString line = QString::fromUtf8(file.readLine());
+            auto match = lineRegex.match(line);
+            if(!match.hasMatch())
+                continue;   // Comments, blank lines
+            bool ok{false};
+            quint32 id = match.captured(1).toUInt(&ok, 0);
+            // Earlier files take precedence, like iproute2
+            if(ok && !tableIds.contains(match.captured(2)))
+                tableIds.insert(match.captured(2), id);
+        }
+    }
+
+    quint32 toNetworkAddress(const QHostAddress &address)
+    {
+        if(address.protocol() != QAbstractSocket::NetworkLayerProtocol::IPv4Protocol)
+            return 0;
+        return htonl(address.toIPv4Address());
+    }
+}
+
+quint32 LinuxRouting::tableId(const QString &tableName)
+{
+    // The installer registers our tables once; cache the names read.  The
+    // files are read again if a name isn't found, in case it was registered
+    // after the lookup.
+    static QHash<QString, quint32> tableIds;
+    if(!tableIds.contains(tableName))
+    {
+        tableIds.clear();
+        for(const char *pFile : kRtTablesFiles)
+            readRtTablesFile(QString::fromLatin1(pFile), tableIds);
+        for(const char *pDir : kRtTablesDirs)
+        {
+            QDir dir{QString::fromLatin1(pDir)};
+            for(const auto &entry : dir.entryList({QStringLiteral("*.conf")}, QDir::Files, QDir::Name))
+                readRtTablesFile(dir.filePath(entry), tableIds);
+        }
+        // The standard tables are built into iproute2
+        tableIds.insert(QStringLiteral("main"), RT_TABLE_MAIN);
+        tableIds.insert(QStringLiteral("local"), RT_TABLE_LOCAL);
+        tableIds.insert(QStringLiteral("default"), RT_TABLE_DEFAULT);
+    }
+
+    quint32 id = tableIds.value(tableName, RT_TABLE_UNSPEC);
+    if(id == RT_TABLE_UNSPEC)
+        qWarning() << "Routing table" << tableName << "is not registered";
+    return id;
+}
+
+bool LinuxRouting::ensureRule(const Rule &rule)
+{
+    RuleFields fields{toNetworkAddress(rule.source), rule.fwmark,
+                      tableId(rule.tableName), rule.priority,
+                      rule.suppressPrefixLength};
+    if(fields.table == RT_TABLE_UNSPEC)
+        return false;
+
+    NetlinkSocket sock{NETLINK_ROUTE};
+    bool exists{false};
+    fib_rule_hdr dumpHeader{};
+    dumpHeader.family = AF_INET;
+    NetlinkRequest dump{RTM_GETRULE, NLM_F_REQUEST | NLM_F_DUMP, dumpHeader};
+    int err = sock.perform(dump, [&](const nlmsghdr &msg)
+    {
+        RuleFields existing;
+        if(parseRule(msg, existing) && existing == fields)
+            exists = true;
+    });
+    if(err)
+    {
+        qWarning() << "Unable to list routing rules:" << err
+            << qPrintable(qt_error_string(err));
+        return false;
+    }
+    if(exists)
+        return true;
+
+    NetlinkRequest add = buildRuleRequest(RTM_NEWRULE, NLM_F_REQUEST | NLM_F_CREATE, fields);
+    err = sock.perform(add);
+    if(err && err != EEXIST)
+    {
+        qWarning() << "Unable to add routing rule for table" << rule.tableName
+            << "- priority" << rule.priority << "-" << err
+            << qPrintable(qt_error_string(err));
+        return false;
+    }
+    qInfo() << "Added routing rule for table" << rule.tableName << "- priority"
+        << rule.priority;
+    return true;
+}
+
+void LinuxRouting::removeRule(const Rule &rule)
+{
+    RuleFields fields{toNetworkAddress(rule.source), rule.fwmark,
+                      tableId(rule.tableName), rule.priority,
+                      rule.suppressPrefixLength};
+    if(fields.table == RT_TABLE_UNSPEC)
+        return;
+
+    NetlinkSocket sock{NETLINK_ROUTE};
+    // Each request deletes one matching rule; if it had been added more than
+    // once, delete all of them.  Bound the loop in case deletion somehow
+    // doesn't make progress.
+    for(int i = 0; i < 16; ++i)
+    {
+        NetlinkRequest del = buildRuleRequest(RTM_DELRULE, NLM_F_REQUEST, fields);
+        int err = sock.perform(del);
+        if(err == ENOENT)
+            return;
+        if(err)
+        {
+            qWarning() << "Unable to remove routing rule for table"
+                << rule.tableName << "- priority" << rule.priority << "-"
+                << err << qPrintable(qt_error_string(err));
+            return;
+        }
+    }
+}
+
+bool LinuxRouting::ensureDefaultRoute(const QString &gatewayIp,
+                                      const QString &interfaceName,
+                                      const QString &tableName)
+{
+    quint32 table = tableId(tableName);
+    if(table == RT_TABLE_UNSPEC)
+        return false;
+
+    in_addr gateway{};
+    if(::inet_pton(AF_INET, qPrintable(gatewayIp), &gateway) != 1)
+    {
+        qWarning() << "Invalid gateway" << gatewayIp << "for table" << tableName;
+        return false;
+    }
+    unsigned interfaceIndex = ::if_nametoindex(qPrintable(interfaceName));
+    if(!interfaceIndex)
+    {
+        qWarning() << "Unknown interface" << interfaceName << "for table" << tableName;
+        return false;
+    }
+
+    NetlinkSocket sock{NETLINK_ROUTE};
+
+    // Check for the route first
+    bool present{false};
+    rtmsg dumpHeader{};
+    dumpHeader.rtm_family = AF_INET;
+    NetlinkRequest dump{RTM_GETROUTE, NLM_F_REQUEST | NLM_F_DUMP, dumpHeader};
+    int err = sock.perform(dump, [&](const nlmsghdr &msg)
+    {
+        auto pRoute = reinterpret_cast<const rtmsg*>(NLMSG_DATA(&msg));
+        if(msg.nlmsg_type != RTM_NEWROUTE || pRoute->rtm_dst_len != 0 ||
+           routeTable(msg) != table)
+        {
+            return;
+        }
+        in_addr routeGateway{};
+        unsigned routeInterface{0};
+        int attrLen = static_cast<int>(RTM_PAYLOAD(&msg));
+        for(auto pAttr = RTM_RTA(pRoute); RTA_OK(pAttr, attrLen);
+            pAttr = RTA_NEXT(pAttr, attrLen))
+        {
+            if(pAttr->rta_type == RTA_GATEWAY)
+                std::memcpy(&routeGateway, RTA_DATA(pAttr), sizeof(routeGateway));
+            else if(pAttr->rta_type == RTA_OIF)
+                std::memcpy(&routeInterface, RTA_DATA(pAttr), sizeof(routeInterface));
+        }
+        if(routeGateway.s_addr == gateway.s_addr && routeInterface == interfaceIndex)
+            present = true;
+    });
+    if(err)
+    {
+        qWarning() << "Unable to list routes in table" << tableName << "-"
+            << err << qPrintable(qt_error_string(err));
+    }
+    else if(present)
+        return false;
+
+    rtmsg header{};
+    header.rtm_family = AF_INET;
+    header.rtm_table = static_cast<unsigned char>(table < 256 ? table : RT_TABLE_UNSPEC);
+    header.rtm_protocol = RTPROT_BOOT;
+    header.rtm_scope = RT_SCOPE_UNIVERSE;
+    header.rtm_type = RTN_UNICAST;
+
+    NetlinkRequest request{RTM_NEWROUTE, NLM_F_REQUEST | NLM_F_CREATE | NLM_F_REPLACE, header};
+    request.addU32(RTA_TABLE, table);
+    request.addAttr(RTA_GATEWAY, &gateway, sizeof(gateway));
+    request.addU32(RTA_OIF, interfaceIndex);
+
+    err = sock.perform(request);
+    if(err)
+    {
+        qWarning() << "Unable to set default route via" << gatewayIp << "dev"
+            << interfaceName << "in table" << tableName << "-" << err
+            << qPrintable(qt_error_string(err));
+        return false;
+    }
+    qInfo() << "Set default route via" << gatewayIp << "dev" << interfaceName
+        << "in table" << tableName;
+    return true;
+}
+
+void LinuxRouting::flushTable(const QString &tableName)
+{
+    quint32 table = tableId(tableName);
+    if(table == RT_TABLE_UNSPEC)
+        return;
+
+    // Collect the routes in the table, then delete each one - the socket
+    // can't be used for other requests during the dump.
+    NetlinkSocket sock{NETLINK_ROUTE};
+    std::vector<std::vector<unsigned char>> routes;
+    rtmsg dumpHeader{};
+    dumpHeader.rtm_family = AF_INET;
+    NetlinkRequest dump{RTM_GETROUTE, NLM_F_REQUEST | NLM_F_DUMP, dumpHeader};
+    int err = sock.perform(dump, [&](const nlmsghdr &msg)
+    {
+        if(msg.nlmsg_type == RTM_NEWROUTE && routeTable(msg) == table)
+        {
+            auto pBegin = reinterpret_cast<const unsigned char*>(&msg);
+            routes.emplace_back(pBegin, pBegin + msg.nlmsg_len);
+        }
+    });
+    if(err)
+    {
+        qWarning() << "Unable to list routes in table" << tableName << "-"
+            << err << qPrintable(qt_error_string(err));
+        return;
+    }
+
+    for(auto &route : routes)
+    {
+        // Reuse the dumped route as the delete request; it identifies the
+        // route exactly.
+        auto pMsg = reinterpret_cast<const nlmsghdr*>(route.data());
+        auto pRoute = reinterpret_cast<const rtmsg*>(NLMSG_DATA(pMsg));
+        NetlinkRequest del{RTM_DELROUTE, NLM_F_REQUEST, *pRoute};
+        int attrLen = static_cast<int>(RTM_PAYLOAD(pMsg));
+        for(auto pAttr = RTM_RTA(pRoute); RTA_OK(pAttr, attrLen);
+            pAttr = RTA_NEXT(pAttr, attrLen))
+        {
+            del.addAttr(pAttr->rta_type, RTA_DATA(pAttr), RTA_PAYLOAD(pAttr));
+        }
+        err = sock.perform(del);
+        if(err && err != ESRCH)
+        {
+            qWarning() << "Unable to remove route from table" << tableName
+                << "-" << err << qPrintable(qt_error_string(err));
+        }
+    }
+}
+
+void LinuxRouting::flushRouteCache()
+{
+    // Equivalent to 'ip route flush cache'
+    QFile flushFile{QString::fromLatin1(kRouteFlushFile)};
+    if(!flushFile.open(QIODevice::WriteOnly) || flushFile.write("-1") < 0)
+    {
+        qWarning() << "Unable to flush route cache:"
+            << flushFile.errorString();
+    }
+}
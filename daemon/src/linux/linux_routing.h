@@ -0,0 +1,80 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("linux/linux_routing.h")
+
+#ifndef LINUX_ROUTING_H
+#define LINUX_ROUTING_H
+
+#include <QString>
+#include <QHostAddress>
+
+// LinuxRouting manages the IPv4 policy routing rules and routes used by split
+// tunnel, using rtnetlink directly instead of running 'ip rule' / 'ip route'
+// through a shell.
+//
+// Routing tables are referenced by name (the names from
+// /etc/iproute2/rt_tables that the installer registered); they're resolved to
+// table IDs here since netlink only deals with IDs.
+class LinuxRouting
+{
+    CLASS_LOGGING_CATEGORY("linux.routing")
+
+public:
+    // A policy routing rule - "[from <source>] [fwmark <fwmark>] lookup <table>
+    // [suppress_prefixlength <n>] priority <priority>".  A null source or zero
+    // fwmark isn't part of the selector.
+    struct Rule
+    {
+        QHostAddress source;
+        quint32 fwmark;
+        QString tableName;
+        quint32 priority;
+        // -1 if the rule doesn't suppress any prefix lengths
+        int suppressPrefixLength;
+    };
+
+public:
+    // Add a rule if an identical rule doesn't exist already.  Returns true if
+    // the rule exists after the call.
+    static bool ensureRule(const Rule &rule);
+    // Remove a rule (all copies of it, if it was added more than once).  Does
+    // nothing if the rule doesn't exist.
+    static void removeRule(const Rule &rule);
+
+    // Ensure that the default route in a routing table goes via gatewayIp on
+    // interfaceName, replacing any other default route.  Nothing is changed if
+    // the route is already present (it's checked in the kernel rather than
+    // remembered, because the kernel removes routes when their interface goes
+    // down).  Returns true if the route was changed.
+    static bool ensureDefaultRoute(const QString &gatewayIp,
+                                   const QString &interfaceName,
+                                   const QString &tableName);
+    // Remove all IPv4 routes from a routing table.
+    static void flushTable(const QString &tableName);
+    // Flush the kernel's cached routing decisions after changing routes.
+    static void flushRouteCache();
+
+private:
+    // Find the ID of a routing table by its name.  Returns 0 (RT_TABLE_UNSPEC)
+    // if it's not known.
+    static quint32 tableId(const QString &tableName);
+};
+
+#endif
@@ -0,0 +1,221 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("linux/linux_splicerelay.cpp")
+
+#include "linux_splicerelay.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <utility>
+
+namespace
+{
+    // Maximum bytes moved into a pipe by one splice() call
+    const std::size_t SpliceChunkSize{64 * 1024};
+    // Maximum number of chunks relayed in one direction before returning to
+    // the event loop, so one busy connection can't starve the others
+    const int MaxChunksPerPump{16};
+
+    void closeFd(int &fd)
+    {
+        if(fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+}
+
+LinuxSpliceRelay::LinuxSpliceRelay(int firstFd, int secondFd, QObject *pParent)
+    : QObject{pParent}, _open{false}, _firstFd{firstFd}, _secondFd{secondFd},
+      _directions{}, _halfClosed{false}, _bytesRelayed{0}
+{
+    for(auto &direction : _directions)
+        direction.pipeRead = direction.pipeWrite = -1;
+
+    initDirection(_directions[0], _firstFd, _secondFd);
+    initDirection(_directions[1], _secondFd, _firstFd);
+    _open = _directions[0].pipeRead >= 0 && _directions[1].pipeRead >= 0;
+}
+
+LinuxSpliceRelay::~LinuxSpliceRelay()
+{
+    close();
+}
+
+void LinuxSpliceRelay::initDirection(Direction &direction, int sourceFd, int destFd)
+{
+    direction.sourceFd = sourceFd;
+    direction.destFd = destFd;
+    direction.pending = 0;
+    direction.sourceEof = false;
+    direction.destShutdown = false;
+
+    int pipeFds[2];
+    if(::pipe2(pipeFds, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        qWarning() << "Unable to create relay pipe:" << errno
+            << qPrintable(qt_error_string(errno));
+        return;
+    }
+    direction.pipeRead = pipeFds[0];
+    direction.pipeWrite = pipeFds[1];
+}
+
+void LinuxSpliceRelay::start()
+{
+    Q_ASSERT(_open);    // Checked by caller
+
+    for(auto &direction : _directions)
+    {
+        direction.pSourceReadable = new QSocketNotifier{direction.sourceFd,
+                                                        QSocketNotifier::Read,
+                                                        this};
+        direction.pDestWritable = new QSocketNotifier{direction.destFd,
+                                                      QSocketNotifier::Write,
+                                                      this};
+        // Only watch for writability when the destination is full
+        direction.pDestWritable->setEnabled(false);
+        Direction *pDirection = &direction;
+        connect(direction.pSourceReadable, &QSocketNotifier::activated, this,
+                [this, pDirection](){pump(*pDirection);});
+        connect(direction.pDestWritable, &QSocketNotifier::activated, this,
+                [this, pDirection](){pump(*pDirection);});
+    }
+}
+
+void LinuxSpliceRelay::close()
+{
+    for(auto &direction : _directions)
+    {
+        // The notifiers may be signaling right now; disable them (which stops
+        // watching the descriptors) and destroy them later.
+        for(auto pNotifier : {direction.pSourceReadable, direction.pDestWritable})
+        {
+            if(pNotifier)
+            {
+                pNotifier->setEnabled(false);
+                pNotifier->deleteLater();
+            }
+        }
+        direction.pSourceReadable.clear();
+        direction.pDestWritable.clear();
+        closeFd(direction.pipeRead);
+        closeFd(direction.pipeWrite);
+    }
+    closeFd(_firstFd);
+    closeFd(_secondFd);
+    _open = false;
+}
+
+void LinuxSpliceRelay::pump(Direction &direction)
+{
+    for(int chunk = 0; chunk < MaxChunksPerPump; ++chunk)
+    {
+        // Write out everything in the pipe before reading more
+        while(direction.pending > 0)
+        {
+            ssize_t moved = ::splice(direction.pipeRead, nullptr,
+                                     direction.destFd, nullptr,
+                                     direction.pending,
+                                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(moved > 0)
+            {
+                direction.pending -= static_cast<std::size_t>(moved);
+                _bytesRelayed += static_cast<quint64>(moved);
+            }
+            else if(moved < 0 && errno == EINTR)
+                continue;
+            else if(moved < 0 && errno == EAGAIN)
+            {
+                // The destination is full; stop reading until it drains
+                direction.pSourceReadable->setEnabled(false);
+                direction.pDestWritable->setEnabled(true);
+                return;
+            }
+            else
+            {
+                fail("write");
+                return;
+            }
+        }
+        direction.pDestWritable->setEnabled(false);
+
+        if(direction.sourceEof)
+        {
+            if(!direction.destShutdown)
+            {
+                direction.destShutdown = true;
+                ::shutdown(direction.destFd, SHUT_WR);
+            }
+            if(_directions[0].destShutdown && _directions[1].destShutdown)
+                emit finished();
+            else if(!std::exchange(_halfClosed, true))
+                emit halfClosed();
+            return;
+        }
+
+        ssize_t received = ::splice(direction.sourceFd, nullptr,
+                                    direction.pipeWrite, nullptr,
+                                    SpliceChunkSize,
+                                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(received > 0)
+            direction.pending += static_cast<std::size_t>(received);
+        else if(received == 0)
+        {
+            direction.sourceEof = true;
+            direction.pSourceReadable->setEnabled(false);
+        }
+        else if(errno == EINTR)
+            continue;
+        else if(errno == EAGAIN)
+        {
+            // Nothing more to read right now
+            direction.pSourceReadable->setEnabled(true);
+            return;
+        }
+        else
+        {
+            fail("read");
+            return;
+        }
+    }
+
+    // Yield to the event loop; the source is still readable (or the pipe
+    // still has data) so the notifier will activate again.
+    direction.pSourceReadable->setEnabled(direction.pending == 0 && !direction.sourceEof);
+    direction.pDestWritable->setEnabled(direction.pending > 0);
+}
+
+void LinuxSpliceRelay::fail(const char *operation)
+{
+    int error = errno;
+    qInfo() << "Relay" << operation << "failed:" << error
+        << qPrintable(qt_error_string(error));
+    for(auto &direction : _directions)
+    {
+        if(direction.pSourceReadable)
+            direction.pSourceReadable->setEnabled(false);
+        if(direction.pDestWritable)
+            direction.pDestWritable->setEnabled(false);
+    }
+    emit failed();
+}
@@ -0,0 +1,106 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("linux/linux_splicerelay.h")
+
+#ifndef LINUX_SPLICERELAY_H
+#define LINUX_SPLICERELAY_H
+
+#include <QObject>
+#include <QPointer>
+#include <QSocketNotifier>
+#include <array>
+#include <cstddef>
+
+// LinuxSpliceRelay relays data in both directions between two connected TCP
+// sockets with splice().  Data are moved through a pipe in the kernel for each
+// direction, so they're never copied into user space.
+//
+// SocksConnection hands its sockets over to LinuxSpliceRelay once the SOCKS
+// negotiation is complete.  The relay takes ownership of the descriptors it's
+// given; they're closed when the relay is closed or destroyed.
+//
+// Flow control is implicit - a direction doesn't read more from its source
+// until the data in its pipe have been written to the destination.
+class LinuxSpliceRelay : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("socksserver");
+
+public:
+    // The sockets must be connected and non-blocking.
+    LinuxSpliceRelay(int firstFd, int secondFd, QObject *pParent);
+    ~LinuxSpliceRelay();
+
+public:
+    // Whether the pipes were created.  If this is false, the relay can't be
+    // used (but it still owns the descriptors).
+    bool isOpen() const {return _open;}
+
+    // Total bytes relayed in both directions
+    quint64 bytesRelayed() const {return _bytesRelayed;}
+
+    // Begin relaying data.
+    void start();
+
+    // Stop relaying and close all descriptors.  No signals are emitted after
+    // this.
+    void close();
+
+signals:
+    // One side closed its connection; the other side has been shut down for
+    // writing after all data were relayed to it.
+    void halfClosed();
+    // Both sides have closed their connections and all data were relayed.
+    void finished();
+    // A socket error occurred; the relay can't continue.
+    void failed();
+
+private:
+    struct Direction
+    {
+        int sourceFd;
+        int destFd;
+        int pipeRead;
+        int pipeWrite;
+        // Bytes in the pipe that haven't been written to destFd yet
+        std::size_t pending;
+        // Whether the source has reached EOF
+        bool sourceEof;
+        // Whether destFd has been shut down for writing
+        bool destShutdown;
+        QPointer<QSocketNotifier> pSourceReadable;
+        QPointer<QSocketNotifier> pDestWritable;
+    };
+
+private:
+    void initDirection(Direction &direction, int sourceFd, int destFd);
+    // Relay as much data as possible in one direction without blocking
+    void pump(Direction &direction);
+    void fail(const char *operation);
+
+private:
+    bool _open;
+    int _firstFd, _secondFd;
+    std::array<Direction, 2> _directions;
+    bool _halfClosed;
+    quint64 _bytesRelayed;
+};
+
+#endif
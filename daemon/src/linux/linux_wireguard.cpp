@@ -0,0 +1,280 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("linux/linux_wireguard.cpp")
+
+#include "linux_wireguard.h"
+#include "linux_netlink.h"
+#include <linux/genetlink.h>
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <linux/wireguard.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <cerrno>
+#include <cstring>
+
+namespace
+{
+    // Get an interface's index, or 0 if it doesn't exist
+    int interfaceIndex(const QString &name)
+    {
+        return static_cast<int>(::if_nametoindex(name.toLocal8Bit().constData()));
+    }
+
+    // Build a WireGuard generic netlink request
+    NetlinkRequest buildWireguardRequest(quint16 familyId, quint8 command, quint16 flags)
+    {
+        genlmsghdr header{};
+        header.cmd = command;
+        header.version = WG_GENL_VERSION;
+        return {familyId, flags, header};
+    }
+}
+
+bool LinuxWireguard::isAvailable()
+{
+    NetlinkSocket sock{NETLINK_GENERIC};
+    return sock.resolveGenericFamily(WG_GENL_NAME) != 0;
+}
+
+bool LinuxWireguard::createDevice(const QString &name)
+{
+    ifinfomsg header{};
+    header.ifi_family = AF_UNSPEC;
+    NetlinkRequest request{RTM_NEWLINK, NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL, header};
+    request.addString(IFLA_IFNAME, name.toLocal8Bit());
+    auto linkInfo = request.beginNested(IFLA_LINKINFO);
+    request.addString(IFLA_INFO_KIND, QByteArrayLiteral("wireguard"));
+    request.endNested(linkInfo);
+
+    // The kernel loads the WireGuard module (if it's available) to create the
+    // link, so this also works before anything else has used WireGuard.
+    NetlinkSocket sock{NETLINK_ROUTE};
+    int err = sock.perform(request);
+    if(err)
+    {
+        qWarning() << "Unable to create WireGuard interface" << name << "-"
+            << err << qPrintable(qt_error_string(err));
+        return false;
+    }
+    qInfo() << "Created WireGuard interface" << name;
+    return true;
+}
+
+void LinuxWireguard::deleteDevice(const QString &name)
+{
+    int index = interfaceIndex(name);
+    if(!index)
+        return;
+
+    ifinfomsg header{};
+    header.ifi_family = AF_UNSPEC;
+    header.ifi_index = index;
+    NetlinkRequest request{RTM_DELLINK, NLM_F_REQUEST, header};
+    NetlinkSocket sock{NETLINK_ROUTE};
+    int err = sock.perform(request);
+    if(err && err != ENODEV)
+    {
+        qWarning() << "Unable to delete interface" << name << "-" << err
+            << qPrintable(qt_error_string(err));
+    }
+    else
+        qInfo() << "Deleted interface" << name;
+}
+
+bool LinuxWireguard::configureDevice(const QString &name, const QByteArray &privateKey,
+                                     quint32 fwmark, const Peer &peer)
+{
+    if(privateKey.size() != WG_KEY_LEN || peer.publicKey.size() != WG_KEY_LEN ||
+       peer.endpointIp.protocol() != QAbstractSocket::IPv4Protocol)
+    {
+        qWarning() << "Invalid WireGuard configuration for" << name;
+        return false;
+    }
+
+    NetlinkSocket sock{NETLINK_GENERIC};
+    quint16 familyId = sock.resolveGenericFamily(WG_GENL_NAME);
+    if(!familyId)
+    {
+        qWarning() << "WireGuard is not available, can't configure" << name;
+        return false;
+    }
+
+    NetlinkRequest request = buildWireguardRequest(familyId, WG_CMD_SET_DEVICE, NLM_F_REQUEST);
+    request.addString(WGDEVICE_A_IFNAME, name.toLocal8Bit());
+    request.addAttr(WGDEVICE_A_PRIVATE_KEY, privateKey.constData(), WG_KEY_LEN);
+    request.addU32(WGDEVICE_A_FWMARK, fwmark);
+    request.addU32(WGDEVICE_A_FLAGS, WGDEVICE_F_REPLACE_PEERS);
+
+    auto peers = request.beginNested(WGDEVICE_A_PEERS);
+    auto peerAttrs = request.beginNested(0);
+    request.addAttr(WGPEER_A_PUBLIC_KEY, peer.publicKey.constData(), WG_KEY_LEN);
+    request.addU32(WGPEER_A_FLAGS, WGPEER_F_REPLACE_ALLOWEDIPS);
+    sockaddr_in endpoint{};
+    endpoint.sin_family = AF_INET;
+    endpoint.sin_port = htons(peer.endpointPort);
+    endpoint.sin_addr.s_addr = htonl(peer.endpointIp.toIPv4Address());
+    request.addAttr(WGPEER_A_ENDPOINT, &endpoint, sizeof(endpoint));
+    request.addU16(WGPEER_A_PERSISTENT_KEEPALIVE_INTERVAL, peer.keepaliveInterval);
+
+    auto allowedIps = request.beginNested(WGPEER_A_ALLOWEDIPS);
+    for(const auto &allowedIp : peer.allowedIps)
+    {
+        if(allowedIp.first.protocol() != QAbstractSocket::IPv4Protocol)
+            continue;
+        auto allowedIpAttrs = request.beginNested(0);
+        request.addU16(WGALLOWEDIP_A_FAMILY, AF_INET);
+        in_addr address{htonl(allowedIp.first.toIPv4Address())};
+        request.addAttr(WGALLOWEDIP_A_IPADDR, &address, sizeof(address));
+        quint8 prefixLength = static_cast<quint8>(allowedIp.second);
+        request.addAttr(WGALLOWEDIP_A_CIDR_MASK, &prefixLength, sizeof(prefixLength));
+        request.endNested(allowedIpAttrs);
+    }
+    request.endNested(allowedIps);
+    request.endNested(peerAttrs);
+    request.endNested(peers);
+
+    int err = sock.perform(request);
+    if(err)
+    {
+        qWarning() << "Unable to configure WireGuard interface" << name << "-"
+            << err << qPrintable(qt_error_string(err));
+        return false;
+    }
+    qInfo() << "Configured WireGuard interface" << name << "with peer"
+        << peer.endpointIp.toString() << peer.endpointPort;
+    return true;
+}
+
+bool LinuxWireguard::setAddress(const QString &name, const QHostAddress &address,
+                                int prefixLength)
+{
+    int index = interfaceIndex(name);
+    if(!index || address.protocol() != QAbstractSocket::IPv4Protocol)
+        return false;
+
+    ifaddrmsg header{};
+    header.ifa_family = AF_INET;
+    header.ifa_prefixlen = static_cast<quint8>(prefixLength);
+    header.ifa_index = static_cast<quint32>(index);
+    NetlinkRequest request{RTM_NEWADDR, NLM_F_REQUEST | NLM_F_CREATE | NLM_F_REPLACE, header};
+    in_addr addr{htonl(address.toIPv4Address())};
+    request.addAttr(IFA_LOCAL, &addr, sizeof(addr));
+    request.addAttr(IFA_ADDRESS, &addr, sizeof(addr));
+
+    NetlinkSocket sock{NETLINK_ROUTE};
+    int err = sock.perform(request);
+    if(err)
+    {
+        qWarning() << "Unable to set address of" << name << "to"
+            << address.toString() << "-" << err << qPrintable(qt_error_string(err));
+        return false;
+    }
+    return true;
+}
+
+bool LinuxWireguard::setUp(const QString &name, unsigned mtu)
+{
+    int index = interfaceIndex(name);
+    if(!index)
+        return false;
+
+    ifinfomsg header{};
+    header.ifi_family = AF_UNSPEC;
+    header.ifi_index = index;
+    header.ifi_flags = IFF_UP;
+    header.ifi_change = IFF_UP;
+    NetlinkRequest request{RTM_NEWLINK, NLM_F_REQUEST, header};
+    request.addU32(IFLA_MTU, mtu);
+
+    NetlinkSocket sock{NETLINK_ROUTE};
+    int err = sock.perform(request);
+    if(err)
+    {
+        qWarning() << "Unable to bring up" << name << "with MTU" << mtu << "-"
+            << err << qPrintable(qt_error_string(err));
+        return false;
+    }
+    return true;
+}
+
+bool LinuxWireguard::readStatistics(const QString &name, Statistics &statistics)
+{
+    NetlinkSocket sock{NETLINK_GENERIC};
+    quint16 familyId = sock.resolveGenericFamily(WG_GENL_NAME);
+    if(!familyId)
+        return false;
+
+    NetlinkRequest request = buildWireguardRequest(familyId, WG_CMD_GET_DEVICE,
+                                                   NLM_F_REQUEST | NLM_F_DUMP);
+    request.addString(WGDEVICE_A_IFNAME, name.toLocal8Bit());
+
+    bool foundPeer{false};
+    statistics = {0, 0, 0};
+    auto parsePeer = [&](quint16 type, const void *pData, int len)
+    {
+        switch(type)
+        {
+            case WGPEER_A_RX_BYTES:
+                if(len >= static_cast<int>(sizeof(quint64)))
+                    std::memcpy(&statistics.received, pData, sizeof(quint64));
+                break;
+            case WGPEER_A_TX_BYTES:
+                if(len >= static_cast<int>(sizeof(quint64)))
+                    std::memcpy(&statistics.sent, pData, sizeof(quint64));
+                break;
+            case WGPEER_A_LAST_HANDSHAKE_TIME:
+            {
+                // struct __kernel_timespec - starts with the 64-bit seconds
+                qint64 seconds{0};
+                if(len >= static_cast<int>(sizeof(seconds)))
+                    std::memcpy(&seconds, pData, sizeof(seconds));
+                statistics.lastHandshake = seconds;
+                break;
+            }
+            default:
+                break;
+        }
+    };
+    int err = sock.perform(request, [&](const nlmsghdr &msg)
+    {
+        forEachNetlinkAttr(reinterpret_cast<const char*>(NLMSG_DATA(&msg)) + GENL_HDRLEN,
+                           static_cast<int>(msg.nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN)),
+                           [&](quint16 type, const void *pData, int len)
+                           {
+                               if(type != WGDEVICE_A_PEERS)
+                                   return;
+                               // Each peer is nested in the peers list
+                               forEachNetlinkAttr(pData, len, [&](quint16, const void *pPeer, int peerLen)
+                               {
+                                   foundPeer = true;
+                                   forEachNetlinkAttr(pPeer, peerLen, parsePeer);
+                               });
+                           });
+    });
+    if(err)
+    {
+        qWarning() << "Unable to read WireGuard interface" << name << "-" << err
+            << qPrintable(qt_error_string(err));
+        return false;
+    }
+    return foundPeer;
+}
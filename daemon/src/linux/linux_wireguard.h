@@ -0,0 +1,93 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("linux/linux_wireguard.h")
+
+#ifndef LINUX_WIREGUARD_H
+#define LINUX_WIREGUARD_H
+
+#include <QByteArray>
+#include <QHostAddress>
+#include <QString>
+#include <QVector>
+#include <QPair>
+
+// LinuxWireguard manages kernel WireGuard interfaces - creating the
+// interface, configuring its key and peer, and reading its statistics - using
+// rtnetlink and the WireGuard generic netlink family directly (like the 'ip'
+// and 'wg' tools do).
+//
+// This is the Linux device layer for a WireGuard VPN method.  Keys are the raw
+// 32-byte values (see genCurve25519KeyPair()).  Only IPv4 is supported, like
+// the rest of the daemon's tunnel configuration.
+class LinuxWireguard
+{
+    CLASS_LOGGING_CATEGORY("linux.wireguard")
+
+public:
+    // The single peer of a PIA WireGuard interface - the VPN server
+    struct Peer
+    {
+        QByteArray publicKey;
+        QHostAddress endpointIp;
+        quint16 endpointPort;
+        // Subnets routed to the peer, as (address, prefix length)
+        QVector<QPair<QHostAddress, int>> allowedIps;
+        // Persistent keepalive interval in seconds, 0 to disable
+        quint16 keepaliveInterval;
+    };
+
+    // Traffic and handshake status of an interface's peer
+    struct Statistics
+    {
+        quint64 received;
+        quint64 sent;
+        // Time of the last handshake (seconds since the epoch), 0 if there
+        // hasn't been one yet
+        qint64 lastHandshake;
+    };
+
+public:
+    // Whether kernel WireGuard is available - the WireGuard netlink family is
+    // registered once the module is loaded (createDevice() loads it if
+    // possible).
+    static bool isAvailable();
+
+    // Create a WireGuard interface.  Returns false if it couldn't be created
+    // (the kernel doesn't support WireGuard, or the name is in use).
+    static bool createDevice(const QString &name);
+    // Delete an interface (of any type).  Does nothing if it doesn't exist.
+    static void deleteDevice(const QString &name);
+
+    // Set the interface's private key, firewall mark for its encrypted
+    // packets (0 for none), and its peer, replacing any existing peers.
+    static bool configureDevice(const QString &name, const QByteArray &privateKey,
+                                quint32 fwmark, const Peer &peer);
+    // Assign the interface's local tunnel address.
+    static bool setAddress(const QString &name, const QHostAddress &address,
+                           int prefixLength);
+    // Set the interface's MTU and bring it up.
+    static bool setUp(const QString &name, unsigned mtu);
+
+    // Read the statistics of the interface's peer.  Returns false if the
+    // interface doesn't exist or has no peer.
+    static bool readStatistics(const QString &name, Statistics &statistics);
+};
+
+#endif
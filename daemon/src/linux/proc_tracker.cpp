@@ -34,6 +34,7 @@
 #include "daemon.h"
 #include "path.h"
 #include "posix/posix_firewall_iptables.h"
+#include "linux/linux_routing.h"
 #include "proc_tracker.h"
 
 namespace
@@ -41,6 +42,18 @@ namespace
     RegisterMetaType<QVector<QString>> qStringVector;
     RegisterMetaType<OriginalNetworkScan> qNetScan;
     RegisterMetaType<FirewallParams> qFirewallParams;
+
+    // Maximum number of process events handled each time the netlink socket
+    // becomes readable; limits how long a constant stream of events can block
+    // the event loop.
+    const int MaxEventsPerRead = 256;
+
+    // Routing rule sending packets from the given source address to a split
+    // tunnel routing table (priority 101, just after the fwmark rules)
+    LinuxRouting::Rule sourceIpRule(const QString &ipAddress, const QString &routingTableName)
+    {
+        return {QHostAddress{ipAddress}, 0, routingTableName, 101, -1};
+    }
 }
 
 QSet<pid_t> ProcFs::filterPids(const std::function<bool(pid_t)> &filterFunc)
@@ -94,6 +107,82 @@ bool ProcFs::isChildOf(pid_t parentPid, pid_t pid)
     return false;
 }
 
+ProcessSnapshot::ProcessSnapshot()
+    : _parentsRead{false}, _pathsRead{false}
+{
+}
+
+void ProcessSnapshot::readParents() const
+{
+    if(_parentsRead)
+        return;
+    _parentsRead = true;
+
+    QDir procDir{"/proc"};
+    procDir.setFilter(QDir::Dirs);
+    procDir.setNameFilters({"[1-9]*"});
+
+    for(const auto &entry : procDir.entryList())
+    {
+        pid_t pid = entry.toInt();
+
+        // The parent PID is the 4th field of /proc/<pid>/stat.  The 2nd field
+        // is the command name in parentheses, which could contain spaces or
+        // parentheses, so parse from the last ')'.
+        QFile statFile{QStringLiteral("/proc/%1/stat").arg(pid)};
+        if(!statFile.open(QIODevice::ReadOnly))
+            continue;   // Process has exited
+        QByteArray stat = statFile.readAll();
+        int commEnd = stat.lastIndexOf(')');
+        if(commEnd < 0)
+            continue;
+        // Fields after the command are " <state> <ppid> ..."
+        QList<QByteArray> fields = stat.mid(commEnd + 1).simplified().split(' ');
+        if(fields.size() < 2)
+            continue;
+        pid_t parentPid = fields[1].toInt();
+
+        _parentPids.insert(pid, parentPid);
+        _childPids[parentPid].push_back(pid);
+    }
+}
+
+void ProcessSnapshot::readPaths() const
+{
+    if(_pathsRead)
+        return;
+    _pathsRead = true;
+    readParents();
+
+    for(auto itProcess = _parentPids.begin(); itProcess != _parentPids.end(); ++itProcess)
+    {
+        QString path = ProcFs::pathForPid(itProcess.key());
+        // Empty for kernel threads, or if the process has exited
+        if(!path.isEmpty())
+            _pathPids[path].insert(itProcess.key());
+    }
+}
+
+QSet<pid_t> ProcessSnapshot::pidsForPath(const QString &path) const
+{
+    readPaths();
+    return _pathPids.value(path);
+}
+
+QVector<pid_t> ProcessSnapshot::descendantsOf(pid_t parentPid) const
+{
+    readParents();
+    QVector<pid_t> descendants = _childPids.value(parentPid);
+    // Walk the tree breadth-first; descendants grows as children are found.
+    for(int i = 0; i < descendants.size(); ++i)
+    {
+        auto itChildren = _childPids.find(descendants[i]);
+        if(itChildren != _childPids.end())
+            descendants += itChildren.value();
+    }
+    return descendants;
+}
+
 // Explicitly specify struct alignment
 typedef struct __attribute__((aligned(NLMSG_ALIGNTO)))
 {
@@ -125,49 +214,88 @@ void ProcTracker::showError(QString funcName)
 
 void ProcTracker::writePidToCGroup(pid_t pid, const QString &cGroupPath)
 {
-    QFile cGroupFile{cGroupPath};
-
-    if(!cGroupFile.open(QFile::WriteOnly))
+    // Keep the cgroup files open, they're written very frequently when a lot
+    // of processes are being launched
+    auto itFd = _cGroupFds.find(cGroupPath);
+    if(itFd == _cGroupFds.end())
     {
-        qWarning() << "Cannot open" << cGroupPath << "for writing!" << cGroupFile.errorString();
-        return;
+        int fd = ::open(QFile::encodeName(cGroupPath).constData(), O_WRONLY|O_CLOEXEC);
+        if(fd == -1)
+        {
+            qWarning() << "Cannot open" << cGroupPath << "for writing!" << errno
+                << qPrintable(qt_error_string(errno));
+            return;
+        }
+        itFd = _cGroupFds.insert(cGroupPath, fd);
     }
 
-    if(cGroupFile.write(QByteArray::number(pid)) < 0)
-        qWarning() << "Could not write to" << cGroupPath << cGroupFile.errorString();
+    // cgroup.procs only accepts one PID per write
+    QByteArray pidText = QByteArray::number(pid);
+    if(::write(itFd.value(), pidText.constData(), static_cast<size_t>(pidText.size())) == -1)
+    {
+        // ESRCH just means the process already exited.  For anything else,
+        // reopen the file next time in case the cgroup was recreated.
+        if(errno != ESRCH)
+        {
+            qWarning() << "Could not write to" << cGroupPath << errno
+                << qPrintable(qt_error_string(errno));
+            ::close(itFd.value());
+            _cGroupFds.erase(itFd);
+        }
+    }
 }
 
-void ProcTracker::addPidToCgroup(pid_t pid, const Path &cGroupPath)
+void ProcTracker::queuePidForCGroup(pid_t pid, const QString &cGroupPath)
 {
-    writePidToCGroup(pid, cGroupPath);
-    // Add child processes (NOTE: we also recurse through child processes of child processes)
-    addChildPidsToCgroup(pid, cGroupPath);
+    _pendingCGroupWrites[cGroupPath].push_back(pid);
 }
 
-void ProcTracker::addChildPidsToCgroup(pid_t parentPid, const Path &cGroupPath)
+void ProcTracker::flushCGroupWrites()
 {
-    for(pid_t pid : ProcFs::childPidsOf(parentPid))
+    for(auto itPending = _pendingCGroupWrites.begin(); itPending != _pendingCGroupWrites.end(); ++itPending)
     {
-        qInfo() << "Adding child pid" << pid;
-        addPidToCgroup(pid, cGroupPath);
+        for(pid_t pid : itPending.value())
+            writePidToCGroup(pid, itPending.key());
     }
+    _pendingCGroupWrites.clear();
+}
+
+void ProcTracker::closeCGroupFiles()
+{
+    for(int fd : _cGroupFds)
+        ::close(fd);
+    _cGroupFds.clear();
 }
 
-void ProcTracker::removeChildPidsFromCgroup(pid_t parentPid, const Path &cGroupPath)
+void ProcTracker::addPidToCgroup(pid_t pid, const QString &app, const QString &cGroupPath,
+                                 const ProcessSnapshot &snapshot)
 {
-    for(pid_t pid : ProcFs::childPidsOf(parentPid))
+    _trackedPids.insert(pid, {app, cGroupPath, LinuxCGroups::procsFileForPid(pid)});
+    writePidToCGroup(pid, cGroupPath);
+    // Add child processes (NOTE: we also recurse through child processes of child processes)
+    for(pid_t childPid : snapshot.descendantsOf(pid))
     {
-        qInfo() << "Removing child pid" << pid << cGroupPath;
-        removePidFromCgroup(pid, cGroupPath);
+        qInfo() << "Adding child pid" << childPid;
+        _trackedPids.insert(childPid, {app, cGroupPath, LinuxCGroups::procsFileForPid(childPid)});
+        writePidToCGroup(childPid, cGroupPath);
     }
 }
 
-void ProcTracker::removePidFromCgroup(pid_t pid, const Path &cGroupPath)
+void ProcTracker::untrackApp(const QString &app, const QString &cGroupPath)
 {
-    // We remove a PID from a cgroup by adding it to its parent cgroup
-    writePidToCGroup(pid, cGroupPath);
-    // Remove child processes (NOTE: we also recurse through child processes of child processes)
-    removeChildPidsFromCgroup(pid, cGroupPath);
+    for(auto itPid = _trackedPids.begin(); itPid != _trackedPids.end(); )
+    {
+        if(itPid->app == app && itPid->cGroupPath == cGroupPath)
+        {
+            // We remove a PID from a cgroup by adding it to its original
+            // cgroup if it's known, otherwise to the parent cgroup
+            writePidToCGroup(itPid.key(), itPid->originalCGroupPath.isEmpty() ?
+                _parentCGroupFile : itPid->originalCGroupPath);
+            itPid = _trackedPids.erase(itPid);
+        }
+        else
+            ++itPid;
+    }
 }
 
 void ProcTracker::updateMasquerade(QString interfaceName)
@@ -212,6 +340,8 @@ void ProcTracker::updateRoutes(QString gatewayIp, QString interfaceName, QString
         << "tunnel interface"
         << tunnelDeviceName;
 
+    bool routesChanged{false};
+
     // The bypass route can be left as-is if the configuration is not known,
     // even though the route may be out of date - we don't put any processes in
     // this cgroup when not connected.
@@ -222,9 +352,8 @@ void ProcTracker::updateRoutes(QString gatewayIp, QString interfaceName, QString
     }
     else
     {
-        auto cmd = QStringLiteral("ip route replace default via %1 dev %2 table %3").arg(gatewayIp, interfaceName, routingTableName);
-        qInfo() << "Executing:" << cmd;
-        ::shellExecute(cmd);
+        if(LinuxRouting::ensureDefaultRoute(gatewayIp, interfaceName, routingTableName))
+            routesChanged = true;
     }
 
     // The VPN-only route can be left as-is if we're not connected, VPN-only
@@ -236,12 +365,14 @@ void ProcTracker::updateRoutes(QString gatewayIp, QString interfaceName, QString
     }
     else
     {
-        auto cmd = QStringLiteral("ip route replace default via %1 dev %2 table %3").arg(tunnelDeviceRemoteAddress, tunnelDeviceName, vpnOnlyRoutingTableName);
-        qInfo() << "Executing:" << cmd;
-        ::shellExecute(cmd);
+        if(LinuxRouting::ensureDefaultRoute(tunnelDeviceRemoteAddress, tunnelDeviceName, vpnOnlyRoutingTableName))
+            routesChanged = true;
     }
 
-    ::shellExecute(QStringLiteral("ip route flush cache"));
+    // Only flush cached routing decisions if a route actually changed; when
+    // reconnecting to the same network, nothing needs to be done.
+    if(routesChanged)
+        LinuxRouting::flushRouteCache();
 }
 
 void ProcTracker::updateNetwork(const FirewallParams &params, QString tunnelDeviceName,
@@ -270,7 +401,10 @@ void ProcTracker::updateNetwork(const FirewallParams &params, QString tunnelDevi
         addRoutingPolicyForSourceIp(tunnelDeviceLocalAddress, IpTablesFirewall::kVpnOnlyRtableName);
     }
 
-    // always update the routes - as we use 'route replace' so we don't have to worry about adding the same route multiple times
+    // Always check the routes - they're only changed if they're missing or
+    // out of date.  (The kernel removes them if their interface goes down, so
+    // the routes can't be assumed to still exist when the settings haven't
+    // changed.)
     updateRoutes(params.splitTunnelNetScan.gatewayIp(), params.splitTunnelNetScan.interfaceName(), tunnelDeviceName, tunnelDeviceRemoteAddress);
 
     // If we just got a valid network scan (we're connecting) or we lost it
@@ -370,56 +504,90 @@ void ProcTracker::teardownReversePathFiltering()
 
 void ProcTracker::updateApps(QVector<QString> excludedApps, QVector<QString> vpnOnlyApps)
 {
-    qInfo() << "Inside updateApps." << "excludedApps:" << excludedApps << "vpnOnlyApps:" << vpnOnlyApps;
     // If we're not tracking excluded apps, remove everything
     if(!_previousNetScan.isValid())
         excludedApps = {};
-    // Update excluded apps
-    removeApps(excludedApps, _exclusionsMap);
-    addApps(excludedApps, _exclusionsMap, Path::VpnExclusionsFile);
 
-    // Update vpnOnly
-    removeApps(vpnOnlyApps, _vpnOnlyMap);
-    addApps(vpnOnlyApps, _vpnOnlyMap, Path::VpnOnlyFile);
+    // Apps that are already tracked keep their PIDs - processes launched or
+    // forked since they were added are tracked from proc events, so only apps
+    // that are new need to be found in /proc.  This keeps small changes to a
+    // large rule list cheap.
+    QSet<QString> excludedSet{QSet<QString>::fromList(excludedApps.toList())};
+    QSet<QString> vpnOnlySet{QSet<QString>::fromList(vpnOnlyApps.toList())};
+
+    removeApps(excludedSet, _exclusionsMap, _exclusionsCGroupFile);
+    removeApps(vpnOnlySet, _vpnOnlyMap, _vpnOnlyCGroupFile);
+
+    QVector<QString> addedExcluded{findUntrackedApps(excludedApps, _exclusionsMap)};
+    QVector<QString> addedVpnOnly{findUntrackedApps(vpnOnlyApps, _vpnOnlyMap)};
+    qInfo() << "Updating apps - excludedApps:" << excludedApps.size()
+        << "added:" << addedExcluded << "- vpnOnlyApps:" << vpnOnlyApps.size()
+        << "added:" << addedVpnOnly;
+    if(addedExcluded.isEmpty() && addedVpnOnly.isEmpty())
+        return;
+
+    // Read /proc once for all of the new apps
+    ProcessSnapshot snapshot;
+    addApps(addedExcluded, _exclusionsMap, _exclusionsCGroupFile, snapshot);
+    addApps(addedVpnOnly, _vpnOnlyMap, _vpnOnlyCGroupFile, snapshot);
+}
+
+QVector<QString> ProcTracker::findUntrackedApps(const QVector<QString> &apps,
+                                                const AppMap &appMap) const
+{
+    QVector<QString> untracked;
+    QSet<QString> seen;
+    for(const auto &app : apps)
+    {
+        if(!appMap.contains(app) && !seen.contains(app))
+        {
+            seen.insert(app);
+            untracked.push_back(app);
+        }
+    }
+    return untracked;
 }
 
 void ProcTracker::removeAllApps()
 {
     qInfo() << "Removing all apps from cgroups";
-    removeApps({}, _exclusionsMap);
-    removeApps({}, _vpnOnlyMap);
+    removeApps({}, _exclusionsMap, _exclusionsCGroupFile);
+    removeApps({}, _vpnOnlyMap, _vpnOnlyCGroupFile);
 
     _exclusionsMap.clear();
     _vpnOnlyMap.clear();
 }
 
-void ProcTracker::addApps(const QVector<QString> &apps, AppMap &appMap, QString cGroupPath)
+void ProcTracker::addApps(const QVector<QString> &apps, AppMap &appMap, QString cGroupPath,
+                          const ProcessSnapshot &snapshot)
 {
     for(auto &app : apps)
     {
         appMap.insert(app, {});
-        for(pid_t pid : ProcFs::pidsForPath(app))
+        for(pid_t pid : snapshot.pidsForPath(app))
         {
             // Both these calls are no-ops if the PID is already excluded
-            addPidToCgroup(pid, cGroupPath);
+            addPidToCgroup(pid, app, cGroupPath, snapshot);
             appMap[app].insert(pid);
         }
     }
 }
 
-void ProcTracker::removeApps(const QVector<QString> &keepApps, AppMap &appMap)
+void ProcTracker::removeApps(const QSet<QString> &keepApps, AppMap &appMap,
+                             const QString &cGroupPath)
 {
-    for(const auto &app : appMap.keys())
+    for(auto itApp = appMap.begin(); itApp != appMap.end(); )
     {
-        if(!keepApps.contains(app))
+        if(!keepApps.contains(itApp.key()))
         {
-            for(pid_t pid : appMap[app])
-            {
-                removePidFromCgroup(pid, Path::ParentVpnExclusionsFile);
-            }
-
-            appMap.remove(app);
+            qInfo() << "Removing app" << itApp.key();
+            // This includes all descendants of the app's processes, both those
+            // found when the app was added and those forked since
+            untrackApp(itApp.key(), cGroupPath);
+            itApp = appMap.erase(itApp);
         }
+        else
+            ++itApp;
     }
 }
 
@@ -467,15 +635,13 @@ void ProcTracker::teardownFirewall()
 void ProcTracker::addRoutingPolicyForSourceIp(QString ipAddress, QString routingTableName)
 {
     if(!ipAddress.isEmpty())
-        ::shellExecute(QStringLiteral("ip rule add from %1 lookup %3 pri 101")
-            .arg(ipAddress, routingTableName));
+        LinuxRouting::ensureRule(sourceIpRule(ipAddress, routingTableName));
 }
 
 void ProcTracker::removeRoutingPolicyForSourceIp(QString ipAddress, QString routingTableName)
 {
     if(!ipAddress.isEmpty())
-        ::shellExecute(QStringLiteral("ip rule del from %1 lookup %3 pri 101")
-            .arg(ipAddress, routingTableName));
+        LinuxRouting::removeRule(sourceIpRule(ipAddress, routingTableName));
 }
 
 void ProcTracker::shutdownConnection()
@@ -497,6 +663,9 @@ void ProcTracker::shutdownConnection()
 
     teardownFirewall();
     removeAllApps();
+    _trackedPids.clear();
+    _pendingCGroupWrites.clear();
+    closeCGroupFiles();
     removeRoutingPolicyForSourceIp(_previousNetScan.ipAddress(), IpTablesFirewall::kRtableName);
     removeRoutingPolicyForSourceIp(_previousTunnelDeviceLocalAddress, IpTablesFirewall::kVpnOnlyRtableName);
     teardownReversePathFiltering();
@@ -520,23 +689,32 @@ void ProcTracker::updateSplitTunnel(const FirewallParams &params, QString tunnel
 
 void ProcTracker::removeTerminatedApp(pid_t pid)
 {
-    // Remove from exclusions
-    for(AppMap::iterator i = _exclusionsMap.begin(); i != _exclusionsMap.end(); ++i)
-    {
-        auto &set = i.value();
-        set.remove(pid);
-    }
+    auto itPid = _trackedPids.find(pid);
+    if(itPid == _trackedPids.end())
+        return;
 
-    // Remove from vpnOnly
-    for(AppMap::iterator i = _vpnOnlyMap.begin(); i != _vpnOnlyMap.end(); ++i)
-    {
-        auto &set = i.value();
-        set.remove(pid);
-    }
+    AppMap &appMap = itPid->cGroupPath == _vpnOnlyCGroupFile ? _vpnOnlyMap : _exclusionsMap;
+    auto itApp = appMap.find(itPid->app);
+    if(itApp != appMap.end())
+        itApp->remove(pid);
+    _trackedPids.erase(itPid);
+}
+
+void ProcTracker::addForkedProcess(pid_t parentPid, pid_t childPid)
+{
+    // The kernel puts the child in the parent's cgroup, we just have to track
+    // it so it's removed from the cgroup along with the app.
+    auto itParent = _trackedPids.find(parentPid);
+    if(itParent != _trackedPids.end())
+        _trackedPids.insert(childPid, itParent.value());
 }
 
 void ProcTracker::addLaunchedApp(pid_t pid)
 {
+    // Nothing to match if there are no apps
+    if(_exclusionsMap.isEmpty() && _vpnOnlyMap.isEmpty())
+        return;
+
     // Get the launch path associated with the PID
     QString appName = ProcFs::pathForPid(pid);
 
@@ -545,58 +723,109 @@ void ProcTracker::addLaunchedApp(pid_t pid)
     if(appName.isEmpty())
         return;
 
+    // If the process is already tracked for this app (it forked from another
+    // process of the same app), it's already in the right cgroup
+    auto itTracked = _trackedPids.find(pid);
+    if(itTracked != _trackedPids.end() && itTracked->app == appName)
+        return;
+    // Remember the cgroup it was originally in, so it can be restored when
+    // it's no longer tracked.  If it's already tracked, it's in one of our
+    // cgroups now, so keep the original recorded for it.
+    QString originalCGroup;
+    if(itTracked != _trackedPids.end())
+        originalCGroup = itTracked->originalCGroupPath;
+    else if(_exclusionsMap.contains(appName) || _vpnOnlyMap.contains(appName))
+        originalCGroup = LinuxCGroups::procsFileForPid(pid);
+
+    // Otherwise, if it's about to be tracked for a different app, drop it from
+    // the old one
+    if(itTracked != _trackedPids.end() &&
+       ((_exclusionsMap.contains(appName) && _previousNetScan.isValid()) ||
+        _vpnOnlyMap.contains(appName)))
+    {
+        removeTerminatedApp(pid);
+    }
+
+    // A process that was just exec'd normally has no children yet, and any
+    // children it forks later are tracked from fork events, so unlike
+    // addApps(), this doesn't search /proc for descendants.
     if(_exclusionsMap.contains(appName))
     {
         // Add it if we're currently tracking excluded apps.
         if(_previousNetScan.isValid())
         {
             _exclusionsMap[appName].insert(pid);
+            _trackedPids.insert(pid, {appName, _exclusionsCGroupFile,
+                                      originalCGroup});
             qInfo() << "Adding" << pid << "to VPN exclusions for app:" << appName;
 
             // Add the PID to the cgroup so its network traffic goes out the
             // physical uplink
-            addPidToCgroup(pid, Path::VpnExclusionsFile);
+            queuePidForCGroup(pid, _exclusionsCGroupFile);
         }
     }
     else if(_vpnOnlyMap.contains(appName))
     {
         _vpnOnlyMap[appName].insert(pid);
+        _trackedPids.insert(pid, {appName, _vpnOnlyCGroupFile,
+                                  originalCGroup});
         qInfo() << "Adding" << pid << "to VPN Only for app:" << appName;
 
         // Add the PID to the cgroup so its network traffic is forced out the
         // VPN
-        addPidToCgroup(pid, Path::VpnOnlyFile);
+        queuePidForCGroup(pid, _vpnOnlyCGroupFile);
     }
 }
 
 void ProcTracker::readFromSocket(int sock)
 {
-    NetlinkResponse message = {};
-
-    ::recv(sock, &message, sizeof(message), 0);
-
-    // shortcut
-    const auto &eventData = message.event.event_data;
-    pid_t pid;
-    QString appName;
-
-    switch(message.event.what)
+    // Handle all of the events that are queued up, then write the resulting
+    // cgroup changes together.  Builds and similar workloads generate large
+    // bursts of events.
+    for(int i = 0; i < MaxEventsPerRead; ++i)
     {
-    case proc_event::PROC_EVENT_NONE:
-        qInfo() << "Listening to process events";
-        break;
-    case proc_event::PROC_EVENT_EXEC:
-        pid = eventData.exec.process_pid;
-        addLaunchedApp(pid);
+        NetlinkResponse message = {};
 
-        break;
-    case proc_event::PROC_EVENT_EXIT:
-        pid = eventData.exit.process_pid;
-        removeTerminatedApp(pid);
+        if(::recv(sock, &message, sizeof(message), MSG_DONTWAIT) == -1)
+        {
+            // ENOBUFS means the socket overflowed and some events were lost,
+            // but there are still more to read
+            if(errno == ENOBUFS)
+            {
+                qWarning() << "Process events were dropped, socket buffer overflowed";
+                continue;
+            }
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+                showError("::recv");
+            break;
+        }
+
+        // shortcut
+        const auto &eventData = message.event.event_data;
 
-        break;
-    default:
-        // We're not interested in any other events
-        break;
+        switch(message.event.what)
+        {
+        case proc_event::PROC_EVENT_NONE:
+            qInfo() << "Listening to process events";
+            break;
+        case proc_event::PROC_EVENT_FORK:
+            // Ignore new threads, only track processes
+            if(eventData.fork.child_pid == eventData.fork.child_tgid)
+                addForkedProcess(eventData.fork.parent_tgid, eventData.fork.child_pid);
+            break;
+        case proc_event::PROC_EVENT_EXEC:
+            addLaunchedApp(eventData.exec.process_pid);
+            break;
+        case proc_event::PROC_EVENT_EXIT:
+            // Ignore threads exiting
+            if(eventData.exit.process_pid == eventData.exit.process_tgid)
+                removeTerminatedApp(eventData.exit.process_pid);
+            break;
+        default:
+            // We're not interested in any other events
+            break;
+        }
     }
+
+    flushCGroupWrites();
 }
@@ -27,6 +27,7 @@
 #include <QDir>
 #include "daemon.h"
 #include "posix/posix_firewall_pf.h"
+#include "linux/linux_cgroups.h"
 #include "vpn.h"
 #include "daemon.h"
 
@@ -50,6 +51,39 @@ public:
     static bool isChildOf(pid_t parentPid, pid_t pid);
 };
 
+// Snapshot of the process tree in /proc, read in a single pass.  ProcFs scans
+// all of /proc for each query, so walking a process tree or matching several
+// apps with ProcFs would scan it many times.
+//
+// /proc is read the first time the snapshot is queried, so creating one that
+// ends up unused is free.  Executable paths are only read if pidsForPath() is
+// used.
+class ProcessSnapshot
+{
+public:
+    ProcessSnapshot();
+
+    // Return all pids for the given executable path
+    QSet<pid_t> pidsForPath(const QString &path) const;
+    // Return all descendants of parentPid (children, their children, etc.)
+    QVector<pid_t> descendantsOf(pid_t parentPid) const;
+
+private:
+    // Read the parent PIDs or executable paths for all processes if they
+    // haven't been read yet
+    void readParents() const;
+    void readPaths() const;
+
+private:
+    // Parent PID of each process, read by readParents()
+    mutable QHash<pid_t, pid_t> _parentPids;
+    // Immediate children of each process that has children
+    mutable QHash<pid_t, QVector<pid_t>> _childPids;
+    // PIDs for each executable path, read by readPaths()
+    mutable QHash<QString, QSet<pid_t>> _pathPids;
+    mutable bool _parentsRead, _pathsRead;
+};
+
 class ProcTracker : public QObject
 {
     Q_OBJECT
@@ -58,6 +92,9 @@ class ProcTracker : public QObject
 public:
     ProcTracker(QObject *pParent)
         : QObject{pParent},
+          _exclusionsCGroupFile{LinuxCGroups::exclusionsFile()},
+          _vpnOnlyCGroupFile{LinuxCGroups::vpnOnlyFile()},
+          _parentCGroupFile{LinuxCGroups::parentFile()},
           _sockFd{-1}
     {
     }
@@ -79,23 +116,48 @@ public slots:
 private:
     using AppMap = QHash<QString, QSet<pid_t>>;
 
+    // App that a tracked PID belongs to - either the PID was launched from
+    // the app's executable, or it descends from such a process.
+    struct TrackedPid
+    {
+        QString app;
+        QString cGroupPath;
+        // With cgroup v2, the cgroup.procs file of the cgroup the process was
+        // in before we moved it; see LinuxCGroups::procsFileForPid()
+        QString originalCGroupPath;
+    };
+
     void showError(QString funcName);
 
     int subscribeToProcEvents(int sock, bool enable);
-    void addPidToCgroup(pid_t pid, const Path &cGroupPath);
-    void removePidFromCgroup(pid_t pid, const Path &cGroupPath);
-    void addChildPidsToCgroup(pid_t parentPid, const Path &cGroupPath);
-    void removeChildPidsFromCgroup(pid_t parentPid, const Path &cGroupPath);
+    // Add a PID and all of its descendants to a cgroup, and track them for
+    // app.  The snapshot is shared when adding several PIDs at once, so /proc
+    // is only read once.
+    void addPidToCgroup(pid_t pid, const QString &app, const QString &cGroupPath,
+                        const ProcessSnapshot &snapshot);
     // Remove apps that are no longer in this group - removes apps and PIDs from
     // appMap that do not appear in keepApps
-    void removeApps(const QVector<QString> &keepApps, AppMap &appMap);
-    void addApps(const QVector<QString> &apps, AppMap &appMap, QString cGroupPath);
+    void removeApps(const QSet<QString> &keepApps, AppMap &appMap,
+                    const QString &cGroupPath);
+    // Find the apps that aren't in appMap yet (without duplicates)
+    QVector<QString> findUntrackedApps(const QVector<QString> &apps,
+                                       const AppMap &appMap) const;
+    void addApps(const QVector<QString> &apps, AppMap &appMap, QString cGroupPath,
+                 const ProcessSnapshot &snapshot);
     void removeAllApps();
     void writePidToCGroup(pid_t pid, const QString &cGroupPath);
+    // PIDs queued by queuePidForCGroup() are written by flushCGroupWrites(),
+    // which is done once for each burst of process events
+    void queuePidForCGroup(pid_t pid, const QString &cGroupPath);
+    void flushCGroupWrites();
+    void closeCGroupFiles();
     QSet<pid_t> pidsForPath(const QString &path);
     QString pathForPid(pid_t pid);
     void addLaunchedApp(pid_t pid);
+    void addForkedProcess(pid_t parentPid, pid_t childPid);
     void removeTerminatedApp(pid_t pid);
+    // Remove all tracked PIDs for an app from its cgroup
+    void untrackApp(const QString &app, const QString &cGroupPath);
     void updateMasquerade(QString interfaceName);
     void updateRoutes(QString gatewayIp, QString interfaceName, QString tunnelDeviceName, QString tunnelDeviceRemoteAddress);
     void updateNetwork(const FirewallParams &params, QString tunnelDeviceName,
@@ -109,11 +171,21 @@ private:
     void updateApps(QVector<QString> excludedApps, QVector<QString> vpnOnlyApps);
 
 private:
+    // The cgroup.procs files used for split tunnel; see LinuxCGroups
+    const QString _exclusionsCGroupFile, _vpnOnlyCGroupFile, _parentCGroupFile;
     QPointer<QSocketNotifier> _readNotifier;
     OriginalNetworkScan _previousNetScan;
     QString _previousRPFilter;
     AppMap _exclusionsMap;
     AppMap _vpnOnlyMap;
+    // All PIDs that have been put in a cgroup, including descendants of the
+    // app processes.  Updated from fork/exec/exit events so those events are
+    // handled without reading /proc when possible.
+    QHash<pid_t, TrackedPid> _trackedPids;
+    // Open cgroup.procs files, so each PID write is one syscall
+    QHash<QString, int> _cGroupFds;
+    // PIDs waiting to be written to each cgroup (see flushCGroupWrites())
+    QHash<QString, QVector<pid_t>> _pendingCGroupWrites;
     QString _previousTunnelDeviceLocalAddress;
     int _sockFd;
 };
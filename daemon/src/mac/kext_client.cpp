@@ -55,6 +55,8 @@ namespace
     RegisterMetaType<FirewallParams> qFirewallParams;
 
     const QString kSplitTunnelAnchorName = "150.allowExcludedApps";
+    // Table in the split tunnel anchor containing the bound address
+    const QString kSplitTunnelAddressTable = "boundaddr";
 }
 
 bool PidFinder::matchesPath(pid_t pid)
@@ -308,13 +310,16 @@ void KextClient::updateFirewall(QString ipAddress)
     if(ipAddress.isEmpty())
     {
         qInfo() << "Removing firewall rule - empty split tunnel IP address";
-        PFFirewall::setAnchorWithRules(kSplitTunnelAnchorName, false, {});
+        teardownFirewall();
     }
     else
     {
+        // The anchor's rule refers to a table, so a new address just replaces
+        // the table contents; the anchor's rules are only loaded once.
         qInfo() << "Updating the firewall rule for new ip" << ipAddress;
-        PFFirewall::setAnchorWithRules(kSplitTunnelAnchorName,
-            true, { QStringLiteral("pass out from %1 no state").arg(ipAddress)});
+        PFFirewall::setAnchorEnabled(kSplitTunnelAnchorName, true);
+        PFFirewall::setAnchorTable(kSplitTunnelAnchorName, true,
+                                   kSplitTunnelAddressTable, {ipAddress});
     }
 }
 
@@ -419,7 +424,8 @@ void KextClient::updateNetwork(const FirewallParams &params, QString tunnelDevic
 void KextClient::teardownFirewall()
 {
     // Remove all firewall rules
-    PFFirewall::setAnchorWithRules(kSplitTunnelAnchorName, false, QStringList{});
+    PFFirewall::setAnchorTable(kSplitTunnelAnchorName, false, kSplitTunnelAddressTable, {});
+    PFFirewall::setAnchorEnabled(kSplitTunnelAnchorName, false);
 }
 
 void KextClient::shutdownConnection()
@@ -449,6 +455,7 @@ void KextClient::shutdownConnection()
 
      _excludedApps = {};
      _vpnOnlyApps = {};
+    _appCache.clear();
 
     _sockFd = -1;
 
@@ -498,16 +505,37 @@ void KextClient::manageWebKitApps(QVector<QString> &apps)
 QVector<QString> KextClient::findRemovedApps(const QVector<QString> &newApps, const QVector<QString> &oldApps)
 {
     QVector<QString> removedApps;
+    QSet<QString> newAppSet{QSet<QString>::fromList(newApps.toList())};
 
     for(const auto &app : oldApps)
     {
-        if(!newApps.contains(app))
+        if(!newAppSet.contains(app))
             removedApps.push_back(app);
     }
 
     return removedApps;
 }
 
+void KextClient::invalidateCachedApps(const QVector<QString> &changedApps)
+{
+    if(changedApps.isEmpty())
+        return;
+
+    // Only processes in the changed apps could have a different rule now; the
+    // rest of the cache is still valid.  Rules match by prefix (see
+    // findAppRule()).
+    for(auto itCached = _appCache.begin(); itCached != _appCache.end(); )
+    {
+        QString appPath{itCached->appPath};
+        bool changed = std::any_of(changedApps.begin(), changedApps.end(),
+            [&appPath](const QString &prefix){return appPath.startsWith(prefix);});
+        if(changed)
+            itCached = _appCache.erase(itCached);
+        else
+            ++itCached;
+    }
+}
+
 void KextClient::updateApps(QVector<QString> excludedApps, QVector<QString> vpnOnlyApps)
 {
     if(_state == State::Disconnected)
@@ -523,16 +551,26 @@ void KextClient::updateApps(QVector<QString> excludedApps, QVector<QString> vpnO
     // If nothing has changed, just return
     if(_excludedApps != excludedApps)
     {
-        removeApps(findRemovedApps(excludedApps, _excludedApps));
+        QVector<QString> removedApps{findRemovedApps(excludedApps, _excludedApps)};
+        QVector<QString> addedApps{findRemovedApps(_excludedApps, excludedApps)};
+        removeApps(removedApps);
+        invalidateCachedApps(removedApps);
+        invalidateCachedApps(addedApps);
         _excludedApps = std::move(excludedApps);
-        for(const auto &app : _excludedApps) qInfo() << "Excluded Apps:" << app;
+        qInfo() << "Excluded apps:" << _excludedApps.size() << "- added:"
+            << addedApps << "- removed:" << removedApps;
     }
 
     if(_vpnOnlyApps != vpnOnlyApps)
     {
-        removeApps(findRemovedApps(vpnOnlyApps, _vpnOnlyApps));
+        QVector<QString> removedApps{findRemovedApps(vpnOnlyApps, _vpnOnlyApps)};
+        QVector<QString> addedApps{findRemovedApps(_vpnOnlyApps, vpnOnlyApps)};
+        removeApps(removedApps);
+        invalidateCachedApps(removedApps);
+        invalidateCachedApps(addedApps);
         _vpnOnlyApps = std::move(vpnOnlyApps);
-        for(const auto &app : _vpnOnlyApps) qInfo() << "VPN Only Apps:" << app;
+        qInfo() << "VPN only apps:" << _vpnOnlyApps.size() << "- added:"
+            << addedApps << "- removed:" << removedApps;
     }
 
     qInfo() << "Updated apps";
@@ -559,10 +597,23 @@ void KextClient::removeApps(const QVector<QString> removedApps)
 
 void KextClient::readFromSocket(int socket)
 {
+    // Handle all of the queries that have been queued by the kext, not just
+    // one per notification - launching a large app can queue many queries at
+    // once.
     ProcQuery procQuery = {};
-    ProcQuery procResponse = {};
+    int handled = 0;
+    while(handled < MaxQueriesPerRead &&
+          ::recv(socket, &procQuery, sizeof(procQuery), MSG_DONTWAIT) == sizeof(procQuery))
+    {
+        handleQuery(socket, procQuery);
+        procQuery = {};
+        ++handled;
+    }
+}
 
-    ::recv(socket, &procQuery, sizeof(procQuery), 0);
+void KextClient::handleQuery(int socket, const ProcQuery &procQuery)
+{
+    ProcQuery procResponse = {};
 
     processCommand(procQuery, procResponse);
 
@@ -635,32 +686,72 @@ void KextClient::processCommand(const ProcQuery &procQuery, ProcQuery &procRespo
     }
 }
 
-void KextClient::verifyApp(const ProcQuery &procQuery, ProcQuery &procResponse)
+KextClient::CachedApp KextClient::findAppRule(pid_t pid) const
 {
-    // Copy basic details across from the query object
-    procResponse.id = procQuery.id;
-    procResponse.command = procQuery.command;
-    procResponse.pid = procQuery.pid;
-    procResponse.accept = false;
+    CachedApp app{};
 
     // Convert the PID to an app path on disk
-    proc_pidpath(procQuery.pid, procResponse.app_path, sizeof(procResponse.app_path));
+    char appPath[PATH_MAX]{};
+    proc_pidpath(pid, appPath, sizeof(appPath));
+    app.appPath = QByteArray{appPath};
 
     // Wrap the app path in a QString for convenience
-    QString appPath{procResponse.app_path};
+    QString appPathStr{appPath};
 
     // Check whether the app is one we want to exclude
-    auto matchesPath = [&appPath](const QVector<QString> &apps) {
+    auto matchesPath = [&appPathStr](const QVector<QString> &apps) {
         return std::any_of(apps.begin(), apps.end(),
-        [&appPath](const QString &prefix)
+        [&appPathStr](const QString &prefix)
         {
             // On MacOS we exclude apps based on their ".app" bundle,
             // this means we don't match on entire paths, but just on prefixes
-            return appPath.startsWith(prefix);
+            return appPathStr.startsWith(prefix);
         });
     };
 
     if(matchesPath(_excludedApps))
+        app.rule = AppRule::Excluded;
+    else if(matchesPath(_vpnOnlyApps))
+        app.rule = AppRule::VpnOnly;
+    else
+        app.rule = AppRule::None;
+    return app;
+}
+
+void KextClient::verifyApp(const ProcQuery &procQuery, ProcQuery &procResponse)
+{
+    // Copy basic details across from the query object
+    procResponse.id = procQuery.id;
+    procResponse.command = procQuery.command;
+    procResponse.pid = procQuery.pid;
+    procResponse.accept = false;
+
+    // Find the process's start time to look it up in the cache.  If this
+    // fails (the process may have already exited), just find the rule without
+    // caching it.
+    proc_bsdinfo bsdInfo{};
+    CachedApp app;
+    if(proc_pidinfo(procQuery.pid, PROC_PIDTBSDINFO, 0, &bsdInfo, sizeof(bsdInfo)) == sizeof(bsdInfo))
+    {
+        ProcessKey processKey{procQuery.pid,
+                              bsdInfo.pbi_start_tvsec * 1000000 + bsdInfo.pbi_start_tvusec};
+        auto itCached = _appCache.find(processKey);
+        if(itCached != _appCache.end())
+            app = itCached.value();
+        else
+        {
+            app = findAppRule(procQuery.pid);
+            if(_appCache.size() >= MaxCachedApps)
+                _appCache.clear();
+            _appCache.insert(processKey, app);
+        }
+    }
+    else
+        app = findAppRule(procQuery.pid);
+
+    ::strncpy(procResponse.app_path, app.appPath.constData(), sizeof(procResponse.app_path) - 1);
+
+    if(app.rule == AppRule::Excluded)
     {
         // Ignore excluded apps when not connected; we don't know the current IP
         // address (but they'll route to the physical interface anyway).
@@ -672,13 +763,13 @@ void KextClient::verifyApp(const ProcQuery &procQuery, ProcQuery &procResponse)
             procResponse.bind_ip = htonl(addr);
             if(!procResponse.bind_ip)
             {
-                qWarning() << "Unable to bind excluded app" << appPath
+                qWarning() << "Unable to bind excluded app" << app.appPath
                     << "- do not have interface IP address";
                 procResponse.accept = false;
             }
         }
     }
-    else if(matchesPath(_vpnOnlyApps))
+    else if(app.rule == AppRule::VpnOnly)
     {
         procResponse.accept = true;
         procResponse.rule_type = RuleType::OnlyVPN;
@@ -146,6 +146,7 @@ private:
     };
 
     void readFromSocket(int socket);
+    void handleQuery(int socket, const ProcQuery &procQuery);
     void showError(QString funcName);
     void verifyApp(const ProcQuery &proc_query, ProcQuery &proc_response);
     void processCommand(const ProcQuery &proc_query,  ProcQuery &proc_response);
@@ -161,6 +162,8 @@ private:
                        QString tunnelDeviceLocalAddress, QString tunnelDeviceRemoteAddress);
     void manageWebKitApps(QVector<QString> &apps);
     QVector<QString> findRemovedApps(const QVector<QString> &newApps, const QVector<QString> &oldApps);
+    // Remove cached rules for processes in apps that were added or removed
+    void invalidateCachedApps(const QVector<QString> &changedApps);
     void updateApps(QVector<QString> excludedApps, QVector<QString> vpnOnlyApps);
 
 private:
@@ -170,6 +173,37 @@ private:
         Disconnected
     };
 
+    // App rule that applies to a process, determined from its path
+    enum class AppRule
+    {
+        None,
+        Excluded,
+        VpnOnly
+    };
+
+    // Identifies a process - PIDs can be reused, so the start time is
+    // included to tell apart processes that had the same PID
+    using ProcessKey = QPair<pid_t, quint64>;
+
+    struct CachedApp
+    {
+        QByteArray appPath;
+        AppRule rule;
+    };
+
+    enum : int
+    {
+        // Maximum number of processes kept in _appCache; the cache is cleared
+        // when it's exceeded
+        MaxCachedApps = PidFinder::maxPids,
+        // Maximum number of queries handled from the kext socket each time it
+        // becomes readable, so a flood of queries can't starve the event loop
+        MaxQueriesPerRead = 64,
+    };
+
+    // Find the app path and rule that apply to a process
+    CachedApp findAppRule(pid_t pid) const;
+
     struct FirewallState
     {
         // Determines the default policy for the Kext firewall, i.e block or allow
@@ -201,6 +235,12 @@ private:
     // Keep track of the last few processes traced, so we can trace some of
     // these without completely overwhelming the log.
     std::deque<TracedResponse> _tracedResponses;
+    // The app path and rule found by verifyApp() for each process.  The kext
+    // queries the same processes over and over (once per socket), so this
+    // avoids looking up the path and matching it against the app lists each
+    // time.  Entries for apps that are added or removed are invalidated when
+    // the app lists change.
+    QHash<ProcessKey, CachedApp> _appCache;
 };
 
 class KextMonitor : public QObject
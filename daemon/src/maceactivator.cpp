@@ -0,0 +1,112 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("maceactivator.cpp")
+
+#include "maceactivator.h"
+#include <QHostAddress>
+
+namespace
+{
+    // The MACE activation address.  This is a fixed address, so it's parsed
+    // once rather than resolved for each connection.
+    const QHostAddress maceAddress{QStringLiteral("209.222.18.222")};
+    const quint16 macePort{1111};
+
+    // Timeout for each activation attempt
+    const std::chrono::seconds attemptTimeout{2};
+    // Delay before retrying a failed attempt
+    const std::chrono::milliseconds retryDelay{500};
+    // Maximum number of attempts
+    const int maxAttempts{3};
+}
+
+MaceActivationTask::MaceActivationTask()
+    : _finishedElapsed{}, _attemptCount{0}
+{
+    _timeoutTimer.setSingleShot(true);
+    _retryTimer.setSingleShot(true);
+
+    connect(&_socket, &QAbstractSocket::connected, this,
+            &MaceActivationTask::onConnected);
+    connect(&_socket, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error),
+            this, [this](QAbstractSocket::SocketError socketError)
+            {
+                onAttemptFailed(qEnumToString(socketError));
+            });
+    connect(&_timeoutTimer, &QTimer::timeout, this, [this]()
+    {
+        onAttemptFailed(QStringLiteral("timed out"));
+    });
+    connect(&_retryTimer, &QTimer::timeout, this,
+            &MaceActivationTask::beginAttempt);
+
+    _elapsed.start();
+    beginAttempt();
+}
+
+std::chrono::milliseconds MaceActivationTask::elapsed() const
+{
+    if(isFinished())
+        return _finishedElapsed;
+    return std::chrono::milliseconds{_elapsed.elapsed()};
+}
+
+void MaceActivationTask::beginAttempt()
+{
+    ++_attemptCount;
+    qInfo() << "Activating MACE, attempt" << _attemptCount << "of" << maxAttempts;
+    _timeoutTimer.start(attemptTimeout);
+    _socket.connectToHost(maceAddress, macePort);
+}
+
+void MaceActivationTask::onConnected()
+{
+    if(!isPending())
+        return;
+
+    _timeoutTimer.stop();
+    _socket.close();
+    _finishedElapsed = std::chrono::milliseconds{_elapsed.elapsed()};
+    qInfo() << "MACE activated after" << _finishedElapsed.count() << "ms and"
+        << _attemptCount << "attempts";
+    resolve();
+}
+
+void MaceActivationTask::onAttemptFailed(const QString &reason)
+{
+    // A timeout and a socket error can both be reported for one attempt;
+    // ignore anything after the attempt has already ended
+    if(!isPending() || _retryTimer.isActive())
+        return;
+
+    _timeoutTimer.stop();
+    _socket.abort();
+    qWarning() << "MACE activation attempt" << _attemptCount << "failed:" << reason;
+
+    if(_attemptCount < maxAttempts)
+    {
+        _retryTimer.start(retryDelay);
+        return;
+    }
+
+    _finishedElapsed = std::chrono::milliseconds{_elapsed.elapsed()};
+    reject({HERE, Error::Code::Unknown,
+            QStringLiteral("MACE activation failed after %1 attempts").arg(_attemptCount)});
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("maceactivator.h")
+
+#ifndef MACEACTIVATOR_H
+#define MACEACTIVATOR_H
+
+#include "async.h"
+#include <QElapsedTimer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <chrono>
+
+// MaceActivationTask activates MACE for the current VPN connection.  MACE is
+// activated by connecting to a fixed address through the tunnel, which causes
+// the VPN server's DNS to block known tracking domains.
+//
+// Each attempt connects to the activation address with a timeout, and failed
+// attempts are retried up to a limit.  The task resolves once an attempt
+// connects, or rejects when all attempts have failed.  One socket is reused for
+// all attempts.
+class MaceActivationTask : public Task<void>
+{
+    CLASS_LOGGING_CATEGORY("mace")
+
+public:
+    MaceActivationTask();
+
+public:
+    // Time spent activating MACE, including any retries.  Once the task has
+    // finished, this is the total time taken.
+    std::chrono::milliseconds elapsed() const;
+    // Number of attempts that have been started
+    int attempts() const {return _attemptCount;}
+
+private:
+    void beginAttempt();
+    void onConnected();
+    void onAttemptFailed(const QString &reason);
+
+private:
+    QTcpSocket _socket;
+    // Times out the current attempt
+    QTimer _timeoutTimer;
+    // Delays the next attempt after a failure
+    QTimer _retryTimer;
+    QElapsedTimer _elapsed;
+    std::chrono::milliseconds _finishedElapsed;
+    int _attemptCount;
+};
+
+#endif
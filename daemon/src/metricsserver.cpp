@@ -0,0 +1,140 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("metricsserver.cpp")
+
+#include "metricsserver.h"
+#include "metrics.h"
+#include <QTcpSocket>
+#include <chrono>
+
+namespace
+{
+    // Interval of the event loop lag timer
+    const std::chrono::seconds lagInterval{1};
+    // Largest request that will be buffered; requests are just a request line
+    // and a few headers.
+    const qint64 maxRequestSize = 8192;
+
+    void sendResponse(QTcpSocket &socket, const QByteArray &status,
+                      const QByteArray &contentType, const QByteArray &body)
+    {
+        QByteArray response;
+        response += "HTTP/1.1 " + status + "\r\n";
+        response += "Content-Type: " + contentType + "\r\n";
+        response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+        response += "Connection: close\r\n\r\n";
+        response += body;
+        socket.write(response);
+        socket.disconnectFromHost();
+    }
+}
+
+MetricsServer::MetricsServer(Collector collector)
+    : _collector{std::move(collector)}
+{
+    connect(&_server, &QTcpServer::newConnection, this,
+            &MetricsServer::onNewConnection);
+    _lagTimer.setInterval(msec(lagInterval));
+    _lagTimer.setTimerType(Qt::TimerType::PreciseTimer);
+    connect(&_lagTimer, &QTimer::timeout, this,
+            &MetricsServer::onLagTimerElapsed);
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+bool MetricsServer::start(quint16 port)
+{
+    if(_server.isListening())
+    {
+        if(_server.serverPort() == port)
+            return true;
+        _server.close();
+    }
+
+    if(!_server.listen(QHostAddress::LocalHost, port))
+    {
+        qWarning() << "Unable to listen for metrics on port" << port << "-"
+            << _server.errorString();
+        stop();
+        return false;
+    }
+
+    qInfo() << "Serving metrics on port" << port;
+    Metrics::setEnabled(true);
+    _lagElapsed.start();
+    _lagTimer.start();
+    return true;
+}
+
+void MetricsServer::stop()
+{
+    if(_server.isListening())
+        qInfo() << "Stopped serving metrics";
+    _server.close();
+    _lagTimer.stop();
+    Metrics::setEnabled(false);
+}
+
+void MetricsServer::onNewConnection()
+{
+    while(QTcpSocket *pSocket = _server.nextPendingConnection())
+    {
+        connect(pSocket, &QTcpSocket::disconnected, pSocket,
+                &QObject::deleteLater);
+        connect(pSocket, &QTcpSocket::readyRead, this, [this, pSocket]()
+        {
+            // Wait for the end of the request headers; the request body (if
+            // any) is ignored.
+            QByteArray request = pSocket->peek(maxRequestSize);
+            if(!request.contains("\r\n\r\n"))
+            {
+                if(request.size() >= maxRequestSize)
+                    pSocket->abort();
+                return;
+            }
+            pSocket->readAll();
+
+            QList<QByteArray> requestLine = request.left(request.indexOf("\r\n")).split(' ');
+            QByteArray path = requestLine.value(1);
+            path = path.left(path.indexOf('?'));
+            if(requestLine.value(0) != "GET" || path != "/metrics")
+            {
+                sendResponse(*pSocket, QByteArrayLiteral("404 Not Found"),
+                             QByteArrayLiteral("text/plain; charset=utf-8"),
+                             QByteArrayLiteral("Not found\n"));
+                return;
+            }
+
+            if(_collector)
+                _collector();
+            sendResponse(*pSocket, QByteArrayLiteral("200 OK"),
+                         Metrics::contentType(), Metrics::openMetricsText());
+        });
+    }
+}
+
+void MetricsServer::onLagTimerElapsed()
+{
+    qint64 lagMs = _lagElapsed.restart() - msec(lagInterval);
+    Metrics::setGauge(QStringLiteral("pia_event_loop_lag_seconds"),
+                      std::max<qint64>(lagMs, 0) / 1000.0);
+}
@@ -0,0 +1,73 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("metricsserver.h")
+
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <QElapsedTimer>
+#include <QTcpServer>
+#include <QTimer>
+#include <functional>
+
+// MetricsServer serves the current Metrics in the OpenMetrics text format over
+// a minimal HTTP server on the loopback interface, for scraping by Prometheus
+// or similar tools.  Any request for "/metrics" returns the metrics; other
+// paths return 404.
+//
+// While running, MetricsServer also enables recording in Metrics and measures
+// the daemon's event loop lag (pia_event_loop_lag_seconds).
+class MetricsServer : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("metrics")
+
+public:
+    // Called before rendering the metrics for each scrape, so values that are
+    // only sampled (like connection state) can be updated.
+    using Collector = std::function<void()>;
+
+public:
+    MetricsServer(Collector collector);
+    ~MetricsServer();
+
+public:
+    // Start listening on 127.0.0.1:port.  If the server is already running on
+    // a different port, it's restarted.  Returns false if the port couldn't
+    // be bound.
+    bool start(quint16 port);
+    // Stop listening and disable metrics recording.
+    void stop();
+
+    quint16 port() const {return _server.isListening() ? _server.serverPort() : 0;}
+
+private:
+    void onNewConnection();
+    void onLagTimerElapsed();
+
+private:
+    Collector _collector;
+    QTcpServer _server;
+    // Fires every LagInterval; the amount by which it's late is the event
+    // loop lag.
+    QTimer _lagTimer;
+    QElapsedTimer _lagElapsed;
+};
+
+#endif
@@ -0,0 +1,73 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("networkmonitor.cpp")
+
+#include "networkmonitor.h"
+#if defined(Q_OS_WIN)
+#include "win/win_routenotifier.h"
+#elif defined(Q_OS_UNIX)
+#include "posix/posix_routenotifier.h"
+#endif
+
+namespace
+{
+    // Time to wait for notifications to settle before emitting
+    // networkChanged().  Long enough to cover the burst of changes made when
+    // joining a network, short enough that a dead tunnel is noticed long
+    // before OpenVPN's ping timeout.
+    const std::chrono::milliseconds networkSettleDelay{750};
+}
+
+NetworkMonitor::NetworkMonitor(QObject *pParent)
+    : QObject{pParent}, _pNotifier{nullptr}
+{
+    _settleTimer.setSingleShot(true);
+    _settleTimer.setInterval(msec32(networkSettleDelay));
+    connect(&_settleTimer, &QTimer::timeout, this, [this]()
+    {
+        qInfo() << "Network configuration changed";
+        emit networkChanged();
+    });
+
+#if defined(Q_OS_WIN)
+    _pNotifier = new WinRouteNotifier{this};
+    connect(_pNotifier, &WinRouteNotifier::routesChanged, this,
+            &NetworkMonitor::onRouteNotification);
+#elif defined(Q_OS_UNIX)
+    _pNotifier = new PosixRouteNotifier{this};
+    connect(_pNotifier, &PosixRouteNotifier::routesChanged, this,
+            &NetworkMonitor::onRouteNotification);
+#endif
+}
+
+NetworkMonitor::~NetworkMonitor()
+{
+}
+
+bool NetworkMonitor::isMonitoring() const
+{
+    return _pNotifier && _pNotifier->isOpen();
+}
+
+void NetworkMonitor::onRouteNotification()
+{
+    emit routesChanged();
+    // Restart the timer for each notification, emit once they stop
+    _settleTimer.start();
+}
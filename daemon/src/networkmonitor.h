@@ -0,0 +1,79 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("networkmonitor.h")
+
+#ifndef NETWORKMONITOR_H
+#define NETWORKMONITOR_H
+
+#include <QObject>
+#include <QTimer>
+
+#if defined(Q_OS_WIN)
+class WinRouteNotifier;
+#elif defined(Q_OS_UNIX)
+class PosixRouteNotifier;
+#endif
+
+// NetworkMonitor emits networkChanged() when the OS reports a change to the
+// network interfaces, addresses, or routes.
+//
+// The OS notifications come in bursts (joining a network changes links,
+// addresses and several routes), so they're coalesced - networkChanged() is
+// emitted once the notifications have settled for a moment.  Receivers still
+// have to check whether anything relevant changed; routes for the tunnel
+// itself cause notifications too.
+//
+// The notifications come from:
+// - Linux: rtnetlink (RTM_NEWROUTE, RTM_NEWADDR, RTM_NEWLINK, etc.)
+// - macOS: a PF_ROUTE routing socket (RTM_ADD, RTM_NEWADDR, RTM_IFINFO, etc.)
+// - Windows: NotifyRouteChange2() and NotifyUnicastIpAddressChange()
+class NetworkMonitor : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("networkmonitor");
+
+public:
+    NetworkMonitor(QObject *pParent = nullptr);
+    ~NetworkMonitor();
+
+    // Whether OS notifications are being received.  If not, routesChanged()
+    // and networkChanged() are never emitted, so network state can't be
+    // cached.
+    bool isMonitoring() const;
+
+signals:
+    // The network configuration has changed (after settling)
+    void networkChanged();
+    // The OS reported a change (emitted immediately for each notification,
+    // before settling).  Used to invalidate cached routing information.
+    void routesChanged();
+
+private:
+    void onRouteNotification();
+
+private:
+#if defined(Q_OS_WIN)
+    WinRouteNotifier *_pNotifier;
+#elif defined(Q_OS_UNIX)
+    PosixRouteNotifier *_pNotifier;
+#endif
+    QTimer _settleTimer;
+};
+
+#endif
@@ -24,8 +24,187 @@
 
 #include <QNetworkProxy>
 #include <QProcess>
+#include <QRegularExpression>
 #include <QTcpServer>
 #include <QTcpSocket>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace
+{
+    struct StateName
+    {
+        const char *name;
+        int length;
+        OpenVPNProcess::State state;
+    };
+
+    template<int N>
+    constexpr StateName stateName(const char (&name)[N], OpenVPNProcess::State state)
+    {
+        return {name, N-1, state};
+    }
+
+    // State names reported in '>STATE:' lines
+    constexpr StateName stateNames[]
+    {
+        stateName("CONNECTING", OpenVPNProcess::Connecting),
+        stateName("RESOLVE", OpenVPNProcess::Resolve),
+        stateName("TCP_CONNECT", OpenVPNProcess::TCPConnect),
+        stateName("WAIT", OpenVPNProcess::Wait),
+        stateName("AUTH", OpenVPNProcess::Auth),
+        stateName("GET_CONFIG", OpenVPNProcess::GetConfig),
+        stateName("ASSIGN_IP", OpenVPNProcess::AssignIP),
+        stateName("ADD_ROUTES", OpenVPNProcess::AddRoutes),
+        stateName("CONNECTED", OpenVPNProcess::Connected),
+        stateName("RECONNECTING", OpenVPNProcess::Reconnecting),
+        stateName("EXITING", OpenVPNProcess::Exiting),
+    };
+
+    // A field of a management line, referring to the line's data
+    struct LineField
+    {
+        const char *data;
+        int size;
+
+        bool operator==(const char *other) const
+        {
+            return std::strlen(other) == static_cast<std::size_t>(size) &&
+                std::memcmp(data, other, size) == 0;
+        }
+        QString toString() const {return QString::fromLatin1(data, size);}
+    };
+
+    bool startsWith(const QByteArray &line, const char *prefix, int prefixLength)
+    {
+        return line.size() >= prefixLength &&
+            std::memcmp(line.constData(), prefix, prefixLength) == 0;
+    }
+
+    // Split [begin, end) at commas into at most maxFields fields; the last
+    // field holds the remainder of the line.  Returns the number of fields.
+    template<std::size_t N>
+    int splitFields(const char *begin, const char *end, LineField (&fields)[N])
+    {
+        int count = 0;
+        while(count < static_cast<int>(N) - 1)
+        {
+            const char *comma = static_cast<const char*>(std::memchr(begin, ',', end - begin));
+            if(!comma)
+                break;
+            fields[count++] = {begin, static_cast<int>(comma - begin)};
+            begin = comma + 1;
+        }
+        fields[count++] = {begin, static_cast<int>(end - begin)};
+        return count;
+    }
+
+    // Parse a decimal integer occupying all of [begin, end)
+    bool parseUInt64(const char *begin, const char *end, quint64 &value)
+    {
+        if(begin == end)
+            return false;
+        quint64 result = 0;
+        for(; begin != end; ++begin)
+        {
+            if(*begin < '0' || *begin > '9')
+                return false;
+            quint64 digit = static_cast<quint64>(*begin - '0');
+            if(result > (std::numeric_limits<quint64>::max() - digit) / 10)
+                return false;   // Overflow
+            result = result * 10 + digit;
+        }
+        value = result;
+        return true;
+    }
+}
+
+bool OpenVPNProcess::parseByteCount(const QByteArray &line, quint64 &received,
+                                    quint64 &sent)
+{
+    static const char prefix[] = ">BYTECOUNT:";
+    const int prefixLength = sizeof(prefix) - 1;
+    if(!startsWith(line, prefix, prefixLength))
+        return false;
+
+    const char *begin = line.constData() + prefixLength;
+    const char *end = line.constData() + line.size();
+    const char *comma = static_cast<const char*>(std::memchr(begin, ',', end - begin));
+    return comma && parseUInt64(begin, comma, received) &&
+        parseUInt64(comma+1, end, sent);
+}
+
+bool OpenVPNProcess::parseStateName(const char *name, int length, State &state)
+{
+    for(const auto &entry : stateNames)
+    {
+        if(entry.length == length && std::memcmp(entry.name, name, length) == 0)
+        {
+            state = entry.state;
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace
+{
+    struct OutputPattern
+    {
+        OpenVPNProcess::OutputEvent event;
+        // The line must contain this literal (or start with it, if 'prefix' is
+        // set) to be a candidate
+        QLatin1String literal;
+        bool prefix;
+        // If valid, a candidate line must also match this expression; its
+        // capture groups become the match's captures
+        QRegularExpression regex;
+    };
+
+    const std::vector<OutputPattern> &outputPatterns()
+    {
+        static const std::vector<OutputPattern> patterns = []()
+        {
+            using Event = OpenVPNProcess::OutputEvent;
+            std::vector<OutputPattern> result{
+                {Event::ProxyAuthFailed,
+                 QLatin1String{"socks_username_password_auth: server refused the authentication"},
+                 false, {}},
+                // This error can be logged by socks_handshake and
+                // recv_socks_reply, others might be possible too.
+                {Event::ProxyReadFailed, QLatin1String{"TCP port read failed"}, false,
+                 QRegularExpression{QStringLiteral("socks.*: TCP port read failed")}},
+                {Event::TcpConnectFailed, QLatin1String{"TCP: connect to [AF_INET]"}, false,
+                 QRegularExpression{QStringLiteral(R"(TCP: connect to \[AF_INET\]([\d\.]+):\d+ failed:)")}},
+                {Event::UsingDevice, QLatin1String{"Using device:"}, false,
+                 QRegularExpression{QStringLiteral(R"(Using device:([^ ]+) local_address:([^ ]+) remote_address:([^ ]+))")}},
+            };
+            for(auto &pattern : result)
+            {
+                if(!pattern.regex.pattern().isEmpty())
+                    pattern.regex.optimize();
+            }
+            return result;
+        }();
+        return patterns;
+    }
+}
+
+auto OpenVPNProcess::matchOutputLine(const QString &line) -> OutputMatch
+{
+    for(const auto &pattern : outputPatterns())
+    {
+        if(pattern.prefix ? !line.startsWith(pattern.literal) : !line.contains(pattern.literal))
+            continue;
+        if(pattern.regex.pattern().isEmpty())
+            return {pattern.event, {}};
+        const auto &match = pattern.regex.match(line);
+        if(match.hasMatch())
+            return {pattern.event, match.capturedTexts().mid(1)};
+    }
+    return {OutputEvent::None, {}};
+}
 
 OpenVPNProcess::OpenVPNProcess(QObject *parent)
     : QObject(parent)
@@ -33,8 +212,12 @@ OpenVPNProcess::OpenVPNProcess(QObject *parent)
     , _process(new QProcess(this))
     , _managementServer(new QTcpServer(this))
     , _managementSocket(nullptr)
+    , _pStdoutBuffer(nullptr)
+    , _pStderrBuffer(nullptr)
     , _remotePort(0)
     , _localPort(0)
+    , _remoteOverridePort(0)
+    , _byteCountInterval(5)
     , _managementExitSignaled(false)
     , _exited(false)
 {
@@ -55,7 +238,33 @@ OpenVPNProcess::OpenVPNProcess(QObject *parent)
         raiseError(Error(HERE, Error::OpenVPNManagementAcceptError));
     });
 
-    connect(this, &OpenVPNProcess::managementLine, this, &OpenVPNProcess::handleManagementLine);
+    // The output can be verbose, so converting, logging, and matching each
+    // line happens on the output thread.
+    _outputThread.invokeOnThread([this]()
+    {
+        _pStdoutBuffer = new LineBuffer;
+        _pStdoutBuffer->setParent(&_outputThread.objectOwner());
+        connect(_pStdoutBuffer, &LineBuffer::lineView, _pStdoutBuffer,
+            [this](const QByteArray &line)
+            {
+                SCOPE_LOGGING_CATEGORY("openvpn.stdout");
+                const QString &lineStr = QString::fromLatin1(line);
+                qDebug().noquote() << lineStr;
+                classifyOutputLine(OutputStream::Stdout, lineStr);
+            });
+        _pStderrBuffer = new LineBuffer;
+        _pStderrBuffer->setParent(&_outputThread.objectOwner());
+        connect(_pStderrBuffer, &LineBuffer::lineView, _pStderrBuffer,
+            [this](const QByteArray &line)
+            {
+                SCOPE_LOGGING_CATEGORY("openvpn.stderr");
+                const QString &lineStr = QString::fromLatin1(line);
+                qDebug().noquote() << lineStr;
+                classifyOutputLine(OutputStream::Stderr, lineStr);
+            });
+    });
+    connect(&_managementReadBuffer, &LineBuffer::lineView, this,
+            &OpenVPNProcess::managementLineComplete);
 }
 
 void OpenVPNProcess::run(const QStringList& arguments)
@@ -80,15 +289,18 @@ void OpenVPNProcess::run(const QStringList& arguments)
     finalArguments += QStringLiteral("--management-hold");
     finalArguments += QStringLiteral("--management-client");
     finalArguments += QStringLiteral("--management-query-passwords");
-    finalArguments += QStringLiteral("--remap-usr1");
-    finalArguments += QStringLiteral("SIGTERM");
+    // Query the remote so warmRestart() can redirect a restarted connection.
+    // SIGUSR1 is not remapped to SIGTERM so warmRestart() can use it; any
+    // internal restart is still stopped by VPNConnection when OpenVPN reports
+    // the Reconnecting state.
+    finalArguments += QStringLiteral("--management-query-remote");
 
     _process->setArguments(finalArguments);
     _process->start(QIODevice::ReadOnly);
     _process->closeWriteChannel();
 
     sendManagementCommand(QLatin1String("state on"));
-    sendManagementCommand(QLatin1String("bytecount 5"));
+    sendManagementCommand(QLatin1String{"bytecount " + QByteArray::number(_byteCountInterval)});
     sendManagementCommand(QLatin1String("hold release"));
 }
 
@@ -100,6 +312,28 @@ void OpenVPNProcess::sendManagementCommand(QLatin1String command)
     if (empty) managementBytesWritten(0); // Restart write queue if it was exhausted
 }
 
+void OpenVPNProcess::warmRestart(const QString &remoteHost, uint remotePort)
+{
+    if (_state != Connected)
+    {
+        qWarning() << "Can't restart OpenVPN in state" << traceEnum(_state);
+        return;
+    }
+    _remoteOverrideHost = remoteHost;
+    _remoteOverridePort = remotePort;
+    sendManagementCommand(QLatin1String("signal SIGUSR1"));
+}
+
+void OpenVPNProcess::setByteCountInterval(uint seconds)
+{
+    if (seconds == _byteCountInterval)
+        return;
+    _byteCountInterval = seconds;
+    // Once running, the new interval takes effect immediately
+    if (_state != Created && _state < Exiting)
+        sendManagementCommand(QLatin1String{"bytecount " + QByteArray::number(_byteCountInterval)});
+}
+
 void OpenVPNProcess::shutdown()
 {
     if (_state < Exiting)
@@ -116,28 +350,58 @@ void OpenVPNProcess::kill()
 
 void OpenVPNProcess::stdoutReadyRead()
 {
-    _stdoutBuffer += _process->readAllStandardOutput();
-    auto lines = _stdoutBuffer.split('\n');
-    _stdoutBuffer = lines.last();
-    for (int i = 0; i < lines.size() - 1; i++)
+    QByteArray data{_process->readAllStandardOutput()};
+    if(!data.isEmpty())
+        _outputThread.queueOnThread([this, data](){_pStdoutBuffer->append(data);});
+}
+
+void OpenVPNProcess::stderrReadyRead()
+{
+    QByteArray data{_process->readAllStandardError()};
+    if(!data.isEmpty())
+        _outputThread.queueOnThread([this, data](){_pStderrBuffer->append(data);});
+}
+
+void OpenVPNProcess::classifyOutputLine(OutputStream stream, const QString &line)
+{
+    OutputMatch match{matchOutputLine(line)};
+    if(match.event == OutputEvent::None)
+        return;
+
+    bool wasEmpty;
+    {
+        QMutexLocker lock{&_outputEventsMutex};
+        wasEmpty = _outputEvents.isEmpty();
+        _outputEvents.push_back({stream, std::move(match)});
+    }
+    // Only one delivery is queued at a time; it takes all the events queued
+    // by then
+    if(wasEmpty)
     {
-        if (lines[i].endsWith('\r'))
-            lines[i].chop(1);
-        emit stdoutLine(QString::fromLatin1(lines[i]));
+        QMetaObject::invokeMethod(this, [this](){deliverOutputEvents();},
+                                  Qt::QueuedConnection);
     }
 }
 
-void OpenVPNProcess::stderrReadyRead()
+void OpenVPNProcess::deliverOutputEvents()
 {
-    _stderrBuffer += _process->readAllStandardError();
-    auto lines = _stderrBuffer.split('\n');
-    _stderrBuffer = lines.last();
-    for (int i = 0; i < lines.size() - 1; i++)
+    QVector<PendingOutputEvent> events;
     {
-        if (lines[i].endsWith('\r'))
-            lines[i].chop(1);
-        emit stderrLine(QString::fromLatin1(lines[i]));
+        QMutexLocker lock{&_outputEventsMutex};
+        events.swap(_outputEvents);
     }
+    for(const auto &event : events)
+        emit outputEvent(event.stream, event.match);
+}
+
+void OpenVPNProcess::flushOutput()
+{
+    // Take any output that's already buffered by QProcess, then wait for the
+    // output thread to get through everything queued so far
+    stdoutReadyRead();
+    stderrReadyRead();
+    _outputThread.invokeOnThread([](){});
+    deliverOutputEvents();
 }
 
 void OpenVPNProcess::processError(QProcess::ProcessError error)
@@ -169,6 +433,7 @@ void OpenVPNProcess::processFinished(int exitCode, QProcess::ExitStatus exitStat
 {
     if (!std::exchange(_exited, true))
     {
+        flushOutput();
         emit exited(exitStatus == QProcess::NormalExit ? exitCode : -1);
     }
 }
@@ -188,27 +453,21 @@ void OpenVPNProcess::managementConnected()
 void OpenVPNProcess::managementReadyRead()
 {
     if (_managementSocket->bytesAvailable() > 0)
-    {
-        _managementReadBuffer += _managementSocket->readAll();
-        auto lines = _managementReadBuffer.split('\n');
-        _managementReadBuffer = lines.last();
-        for (int i = 0; i < lines.size() - 1; i++)
-        {
-            if (lines[i].endsWith('\r'))
-                lines[i].chop(1);
-            emit managementLine(QString::fromLatin1(lines[i]));
-        }
-    }
+        _managementReadBuffer.append(_managementSocket->readAll());
 }
 
 void OpenVPNProcess::managementReadFinished()
 {
     managementReadyRead();
-    if (_managementReadBuffer.size() > 0)
-    {
-        emit managementLine(QString::fromLatin1(_managementReadBuffer));
-        _managementReadBuffer.clear();
-    }
+    QByteArray partialLine = _managementReadBuffer.reset();
+    if (partialLine.size() > 0)
+        managementLineComplete(partialLine);
+}
+
+void OpenVPNProcess::managementLineComplete(const QByteArray &line)
+{
+    if (!handleManagementLine(line))
+        emit managementLine(QString::fromLatin1(line));
 }
 
 void OpenVPNProcess::managementBytesWritten(qint64 bytes)
@@ -236,81 +495,92 @@ void OpenVPNProcess::setState(State state)
 {
     if (state != _state)
     {
+        flushOutput();
         _state = state;
         emit stateChanged();
     }
 }
 
-void OpenVPNProcess::handleManagementLine(const QString& line)
+bool OpenVPNProcess::handleManagementLine(const QByteArray& line)
 {
     if (line.isEmpty() || line[0] != '>')
-        return;
-    if (line.startsWith(QLatin1String(">STATE:")))
+        return false;
+
+    // Bytecounts are the most frequent notification, check them first
+    quint64 received, sent;
+    if (parseByteCount(line, received, sent))
     {
-        auto params = line.midRef(7).split(',');
-        if (params.size() < 2)
-        {
-            qWarning() << "Unrecognized OpenVPN state:" << line.midRef(7);
-            return;
-        }
-        QStringRef description, tunnelIP, remoteIP, remotePort, localIP, localPort, tunnelIPv6;
-        switch (params.size())
+        emit byteCount(received, sent);
+        return true;
+    }
+
+    static const char statePrefix[] = ">STATE:";
+    const int statePrefixLength = sizeof(statePrefix) - 1;
+    if (startsWith(line, statePrefix, statePrefixLength))
+    {
+        LineField params[9];
+        int paramCount = splitFields(line.constData() + statePrefixLength,
+                                     line.constData() + line.size(), params);
+        if (paramCount < 2)
         {
-        default:
-        case 9: tunnelIPv6 = params[8];
-        case 8: localPort = params[7];
-        case 7: localIP = params[6];
-        case 6: remotePort = params[5];
-        case 5: remoteIP = params[4];
-        case 4: tunnelIP = params[3];
-        case 3: description = params[2];
-        case 2: case 1: case 0: break;
+            qWarning() << "Unrecognized OpenVPN state:" << line.mid(statePrefixLength);
+            return false;
         }
+        LineField empty{nullptr, 0};
+        const LineField &description = paramCount > 2 ? params[2] : empty;
+        const LineField &tunnelIP = paramCount > 3 ? params[3] : empty;
+        const LineField &remoteIP = paramCount > 4 ? params[4] : empty;
+        const LineField &remotePort = paramCount > 5 ? params[5] : empty;
+        const LineField &localIP = paramCount > 6 ? params[6] : empty;
+        const LineField &localPort = paramCount > 7 ? params[7] : empty;
+        const LineField &tunnelIPv6 = paramCount > 8 ? params[8] : empty;
 
-        auto assignUInt = [](uint& var, const QStringRef& str) { bool ok; uint value = str.toUInt(&ok); if (ok) var = value; };
+        auto assignUInt = [](uint& var, const LineField &field)
+        {
+            quint64 value;
+            if (parseUInt64(field.data, field.data + field.size, value) &&
+                value <= std::numeric_limits<uint>::max())
+            {
+                var = static_cast<uint>(value);
+            }
+        };
 
-        if (!tunnelIP.isEmpty())
+        if (tunnelIP.size > 0)
             _tunnelIP = tunnelIP.toString();
-        if (!tunnelIPv6.isEmpty())
+        if (tunnelIPv6.size > 0)
             _tunnelIPv6 = tunnelIPv6.toString();
-        if (!remoteIP.isEmpty())
+        if (remoteIP.size > 0)
             _remoteIP = remoteIP.toString();
-        if (!localIP.isEmpty())
+        if (localIP.size > 0)
             _localIP = localIP.toString();
-        if (!remotePort.isEmpty())
+        if (remotePort.size > 0)
             assignUInt(_remotePort, remotePort);
-        if (!localPort.isEmpty())
+        if (localPort.size > 0)
             assignUInt(_localPort, localPort);
 
-        if (params[1] == QLatin1String("CONNECTING"))
-            setState(Connecting);
-        else if (params[1] == QLatin1String("RESOLVE"))
-            setState(Resolve);
-        else if (params[1] == QLatin1String("TCP_CONNECT"))
-            setState(TCPConnect);
-        else if (params[1] == QLatin1String("WAIT"))
-            setState(Wait);
-        else if (params[1] == QLatin1String("AUTH"))
-            setState(Auth);
-        else if (params[1] == QLatin1String("GET_CONFIG"))
-            setState(GetConfig);
-        else if (params[1] == QLatin1String("ASSIGN_IP"))
-            setState(AssignIP);
-        else if (params[1] == QLatin1String("ADD_ROUTES"))
-            setState(AddRoutes);
-        else if (params[1] == QLatin1String("CONNECTED"))
-            setState(Connected);
-        else if (params[1] == QLatin1String("RECONNECTING"))
-            setState(Reconnecting);
-        else if (params[1] == QLatin1String("EXITING"))
+        State newState;
+        if (!parseStateName(params[1].data, params[1].size, newState))
+            qWarning() << "Unrecognized OpenVPN state:" << line.mid(statePrefixLength);
+        else
         {
-            if (description == QLatin1String("tls-error"))
+            if (newState == Exiting && description == "tls-error")
                 raiseError(Error(HERE, Error::OpenVPNTLSHandshakeError));
-            setState(Exiting);
+            setState(newState);
         }
-        else
-            qWarning() << "Unrecognized OpenVPN state:" << line.midRef(7);
     }
-    else if (line.startsWith(QLatin1String(">HOLD:")))
+    else if (line.startsWith(">HOLD:"))
         sendManagementCommand(QLatin1String("hold release"));
+    else if (line.startsWith(">REMOTE:"))
+    {
+        if (_remoteOverrideHost.isEmpty())
+            sendManagementCommand(QLatin1String("remote ACCEPT"));
+        else
+        {
+            QByteArray command = QByteArrayLiteral("remote MOD ") +
+                _remoteOverrideHost.toLatin1() + ' ' +
+                QByteArray::number(_remoteOverridePort);
+            sendManagementCommand(QLatin1String{command});
+        }
+    }
+    return false;
 }
@@ -23,10 +23,14 @@
 #define OPENVPN_H
 #pragma once
 
+#include "linebuffer.h"
+#include "thread.h"
 #include <QByteArray>
+#include <QMutex>
 #include <QObject>
 #include <QProcess>
 #include <QStringList>
+#include <QVector>
 
 /**
  * @brief The OpenVPNProcess class abstracts the handling of a single OpenVPN
@@ -34,7 +38,8 @@
  * interface streams to line-based signals. This class is used to manage a
  * single connection attempt; the Connection class uses this class in order
  * to implement an ongoing VPN connection, disabling OpenVPN's built-in
- * reconnect handling in favor of our own.
+ * reconnect handling in favor of our own.  (The only restarts are the ones
+ * requested explicitly with warmRestart().)
  */
 class OpenVPNProcess : public QObject
 {
@@ -65,6 +70,32 @@ public:
     };
     Q_ENUM(State)
 
+    // Events recognized in the lines OpenVPN prints to stdout/stderr (which
+    // also include the magic strings printed by our up/down scripts).
+    enum class OutputEvent
+    {
+        None,
+        // The SOCKS proxy refused our credentials
+        ProxyAuthFailed,
+        // Reading from the SOCKS proxy failed
+        ProxyReadFailed,
+        // A TCP connection failed; captures the address that failed
+        TcpConnectFailed,
+        // The tunnel device is known; captures the device name, local address,
+        // and remote address
+        UsingDevice,
+    };
+    struct OutputMatch
+    {
+        OutputEvent event;
+        QStringList captures;
+    };
+    enum class OutputStream
+    {
+        Stdout,
+        Stderr,
+    };
+
 public:
     explicit OpenVPNProcess(QObject *parent = nullptr);
 
@@ -78,16 +109,43 @@ public:
     uint remotePort() const { return _remotePort; }
     uint localPort() const { return _localPort; }
 
+    // Parse a '>BYTECOUNT:<received>,<sent>' management line in place.
+    // Returns false if the line is not a valid bytecount line.
+    static bool parseByteCount(const QByteArray &line, quint64 &received,
+                               quint64 &sent);
+    // Find the State for a state name from a '>STATE:' line, such as
+    // "CONNECTED".  Returns false if the name isn't recognized.
+    static bool parseStateName(const char *name, int length, State &state);
+    // Match a stdout/stderr line against all known output patterns.  The
+    // patterns are compiled once and shared by all scanners.  Each pattern
+    // has a literal that is checked first, so the regular expressions only
+    // run on lines that could match (most lines match nothing).
+    static OutputMatch matchOutputLine(const QString &line);
+
 signals:
-    void stdoutLine(const QString& line);
-    void stderrLine(const QString& line);
+    // OpenVPN's stdout and stderr are split into lines, logged, and matched
+    // with matchOutputLine() on a worker thread; only the lines that match an
+    // event are emitted with this signal (on OpenVPNProcess's thread).  Any
+    // pending events are emitted before stateChanged() and exited(), so they
+    // are observed in the same order as they were printed relative to those.
+    void outputEvent(OpenVPNProcess::OutputStream stream,
+                     const OpenVPNProcess::OutputMatch &match);
     void managementLine(const QString& line);
+    // Bytecount notifications are parsed by OpenVPNProcess and emitted with
+    // this signal instead of managementLine().
+    void byteCount(quint64 received, quint64 sent);
     void stateChanged();
     void exited(int exitCode);
     void error(const Error& error);
 
 public slots:
     void sendManagementCommand(QLatin1String command);
+    // Restart the connection in place (SIGUSR1) using the given remote; the
+    // process and its management interface are kept.
+    void warmRestart(const QString &remoteHost, uint remotePort);
+    // Set the interval (in seconds) of the bytecount notifications from the
+    // management interface.  Can be called before or after run().
+    void setByteCountInterval(uint seconds);
     void shutdown();
     void kill();
 
@@ -99,12 +157,25 @@ private slots:
     void managementConnected();
     void managementReadyRead();
     void managementReadFinished();
+    void managementLineComplete(const QByteArray &line);
     void managementBytesWritten(qint64 bytes);
     void raiseError(const Error& error);
 
+private:
+    // Match an output line and queue its event, if any (on _outputThread)
+    void classifyOutputLine(OutputStream stream, const QString &line);
+    // Emit the queued output events
+    void deliverOutputEvents();
+    // Wait for the output read so far to be classified, and emit the
+    // resulting events
+    void flushOutput();
+
 protected:
     void setState(State state);
-    void handleManagementLine(const QString& line);
+    // Handle the management lines that OpenVPNProcess handles itself.
+    // Returns true if the line is consumed and shouldn't be emitted with
+    // managementLine().
+    bool handleManagementLine(const QByteArray& line);
 
 private:
     State _state;
@@ -112,15 +183,36 @@ private:
     class QTcpServer* _managementServer;
     class QTcpSocket* _managementSocket;
 
-    QByteArray _stdoutBuffer, _stderrBuffer;
-    QByteArray _managementReadBuffer, _managementWriteBuffer;
+    // Line buffers for stdout/stderr; these live on _outputThread
+    LineBuffer *_pStdoutBuffer, *_pStderrBuffer;
+    LineBuffer _managementReadBuffer;
+    QByteArray _managementWriteBuffer;
 
     QString _tunnelIP, _tunnelIPv6;
     QString _remoteIP, _localIP;
     uint _remotePort, _localPort;
 
+    // Remote used to answer OpenVPN's remote queries, set by warmRestart().
+    // If it's not set, OpenVPN's configured remote is accepted.
+    QString _remoteOverrideHost;
+    uint _remoteOverridePort;
+
+    uint _byteCountInterval;
+
     bool _managementExitSignaled;
     bool _exited;
+
+    struct PendingOutputEvent
+    {
+        OutputStream stream;
+        OutputMatch match;
+    };
+    // Events classified by _outputThread that haven't been delivered yet
+    QMutex _outputEventsMutex;
+    QVector<PendingOutputEvent> _outputEvents;
+    // Reads and classifies stdout/stderr.  Declared last so it's shut down
+    // before the state above is destroyed.
+    RunningWorkerThread _outputThread;
 };
 
 #endif // OPENVPN_H
@@ -33,15 +33,19 @@ PortForwarder::PortForwarder(QObject *pParent, const QString &clientId)
       _clientId{clientId},
       _connectionState{State::Disconnected},
       _forwardingEnabled{false},
-      _pPortForwardRequest{}
+      _pPortForwardRequest{},
+      _cachedPortReported{0}
 {
 }
 
-void PortForwarder::updateConnectionState(State connectionState)
+void PortForwarder::updateConnectionState(State connectionState, const QString &regionId)
 {
     if(connectionState == _connectionState)
         return; // No change, nothing to do
 
+    _regionId = (connectionState == State::Disconnected) ? QString{} : regionId;
+    _cachedPortReported = 0;
+
     if(connectionState == State::ConnectedSupported)
     {
         // Invariant - cleared in any state other than ConnectedSupported
@@ -109,15 +113,47 @@ void PortForwarder::requestPort()
    _pPortForwardRequest = ApiClient::instance()
                 ->getForwardedPort(QStringLiteral("?client_id=%1").arg(_clientId))
                 ->then(this, [this](const QJsonDocument& json) {
-                    const auto &port = json[QStringLiteral("port")].toInt();
-                    emit portForwardUpdated(port ? port : PortForwardState::Failed);
+                    portRequestFinished(json[QStringLiteral("port")].toInt());
                 })
                 ->except(this, [this](const Error& err) {
                     qWarning() << "Couldn't request port forward due to error:" << err;
-                    emit portForwardUpdated(PortForwardState::Failed);
+                    portRequestFinished(0);
                 });
 
-   emit portForwardUpdated(PortForwardState::Attempting);
+   // If we forwarded a port in this region before, report it right away; the
+   // request above revalidates it.
+   int cachedPort = _regionId.isEmpty() ? 0 : _lastForwardedPorts.value(_regionId);
+   if(cachedPort)
+   {
+       qInfo() << "Reusing port" << cachedPort << "previously forwarded in"
+           << _regionId << "while revalidating it";
+       _cachedPortReported = cachedPort;
+       emit portForwardUpdated(cachedPort);
+   }
+   else
+       emit portForwardUpdated(PortForwardState::Attempting);
+}
+
+void PortForwarder::portRequestFinished(int port)
+{
+    if(!_regionId.isEmpty())
+    {
+        if(port)
+            _lastForwardedPorts.insert(_regionId, port);
+        else
+            _lastForwardedPorts.remove(_regionId);
+    }
+
+    // If the cached port was confirmed, it's already been reported
+    if(port && port == _cachedPortReported)
+        return;
+    if(_cachedPortReported)
+    {
+        qWarning() << "Previously forwarded port" << _cachedPortReported
+            << "in" << _regionId << "was not confirmed, result:" << port;
+    }
+    _cachedPortReported = 0;
+    emit portForwardUpdated(port ? port : PortForwardState::Failed);
 }
 
 // The existing client uses lowercase characters for this encoding
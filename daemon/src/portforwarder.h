@@ -23,6 +23,7 @@
 #define PORTFORWARDER_H
 
 #include <QTimer>
+#include <QHash>
 #include <QNetworkAccessManager>
 #include <QPointer>
 #include <QScopedPointer>
@@ -66,7 +67,12 @@ public:
     // (VPNConnection has a number of states, but PortForwarder only cares
     // whether we are connected or not and whether the connected region supports
     // PF.)
-    void updateConnectionState(State connectionState);
+    //
+    // regionId identifies the connected region.  If a port was forwarded in
+    // this region earlier, that port is reported right away while the new
+    // request revalidates it (the API returns the same port for the same
+    // client ID and region).  If regionId is empty, no port is cached.
+    void updateConnectionState(State connectionState, const QString &regionId = {});
 
     // Specify whether port forwarding is currently enabled.
     // If port forwarding becomes enabled, the VPN is already connected, and a
@@ -84,6 +90,9 @@ signals:
 private:
     // Request a port forward (create a new PortRequester)
     void requestPort();
+    // Handle the result of a port forward request.  port is 0 if the request
+    // failed.
+    void portRequestFinished(int port);
 
 private:
     // The client Id (used to make a PF request)
@@ -101,6 +110,16 @@ private:
     // (It can be set with _forwardingEnabled is false if the setting was
     // toggled while connected.)
     Async<void> _pPortForwardRequest;
+    // The region of the current connection (if connected), see
+    // updateConnectionState()
+    QString _regionId;
+    // The port that was reported from the cache for this connection, if any.
+    // The request result is only emitted if it differs.
+    int _cachedPortReported;
+    // The last port forwarded in each region.  The client ID is fixed for the
+    // lifetime of PortForwarder, so only the region is needed to identify a
+    // port.
+    QHash<QString, int> _lastForwardedPorts;
 };
 
 // The client ID we use for requests - a 256-bit number encoded in Base-36
@@ -24,6 +24,7 @@
 #include "posix.h"
 #include "posix_firewall_pf.h"
 #include "posix_firewall_iptables.h"
+#include "posix_firewall_nftables.h"
 #include "path.h"
 #include "brand.h"
 
@@ -31,12 +32,16 @@
 #include "mac/kext_client.h"
 #elif defined(Q_OS_LINUX)
 #include "linux/proc_tracker.h"
+#include "linux/linux_netlink.h"
+#include <linux/netlink.h>
 #endif
 
 #include <QFileSystemWatcher>
+#include <QProcess>
 #include <QSocketNotifier>
 
 #include <initializer_list>
+#include <utility>
 
 #include <grp.h>
 #include <pwd.h>
@@ -101,7 +106,7 @@ void setUidAndGid()
 }
 
 PosixDaemon::PosixDaemon(const QStringList& arguments)
-    : Daemon(arguments), _enableSplitTunnel{false}
+    : Daemon(arguments), _enableSplitTunnel{false}, _firewallVerified{false}
 {
     // Route signals through a local socket pair to let Qt safely handle them
     if (::socketpair(AF_UNIX, SOCK_STREAM, 0, _signalFd))
@@ -174,6 +179,7 @@ PosixDaemon::~PosixDaemon()
 
 #ifdef Q_OS_LINUX
     IpTablesFirewall::uninstall();
+    if (NftablesFirewall::isInstalled()) NftablesFirewall::uninstall();
 #endif
 
     // Presumably guaranteed to exit if we reach this point..?
@@ -186,11 +192,136 @@ PosixDaemon::~PosixDaemon()
     toggleSplitTunnel({});
 }
 
+#ifdef Q_OS_LINUX
+namespace
+{
+    // Generic netlink family registered by the ovpn-dco kernel module
+    const char *ovpnDcoFamily = "ovpn-dco-v2";
+
+    // On Linux, the adapter just indicates whether to use DCO; OpenVPN
+    // creates the tun (or ovpn-dco) device itself.
+    class LinuxNetworkAdapter : public NetworkAdapter
+    {
+    public:
+        LinuxNetworkAdapter(bool dcoSupported, bool useDco)
+            : NetworkAdapter{{}}, _dcoSupported{dcoSupported}, _useDco{useDco}
+        {}
+
+        virtual bool dcoSupported() const override { return _dcoSupported; }
+        virtual bool usesDco() const override { return _useDco; }
+
+    private:
+        bool _dcoSupported, _useDco;
+    };
+}
+
+bool PosixDaemon::openvpnSupportsDco()
+{
+    if(!_openvpnSupportsDco)
+    {
+        // Check OpenVPN's usage text for the option to disable DCO, which
+        // is present in builds that support it
+        QProcess help;
+        help.setProcessChannelMode(QProcess::ProcessChannelMode::MergedChannels);
+        help.start(Path::OpenVPNExecutable, {QStringLiteral("--help")});
+        help.waitForFinished(2000);
+        _openvpnSupportsDco = help.readAll().contains("--disable-dco");
+        qInfo() << "OpenVPN supports data channel offload:" << _openvpnSupportsDco.get();
+    }
+    return _openvpnSupportsDco.get();
+}
+
+void PosixDaemon::updateSplitTunnelBandwidth()
+{
+    if(!_enableSplitTunnel || _state.connectionState() != QStringLiteral("Connected"))
+    {
+        _lastSplitTunnelCounters.clear();
+        _state.splitTunnelBandwidth({});
+        return;
+    }
+
+    // If the last dump is somehow still running, skip this sample
+    if(_pCounterDump)
+        return;
+
+    // Dump the counters asynchronously; this is done for every bandwidth
+    // measurement, so don't block the daemon while iptables-save runs.
+    QProcess *pDump = new QProcess{this};
+    _pCounterDump = pDump;
+    connect(pDump, &QProcess::errorOccurred, this, [pDump](QProcess::ProcessError error)
+    {
+        if(error == QProcess::ProcessError::FailedToStart)
+        {
+            qWarning() << "Unable to dump split tunnel counters:" << error;
+            pDump->deleteLater();
+        }
+    });
+    connect(pDump, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+            this, [this, pDump]()
+    {
+        pDump->deleteLater();
+        // Ignore the exit code, ip6tables-save fails if IPv6 is disabled;
+        // use whatever counters were dumped.
+        if(_enableSplitTunnel)
+            applySplitTunnelCounters(IpTablesFirewall::parseCounters(pDump->readAllStandardOutput()));
+    });
+    pDump->start(QStringLiteral("/bin/bash"),
+                 {QStringLiteral("-c"), IpTablesFirewall::counterDumpCommand()},
+                 QProcess::ReadOnly);
+}
+
+void PosixDaemon::applySplitTunnelCounters(const QHash<QString, quint64> &counters)
+{
+    auto counterDelta = [&](const QString &name) -> quint64
+    {
+        quint64 total = counters.value(name);
+        auto itLast = _lastSplitTunnelCounters.find(name);
+        // Nothing to compare to in the first sample.  If the counter went
+        // backwards, the rules were reinstalled and it started over.
+        quint64 delta = 0;
+        if(itLast != _lastSplitTunnelCounters.end())
+            delta = total >= itLast.value() ? total - itLast.value() : total;
+        _lastSplitTunnelCounters[name] = total;
+        return delta;
+    };
+
+    QVector<SplitTunnelBandwidth> bandwidth;
+    for(const auto &rule : {qMakePair(QStringLiteral("exclude"), IpTablesFirewall::kExcludedCounter),
+                            qMakePair(QStringLiteral("include"), IpTablesFirewall::kVpnOnlyCounter)})
+    {
+        const QString receivedName = rule.second + QStringLiteral(".received");
+        const QString sentName = rule.second + QStringLiteral(".sent");
+        SplitTunnelBandwidth ruleBandwidth;
+        ruleBandwidth.mode(rule.first);
+        ruleBandwidth.received(counters.value(receivedName));
+        ruleBandwidth.sent(counters.value(sentName));
+        ruleBandwidth.intervalReceived(counterDelta(receivedName));
+        ruleBandwidth.intervalSent(counterDelta(sentName));
+        bandwidth.push_back(ruleBandwidth);
+    }
+    _state.splitTunnelBandwidth(bandwidth);
+}
+#endif
+
 QSharedPointer<NetworkAdapter> PosixDaemon::getNetworkAdapter()
 {
 #ifdef Q_OS_MACOS
     static QSharedPointer<NetworkAdapter> staticAdapter = QSharedPointer<NetworkAdapter>::create("utun");
     return staticAdapter;
+#elif defined(Q_OS_LINUX)
+    bool dcoSupported = openvpnSupportsDco();
+    bool useDco = false;
+    if(dcoSupported && _settings.linuxDataChannel() == QStringLiteral("dco"))
+    {
+        // Resolving the family loads the module on demand if it's installed
+        // but not loaded yet.  If it's not installed, fall back to the
+        // userspace data channel.
+        NetlinkSocket sock{NETLINK_GENERIC};
+        useDco = sock.resolveGenericFamily(ovpnDcoFamily) != 0;
+        if(!useDco)
+            qWarning() << "ovpn-dco module is not available, using userspace data channel";
+    }
+    return QSharedPointer<LinuxNetworkAdapter>::create(dcoSupported, useDco);
 #else
     return nullptr;
 #endif
@@ -250,9 +381,15 @@ void PosixDaemon::applyFirewallRules(const FirewallParams& params)
 #if defined(Q_OS_MACOS)
     // double-check + ensure our firewall is installed and enabled. This is necessary as
     // other software may disable pfctl before re-enabling with their own rules (e.g other VPNs)
-    if (!PFFirewall::isInstalled()) PFFirewall::install();
+    if (!std::exchange(_firewallVerified, false))
+    {
+        if (!PFFirewall::isInstalled()) PFFirewall::install();
 
-    PFFirewall::ensureRootAnchorPriority();
+        PFFirewall::ensureRootAnchorPriority();
+    }
+
+    // Apply all of the anchor changes at once
+    PFFirewall::beginBatch();
     PFFirewall::setAnchorEnabled(QStringLiteral("000.allowLoopback"), params.allowLoopback);
     PFFirewall::setAnchorEnabled(QStringLiteral("100.blockAll"), params.blockAll);
     PFFirewall::setAnchorEnabled(QStringLiteral("200.allowVPN"), params.allowVPN);
@@ -263,29 +400,53 @@ void PosixDaemon::applyFirewallRules(const FirewallParams& params)
     PFFirewall::setAnchorTable(QStringLiteral("310.blockDNS"), params.blockDNS, QStringLiteral("dnsaddr"), params.dnsServers);
     PFFirewall::setAnchorEnabled(QStringLiteral("350.allowHnsd"), params.allowHnsd);
     PFFirewall::setAnchorEnabled(QStringLiteral("400.allowPIA"), params.allowPIA);
+    PFFirewall::commitBatch();
 #elif defined(Q_OS_LINUX)
 
      // double-check + ensure our firewall is installed and enabled
-    if (!IpTablesFirewall::isInstalled()) IpTablesFirewall::install();
+    if (!std::exchange(_firewallVerified, false))
+    {
+        if (!IpTablesFirewall::isInstalled()) IpTablesFirewall::install();
 
-    // Note: rule precedence is handled inside IpTablesFirewall
-    IpTablesFirewall::ensureRootAnchorPriority();
+        // Note: rule precedence is handled inside IpTablesFirewall
+        IpTablesFirewall::ensureRootAnchorPriority();
+    }
+
+    // The filter anchors are applied by the nftables backend if it's
+    // selected; they're disabled in iptables then.
+    const bool useNftables = _settings.linuxFirewallBackend() == QStringLiteral("nftables");
+    if (!useNftables && NftablesFirewall::isInstalled()) NftablesFirewall::uninstall();
+    auto setFilterAnchorEnabled = [useNftables](IpTablesFirewall::IPVersion ip, const QString &anchor, bool enabled)
+    {
+        IpTablesFirewall::setAnchorEnabled(ip, anchor, enabled && !useNftables);
+        if (useNftables) NftablesFirewall::setAnchorEnabled(ip, anchor, enabled);
+    };
 
-    IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("000.allowLoopback"), params.allowLoopback);
-    IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("100.blockAll"), params.blockAll);
-    IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("200.allowVPN"), params.allowVPN);
-    IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::IPv6, QStringLiteral("250.blockIPv6"), params.blockIPv6);
-    IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("290.allowDHCP"), params.allowDHCP);
-    IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("300.allowLAN"), params.allowLAN);
-    IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("310.blockDNS"), params.blockDNS);
-    IpTablesFirewall::updateDNSServers(params.dnsServers);
-    IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::IPv4, QStringLiteral("320.allowDNS"), params.blockDNS);
+    // Apply all of the anchor changes at once
+    IpTablesFirewall::beginBatch();
+    if (useNftables) NftablesFirewall::beginBatch();
+
+    setFilterAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("000.allowLoopback"), params.allowLoopback);
+    setFilterAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("100.blockAll"), params.blockAll);
+    setFilterAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("200.allowVPN"), params.allowVPN);
+    setFilterAnchorEnabled(IpTablesFirewall::IPv6, QStringLiteral("250.blockIPv6"), params.blockIPv6);
+    setFilterAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("290.allowDHCP"), params.allowDHCP);
+    setFilterAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("300.allowLAN"), params.allowLAN);
+    setFilterAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("310.blockDNS"), params.blockDNS);
+    // The DNS servers only matter when 320.allowDNS is enabled.  While it's
+    // disabled, leave the servers staged by prepareFirewallRules().
+    if (params.blockDNS)
+    {
+        IpTablesFirewall::updateDNSServers(params.dnsServers);
+        if (useNftables) NftablesFirewall::updateDNSServers(params.dnsServers);
+    }
+    setFilterAnchorEnabled(IpTablesFirewall::IPv4, QStringLiteral("320.allowDNS"), params.blockDNS);
 
     // block VpnOnly packets when the VPN is not connected
-    IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("340.blockVpnOnly"), !_state.vpnEnabled());
-    IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("350.allowHnsd"), params.allowHnsd && params.defaultRoute);
-    IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("350.cgAllowHnsd"), params.allowHnsd && !params.defaultRoute);
-    IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("400.allowPIA"), params.allowPIA);
+    setFilterAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("340.blockVpnOnly"), !_state.vpnEnabled());
+    setFilterAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("350.allowHnsd"), params.allowHnsd && params.defaultRoute);
+    setFilterAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("350.cgAllowHnsd"), params.allowHnsd && !params.defaultRoute);
+    setFilterAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("400.allowPIA"), params.allowPIA);
 
     // Update and apply our rules to ensure VPN packets are only accepted on the
     // tun interface, mitigates CVE-2019-14899: https://seclists.org/oss-sec/2019/q4/122
@@ -297,11 +458,43 @@ void PosixDaemon::applyFirewallRules(const FirewallParams& params)
                                        enableVpnTunOnly,
                                        IpTablesFirewall::kRawTable);
 
+    IpTablesFirewall::commitBatch();
+    if (useNftables) NftablesFirewall::commitBatch();
 #endif
 
     toggleSplitTunnel(params);
 }
 
+void PosixDaemon::prepareFirewallRules(const FirewallParams &current,
+                                       const FirewallParams &next)
+{
+    // Check the firewall now instead of during the transition
+#if defined(Q_OS_MACOS)
+    Q_UNUSED(current);
+    Q_UNUSED(next);
+    if (!PFFirewall::isInstalled()) PFFirewall::install();
+    PFFirewall::ensureRootAnchorPriority();
+    _firewallVerified = true;
+#elif defined(Q_OS_LINUX)
+    if (!IpTablesFirewall::isInstalled()) IpTablesFirewall::install();
+    IpTablesFirewall::ensureRootAnchorPriority();
+    _firewallVerified = true;
+
+    // 320.allowDNS has no effect while it's disabled, so its rules (or the
+    // nftables set) can be loaded with the servers for the connection ahead
+    // of time.  Enabling blockDNS/allowDNS is then only an anchor swap.
+    // (This does nothing if they're already staged.)
+    if (!current.blockDNS && next.blockDNS)
+    {
+        IpTablesFirewall::beginBatch();
+        IpTablesFirewall::updateDNSServers(next.dnsServers);
+        IpTablesFirewall::commitBatch();
+        if (_settings.linuxFirewallBackend() == QStringLiteral("nftables"))
+            NftablesFirewall::updateDNSServers(next.dnsServers);
+    }
+#endif
+}
+
 
 QJsonValue PosixDaemon::RPC_installKext()
 {
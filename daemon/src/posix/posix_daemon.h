@@ -24,11 +24,14 @@
 #pragma once
 
 #include "daemon.h"
+#include <QHash>
+#include <QPointer>
 
 #ifdef Q_OS_MAC
 #include "mac/kext_client.h"
 #endif
 
+class QProcess;
 class QSocketNotifier;
 
 class PosixDaemon : public Daemon
@@ -48,10 +51,23 @@ protected slots:
 
 protected:
     virtual void applyFirewallRules(const FirewallParams& params) override;
+    virtual void prepareFirewallRules(const FirewallParams &current,
+                                      const FirewallParams &next) override;
     virtual QJsonValue RPC_installKext() override;
     virtual void writePlatformDiagnostics(DiagnosticsFile &file) override;
+#ifdef Q_OS_LINUX
+    virtual void updateSplitTunnelBandwidth() override;
+#endif
 
 private:
+#ifdef Q_OS_LINUX
+    // Whether the OpenVPN executable supports data channel offload (checked
+    // once, the executable doesn't change while the daemon is running)
+    bool openvpnSupportsDco();
+    // Update DaemonState::splitTunnelBandwidth from a sample of the firewall
+    // counters
+    void applySplitTunnelCounters(const QHash<QString, quint64> &counters);
+#endif
     void toggleSplitTunnel(const FirewallParams &params);
     template <typename T>
     void prepareSplitTunnel()
@@ -84,9 +100,21 @@ private:
     bool _enableSplitTunnel;
     OriginalNetworkScan _splitTunnelNetScan;
 
+    // Set when prepareFirewallRules() has just checked that the firewall is
+    // installed with the right priority, so the next applyFirewallRules()
+    // (usually the transition to Connected) doesn't have to check again.
+    bool _firewallVerified;
+
 #ifdef Q_OS_MAC
     KextMonitor _kextMonitor;
 #endif
+#ifdef Q_OS_LINUX
+    nullable_t<bool> _openvpnSupportsDco;
+    // The firewall counter dump in progress, if any
+    QPointer<QProcess> _pCounterDump;
+    // Counter totals from the last sample, used to find the interval traffic
+    QHash<QString, quint64> _lastSplitTunnelCounters;
+#endif
 
 signals:
     void startSplitTunnel(const FirewallParams &params, QString tunnelDeviceName,
@@ -22,10 +22,14 @@
 #ifdef Q_OS_LINUX
 
 #include "posix_firewall_iptables.h"
+#include "linux/linux_cgroups.h"
+#include "linux/linux_routing.h"
 #include "path.h"
 #include "brand.h"
 
+#include <QFileInfo>
 #include <QProcess>
+#include <array>
 
 namespace
 {
@@ -40,6 +44,39 @@ namespace
     const QString kHnsdGroupName = BRAND_CODE "hnsd";
 
     QHash<QString, IpTablesFirewall::FilterCallbackFunc> anchorCallbacks;
+
+    // Routing rule sending packets tagged with packetTag to a split tunnel
+    // routing table.  Priority 100 is lower than local, but higher than
+    // main/default (0 is highest priority).
+    LinuxRouting::Rule splitTunnelRule(const QString &packetTag, const QString &routingTableName)
+    {
+        return {{}, packetTag.toUInt(nullptr, 0), routingTableName, 100, -1};
+    }
+
+    // Routing rule ensuring LAN traffic gets managed by the 'main' table.
+    // Without this even LAN traffic will get routed out the default gateway.
+    // Priority 99 takes precedence over split tunnel rules (which are in the
+    // 100-101 range).
+    LinuxRouting::Rule lanRoutesRule()
+    {
+        return {{}, 0, QStringLiteral("main"), 99, 1};
+    }
+
+    // Chains whose contents will be replaced by the current batch, indexed by
+    // IP version (IPv4 or IPv6), then table, then chain.  See
+    // IpTablesFirewall::beginBatch().
+    using BatchChains = QMap<QString, QStringList>;
+    std::array<QMap<QString, BatchChains>, 2> batchTables;
+    bool batchActive{false};
+
+    // Last state applied for each anchor, used to log changes.  Keys are
+    // "<table>:<anchor><ipStr>".
+    QHash<QString, bool> anchorStates;
+
+    // Last rules applied to each chain by a batch, indexed by IP version, then
+    // "<table>:<chain>".  Chains that haven't changed are left out of the next
+    // batch, so a reapply with no changes doesn't run iptables-restore at all.
+    std::array<QHash<QString, QStringList>, 2> appliedChains;
 }
 
 QString IpTablesFirewall::kRtableName = QStringLiteral("%1rt").arg(kAnchorName);
@@ -47,6 +84,10 @@ QString IpTablesFirewall::kVpnOnlyRtableName = QStringLiteral("%1Onlyrt").arg(kA
 QString IpTablesFirewall::kOutputChain = QStringLiteral("OUTPUT");
 QString IpTablesFirewall::kPostRoutingChain = QStringLiteral("POSTROUTING");
 QString IpTablesFirewall::kPreRoutingChain = QStringLiteral("PREROUTING");
+QString IpTablesFirewall::kInputChain = QStringLiteral("INPUT");
+QString IpTablesFirewall::kCountInChain = QStringLiteral("%1.countIn").arg(kAnchorName);
+QString IpTablesFirewall::kExcludedCounter = QStringLiteral("%1.excluded").arg(kAnchorName);
+QString IpTablesFirewall::kVpnOnlyCounter = QStringLiteral("%1.vpnOnly").arg(kAnchorName);
 QString IpTablesFirewall::kRootChain = QStringLiteral("%1.anchors").arg(kAnchorName);
 QString IpTablesFirewall::kFilterTable = QStringLiteral("filter");
 QString IpTablesFirewall::kNatTable = QStringLiteral("nat");
@@ -58,18 +99,6 @@ static QString getCommand(IpTablesFirewall::IPVersion ip)
     return ip == IpTablesFirewall::IPv6 ? QStringLiteral("ip6tables") : QStringLiteral("iptables");
 }
 
-int IpTablesFirewall::createChain(IpTablesFirewall::IPVersion ip, const QString& chain, const QString& tableName)
-{
-    if (ip == Both)
-    {
-        int result4 = createChain(IPv4, chain, tableName);
-        int result6 = createChain(IPv6, chain, tableName);
-        return result4 ? result4 : result6;
-    }
-    const QString cmd = getCommand(ip);
-    return execute(QStringLiteral("%1 -N %2 -t %3 || %1 -F %2 -t %3").arg(cmd, chain, tableName));
-}
-
 int IpTablesFirewall::deleteChain(IpTablesFirewall::IPVersion ip, const QString& chain, const QString& tableName)
 {
     if (ip == Both)
@@ -78,6 +107,7 @@ int IpTablesFirewall::deleteChain(IpTablesFirewall::IPVersion ip, const QString&
         int result6 = deleteChain(IPv6, chain, tableName);
         return result4 ? result4 : result6;
     }
+    appliedChains[ip].remove(tableName + ':' + chain);
     const QString cmd = getCommand(ip);
     return execute(QStringLiteral("if %1 -L %2 -n -t %3 > /dev/null 2> /dev/null ; then %1 -F %2 -t %3 && %1 -X %2 -t %3; fi").arg(cmd, chain, tableName));
 }
@@ -133,15 +163,14 @@ void IpTablesFirewall::installAnchor(IpTablesFirewall::IPVersion ip, const QStri
         return;
     }
 
-    const QString cmd = getCommand(ip);
     const QString anchorChain = QStringLiteral("%1.a.%2").arg(kAnchorName, anchor);
     const QString actualChain = QStringLiteral("%1.%2").arg(kAnchorName, anchor);
 
     // Start by defining a placeholder chain, which stays locked into place
     // in the root chain without being removed or recreated, ensuring the
     // intended precedence order.
-    createChain(ip, anchorChain, tableName);
-    linkChain(ip, anchorChain, kRootChain, false, tableName);
+    setChainRules(ip, anchorChain, {}, tableName);
+    appendChainRule(ip, kRootChain, QStringLiteral("-j %1").arg(anchorChain), tableName);
 
     if(enableFunc)
     {
@@ -156,9 +185,7 @@ void IpTablesFirewall::installAnchor(IpTablesFirewall::IPVersion ip, const QStri
 
     // Create the actual rule chain, which we'll insert or remove from the
     // placeholder anchor when needed.
-    createChain(ip, actualChain, tableName);
-    for (const QString& rule : rules)
-        execute(QStringLiteral("%1 -A %2 %3 -t %4").arg(cmd, actualChain, rule, tableName));
+    setChainRules(ip, actualChain, rules, tableName);
 }
 
 void IpTablesFirewall::uninstallAnchor(IpTablesFirewall::IPVersion ip, const QString& anchor, const QString& tableName)
@@ -195,17 +222,28 @@ void IpTablesFirewall::install()
     // Clean up any existing rules if they exist.
     uninstall();
 
+    // All of the chains are created with one iptables-restore (and one
+    // ip6tables-restore).
+    beginBatch();
+
     // Create a root filter chain to hold all our other anchors in order.
-    createChain(Both, kRootChain, kFilterTable);
+    setChainRules(Both, kRootChain, {}, kFilterTable);
 
     // Create a root raw chain
-    createChain(Both, kRootChain, kRawTable);
+    setChainRules(Both, kRootChain, {}, kRawTable);
 
     // Create a root NAT chain
-    createChain(Both, kRootChain, kNatTable);
+    setChainRules(Both, kRootChain, {}, kNatTable);
 
     // Create a root Mangle chain
-    createChain(Both, kRootChain, kMangleTable);
+    setChainRules(Both, kRootChain, {}, kMangleTable);
+
+    // Count received split tunnel traffic by the connection marks saved by
+    // 100.tagPkts.  These rules only count, they have no target.
+    setChainRules(Both, kCountInChain, {
+        QStringLiteral("-m connmark --mark %1/0xffff -m comment --comment %2.received").arg(kPacketTag, kExcludedCounter),
+        QStringLiteral("-m connmark --mark %1/0xffff -m comment --comment %2.received").arg(kVpnOnlyPacketTag, kVpnOnlyCounter),
+    }, kMangleTable);
 
     // Install our filter rulesets in each corresponding anchor chain.
     installAnchor(Both, QStringLiteral("000.allowLoopback"), {
@@ -224,12 +262,18 @@ void IpTablesFirewall::install()
         // Port 13038 is the handshake control port
         QStringLiteral("-m owner --gid-owner %1 -m cgroup --cgroup %2 -p tcp --match multiport --dports 53,13038 -j ACCEPT").arg(kHnsdGroupName, kVpnOnlyCGroupId),
         QStringLiteral("-m owner --gid-owner %1 -m cgroup --cgroup %2 -p udp --match multiport --dports 53,13038 -j ACCEPT").arg(kHnsdGroupName, kVpnOnlyCGroupId),
+        // With the cgroup v2 classifier, VPN-only sockets are identified by
+        // their mark (see LinuxCGroups).  With net_cls, 100.tagPkts applies the
+        // same mark to the packets matched above.
+        QStringLiteral("-m owner --gid-owner %1 -m mark --mark %2 -p tcp --match multiport --dports 53,13038 -j ACCEPT").arg(kHnsdGroupName, kVpnOnlyPacketTag),
+        QStringLiteral("-m owner --gid-owner %1 -m mark --mark %2 -p udp --match multiport --dports 53,13038 -j ACCEPT").arg(kHnsdGroupName, kVpnOnlyPacketTag),
         QStringLiteral("-m owner --gid-owner %1 -j REJECT").arg(kHnsdGroupName),
     });
 
     // block vpnOnly packets (these are only blocked when VPN is disconnected)
     installAnchor(Both, QStringLiteral("340.blockVpnOnly"), {
         QStringLiteral("-m cgroup --cgroup %1 -j REJECT").arg(kVpnOnlyCGroupId),
+        QStringLiteral("-m mark --mark %1 -j REJECT").arg(kVpnOnlyPacketTag),
     });
 
     installAnchor(IPv4, QStringLiteral("320.allowDNS"), {});
@@ -284,7 +328,14 @@ void IpTablesFirewall::install()
         QStringLiteral("-m cgroup --cgroup %1 -j MARK --set-mark %2").arg(kCGroupId, kPacketTag),
 
         // Inverse split tunnel
-        QStringLiteral("-m cgroup --cgroup %1 -j MARK --set-mark %2").arg(kVpnOnlyCGroupId, kVpnOnlyPacketTag)
+        QStringLiteral("-m cgroup --cgroup %1 -j MARK --set-mark %2").arg(kVpnOnlyCGroupId, kVpnOnlyPacketTag),
+
+        // Save the mark to the connection so replies can be counted (see
+        // kCountInChain).  With the cgroup v2 classifier, the sockets were
+        // already marked.  These rules also count the sent traffic.  Only the
+        // low bits are used, in case other software uses connection marks.
+        QStringLiteral("-m mark --mark %1 -m comment --comment %2.sent -j CONNMARK --set-mark %1/0xffff").arg(kPacketTag, kExcludedCounter),
+        QStringLiteral("-m mark --mark %1 -m comment --comment %2.sent -j CONNMARK --set-mark %1/0xffff").arg(kVpnOnlyPacketTag, kVpnOnlyCounter)
     }, kMangleTable, setupTrafficSplitting, teardownTrafficSplitting);
 
     // A rule to mitigate CVE-2019-14899 - drop packets addressed to the local
@@ -295,6 +346,7 @@ void IpTablesFirewall::install()
         QStringLiteral("-j ACCEPT")
     }, kRawTable);
 
+    commitBatch();
 
     // Insert our fitler root chain at the top of the OUTPUT chain.
     linkChain(Both, kRootChain, kOutputChain, true, kFilterTable);
@@ -305,12 +357,21 @@ void IpTablesFirewall::install()
     // Insert our Mangle root chain at the top of the OUTPUT chain.
     linkChain(Both, kRootChain, kOutputChain, true, kMangleTable);
 
+    // Count received split tunnel traffic.  This doesn't affect the packets,
+    // so it doesn't matter where it is in INPUT.
+    linkChain(Both, kCountInChain, kInputChain, false, kMangleTable);
+
     // Insert our Raw root chain at the top of the PREROUTING chain.
     linkChain(Both, kRootChain, kPreRoutingChain, true, kRawTable);
 }
 
 void IpTablesFirewall::uninstall()
 {
+    // All anchors are disabled (or removed) after install() or uninstall()
+    anchorStates.clear();
+    for(auto &chains : appliedChains)
+        chains.clear();
+
     // Filter chain
     unlinkChain(Both, kRootChain, kOutputChain, kFilterTable);
     deleteChain(Both, kRootChain, kFilterTable);
@@ -326,6 +387,8 @@ void IpTablesFirewall::uninstall()
     // Mangle chain
     unlinkChain(Both, kRootChain, kOutputChain, kMangleTable);
     deleteChain(Both, kRootChain, kMangleTable);
+    unlinkChain(Both, kCountInChain, kInputChain, kMangleTable);
+    deleteChain(Both, kCountInChain, kMangleTable);
 
     // Remove filter anchors
     uninstallAnchor(Both, QStringLiteral("000.allowLoopback"));
@@ -353,6 +416,23 @@ bool IpTablesFirewall::isInstalled()
     return execute(QStringLiteral("iptables -C %1 -j %2 2> /dev/null").arg(kOutputChain, kRootChain)) == 0;
 }
 
+void IpTablesFirewall::logAnchorState(IpTablesFirewall::IPVersion ip, const QString &anchor, bool enabled, const QString &tableName)
+{
+    const QString ipStr = ip == IPv6 ? QStringLiteral("(IPv6)") : QStringLiteral("(IPv4)");
+    const QString key = QStringLiteral("%1:%2%3").arg(tableName, anchor, ipStr);
+    auto itState = anchorStates.find(key);
+    if(itState == anchorStates.end())
+    {
+        qInfo().noquote() << anchor + ipStr << (enabled ? "-> ON" : "-> OFF");
+        anchorStates.insert(key, enabled);
+    }
+    else if(itState.value() != enabled)
+    {
+        qInfo().noquote() << anchor + ipStr << (enabled ? "OFF -> ON" : "ON -> OFF");
+        itState.value() = enabled;
+    }
+}
+
 void IpTablesFirewall::enableAnchor(IpTablesFirewall::IPVersion ip, const QString &anchor, const QString& tableName)
 {
     if (ip == Both)
@@ -361,30 +441,16 @@ void IpTablesFirewall::enableAnchor(IpTablesFirewall::IPVersion ip, const QStrin
         enableAnchor(IPv6, anchor, tableName);
         return;
     }
-    const QString cmd = getCommand(ip);
-    const QString ipStr = ip == IPv6 ? QStringLiteral("(IPv6)") : QStringLiteral("(IPv4)");
 
-    execute(QStringLiteral("if %1 -C %5.a.%2 -j %5.%2 -t %4 2> /dev/null ; then echo '%2%3: ON' ; else echo '%2%3: OFF -> ON' ; %1 -A %5.a.%2 -j %5.%2 -t %4; fi").arg(cmd, anchor, ipStr, tableName, kAnchorName));
+    logAnchorState(ip, anchor, true, tableName);
+    setChainRules(ip, QStringLiteral("%1.a.%2").arg(kAnchorName, anchor),
+                  {QStringLiteral("-j %1.%2").arg(kAnchorName, anchor)},
+                  tableName);
 }
 
 void IpTablesFirewall::replaceAnchor(IpTablesFirewall::IPVersion ip, const QString &anchor, const QStringList &newRules, const QString& tableName)
 {
-    if (ip == Both)
-    {
-        replaceAnchor(IPv4, anchor, newRules, tableName);
-        replaceAnchor(IPv6, anchor, newRules, tableName);
-        return;
-    }
-    const QString cmd = getCommand(ip);
-    const QString ipStr = ip == IPv6 ? QStringLiteral("(IPv6)") : QStringLiteral("(IPv4)");
-
-    execute(QStringLiteral("%1 -F %2.%3 -t %4").arg(cmd, kAnchorName, anchor, tableName));
-    for(const auto &rule : newRules)
-    {
-        execute(QStringLiteral("%1 -A %2.%3 %4 -t %5").arg(cmd, kAnchorName, anchor, rule, tableName));
-    }
-
-    //execute(QStringLiteral("%1 -R %7.%2 1 %3 -t %4 ; echo 'Replaced rule %7.%2 %5 with %6'").arg(cmd, anchor, newRule, tableName, ipStr, newRule, kAnchorName));
+    setChainRules(ip, QStringLiteral("%1.%2").arg(kAnchorName, anchor), newRules, tableName);
 }
 
 void IpTablesFirewall::disableAnchor(IpTablesFirewall::IPVersion ip, const QString &anchor, const QString& tableName)
@@ -395,9 +461,9 @@ void IpTablesFirewall::disableAnchor(IpTablesFirewall::IPVersion ip, const QStri
         disableAnchor(IPv6, anchor, tableName);
         return;
     }
-    const QString cmd = getCommand(ip);
-    const QString ipStr = ip == IPv6 ? QStringLiteral("(IPv6)") : QStringLiteral("(IPv4)");
-    execute(QStringLiteral("if ! %1 -C %5.a.%2 -j %5.%2 -t %4 2> /dev/null ; then echo '%2%3: OFF' ; else echo '%2%3: ON -> OFF' ; %1 -F %5.a.%2 -t %4; fi").arg(cmd, anchor, ipStr, tableName, kAnchorName));
+
+    logAnchorState(ip, anchor, false, tableName);
+    setChainRules(ip, QStringLiteral("%1.a.%2").arg(kAnchorName, anchor), {}, tableName);
 }
 
 bool IpTablesFirewall::isAnchorEnabled(IpTablesFirewall::IPVersion ip, const QString &anchor, const QString& tableName)
@@ -424,13 +490,139 @@ void IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::IPVersion ip, const QS
 
 void IpTablesFirewall::updateDNSServers(const QStringList& servers)
 {
-    static QStringList existingServers {};
-    if (servers == existingServers)
+    // This is always specified; commitBatch() skips it if the servers haven't
+    // changed, and it's restored if the firewall was reinstalled.
+    replaceAnchor(IPv4, QStringLiteral("320.allowDNS"), getDNSRules(servers), kFilterTable);
+}
+
+void IpTablesFirewall::beginBatch()
+{
+    Q_ASSERT(!batchActive); // Batches can't be nested
+    batchActive = true;
+}
+
+int IpTablesFirewall::commitBatch()
+{
+    Q_ASSERT(batchActive);
+    batchActive = false;
+
+    int result = 0;
+    for(IPVersion ip : {IPv4, IPv6})
+    {
+        auto &tables = batchTables[ip];
+        auto &applied = appliedChains[ip];
+
+        // Leave out chains that already have the rules specified
+        for(auto itTable = tables.begin(); itTable != tables.end(); )
+        {
+            for(auto itChain = itTable->begin(); itChain != itTable->end(); )
+            {
+                auto itApplied = applied.find(itTable.key() + ':' + itChain.key());
+                if(itApplied != applied.end() && itApplied.value() == itChain.value())
+                    itChain = itTable->erase(itChain);
+                else
+                    ++itChain;
+            }
+            if(itTable->isEmpty())
+                itTable = tables.erase(itTable);
+            else
+                ++itTable;
+        }
+
+        if(tables.isEmpty())
+            continue;
+
+        // Declaring a chain creates it, or flushes it if it exists
+        // (with --noflush, other chains are not affected).  Declare all chains
+        // before any rules, so rules can jump to chains created in this batch.
+        QByteArray input;
+        for(auto itTable = tables.begin(); itTable != tables.end(); ++itTable)
+        {
+            input += "*" + itTable.key().toLatin1() + "\n";
+            for(auto itChain = itTable->begin(); itChain != itTable->end(); ++itChain)
+                input += ":" + itChain.key().toLatin1() + " - [0:0]\n";
+            for(auto itChain = itTable->begin(); itChain != itTable->end(); ++itChain)
+            {
+                for(const auto &rule : itChain.value())
+                    input += "-A " + itChain.key().toLatin1() + " " + rule.toLatin1() + "\n";
+            }
+            input += "COMMIT\n";
+        }
+
+        int ipResult = restore(ip, input);
+        // If the restore failed, none of the changes were applied (it's
+        // atomic), but the prior contents aren't known for certain either.
+        for(auto itTable = tables.begin(); itTable != tables.end(); ++itTable)
+        {
+            for(auto itChain = itTable->begin(); itChain != itTable->end(); ++itChain)
+            {
+                const QString key = itTable.key() + ':' + itChain.key();
+                if(ipResult == 0)
+                    applied.insert(key, itChain.value());
+                else
+                    applied.remove(key);
+            }
+        }
+        tables.clear();
+
+        if(!result)
+            result = ipResult;
+    }
+    return result;
+}
+
+void IpTablesFirewall::setChainRules(IpTablesFirewall::IPVersion ip, const QString &chain, const QStringList &rules, const QString &tableName)
+{
+    if (ip == Both)
+    {
+        setChainRules(IPv4, chain, rules, tableName);
+        setChainRules(IPv6, chain, rules, tableName);
         return;
-    existingServers = servers;
-    execute(QStringLiteral("iptables -F %1.320.allowDNS").arg(kAnchorName));
-    for (const QString& rule : getDNSRules(servers))
-        execute(QStringLiteral("iptables -A %1.320.allowDNS %2").arg(kAnchorName, rule));
+    }
+
+    // Outside of a batch, apply this chain by itself
+    bool ownBatch = !batchActive;
+    if(ownBatch)
+        beginBatch();
+    batchTables[ip][tableName][chain] = rules;
+    if(ownBatch)
+        commitBatch();
+}
+
+void IpTablesFirewall::appendChainRule(IpTablesFirewall::IPVersion ip, const QString &chain, const QString &rule, const QString &tableName)
+{
+    if (ip == Both)
+    {
+        appendChainRule(IPv4, chain, rule, tableName);
+        appendChainRule(IPv6, chain, rule, tableName);
+        return;
+    }
+
+    Q_ASSERT(batchActive);  // Only used while building a batch
+    batchTables[ip][tableName][chain].append(rule);
+}
+
+int IpTablesFirewall::restore(IpTablesFirewall::IPVersion ip, const QByteArray &input)
+{
+    static QLoggingCategory stderrCategory("iptables.stderr");
+
+    const QString cmd = ip == IPv6 ? QStringLiteral("ip6tables-restore") : QStringLiteral("iptables-restore");
+    QProcess p;
+    p.start(cmd, {QStringLiteral("--noflush")});
+    p.write(input);
+    p.closeWriteChannel();
+    int exitCode = waitForExitCode(p);
+    auto err = p.readAllStandardError().trimmed();
+    if (exitCode != 0 || !err.isEmpty())
+    {
+        // The whole batch is rejected if any part fails; trace the input to
+        // show what it was
+        qWarning().noquote().nospace() << "(" << exitCode << ") $ " << cmd
+            << " --noflush\n" << input.trimmed();
+    }
+    if (!err.isEmpty())
+        qCWarning(stderrCategory).noquote() << err;
+    return exitCode;
 }
 
 int IpTablesFirewall::execute(const QString &command, bool ignoreErrors)
@@ -455,45 +647,100 @@ int IpTablesFirewall::execute(const QString &command, bool ignoreErrors)
     return exitCode;
 }
 
+QString IpTablesFirewall::counterDumpCommand()
+{
+    return QStringLiteral("iptables-save -c -t %1 ; ip6tables-save -c -t %1").arg(kMangleTable);
+}
+
+QHash<QString, quint64> IpTablesFirewall::parseCounters(const QByteArray &dump)
+{
+    // Rules with counters look like:
+    //   [<packets>:<bytes>] -A <chain> ... -m comment --comment "<name>" ...
+    // (older iptables-save versions don't quote the comment)
+    static const QByteArray commentArg{"--comment "};
+    QHash<QString, quint64> counters;
+    for(const QByteArray &line : dump.split('\n'))
+    {
+        if(!line.startsWith('['))
+            continue;
+        int colon = line.indexOf(':');
+        int close = line.indexOf(']');
+        int commentPos = line.indexOf(commentArg);
+        if(colon < 0 || close < colon || commentPos < 0)
+            continue;
+
+        bool ok = false;
+        quint64 bytes = line.mid(colon + 1, close - colon - 1).toULongLong(&ok);
+        if(!ok)
+            continue;
+
+        int nameStart = commentPos + commentArg.size();
+        int nameEnd = line.indexOf(' ', nameStart);
+        QByteArray name = line.mid(nameStart, nameEnd < 0 ? -1 : nameEnd - nameStart);
+        if(name.startsWith('"') && name.endsWith('"') && name.size() >= 2)
+            name = name.mid(1, name.size() - 2);
+        counters[QString::fromLatin1(name)] += bytes;
+    }
+    return counters;
+}
+
 void IpTablesFirewall::setupCgroup(const Path &cGroupDir, QString cGroupId, QString packetTag, QString routingTableName)
 {
     qInfo() << "Should be setting up cgroups in" << cGroupDir << "for traffic splitting";
     execute(QStringLiteral("if [ ! -d %1 ] ; then mkdir %1 ; sleep 0.1 ; echo %2 > %1/net_cls.classid ; fi").arg(cGroupDir).arg(cGroupId));
-    // Set a rule with priority 100 (lower priority than local but higher than main/default, 0 is highest priority)
-    execute(QStringLiteral("if ! ip rule list | grep -q %1 ; then ip rule add from all fwmark %1 lookup %2 pri 100 ; fi").arg(packetTag, routingTableName));
+    LinuxRouting::ensureRule(splitTunnelRule(packetTag, routingTableName));
+}
+
+void IpTablesFirewall::setupCgroup2(const QString &cGroupDir, QString packetTag, QString routingTableName)
+{
+    qInfo() << "Setting up cgroup2 classifier in" << cGroupDir << "for traffic splitting";
+    LinuxCGroups::attachMarkProgram(cGroupDir, packetTag.toUInt(nullptr, 0));
+    LinuxRouting::ensureRule(splitTunnelRule(packetTag, routingTableName));
 }
 
 void IpTablesFirewall::teardownCgroup(QString packetTag, QString routingTableName)
 {
     qInfo() << "Tearing down cgroup and routing rules";
-    execute(QStringLiteral("if ip rule list | grep -q %1; then ip rule del from all fwmark %1 lookup %2 2> /dev/null ; fi").arg(packetTag, routingTableName));
-    execute(QStringLiteral("ip route flush table %1").arg(routingTableName));
-    execute(QStringLiteral("ip route flush cache"));
+    LinuxRouting::removeRule(splitTunnelRule(packetTag, routingTableName));
+    LinuxRouting::flushTable(routingTableName);
+    LinuxRouting::flushRouteCache();
 }
 
 void IpTablesFirewall::setupTrafficSplitting()
 {
-    auto cGroupExclusionsDir = Path::VpnExclusionsFile.parent();
-    auto cGroupVpnOnlyDir = Path::VpnOnlyFile.parent();
+    if(LinuxCGroups::useCGroup2())
+    {
+        // Sockets are marked by the cgroups' programs; just add the routing
+        // rules
+        setupCgroup2(QFileInfo{LinuxCGroups::exclusionsFile()}.path(), kPacketTag, kRtableName);
+        setupCgroup2(QFileInfo{LinuxCGroups::vpnOnlyFile()}.path(), kVpnOnlyPacketTag, kVpnOnlyRtableName);
+    }
+    else
+    {
+        auto cGroupExclusionsDir = Path::VpnExclusionsFile.parent();
+        auto cGroupVpnOnlyDir = Path::VpnOnlyFile.parent();
 
-    // Split tunnel (exclusions)
-    setupCgroup(cGroupExclusionsDir, kCGroupId, kPacketTag, kRtableName);
+        // Split tunnel (exclusions)
+        setupCgroup(cGroupExclusionsDir, kCGroupId, kPacketTag, kRtableName);
 
-    // Inverse split tunnel (vpn only)
-    setupCgroup(cGroupVpnOnlyDir, kVpnOnlyCGroupId, kVpnOnlyPacketTag, kVpnOnlyRtableName);
+        // Inverse split tunnel (vpn only)
+        setupCgroup(cGroupVpnOnlyDir, kVpnOnlyCGroupId, kVpnOnlyPacketTag, kVpnOnlyRtableName);
+    }
 
-    // Ensure LAN traffic gets managed by the 'main' table. Without this even LAN traffic
-    // will get routed out the default gateway. Set priority to 99 so it takes precedence over
-    // split tunnel rules (which are in the 100-101 range).
-    execute(QStringLiteral("ip rule add lookup main suppress_prefixlength 1 prio 99"));
+    LinuxRouting::ensureRule(lanRoutesRule());
 }
 
 void IpTablesFirewall::teardownTrafficSplitting()
 {
+    if(LinuxCGroups::useCGroup2())
+    {
+        LinuxCGroups::detachMarkProgram(QFileInfo{LinuxCGroups::exclusionsFile()}.path());
+        LinuxCGroups::detachMarkProgram(QFileInfo{LinuxCGroups::vpnOnlyFile()}.path());
+    }
     teardownCgroup(kPacketTag, kRtableName);
     teardownCgroup(kVpnOnlyPacketTag, kVpnOnlyRtableName);
 
-    execute(QStringLiteral("ip rule del lookup main suppress_prefixlength 1 prio 99"));
+    LinuxRouting::removeRule(lanRoutesRule());
 }
 
 #endif
@@ -25,6 +25,7 @@
 
 #ifdef Q_OS_LINUX
 
+#include <QHash>
 #include <QString>
 #include <QStringList>
 
@@ -38,7 +39,6 @@ public:
 public:
     using FilterCallbackFunc = std::function<void()>;
 private:
-    static int createChain(IPVersion ip, const QString& chain, const QString& tableName = kFilterTable);
     static int deleteChain(IPVersion ip, const QString& chain, const QString& tableName = kFilterTable);
     static int linkChain(IPVersion ip, const QString& chain, const QString& parent, bool mustBeFirst = false, const QString& tableName = kFilterTable);
     static int unlinkChain(IPVersion ip, const QString& chain, const QString& parent, const QString& tableName = kFilterTable);
@@ -48,11 +48,24 @@ private:
     static void setupTrafficSplitting();
     static void teardownTrafficSplitting();
     static void setupCgroup(const Path &cGroupDir, QString cGroupId, QString packetTag, QString routingTableName);
+    static void setupCgroup2(const QString &cGroupDir, QString packetTag, QString routingTableName);
     static void teardownCgroup(QString packetTag, QString routingTableName);
     static int execute(const QString& command, bool ignoreErrors = false);
+    // Replace the rules in a chain, creating it if needed.  This is applied
+    // by commitBatch() if a batch is in progress, otherwise it's applied
+    // immediately.
+    static void setChainRules(IPVersion ip, const QString& chain, const QStringList& rules, const QString& tableName = kFilterTable);
+    // Append a rule to a chain in the current batch.  If the chain wasn't
+    // already in the batch, its existing rules are replaced.
+    static void appendChainRule(IPVersion ip, const QString& chain, const QString& rule, const QString& tableName = kFilterTable);
+    // Apply a ruleset with iptables-restore/ip6tables-restore --noflush
+    static int restore(IPVersion ip, const QByteArray& input);
+    static void logAnchorState(IPVersion ip, const QString& anchor, bool enabled, const QString& tableName);
 private:
     // Chain names
     static QString kOutputChain, kRootChain, kPostRoutingChain, kPreRoutingChain;
+    // Mangle chain linked to INPUT that counts received split tunnel traffic
+    static QString kInputChain, kCountInChain;
 
 public:
     static void install();
@@ -65,6 +78,28 @@ public:
     static void setAnchorEnabled(IPVersion ip, const QString& anchor, bool enabled, const QString& tableName = kFilterTable);
     static void replaceAnchor(IpTablesFirewall::IPVersion ip, const QString &anchor, const QStringList &newRules, const QString& tableName);
     static void updateDNSServers(const QStringList& servers);
+
+    // Batch the anchor changes made until commitBatch() (enabling, disabling,
+    // or replacing anchors, and updating DNS servers).  The batch is applied
+    // atomically with one iptables-restore and one ip6tables-restore, instead
+    // of running iptables for each change.  Batches can't be nested.
+    static void beginBatch();
+    // Apply the batch.  Returns 0 if successful, or the first nonzero exit
+    // code otherwise.
+    static int commitBatch();
+
+    // Split tunnel traffic counters.  Packets sent by split tunnel apps are
+    // counted by the rules that save their mark to the connection, and
+    // received packets are counted by that connection mark.  The rules are
+    // identified by these names, with ".sent" and ".received" suffixes.
+    static QString kExcludedCounter, kVpnOnlyCounter;
+    // Shell command that dumps the mangle tables with counters (both IPv4
+    // and IPv6).  This is run asynchronously by the caller, so sampling the
+    // counters doesn't block.
+    static QString counterDumpCommand();
+    // Parse the output of counterDumpCommand() - returns the total bytes
+    // counted by each named rule, summed over IPv4 and IPv6.
+    static QHash<QString, quint64> parseCounters(const QByteArray &dump);
 };
 
 #endif
@@ -0,0 +1,371 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("posix/posix_firewall_nftables.cpp")
+
+#ifdef Q_OS_LINUX
+
+#include "posix_firewall_nftables.h"
+#include "brand.h"
+
+#include <QHostAddress>
+#include <QProcess>
+#include <QSet>
+#include <vector>
+
+namespace
+{
+    const QString kTableName{BRAND_CODE "vpn"};
+    const QString kDnsSetName{QStringLiteral("dnsServers")};
+    const QString kVpnOnlyCGroupId{"0x568"};
+    const QString kVpnOnlyPacketTag{"0x3212"};
+    const QString kVpnGroupName = BRAND_CODE "vpn";
+    const QString kHnsdGroupName = BRAND_CODE "hnsd";
+
+    struct Anchor
+    {
+        IpTablesFirewall::IPVersion ip;
+        QString name;
+        QStringList rules;
+    };
+
+    // The filter anchors, in precedence order.  These are the same as
+    // IpTablesFirewall's filter anchors, in nft syntax.
+    const std::vector<Anchor> &filterAnchors()
+    {
+        using IPVersion = IpTablesFirewall::IPVersion;
+        static const std::vector<Anchor> anchors
+        {
+            {IPVersion::Both, QStringLiteral("000.allowLoopback"), {
+                QStringLiteral("oifname \"lo*\" accept"),
+            }},
+            {IPVersion::Both, QStringLiteral("400.allowPIA"), {
+                QStringLiteral("meta skgid %1 accept").arg(kVpnGroupName),
+            }},
+            {IPVersion::Both, QStringLiteral("350.allowHnsd"), {
+                // Port 13038 is the handshake control port
+                QStringLiteral("meta skgid %1 oifname \"tun*\" tcp dport { 53, 13038 } accept").arg(kHnsdGroupName),
+                QStringLiteral("meta skgid %1 oifname \"tun*\" udp dport { 53, 13038 } accept").arg(kHnsdGroupName),
+                QStringLiteral("meta skgid %1 reject").arg(kHnsdGroupName),
+            }},
+            {IPVersion::Both, QStringLiteral("350.cgAllowHnsd"), {
+                QStringLiteral("meta skgid %1 meta cgroup %2 tcp dport { 53, 13038 } accept").arg(kHnsdGroupName, kVpnOnlyCGroupId),
+                QStringLiteral("meta skgid %1 meta cgroup %2 udp dport { 53, 13038 } accept").arg(kHnsdGroupName, kVpnOnlyCGroupId),
+                QStringLiteral("meta skgid %1 meta mark %2 tcp dport { 53, 13038 } accept").arg(kHnsdGroupName, kVpnOnlyPacketTag),
+                QStringLiteral("meta skgid %1 meta mark %2 udp dport { 53, 13038 } accept").arg(kHnsdGroupName, kVpnOnlyPacketTag),
+                QStringLiteral("meta skgid %1 reject").arg(kHnsdGroupName),
+            }},
+            {IPVersion::Both, QStringLiteral("340.blockVpnOnly"), {
+                QStringLiteral("meta cgroup %1 reject").arg(kVpnOnlyCGroupId),
+                QStringLiteral("meta mark %1 reject").arg(kVpnOnlyPacketTag),
+            }},
+            {IPVersion::IPv4, QStringLiteral("320.allowDNS"), {
+                QStringLiteral("oifname \"tun*\" ip daddr @%1 udp dport 53 accept").arg(kDnsSetName),
+                QStringLiteral("oifname \"tun*\" ip daddr @%1 tcp dport 53 accept").arg(kDnsSetName),
+            }},
+            {IPVersion::Both, QStringLiteral("310.blockDNS"), {
+                QStringLiteral("udp dport 53 reject"),
+                QStringLiteral("tcp dport 53 reject"),
+            }},
+            {IPVersion::IPv4, QStringLiteral("300.allowLAN"), {
+                QStringLiteral("ip daddr { 10.0.0.0/8, 169.254.0.0/16, 172.16.0.0/12, 192.168.0.0/16, 224.0.0.0/4, 255.255.255.255 } accept"),
+            }},
+            {IPVersion::IPv6, QStringLiteral("300.allowLAN"), {
+                QStringLiteral("ip6 daddr { fc00::/7, fe80::/10, ff00::/8 } accept"),
+            }},
+            {IPVersion::IPv4, QStringLiteral("290.allowDHCP"), {
+                QStringLiteral("ip daddr 255.255.255.255 udp sport 68 udp dport 67 accept"),
+            }},
+            {IPVersion::IPv6, QStringLiteral("290.allowDHCP"), {
+                QStringLiteral("ip6 daddr ff00::/8 udp sport 546 udp dport 547 accept"),
+            }},
+            {IPVersion::IPv6, QStringLiteral("250.blockIPv6"), {
+                QStringLiteral("oifname != \"lo*\" reject"),
+            }},
+            {IPVersion::Both, QStringLiteral("200.allowVPN"), {
+                QStringLiteral("oifname \"tun*\" accept"),
+            }},
+            {IPVersion::Both, QStringLiteral("100.blockAll"), {
+                QStringLiteral("reject"),
+            }},
+        };
+        return anchors;
+    }
+
+    bool appliesTo(const Anchor &anchor, IpTablesFirewall::IPVersion ip)
+    {
+        return anchor.ip == IpTablesFirewall::Both || anchor.ip == ip;
+    }
+
+    QString family(IpTablesFirewall::IPVersion ip)
+    {
+        return ip == IpTablesFirewall::IPv6 ? QStringLiteral("ip6") : QStringLiteral("ip");
+    }
+
+    // nft identifiers can't start with a digit, and "." is the anchor
+    // separator in IpTablesFirewall, so the chain names are prefixed with
+    // "a_" (placeholder) or "r_" (rules).
+    QString chainName(const QString &prefix, const QString &anchor)
+    {
+        return prefix + QString{anchor}.replace('.', '_');
+    }
+
+    QString anchorKey(IpTablesFirewall::IPVersion ip, const QString &anchor)
+    {
+        return family(ip) + QLatin1Char(' ') + anchor;
+    }
+
+    bool installed{false};
+    bool batchActive{false};
+    // Anchors that should be enabled / are enabled, keyed by anchorKey()
+    QSet<QString> desiredAnchors, appliedAnchors;
+    QStringList desiredDnsServers, appliedDnsServers;
+}
+
+QString NftablesFirewall::buildInstallScript()
+{
+    QString script;
+    for(auto ip : {IpTablesFirewall::IPv4, IpTablesFirewall::IPv6})
+    {
+        const QString tableFamily = family(ip);
+        // Adding the table first ensures the delete succeeds if it didn't
+        // exist
+        script += QStringLiteral("add table %1 %2\n").arg(tableFamily, kTableName);
+        script += QStringLiteral("delete table %1 %2\n").arg(tableFamily, kTableName);
+        script += QStringLiteral("table %1 %2 {\n").arg(tableFamily, kTableName);
+        if(ip == IpTablesFirewall::IPv4)
+            script += QStringLiteral("  set %1 { type ipv4_addr; }\n").arg(kDnsSetName);
+
+        QString output;
+        for(const auto &anchor : filterAnchors())
+        {
+            if(!appliesTo(anchor, ip))
+                continue;
+            const QString rulesChain = chainName(QStringLiteral("r_"), anchor.name);
+            const QString anchorChain = chainName(QStringLiteral("a_"), anchor.name);
+            script += QStringLiteral("  chain %1 {\n").arg(rulesChain);
+            for(const auto &rule : anchor.rules)
+                script += QStringLiteral("    %1\n").arg(rule);
+            script += QStringLiteral("  }\n");
+            // The placeholder is empty until the anchor is enabled
+            script += QStringLiteral("  chain %1 {\n  }\n").arg(anchorChain);
+            output += QStringLiteral("    jump %1\n").arg(anchorChain);
+        }
+
+        // Use a priority just before iptables' filter chains, so these rules
+        // take precedence like IpTablesFirewall's root anchor does at the top
+        // of OUTPUT.
+        script += QStringLiteral("  chain output {\n"
+                                 "    type filter hook output priority -1; policy accept;\n");
+        script += output;
+        script += QStringLiteral("  }\n}\n");
+    }
+    return script;
+}
+
+void NftablesFirewall::install()
+{
+    qInfo() << "Installing nftables firewall";
+    installed = runScript(buildInstallScript()) == 0;
+    // All anchors are disabled and the DNS set is empty in the new tables
+    appliedAnchors.clear();
+    appliedDnsServers.clear();
+}
+
+void NftablesFirewall::uninstall()
+{
+    qInfo() << "Uninstalling nftables firewall";
+    QString script;
+    for(auto ip : {IpTablesFirewall::IPv4, IpTablesFirewall::IPv6})
+    {
+        script += QStringLiteral("add table %1 %2\n").arg(family(ip), kTableName);
+        script += QStringLiteral("delete table %1 %2\n").arg(family(ip), kTableName);
+    }
+    runScript(script);
+    installed = false;
+    appliedAnchors.clear();
+    desiredAnchors.clear();
+    appliedDnsServers.clear();
+    desiredDnsServers.clear();
+}
+
+bool NftablesFirewall::isInstalled()
+{
+    return installed;
+}
+
+void NftablesFirewall::setAnchorEnabled(IPVersion ip, const QString &anchor, bool enabled)
+{
+    if(ip == IpTablesFirewall::Both)
+    {
+        setAnchorEnabled(IpTablesFirewall::IPv4, anchor, enabled);
+        setAnchorEnabled(IpTablesFirewall::IPv6, anchor, enabled);
+        return;
+    }
+
+    bool ownBatch = !batchActive;
+    if(ownBatch)
+        beginBatch();
+    if(enabled)
+        desiredAnchors.insert(anchorKey(ip, anchor));
+    else
+        desiredAnchors.remove(anchorKey(ip, anchor));
+    if(ownBatch)
+        commitBatch();
+}
+
+void NftablesFirewall::updateDNSServers(const QStringList &servers)
+{
+    bool ownBatch = !batchActive;
+    if(ownBatch)
+        beginBatch();
+    // These are written into the nft script, so only accept valid IPv4
+    // addresses.
+    desiredDnsServers.clear();
+    for(const auto &server : servers)
+    {
+        QHostAddress address;
+        if(!address.setAddress(server) ||
+           address.protocol() != QAbstractSocket::NetworkLayerProtocol::IPv4Protocol)
+        {
+            qWarning() << "Ignoring invalid DNS server address" << server;
+            continue;
+        }
+        if(!desiredDnsServers.contains(address.toString()))
+            desiredDnsServers.push_back(address.toString());
+    }
+    if(ownBatch)
+        commitBatch();
+}
+
+void NftablesFirewall::beginBatch()
+{
+    Q_ASSERT(!batchActive); // Batches can't be nested
+    batchActive = true;
+}
+
+QString NftablesFirewall::buildChanges()
+{
+    QString script;
+    for(auto ip : {IpTablesFirewall::IPv4, IpTablesFirewall::IPv6})
+    {
+        const QString ipStr = ip == IpTablesFirewall::IPv6 ? QStringLiteral("(IPv6)") : QStringLiteral("(IPv4)");
+        for(const auto &anchor : filterAnchors())
+        {
+            // Both IPv4 and IPv6 variants of some anchors are listed; just
+            // check the one for this IP version
+            if(!appliesTo(anchor, ip))
+                continue;
+            const QString key = anchorKey(ip, anchor.name);
+            bool enable = desiredAnchors.contains(key);
+            if(enable == appliedAnchors.contains(key))
+                continue;
+
+            qInfo().noquote() << anchor.name + ipStr << (enable ? "OFF -> ON" : "ON -> OFF");
+            const QString anchorChain = chainName(QStringLiteral("a_"), anchor.name);
+            script += QStringLiteral("flush chain %1 %2 %3\n")
+                .arg(family(ip), kTableName, anchorChain);
+            if(enable)
+            {
+                script += QStringLiteral("add rule %1 %2 %3 jump %4\n")
+                    .arg(family(ip), kTableName, anchorChain,
+                         chainName(QStringLiteral("r_"), anchor.name));
+            }
+        }
+    }
+
+    // Update the DNS set elements that changed
+    for(const auto &server : appliedDnsServers)
+    {
+        if(!desiredDnsServers.contains(server))
+        {
+            script += QStringLiteral("delete element ip %1 %2 { %3 }\n")
+                .arg(kTableName, kDnsSetName, server);
+        }
+    }
+    for(const auto &server : desiredDnsServers)
+    {
+        if(!appliedDnsServers.contains(server))
+        {
+            script += QStringLiteral("add element ip %1 %2 { %3 }\n")
+                .arg(kTableName, kDnsSetName, server);
+        }
+    }
+
+    return script;
+}
+
+int NftablesFirewall::commitBatch()
+{
+    Q_ASSERT(batchActive);
+    batchActive = false;
+
+    if(!installed)
+    {
+        install();
+        if(!installed)
+            return -1;
+    }
+
+    QString changes = buildChanges();
+    if(changes.isEmpty())
+        return 0;
+
+    int result = runScript(changes);
+    if(result != 0)
+    {
+        // The tables may have been removed or modified by something else.
+        // Reinstall them and apply the whole desired state.
+        qWarning() << "Unable to apply nftables changes, reinstalling firewall";
+        install();
+        if(!installed)
+            return -1;
+        changes = buildChanges();
+        result = changes.isEmpty() ? 0 : runScript(changes);
+    }
+
+    if(result == 0)
+    {
+        appliedAnchors = desiredAnchors;
+        appliedDnsServers = desiredDnsServers;
+    }
+    return result;
+}
+
+int NftablesFirewall::runScript(const QString &script)
+{
+    static QLoggingCategory stderrCategory("nftables.stderr");
+
+    QProcess p;
+    p.start(QStringLiteral("nft"), {QStringLiteral("-f"), QStringLiteral("-")});
+    p.write(script.toLatin1());
+    p.closeWriteChannel();
+    int exitCode = waitForExitCode(p);
+    auto err = p.readAllStandardError().trimmed();
+    if(exitCode != 0 || !err.isEmpty())
+    {
+        qWarning().noquote().nospace() << "(" << exitCode << ") $ nft -f -\n"
+            << script.trimmed();
+    }
+    if(!err.isEmpty())
+        qCWarning(stderrCategory).noquote() << err;
+    return exitCode;
+}
+
+#endif
@@ -0,0 +1,79 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("posix/posix_firewall_nftables.h")
+
+#ifndef POSIX_FIREWALL_NFTABLES_H
+#define POSIX_FIREWALL_NFTABLES_H
+#pragma once
+
+#ifdef Q_OS_LINUX
+
+#include "posix_firewall_iptables.h"
+#include <QString>
+#include <QStringList>
+
+// NftablesFirewall implements the filter anchors of IpTablesFirewall (the
+// killswitch rules) as native nftables tables, one for IPv4 and one for IPv6.
+// It's used instead of IpTablesFirewall's filter anchors when the
+// linuxFirewallBackend setting is "nftables"; IpTablesFirewall still provides
+// the NAT, mangle, and raw anchors used for split tunnel.
+//
+// The desired state is tracked in memory, so applying the same state again
+// does nothing.  Changes are applied incrementally with one "nft -f" per
+// batch - enabling an anchor only replaces the jump in its placeholder chain,
+// and DNS servers are elements of an nftables set that are added or removed
+// individually.
+class NftablesFirewall
+{
+    CLASS_LOGGING_CATEGORY("nftables")
+public:
+    using IPVersion = IpTablesFirewall::IPVersion;
+
+public:
+    // Create the tables with all anchors disabled.  Any existing tables are
+    // replaced.
+    static void install();
+    static void uninstall();
+    // Whether install() has been called (and uninstall() hasn't).  The
+    // tables are reinstalled automatically if a change can't be applied.
+    static bool isInstalled();
+    // Enable or disable an anchor; the anchor names are the same as
+    // IpTablesFirewall's filter anchors.
+    static void setAnchorEnabled(IPVersion ip, const QString& anchor, bool enabled);
+    // Set the DNS servers allowed by 320.allowDNS (IPv4 only, like
+    // IpTablesFirewall).
+    static void updateDNSServers(const QStringList& servers);
+
+    // Batch changes until commitBatch(), like IpTablesFirewall.  Outside of a
+    // batch, changes are applied immediately.
+    static void beginBatch();
+    static int commitBatch();
+
+private:
+    static QString buildInstallScript();
+    // Build the statements needed to go from the applied state to the
+    // desired state - empty if there are no changes.
+    static QString buildChanges();
+    static int runScript(const QString& script);
+};
+
+#endif
+
+#endif
@@ -26,10 +26,24 @@
 #include "brand.h"
 
 #include <QProcess>
+#include <QHash>
+#include <QPair>
 
 static QString kRootAnchor = QStringLiteral(BRAND_IDENTIFIER);
 static QByteArray kPfWarning = "pfctl: Use of -f option, could result in flushing of rules\npresent in the main ruleset added by the system at startup.\nSee /etc/pf.conf for further details.\n";
 
+// Last state applied for each anchor and anchor table, so unchanged anchors
+// can be skipped without running pfctl.  Cleared by install() and uninstall(),
+// which reset all anchors.
+static QHash<QString, bool> anchorStates;
+// Keys are "<anchor>/<table>"; values are the enabled state and the table
+// contents.  Toggling an anchor flushes its tables, so this is also cleared
+// for that anchor when its state changes.
+static QHash<QString, QPair<bool, QStringList>> anchorTables;
+// Commands queued for the current batch - see PFFirewall::beginBatch()
+static QStringList batchCommands;
+static bool batchActive{false};
+
 int PFFirewall::execute(const QString& command, bool ignoreErrors)
 {
     static QLoggingCategory stdoutCategory("pf.stdout");
@@ -50,6 +64,17 @@ int PFFirewall::execute(const QString& command, bool ignoreErrors)
     return exitCode;
 }
 
+void PFFirewall::executeAnchorCommand(const QString &command, bool ignoreErrors)
+{
+    if (batchActive)
+    {
+        // Ignored errors are just discarded from the batch's output
+        batchCommands.push_back(ignoreErrors ? command + QStringLiteral(" 2> /dev/null") : command);
+    }
+    else
+        execute(command, ignoreErrors);
+}
+
 void PFFirewall::install()
 {
     // remove hard-coded (legacy) pia anchor from /etc/pf.conf if it exists
@@ -71,6 +96,10 @@ void PFFirewall::uninstall()
 {
     qInfo() << "Uninstalling PF root anchor";
 
+    Q_ASSERT(!batchActive); // Can't uninstall during a batch
+    anchorStates.clear();
+    anchorTables.clear();
+
     if (isRootAnchorLoaded())
         execute(QStringLiteral("pfctl -q -a '%1' -F all").arg(kRootAnchor));
 
@@ -106,12 +135,12 @@ bool PFFirewall::isRootAnchorLoaded()
 
 void PFFirewall::enableAnchor(const QString& anchor)
 {
-    execute(QStringLiteral("if pfctl -q -a '%1/%2' -s rules 2> /dev/null | grep -q . ; then echo '%2: ON' ; else echo '%2: OFF -> ON' ; pfctl -q -a '%1/%2' -F all -f '%3/pf/%1.%2.conf' ; fi").arg(kRootAnchor, anchor, Path::ResourceDir));
+    executeAnchorCommand(QStringLiteral("if pfctl -q -a '%1/%2' -s rules 2> /dev/null | grep -q . ; then echo '%2: ON' ; else echo '%2: OFF -> ON' ; pfctl -q -a '%1/%2' -F all -f '%3/pf/%1.%2.conf' ; fi").arg(kRootAnchor, anchor, Path::ResourceDir));
 }
 
 void PFFirewall::disableAnchor(const QString& anchor)
 {
-    execute(QStringLiteral("if ! pfctl -q -a '%1/%2' -s rules 2> /dev/null | grep -q . ; then echo '%2: OFF' ; else echo '%2: ON -> OFF' ; pfctl -q -a '%1/%2' -F all ; fi").arg(kRootAnchor, anchor));
+    executeAnchorCommand(QStringLiteral("if ! pfctl -q -a '%1/%2' -s rules 2> /dev/null | grep -q . ; then echo '%2: OFF' ; else echo '%2: ON -> OFF' ; pfctl -q -a '%1/%2' -F all ; fi").arg(kRootAnchor, anchor));
 }
 
 bool PFFirewall::isAnchorEnabled(const QString& anchor)
@@ -121,6 +150,19 @@ bool PFFirewall::isAnchorEnabled(const QString& anchor)
 
 void PFFirewall::setAnchorEnabled(const QString& anchor, bool enabled)
 {
+    auto itState = anchorStates.find(anchor);
+    if (itState != anchorStates.end() && itState.value() == enabled)
+        return;
+    anchorStates.insert(anchor, enabled);
+    const QString tablePrefix = anchor + '/';
+    for (auto itTable = anchorTables.begin(); itTable != anchorTables.end(); )
+    {
+        if (itTable.key().startsWith(tablePrefix))
+            itTable = anchorTables.erase(itTable);
+        else
+            ++itTable;
+    }
+
     if (enabled)
         enableAnchor(anchor);
     else
@@ -129,17 +171,34 @@ void PFFirewall::setAnchorEnabled(const QString& anchor, bool enabled)
 
 void PFFirewall::setAnchorTable(const QString& anchor, bool enabled, const QString& table, const QStringList& items)
 {
+    const QString key = anchor + '/' + table;
+    QPair<bool, QStringList> newTable{enabled, enabled ? items : QStringList{}};
+    auto itTable = anchorTables.find(key);
+    if (itTable != anchorTables.end() && itTable.value() == newTable)
+        return;
+    anchorTables.insert(key, std::move(newTable));
+
     if (enabled)
-        execute(QStringLiteral("pfctl -q -a '%1/%2' -t '%3' -T replace %4").arg(kRootAnchor, anchor, table, items.join(' ')));
+        executeAnchorCommand(QStringLiteral("pfctl -q -a '%1/%2' -t '%3' -T replace %4").arg(kRootAnchor, anchor, table, items.join(' ')));
     else
-        execute(QStringLiteral("pfctl -q -a '%1/%2' -t '%3' -T kill").arg(kRootAnchor, anchor, table), true);
+        executeAnchorCommand(QStringLiteral("pfctl -q -a '%1/%2' -t '%3' -T kill").arg(kRootAnchor, anchor, table), true);
 }
 
-void PFFirewall::setAnchorWithRules(const QString& anchor, bool enabled, const QStringList &ruleList)
+void PFFirewall::beginBatch()
 {
-    if(!enabled)
-        return (void)execute(QStringLiteral("pfctl -q -a '%1/%2' -F rules").arg(kRootAnchor, anchor), true);
-    else
-        return (void)execute(QStringLiteral("echo -e \"%1\" | pfctl -q -a '%2/%3' -f -").arg(ruleList.join('\n'), kRootAnchor, anchor), true);
+    Q_ASSERT(!batchActive); // Batches can't be nested
+    batchActive = true;
+}
+
+int PFFirewall::commitBatch()
+{
+    Q_ASSERT(batchActive);
+    batchActive = false;
+
+    QStringList commands;
+    commands.swap(batchCommands);
+    if (commands.isEmpty())
+        return 0;
+    return execute(commands.join('\n'));
 }
 #endif
@@ -37,6 +37,9 @@ class PFFirewall
 
 private:
     static int execute(const QString &command, bool ignoreErrors = false);
+    // Run a command that changes an anchor - queued if a batch is in
+    // progress, otherwise run now.
+    static void executeAnchorCommand(const QString &command, bool ignoreErrors = false);
     static bool isPFEnabled();
     static bool isRootAnchorLoaded();
 
@@ -49,8 +52,14 @@ public:
     static bool isAnchorEnabled(const QString &anchor);
     static void setAnchorEnabled(const QString &anchor, bool enable);
     static void setAnchorTable(const QString &anchor, bool enabled, const QString &table, const QStringList &items);
-    static void setAnchorWithRules(const QString &anchor, bool enabled, const QStringList &rules);
     static void ensureRootAnchorPriority();
+    // Batch the anchor and table changes made until commitBatch().  Each
+    // change still runs pfctl, but the whole batch runs in one shell, which
+    // avoids spawning (and waiting for) a shell for every anchor.
+    static void beginBatch();
+    // Apply the batch.  Returns the shell's exit code (0 if the batch was
+    // empty).
+    static int commitBatch();
 };
 
 #endif
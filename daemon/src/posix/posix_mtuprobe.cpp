@@ -0,0 +1,246 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("posix/posix_mtuprobe.cpp")
+
+#include "posix_mtuprobe.h"
+#include <QRandomGenerator>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <vector>
+
+namespace
+{
+    enum : unsigned
+    {
+        // IPv4 header (without options) and ICMP echo header sizes
+        IpHeaderSize = 20,
+        IcmpHeaderSize = 8,
+        // Stop the binary search once the range is this small
+        SearchGranularity = 8,
+    };
+
+    enum : quint8
+    {
+        IcmpEchoReply = 0,
+        IcmpEchoRequest = 8,
+    };
+
+    // Number of times each size is tried before deciding it doesn't work -
+    // a single lost echo shouldn't lower the MTU
+    const int probeAttempts{2};
+    // Time to wait for each echo
+    const std::chrono::milliseconds probeTimeout{1000};
+
+    quint16 icmpChecksum(const quint8 *pData, std::size_t len)
+    {
+        quint32 sum = 0;
+        for(std::size_t i = 0; i + 1 < len; i += 2)
+            sum += (static_cast<quint32>(pData[i]) << 8) | pData[i+1];
+        if(len % 2)
+            sum += static_cast<quint32>(pData[len-1]) << 8;
+        while(sum >> 16)
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        return static_cast<quint16>(~sum);
+    }
+}
+
+PosixMtuProbe::PosixMtuProbe(QObject *pParent, const QHostAddress &target)
+    : QObject{pParent}, _target{target}, _sockFd{-1},
+      _ident{static_cast<quint16>(QRandomGenerator::global()->generate())},
+      _sequence{0}, _goodSize{0}, _badSize{MaxPacketSize + 1},
+      _probeSize{MaxPacketSize}, _attempt{0}, _finished{false}
+{
+    _timeout.setSingleShot(true);
+    _timeout.setInterval(msec32(probeTimeout));
+    connect(&_timeout, &QTimer::timeout, this, &PosixMtuProbe::onTimeout);
+
+    if(_target.protocol() != QAbstractSocket::NetworkLayerProtocol::IPv4Protocol)
+    {
+        qWarning() << "Can't probe MTU to non-IPv4 address" << _target;
+        QMetaObject::invokeMethod(this, [this](){finish(0);}, Qt::QueuedConnection);
+        return;
+    }
+
+    _sockFd = ::socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+    if(_sockFd < 0)
+    {
+        qWarning() << "Unable to open ICMP socket:" << errno
+            << qPrintable(qt_error_string(errno));
+        QMetaObject::invokeMethod(this, [this](){finish(0);}, Qt::QueuedConnection);
+        return;
+    }
+    ::fcntl(_sockFd, F_SETFL, ::fcntl(_sockFd, F_GETFL) | O_NONBLOCK);
+    ::fcntl(_sockFd, F_SETFD, FD_CLOEXEC);
+
+    // Set DF on the probes.  On Linux, IP_PMTUDISC_PROBE sets DF but ignores
+    // any cached path MTU, so the probe sizes are actually sent.
+#if defined(Q_OS_LINUX)
+    int pmtuDisc = IP_PMTUDISC_PROBE;
+    if(::setsockopt(_sockFd, IPPROTO_IP, IP_MTU_DISCOVER, &pmtuDisc, sizeof(pmtuDisc)) < 0)
+#elif defined(IP_DONTFRAG)
+    int dontFrag = 1;
+    if(::setsockopt(_sockFd, IPPROTO_IP, IP_DONTFRAG, &dontFrag, sizeof(dontFrag)) < 0)
+#else
+    if(false)
+#endif
+    {
+        // Not fatal; the probes that are too large for the tunnel device
+        // would just be fragmented locally
+        qWarning() << "Unable to set DF on ICMP socket:" << errno
+            << qPrintable(qt_error_string(errno));
+    }
+
+    _readNotifier = new QSocketNotifier(_sockFd, QSocketNotifier::Read, this);
+    connect(_readNotifier, &QSocketNotifier::activated, this,
+            &PosixMtuProbe::onReadable);
+
+    qInfo() << "Probing tunnel MTU with pings to" << _target;
+    sendProbe();
+}
+
+PosixMtuProbe::~PosixMtuProbe()
+{
+    //Destroy the notifier before the socket is closed
+    delete _readNotifier;
+    if(_sockFd >= 0)
+        ::close(_sockFd);
+}
+
+void PosixMtuProbe::sendProbe()
+{
+    ++_sequence;
+    std::vector<quint8> packet(_probeSize - IpHeaderSize, 0);
+    packet[0] = IcmpEchoRequest;
+    packet[1] = 0;  // Code
+    packet[4] = static_cast<quint8>(_ident >> 8);
+    packet[5] = static_cast<quint8>(_ident);
+    packet[6] = static_cast<quint8>(_sequence >> 8);
+    packet[7] = static_cast<quint8>(_sequence);
+    quint16 checksum = icmpChecksum(packet.data(), packet.size());
+    packet[2] = static_cast<quint8>(checksum >> 8);
+    packet[3] = static_cast<quint8>(checksum);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(_target.toIPv4Address());
+    if(::sendto(_sockFd, packet.data(), packet.size(), 0,
+                reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0)
+    {
+        // EMSGSIZE is expected if the size is larger than the local interface
+        // MTU; that's just a failed size
+        qInfo() << "Unable to send" << _probeSize << "byte probe:" << errno
+            << qPrintable(qt_error_string(errno));
+    }
+    _timeout.start();
+}
+
+void PosixMtuProbe::onReadable()
+{
+    quint8 buffer[MaxPacketSize + 64];
+    while(true)
+    {
+        sockaddr_in from{};
+        socklen_t fromLen = sizeof(from);
+        ssize_t len = ::recvfrom(_sockFd, buffer, sizeof(buffer), 0,
+                                 reinterpret_cast<sockaddr*>(&from), &fromLen);
+        if(len < 0)
+            return; // EAGAIN, or an error - either way, nothing more to read
+
+        // Raw ICMP sockets receive the IP header too
+        if(len < static_cast<ssize_t>(IpHeaderSize))
+            continue;
+        std::size_t ipHeaderLen = (buffer[0] & 0x0F) * 4u;
+        if(static_cast<std::size_t>(len) < ipHeaderLen + IcmpHeaderSize)
+            continue;
+        const quint8 *pIcmp = buffer + ipHeaderLen;
+        quint16 ident = static_cast<quint16>((pIcmp[4] << 8) | pIcmp[5]);
+        quint16 sequence = static_cast<quint16>((pIcmp[6] << 8) | pIcmp[7]);
+        if(pIcmp[0] != IcmpEchoReply || ident != _ident ||
+           sequence != _sequence || ntohl(from.sin_addr.s_addr) != _target.toIPv4Address())
+        {
+            continue;   // Not a reply to the current probe
+        }
+
+        // Require the full-size echo; a truncated reply doesn't show that the
+        // packet size works in both directions
+        std::size_t icmpLen = static_cast<std::size_t>(len) - ipHeaderLen;
+        if(icmpLen + IpHeaderSize < _probeSize)
+            continue;
+
+        _timeout.stop();
+        probeResult(true);
+        return;
+    }
+}
+
+void PosixMtuProbe::onTimeout()
+{
+    if(++_attempt < probeAttempts)
+        sendProbe();
+    else
+        probeResult(false);
+}
+
+void PosixMtuProbe::probeResult(bool echoed)
+{
+    _attempt = 0;
+    if(echoed)
+        _goodSize = _probeSize;
+    else
+        _badSize = _probeSize;
+
+    if(!_goodSize)
+    {
+        // Nothing has worked yet.  If the full size failed, check that the
+        // target answers at all with the smallest size.
+        if(_badSize <= MinPacketSize)
+        {
+            qWarning() << "No response to MTU probes from" << _target;
+            finish(0);
+            return;
+        }
+        _probeSize = MinPacketSize;
+    }
+    else if(_badSize - _goodSize <= SearchGranularity)
+    {
+        finish(_goodSize);
+        return;
+    }
+    else
+        _probeSize = (_goodSize + _badSize) / 2;
+
+    sendProbe();
+}
+
+void PosixMtuProbe::finish(unsigned mtu)
+{
+    if(_finished)
+        return;
+    _finished = true;
+    _timeout.stop();
+    if(mtu)
+        qInfo() << "Tunnel MTU to" << _target << "is" << mtu;
+    emit finished(mtu);
+}
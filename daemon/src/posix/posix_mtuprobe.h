@@ -0,0 +1,91 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("posix/posix_mtuprobe.h")
+
+#ifndef POSIX_MTUPROBE_H
+#define POSIX_MTUPROBE_H
+
+#include <QHostAddress>
+#include <QObject>
+#include <QPointer>
+#include <QSocketNotifier>
+#include <QTimer>
+
+// PosixMtuProbe finds the largest packet that gets through the VPN tunnel by
+// pinging a host on the other end with ICMP echo requests of various sizes.
+//
+// Large packets are sent with DF set and are encapsulated by OpenVPN; if the
+// encapsulated packets are too large for the physical link, they're
+// fragmented, and some links (many PPPoE and LTE links) silently drop the
+// fragments.  The probe finds this limit with a binary search - a size is
+// considered to work if its echo is received.
+//
+// This requires a raw ICMP socket, so it only works as root (which the daemon
+// is).  Only IPv4 is supported.
+class PosixMtuProbe : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("mtuprobe");
+
+public:
+    enum : unsigned
+    {
+        // Smallest and largest packet sizes probed (total IP packet size).
+        // The upper limit is the tunnel MTU.
+        MinPacketSize = 576,
+        MaxPacketSize = 1500,
+    };
+
+public:
+    // Begin probing 'target' immediately.  finished() is emitted once probing
+    // is done (if the socket can't be opened, it's emitted asynchronously).
+    PosixMtuProbe(QObject *pParent, const QHostAddress &target);
+    ~PosixMtuProbe();
+
+signals:
+    // Probing is done.  'mtu' is the largest packet size that was echoed, or 0
+    // if nothing was echoed (the target doesn't answer pings or the probe
+    // couldn't be sent).
+    void finished(unsigned mtu);
+
+private:
+    // Send a probe of the current size (_probeSize)
+    void sendProbe();
+    void onReadable();
+    void onTimeout();
+    // The current size worked (or failed); move on to the next size
+    void probeResult(bool echoed);
+    void finish(unsigned mtu);
+
+private:
+    QHostAddress _target;
+    int _sockFd;
+    QPointer<QSocketNotifier> _readNotifier;
+    QTimer _timeout;
+    quint16 _ident, _sequence;
+    // Bounds of the binary search - _goodSize is known to work (0 if nothing
+    // has worked yet), _badSize is known not to
+    unsigned _goodSize, _badSize;
+    unsigned _probeSize;
+    int _attempt;
+    bool _finished;
+};
+
+#endif
@@ -0,0 +1,168 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("posix/posix_routenotifier.cpp")
+
+#include "posix_routenotifier.h"
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#if defined(Q_OS_LINUX)
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#elif defined(Q_OS_MACOS)
+#include <net/if.h>
+#include <net/route.h>
+#endif
+
+PosixRouteNotifier::PosixRouteNotifier(QObject *pParent)
+    : QObject{pParent}, _sockFd{-1}
+{
+#if defined(Q_OS_LINUX)
+    _sockFd = ::socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if(_sockFd >= 0)
+    {
+        sockaddr_nl addr{};
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR |
+            RTMGRP_IPV4_ROUTE;
+        if(::bind(_sockFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+        {
+            qWarning() << "Unable to bind netlink socket:" << errno
+                << qPrintable(qt_error_string(errno));
+            ::close(_sockFd);
+            _sockFd = -1;
+            return;
+        }
+    }
+#elif defined(Q_OS_MACOS)
+    _sockFd = ::socket(PF_ROUTE, SOCK_RAW, AF_UNSPEC);
+    if(_sockFd >= 0)
+    {
+        // No SOCK_NONBLOCK/SOCK_CLOEXEC on macOS
+        ::fcntl(_sockFd, F_SETFL, ::fcntl(_sockFd, F_GETFL) | O_NONBLOCK);
+        ::fcntl(_sockFd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    if(_sockFd < 0)
+    {
+        qWarning() << "Unable to open routing socket:" << errno
+            << qPrintable(qt_error_string(errno));
+        return;
+    }
+
+    _readNotifier = new QSocketNotifier{_sockFd, QSocketNotifier::Read, this};
+    connect(_readNotifier.data(), &QSocketNotifier::activated, this,
+            &PosixRouteNotifier::onReadable);
+}
+
+PosixRouteNotifier::~PosixRouteNotifier()
+{
+    delete _readNotifier;
+    if(_sockFd >= 0)
+        ::close(_sockFd);
+}
+
+void PosixRouteNotifier::onReadable()
+{
+    // Drain the socket, check all the messages read
+    unsigned char buffer[8192];
+    bool changed{false};
+    while(true)
+    {
+        ssize_t len = ::recv(_sockFd, buffer, sizeof(buffer), 0);
+        if(len < 0)
+        {
+            // ENOBUFS means the kernel dropped messages because we didn't
+            // read them fast enough; something did change.
+            if(errno == ENOBUFS)
+                changed = true;
+            else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                qWarning() << "Unable to read routing socket:" << errno
+                    << qPrintable(qt_error_string(errno));
+            }
+            if(errno != EINTR)
+                break;
+            continue;
+        }
+        if(len == 0)
+            break;
+        if(hasRouteChange(buffer, static_cast<std::size_t>(len)))
+            changed = true;
+    }
+
+    if(changed)
+        emit routesChanged();
+}
+
+bool PosixRouteNotifier::hasRouteChange(const unsigned char *pData, std::size_t len) const
+{
+#if defined(Q_OS_LINUX)
+    int remaining = static_cast<int>(len);
+    for(auto pMsg = reinterpret_cast<const nlmsghdr*>(pData);
+        NLMSG_OK(pMsg, remaining); pMsg = NLMSG_NEXT(pMsg, remaining))
+    {
+        switch(pMsg->nlmsg_type)
+        {
+            case RTM_NEWLINK:
+            case RTM_DELLINK:
+            case RTM_NEWADDR:
+            case RTM_DELADDR:
+            case RTM_NEWROUTE:
+            case RTM_DELROUTE:
+                return true;
+            default:
+                break;
+        }
+    }
+    return false;
+#elif defined(Q_OS_MACOS)
+    // Each message starts with its length and type (the common prefix of
+    // rt_msghdr, ifa_msghdr, and if_msghdr)
+    std::size_t offset = 0;
+    while(offset + sizeof(rt_msghdr) <= len)
+    {
+        auto pMsg = reinterpret_cast<const rt_msghdr*>(pData + offset);
+        if(pMsg->rtm_msglen == 0)
+            break;
+        switch(pMsg->rtm_type)
+        {
+            case RTM_ADD:
+            case RTM_DELETE:
+            case RTM_CHANGE:
+                // Ignore cloned host routes and ARP entries, these come and go
+                // constantly as hosts are contacted
+                if(pMsg->rtm_flags & (RTF_WASCLONED | RTF_LLINFO))
+                    break;
+                return true;
+            case RTM_NEWADDR:
+            case RTM_DELADDR:
+            case RTM_IFINFO:
+                return true;
+            default:
+                break;
+        }
+        offset += pMsg->rtm_msglen;
+    }
+    return false;
+#else
+    return len > 0;
+#endif
+}
@@ -0,0 +1,64 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("posix/posix_routenotifier.h")
+
+#ifndef POSIX_ROUTENOTIFIER_H
+#define POSIX_ROUTENOTIFIER_H
+
+#include <QObject>
+#include <QPointer>
+#include <QSocketNotifier>
+
+// PosixRouteNotifier reads route, address, and link change messages from the
+// kernel and emits routesChanged() for each batch read.
+//
+// On Linux, this is an rtnetlink socket subscribed to the link, IPv4/IPv6
+// address, and IPv4 route groups.  On macOS, it's a PF_ROUTE socket, which
+// receives all routing messages.
+//
+// If the socket can't be opened, no notifications are emitted (network changes
+// are then only detected by OpenVPN's ping timeout as before).
+class PosixRouteNotifier : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("posix.routenotifier");
+
+public:
+    PosixRouteNotifier(QObject *pParent);
+    ~PosixRouteNotifier();
+
+    // Whether the routing socket was opened; if not, no notifications will be
+    // emitted.
+    bool isOpen() const {return _sockFd >= 0;}
+
+signals:
+    void routesChanged();
+
+private:
+    void onReadable();
+    // Check whether a batch of messages read from the socket contains any
+    // relevant change
+    bool hasRouteChange(const unsigned char *pData, std::size_t len) const;
+
+private:
+    int _sockFd;
+    QPointer<QSocketNotifier> _readNotifier;
+};
+
+#endif
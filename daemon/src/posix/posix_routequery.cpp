@@ -0,0 +1,297 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("posix/posix_routequery.cpp")
+
+#include "posix_routequery.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#if defined(Q_OS_LINUX)
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#elif defined(Q_OS_MACOS)
+#include <sys/sysctl.h>
+#include <net/route.h>
+#endif
+
+namespace
+{
+    QString ipv4ToString(const in_addr &addr)
+    {
+        char text[INET_ADDRSTRLEN]{};
+        if(!::inet_ntop(AF_INET, &addr, text, sizeof(text)))
+            return {};
+        return QString::fromLatin1(text);
+    }
+
+    QString interfaceIndexName(unsigned index)
+    {
+        char name[IF_NAMESIZE]{};
+        if(!::if_indextoname(index, name))
+            return {};
+        return QString::fromLatin1(name);
+    }
+
+#if defined(Q_OS_LINUX)
+    // Close a netlink socket when leaving scope
+    class NetlinkSocket
+    {
+    public:
+        NetlinkSocket() : _fd{::socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)} {}
+        ~NetlinkSocket() {if(_fd >= 0) ::close(_fd);}
+        NetlinkSocket(const NetlinkSocket &) = delete;
+        NetlinkSocket &operator=(const NetlinkSocket &) = delete;
+
+        int fd() const {return _fd;}
+
+    private:
+        int _fd;
+    };
+
+    bool queryLinuxDefaultRoute(PosixDefaultRoute &route)
+    {
+        NetlinkSocket sock;
+        if(sock.fd() < 0)
+        {
+            qWarning() << "Unable to open netlink socket:" << errno
+                << qPrintable(qt_error_string(errno));
+            return false;
+        }
+
+        struct
+        {
+            nlmsghdr header;
+            rtmsg message;
+        } request{};
+        request.header.nlmsg_len = NLMSG_LENGTH(sizeof(rtmsg));
+        request.header.nlmsg_type = RTM_GETROUTE;
+        request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+        request.header.nlmsg_seq = 1;
+        request.message.rtm_family = AF_INET;
+
+        if(::send(sock.fd(), &request, request.header.nlmsg_len, 0) < 0)
+        {
+            qWarning() << "Unable to request routes:" << errno
+                << qPrintable(qt_error_string(errno));
+            return false;
+        }
+
+        bool found{false};
+        quint32 bestMetric{0};
+        std::vector<unsigned char> buffer(16384);
+        while(true)
+        {
+            ssize_t len = ::recv(sock.fd(), buffer.data(), buffer.size(), 0);
+            if(len < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                qWarning() << "Unable to read routes:" << errno
+                    << qPrintable(qt_error_string(errno));
+                return false;
+            }
+
+            int remaining = static_cast<int>(len);
+            for(auto pMsg = reinterpret_cast<const nlmsghdr*>(buffer.data());
+                NLMSG_OK(pMsg, remaining); pMsg = NLMSG_NEXT(pMsg, remaining))
+            {
+                if(pMsg->nlmsg_type == NLMSG_DONE)
+                    return found;
+                if(pMsg->nlmsg_type == NLMSG_ERROR)
+                {
+                    qWarning() << "Route dump failed";
+                    return false;
+                }
+                if(pMsg->nlmsg_type != RTM_NEWROUTE)
+                    continue;
+
+                auto pRoute = reinterpret_cast<const rtmsg*>(NLMSG_DATA(pMsg));
+                // Only unicast default routes (0.0.0.0/0)
+                if(pRoute->rtm_family != AF_INET || pRoute->rtm_dst_len != 0 ||
+                   pRoute->rtm_type != RTN_UNICAST)
+                {
+                    continue;
+                }
+
+                quint32 table{pRoute->rtm_table};
+                in_addr gateway{};  // 0.0.0.0 if there's no gateway
+                unsigned oif{0};
+                quint32 metric{0};
+                int attrLen = static_cast<int>(RTM_PAYLOAD(pMsg));
+                for(auto pAttr = RTM_RTA(pRoute); RTA_OK(pAttr, attrLen);
+                    pAttr = RTA_NEXT(pAttr, attrLen))
+                {
+                    switch(pAttr->rta_type)
+                    {
+                        case RTA_TABLE:
+                            std::memcpy(&table, RTA_DATA(pAttr), sizeof(table));
+                            break;
+                        case RTA_GATEWAY:
+                            std::memcpy(&gateway, RTA_DATA(pAttr), sizeof(gateway));
+                            break;
+                        case RTA_OIF:
+                        {
+                            int index{0};
+                            std::memcpy(&index, RTA_DATA(pAttr), sizeof(index));
+                            oif = static_cast<unsigned>(index);
+                            break;
+                        }
+                        case RTA_PRIORITY:
+                            std::memcpy(&metric, RTA_DATA(pAttr), sizeof(metric));
+                            break;
+                        default:
+                            break;
+                    }
+                }
+
+                // netstat -nr only showed the main table; policy routing
+                // tables (including our own split tunnel tables) are ignored.
+                if(table != RT_TABLE_MAIN || oif == 0)
+                    continue;
+                if(found && metric >= bestMetric)
+                    continue;
+
+                QString interfaceName = interfaceIndexName(oif);
+                if(interfaceName.isEmpty())
+                    continue;
+                route.gatewayIp = ipv4ToString(gateway);
+                route.interfaceName = interfaceName;
+                bestMetric = metric;
+                found = true;
+            }
+        }
+    }
+#elif defined(Q_OS_MACOS)
+    // Sockaddrs in routing messages are padded to a multiple of uint32_t
+    std::size_t sockaddrSpace(const sockaddr *pAddr)
+    {
+        std::size_t len = pAddr->sa_len ? pAddr->sa_len : sizeof(uint32_t);
+        return (len + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+    }
+
+    bool queryMacDefaultRoute(PosixDefaultRoute &route)
+    {
+        int mib[]{CTL_NET, PF_ROUTE, 0, AF_INET, NET_RT_DUMP, 0};
+        std::size_t size{0};
+        std::vector<char> buffer;
+        // The table can grow between the size query and the dump, retry a
+        // few times if it does.
+        int result{-1};
+        for(int tries = 0; tries < 3 && result < 0; ++tries)
+        {
+            if(::sysctl(mib, 6, nullptr, &size, nullptr, 0) < 0)
+                break;
+            buffer.resize(size);
+            result = ::sysctl(mib, 6, buffer.data(), &size, nullptr, 0);
+            if(result < 0 && errno != ENOMEM)
+                break;
+        }
+        if(result < 0)
+        {
+            qWarning() << "Unable to dump routing table:" << errno
+                << qPrintable(qt_error_string(errno));
+            return false;
+        }
+
+        bool foundScoped{false};
+        std::size_t offset{0};
+        while(offset + sizeof(rt_msghdr) <= size)
+        {
+            auto pMsg = reinterpret_cast<const rt_msghdr*>(buffer.data() + offset);
+            if(pMsg->rtm_msglen == 0)
+                break;
+            offset += pMsg->rtm_msglen;
+
+            if(!(pMsg->rtm_flags & RTF_UP) || !(pMsg->rtm_flags & RTF_GATEWAY))
+                continue;
+
+            // Find the destination, gateway, and netmask sockaddrs.  They
+            // follow the header in order of their RTA_* bits.
+            const sockaddr *pAddrs[RTAX_MAX]{};
+            auto pAddrData = reinterpret_cast<const char*>(pMsg + 1);
+            auto pMsgEnd = reinterpret_cast<const char*>(pMsg) + pMsg->rtm_msglen;
+            for(int i = 0; i < RTAX_MAX && pAddrData < pMsgEnd; ++i)
+            {
+                if(!(pMsg->rtm_addrs & (1 << i)))
+                    continue;
+                auto pAddr = reinterpret_cast<const sockaddr*>(pAddrData);
+                pAddrs[i] = pAddr;
+                pAddrData += sockaddrSpace(pAddr);
+            }
+
+            const sockaddr *pDst = pAddrs[RTAX_DST];
+            const sockaddr *pGateway = pAddrs[RTAX_GATEWAY];
+            const sockaddr *pNetmask = pAddrs[RTAX_NETMASK];
+            if(!pDst || pDst->sa_family != AF_INET || !pGateway ||
+               pGateway->sa_family != AF_INET)
+            {
+                continue;
+            }
+            if(reinterpret_cast<const sockaddr_in*>(pDst)->sin_addr.s_addr != INADDR_ANY)
+                continue;
+            // A default route's netmask is absent or all zeros.  (The kernel
+            // truncates netmasks, so a zero mask may have a very short length.)
+            if(pNetmask && pNetmask->sa_len >= offsetof(sockaddr_in, sin_addr) + sizeof(in_addr) &&
+               reinterpret_cast<const sockaddr_in*>(pNetmask)->sin_addr.s_addr != 0)
+            {
+                continue;
+            }
+
+            bool scoped{false};
+#ifdef RTF_IFSCOPE
+            scoped = pMsg->rtm_flags & RTF_IFSCOPE;
+#endif
+            // Keep the first scoped route only as a fallback
+            if(scoped && foundScoped)
+                continue;
+
+            QString interfaceName = interfaceIndexName(pMsg->rtm_index);
+            if(interfaceName.isEmpty())
+                continue;
+            route.gatewayIp = ipv4ToString(reinterpret_cast<const sockaddr_in*>(pGateway)->sin_addr);
+            route.interfaceName = interfaceName;
+            if(!scoped)
+                return true;
+            foundScoped = true;
+        }
+
+        return foundScoped;
+    }
+#endif
+}
+
+bool queryDefaultRoute(PosixDefaultRoute &route)
+{
+    bool found{false};
+#if defined(Q_OS_LINUX)
+    found = queryLinuxDefaultRoute(route);
+#elif defined(Q_OS_MACOS)
+    found = queryMacDefaultRoute(route);
+#endif
+    if(!found)
+        qWarning() << "Unable to find the default route";
+    return found;
+}
@@ -0,0 +1,50 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("posix/posix_routequery.h")
+
+#ifndef POSIX_ROUTEQUERY_H
+#define POSIX_ROUTEQUERY_H
+
+#include <QString>
+
+// The IPv4 default route found by queryDefaultRoute()
+struct PosixDefaultRoute
+{
+    // Gateway IP address; "0.0.0.0" if the default route has no gateway (a
+    // point-to-point interface)
+    QString gatewayIp;
+    // Name of the interface used by the default route
+    QString interfaceName;
+};
+
+// Query the kernel routing table for the IPv4 default route.  This replaces
+// parsing netstat output, which needed several process spawns and depended on
+// the output format of the system tools.
+//
+// - Linux: an rtnetlink RTM_GETROUTE dump of the main table.  If there are
+//   several default routes, the one with the lowest metric is used.
+// - macOS: a PF_ROUTE NET_RT_DUMP sysctl.  The first unscoped default route is
+//   used, falling back to the first scoped (-ifscope) default route.
+//
+// Returns false (and logs a warning) if the query fails or there is no default
+// route.
+bool queryDefaultRoute(PosixDefaultRoute &route);
+
+#endif
@@ -28,6 +28,27 @@
 #include <unistd.h>
 #endif
 
+namespace
+{
+    // A process that exits with a nonzero exit code within this long after
+    // starting most likely rejected its configuration
+    const std::chrono::seconds immediateExitTime{1};
+
+    // stderr patterns used to classify failures (matched against the line in
+    // lowercase).  These are generic enough to cover hnsd, ss-local, etc.
+    const std::initializer_list<std::pair<const char*, RestartStrategy::FailureCause>> stderrPatterns
+    {
+        {"address already in use", RestartStrategy::FailureCause::Network},
+        {"address not available", RestartStrategy::FailureCause::Network},
+        {"network is unreachable", RestartStrategy::FailureCause::Network},
+        {"getaddrinfo", RestartStrategy::FailureCause::Network},
+        {"usage:", RestartStrategy::FailureCause::Config},
+        {"unrecognized option", RestartStrategy::FailureCause::Config},
+        {"invalid option", RestartStrategy::FailureCause::Config},
+        {"unknown option", RestartStrategy::FailureCause::Config},
+    };
+}
+
 RestartStrategy::RestartStrategy(Params params)
     : _params{std::move(params)}
 {
@@ -46,6 +67,8 @@ RestartStrategy::RestartStrategy(Params params)
 void RestartStrategy::resetFailures()
 {
     _nextDelay = _params._initialDelay;
+    _crashCount = 0;
+    _deterministicCount = 0;
     // Start measuring the failure time from the next failure
     _lastSuccessEnd.invalidate();
 }
@@ -61,7 +84,8 @@ void RestartStrategy::processStarting()
         _lastSuccessEnd.start();
 }
 
-std::chrono::milliseconds RestartStrategy::processFailed(std::chrono::milliseconds &failureDuration)
+nullable_t<std::chrono::milliseconds> RestartStrategy::processFailed(FailureCause cause,
+                                                                    std::chrono::milliseconds &failureDuration)
 {
     // Is this the first failure since a successful run?
     if(!_lastSuccessEnd.isValid())
@@ -69,13 +93,36 @@ std::chrono::milliseconds RestartStrategy::processFailed(std::chrono::millisecon
 
     // Otherwise, keep the current _lastSuccessEnd
 
+    // Not guaranteed to be 0 for the first failure; that's fine.
+    failureDuration = std::chrono::milliseconds(_lastSuccessEnd.elapsed());
+
+    if(cause == FailureCause::Config)
+    {
+        ++_deterministicCount;
+        // Restarting won't fix this, stop once it has failed the same way a
+        // few times in a row
+        if(_deterministicCount >= DeterministicFailureLimit)
+            return {};
+    }
+    else
+        _deterministicCount = 0;
+
+    // Crashes are usually transient, restart the first few quickly without
+    // advancing the backoff.
+    if(cause == FailureCause::Crash)
+    {
+        ++_crashCount;
+        if(_crashCount <= FastRestartLimit)
+            return _params._initialDelay;
+    }
+    else
+        _crashCount = 0;
+
     auto thisDelay = _nextDelay;
     _nextDelay *= BackoffFactor;
     if(_nextDelay > _params._maxDelay)
         _nextDelay = _params._maxDelay;
 
-    // Not guaranteed to be 0 for the first failure; that's fine.
-    failureDuration = std::chrono::milliseconds(_lastSuccessEnd.elapsed());
     return thisDelay;
 }
 
@@ -121,7 +168,9 @@ void UidGidProcess::setupChildProcess()
 
 ProcessRunner::ProcessRunner(RestartStrategy::Params restartParams)
     : _restartStrategy{std::move(restartParams)},
-      _enabled{false}, _state{State::Idle}
+      _enabled{false}, _state{State::Idle},
+      _exitStatus{QProcess::ExitStatus::NormalExit}, _exitCode{0},
+      _haltAfterExit{false}, _restartCount{0}
 {
     connect(&_restartStrategy, &RestartStrategy::processSucceeded, this, [this]()
     {
@@ -136,11 +185,22 @@ ProcessRunner::ProcessRunner(RestartStrategy::Params restartParams)
     // stdout is forwarded
     connect(&_stdoutBuf, &LineBuffer::lineComplete, this,
             &ProcessRunner::stdoutLine);
-    // stderr is just logged at warning level
-    connect(&_stderrBuf, &LineBuffer::lineComplete, this,
+    // stderr is logged at warning level, and checked for patterns that
+    // indicate the cause of a failure
+    connect(&_stderrBuf, &LineBuffer::lineView, this,
         [this](const QByteArray &line)
         {
             qWarning() << objectName() << "- stderr:" << line;
+
+            QByteArray lowerLine = line.toLower();
+            for(const auto &pattern : stderrPatterns)
+            {
+                if(lowerLine.contains(pattern.first))
+                {
+                    _stderrCause = pattern.second;
+                    break;
+                }
+            }
         });
 }
 
@@ -162,6 +222,10 @@ void ProcessRunner::startProcess()
     Q_ASSERT(!_process);
 
     _stderrBuf.reset();
+    _processError.clear();
+    _exitStatus = QProcess::ExitStatus::NormalExit;
+    _exitCode = 0;
+    _stderrCause.clear();
     _process.emplace();
 
     connect(_process.ptr(), &QProcess::errorOccurred, this,
@@ -180,6 +244,7 @@ void ProcessRunner::startProcess()
     setupProcess(*_process);
 
     _process->start();
+    _runTime.start();
 
     _restartStrategy.processStarting();
 
@@ -198,6 +263,26 @@ void ProcessRunner::stderrReadyRead()
     _stderrBuf.append(_process->readAllStandardError());
 }
 
+RestartStrategy::FailureCause ProcessRunner::classifyFailure() const
+{
+    // The program is missing or can't be executed
+    if(_processError && _processError.get() == QProcess::ProcessError::FailedToStart)
+        return RestartStrategy::FailureCause::Config;
+    // The process told us what was wrong
+    if(_stderrCause)
+        return _stderrCause.get();
+    if(_exitStatus == QProcess::ExitStatus::CrashExit)
+        return RestartStrategy::FailureCause::Crash;
+    // Exiting with an error right away means it didn't accept its arguments
+    // or configuration
+    if(_exitCode != 0 && _runTime.isValid() &&
+       _runTime.elapsed() < msec(immediateExitTime))
+    {
+        return RestartStrategy::FailureCause::Config;
+    }
+    return RestartStrategy::FailureCause::Exit;
+}
+
 void ProcessRunner::handleProcessEnded()
 {
     // If there's anything left in the stderr buffer, print it, the process
@@ -213,6 +298,10 @@ void ProcessRunner::handleProcessEnded()
     bool unexpected = false;
     switch(_state)
     {
+    case State::Halted:
+        // Not possible, there's no process in this state
+        Q_ASSERT(false);
+        return;
     case State::Waiting:
         // Shouldn't normally happen, probably means that we received both a
         // "fatal" error signal and a finished signal.  Nothing to do since
@@ -236,17 +325,33 @@ void ProcessRunner::handleProcessEnded()
     _state = State::Waiting;
     if(unexpected)
     {
+        RestartStrategy::FailureCause cause = classifyFailure();
+        _lastFailureCause = cause;
         std::chrono::milliseconds failureDuration;
-        std::chrono::milliseconds retryDelay = _restartStrategy.processFailed(failureDuration);
+        auto retryDelay = _restartStrategy.processFailed(cause, failureDuration);
 
-        qWarning() << objectName() << "- Has been failing for"
-            << traceMsec(failureDuration) << "- restart after"
-            << traceMsec(retryDelay);
+        if(retryDelay)
+        {
+            qWarning() << objectName() << "- Failed due to" << cause
+                << "- has been failing for" << traceMsec(failureDuration)
+                << "- restart after" << traceMsec(retryDelay.get());
 
-        // This was unexpected, so wait briefly before restarting
-        _postExitTimer.start(msec32(retryDelay));
+            // This was unexpected, so wait briefly before restarting
+            ++_restartCount;
+            _postExitTimer.start(msec32(retryDelay.get()));
+        }
+        else
+        {
+            qWarning() << objectName() << "- Failed due to" << cause
+                << "- has been failing for" << traceMsec(failureDuration)
+                << "- not restarting until it is reconfigured";
+            // Clean up, then halt instead of restarting
+            _haltAfterExit = true;
+            _postExitTimer.start(0);
+        }
         // This was unexpected so emit a failure signal.  (Do this last after
         // all state changes are done.)
+        emit statusChanged();
         emit failed(failureDuration);
     }
     else
@@ -264,6 +369,7 @@ void ProcessRunner::processErrorOccurred(QProcess::ProcessError error)
 {
     Q_ASSERT(_process); // Valid because signal is connected to _process
 
+    _processError = error;
     QProcess::ProcessState procState = _process->state();
     qWarning() << objectName() << "- Process signaled error:" << error
         << "in state" << procState;
@@ -283,6 +389,8 @@ void ProcessRunner::processFinished(int exitCode, QProcess::ExitStatus exitStatu
 {
     qInfo() << objectName() << "- Process exited with code" << exitCode
         << "and status" << exitStatus;
+    _exitCode = exitCode;
+    _exitStatus = exitStatus;
     handleProcessEnded();
 }
 
@@ -293,7 +401,15 @@ void ProcessRunner::postExitTimerElapsed()
 
     _state = State::Idle;
     _process.clear();
-    if(_enabled)
+    bool halt = _haltAfterExit;
+    _haltAfterExit = false;
+    if(_enabled && halt)
+    {
+        qWarning() << objectName() << "- Process failed deterministically, halted";
+        _state = State::Halted;
+        emit statusChanged();
+    }
+    else if(_enabled)
     {
         qInfo() << objectName() << "- Restarting process now";
         startProcess();
@@ -351,6 +467,10 @@ bool ProcessRunner::enable(QString program, QStringList arguments)
         // disable() cleared the remaining delay.
         Q_ASSERT(_postExitTimer.interval() == 0);
         break;
+    case State::Halted:
+        // Not possible, disable() above always leaves the Halted state
+        Q_ASSERT(false);
+        break;
     }
 
     return true;
@@ -390,6 +510,17 @@ void ProcessRunner::disable()
         // RestartStrategy is still tracking.  Forget all prior failures; the
         // next run will be a fresh start.
         _restartStrategy.resetFailures();
+        // If the last failure would have halted the process, it no longer
+        // applies either
+        _haltAfterExit = false;
+        break;
+    case State::Halted:
+        // The process isn't running, just forget the failures so it can be
+        // started again.
+        Q_ASSERT(!_process);
+        _state = State::Idle;
+        _restartStrategy.resetFailures();
+        emit statusChanged();
         break;
     }
 }
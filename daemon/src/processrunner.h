@@ -36,6 +36,11 @@
 // If a process runs for longer than successRunTime, it is considered
 // "successful" - RestartStrategy resets its ongoing measurements and emits the
 // processSucceeded() signal.
+//
+// The restart delay depends on the cause of the failure.  Crashes are usually
+// transient, the first few are restarted quickly.  Deterministic failures
+// (configuration errors, etc.) won't be fixed by restarting, so after a few of
+// those RestartStrategy stops restarting the process.
 class RestartStrategy : public QObject
 {
     Q_OBJECT
@@ -46,6 +51,31 @@ private:
         // Factor applied to delay for repeated failures
         BackoffFactor = 2
     };
+    enum : int
+    {
+        // Number of consecutive crashes restarted with the initial delay
+        // before backing off
+        FastRestartLimit = 3,
+        // Number of consecutive deterministic failures tolerated before the
+        // process is no longer restarted
+        DeterministicFailureLimit = 3
+    };
+
+public:
+    // Cause of a process failure, classified by ProcessRunner
+    enum class FailureCause
+    {
+        // The process exited on its own, no other information
+        Exit,
+        // The process crashed (or was killed)
+        Crash,
+        // The process reported a network error (couldn't bind a port, resolve
+        // a name, etc.)
+        Network,
+        // The process couldn't start, or it rejected its configuration
+        Config,
+    };
+    Q_ENUM(FailureCause)
 
 public:
     struct Params
@@ -72,11 +102,13 @@ public:
     void processStarting();
 
     // The process has failed.  Returns the new delay to use before restarting
-    // the process.
+    // the process, or an empty value if the process has failed
+    // deterministically and shouldn't be restarted.
     // Also sets failureDuration to the amount of time elapses since the
     // recent failures started occurring (how long it has been since the process
     // ran for _successRunTime continuously).
-    std::chrono::milliseconds processFailed(std::chrono::milliseconds &failureDuration);
+    nullable_t<std::chrono::milliseconds> processFailed(FailureCause cause,
+                                                        std::chrono::milliseconds &failureDuration);
 
 signals:
     // When the process has run for longer than _successRunTime, this signal is
@@ -89,6 +121,10 @@ private:
     // Next delay to use if the process fails again before _successDeadline
     // elapses.
     std::chrono::milliseconds _nextDelay;
+    // Consecutive crashes and deterministic failures since the last
+    // successful run
+    int _crashCount;
+    int _deterministicCount;
     // This timer is started when the process is started; if it elapses, the
     // process has succeeded.
     QTimer _successTimer;
@@ -162,6 +198,11 @@ public:
         // was started (we can't destroy it immediately).
         // _restartTimer is running in this state.
         Waiting,
+        // Halted - Process failed deterministically and won't be restarted.
+        // _enabled is always true and _process is always clear in this
+        // state.  ProcessRunner stays here until it's disabled, or enabled
+        // with a different program/arguments.
+        Halted,
     };
 
 public:
@@ -185,6 +226,10 @@ private:
     // processFinished()
     void handleProcessEnded();
 
+    // Classify an unexpected exit using the exit status, error, and stderr
+    // output of the process that just ended
+    RestartStrategy::FailureCause classifyFailure() const;
+
     // Process encountered an error.  Some errors are fatal and indicate that
     // finished() won't be emitted; others are not.
     void processErrorOccurred(QProcess::ProcessError error);
@@ -215,6 +260,13 @@ public:
 
     bool isEnabled() const {return _enabled;}
 
+    // Number of times the process has been restarted after failing, the cause
+    // of the last failure (if there has been one), and whether the process
+    // has been halted after failing deterministically.
+    int restartCount() const {return _restartCount;}
+    const nullable_t<RestartStrategy::FailureCause> &lastFailureCause() const {return _lastFailureCause;}
+    bool isHalted() const {return _state == State::Halted;}
+
     // Kill the process if it is running - if ProcessRunner is enabled, the
     // process will be restarted (this is treated as an unexpected failure).
     // Usually used when an error is detected that may not cause the process to
@@ -246,6 +298,9 @@ signals:
     // of this signal.
     void failed(std::chrono::milliseconds failureDuration);
 
+    // restartCount(), lastFailureCause(), or isHalted() have changed
+    void statusChanged();
+
 private:
     // Program and arguments last passed to enabled().  These are set when
     // _enabled is set (though _arguments could be empty) and clear otherwise.
@@ -265,6 +320,19 @@ private:
     QTimer _postExitTimer;
     // Buffers for stdout and stderr
     LineBuffer _stdoutBuf, _stderrBuf;
+    // Information about the current (or last) process used to classify
+    // failures - the error signaled, exit status, the cause indicated by
+    // stderr output, and the time since the process was started.
+    nullable_t<QProcess::ProcessError> _processError;
+    QProcess::ExitStatus _exitStatus;
+    int _exitCode;
+    nullable_t<RestartStrategy::FailureCause> _stderrCause;
+    QElapsedTimer _runTime;
+    // Set when a failure was deterministic; the process is halted once it has
+    // been cleaned up instead of being restarted
+    bool _haltAfterExit;
+    int _restartCount;
+    nullable_t<RestartStrategy::FailureCause> _lastFailureCause;
 };
 
 #endif
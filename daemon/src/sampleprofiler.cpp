@@ -0,0 +1,362 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("sampleprofiler.cpp")
+
+#include "sampleprofiler.h"
+#include <QStringList>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#ifdef Q_OS_WIN
+#include <Windows.h>
+#pragma comment(lib, "DbgHelp.lib")
+#include <DbgHelp.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <cstdlib>
+#endif
+
+namespace
+{
+    // Set while a SampleProfiler is running; only one can run at a time since
+    // the signal handler (and dbghelp) are process-wide.
+    std::atomic<bool> g_profilerActive{false};
+
+#ifndef Q_OS_WIN
+    // Samples captured by the signal handler and not yet drained by the worker
+    // thread.  The handler can't allocate or lock, so it claims a free slot
+    // and fills it in; if none is free, the sample is dropped.
+    struct RawSample
+    {
+        enum State : int { Empty, Writing, Ready };
+        std::atomic<int> state;
+        int depth;
+        void *frames[SampleProfiler::MaxFrames];
+    };
+    enum : unsigned { RawSampleCount = 64 };
+    RawSample g_rawSamples[RawSampleCount];
+    std::atomic<unsigned> g_nextRawSample{0};
+    std::atomic<quint64> g_droppedRawSamples{0};
+
+    // The first two frames in the handler's stack are the handler itself and
+    // the signal trampoline
+    const int signalHandlerFrames = 2;
+
+    struct sigaction g_oldProfAction;
+
+    void profSignalHandler(int)
+    {
+        int savedErrno = errno;
+        unsigned index = g_nextRawSample.fetch_add(1, std::memory_order_relaxed) % RawSampleCount;
+        RawSample &rawSample = g_rawSamples[index];
+        int expected = RawSample::Empty;
+        if(rawSample.state.compare_exchange_strong(expected, RawSample::Writing,
+                                                   std::memory_order_acquire))
+        {
+            rawSample.depth = ::backtrace(rawSample.frames, SampleProfiler::MaxFrames);
+            rawSample.state.store(RawSample::Ready, std::memory_order_release);
+        }
+        else
+            g_droppedRawSamples.fetch_add(1, std::memory_order_relaxed);
+        errno = savedErrno;
+    }
+#endif
+}
+
+SampleProfiler::SampleProfiler()
+    : _running{false}, _sampleCount{0}, _droppedCount{0}
+{
+#ifdef Q_OS_WIN
+    _hTargetThread = nullptr;
+    if(!::DuplicateHandle(::GetCurrentProcess(), ::GetCurrentThread(),
+                          ::GetCurrentProcess(), &_hTargetThread,
+                          THREAD_SUSPEND_RESUME|THREAD_GET_CONTEXT|THREAD_QUERY_INFORMATION,
+                          FALSE, 0))
+    {
+        qWarning() << "Unable to open target thread for sampling -" << ::GetLastError();
+        _hTargetThread = nullptr;
+    }
+#else
+    _targetThread = ::pthread_self();
+#endif
+}
+
+SampleProfiler::~SampleProfiler()
+{
+    stop();
+#ifdef Q_OS_WIN
+    if(_hTargetThread)
+        ::CloseHandle(_hTargetThread);
+#endif
+}
+
+bool SampleProfiler::start(std::chrono::milliseconds interval)
+{
+    if(_running)
+        stop();
+
+#ifdef Q_OS_WIN
+    if(!_hTargetThread)
+        return false;
+#endif
+
+    bool expected = false;
+    if(!g_profilerActive.compare_exchange_strong(expected, true))
+    {
+        qWarning() << "Another profiler is already running";
+        return false;
+    }
+
+#ifndef Q_OS_WIN
+    // backtrace() loads the unwinder the first time it's called, which isn't
+    // safe in a signal handler; call it once here first
+    void *primeFrames[1];
+    ::backtrace(primeFrames, 1);
+    for(auto &rawSample : g_rawSamples)
+        rawSample.state.store(RawSample::Empty, std::memory_order_relaxed);
+    g_droppedRawSamples = 0;
+
+    struct sigaction action{};
+    action.sa_handler = &profSignalHandler;
+    // Interrupted calls on the target thread are restarted, so sampling
+    // doesn't cause spurious EINTR errors
+    action.sa_flags = SA_RESTART;
+    ::sigemptyset(&action.sa_mask);
+    if(::sigaction(SIGPROF, &action, &g_oldProfAction) != 0)
+    {
+        qWarning() << "Unable to install sampling signal handler -" << errno;
+        g_profilerActive = false;
+        return false;
+    }
+#endif
+
+    _samplerThread.invokeOnThread([&]()
+    {
+#ifdef Q_OS_WIN
+        ::SymSetOptions(SYMOPT_UNDNAME|SYMOPT_DEFERRED_LOADS);
+        if(!::SymInitialize(::GetCurrentProcess(), nullptr, TRUE))
+            qWarning() << "Unable to load symbols for sampling -" << ::GetLastError();
+#endif
+        _symbols.clear();
+        _stacks.clear();
+        _sampleCount = 0;
+        _droppedCount = 0;
+        _pSampleTimer = new QTimer{&_samplerThread.objectOwner()};
+        _pSampleTimer->setTimerType(Qt::TimerType::PreciseTimer);
+        connect(_pSampleTimer.data(), &QTimer::timeout, _pSampleTimer.data(),
+                [this](){sample();});
+        _pSampleTimer->start(interval);
+    });
+
+    qInfo() << "Started sampling every" << traceMsec(interval);
+    _running = true;
+    return true;
+}
+
+void SampleProfiler::stop()
+{
+    if(!_running)
+        return;
+
+    _samplerThread.invokeOnThread([&]()
+    {
+        delete _pSampleTimer.data();
+#ifndef Q_OS_WIN
+        drainSamples();
+#else
+        ::SymCleanup(::GetCurrentProcess());
+#endif
+    });
+
+#ifndef Q_OS_WIN
+    ::sigaction(SIGPROF, &g_oldProfAction, nullptr);
+#endif
+    g_profilerActive = false;
+    _running = false;
+    qInfo() << "Stopped sampling, collected" << _sampleCount << "samples ("
+        << _droppedCount << "dropped)";
+}
+
+QString SampleProfiler::foldedStacks()
+{
+    QString result;
+    _samplerThread.invokeOnThread([&]()
+    {
+#ifndef Q_OS_WIN
+        if(_running)
+            drainSamples();
+#endif
+        std::vector<std::pair<QString, quint64>> stacks;
+        stacks.reserve(static_cast<std::size_t>(_stacks.size()));
+        for(auto itStack = _stacks.begin(); itStack != _stacks.end(); ++itStack)
+            stacks.emplace_back(itStack.key(), itStack.value());
+        std::sort(stacks.begin(), stacks.end(),
+                  [](const std::pair<QString, quint64> &first,
+                     const std::pair<QString, quint64> &second)
+                  {
+                      return first.second > second.second;
+                  });
+        for(const auto &stack : stacks)
+            result += QStringLiteral("%1 %2\n").arg(stack.first).arg(stack.second);
+        if(_droppedCount)
+            result += QStringLiteral("[dropped] %1\n").arg(_droppedCount);
+    });
+    return result;
+}
+
+void SampleProfiler::sample()
+{
+#ifdef Q_OS_WIN
+    void *frames[MaxFrames];
+    int depth = 0;
+
+    // Nothing can be allocated or logged while the target is suspended, it
+    // might hold the heap lock
+    if(::SuspendThread(_hTargetThread) == static_cast<DWORD>(-1))
+        return;
+    CONTEXT context{};
+    context.ContextFlags = CONTEXT_FULL;
+    if(::GetThreadContext(_hTargetThread, &context))
+    {
+#if defined(_M_X64)
+        while(depth < MaxFrames && context.Rip)
+        {
+            frames[depth++] = reinterpret_cast<void*>(context.Rip);
+            DWORD64 imageBase{};
+            PRUNTIME_FUNCTION pFunction = ::RtlLookupFunctionEntry(context.Rip, &imageBase, nullptr);
+            if(pFunction)
+            {
+                PVOID pHandlerData{};
+                DWORD64 establisherFrame{};
+                ::RtlVirtualUnwind(UNW_FLAG_NHANDLER, imageBase, context.Rip,
+                                   pFunction, &context, &pHandlerData,
+                                   &establisherFrame, nullptr);
+            }
+            else
+            {
+                // Leaf function - the return address is on top of the stack
+                context.Rip = *reinterpret_cast<DWORD64*>(context.Rsp);
+                context.Rsp += sizeof(DWORD64);
+            }
+        }
+#elif defined(_M_IX86)
+        // Frames can't be unwound reliably without frame pointers; just
+        // sample the current function
+        frames[depth++] = reinterpret_cast<void*>(context.Eip);
+#elif defined(_M_ARM64)
+        frames[depth++] = reinterpret_cast<void*>(context.Pc);
+#endif
+    }
+    ::ResumeThread(_hTargetThread);
+
+    addSample(frames, depth);
+#else
+    ::pthread_kill(_targetThread, SIGPROF);
+    // The handler runs asynchronously on the target thread; drain the samples
+    // that have completed so far, the rest are picked up on the next tick
+    drainSamples();
+#endif
+}
+
+void SampleProfiler::drainSamples()
+{
+#ifndef Q_OS_WIN
+    for(auto &rawSample : g_rawSamples)
+    {
+        if(rawSample.state.load(std::memory_order_acquire) != RawSample::Ready)
+            continue;
+        if(rawSample.depth > signalHandlerFrames)
+        {
+            addSample(rawSample.frames + signalHandlerFrames,
+                      rawSample.depth - signalHandlerFrames);
+        }
+        rawSample.state.store(RawSample::Empty, std::memory_order_release);
+    }
+    _droppedCount += g_droppedRawSamples.exchange(0, std::memory_order_relaxed);
+#endif
+}
+
+void SampleProfiler::addSample(void * const *frames, int depth)
+{
+    if(depth <= 0)
+        return;
+
+    // The frames are innermost first; folded stacks are outermost first
+    QStringList names;
+    names.reserve(depth);
+    for(int i = depth-1; i >= 0; --i)
+        names.push_back(symbolName(frames[i]));
+    QString stack = names.join(QLatin1Char(';'));
+
+    auto itStack = _stacks.find(stack);
+    if(itStack != _stacks.end())
+        ++itStack.value();
+    else if(_stacks.size() < MaxStacks)
+        _stacks.insert(stack, 1);
+    else
+    {
+        ++_droppedCount;
+        return;
+    }
+    ++_sampleCount;
+}
+
+QString SampleProfiler::symbolName(void *address)
+{
+    auto itSymbol = _symbols.find(address);
+    if(itSymbol != _symbols.end())
+        return itSymbol.value();
+
+    QString name;
+#ifdef Q_OS_WIN
+    alignas(SYMBOL_INFO) char symbolBuffer[sizeof(SYMBOL_INFO) + MAX_SYM_NAME];
+    SYMBOL_INFO *pSymbol = reinterpret_cast<SYMBOL_INFO*>(symbolBuffer);
+    pSymbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+    pSymbol->MaxNameLen = MAX_SYM_NAME;
+    DWORD64 displacement{};
+    if(::SymFromAddr(::GetCurrentProcess(), reinterpret_cast<DWORD64>(address),
+                     &displacement, pSymbol))
+    {
+        name = QString::fromLocal8Bit(pSymbol->Name, static_cast<int>(pSymbol->NameLen));
+    }
+#else
+    Dl_info info{};
+    if(::dladdr(address, &info) && info.dli_sname)
+    {
+        int status = 0;
+        char *pDemangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        name = QString::fromUtf8(status == 0 && pDemangled ? pDemangled : info.dli_sname);
+        std::free(pDemangled);
+    }
+#endif
+    // Unknown symbols are identified by address.  ';' would split the frame
+    // in the folded output, and spaces would split off the count.
+    if(name.isEmpty())
+        name = QStringLiteral("0x%1").arg(reinterpret_cast<quintptr>(address), 0, 16);
+    name.replace(QLatin1Char(';'), QLatin1Char(':'));
+    name.replace(QLatin1Char(' '), QLatin1Char('_'));
+    _symbols.insert(address, name);
+    return name;
+}
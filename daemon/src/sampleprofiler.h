@@ -0,0 +1,107 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("sampleprofiler.h")
+
+#ifndef SAMPLEPROFILER_H
+#define SAMPLEPROFILER_H
+
+#include "thread.h"
+#include <QHash>
+#include <QPointer>
+#include <QTimer>
+#include <chrono>
+
+#ifndef Q_OS_WIN
+#include <pthread.h>
+#endif
+
+// SampleProfiler periodically samples the call stack of the thread that
+// created it (the daemon's main thread), so the cause of a slow or busy daemon
+// can be found on a machine where it can't be reproduced with a debugger.
+//
+// Sampling runs on a dedicated worker thread:
+// - on Windows, the target thread is suspended briefly and its stack is
+//   unwound from its context
+// - on Mac and Linux, the target thread is sent SIGPROF, and the signal
+//   handler captures the stack with backtrace() into a preallocated buffer
+//
+// The stacks are symbolized on the worker thread and aggregated into
+// "folded" stacks (one line per unique stack, "outer;...;inner count"), which
+// can be rendered directly as a flame graph.
+//
+// The profiler is opt-in; it has no cost until start() is called.  Only one
+// SampleProfiler can be running at a time.
+class SampleProfiler : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("daemon.profiler")
+
+public:
+    // Maximum stack depth captured for each sample; deeper frames are lost
+    enum : int { MaxFrames = 64 };
+    // Maximum number of unique stacks kept; once reached, samples with new
+    // stacks are only counted as dropped
+    enum : int { MaxStacks = 4096 };
+
+public:
+    // Create SampleProfiler on the thread that it should sample.
+    SampleProfiler();
+    ~SampleProfiler();
+
+public:
+    bool running() const {return _running;}
+
+    // Start sampling every 'interval'.  Samples from a previous run are
+    // discarded.  Returns false if sampling isn't possible on this platform or
+    // another profiler is already running.
+    bool start(std::chrono::milliseconds interval);
+    // Stop sampling.  The aggregated samples are kept until the next start().
+    void stop();
+
+    // Get the folded stacks collected so far, most frequent first.  Empty if
+    // nothing has been sampled.
+    QString foldedStacks();
+
+private:
+    // These are only used on the worker thread
+    void sample();
+    void drainSamples();
+    void addSample(void * const *frames, int depth);
+    QString symbolName(void *address);
+
+private:
+#ifdef Q_OS_WIN
+    void *_hTargetThread;
+#else
+    pthread_t _targetThread;
+#endif
+    bool _running;
+    // Worker thread state - the sampling timer, symbol names cached by
+    // address, and the aggregated stacks.
+    QPointer<QTimer> _pSampleTimer;
+    QHash<void*, QString> _symbols;
+    QHash<QString, quint64> _stacks;
+    quint64 _sampleCount;
+    quint64 _droppedCount;
+    // Declared last so it's shut down before the state above is destroyed
+    RunningWorkerThread _samplerThread;
+};
+
+#endif
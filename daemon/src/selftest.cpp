@@ -0,0 +1,211 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("selftest.cpp")
+
+#include "selftest.h"
+#include "apinetwork.h"
+#include <QNetworkRequest>
+#include <QRandomGenerator>
+#include <QtEndian>
+#include <algorithm>
+
+namespace
+{
+    // Latency probes sent to the gateway, and the interval between them
+    const int latencyProbeCount{5};
+    const std::chrono::milliseconds latencyProbeInterval{200};
+    // Time to wait for replies after the last probe is sent
+    const std::chrono::seconds latencyTimeout{1};
+    const quint16 dnsPort{53};
+
+    // Time limit for the download.  This is kept short so the test fits in
+    // the CLI's default timeout; it's enough to get past TCP slow start on
+    // most links.
+    const std::chrono::seconds downloadDuration{3};
+    // Time limit to wait for the download to begin
+    const std::chrono::seconds downloadStartTimeout{5};
+
+    // Build a DNS query for the root NS records.  The answer doesn't matter,
+    // only that the gateway replies.
+    QByteArray buildDnsQuery(quint16 id)
+    {
+        QByteArray query(17, '\0');
+        uchar *pData = reinterpret_cast<uchar*>(query.data());
+        qToBigEndian<quint16>(id, pData);
+        qToBigEndian<quint16>(0x0100, pData + 2);  // Recursion desired
+        qToBigEndian<quint16>(1, pData + 4);       // One question
+        // Root name is a single 0 byte at offset 12
+        qToBigEndian<quint16>(2, pData + 13);      // QTYPE NS
+        qToBigEndian<quint16>(1, pData + 15);      // QCLASS IN
+        return query;
+    }
+}
+
+SelfTest::SelfTest(QObject *pParent, const QHostAddress &localAddress,
+                   const QHostAddress &gateway, const QString &downloadUri)
+    : QObject{pParent}, _gateway{gateway}, _downloadUri{downloadUri},
+      _result{}, _probesSent{0}, _nextQueryId{0}, _downloadBytes{0}
+{
+    _nextQueryId = static_cast<quint16>(QRandomGenerator::global()->bounded(0x10000));
+
+    _probeTimer.setInterval(msec32(latencyProbeInterval));
+    connect(&_probeTimer, &QTimer::timeout, this, &SelfTest::sendLatencyProbe);
+    _phaseTimeout.setSingleShot(true);
+
+    connect(&_probeSocket, &QUdpSocket::readyRead, this,
+            &SelfTest::onLatencyReadyRead);
+
+    if(!_probeSocket.bind(localAddress, 0))
+    {
+        qWarning() << "Unable to bind latency probe socket to" << localAddress
+            << "-" << _probeSocket.errorString();
+        // Skip to the download; queue it so finished() isn't emitted during
+        // the constructor
+        QMetaObject::invokeMethod(this, &SelfTest::beginDownload, Qt::QueuedConnection);
+        return;
+    }
+
+    qInfo() << "Measuring latency to gateway" << _gateway;
+    sendLatencyProbe();
+    _probeTimer.start();
+}
+
+void SelfTest::sendLatencyProbe()
+{
+    if(_probesSent >= latencyProbeCount)
+    {
+        _probeTimer.stop();
+        connect(&_phaseTimeout, &QTimer::timeout, this, &SelfTest::finishLatency);
+        _phaseTimeout.start(msec32(latencyTimeout));
+        return;
+    }
+
+    quint16 id = _nextQueryId++;
+    _pendingProbes[id].start();
+    ++_probesSent;
+    _probeSocket.writeDatagram(buildDnsQuery(id), _gateway, dnsPort);
+}
+
+void SelfTest::onLatencyReadyRead()
+{
+    while(_probeSocket.hasPendingDatagrams())
+    {
+        QByteArray reply(static_cast<int>(_probeSocket.pendingDatagramSize()), '\0');
+        QHostAddress sender;
+        qint64 size = _probeSocket.readDatagram(reply.data(), reply.size(), &sender);
+        if(size < 2 || sender != _gateway)
+            continue;
+
+        quint16 id = qFromBigEndian<quint16>(reinterpret_cast<const uchar*>(reply.constData()));
+        auto itProbe = _pendingProbes.find(id);
+        if(itProbe == _pendingProbes.end())
+            continue;
+
+        double rtt = itProbe->nsecsElapsed() / 1000000.0;
+        _pendingProbes.erase(itProbe);
+        if(!_result.tunnelLatency || rtt < *_result.tunnelLatency)
+            _result.tunnelLatency = rtt;
+    }
+
+    // If all probes have been answered, there's no need to wait
+    if(_probesSent >= latencyProbeCount && _pendingProbes.isEmpty())
+        finishLatency();
+}
+
+void SelfTest::finishLatency()
+{
+    _probeTimer.stop();
+    _phaseTimeout.stop();
+    _phaseTimeout.disconnect(this);
+    _probeSocket.close();
+    _pendingProbes.clear();
+
+    if(_result.tunnelLatency)
+        qInfo() << "Gateway latency:" << *_result.tunnelLatency << "ms";
+    else
+        qWarning() << "No replies from gateway" << _gateway;
+
+    beginDownload();
+}
+
+void SelfTest::beginDownload()
+{
+    if(_downloadUri.isEmpty())
+    {
+        qInfo() << "No download resource known, skipping download test";
+        emit finished(_result);
+        return;
+    }
+
+    qInfo() << "Measuring download rate from" << _downloadUri;
+    QNetworkRequest request{_downloadUri};
+    request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+    _pDownload = ApiNetwork::instance()->getAccessManager().get(request);
+    connect(_pDownload.data(), &QNetworkReply::readyRead, this,
+            &SelfTest::onDownloadReadyRead);
+    connect(_pDownload.data(), &QNetworkReply::finished, this,
+            &SelfTest::finishDownload);
+
+    connect(&_phaseTimeout, &QTimer::timeout, this, &SelfTest::finishDownload);
+    _phaseTimeout.start(msec32(downloadStartTimeout));
+}
+
+void SelfTest::onDownloadReadyRead()
+{
+    if(!_pDownload)
+        return;
+
+    if(!_downloadTime.isValid())
+    {
+        // Measure from the first data; limit the download from here
+        _downloadTime.start();
+        _phaseTimeout.start(msec32(downloadDuration));
+    }
+    // The data aren't needed, just count them
+    _downloadBytes += _pDownload->skip(_pDownload->bytesAvailable());
+}
+
+void SelfTest::finishDownload()
+{
+    _phaseTimeout.stop();
+    _phaseTimeout.disconnect(this);
+    if(_pDownload)
+    {
+        // Read anything left before the reply is aborted
+        onDownloadReadyRead();
+        _pDownload->disconnect(this);
+        if(_pDownload->error() != QNetworkReply::NoError)
+            qWarning() << "Download ended with error" << _pDownload->errorString();
+        _pDownload->abort();
+        _pDownload->deleteLater();
+        _pDownload = nullptr;
+    }
+
+    qint64 elapsedMs = _downloadTime.isValid() ? _downloadTime.elapsed() : 0;
+    if(_downloadBytes > 0)
+    {
+        _result.downloadRate = _downloadBytes * 1000.0 / std::max<qint64>(elapsedMs, 1);
+        qInfo() << "Downloaded" << _downloadBytes << "bytes in" << elapsedMs
+            << "ms -" << *_result.downloadRate / 1000000.0 << "MB/s";
+    }
+    else
+        qWarning() << "No data received from" << _downloadUri;
+
+    emit finished(_result);
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("selftest.h")
+
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QHostAddress>
+#include <QNetworkReply>
+#include <QPointer>
+#include <QTimer>
+#include <QUdpSocket>
+#include <chrono>
+
+// SelfTest measures the VPN connection from inside the tunnel, so slowness can
+// be attributed to the VPN server or to the user's own link:
+// - the roundtrip time to the VPN gateway, measured with DNS queries sent from
+//   the tunnel's local address (any reply counts, even an error)
+// - the rate of a short bulk download, made with ApiNetwork (which is bound to
+//   the tunnel while connected)
+//
+// The Daemon compares these to the latency measured by LatencyTracker before
+// connecting.  The test begins when SelfTest is created, and finished() is
+// emitted once; destroy the SelfTest to abandon it.
+class SelfTest : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("selftest")
+
+public:
+    // Results of the test; a measurement is null if it couldn't be made.
+    struct Result
+    {
+        // Minimum roundtrip time to the gateway (ms)
+        nullable_t<double> tunnelLatency;
+        // Download rate (bytes per second)
+        nullable_t<double> downloadRate;
+    };
+
+public:
+    // localAddress and gateway are the tunnel's local and remote addresses.
+    // downloadUri is the resource to download; if it's empty, no download is
+    // done.
+    SelfTest(QObject *pParent, const QHostAddress &localAddress,
+             const QHostAddress &gateway, const QString &downloadUri);
+
+signals:
+    void finished(const SelfTest::Result &result);
+
+private:
+    void sendLatencyProbe();
+    void onLatencyReadyRead();
+    void finishLatency();
+    void beginDownload();
+    void onDownloadReadyRead();
+    void finishDownload();
+
+private:
+    QHostAddress _gateway;
+    QString _downloadUri;
+    Result _result;
+
+    QUdpSocket _probeSocket;
+    QTimer _probeTimer;
+    QTimer _phaseTimeout;
+    // Send time of each outstanding probe, by DNS query ID
+    QHash<quint16, QElapsedTimer> _pendingProbes;
+    int _probesSent;
+    quint16 _nextQueryId;
+
+    QPointer<QNetworkReply> _pDownload;
+    // Started when the first data arrive, so connection setup isn't counted
+    QElapsedTimer _downloadTime;
+    qint64 _downloadBytes;
+};
+
+Q_DECLARE_METATYPE(SelfTest::Result);
+
+#endif
@@ -0,0 +1,133 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("socksresolver.cpp")
+
+#include "socksresolver.h"
+#include <QDnsLookup>
+#include <QMutexLocker>
+#include <algorithm>
+
+SocksResolver::SocksResolver(QStringList dnsServers)
+    : _dnsServers{std::move(dnsServers)}
+{
+}
+
+void SocksResolver::updateDnsServers(QStringList dnsServers)
+{
+    QMutexLocker lock{&_mutex};
+    if(dnsServers != _dnsServers)
+    {
+        _dnsServers = std::move(dnsServers);
+        _cache.clear();
+    }
+}
+
+QHostAddress SocksResolver::findCached(const QString &name)
+{
+    QMutexLocker lock{&_mutex};
+    auto itEntry = _cache.find(name);
+    if(itEntry == _cache.end())
+        return {};
+    if(itEntry->expiration.hasExpired())
+    {
+        _cache.erase(itEntry);
+        return {};
+    }
+    return itEntry->address;
+}
+
+void SocksResolver::store(const QString &name, const QHostAddress &address,
+                          quint32 ttlSec)
+{
+    // A TTL of 0 means the result must not be cached
+    if(ttlSec == 0)
+        return;
+
+    QMutexLocker lock{&_mutex};
+    if(_cache.size() >= MaxEntries)
+    {
+        // Drop expired entries; if that isn't enough, start over
+        for(auto itEntry = _cache.begin(); itEntry != _cache.end();)
+        {
+            if(itEntry->expiration.hasExpired())
+                itEntry = _cache.erase(itEntry);
+            else
+                ++itEntry;
+        }
+        if(_cache.size() >= MaxEntries)
+            _cache.clear();
+    }
+
+    qint64 ttlMsec = std::min<qint64>(ttlSec, MaxTtlSec) * 1000;
+    _cache.insert(name, {address, QDeadlineTimer{ttlMsec}});
+}
+
+void SocksResolver::resolve(const QString &name, QObject &context,
+                            Callback callback)
+{
+    QHostAddress cached = findCached(name);
+    if(!cached.isNull())
+    {
+        callback(cached);
+        return;
+    }
+
+    QHostAddress nameserver;
+    {
+        QMutexLocker lock{&_mutex};
+        if(!_dnsServers.isEmpty())
+            nameserver.setAddress(_dnsServers.first());
+    }
+
+    QDnsLookup *pLookup = new QDnsLookup{QDnsLookup::Type::A, name, &context};
+    if(!nameserver.isNull())
+        pLookup->setNameserver(nameserver);
+    QObject::connect(pLookup, &QDnsLookup::finished, &context,
+        [this, pLookup, name, callback = std::move(callback)]()
+        {
+            pLookup->deleteLater();
+            if(pLookup->error() != QDnsLookup::Error::NoError)
+            {
+                qWarning() << "Unable to resolve" << name << "-"
+                    << pLookup->errorString();
+                callback({});
+                return;
+            }
+
+            // Use the first IPv4 address; SocksConnection only supports IPv4
+            // targets.
+            const auto &records = pLookup->hostAddressRecords();
+            auto itRecord = std::find_if(records.begin(), records.end(),
+                [](const QDnsHostAddressRecord &record)
+                {
+                    return record.value().protocol() == QAbstractSocket::NetworkLayerProtocol::IPv4Protocol;
+                });
+            if(itRecord == records.end())
+            {
+                qWarning() << "No IPv4 addresses found for" << name;
+                callback({});
+                return;
+            }
+
+            store(name, itRecord->value(), itRecord->timeToLive());
+            callback(itRecord->value());
+        });
+    pLookup->lookup();
+}
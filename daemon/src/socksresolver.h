@@ -0,0 +1,86 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("socksresolver.h")
+
+#ifndef SOCKSRESOLVER_H
+#define SOCKSRESOLVER_H
+
+#include <QDeadlineTimer>
+#include <QHash>
+#include <QHostAddress>
+#include <QMutex>
+#include <QStringList>
+#include <functional>
+
+// SocksResolver resolves domain names requested by SOCKS clients, using the
+// VPN's DNS servers.  Results are cached for their DNS TTL, so repeated
+// connections to the same host do not each perform a lookup.
+//
+// One SocksResolver is shared by all of a SocksServer's workers; the cache is
+// locked internally.  Lookups are performed asynchronously with QDnsLookup on
+// the calling thread's event loop.
+class SocksResolver
+{
+    CLASS_LOGGING_CATEGORY("socksserver");
+
+public:
+    using Callback = std::function<void(const QHostAddress &address)>;
+
+    // Cache limits - TTLs longer than MaxTtl are capped, and the cache is
+    // pruned if it reaches MaxEntries.
+    enum : int { MaxTtlSec = 3600 };
+    enum : int { MaxEntries = 256 };
+
+public:
+    // Create SocksResolver with the DNS servers to use.  If the list is empty,
+    // the system's DNS configuration is used.
+    explicit SocksResolver(QStringList dnsServers);
+
+public:
+    // Update the DNS servers; also clears the cache since the results may
+    // differ.
+    void updateDnsServers(QStringList dnsServers);
+
+    // Resolve a name to an IPv4 address.  If the name is cached, callback is
+    // invoked synchronously.  Otherwise, a lookup is started and owned by
+    // context; callback is invoked on context's thread when it completes
+    // unless context is destroyed first.  On failure, callback receives a
+    // null address.
+    void resolve(const QString &name, QObject &context, Callback callback);
+
+private:
+    // Look up a name in the cache - returns a null address if it's not cached
+    // or has expired.
+    QHostAddress findCached(const QString &name);
+    void store(const QString &name, const QHostAddress &address, quint32 ttlSec);
+
+private:
+    struct CacheEntry
+    {
+        QHostAddress address;
+        QDeadlineTimer expiration;
+    };
+
+    QMutex _mutex;
+    QStringList _dnsServers;
+    QHash<QString, CacheEntry> _cache;
+};
+
+#endif
@@ -23,14 +23,32 @@
 #include "brand.h"
 #include <QRandomGenerator>
 #include <QCryptographicHash>
+#include <algorithm>
+#include <array>
 
-// For SO_BINDTODEVICE
+// For SO_BINDTODEVICE, and the splice() relay
 #ifdef Q_OS_LINUX
+#include "linux/linux_splicerelay.h"
 #include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// To close a descriptor that couldn't be adopted by a worker
+#ifdef Q_OS_WIN
+#include <winsock2.h>
+#else
+#include <unistd.h>
 #endif
 
 namespace
 {
+    // Size of the buffer used to forward data between the QTcpSockets
+    enum : std::size_t { ForwardBufferSize = 16 * 1024 };
+    // Size of the buffer used to relay datagrams - the largest possible UDP
+    // payload
+    enum : std::size_t { DatagramBufferSize = 65535 };
+
     // SOCKS protocol constants
     enum : quint8
     {
@@ -49,12 +67,14 @@ namespace
     enum AddressType : quint8
     {
         IPv4 = 1,
+        DomainName = 3,
         IPv6 = 4,
     };
 
     enum Command : quint8
     {
         Connect = 1,
+        UdpAssociate = 3,
     };
 
     enum Reply : quint8
@@ -161,6 +181,21 @@ namespace
         };
     }
 
+    // Header on each datagram relayed for a UDP ASSOCIATE, in both directions.
+    // Only IPv4 addresses are supported, like CONNECT.
+    namespace UdpHeaderMsg
+    {
+        enum
+        {
+            Reserved,
+            Frag = Reserved + 2,
+            AddrType,
+            Addr,
+            Port = Addr + 4,
+            Length = Port + 2,
+        };
+    }
+
     // Read an unsigned big-endian integer from a QByteArray offset.  This is
     // slightly tricky since QByteArray returns 'chars' as its element type,
     // which may be signed.
@@ -200,22 +235,121 @@ namespace
 
         return !accumulatedDifference;
     }
+
+    // Buffer used to relay datagrams; reused for all datagrams on each thread.
+    std::array<char, DatagramBufferSize> &datagramBuffer()
+    {
+        static thread_local std::array<char, DatagramBufferSize> buffer;
+        return buffer;
+    }
+}
+
+void bindToVpn(QAbstractSocket &socket, const QHostAddress &bindAddress,
+               const QString &bindInterface)
+{
+    qInfo() << "Target socket:" << socket.socketDescriptor() << "->" << bindAddress;
+    if(!socket.bind(bindAddress))
+    {
+        qWarning() << "Bind failed on socket:" << socket.socketDescriptor()
+            << "->" << bindAddress << ":" << traceEnum(socket.error());
+    }
+    else
+        qInfo() << "Bind succeeded on socket:" << socket.socketDescriptor()
+            << "->" << bindAddress << "==" << socket.localAddress();
+
+// Also bind the socket to the interface on Linux, as Linux does not support the "strong host model"
+// meaning the packets won't be routed through our preferred interface based on source ip alone
+#ifdef Q_OS_LINUX
+    if(setsockopt(socket.socketDescriptor(), SOL_SOCKET, SO_BINDTODEVICE, qPrintable(bindInterface), bindInterface.size()))
+    {
+        qWarning() << QStringLiteral("setsockopt error: %1 (code: %2)").arg(qt_error_string(errno)).arg(errno);
+    }
+#else
+    Q_UNUSED(bindInterface);
+#endif
 }
 
 // The username doesn't really matter, brand code is a sane value
 const QByteArray SocksConnection::username = QByteArrayLiteral(BRAND_CODE);
 
-SocksServer::SocksServer(QHostAddress bindAddress, QString bindInterface)
-    : _bindAddress{std::move(bindAddress)},
-      _bindInterface{bindInterface}
+void SocksListener::incomingConnection(qintptr socketDescriptor)
+{
+    _handler(socketDescriptor);
+}
+
+void SocksWorker::addConnection(qintptr socketDescriptor,
+                                QByteArray passwordHash,
+                                QHostAddress bindAddress,
+                                QString bindInterface,
+                                SocksResolver &resolver, qint64 writeWatermark)
+{
+    // Count the connection now so the next one accepted sees this worker's
+    // load correctly, even if this one hasn't been handled yet.
+    ++_load;
+    // The captured state is all copied; 'this' remains valid since queued
+    // functors are run before _thread shuts down.
+    _thread.queueOnThread([this, socketDescriptor,
+                           passwordHash = std::move(passwordHash),
+                           bindAddress = std::move(bindAddress),
+                           bindInterface = std::move(bindInterface),
+                           &resolver, writeWatermark]()
+    {
+        QTcpSocket *pSocket = new QTcpSocket{&_thread.objectOwner()};
+        if(!pSocket->setSocketDescriptor(socketDescriptor))
+        {
+            qWarning() << "Unable to accept API proxy connection -"
+                << pSocket->errorString();
+            delete pSocket;
+#ifdef Q_OS_WIN
+            ::closesocket(static_cast<SOCKET>(socketDescriptor));
+#else
+            ::close(static_cast<int>(socketDescriptor));
+#endif
+            --_load;
+            return;
+        }
+
+        QObject::connect(pSocket, &QObject::destroyed, [this](){--_load;});
+        // SocksConnection manages its own lifetime; it becomes parented to the
+        // new QTcpSocket.
+        new SocksConnection{*pSocket, passwordHash, bindAddress, bindInterface,
+                            resolver, writeWatermark, _stats};
+    });
+}
+
+SocksServerStats SocksWorker::stats()
+{
+    SocksServerStats stats{};
+    _thread.invokeOnThread([&]()
+    {
+        stats = _stats;
+    });
+    return stats;
+}
+
+SocksServer::SocksServer(QHostAddress bindAddress, QString bindInterface,
+                         QStringList dnsServers, qint64 writeWatermark,
+                         int workerCount)
+    : _writeWatermark{writeWatermark},
+      _bindAddress{std::move(bindAddress)},
+      _bindInterface{bindInterface},
+      _resolver{std::move(dnsServers)},
+      _server{[this](qintptr socketDescriptor){onIncomingConnection(socketDescriptor);}}
 {
     Q_ASSERT(_bindAddress.protocol() == QAbstractSocket::NetworkLayerProtocol::IPv4Protocol);
 
+    if(workerCount <= 0)
+        workerCount = qBound(1, QThread::idealThreadCount(), static_cast<int>(MaxDefaultWorkers));
+
     if(_server.listen(QHostAddress::SpecialAddress::LocalHost))
     {
         Q_ASSERT(_server.serverPort()); // Should have assigned a port if listen succeeded
-        qInfo() << "Started API proxy on port" << _server.serverPort();
-        connect(&_server, &QTcpServer::newConnection, this, &SocksServer::onNewConnection);
+        qInfo() << "Started API proxy on port" << _server.serverPort() << "with"
+            << workerCount << "workers";
+
+        _workers.reserve(static_cast<std::size_t>(workerCount));
+        while(_workers.size() < static_cast<std::size_t>(workerCount))
+            _workers.push_back(std::make_unique<SocksWorker>());
 
         // Generate a password.  The SocksServer port is reachable by any
         // application, but we only intend to use it from the daemon.
@@ -233,32 +367,212 @@ SocksServer::SocksServer(QHostAddress bindAddress, QString bindInterface)
     }
 }
 
-void SocksServer::updateBindAddress(QHostAddress bindAddress, QString bindInterface)
+void SocksServer::applyConnectionSnapshot()
 {
-    // Checked by caller
-    Q_ASSERT(bindAddress.protocol() == QAbstractSocket::NetworkLayerProtocol::IPv4Protocol);
-    _bindAddress = std::move(bindAddress);
-    _bindInterface = bindInterface;
+    std::shared_ptr<const ConnectionSnapshot> pSnapshot{g_connectionSnapshot.get()};
+    if(!pSnapshot || pSnapshot == _pAppliedSnapshot)
+        return;
+    _pAppliedSnapshot = pSnapshot;
+
+    // The server is stopped when the VPN disconnects, keep the last address
+    // until then
+    if(!pSnapshot->connected ||
+       pSnapshot->tunnelDeviceLocalAddress.protocol() != QAbstractSocket::NetworkLayerProtocol::IPv4Protocol)
+    {
+        return;
+    }
+
+    if(pSnapshot->tunnelDeviceLocalAddress != _bindAddress ||
+       pSnapshot->tunnelDeviceName != _bindInterface)
+    {
+        qInfo() << "Updating SOCKS server bind address to"
+            << pSnapshot->tunnelDeviceLocalAddress;
+        _bindAddress = pSnapshot->tunnelDeviceLocalAddress;
+        _bindInterface = pSnapshot->tunnelDeviceName;
+    }
+    _resolver.updateDnsServers(pSnapshot->dnsServers);
 }
 
-void SocksServer::onNewConnection()
+SocksServerStats SocksServer::stats() const
 {
-    while(auto pNewConnection = _server.nextPendingConnection())
+    SocksServerStats totals{};
+    for(const auto &pWorker : _workers)
     {
-        // SocksConnection manages its own lifetime; it becomes parented to the
-        // new QTcpSocket.
-        new SocksConnection{*pNewConnection, _passwordHash, _bindAddress, _bindInterface};
+        SocksServerStats workerStats = pWorker->stats();
+        totals.connections += workerStats.connections;
+        totals.activeConnections += workerStats.activeConnections;
+        totals.bytesRelayed += workerStats.bytesRelayed;
+        totals.readPauses += workerStats.readPauses;
+        totals.peakBufferedBytes = std::max(totals.peakBufferedBytes,
+                                            workerStats.peakBufferedBytes);
+    }
+    return totals;
+}
+
+void SocksServer::onIncomingConnection(qintptr socketDescriptor)
+{
+    // Workers are only created if listen() succeeded, so there's at least one
+    Q_ASSERT(!_workers.empty());
+
+    applyConnectionSnapshot();
+
+    auto itLeastLoaded = std::min_element(_workers.begin(), _workers.end(),
+        [](const std::unique_ptr<SocksWorker> &pFirst,
+           const std::unique_ptr<SocksWorker> &pSecond)
+        {
+            return pFirst->load() < pSecond->load();
+        });
+    (*itLeastLoaded)->addConnection(socketDescriptor, _passwordHash,
+                                    _bindAddress, _bindInterface, _resolver,
+                                    _writeWatermark);
+}
+
+SocksUdpRelay::SocksUdpRelay(const QHostAddress &bindAddress,
+                             const QString &bindInterface,
+                             QHostAddress clientAddress, quint16 clientPort,
+                             SocksServerStats &stats, QObject *pParent)
+    : QObject{pParent}, _clientAddress{std::move(clientAddress)},
+      _clientPort{clientPort}, _stats{stats}
+{
+    // An all-zero address means the client doesn't know its address yet
+    if(_clientAddress == QHostAddress{QHostAddress::SpecialAddress::AnyIPv4})
+        _clientAddress.clear();
+
+    if(!_clientSocket.bind(QHostAddress::SpecialAddress::LocalHost))
+    {
+        qWarning() << "Unable to bind UDP relay socket:"
+            << traceEnum(_clientSocket.error());
+    }
+    bindToVpn(_targetSocket, bindAddress, bindInterface);
+
+    connect(&_clientSocket, &QUdpSocket::readyRead, this, &SocksUdpRelay::relayFromClient);
+    connect(&_targetSocket, &QUdpSocket::readyRead, this, &SocksUdpRelay::relayFromTarget);
+
+    if(isOpen())
+        qInfo() << "Started UDP relay on port" << clientPort();
+}
+
+bool SocksUdpRelay::isOpen() const
+{
+    return _clientSocket.state() == QAbstractSocket::SocketState::BoundState &&
+        _targetSocket.state() == QAbstractSocket::SocketState::BoundState;
+}
+
+void SocksUdpRelay::relayFromClient()
+{
+    auto &buffer = datagramBuffer();
+    while(_clientSocket.hasPendingDatagrams())
+    {
+        QHostAddress senderAddress;
+        quint16 senderPort{0};
+        qint64 size = _clientSocket.readDatagram(buffer.data(), buffer.size(),
+                                                 &senderAddress, &senderPort);
+        if(size < 0)
+            break;
+
+        // If the client didn't specify its endpoint, the first sender becomes
+        // the client.  Datagrams from anything else are dropped.
+        if(_clientAddress.isNull())
+            _clientAddress = senderAddress;
+        if(_clientPort == 0)
+            _clientPort = senderPort;
+        if(senderAddress != _clientAddress || senderPort != _clientPort)
+            continue;
+
+        // Fragmentation isn't supported (RFC1928 permits dropping fragments),
+        // and only IPv4 targets are supported.
+        if(size < UdpHeaderMsg::Length || buffer[UdpHeaderMsg::Frag] != 0 ||
+           buffer[UdpHeaderMsg::AddrType] != AddressType::IPv4)
+        {
+            continue;
+        }
+
+        const QByteArray header = QByteArray::fromRawData(buffer.data(), UdpHeaderMsg::Length);
+        QHostAddress targetAddress{readUnsignedBE<quint32>(header, UdpHeaderMsg::Addr)};
+        quint16 targetPort = readUnsignedBE<quint16>(header, UdpHeaderMsg::Port);
+        qint64 payloadSize = size - UdpHeaderMsg::Length;
+        auto written = _targetSocket.writeDatagram(buffer.data() + UdpHeaderMsg::Length,
+                                                   payloadSize, targetAddress,
+                                                   targetPort);
+        if(written != payloadSize)
+        {
+            qWarning() << "Failed to relay datagram of" << payloadSize
+                << "bytes to" << targetAddress << "port" << targetPort << "-"
+                << traceEnum(_targetSocket.error());
+        }
+        else
+            _stats.bytesRelayed += static_cast<quint64>(payloadSize);
+    }
+}
+
+void SocksUdpRelay::relayFromTarget()
+{
+    // Read each payload after room for the header, then fill in the header
+    auto &buffer = datagramBuffer();
+    while(_targetSocket.hasPendingDatagrams())
+    {
+        QHostAddress senderAddress;
+        quint16 senderPort{0};
+        qint64 size = _targetSocket.readDatagram(buffer.data() + UdpHeaderMsg::Length,
+                                                 buffer.size() - UdpHeaderMsg::Length,
+                                                 &senderAddress, &senderPort);
+        if(size < 0)
+            break;
+
+        // Nowhere to send it if the client hasn't sent anything yet
+        if(_clientAddress.isNull() || _clientPort == 0)
+            continue;
+
+        quint32 sender = senderAddress.toIPv4Address();
+        buffer[UdpHeaderMsg::Reserved] = 0;
+        buffer[UdpHeaderMsg::Reserved+1] = 0;
+        buffer[UdpHeaderMsg::Frag] = 0;
+        buffer[UdpHeaderMsg::AddrType] = AddressType::IPv4;
+        buffer[UdpHeaderMsg::Addr] = static_cast<char>(sender >> 24);
+        buffer[UdpHeaderMsg::Addr+1] = static_cast<char>(sender >> 16);
+        buffer[UdpHeaderMsg::Addr+2] = static_cast<char>(sender >> 8);
+        buffer[UdpHeaderMsg::Addr+3] = static_cast<char>(sender);
+        buffer[UdpHeaderMsg::Port] = static_cast<char>(senderPort >> 8);
+        buffer[UdpHeaderMsg::Port+1] = static_cast<char>(senderPort);
+
+        qint64 datagramSize = size + UdpHeaderMsg::Length;
+        auto written = _clientSocket.writeDatagram(buffer.data(), datagramSize,
+                                                   _clientAddress, _clientPort);
+        if(written != datagramSize)
+        {
+            qWarning() << "Failed to relay datagram of" << size
+                << "bytes from" << senderAddress << "port" << senderPort << "-"
+                << traceEnum(_clientSocket.error());
+        }
+        else
+            _stats.bytesRelayed += static_cast<quint64>(size);
     }
 }
 
 SocksConnection::SocksConnection(QTcpSocket &socksSocket,
                                  QByteArray passwordHash,
                                  const QHostAddress &bindAddress,
-                                 QString bindInterface)
+                                 QString bindInterface,
+                                 SocksResolver &resolver,
+                                 qint64 writeWatermark,
+                                 SocksServerStats &stats)
     : QObject{&socksSocket}, _socksSocket{socksSocket},
       _passwordHash{std::move(passwordHash)},
-      _state{State::ReceiveAuthMethodsHeader}, _nextMessageBytes{2}
+      _state{State::ReceiveAuthMethodsHeader}, _nextMessageBytes{2},
+      _udpAssociate{false}, _addressType{AddressType::IPv4},
+      _resolver{resolver}, _bindAddress{bindAddress},
+      _bindInterface{std::move(bindInterface)},
+      _writeWatermark{writeWatermark}, _stats{stats}
 {
+    ++_stats.connections;
+    ++_stats.activeConnections;
+
+    // Limit how much each QTcpSocket reads ahead.  When forwarding is paused,
+    // the read buffer fills up and QTcpSocket stops reading, which applies
+    // TCP flow control to the sender.
+    _socksSocket.setReadBufferSize(_writeWatermark);
+    _targetSocket.setReadBufferSize(_writeWatermark);
+
     connect(&_socksSocket, &QTcpSocket::readyRead, this, &SocksConnection::onSocksReadyRead);
     connect(&_socksSocket, QOverload<QTcpSocket::SocketError>::of(&QTcpSocket::error),
             this, &SocksConnection::onSocksError);
@@ -268,6 +582,14 @@ SocksConnection::SocksConnection(QTcpSocket &socksSocket,
     connect(&_targetSocket, QOverload<QTcpSocket::SocketError>::of(&QTcpSocket::error),
             this, &SocksConnection::onTargetError);
     connect(&_targetSocket, &QTcpSocket::disconnected, this, &SocksConnection::onTargetDisconnected);
+    connect(&_targetSocket, &QTcpSocket::bytesWritten, this, [this]()
+    {
+        resumeForwarding(_socksSocket, _targetSocket, QStringLiteral("outbound"));
+    });
+    connect(&_socksSocket, &QTcpSocket::bytesWritten, this, [this]()
+    {
+        resumeForwarding(_targetSocket, _socksSocket, QStringLiteral("inbound"));
+    });
 
     _abortTimer.setSingleShot(true);
     _abortTimer.setInterval(msec(std::chrono::seconds(5)));
@@ -281,28 +603,24 @@ SocksConnection::SocksConnection(QTcpSocket &socksSocket,
     // Time out if initial negotiation isn't completed
     _abortTimer.start();
 
-    qInfo() << "Target socket:" << _targetSocket.socketDescriptor() << "->" << bindAddress;
-    if(!_targetSocket.bind(bindAddress))
-    {
-        qWarning() << "Bind failed on socket:" << _targetSocket.socketDescriptor()
-            << "->" << bindAddress << ":" << traceEnum(_targetSocket.error());
-    }
-    else
-        qInfo() << "Bind succeeded on socket:" << _targetSocket.socketDescriptor()
-            << "->" << bindAddress << "==" << _targetSocket.localAddress();
+    bindToVpn(_targetSocket, _bindAddress, _bindInterface);
+}
 
-// Also bind the socket to the interface on Linux, as Linux does not support the "strong host model"
-// meaning the packets won't be routed through our preferred interface based on source ip alone
+SocksConnection::~SocksConnection()
+{
+    --_stats.activeConnections;
 #ifdef Q_OS_LINUX
-    if(setsockopt(_targetSocket.socketDescriptor(), SOL_SOCKET, SO_BINDTODEVICE, qPrintable(bindInterface), bindInterface.size()))
-    {
-        qWarning() << QStringLiteral("setsockopt error: %1 (code: %2)").arg(qt_error_string(errno)).arg(errno);
-    }
+    if(_pSpliceRelay)
+        _stats.bytesRelayed += _pSpliceRelay->bytesRelayed();
 #endif
 }
 
 void SocksConnection::abortConnection()
 {
+#ifdef Q_OS_LINUX
+    if(_pSpliceRelay)
+        _pSpliceRelay->close();
+#endif
     _socksSocket.abort();
     _targetSocket.abort();  // No effect if not connected
     _state = State::Closed;
@@ -366,23 +684,181 @@ bool SocksConnection::checkUPAuthVersion(const QByteArray &message)
 }
 
 void SocksConnection::forwardData(QTcpSocket &source, QTcpSocket &dest,
-                                  const QString &directionTrace)
+                                  const QString &directionTrace, bool flushAll)
 {
     Q_ASSERT(_state == State::Connected);   // Ensured by caller
 
-    auto data = source.readAll();
-    if(!data.isEmpty())
+    // Reuse one buffer instead of allocating a QByteArray for each read
+    static thread_local std::array<char, ForwardBufferSize> buffer;
+    qint64 forwarded = 0;
+    while(source.bytesAvailable() > 0)
     {
-        auto size = dest.write(data);
-        if(size != data.size())
+        if(!flushAll && dest.bytesToWrite() >= _writeWatermark)
         {
-            qWarning() << "Failed to forward" << data.size()
+            // Pause until dest drains; resumeForwarding() picks this up.
+            // Only count this if we just reached the watermark.
+            if(forwarded > 0)
+                ++_stats.readPauses;
+            break;
+        }
+        auto read = source.read(buffer.data(), buffer.size());
+        if(read <= 0)
+            break;
+        auto size = dest.write(buffer.data(), read);
+        if(size != read)
+        {
+            qWarning() << "Failed to forward" << read
                 << "bytes of" << directionTrace << "data -" << size;
             abortConnection();
+            return;
         }
+        forwarded += read;
+    }
+    _stats.bytesRelayed += static_cast<quint64>(forwarded);
+    _stats.peakBufferedBytes = std::max(_stats.peakBufferedBytes, dest.bytesToWrite());
+}
+
+void SocksConnection::resumeForwarding(QTcpSocket &source, QTcpSocket &dest,
+                                       const QString &directionTrace)
+{
+    if(_state == State::Connected && source.bytesAvailable() > 0 &&
+       dest.bytesToWrite() <= _writeWatermark / 2)
+    {
+        forwardData(source, dest, directionTrace);
     }
 }
 
+#ifdef Q_OS_LINUX
+bool SocksConnection::startSpliceRelay()
+{
+    Q_ASSERT(_state == State::Connected);   // Ensured by caller
+
+    // Anything QTcpSocket has already buffered has to be written out first,
+    // the relay only sees data that are still in the kernel.
+    _socksSocket.flush();
+    _targetSocket.flush();
+    if(_socksSocket.bytesAvailable() > 0 || _socksSocket.bytesToWrite() > 0 ||
+       _targetSocket.bytesAvailable() > 0 || _targetSocket.bytesToWrite() > 0)
+    {
+        return false;
+    }
+
+    // Duplicate the descriptors, the QTcpSockets close theirs when they're
+    // aborted below.
+    int socksFd = ::fcntl(static_cast<int>(_socksSocket.socketDescriptor()), F_DUPFD_CLOEXEC, 0);
+    int targetFd = ::fcntl(static_cast<int>(_targetSocket.socketDescriptor()), F_DUPFD_CLOEXEC, 0);
+    if(socksFd < 0 || targetFd < 0)
+    {
+        qWarning() << "Unable to duplicate sockets for relay:" << errno
+            << qPrintable(qt_error_string(errno));
+        if(socksFd >= 0)
+            ::close(socksFd);
+        if(targetFd >= 0)
+            ::close(targetFd);
+        return false;
+    }
+
+    // The relay owns the duplicated descriptors now
+    _pSpliceRelay = new LinuxSpliceRelay{socksFd, targetFd, this};
+    if(!_pSpliceRelay->isOpen())
+    {
+        delete _pSpliceRelay;
+        return false;
+    }
+
+    connect(_pSpliceRelay, &LinuxSpliceRelay::halfClosed, this, [this]()
+    {
+        // Like a disconnect in the Connected state, give the other side a
+        // few seconds to finish.
+        _abortTimer.start();
+    });
+    connect(_pSpliceRelay, &LinuxSpliceRelay::finished, this, [this]()
+    {
+        _abortTimer.stop();
+        _pSpliceRelay->close();
+        _state = State::Closed;
+        _socksSocket.deleteLater();
+    });
+    connect(_pSpliceRelay, &LinuxSpliceRelay::failed, this, [this]()
+    {
+        qInfo() << "Aborting relayed connection due to socket error";
+        abortConnection();
+    });
+
+    // Stop handling the QTcpSockets and release their descriptors.  The
+    // connections stay open through the duplicated descriptors.
+    _socksSocket.disconnect(this);
+    _targetSocket.disconnect(this);
+    _socksSocket.abort();
+    _targetSocket.abort();
+
+    _pSpliceRelay->start();
+    return true;
+}
+#endif
+
+void SocksConnection::startUdpAssociate(const QHostAddress &clientAddress,
+                                        quint16 clientPort)
+{
+    QByteArray response{ConnectResponseMsg::Length, 0};
+    response[ConnectResponseMsg::Version] = SocksVersion;
+    response[ConnectResponseMsg::AddrType] = AddressType::IPv4;
+
+    _pUdpRelay = new SocksUdpRelay{_bindAddress, _bindInterface, clientAddress,
+                                   clientPort, _stats, this};
+    if(!_pUdpRelay->isOpen())
+    {
+        qWarning() << "Rejecting UDP ASSOCIATE, unable to open relay";
+        delete _pUdpRelay;
+        response[ConnectResponseMsg::Reply] = Reply::GeneralFailure;
+        rejectConnection(response);
+        return;
+    }
+
+    _nextMessageBytes = 0;
+    _state = State::UdpAssociated;
+    // Negotiation completed; the relay lasts as long as the connection
+    _abortTimer.stop();
+
+    // The relay address is always localhost, the relay only listens there
+    response[ConnectResponseMsg::Reply] = Reply::Succeeded;
+    quint32 relayAddr = QHostAddress{QHostAddress::SpecialAddress::LocalHost}.toIPv4Address();
+    response[ConnectResponseMsg::Addr] = static_cast<quint8>(relayAddr >> 24);
+    response[ConnectResponseMsg::Addr+1] = static_cast<quint8>(relayAddr >> 16);
+    response[ConnectResponseMsg::Addr+2] = static_cast<quint8>(relayAddr >> 8);
+    response[ConnectResponseMsg::Addr+3] = static_cast<quint8>(relayAddr);
+    quint16 relayPort = _pUdpRelay->clientPort();
+    response[ConnectResponseMsg::Port] = static_cast<quint8>(relayPort >> 8);
+    response[ConnectResponseMsg::Port+1] = static_cast<quint8>(relayPort);
+    respond(response);
+}
+
+void SocksConnection::connectTarget(const QHostAddress &address, quint16 port)
+{
+    qInfo() << "Connecting to" << address << "port" << port;
+    _state = State::Connecting;
+    _targetSocket.connectToHost(address, port);
+}
+
+void SocksConnection::onTargetResolved(const QHostAddress &address, quint16 port)
+{
+    // Ignore the result if the connection was aborted in the meantime
+    if(_state != State::Resolving)
+        return;
+
+    if(address.isNull())
+    {
+        QByteArray response{ConnectResponseMsg::Length, 0};
+        response[ConnectResponseMsg::Version] = SocksVersion;
+        response[ConnectResponseMsg::AddrType] = AddressType::IPv4;
+        response[ConnectResponseMsg::Reply] = Reply::HostUnreachable;
+        rejectConnection(response);
+        return;
+    }
+
+    connectTarget(address, port);
+}
+
 void SocksConnection::onSocksReadyRead()
 {
     while(true)
@@ -557,14 +1033,17 @@ void SocksConnection::processSocksData()
             // understand the command or address type, we may not know how long
             // it is.
             // Ignore any subsquent data and send a rejection now.
-            if(receivedMsg.at(ConnectHeaderMsg::Command) != Command::Connect)
+            if(receivedMsg.at(ConnectHeaderMsg::Command) != Command::Connect &&
+               receivedMsg.at(ConnectHeaderMsg::Command) != Command::UdpAssociate)
             {
                 qInfo() << "Rejecting SOCKS connection, unexpected command"
                     << int(receivedMsg.at(ConnectHeaderMsg::Command));
                 response[ConnectResponseMsg::Reply] = Reply::CommandNotSupported;
                 rejectConnection(response);
             }
-            else if(receivedMsg.at(ConnectHeaderMsg::AddrType) != AddressType::IPv4)
+            else if(receivedMsg.at(ConnectHeaderMsg::AddrType) != AddressType::IPv4 &&
+                    (receivedMsg.at(ConnectHeaderMsg::AddrType) != AddressType::DomainName ||
+                     receivedMsg.at(ConnectHeaderMsg::Command) != Command::Connect))
             {
                 qInfo() << "Rejecting SOCKS connection, unexpected address type"
                     << int(receivedMsg.at(ConnectHeaderMsg::AddrType));
@@ -574,26 +1053,70 @@ void SocksConnection::processSocksData()
             else
             {
                 // Success, wait for address data
-                _nextMessageBytes = 6;  // IPv4 4 bytes + port 2 bytes
-                _state = State::ReceiveConnect;
+                _udpAssociate = receivedMsg.at(ConnectHeaderMsg::Command) == Command::UdpAssociate;
+                _addressType = static_cast<quint8>(receivedMsg.at(ConnectHeaderMsg::AddrType));
+                if(_addressType == AddressType::DomainName)
+                {
+                    _nextMessageBytes = 1;  // Name length
+                    _state = State::ReceiveConnectNameLength;
+                }
+                else
+                {
+                    _nextMessageBytes = 6;  // IPv4 4 bytes + port 2 bytes
+                    _state = State::ReceiveConnect;
+                }
             }
             break;
         }
+        case State::ReceiveConnectNameLength:
+            Q_ASSERT(receivedMsg.size() == 1);  // Message size for this state
+            // Name of the given length, then port 2 bytes
+            _nextMessageBytes = static_cast<quint8>(receivedMsg[0]) + 2;
+            _state = State::ReceiveConnect;
+            break;
         case State::ReceiveConnect:
         {
+            if(_addressType == AddressType::DomainName)
+            {
+                Q_ASSERT(receivedMsg.size() >= 2);  // Message size for this state
+                QString destName = QString::fromLatin1(receivedMsg.left(receivedMsg.size() - 2));
+                quint16 port = readUnsignedBE<quint16>(receivedMsg, static_cast<unsigned>(receivedMsg.size() - 2));
+                qInfo() << "Resolving" << destName << "for port" << port;
+                _nextMessageBytes = 0;
+                _state = State::Resolving;
+                // Negotiation completed, stop the abort timeout.  The DNS
+                // lookup has its own timeout.
+                _abortTimer.stop();
+                // This may call back synchronously if the name is cached.  The
+                // lookup is owned by this SocksConnection, so the callback
+                // can't occur after it's destroyed.
+                _resolver.resolve(destName, *this, [this, port](const QHostAddress &address)
+                {
+                    onTargetResolved(address, port);
+                });
+                break;
+            }
+
             Q_ASSERT(receivedMsg.size() == 6);  // Message size for this state
             quint32 destAddr = readUnsignedBE<quint32>(receivedMsg, 0);
             quint16 port = readUnsignedBE<quint16>(receivedMsg, 4);
             QHostAddress destHost{destAddr};
-            qInfo() << "Connecting to" << destHost << "port" << port;
+            if(_udpAssociate)
+            {
+                // For UDP ASSOCIATE, this is the address the client will send
+                // datagrams from (if it knows it)
+                qInfo() << "Associating UDP relay for" << destHost << "port" << port;
+                startUdpAssociate(destHost, port);
+                break;
+            }
             _nextMessageBytes = 0;
-            _state = State::Connecting;
             // Negotiation completed, now waiting on the connect - stop the
             // abort timeout
             _abortTimer.stop();
-            _targetSocket.connectToHost(destHost, port);
+            connectTarget(destHost, port);
             break;
         }
+        case State::Resolving:
         case State::Connecting:
             // If data is sent in this state, it's supposed to be forwarded
             // after the connection completes.  Don't do anything, let
@@ -603,6 +1126,9 @@ void SocksConnection::processSocksData()
             forwardData(_socksSocket, _targetSocket, QStringLiteral("outbound"));
             break;
         default:
+        case State::UdpAssociated:
+            // Nothing else is expected on the connection once the UDP relay
+            // is associated, it's only kept open to keep the relay alive.
         case State::SocksDisconnecting:
         case State::Closed:
             // Ignore any data sent in these states.
@@ -627,7 +1153,9 @@ void SocksConnection::onSocksDisconnected()
         case State::ReceiveAuthMethodsHeader:
         case State::ReceiveAuthMethods:
         case State::ReceiveConnectHeader:
+        case State::ReceiveConnectNameLength:
         case State::ReceiveConnect:
+        case State::Resolving:
         case State::Connecting:
         case State::TargetDisconnecting:
         case State::Closed:
@@ -640,7 +1168,11 @@ void SocksConnection::onSocksDisconnected()
             abortConnection();
             break;
         case State::Connected:
-            // This is normal, SOCKS side has shut down the connection.
+            // This is normal, SOCKS side has shut down the connection.  Forward
+            // anything still buffered from it, even if forwarding was paused.
+            forwardData(_socksSocket, _targetSocket, QStringLiteral("outbound"), true);
+            if(_state != State::Connected)
+                break;  // Aborted
             _state = State::TargetDisconnecting;
             _targetSocket.disconnectFromHost(); // Flushes data
             _abortTimer.start();
@@ -650,6 +1182,13 @@ void SocksConnection::onSocksDisconnected()
             _state = State::Closed;
             _socksSocket.deleteLater();
             break;
+        case State::UdpAssociated:
+            // This is normal, the client is done with the UDP relay.
+            qInfo() << "Closing UDP relay";
+            delete _pUdpRelay;
+            _state = State::Closed;
+            _socksSocket.deleteLater();
+            break;
     }
 }
 
@@ -661,11 +1200,14 @@ void SocksConnection::onTargetConnected()
         case State::ReceiveAuthMethodsHeader:
         case State::ReceiveAuthMethods:
         case State::ReceiveConnectHeader:
+        case State::ReceiveConnectNameLength:
         case State::ReceiveConnect:
+        case State::Resolving:
         case State::Connected:
         case State::SocksDisconnecting:
         case State::TargetDisconnecting:
         case State::Closed:
+        case State::UdpAssociated:
             // Unexpected, abort
             qInfo() << "Aborting connection in state" << traceEnum(_state)
                 << "due to unexpected target connect";
@@ -700,6 +1242,13 @@ void SocksConnection::onTargetConnected()
             // Could also have aborted in the first forwardData() call
             if(_state == State::Connected)
                 forwardData(_targetSocket, _socksSocket, QStringLiteral("inbound"));
+#ifdef Q_OS_LINUX
+            // Relay the rest of the connection in the kernel if possible
+            if(_state == State::Connected && startSpliceRelay())
+            {
+                qInfo() << "Relaying connection with splice()";
+            }
+#endif
 
             break;
         }
@@ -714,11 +1263,14 @@ void SocksConnection::onTargetError(QAbstractSocket::SocketError socketError)
         case State::ReceiveAuthMethodsHeader:
         case State::ReceiveAuthMethods:
         case State::ReceiveConnectHeader:
+        case State::ReceiveConnectNameLength:
         case State::ReceiveConnect:
+        case State::Resolving:
         case State::Connected:
         case State::SocksDisconnecting:
         case State::TargetDisconnecting:
         case State::Closed:
+        case State::UdpAssociated:
             // Unexpected, abort
             qInfo() << "Aborting connection in state" << traceEnum(_state)
                 << "due to target error" << traceEnum(socketError);
@@ -768,13 +1320,16 @@ void SocksConnection::onTargetReadyRead()
         case State::ReceiveAuthMethodsHeader:
         case State::ReceiveAuthMethods:
         case State::ReceiveConnectHeader:
+        case State::ReceiveConnectNameLength:
         case State::ReceiveConnect:
+        case State::Resolving:
         case State::Connecting:
             // Not ready to forward data, let the QTcpSocket buffer it
             break;
         case State::Connected:
             forwardData(_targetSocket, _socksSocket, QStringLiteral("inbound"));
             break;
+        case State::UdpAssociated:
         case State::SocksDisconnecting:
         case State::TargetDisconnecting:
         case State::Closed:
@@ -792,8 +1347,11 @@ void SocksConnection::onTargetDisconnected()
         case State::ReceiveAuthMethodsHeader:
         case State::ReceiveAuthMethods:
         case State::ReceiveConnectHeader:
+        case State::ReceiveConnectNameLength:
         case State::ReceiveConnect:
+        case State::Resolving:
         case State::Connecting:
+        case State::UdpAssociated:
         case State::SocksDisconnecting:
         case State::Closed:
             // Unexpected, abort.  Can occur in Receive* or Connecting if the
@@ -806,6 +1364,11 @@ void SocksConnection::onTargetDisconnected()
             break;
         case State::Connected:
             // This is normal, target side has shut down the connection.
+            // Forward anything still buffered from it, even if forwarding was
+            // paused.
+            forwardData(_targetSocket, _socksSocket, QStringLiteral("inbound"), true);
+            if(_state != State::Connected)
+                break;  // Aborted
             _state = State::SocksDisconnecting;
             _socksSocket.disconnectFromHost(); // Flushes data
             _abortTimer.start();
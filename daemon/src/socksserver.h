@@ -22,9 +22,91 @@
 #ifndef SOCKSSERVER_H
 #define SOCKSSERVER_H
 
+#include "connectionsnapshot.h"
+#include "socksresolver.h"
+#include "thread.h"
+#include <QPointer>
 #include <QTcpServer>
 #include <QTcpSocket>
 #include <QTimer>
+#include <QUdpSocket>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#ifdef Q_OS_LINUX
+class LinuxSpliceRelay;
+#endif
+
+// Bind a socket to the VPN address (and interface on Linux) for outgoing
+// traffic.  Also used by other local services that relay traffic into the
+// tunnel (DnsCache).
+void bindToVpn(QAbstractSocket &socket, const QHostAddress &bindAddress,
+               const QString &bindInterface);
+
+// Totals for all connections handled by a SocksServer, used for diagnostics.
+struct SocksServerStats
+{
+    // Connections accepted
+    quint64 connections;
+    // Connections currently open
+    quint64 activeConnections;
+    // Bytes of application data relayed in both directions
+    quint64 bytesRelayed;
+    // Number of times a connection stopped reading because the other side's
+    // write buffer reached the watermark
+    quint64 readPauses;
+    // Largest write buffer seen on any connection, in bytes
+    qint64 peakBufferedBytes;
+};
+
+// SocksListener is a QTcpServer that hands accepted connections off as socket
+// descriptors rather than creating QTcpSockets on the listening thread.  The
+// sockets are created by a SocksWorker on its own thread.
+class SocksListener : public QTcpServer
+{
+public:
+    using DescriptorHandler = std::function<void(qintptr)>;
+
+public:
+    SocksListener(DescriptorHandler handler) : _handler{std::move(handler)} {}
+
+protected:
+    virtual void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+    DescriptorHandler _handler;
+};
+
+// SocksWorker is one of the SocksServer's worker threads.  It owns the
+// SocksConnections (and their sockets) for the connections handed to it, which
+// are serviced entirely on the worker's event loop.
+class SocksWorker
+{
+public:
+    // Queue a newly-accepted connection to be handled by this worker.  The
+    // descriptor is adopted by a QTcpSocket on the worker thread (or closed if
+    // that fails).  Called on the SocksServer's thread.
+    void addConnection(qintptr socketDescriptor, QByteArray passwordHash,
+                       QHostAddress bindAddress, QString bindInterface,
+                       SocksResolver &resolver, qint64 writeWatermark);
+
+    // Number of connections queued to or owned by this worker; used to pick
+    // the least-loaded worker.  Can be read from any thread.
+    int load() const {return _load;}
+
+    // Get the stats for this worker's connections (blocks until the worker
+    // thread has handled all previously-queued connections)
+    SocksServerStats stats();
+
+private:
+    // Both of these are updated by SocksConnections or their sockets, which are
+    // destroyed with _thread, so they must be declared before _thread.
+    SocksServerStats _stats{};
+    std::atomic<int> _load{0};
+    RunningWorkerThread _thread;
+};
 
 // SocksServer runs a minimal TCP SOCKS5 server that forwards connections
 // through the VPN interface.  This is used to route QNetworkAccessManager-based
@@ -33,10 +115,32 @@ class SocksServer : public QObject
 {
     Q_OBJECT
 
+public:
+    // Default write buffer watermark for each connection - see SocksServer()
+    enum : qint64 { DefaultWriteWatermark = 256 * 1024 };
+    // Upper limit on the default number of worker threads - the proxy is only
+    // used for the daemon's own API requests, so more than this is not useful.
+    enum : int { MaxDefaultWorkers = 8 };
+
 public:
     // Create SocksServer with the VPN IP address that it will bind to for
     // outgoing connections.  This must be a valid IPv4 address. Also provide he interface the socket will bind to.
-    SocksServer(QHostAddress bindAddress, QString bindInterface);
+    //
+    // When one side of a connection has more than writeWatermark bytes waiting
+    // to be written, the connection stops reading from the other side until
+    // that buffer drains to half of the watermark.  This bounds the memory
+    // used by each connection when one side is much faster than the other.
+    //
+    // Accepted connections are handed to workerCount worker threads, each
+    // connection going to the worker with the fewest connections.  If
+    // workerCount is 0, one worker per core is used (up to MaxDefaultWorkers).
+    //
+    // Domain names requested by clients are resolved using dnsServers (or the
+    // system's DNS configuration if it is empty); see SocksResolver.
+    SocksServer(QHostAddress bindAddress, QString bindInterface,
+                QStringList dnsServers,
+                qint64 writeWatermark = DefaultWriteWatermark,
+                int workerCount = 0);
 
 public:
     // Get the port that the server is listening on.  If this returns 0, the
@@ -47,20 +151,74 @@ public:
     // SocksConnection::username.
     QByteArray password() const {return _password;}
 
-    // Update the bind address - the new address must be a valid IPv4 address.
-    void updateBindAddress(QHostAddress bindAddress, QString bindInterface);
+    // Get the totals for all workers' connections.  This blocks briefly on
+    // each worker thread.
+    SocksServerStats stats() const;
 
 private:
-    void onNewConnection();
+    // Pick up a new bind address and DNS servers from g_connectionSnapshot if
+    // the daemon has published a new connection.  Connections already handed
+    // to workers keep the address they were given; new connections get the
+    // new address.
+    void applyConnectionSnapshot();
+    void onIncomingConnection(qintptr socketDescriptor);
 
 private:
+    qint64 _writeWatermark;
     QHostAddress _bindAddress;
     QString _bindInterface;
-    QTcpServer _server;
+    // The last snapshot checked by applyConnectionSnapshot()
+    std::shared_ptr<const ConnectionSnapshot> _pAppliedSnapshot;
+    // The resolver is used by the workers' connections, so it must be declared
+    // before _workers.
+    SocksResolver _resolver;
+    std::vector<std::unique_ptr<SocksWorker>> _workers;
+    SocksListener _server;
     QByteArray _password;
     QByteArray _passwordHash;
 };
 
+// SocksUdpRelay relays datagrams for a SOCKS5 UDP ASSOCIATE request.  The
+// client sends datagrams with a SOCKS UDP request header to clientPort() on
+// localhost; the relay strips the header and sends the payload from a socket
+// bound to the VPN interface.  Replies get a header identifying their source
+// and are sent back to the client.
+//
+// The relay lives as long as the TCP connection that requested it (RFC1928
+// section 7); the SocksConnection destroys it when that connection closes.
+class SocksUdpRelay : public QObject
+{
+    Q_OBJECT
+
+public:
+    // If clientAddress/clientPort are specified (non-null/nonzero) in the
+    // request, only datagrams from that endpoint are relayed.  Otherwise, the
+    // first local sender becomes the client.
+    SocksUdpRelay(const QHostAddress &bindAddress, const QString &bindInterface,
+                  QHostAddress clientAddress, quint16 clientPort,
+                  SocksServerStats &stats, QObject *pParent);
+
+public:
+    // Whether both sockets were bound; if not, the relay can't be used.
+    bool isOpen() const;
+    // The local port that the client sends datagrams to.
+    quint16 clientPort() const {return _clientSocket.localPort();}
+
+private:
+    // Relay all pending datagrams from the client to their targets, or from
+    // targets to the client.  All pending datagrams are handled in one pass
+    // through a reused buffer, rather than one datagram per event.
+    void relayFromClient();
+    void relayFromTarget();
+
+private:
+    QUdpSocket _clientSocket;
+    QUdpSocket _targetSocket;
+    QHostAddress _clientAddress;
+    quint16 _clientPort;
+    SocksServerStats &_stats;
+};
+
 // SocksConnection handles a single connection established to the SocksServer.
 class SocksConnection : public QObject
 {
@@ -89,16 +247,25 @@ public:
         ReceiveAuthPasswordHeader,
         // Receive the auth password
         ReceiveAuthPassword,
-        // Receive the TCP connect request header - everything up to the address
-        // type, which determines the length of the rest of the message.
+        // Receive the request header (CONNECT or UDP ASSOCIATE) - everything up
+        // to the address type, which determines the length of the rest of the
+        // message.
         ReceiveConnectHeader,
-        // Receive the rest of the connect request.
+        // For a domain name address, receive the name length.
+        ReceiveConnectNameLength,
+        // Receive the rest of the request.
         ReceiveConnect,
+        // Resolving the domain name requested; we connect the outgoing socket
+        // once it's resolved.
+        Resolving,
         // We're connecting the outgoing socket; response is sent when this
         // completes.
         Connecting,
         // We are connected, relay data from both sides
         Connected,
+        // A UDP ASSOCIATE request succeeded; datagrams are relayed by the
+        // SocksUdpRelay until the SOCKS connection closes.
+        UdpAssociated,
         // Waiting for the SOCKS connection to disconnect.  Occurs if the target
         // disconnects after successfully connecting, or if we send a failure to
         // the SOCKS side without having connected.
@@ -124,9 +291,14 @@ public:
     //
     // SocksConnection also destroys the QTcpSocket (and consequently, itself)
     // if the connection is closed.
+    //
+    // The connection's totals are added to 'stats', which must outlive the
+    // connection.
     SocksConnection(QTcpSocket &socksSocket, QByteArray passwordHash,
                     const QHostAddress &bindAddress,
-                    QString bindInterface);
+                    QString bindInterface, SocksResolver &resolver,
+                    qint64 writeWatermark, SocksServerStats &stats);
+    ~SocksConnection();
 
 private:
     // Close the TCP connection(s) immediately without sending any failure
@@ -149,10 +321,32 @@ private:
     bool checkSocksVersion(const QByteArray &message);
     bool checkUPAuthVersion(const QByteArray &message);
 
-    // Forward all available data in both directions.  If any write fails, this
-    // aborts the connection.
+    // Forward available data from source to dest.  This stops when dest's
+    // write buffer reaches the watermark, unless flushAll is set (used when
+    // the source has disconnected).  If any write fails, this aborts the
+    // connection.
     void forwardData(QTcpSocket &source, QTcpSocket &dest,
-                     const QString &directionTrace);
+                     const QString &directionTrace, bool flushAll = false);
+    // When data were written from dest's buffer, resume forwarding from
+    // source if it was paused and dest's buffer has drained enough.
+    void resumeForwarding(QTcpSocket &source, QTcpSocket &dest,
+                          const QString &directionTrace);
+#ifdef Q_OS_LINUX
+    // Once connected, hand both connections over to a LinuxSpliceRelay so the
+    // data no longer pass through the QTcpSockets.  Returns false if the
+    // relay can't be used (data are still buffered in a QTcpSocket, or the
+    // relay couldn't be created); the QTcpSockets continue to be used then.
+    bool startSpliceRelay();
+#endif
+    // Handle a UDP ASSOCIATE request with the client's expected source
+    // endpoint (which may be unspecified).  Responds and goes to the
+    // UdpAssociated state, or rejects the request.
+    void startUdpAssociate(const QHostAddress &clientAddress, quint16 clientPort);
+    // Connect the outgoing socket to the target; goes to the Connecting state.
+    void connectTarget(const QHostAddress &address, quint16 port);
+    // The requested domain name was resolved; connects the target or rejects
+    // the request if it couldn't be resolved (address is null).
+    void onTargetResolved(const QHostAddress &address, quint16 port);
     // Process incoming data on the SOCKS connection (protocol messages or
     // application data).  Used by onSocksReadyRead().
     void processSocksData();
@@ -184,7 +378,24 @@ private:
     // In Receive* states, the number of bytes in the next message.  In other
     // states, 0.
     qint64 _nextMessageBytes;
+    // Whether the request being received is a UDP ASSOCIATE (otherwise it's a
+    // CONNECT)
+    bool _udpAssociate;
+    // Address type of the request being received
+    quint8 _addressType;
+    SocksResolver &_resolver;
+    QHostAddress _bindAddress;
+    QString _bindInterface;
     QTcpSocket _targetSocket;
+    qint64 _writeWatermark;
+    SocksServerStats &_stats;
+#ifdef Q_OS_LINUX
+    // In the Connected state, the relay that took over the connections, if
+    // one is used.  The QTcpSockets are unconnected in that case.
+    QPointer<LinuxSpliceRelay> _pSpliceRelay;
+#endif
+    // In the UdpAssociated state, the datagram relay
+    QPointer<SocksUdpRelay> _pUdpRelay;
 };
 
 #endif
@@ -26,37 +26,32 @@ SocksServerThread::SocksServerThread()
 {
 }
 
-void SocksServerThread::start(QHostAddress bindAddress, QString bindInterface)
+void SocksServerThread::start(QHostAddress bindAddress, QString bindInterface,
+                              QStringList dnsServers)
 {
     // Checked by caller
     Q_ASSERT(bindAddress.protocol() == QAbstractSocket::NetworkLayerProtocol::IPv4Protocol);
 
+    // _port is only set while the server is running (it's written on the
+    // worker thread, but only during invokeOnThread(), which blocks)
+    if(_port)
+        return;
+
     _thread.invokeOnThread([&]()
     {
-        if(_pSocksServer)
+        _pSocksServer = new SocksServer{bindAddress, bindInterface, dnsServers};
+        _pSocksServer->setParent(&_thread.objectOwner());
+        _port = _pSocksServer->port();
+        _password = _pSocksServer->password();
+        if(!_port)
         {
-            qInfo() << "Updating SOCKS server bind address to" << bindAddress;
-            // Set the new bind address.  It does not seem possible to actually
-            // reach this since the proxy is stopped when we leave the Connected
-            // state, but this is here just in case.
-            _pSocksServer->updateBindAddress(bindAddress, bindInterface);
+            qWarning() << "Unable to start SOCKS server";
+            delete _pSocksServer.data();
         }
         else
         {
-            _pSocksServer = new SocksServer{bindAddress, bindInterface};
-            _pSocksServer->setParent(&_thread.objectOwner());
-            _port = _pSocksServer->port();
-            _password = _pSocksServer->password();
-            if(!_port)
-            {
-                qWarning() << "Unable to start SOCKS server";
-                delete _pSocksServer.data();
-            }
-            else
-            {
-                qInfo() << "Started SOCKS server on port" << _port
-                    << "with bind address" << bindAddress;
-            }
+            qInfo() << "Started SOCKS server on port" << _port
+                << "with bind address" << bindAddress;
         }
     });
 }
@@ -77,3 +72,17 @@ void SocksServerThread::stop()
         }
     });
 }
+
+bool SocksServerThread::stats(SocksServerStats &stats)
+{
+    bool running = false;
+    _thread.invokeOnThread([&]()
+    {
+        if(_pSocksServer)
+        {
+            stats = _pSocksServer->stats();
+            running = true;
+        }
+    });
+    return running;
+}
@@ -36,10 +36,12 @@ public:
     SocksServerThread();
 
 public:
-    // Start the SOCKS server, or update the bind address if it is already
-    // running.  port() will be nonzero following this call if the server
-    // starts; otherwise it will be 0.
-    void start(QHostAddress bindAddress, QString bindInterface);
+    // Start the SOCKS server if it isn't already running.  port() will be
+    // nonzero following this call if the server starts; otherwise it will be
+    // 0.  A running server picks up changes in the bind address and DNS
+    // servers from g_connectionSnapshot itself.
+    void start(QHostAddress bindAddress, QString bindInterface,
+               QStringList dnsServers);
 
     // Stop the SOCKS server if it is running.
     void stop();
@@ -47,6 +49,10 @@ public:
     quint16 port() const {return _port;}
     const QByteArray &password() const {return _password;}
 
+    // Get the running server's connection totals.  Returns false if the
+    // server isn't running.
+    bool stats(SocksServerStats &stats);
+
 private:
     RunningWorkerThread _thread;
     QPointer<SocksServer> _pSocksServer;
@@ -29,9 +29,13 @@
 #include "apinetwork.h"
 #include "openssl.h"
 #include "brand.h"
+#include "updatepatch.h"
+#include <QJsonArray>
 #include <QNetworkReply>
 #include <QDir>
+#include <QFileInfo>
 #include <QProcess>
+#include <algorithm>
 
 #ifdef Q_OS_WIN
 #include <Windows.h>
@@ -64,20 +68,51 @@ namespace
     const std::chrono::minutes versionInitialInterval{10};
     // Refresh interval after initial load.
     const std::chrono::hours versionRefreshInterval{1};
+
+    // Suffix of the partial file used while downloading an installer
+    const QString partialFileSuffix{QStringLiteral(".partial")};
+    // Suffix of a delta patch (before partialFileSuffix while downloading it)
+    const QString patchFileSuffix{QStringLiteral(".patch")};
+    // Maximum number of times to resume a download without receiving any data
+    const int maxResumeAttempts{5};
+    // Delay before resuming a download after a request fails
+    const std::chrono::seconds resumeDelay{3};
+
+    // Interval to refill the token bucket when limiting the rate of a
+    // background download
+    const std::chrono::milliseconds rateLimitTick{100};
+    // Minimum read buffer size for a rate-limited download
+    const qint64 minReadBufferSize{16384};
+
+    const int httpStatusOk{200};
+    const int httpStatusPartialContent{206};
+    const int httpStatusRangeNotSatisfiable{416};
+}
+
+bool UpdateDelta::operator==(const UpdateDelta &other) const
+{
+    return uri == other.uri && baseSha256 == other.baseSha256 &&
+        patchSha256 == other.patchSha256;
 }
 
-Update::Update(const QString &uri, const QString &version)
+Update::Update(const QString &uri, const QString &version, QByteArray sha256,
+               UpdateDelta delta)
 {
     if(!uri.isEmpty() && !version.isEmpty())
     {
         _uri = uri;
         _version = version;
+        _sha256 = std::move(sha256);
+        // A delta can only be used if the resulting installer can be verified
+        if(!_sha256.isEmpty() && delta.isValid())
+            _delta = std::move(delta);
     }
 }
 
 bool Update::operator==(const Update &other) const
 {
-    return uri() == other.uri() && version() == other.version();
+    return uri() == other.uri() && version() == other.version() &&
+        sha256() == other.sha256() && delta() == other.delta();
 }
 
 UpdateChannel::UpdateChannel()
@@ -117,6 +152,22 @@ void UpdateChannel::checkVersionMetadata(const QJsonDocument &regionsDoc)
     const QString &latestVersion = platformObj[QStringLiteral("version")].toString();
     const QString &downloadUrl = platformObj[QStringLiteral("download")].toString();
     const QString &osVersionRequirement = platformObj[QStringLiteral("required")].toString();
+    // The installer hash is optional
+    const QByteArray &installerSha256 = QByteArray::fromHex(platformObj[QStringLiteral("sha256")].toString().toLatin1());
+    // Deltas are optional too; use the one from the installed version if
+    // there is one
+    UpdateDelta delta;
+    for(const auto &deltaVal : platformObj[QStringLiteral("deltas")].toArray())
+    {
+        const auto &deltaObj = deltaVal.toObject();
+        if(deltaObj[QStringLiteral("from")].toString() == QStringLiteral(PIA_VERSION))
+        {
+            delta.uri = deltaObj[QStringLiteral("download")].toString();
+            delta.baseSha256 = QByteArray::fromHex(deltaObj[QStringLiteral("base_sha256")].toString().toLatin1());
+            delta.patchSha256 = QByteArray::fromHex(deltaObj[QStringLiteral("sha256")].toString().toLatin1());
+            break;
+        }
+    }
 
     // If something is missing from the server data, log a warning just for
     // diagnostic purposes.
@@ -136,7 +187,7 @@ void UpdateChannel::checkVersionMetadata(const QJsonDocument &regionsDoc)
 
     // Store the update.  (Update ignores partial data if the server returned
     // only a URI or version somehow.)
-    _update = Update{downloadUrl, latestVersion};
+    _update = Update{downloadUrl, latestVersion, installerSha256, std::move(delta)};
 }
 
 void UpdateChannel::run(bool newRunning)
@@ -249,7 +300,11 @@ but that's acceptable.
 */
 
 UpdateDownloader::UpdateDownloader()
-    : _daemonVersion{99999, 99999, 99999}, _running{false}, _enableBeta{false}
+    : _daemonVersion{99999, 99999, 99999}, _running{false}, _enableBeta{false},
+      _installerHash{QCryptographicHash::Algorithm::Sha256}, _downloadingDelta{false},
+      _requestOffset{0}, _responseChecked{false}, _responseAccepted{false}, _resumeAttempts{0},
+      _backgroundEnabled{false}, _backgroundRateLimit{0}, _networkIdle{false},
+      _backgroundDownload{false}, _downloadProgress{0}, _rateTokens{0}
 {
     // If the daemon's version can't be parsed, we log an error and proceed with
     // the default version above that will never offer an upgrade.  This might
@@ -272,6 +327,12 @@ UpdateDownloader::UpdateDownloader()
                      &UpdateDownloader::emitUpdateRefreshed);
     QObject::connect(&_betaChannel, &UpdateChannel::updateChanged, this,
                      &UpdateDownloader::emitUpdateRefreshed);
+
+    _resumeTimer.setSingleShot(true);
+    connect(&_resumeTimer, &QTimer::timeout, this,
+            &UpdateDownloader::startDownloadRequest);
+    connect(&_rateLimitTimer, &QTimer::timeout, this,
+            &UpdateDownloader::onRateLimitTick);
 }
 
 void UpdateDownloader::checkUpdateChannel(const UpdateChannel &channel,
@@ -342,6 +403,22 @@ void UpdateDownloader::emitUpdateRefreshed()
 {
     emit updateRefreshed(calculateAvailableUpdate(), _gaChannel.update(),
                          _betaChannel.update());
+    checkBackgroundDownload();
+}
+
+void UpdateDownloader::checkBackgroundDownload()
+{
+    if(!_backgroundEnabled || !_networkIdle || !_running || _pDownloadTask)
+        return;
+
+    Update availableUpdate = calculateAvailableUpdate();
+    if(!availableUpdate.isValid())
+        return;
+    // Nothing to do if it has already been downloaded
+    if(availableUpdate == _downloadedUpdate && QFile::exists(_downloadedInstallerPath))
+        return;
+
+    startDownload(availableUpdate, true);
 }
 
 void UpdateDownloader::run(bool newRunning)
@@ -349,6 +426,32 @@ void UpdateDownloader::run(bool newRunning)
     _running = newRunning;
     _gaChannel.run(_running);
     _betaChannel.run(_running && _enableBeta);
+    checkBackgroundDownload();
+}
+
+void UpdateDownloader::enableBackgroundDownload(bool enable, qint64 rateLimit)
+{
+    _backgroundEnabled = enable;
+    _backgroundRateLimit = std::max<qint64>(rateLimit, 0);
+    qInfo() << "Background update downloads:" << enable << "- rate limit:"
+        << _backgroundRateLimit << "bytes/sec";
+
+    if(_pDownloadTask && _backgroundDownload)
+    {
+        if(!enable)
+            stopBackgroundDownload();
+        else
+            applyRateLimit();
+    }
+    checkBackgroundDownload();
+}
+
+void UpdateDownloader::setNetworkIdle(bool idle)
+{
+    if(_networkIdle == idle)
+        return;
+    _networkIdle = idle;
+    checkBackgroundDownload();
 }
 
 void UpdateDownloader::reloadAvailableUpdates(const Update &gaUpdate,
@@ -432,50 +535,207 @@ Async<DownloadResult> UpdateDownloader::downloadUpdate()
         qWarning() << "Can't download update, no update is available";
         return Async<DownloadResult>::resolve();
     }
-    if(_pDownloadReply)
+
+    // If this update was already downloaded in the background, it's ready now.
+    if(!_pDownloadTask && availableUpdate == _downloadedUpdate &&
+       QFile::exists(_downloadedInstallerPath))
+    {
+        qInfo() << "Update" << availableUpdate.version()
+            << "has already been downloaded";
+        emit downloadFinished(availableUpdate.version(), _downloadedInstallerPath);
+        return Async<DownloadResult>::resolve(DownloadResult().version(availableUpdate.version()).succeeded(true));
+    }
+
+    if(_pDownloadTask && _backgroundDownload)
+    {
+        // If this update is being downloaded in the background, the user wants
+        // it now - show the progress and stop limiting the download rate.
+        if(_downloadingUpdate == availableUpdate)
+        {
+            qInfo() << "Continuing background download of"
+                << availableUpdate.version() << "in foreground";
+            _backgroundDownload = false;
+            applyRateLimit();
+            emit downloadProgress(_downloadingUpdate.version(), _downloadProgress);
+            return _pDownloadTask;
+        }
+
+        // Otherwise, it's a stale update, stop it.
+        qInfo() << "Stopping background download of"
+            << _downloadingUpdate.version() << "to download"
+            << availableUpdate.version();
+        stopBackgroundDownload();
+    }
+
+    if(_pDownloadTask)
     {
         qWarning() << "Already downloading an update, can't start again";
         return Async<DownloadResult>::resolve(DownloadResult().version(availableUpdate.version()));
     }
 
-    // Class invariant - open when _pDownloadReply is set
+    return startDownload(availableUpdate, false);
+}
+
+Async<DownloadResult> UpdateDownloader::startDownload(const Update &update,
+                                                      bool background)
+{
+    // Class invariant - open when _pDownloadTask is set
     Q_ASSERT(!_installerFile.isOpen());
+    Q_ASSERT(!_pDownloadTask);
+    Q_ASSERT(update.isValid());
 
-    QUrl reqUrl{availableUpdate.uri()};
+    QUrl reqUrl{update.uri()};
+    _installerPath = Path::DaemonUpdateDir / reqUrl.fileName();
 
-    // Open the installer file in the download location.
-    Path downloadPath{Path::DaemonUpdateDir / reqUrl.fileName()};
-    _installerFile.unsetError();
-    _installerFile.setFileName(downloadPath);
+    // If a delta from the installed version is available, and we still have
+    // the installer that it applies to, download the delta instead.
+    _deltaBasePath.clear();
+    if(update.delta().isValid())
+    {
+        _deltaBasePath = findDeltaBase(update.delta());
+        if(_deltaBasePath.isEmpty())
+            qInfo() << "Base installer for delta to" << update.version() << "not found, downloading full installer";
+        else
+            qInfo() << "Downloading delta to" << update.version() << "from" << _deltaBasePath;
+    }
+    _downloadingDelta = !_deltaBasePath.isEmpty();
+
+    // Download to a partial file in the download location; it's renamed once
+    // the download completes.
+    QString partialPath{_installerPath};
+    if(_downloadingDelta)
+        partialPath += patchFileSuffix;
+    partialPath += partialFileSuffix;
 
     // Attempt to clean any old downloads that exist to limit accumulation of
-    // installers.  Failure does not prevent us from downloading the new file
-    // though.
-    // Note that QDir::removeRecursively() returns true (success) if the
-    // directory doesn't exist ("expected result already reached" per doc).
-    if(!QDir{Path::DaemonUpdateDir}.removeRecursively())
+    // installers.  A partial download of this installer is kept so it can be
+    // resumed, and the delta base is kept until the delta is applied.
+    // Failure does not prevent us from downloading the new file though.
+    _downloadedUpdate = {};
+    _downloadedInstallerPath.clear();
+    QDir updateDir{Path::DaemonUpdateDir};
+    for(const auto &entry : updateDir.entryInfoList(QDir::Filter::AllEntries |
+                                                    QDir::Filter::NoDotAndDotDot |
+                                                    QDir::Filter::Hidden))
     {
-        qWarning() << "Unable to clean update directory:"
-            << Path::DaemonUpdateDir;
+        if(entry.absoluteFilePath() == QFileInfo{partialPath}.absoluteFilePath() ||
+           (!_deltaBasePath.isEmpty() && entry.absoluteFilePath() == QFileInfo{_deltaBasePath}.absoluteFilePath()))
+        {
+            continue;
+        }
+        bool removed = entry.isDir() ? QDir{entry.absoluteFilePath()}.removeRecursively()
+                                     : QFile::remove(entry.absoluteFilePath());
+        if(!removed)
+        {
+            qWarning() << "Unable to clean update file:"
+                << entry.absoluteFilePath();
+        }
     }
 
     Path::DaemonUpdateDir.mkpath();
-    if(!_installerFile.open(QFile::OpenModeFlag::WriteOnly | QFile::OpenModeFlag::Truncate))
+    if(!openPartialFile(partialPath))
+    {
+        if(!background)
+            emit downloadFailed(update.version(), true);
+        // This call did initiate a download, but it failed.
+        return Async<DownloadResult>::resolve(DownloadResult().version(update.version()).failed(true));
+    }
+
+    _pDownloadTask = Async<DownloadResult>::create();
+    _downloadingUpdate = update;
+    _backgroundDownload = background;
+    _downloadProgress = 0;
+    if(background)
+        qInfo() << "Downloading update" << update.version() << "in background";
+    else
+        emit downloadProgress(_downloadingUpdate.version(), 0);
+    startDownloadRequest();
+
+    return _pDownloadTask;
+}
+
+bool UpdateDownloader::openPartialFile(const QString &partialPath)
+{
+    _installerFile.unsetError();
+    _installerFile.setFileName(partialPath);
+    if(!_installerFile.open(QFile::OpenModeFlag::ReadWrite))
     {
         // Can't open the file for some reason.  This could legitimately happen,
         // ensure that it's visible if it does.
         qError() << "Can't download installer - can't open file"
-            << downloadPath << "due to error" << _installerFile.error();
-        emit downloadFailed(availableUpdate.version(), true);
-        // This call did initiate a download, but it failed.
-        return Async<DownloadResult>::resolve(DownloadResult().version(availableUpdate.version()).failed(true));
+            << partialPath << "due to error" << _installerFile.error();
+        return false;
+    }
+
+    // Hash any data that was already downloaded, and continue from the end of
+    // it.
+    _installerHash.reset();
+    if(!_installerHash.addData(&_installerFile))
+    {
+        qWarning() << "Can't read partial download" << partialPath
+            << "- starting over";
+        _installerFile.resize(0);
+        _installerHash.reset();
+    }
+    if(_installerFile.size() > 0)
+    {
+        qInfo() << "Resuming partial download" << partialPath << "from"
+            << _installerFile.size() << "bytes";
+    }
+    _installerFile.seek(_installerFile.size());
+    _resumeValidator.clear();
+    _resumeAttempts = 0;
+    return true;
+}
+
+QString UpdateDownloader::findDeltaBase(const UpdateDelta &delta) const
+{
+    // The installer for the installed version is normally still in the update
+    // directory if it was installed by downloading it here.  Partial files
+    // can't be the base.
+    QDir updateDir{Path::DaemonUpdateDir};
+    for(const auto &entry : updateDir.entryInfoList(QDir::Filter::Files))
+    {
+        if(entry.fileName().endsWith(partialFileSuffix))
+            continue;
+        QFile candidate{entry.absoluteFilePath()};
+        QCryptographicHash candidateHash{QCryptographicHash::Algorithm::Sha256};
+        if(candidate.open(QFile::OpenModeFlag::ReadOnly) &&
+           candidateHash.addData(&candidate) &&
+           candidateHash.result() == delta.baseSha256)
+        {
+            return entry.absoluteFilePath();
+        }
+    }
+    return {};
+}
+
+void UpdateDownloader::startDownloadRequest()
+{
+    // Class invariant - valid when _pDownloadTask is set
+    Q_ASSERT(_installerFile.isOpen());
+    Q_ASSERT(_downloadingUpdate.isValid());
+    Q_ASSERT(!_pDownloadReply);
+
+    _requestOffset = _installerFile.size();
+    _responseChecked = false;
+    _responseAccepted = false;
+
+    QNetworkRequest downloadReq{_downloadingDelta ? _downloadingUpdate.delta().uri
+                                                  : _downloadingUpdate.uri()};
+    if(_requestOffset > 0)
+    {
+        downloadReq.setRawHeader(QByteArrayLiteral("Range"),
+                                 QByteArrayLiteral("bytes=") +
+                                 QByteArray::number(_requestOffset) + '-');
+        // If we know which version of the file we have, ask for the whole file
+        // instead if it changed.
+        if(!_resumeValidator.isEmpty())
+            downloadReq.setRawHeader(QByteArrayLiteral("If-Range"), _resumeValidator);
     }
 
-    QNetworkRequest downloadReq{availableUpdate.uri()};
     _pDownloadReply = ApiNetwork::instance()->getAccessManager().get(downloadReq);
     _pDownloadReply->setParent(this);
-    _pDownloadTask = Async<DownloadResult>::create();
-    _downloadingVersion = availableUpdate.version();
     // There is no timeout on this download, but the user can cancel it
     // manually if it appears to be stuck but does not fail.
     connect(_pDownloadReply, &QNetworkReply::downloadProgress, this,
@@ -484,21 +744,178 @@ Async<DownloadResult> UpdateDownloader::downloadUpdate()
             &UpdateDownloader::onDownloadReadyRead);
     connect(_pDownloadReply, &QNetworkReply::finished, this,
             &UpdateDownloader::onDownloadFinished);
-    emit downloadProgress(_downloadingVersion, 0);
+    applyRateLimit();
+}
 
-    return _pDownloadTask;
+bool UpdateDownloader::isRateLimited() const
+{
+    return _pDownloadTask && _backgroundDownload && _backgroundRateLimit > 0;
+}
+
+void UpdateDownloader::applyRateLimit()
+{
+    if(isRateLimited())
+    {
+        // Limit the reply's buffer so the connection is throttled when we
+        // don't read from it.  Allow a little more than one tick's worth of
+        // data.
+        qint64 tickBytes = _backgroundRateLimit * msec(rateLimitTick) / 1000;
+        if(_pDownloadReply)
+            _pDownloadReply->setReadBufferSize(std::max(tickBytes * 2, minReadBufferSize));
+        if(!_rateLimitTimer.isActive())
+        {
+            _rateTokens = tickBytes;
+            _rateLimitTimer.start(msec32(rateLimitTick));
+        }
+    }
+    else
+    {
+        _rateLimitTimer.stop();
+        if(_pDownloadReply)
+        {
+            _pDownloadReply->setReadBufferSize(0);
+            // Read anything that was held back by the rate limit
+            if(_pDownloadReply->bytesAvailable() > 0)
+                onDownloadReadyRead();
+        }
+    }
+}
+
+void UpdateDownloader::onRateLimitTick()
+{
+    // Add tokens to the bucket, up to one second's worth
+    _rateTokens = std::min(_rateTokens + _backgroundRateLimit * msec(rateLimitTick) / 1000,
+                           _backgroundRateLimit);
+    if(_pDownloadReply && _pDownloadReply->bytesAvailable() > 0)
+        onDownloadReadyRead();
+}
+
+void UpdateDownloader::stopBackgroundDownload()
+{
+    Q_ASSERT(_pDownloadTask && _backgroundDownload);    // Guaranteed by caller
+
+    _resumeTimer.stop();
+    if(_pDownloadReply)
+    {
+        // Disconnect the reply so aborting it doesn't complete the download as
+        // a cancellation (which would delete the partial file)
+        _pDownloadReply->disconnect(this);
+        _pDownloadReply->abort();
+        _pDownloadReply->deleteLater();
+        _pDownloadReply.clear();
+    }
+    completeDownload(false, false);
+}
+
+void UpdateDownloader::checkDownloadResponse()
+{
+    // Class invariant - valid when this is called
+    Q_ASSERT(_pDownloadReply);
+
+    _responseChecked = true;
+
+    int status = _pDownloadReply->attribute(QNetworkRequest::Attribute::HttpStatusCodeAttribute).toInt();
+    // Don't write error responses to the file (the request will fail once
+    // it's finished)
+    _responseAccepted = status == httpStatusOk || status == httpStatusPartialContent;
+    if(!_responseAccepted)
+    {
+        qWarning() << "Ignoring installer response body with status" << status;
+        return;
+    }
+
+    // If we requested a range and the server sent the whole file (it doesn't
+    // support ranges, or the file changed), start over from the beginning.
+    if(_requestOffset > 0 && status != httpStatusPartialContent)
+    {
+        qInfo() << "Server sent complete file with status" << status
+            << "instead of resuming from" << _requestOffset << "bytes";
+        _installerFile.resize(0);
+        _installerFile.seek(0);
+        _installerHash.reset();
+        _requestOffset = 0;
+    }
+
+    // If this response begins the file, keep its validator for resuming later.
+    if(_requestOffset == 0)
+    {
+        _resumeValidator = _pDownloadReply->rawHeader(QByteArrayLiteral("ETag"));
+        // Weak ETags can't be used with If-Range
+        if(_resumeValidator.startsWith("W/"))
+            _resumeValidator.clear();
+        if(_resumeValidator.isEmpty())
+            _resumeValidator = _pDownloadReply->rawHeader(QByteArrayLiteral("Last-Modified"));
+    }
+}
+
+void UpdateDownloader::completeDownload(bool succeeded, bool dueToError,
+                                        const QString &installerPath)
+{
+    // Class invariant - valid while a download is in progress
+    Q_ASSERT(_pDownloadTask);
+
+    _installerFile.close();
+
+    // Reset _pDownloadTask and _downloadingUpdate since the download is
+    // finished and we've closed the file.
+    Async<DownloadResult> pFinishedTask;
+    _pDownloadTask.swap(pFinishedTask);
+    Update finishedUpdate;
+    std::swap(_downloadingUpdate, finishedUpdate);
+
+    bool background = _backgroundDownload;
+    _backgroundDownload = false;
+    _rateLimitTimer.stop();
+
+    DownloadResult taskResult;
+    taskResult.version(finishedUpdate.version());
+    if(succeeded)
+    {
+        _downloadedUpdate = finishedUpdate;
+        _downloadedInstallerPath = installerPath;
+        // A background download isn't reported yet; it's reported when the
+        // user asks to download the update.
+        if(background)
+            qInfo() << "Downloaded update" << finishedUpdate.version() << "in background";
+        else
+            emit downloadFinished(finishedUpdate.version(), installerPath);
+        taskResult.succeeded(true);
+    }
+    else
+    {
+        if(background)
+            qInfo() << "Background download of" << finishedUpdate.version() << "stopped";
+        else
+            emit downloadFailed(finishedUpdate.version(), dueToError);
+        // The result is an error if we detected an error, canceled otherwise.
+        taskResult.failed(dueToError);
+    }
+    // Resolve the existing task
+    pFinishedTask->resolve(std::move(taskResult));
 }
 
 void UpdateDownloader::cancelDownload()
 {
     // Client only shows this UI when a download is in progress, don't need to
     // provide feedback for this case.
-    if(!_pDownloadReply)
+    if(!_pDownloadTask)
     {
         qWarning() << "Can't cancel download, no download is taking place";
         return;
     }
 
+    // If we're waiting to resume the download, cancel it now - the partial
+    // file is deleted, like a cancellation during a request.
+    if(!_pDownloadReply)
+    {
+        _resumeTimer.stop();
+        qInfo() << "Canceled download of" << _downloadingUpdate.version()
+            << "while waiting to resume";
+        _installerFile.remove();
+        completeDownload(false, false);
+        return;
+    }
+
     _pDownloadReply->abort();
 }
 
@@ -507,37 +924,79 @@ void UpdateDownloader::onDownloadProgress(qint64 bytesReceived,
 {
     // Class invariant - valid when this signal is connected
     Q_ASSERT(_pDownloadReply);
-    // Class invariant - set when _pDownloadReply is set
-    Q_ASSERT(!_downloadingVersion.isEmpty());
+    // Class invariant - valid when _pDownloadReply is set
+    Q_ASSERT(_downloadingUpdate.isValid());
 
     // This signal can be emitted with bytesTotal == 0 if the download fails
     // before getting the content length from the server (or presumably if the
     // file isn't found, etc.).
+    //
+    // If this request is resuming a download, the progress is relative to the
+    // offset where it started.
     int progressPct = 0;
     if(bytesTotal > 0 && bytesReceived >= 0)
-        progressPct = static_cast<int>(bytesReceived * 100 / bytesTotal);
-    emit downloadProgress(_downloadingVersion, progressPct);
+    {
+        progressPct = static_cast<int>((_requestOffset + bytesReceived) * 100 /
+                                       (_requestOffset + bytesTotal));
+    }
+    _downloadProgress = progressPct;
+    if(!_backgroundDownload)
+        emit downloadProgress(_downloadingUpdate.version(), progressPct);
 }
 
 void UpdateDownloader::onDownloadReadyRead()
 {
     // Class invariant - valid when this signal is connected
     Q_ASSERT(_pDownloadReply);
-    // Class invariant - file open when _pDownloadReply is set
-    Q_ASSERT(_installerFile.isOpen());
 
-    // Write the new data to the file.
-    // QIODevice doesn't provide any way to observe the new data without copying
-    // it, so we make a copy here just to write it and throw the copy away.
-    if(_installerFile.write(_pDownloadReply->readAll()) < 0)
+    if(!readDownloadData(false))
     {
         // The write failed, cancel the download by aborting the network
         // request.  This will cause onDownloadFinished() to be called with an
         // error, which will close the file and emit downloadFailed().
+        _pDownloadReply->abort();
+    }
+}
+
+bool UpdateDownloader::readDownloadData(bool ignoreRateLimit)
+{
+    // Class invariant - valid when this is called
+    Q_ASSERT(_pDownloadReply);
+    // Class invariant - file open when _pDownloadTask is set
+    Q_ASSERT(_installerFile.isOpen());
+
+    if(!_responseChecked)
+        checkDownloadResponse();
+
+    // Write the new data to the file, and hash it as it's written.
+    // QIODevice doesn't provide any way to observe the new data without copying
+    // it, so we make a copy here just to write it and throw the copy away.
+    //
+    // If the rate is limited, only read as much as the token bucket allows;
+    // the rest is read on a later tick.
+    QByteArray data;
+    if(isRateLimited() && !ignoreRateLimit)
+    {
+        data = _pDownloadReply->read(std::max<qint64>(_rateTokens, 0));
+        _rateTokens -= data.size();
+    }
+    else
+        data = _pDownloadReply->readAll();
+    if(!_responseAccepted)
+        return true;
+    if(_installerFile.write(data) < 0)
+    {
         qError() << "Failed to write to installer file"
             << _installerFile.fileName() << "-" << _installerFile.error();
-        _pDownloadReply->abort();
+        return false;
     }
+    _installerHash.addData(data);
+
+    // We're making progress, so allow more resume attempts if this request
+    // fails later
+    if(!data.isEmpty())
+        _resumeAttempts = 0;
+    return true;
 }
 
 void UpdateDownloader::onDownloadFinished()
@@ -546,51 +1005,192 @@ void UpdateDownloader::onDownloadFinished()
     Q_ASSERT(_pDownloadReply);
     // Class invariant - valid when _pDownloadReply is set
     Q_ASSERT(_pDownloadTask);
-    // Class invariant - file open when _pDownloadReply is set
+    // Class invariant - file open when _pDownloadTask is set
     Q_ASSERT(_installerFile.isOpen());
-    // Class invariant - set when _pDownloadReply is set
-    Q_ASSERT(!_downloadingVersion.isEmpty());
+    // Class invariant - set when _pDownloadTask is set
+    Q_ASSERT(_downloadingUpdate.isValid());
+
+    // Write anything that was held back by the rate limit
+    bool writeFailed = _pDownloadReply->bytesAvailable() > 0 && !readDownloadData(true);
 
     // Delete the reply when we're done here
     _pDownloadReply->deleteLater();
-    _installerFile.close();
 
-    // Reset _pDownloadReply, _pDownloadTask, and _downloadingVersion since the
-    // download is finished and we've closed the file.
+    // Reset _pDownloadReply since this request is finished
     QPointer<QNetworkReply> pFinishedReply;
     _pDownloadReply.swap(pFinishedReply);
-    Async<DownloadResult> pFinishedTask;
-    _pDownloadTask.swap(pFinishedTask);
-    QString finishedVersion;
-    _downloadingVersion.swap(finishedVersion);
+
+    if(writeFailed)
+    {
+        _installerFile.remove();
+        completeDownload(false, true);
+        return;
+    }
 
     // Check if the download failed
-    DownloadResult taskResult;
-    taskResult.version(finishedVersion);
     auto error = pFinishedReply->error();
     if(error != QNetworkReply::NetworkError::NoError)
     {
-        qInfo() << "Installer download of" << finishedVersion << "from"
-            << pFinishedReply->url() << "failed with error:"
-            << qEnumToString(error);
-        // Delete the partial file - failure is ignored
-        _installerFile.remove();
+        qInfo() << "Installer download of" << _downloadingUpdate.version()
+            << "from" << pFinishedReply->url() << "failed with error:"
+            << qEnumToString(error) << "after" << _installerFile.size()
+            << "bytes";
+
         // 'OperationCanceledError' indicates that the user canceled the
-        // download (we only call abort() due to a user cancellation).
+        // download (we only call abort() due to a user cancellation or a write
+        // failure).
         bool dueToError = error != QNetworkReply::NetworkError::OperationCanceledError;
-        emit downloadFailed(finishedVersion, dueToError);
-        // The result is an error if we detected an error above, canceled
-        // otherwise.
-        taskResult.failed(dueToError);
+
+        // If the server rejected the range, the partial file must be bad
+        // (it's already complete, or the file changed), start over.
+        int status = pFinishedReply->attribute(QNetworkRequest::Attribute::HttpStatusCodeAttribute).toInt();
+        if(status == httpStatusRangeNotSatisfiable)
+        {
+            _installerFile.resize(0);
+            _installerFile.seek(0);
+            _installerHash.reset();
+            _resumeValidator.clear();
+        }
+
+        // Resume the download if it failed due to a network error.  Background
+        // downloads wait until the network is idle again instead (see
+        // setNetworkIdle()).
+        if(dueToError && _resumeAttempts < maxResumeAttempts &&
+           (!_backgroundDownload || _networkIdle))
+        {
+            ++_resumeAttempts;
+            qInfo() << "Resuming download in" << traceMsec(resumeDelay)
+                << "(attempt" << _resumeAttempts << "of" << maxResumeAttempts
+                << ")";
+            _resumeTimer.start(msec32(resumeDelay));
+            return;
+        }
+
+        // Delete the partial file - failure is ignored.  A partial file is
+        // kept after a network error so a later download can resume it.
+        if(!dueToError)
+            _installerFile.remove();
+        completeDownload(false, dueToError);
+        return;
     }
-    else
+
+    QByteArray downloadHash{_installerHash.result()};
+    qInfo() << "Downloaded" << _installerFile.size() << "bytes, SHA-256:"
+        << downloadHash.toHex();
+
+    // If this was a delta, apply it to get the installer.  If that fails for
+    // any reason, fall back to the full installer.
+    if(_downloadingDelta)
     {
-        // Otherwise, we're done, the download succeeded
-        emit downloadFinished(finishedVersion, _installerFile.fileName());
-        taskResult.succeeded(true);
+        const UpdateDelta &delta = _downloadingUpdate.delta();
+        if(!delta.patchSha256.isEmpty() && downloadHash != delta.patchSha256)
+        {
+            qWarning() << "Delta download does not match expected SHA-256"
+                << delta.patchSha256.toHex();
+            fallBackToFullDownload();
+            return;
+        }
+        if(!applyDelta())
+        {
+            fallBackToFullDownload();
+            return;
+        }
+        // _installerFile now refers to the patched installer, and
+        // _installerHash is its hash
+        downloadHash = _installerHash.result();
     }
-    // Resolve the existing task
-    pFinishedTask->resolve(std::move(taskResult));
+
+    if(!_downloadingUpdate.sha256().isEmpty() &&
+       downloadHash != _downloadingUpdate.sha256())
+    {
+        qWarning() << "Installer download of" << _downloadingUpdate.version()
+            << "does not match expected SHA-256"
+            << _downloadingUpdate.sha256().toHex();
+        _installerFile.remove();
+        completeDownload(false, true);
+        return;
+    }
+
+    // Move the installer to its final path
+    QString installerPath{_installerPath};
+    _installerFile.close();
+    QFile::remove(installerPath);
+    if(!_installerFile.rename(installerPath))
+    {
+        qError() << "Can't move downloaded installer to" << installerPath
+            << "-" << _installerFile.error();
+        _installerFile.remove();
+        completeDownload(false, true);
+        return;
+    }
+
+    // Otherwise, we're done, the download succeeded
+    completeDownload(true, false, installerPath);
+}
+
+bool UpdateDownloader::applyDelta()
+{
+    Q_ASSERT(_downloadingDelta);    // Guaranteed by caller
+    Q_ASSERT(_installerFile.isOpen());  // Guaranteed by caller
+
+    // Patches are small compared to the installer, read it all.
+    _installerFile.seek(0);
+    QByteArray patch{_installerFile.readAll()};
+    _installerFile.close();
+    _installerFile.remove();
+
+    // Write the patched installer to the partial file for the full
+    // installer.  If this fails, fallBackToFullDownload() starts over.
+    if(!openPartialFile(_installerPath + partialFileSuffix))
+        return false;
+    _installerFile.resize(0);
+    _installerHash.reset();
+
+    qInfo() << "Applying delta to" << _downloadingUpdate.version() << "to"
+        << _deltaBasePath;
+    if(!UpdatePatch::apply(_deltaBasePath, patch, _installerFile, _installerHash))
+    {
+        qWarning() << "Can't apply delta to" << _deltaBasePath;
+        return false;
+    }
+
+    // Verify the result here; the full installer is used if this fails.  (A
+    // delta is only offered when the installer hash is known.)
+    if(_installerHash.result() != _downloadingUpdate.sha256())
+    {
+        qWarning() << "Patched installer does not match expected SHA-256"
+            << _downloadingUpdate.sha256().toHex();
+        return false;
+    }
+
+    // The old installer isn't needed any more
+    if(!QFile::remove(_deltaBasePath))
+        qWarning() << "Unable to remove delta base" << _deltaBasePath;
+    _deltaBasePath.clear();
+    return true;
+}
+
+void UpdateDownloader::fallBackToFullDownload()
+{
+    qWarning() << "Delta to" << _downloadingUpdate.version()
+        << "failed, downloading full installer";
+
+    // Discard the delta or the patched data
+    _installerFile.close();
+    _installerFile.remove();
+    _downloadingDelta = false;
+    _deltaBasePath.clear();
+
+    if(!openPartialFile(_installerPath + partialFileSuffix))
+    {
+        completeDownload(false, true);
+        return;
+    }
+    // Start over even if a partial file existed (it might be from a failed
+    // patch)
+    _installerFile.resize(0);
+    _installerHash.reset();
+    startDownloadRequest();
 }
 
 bool UpdateChannel::validateOSRequirements(const QString &requirement)
@@ -28,6 +28,7 @@
 #include "apiclient.h"
 #include "jsonrefresher.h"
 #include <QObject>
+#include <QCryptographicHash>
 #include <QJsonDocument>
 #include <QNetworkAccessManager>
 #include <QFile>
@@ -57,6 +58,22 @@ public:
 #undef BuilderField
 };
 
+// A binary delta that produces an update's installer from the installer of the
+// installed version (see UpdatePatch).
+struct UpdateDelta
+{
+    // URI of the patch
+    QString uri;
+    // SHA-256 hash of the installer that the patch applies to (raw bytes)
+    QByteArray baseSha256;
+    // SHA-256 hash of the patch itself (raw bytes), empty if not known
+    QByteArray patchSha256;
+
+    bool isValid() const {return !uri.isEmpty() && !baseSha256.isEmpty();}
+    bool operator==(const UpdateDelta &other) const;
+    bool operator!=(const UpdateDelta &other) const {return !(*this == other);}
+};
+
 // Object representing an update available from an update channel - a version
 // string and download URI.
 //
@@ -70,19 +87,33 @@ public:
     // Construct Update with the URI and version.  If either is empty, both
     // strings are left empty in the resulting object (there is never a
     // partially-valid Update).
-    Update(const QString &uri, const QString &version);
+    //
+    // The SHA-256 hash of the installer is optional; if it's known, the
+    // download is verified against it.
+    //
+    // A delta from the installed version can be provided too; it's ignored
+    // unless the installer hash is known (the patched installer must be
+    // verified).
+    Update(const QString &uri, const QString &version, QByteArray sha256 = {},
+           UpdateDelta delta = {});
 
 public:
     // A valid Update has a non-empty URI and version.
     bool isValid() const {return !_uri.isEmpty();}
     const QString &uri() const {return _uri;}
     const QString &version() const {return _version;}
+    // Expected SHA-256 hash of the installer (raw bytes), empty if not known.
+    const QByteArray &sha256() const {return _sha256;}
+    // Delta from the installed version, invalid if there isn't one.
+    const UpdateDelta &delta() const {return _delta;}
 
     bool operator==(const Update &other) const;
     bool operator!=(const Update &other) const {return !(*this == other);}
 
 private:
     QString _uri, _version;
+    QByteArray _sha256;
+    UpdateDelta _delta;
 };
 
 inline QDebug &operator<<(QDebug &dbg, const Update &update)
@@ -199,6 +230,10 @@ private:
 
     void emitUpdateRefreshed();
 
+    // Start a background download of the available update if background
+    // downloads are enabled and possible right now.
+    void checkBackgroundDownload();
+
 public:
     // Start or stop refreshing the version metadata
     void run(bool newRunning);
@@ -236,6 +271,11 @@ public:
     // Only one download can occur at a time.  If a download is already
     // occurring, subsequent calls to downloadUpdate() are ignored (the result
     // is as if the request was canceled).
+    //
+    // If the connection fails, the download resumes from the data received so
+    // far (using an HTTP range request) after a short delay, up to a few
+    // times without progress.  If a prior download of the same installer
+    // failed, the partial file is resumed too.
     // The returned Task is resolved when the request completes (successfully,
     // in error, or canceled - the task is always resolved successfully so the
     // version string can be provided).  The result object indicates the status
@@ -245,7 +285,61 @@ public:
     // Cancel a download in progress.
     void cancelDownload();
 
+    // Enable or disable downloading updates in the background.  When enabled,
+    // an available update is downloaded as soon as it's found (while the
+    // network is idle, see setNetworkIdle()), so downloadUpdate() completes
+    // immediately later.  The download is limited to rateLimit bytes per
+    // second (0 for no limit) until downloadUpdate() is called.
+    //
+    // Background downloads don't emit any signals; downloadUpdate() reports
+    // the progress (or result) as usual when it's called.
+    void enableBackgroundDownload(bool enable, qint64 rateLimit);
+
+    // Indicate whether the network is idle - the VPN connection isn't being
+    // established or torn down.  Background downloads only start when idle.
+    void setNetworkIdle(bool idle);
+
 private:
+    // Start downloading an update (used by downloadUpdate() and for
+    // background downloads).  Background downloads don't emit any signals.
+    Async<DownloadResult> startDownload(const Update &update, bool background);
+    // Stop a background download, keeping the partial file so it can be
+    // resumed later.
+    void stopBackgroundDownload();
+    // Whether the current download is rate-limited (a background download
+    // with a rate limit)
+    bool isRateLimited() const;
+    // Apply or remove the rate limit for the current download
+    void applyRateLimit();
+    // Refill the token bucket for a rate-limited download
+    void onRateLimitTick();
+    // Read data from the current download request and write it to the file
+    // (limited by the token bucket unless ignoreRateLimit is set).  Returns
+    // false if the data can't be written.
+    bool readDownloadData(bool ignoreRateLimit);
+    // Open the partial file for a download in _installerFile, and hash the
+    // data that's already in it so it can be resumed.
+    bool openPartialFile(const QString &partialPath);
+    // Find the installer that a delta applies to in the update directory;
+    // returns an empty string if it's not there.
+    QString findDeltaBase(const UpdateDelta &delta) const;
+    // Apply a downloaded delta; replaces _installerFile with the patched
+    // installer.  Returns false if it can't be applied or the result isn't
+    // correct.
+    bool applyDelta();
+    // Discard a delta that couldn't be used and download the full installer
+    void fallBackToFullDownload();
+    // Issue a request for the installer (or delta), starting from the data
+    // already in _installerFile.  Used to start and resume the download.
+    void startDownloadRequest();
+    // Check the response status of a download request the first time data is
+    // received - handles servers that ignore the range request.
+    void checkDownloadResponse();
+    // Complete the download (successfully, in error, or canceled) - resolves
+    // the download task and emits downloadFinished()/downloadFailed().
+    // installerPath is the completed installer if it succeeded.
+    void completeDownload(bool succeeded, bool dueToError,
+                          const QString &installerPath = {});
     void onDownloadProgress(qint64 bytesReceived, qint64 bytesTotal);
     void onDownloadReadyRead();
     void onDownloadFinished();
@@ -280,20 +374,64 @@ private:
     UpdateChannel _gaChannel, _betaChannel;
     // Whether the beta channel is enabled
     bool _enableBeta;
-    // Network reply for the download in progress (prevents us from starting
-    // another download)
+    // Network reply for the current download request.  This is null between
+    // requests while waiting to resume a download.
     QPointer<QNetworkReply> _pDownloadReply;
-    // Task to resolve/reject for the download in progress.  Set when
-    // _pDownloadReply is set.
+    // Task to resolve/reject for the download in progress (prevents us from
+    // starting another download).  Set while a download is in progress,
+    // including while waiting to resume it.
     Async<DownloadResult> _pDownloadTask;
-    // The version being downloaded.  Normally, this is the same as
-    // _availableVersion, but it can be different if a refresh occurs during a
-    // download, and the available version changes.  Set when _pDownloadReply is
+    // The update being downloaded.  Normally, this is the same as the
+    // available update, but it can be different if a refresh occurs during a
+    // download, and the available version changes.  Set when _pDownloadTask is
     // set.
-    QString _downloadingVersion;
-    // When a download is in progress, the file we are writing to.  This holds
-    // an open file when _pDownloadReply is set, it is closed otherwise.
+    Update _downloadingUpdate;
+    // When a download is in progress, the partial file we are writing to.
+    // This holds an open file when _pDownloadTask is set, it is closed
+    // otherwise.  It's renamed to the installer path once the download
+    // completes.
     QFile _installerFile;
+    // Hash of the data written to _installerFile so far, updated as data is
+    // written so the completed file doesn't have to be read again.
+    QCryptographicHash _installerHash;
+    // Final path of the installer being downloaded
+    QString _installerPath;
+    // Whether a delta is being downloaded instead of the full installer, and
+    // the installer that it applies to
+    bool _downloadingDelta;
+    QString _deltaBasePath;
+    // Offset that the current download request started from, whether its
+    // response has been checked yet (see checkDownloadResponse()), and
+    // whether the response body is being written to the file.
+    qint64 _requestOffset;
+    bool _responseChecked;
+    bool _responseAccepted;
+    // Validator (ETag or Last-Modified) from the response that began the
+    // data in _installerFile, if known.  Sent with If-Range when resuming so
+    // the server sends the whole file if it has changed.
+    QByteArray _resumeValidator;
+    // Number of resume attempts since data was last received.
+    int _resumeAttempts;
+    // Delays resuming a download after a request fails.
+    QTimer _resumeTimer;
+    // Background download settings, and whether the network is idle (see
+    // enableBackgroundDownload() and setNetworkIdle())
+    bool _backgroundEnabled;
+    qint64 _backgroundRateLimit;
+    bool _networkIdle;
+    // Whether the current download is a background download
+    bool _backgroundDownload;
+    // Progress of the current download (0-100), so it can be reported if a
+    // background download moves to the foreground
+    int _downloadProgress;
+    // Token bucket for a rate-limited download - the number of bytes that
+    // can be read now.  Refilled by _rateLimitTimer.
+    qint64 _rateTokens;
+    QTimer _rateLimitTimer;
+    // The update that was downloaded most recently and the path to its
+    // installer, if it's still available
+    Update _downloadedUpdate;
+    QString _downloadedInstallerPath;
 };
 
 #endif
@@ -0,0 +1,155 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("updatepatch.cpp")
+
+#include "updatepatch.h"
+#include <QFile>
+#include <algorithm>
+
+namespace
+{
+    const QByteArray patchMagic{QByteArrayLiteral("ENDSLEY/BSDIFF43")};
+    // Size of an encoded offset in the patch
+    const int offsetSize{8};
+    // Maximum amount of new data written at once
+    const qint64 outputChunkSize{65536};
+
+    // Decode a bsdiff offset - an 8-byte little-endian magnitude with the
+    // sign in the high bit
+    qint64 decodeOffset(const char *pData)
+    {
+        const unsigned char *pBytes = reinterpret_cast<const unsigned char*>(pData);
+        quint64 magnitude = 0;
+        for(int i = offsetSize-1; i >= 0; --i)
+        {
+            magnitude <<= 8;
+            magnitude |= (i == offsetSize-1) ? (pBytes[i] & 0x7F) : pBytes[i];
+        }
+        qint64 value = static_cast<qint64>(magnitude);
+        return (pBytes[offsetSize-1] & 0x80) ? -value : value;
+    }
+
+    // Write new data to the output and hash
+    bool writeOutput(QIODevice &output, QCryptographicHash &hash,
+                     const char *pData, qint64 len)
+    {
+        if(output.write(pData, len) != len)
+        {
+            qWarning() << "Failed to write patched data -" << output.errorString();
+            return false;
+        }
+        hash.addData(pData, static_cast<int>(len));
+        return true;
+    }
+}
+
+bool UpdatePatch::apply(const QString &basePath, const QByteArray &patch,
+                        QIODevice &output, QCryptographicHash &hash)
+{
+    if(patch.size() < patchMagic.size() + offsetSize || !patch.startsWith(patchMagic))
+    {
+        qWarning() << "Patch is not valid, header is missing";
+        return false;
+    }
+    qint64 newSize = decodeOffset(patch.data() + patchMagic.size());
+    if(newSize < 0)
+    {
+        qWarning() << "Patch is not valid, new size is" << newSize;
+        return false;
+    }
+
+    const QByteArray body = qUncompress(patch.mid(patchMagic.size() + offsetSize));
+    if(body.isEmpty() && newSize > 0)
+    {
+        qWarning() << "Patch is not valid, can't decompress body";
+        return false;
+    }
+
+    // Map the base file rather than reading it, it's as large as the
+    // installer
+    QFile baseFile{basePath};
+    if(!baseFile.open(QIODevice::OpenModeFlag::ReadOnly))
+    {
+        qWarning() << "Can't open patch base" << basePath << "-"
+            << baseFile.errorString();
+        return false;
+    }
+    const qint64 baseSize = baseFile.size();
+    const uchar *pBase = baseSize > 0 ? baseFile.map(0, baseSize) : nullptr;
+    if(baseSize > 0 && !pBase)
+    {
+        qWarning() << "Can't map patch base" << basePath << "-"
+            << baseFile.errorString();
+        return false;
+    }
+
+    const char *pBody = body.constData();
+    const qint64 bodySize = body.size();
+    qint64 bodyPos = 0, basePos = 0, newPos = 0;
+    QByteArray diffChunk;
+    while(newPos < newSize)
+    {
+        if(bodySize - bodyPos < offsetSize * 3)
+        {
+            qWarning() << "Patch is not valid, control data is truncated at"
+                << newPos << "of" << newSize << "bytes";
+            return false;
+        }
+        qint64 diffLen = decodeOffset(pBody + bodyPos);
+        qint64 extraLen = decodeOffset(pBody + bodyPos + offsetSize);
+        qint64 baseSeek = decodeOffset(pBody + bodyPos + offsetSize * 2);
+        bodyPos += offsetSize * 3;
+
+        if(diffLen < 0 || extraLen < 0 || diffLen > newSize - newPos ||
+           extraLen > newSize - newPos - diffLen ||
+           diffLen + extraLen > bodySize - bodyPos)
+        {
+            qWarning() << "Patch is not valid, control data is out of range at"
+                << newPos << "of" << newSize << "bytes";
+            return false;
+        }
+
+        // Add the diff bytes to the base, in manageable chunks
+        for(qint64 diffPos = 0; diffPos < diffLen; diffPos += outputChunkSize)
+        {
+            qint64 chunkLen = std::min(outputChunkSize, diffLen - diffPos);
+            diffChunk = QByteArray{pBody + bodyPos + diffPos, static_cast<int>(chunkLen)};
+            for(qint64 i = 0; i < chunkLen; ++i)
+            {
+                qint64 baseIdx = basePos + diffPos + i;
+                if(baseIdx >= 0 && baseIdx < baseSize)
+                    diffChunk[static_cast<int>(i)] = static_cast<char>(diffChunk[static_cast<int>(i)] + pBase[baseIdx]);
+            }
+            if(!writeOutput(output, hash, diffChunk.constData(), chunkLen))
+                return false;
+        }
+        bodyPos += diffLen;
+        newPos += diffLen;
+        basePos += diffLen;
+
+        // Copy the extra bytes
+        if(extraLen > 0 && !writeOutput(output, hash, pBody + bodyPos, extraLen))
+            return false;
+        bodyPos += extraLen;
+        newPos += extraLen;
+        basePos += baseSeek;
+    }
+
+    return true;
+}
@@ -0,0 +1,52 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("updatepatch.h")
+
+#ifndef UPDATEPATCH_H
+#define UPDATEPATCH_H
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QIODevice>
+#include <QString>
+
+// UpdatePatch applies binary delta patches to installers, so an update can be
+// downloaded as a delta from the installer of the installed version.
+//
+// The patch format is the "ENDSLEY/BSDIFF43" format produced by bsdiff
+// (https://github.com/mendsley/bsdiff), except that the patch body is
+// compressed with zlib (framed as by qCompress()) instead of bzip2:
+//
+//   16 bytes  "ENDSLEY/BSDIFF43"
+//    8 bytes  size of the new file (bsdiff offset encoding)
+//   ...       qCompress()ed body - a sequence of control triples (x, y, z),
+//             each followed by x "diff" bytes (added to the old file's bytes)
+//             and y "extra" bytes (copied), after which the old file position
+//             is adjusted by z.
+namespace UpdatePatch
+{
+    // Apply a patch to the file at basePath, writing the new file to output
+    // and adding it to hash as it's written.  Returns false if the patch is
+    // not valid or can't be applied; output contains partial data in that
+    // case.
+    bool apply(const QString &basePath, const QByteArray &patch,
+               QIODevice &output, QCryptographicHash &hash);
+}
+
+#endif
@@ -23,13 +23,27 @@
 #include "daemon.h"
 #include "path.h"
 #include "brand.h"
+#include "tracing.h"
+#include "metrics.h"
+#include "openssl.h"
+#ifdef Q_OS_UNIX
+#include "posix/posix_mtuprobe.h"
+#include "posix/posix_routequery.h"
+#endif
+#ifdef Q_OS_LINUX
+#include "linux/linux_dns.h"
+#endif
 
+#include <QBuffer>
 #include <QFile>
+#include <QFileInfo>
 #include <QTextStream>
 #include <QTcpSocket>
+#include <QUdpSocket>
 #include <QTimer>
 #include <QHostInfo>
 #include <QRandomGenerator>
+#include <algorithm>
 
 // For use by findInterfaceIp on Mac/Linux
 #ifdef Q_OS_UNIX
@@ -39,6 +53,8 @@
 #include <arpa/inet.h>
 #include <net/if.h>
 #include <unistd.h>
+#include <grp.h>
+#include <sys/stat.h>
 #endif
 
 // List of settings which require a reconnection.
@@ -53,11 +69,14 @@ static std::initializer_list<const char*> g_connectionSettingNames = {
     "auth",
     "serverCertificate",
     "overrideDNS",
+    "dnsCache",
     "defaultRoute",
     "blockIPv6",
     "mtu",
     "enableMACE",
     "windowsIpMethod",
+    "windowsDriver",
+    "linuxDataChannel",
     "proxy",
     "proxyCustom",
     "proxyShadowsocksLocation"
@@ -65,9 +84,6 @@ static std::initializer_list<const char*> g_connectionSettingNames = {
 
 namespace
 {
-    // Maximum number of measurements in _intervalMeasurements
-    const std::size_t g_maxMeasurementIntervals{32};
-
     // This seed is run by PIA Ops, this is used in addition to hnsd's
     // hard-coded seeds.  It has a static IP address but it's also resolvable
     // as hsd.londontrustmedia.com.
@@ -96,10 +112,54 @@ namespace
     // in the RestartStrategy, so the warning doesn't flap if hnsd fails for a
     // while, then starts up, but fails to sync.
     const std::chrono::seconds hnsdSyncTimeout{5};
+    // hnsd's sync height is reported at most this often
+    const std::chrono::seconds hnsdSyncHeightInterval{1};
 
     // Timeout for preferred transport before starting to try alternate transports
     const std::chrono::seconds preferredTransportTimeout{30};
 
+    // While no client is displaying the bandwidth graph, OpenVPN reports the
+    // byte counts this many times less often.  Each report is split into this
+    // many interval measurements, so the graph history stays continuous.
+    const uint reducedByteCountScale{6};
+
+    // Head start given to the preferred transport in a TransportRace before
+    // the alternates are probed, and the time to wait for any response
+    const std::chrono::milliseconds transportRaceHeadStart{250};
+    const std::chrono::seconds transportRaceTimeout{2};
+    // Maximum number of transports probed in a TransportRace
+    const std::size_t transportRaceMaxCandidates{8};
+
+    // Time to wait for proxy servers to accept a connection in a ProxyProbe
+    const std::chrono::seconds proxyProbeTimeout{3};
+
+    // Maximum number of networks remembered in DaemonData::networkTransports
+    const int maxNetworkTransports{64};
+    // Maximum number of networks remembered in DaemonData::networkMtus
+    const int maxNetworkMtus{64};
+    // Maximum number of networks remembered in DaemonData::networkThroughputs
+    const int maxNetworkThroughputs{64};
+
+    // Ciphers considered for the "auto" cipher setting, in order of
+    // preference.  A later cipher is only used if it's meaningfully faster
+    // than the best one preceding it.
+    const std::array<const char *, 4> autoCipherCandidates{{"AES-128-GCM", "AES-256-GCM",
+                                                            "AES-128-CBC", "AES-256-CBC"}};
+    const double autoCipherMargin{1.25};
+    // How much faster an alternate transport must have been on a network to
+    // begin with it instead of the preferred transport
+    const double fasterTransportMargin{1.5};
+
+    // Key for a transport in DaemonData::networkThroughputs
+    QString throughputKey(const Transport &transport)
+    {
+        return transport.protocol() + ':' + QString::number(transport.port());
+    }
+
+    // Number of recent connections included in the connection phase
+    // histograms
+    const std::size_t maxRecentConnectionPhases{32};
+
     // All IPv4 LAN and loopback subnets
     using SubnetPair = QPair<QHostAddress, int>;
     std::array<SubnetPair, 5> ipv4LocalSubnets{
@@ -119,10 +179,16 @@ namespace
 }
 
 HnsdRunner::HnsdRunner(RestartStrategy::Params restartParams)
-    : ProcessRunner{std::move(restartParams)}
+    : ProcessRunner{std::move(restartParams)}, _reportedSyncHeight{0},
+      _syncHeight{0}
 {
     setObjectName(QStringLiteral("hnsd"));
 
+    _syncHeightTimer.setSingleShot(true);
+    _syncHeightTimer.setInterval(msec(hnsdSyncHeightInterval));
+    connect(&_syncHeightTimer, &QTimer::timeout, this,
+            [this](){reportSyncHeight(_syncHeight);});
+
     _hnsdSyncTimer.setSingleShot(true);
     _hnsdSyncTimer.setInterval(msec(hnsdSyncTimeout));
     connect(&_hnsdSyncTimer, &QTimer::timeout, this,
@@ -144,6 +210,16 @@ HnsdRunner::HnsdRunner(RestartStrategy::Params restartParams)
                     _hnsdSyncTimer.stop();
                     emit hnsdSyncFailure(false);
 
+                    // Report the sync progress (throttled by _syncHeightTimer)
+                    QByteArray marker{QByteArrayLiteral(" new height: ")};
+                    int height = line.mid(line.indexOf(marker) + marker.length()).trimmed().toInt();
+                    if(height > 0)
+                    {
+                        _syncHeight = height;
+                        if(!_syncHeightTimer.isActive())
+                            _syncHeightTimer.start();
+                    }
+
                     // We just want to show some progress of hnsd's sync in the log.
                     // Qt regexes don't work on byte arrays but this check works
                     // well enough to trace every 1000 blocks.
@@ -161,6 +237,10 @@ HnsdRunner::HnsdRunner(RestartStrategy::Params restartParams)
             {
                 // Start (or restart) the sync timer.
                 _hnsdSyncTimer.start();
+                // A new process starts syncing from its saved state (or from
+                // scratch), it'll report its height again
+                _syncHeightTimer.stop();
+                reportSyncHeight(0);
             });
     // 'succeeded' means that the process has been running for long enough that
     // ProcessRunner considers it successful.  It hasn't necessarily synced any
@@ -199,6 +279,26 @@ bool HnsdRunner::enable(QString program, QStringList arguments)
     ::shellExecute(QStringLiteral("ifconfig lo0 alias %1 up").arg(::hnsdLocalAddress));
 
 #endif
+    // Keep the chain state across restarts if hnsd supports it, so it resumes
+    // syncing where it left off instead of from the genesis block.
+    if(supportsStatePrefix(program))
+    {
+        Path::HnsdDataDir.mkpath();
+#ifdef Q_OS_UNIX
+        // hnsd runs as the hnsd group (and 'nobody' on Linux), let it write
+        // its state
+        struct group *pGroup = getgrnam(BRAND_CODE "hnsd");
+        if(!pGroup || ::chown(qPrintable(Path::HnsdDataDir), static_cast<uid_t>(-1), pGroup->gr_gid) ||
+           ::chmod(qPrintable(Path::HnsdDataDir), 0770))
+        {
+            qWarning() << "Unable to set permissions on" << Path::HnsdDataDir
+                << "-" << qt_error_string(errno);
+        }
+#endif
+        arguments.push_back(QStringLiteral("--prefix"));
+        arguments.push_back(Path::HnsdDataDir);
+    }
+
     // Invoke the original
     return ProcessRunner::enable(std::move(program), std::move(arguments));
 }
@@ -211,6 +311,8 @@ void HnsdRunner::disable()
     // Not syncing or failing to sync since hnsd is no longer enabled.
     _hnsdSyncTimer.stop();
     emit hnsdSyncFailure(false);
+    _syncHeightTimer.stop();
+    reportSyncHeight(0);
 
 #ifdef Q_OS_MACOS
     QByteArray out;
@@ -240,6 +342,30 @@ bool HnsdRunner::hasNetBindServiceCapability()
 #endif
 }
 
+bool HnsdRunner::supportsStatePrefix(const QString &program)
+{
+    if(!_supportsStatePrefix)
+    {
+        // Check hnsd's usage text for the option
+        QProcess help;
+        help.setProcessChannelMode(QProcess::ProcessChannelMode::MergedChannels);
+        help.start(program, {QStringLiteral("--help")});
+        help.waitForFinished(2000);
+        _supportsStatePrefix = help.readAll().contains("--prefix");
+        qInfo() << "hnsd supports saving chain state:" << _supportsStatePrefix.get();
+    }
+    return _supportsStatePrefix.get();
+}
+
+void HnsdRunner::reportSyncHeight(int height)
+{
+    if(height != _reportedSyncHeight)
+    {
+        _reportedSyncHeight = height;
+        emit hnsdSyncHeight(height);
+    }
+}
+
 ShadowsocksRunner::ShadowsocksRunner(RestartStrategy::Params restartParams)
     : ProcessRunner{std::move(restartParams)}, _localPort{0}
 {
@@ -312,11 +438,20 @@ QDebug operator<<(QDebug debug, const OriginalNetworkScan& netScan) {
 }
 
 TransportSelector::TransportSelector()
-    : _preferred{QStringLiteral("udp"), 0}, _lastUsed{QStringLiteral("udp"), 0}, _alternates{},
-      _nextAlternate{0}, _startAlternates{-1}, _status{Status::Connecting}
+    : _preferred{QStringLiteral("udp"), 0}, _lastUsed{QStringLiteral("udp"), 0},
+      _hasRaceWinner{false}, _hasKnownTransport{false}, _alternates{},
+      _nextAlternate{0},
+      _startAlternates{-1}, _status{Status::Connecting},
+      _routeCacheEnabled{false}, _hasCachedRoute{false}
 {
 }
 
+void TransportSelector::setRouteCacheEnabled(bool enabled)
+{
+    _routeCacheEnabled = enabled;
+    _hasCachedRoute = false;
+}
+
 void TransportSelector::addAlternates(const QString &protocol,
                                       const ServerLocation &location,
                                       const QVector<uint> &ports)
@@ -375,27 +510,23 @@ QHostAddress TransportSelector::findLocalAddress(const QString &remoteAddress)
 
 void TransportSelector::scanNetworkRoutes(OriginalNetworkScan &netScan)
 {
-    QString out, err;
-    QStringList result;
-    int exitCode{-1};  // Default to -1 so it fails on windows for now
-
-    // TODO: use system APIs for this rather than relying on flaky and changeable system tools (in terms of their output format)
-#if defined(Q_OS_MACOS)
-    // This awk script is necessary as the macOS 10.14 and 10.15 output of netstat has changed. As a result we need to actually locate the columns
-    // we're interested in, we can't just hard-code a column number
-    auto commandString = QStringLiteral("netstat -nr -f inet | sed '1,3 d' | awk 'NR==1 { for (i=1; i<=NF; i++) { f[$i] = i  } } NR>1 && $(f[\"Destination\"])==\"default\" { print $(f[\"Gateway\"]), $(f[\"Netif\"]) ; exit }'");
-#elif defined(Q_OS_LINUX)
-    auto commandString = QStringLiteral("netstat -nr | tee /dev/stderr | awk '$1==\"default\" || ($1==\"0.0.0.0\" && $3==\"0.0.0.0\") { print $2, $8; exit }'");
-
-#endif
 #ifdef Q_OS_UNIX
-    std::tie(exitCode, out, err) = ::shellExecute(commandString);
-    if(exitCode == 0)
+    // The default route is queried once per connection attempt, use the
+    // cached result unless the routing table has changed since then.
+    if(!_routeCacheEnabled || !_hasCachedRoute)
     {
-        result = out.split(' ');
-        netScan.gatewayIp(result.first());
-        netScan.interfaceName(result.last());
+        PosixDefaultRoute route;
+        if(!queryDefaultRoute(route))
+        {
+            _hasCachedRoute = false;
+            return;
+        }
+        _cachedGatewayIp = route.gatewayIp;
+        _cachedInterfaceName = route.interfaceName;
+        _hasCachedRoute = true;
     }
+    netScan.gatewayIp(_cachedGatewayIp);
+    netScan.interfaceName(_cachedInterfaceName);
 #else
     // Not needed for Windows
     netScan.gatewayIp(QStringLiteral("N/A"));
@@ -403,6 +534,70 @@ void TransportSelector::scanNetworkRoutes(OriginalNetworkScan &netScan)
 #endif
 }
 
+bool TransportSelector::isCandidate(const Transport &transport) const
+{
+    return transport == _preferred ||
+        std::find(_alternates.begin(), _alternates.end(), transport) != _alternates.end();
+}
+
+void TransportSelector::updateKnownTransport()
+{
+    auto itKnown = _knownTransports.find(_networkFingerprint);
+    _hasKnownTransport = !_networkFingerprint.isEmpty() &&
+        itKnown != _knownTransports.end() && isCandidate(*itKnown);
+    if(_hasKnownTransport)
+    {
+        _knownTransport = *itKnown;
+        return;
+    }
+
+    // Otherwise, an alternate that has been much faster on this network is
+    // treated like a known transport
+    const Transport *pFaster = findFasterTransport();
+    if(pFaster)
+    {
+        qInfo() << "Starting with" << pFaster->protocol() << pFaster->port()
+            << "due to throughput on this network";
+        _knownTransport = *pFaster;
+        _hasKnownTransport = true;
+    }
+}
+
+const Transport *TransportSelector::findFasterTransport() const
+{
+    auto itNetwork = _throughputs.find(_networkFingerprint);
+    if(_networkFingerprint.isEmpty() || itNetwork == _throughputs.end())
+        return nullptr;
+
+    // Without a measurement of the preferred transport, there's nothing to
+    // compare to
+    double preferredThroughput = itNetwork->value(throughputKey(_preferred), 0.0);
+    if(preferredThroughput <= 0.0)
+        return nullptr;
+
+    const Transport *pFastest = nullptr;
+    double fastestThroughput = preferredThroughput * fasterTransportMargin;
+    for(const auto &alternate : _alternates)
+    {
+        double throughput = itNetwork->value(throughputKey(alternate), 0.0);
+        if(throughput > fastestThroughput)
+        {
+            pFastest = &alternate;
+            fastestThroughput = throughput;
+        }
+    }
+    return pFastest;
+}
+
+const Transport &TransportSelector::startingTransport() const
+{
+    if(_hasKnownTransport)
+        return _knownTransport;
+    if(_hasRaceWinner)
+        return _raceWinner;
+    return _preferred;
+}
+
 QHostAddress TransportSelector::validLastLocalAddress() const
 {
     if(_lastUsed.protocol() == QStringLiteral("udp"))
@@ -414,10 +609,17 @@ QHostAddress TransportSelector::validLastLocalAddress() const
 void TransportSelector::reset(Transport preferred, bool useAlternates,
                               const ServerLocation &location,
                               const QVector<uint> &udpPorts,
-                              const QVector<uint> &tcpPorts)
+                              const QVector<uint> &tcpPorts,
+                              const DaemonData::NetworkTransportMap &knownTransports,
+                              const DaemonData::NetworkThroughputMap &throughputs)
 {
     _preferred = preferred;
     _preferred.resolvePort(location);
+    _hasRaceWinner = false;
+    // The known transports are only used with alternates; otherwise only the
+    // preferred transport is used.
+    _knownTransports = useAlternates ? knownTransports : DaemonData::NetworkTransportMap{};
+    _throughputs = useAlternates ? throughputs : DaemonData::NetworkThroughputMap{};
     _alternates.clear();
     _nextAlternate = 0;
     _startAlternates.setRemainingTime(msec(preferredTransportTimeout));
@@ -450,6 +652,10 @@ void TransportSelector::reset(Transport preferred, bool useAlternates,
             addAlternates(QStringLiteral("udp"), location, udpPorts);
         }
     }
+
+    // Check the last network seen against the new known transports; this is
+    // rechecked by beginAttempt() when the network is scanned again.
+    updateKnownTransport();
 }
 
 OriginalNetworkScan TransportSelector::scanNetwork(const ServerLocation *pLocation,
@@ -526,8 +732,26 @@ bool TransportSelector::beginAttempt(const ServerLocation &location,
         qInfo() << "UDP:" << localUdpAddress << "->" << location.udpHost();
         qInfo() << "TCP:" << localTcpAddress << "->" << location.tcpHost();
         qInfo() << "Network connectivity has changed since last attempt, start over from preferred transport";
+        // A race winner is no longer meaningful on a different network.  (The
+        // addresses are also cleared by reset(), which isn't a network change.)
+        if(!_lastLocalUdpAddress.isNull() || !_lastLocalTcpAddress.isNull())
+            _hasRaceWinner = false;
         _lastLocalUdpAddress = localUdpAddress;
         _lastLocalTcpAddress = localTcpAddress;
+
+        // If a transport worked on this network before, start with it
+        if(!netScan.gatewayIp().isEmpty() && netScan.gatewayIp() != QStringLiteral("N/A"))
+            _networkFingerprint = netScan.gatewayIp() + '%' + netScan.interfaceName();
+        else if(!localUdpAddress.isNull())
+            _networkFingerprint = localUdpAddress.toString();
+        else
+            _networkFingerprint.clear();
+        updateKnownTransport();
+        if(_hasKnownTransport)
+        {
+            qInfo() << "Using transport" << _knownTransport.protocol()
+                << _knownTransport.port() << "that worked on this network before";
+        }
         _nextAlternate = 0;
         _startAlternates.setRemainingTime(msec(preferredTransportTimeout));
         _status = Status::Connecting;
@@ -561,7 +785,7 @@ bool TransportSelector::beginAttempt(const ServerLocation &location,
     if(_alternates.empty() || _status == Status::Connecting ||
         _lastLocalUdpAddress.isNull() || _lastLocalTcpAddress.isNull())
     {
-        _lastUsed = _preferred;
+        _lastUsed = startingTransport();
     }
     // After a few failures, start trying alternates.  After each retry delay,
     // we try the preferred settings, then immediately try one alternate if that
@@ -572,9 +796,9 @@ bool TransportSelector::beginAttempt(const ServerLocation &location,
     // the next alternate with the usual delay.
     else if(!_useAlternateNext)
     {
-        // Try preferred settings.
+        // Try preferred settings (or the race winner).
         _useAlternateNext = true;
-        _lastUsed = _preferred;
+        _lastUsed = startingTransport();
         // No delay since we'll try an alternate next.
         delayNext = false;
     }
@@ -593,6 +817,175 @@ bool TransportSelector::beginAttempt(const ServerLocation &location,
     return delayNext;
 }
 
+std::vector<Transport> TransportSelector::raceCandidates() const
+{
+    std::vector<Transport> candidates;
+    if(_alternates.empty())
+        return candidates;
+
+    candidates.reserve(std::min(_alternates.size() + 1, transportRaceMaxCandidates));
+    candidates.push_back(_preferred);
+    for(const auto &alternate : _alternates)
+    {
+        if(candidates.size() >= transportRaceMaxCandidates)
+            break;
+        candidates.push_back(alternate);
+    }
+    return candidates;
+}
+
+void TransportSelector::useRaceWinner(const Transport &winner)
+{
+    _raceWinner = winner;
+    _hasRaceWinner = true;
+}
+
+TransportRace::TransportRace(const ServerLocation &location,
+                             const std::vector<Transport> &candidates)
+    : _candidates{candidates}, _udpHost{location.udpHost()},
+      _tcpHost{location.tcpHost()}, _finished{false}
+{
+    Q_ASSERT(!_candidates.empty());
+
+    _headStartTimer.setSingleShot(true);
+    connect(&_headStartTimer, &QTimer::timeout, this,
+            &TransportRace::probeAlternates);
+    _timeoutTimer.setSingleShot(true);
+    connect(&_timeoutTimer, &QTimer::timeout, this, &TransportRace::onTimeout);
+
+    qInfo() << "Racing" << _candidates.size() << "transports to"
+        << location.id();
+    probe(0);
+    _headStartTimer.start(msec32(transportRaceHeadStart));
+    _timeoutTimer.start(msec32(transportRaceTimeout));
+}
+
+void TransportRace::probe(std::size_t index)
+{
+    const Transport &transport = _candidates[index];
+    if(transport.protocol() == QStringLiteral("udp"))
+    {
+        if(_udpHost.isNull())
+            return;
+        auto pSocket = new QUdpSocket{this};
+        connect(pSocket, &QUdpSocket::readyRead, this, [this, pSocket, index]()
+        {
+            QHostAddress senderHost;
+            quint16 senderPort;
+            while(pSocket->hasPendingDatagrams())
+            {
+                pSocket->readDatagram(nullptr, 0, &senderHost, &senderPort);
+                if(senderHost.isEqual(_udpHost, QHostAddress::ConvertV4MappedToIPv4) &&
+                   senderPort == _candidates[index].port())
+                {
+                    finish(index);
+                    return;
+                }
+            }
+        });
+        pSocket->bind();
+
+        // P_CONTROL_HARD_RESET_CLIENT_V2 with key ID 0, a random session ID,
+        // no acks, and packet ID 0
+        QByteArray hardReset{1, static_cast<char>(7 << 3)};
+        quint64 sessionId = QRandomGenerator::global()->generate64();
+        hardReset.append(reinterpret_cast<const char*>(&sessionId), sizeof(sessionId));
+        hardReset.append(5, 0);
+        pSocket->writeDatagram(hardReset, _udpHost, transport.port());
+    }
+    else
+    {
+        if(_tcpHost.isNull())
+            return;
+        auto pSocket = new QTcpSocket{this};
+        connect(pSocket, &QTcpSocket::connected, this,
+                [this, index](){finish(index);});
+        pSocket->connectToHost(_tcpHost, transport.port());
+    }
+}
+
+void TransportRace::probeAlternates()
+{
+    for(std::size_t i=1; i<_candidates.size(); ++i)
+        probe(i);
+}
+
+void TransportRace::finish(std::size_t index)
+{
+    if(_finished)
+        return;
+    _finished = true;
+    _headStartTimer.stop();
+    _timeoutTimer.stop();
+
+    qInfo() << "Transport" << _candidates[index].protocol()
+        << _candidates[index].port() << "responded first";
+    emit finished(_candidates[index], true);
+}
+
+void TransportRace::onTimeout()
+{
+    if(_finished)
+        return;
+    _finished = true;
+    _headStartTimer.stop();
+
+    qInfo() << "No transport responded within"
+        << traceMsec(transportRaceTimeout);
+    emit finished({}, false);
+}
+
+ProxyProbe::ProxyProbe(const std::vector<Endpoint> &endpoints)
+    : _remaining{0}, _finished{false}
+{
+    _timeoutTimer.setSingleShot(true);
+    connect(&_timeoutTimer, &QTimer::timeout, this, &ProxyProbe::finish);
+
+    _elapsed.start();
+    for(const auto &endpoint : endpoints)
+    {
+        if(endpoint.host.isNull())
+            continue;
+        ++_remaining;
+        auto pSocket = new QTcpSocket{this};
+        auto onDone = [this, pSocket, id = endpoint.id](bool connected)
+        {
+            // Only count each socket once (aborting it emits an error)
+            QObject::disconnect(pSocket, nullptr, this, nullptr);
+            if(connected)
+                _latencies.insert(id, std::chrono::milliseconds{_elapsed.elapsed()});
+            pSocket->abort();
+            if(--_remaining == 0)
+                finish();
+        };
+        connect(pSocket, &QTcpSocket::connected, this, [onDone](){onDone(true);});
+        connect(pSocket, QOverload<QTcpSocket::SocketError>::of(&QTcpSocket::error),
+                this, [onDone](){onDone(false);});
+        pSocket->connectToHost(endpoint.host, endpoint.port);
+    }
+
+    qInfo() << "Probing" << _remaining << "proxy servers";
+    if(_remaining == 0)
+    {
+        // Emit asynchronously, the caller hasn't connected yet
+        QMetaObject::invokeMethod(this, &ProxyProbe::finish, Qt::QueuedConnection);
+    }
+    else
+        _timeoutTimer.start(msec32(proxyProbeTimeout));
+}
+
+void ProxyProbe::finish()
+{
+    if(_finished)
+        return;
+    _finished = true;
+    _timeoutTimer.stop();
+
+    qInfo() << _latencies.size() << "proxy servers responded within"
+        << traceMsec(std::chrono::milliseconds{_elapsed.elapsed()});
+    emit finished(_latencies);
+}
+
 QHostAddress ConnectionConfig::parseIpv4Host(const QString &host)
 {
     // The proxy address must be a literal IPv4 address, we cannot
@@ -692,6 +1085,12 @@ bool ConnectionConfig::canConnect() const
     return true;
 }
 
+void ConnectionConfig::failOver(const QSharedPointer<ServerLocation> &pFailoverLocation)
+{
+    if(_vpnLocationAuto && pFailoverLocation)
+        _pVpnLocation = pFailoverLocation;
+}
+
 bool ConnectionConfig::hasChanged(const ConnectionConfig &other) const
 {
     // Only consider location changes if the location ID has changed.  Ignore
@@ -716,21 +1115,59 @@ VPNConnection::VPNConnection(QObject* parent)
     , _openvpn(nullptr)
     , _hnsdRunner{hnsdRestart}
     , _shadowsocksRunner{shadowsocksRestart}
+    , _dnsCacheActive{false}
+    , _hnsdBackgroundSync{false}
     , _connectionAttemptCount(0)
     , _receivedByteCount(0)
     , _sentByteCount(0)
+    , _peakThroughput{0.0}
     , _lastReceivedByteCount(0)
     , _lastSentByteCount(0)
+    , _intervalMeasurements{}
+    , _intervalStart{0}
+    , _intervalCount{0}
+    , _reducedByteCountRate{false}
     , _needsReconnect(false)
+    , _settingsVersion{1}
+    , _checkedSettingsVersion{0}
+    , _configVersion{1}
+    , _currentConfigVersion{0}
+    , _warmRestartPending{false}
+    , _networkLost{false}
+    , _failingOver{false}
+    , _currentPhase{OpenVPNProcess::Created}
+    , _attemptPhaseTimes{}
+    , _connectionHistory{Path::DaemonSettingsDir / "connhistory.dat"}
 {
     _shadowsocksRunner.setObjectName("shadowsocks");
 
     _connectTimer.setSingleShot(true);
     connect(&_connectTimer, &QTimer::timeout, this, &VPNConnection::beginConnection);
 
+    connect(&_networkMonitor, &NetworkMonitor::networkChanged, this,
+            &VPNConnection::onNetworkChanged);
+    connect(&_networkMonitor, &NetworkMonitor::routesChanged, this,
+            [this](){_transportSelector.invalidateRouteCache();});
+    _transportSelector.setRouteCacheEnabled(_networkMonitor.isMonitoring());
+
     connect(&_hnsdRunner, &HnsdRunner::hnsdSucceeded, this, &VPNConnection::hnsdSucceeded);
     connect(&_hnsdRunner, &HnsdRunner::hnsdFailed, this, &VPNConnection::hnsdFailed);
     connect(&_hnsdRunner, &HnsdRunner::hnsdSyncFailure, this, &VPNConnection::hnsdSyncFailure);
+    connect(&_hnsdRunner, &HnsdRunner::hnsdSyncHeight, this, &VPNConnection::hnsdSyncHeight);
+
+    // Report restart counts and failure causes of both helpers
+    for(ProcessRunner *pRunner : std::initializer_list<ProcessRunner*>{&_hnsdRunner, &_shadowsocksRunner})
+    {
+        connect(pRunner, &ProcessRunner::statusChanged, this, [this, pRunner]()
+        {
+            HelperProcessStatus status;
+            status.restartCount(pRunner->restartCount());
+            if(pRunner->lastFailureCause())
+                status.lastFailureCause(qEnumToString(pRunner->lastFailureCause().get()));
+            status.halted(pRunner->isHalted());
+            emit helperProcessStatusChanged(pRunner->objectName(), status);
+        });
+    }
 
     // The succeeded/failed signals from _shadowsocksRunner are ignored.  It
     // rarely fails, particularly since it does not do much of anything until we
@@ -763,45 +1200,37 @@ VPNConnection::VPNConnection(QObject* parent)
     });
 }
 
-void VPNConnection::activateMACE()
+void VPNConnection::activateMace()
 {
-    // To activate MACE, we need to send a TCP packet to 209.222.18.222 port 1111.
-    // This sets the DNS servers to block queries for known tracking domains
-    // As a fallback, we also need to send another packet 5 seconds later
-    // (see pia_manager's openvpn_manager.rb for original implementation)
-    //
-    // We can later test if we need a second packet, but it might be used to mitigate
-    // issues occured by sending a packet immediately.
-    auto maceActivate1 = new QTcpSocket();
-    qDebug () << "Sending MACE Packet 1";
-    maceActivate1->connectToHost(QStringLiteral("209.222.18.222"), 1111);
-    // Tested if error condition is hit by changing the port/invalid IP
-    connect(maceActivate1,QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error), this,
-            [maceActivate1](QAbstractSocket::SocketError socketError) {
-        qError() << "Failed to activate MACE packet 1 " << socketError;
-        maceActivate1->deleteLater();
-    });
-    connect(maceActivate1, &QAbstractSocket::connected, this, [maceActivate1]() {
-        qDebug () << "MACE Packet 1 connected succesfully";
-        maceActivate1->close();
-        maceActivate1->deleteLater();
-    });
+    _connectionStep = ConnectionStep::ActivatingMACE;
+    // If OpenVPN restarted during a prior activation, that one is replaced
+    _pMaceActivation.abandon();
+    _pMaceActivation = Async<MaceActivationTask>::create();
+    // Queued, so the task isn't destroyed during its own signal if the result
+    // causes the connection to be dropped
+    connect(_pMaceActivation.get(), &BaseTask::finished, this,
+            &VPNConnection::onMaceActivationFinished, Qt::QueuedConnection);
+}
 
-    QTimer::singleShot(std::chrono::milliseconds(5000).count(), this, [this]() {
-        auto maceActivate2 = new QTcpSocket();
-        qDebug () << "Sending MACE Packet 2";
-        maceActivate2->connectToHost(QStringLiteral("209.222.18.222"), 1111);
-        connect(maceActivate2,QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error), this,
-            [maceActivate2](QAbstractSocket::SocketError socketError) {
-        qError() << "Failed to activate MACE packet 2 " << socketError;
-        maceActivate2->deleteLater();
-        });
-        connect(maceActivate2, &QAbstractSocket::connected, this, [maceActivate2]() {
-        qDebug () << "MACE Packet 2 connected succesfully";
-        maceActivate2->close();
-        maceActivate2->deleteLater();
-        });
-    });
+void VPNConnection::onMaceActivationFinished()
+{
+    // Ignore the result if the attempt was abandoned, or if OpenVPN didn't stay
+    // connected while MACE was being activated
+    if(!_pMaceActivation || !_pMaceActivation->isFinished() ||
+       _connectionStep != ConnectionStep::ActivatingMACE ||
+       !_openvpn || _openvpn->state() != OpenVPNProcess::Connected)
+    {
+        return;
+    }
+
+    bool active = _pMaceActivation->isResolved();
+    if(!active)
+        qWarning() << "Couldn't activate MACE:" << _pMaceActivation->error();
+    emit maceActivationFinished(active, _pMaceActivation->elapsed());
+
+    // Go to the Connected state even if activation failed; the connection
+    // works without MACE.
+    setState(State::Connected);
 }
 
 bool VPNConnection::needsReconnect()
@@ -810,14 +1239,20 @@ bool VPNConnection::needsReconnect()
         return _needsReconnect = false;
     if (_needsReconnect)
         return true;
-    for (auto name : g_connectionSettingNames)
+    // The settings only need to be compared again if one of them has changed
+    // since they last matched
+    if (_checkedSettingsVersion != _settingsVersion)
     {
-        QJsonValue storedValue = _connectionSettings.value(QLatin1String(name));
-        QJsonValue currentValue = g_settings.get(name);
-        if (storedValue != currentValue)
-            return _needsReconnect = true;
+        for (auto name : g_connectionSettingNames)
+        {
+            QJsonValue storedValue = _connectionSettings.value(QLatin1String(name));
+            QJsonValue currentValue = g_settings.get(name);
+            if (storedValue != currentValue)
+                return _needsReconnect = true;
+        }
+        _checkedSettingsVersion = _settingsVersion;
     }
-    ConnectionConfig newConfig{g_settings, g_state};
+    const ConnectionConfig &newConfig{currentConfig()};
     switch(_state)
     {
     default:
@@ -853,9 +1288,92 @@ bool VPNConnection::needsReconnect()
     return _needsReconnect;
 }
 
+void VPNConnection::connectionSettingChanged(const QString &name)
+{
+    // Settings that are captured by ConnectionConfig
+    static const std::initializer_list<const char*> configSettingNames{
+        "splitTunnelEnabled", "defaultRoute", "proxy", "proxyCustom"
+    };
+
+    if(std::find(g_connectionSettingNames.begin(), g_connectionSettingNames.end(), name) != g_connectionSettingNames.end())
+        ++_settingsVersion;
+    if(std::find(configSettingNames.begin(), configSettingNames.end(), name) != configSettingNames.end())
+        ++_configVersion;
+}
+
+void VPNConnection::connectionLocationsChanged()
+{
+    ++_configVersion;
+}
+
+const ConnectionConfig &VPNConnection::currentConfig()
+{
+    if(_currentConfigVersion != _configVersion)
+    {
+        _currentConfig = ConnectionConfig{g_settings, g_state};
+        _currentConfig.failOver(_pFailoverLocation);
+        _currentConfigVersion = _configVersion;
+    }
+    return _currentConfig;
+}
+
 void VPNConnection::scanNetwork(const ServerLocation *pLocation, const QString &protocol)
 {
-    emit scannedOriginalNetwork(_transportSelector.scanNetwork(pLocation, protocol));
+    _lastNetworkScan = _transportSelector.scanNetwork(pLocation, protocol);
+    _networkLost = false;
+    emit scannedOriginalNetwork(_lastNetworkScan);
+}
+
+void VPNConnection::onNetworkChanged()
+{
+    switch(_state)
+    {
+    case State::Connected:
+    {
+        Q_ASSERT(_connectedConfig.vpnLocation()); // Valid in this state
+        OriginalNetworkScan netScan = _transportSelector.scanNetwork(_connectedConfig.vpnLocation().get(),
+                                                                     _transportSelector.lastUsed().protocol());
+        // Most notifications are for routes that don't matter here (the
+        // tunnel's own routes, split tunnel, etc.)
+        if(netScan == _lastNetworkScan && !_networkLost)
+            return;
+        // If the network is gone, there's nothing to reconnect over yet.
+        // Remember that it was lost though - even if the same network comes
+        // back (sleep/wake, Wi-Fi dropout), the tunnel may well be dead by
+        // then.
+        if(!netScan.isValid())
+        {
+            qInfo() << "Network lost while connected:" << netScan;
+            _networkLost = true;
+            return;
+        }
+        qInfo() << "Network changed while connected:" << _lastNetworkScan
+            << "->" << netScan << "- reconnecting now";
+        _networkLost = false;
+        // Reconnect with the same settings.  This restarts OpenVPN in place if
+        // possible, otherwise it starts a new process as usual; either way the
+        // network is scanned again for the new connection.
+        connectVPN(true);
+        return;
+    }
+    case State::Connecting:
+    case State::StillConnecting:
+    case State::Reconnecting:
+    case State::StillReconnecting:
+        // If we're waiting to retry (possibly the slow interval), retry now -
+        // the last attempt may have failed because the network was going away
+        // or hadn't come up yet.
+        if(_connectTimer.isActive())
+        {
+            qInfo() << "Network changed while waiting to retry, retrying now";
+            _connectTimer.stop();
+            _timeUntilNextConnectionAttempt.setRemainingTime(0);
+            queueConnectionAttempt();
+        }
+        return;
+    default:
+        return;
+    }
 }
 
 void VPNConnection::connectVPN(bool force)
@@ -868,11 +1386,29 @@ void VPNConnection::connectVPN(bool force)
         if (!force && !needsReconnect())
             return;
 
-        // Otherwise, change to DisconnectingToReconnect
-        copySettings(State::DisconnectingToReconnect, State::Disconnecting);
+        {
+            // Keep the settings that the running OpenVPN process was started
+            // with, they determine whether it can be reused.
+            QJsonObject runningSettings = _connectionSettings;
+            QString runningUsername = _openvpnUsername;
+            QString runningPassword = _openvpnPassword;
+            DaemonSettings::DNSSetting runningDnsServers = _dnsServers;
+
+            // Otherwise, change to DisconnectingToReconnect
+            copySettings(State::DisconnectingToReconnect, State::Disconnecting);
 
-        Q_ASSERT(_openvpn); // Valid in this state
-        _openvpn->shutdown();
+            Q_ASSERT(_openvpn); // Valid in this state
+            if(_state == State::DisconnectingToReconnect &&
+               runningSettings == _connectionSettings &&
+               runningUsername == _openvpnUsername &&
+               runningPassword == _openvpnPassword &&
+               runningDnsServers == _dnsServers &&
+               warmRestart())
+            {
+                return;
+            }
+            _openvpn->shutdown();
+        }
         return;
     case State::Connecting:
     case State::StillConnecting:
@@ -908,6 +1444,9 @@ void VPNConnection::connectVPN(bool force)
     case State::Disconnected:
         _connectionAttemptCount = 0;
         _connectedConfig = {};
+        _pFailoverLocation.reset();
+        _failingOver = false;
+        ++_configVersion;
         if(copySettings(State::Connecting, State::Disconnected))
             queueConnectionAttempt();
         return;
@@ -919,6 +1458,21 @@ void VPNConnection::disconnectVPN()
     if (_state != State::Disconnected)
     {
         _connectingConfig = {};
+        _warmRestartPending = false;
+        _pFailoverLocation.reset();
+        _failingOver = false;
+        ++_configVersion;
+        // Abandon a transport race if one is running
+        if(_pTransportRace)
+        {
+            _pTransportRace->deleteLater();
+            _pTransportRace = nullptr;
+        }
+        if(_pProxyProbe)
+        {
+            _pProxyProbe->deleteLater();
+            _pProxyProbe = nullptr;
+        }
         setState(State::Disconnecting);
         if (_openvpn && _openvpn->state() < OpenVPNProcess::Exiting)
             _openvpn->shutdown();
@@ -927,12 +1481,256 @@ void VPNConnection::disconnectVPN()
             setState(State::Disconnected);
         }
     }
-}
+}
+
+void VPNConnection::beginConnection()
+{
+    _connectionStep = ConnectionStep::Initializing;
+    _pMaceActivation.abandon();
+    doConnect();
+}
+
+void VPNConnection::rememberNetworkTransport()
+{
+    const QString &fingerprint = _transportSelector.networkFingerprint();
+    // Nothing to remember if the network wasn't identified, or if alternates
+    // aren't enabled (the preferred transport is the only choice)
+    if(fingerprint.isEmpty() || _transportSelector.raceCandidates().empty())
+        return;
+
+    auto networkTransports = g_data.networkTransports();
+    if(_transportSelector.lastUsed() == _transportSelector.preferred())
+    {
+        if(!networkTransports.remove(fingerprint))
+            return;
+    }
+    else
+    {
+        auto itExisting = networkTransports.find(fingerprint);
+        if(itExisting != networkTransports.end() &&
+           *itExisting == _transportSelector.lastUsed())
+        {
+            return;
+        }
+        // Keep the map bounded; drop an arbitrary network if it's full
+        if(itExisting == networkTransports.end() &&
+           networkTransports.size() >= maxNetworkTransports)
+        {
+            networkTransports.erase(networkTransports.begin());
+        }
+        networkTransports.insert(fingerprint, _transportSelector.lastUsed());
+        qInfo() << "Remembering transport" << _transportSelector.lastUsed().protocol()
+            << _transportSelector.lastUsed().port() << "for this network";
+    }
+    g_data.networkTransports(networkTransports);
+}
+
+void VPNConnection::startMtuProbe()
+{
+#ifdef Q_OS_UNIX
+    if(!g_settings.mtuDiscovery() || g_settings.mtu() > 0)
+        return;
+
+    const QString &fingerprint = _transportSelector.networkFingerprint();
+    if(fingerprint.isEmpty() || g_data.networkMtus().contains(fingerprint))
+        return;
+
+    QHostAddress target{g_state.tunnelDeviceRemoteAddress()};
+    if(target.protocol() != QAbstractSocket::IPv4Protocol)
+    {
+        qInfo() << "Not probing MTU, tunnel remote address is"
+            << g_state.tunnelDeviceRemoteAddress();
+        return;
+    }
+
+    if(_pMtuProbe)
+        _pMtuProbe->deleteLater();
+    _pMtuProbe = new PosixMtuProbe{this, target};
+    connect(_pMtuProbe.data(), &PosixMtuProbe::finished, this,
+            [this, fingerprint](unsigned mtu)
+            {
+                if(_pMtuProbe)
+                {
+                    _pMtuProbe->deleteLater();
+                    _pMtuProbe = nullptr;
+                }
+                storeNetworkMtu(fingerprint, mtu);
+            });
+#endif
+}
+
+void VPNConnection::storeNetworkMtu(const QString &fingerprint, unsigned mtu)
+{
+    // If nothing was echoed, the server probably doesn't answer pings; don't
+    // remember anything so the next connection on this network tries again.
+    if(mtu == 0)
+    {
+        qInfo() << "MTU probe didn't get any replies";
+        return;
+    }
+
+    auto networkMtus = g_data.networkMtus();
+    auto itExisting = networkMtus.find(fingerprint);
+    if(itExisting != networkMtus.end() && *itExisting == mtu)
+        return;
+    // Keep the map bounded; drop an arbitrary network if it's full
+    if(itExisting == networkMtus.end() && networkMtus.size() >= maxNetworkMtus)
+        networkMtus.erase(networkMtus.begin());
+    networkMtus.insert(fingerprint, mtu);
+    qInfo() << "Discovered MTU" << mtu << "for this network";
+    g_data.networkMtus(networkMtus);
+}
+
+void VPNConnection::rememberTransportThroughput()
+{
+    const QString &fingerprint = _transportSelector.networkFingerprint();
+    if(g_settings.cipher() != QStringLiteral("auto") || fingerprint.isEmpty() ||
+       _peakThroughput <= 0.0)
+    {
+        return;
+    }
+
+    auto networkThroughputs = g_data.networkThroughputs();
+    auto itNetwork = networkThroughputs.find(fingerprint);
+    if(itNetwork == networkThroughputs.end())
+    {
+        // Keep the map bounded; drop an arbitrary network if it's full
+        if(networkThroughputs.size() >= maxNetworkThroughputs)
+            networkThroughputs.erase(networkThroughputs.begin());
+        itNetwork = networkThroughputs.insert(fingerprint, {});
+    }
+    double &best = (*itNetwork)[throughputKey(_transportSelector.lastUsed())];
+    if(_peakThroughput <= best)
+        return;
+    best = _peakThroughput;
+    g_data.networkThroughputs(networkThroughputs);
+}
+
+DaemonData::CipherThroughputMap VPNConnection::benchmarkCiphers()
+{
+    DaemonData::CipherThroughputMap throughputs;
+    for(const char *pCipher : autoCipherCandidates)
+    {
+        QString cipher = QLatin1String(pCipher);
+        // CBC ciphers are measured with the default HMAC digest
+        double throughput = measureCipherThroughput(cipher, DaemonSettings::default_auth());
+        if(throughput > 0.0)
+            throughputs.insert(cipher, throughput);
+        qInfo() << "Cipher" << cipher << "throughput:" << throughput / 1000000.0 << "MB/s";
+    }
+    return throughputs;
+}
+
+QString VPNConnection::selectAutoCipher(const DaemonData::CipherThroughputMap &throughputs)
+{
+    QString selected = QLatin1String(autoCipherCandidates[0]);
+    double selectedThroughput = throughputs.value(selected, 0.0);
+    for(const char *pCipher : autoCipherCandidates)
+    {
+        QString cipher = QLatin1String(pCipher);
+        double throughput = throughputs.value(cipher, 0.0);
+        if(throughput > selectedThroughput * autoCipherMargin)
+        {
+            selected = cipher;
+            selectedThroughput = throughput;
+        }
+    }
+    return selected;
+}
+
+bool VPNConnection::startTransportRace()
+{
+    // No need to race if a transport is known to work on the last network
+    // seen; beginAttempt() checks that it's still the same network.
+    if(_transportSelector.hasKnownTransport())
+        return false;
+
+    const auto &candidates = _transportSelector.raceCandidates();
+    if(candidates.empty())
+        return false;
+
+    if(_pTransportRace)
+        _pTransportRace->deleteLater();
+    TransportRace *pRace = new TransportRace{*_connectingConfig.vpnLocation(),
+                                             candidates};
+    _pTransportRace = pRace;
+    connect(pRace, &TransportRace::finished, this,
+        [this, pRace](const Transport &winner, bool responded)
+        {
+            pRace->deleteLater();
+            // Ignore a race that was abandoned (by disconnecting or starting
+            // over)
+            if(pRace != _pTransportRace ||
+               _connectionStep != ConnectionStep::RacingTransports)
+            {
+                return;
+            }
+            _pTransportRace = nullptr;
+            if(responded)
+                _transportSelector.useRaceWinner(winner);
+            doConnect();
+        });
+    return true;
+}
+
+void VPNConnection::startProxyProbe()
+{
+    ProxyProbe::Endpoint endpoint{};
+    switch(_connectingConfig.proxyType())
+    {
+        default:
+        case ConnectionConfig::ProxyType::None:
+            return;
+        case ConnectionConfig::ProxyType::Custom:
+            endpoint.host = _connectingConfig.socksHost();
+            // Same default as in writeOpenVPNConfig()
+            endpoint.port = _connectingConfig.customProxy().port() ?
+                static_cast<quint16>(_connectingConfig.customProxy().port()) : 1080;
+            break;
+        case ConnectionConfig::ProxyType::Shadowsocks:
+        {
+            // Probe the Shadowsocks server, the local proxy is always reachable
+            QSharedPointer<ShadowsocksServer> pSsServer;
+            if(_connectingConfig.shadowsocksLocation())
+                pSsServer = _connectingConfig.shadowsocksLocation()->shadowsocks();
+            if(!pSsServer)
+                return;
+            endpoint.host = ConnectionConfig::parseIpv4Host(pSsServer->host());
+            endpoint.port = static_cast<quint16>(pSsServer->port());
+            break;
+        }
+    }
+    // An invalid host is reported when OpenVPN is started
+    if(endpoint.host.isNull())
+        return;
 
-void VPNConnection::beginConnection()
-{
-    _connectionStep = ConnectionStep::Initializing;
-    doConnect();
+    if(_pProxyProbe)
+        _pProxyProbe->deleteLater();
+    ProxyProbe *pProbe = new ProxyProbe{{endpoint}};
+    _pProxyProbe = pProbe;
+    connect(pProbe, &ProxyProbe::finished, this,
+        [this, pProbe](const ProxyProbe::Latencies &latencies)
+        {
+            pProbe->deleteLater();
+            // Ignore a probe that was abandoned by disconnecting
+            if(pProbe != _pProxyProbe)
+                return;
+            _pProxyProbe = nullptr;
+            if(!latencies.isEmpty())
+            {
+                qInfo() << "Proxy server responded in"
+                    << traceMsec(latencies.begin().value());
+                return;
+            }
+            // Only report this if we're still trying to connect
+            if(_state == State::Connecting || _state == State::StillConnecting ||
+               _state == State::Reconnecting || _state == State::StillReconnecting)
+            {
+                qWarning() << "Proxy server did not respond within"
+                    << traceMsec(proxyProbeTimeout);
+                emit error({HERE, Error::Code::OpenVPNProxyError});
+            }
+        });
 }
 
 void VPNConnection::doConnect()
@@ -973,6 +1771,8 @@ void VPNConnection::doConnect()
         return;
     }
 
+    TraceSpan span{"daemon", QStringLiteral("VPNConnection::doConnect")};
+
     // Handle pre-connection steps.  Note that these _cannot_ fail with nonfatal
     // errors - we need to apply the failure logic later to set the next request
     // delay and possibly change state.  Nonfatal errors have to be detected
@@ -1021,19 +1821,15 @@ void VPNConnection::doConnect()
     if(_connectionStep == ConnectionStep::FetchingIP)
     {
         _connectionStep = ConnectionStep::StartingProxy;
+        if(_connectionAttemptCount == 0)
+            startProxyProbe();
         if(_connectingConfig.shadowsocksLocation() && _connectingConfig.shadowsocksLocation()->shadowsocks())
         {
-            const auto &pSsServer = _connectingConfig.shadowsocksLocation()->shadowsocks();
-            _shadowsocksRunner.enable(Path::SsLocalExecutable,
-                QStringList{QStringLiteral("-s"), pSsServer->host(),
-                            QStringLiteral("-p"), QString::number(pSsServer->port()),
-                            QStringLiteral("-k"), pSsServer->key(),
-                            QStringLiteral("-b"), QStringLiteral("127.0.0.1"),
-                            QStringLiteral("-l"), QStringLiteral("0"),
-                            QStringLiteral("-m"), pSsServer->cipher()});
+            enableShadowsocks(*_connectingConfig.shadowsocksLocation());
 
             // If we don't already know a listening port, wait for it to tell
-            // us (we could already know if the SS client was already running)
+            // us (we could already know if the SS client was already running,
+            // including if it was prestarted for this location)
             if(_shadowsocksRunner.localPort() == 0)
             {
                 qInfo() << "Wait for local proxy port to be assigned";
@@ -1049,11 +1845,9 @@ void VPNConnection::doConnect()
             _shadowsocksRunner.disable();
     }
 
-    // We either finished starting a proxy or we skipped it.  We're ready to connect
-    Q_ASSERT(_connectionStep == ConnectionStep::StartingProxy);
-    _connectionStep = ConnectionStep::ConnectingOpenVPN;
-
-    if (_connectionAttemptCount == 0)
+    // We either finished starting a proxy or we skipped it.  For the first
+    // attempt, reset the transport selection.
+    if (_connectionStep == ConnectionStep::StartingProxy && _connectionAttemptCount == 0)
     {
         // We shouldn't have any problems json_cast()ing these values since they
         // came from DaemonSettings; just use defaults if it does happen
@@ -1095,13 +1889,33 @@ void VPNConnection::doConnect()
         // Reset the transport selection sequence
         _transportSelector.reset({protocol, selectedPort}, automaticTransport,
                                  *_connectingConfig.vpnLocation(),
-                                 g_data.udpPorts(), g_data.tcpPorts());
+                                 g_data.udpPorts(), g_data.tcpPorts(),
+                                 g_data.networkTransports(),
+                                 g_settings.cipher() == QStringLiteral("auto") ?
+                                    g_data.networkThroughputs() :
+                                    DaemonData::NetworkThroughputMap{});
+    }
+
+    // Race the transports before the first attempt if alternates are enabled
+    if(_connectionStep == ConnectionStep::StartingProxy)
+    {
+        _connectionStep = ConnectionStep::RacingTransports;
+        // Don't race when failing over, the transport that worked on this
+        // network is already first (from the remembered network transports).
+        bool failingOver = std::exchange(_failingOver, false);
+        if(_connectionAttemptCount == 0 && !failingOver && startTransportRace())
+            return;
     }
 
+    // We're ready to connect
+    Q_ASSERT(_connectionStep == ConnectionStep::RacingTransports);
+    _connectionStep = ConnectionStep::ConnectingOpenVPN;
+
     // Reset traffic counters since we have a new process
     _lastReceivedByteCount = 0;
     _lastSentByteCount = 0;
-    _intervalMeasurements.clear();
+    _intervalCount = 0;
+    _peakThroughput = 0.0;
     emit byteCountsChanged();
 
     // Reset any running connect timer, just in case
@@ -1146,6 +1960,7 @@ void VPNConnection::doConnect()
         _timeUntilNextConnectionAttempt.setRemainingTime(0);
 
     ++_connectionAttemptCount;
+    Metrics::increment(QStringLiteral("pia_vpn_connection_attempts"));
 
     if (_state == State::Connecting && _connectionAttemptCount > SlowConnectionAttemptLimit)
         setState(State::StillConnecting);
@@ -1203,13 +2018,26 @@ void VPNConnection::doConnect()
         }
 #endif
 
-        // Pass DNS server addresses
+        // Pass DNS server addresses.  If the DNS cache is enabled, the OS uses
+        // it instead; it forwards to the real servers once connected.
         QStringList dnsServers = getDNSServers(_dnsServers);
+        _dnsCacheActive = !dnsServers.isEmpty() && !isDNSHandshake(_dnsServers) &&
+            _connectionSettings.value(QLatin1String("dnsCache")).toBool() &&
+            _dnsCache.listen();
+        if(_dnsCacheActive)
+            dnsServers = QStringList{dnsCacheLocalAddress};
+#ifdef Q_OS_LINUX
+        // On Linux, the daemon applies DNS itself once the tunnel device is
+        // up (see checkForMagicStrings()); the updown script only reports the
+        // device.
+        _tunnelDnsServers = dnsServers;
+#else
         if(!dnsServers.isEmpty())
         {
             updownCmd += " --dns ";
             updownCmd += dnsServers.join(':');
         }
+#endif
 
         // Terminate PIA args with '--' (OpenVPN passes several subsequent
         // arguments)
@@ -1218,7 +2046,15 @@ void VPNConnection::doConnect()
         qInfo() << "updownCmd is: " << updownCmd;
 
 #ifdef Q_OS_WIN
-        if(g_settings.windowsIpMethod() == QStringLiteral("static"))
+        // Use the WinTUN driver if we found a WinTUN adapter
+        bool useWintun = _networkAdapter && _networkAdapter->usesWintun();
+        if(useWintun)
+        {
+            arguments += "--windows-driver";
+            arguments += "wintun";
+        }
+        // WinTUN has no DHCP server, it always uses the static method
+        if(useWintun || g_settings.windowsIpMethod() == QStringLiteral("static"))
         {
             // Static configuration on Windows - use OpenVPN's netsh method, use
             // updown script to apply DNS with netsh
@@ -1242,7 +2078,8 @@ void VPNConnection::doConnect()
             }
         }
 #else
-        // Mac and Linux - always use updown script for DNS
+        // Mac and Linux - always use updown script (for DNS on Mac, and to
+        // report the tunnel device on both)
         // Use the same script for --up and --down
         arguments += "--up";
         arguments += updownCmd;
@@ -1250,15 +2087,43 @@ void VPNConnection::doConnect()
         arguments += updownCmd;
 #endif
 
+#ifdef Q_OS_LINUX
+        if(_networkAdapter && _networkAdapter->usesDco())
+            qInfo() << "Using data channel offload";
+        else if(_networkAdapter && _networkAdapter->dcoSupported())
+            arguments += QStringLiteral("--disable-dco");
+#endif
+
         arguments += QStringLiteral("--config");
 
-        QFile configFile(Path::OpenVPNConfigFile);
-        if (!configFile.open(QIODevice::WriteOnly | QIODevice::Text) ||
-            !writeOpenVPNConfig(configFile))
+        // Generate the config in memory first; it's kept to decide whether a
+        // later reconnect can reuse this OpenVPN process.
+        QByteArray config;
+        QBuffer configBuffer{&config};
+        if (!configBuffer.open(QIODevice::WriteOnly) ||
+            !writeOpenVPNConfig(configBuffer))
         {
             throw Error(HERE, Error::OpenVPNConfigFileWriteError);
         }
-        configFile.close();
+        configBuffer.close();
+
+        // Retries in the failure ladder often produce the same config (same
+        // host and transport); don't rewrite the file if it already has this
+        // content.
+        if(config != _writtenConfig ||
+           QFileInfo{Path::OpenVPNConfigFile}.size() != config.size())
+        {
+            QFile configFile(Path::OpenVPNConfigFile);
+            if (!configFile.open(QIODevice::WriteOnly | QIODevice::Text) ||
+                configFile.write(config) != config.size())
+            {
+                _writtenConfig.clear();
+                throw Error(HERE, Error::OpenVPNConfigFileWriteError);
+            }
+            configFile.close();
+            _writtenConfig = config;
+        }
+        _runningConfig = std::move(config);
 
         arguments += Path::OpenVPNConfigFile;
     }
@@ -1284,78 +2149,75 @@ void VPNConnection::doConnect()
     _openvpn = new OpenVPNProcess(this);
 
     // TODO: this can be hooked up to support in-process up/down script handling via scripts that print magic strings
-    connect(_openvpn, &OpenVPNProcess::stdoutLine, this, &VPNConnection::openvpnStdoutLine);
-    connect(_openvpn, &OpenVPNProcess::stderrLine, this, &VPNConnection::openvpnStderrLine);
+    connect(_openvpn, &OpenVPNProcess::outputEvent, this, &VPNConnection::openvpnOutputEvent);
     connect(_openvpn, &OpenVPNProcess::managementLine, this, &VPNConnection::openvpnManagementLine);
+    connect(_openvpn, &OpenVPNProcess::byteCount, this, &VPNConnection::updateByteCounts);
     connect(_openvpn, &OpenVPNProcess::stateChanged, this, &VPNConnection::openvpnStateChanged);
     connect(_openvpn, &OpenVPNProcess::exited, this, &VPNConnection::openvpnExited);
     connect(_openvpn, &OpenVPNProcess::error, this, &VPNConnection::openvpnError);
 
+    _openvpn->setByteCountInterval(byteCountIntervalScale() * g_settings.bandwidthSampleInterval());
+
+    // Time the phases of this attempt from when OpenVPN is started
+    _attemptPhaseTimes.fill(0);
+    _currentPhase = OpenVPNProcess::Connecting;
+    _phaseTimer.start();
+
     _openvpn->run(arguments);
 }
 
-void VPNConnection::openvpnStdoutLine(const QString& line)
+void VPNConnection::openvpnOutputEvent(OpenVPNProcess::OutputStream stream,
+                                       const OpenVPNProcess::OutputMatch &match)
 {
-    FUNCTION_LOGGING_CATEGORY("openvpn.stdout");
-    qDebug().noquote() << line;
-
-    checkStdoutErrors(line);
+    // The lines were already logged by OpenVPNProcess
+    if(stream == OpenVPNProcess::OutputStream::Stdout)
+        checkStdoutErrors(match);
+    else
+        checkForMagicStrings(match);
 }
 
-void VPNConnection::checkStdoutErrors(const QString &line)
+void VPNConnection::checkStdoutErrors(const OpenVPNProcess::OutputMatch &match)
 {
     // Check for specific errors that we can detect from OpenVPN's output.
-
-    if(line.contains("socks_username_password_auth: server refused the authentication"))
-    {
-        raiseError({HERE, Error::Code::OpenVPNProxyAuthenticationError});
-        return;
-    }
-
-    // This error can be logged by socks_handshake and recv_socks_reply, others
-    // might be possible too.
-    if(line.contains(QRegExp("socks.*: TCP port read failed")))
-    {
-        raiseError({HERE, Error::Code::OpenVPNProxyError});
-        return;
-    }
-
-    // This error occurs if OpenVPN fails to open a TCP connection.  If it's
-    // reported for the SOCKS proxy, report it as a proxy error, otherwise let
-    // it be handled as a general failure.
-    QRegExp tcpFailRegex{R"(TCP: connect to \[AF_INET\]([\d\.]+):\d+ failed:)"};
-    if(line.contains(tcpFailRegex))
+    switch(match.event)
     {
-        QHostAddress failedHost;
-        if(failedHost.setAddress(tcpFailRegex.cap(1)) &&
-            failedHost == _connectingConfig.socksHost())
-        {
+        case OpenVPNProcess::OutputEvent::ProxyAuthFailed:
+            raiseError({HERE, Error::Code::OpenVPNProxyAuthenticationError});
+            break;
+        case OpenVPNProcess::OutputEvent::ProxyReadFailed:
             raiseError({HERE, Error::Code::OpenVPNProxyError});
-            return;
+            break;
+        case OpenVPNProcess::OutputEvent::TcpConnectFailed:
+        {
+            // This error occurs if OpenVPN fails to open a TCP connection.  If
+            // it's reported for the SOCKS proxy, report it as a proxy error,
+            // otherwise let it be handled as a general failure.
+            QHostAddress failedHost;
+            if(failedHost.setAddress(match.captures.value(0)) &&
+                failedHost == _connectingConfig.socksHost())
+            {
+                raiseError({HERE, Error::Code::OpenVPNProxyError});
+            }
+            break;
         }
+        default:
+            break;
     }
 }
 
-void VPNConnection::openvpnStderrLine(const QString& line)
-{
-    FUNCTION_LOGGING_CATEGORY("openvpn.stderr");
-    qDebug().noquote() << line;
-
-    checkForMagicStrings(line);
-}
-
-void VPNConnection::checkForMagicStrings(const QString& line)
+void VPNConnection::checkForMagicStrings(const OpenVPNProcess::OutputMatch &match)
 {
-    QRegExp tunDeviceNameRegex{R"(Using device:([^ ]+) local_address:([^ ]+) remote_address:([^ ]+))"};
-    if(line.contains(tunDeviceNameRegex))
+    switch(match.event)
     {
-        emit usingTunnelDevice(tunDeviceNameRegex.cap(1), tunDeviceNameRegex.cap(2), tunDeviceNameRegex.cap(3));
-    }
-
-    // TODO: extract this out into a more general error mechanism, where the "!!!" prefix
-    // indicates an error condition followed by the code.
-    if (line.startsWith("!!!updown.sh!!!dnsConfigFailure")) {
-        raiseError(Error(HERE, Error::OpenVPNDNSConfigError));
+        case OpenVPNProcess::OutputEvent::UsingDevice:
+            emit usingTunnelDevice(match.captures.value(0), match.captures.value(1),
+                                   match.captures.value(2));
+#ifdef Q_OS_LINUX
+            applyTunnelDns(match.captures.value(0));
+#endif
+            break;
+        default:
+            break;
     }
 }
 
@@ -1418,19 +2280,6 @@ void VPNConnection::openvpnManagementLine(const QString& line)
             // All unhandled cases
             raiseError(Error(HERE, Error::OpenVPNAuthenticationError));
         }
-        else if (line.startsWith(QLatin1String(">BYTECOUNT:")))
-        {
-            auto params = line.midRef(11).split(',');
-            if (params.size() >= 2)
-            {
-                bool ok = false;
-                quint64 up, down;
-                if (((down = params[0].toULongLong(&ok)), ok) && ((up = params[1].toULongLong(&ok)), ok))
-                {
-                    updateByteCounts(down, up);
-                }
-            }
-        }
     }
 }
 
@@ -1439,6 +2288,8 @@ void VPNConnection::openvpnStateChanged()
     OpenVPNProcess::State openvpnState = _openvpn ? _openvpn->state() : OpenVPNProcess::Exited;
     State newState = _state;
 
+    recordConnectionPhase(openvpnState);
+
     switch (openvpnState)
     {
     case OpenVPNProcess::AssignIP:
@@ -1478,6 +2329,13 @@ void VPNConnection::openvpnStateChanged()
             _connectedConfig = std::move(_connectingConfig);
             _connectingConfig = {};
 
+            rememberNetworkTransport();
+
+            // Routes are up, so start activating MACE right away; the Connected
+            // state waits for it.
+            if(g_settings.enableMACE())
+                activateMace();
+
             // Do a new network scan now that we've connected.  If split tunnel
             // is enabled (now or later while connected), this is necessary to
             // ensure that we have the correct local IP address.  If the network
@@ -1486,28 +2344,27 @@ void VPNConnection::openvpnStateChanged()
             // the OpenVPN connection and re-scan when we connect again.
             scanNetwork(_connectedConfig.vpnLocation().get(), _transportSelector.lastUsed().protocol());
 
-            // If DNS is set to Handshake, start it now, since we've connected
-            if(isDNSHandshake(_dnsServers))
+            startMtuProbe();
+
+            // Forward DNS cache misses through the tunnel
+            if(_dnsCacheActive)
             {
-                auto hnsdArgs = hnsdFixedArgs;
-                // Tell hnsd to use the VPN interface for outgoing DNS queries.
-                //
-                // This matters when defaultRoute is off - split tunnel has
-                // issues with UDP that are being addressed separately, so for
-                // now hnsd is patched to handle this.  (We still need to treat
-                // hnsd as a VPN-only app to handle its TCP connections to
-                // Handshake nodes.)
-                //
-                // Also provide 127.0.0.1 as an outgoing interface since the
-                // authoritative root server (part of hnsd itself) is on
-                // localhost - this relies on patches applied to libunbound to
-                // use loopback interfaces for loopback queries only.
-                hnsdArgs.push_back(QStringLiteral("--outgoing-dns-if"));
-                hnsdArgs.push_back(QStringLiteral("127.0.0.1,") + g_state.tunnelDeviceLocalAddress());
-                _hnsdRunner.enable(Path::HnsdExecutable, hnsdArgs);
+                _dnsCache.setUpstream(QHostAddress{g_state.tunnelDeviceLocalAddress()},
+                                      g_state.tunnelDeviceName(),
+                                      getDNSServers(_dnsServers));
             }
 
-            newState = State::Connected;
+            // If DNS is set to Handshake (or hnsd is syncing in the
+            // background), start it now, since we've connected.  (If it was
+            // kept running through a reconnect, this just restarts it if the
+            // tunnel address changed.)
+            if(isDNSHandshake(_dnsServers) || _hnsdBackgroundSync)
+                enableHnsd();
+            else
+                _hnsdRunner.disable();
+
+            if(!_pMaceActivation)
+                newState = State::Connected;
             break;
         case State::Disconnecting:
         case State::Disconnected:
@@ -1523,6 +2380,17 @@ void VPNConnection::openvpnStateChanged()
         break;
 
     case OpenVPNProcess::Reconnecting:
+        // If we asked OpenVPN to restart, let it reconnect.  Time the phases of
+        // the restarted connection like a new attempt.
+        if(std::exchange(_warmRestartPending, false) &&
+           _state == State::Reconnecting)
+        {
+            qInfo() << "OpenVPN is restarting the connection";
+            _attemptPhaseTimes.fill(0);
+            _currentPhase = OpenVPNProcess::Connecting;
+            _phaseTimer.start();
+            break;
+        }
         // In some rare cases OpenVPN reconnects on its own (e.g. TAP adapter I/O failure),
         // but we don't want it to try to reconnect on its own; send a SIGTERM instead.
         qWarning() << "OpenVPN trying to reconnect internally, sending SIGTERM";
@@ -1533,8 +2401,10 @@ void VPNConnection::openvpnStateChanged()
     case OpenVPNProcess::Exiting:
         if (_state == State::Connected)
         {
-            // Reconnect to the same location again
+            // Reconnect to the same location again, or fail over to the
+            // standby location
             _connectingConfig = _connectedConfig;
+            failOverToStandby();
             newState = State::Interrupted;
             queueConnectionAttempt();
         }
@@ -1544,8 +2414,10 @@ void VPNConnection::openvpnStateChanged()
         switch (_state)
         {
         case State::Connected:
-            // Reconnect to the same location again
+            // Reconnect to the same location again, or fail over to the
+            // standby location
             _connectingConfig = _connectedConfig;
+            failOverToStandby();
             newState = State::Interrupted;
             queueConnectionAttempt();
             break;
@@ -1584,8 +2456,79 @@ void VPNConnection::openvpnStateChanged()
     setState(newState);
 }
 
+void VPNConnection::recordConnectionPhase(OpenVPNProcess::State newState)
+{
+    if(!_phaseTimer.isValid() || newState == _currentPhase ||
+       newState < OpenVPNProcess::Connecting)
+    {
+        return;
+    }
+
+    _attemptPhaseTimes[_currentPhase - OpenVPNProcess::Connecting] += _phaseTimer.restart();
+    _currentPhase = newState;
+
+    // Keep timing until OpenVPN connects (or the attempt fails)
+    if(newState < OpenVPNProcess::Connected)
+        return;
+
+    _phaseTimer.invalidate();
+    if(newState != OpenVPNProcess::Connected)
+        return;
+
+    _recentPhaseTimes.push_back(_attemptPhaseTimes);
+    if(_recentPhaseTimes.size() > maxRecentConnectionPhases)
+        _recentPhaseTimes.pop_front();
+
+    QVector<ConnectionPhase> phases;
+    phases.reserve(ConnectionPhaseCount);
+    QStringList trace;
+    for(int i=0; i<ConnectionPhaseCount; ++i)
+    {
+        QVector<uint> histogram(ConnectionPhase::histogramBounds.size() + 1);
+        for(const auto &times : _recentPhaseTimes)
+        {
+            auto itBucket = std::lower_bound(ConnectionPhase::histogramBounds.begin(),
+                                             ConnectionPhase::histogramBounds.end(),
+                                             static_cast<quint64>(times[i]));
+            ++histogram[itBucket - ConnectionPhase::histogramBounds.begin()];
+        }
+        QString phaseName{qEnumToString(static_cast<OpenVPNProcess::State>(OpenVPNProcess::Connecting + i))};
+        trace.push_back(phaseName + QStringLiteral(": ") + traceMsec(_attemptPhaseTimes[i]));
+        phases.push_back({phaseName, static_cast<quint64>(_attemptPhaseTimes[i]),
+                          histogram});
+    }
+
+    qInfo() << "Connection phase times -" << trace.join(QStringLiteral(", "));
+    emit connectionPhasesChanged(phases);
+}
+
+#ifdef Q_OS_LINUX
+void VPNConnection::applyTunnelDns(const QString &tunnelDevice)
+{
+    // Restore the prior configuration first if the device changed without
+    // OpenVPN exiting
+    if(!_dnsTunnelDevice.isEmpty() && _dnsTunnelDevice != tunnelDevice)
+        LinuxDns::restoreDns(_dnsTunnelDevice);
+    _dnsTunnelDevice.clear();
+
+    if(_tunnelDnsServers.isEmpty())
+        return; // Using the existing DNS configuration
+
+    _dnsTunnelDevice = tunnelDevice;
+    if(!LinuxDns::applyDns(tunnelDevice, _tunnelDnsServers))
+        raiseError(Error(HERE, Error::OpenVPNDNSConfigError));
+}
+#endif
+
 void VPNConnection::openvpnExited(int exitCode)
 {
+#ifdef Q_OS_LINUX
+    // The tunnel device is gone, restore the DNS configuration (this is what
+    // the updown script used to do for --down).  This is done even if we
+    // didn't apply DNS, so a resolv.conf backup left by a crash is restored.
+    LinuxDns::restoreDns(_dnsTunnelDevice);
+    _dnsTunnelDevice.clear();
+#endif
     if (_networkAdapter)
     {
         // Ensure we return our tunnel metric to how it was before we lowered it.
@@ -1633,6 +2576,84 @@ void VPNConnection::raiseError(const Error& err)
     emit error(err);
 }
 
+bool VPNConnection::enableShadowsocks(const ServerLocation &location)
+{
+    const auto &pSsServer = location.shadowsocks();
+    Q_ASSERT(pSsServer);    // Checked by callers
+    return _shadowsocksRunner.enable(Path::SsLocalExecutable,
+        QStringList{QStringLiteral("-s"), pSsServer->host(),
+                    QStringLiteral("-p"), QString::number(pSsServer->port()),
+                    QStringLiteral("-k"), pSsServer->key(),
+                    QStringLiteral("-b"), QStringLiteral("127.0.0.1"),
+                    QStringLiteral("-l"), QStringLiteral("0"),
+                    QStringLiteral("-m"), pSsServer->cipher()});
+}
+
+void VPNConnection::prestartShadowsocks(const QSharedPointer<ServerLocation> &pLocation)
+{
+    if(pLocation && !pLocation->shadowsocks())
+        _pPrestartShadowsocksLocation.reset();
+    else
+        _pPrestartShadowsocksLocation = pLocation;
+
+    // Apply it now if we're disconnected; otherwise it's applied when the
+    // connection ends
+    if(_state == State::Disconnected)
+        applyPrestartShadowsocks();
+}
+
+void VPNConnection::setHnsdBackgroundSync(bool enable)
+{
+    _hnsdBackgroundSync = enable;
+    // If the current connection uses Handshake, hnsd is needed regardless.
+    // Otherwise, start or stop it now if we're connected; if not it's applied
+    // when we connect.
+    if(_state == State::Connected && !isDNSHandshake(_dnsServers))
+    {
+        if(enable)
+        {
+            qInfo() << "Syncing hnsd in the background";
+            enableHnsd();
+        }
+        else
+            _hnsdRunner.disable();
+    }
+}
+
+void VPNConnection::enableHnsd()
+{
+    auto hnsdArgs = hnsdFixedArgs;
+    // Tell hnsd to use the VPN interface for outgoing DNS queries.
+    //
+    // This matters when defaultRoute is off - split tunnel has
+    // issues with UDP that are being addressed separately, so for
+    // now hnsd is patched to handle this.  (We still need to treat
+    // hnsd as a VPN-only app to handle its TCP connections to
+    // Handshake nodes.)
+    //
+    // Also provide 127.0.0.1 as an outgoing interface since the
+    // authoritative root server (part of hnsd itself) is on
+    // localhost - this relies on patches applied to libunbound to
+    // use loopback interfaces for loopback queries only.
+    hnsdArgs.push_back(QStringLiteral("--outgoing-dns-if"));
+    hnsdArgs.push_back(QStringLiteral("127.0.0.1,") + g_state.tunnelDeviceLocalAddress());
+    _hnsdRunner.enable(Path::HnsdExecutable, hnsdArgs);
+}
+
+void VPNConnection::applyPrestartShadowsocks()
+{
+    if(_pPrestartShadowsocksLocation)
+    {
+        if(enableShadowsocks(*_pPrestartShadowsocksLocation))
+        {
+            qInfo() << "Prestarted Shadowsocks for"
+                << _pPrestartShadowsocksLocation->id();
+        }
+    }
+    else
+        _shadowsocksRunner.disable();
+}
+
 void VPNConnection::setState(State state)
 {
     if (state != _state)
@@ -1640,11 +2661,16 @@ void VPNConnection::setState(State state)
         if(state == State::Disconnected)
         {
             // We have completely disconnected, drop the measurement intervals.
-            _intervalMeasurements.clear();
+            _intervalCount = 0;
             emit byteCountsChanged();
 
-            // Stop shadowsocks if it was running.
-            _shadowsocksRunner.disable();
+            // Stop shadowsocks if it was running, unless it's being kept
+            // running for the next connection.
+            applyPrestartShadowsocks();
+
+            // The OS's DNS configuration has been restored, stop the cache
+            _dnsCache.stop();
+            _dnsCacheActive = false;
         }
 
         // Several members are only valid in the [Still]Connecting and
@@ -1656,13 +2682,79 @@ void VPNConnection::setState(State state)
             _connectionStep = ConnectionStep::Initializing;
             _connectionAttemptCount = 0;
             _connectTimer.stop();
+            _pMaceActivation.abandon();
         }
 
-        // In any state other than Connected, stop hnsd, even if that's our
-        // current DNS setting.  (If we're reconnecting while Handshake is
-        // selected, it'll be restarted after we connect.)
-        if(state != State::Connected)
+        // When disconnecting, stop hnsd, even if that's our current DNS
+        // setting.  It's kept running through a reconnect though - it can't
+        // reach any peers until the tunnel is back up, but it keeps its synced
+        // chain, which would take minutes to sync again.  The next connection
+        // decides whether it's still needed.
+        if(state == State::Disconnecting || state == State::Disconnected)
             _hnsdRunner.disable();
+        if(state != State::Connected)
+        {
+            // The DNS cache keeps answering from the cache, but can't forward
+            // until we're connected again
+            _dnsCache.clearUpstream();
+        }
+
+        // Trace connection attempts - from entering any of the
+        // [Still]Connecting or [Still]Reconnecting states until leaving them
+        auto isAttemptState = [](State s)
+        {
+            return s == State::Connecting || s == State::StillConnecting ||
+                s == State::Reconnecting || s == State::StillReconnecting;
+        };
+        if(isAttemptState(state) && !isAttemptState(_state))
+            Tracer::asyncBegin("daemon", QStringLiteral("VPN connection attempt"), 0);
+        else if(!isAttemptState(state) && isAttemptState(_state))
+            Tracer::asyncEnd("daemon", QStringLiteral("VPN connection attempt"), 0);
+        Tracer::instant("daemon", QStringLiteral("VPN state: %1").arg(qEnumToString(state)));
+        Metrics::increment(QStringLiteral("pia_vpn_state_changes"),
+                           {{QStringLiteral("state"), qEnumToString(state)}});
+        if(state == State::Reconnecting && _state != State::Reconnecting &&
+           _state != State::StillReconnecting)
+        {
+            Metrics::increment(QStringLiteral("pia_vpn_reconnects"));
+        }
+
+        if(_state == State::Connected)
+        {
+            rememberTransportThroughput();
+
+            // End the history session.  Losing the connection goes to
+            // Interrupted (or directly to Reconnecting in some cases).
+            ConnectionHistory::EndReason reason;
+            switch(state)
+            {
+            case State::Interrupted:
+            case State::Reconnecting:
+            case State::StillReconnecting:
+                reason = ConnectionHistory::EndReason::ConnectionLost;
+                break;
+            case State::DisconnectingToReconnect:
+                reason = ConnectionHistory::EndReason::Reconnected;
+                break;
+            case State::Disconnecting:
+            case State::Disconnected:
+                reason = ConnectionHistory::EndReason::Disconnected;
+                break;
+            default:
+                reason = ConnectionHistory::EndReason::Unknown;
+                break;
+            }
+            _connectionHistory.endSession(reason);
+        }
+
+#ifdef Q_OS_UNIX
+        // An MTU probe is only meaningful while connected
+        if(_state == State::Connected && _pMtuProbe)
+        {
+            _pMtuProbe->deleteLater();
+            _pMtuProbe = nullptr;
+        }
+#endif
 
         _state = state;
 
@@ -1716,6 +2808,17 @@ void VPNConnection::setState(State state)
                 actualTransport->resolvePort(*_connectedConfig.vpnLocation());
         }
 
+        // Begin a history session when we connect; the phase times are still
+        // those of the attempt that connected
+        if(_state == State::Connected && actualTransport)
+        {
+            _connectionHistory.beginSession(_connectedConfig.vpnLocation()->id(),
+                                            actualTransport->protocol(),
+                                            static_cast<quint16>(actualTransport->port()),
+                                            _attemptPhaseTimes,
+                                            _receivedByteCount, _sentByteCount);
+        }
+
         emit stateChanged(_state, _connectingConfig, _connectedConfig,
                           preferredTransport, actualTransport);
     }
@@ -1723,6 +2826,12 @@ void VPNConnection::setState(State state)
 
 void VPNConnection::updateByteCounts(quint64 received, quint64 sent)
 {
+    // The counts can restart from 0 if OpenVPN was restarted in place
+    if(received < _lastReceivedByteCount || sent < _lastSentByteCount)
+    {
+        _lastReceivedByteCount = 0;
+        _lastSentByteCount = 0;
+    }
     quint64 intervalReceived = received - _lastReceivedByteCount;
     quint64 intervalSent = sent - _lastSentByteCount;
     _lastReceivedByteCount = received;
@@ -1732,17 +2841,90 @@ void VPNConnection::updateByteCounts(quint64 received, quint64 sent)
     _receivedByteCount += intervalReceived;
     _sentByteCount += intervalSent;
 
-    // If we've reached the maximum number of measurements, discard one before
-    // adding a new one
-    if(_intervalMeasurements.size() == g_maxMeasurementIntervals)
-        _intervalMeasurements.takeFirst();
-    _intervalMeasurements.push_back({intervalReceived, intervalSent});
+    // At a reduced rate, this report covers several sample intervals
+    const uint scale = byteCountIntervalScale();
+    if(_state == State::Connected && g_settings.bandwidthSampleInterval() > 0)
+    {
+        double throughput = static_cast<double>(intervalReceived + intervalSent) /
+            (scale * g_settings.bandwidthSampleInterval());
+        _peakThroughput = std::max(_peakThroughput, throughput);
+    }
+
+    if(_state == State::Connected)
+    {
+        _connectionHistory.updateSession(_receivedByteCount, _sentByteCount,
+                                         _peakThroughput);
+    }
+
+    // Spread the traffic evenly over the intervals covered by this report;
+    // any remainder goes in the last one
+    for(uint i = 0; i < scale; ++i)
+    {
+        ByteCountSample sample{intervalReceived / scale, intervalSent / scale};
+        if(i + 1 == scale)
+        {
+            sample.received += intervalReceived % scale;
+            sample.sent += intervalSent % scale;
+        }
+
+        // If we've reached the maximum number of measurements, the new one
+        // replaces the oldest
+        if(_intervalCount == _intervalMeasurements.size())
+        {
+            _intervalMeasurements[_intervalStart] = sample;
+            _intervalStart = (_intervalStart + 1) % _intervalMeasurements.size();
+        }
+        else
+        {
+            auto end = (_intervalStart + _intervalCount) % _intervalMeasurements.size();
+            _intervalMeasurements[end] = sample;
+            ++_intervalCount;
+        }
+    }
 
     // The interval measurements always change even if the perpetual totals do
     // not (we added a 0,0 entry).
     emit byteCountsChanged();
 }
 
+QList<IntervalBandwidth> VPNConnection::intervalMeasurements() const
+{
+    QList<IntervalBandwidth> measurements;
+    measurements.reserve(static_cast<int>(_intervalCount));
+    for(std::size_t i=0; i<_intervalCount; ++i)
+    {
+        const auto &sample = _intervalMeasurements[(_intervalStart + i) % _intervalMeasurements.size()];
+        measurements.push_back({sample.received, sample.sent});
+    }
+    return measurements;
+}
+
+void VPNConnection::updateByteCountInterval()
+{
+    _intervalCount = 0;
+    emit byteCountsChanged();
+    if(_openvpn)
+        _openvpn->setByteCountInterval(byteCountIntervalScale() * g_settings.bandwidthSampleInterval());
+}
+
+void VPNConnection::setReducedByteCountRate(bool reduced)
+{
+    if(reduced == _reducedByteCountRate)
+        return;
+
+    qInfo() << (reduced ? "Reducing" : "Restoring") << "byte count rate";
+    _reducedByteCountRate = reduced;
+    // The interval measurements are kept; reports at the reduced rate are
+    // split into samples at the configured interval
+    if(_openvpn)
+        _openvpn->setByteCountInterval(byteCountIntervalScale() * g_settings.bandwidthSampleInterval());
+}
+
+uint VPNConnection::byteCountIntervalScale() const
+{
+    return _reducedByteCountRate ? reducedByteCountScale : 1;
+}
+
 void VPNConnection::scheduleNextConnectionAttempt()
 {
     quint64 remaining = _timeUntilNextConnectionAttempt.remainingTime();
@@ -1779,12 +2961,14 @@ bool VPNConnection::copySettings(State successState, State failureState)
     QString password = g_account.openvpnPassword();
     DaemonSettings::DNSSetting dnsServers = g_settings.overrideDNS();
     ConnectionConfig newConfig{g_settings, g_state};
+    newConfig.failOver(_pFailoverLocation);
 
     bool changed = _connectionSettings != settings ||
         _openvpnUsername != username || _openvpnPassword != password ||
         dnsServers != _dnsServers || newConfig.hasChanged(_connectingConfig);
 
     _connectionSettings.swap(settings);
+    _checkedSettingsVersion = _settingsVersion;
     _openvpnUsername.swap(username);
     _openvpnPassword.swap(password);
     _dnsServers = std::move(dnsServers);
@@ -1818,9 +3002,107 @@ bool VPNConnection::copySettings(State successState, State failureState)
     return true;
 }
 
-bool VPNConnection::writeOpenVPNConfig(QFile& outFile)
+bool VPNConnection::warmRestart()
+{
+    Q_ASSERT(_openvpn);
+    Q_ASSERT(_connectingConfig.vpnLocation());
+
+    if(_runningConfig.isEmpty() || _openvpn->state() != OpenVPNProcess::Connected)
+        return false;
+
+    QByteArray config;
+    QBuffer configBuffer{&config};
+    try
+    {
+        if(!configBuffer.open(QIODevice::WriteOnly) ||
+           !writeOpenVPNConfig(configBuffer))
+        {
+            return false;
+        }
+    }
+    catch(const Error &ex)
+    {
+        qInfo() << "Can't restart OpenVPN in place:" << ex;
+        return false;
+    }
+
+    // The 'remote' line can be overridden through the management interface
+    // (the host can change for the same region when the server list is
+    // updated).  Anything else requires a new OpenVPN process - in particular,
+    // a region change would change verify-x509-name.
+    const QByteArray remotePrefix{"remote "};
+    auto splitConfig = [&](const QByteArray &text, QByteArray &remote)
+    {
+        QList<QByteArray> lines = text.split('\n');
+        auto itRemote = std::find_if(lines.begin(), lines.end(),
+            [&](const QByteArray &line){return line.startsWith(remotePrefix);});
+        if(itRemote != lines.end())
+        {
+            remote = itRemote->mid(remotePrefix.size());
+            lines.erase(itRemote);
+        }
+        return lines;
+    };
+    QByteArray runningRemote, newRemote;
+    if(splitConfig(_runningConfig, runningRemote) != splitConfig(config, newRemote))
+        return false;
+
+    // The remote line is "remote <host> <port>"
+    QList<QByteArray> remoteParts = newRemote.split(' ');
+    if(remoteParts.size() != 2)
+        return false;
+    bool portOk{false};
+    uint port = remoteParts[1].toUInt(&portOk);
+    if(!portOk)
+        return false;
+
+    qInfo() << "Restarting OpenVPN in place to reconnect to"
+        << remoteParts[0] << port;
+    // Go to Reconnecting now; OpenVPN's own Reconnecting state will follow.
+    // If the restart fails, OpenVPN exits (ping-exit/tls-exit) and we retry
+    // with a new process as usual.
+    setState(State::Reconnecting);
+    _warmRestartPending = true;
+    _openvpn->warmRestart(QString::fromLatin1(remoteParts[0]), port);
+    _runningConfig = std::move(config);
+    return true;
+}
+
+void VPNConnection::failOverToStandby()
+{
+    // Don't fail over if the network was lost - the server isn't at fault,
+    // and the standby location wouldn't be reachable either.
+    if(!g_settings.standbyFailover() || !_connectedConfig.vpnLocationAuto() ||
+       _networkLost || !_lastNetworkScan.isValid())
+    {
+        return;
+    }
+
+    Q_ASSERT(_connectedConfig.vpnLocation()); // Valid in Connected state
+    const QString &lostId = _connectedConfig.vpnLocation()->id();
+    const auto &locations = g_state.vpnLocations();
+    // If we had already failed over to the standby location, go back to the
+    // next location.
+    QSharedPointer<ServerLocation> pStandby = locations.standbyLocation();
+    if(pStandby && pStandby->id() == lostId)
+        pStandby = locations.nextLocation();
+    if(!pStandby || pStandby->id() == lostId)
+        return;
+
+    qInfo() << "Connection to" << lostId << "lost, failing over to"
+        << pStandby->id();
+    // Failing over to the next location is the same as not overriding it
+    if(locations.nextLocation() && pStandby->id() == locations.nextLocation()->id())
+        _pFailoverLocation.reset();
+    else
+        _pFailoverLocation.reset(new ServerLocation{*pStandby});
+    _failingOver = true;
+    ++_configVersion;
+}
+
+bool VPNConnection::writeOpenVPNConfig(QIODevice& outDevice)
 {
-    QTextStream out{&outFile};
+    QTextStream out{&outDevice};
     const char endl = '\n';
 
     auto sanitize = [](const QString& s) {
@@ -1892,6 +3174,11 @@ bool VPNConnection::writeOpenVPNConfig(QFile& outFile)
     out << "ping 5" << endl;
     out << "ping-exit 25" << endl;
 
+    // Each connection attempt is a new OpenVPN process (ping-exit/tls-exit),
+    // so there's nothing to resume on reconnect - OpenVPN can't resume a TLS
+    // session or reuse pushed options from a prior process.  The time spent
+    // in each phase (including AUTH and GET_CONFIG) is reported in
+    // connectionPhases.
     out << "persist-remote-ip" << endl;
     out << "resolv-retry 0" << endl;
     out << "route-delay 0" << endl;
@@ -2038,8 +3325,14 @@ bool VPNConnection::writeOpenVPNConfig(QFile& outFile)
     else
         out << "lport " << g_settings.localPort() << endl;
 
-    out << "cipher " << sanitize(g_settings.cipher()) << endl;
-    if (!g_settings.cipher().endsWith("GCM"))
+    QString cipher = g_settings.cipher();
+    if (cipher == QStringLiteral("auto"))
+    {
+        cipher = selectAutoCipher(g_data.cipherThroughputs());
+        qInfo() << "Using cipher" << cipher << "for automatic cipher setting";
+    }
+    out << "cipher " << sanitize(cipher) << endl;
+    if (!cipher.endsWith("GCM"))
         out << "auth " << sanitize(g_settings.auth()) << endl;
 
     if (g_settings.mtu() > 0)
@@ -2052,6 +3345,20 @@ bool VPNConnection::writeOpenVPNConfig(QFile& outFile)
 
         out << "mssfix " << g_settings.mtu() << endl;
     }
+#ifdef Q_OS_UNIX
+    else if(g_settings.mtuDiscovery())
+    {
+        // Apply the MTU found by a previous probe on this network, if it was
+        // smaller than the default
+        const auto &fingerprint = _transportSelector.networkFingerprint();
+        unsigned knownMtu = fingerprint.isEmpty() ? 0 : g_data.networkMtus().value(fingerprint, 0);
+        if(knownMtu > 0 && knownMtu < PosixMtuProbe::MaxPacketSize)
+        {
+            qInfo() << "Using discovered MTU" << knownMtu << "for this network";
+            out << "mssfix " << knownMtu << endl;
+        }
+    }
+#endif
 
     if(_connectingConfig.proxyType() != ConnectionConfig::ProxyType::None)
     {
@@ -2090,10 +3397,18 @@ bool VPNConnection::writeOpenVPNConfig(QFile& outFile)
     out << "pull-filter ignore \"dhcp-option DNS \"" << endl;
     out << "pull-filter ignore \"dhcp-option DOMAIN local\"" << endl;
 
-    out << "<ca>" << endl;
-    for (const auto& line : g_data.getCertificateAuthority(g_settings.serverCertificate()))
-        out << line << endl;
-    out << "</ca>" << endl;
+    // The CA block is the bulk of the config, and only depends on the
+    // serverCertificate setting; build it once for each certificate.
+    if(_caBlock.isEmpty() || _caBlockCertificate != g_settings.serverCertificate())
+    {
+        QStringList caLines = g_data.getCertificateAuthority(g_settings.serverCertificate());
+        caLines.prepend(QStringLiteral("<ca>"));
+        caLines.append(QStringLiteral("</ca>"));
+        caLines.append(QString{});
+        _caBlock = caLines.join(endl);
+        _caBlockCertificate = g_settings.serverCertificate();
+    }
+    out << _caBlock;
 
     return true;
 }
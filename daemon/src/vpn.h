@@ -23,6 +23,10 @@
 #define CONNECTION_H
 #pragma once
 
+#include "connectionhistory.h"
+#include "dnscache.h"
+#include "maceactivator.h"
+#include "networkmonitor.h"
 #include "openvpn.h"
 #include "settings.h"
 #include "processrunner.h"
@@ -37,6 +41,13 @@
 #include <QObject>
 #include <QFile>
 #include <QTimer>
+#include <QPointer>
+#include <array>
+#include <deque>
+
+#ifdef Q_OS_UNIX
+class PosixMtuProbe;
+#endif
 
 
 // A descriptor for the desired network adapter (--dev-node) to use.
@@ -50,6 +61,15 @@ public:
     virtual QString devNode() const { return _devNode; }
     virtual void setMetricToLowest() { }
     virtual void restoreOriginalMetric() { }
+    // Whether this is a WinTUN adapter (Windows only; see
+    // DaemonSettings::windowsDriver)
+    virtual bool usesWintun() const { return false; }
+    // Whether the OpenVPN build supports data channel offload, and whether
+    // to use it (Linux only; see DaemonSettings::linuxDataChannel).  Builds
+    // with DCO support use it by default, so it has to be disabled
+    // explicitly when it's supported but not used.
+    virtual bool dcoSupported() const { return false; }
+    virtual bool usesDco() const { return false; }
 protected:
     QString _devNode;
 };
@@ -83,6 +103,9 @@ signals:
     // Other conditions (such as hnsd crashing / failing to start) do not emit
     // this, we keep the current sync failure state.
     void hnsdSyncFailure(bool failing);
+    // hnsd's sync height has changed (throttled, not emitted for every block).
+    // 0 indicates that hnsd has restarted or stopped.
+    void hnsdSyncHeight(int height);
 
 public:
     // Change process UID/GID on Linux/MacOS
@@ -93,12 +116,21 @@ public:
 private:
     // Only used by Linux - check whether Hnsd can bind to low ports (cap_net_bind_service capability)
     bool hasNetBindServiceCapability();
+    // Check whether hnsd can save its chain state (the --prefix option); the
+    // result is cached after the first check.
+    bool supportsStatePrefix(const QString &program);
+    void reportSyncHeight(int height);
 
 private:
     // Timer used to detect the "hnsd failing to sync" condition - hnsd needs to
     // sync at least 1 block before this timer elapses, or we assume it is not
     // working.
     QTimer _hnsdSyncTimer;
+    // Last sync height reported, and the height to report when
+    // _syncHeightTimer elapses
+    int _reportedSyncHeight, _syncHeight;
+    QTimer _syncHeightTimer;
+    nullable_t<bool> _supportsStatePrefix;
 };
 
 // ProcessRunner for Shadowsocks - drops UID to 'nobody' on Unix platforms, and
@@ -222,11 +254,38 @@ private:
     // (never returns empty, unlike lastLocalAddress())
     QHostAddress validLastLocalAddress() const;
 
+    // Whether a transport is the preferred transport or one of the alternates
+    bool isCandidate(const Transport &transport) const;
+
+    // Find the known transport for _networkFingerprint, if there is one
+    void updateKnownTransport();
+
+    // Find the candidate with the best throughput on _networkFingerprint, if
+    // it's much faster than the preferred transport.  Returns nullptr if
+    // the preferred transport should be used.
+    const Transport *findFasterTransport() const;
+
+    // The transport to begin a connection sequence with - a transport known to
+    // work on this network, the race winner, or the preferred transport.
+    const Transport &startingTransport() const;
+
 public:
     // Reset TransportSelector for a new connection sequence.
+    //
+    // knownTransports are the transports that worked previously on each
+    // network (DaemonData::networkTransports).  If alternates are enabled and
+    // the current network is found there, the sequence begins with that
+    // transport.
+    //
+    // throughputs are the best throughputs seen with each transport on each
+    // network (DaemonData::networkThroughputs).  If no transport is known to
+    // be needed on this network, but an alternate has been much faster than
+    // the preferred transport, the sequence begins with that alternate.
     void reset(Transport preferred, bool useAlternates,
                const ServerLocation &location, const QVector<uint> &udpPorts,
-               const QVector<uint> &tcpPorts);
+               const QVector<uint> &tcpPorts,
+               const DaemonData::NetworkTransportMap &knownTransports,
+               const DaemonData::NetworkThroughputMap &throughputs);
 
     // Get the current preferred transport
     const Transport &preferred() const {return _preferred;}
@@ -236,6 +295,15 @@ public:
 
     Status status() const {return _status;}
 
+    // Fingerprint of the network found by the last beginAttempt() - the
+    // gateway IP and interface, or the local IP address if those aren't known
+    // on this platform.  Empty if the network couldn't be identified.
+    const QString &networkFingerprint() const {return _networkFingerprint;}
+
+    // Whether a transport is known to work on the network found by the last
+    // beginAttempt().  (A transport race is not needed in that case.)
+    bool hasKnownTransport() const {return _hasKnownTransport;}
+
     // Do a network scan now; this is independent of any state tracked by
     // TransportSelector - it's a stopgap solution since the iptables firewall
     // currently requires the network interface and gateway at startup.
@@ -260,14 +328,128 @@ public:
     // dependent.
     bool beginAttempt(const ServerLocation &location, OriginalNetworkScan &netScan);
 
+    // Get the transports that can be raced with TransportRace - the preferred
+    // transport, followed by the alternates.  Empty if alternates aren't
+    // enabled.
+    std::vector<Transport> raceCandidates() const;
+
+    // Begin the connection sequence with the transport that won a
+    // TransportRace instead of the preferred transport.  This lasts until the
+    // next reset() or until the network connection changes.
+    void useRaceWinner(const Transport &winner);
+
+    // Enable caching of the default route found by network scans.  This should
+    // only be enabled if route changes are monitored, so the cache can be
+    // invalidated with invalidateRouteCache().
+    void setRouteCacheEnabled(bool enabled);
+    // The routing table has changed; the next scan queries it again.
+    void invalidateRouteCache() {_hasCachedRoute = false;}
+
 private:
     Transport _preferred, _lastUsed;
+    // Winner of the last TransportRace; valid if _hasRaceWinner is set
+    Transport _raceWinner;
+    bool _hasRaceWinner;
+    // Transports known to work on each network, from reset()
+    DaemonData::NetworkTransportMap _knownTransports;
+    // Transport throughputs on each network, from reset()
+    DaemonData::NetworkThroughputMap _throughputs;
+    QString _networkFingerprint;
+    // Transport known to work on the current network; valid if
+    // _hasKnownTransport is set
+    Transport _knownTransport;
+    bool _hasKnownTransport;
     std::vector<Transport> _alternates;
     QHostAddress _lastLocalUdpAddress, _lastLocalTcpAddress;
     std::size_t _nextAlternate;
     QDeadlineTimer _startAlternates;
     Status _status;
     bool _useAlternateNext;
+    // Default route found by the last scan; valid if _hasCachedRoute is set
+    // (only used if _routeCacheEnabled is set)
+    QString _cachedGatewayIp, _cachedInterfaceName;
+    bool _routeCacheEnabled, _hasCachedRoute;
+};
+
+// TransportRace probes several transports to a location in parallel, so a
+// connection sequence can begin with a transport that is known to be
+// reachable.  Otherwise, when the preferred port is blocked, each alternate
+// costs a full OpenVPN connection timeout.
+//
+// UDP transports are probed with an OpenVPN hard reset packet - any reply from
+// the server shows that the port is reachable.  TCP transports are probed by
+// opening a connection.  The preferred transport (the first candidate) gets a
+// head start, the others are probed if it hasn't responded by then.
+class TransportRace : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("vpn")
+
+public:
+    // Begin probing the candidates immediately.  candidates[0] is the
+    // preferred transport.
+    TransportRace(const ServerLocation &location,
+                  const std::vector<Transport> &candidates);
+
+signals:
+    // The race has finished.  If a transport responded, 'responded' is true
+    // and 'winner' is the first transport that responded.  This is emitted
+    // exactly once.
+    void finished(const Transport &winner, bool responded);
+
+private:
+    void probe(std::size_t index);
+    void probeAlternates();
+    void finish(std::size_t index);
+    void onTimeout();
+
+private:
+    std::vector<Transport> _candidates;
+    QHostAddress _udpHost, _tcpHost;
+    QTimer _headStartTimer, _timeoutTimer;
+    bool _finished;
+};
+
+// ProxyProbe checks the reachability and connect latency of proxy servers by
+// opening TCP connections to all of them in parallel.  VPNConnection uses it
+// to detect an unreachable proxy before OpenVPN times out, and Daemon uses it
+// to rank Shadowsocks locations by proxy latency.
+class ProxyProbe : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("vpn")
+
+public:
+    struct Endpoint
+    {
+        // Identifies this endpoint in the result (such as a location ID)
+        QString id;
+        QHostAddress host;
+        quint16 port;
+    };
+
+    // Maps each endpoint ID that responded to its connect latency
+    using Latencies = QHash<QString, std::chrono::milliseconds>;
+
+public:
+    // Begin probing all endpoints immediately.  Endpoints with a null host
+    // are skipped (they're unreachable).
+    ProxyProbe(const std::vector<Endpoint> &endpoints);
+
+signals:
+    // All endpoints have responded or the timeout elapsed.  Endpoints that
+    // didn't respond aren't in 'latencies'.  This is emitted exactly once.
+    void finished(const Latencies &latencies);
+
+private:
+    void finish();
+
+private:
+    QElapsedTimer _elapsed;
+    QTimer _timeoutTimer;
+    Latencies _latencies;
+    std::size_t _remaining;
+    bool _finished;
 };
 
 // Holds the configuration details that we provide via DaemonState for the
@@ -312,6 +494,11 @@ public:
     const QSharedPointer<ServerLocation> &vpnLocation() const {return _pVpnLocation;}
     bool vpnLocationAuto() const {return _vpnLocationAuto;}
 
+    // Replace an automatic VPN location with the location that the connection
+    // failed over to (see DaemonSettings::standbyFailover).  Has no effect if
+    // the location was chosen explicitly.
+    void failOver(const QSharedPointer<ServerLocation> &pFailoverLocation);
+
     bool defaultRoute() const {return _defaultRoute;}
 
     ProxyType proxyType() const {return _proxyType;}
@@ -371,8 +558,14 @@ public:
         // Starting proxy, only done when starting up Shadowsocks client with
         // ephemeral port
         StartingProxy,
+        // Racing transports, only done for the first connection attempt when
+        // alternate transports are enabled
+        RacingTransports,
         // OpenVPN has been started and is connecting
         ConnectingOpenVPN,
+        // OpenVPN has connected, activating MACE before going to the Connected
+        // state; only done when MACE is enabled
+        ActivatingMACE,
     };
     Q_ENUM(ConnectionStep)
 
@@ -394,34 +587,110 @@ public:
     State state() const { return _state; }
     quint64 bytesReceived() const { return _receivedByteCount; }
     quint64 bytesSent() const { return _sentByteCount; }
-    const QList<IntervalBandwidth> &intervalMeasurements() const {return _intervalMeasurements;}
-    void activateMACE ();
+    // The interval measurements for the current OpenVPN process, oldest first
+    QList<IntervalBandwidth> intervalMeasurements() const;
+    // History of past connection sessions
+    ConnectionHistory &connectionHistory() { return _connectionHistory; }
 
     bool needsReconnect();
+    // Daemon calls these when a setting or the VPN/Shadowsocks locations
+    // change, so needsReconnect() only compares the settings and rebuilds the
+    // connection configuration when one of their inputs has changed.
+    void connectionSettingChanged(const QString &name);
+    void connectionLocationsChanged();
     QSharedPointer<NetworkAdapter> networkAdapter() const { return _networkAdapter; }
     const DaemonSettings::DNSSetting &dnsServers() const { return _dnsServers; }
+    // Whether the OS was configured to use the local DNS cache for this
+    // connection (dnsCacheLocalAddress instead of dnsServers())
+    bool dnsCacheActive() const { return _dnsCacheActive; }
+    // Whether hnsd is running (for Handshake DNS, or to sync in the background)
+    bool hnsdEnabled() const { return _hnsdRunner.isEnabled(); }
 
     // Do a network scan now - stopgap solution for the iptables firewall.
     // Emits scannedOriginalNetwork() with the result.
     void scanNetwork(const ServerLocation *pLocation, const QString &protocol);
 
+    // Measure the throughput of each data channel cipher on this CPU, for
+    // DaemonData::cipherThroughputs.  This takes a few hundred milliseconds;
+    // call it on a worker thread.
+    static DaemonData::CipherThroughputMap benchmarkCiphers();
+    // Pick the cipher to use for the "auto" cipher setting from the benchmark
+    // results.  Uses AES-128-GCM if the results are empty.
+    static QString selectAutoCipher(const DaemonData::CipherThroughputMap &throughputs);
+
 public slots:
     void connectVPN(bool force);
     void disconnectVPN();
+    // Apply DaemonSettings::bandwidthSampleInterval to the running OpenVPN
+    // process.  The interval measurements are cleared since they were sampled
+    // at the old interval.
+    void updateByteCountInterval();
+    // Reduce the rate of byte count reports from OpenVPN when no client is
+    // displaying them (they're still needed for the totals, connection
+    // history, etc.)  The interval measurements are still reported at
+    // DaemonSettings::bandwidthSampleInterval.
+    void setReducedByteCountRate(bool reduced);
+    // Keep the Shadowsocks client running for this location while
+    // disconnected, so connecting through it doesn't have to wait for it to
+    // start and bind its local port.  Pass nullptr to stop doing this.  (It's
+    // still started on demand when connecting if this isn't used.)
+    void prestartShadowsocks(const QSharedPointer<ServerLocation> &pLocation);
+    // Run hnsd while connected even if the current connection doesn't use
+    // Handshake DNS, so it's synced by the time a reconnect applies the
+    // Handshake setting.
+    void setHnsdBackgroundSync(bool enable);
 
 private:
+    // The current connection configuration from DaemonSettings and
+    // DaemonState, rebuilt only if its inputs have changed
+    const ConnectionConfig &currentConfig();
     void beginConnection();
+    // Start a TransportRace for the first attempt of a connection sequence.
+    // Returns false if there are no transports to race.  When the race
+    // finishes, doConnect() is called again to continue.
+    bool startTransportRace();
+    // Probe the proxy server for the first attempt of a connection sequence,
+    // while the rest of the connection is set up.  If it's unreachable, this
+    // is reported right away (see DaemonState::proxyUnreachable) rather than
+    // when OpenVPN times out.  The connection attempt continues either way.
+    void startProxyProbe();
+    // After connecting, remember the transport that worked on this network if
+    // it wasn't the preferred transport (or forget it if the preferred
+    // transport worked).
+    void rememberNetworkTransport();
+    // After connecting, probe the path MTU through the tunnel if MTU discovery
+    // is enabled and this network hasn't been probed yet.  The result is
+    // stored in DaemonData::networkMtus and applied on the next connection.
+    void startMtuProbe();
+    void storeNetworkMtu(const QString &fingerprint, unsigned mtu);
+    // After OpenVPN connects with MACE enabled, activate MACE.  The connection
+    // goes to the Connected state once activation finishes (whether or not it
+    // succeeded), so ad blocking is active when we report the connection.
+    void activateMace();
+    void onMaceActivationFinished();
+    // When leaving the Connected state with the "auto" cipher, remember the
+    // best throughput seen on this connection for the transport that was used
+    // (DaemonData::networkThroughputs).
+    void rememberTransportThroughput();
     void doConnect();
-    void openvpnStdoutLine(const QString& line);
-    void checkStdoutErrors(const QString &line);
-    void openvpnStderrLine(const QString& line);
+    void openvpnOutputEvent(OpenVPNProcess::OutputStream stream,
+                            const OpenVPNProcess::OutputMatch &match);
+    void checkStdoutErrors(const OpenVPNProcess::OutputMatch &match);
     bool respondToMgmtAuth(const QString &line, const QString &user,
                            const QString &password);
     void openvpnManagementLine(const QString& line);
     void openvpnStateChanged();
     void openvpnExited(int exitCode);
+#ifdef Q_OS_LINUX
+    // Apply DNS for the tunnel device reported by OpenVPN
+    void applyTunnelDns(const QString &tunnelDevice);
+#endif
     void openvpnError(const Error& error);
     void raiseError(const Error& error);
+    // The OS reported a network change - rescan the original network, and if
+    // it changed, reconnect (or retry) right away instead of waiting for
+    // OpenVPN's ping timeout.
+    void onNetworkChanged();
 
 signals:
     void error(const Error& error);
@@ -447,15 +716,34 @@ signals:
     // The total sent/received bytecounts and the interval measurements have
     // changed.
     void byteCountsChanged();
+    // A connection was established; this is the time spent in each phase of
+    // the attempt, with histograms over recent connections.
+    void connectionPhasesChanged(const QVector<ConnectionPhase> &phases);
+    // MACE activation finished for a connection that's about to be
+    // established - whether it was activated, and the time taken (including
+    // any retries)
+    void maceActivationFinished(bool active, std::chrono::milliseconds latency);
     // Signals forwarded from HnsdRunner
     void hnsdSucceeded();
     void hnsdFailed(std::chrono::milliseconds failureDuration);
     void hnsdSyncFailure(bool failing);
+    void hnsdSyncHeight(int height);
+    // The restart status of a helper process (hnsd or Shadowsocks) changed
+    void helperProcessStatusChanged(const QString &name, const HelperProcessStatus &status);
     void usingTunnelDevice(QString deviceName, QString deviceLocalAddress, QString deviceRemoteAddress);
 
 private:
     void setState(State state);
+    // Enable ss-local for a Shadowsocks location's server.  Returns the result
+    // of ProcessRunner::enable().
+    bool enableShadowsocks(const ServerLocation &location);
+    // Apply _pPrestartShadowsocksLocation while disconnected
+    void applyPrestartShadowsocks();
+    // Enable hnsd for the current tunnel
+    void enableHnsd();
     void updateByteCounts(quint64 received, quint64 sent);
+    // Number of sample intervals covered by each byte count report
+    uint byteCountIntervalScale() const;
     void scheduleNextConnectionAttempt();
     void queueConnectionAttempt();
     // Copy settings to begin a connection attempt.  If the settings are loaded
@@ -465,8 +753,35 @@ private:
     // not be found), it instead transitions to failureState and returns false.
     // _connectingConfig is cleared in this case.
     bool copySettings(State successState, State failureState);
-    bool writeOpenVPNConfig(QFile& outFile);
-    void checkForMagicStrings(const QString& line);
+    // If the only change in the OpenVPN config for the new connection is the
+    // remote host/port, restart the running OpenVPN process in place instead
+    // of starting a new one (avoids the process startup, config parsing, and
+    // network scan of a full attempt).  Goes to the Reconnecting state and returns true if the
+    // restart was started.  The connection settings must have been checked by
+    // the caller.
+    bool warmRestart();
+    // The connection was lost - if standby failover is enabled, switch the
+    // automatic location to the standby location for the next attempt.
+    void failOverToStandby();
+    bool writeOpenVPNConfig(QIODevice& outDevice);
+    void checkForMagicStrings(const OpenVPNProcess::OutputMatch &match);
+    // Record the time spent in the last OpenVPN phase when OpenVPN's state
+    // changes.  When OpenVPN connects, emits connectionPhasesChanged().
+    void recordConnectionPhase(OpenVPNProcess::State newState);
+
+private:
+    // The phases timed for each attempt - OpenVPN states from Connecting up to
+    // (but not including) Connected
+    enum : int { ConnectionPhaseCount = OpenVPNProcess::Connected - OpenVPNProcess::Connecting };
+    using PhaseTimes = std::array<qint64, ConnectionPhaseCount>;
+
+    // Maximum number of interval measurements kept
+    enum : std::size_t { MaxMeasurementIntervals = 32 };
+    struct ByteCountSample
+    {
+        quint64 received;
+        quint64 sent;
+    };
 
 private:
     State _state;
@@ -480,6 +795,9 @@ private:
     // Runner for ss-local process, enabled when we connect with a Shadowsocks
     // proxy.
     ShadowsocksRunner _shadowsocksRunner;
+    // Shadowsocks location to keep ss-local running for while disconnected;
+    // see prestartShadowsocks()
+    QSharedPointer<ServerLocation> _pPrestartShadowsocksLocation;
     // Stored settings as of last/current connection.  These are valid in any
     // state, they are the settings that will be used for the next connection
     // (even in the Connected state; they'll be applied when a reconnect occurs)
@@ -490,6 +808,19 @@ private:
     QSharedPointer<NetworkAdapter> _networkAdapter;
     // The DNS servers for the current connection
     DaemonSettings::DNSSetting _dnsServers;
+    // Local DNS cache, used for the connection if DaemonSettings::dnsCache is
+    // set and it's able to listen (_dnsCacheActive)
+    DnsCache _dnsCache;
+    bool _dnsCacheActive;
+#ifdef Q_OS_LINUX
+    // DNS servers to apply when the tunnel device comes up (empty to keep the
+    // existing DNS configuration), and the device they were applied to (empty
+    // if they haven't been applied)
+    QStringList _tunnelDnsServers;
+    QString _dnsTunnelDevice;
+#endif
+    // See setHnsdBackgroundSync()
+    bool _hnsdBackgroundSync;
     // The configuration we are currently attempting to connect with.
     ConnectionConfig _connectingConfig;
     // The configuration that we last connected with.
@@ -502,6 +833,29 @@ private:
     // used in any of the Connecting/Reconnecting states, it does not run in any
     // other state.
     QTimer _connectTimer;
+    // Transport race for the current connection sequence, if one is running
+    QPointer<TransportRace> _pTransportRace;
+    // Pre-flight probe of the proxy for the current connection sequence, if
+    // one is running
+    QPointer<ProxyProbe> _pProxyProbe;
+    // MACE activation for the current connection attempt; only set in the
+    // ActivatingMACE step
+    Async<MaceActivationTask> _pMaceActivation;
+#ifdef Q_OS_UNIX
+    // MTU probe for the current connection, if one is running
+    QPointer<PosixMtuProbe> _pMtuProbe;
+#endif
+    // Measures the current OpenVPN phase of the current attempt; invalid when
+    // no attempt is being timed
+    QElapsedTimer _phaseTimer;
+    OpenVPNProcess::State _currentPhase;
+    // Time spent in each phase of the current attempt (ms)
+    PhaseTimes _attemptPhaseTimes;
+    // Phase times of recent connections, used for the histograms; newest last
+    std::deque<PhaseTimes> _recentPhaseTimes;
+    // Persistent history of connection sessions; a session is active while
+    // we're in the Connected state
+    ConnectionHistory _connectionHistory;
     // Number of connection attempts performed for this connection.  This can be
     // nonzero in any Connecting/Reconnecting state; in any other state it is
     // zero.
@@ -510,12 +864,54 @@ private:
     // Accumulated received/sent traffic over this connection. This includes
     // all traffic, even across multiple OpenVPN processes.
     quint64 _receivedByteCount, _sentByteCount;
+    // Best throughput (bytes/second in both directions) seen in any interval
+    // while connected; reset for each OpenVPN process
+    double _peakThroughput;
     // Last traffic counts received from the current OpenVPN process
     quint64 _lastReceivedByteCount, _lastSentByteCount;
-    // Interval measurements for the current OpenVPN process
-    QList<IntervalBandwidth> _intervalMeasurements;
+    // Interval measurements for the current OpenVPN process - a ring buffer of
+    // _intervalCount samples starting at _intervalStart
+    std::array<ByteCountSample, MaxMeasurementIntervals> _intervalMeasurements;
+    std::size_t _intervalStart, _intervalCount;
+    // Whether byte counts are reported at a reduced rate - see
+    // setReducedByteCountRate()
+    bool _reducedByteCountRate;
     // Cached value if we already determined we need a reconnect to apply settings
     bool _needsReconnect;
+    // Incremented when a setting in g_connectionSettingNames changes, and the
+    // version that _connectionSettings was last known to match.
+    unsigned _settingsVersion, _checkedSettingsVersion;
+    // Incremented when an input to ConnectionConfig changes, and the version
+    // that _currentConfig was built from.  needsReconnect() compares the
+    // current configuration each time it's called, which happens on many
+    // settings and state changes; this avoids copying the locations and proxy
+    // configuration each time.
+    unsigned _configVersion, _currentConfigVersion;
+    ConnectionConfig _currentConfig;
+    // OpenVPN config used by the current OpenVPN process
+    QByteArray _runningConfig;
+    // Contents last written to Path::OpenVPNConfigFile, so retries with the
+    // same config don't rewrite it
+    QByteArray _writtenConfig;
+    // "<ca>" block of the OpenVPN config, and the serverCertificate setting it
+    // was built for (see writeOpenVPNConfig())
+    QString _caBlock, _caBlockCertificate;
+    // Set when OpenVPN was asked to restart in place, until it reaches its
+    // Reconnecting state
+    bool _warmRestartPending;
+    // Notifies network changes, see onNetworkChanged()
+    NetworkMonitor _networkMonitor;
+    // The last original network scanned while connected (scanNetwork()), and
+    // whether the network has been lost since then (no usable default route).
+    OriginalNetworkScan _lastNetworkScan;
+    bool _networkLost;
+    // The location the connection failed over to, which replaces the
+    // automatic location until the user connects again (see
+    // failOverToStandby()).  _failingOver is set until the first attempt to
+    // the failover location begins; that attempt skips the transport race and
+    // goes straight to the transport that worked on this network.
+    QSharedPointer<ServerLocation> _pFailoverLocation;
+    bool _failingOver;
 };
 
 #endif // CONNECTION_H
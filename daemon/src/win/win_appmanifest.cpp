@@ -22,11 +22,27 @@
 #include "win_appmanifest.h"
 #include "path.h"
 #include <QXmlStreamReader>
+#include <QDateTime>
 #include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
 
 namespace
 {
     const QString manifestNamespace = QStringLiteral("http://schemas.microsoft.com/appx/manifest/foundation/windows10");
+
+    // Maximum number of install directories in the manifest cache.  The cache
+    // is just cleared if it grows beyond this (old versions of apps that have
+    // been updated are never looked up again).
+    const int manifestCacheLimit{512};
+
+    struct CachedManifest
+    {
+        QDateTime modified;
+        bool inspected;
+        AppExecutables appExes;
+    };
 }
 
 bool findXmlStartNode(QXmlStreamReader &xmlReader, const QString &nodeNamespace,
@@ -94,3 +110,44 @@ bool inspectUwpAppManifest(const QString &installDir, AppExecutables &appExes)
 
     return true;
 };
+
+bool inspectUwpAppManifestCached(const QString &installDir, AppExecutables &appExes)
+{
+    static QMutex cacheMutex;
+    static QHash<QString, CachedManifest> cache;
+
+    const QDateTime &modified = QFileInfo{installDir + QStringLiteral("\\appxmanifest.xml")}.lastModified();
+
+    CachedManifest entry{};
+    bool found = false;
+    {
+        QMutexLocker lock{&cacheMutex};
+        auto itEntry = cache.constFind(installDir);
+        if(itEntry != cache.constEnd() && itEntry->modified == modified)
+        {
+            entry = *itEntry;
+            found = true;
+        }
+    }
+
+    // Parse outside of the lock, so other directories can be looked up
+    // concurrently.  (If two threads inspect the same new directory, both
+    // parse it, which is harmless.)
+    if(!found)
+    {
+        entry.modified = modified;
+        entry.appExes.usesWwa = false;
+        entry.inspected = inspectUwpAppManifest(installDir, entry.appExes);
+
+        QMutexLocker lock{&cacheMutex};
+        if(cache.size() >= manifestCacheLimit)
+            cache.clear();
+        cache.insert(installDir, entry);
+    }
+
+    appExes.executables.insert(entry.appExes.executables.begin(),
+                               entry.appExes.executables.end());
+    if(entry.appExes.usesWwa)
+        appExes.usesWwa = true;
+    return entry.inspected;
+}
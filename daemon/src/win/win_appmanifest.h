@@ -34,4 +34,11 @@ struct AppExecutables
 // and whether it uses WWA.
 bool inspectUwpAppManifest(const QString &installDir, AppExecutables &appExes);
 
+// Like inspectUwpAppManifest(), but the result for each install directory is
+// cached.  Install directories are named for the package's full name
+// (including its version), so an update installs to a new directory; the
+// cached result is also discarded if the manifest's modification time
+// changes.  Thread-safe.
+bool inspectUwpAppManifestCached(const QString &installDir, AppExecutables &appExes);
+
 #endif
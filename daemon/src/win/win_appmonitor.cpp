@@ -25,12 +25,21 @@
 #include "win/win_winrtloader.h"
 #include <QMutex>
 #include <QMutexLocker>
+#include <QFileInfo>
+#include "brand.h"
 #include <Psapi.h>
 #include <comutil.h>
+#include <evntrace.h>
+#include <evntcons.h>
 #include <array>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
 
 #pragma comment(lib, "comsuppw.lib")
 #pragma comment(lib, "Wbemuuid.lib")
+#pragma comment(lib, "Advapi32.lib")
 
 class SystemTimeTracer : public DebugTraceable<SystemTimeTracer>
 {
@@ -98,7 +107,10 @@ std::set<const AppIdKey*, PtrValueLess> WinAppTracker::getAppIds() const
     return ids;
 }
 
-bool WinAppTracker::setSplitTunnelRules(const QVector<SplitTunnelRule> &rules)
+std::vector<WinResolvedApp> WinAppTracker::resolveRules(SplitType type,
+                                                       const QVector<SplitTunnelRule> &rules,
+                                                       QStringList &watchDirs,
+                                                       SignerCache &signerCache)
 {
     // Try to load the link reader; this can fail.
     nullable_t<WinLinkReader> linkReader;
@@ -114,7 +126,7 @@ bool WinAppTracker::setSplitTunnelRules(const QVector<SplitTunnelRule> &rules)
 
     QString ruleMode;
 
-    switch(_type)
+    switch(type)
     {
     case SplitType::Excluded:
         ruleMode = QStringLiteral("exclude");
@@ -124,6 +136,12 @@ bool WinAppTracker::setSplitTunnelRules(const QVector<SplitTunnelRule> &rules)
         break;
     }
 
+    auto addWatchDir = [&watchDirs](const QString &dir)
+    {
+        if(!dir.isEmpty() && !watchDirs.contains(dir))
+            watchDirs.push_back(dir);
+    };
+
     ExcludedApps_t addedApps;
     for(const auto &rule : rules)
     {
@@ -140,7 +158,12 @@ bool WinAppTracker::setSplitTunnelRules(const QVector<SplitTunnelRule> &rules)
             // find.
             AppExecutables appExes{};
             for(const auto &dir : installDirs)
-                inspectUwpAppManifest(dir, appExes);
+            {
+                inspectUwpAppManifestCached(dir, appExes);
+                // Install directories are versioned, an update installs to a
+                // new directory next to this one
+                addWatchDir(QFileInfo{dir}.absolutePath());
+            }
 
             for(const auto &exe : appExes.executables)
             {
@@ -166,16 +189,42 @@ bool WinAppTracker::setSplitTunnelRules(const QVector<SplitTunnelRule> &rules)
                            &targetPath};
             if(appId.empty())
                 continue;   // Traced by AppIdKey
+            addWatchDir(QFileInfo{QString::fromStdWString(targetPath)}.absolutePath());
             auto emplaceResult = addedApps.emplace(std::move(appId), ExcludedAppData{});
             if(emplaceResult.second)
-            {
                 emplaceResult.first->second._targetPath = std::move(targetPath);
-                // Don't load _signerNames yet, this could be expensive, do that if
-                // this is actually a new app we don't already have.
-            }
         }
     }
 
+    // Read the signer names too - this is the most expensive part, which is
+    // why this is done on a worker thread.  The cache holds every app from
+    // large rule lists, so it isn't cleared on each resolve.
+    enum : int { MaxResolvedSigners = 4096 };
+    std::vector<WinResolvedApp> apps;
+    apps.reserve(addedApps.size());
+    while(!addedApps.empty())
+    {
+        auto appNode = addedApps.extract(addedApps.begin());
+        WinResolvedApp app{std::move(appNode.key()), std::move(appNode.mapped()._targetPath), {}};
+        app._signerNames = getCachedSigners(signerCache,
+                                            QString::fromStdWString(app._targetPath),
+                                            MaxResolvedSigners);
+        apps.push_back(std::move(app));
+    }
+    return apps;
+}
+
+bool WinAppTracker::setResolvedApps(std::vector<WinResolvedApp> apps)
+{
+    ExcludedApps_t addedApps;
+    for(auto &app : apps)
+    {
+        ExcludedAppData appData{};
+        appData._targetPath = std::move(app._targetPath);
+        appData._signerNames = std::move(app._signerNames);
+        addedApps.emplace(std::move(app._appId), std::move(appData));
+    }
+
     for(auto itExistingApp = _apps.begin(); itExistingApp != _apps.end(); )
     {
         // Is the app still excluded?
@@ -207,8 +256,7 @@ bool WinAppTracker::setSplitTunnelRules(const QVector<SplitTunnelRule> &rules)
         // existing app IDs.  Ignore it in this case since it's a duplicate.
         if(insertResult.inserted)
         {
-            // Read the signer names since we're adding a new app
-            insertResult.position->second._signerNames = winGetExecutableSigners(insertResult.position->second._targetPath);
+            // The signer names were read by resolveRules().
             // At this point, we could conceivably scan for existing processes
             // that match this app (and their descendants, etc.).  However, it
             // won't help for most "launcher" apps - the launcher is gone by
@@ -219,6 +267,11 @@ bool WinAppTracker::setSplitTunnelRules(const QVector<SplitTunnelRule> &rules)
         }
     }
 
+    _appIndex.clear();
+    _appIndex.reserve(_apps.size());
+    for(auto itApp = _apps.begin(); itApp != _apps.end(); ++itApp)
+        _appIndex.emplace(&itApp->first, itApp);
+
     // It's possible the set of excluded app IDs might not have changed, but it
     // usually does, it's not worth attempting to figure this out here (the
     // firewall implementation will compare the new app IDs to the current
@@ -260,7 +313,7 @@ void WinAppTracker::checkMatchingProcess(WinHandle &procHandle, AppIdKey &appId,
     // Check if it's a matching app itself.  Do this before checking if it's a
     // descendant - it's possible it could be both if one excluded app launches
     // another.
-    auto itMatchingApp = _apps.find(appId);
+    auto itMatchingApp = findApp(appId);
     if(itMatchingApp != _apps.end())
     {
         // It matches one of our apps - take the process handle and app ID; this
@@ -330,7 +383,7 @@ void WinAppTracker::checkNewParent(WinHandle &procHandle, AppIdKey &appId,
     // This means that apps whose "launcher" processes are very short-lived
     // should work, but if an intermediate process is very short-lived we might
     // not be able to identify their descendants.
-    auto itParentApp = _apps.find(parentAppId);
+    auto itParentApp = findApp(parentAppId);
     // If the parent is an excluded app, it's ours - take parentHandle and
     // parentAppId to indicate this to the caller, and add it if it has any
     // signer names.
@@ -405,6 +458,46 @@ void WinAppTracker::dump() const
     }
 }
 
+auto WinAppTracker::findApp(const AppIdKey &appId) -> ExcludedApps_t::iterator
+{
+    auto itIndex = _appIndex.find(&appId);
+    if(itIndex == _appIndex.end())
+        return _apps.end();
+    return itIndex->second;
+}
+
+const std::set<std::wstring> &WinAppTracker::getCachedSigners(SignerCache &signerCache,
+                                                              const QString &imgPath,
+                                                              int maxEntries)
+{
+    QFileInfo imgInfo{imgPath};
+    QDateTime lastModified = imgInfo.lastModified();
+    qint64 size = imgInfo.size();
+
+    auto itCached = signerCache.find(imgPath);
+    if(itCached != signerCache.end() && lastModified.isValid() &&
+        itCached->_lastModified == lastModified && itCached->_size == size)
+    {
+        return itCached->_signerNames;
+    }
+
+    if(itCached == signerCache.end() && signerCache.size() >= maxEntries)
+        signerCache.clear();
+
+    CachedSigners &cached = signerCache[imgPath];
+    cached._lastModified = lastModified;
+    cached._size = size;
+    cached._signerNames = winGetExecutableSigners(imgPath);
+    return cached._signerNames;
+}
+
+const std::set<std::wstring> &WinAppTracker::getSigners(const QString &imgPath)
+{
+    // Limit the cache size; just start over if it gets too big
+    enum : int { MaxCachedSigners = 256 };
+    return getCachedSigners(_signerCache, imgPath, MaxCachedSigners);
+}
+
 void WinAppTracker::addSplitProcess(ExcludedApps_t::iterator itMatchingApp,
                                     WinHandle procHandle, Pid_t pid,
                                     AppIdKey appId)
@@ -456,7 +549,7 @@ auto WinAppTracker::isAppDescendant(Pid_t parentPid, const QString &imgPath)
     if(itProcData->second._excludedAppPos->second._signerNames.empty())
         return _apps.end();
 
-    std::set<std::wstring> signerNames{winGetExecutableSigners(imgPath)};
+    const std::set<std::wstring> &signerNames{getSigners(imgPath)};
 
     for(const auto &expectedSignerName : itProcData->second._excludedAppPos->second._signerNames)
     {
@@ -594,10 +687,23 @@ std::set<const AppIdKey*, PtrValueLess> WinSplitTunnelTracker::getVpnOnlyAppIds(
     return _vpnOnly.getAppIds();
 }
 
-bool WinSplitTunnelTracker::setSplitTunnelRules(const QVector<SplitTunnelRule> &rules)
+WinResolvedRules WinSplitTunnelTracker::resolveRules(const QVector<SplitTunnelRule> &rules,
+                                                    WinAppTracker::SignerCache &signerCache)
 {
-    bool vpnOnlyRules = _vpnOnly.setSplitTunnelRules(rules);
-    bool exclusionRules = _excluded.setSplitTunnelRules(rules);
+    WinResolvedRules resolved;
+    resolved._vpnOnly = WinAppTracker::resolveRules(WinAppTracker::SplitType::VpnOnly,
+                                                    rules, resolved._watchDirs,
+                                                    signerCache);
+    resolved._excluded = WinAppTracker::resolveRules(WinAppTracker::SplitType::Excluded,
+                                                     rules, resolved._watchDirs,
+                                                     signerCache);
+    return resolved;
+}
+
+bool WinSplitTunnelTracker::setResolvedRules(WinResolvedRules rules)
+{
+    bool vpnOnlyRules = _vpnOnly.setResolvedApps(std::move(rules._vpnOnly));
+    bool exclusionRules = _excluded.setResolvedApps(std::move(rules._excluded));
     return vpnOnlyRules || exclusionRules;
 }
 
@@ -991,10 +1097,258 @@ void WinAppMonitor::WbemEventSink::readNewProcess(IWbemClassObject &obj)
                                        std::move(parentHandle), ppid);
 }
 
-WinAppMonitor::WinAppMonitor()
+namespace
+{
+    // Microsoft-Windows-Kernel-Process provider -
+    // {22FB2CD6-0E7B-422B-A0C7-2FAD1FD0E716}
+    const GUID kernelProcessProvider{0x22fb2cd6, 0x0e7b, 0x422b,
+                                     {0xa0, 0xc7, 0x2f, 0xad, 0x1f, 0xd0, 0xe7, 0x16}};
+    // WINEVENT_KEYWORD_PROCESS - process start/stop events (excludes thread,
+    // image load, etc.)
+    const ULONGLONG kernelProcessKeyword{0x10};
+    // Event ID of the ProcessStart event
+    const USHORT processStartEventId{1};
+    // ETW sessions are system-wide, so the name includes the brand code
+    const wchar_t etwSessionName[] = L"" BRAND_CODE "-process-monitor";
+    // Flush interval for the session's buffers.  Real-time consumers only
+    // receive events when a buffer is flushed (or fills up), so this limits
+    // the latency of process start events.
+    const ULONG etwFlushTimerMs{10};
+    // Time to wait for additional app ID changes before emitting
+    // appIdsChanged()
+    const std::chrono::milliseconds appIdsChangedDelay{50};
+    // Time to wait after a change in a watched app directory before resolving
+    // the split tunnel rules again - an app update changes many files
+    const std::chrono::seconds watchDirsChangedDelay{5};
+}
+
+// EtwProcessTrace runs a real-time ETW session on the kernel process provider,
+// and forwards process start events to WinAppMonitor.  The events are
+// received on a worker thread (ETW's ProcessTrace() blocks), they're queued to
+// the monitor's thread for processing.
+class WinAppMonitor::EtwProcessTrace
+{
+public:
+    // Start the trace session.  Returns nullptr if it can't be started (such
+    // as if ETW or the provider isn't available).
+    static std::unique_ptr<EtwProcessTrace> start(WinAppMonitor &monitor);
+
+private:
+    EtwProcessTrace(WinAppMonitor &monitor);
+
+public:
+    // Stops the session and waits for the worker thread to exit
+    ~EtwProcessTrace();
+
+private:
+    // EVENT_TRACE_PROPERTIES has to be followed by space for the session name;
+    // initialize a buffer for it.  With msFlushTimer set, the session uses a
+    // millisecond flush timer (Windows 8+), otherwise it flushes every second.
+    static EVENT_TRACE_PROPERTIES &initProperties(std::vector<unsigned char> &buffer,
+                                                  bool msFlushTimer);
+    static ULONG startSession(TRACEHANDLE &session, bool msFlushTimer);
+    static void WINAPI onEventRecord(PEVENT_RECORD pEvent);
+
+    bool init();
+
+private:
+    WinAppMonitor &_monitor;
+    TRACEHANDLE _session;
+    TRACEHANDLE _consumer;
+    std::thread _processThread;
+};
+
+std::unique_ptr<WinAppMonitor::EtwProcessTrace> WinAppMonitor::EtwProcessTrace::start(WinAppMonitor &monitor)
+{
+    std::unique_ptr<EtwProcessTrace> pTrace{new EtwProcessTrace{monitor}};
+    if(!pTrace->init())
+        pTrace.reset();
+    return pTrace;
+}
+
+WinAppMonitor::EtwProcessTrace::EtwProcessTrace(WinAppMonitor &monitor)
+    : _monitor{monitor}, _session{0}, _consumer{INVALID_PROCESSTRACE_HANDLE}
+{
+}
+
+WinAppMonitor::EtwProcessTrace::~EtwProcessTrace()
 {
-    connect(&_tracker, &WinSplitTunnelTracker::appIdsChanged, this,
+    std::vector<unsigned char> propsBuf;
+    if(_session)
+    {
+        ULONG stopErr = ::ControlTraceW(_session, nullptr,
+                                        &initProperties(propsBuf, false),
+                                        EVENT_TRACE_CONTROL_STOP);
+        if(stopErr != ERROR_SUCCESS)
+            qWarning() << "Unable to stop ETW session -" << SystemError{HERE, stopErr};
+    }
+    // Closing the consumer handle ends ProcessTrace() if it hadn't already
+    // returned due to the session stopping
+    if(_consumer != INVALID_PROCESSTRACE_HANDLE)
+        ::CloseTrace(_consumer);
+    if(_processThread.joinable())
+        _processThread.join();
+}
+
+EVENT_TRACE_PROPERTIES &WinAppMonitor::EtwProcessTrace::initProperties(std::vector<unsigned char> &buffer,
+                                                                      bool msFlushTimer)
+{
+    buffer.clear();
+    buffer.resize(sizeof(EVENT_TRACE_PROPERTIES) + sizeof(etwSessionName));
+    EVENT_TRACE_PROPERTIES &props = *reinterpret_cast<EVENT_TRACE_PROPERTIES*>(buffer.data());
+    props.Wnode.BufferSize = static_cast<ULONG>(buffer.size());
+    props.Wnode.Flags = WNODE_FLAG_TRACED_GUID;
+    props.Wnode.ClientContext = 1;  // QueryPerformanceCounter timestamps
+    props.LogFileMode = EVENT_TRACE_REAL_TIME_MODE;
+    if(msFlushTimer)
+    {
+        props.LogFileMode |= EVENT_TRACE_USE_MS_FLUSH_TIMER;
+        props.FlushTimer = etwFlushTimerMs;
+    }
+    else
+        props.FlushTimer = 1;
+    props.LoggerNameOffset = sizeof(EVENT_TRACE_PROPERTIES);
+    return props;
+}
+
+ULONG WinAppMonitor::EtwProcessTrace::startSession(TRACEHANDLE &session,
+                                                   bool msFlushTimer)
+{
+    std::vector<unsigned char> propsBuf;
+    ULONG startErr = ::StartTraceW(&session, etwSessionName,
+                                   &initProperties(propsBuf, msFlushTimer));
+    if(startErr == ERROR_ALREADY_EXISTS)
+    {
+        // A session was left over, probably from a prior daemon that crashed.
+        // Stop it and start a new one.
+        qInfo() << "Stopping existing ETW session";
+        ::ControlTraceW(0, etwSessionName, &initProperties(propsBuf, false),
+                        EVENT_TRACE_CONTROL_STOP);
+        startErr = ::StartTraceW(&session, etwSessionName,
+                                 &initProperties(propsBuf, msFlushTimer));
+    }
+    return startErr;
+}
+
+void WINAPI WinAppMonitor::EtwProcessTrace::onEventRecord(PEVENT_RECORD pEvent)
+{
+    if(!pEvent || !pEvent->UserContext)
+        return;
+    const EVENT_HEADER &header = pEvent->EventHeader;
+    if(header.ProviderId != kernelProcessProvider ||
+        header.EventDescriptor.Id != processStartEventId)
+    {
+        return;
+    }
+
+    // All versions of ProcessStart begin with ProcessID (UInt32), CreateTime
+    // (FILETIME), and ParentProcessID (UInt32).
+    DWORD pid, parentPid;
+    FILETIME createTime;
+    if(pEvent->UserDataLength < sizeof(pid) + sizeof(createTime) + sizeof(parentPid))
+        return;
+    const unsigned char *pData = reinterpret_cast<const unsigned char*>(pEvent->UserData);
+    std::memcpy(&pid, pData, sizeof(pid));
+    pData += sizeof(pid);
+    std::memcpy(&createTime, pData, sizeof(createTime));
+    pData += sizeof(createTime);
+    std::memcpy(&parentPid, pData, sizeof(parentPid));
+
+    // Queue the event to the monitor's thread.  The trace is destroyed (and
+    // this thread joined) before the monitor, so the monitor is still valid.
+    WinAppMonitor *pMonitor = &reinterpret_cast<EtwProcessTrace*>(pEvent->UserContext)->_monitor;
+    QMetaObject::invokeMethod(pMonitor, [pMonitor, pid, parentPid, createTime]()
+        {
+            pMonitor->onEtwProcessStart(pid, parentPid, createTime);
+        }, Qt::QueuedConnection);
+}
+
+bool WinAppMonitor::EtwProcessTrace::init()
+{
+    ULONG startErr = startSession(_session, true);
+    // The millisecond flush timer isn't supported on Windows 7, fall back to
+    // the default one-second timer
+    if(startErr == ERROR_INVALID_PARAMETER)
+    {
+        qInfo() << "Millisecond ETW flush timer not supported, using default";
+        startErr = startSession(_session, false);
+    }
+    if(startErr != ERROR_SUCCESS)
+    {
+        qWarning() << "Unable to start ETW session -" << SystemError{HERE, startErr};
+        _session = 0;
+        return false;
+    }
+
+    ULONG enableErr = ::EnableTraceEx2(_session, &kernelProcessProvider,
+                                       EVENT_CONTROL_CODE_ENABLE_PROVIDER,
+                                       TRACE_LEVEL_INFORMATION,
+                                       kernelProcessKeyword, 0, 0, nullptr);
+    if(enableErr != ERROR_SUCCESS)
+    {
+        qWarning() << "Unable to enable kernel process provider -"
+            << SystemError{HERE, enableErr};
+        return false;
+    }
+
+    // OpenTraceW() takes a non-const name, but doesn't modify it
+    std::wstring sessionName{etwSessionName};
+    EVENT_TRACE_LOGFILEW logFile{};
+    logFile.LoggerName = &sessionName[0];
+    logFile.ProcessTraceMode = PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD;
+    logFile.EventRecordCallback = &EtwProcessTrace::onEventRecord;
+    logFile.Context = this;
+    _consumer = ::OpenTraceW(&logFile);
+    if(_consumer == INVALID_PROCESSTRACE_HANDLE)
+    {
+        qWarning() << "Unable to open ETW session -" << SystemError{HERE, ::GetLastError()};
+        return false;
+    }
+
+    _processThread = std::thread{[this]()
+        {
+            ULONG processErr = ::ProcessTrace(&_consumer, 1, nullptr, nullptr);
+            if(processErr != ERROR_SUCCESS && processErr != ERROR_CANCELLED)
+                qWarning() << "ETW session ended -" << SystemError{HERE, processErr};
+        }};
+
+    return true;
+}
+
+WinAppMonitor::WinAppMonitor(WorkerPool &pool)
+    : _resolveGeneration{0},
+      _pResolveSignerCache{std::make_shared<WinAppTracker::SignerCache>()},
+      _resolveQueue{pool, QStringLiteral("splittunnel"), WorkerPool::Priority::Normal}
+{
+    // When an app is updated, its executables may change.  Resolve the rules
+    // again after the directory changes settle.  (Don't restart the timer,
+    // like _appIdsChangedTimer.)
+    _watchDirsTimer.setSingleShot(true);
+    _watchDirsTimer.setInterval(msec32(watchDirsChangedDelay));
+    connect(&_watchDirsTimer, &QTimer::timeout, this, &WinAppMonitor::resolveRules);
+    connect(&_watchDirsWatcher, &QFileSystemWatcher::directoryChanged, this,
+        [this](const QString &dir)
+        {
+            if(!_watchDirsTimer.isActive())
+            {
+                qInfo() << "App directory changed, will resolve split tunnel rules again:" << dir;
+                _watchDirsTimer.start();
+            }
+        });
+
+    // Don't restart the timer if it's already running - a steady stream of
+    // process events shouldn't hold off the firewall update indefinitely.
+    // (The tracker may emit this from a WMI thread; the connection is queued
+    // in that case so the timer is only used from this thread.)
+    _appIdsChangedTimer.setSingleShot(true);
+    _appIdsChangedTimer.setInterval(appIdsChangedDelay);
+    connect(&_appIdsChangedTimer, &QTimer::timeout, this,
             &WinAppMonitor::appIdsChanged);
+    connect(&_tracker, &WinSplitTunnelTracker::appIdsChanged, this, [this]()
+        {
+            if(!_appIdsChangedTimer.isActive())
+                _appIdsChangedTimer.start();
+        });
 
     // Create the WMI locator
     auto pLocator = WinComPtr<IWbemLocator>::createInprocInst(CLSID_WbemLocator, IID_IWbemLocator);
@@ -1035,9 +1389,29 @@ WinAppMonitor::~WinAppMonitor()
 
 void WinAppMonitor::activate()
 {
-    if(_pSink || _pSinkStubSink)
+    if(_pEtwTrace || _pSink || _pSinkStubSink)
         return; // Already active, skip trace
 
+    if(activateEtw())
+        return;
+    activateWmi();
+}
+
+bool WinAppMonitor::activateEtw()
+{
+    qInfo() << "Activating ETW monitor";
+    _pEtwTrace = EtwProcessTrace::start(*this);
+    if(!_pEtwTrace)
+    {
+        qWarning() << "Unable to activate ETW monitor, falling back to WMI";
+        return false;
+    }
+    qInfo() << "Successfully activated ETW monitor";
+    return true;
+}
+
+void WinAppMonitor::activateWmi()
+{
     if(!_pSvcs)
     {
         qWarning() << "Can't activate monitor, couldn't connect to WMI";
@@ -1102,6 +1476,12 @@ void WinAppMonitor::activate()
 
 void WinAppMonitor::deactivate()
 {
+    if(_pEtwTrace)
+    {
+        qInfo() << "Deactivating ETW monitor";
+        _pEtwTrace.reset();
+    }
+
     if(!_pSinkStubSink && !_pSink)
         return; // Skip trace
 
@@ -1116,9 +1496,105 @@ void WinAppMonitor::deactivate()
     _pSink.reset();
 }
 
+void WinAppMonitor::onEtwProcessStart(DWORD pid, DWORD parentPid,
+                                      FILETIME createTime)
+{
+    // Ignore events that were still queued when the trace was stopped
+    if(!_pEtwTrace)
+        return;
+    if(!pid || !parentPid)
+        return;
+
+    qInfo() << "Parent" << parentPid << "->" << pid;
+
+    // Open the process
+    WinHandle procHandle{::OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | SYNCHRONIZE, FALSE, pid)};
+    if(!procHandle)
+    {
+        qWarning() << "Unable to open process" << pid;
+        return;
+    }
+
+    // Check if it's really the right process.  Unlike WMI, the event has the
+    // exact creation time, so any difference means the PID was reused.
+    FILETIME actualCreateTime, ignored1, ignored2, ignored3;
+    if(!::GetProcessTimes(procHandle.get(), &actualCreateTime, &ignored1,
+                          &ignored2, &ignored3))
+    {
+        qWarning() << "Unable to get creation time of" << pid;
+        return;
+    }
+    if(::CompareFileTime(&actualCreateTime, &createTime) != 0)
+    {
+        qWarning() << "Ignoring PID" << pid
+            << "- PID was reused.  Expected creation time"
+            << FileTimeTracer{createTime} << "- got"
+            << FileTimeTracer{actualCreateTime};
+        return;
+    }
+
+    // Open the parent process and check that it wasn't reused, as in
+    // WbemEventSink::readNewProcess()
+    WinHandle parentHandle{::OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | SYNCHRONIZE, FALSE, parentPid)};
+    FILETIME parentCreateTime;
+    if(!::GetProcessTimes(parentHandle.get(), &parentCreateTime, &ignored1,
+                          &ignored2, &ignored3))
+    {
+        qWarning() << "Unable to get creation time of" << parentPid
+            << "(parent of" << pid << ")";
+        return;
+    }
+    if(::CompareFileTime(&parentCreateTime, &actualCreateTime) > 0)
+    {
+        qWarning() << "Ignoring PID" << pid
+            << "- parent PID" << parentPid << "was reused.  Child was created at"
+            << FileTimeTracer{actualCreateTime} << "- parent reported"
+            << FileTimeTracer{parentCreateTime};
+        return;
+    }
+
+    _tracker.processCreated(std::move(procHandle), pid,
+                            std::move(parentHandle), parentPid);
+}
+
 void WinAppMonitor::setSplitTunnelRules(const QVector<SplitTunnelRule> &rules)
 {
-    if(_tracker.setSplitTunnelRules(rules))
+    // Nothing to resolve again if the rules did not change
+    if(rules == _rules)
+        return;
+    _rules = rules;
+    resolveRules();
+}
+
+void WinAppMonitor::resolveRules()
+{
+    _watchDirsTimer.stop();
+    unsigned generation = ++_resolveGeneration;
+    _resolveQueue.run([rules = _rules, pSignerCache = _pResolveSignerCache]()
+        {
+            // Pool threads don't initialize COM, which is needed to read links
+            WinComInit comInit;
+            return std::make_shared<WinResolvedRules>(WinSplitTunnelTracker::resolveRules(rules, *pSignerCache));
+        })
+        ->notify(this, [this, generation](const Error &err, const std::shared_ptr<WinResolvedRules> &pRules)
+        {
+            // Ignore the result if the rules have changed since
+            if(generation != _resolveGeneration)
+                return;
+            if(err || !pRules)
+            {
+                qWarning() << "Unable to resolve split tunnel rules:" << err;
+                return;
+            }
+            applyResolvedRules(std::move(*pRules));
+        });
+}
+
+void WinAppMonitor::applyResolvedRules(WinResolvedRules rules)
+{
+    QStringList watchDirs = std::move(rules._watchDirs);
+
+    if(_tracker.setResolvedRules(std::move(rules)))
     {
         activate();
     }
@@ -1126,11 +1602,19 @@ void WinAppMonitor::setSplitTunnelRules(const QVector<SplitTunnelRule> &rules)
     {
         deactivate();
     }
+
+    // Watch the directories of the new apps
+    QStringList oldDirs = _watchDirsWatcher.directories();
+    if(!oldDirs.isEmpty())
+        _watchDirsWatcher.removePaths(oldDirs);
+    if(!watchDirs.isEmpty())
+        _watchDirsWatcher.addPaths(watchDirs);
 }
 
 void WinAppMonitor::dump() const
 {
     qInfo() << "_pSvcs:" << !!_pSvcs << "- pSink:" << !!_pSink
-        << "- pSinkStubSink:" << !!_pSinkStubSink;
+        << "- pSinkStubSink:" << !!_pSinkStubSink << "- pEtwTrace:"
+        << !!_pEtwTrace;
     _tracker.dump();
 }
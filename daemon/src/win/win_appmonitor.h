@@ -25,11 +25,18 @@
 #include "settings.h"
 #include "win_firewall.h"
 #include "win/win_com.h"
+#include "workerpool.h"
+#include <QFileSystemWatcher>
 #include <QWinEventNotifier>
+#include <QTimer>
+#include <QHash>
+#include <QDateTime>
 #include <WbemIdl.h>
 #include <set>
 #include <unordered_set>
 #include <unordered_map>
+#include <memory>
+#include <vector>
 
 struct PtrValueLess
 {
@@ -40,6 +47,48 @@ struct PtrValueLess
     }
 };
 
+struct PtrValueHash
+{
+    template<class Ptr_t>
+    std::size_t operator()(const Ptr_t &value) const
+    {
+        return std::hash<std::decay_t<decltype(*value)>>{}(*value);
+    }
+};
+
+struct PtrValueEqual
+{
+    template<class Ptr_t>
+    bool operator()(const Ptr_t &first, const Ptr_t &second) const
+    {
+        return *first == *second;
+    }
+};
+
+// An app ID found from a split tunnel rule, with its executable path and the
+// signer names used to match its descendants.
+//
+// Resolving these from the rules is expensive (reading shell links, UWP
+// manifests, and signatures), so WinAppMonitor does it on a worker thread and
+// then gives the result to the trackers.
+struct WinResolvedApp
+{
+    AppIdKey _appId;
+    std::wstring _targetPath;
+    std::set<std::wstring> _signerNames;
+};
+
+// Split tunnel rules resolved by WinSplitTunnelTracker::resolveRules()
+struct WinResolvedRules
+{
+    std::vector<WinResolvedApp> _vpnOnly;
+    std::vector<WinResolvedApp> _excluded;
+    // Directories that contain the resolved apps.  WinAppMonitor watches these
+    // to resolve the rules again when an app is updated (the link target or
+    // UWP install directory may change).
+    QStringList _watchDirs;
+};
+
 // WinAppTracker is part of the implementation of WinAppMonitor.  It keeps track
 // of the current set of excluded apps, and it is notified when processes are
 // created/destroyed.
@@ -102,6 +151,18 @@ private:
     // way to look up processes by PID alone.
     using ProcDataMap = std::unordered_map<Pid_t, ProcessData>;
 
+public:
+    // Signer names found for an executable, along with the file's size and
+    // modification time when they were read, so a changed file is re-read.
+    struct CachedSigners
+    {
+        QDateTime _lastModified;
+        qint64 _size;
+        std::set<std::wstring> _signerNames;
+    };
+    // Signer names keyed by executable path
+    using SignerCache = QHash<QString, CachedSigners>;
+
 public:
     explicit WinAppTracker(SplitType type);
 
@@ -109,11 +170,30 @@ public:
     // Get all the current known app IDs for this rule type.
     std::set<const AppIdKey *, PtrValueLess> getAppIds() const;
 
-    // Set the current split tunnel rules.  Returns true if we need to monitor
-    // for process creation (returns false if there is no way processCreated()
-    // would ever match a process, which allows WinAppMonitor to shut down the
-    // monitor when not needed).
-    bool setSplitTunnelRules(const QVector<SplitTunnelRule> &rules);
+    // Resolve the split tunnel rules of a given type to app IDs.  This can be
+    // used on any thread that has initialized COM.  Directories containing the
+    // apps found are added to watchDirs.
+    //
+    // Signer names are read using signerCache, so resolving a large rule list
+    // again after a small change only reads the signatures of new or modified
+    // executables.  The cache must not be used by any other thread at the same
+    // time.
+    static std::vector<WinResolvedApp> resolveRules(SplitType type,
+                                                    const QVector<SplitTunnelRule> &rules,
+                                                    QStringList &watchDirs,
+                                                    SignerCache &signerCache);
+
+    // Get the signer names of an executable, using signerCache if possible.
+    // The cache is cleared if it would exceed maxEntries.
+    static const std::set<std::wstring> &getCachedSigners(SignerCache &signerCache,
+                                                          const QString &imgPath,
+                                                          int maxEntries);
+
+    // Set the current apps resolved from the split tunnel rules.  Returns true
+    // if we need to monitor for process creation (returns false if there is no
+    // way processCreated() would ever match a process, which allows
+    // WinAppMonitor to shut down the monitor when not needed).
+    bool setResolvedApps(std::vector<WinResolvedApp> apps);
 
     // Check if a newly created process matches one of our app rules (directly,
     // not as a descendant).  If it does, this takes the process handle and app
@@ -142,6 +222,12 @@ public:
     void dump() const;
 
 private:
+    // Find the app for an app ID using _appIndex; returns _apps.end() if it
+    // isn't found.
+    ExcludedApps_t::iterator findApp(const AppIdKey &appId);
+    // Get the signer names of an executable, using _signerCache if possible.
+    const std::set<std::wstring> &getSigners(const QString &imgPath);
+
     void addSplitProcess(ExcludedApps_t::iterator itMatchingApp,
                          WinHandle procHandle, Pid_t pid, AppIdKey appId);
 
@@ -163,7 +249,16 @@ private:
     // These are the current app IDs for this rule type, along with all PIDs
     // currently associated with those app IDs.
     ExcludedApps_t _apps;
+    // Hash index of _apps, so new processes can be matched by hashing their
+    // app ID once rather than comparing it to the app IDs in _apps.  Rebuilt
+    // when the rules change (keys point to the keys in _apps).
+    std::unordered_map<const AppIdKey*, ExcludedApps_t::iterator, PtrValueHash,
+                       PtrValueEqual> _appIndex;
     std::unordered_map<Pid_t, ProcessData> _procData;
+    // Signer names of executables checked as possible descendants - many
+    // processes from the same few executables are usually checked, and reading
+    // signatures is expensive.  Keyed by image path.
+    SignerCache _signerCache;
 };
 
 // WinSplitTunnelTracker managers WinAppTracker objects for each type of split
@@ -193,9 +288,14 @@ public:
     std::set<const AppIdKey*, PtrValueLess> getExcludedAppIds() const;
     std::set<const AppIdKey*, PtrValueLess> getVpnOnlyAppIds() const;
 
-    // Set the current split tunnel rules.  Returns true if we need to monitor
-    // for process creation (if any rule type returned true).
-    bool setSplitTunnelRules(const QVector<SplitTunnelRule> &rules);
+    // Resolve split tunnel rules for setResolvedRules(); see
+    // WinAppTracker::resolveRules().
+    static WinResolvedRules resolveRules(const QVector<SplitTunnelRule> &rules,
+                                         WinAppTracker::SignerCache &signerCache);
+
+    // Set the current resolved rules.  Returns true if we need to monitor for
+    // process creation (if any rule type returned true).
+    bool setResolvedRules(WinResolvedRules rules);
 
     // A process has been created.
     void processCreated(WinHandle procHandle, Pid_t pid,
@@ -226,27 +326,45 @@ private:
 // which in turn invokes the actual application.  There's no reliable way to
 // determine what the "actual" application is going to be ahead of time, instead
 // we watch what the app does at runtime.
+//
+// Process creation is observed with a real-time ETW session on the
+// Microsoft-Windows-Kernel-Process provider when possible, which delivers
+// events as processes are created.  If that session can't be started, this
+// falls back to a WMI instance creation query, which polls once per second.
 class WinAppMonitor : public QObject
 {
     Q_OBJECT
 
 private:
     class WbemEventSink;
+    class EtwProcessTrace;
 
 public:
-    WinAppMonitor();
+    // The split tunnel rules are resolved on a queue in 'pool'
+    WinAppMonitor(WorkerPool &pool);
     ~WinAppMonitor();
 
 private:
+    // Resolve _rules on _resolveQueue, then apply them to the tracker
+    void resolveRules();
+    void applyResolvedRules(WinResolvedRules rules);
     void activate();
+    bool activateEtw();
+    void activateWmi();
     void deactivate();
+    // A process start event was received from the ETW trace (invoked on the
+    // monitor's thread).  The exact creation time from the event is used to
+    // detect PID reuse.
+    void onEtwProcessStart(DWORD pid, DWORD parentPid, FILETIME createTime);
 
 public:
     // Get the current excluded app IDs; see WinAppTracker.
     std::set<const AppIdKey*, PtrValueLess> getExcludedAppIds() const {return _tracker.getExcludedAppIds();}
     std::set<const AppIdKey*, PtrValueLess> getVpnOnlyAppIds() const {return _tracker.getVpnOnlyAppIds();}
 
-    // Set the current split tunnel rules
+    // Set the current split tunnel rules.  The rules are resolved in the
+    // background, and again whenever the directories of the resolved apps
+    // change; appIdsChanged() is emitted when the new app IDs are applied.
     void setSplitTunnelRules(const QVector<SplitTunnelRule> &rules);
 
     // Dump the diagnostics debug logs
@@ -255,16 +373,40 @@ public:
 signals:
     // The current set of excluded app IDs has changed.  (Get the current list
     // with getExcludedAppIds().)
+    //
+    // Changes from the tracker are coalesced for a short time, so an app that
+    // launches several processes at once causes one firewall update.
     void appIdsChanged();
 
 private:
     WinSplitTunnelTracker _tracker;
+    // Started when the tracker's app IDs change, emits appIdsChanged() when it
+    // elapses.
+    QTimer _appIdsChangedTimer;
     // IWbemServices is loaded at startup, this is always valid if we were able
     // to connect to WMI.
     WinComPtr<IWbemServices> _pSvcs;
     // The sink and stub are created only when notifications are active.
     WinComPtr<WbemEventSink> _pSink;
     WinComPtr<IWbemObjectSink> _pSinkStubSink;
+    // The ETW trace is created only when notifications are active, the WMI
+    // sink is only used if this couldn't be started.
+    std::unique_ptr<EtwProcessTrace> _pEtwTrace;
+    // The current split tunnel rules, and a counter incremented for each
+    // resolve so only the result of the latest one is applied
+    QVector<SplitTunnelRule> _rules;
+    unsigned _resolveGeneration;
+    // Watches the directories of the resolved apps; _watchDirsTimer delays the
+    // re-resolve since updates change many files
+    QFileSystemWatcher _watchDirsWatcher;
+    QTimer _watchDirsTimer;
+    // Signer names read while resolving rules.  Only used by the work on
+    // _resolveQueue, which runs one item at a time; shared so it outlives any
+    // work still running when WinAppMonitor is destroyed.
+    std::shared_ptr<WinAppTracker::SignerCache> _pResolveSignerCache;
+    // Rules are resolved on this queue.  The work only uses copies of the
+    // rules, the results are applied on this thread.
+    WorkerQueue _resolveQueue;
 };
 
 #endif
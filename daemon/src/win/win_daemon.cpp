@@ -24,11 +24,24 @@
 #include "win_appmanifest.h"
 #include "win/win_winrtloader.h"
 #include "path.h"
+#include "tracing.h"
 #include "win.h"
 #include "../../extras/installer/win/tap.inl"
+#include <QFile>
+#include <algorithm>
 
 // The 'bind' callout GUID is the GUID used in 1.7 and earlier; the WFP callout
 // only handled the bind layer in those releases.
+namespace
+{
+    // Name of the WinTUN adapter used when DaemonSettings::windowsDriver is
+    // "wintun"
+    const wchar_t wintunAdapterName[] = L"Private Internet Access WinTUN";
+    // Marker file (in the daemon data directory) that exists while the
+    // callout driver is being preloaded; see preloadCalloutDriver()
+    const QString calloutPreloadMarker{QStringLiteral("callout-preload")};
+}
+
 GUID PIA_WFP_CALLOUT_BIND_V4 = {0xb16b0a6e, 0x2b2a, 0x41a3, { 0x8b, 0x39, 0xbd, 0x3f, 0xfc, 0x85, 0x5f, 0xf8 } };
 GUID PIA_WFP_CALLOUT_CONNECT_V4 = { 0xb80ca14a, 0xa807, 0x4ef2, { 0x87, 0x2d, 0x4b, 0x1a, 0x51, 0x82, 0x54, 0x2 } };
 
@@ -184,24 +197,37 @@ void WINAPI WinDaemon::ipChangeCallback(PVOID callerContext,
 WinDaemon::WinDaemon(const QStringList& arguments, QObject* parent)
     : Daemon(arguments, parent)
     , MessageWnd(WindowType::Invisible)
-    , _firewall(new FirewallEngine(this))
+    , _firewall(nullptr)
     , _hnsdAppId{nullptr, Path::HnsdExecutable}
     , _lastConnected{false}
     , _ipNotificationHandle(nullptr)
     , _wfpCalloutMonitor{L"PiaWfpCallout"}
+    , _appMonitor{_workerPool}
+    , _calloutStarted{false}
+    , _calloutPreloading{false}
+    , _calloutQueue{_workerPool, QStringLiteral("callout"), WorkerPool::Priority::Background}
 {
     _filters = FirewallFilters{};
     _filterAdapterLuid = 0;
-
-    if (!_firewall->open() || !_firewall->installProvider())
-    {
-        qCritical() << "Unable to initialize WFP firewall";
-        delete _firewall;
-        _firewall = nullptr;
-    }
+    _lastFirewallParamsValid = false;
+
+    // The WFP setup (particularly removing leftover objects) is the slowest
+    // part of startup, and the SCM waits for us to report that the service is
+    // running, which holds up boot and post-update starts.  If the killswitch
+    // is always on, get the firewall up before that so the block rules are
+    // applied as early as possible.  Otherwise, defer it until the event loop
+    // starts - that's after Daemon::start() has started the IPC server and the
+    // service has reported that it's running.
+    if(_settings.killswitch() == QStringLiteral("on"))
+        initializeFirewall();
     else
     {
-        _firewall->removeAll();
+        QMetaObject::invokeMethod(this, [this]()
+            {
+                initializeFirewall();
+                // Apply the rules now; any earlier attempts were skipped
+                queueApplyFirewallRules();
+            }, Qt::QueuedConnection);
     }
 
     auto notifyResult = ::NotifyIpInterfaceChange(AF_UNSPEC, &ipChangeCallback,
@@ -216,6 +242,9 @@ WinDaemon::WinDaemon(const QStringList& arguments, QObject* parent)
             [this](DaemonState::NetExtensionState extState)
             {
                 state().netExtensionState(qEnumToString(extState));
+                // A newly installed or removed driver isn't running
+                _calloutStarted = false;
+                preloadCalloutDriver();
             });
     state().netExtensionState(qEnumToString(_wfpCalloutMonitor.lastState()));
     qInfo() << "Initial callout driver state:" << state().netExtensionState();
@@ -232,7 +261,26 @@ WinDaemon::WinDaemon(const QStringList& arguments, QObject* parent)
     connect(&_settings, &DaemonSettings::splitTunnelEnabledChanged, this, [this]()
     {
         _wfpCalloutMonitor.doManualCheck();
+        preloadCalloutDriver();
     });
+    preloadCalloutDriver();
+}
+
+void WinDaemon::initializeFirewall()
+{
+    TraceSpan span{"daemon", QStringLiteral("WinDaemon::initializeFirewall")};
+
+    _firewall = new FirewallEngine(this);
+    if (!_firewall->open() || !_firewall->installProvider())
+    {
+        qCritical() << "Unable to initialize WFP firewall";
+        delete _firewall;
+        _firewall = nullptr;
+    }
+    else
+    {
+        _firewall->removeAll();
+    }
 }
 
 WinDaemon::WinDaemon(QObject* parent)
@@ -246,7 +294,11 @@ WinDaemon::~WinDaemon()
     if (_firewall)
     {
         qInfo() << "Cleaning up WFP objects";
-        _firewall->removeAll();
+        // Everything left over from prior instances was removed at startup, so
+        // just remove what we added.  Fall back to enumerating all our layers
+        // if this fails for any reason.
+        if(!_firewall->removeAdded())
+            _firewall->removeAll();
         _firewall->uninstallProvider();
         _firewall->checkLeakedObjects();
     }
@@ -269,9 +321,22 @@ WinDaemon::~WinDaemon()
 
 QSharedPointer<NetworkAdapter> WinDaemon::getNetworkAdapter()
 {
-    // For robustness, when making a connection, we always re-query for the
-    // network adapter, in case the change notifications aren't 100% reliable.
-    // Also update the DaemonState accordingly to keep everything in sync.
+    // Use the cached adapter if it still exists.  The cache is discarded when
+    // interfaces are added or removed, but for robustness (in case the change
+    // notifications aren't 100% reliable), the LUID is still checked each
+    // time - this is a single interface lookup rather than an enumeration of
+    // all adapters.
+    bool wantWintun = _settings.windowsDriver() == QStringLiteral("wintun");
+    if(_pCachedAdapter && _pCachedAdapter->isWintun != wantWintun)
+        _pCachedAdapter.reset();
+    if(_pCachedAdapter && validateCachedAdapter())
+    {
+        state().tapAdapterMissing(false);
+        return _pCachedAdapter;
+    }
+
+    // Otherwise, enumerate the adapters.  Also update the DaemonState
+    // accordingly to keep everything in sync.
     auto adapters = getAllNetworkAdapters();
     if (adapters.size() == 0)
     {
@@ -290,7 +355,36 @@ QSharedPointer<NetworkAdapter> WinDaemon::getNetworkAdapter()
     // those checks to show spurious errors (they're normally suppressed due to
     // entering the grace period after the "suspend" notification).
     state().tapAdapterMissing(false);
-    return adapters[0];
+    _pCachedAdapter = adapters[0];
+    if(wantWintun)
+    {
+        auto itWintun = std::find_if(adapters.begin(), adapters.end(),
+            [](const auto &pAdapter){return pAdapter->isWintun;});
+        if(itWintun != adapters.end())
+            _pCachedAdapter = *itWintun;
+        else
+            qWarning() << "WinTUN adapter not found, using TAP adapter";
+    }
+    return _pCachedAdapter;
+}
+
+bool WinDaemon::validateCachedAdapter()
+{
+    Q_ASSERT(_pCachedAdapter);  // Checked by caller
+
+    MIB_IF_ROW2 row{};
+    row.InterfaceLuid.Value = _pCachedAdapter->luid;
+    DWORD err = ::GetIfEntry2(&row);
+    if(err != NO_ERROR)
+    {
+        qInfo() << "Cached TAP adapter" << _pCachedAdapter->luid
+            << "is no longer present:" << err;
+        _pCachedAdapter.reset();
+        return false;
+    }
+
+    _pCachedAdapter->connectionName = QString::fromWCharArray(row.Alias);
+    return true;
 }
 
 QList<QSharedPointer<WinNetworkAdapter>> WinDaemon::getAllNetworkAdapters()
@@ -321,25 +415,41 @@ QList<QSharedPointer<WinNetworkAdapter>> WinDaemon::getAllNetworkAdapters()
     if (error != ERROR_SUCCESS)
         throw SystemError(HERE, error);
 
+    QList<QSharedPointer<WinNetworkAdapter>> wintunAdapters;
     for (auto address = addresses; address; address = address->Next)
     {
-        if (address->Description && wcsstr(address->Description, L"Private Internet Access Network Adapter") != NULL)
+        bool isTap = address->Description && wcsstr(address->Description, L"Private Internet Access Network Adapter") != NULL;
+        // WinTUN adapters all have the same description, ours is identified
+        // by its name
+        bool isWintun = !isTap && address->Description && address->FriendlyName &&
+            wcsstr(address->Description, L"Wintun") != NULL &&
+            wcscmp(address->FriendlyName, wintunAdapterName) == 0;
+        if (isTap || isWintun)
         {
             auto adapter = QSharedPointer<WinNetworkAdapter>::create(address->AdapterName);
             adapter->luid = address->Luid.Value;
             adapter->ifIndex = address->IfIndex;
             adapter->adapterName = QString::fromWCharArray(address->Description);
             adapter->connectionName = QString::fromWCharArray(address->FriendlyName);
-            adapter->isCustomTap = true;
-            adapters.append(std::move(adapter));
+            adapter->isCustomTap = isTap;
+            adapter->isWintun = isWintun;
+            if(isWintun)
+                wintunAdapters.append(std::move(adapter));
+            else
+                adapters.append(std::move(adapter));
         }
     }
     free(addresses);
+    // TAP adapters go first, so the first adapter is the TAP adapter if there
+    // is one; getNetworkAdapter() looks for WinTUN if it's selected
+    adapters.append(wintunAdapters);
     return adapters;
 }
 
 void WinDaemon::checkNetworkAdapter()
 {
+    // The adapters have changed, find the adapter again.
+    _pCachedAdapter.reset();
     // To check the network adapter state, just call getNetworkAdapter() and let
     // it update DaemonState.  Ignore the result and any exception for a missing
     // adapter.
@@ -355,16 +465,13 @@ void WinDaemon::checkNetworkAdapter()
 
 void WinDaemon::onAboutToConnect()
 {
-    // Reapply split tunnel rules.  If an app updates, the executables found
-    // from the rules might change (likely for UWP apps because the package
-    // install paths are versioned, less likely for native apps but possible if
-    // the link target changes).
-    //
-    // If this does happen, this means the user may have to reconnect for the
-    // updated rules to apply, but this is much better than restarting the
-    // service or having to make a change to the rules just to force this
-    // update.
-    _appMonitor.setSplitTunnelRules(_settings.splitTunnelRules());
+    // The split tunnel rules don't need to be reapplied here.  If an app
+    // updates, the executables found from the rules might change (likely for
+    // UWP apps because the package install paths are versioned, less likely
+    // for native apps but possible if the link target changes), but
+    // WinAppMonitor watches the apps' directories and resolves the rules again
+    // in the background when they change.  Resolving them here would delay
+    // every connection.
 
     // If the WFP callout driver is installed but not loaded yet, load it now.
     // The driver is loaded this way for resiliency:
@@ -375,11 +482,22 @@ void WinDaemon::onAboutToConnect()
     //
     // This may slow down the first connection attempt slightly, but the driver
     // does not take long to load and the resiliency gains are worth this
-    // tradeoff.
+    // tradeoff.  When split tunnel is enabled, the driver is usually preloaded
+    // by preloadCalloutDriver() already.
 
     // Do a manual check of the callout state right now if needed
     _wfpCalloutMonitor.doManualCheck();
 
+    if(_calloutStarted)
+        return;
+    // If a preload is still running, don't wait for it here; the firewall
+    // rules are reapplied when it finishes.
+    if(_calloutPreloading)
+    {
+        qInfo() << "Callout driver is still being preloaded, not waiting for it";
+        return;
+    }
+
     // Skip this quickly if the driver isn't installed to avoid holding up
     // connections (don't open SCM or the service an additional time).
     // TODO - Also check master toggle for split tunnel
@@ -390,7 +508,11 @@ void WinDaemon::onAboutToConnect()
     }
 
     qInfo() << "Starting callout driver";
-    auto startResult = startCalloutDriver(10000);
+    traceCalloutStartResult(startCalloutDriver(10000));
+}
+
+void WinDaemon::traceCalloutStartResult(ServiceStatus startResult)
+{
     switch(startResult)
     {
         case ServiceStatus::ServiceNotInstalled:
@@ -400,9 +522,11 @@ void WinDaemon::onAboutToConnect()
             break;
         case ServiceStatus::ServiceAlreadyStarted:
             qInfo() << "Callout driver is already running";
+            _calloutStarted = true;
             break;
         case ServiceStatus::ServiceStarted:
             qInfo() << "Callout driver was started successfully";
+            _calloutStarted = true;
             break;
         case ServiceStatus::ServiceRebootNeeded:
             // TODO - Display this in the client UI
@@ -414,6 +538,53 @@ void WinDaemon::onAboutToConnect()
     }
 }
 
+void WinDaemon::preloadCalloutDriver()
+{
+    if(!_settings.splitTunnelEnabled() || _calloutStarted || _calloutPreloading ||
+       _wfpCalloutMonitor.lastState() != DaemonState::NetExtensionState::Installed)
+    {
+        return;
+    }
+
+    // Preloading gives up some of the resiliency of loading the driver only
+    // when connecting (see onAboutToConnect()) - if the driver crashed the
+    // system while loading, preloading on startup would crash it again on
+    // every boot.  To keep that from happening, a marker file is created while
+    // the driver is being preloaded.  If it still exists at the next preload,
+    // the last one didn't finish, so skip preloading and load the driver only
+    // when connecting from then on.
+    QFile marker{Path::DaemonDataDir / calloutPreloadMarker};
+    if(marker.exists())
+    {
+        qWarning() << "Last callout driver preload did not complete, loading it only when connecting";
+        return;
+    }
+    if(!marker.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "Can't create callout preload marker, not preloading driver";
+        return;
+    }
+    marker.close();
+
+    qInfo() << "Preloading callout driver";
+    _calloutPreloading = true;
+    _calloutQueue.run([](){return startCalloutDriver(10000);})
+        ->notify(this, [this](const Error &err, const ServiceStatus &startResult)
+        {
+            _calloutPreloading = false;
+            QFile::remove(Path::DaemonDataDir / calloutPreloadMarker);
+            if(err)
+            {
+                qWarning() << "Callout driver preload failed:" << err;
+                return;
+            }
+            traceCalloutStartResult(startResult);
+            // If a connection started while preloading, make sure the split
+            // tunnel rules are in place now that the driver is running.
+            queueApplyFirewallRules();
+        });
+}
+
 static void logFilter(const char* filterName, int currentState, bool enableCondition, bool invalidateCondition = false)
 {
     if (enableCondition ? currentState != 1 || invalidateCondition : currentState != 0)
@@ -516,6 +687,8 @@ void WinDaemon::applyFirewallRules(const FirewallParams& params)
         { \
             if ((filterVariable = _firewall->add(__VA_ARGS__)) == zeroGuid) { \
                 reportError(Error(HERE, Error::FirewallRuleFailed, { QStringLiteral(#filterVariable) })); \
+                /* Retry on the next update even if the params don't change */ \
+                _lastFirewallParamsValid = false; \
             } \
         } \
     } \
@@ -538,87 +711,101 @@ void WinDaemon::applyFirewallRules(const FirewallParams& params)
     } while(false)
 #define filterActive(filterVariable) (_filters.filterVariable != zeroGuid)
 
-    // Firewall rules, listed in order of ascending priority (as if the last
-    // matching rule applies, but note that it is the priority argument that
-    // actually determines precedence).
-
-    // As a bit of an exception to the normal firewall rule logic, the WFP
-    // rules handle the blockIPv6 rule by changing the priority of the IPv6
-    // part of the killswitch rule instead of having a dedicated IPv6 block.
-
-    // Block all other traffic when killswitch is enabled. If blockIPv6 is
-    // true, block IPv6 regardless of killswitch state.
-    logFilter("blockAll(IPv4)", _filters.blockAll[0], params.blockAll);
-    updateBooleanFilter(blockAll[0], params.blockAll,                     EverythingFilter<FWP_ACTION_BLOCK, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(0));
-    logFilter("blockAll(IPv6)", _filters.blockAll[1], params.blockAll || params.blockIPv6);
-    updateBooleanFilter(blockAll[1], params.blockAll || params.blockIPv6, EverythingFilter<FWP_ACTION_BLOCK, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V6>(params.blockIPv6 ? 4 : 0));
-
-    // Exempt traffic going over the TAP adapter used by OpenVPN.
-    UINT64 luid = networkAdapter ? networkAdapter->luid : 0;
-    logFilter("allowVPN", _filters.permitAdapter, luid && params.allowVPN, luid != _filterAdapterLuid);
-    updateBooleanInvalidateFilter(permitAdapter[0], luid && params.allowVPN, luid != _filterAdapterLuid, InterfaceFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(luid, 2));
-    updateBooleanInvalidateFilter(permitAdapter[1], luid && params.allowVPN, luid != _filterAdapterLuid, InterfaceFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V6>(luid, 2));
-    _filterAdapterLuid = luid;
-
-    // Note: This is where the IPv6 block rule is ordered if blockIPv6 is true.
-
-    // Exempt DHCP traffic.
-    logFilter("allowDHCP", _filters.permitDHCP, params.allowDHCP);
-    updateBooleanFilter(permitDHCP[0], params.allowDHCP, DHCPFilter<FWP_ACTION_PERMIT, FWP_IP_VERSION_V4>(6));
-    updateBooleanFilter(permitDHCP[1], params.allowDHCP, DHCPFilter<FWP_ACTION_PERMIT, FWP_IP_VERSION_V6>(6));
-
-    // Permit LAN traffic depending on settings
-    logFilter("allowLAN", _filters.permitLAN, params.allowLAN);
-    updateBooleanFilter(permitLAN[0], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(QStringLiteral("192.168.0.0/16"), 8));
-    updateBooleanFilter(permitLAN[1], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(QStringLiteral("172.16.0.0/12"), 8));
-    updateBooleanFilter(permitLAN[2], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(QStringLiteral("10.0.0.0/8"), 8));
-    updateBooleanFilter(permitLAN[3], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(QStringLiteral("224.0.0.0/4"), 8));
-    updateBooleanFilter(permitLAN[4], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(QStringLiteral("169.254.0.0/16"), 8));
-    updateBooleanFilter(permitLAN[5], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(QStringLiteral("255.255.255.255/32"), 8));
-    updateBooleanFilter(permitLAN[6], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V6>(QStringLiteral("fc00::/7"), 8));
-    updateBooleanFilter(permitLAN[7], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V6>(QStringLiteral("fe80::/10"), 8));
-    updateBooleanFilter(permitLAN[8], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V6>(QStringLiteral("ff00::/8"), 8));
-
-    // Add rules to block non-PIA DNS servers if connected and DNS leak protection is enabled
-    logFilter("blockDNS", _filters.blockDNS, params.blockDNS);
-    updateBooleanFilter(blockDNS[0], params.blockDNS, DNSFilter<FWP_ACTION_BLOCK, FWP_IP_VERSION_V4>(10));
-    updateBooleanFilter(blockDNS[1], params.blockDNS, DNSFilter<FWP_ACTION_BLOCK, FWP_IP_VERSION_V6>(10));
-    logFilter("allowDNS(1)", _filters.permitDNS[0], params.blockDNS && !dnsServers[0].isEmpty(), _dnsServers[0] != dnsServers[0]);
-    updateBooleanInvalidateFilter(permitDNS[0], params.blockDNS && !dnsServers[0].isEmpty(), _dnsServers[0] != dnsServers[0], IPAddressFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(dnsServers[0], 14));
-    _dnsServers[0] = dnsServers[0];
-    logFilter("allowDNS(2)", _filters.permitDNS[1], params.blockDNS && !dnsServers[1].isEmpty(), _dnsServers[1] != dnsServers[1]);
-    updateBooleanInvalidateFilter(permitDNS[1], params.blockDNS && !dnsServers[1].isEmpty(), _dnsServers[1] != dnsServers[1], IPAddressFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(dnsServers[1], 14));
-    _dnsServers[1] = dnsServers[1];
-
-    // Always permit traffic from known applications.
-    logFilter("allowPIA", _filters.permitPIA, params.allowPIA);
-    updateBooleanFilter(permitPIA[0], params.allowPIA, ApplicationFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(Path::ClientExecutable, 15));
-    updateBooleanFilter(permitPIA[1], params.allowPIA, ApplicationFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(Path::DaemonExecutable, 15));
-    updateBooleanFilter(permitPIA[2], params.allowPIA, ApplicationFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(Path::OpenVPNExecutable, 15));
-    updateBooleanFilter(permitPIA[3], params.allowPIA, ApplicationFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(Path::SupportToolExecutable, 15));
-    updateBooleanFilter(permitPIA[4], params.allowPIA, ApplicationFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(Path::SsLocalExecutable, 15));
-
-    // Handshake related filters
-    // (1) First we block everything coming from the handshake process
-    logFilter("allowHnsd (block everything)", _filters.blockHnsd, luid && params.allowHnsd, luid != _filterAdapterLuid);
-    updateBooleanInvalidateFilter(blockHnsd[0], luid && params.allowHnsd, luid != _filterAdapterLuid, ApplicationFilter<FWP_ACTION_BLOCK, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(Path::HnsdExecutable, 14));
-
-    // (2) Next we poke a hole in this block but only allow data that goes across the tunnel
-    logFilter("allowHnsd (tunnel traffic)", _filters.permitHnsd, luid && params.allowHnsd, luid != _filterAdapterLuid);
-    updateBooleanInvalidateFilter(permitHnsd[0], luid && params.allowHnsd, luid != _filterAdapterLuid, ApplicationFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(Path::HnsdExecutable, 15,
-        Condition<FWP_UINT64>{FWPM_CONDITION_IP_LOCAL_INTERFACE, FWP_MATCH_EQUAL, &luid},
-
-        // OR'ing of conditions is done automatically when you have 2 or more consecutive conditions of the same fieldId.
-        Condition<FWP_UINT16>{FWPM_CONDITION_IP_REMOTE_PORT, FWP_MATCH_EQUAL, 53},
-
-        // 13038 is the Handshake control port
-        Condition<FWP_UINT16>{FWPM_CONDITION_IP_REMOTE_PORT, FWP_MATCH_EQUAL, 13038}
-    ));
-
-    // Always permit loopback traffic, including IPv6.
-    logFilter("allowLoopback", _filters.permitLocalhost, params.allowLoopback);
-    updateBooleanFilter(permitLocalhost[0], params.allowLoopback, LocalhostFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(15));
-    updateBooleanFilter(permitLocalhost[1], params.allowLoopback, LocalhostFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V6>(15));
+    // The base filters depend only on the firewall params; skip all of them if
+    // nothing has changed since they were last applied.  This happens very
+    // frequently, since a lot of state changes trigger a firewall update
+    // (particularly while reconnecting).
+    if(_lastFirewallParamsValid && params == _lastFirewallParams)
+    {
+        qInfo() << "Firewall params have not changed, skipping base filters";
+    }
+    else
+    {
+        _lastFirewallParams = params;
+        _lastFirewallParamsValid = true;
+
+        // Firewall rules, listed in order of ascending priority (as if the last
+        // matching rule applies, but note that it is the priority argument that
+        // actually determines precedence).
+
+        // As a bit of an exception to the normal firewall rule logic, the WFP
+        // rules handle the blockIPv6 rule by changing the priority of the IPv6
+        // part of the killswitch rule instead of having a dedicated IPv6 block.
+
+        // Block all other traffic when killswitch is enabled. If blockIPv6 is
+        // true, block IPv6 regardless of killswitch state.
+        logFilter("blockAll(IPv4)", _filters.blockAll[0], params.blockAll);
+        updateBooleanFilter(blockAll[0], params.blockAll,                     EverythingFilter<FWP_ACTION_BLOCK, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(0));
+        logFilter("blockAll(IPv6)", _filters.blockAll[1], params.blockAll || params.blockIPv6);
+        updateBooleanFilter(blockAll[1], params.blockAll || params.blockIPv6, EverythingFilter<FWP_ACTION_BLOCK, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V6>(params.blockIPv6 ? 4 : 0));
+
+        // Exempt traffic going over the TAP adapter used by OpenVPN.
+        UINT64 luid = networkAdapter ? networkAdapter->luid : 0;
+        logFilter("allowVPN", _filters.permitAdapter, luid && params.allowVPN, luid != _filterAdapterLuid);
+        updateBooleanInvalidateFilter(permitAdapter[0], luid && params.allowVPN, luid != _filterAdapterLuid, InterfaceFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(luid, 2));
+        updateBooleanInvalidateFilter(permitAdapter[1], luid && params.allowVPN, luid != _filterAdapterLuid, InterfaceFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V6>(luid, 2));
+        _filterAdapterLuid = luid;
+
+        // Note: This is where the IPv6 block rule is ordered if blockIPv6 is true.
+
+        // Exempt DHCP traffic.
+        logFilter("allowDHCP", _filters.permitDHCP, params.allowDHCP);
+        updateBooleanFilter(permitDHCP[0], params.allowDHCP, DHCPFilter<FWP_ACTION_PERMIT, FWP_IP_VERSION_V4>(6));
+        updateBooleanFilter(permitDHCP[1], params.allowDHCP, DHCPFilter<FWP_ACTION_PERMIT, FWP_IP_VERSION_V6>(6));
+
+        // Permit LAN traffic depending on settings
+        logFilter("allowLAN", _filters.permitLAN, params.allowLAN);
+        updateBooleanFilter(permitLAN[0], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(QStringLiteral("192.168.0.0/16"), 8));
+        updateBooleanFilter(permitLAN[1], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(QStringLiteral("172.16.0.0/12"), 8));
+        updateBooleanFilter(permitLAN[2], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(QStringLiteral("10.0.0.0/8"), 8));
+        updateBooleanFilter(permitLAN[3], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(QStringLiteral("224.0.0.0/4"), 8));
+        updateBooleanFilter(permitLAN[4], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(QStringLiteral("169.254.0.0/16"), 8));
+        updateBooleanFilter(permitLAN[5], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(QStringLiteral("255.255.255.255/32"), 8));
+        updateBooleanFilter(permitLAN[6], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V6>(QStringLiteral("fc00::/7"), 8));
+        updateBooleanFilter(permitLAN[7], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V6>(QStringLiteral("fe80::/10"), 8));
+        updateBooleanFilter(permitLAN[8], params.allowLAN, IPSubnetFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V6>(QStringLiteral("ff00::/8"), 8));
+
+        // Add rules to block non-PIA DNS servers if connected and DNS leak protection is enabled
+        logFilter("blockDNS", _filters.blockDNS, params.blockDNS);
+        updateBooleanFilter(blockDNS[0], params.blockDNS, DNSFilter<FWP_ACTION_BLOCK, FWP_IP_VERSION_V4>(10));
+        updateBooleanFilter(blockDNS[1], params.blockDNS, DNSFilter<FWP_ACTION_BLOCK, FWP_IP_VERSION_V6>(10));
+        logFilter("allowDNS(1)", _filters.permitDNS[0], params.blockDNS && !dnsServers[0].isEmpty(), _dnsServers[0] != dnsServers[0]);
+        updateBooleanInvalidateFilter(permitDNS[0], params.blockDNS && !dnsServers[0].isEmpty(), _dnsServers[0] != dnsServers[0], IPAddressFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(dnsServers[0], 14));
+        _dnsServers[0] = dnsServers[0];
+        logFilter("allowDNS(2)", _filters.permitDNS[1], params.blockDNS && !dnsServers[1].isEmpty(), _dnsServers[1] != dnsServers[1]);
+        updateBooleanInvalidateFilter(permitDNS[1], params.blockDNS && !dnsServers[1].isEmpty(), _dnsServers[1] != dnsServers[1], IPAddressFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(dnsServers[1], 14));
+        _dnsServers[1] = dnsServers[1];
+
+        // Always permit traffic from known applications.
+        logFilter("allowPIA", _filters.permitPIA, params.allowPIA);
+        updateBooleanFilter(permitPIA[0], params.allowPIA, ApplicationFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(Path::ClientExecutable, 15));
+        updateBooleanFilter(permitPIA[1], params.allowPIA, ApplicationFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(Path::DaemonExecutable, 15));
+        updateBooleanFilter(permitPIA[2], params.allowPIA, ApplicationFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(Path::OpenVPNExecutable, 15));
+        updateBooleanFilter(permitPIA[3], params.allowPIA, ApplicationFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(Path::SupportToolExecutable, 15));
+        updateBooleanFilter(permitPIA[4], params.allowPIA, ApplicationFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(Path::SsLocalExecutable, 15));
+
+        // Handshake related filters
+        // (1) First we block everything coming from the handshake process
+        logFilter("allowHnsd (block everything)", _filters.blockHnsd, luid && params.allowHnsd, luid != _filterAdapterLuid);
+        updateBooleanInvalidateFilter(blockHnsd[0], luid && params.allowHnsd, luid != _filterAdapterLuid, ApplicationFilter<FWP_ACTION_BLOCK, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(Path::HnsdExecutable, 14));
+
+        // (2) Next we poke a hole in this block but only allow data that goes across the tunnel
+        logFilter("allowHnsd (tunnel traffic)", _filters.permitHnsd, luid && params.allowHnsd, luid != _filterAdapterLuid);
+        updateBooleanInvalidateFilter(permitHnsd[0], luid && params.allowHnsd, luid != _filterAdapterLuid, ApplicationFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(Path::HnsdExecutable, 15,
+            Condition<FWP_UINT64>{FWPM_CONDITION_IP_LOCAL_INTERFACE, FWP_MATCH_EQUAL, &luid},
+
+            // OR'ing of conditions is done automatically when you have 2 or more consecutive conditions of the same fieldId.
+            Condition<FWP_UINT16>{FWPM_CONDITION_IP_REMOTE_PORT, FWP_MATCH_EQUAL, 53},
+
+            // 13038 is the Handshake control port
+            Condition<FWP_UINT16>{FWPM_CONDITION_IP_REMOTE_PORT, FWP_MATCH_EQUAL, 13038}
+        ));
+
+        // Always permit loopback traffic, including IPv6.
+        logFilter("allowLoopback", _filters.permitLocalhost, params.allowLoopback);
+        updateBooleanFilter(permitLocalhost[0], params.allowLoopback, LocalhostFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V4>(15));
+        updateBooleanFilter(permitLocalhost[1], params.allowLoopback, LocalhostFilter<FWP_ACTION_PERMIT, FWP_DIRECTION_OUTBOUND, FWP_IP_VERSION_V6>(15));
+    }
 
     // Get the current set of excluded app IDs.  If they've changed we recreate
     // all app rules, but if they stay the same we don't recreate them.
@@ -663,6 +850,33 @@ void WinDaemon::removeSplitTunnelAppFilters(std::map<QByteArray, SplitAppFilters
     apps.clear();
 }
 
+void WinDaemon::removeStaleSplitTunnelAppFilters(std::map<QByteArray, SplitAppFilters> &apps,
+                                                 const std::set<const AppIdKey*, PtrValueLess> &newApps,
+                                                 const QString &traceType)
+{
+    for(auto itOldApp = apps.begin(); itOldApp != apps.end(); )
+    {
+        bool stillPresent = std::any_of(newApps.begin(), newApps.end(),
+            [&](const AppIdKey *pNewApp){return *pNewApp == itOldApp->first;});
+        if(stillPresent)
+        {
+            ++itOldApp;
+            continue;
+        }
+
+        const QByteArray &appId = itOldApp->first;
+        qInfo() << "remove" << traceType << "app filters:"
+            << QStringView{reinterpret_cast<const wchar_t*>(appId.data()),
+                           static_cast<qsizetype>(appId.size() / sizeof(wchar_t))};
+        deactivateFilter(itOldApp->second.splitAppBind, true);
+        deactivateFilter(itOldApp->second.splitAppConnect, true);
+        deactivateFilter(itOldApp->second.permitApp, true);
+        deactivateFilter(itOldApp->second.blockAppIpv4, true);
+        deactivateFilter(itOldApp->second.blockAppIpv6, true);
+        itOldApp = apps.erase(itOldApp);
+    }
+}
+
 void WinDaemon::createBypassAppFilters(std::map<QByteArray, SplitAppFilters> &apps,
                                        const WfpProviderContextObject &context,
                                        const AppIdKey &appId)
@@ -743,13 +957,10 @@ void WinDaemon::reapplySplitTunnelFirewall(const QString &newSplitTunnelIp,
 {
     bool sameExcludedApps = areAppsUnchanged(newExcludedApps, excludedApps);
     bool sameVpnOnlyApps = areAppsUnchanged(newVpnOnlyApps, vpnOnlyApps);
+    bool sameState = _lastSplitTunnelIp == newSplitTunnelIp &&
+        _lastTunnelIp == newTunnelIp && _lastConnected == hasConnected;
 
-    // If anything changes, we have to delete all filters and recreate
-    // everything.  WFP has been known to throw spurious errors if we try to
-    // reuse callout or context objects, so we delete everything in order to
-    // tear those down and recreate them.
-    if(sameExcludedApps && sameVpnOnlyApps && _lastSplitTunnelIp == newSplitTunnelIp &&
-        _lastTunnelIp == newTunnelIp && _lastConnected == hasConnected)
+    if(sameExcludedApps && sameVpnOnlyApps && sameState)
     {
         qInfo() << "Split tunnel rules have not changed - excluded:"
             << excludedApps.size() << "- VPN-only:" << vpnOnlyApps.size()
@@ -759,6 +970,60 @@ void WinDaemon::reapplySplitTunnelFirewall(const QString &newSplitTunnelIp,
         return;
     }
 
+    // We can only create exclude rules when the appropriate bind IP address is known
+    bool createExcludedRules = !newSplitTunnelIp.isEmpty() && !newExcludedApps.empty();
+    // VPN-only rules are applied even if the last tunnel IP is not known
+    // though; we still apply the block rule ("per-app killswitch") until the IP
+    // is known.
+    bool createVpnOnlyRules = !newVpnOnlyApps.empty();
+    // We create bind rules for VPN-only apps when connected and the IP is
+    // known; otherwise we just create a block rule (which does not require the
+    // callout/context objects).
+    bool createVpnOnlyBindRules = hasConnected && !newTunnelIp.isEmpty();
+    bool needCallouts = createExcludedRules || (createVpnOnlyRules && createVpnOnlyBindRules);
+
+    // If only the apps have changed, and the existing callout and context
+    // objects are still what we need, just add and remove filters for the apps
+    // that changed.  This is common, since apps are detected as they start
+    // and exit.
+    if(sameState && needCallouts == (_filters.splitCalloutBind != zeroGuid))
+    {
+        qInfo() << "Updating split tunnel app rules - excluded:"
+            << excludedApps.size() << "->" << newExcludedApps.size()
+            << "- VPN-only:" << vpnOnlyApps.size() << "->" << newVpnOnlyApps.size();
+        removeStaleSplitTunnelAppFilters(excludedApps, newExcludedApps,
+                                         QStringLiteral("excluded"));
+        removeStaleSplitTunnelAppFilters(vpnOnlyApps, newVpnOnlyApps,
+                                         QStringLiteral("VPN-only"));
+        // The create functions skip apps that already have filters
+        if(createExcludedRules)
+        {
+            for(auto &pAppId : newExcludedApps)
+            {
+                createBypassAppFilters(excludedApps, _filters.providerContextKey,
+                                       *pAppId);
+            }
+        }
+        for(auto &pAppId : newVpnOnlyApps)
+        {
+            if(createVpnOnlyBindRules)
+            {
+                createOnlyVPNAppFilters(vpnOnlyApps, _filters.vpnOnlyProviderContextKey,
+                                        *pAppId);
+            }
+            else
+            {
+                createBlockAppFilters(vpnOnlyApps, *pAppId);
+            }
+        }
+        return;
+    }
+
+    // Otherwise, we have to delete all filters and recreate everything.  WFP
+    // has been known to throw spurious errors if we try to reuse callout or
+    // context objects, so we delete everything in order to tear those down and
+    // recreate them.
+
     // Remove all app filters
     removeSplitTunnelAppFilters(excludedApps, QStringLiteral("excluded"));
     removeSplitTunnelAppFilters(vpnOnlyApps, QStringLiteral("VPN-only"));
@@ -792,19 +1057,8 @@ void WinDaemon::reapplySplitTunnelFirewall(const QString &newSplitTunnelIp,
         << !_lastSplitTunnelIp.isEmpty() << "- tunnel IP known:"
         << !_lastTunnelIp.isEmpty() << "- have connected:" << _lastConnected;
 
-    // We can only create exclude rules when the appropriate bind IP address is known
-    bool createExcludedRules = !_lastSplitTunnelIp.isEmpty() && !newExcludedApps.empty();
-    // VPN-only rules are applied even if the last tunnel IP is not known
-    // though; we still apply the block rule ("per-app killswitch") until the IP
-    // is known.
-    bool createVpnOnlyRules = !newVpnOnlyApps.empty();
-    // We create bind rules for VPN-only apps when connected and the IP is
-    // known; otherwise we just create a block rule (which does not require the
-    // callout/context objects).
-    bool createVpnOnlyBindRules = _lastConnected && !_lastTunnelIp.isEmpty();
-
     // Create the new callout and context objects if any rules are needed
-    if(createExcludedRules || (createVpnOnlyRules && createVpnOnlyBindRules))
+    if(needCallouts)
     {
         UINT32 splitIpAddress = QHostAddress{_lastSplitTunnelIp}.toIPv4Address();
         if(splitIpAddress)
@@ -865,41 +1119,52 @@ void WinDaemon::reapplySplitTunnelFirewall(const QString &newSplitTunnelIp,
     }
 }
 
-QJsonValue WinDaemon::RPC_inspectUwpApps(const QJsonArray &familyIds)
+Async<QJsonValue> WinDaemon::RPC_inspectUwpApps(const QJsonArray &familyIds)
 {
-    QJsonArray exeApps, wwaApps;
-
+    // Find the install directories here - WinRT is only used on this thread -
+    // then read the manifests on the worker pool
+    std::vector<std::pair<QJsonValue, std::vector<QString>>> familyDirs;
+    familyDirs.reserve(static_cast<std::size_t>(familyIds.size()));
     for(const auto &family : familyIds)
+        familyDirs.push_back({family, getWinRtLoader().adminGetInstallDirs(family.toString())});
+
+    return _rpcQueue.run([familyDirs = std::move(familyDirs)]() -> QJsonValue
     {
-        auto installDirs = getWinRtLoader().adminGetInstallDirs(family.toString());
-        AppExecutables appExes{};
-        for(const auto &dir : installDirs)
+        QJsonArray exeApps, wwaApps;
+
+        for(const auto &familyDir : familyDirs)
         {
-            if(!inspectUwpAppManifest(dir, appExes))
+            const auto &family = familyDir.first;
+            const auto &installDirs = familyDir.second;
+            AppExecutables appExes{};
+            for(const auto &dir : installDirs)
             {
-                // Failed to scan a directory, skip this app, couldn't understand it
-                appExes.executables.clear();
-                appExes.usesWwa = false;
+                if(!inspectUwpAppManifestCached(dir, appExes))
+                {
+                    // Failed to scan a directory, skip this app, couldn't understand it
+                    appExes.executables.clear();
+                    appExes.usesWwa = false;
+                }
             }
-        }
 
-        if(appExes.usesWwa && appExes.executables.empty())
-            wwaApps.push_back(family);
-        else if(!appExes.usesWwa && !appExes.executables.empty())
-            exeApps.push_back(family);
-        else
-        {
-            // Otherwise, no targets were found, or both types of targets were
-            // found, skip it.
-            qInfo() << "Skipping app:" << family << "->" << appExes.executables.size()
-                << "exes, uses wwa:" << appExes.usesWwa;
+            if(appExes.usesWwa && appExes.executables.empty())
+                wwaApps.push_back(family);
+            else if(!appExes.usesWwa && !appExes.executables.empty())
+                exeApps.push_back(family);
+            else
+            {
+                // Otherwise, no targets were found, or both types of targets were
+                // found, skip it.
+                qInfo() << "Skipping app:" << family << "->" << appExes.executables.size()
+                    << "exes, uses wwa:" << appExes.usesWwa;
+            }
         }
-    }
 
-    QJsonObject result;
-    result.insert(QStringLiteral("exe"), exeApps);
-    result.insert(QStringLiteral("wwa"), wwaApps);
-    return result;
+        QJsonObject result;
+        result.insert(QStringLiteral("exe"), exeApps);
+        result.insert(QStringLiteral("wwa"), wwaApps);
+        return result;
+    });
 }
 
 void WinDaemon::RPC_checkCalloutState()
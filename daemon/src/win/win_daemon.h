@@ -32,15 +32,18 @@
 class WinNetworkAdapter : public NetworkAdapter
 {
 public:
-    WinNetworkAdapter(const QString& guid) : NetworkAdapter(guid), _savedMetricValueIPv4(-1), _savedMetricValueIPv6(-1) {}
+    WinNetworkAdapter(const QString& guid) : NetworkAdapter(guid), isWintun{false}, _savedMetricValueIPv4(-1), _savedMetricValueIPv6(-1) {}
 
     quint64 luid;
     QString adapterName;
     QString connectionName;
     bool isCustomTap;
+    // Whether this is a WinTUN adapter rather than TAP
+    bool isWintun;
     quint32 ifIndex;
     virtual void setMetricToLowest() override;
     virtual void restoreOriginalMetric() override;
+    virtual bool usesWintun() const override { return isWintun; }
 private:
     // Any value less than 5 should work fine. 3 is chosen without any real reason.
     enum { interfaceMetric = 3 };
@@ -93,6 +96,7 @@ public:
 
     virtual QSharedPointer<NetworkAdapter> getNetworkAdapter() override;
 
+    // Find all of our adapters - TAP adapters first, then WinTUN adapters
     static QList<QSharedPointer<WinNetworkAdapter>> getAllNetworkAdapters();
 
 protected:
@@ -115,15 +119,30 @@ protected:
 
 private:
     // Check if the adapter is present, and update Daemon's corresponding state
-    // (Daemon::adapterValid()).
+    // (Daemon::adapterValid()).  Discards the cached adapter, this is called
+    // when adapters are added/removed or the system suspends/resumes.
     void checkNetworkAdapter();
+    // Open the WFP engine, install our provider, and remove any objects left
+    // over from a prior instance.  Done during startup only if the killswitch
+    // is always on; otherwise it's deferred until the service has reported
+    // that it's running.
+    void initializeFirewall();
+    // Start the callout driver in the background if split tunnel is enabled
+    // and the driver is installed, so onAboutToConnect() doesn't have to wait
+    // for it to load.  See implementation for resiliency considerations.
+    void preloadCalloutDriver();
+    void traceCalloutStartResult(ServiceStatus startResult);
+    // Check that the cached adapter still exists (by LUID) and refresh its
+    // connection name, which can be changed by the user at any time.  Returns
+    // false (and clears the cache) if it no longer exists.
+    bool validateCachedAdapter();
     void onAboutToConnect();
 
     void doVpnExclusions(std::set<const AppIdKey*, PtrValueLess> newExcludedApps, bool hasConnected);
     void doVpnOnly(std::set<const AppIdKey*, PtrValueLess> newVpnOnlyApps, bool hasConnected);
 
-    bool areAppsUnchanged(std::set<const AppIdKey*, PtrValueLess> newApps,
-                          std::map<QByteArray, SplitAppFilters> oldAppMap)
+    bool areAppsUnchanged(const std::set<const AppIdKey*, PtrValueLess> &newApps,
+                          const std::map<QByteArray, SplitAppFilters> &oldAppMap)
     {
         // Compare these element-wise; valid because both containers are sorted
         // lexically.
@@ -139,13 +158,17 @@ private:
 
 protected:
     virtual void applyFirewallRules(const FirewallParams& params) override;
-    virtual QJsonValue RPC_inspectUwpApps(const QJsonArray &familyIds) override;
+    virtual Async<QJsonValue> RPC_inspectUwpApps(const QJsonArray &familyIds) override;
     virtual void RPC_checkCalloutState() override;
     virtual void writePlatformDiagnostics(DiagnosticsFile &file) override;
 
 private:
     void removeSplitTunnelAppFilters(std::map<QByteArray, SplitAppFilters> &apps,
                                      const QString &traceType);
+    // Remove filters for apps in 'apps' that are no longer in 'newApps'
+    void removeStaleSplitTunnelAppFilters(std::map<QByteArray, SplitAppFilters> &apps,
+                                          const std::set<const AppIdKey*, PtrValueLess> &newApps,
+                                          const QString &traceType);
     void createBypassAppFilters(std::map<QByteArray, SplitAppFilters> &apps,
                                 const WfpProviderContextObject &context,
                                 const AppIdKey &appId);
@@ -209,13 +232,30 @@ protected:
     // the WFP filters.
     UINT64 _filterAdapterLuid;  // LUID of the TAP adapter used in some rules
     QString _dnsServers[2]; // Permitted DNS server addresses
+    // The last params used to apply the base filters (not the split tunnel
+    // filters, which depend on the app monitor state too).  Invalidated if
+    // a filter fails to apply, so it'll be retried.
+    FirewallParams _lastFirewallParams;
+    bool _lastFirewallParamsValid;
     HANDLE _ipNotificationHandle;
+    // The TAP adapter found by the last getNetworkAdapter(), if any.
+    // Enumerating all adapters is slow on systems with many virtual adapters,
+    // so this is reused until an interface is added or removed.
+    QSharedPointer<WinNetworkAdapter> _pCachedAdapter;
     // When Windows suspends, the TAP adapter disappears, and it won't be back
     // right away when we resume.  This just suppresses the "TAP adapter
     // missing" error briefly after a system resume.
     WinUnbiasedDeadline _resumeGracePeriod;
     ServiceMonitor _wfpCalloutMonitor;
     WinAppMonitor _appMonitor;
+    // Whether the callout driver has been started (by onAboutToConnect() or a
+    // preload), and whether a preload is running on _calloutQueue
+    bool _calloutStarted;
+    bool _calloutPreloading;
+    // The callout driver is preloaded on this queue (starting it can take a
+    // few seconds).  Declared last so a running preload finishes before the
+    // rest of WinDaemon is destroyed.
+    WorkerQueue _calloutQueue;
 };
 
 #undef g_daemon
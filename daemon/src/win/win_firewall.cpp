@@ -310,6 +310,7 @@ WfpFilterObject FirewallEngine::add(const FirewallFilter& filter)
         qCritical(SystemError(HERE, error));
         return {zeroGuid};
     }
+    _addedFilters.insert(QUuid{filter.filterKey});
     return {filter.filterKey};
 }
 
@@ -321,6 +322,7 @@ WfpCalloutObject FirewallEngine::add(const Callout& mCallout)
         qCritical(SystemError(HERE, error));
         return {zeroGuid};
     }
+    _addedCallouts.insert(QUuid{mCallout.calloutKey});
     return {mCallout.calloutKey};
 }
 
@@ -332,6 +334,7 @@ WfpProviderContextObject FirewallEngine::add(const ProviderContext& providerCont
         qCritical(SystemError(HERE, error));
         return {zeroGuid};
     }
+    _addedProviderContexts.insert(QUuid{providerContext.providerContextKey});
     return {providerContext.providerContextKey};
 }
 
@@ -342,6 +345,7 @@ bool FirewallEngine::remove(const WfpFilterObject &filter)
         qCritical(SystemError{HERE, error});
         return false;
     }
+    _addedFilters.remove(QUuid{filter});
     return true;
 }
 
@@ -352,6 +356,7 @@ bool FirewallEngine::remove(const WfpCalloutObject &callout)
         qCritical(SystemError{HERE, error});
         return false;
     }
+    _addedCallouts.remove(QUuid{callout});
     return true;
 }
 
@@ -362,6 +367,7 @@ bool FirewallEngine::remove(const WfpProviderContextObject &providerContext)
         qCritical(SystemError{HERE, error});
         return false;
     }
+    _addedProviderContexts.remove(QUuid{providerContext});
     return true;
 }
 
@@ -387,6 +393,31 @@ bool FirewallEngine::removeAll(const GUID &layerKey)
     return result;
 }
 
+bool FirewallEngine::removeAdded()
+{
+    bool result = true;
+    FirewallTransaction tx{this};
+    // Filters refer to callouts and provider contexts, so remove those last.
+    // Copy each set, since remove() updates it.
+    for(const QUuid &filterKey : QSet<QUuid>{_addedFilters})
+    {
+        if(!remove(WfpFilterObject{static_cast<GUID>(filterKey)}))
+            result = false;
+    }
+    for(const QUuid &calloutKey : QSet<QUuid>{_addedCallouts})
+    {
+        if(!remove(WfpCalloutObject{static_cast<GUID>(calloutKey)}))
+            result = false;
+    }
+    for(const QUuid &contextKey : QSet<QUuid>{_addedProviderContexts})
+    {
+        if(!remove(WfpProviderContextObject{static_cast<GUID>(contextKey)}))
+            result = false;
+    }
+    tx.commit();
+    return result;
+}
+
 // Enumerate all WFP objects of a particular type.
 //
 // The WFP object enumeration APIs are all nearly identical, this function
@@ -524,20 +555,14 @@ void FirewallEngine::checkLeakedLayerObjects(const GUID &layerKey)
 
 void FirewallEngine::checkLeakedObjects()
 {
-    checkLeakedLayerObjects(FWPM_LAYER_ALE_AUTH_CONNECT_V4);
-    checkLeakedLayerObjects(FWPM_LAYER_ALE_AUTH_CONNECT_V6);
-    checkLeakedLayerObjects(FWPM_LAYER_ALE_AUTH_RECV_ACCEPT_V4);
-    checkLeakedLayerObjects(FWPM_LAYER_ALE_AUTH_RECV_ACCEPT_V6);
-    checkLeakedLayerObjects(FWPM_LAYER_ALE_BIND_REDIRECT_V4);
-    checkLeakedLayerObjects(FWPM_LAYER_ALE_CONNECT_REDIRECT_V4);
-    enumProviderContexts([&](const FWPM_PROVIDER_CONTEXT &providerContext)
-    {
-        qWarning() << "WFP provider context leaked:"
-            << QUuid{providerContext.providerContextKey};
-        return true;
-    });
+    for(const QUuid &filterKey : _addedFilters)
+        qWarning() << "WFP filter leaked:" << filterKey;
+    for(const QUuid &calloutKey : _addedCallouts)
+        qWarning() << "WFP callout leaked:" << calloutKey;
+    for(const QUuid &contextKey : _addedProviderContexts)
+        qWarning() << "WFP provider context leaked:" << contextKey;
 
-    qInfo() << "Finished enumerating WFP objects";
+    qInfo() << "Finished checking WFP objects";
 }
 
 FirewallTransaction::FirewallTransaction(FirewallEngine* firewall)
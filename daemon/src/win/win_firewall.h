@@ -28,7 +28,9 @@
 #include "win/win_util.h"
 #include <QHostAddress>
 #include <QObject>
+#include <QSet>
 #include <QStringView>
+#include <QUuid>
 #include <optional>
 
 class FirewallFilter;
@@ -78,8 +80,14 @@ public:
     bool remove(const WfpCalloutObject &callout);
     bool remove(const WfpProviderContextObject &providerContext);
 
+    // Remove all objects created by this provider, including any left over
+    // from a prior daemon instance.  This enumerates all of the layers we use.
     bool removeAll();
     bool removeAll(const GUID& layerKey);
+    // Remove the objects added through this FirewallEngine, in one
+    // transaction.  This uses the in-memory index, so it doesn't have to
+    // enumerate any WFP layers.
+    bool removeAdded();
 
 private:
     template<class ObjectT, class TemplateT, class CreateEnumHandleFuncT,
@@ -101,7 +109,9 @@ private:
 
 public:
     // Verify that no WFP objects were leaked; used by destructor for
-    // diagnostics.
+    // diagnostics.  checkLeakedObjects() checks the in-memory index of objects
+    // added through this FirewallEngine; checkLeakedLayerObjects() enumerates
+    // a WFP layer.
     void checkLeakedLayerObjects(const GUID &layerKey);
     void checkLeakedObjects();
 
@@ -109,6 +119,10 @@ public:
     HANDLE _handle;
 
 private:
+    // Objects that have been added through this FirewallEngine and not yet
+    // removed.
+    QSet<QUuid> _addedFilters, _addedCallouts, _addedProviderContexts;
+
     friend class FirewallTransaction;
 };
 
@@ -0,0 +1,72 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("win/win_routenotifier.cpp")
+
+#include "win_routenotifier.h"
+#include <QMetaObject>
+
+void WINAPI WinRouteNotifier::routeChangeCallback(PVOID pContext, PMIB_IPFORWARD_ROW2,
+                                                  MIB_NOTIFICATION_TYPE type)
+{
+    // The initial notification is only sent if requested, ignore it anyway
+    if(type == MibInitialNotification)
+        return;
+    QMetaObject::invokeMethod(reinterpret_cast<WinRouteNotifier*>(pContext),
+                              &WinRouteNotifier::routesChanged, Qt::QueuedConnection);
+}
+
+void WINAPI WinRouteNotifier::addressChangeCallback(PVOID pContext, PMIB_UNICASTIPADDRESS_ROW,
+                                                    MIB_NOTIFICATION_TYPE type)
+{
+    if(type == MibInitialNotification)
+        return;
+    QMetaObject::invokeMethod(reinterpret_cast<WinRouteNotifier*>(pContext),
+                              &WinRouteNotifier::routesChanged, Qt::QueuedConnection);
+}
+
+WinRouteNotifier::WinRouteNotifier(QObject *pParent)
+    : QObject{pParent}, _routeNotificationHandle{nullptr},
+      _addressNotificationHandle{nullptr}
+{
+    DWORD err = ::NotifyRouteChange2(AF_UNSPEC, &WinRouteNotifier::routeChangeCallback,
+                                     this, FALSE, &_routeNotificationHandle);
+    if(err != NO_ERROR)
+    {
+        qWarning() << "Unable to register for route changes:" << err;
+        _routeNotificationHandle = nullptr;
+    }
+    err = ::NotifyUnicastIpAddressChange(AF_UNSPEC, &WinRouteNotifier::addressChangeCallback,
+                                         this, FALSE, &_addressNotificationHandle);
+    if(err != NO_ERROR)
+    {
+        qWarning() << "Unable to register for address changes:" << err;
+        _addressNotificationHandle = nullptr;
+    }
+}
+
+WinRouteNotifier::~WinRouteNotifier()
+{
+    // CancelMibChangeNotify2() waits for any callbacks in progress to finish,
+    // so no callback can refer to this object after this.  (A routesChanged()
+    // call that was already queued is discarded with the object.)
+    if(_routeNotificationHandle)
+        ::CancelMibChangeNotify2(_routeNotificationHandle);
+    if(_addressNotificationHandle)
+        ::CancelMibChangeNotify2(_addressNotificationHandle);
+}
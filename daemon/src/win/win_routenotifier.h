@@ -0,0 +1,62 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("win/win_routenotifier.h")
+
+#ifndef WIN_ROUTENOTIFIER_H
+#define WIN_ROUTENOTIFIER_H
+
+#include "win.h"
+#include <QObject>
+
+// WinRouteNotifier registers for IP route and unicast address change
+// notifications (NotifyRouteChange2() / NotifyUnicastIpAddressChange()) and
+// emits routesChanged() on the owning thread when either is received.
+class WinRouteNotifier : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("win.routenotifier");
+
+private:
+    // Callbacks are invoked on a thread pool thread, these just queue
+    // routesChanged() to the owning thread.
+    static void WINAPI routeChangeCallback(PVOID pContext, PMIB_IPFORWARD_ROW2 pRow,
+                                           MIB_NOTIFICATION_TYPE type);
+    static void WINAPI addressChangeCallback(PVOID pContext, PMIB_UNICASTIPADDRESS_ROW pRow,
+                                             MIB_NOTIFICATION_TYPE type);
+
+public:
+    WinRouteNotifier(QObject *pParent);
+    ~WinRouteNotifier();
+
+    // Whether route change notifications were registered; if not, no
+    // notifications will be emitted for route changes.
+    bool isOpen() const {return _routeNotificationHandle != nullptr;}
+
+private:
+    WinRouteNotifier(const WinRouteNotifier &) = delete;
+    WinRouteNotifier &operator=(const WinRouteNotifier &) = delete;
+
+signals:
+    void routesChanged();
+
+private:
+    HANDLE _routeNotificationHandle, _addressNotificationHandle;
+};
+
+#endif
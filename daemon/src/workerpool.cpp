@@ -0,0 +1,122 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("workerpool.cpp")
+
+#include "workerpool.h"
+#include "tracing.h"
+#include <QRunnable>
+
+namespace
+{
+    // QRunnable::create() was only added in Qt 5.15
+    class FunctorRunnable : public QRunnable
+    {
+    public:
+        FunctorRunnable(std::function<void()> work) : _work{std::move(work)} {}
+        void run() override {_work();}
+
+    private:
+        std::function<void()> _work;
+    };
+}
+
+WorkerPool::WorkerPool(int maxThreads)
+{
+    _pool.setMaxThreadCount(maxThreads);
+    // Keep idle threads around for a while; work tends to arrive in bursts
+    // (serializing several files, parsing a refreshed regions list, etc.)
+    _pool.setExpiryTimeout(60000);
+}
+
+WorkerPool::~WorkerPool()
+{
+    _pool.waitForDone();
+}
+
+void WorkerPool::start(std::function<void()> work, Priority priority)
+{
+    // QThreadPool deletes the runnable after it runs (autoDelete() is set by
+    // default)
+    _pool.start(new FunctorRunnable{std::move(work)}, static_cast<int>(priority));
+}
+
+WorkerQueue::WorkerQueue(WorkerPool &pool, QString name,
+                         WorkerPool::Priority priority)
+    : _pool{pool}, _name{std::move(name)}, _priority{priority}, _running{false}
+{
+}
+
+WorkerQueue::~WorkerQueue()
+{
+    QMutexLocker lock{&_mutex};
+    if(_running)
+    {
+        qInfo() << "Waiting for" << _pending.size() + 1 << "items in queue"
+            << _name;
+    }
+    while(_running)
+        _idle.wait(&_mutex);
+}
+
+void WorkerQueue::startNext()
+{
+    Q_ASSERT(!_pending.empty());    // Checked by caller
+    auto work = std::move(_pending.front());
+    _pending.pop_front();
+    _pool.start([this, work = std::move(work)]()
+    {
+        {
+            TraceSpan span{"workerpool", _name};
+            work();
+        }
+        itemFinished();
+    }, _priority);
+}
+
+void WorkerQueue::itemFinished()
+{
+    QMutexLocker lock{&_mutex};
+    if(!_pending.empty())
+        startNext();
+    else
+    {
+        _running = false;
+        _idle.wakeAll();
+    }
+}
+
+void WorkerQueue::queue(std::function<void()> work)
+{
+    QMutexLocker lock{&_mutex};
+    _pending.push_back(std::move(work));
+    // If an item is already running, it'll start this one when it's done;
+    // items in a queue never run concurrently.
+    if(!_running)
+    {
+        _running = true;
+        startNext();
+    }
+}
+
+std::size_t WorkerQueue::pendingCount() const
+{
+    QMutexLocker lock{&_mutex};
+    return _pending.size();
+}
@@ -0,0 +1,139 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("workerpool.h")
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include "thread.h"
+#include <QMutex>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <deque>
+#include <functional>
+#include <memory>
+
+// WorkerPool is a bounded pool of threads shared by the daemon's subsystems for
+// background work - parsing and serializing JSON, verifying signatures, etc.
+// Work is submitted through named WorkerQueues rather than directly to the
+// pool.
+//
+// The pool's threads don't have event loops; work that needs one (sockets,
+// timers) still needs a RunningWorkerThread.
+class WorkerPool
+{
+    CLASS_LOGGING_CATEGORY("workerpool")
+
+public:
+    // Priority of a queue's work relative to other queues.  When all threads
+    // are busy, the next work item is taken from the highest-priority queue.
+    enum class Priority
+    {
+        Background,
+        Normal,
+        High,
+    };
+
+public:
+    explicit WorkerPool(int maxThreads);
+    // Waits for all work that has been started to finish.  Queues must be
+    // destroyed before the pool.
+    ~WorkerPool();
+
+private:
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+public:
+    int maxThreads() const {return _pool.maxThreadCount();}
+    int activeThreads() const {return _pool.activeThreadCount();}
+
+    // Start a work item with the given priority; used by WorkerQueue.
+    void start(std::function<void()> work, Priority priority);
+
+private:
+    QThreadPool _pool;
+};
+
+// A WorkerQueue is a named, serial queue of work on a WorkerPool.  Work items
+// in one queue run in order, one at a time, so a subsystem doesn't need
+// to synchronize its own items with each other.  Different queues run
+// concurrently, up to the pool's thread limit.
+//
+// The queue's name is used for tracing and logging.
+//
+// Functors run on a pool thread; the usual care applies to state they capture.
+// Destroying the queue waits for all of its queued work to finish, so work
+// capturing the owner of the queue remains valid as long as the queue is
+// destroyed first (declare it after the state that it uses).
+class WorkerQueue
+{
+    CLASS_LOGGING_CATEGORY("workerpool")
+
+public:
+    WorkerQueue(WorkerPool &pool, QString name, WorkerPool::Priority priority);
+    ~WorkerQueue();
+
+private:
+    WorkerQueue(const WorkerQueue &) = delete;
+    WorkerQueue &operator=(const WorkerQueue &) = delete;
+
+    // Run the next item on the pool.  _mutex must be locked.
+    void startNext();
+    // Called on the pool thread when an item finishes
+    void itemFinished();
+
+public:
+    const QString &name() const {return _name;}
+
+    // Queue a functor to run on the pool, without waiting for a result.
+    void queue(std::function<void()> work);
+
+    // Queue a functor to run on the pool, and get its result with an
+    // Async<T>.  The task is resolved on the calling thread, which must have an
+    // event loop; if the functor throws an Error, the task is rejected with
+    // it.  This can be used in Async chains to offload work from a then()
+    // callback:
+    //   ->then(this, [this](const QByteArray &json){return _queue.run([json](){return parse(json);});})
+    template<class Func, class Result = std::decay_t<decltype(std::declval<Func&>()())>>
+    Async<Result> run(Func f)
+    {
+        auto pTask = Async<Result>::create();
+        queue([pTask, f = std::move(f)]() mutable
+        {
+            invokeForTask(f, pTask);
+        });
+        return pTask;
+    }
+
+    // Number of items waiting to run (not including one that's running)
+    std::size_t pendingCount() const;
+
+private:
+    WorkerPool &_pool;
+    const QString _name;
+    const WorkerPool::Priority _priority;
+    mutable QMutex _mutex;
+    QWaitCondition _idle;
+    std::deque<std::function<void()>> _pending;
+    bool _running;
+};
+
+#endif
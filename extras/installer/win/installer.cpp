@@ -22,6 +22,7 @@
 #include "tasks/callout.h"
 #include "tasks/file.h"
 #include "tasks/function.h"
+#include "tasks/graph.h"
 #include "tasks/list.h"
 #include "tasks/migrate.h"
 #include "tasks/payload.h"
@@ -671,27 +672,31 @@ DWORD Installer::workerThreadMain()
         // Copy new files
         tasks.addNew<PayloadTask>(g_installPath);
 
+        // The remaining setup steps only need the new files, so run the
+        // independent ones concurrently
+        auto& setupTasks = tasks.addNew<TaskGraph>();
+
         // Plant any remembered account/settings
-        tasks.addNew<WriteSettingsTask>(g_daemonDataPath);
+        auto& writeSettings = setupTasks.addNew<WriteSettingsTask>({}, g_daemonDataPath);
 
         // Install TAP driver
-        tasks.addNew<InstallTapDriverTask>();
+        auto& installTap = setupTasks.addNew<InstallTapDriverTask>({});
 
         // Update callout driver if installed
-        tasks.addNew<UpdateCalloutDriverTask>();
+        auto& updateCallout = setupTasks.addNew<UpdateCalloutDriverTask>({});
 
         // Install service
-        tasks.addNew<InstallServiceTask>();
-
-        // Start service
-        tasks.addNew<StartInstalledServiceTask>();
+        auto& installService = setupTasks.addNew<InstallServiceTask>({});
 
-        // Bulk of the work done; finish up
-        tasks.addNew<CaptionTask>(IDS_CAPTION_FINISHINGUP);
+        // Start service once everything it uses is in place
+        setupTasks.addNew<StartInstalledServiceTask>({&writeSettings, &installTap, &updateCallout, &installService});
 
         // Add shortcuts
         // Translation note - the product name is not translated
-        tasks.addNew<AddShortcutTask>(L"" PIA_PRODUCT_NAME, g_clientPath);
+        setupTasks.addNew<AddShortcutTask>({}, L"" PIA_PRODUCT_NAME, g_clientPath);
+
+        // Bulk of the work done; finish up
+        tasks.addNew<CaptionTask>(IDS_CAPTION_FINISHINGUP);
 
         // Write uninstall data
         tasks.addNew<WriteUninstallDataTask>(g_installPath);
@@ -0,0 +1,248 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+
+#include "graph.h"
+
+#include <algorithm>
+
+TaskGraph::TaskGraph()
+{
+    InitializeCriticalSection(&_lock);
+    InitializeConditionVariable(&_nodeFinished);
+}
+
+TaskGraph::TaskGraph(UIString caption)
+    : CaptionTask(std::move(caption))
+{
+    InitializeCriticalSection(&_lock);
+    InitializeConditionVariable(&_nodeFinished);
+}
+
+TaskGraph::~TaskGraph()
+{
+    // execute() doesn't return while subtasks are running, so the threads have
+    // all exited
+    for (auto& node : _nodes)
+    {
+        if (node.thread)
+            CloseHandle(node.thread);
+    }
+    DeleteCriticalSection(&_lock);
+}
+
+void TaskGraph::add(std::shared_ptr<Task> task, Dependencies dependencies)
+{
+    Node node;
+    for (const Task* dependency : dependencies)
+    {
+        auto itDependency = std::find_if(_nodes.begin(), _nodes.end(),
+            [dependency](const Node& n) { return n.task.get() == dependency; });
+        // Dependencies must be added first, which also rules out cycles
+        if (itDependency == _nodes.end())
+            LOG("Ignoring task graph dependency that wasn't added before its dependent");
+        else
+            node.dependencies.push_back(itDependency - _nodes.begin());
+    }
+    node.listener.reset(new NodeListener(*this, _nodes.size()));
+    node.graph = this;
+    task->setListener(node.listener.get());
+    node.task = std::move(task);
+    _nodes.push_back(std::move(node));
+}
+
+void TaskGraph::prepare()
+{
+    _totalExecutionTime = 0.0;
+    for (auto& node : _nodes)
+    {
+        node.task->prepare();
+        node.estimate = node.task->getEstimatedExecutionTime();
+        _totalExecutionTime += node.estimate;
+    }
+    _remainingRollbackTime = 0.0;
+}
+
+void TaskGraph::execute()
+{
+    CaptionTask::execute();
+
+    EnterCriticalSection(&_lock);
+    std::exception_ptr failure;
+    for (;;)
+    {
+        // Start everything that's ready, unless something has failed
+        size_t running = 0;
+        for (auto& node : _nodes)
+        {
+            if (!failure && node.state == NodeState::Pending && isReady(node))
+                startNode(node);
+            if (node.state == NodeState::Running)
+                ++running;
+        }
+        // If nothing is running, everything has been executed (or a failure
+        // prevents the rest from starting)
+        if (running == 0)
+            break;
+
+        SleepConditionVariableCS(&_nodeFinished, &_lock, INFINITE);
+
+        for (size_t index : _finishedOrder)
+        {
+            if (!failure && _nodes[index].failure)
+                failure = _nodes[index].failure;
+        }
+        if (!failure)
+        {
+            try
+            {
+                checkAbort();
+            }
+            catch (...)
+            {
+                failure = std::current_exception();
+            }
+        }
+    }
+    LeaveCriticalSection(&_lock);
+
+    if (failure)
+        std::rethrow_exception(failure);
+}
+
+void TaskGraph::rollback()
+{
+    EnterCriticalSection(&_lock);
+    _rollingBack = true;
+    LeaveCriticalSection(&_lock);
+    // The subtasks ran on their own threads, but roll them back sequentially
+    // on this thread.
+    for (auto it = _finishedOrder.rbegin(); it != _finishedOrder.rend(); ++it)
+    {
+        Node& node = _nodes[*it];
+        EnterCriticalSection(&_lock);
+        _remainingRollbackTime -= node.task->getEstimatedRollbackTime();
+        LeaveCriticalSection(&_lock);
+
+        node.task->rollback();
+
+        EnterCriticalSection(&_lock);
+        node.progress = 0.0;
+        reportProgress();
+        LeaveCriticalSection(&_lock);
+    }
+}
+
+double TaskGraph::getEstimatedExecutionTime() const
+{
+    return _totalExecutionTime;
+}
+
+double TaskGraph::getEstimatedRollbackTime() const
+{
+    return _remainingRollbackTime;
+}
+
+DWORD WINAPI TaskGraph::staticNodeThreadMain(LPVOID param)
+{
+    Node& node = *reinterpret_cast<Node*>(param);
+    TaskGraph& graph = *node.graph;
+
+    // Subtasks may use COM (shortcuts, etc.) like the worker thread
+    HRESULT comErr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+    if (FAILED(comErr))
+        LOG("CoInitializeEx failed (%d)", comErr);
+
+    std::exception_ptr failure;
+    try
+    {
+        node.task->execute();
+    }
+    catch (...)
+    {
+        failure = std::current_exception();
+    }
+
+    if (SUCCEEDED(comErr))
+        CoUninitialize();
+
+    EnterCriticalSection(&graph._lock);
+    node.failure = std::move(failure);
+    node.state = NodeState::Finished;
+    node.progress = 1.0;
+    graph._finishedOrder.push_back(&node - graph._nodes.data());
+    graph._remainingRollbackTime += node.task->getEstimatedRollbackTime();
+    graph.reportProgress();
+    WakeAllConditionVariable(&graph._nodeFinished);
+    LeaveCriticalSection(&graph._lock);
+    return 0;
+}
+
+bool TaskGraph::isReady(const Node& node) const
+{
+    return std::all_of(node.dependencies.begin(), node.dependencies.end(),
+        [this](size_t index) { return _nodes[index].state == NodeState::Finished; });
+}
+
+void TaskGraph::startNode(Node& node)
+{
+    node.state = NodeState::Running;
+    node.progress = 0.0;
+    node.thread = CreateThread(NULL, 0, &staticNodeThreadMain, reinterpret_cast<LPVOID>(&node), 0, NULL);
+    if (!node.thread)
+    {
+        // Run it on this thread instead; this still honors the dependencies,
+        // just without the concurrency.
+        LOG("Unable to create task thread (%d), running task inline", GetLastError());
+        LeaveCriticalSection(&_lock);
+        staticNodeThreadMain(&node);
+        EnterCriticalSection(&_lock);
+    }
+}
+
+void TaskGraph::reportProgress()
+{
+    double completedTime = 0.0, remainingTime = 0.0;
+    for (const auto& node : _nodes)
+    {
+        completedTime += node.progress * node.estimate;
+        remainingTime += (1.0 - node.progress) * node.estimate;
+    }
+    if (!_listener)
+        return;
+    double progress = _totalExecutionTime > 0.0 ? completedTime / _totalExecutionTime : 0.0;
+    if (progress > 1.0)
+        progress = 1.0;
+    _listener->setProgress(progress, _rollingBack ? _remainingRollbackTime : remainingTime);
+}
+
+void TaskGraph::NodeListener::setProgress(double progress, double timeRemaining)
+{
+    EnterCriticalSection(&_graph._lock);
+    _graph._nodes[_index].progress = progress;
+    _graph.reportProgress();
+    LeaveCriticalSection(&_graph._lock);
+}
+
+void TaskGraph::NodeListener::setCaption(UIString caption)
+{
+    EnterCriticalSection(&_graph._lock);
+    if (_graph._listener)
+        _graph._listener->setCaption(std::move(caption));
+    LeaveCriticalSection(&_graph._lock);
+}
@@ -0,0 +1,123 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+
+#ifndef TASKS_GRAPH_H
+#define TASKS_GRAPH_H
+#pragma once
+
+#include "tasks.h"
+#include "function.h"
+
+#include <exception>
+
+// Task that performs a set of subtasks, where each subtask can declare the
+// subtasks it depends on.  A subtask is started once all of its dependencies
+// have finished, so independent subtasks run concurrently (each on its own
+// thread).
+//
+// If a subtask fails, no more subtasks are started, the running ones are
+// allowed to finish, and the first failure is rethrown.  Rollback rolls back
+// every subtask that was executed (including any that failed), in the reverse
+// of the order they finished - since a subtask only starts after its
+// dependencies finish, dependents are always rolled back first.
+//
+// Subtasks run on other threads, so they must not depend on thread state of
+// the worker thread (COM is initialized on each thread).  Error prompts from
+// concurrent subtasks may be shown at the same time.
+class TaskGraph : public CaptionTask
+{
+public:
+    using Dependencies = std::initializer_list<const Task*>;
+
+    TaskGraph();
+    TaskGraph(UIString caption);
+    ~TaskGraph();
+
+    // Add a subtask that starts after the given subtasks have finished; they
+    // must have been added to this graph already.
+    void add(std::shared_ptr<Task> task, Dependencies dependencies = {});
+    template<class TaskType = FunctionTask, typename... Args> inline TaskType& addNew(Dependencies dependencies, Args&&... args);
+
+    virtual void prepare() override;
+    virtual void execute() override;
+    virtual void rollback() override;
+    virtual bool needsRollback() const override { return !_finishedOrder.empty(); }
+    virtual double getEstimatedExecutionTime() const override;
+    virtual double getEstimatedRollbackTime() const override;
+
+private:
+    enum class NodeState
+    {
+        Pending,
+        Running,
+        Finished,
+    };
+
+    // Forwards a subtask's progress to the graph
+    class NodeListener : public ProgressListener
+    {
+    public:
+        NodeListener(TaskGraph& graph, size_t index) : _graph(graph), _index(index) {}
+        virtual void setProgress(double progress, double timeRemaining) override;
+        virtual void setCaption(UIString caption) override;
+    private:
+        TaskGraph& _graph;
+        size_t _index;
+    };
+
+    struct Node
+    {
+        std::shared_ptr<Task> task;
+        std::vector<size_t> dependencies;
+        std::unique_ptr<NodeListener> listener;
+        NodeState state = NodeState::Pending;
+        double estimate = 0.0;
+        double progress = 0.0;
+        std::exception_ptr failure;
+        TaskGraph* graph = nullptr;
+        HANDLE thread = NULL;
+    };
+
+private:
+    static DWORD WINAPI staticNodeThreadMain(LPVOID param);
+    bool isReady(const Node& node) const;
+    void startNode(Node& node);
+    // Report the overall progress to the listener; _lock must be held
+    void reportProgress();
+
+private:
+    CRITICAL_SECTION _lock;
+    CONDITION_VARIABLE _nodeFinished;
+    std::vector<Node> _nodes;
+    // Indices of the executed subtasks, in the order they finished
+    std::vector<size_t> _finishedOrder;
+    double _totalExecutionTime = 0.0;
+    double _remainingRollbackTime = 0.0;
+    bool _rollingBack = false;
+};
+
+template<class TaskType, typename... Args>
+inline TaskType& TaskGraph::addNew(Dependencies dependencies, Args&&... args)
+{
+    auto task = std::make_shared<TaskType>(std::forward<Args>(args)...);
+    add(task, dependencies);
+    return *task;
+}
+
+#endif // TASKS_GRAPH_H
@@ -19,6 +19,8 @@
 #include "payload.h"
 #ifdef INSTALLER
 
+#include <deque>
+
 // Payload data (for installer)
 static HRSRC g_payloadResource = NULL;
 static HGLOBAL g_payloadHandle = NULL;
@@ -119,6 +121,210 @@ void MemoryInStream_CreateVTable(CMemoryInStream* p, const Byte* buf, size_t siz
 }
 
 
+// Writes extracted files on a small pool of threads.  Several writes are in
+// flight at once, so the file system can overlap them (and the CRC checks)
+// instead of waiting on each file in turn; this matters most on HDDs, where
+// creating and writing many small files is dominated by seek time.
+//
+// Files are written directly from the unpacked folder buffer, so the writes
+// must be flushed before the buffer is released.  If a write fails, the
+// remaining queued files are skipped, and flush() aborts with the first error.
+class PayloadTask::FileWriter
+{
+public:
+    struct File
+    {
+        std::wstring path;
+        const Byte* data;
+        size_t size;
+        bool checkCrc;
+        UInt32 crc;
+        bool hasMTime;
+        FILETIME mTime;
+        bool hasAttribs;
+        DWORD attribs;
+    };
+
+public:
+    FileWriter();
+    ~FileWriter();
+
+    void queue(File file);
+    // Wait for the queued files to be written (throws InstallerError if any
+    // failed).  onProgress is called periodically with the fraction of the
+    // queued bytes that have been written.
+    void flush(const std::function<void(double)>& onProgress);
+    // Wait for the queued files without reporting errors (before rolling back)
+    void drain();
+
+private:
+    static DWORD WINAPI staticThreadMain(LPVOID param);
+    void threadMain();
+    UIString waitIdle(const std::function<void(double)>& onProgress);
+    static UIString writeFile(const File& file);
+
+private:
+    CRITICAL_SECTION _lock;
+    CONDITION_VARIABLE _queueChanged, _fileDone;
+    std::deque<File> _queue;
+    int _busyThreads = 0;
+    size_t _queuedBytes = 0, _writtenBytes = 0;
+    UIString _error;
+    bool _stopping = false;
+    std::vector<HANDLE> _threads;
+};
+
+PayloadTask::FileWriter::FileWriter()
+{
+    InitializeCriticalSection(&_lock);
+    InitializeConditionVariable(&_queueChanged);
+    InitializeConditionVariable(&_fileDone);
+    for (int i = 0; i < WriterThreadCount; i++)
+    {
+        if (HANDLE thread = CreateThread(NULL, 0, &staticThreadMain, reinterpret_cast<LPVOID>(this), 0, NULL))
+            _threads.push_back(thread);
+        else
+            LOG("Unable to create writer thread (%d)", GetLastError());
+    }
+}
+
+PayloadTask::FileWriter::~FileWriter()
+{
+    drain();
+    EnterCriticalSection(&_lock);
+    _stopping = true;
+    WakeAllConditionVariable(&_queueChanged);
+    LeaveCriticalSection(&_lock);
+    for (HANDLE thread : _threads)
+    {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+    DeleteCriticalSection(&_lock);
+}
+
+void PayloadTask::FileWriter::queue(File file)
+{
+    // If no threads could be created, just write synchronously
+    if (_threads.empty())
+    {
+        if (UIString error = writeFile(file))
+            InstallerError::abort(std::move(error));
+        return;
+    }
+
+    EnterCriticalSection(&_lock);
+    _queuedBytes += file.size;
+    _queue.push_back(std::move(file));
+    WakeConditionVariable(&_queueChanged);
+    LeaveCriticalSection(&_lock);
+}
+
+void PayloadTask::FileWriter::flush(const std::function<void(double)>& onProgress)
+{
+    if (UIString error = waitIdle(onProgress))
+        InstallerError::abort(std::move(error));
+}
+
+void PayloadTask::FileWriter::drain()
+{
+    waitIdle({});
+}
+
+DWORD WINAPI PayloadTask::FileWriter::staticThreadMain(LPVOID param)
+{
+    reinterpret_cast<FileWriter*>(param)->threadMain();
+    return 0;
+}
+
+void PayloadTask::FileWriter::threadMain()
+{
+    EnterCriticalSection(&_lock);
+    for (;;)
+    {
+        while (_queue.empty() && !_stopping)
+            SleepConditionVariableCS(&_queueChanged, &_lock, INFINITE);
+        if (_queue.empty())
+            break;
+
+        File file = std::move(_queue.front());
+        _queue.pop_front();
+        // Skip the remaining files once a write has failed
+        bool skip = !_error.is_null();
+        ++_busyThreads;
+        LeaveCriticalSection(&_lock);
+
+        UIString error = skip ? UIString{} : writeFile(file);
+
+        EnterCriticalSection(&_lock);
+        --_busyThreads;
+        _writtenBytes += file.size;
+        if (error && !_error)
+            _error = std::move(error);
+        WakeAllConditionVariable(&_fileDone);
+    }
+    LeaveCriticalSection(&_lock);
+}
+
+UIString PayloadTask::FileWriter::waitIdle(const std::function<void(double)>& onProgress)
+{
+    EnterCriticalSection(&_lock);
+    while (!_queue.empty() || _busyThreads > 0)
+    {
+        if (onProgress)
+        {
+            double progress = _queuedBytes > 0 ? (double)_writtenBytes / _queuedBytes : 1.0;
+            LeaveCriticalSection(&_lock);
+            onProgress(progress);
+            EnterCriticalSection(&_lock);
+        }
+        SleepConditionVariableCS(&_fileDone, &_lock, 100);
+    }
+    _queuedBytes = 0;
+    _writtenBytes = 0;
+    UIString error = std::move(_error);
+    _error = {};
+    LeaveCriticalSection(&_lock);
+    return error;
+}
+
+UIString PayloadTask::FileWriter::writeFile(const File& file)
+{
+    if (file.checkCrc && CrcCalc(file.data, file.size) != file.crc)
+        return IDS_MB_CORRUPTPAYLOADCRC;
+
+    CSzFile outFile;
+    if (WRes err = OutFile_Open(&outFile, file.path.c_str()))
+        return UIString{IDS_MB_UNABLETOCREATEFILE, file.path};
+
+    size_t writtenBytes = file.size;
+    if (WRes err = File_Write(&outFile, file.data, &writtenBytes))
+    {
+        File_Close(&outFile);
+        return UIString{IDS_MB_UNABLETOWRITEFILE, file.path};
+    }
+    else if (writtenBytes != file.size)
+    {
+        File_Close(&outFile);
+        return UIString{IDS_MB_UNABLETOWRITEENTIREFILE, file.path};
+    }
+
+#ifdef USE_WINDOWS_FILE
+    if (file.hasMTime)
+        SetFileTime(outFile.handle, NULL, NULL, &file.mTime);
+#endif
+
+    File_Close(&outFile);
+
+#ifdef USE_WINDOWS_FILE
+    if (file.hasAttribs)
+        SetFileAttributes(file.path.c_str(), file.attribs);
+#endif
+
+    return {};
+}
+
+
 PayloadTask::UnpackTask* PayloadTask::_currentUnpackTask = nullptr;
 
 PayloadTask::UnpackTask::UnpackTask(UInt32 folderIndex, size_t folderSize)
@@ -186,47 +392,46 @@ void PayloadTask::ExtractTask::execute()
 
     _listener->setCaption(IDS_CAPTION_COPYINGFILES);
 
-    const auto& parent = this->parent();
-
-    if (SzBitWithVals_Check(&parent._db.CRCs, _fileIndex))
-        if (CrcCalc(parent._buffer + _offset, _size) != parent._db.CRCs.Vals[_fileIndex])
-            InstallerError::abort(IDS_MB_CORRUPTPAYLOADCRC);
+    auto& parent = this->parent();
 
+    // Back up any existing file here, so the backups (and any errors) happen
+    // in order on this thread; the write is queued
     CreateFileTask::execute();
 
-    CSzFile outFile;
-    if (WRes err = OutFile_Open(&outFile, _path.c_str()))
-        InstallerError::abort(UIString{IDS_MB_UNABLETOCREATEFILE, _path});
-
-    size_t writtenBytes = _size;
-    if (WRes err = File_Write(&outFile, parent._buffer + _offset, &writtenBytes))
-    {
-        File_Close(&outFile);
-        InstallerError::abort(UIString{IDS_MB_UNABLETOWRITEFILE, _path});
-    }
-    else if (writtenBytes != _size)
-    {
-        File_Close(&outFile);
-        InstallerError::abort(UIString{IDS_MB_UNABLETOWRITEENTIREFILE, _path});
-    }
-
-#ifdef USE_WINDOWS_FILE
-    if (SzBitWithVals_Check(&parent._db.MTime, _fileIndex))
+    FileWriter::File file{};
+    file.path = _path;
+    file.data = parent._buffer + _offset;
+    file.size = _size;
+    file.checkCrc = SzBitWithVals_Check(&parent._db.CRCs, _fileIndex);
+    if (file.checkCrc)
+        file.crc = parent._db.CRCs.Vals[_fileIndex];
+    file.hasMTime = SzBitWithVals_Check(&parent._db.MTime, _fileIndex);
+    if (file.hasMTime)
     {
         const CNtfsFileTime *t = parent._db.MTime.Vals + _fileIndex;
-        FILETIME mTime;
-        mTime.dwLowDateTime = t->Low;
-        mTime.dwHighDateTime = t->High;
-        SetFileTime(outFile.handle, NULL, NULL, &mTime);
+        file.mTime.dwLowDateTime = t->Low;
+        file.mTime.dwHighDateTime = t->High;
     }
-#endif
+    file.hasAttribs = SzBitWithVals_Check(&parent._db.Attribs, _fileIndex);
+    if (file.hasAttribs)
+        file.attribs = parent._db.Attribs.Vals[_fileIndex];
+    parent._writer->queue(std::move(file));
+}
 
-    File_Close(&outFile);
+PayloadTask::FlushTask::FlushTask(size_t totalSize)
+    : _totalSize(totalSize)
+{
 
-#ifdef USE_WINDOWS_FILE
-    if (SzBitWithVals_Check(&parent._db.Attribs, _fileIndex))
-        SetFileAttributes(_path.c_str(), parent._db.Attribs.Vals[_fileIndex]);
-#endif
+}
+
+void PayloadTask::FlushTask::execute()
+{
+    _listener->setCaption(IDS_CAPTION_COPYINGFILES);
+
+    parent()._writer->flush([this](double progress)
+    {
+        _listener->setProgress(progress, (1.0 - progress) * getEstimatedExecutionTime());
+    });
 }
 
 PayloadTask::PayloadTask(std::wstring installPath)
@@ -243,10 +448,14 @@ PayloadTask::PayloadTask(std::wstring installPath)
 
     // Wrap a memory stream around the payload resource
     MemoryInStream_CreateVTable(&_stream, g_payloadData, g_payloadSize);
+
+    _writer.reset(new FileWriter());
 }
 
 PayloadTask::~PayloadTask()
 {
+    // Finish any writes before releasing the buffer
+    _writer.reset();
     ISzAlloc_Free(&_alloc, _buffer);
 
     SzArEx_Free(&_db, &_alloc);
@@ -275,6 +484,9 @@ void PayloadTask::prepare()
     UInt32 lastFolderIndex = (UInt32)-1;
     size_t folderOffset = 0;
     size_t folderSize = 0;
+    // Total size of the files extracted from the current folder; written by
+    // the FlushTask that follows them
+    size_t folderWriteSize = 0;
 
     recordInstallationSize((size_t)_db.UnpackPositions[_db.NumFiles]);
 
@@ -284,6 +496,9 @@ void PayloadTask::prepare()
         UInt32 folderIndex = _db.FileToFolder[fileIndex];
         if (folderIndex != lastFolderIndex)
         {
+            if (folderWriteSize > 0)
+                addNew<FlushTask>(folderWriteSize);
+            folderWriteSize = 0;
             folderSize = (size_t)SzAr_GetFolderUnpackSize(&_db.db, folderIndex);
             folderOffset = _db.UnpackPositions[_db.FolderToFile[folderIndex]];
             addNew<UnpackTask>(folderIndex, folderSize);
@@ -322,7 +537,10 @@ void PayloadTask::prepare()
         recordUninstallAction("FILE", std::move(relativePath));
 
         addNew<ExtractTask>(std::move(path), fileIndex, fileOffsetInBuffer, fileSize);
+        folderWriteSize += fileSize;
     }
+    if (folderWriteSize > 0)
+        addNew<FlushTask>(folderWriteSize);
 
     for (const auto& dir : directories)
         directoryTasks.addNew<CreateDirectoryTask>(_installPath + L"\\" + dir);
@@ -339,6 +557,14 @@ void PayloadTask::execute()
     _buffer = NULL;
 }
 
+void PayloadTask::rollback()
+{
+    // Writes could still be in progress if the installation was aborted while
+    // extracting files; finish them before their files are rolled back.
+    _writer->drain();
+    TaskList::rollback();
+}
+
 void PayloadTask::notifyInputStreamPosition(size_t offset, size_t size)
 {
     if (_currentUnpackTask)
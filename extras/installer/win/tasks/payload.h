@@ -48,6 +48,10 @@ class PayloadTask : public TaskList
 private:
     static constexpr double DecompressBytesPerSecond = 20000000.0;
     static constexpr double WriteBytesPerSecond = 20000000.0;
+    // Number of threads writing extracted files
+    static constexpr int WriterThreadCount = 4;
+
+    class FileWriter;
 
     class UnpackTask : public Task
     {
@@ -69,16 +73,32 @@ private:
         ExtractTask(std::wstring path, UInt32 fileIndex, size_t offset, size_t size);
         inline PayloadTask& parent() { return *static_cast<PayloadTask*>(_listener); }
         virtual void execute() override;
-        virtual double getEstimatedExecutionTime() const override { return 0.005 + _size / WriteBytesPerSecond; }
+        // The file is only backed up and queued here; the write itself is
+        // accounted for by the FlushTask following the folder's files.
+        virtual double getEstimatedExecutionTime() const override { return 0.005; }
     private:
         UInt32 _fileIndex;
         size_t _offset, _size;
     };
+    // Wait for the files queued by the preceding ExtractTasks to be written;
+    // the unpacked folder buffer is in use until then.
+    class FlushTask : public Task
+    {
+    public:
+        FlushTask(size_t totalSize);
+        inline PayloadTask& parent() { return *static_cast<PayloadTask*>(_listener); }
+        virtual void execute() override;
+        virtual double getEstimatedExecutionTime() const override { return _totalSize / WriteBytesPerSecond; }
+        virtual double getEstimatedRollbackTime() const override { return 0.0; }
+    private:
+        size_t _totalSize;
+    };
 public:
     PayloadTask(std::wstring installPath);
     ~PayloadTask();
     virtual void prepare() override;
     virtual void execute() override;
+    virtual void rollback() override;
 
     static void notifyInputStreamPosition(size_t offset, size_t size);
 private:
@@ -88,6 +108,7 @@ private:
     CMemoryInStream _stream;
     Byte* _buffer = nullptr;
     size_t _bufferSize = 0;
+    std::unique_ptr<FileWriter> _writer;
 
     static UnpackTask* _currentUnpackTask;
 };
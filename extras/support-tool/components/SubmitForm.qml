@@ -43,6 +43,11 @@ Item {
   // 2 - Success
   // -1 - error
   property int formStatus: 0
+  // Percentage of the report uploaded so far (while formStatus is 1)
+  property int uploadPercent: 0
+  // Whether the payload was built for a failed upload; sending again reuses it
+  // so ReportHelper can resume the upload
+  property bool payloadReady: false
   property string referenceId: ""
   property string networkErrorMessage: ""
 
@@ -220,6 +225,7 @@ Item {
           MouseArea {
             anchors.fill: parent
             onClicked: {
+              payloadReady = false
               wizardLayout.currentIndex = 0;
             }
           }
@@ -238,8 +244,10 @@ Item {
             enabled: formStatus <= 0 && legalCheckbox.checked
             onClicked: {
                 // create the payload and send if successful
-                if (makePayload()) {
-                    ReportHelper.sendPayload(PayloadBuilder.payloadZipContent(),
+                if (payloadReady || makePayload()) {
+                    payloadReady = true
+                    uploadPercent = 0
+                    ReportHelper.sendPayload(PayloadBuilder.payloadFilePath(),
                                              comments.text)
                     formStatus = 1
                 } else {
@@ -252,7 +260,8 @@ Item {
         text: {
             switch (formStatus) {
             case 1:
-                return "Sending your report. Please wait"
+                return "Sending your report. Please wait" + (
+                  uploadPercent > 0 ? " (" + uploadPercent + "%)" : "")
             case -1:
               // Show a network error message if one is set.
                 return "Encountered an error. Please try again." + (
@@ -315,6 +324,7 @@ Item {
       Connections {
         target: ReportHelper
         onUploadSuccess: function (shortcode) {
+          payloadReady = false
           referenceId = shortcode
           formStatus = 2
           wizardLayout.currentIndex = 2
@@ -323,6 +333,9 @@ Item {
           networkErrorMessage = msg
           formStatus = -1
         }
+        onUploadProgress: function (sent, total) {
+          uploadPercent = total > 0 ? Math.floor(sent * 100 / total) : 0
+        }
       }
       Item {
         // spacer
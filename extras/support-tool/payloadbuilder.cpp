@@ -18,15 +18,14 @@
 
 #include "payloadbuilder.h"
 #include "logging.h"
-#include <QProcess>
 #include <QUrl>
 #include <QDateTime>
-#include "path.h"
-#include "reporthelper.h"
 
-QByteArray PayloadBuilder::payloadZipContent() const
+QString PayloadBuilder::payloadFilePath() const
 {
-    return _payloadZipContent;
+    if(!_targetDir)
+        return {};
+    return _targetDir->filePath(PAYLOAD_FILE);
 }
 
 PayloadBuilder::PayloadBuilder(QObject *parent)
@@ -41,94 +40,67 @@ void PayloadBuilder::start()
 
     _started = true;
 
+    _zipWriter.reset();
     _targetDir.reset(new QTemporaryDir());
     _targetDir->setAutoRemove(false);
     qDebug () << "Created temporary dir " << _targetDir->path();
 
-    // Create a new file in the payload called "logs.txt" which will contain all logs added via addLogFile
-    _combinedLogFile.reset(new QFile(payloadPath("logs.txt")));
+    _payloadFile.reset(new QFile(_targetDir->filePath(PAYLOAD_FILE)));
+    if(!_payloadFile->open(QIODevice::WriteOnly))
+        qWarning () << "Unable to create payload file" << _payloadFile->fileName();
+    _zipWriter.reset(new ZipWriter{*_payloadFile});
+
+    // Create a new file called "logs.txt" which will contain all logs added
+    // via addLogFile.  It's added to the payload in finish().
+    _combinedLogFile.reset(new QFile(_targetDir->filePath("logs.txt")));
     _combinedLogFile->open(QIODevice::WriteOnly);
-    _payloadZipContent.clear();
 }
 
 bool PayloadBuilder::finish(const QString &copyToPath)
 {
+    if(!_started) {
+        qWarning () << "Not started yet";
+        return false;
+    }
+
+    // Flag that everything is cleaned up
+    _started = false;
+
     _combinedLogFile->close();
+    _zipWriter->addFile(_combinedLogFile->fileName(),
+                        PAYLOAD_ROOT + QStringLiteral("/logs.txt"));
+
+    bool zipWritten = _zipWriter->finish();
+    _zipWriter.reset();
+    _payloadFile->close();
 
-#ifdef Q_OS_MACOS
-    QString zipCommand = "zip";
-#elif defined(Q_OS_WIN)
-    QString zipCommand = Path::ExecutableDir / "zip.exe";
-#elif defined (Q_OS_LINUX)
-    QString zipCommand("/usr/bin/zip");
-    if(!QFile::exists(zipCommand)) {
-        ReportHelper::showErrorMessage(QStringLiteral("Missing 'zip' command. Please install the appropriate package."));
+    if(!zipWritten || _payloadFile->error() != QFileDevice::NoError) {
+        qWarning () << "Unable to write payload zip file" << _payloadFile->fileName()
+            << "-" << _payloadFile->errorString();
         return false;
     }
-#endif
-
-    QStringList args;
-    args << PAYLOAD_FILE;
-    args << "-r" << PAYLOAD_ROOT;
-
-    QProcess zipProcess;
-    zipProcess.setProgram(zipCommand);
-    zipProcess.setArguments(args);
-    zipProcess.setWorkingDirectory(_targetDir->path());
-    zipProcess.start();
-    zipProcess.waitForFinished();
-
-    bool success = false;
-
-    if(zipProcess.exitStatus() == QProcess::NormalExit) {
-        QFile resultFile(_targetDir->filePath(PAYLOAD_FILE));
-        qDebug() << (_targetDir->filePath(PAYLOAD_FILE));
-        if(resultFile.exists()) {
-            resultFile.open(QIODevice::ReadOnly);
-            _payloadZipContent.append(resultFile.readAll());
-            resultFile.close();
-
-            // If we need to store a copy elsewhere (for save as zip) make a copy
-            // but success is determined by whether we could copy or not.
-            // even though the zip could be generated successfully
-            if(copyToPath.length() > 0) {
-                // Sometimes the file dialog can provide "file://" schema URLs.
-                // To reliably convert them we need to make a new path
-
-                QString copyTargetPath = copyToPath;
-                if(copyToPath.startsWith("file://")) {
-                     copyTargetPath = QUrl(copyToPath).toLocalFile();
-                }
-
-                if(!resultFile.copy(copyTargetPath)) {
-                    qWarning () << "Unable to copy to " << copyTargetPath;
-                }
-                else {
-                    success = true;
-                }
-            }
-            else {
-                success = true;
-            }
-        } else {
-            qWarning () << "Payload zip file does not exist";
+
+    qDebug () << "Wrote payload" << _payloadFile->fileName() << "-" << _payloadFile->size() << "bytes";
+
+    // If we need to store a copy elsewhere (for save as zip) make a copy
+    // but success is determined by whether we could copy or not.
+    // even though the zip could be generated successfully
+    if(copyToPath.length() > 0) {
+        // Sometimes the file dialog can provide "file://" schema URLs.
+        // To reliably convert them we need to make a new path
+
+        QString copyTargetPath = copyToPath;
+        if(copyToPath.startsWith("file://")) {
+             copyTargetPath = QUrl(copyToPath).toLocalFile();
         }
-    }
-    else {
-        qWarning () << "Zip return code" << zipProcess.exitCode();
-    }
 
-    if(!success)
-    {
-        qWarning () << "Zip process failed.";
-        qWarning () << zipProcess.readAllStandardOutput();
-        qWarning () << zipProcess.readAllStandardError();
+        if(!_payloadFile->copy(copyTargetPath)) {
+            qWarning () << "Unable to copy to " << copyTargetPath;
+            return false;
+        }
     }
 
-    // Flag that everything is cleaned up
-    _started = false;
-
-    return success;
+    return true;
 }
 
 void PayloadBuilder::addFile(const QString &fullPath)
@@ -170,17 +142,19 @@ void PayloadBuilder::addFileToPayload(const QString &sourcePath, const QString &
         return;
     }
 
-    QString fullTargetPath = payloadPath(targetName);
-    if(QFileInfo(targetName).size() > FILE_SIZE_LIMIT) {
-        qWarning () << "Skipped large file " << targetName;
+    QFileInfo sourceInfo(sourcePath);
+    if(!sourceInfo.exists()) {
+        qWarning() << "Unable to add file: " << sourcePath;
         return;
     }
-    if(QFile::copy(sourcePath, fullTargetPath)) {
-        qDebug () << "Added file: " << fullTargetPath;
-    }
-    else {
-        qWarning() << "Unable to add file: " << fullTargetPath;
+    if(sourceInfo.size() > FILE_SIZE_LIMIT) {
+        qWarning () << "Skipped large file " << sourcePath;
+        return;
     }
+
+    // Zip entry names always use '/', regardless of platform
+    _zipWriter->addFile(sourcePath, PAYLOAD_ROOT + '/' + targetName);
+    qDebug () << "Added file: " << sourcePath << "as" << targetName;
 }
 
 void PayloadBuilder::addLogFile(const QString &fullPath)
@@ -214,4 +188,50 @@ void PayloadBuilder::addLogFile(const QString &fullPath)
     if(QFile::exists(fullPath + oldFileSuffix)) {
         addLogFile(fullPath + oldFileSuffix);
     }
+
+    // Older generations are already compressed, add them to the payload as-is
+    // rather than expanding them into logs.txt
+    for(int generation = 1; generation <= compressedLogGenerations; ++generation) {
+        QString compressedPath = compressedLogFilePath(fullPath, generation);
+        if(QFile::exists(compressedPath)) {
+            addFileToPayload(compressedPath, QStringLiteral("logs/%1")
+                             .arg(QFileInfo(compressedPath).fileName()));
+        }
+    }
+
+    // If the binary log format was used, render that log too
+    if(!fullPath.endsWith(binaryLogSuffix) && !fullPath.endsWith(oldFileSuffix))
+        addBinaryLogFile(fullPath + binaryLogSuffix);
+}
+
+void PayloadBuilder::addBinaryLogFile(const QString &fullPath)
+{
+    QFileInfo fi(fullPath);
+    if(fi.exists() && fi.isReadable()) {
+        qDebug () << "Adding binary log file with path: " << fullPath;
+        _combinedLogFile->write((QStringLiteral("\n/PIA_PART/%1\n").arg(fi.fileName()).toUtf8()));
+
+        if(fi.size() > FILE_SIZE_LIMIT) {
+            _combinedLogFile->write(QStringLiteral("File Too large. Skipping \n").toUtf8());
+            return;
+        }
+
+        QFile file(fi.filePath());
+        file.open(QFile::ReadOnly);
+        _combinedLogFile->write(renderBinaryLog(file.readAll()));
+        file.close();
+    }
+
+    if(QFile::exists(fullPath + oldFileSuffix)) {
+        addBinaryLogFile(fullPath + oldFileSuffix);
+    }
+
+    // Compressed generations are added as-is, like the text log's
+    for(int generation = 1; generation <= compressedLogGenerations; ++generation) {
+        QString compressedPath = compressedLogFilePath(fullPath, generation);
+        if(QFile::exists(compressedPath)) {
+            addFileToPayload(compressedPath, QStringLiteral("logs/%1")
+                             .arg(QFileInfo(compressedPath).fileName()));
+        }
+    }
 }
@@ -25,6 +25,8 @@
 #include <QTemporaryDir>
 #include <QDebug>
 #include <QScopedPointer>
+#include <memory>
+#include "zipwriter.h"
 
 // The entire payload is in a single folder. The current CrashLab implementation
 // doesn't depend on this, but it's better to keep the name consistent for future
@@ -48,31 +50,15 @@ private:
     // Target temp dir where we build the payload
     QScopedPointer<QTemporaryDir> _targetDir;
 
-    // A bute array containing the contents of the zip file for uploading
-    QByteArray _payloadZipContent;
+    // The zip file being written, and the writer that streams entries into it.
+    // Files are compressed directly from their original locations; they
+    // aren't copied into the temp dir first.
+    QScopedPointer<QFile> _payloadFile;
+    std::unique_ptr<ZipWriter> _zipWriter;
 
-    // Returns a full filesystem path for a given relative file path
-    // For example, if "file" is "client-crash/bar.dmp"
-    // - if the current target dir is /tmp/foo
-    // - current payload is /tmp/foo/payload
-    // - Final file is "/tmp/foo/payload/client-crash/bar.dmp"
-    // - This function ensures that client-crash dir is created
-    //
-    // We can use _targetDir->filePath() instead of this but this function ensures
-    // the directory exists
-    //
-    // Also, it's important to note that QDir's absoluteFilePath normalizes
-    // dir seprators, so client-crash/bar.dmp becomes client-crash\bar.dmp on windows
-    QString payloadPath (const QString &fileName) {
-        QDir payloadDir(_targetDir->filePath(PAYLOAD_ROOT));
-        QFileInfo fi(payloadDir.absoluteFilePath(fileName));
-        if(!fi.dir().exists()) {
-            qDebug () << "Creating dir" << fi.dir().absolutePath();
-            fi.dir().mkpath(".");
-        }
-        return fi.absoluteFilePath();
-    }
-    void addFileToPayload(const QString &sourcePath, const QString &targetPath);
+    void addFileToPayload(const QString &sourcePath, const QString &targetName);
+    // Render a binary log (and its rotated generations) into the combined log
+    void addBinaryLogFile(const QString &fullPath);
 
 public:
     explicit PayloadBuilder(QObject *parent = nullptr);
@@ -86,7 +72,9 @@ public:
     // Add any misc file (currently used for diagnostics.txt)
     Q_INVOKABLE void addFile (const QString &fullPath);
 
-    Q_INVOKABLE QByteArray payloadZipContent() const;
+    // Path to the zip file built by the last call to finish() - the upload
+    // reads it directly from here
+    Q_INVOKABLE QString payloadFilePath() const;
 signals:
 
 public slots:
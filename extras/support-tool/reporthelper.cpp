@@ -25,6 +25,7 @@
 #include <QDebug>
 #include <QHttpMultiPart>
 #include <QFileInfo>
+#include <QFile>
 #include <QNetworkReply>
 #include <QProcess>
 #include <QGuiApplication>
@@ -32,6 +33,9 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QTimer>
+#include <QUrl>
+#include <algorithm>
+#include <utility>
 #include "path.h"
 #include "brand.h"
 
@@ -45,27 +49,57 @@
 
 QObject *ReportHelper::_uiParams;
 
-void ReportHelper::sendPayload(const QByteArray &payloadContent, const QString &comment)
+namespace
 {
-    // Set up the request
-    QString url = getUrl("/api/v1/reports/upload");
-    qDebug () << "Sending payload to URL: " << url << "Payload size: " << payloadContent.size();
-    _request.setUrl(url);
+    // Large payloads are uploaded in chunks of this size, so a network
+    // failure only has to resend the current chunk
+    const qint64 UploadChunkSize = 256 * 1024;
+    // Attempts for each chunk before the upload fails; retries back off from
+    // the initial delay, doubling each time
+    const int ChunkAttemptLimit = 5;
+    const int ChunkRetryDelayMs = 1000;
+
+    // The upload responses are a short report code; anything longer is an
+    // error page from the server
+    bool isReportCode(const QString &data)
+    {
+        return !data.isEmpty() && data.length() <= 15;
+    }
+}
 
-    // Create a multipart uploader. We will delete this in `onUploadFinished`
-    QHttpMultiPart *uploader = new QHttpMultiPart(QHttpMultiPart::FormDataType);
+void ReportHelper::sendPayload(const QString &payloadFilePath, const QString &comment)
+{
+    QFileInfo payloadInfo{payloadFilePath};
 
-    //
-    // Create a file part from the zip file contents from PayloadBuilder
-    //
-    QHttpPart filePart;
-    filePart.setHeader(QNetworkRequest::ContentDispositionHeader, QVariant("form-data; name=\"payload\"; filename=\""+ PAYLOAD_FILE + "\""));
-    filePart.setHeader(QNetworkRequest::ContentTypeHeader, QVariant("application/octet-stream"));
-    filePart.setBody(payloadContent);
+    // If the last chunked upload of this payload failed, resume it
+    if(!_uploadId.isEmpty() && _uploadPath == payloadFilePath &&
+       _uploadComment == comment && _uploadSize == payloadInfo.size() &&
+       _uploadModified == payloadInfo.lastModified())
+    {
+        qDebug() << "Resuming upload" << _uploadId << "at" << _uploadOffset
+            << "of" << _uploadSize;
+        _chunkAttempts = 0;
+        sendNextChunk();
+        return;
+    }
 
-    //
-    // Create parts for the version/comment/platform
-    //
+    _uploadPath = payloadFilePath;
+    _uploadComment = comment;
+    _uploadModified = payloadInfo.lastModified();
+    _uploadSize = payloadInfo.size();
+    _uploadFile.reset();
+    _uploadId.clear();
+    _uploadOffset = 0;
+    _chunkAttempts = 0;
+
+    if(_uploadSize <= UploadChunkSize)
+        sendSinglePayload();
+    else
+        startChunkedUpload();
+}
+
+void ReportHelper::appendReportFields(QHttpMultiPart &uploader, const QString &comment) const
+{
     QHttpPart verPart;
     verPart.setHeader(QNetworkRequest::ContentDispositionHeader, QVariant("form-data; name=\"version\""));
     verPart.setBody(PIA_VERSION);
@@ -92,21 +126,204 @@ void ReportHelper::sendPayload(const QByteArray &payloadContent, const QString &
     platformPart.setBody("linux-x64");
 #endif
 
-    uploader->append(verPart);
-    uploader->append(brandPart);
-    uploader->append(platformPart);
-    uploader->append(commentPart);
+    uploader.append(verPart);
+    uploader.append(brandPart);
+    uploader.append(platformPart);
+    uploader.append(commentPart);
+}
+
+void ReportHelper::sendSinglePayload()
+{
+    // Set up the request
+    QString url = getUrl("/api/v1/reports/upload");
+    qDebug () << "Sending payload to URL: " << url << "Payload size: " << _uploadSize;
+    _request.setUrl(url);
+
+    // Create a multipart uploader. We will delete this in `onUploadFinished`
+    QHttpMultiPart *uploader = new QHttpMultiPart(QHttpMultiPart::FormDataType);
+
+    //
+    // Create a file part from the zip file built by PayloadBuilder.  The file
+    // is read from disk as it's uploaded rather than being loaded into memory;
+    // it's owned by the uploader.
+    //
+    QFile *payloadFile = new QFile{_uploadPath, uploader};
+    if(!payloadFile->open(QIODevice::ReadOnly))
+        qWarning() << "Unable to open payload" << _uploadPath << "-" << payloadFile->errorString();
+    QHttpPart filePart;
+    filePart.setHeader(QNetworkRequest::ContentDispositionHeader, QVariant("form-data; name=\"payload\"; filename=\""+ PAYLOAD_FILE + "\""));
+    filePart.setHeader(QNetworkRequest::ContentTypeHeader, QVariant("application/octet-stream"));
+    filePart.setBodyDevice(payloadFile);
+
+    appendReportFields(*uploader, _uploadComment);
     uploader->append(filePart);
 
     // Perform the post request
     _reply = _nm.post(_request, uploader);
     uploader->setParent(_reply);
 
+    connect(_reply, &QNetworkReply::uploadProgress, this, &ReportHelper::uploadProgress);
     connect(_reply, &QNetworkReply::finished, this, &ReportHelper::onUploadFinished);
     connect(_reply, QOverload<QNetworkReply::NetworkError>::of(&QNetworkReply::error),
             this, &ReportHelper::onError);
 }
 
+void ReportHelper::startChunkedUpload()
+{
+    QString url = getUrl("/api/v1/reports/upload/start");
+    qDebug () << "Starting chunked upload at URL: " << url << "Payload size: " << _uploadSize;
+    _request.setUrl(url);
+
+    // The report fields are sent when the session is created, the chunks then
+    // only carry the payload
+    QHttpMultiPart *uploader = new QHttpMultiPart(QHttpMultiPart::FormDataType);
+    appendReportFields(*uploader, _uploadComment);
+    QHttpPart sizePart;
+    sizePart.setHeader(QNetworkRequest::ContentDispositionHeader, QVariant("form-data; name=\"size\""));
+    sizePart.setBody(QByteArray::number(_uploadSize));
+    uploader->append(sizePart);
+
+    _reply = _nm.post(_request, uploader);
+    uploader->setParent(_reply);
+    connect(_reply, &QNetworkReply::finished, this, &ReportHelper::onUploadStarted);
+}
+
+void ReportHelper::onUploadStarted()
+{
+    QNetworkReply *reply = std::exchange(_reply, nullptr);
+    reply->deleteLater();
+
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if(reply->error() == QNetworkReply::NoError)
+    {
+        // The response is the upload ID, which goes in the chunk URLs
+        QByteArray id = reply->readAll().trimmed();
+        if(!id.isEmpty() && id.size() <= 64 &&
+           QUrl::toPercentEncoding(QString::fromLatin1(id)) == id)
+        {
+            _uploadId = QString::fromLatin1(id);
+            qDebug() << "Started upload" << _uploadId;
+            sendNextChunk();
+            return;
+        }
+        qWarning() << "Invalid upload ID from server";
+        emit uploadFail(QStringLiteral("Server error"));
+        return;
+    }
+
+    // If the server doesn't support chunked uploads, send the payload in one
+    // request instead
+    if(status == 404 || status == 405)
+    {
+        qDebug() << "Chunked upload not supported (" << status
+            << "), sending payload in one request";
+        sendSinglePayload();
+        return;
+    }
+
+    qDebug () << "Network error starting upload: " << reply->error();
+    emit uploadFail(reply->errorString());
+}
+
+void ReportHelper::sendNextChunk()
+{
+    if(!_uploadFile)
+    {
+        _uploadFile.reset(new QFile{_uploadPath});
+        if(!_uploadFile->open(QIODevice::ReadOnly))
+        {
+            qWarning() << "Unable to open payload" << _uploadPath << "-" << _uploadFile->errorString();
+            _uploadFile.reset();
+            emit uploadFail(QStringLiteral("Unable to read report"));
+            return;
+        }
+    }
+
+    QByteArray chunk;
+    if(_uploadFile->seek(_uploadOffset))
+        chunk = _uploadFile->read(std::min(UploadChunkSize, _uploadSize - _uploadOffset));
+    if(chunk.isEmpty())
+    {
+        qWarning() << "Unable to read payload at" << _uploadOffset << "-" << _uploadFile->errorString();
+        emit uploadFail(QStringLiteral("Unable to read report"));
+        return;
+    }
+    _chunkLength = chunk.size();
+
+    _request.setUrl(getUrl(QStringLiteral("/api/v1/reports/upload/%1/chunk").arg(_uploadId)));
+    QNetworkRequest chunkRequest{_request};
+    chunkRequest.setHeader(QNetworkRequest::ContentTypeHeader, QVariant("application/octet-stream"));
+    // The range makes each chunk idempotent, so a chunk can be resent if the
+    // response was lost
+    chunkRequest.setRawHeader("Content-Range",
+                              QStringLiteral("bytes %1-%2/%3").arg(_uploadOffset)
+                                .arg(_uploadOffset + _chunkLength - 1)
+                                .arg(_uploadSize).toLatin1());
+
+    _reply = _nm.post(chunkRequest, chunk);
+    connect(_reply, &QNetworkReply::uploadProgress, this, [this](qint64 sent, qint64)
+    {
+        emit uploadProgress(_uploadOffset + sent, _uploadSize);
+    });
+    connect(_reply, &QNetworkReply::finished, this, &ReportHelper::onChunkFinished);
+}
+
+void ReportHelper::onChunkFinished()
+{
+    QNetworkReply *reply = std::exchange(_reply, nullptr);
+    reply->deleteLater();
+
+    if(reply->error() != QNetworkReply::NoError)
+    {
+        // Client errors other than timeouts/throttling won't succeed later
+        int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        bool permanent = status >= 400 && status < 500 && status != 408 && status != 429;
+        ++_chunkAttempts;
+        if(permanent || _chunkAttempts >= ChunkAttemptLimit)
+        {
+            qDebug () << "Chunk at" << _uploadOffset << "failed after"
+                << _chunkAttempts << "attempts:" << reply->error();
+            // A permanent failure means the session is gone, start over next
+            // time.  Otherwise, keep it so sending again resumes here.
+            if(permanent)
+                _uploadId.clear();
+            emit uploadFail(reply->errorString());
+            return;
+        }
+
+        int delay = ChunkRetryDelayMs << (_chunkAttempts - 1);
+        qDebug () << "Chunk at" << _uploadOffset << "failed:" << reply->error()
+            << "- retrying in" << delay << "ms";
+        QTimer::singleShot(delay, this, &ReportHelper::sendNextChunk);
+        return;
+    }
+
+    _uploadOffset += _chunkLength;
+    _chunkAttempts = 0;
+    emit uploadProgress(_uploadOffset, _uploadSize);
+    if(_uploadOffset < _uploadSize)
+    {
+        sendNextChunk();
+        return;
+    }
+
+    // The response to the last chunk is the report code, like the single
+    // upload's response
+    QString data = QString::fromUtf8(reply->readAll());
+    _uploadId.clear();
+    _uploadFile.reset();
+    if(!isReportCode(data))
+    {
+        qDebug () << "Suspicious output. Might be server error. Check server logs";
+        emit uploadFail(QStringLiteral("Server error"));
+    }
+    else
+    {
+        qDebug() << "Upload Success";
+        emit uploadSuccess(data);
+    }
+}
+
 void ReportHelper::restartApp(bool safeMode)
 {
     if(safeMode)
@@ -21,6 +21,9 @@
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QHttpMultiPart>
+#include <QDateTime>
+#include <QFile>
+#include <QScopedPointer>
 #include "brand.h"
 
 #ifndef REPORTHELPER_H
@@ -33,7 +36,7 @@ class ReportHelper: public QObject
     Q_OBJECT
 
 public:
-    Q_INVOKABLE void sendPayload(const QByteArray &payloadContent, const QString &comment);
+    Q_INVOKABLE void sendPayload(const QString &payloadFilePath, const QString &comment);
     Q_INVOKABLE void restartApp(bool safeMode);
     Q_INVOKABLE void exitReporter();
     Q_INVOKABLE void showFileInSystemViewer(const QString &fullPath);
@@ -62,9 +65,34 @@ public:
 private:
     QNetworkAccessManager _nm;
     QNetworkRequest _request;
-    QNetworkReply *_reply;
+    QNetworkReply *_reply = nullptr;
     QString getUrl(const QString &path) const;
 
+    // Add the version/brand/platform/comment parts of an upload
+    void appendReportFields(QHttpMultiPart &uploader, const QString &comment) const;
+    // Upload the whole payload in one request (small payloads, or servers
+    // without chunked upload support)
+    void sendSinglePayload();
+    // Chunked upload - start an upload session, then send the payload one
+    // chunk at a time.  A failed chunk is retried a few times; if it still
+    // fails, the session is kept so sending the same payload again resumes
+    // from the last chunk the server accepted.
+    void startChunkedUpload();
+    void sendNextChunk();
+
+    // The payload being uploaded
+    QString _uploadPath, _uploadComment;
+    QDateTime _uploadModified;
+    qint64 _uploadSize = 0;
+    QScopedPointer<QFile> _uploadFile;
+    // Chunked upload state - session ID (empty if there's no session), bytes
+    // accepted by the server, size of the chunk being sent, and failed
+    // attempts for that chunk
+    QString _uploadId;
+    qint64 _uploadOffset = 0;
+    qint64 _chunkLength = 0;
+    int _chunkAttempts = 0;
+
 #ifdef Q_OS_WIN
     bool checkDumpFileAgainstBlacklist(const QString &path) const;
 #endif
@@ -72,10 +100,14 @@ private:
 signals:
     void uploadSuccess(QString code);
     void uploadFail (QString message);
+    // Bytes of the payload sent so far
+    void uploadProgress(qint64 sent, qint64 total);
 
 private slots:
     void onUploadFinished();
     void onError(QNetworkReply::NetworkError err);
+    void onUploadStarted();
+    void onChunkFinished();
 };
 
 bool checkAutoRestart (const QString &settingsPath, const QString &clientCrashPath);
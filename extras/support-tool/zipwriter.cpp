@@ -0,0 +1,212 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "zipwriter.h"
+#include "util.h"
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+#include <algorithm>
+
+namespace
+{
+    enum : quint16
+    {
+        // Compression methods
+        MethodStored = 0,
+        MethodDeflate = 8,
+        // Version needed to extract (2.0 - deflate)
+        VersionNeeded = 20,
+        // General purpose flag - names are UTF-8
+        FlagUtf8Names = 0x0800,
+    };
+
+    enum : quint32
+    {
+        LocalHeaderSignature = 0x04034b50,
+        CentralHeaderSignature = 0x02014b50,
+        EndOfCentralDirSignature = 0x06054b50,
+    };
+
+    // Convert a timestamp to the DOS time and date used by zip
+    quint16 dosTime(const QDateTime &timestamp)
+    {
+        const QTime &time = timestamp.time();
+        return static_cast<quint16>((time.hour() << 11) | (time.minute() << 5) | (time.second() / 2));
+    }
+    quint16 dosDate(const QDateTime &timestamp)
+    {
+        const QDate &date = timestamp.date();
+        // DOS dates can't represent anything before 1980
+        if(date.year() < 1980)
+            return (1 << 5) | 1;
+        return static_cast<quint16>(((date.year() - 1980) << 9) | (date.month() << 5) | date.day());
+    }
+}
+
+void ZipWriter::appendLE16(QByteArray &out, quint16 value)
+{
+    out.append(static_cast<char>(value & 0xFF));
+    out.append(static_cast<char>((value >> 8) & 0xFF));
+}
+
+void ZipWriter::appendLE32(QByteArray &out, quint32 value)
+{
+    for(int i=0; i<4; ++i)
+        out.append(static_cast<char>((value >> (i*8)) & 0xFF));
+}
+
+ZipWriter::CompressedEntry ZipWriter::compressFile(const QString &sourcePath, QByteArray name)
+{
+    CompressedEntry entry{std::move(name), {}, MethodStored, 0, 0, {}, false};
+
+    QFile source{sourcePath};
+    if(!source.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "Unable to read" << sourcePath << "-" << source.errorString();
+        return entry;
+    }
+    QByteArray content = source.readAll();
+    entry.modified = QFileInfo{source}.lastModified();
+    entry.crc = crc32(content);
+    entry.uncompressedSize = static_cast<quint32>(content.size());
+
+    // Store the entry if it can't be compressed (including empty files, which
+    // qCompress() doesn't produce a stream for), or if compression doesn't
+    // help (crash dumps are sometimes already compressed)
+    QByteArray compressed = deflateRaw(content, 6);
+    if(!compressed.isEmpty() && compressed.size() < content.size())
+    {
+        entry.method = MethodDeflate;
+        entry.data = std::move(compressed);
+    }
+    else
+        entry.data = std::move(content);
+    entry.valid = true;
+    return entry;
+}
+
+ZipWriter::ZipWriter(QIODevice &output)
+    : _output{output}, _offset{0}, _writeFailed{false}
+{
+}
+
+ZipWriter::~ZipWriter()
+{
+    for(auto &pending : _pending)
+        pending.wait();
+}
+
+void ZipWriter::write(const QByteArray &data)
+{
+    if(_output.write(data) != data.size())
+    {
+        if(!_writeFailed)
+            qWarning() << "Unable to write zip data -" << _output.errorString();
+        _writeFailed = true;
+    }
+    _offset += static_cast<quint32>(data.size());
+}
+
+void ZipWriter::writeNextEntry()
+{
+    CompressedEntry entry = _pending.front().get();
+    _pending.pop_front();
+    if(!entry.valid)
+        return;
+
+    CentralEntry central{entry.name, entry.method, dosTime(entry.modified),
+                         dosDate(entry.modified), entry.crc,
+                         static_cast<quint32>(entry.data.size()),
+                         entry.uncompressedSize, _offset};
+
+    QByteArray header;
+    appendLE32(header, LocalHeaderSignature);
+    appendLE16(header, VersionNeeded);
+    appendLE16(header, FlagUtf8Names);
+    appendLE16(header, central.method);
+    appendLE16(header, central.dosTime);
+    appendLE16(header, central.dosDate);
+    appendLE32(header, central.crc);
+    appendLE32(header, central.compressedSize);
+    appendLE32(header, central.uncompressedSize);
+    appendLE16(header, static_cast<quint16>(central.name.size()));
+    appendLE16(header, 0);  // Extra field length
+    header.append(central.name);
+
+    write(header);
+    write(entry.data);
+    _centralEntries.push_back(std::move(central));
+}
+
+void ZipWriter::addFile(const QString &sourcePath, const QString &entryName)
+{
+    // Limit the number of entries compressing at once - wait for the oldest
+    // one and write it if we're at the limit
+    const std::size_t maxPending = static_cast<std::size_t>(std::max(2, QThread::idealThreadCount()));
+    while(_pending.size() >= maxPending)
+        writeNextEntry();
+
+    _pending.push_back(std::async(std::launch::async, &ZipWriter::compressFile,
+                                  sourcePath, entryName.toUtf8()));
+}
+
+bool ZipWriter::finish()
+{
+    while(!_pending.empty())
+        writeNextEntry();
+
+    const quint32 centralDirOffset = _offset;
+    QByteArray centralDir;
+    for(const auto &entry : _centralEntries)
+    {
+        appendLE32(centralDir, CentralHeaderSignature);
+        appendLE16(centralDir, VersionNeeded);  // Version made by
+        appendLE16(centralDir, VersionNeeded);
+        appendLE16(centralDir, FlagUtf8Names);
+        appendLE16(centralDir, entry.method);
+        appendLE16(centralDir, entry.dosTime);
+        appendLE16(centralDir, entry.dosDate);
+        appendLE32(centralDir, entry.crc);
+        appendLE32(centralDir, entry.compressedSize);
+        appendLE32(centralDir, entry.uncompressedSize);
+        appendLE16(centralDir, static_cast<quint16>(entry.name.size()));
+        appendLE16(centralDir, 0);  // Extra field length
+        appendLE16(centralDir, 0);  // Comment length
+        appendLE16(centralDir, 0);  // Disk number
+        appendLE16(centralDir, 0);  // Internal attributes
+        appendLE32(centralDir, 0);  // External attributes
+        appendLE32(centralDir, entry.localHeaderOffset);
+        centralDir.append(entry.name);
+    }
+    write(centralDir);
+
+    QByteArray end;
+    appendLE32(end, EndOfCentralDirSignature);
+    appendLE16(end, 0);  // This disk
+    appendLE16(end, 0);  // Disk with the central directory
+    appendLE16(end, static_cast<quint16>(_centralEntries.size()));
+    appendLE16(end, static_cast<quint16>(_centralEntries.size()));
+    appendLE32(end, static_cast<quint32>(centralDir.size()));
+    appendLE32(end, centralDirOffset);
+    appendLE16(end, 0);  // Comment length
+    write(end);
+
+    return !_writeFailed;
+}
@@ -0,0 +1,102 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#ifndef ZIPWRITER_H
+#define ZIPWRITER_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QIODevice>
+#include <QString>
+#include <QVector>
+#include <deque>
+#include <future>
+
+// ZipWriter writes a zip archive directly to an output device, reading each
+// entry from its source file.  Nothing is copied to a temporary directory, and
+// only the entries currently being compressed are held in memory.
+//
+// Each entry is read and compressed (deflate) on a worker thread when it's
+// added; a few entries are compressed concurrently.  The entries are written
+// to the output in the order they were added.
+class ZipWriter
+{
+private:
+    // An entry that has been read and compressed, ready to be written
+    struct CompressedEntry
+    {
+        QByteArray name;
+        QDateTime modified;
+        quint16 method;
+        quint32 crc;
+        quint32 uncompressedSize;
+        QByteArray data;
+        bool valid;
+    };
+
+    // An entry that has been written, for the central directory
+    struct CentralEntry
+    {
+        QByteArray name;
+        quint16 method;
+        quint16 dosTime, dosDate;
+        quint32 crc;
+        quint32 compressedSize, uncompressedSize;
+        quint32 localHeaderOffset;
+    };
+
+private:
+    static CompressedEntry compressFile(const QString &sourcePath, QByteArray name);
+    static void appendLE16(QByteArray &out, quint16 value);
+    static void appendLE32(QByteArray &out, quint32 value);
+
+public:
+    // The output device must be open for writing.  It must outlive the
+    // ZipWriter.
+    explicit ZipWriter(QIODevice &output);
+    // Waits for any pending entries (but doesn't write them if finish()
+    // wasn't called).
+    ~ZipWriter();
+
+private:
+    ZipWriter(const ZipWriter &) = delete;
+    ZipWriter &operator=(const ZipWriter &) = delete;
+
+    void write(const QByteArray &data);
+    // Write the oldest pending entry
+    void writeNextEntry();
+
+public:
+    // Add a file to the archive with the given entry name (use '/' as the
+    // directory separator).  The file is read when it's compressed; if it
+    // can't be read, it's skipped with a warning.
+    void addFile(const QString &sourcePath, const QString &entryName);
+    // Write the remaining entries and the central directory.  Returns false
+    // if anything couldn't be written to the output.
+    bool finish();
+
+private:
+    QIODevice &_output;
+    // Entries being compressed, in the order they were added
+    std::deque<std::future<CompressedEntry>> _pending;
+    QVector<CentralEntry> _centralEntries;
+    quint32 _offset;
+    bool _writeFailed;
+};
+
+#endif // ZIPWRITER_H
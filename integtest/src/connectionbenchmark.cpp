@@ -0,0 +1,206 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("connectionbenchmark.cpp")
+
+#include "connectionbenchmark.h"
+#include "output.h"
+#include "version.h"
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <algorithm>
+#include <numeric>
+
+namespace
+{
+    const QString defaultReportFile{QStringLiteral("connection-benchmark.csv")};
+
+    // Nearest-rank percentile of sorted samples
+    quint64 percentile(const std::vector<quint64> &sorted, unsigned pct)
+    {
+        auto rank = (sorted.size() * pct + 99) / 100;
+        return sorted[rank ? rank - 1 : 0];
+    }
+}
+
+bool ConnectionBenchmark::enabled()
+{
+    bool ok{false};
+    int count = qEnvironmentVariableIntValue("PIA_INTEG_BENCHMARK", &ok);
+    return ok && count > 0;
+}
+
+int ConnectionBenchmark::connectionCount()
+{
+    return enabled() ? qEnvironmentVariableIntValue("PIA_INTEG_BENCHMARK") : 1;
+}
+
+QStringList ConnectionBenchmark::regions()
+{
+    return QString::fromLocal8Bit(qgetenv("PIA_INTEG_BENCHMARK_REGIONS"))
+        .split(',', QString::SplitBehavior::SkipEmptyParts);
+}
+
+bool ConnectionBenchmark::record(const QString &configuration,
+                                 const QString &region, const QString &timing)
+{
+    static const QRegularExpression phaseTime{QStringLiteral(R"(^(\w+)=(\d+)ms$)")};
+
+    PhaseSamples &samples = _samples[{configuration, region}];
+    std::vector<std::pair<QString, quint64>> phases;
+    for(const auto &field : timing.split(' ', QString::SplitBehavior::SkipEmptyParts))
+    {
+        auto match = phaseTime.match(field);
+        if(!match.hasMatch())
+        {
+            qWarning() << "Can't parse connection timing:" << timing;
+            return false;
+        }
+        phases.push_back({match.captured(1), match.captured(2).toULongLong()});
+    }
+    if(phases.empty())
+        return false;
+
+    for(const auto &phase : phases)
+    {
+        auto itPhase = std::find_if(samples.begin(), samples.end(),
+            [&](const auto &phaseSamples){return phaseSamples.first == phase.first;});
+        if(itPhase == samples.end())
+            itPhase = samples.insert(samples.end(), std::make_pair(phase.first, std::vector<quint64>{}));
+        itPhase->second.push_back(phase.second);
+    }
+    return true;
+}
+
+auto ConnectionBenchmark::calcStats(const QString &phase,
+                                    std::vector<quint64> samples)
+    -> PhaseStats
+{
+    std::sort(samples.begin(), samples.end());
+    PhaseStats stats{};
+    stats.phase = phase;
+    stats.samples = samples.size();
+    stats.min = samples.front();
+    stats.p50 = percentile(samples, 50);
+    stats.p90 = percentile(samples, 90);
+    stats.p99 = percentile(samples, 99);
+    stats.max = samples.back();
+    stats.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+    return stats;
+}
+
+auto ConnectionBenchmark::buildStats() const
+    -> std::vector<std::pair<Key, std::vector<PhaseStats>>>
+{
+    std::vector<std::pair<Key, std::vector<PhaseStats>>> results;
+    for(const auto &configSamples : _samples)
+    {
+        std::vector<PhaseStats> phases;
+        for(const auto &phaseSamples : configSamples.second)
+            phases.push_back(calcStats(phaseSamples.first, phaseSamples.second));
+        if(!phases.empty())
+            results.push_back({configSamples.first, std::move(phases)});
+    }
+    return results;
+}
+
+void ConnectionBenchmark::writeReport() const
+{
+    auto results = buildStats();
+    if(results.empty())
+        return;
+
+    QString reportPath = QString::fromLocal8Bit(qgetenv("PIA_INTEG_BENCHMARK_REPORT"));
+    if(reportPath.isEmpty())
+        reportPath = defaultReportFile;
+    bool json = reportPath.endsWith(QStringLiteral(".json"), Qt::CaseSensitivity::CaseInsensitive);
+
+    QByteArray report;
+    if(json)
+    {
+        QJsonArray resultsJson;
+        for(const auto &result : results)
+        {
+            QJsonArray phasesJson;
+            for(const auto &stats : result.second)
+            {
+                phasesJson.append(QJsonObject{
+                    {QStringLiteral("phase"), stats.phase},
+                    {QStringLiteral("samples"), static_cast<int>(stats.samples)},
+                    {QStringLiteral("min"), static_cast<double>(stats.min)},
+                    {QStringLiteral("p50"), static_cast<double>(stats.p50)},
+                    {QStringLiteral("p90"), static_cast<double>(stats.p90)},
+                    {QStringLiteral("p99"), static_cast<double>(stats.p99)},
+                    {QStringLiteral("max"), static_cast<double>(stats.max)},
+                    {QStringLiteral("mean"), stats.mean}
+                });
+            }
+            resultsJson.append(QJsonObject{
+                {QStringLiteral("configuration"), result.first.first},
+                {QStringLiteral("region"), result.first.second},
+                {QStringLiteral("phases"), phasesJson}
+            });
+        }
+        report = QJsonDocument{QJsonObject{
+            {QStringLiteral("version"), QStringLiteral(PIA_VERSION)},
+            {QStringLiteral("results"), resultsJson}
+        }}.toJson();
+    }
+    else
+    {
+        report = "configuration,region,phase,samples,min,p50,p90,p99,max,mean\n";
+        for(const auto &result : results)
+        {
+            for(const auto &stats : result.second)
+            {
+                report += QStringLiteral("%1,%2,%3,%4,%5,%6,%7,%8,%9,%10\n")
+                    .arg(result.first.first, result.first.second, stats.phase)
+                    .arg(stats.samples).arg(stats.min).arg(stats.p50)
+                    .arg(stats.p90).arg(stats.p99).arg(stats.max)
+                    .arg(stats.mean, 0, 'f', 1).toUtf8();
+            }
+        }
+    }
+
+    QFile reportFile{reportPath};
+    if(!reportFile.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+       reportFile.write(report) != report.size())
+    {
+        outln() << "Unable to write connection benchmark report to" << reportPath;
+    }
+    else
+    {
+        outln() << "Wrote connection benchmark report to" << reportPath;
+    }
+
+    // Print the total connection time for each configuration
+    for(const auto &result : results)
+    {
+        for(const auto &stats : result.second)
+        {
+            if(stats.phase != QStringLiteral("total"))
+                continue;
+            outln() << "BENCH  :" << result.first.first << result.first.second
+                << QStringLiteral("- p50 %1ms, p90 %2ms, p99 %3ms, %4 connections")
+                    .arg(stats.p50).arg(stats.p90).arg(stats.p99).arg(stats.samples);
+        }
+    }
+}
@@ -0,0 +1,86 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("connectionbenchmark.h")
+
+#ifndef CONNECTIONBENCHMARK_H
+#define CONNECTIONBENCHMARK_H
+
+#include <QString>
+#include <QStringList>
+#include <map>
+#include <utility>
+#include <vector>
+
+// ConnectionBenchmark collects the time spent in each phase of the
+// connections made by the connection tests, so transports, ciphers, and
+// regions can be compared, and time-to-connect regressions can be caught
+// between releases.
+//
+// Benchmark mode is enabled by setting PIA_INTEG_BENCHMARK to the number of
+// connections to make for each configuration.  The report is written to
+// PIA_INTEG_BENCHMARK_REPORT (default "connection-benchmark.csv"); it's JSON
+// if the file name ends in ".json", otherwise CSV.  Each row of the report
+// has the minimum, median, 90th and 99th percentile, maximum, and mean time
+// (ms) for one phase of one configuration in one region.
+class ConnectionBenchmark
+{
+public:
+    // Whether benchmark mode is enabled
+    static bool enabled();
+    // Number of connections to make for each configuration - 1 if benchmark
+    // mode isn't enabled
+    static int connectionCount();
+    // Regions to compare in benchmark mode (PIA_INTEG_BENCHMARK_REGIONS,
+    // comma-separated location IDs).  Empty if not set.
+    static QStringList regions();
+
+public:
+    // Record the timing of one connection, from "piactl get connectiontiming"
+    // ("<phase>=<n>ms ... total=<n>ms").  Returns false if the timing couldn't
+    // be parsed (for example, "Unknown").
+    bool record(const QString &configuration, const QString &region,
+                const QString &timing);
+
+    // Write the report and print a summary.  Does nothing if no connections
+    // were recorded.
+    void writeReport() const;
+
+private:
+    struct PhaseStats
+    {
+        QString phase;
+        std::size_t samples;
+        quint64 min, p50, p90, p99, max;
+        double mean;
+    };
+
+    using Key = std::pair<QString, QString>;  // Configuration, region
+    // Durations (ms) recorded for each phase, with the phases in the order
+    // they were first reported
+    using PhaseSamples = std::vector<std::pair<QString, std::vector<quint64>>>;
+
+    static PhaseStats calcStats(const QString &phase, std::vector<quint64> samples);
+
+    std::vector<std::pair<Key, std::vector<PhaseStats>>> buildStats() const;
+
+private:
+    std::map<Key, PhaseSamples> _samples;
+};
+
+#endif
@@ -21,6 +21,7 @@
 
 #include "integtestcase.h"
 #include "cliharness.h"
+#include "connectionbenchmark.h"
 #include "settings.h"
 #include "tunnelcheckstatus.h"
 
@@ -31,11 +32,18 @@
 // value.
 //
 // Some more complex settings, like Proxy, are tested separately.
+//
+// In benchmark mode (see ConnectionBenchmark), each configuration is connected
+// several times, and the timing of each connection is recorded.
 class TestConnection : public IntegTestCase
 {
     Q_OBJECT
 
 private:
+    ConnectionBenchmark _benchmark;
+    // Configuration being tested, used to label benchmark results
+    QString _configuration;
+
     // Reset settings for a connection test
     void resetSettings()
     {
@@ -77,16 +85,28 @@ private:
     // complete, then disconnect and wait for that to complete.
     // The test function typically has set up the desired connection settings
     // before executing this test.
+    // In benchmark mode, this connects ConnectionBenchmark::connectionCount()
+    // times and records the timing of each connection.
     void runConnectionTest()
     {
-        CliHarness::connectVpn();
-        CliHarness::waitFor(QStringLiteral("connectionstate"), QStringLiteral("Connected"));
-        // Verify that we're really connected by checking the client/status API
-        // We should never get a result routed outside the VPN, this causes the
-        // test to fail.  Failures are initially OK though.
-        testConnectivity(TunnelCheckStatus::Status::OnVPN);
-        CliHarness::disconnectAndWait();
-        testConnectivity(TunnelCheckStatus::Status::OffVPN);
+        for(int i = 0; i < ConnectionBenchmark::connectionCount(); ++i)
+        {
+            CliHarness::connectVpn();
+            bool connected = CliHarness::waitFor(QStringLiteral("connectionstate"), QStringLiteral("Connected"));
+            if(connected && ConnectionBenchmark::enabled())
+            {
+                _benchmark.record(_configuration, CliHarness::get(QStringLiteral("region")),
+                                  CliHarness::get(QStringLiteral("connectiontiming")));
+            }
+            // Verify that we're really connected by checking the client/status API
+            // We should never get a result routed outside the VPN, this causes the
+            // test to fail.  Failures are initially OK though.
+            testConnectivity(TunnelCheckStatus::Status::OnVPN);
+            CliHarness::disconnectAndWait();
+            testConnectivity(TunnelCheckStatus::Status::OffVPN);
+            if(!connected)
+                break;  // Don't keep retrying a configuration that fails
+        }
     }
 
     // Test connecting with all of the options for a specific setting, except
@@ -102,6 +122,7 @@ private:
 
             qInfo() << "Testing" << settingName << "-" << value;
             CliHarness::applySetting(settingName, value);
+            _configuration = settingName + '=' + value;
             runConnectionTest();
         }
     }
@@ -113,6 +134,13 @@ private:
         QCOMPARE(CliHarness::get(QStringLiteral("connectionstate")), QStringLiteral("Disconnected"));
         // Reset to default settings for connection tests
         resetSettings();
+        _configuration = QStringLiteral("default");
+    }
+
+    virtual void integCleanupTestCase() override
+    {
+        _benchmark.writeReport();
+        IntegTestCase::integCleanupTestCase();
     }
 
 private slots:
@@ -140,6 +168,7 @@ private slots:
         for(const auto &port : defaultData.tcpPorts())
         {
             CliHarness::applySetting(QStringLiteral("remotePortTCP"), static_cast<int>(port));
+            _configuration = QStringLiteral("remotePortTCP=%1").arg(port);
             runConnectionTest();
         }
 
@@ -148,6 +177,7 @@ private slots:
         for(const auto &port : defaultData.udpPorts())
         {
             CliHarness::applySetting(QStringLiteral("remotePortUDP"), static_cast<int>(port));
+            _configuration = QStringLiteral("remotePortUDP=%1").arg(port);
             runConnectionTest();
         }
     }
@@ -158,6 +188,7 @@ private slots:
         // default "enabled" value.
         qInfo() << "Testing \"Use Small Packets\"";
         CliHarness::applySetting(QStringLiteral("mtu"), 1250);
+        _configuration = QStringLiteral("mtu=1250");
         runConnectionTest();
     }
     void testCipherChoices()
@@ -177,6 +208,20 @@ private slots:
         testSettingChoices(QStringLiteral("serverCertificate"), DaemonSettings::default_serverCertificate(),
                            DaemonSettings::choices_serverCertificate());
     }
+    // In benchmark mode, compare the default settings in each region listed
+    // in PIA_INTEG_BENCHMARK_REGIONS
+    void testRegionTiming()
+    {
+        const QStringList regions = ConnectionBenchmark::regions();
+        if(regions.isEmpty())
+            QSKIP("No benchmark regions given (PIA_INTEG_BENCHMARK_REGIONS)");
+        for(const auto &region : regions)
+        {
+            qInfo() << "Testing region" << region;
+            CliHarness::applySetting(QStringLiteral("location"), region);
+            runConnectionTest();
+        }
+    }
 };
 
 namespace
@@ -0,0 +1,427 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("tst_throughput.cpp")
+
+#include "integtestcase.h"
+#include "cliharness.h"
+#include "output.h"
+#include "path.h"
+#include "settings.h"
+#include "tunnelcheckstatus.h"
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHostInfo>
+#include <QProcess>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QUdpSocket>
+#include <memory>
+#include <vector>
+#if defined(Q_OS_LINUX)
+#include <unistd.h>
+#endif
+
+// Throughput tests
+//
+// These measure sustained TCP and UDP transfers through the tunnel, with one
+// stream and with several streams, for each cipher with the default and small
+// MTU.  Each transfer reports the throughput, and the CPU used by OpenVPN and
+// the daemon during the transfer (as a percentage of one core).
+//
+// The transfers are made to an echo service (RFC 862) on TCP and UDP, given by
+// PIA_INTEG_THROUGHPUT_ENDPOINT=<host>:<port>.  The tests are skipped if it
+// isn't set.  Optionally:
+// - PIA_INTEG_THROUGHPUT_SECONDS - duration of each transfer (default 10)
+// - PIA_INTEG_THROUGHPUT_REPORT - also write the results to this CSV file
+class TestThroughput : public IntegTestCase
+{
+    Q_OBJECT
+
+private:
+    enum : int
+    {
+        // Streams used for the multi-stream transfers
+        MultiStreamCount = 4,
+        // Size of each TCP write, and the most data each TCP stream keeps
+        // buffered
+        TcpChunk = 64 * 1024,
+        TcpMaxBuffered = 256 * 1024,
+        // Size of each UDP datagram (fits in the small MTU), and the most
+        // datagrams each UDP stream keeps in flight
+        UdpDatagramSize = 1100,
+        UdpWindow = 64,
+    };
+
+    // Sends data to the echo service over TCP and counts the bytes echoed
+    class TcpStream : public QObject
+    {
+    public:
+        TcpStream(const QHostAddress &host, quint16 port)
+            : _chunk{TcpChunk, 'x'}, _received{0}, _stopped{false}
+        {
+            connect(&_socket, &QTcpSocket::connected, this, &TcpStream::sendMore);
+            connect(&_socket, &QTcpSocket::bytesWritten, this, &TcpStream::sendMore);
+            connect(&_socket, &QTcpSocket::readyRead, this, [this]()
+            {
+                _received += _socket.readAll().size();
+            });
+            _socket.connectToHost(host, port);
+        }
+
+    public:
+        void stop() {_stopped = true; _socket.abort();}
+        qint64 received() const {return _received;}
+
+    private:
+        void sendMore()
+        {
+            while(!_stopped && _socket.bytesToWrite() < TcpMaxBuffered)
+                _socket.write(_chunk);
+        }
+
+    private:
+        QTcpSocket _socket;
+        QByteArray _chunk;
+        qint64 _received;
+        bool _stopped;
+    };
+
+    // Sends datagrams to the echo service over UDP and counts the bytes echoed.
+    // Datagrams are sent as replies arrive, keeping up to UdpWindow in flight;
+    // if no replies arrive for a while, the outstanding datagrams are assumed
+    // lost.
+    class UdpStream : public QObject
+    {
+    public:
+        UdpStream(const QHostAddress &host, quint16 port)
+            : _datagram{UdpDatagramSize, 'x'}, _inFlight{0}, _sent{0},
+              _received{0}, _receivedSinceCheck{false}, _stopped{false}
+        {
+            connect(&_socket, &QUdpSocket::readyRead, this, [this]()
+            {
+                while(_socket.hasPendingDatagrams())
+                {
+                    auto size = _socket.readDatagram(nullptr, 0);
+                    if(size < 0)
+                        break;
+                    _received += UdpDatagramSize;
+                    _receivedSinceCheck = true;
+                    if(_inFlight > 0)
+                        --_inFlight;
+                }
+                sendMore();
+            });
+            _lossTimer.setInterval(100);
+            connect(&_lossTimer, &QTimer::timeout, this, [this]()
+            {
+                if(!_receivedSinceCheck)
+                    _inFlight = 0;
+                _receivedSinceCheck = false;
+                sendMore();
+            });
+            _socket.connectToHost(host, port);
+            _lossTimer.start();
+            sendMore();
+        }
+
+    public:
+        void stop() {_stopped = true; _lossTimer.stop(); _socket.abort();}
+        qint64 received() const {return _received;}
+        qint64 sent() const {return _sent;}
+
+    private:
+        void sendMore()
+        {
+            while(!_stopped && _inFlight < UdpWindow)
+            {
+                if(_socket.write(_datagram) != _datagram.size())
+                    break;
+                ++_inFlight;
+                _sent += UdpDatagramSize;
+            }
+        }
+
+    private:
+        QUdpSocket _socket;
+        QTimer _lossTimer;
+        QByteArray _datagram;
+        int _inFlight;
+        qint64 _sent, _received;
+        bool _receivedSinceCheck;
+        bool _stopped;
+    };
+
+    struct Endpoint
+    {
+        QHostAddress host;
+        quint16 port;
+    };
+
+    // Resolve PIA_INTEG_THROUGHPUT_ENDPOINT; returns an empty host if it isn't
+    // set or can't be resolved
+    static Endpoint getEndpoint()
+    {
+        QString endpoint = QString::fromLocal8Bit(qgetenv("PIA_INTEG_THROUGHPUT_ENDPOINT"));
+        int portPos = endpoint.lastIndexOf(':');
+        if(portPos <= 0)
+            return {};
+        bool portOk{false};
+        quint16 port = endpoint.mid(portPos+1).toUShort(&portOk);
+        QHostInfo hostInfo = QHostInfo::fromName(endpoint.left(portPos));
+        if(!portOk || hostInfo.addresses().isEmpty())
+        {
+            qWarning() << "Can't resolve throughput endpoint" << endpoint;
+            return {};
+        }
+        return {hostInfo.addresses().front(), port};
+    }
+
+    static std::chrono::seconds transferDuration()
+    {
+        bool ok{false};
+        int seconds = qEnvironmentVariableIntValue("PIA_INTEG_THROUGHPUT_SECONDS", &ok);
+        return std::chrono::seconds{(ok && seconds > 0) ? seconds : 10};
+    }
+
+    // Total CPU time (seconds) used by the running processes with this
+    // executable name, or -1 if it can't be determined
+    static double processCpuSeconds(const QString &name)
+    {
+#if defined(Q_OS_LINUX)
+        static const double ticksPerSecond = static_cast<double>(::sysconf(_SC_CLK_TCK));
+        double total{-1};
+        const auto pids = QDir{QStringLiteral("/proc")}.entryList(QDir::Filter::Dirs);
+        for(const auto &pid : pids)
+        {
+            QFile comm{QStringLiteral("/proc/%1/comm").arg(pid)};
+            if(!comm.open(QIODevice::ReadOnly) || QString::fromLocal8Bit(comm.readAll().trimmed()) != name)
+                continue;
+            QFile stat{QStringLiteral("/proc/%1/stat").arg(pid)};
+            if(!stat.open(QIODevice::ReadOnly))
+                continue;
+            // The fields following the command name start with the state
+            // (field 3); utime and stime are fields 14 and 15
+            QByteArray statLine = stat.readAll();
+            auto fields = statLine.mid(statLine.lastIndexOf(')') + 2).split(' ');
+            if(fields.size() < 13)
+                continue;
+            total = std::max(total, 0.0) +
+                (fields[11].toLongLong() + fields[12].toLongLong()) / ticksPerSecond;
+        }
+        return total;
+#elif defined(Q_OS_MACOS)
+        QProcess ps;
+        ps.start(QStringLiteral("ps"), {QStringLiteral("-A"), QStringLiteral("-o"),
+                                        QStringLiteral("time=,comm=")});
+        if(!ps.waitForFinished())
+            return -1;
+        double total{-1};
+        for(const auto &line : ps.readAllStandardOutput().split('\n'))
+        {
+            // "[[hh:]mm:]ss.ss <path>"
+            auto fields = line.trimmed().split(' ');
+            if(fields.size() < 2 || !fields.last().endsWith(('/' + name).toLocal8Bit()))
+                continue;
+            double seconds{0};
+            for(const auto &part : fields.front().split(':'))
+                seconds = seconds * 60 + part.toDouble();
+            total = std::max(total, 0.0) + seconds;
+        }
+        return total;
+#elif defined(Q_OS_WIN)
+        QProcess ps;
+        ps.start(QStringLiteral("powershell.exe"),
+                 {QStringLiteral("-NoProfile"), QStringLiteral("-Command"),
+                  QStringLiteral("[string]::Format([cultureinfo]::InvariantCulture, '{0}', "
+                                 "(Get-Process -Name %1 -ErrorAction SilentlyContinue | "
+                                 "Measure-Object -Property CPU -Sum).Sum)").arg(name)});
+        if(!ps.waitForFinished())
+            return -1;
+        bool ok{false};
+        double total = ps.readAllStandardOutput().trimmed().toDouble(&ok);
+        return ok ? total : -1;
+#else
+        return -1;
+#endif
+    }
+
+    // Measures the CPU used by OpenVPN and the daemon
+    class CpuSample
+    {
+    public:
+        CpuSample()
+            : _openvpn{processCpuSeconds(openvpnName())},
+              _daemon{processCpuSeconds(daemonName())}
+        {
+            _elapsed.start();
+        }
+
+    public:
+        // CPU used since the sample was taken as a percentage of one core, or
+        // -1 if it couldn't be measured
+        double openvpnPercent() const {return percent(openvpnName(), _openvpn);}
+        double daemonPercent() const {return percent(daemonName(), _daemon);}
+
+    private:
+        static QString openvpnName() {return QFileInfo{Path::OpenVPNExecutable}.completeBaseName();}
+        static QString daemonName() {return QFileInfo{Path::DaemonExecutable}.completeBaseName();}
+
+        double percent(const QString &name, double startSeconds) const
+        {
+            double endSeconds = processCpuSeconds(name);
+            if(startSeconds < 0 || endSeconds < 0)
+                return -1;
+            return (endSeconds - startSeconds) * 100000.0 / std::max<qint64>(_elapsed.elapsed(), 1);
+        }
+
+    private:
+        QElapsedTimer _elapsed;
+        double _openvpn, _daemon;
+    };
+
+    QString _configuration;
+
+    void report(const QString &transfer, double mbitPerSec, double lossPercent,
+                const CpuSample &cpu)
+    {
+        double openvpnCpu = cpu.openvpnPercent();
+        double daemonCpu = cpu.daemonPercent();
+        outln() << "BENCH  :" << _configuration << transfer
+            << QStringLiteral("- %1 Mbit/s, loss %2%, openvpn CPU %3%, daemon CPU %4%")
+                .arg(mbitPerSec, 0, 'f', 2).arg(lossPercent, 0, 'f', 1)
+                .arg(openvpnCpu, 0, 'f', 1).arg(daemonCpu, 0, 'f', 1);
+
+        QString reportPath = QString::fromLocal8Bit(qgetenv("PIA_INTEG_THROUGHPUT_REPORT"));
+        if(reportPath.isEmpty())
+            return;
+        QFile reportFile{reportPath};
+        bool newFile = !reportFile.exists();
+        if(!reportFile.open(QIODevice::WriteOnly | QIODevice::Append))
+        {
+            qWarning() << "Can't write throughput report to" << reportPath;
+            return;
+        }
+        if(newFile)
+            reportFile.write("configuration,transfer,mbit_per_sec,loss_percent,openvpn_cpu_percent,daemon_cpu_percent\n");
+        reportFile.write(QStringLiteral("%1,%2,%3,%4,%5,%6\n").arg(_configuration, transfer)
+            .arg(mbitPerSec, 0, 'f', 2).arg(lossPercent, 0, 'f', 1)
+            .arg(openvpnCpu, 0, 'f', 1).arg(daemonCpu, 0, 'f', 1)
+            .toUtf8());
+    }
+
+    // Run a transfer with 'streamCount' streams of type StreamT for the
+    // transfer duration, then report the throughput received
+    template<class StreamT>
+    void runTransfer(const QString &name, const Endpoint &endpoint, int streamCount)
+    {
+        std::vector<std::unique_ptr<StreamT>> streams;
+        CpuSample cpu;
+        QElapsedTimer elapsed;
+        elapsed.start();
+        for(int i = 0; i < streamCount; ++i)
+            streams.emplace_back(new StreamT{endpoint.host, endpoint.port});
+        QTest::qWait(msec32(transferDuration()));
+        for(auto &pStream : streams)
+            pStream->stop();
+
+        qint64 received{0}, sent{0};
+        for(const auto &pStream : streams)
+        {
+            received += pStream->received();
+            sent += sentBytes(*pStream);
+        }
+        double mbitPerSec = received * 8.0 / 1000.0 / std::max<qint64>(elapsed.elapsed(), 1);
+        double lossPercent = sent > 0 ? (sent - received) * 100.0 / sent : 0.0;
+        report(name, mbitPerSec, lossPercent, cpu);
+        VERIFY_CONTINUE(received > 0);
+    }
+
+    // Loss is only measured for UDP; TCP retransmits, so everything sent is
+    // eventually received
+    static qint64 sentBytes(const TcpStream &stream) {return stream.received();}
+    static qint64 sentBytes(const UdpStream &stream) {return stream.sent();}
+
+    // Connect with each configuration, and run the transfer function for each
+    template<class TransferFunc>
+    void forEachConfiguration(TransferFunc transfer)
+    {
+        QStringList mtus{QStringLiteral("0"), QStringLiteral("1250")};
+        for(const auto &cipher : DaemonSettings::choices_cipher())
+        {
+            for(const auto &mtu : mtus)
+            {
+                _configuration = QStringLiteral("cipher=%1 mtu=%2").arg(cipher, mtu);
+                qInfo() << "Testing" << _configuration;
+                CliHarness::applySetting(QStringLiteral("cipher"), cipher);
+                CliHarness::applySetting(QStringLiteral("mtu"), mtu.toInt());
+                CliHarness::connectVpn();
+                if(CliHarness::waitFor(QStringLiteral("connectionstate"), QStringLiteral("Connected")))
+                {
+                    // Wait for traffic to route through the tunnel
+                    TunnelCheckStatus tunnelStatus;
+                    (void)QTest::qWaitFor([&]() -> bool {return tunnelStatus.status() == TunnelCheckStatus::Status::OnVPN;}, 10000);
+                    transfer();
+                }
+                CliHarness::disconnectAndWait();
+            }
+        }
+    }
+
+    virtual void integInit() override
+    {
+        IntegTestCase::integInit();
+        QCOMPARE(CliHarness::get(QStringLiteral("connectionstate")), QStringLiteral("Disconnected"));
+        CliHarness::resetSettings();
+        CliHarness::applySetting(QStringLiteral("automaticTransport"), false);
+    }
+
+private slots:
+    void testTcpThroughput()
+    {
+        Endpoint endpoint = getEndpoint();
+        if(endpoint.host.isNull())
+            QSKIP("No throughput endpoint given (PIA_INTEG_THROUGHPUT_ENDPOINT)");
+        forEachConfiguration([&]()
+        {
+            runTransfer<TcpStream>(QStringLiteral("tcp-single"), endpoint, 1);
+            runTransfer<TcpStream>(QStringLiteral("tcp-multi"), endpoint, MultiStreamCount);
+        });
+    }
+
+    void testUdpThroughput()
+    {
+        Endpoint endpoint = getEndpoint();
+        if(endpoint.host.isNull())
+            QSKIP("No throughput endpoint given (PIA_INTEG_THROUGHPUT_ENDPOINT)");
+        forEachConfiguration([&]()
+        {
+            runTransfer<UdpStream>(QStringLiteral("udp-single"), endpoint, 1);
+            runTransfer<UdpStream>(QStringLiteral("udp-multi"), endpoint, MultiStreamCount);
+        });
+    }
+};
+
+namespace
+{
+    IntegTestCaseDef<TestThroughput> _def;
+}
+
+#include "tst_throughput.moc"
@@ -337,6 +337,136 @@ private slots:
         emit pGetReply->finished();
         QVERIFY(TestData::checkSuccess(getSpy.spy()));
     }
+
+    // Test hedged requests.  If the first attempt doesn't respond in time,
+    // another attempt begins on the next API base, and the first one to
+    // succeed is used.
+    // This relies on testApiBaseMemory() leaving piaproxy.net as the last
+    // successful API base, and it leaves www.privateinternetaccess.com as the
+    // last successful base.
+    void testHedgedRequest()
+    {
+        ApiClient client;
+
+        QSignalSpy consumeSpy{&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal};
+
+        // The first attempt goes to piaproxy.net and doesn't respond
+        auto pStalledReply = MockNetworkManager::enqueueReply();
+        CallbackSpy getSpy;
+        client.getRetry(TestData::status, TestData::passwordAuth())
+            ->notify(&getSpy, getSpy.callback());
+        QVERIFY(consumeSpy.wait(100));
+        QVERIFY(TestData::checkConsumedHost(consumeSpy, QStringLiteral("piaproxy.net")));
+        consumeSpy.clear();
+
+        // The hedged attempt begins on the other API base without waiting for
+        // the first attempt to time out
+        auto pHedgeReply = MockNetworkManager::enqueueReply(TestData::success);
+        QVERIFY(consumeSpy.wait(2500));
+        QVERIFY(TestData::checkConsumedHost(consumeSpy, QStringLiteral("www.privateinternetaccess.com")));
+        consumeSpy.clear();
+
+        // The hedged attempt succeeds, which completes the request and aborts
+        // the stalled attempt
+        emit pHedgeReply->finished();
+        QVERIFY(TestData::checkSuccess(getSpy.spy()));
+        QTRY_VERIFY(!pStalledReply);
+        QVERIFY(!MockNetworkManager::hasNextReply());
+
+        // The hedged attempt's API base is used first for the next request
+        CallbackSpy headSpy;
+        auto pHeadReply = MockNetworkManager::enqueueReply(QByteArray{});
+        client.headRetry(TestData::status, TestData::passwordAuth())
+            ->notify(&headSpy, headSpy.callback());
+        QVERIFY(consumeSpy.wait(100));
+        QVERIFY(TestData::checkConsumedHost(consumeSpy, QStringLiteral("www.privateinternetaccess.com")));
+        emit pHeadReply->finished();
+        QVERIFY(TestData::checkError(headSpy.spy(), Error::Code::Success));
+    }
+
+    // Test that identical concurrent GETs share one request.
+    void testSharedGet()
+    {
+        ApiClient client;
+
+        QSignalSpy consumeSpy{&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal};
+
+        auto pGetReply = MockNetworkManager::enqueueReply(TestData::success);
+        CallbackSpy firstSpy, secondSpy;
+        client.getRetry(TestData::status, TestData::passwordAuth())
+            ->notify(&firstSpy, firstSpy.callback());
+        client.getRetry(TestData::status, TestData::passwordAuth())
+            ->notify(&secondSpy, secondSpy.callback());
+        QVERIFY(consumeSpy.wait(100));
+        consumeSpy.clear();
+
+        // Only one reply was consumed, and both requests get its result
+        emit pGetReply->finished();
+        QVERIFY(TestData::checkSuccess(firstSpy.spy()));
+        QVERIFY(TestData::checkSuccess(secondSpy.spy()));
+        QVERIFY(consumeSpy.isEmpty());
+
+        // Once it's finished, a new GET issues a new request
+        auto pNextReply = MockNetworkManager::enqueueReply(TestData::success);
+        CallbackSpy nextSpy;
+        client.getRetry(TestData::status, TestData::passwordAuth())
+            ->notify(&nextSpy, nextSpy.callback());
+        QVERIFY(consumeSpy.wait(100));
+        emit pNextReply->finished();
+        QVERIFY(TestData::checkSuccess(nextSpy.spy()));
+    }
+
+    // Test the API base circuit breakers.  A base URI that has been failing
+    // is skipped, and if all are failing, the request fails without making
+    // any attempts.
+    // This relies on testSharedGet() leaving www.privateinternetaccess.com as
+    // the last successful API base.  It resets the circuit breakers at the
+    // end.
+    void testCircuitBreaker()
+    {
+        ApiClient client;
+
+        QSignalSpy consumeSpy{&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal};
+
+        const QString wwwBase{QStringLiteral("https://www.privateinternetaccess.com/")};
+        const QString proxyBase{QStringLiteral("https://piaproxy.net/")};
+
+        // Fail www.privateinternetaccess.com enough to open its circuit
+        while(!ApiCircuitBreaker::isOpen(wwwBase))
+            ApiCircuitBreaker::attemptFailed(wwwBase);
+
+        // The request skips it and goes to piaproxy.net
+        auto pGetReply = MockNetworkManager::enqueueReply(TestData::success);
+        CallbackSpy getSpy;
+        client.getRetry(TestData::status, TestData::passwordAuth())
+            ->notify(&getSpy, getSpy.callback());
+        QVERIFY(consumeSpy.wait(100));
+        QVERIFY(TestData::checkConsumedHost(consumeSpy, QStringLiteral("piaproxy.net")));
+        consumeSpy.clear();
+        emit pGetReply->finished();
+        QVERIFY(TestData::checkSuccess(getSpy.spy()));
+
+        // With both circuits open, the request fails without any attempts
+        while(!ApiCircuitBreaker::isOpen(proxyBase))
+            ApiCircuitBreaker::attemptFailed(proxyBase);
+        auto pUnusedReply = MockNetworkManager::enqueueReply(TestData::success);
+        CallbackSpy failSpy;
+        client.getRetry(TestData::status, TestData::passwordAuth())
+            ->notify(&failSpy, failSpy.callback());
+        QVERIFY(failSpy.spy().wait(1000));
+        QVERIFY(TestData::checkError(failSpy.spy(), Error::Code::ApiNetworkError));
+        QVERIFY(consumeSpy.isEmpty());
+        QVERIFY(MockNetworkManager::hasNextReply());
+
+        // After a reset, requests are attempted again
+        ApiCircuitBreaker::reset();
+        CallbackSpy resetSpy;
+        client.getRetry(TestData::status, TestData::passwordAuth())
+            ->notify(&resetSpy, resetSpy.callback());
+        QVERIFY(consumeSpy.wait(100));
+        emit pUnusedReply->finished();
+        QVERIFY(TestData::checkSuccess(resetSpy.spy()));
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_apiclient)
@@ -0,0 +1,100 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+#include "async.h"
+
+// Benchmarks for the Async framework's per-task overhead.  These aren't run
+// with the unit tests; build and run "test: asyncbench" manually, such as:
+//   <build-dir>/test-asyncbench -o asyncbench.xml,xml
+// Keep the results from a baseline build to compare later runs.
+//
+// - createResolve: create and resolve a single task
+// - thenChain: build a then() chain like the daemon's login / account refresh
+//   chains, and resolve it
+// - thenChainQueued: the same chain with queued continuations, which also
+//   measures the event dispatch for each step
+// - resolvedThen: chain onto an already-resolved task (synchronous path)
+
+namespace
+{
+    enum : int
+    {
+        // Steps in the benchmarked chains
+        ChainLength = 10,
+    };
+
+    int increment(int x) {return x + 1;}
+}
+
+class tst_asyncbench : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void createResolve()
+    {
+        QBENCHMARK
+        {
+            auto pTask = Async<int>::create();
+            pTask->resolve(1);
+            QCOMPARE(pTask->result(), 1);
+        }
+    }
+
+    void thenChain()
+    {
+        QBENCHMARK
+        {
+            auto pRoot = Async<int>::create();
+            Async<int> pTail = pRoot;
+            for(int i = 0; i < ChainLength; ++i)
+                pTail = pTail->then(this, &increment);
+            pRoot->resolve(0);
+            QCOMPARE(pTail->result(), static_cast<int>(ChainLength));
+        }
+    }
+
+    void thenChainQueued()
+    {
+        QBENCHMARK
+        {
+            auto pRoot = Async<int>::create();
+            Async<int> pTail = pRoot;
+            for(int i = 0; i < ChainLength; ++i)
+                pTail = pTail->then(this, &increment, Qt::QueuedConnection);
+            pRoot->resolve(0);
+            while(!pTail->isFinished())
+                QCoreApplication::processEvents();
+            QCOMPARE(pTail->result(), static_cast<int>(ChainLength));
+        }
+    }
+
+    void resolvedThen()
+    {
+        QBENCHMARK
+        {
+            auto pTask = Async<int>::resolve(0)->then(this, &increment);
+            QCOMPARE(pTask->result(), 1);
+        }
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_asyncbench)
+#include TEST_MOC
@@ -0,0 +1,106 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include "commandexecutor.h"
+#include <QtTest>
+
+class tst_commandexecutor : public QObject
+{
+    Q_OBJECT
+
+private:
+    // Run a shell command with the executor
+    Async<CommandResult> runShell(CommandExecutor &executor, const QString &script,
+                                  std::chrono::milliseconds timeout = std::chrono::seconds{10})
+    {
+        CommandExecutor::Command command;
+        command.program = QStringLiteral("/bin/sh");
+        command.arguments = QStringList{QStringLiteral("-c"), script};
+        command.timeout = timeout;
+        return executor.run(std::move(command));
+    }
+
+private slots:
+    void initTestCase()
+    {
+#ifndef Q_OS_UNIX
+        QSKIP("CommandExecutor tests use /bin/sh");
+#endif
+    }
+
+    // The output and exit code are captured
+    void captureResult()
+    {
+        CommandExecutor executor{2};
+        auto pResult = runShell(executor, QStringLiteral("echo out; echo err >&2; exit 3"));
+        QTRY_VERIFY(pResult->isFinished());
+        QVERIFY(pResult->isResolved());
+        QCOMPARE(pResult->result().exitCode, 3);
+        QCOMPARE(pResult->result().error, QProcess::UnknownError);
+        QCOMPARE(pResult->result().standardOutput, QByteArray{"out\n"});
+        QCOMPARE(pResult->result().standardError, QByteArray{"err\n"});
+        QVERIFY(!pResult->result().succeeded());
+    }
+
+    // Only maxConcurrent commands run at once, the rest are queued
+    void boundedConcurrency()
+    {
+        CommandExecutor executor{2};
+        QVector<Async<CommandResult>> results;
+        for(int i=0; i<5; ++i)
+            results.push_back(runShell(executor, QStringLiteral("sleep 0.2; echo %1").arg(i)));
+        QCOMPARE(executor.runningCount(), 2);
+        QCOMPARE(executor.queuedCount(), 3);
+
+        QTRY_VERIFY(std::all_of(results.begin(), results.end(),
+                                [](const auto &pResult){return pResult->isFinished();}));
+        for(int i=0; i<5; ++i)
+        {
+            QVERIFY(results[i]->result().succeeded());
+            QCOMPARE(results[i]->result().standardOutput, QByteArray::number(i) + '\n');
+        }
+        QCOMPARE(executor.runningCount(), 0);
+        QCOMPARE(executor.queuedCount(), 0);
+    }
+
+    // Commands are killed when they time out
+    void timeout()
+    {
+        CommandExecutor executor{1};
+        auto pResult = runShell(executor, QStringLiteral("sleep 10"), std::chrono::milliseconds{100});
+        QTRY_VERIFY(pResult->isFinished());
+        QCOMPARE(pResult->result().error, QProcess::Timedout);
+        QCOMPARE(pResult->result().exitCode, -1);
+    }
+
+    // A command that can't start resolves with FailedToStart, and the next
+    // command still runs
+    void failedToStart()
+    {
+        CommandExecutor executor{1};
+        auto pFailed = executor.run(QStringLiteral("/nonexistent/command"), {});
+        auto pNext = runShell(executor, QStringLiteral("exit 0"));
+        QTRY_VERIFY(pFailed->isFinished() && pNext->isFinished());
+        QCOMPARE(pFailed->result().error, QProcess::FailedToStart);
+        QVERIFY(pNext->result().succeeded());
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_commandexecutor)
+#include TEST_MOC
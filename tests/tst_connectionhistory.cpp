@@ -0,0 +1,130 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "daemon/src/connectionhistory.h"
+#include <QtTest>
+#include <QJsonObject>
+#include <QTemporaryDir>
+
+class tst_connectionhistory : public QObject
+{
+    Q_OBJECT
+
+private:
+    QTemporaryDir _dir;
+
+    QString historyPath() const {return _dir.filePath(QStringLiteral("history.dat"));}
+
+private slots:
+    void init()
+    {
+        QFile::remove(historyPath());
+    }
+
+    // Sessions are recorded with traffic counted from the start of the session
+    void testSession()
+    {
+        ConnectionHistory history{historyPath()};
+        ConnectionHistory::PhaseTimes phases{};
+        phases[0] = 150;
+        history.beginSession(QStringLiteral("us_east"), QStringLiteral("udp"),
+                             8080, phases, 1000, 500);
+        history.updateSession(3000, 1500, 20.0);
+        history.updateSession(4000, 2500, 10.0);
+        history.endSession(ConnectionHistory::EndReason::ConnectionLost);
+
+        QJsonArray sessions = history.sessions({}, 0, 0);
+        QCOMPARE(sessions.size(), 1);
+        QJsonObject session = sessions[0].toObject();
+        QCOMPARE(session["region"].toString(), QStringLiteral("us_east"));
+        QCOMPARE(session["protocol"].toString(), QStringLiteral("udp"));
+        QCOMPARE(session["port"].toInt(), 8080);
+        QCOMPARE(session["phaseTimes"].toArray()[0].toInt(), 150);
+        QCOMPARE(session["received"].toInt(), 3000);
+        QCOMPARE(session["sent"].toInt(), 2000);
+        QCOMPARE(session["peakThroughput"].toDouble(), 20.0);
+        QCOMPARE(session["endReason"].toString(), QStringLiteral("connectionLost"));
+    }
+
+    // Sessions persist, and one left active is reported as 'unknown'
+    void testReopen()
+    {
+        {
+            ConnectionHistory history{historyPath()};
+            history.beginSession(QStringLiteral("uk"), QStringLiteral("tcp"),
+                                 443, {}, 0, 0);
+            history.endSession(ConnectionHistory::EndReason::Disconnected);
+            history.beginSession(QStringLiteral("de"), QStringLiteral("udp"),
+                                 1198, {}, 0, 0);
+        }
+
+        ConnectionHistory history{historyPath()};
+        QJsonArray sessions = history.sessions({}, 0, 0);
+        QCOMPARE(sessions.size(), 2);
+        QCOMPARE(sessions[0].toObject()["region"].toString(), QStringLiteral("de"));
+        QCOMPARE(sessions[0].toObject()["endReason"].toString(), QStringLiteral("unknown"));
+        QCOMPARE(sessions[1].toObject()["region"].toString(), QStringLiteral("uk"));
+        QCOMPARE(sessions[1].toObject()["endReason"].toString(), QStringLiteral("disconnected"));
+    }
+
+    // The oldest sessions are overwritten once the ring is full
+    void testWrap()
+    {
+        ConnectionHistory history{historyPath()};
+        for(quint32 i=0; i<ConnectionHistory::Capacity + 10; ++i)
+        {
+            history.beginSession(QString::number(i), QStringLiteral("udp"),
+                                 0, {}, 0, 0);
+            history.endSession(ConnectionHistory::EndReason::Disconnected);
+        }
+
+        QJsonArray sessions = history.sessions({}, 0, 0);
+        QCOMPARE(sessions.size(), static_cast<int>(ConnectionHistory::Capacity));
+        QCOMPARE(sessions.first().toObject()["region"].toString(),
+                 QString::number(ConnectionHistory::Capacity + 9));
+        QCOMPARE(sessions.last().toObject()["region"].toString(), QStringLiteral("10"));
+
+        // Filter and limit
+        QCOMPARE(history.sessions(QStringLiteral("500"), 0, 0).size(), 1);
+        QCOMPARE(history.sessions({}, 0, 5).size(), 5);
+    }
+
+    // Sessions are summarized by region
+    void testRegionSummaries()
+    {
+        ConnectionHistory history{historyPath()};
+        ConnectionHistory::PhaseTimes phases{};
+        phases[0] = 100;
+        history.beginSession(QStringLiteral("fr"), QStringLiteral("udp"), 0, phases, 0, 0);
+        history.endSession(ConnectionHistory::EndReason::ConnectionLost);
+        phases[0] = 300;
+        history.beginSession(QStringLiteral("fr"), QStringLiteral("udp"), 0, phases, 0, 0);
+        history.endSession(ConnectionHistory::EndReason::Disconnected);
+
+        QJsonArray regions = history.regionSummaries(0);
+        QCOMPARE(regions.size(), 1);
+        QJsonObject region = regions[0].toObject();
+        QCOMPARE(region["region"].toString(), QStringLiteral("fr"));
+        QCOMPARE(region["sessions"].toInt(), 2);
+        QCOMPARE(region["connectionLost"].toInt(), 1);
+        QCOMPARE(region["meanConnectTime"].toDouble(), 200.0);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_connectionhistory)
+#include TEST_MOC
@@ -0,0 +1,373 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#include "daemon/src/daemon.h"
+#include "ipc.h"
+#include "jsonrpc.h"
+#include "testshim.h"
+#include "src/mocknetwork.h"
+#include <QtTest>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <ctime>
+#include <memory>
+#include <vector>
+
+// Load benchmark for the daemon's IPC and latency handling.  This isn't run
+// with the unit tests; build and run "test: daemonbench" manually to measure
+// the effect of changes to notifications, location processing, etc.
+//
+// The benchmark runs a real Daemon (with a stub platform implementation) in a
+// temporary data directory.  Network requests go to MockNetworkManager, so the
+// benchmark never touches the real API; the daemon doesn't make any while no
+// client is active.  Many in-process IPC clients are connected, half of them
+// using "dataPatch".  Then it measures:
+// - regionsReload: loading a new regions list where every region changed
+// - latencyBatches: applying latency measurements for every location
+// Each result reports the process CPU time per notifyChanges(), the bytes
+// received by each kind of client, and the longest main loop stall (measured
+// with a 1 ms heartbeat timer).
+//
+// This doesn't connect the VPN, since that requires OpenVPN and the platform's
+// firewall implementation.
+
+namespace
+{
+    enum : int
+    {
+        // Countries in the generated servers list, and regions per country
+        CountryCount = 120,
+        RegionsPerCountry = 4,
+        // Clients connected to the daemon.  Odd-numbered clients handshake
+        // with "dataPatch"; the rest receive full data notifications.
+        ClientCount = 32,
+        // Latency batches applied in latencyBatches
+        LatencyBatchCount = 20,
+        // Timeout for each wait in the benchmark
+        BenchmarkTimeoutMs = 60000,
+    };
+
+    // Generate a servers list in the legacy regions list format.  The serials
+    // are varied by 'seed', so each seed changes every region.
+    QJsonObject buildServersList(int seed)
+    {
+        QJsonObject servers;
+        QJsonArray autoRegions;
+        for(int c = 0; c < CountryCount; ++c)
+        {
+            QString country = QString{QChar{'a' + c / 26}} + QChar{'a' + c % 26};
+            for(int r = 0; r < RegionsPerCountry; ++r)
+            {
+                QString id = QStringLiteral("%1_region_%2").arg(country).arg(r);
+                QString host = QStringLiteral("%1.privacy.network").arg(id);
+                QString ip = QStringLiteral("10.%1.%2.1").arg(c).arg(r);
+                servers.insert(id, QJsonObject{
+                    {QStringLiteral("name"), QStringLiteral("Region %1 %2").arg(country.toUpper()).arg(r)},
+                    {QStringLiteral("country"), country.toUpper()},
+                    {QStringLiteral("dns"), host},
+                    {QStringLiteral("port_forward"), r == 0},
+                    {QStringLiteral("ping"), ip + QStringLiteral(":8888")},
+                    {QStringLiteral("serial"), QStringLiteral("%1-%2").arg(id).arg(seed)},
+                    {QStringLiteral("openvpn_udp"), QJsonObject{{QStringLiteral("best"), ip + QStringLiteral(":8080")}}},
+                    {QStringLiteral("openvpn_tcp"), QJsonObject{{QStringLiteral("best"), ip + QStringLiteral(":500")}}}
+                });
+                autoRegions.append(id);
+            }
+        }
+        servers.insert(QStringLiteral("info"), QJsonObject{{QStringLiteral("auto_regions"), autoRegions}});
+        return servers;
+    }
+
+    // Build a latency measurement for every location, varied by 'seed' so
+    // each batch changes all of them
+    LatencyTracker::Latencies buildLatencies(const ServerLocations &locations, int seed)
+    {
+        LatencyTracker::Latencies latencies;
+        latencies.reserve(locations.size());
+        int i = 0;
+        for(auto itLocation = locations.begin(); itLocation != locations.end(); ++itLocation)
+        {
+            LatencyTracker::Measurement measurement{};
+            measurement.id = itLocation.key();
+            measurement.latency = std::chrono::milliseconds{10 + (i * 7 + seed) % 300};
+            measurement.median = measurement.latency;
+            measurement.loss = ((i + seed) % 10) / 100.0;
+            measurement.jitter = std::chrono::milliseconds{(i + seed) % 20};
+            latencies.push_back(measurement);
+            ++i;
+        }
+        return latencies;
+    }
+
+    // Process CPU time in milliseconds (all threads)
+    double cpuTimeMs()
+    {
+        return std::clock() * 1000.0 / CLOCKS_PER_SEC;
+    }
+}
+
+// Daemon with a stub platform implementation, exposing the steps measured by
+// the benchmark
+class BenchDaemon : public Daemon
+{
+public:
+    BenchDaemon() : Daemon{QStringList{}} {}
+
+public:
+    virtual QSharedPointer<NetworkAdapter> getNetworkAdapter() override {return {};}
+    virtual void writePlatformDiagnostics(DiagnosticsFile &) override {}
+
+    using Daemon::regionsLoaded;
+    using Daemon::newLatencyMeasurements;
+
+    // Publish the pending changes now, instead of waiting for the queued
+    // notification, so the caller can measure it
+    void publishChanges()
+    {
+        cancelNotification(&BenchDaemon::notifyChanges);
+        notifyChanges();
+    }
+
+    int clientCount() const {return _clients.size();}
+    quint64 bytesEncoded() const {return _notificationStats.bytesEncoded;}
+};
+
+// IPC client that counts the messages and bytes it receives
+class BenchClient : public QObject
+{
+public:
+    BenchClient(bool dataPatch)
+        : _dataPatch{dataPatch}, _messages{0}, _bytes{0}
+    {
+        connect(&_connection, &IPCConnection::messageReceived, this,
+                [this](const QByteArray &msg)
+                {
+                    ++_messages;
+                    _bytes += msg.size();
+                });
+        connect(&_connection, &IPCConnection::connected, this, [this]()
+        {
+            QJsonArray features;
+            if(_dataPatch)
+                features.append(QStringLiteral("dataPatch"));
+            _connection.sendMessage(encodeJsonRPCNotification(QStringLiteral("handshake"),
+                                                              QJsonArray{QStringLiteral(PIA_VERSION), features},
+                                                              JsonRPCEncoding::Text));
+        });
+        _connection.connectToServer();
+    }
+
+public:
+    bool dataPatch() const {return _dataPatch;}
+    bool isConnected() {return _connection.isConnected();}
+    int messages() const {return _messages;}
+    qint64 bytes() const {return _bytes;}
+    void resetCounts() {_messages = 0; _bytes = 0;}
+
+private:
+    bool _dataPatch;
+    int _messages;
+    qint64 _bytes;
+    LocalSocketIPCConnection _connection;
+};
+
+// Measures the longest time the main loop goes without running a heartbeat
+// timer
+class StallMeter : public QObject
+{
+public:
+    StallMeter() : _maxGapNsec{0}
+    {
+        _heartbeat.setTimerType(Qt::TimerType::PreciseTimer);
+        _heartbeat.setInterval(1);
+        connect(&_heartbeat, &QTimer::timeout, this, &StallMeter::sample);
+    }
+
+public:
+    void start()
+    {
+        _maxGapNsec = 0;
+        _sinceLastBeat.start();
+        _heartbeat.start();
+    }
+    void stop()
+    {
+        sample();
+        _heartbeat.stop();
+    }
+    double maxStallMs() const {return _maxGapNsec / 1000000.0;}
+
+private:
+    void sample()
+    {
+        _maxGapNsec = std::max(_maxGapNsec, _sinceLastBeat.nsecsElapsed());
+        _sinceLastBeat.start();
+    }
+
+private:
+    QTimer _heartbeat;
+    QElapsedTimer _sinceLastBeat;
+    qint64 _maxGapNsec;
+};
+
+class tst_daemonbench : public QObject
+{
+    Q_OBJECT
+
+private:
+    QTemporaryDir _dataDir;
+    std::unique_ptr<BenchDaemon> _pDaemon;
+    std::vector<std::unique_ptr<BenchClient>> _clients;
+    StallMeter _stallMeter;
+
+    void resetClientCounts()
+    {
+        for(auto &pClient : _clients)
+            pClient->resetCounts();
+    }
+
+    // Wait until every client has received at least 'count' messages since the
+    // counts were reset
+    bool waitForMessages(int count)
+    {
+        return QTest::qWaitFor([&]()
+            {
+                return std::all_of(_clients.begin(), _clients.end(),
+                    [&](const auto &pClient){return pClient->messages() >= count;});
+            }, BenchmarkTimeoutMs);
+    }
+
+    void report(const char *name, double value, const char *unit)
+    {
+        qInfo().nospace() << name << ": " << value << " " << unit;
+    }
+
+    // Report the results of 'notifications' notifyChanges() calls that took
+    // 'cpuMs' in total
+    void reportNotifications(int notifications, double cpuMs,
+                             quint64 bytesEncoded)
+    {
+        qint64 fullBytes{0}, patchBytes{0};
+        int fullClients{0}, patchClients{0};
+        for(const auto &pClient : _clients)
+        {
+            if(pClient->dataPatch())
+            {
+                patchBytes += pClient->bytes();
+                ++patchClients;
+            }
+            else
+            {
+                fullBytes += pClient->bytes();
+                ++fullClients;
+            }
+        }
+
+        report("CPU time per notifyChanges", cpuMs / notifications, "ms");
+        report("Bytes encoded per notifyChanges",
+               static_cast<double>(bytesEncoded) / notifications, "B");
+        report("Bytes per full-data client per notification",
+               static_cast<double>(fullBytes) / (fullClients * notifications), "B");
+        report("Bytes per patch client per notification",
+               static_cast<double>(patchBytes) / (patchClients * notifications), "B");
+        report("Longest main loop stall", _stallMeter.maxStallMs(), "ms");
+    }
+
+private slots:
+    void initTestCase()
+    {
+        QVERIFY(_dataDir.isValid());
+        Path::DaemonDataDir = _dataDir.path();
+        Path::DaemonSettingsDir = _dataDir.path();
+        Path::DaemonDiagnosticsDir = Path::DaemonDataDir / "diagnostics";
+        Path::UpdownLogFile = Path::DaemonDataDir / "updown.log";
+        Path::HnsdDataDir = Path::DaemonDataDir / "hnsd";
+
+        TestShim::installMock<QNetworkAccessManager, MockNetworkManager>();
+
+        _pDaemon.reset(new BenchDaemon{});
+        _pDaemon->start();
+        _pDaemon->regionsLoaded(QJsonDocument{buildServersList(0)});
+        QCOMPARE(_pDaemon->data().locations().size(), CountryCount * RegionsPerCountry);
+        // Publish the initial locations before any clients connect
+        _pDaemon->publishChanges();
+
+        for(int i = 0; i < ClientCount; ++i)
+            _clients.emplace_back(new BenchClient{i % 2 == 1});
+        QTRY_COMPARE_WITH_TIMEOUT(_pDaemon->clientCount(), ClientCount, BenchmarkTimeoutMs);
+        // Wait for the initial data notification sent to each client
+        QVERIFY(waitForMessages(1));
+        // Let the handshakes be processed too
+        QTest::qWait(100);
+    }
+
+    void cleanupTestCase()
+    {
+        _clients.clear();
+        _pDaemon.reset();
+    }
+
+    void regionsReload()
+    {
+        resetClientCounts();
+        quint64 encodedBefore = _pDaemon->bytesEncoded();
+        _stallMeter.start();
+
+        double cpuStart = cpuTimeMs();
+        _pDaemon->regionsLoaded(QJsonDocument{buildServersList(1)});
+        _pDaemon->publishChanges();
+        double cpuMs = cpuTimeMs() - cpuStart;
+
+        QVERIFY(waitForMessages(1));
+        _stallMeter.stop();
+        reportNotifications(1, cpuMs, _pDaemon->bytesEncoded() - encodedBefore);
+    }
+
+    void latencyBatches()
+    {
+        const ServerLocations &locations = _pDaemon->data().locations();
+        std::vector<LatencyTracker::Latencies> batches;
+        for(int i = 0; i < LatencyBatchCount; ++i)
+            batches.push_back(buildLatencies(locations, i + 1));
+
+        resetClientCounts();
+        quint64 encodedBefore = _pDaemon->bytesEncoded();
+        double cpuMs{0};
+        _stallMeter.start();
+
+        for(int i = 0; i < LatencyBatchCount; ++i)
+        {
+            double cpuStart = cpuTimeMs();
+            _pDaemon->newLatencyMeasurements(batches[i]);
+            _pDaemon->publishChanges();
+            cpuMs += cpuTimeMs() - cpuStart;
+            // Let the clients receive each notification before the next batch
+            QVERIFY(waitForMessages(i + 1));
+        }
+
+        _stallMeter.stop();
+        reportNotifications(LatencyBatchCount, cpuMs,
+                            _pDaemon->bytesEncoded() - encodedBefore);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_daemonbench)
+#include TEST_MOC
@@ -0,0 +1,177 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include "clientlib/src/daemonconnection.h"
+#include <QtTest>
+#include <QSignalSpy>
+
+namespace
+{
+    QByteArray notification(const QString &method, const QJsonObject &param)
+    {
+        return encodeJsonRPCNotification(method, QJsonArray{param}, JsonRPCEncoding::Text);
+    }
+
+    // Get the params from the decoded message emitted by the decoder
+    QJsonArray takeParams(QSignalSpy &spy)
+    {
+        if(spy.count() != 1)
+            return {};
+        const auto &json = spy.takeFirst()[0].value<QJsonDocument>();
+        return json.object().value(QStringLiteral("params")).toArray();
+    }
+}
+
+class tst_daemonmessagedecoder : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // Unchanged properties are removed from "data" notifications
+    void dataChanges()
+    {
+        DaemonMessageDecoder decoder;
+        QSignalSpy decodedSpy{&decoder, &DaemonMessageDecoder::messageDecoded};
+
+        const QJsonObject state{{"vpnEnabled", false}, {"forwardedPort", 0}};
+        decoder.decodeMessage(notification(QStringLiteral("data"), {{"state", state}}));
+        QJsonArray params = takeParams(decodedSpy);
+        QCOMPARE(params.size(), 1);
+        QCOMPARE(params[0].toObject()["state"].toObject(), state);
+
+        decoder.decodeMessage(notification(QStringLiteral("data"),
+            {{"state", QJsonObject{{"vpnEnabled", true}, {"forwardedPort", 0}}}}));
+        params = takeParams(decodedSpy);
+        QCOMPARE(params[0].toObject()["state"].toObject(), (QJsonObject{{"vpnEnabled", true}}));
+    }
+
+    // "patch" notifications are applied to the last values received
+    void patchValues()
+    {
+        DaemonMessageDecoder decoder;
+        QSignalSpy decodedSpy{&decoder, &DaemonMessageDecoder::messageDecoded};
+
+        const QJsonObject locations{
+            {"us_east", QJsonObject{{"name", "US East"}, {"latency", 30}}},
+            {"us_west", QJsonObject{{"name", "US West"}, {"latency", 80}}},
+        };
+        decoder.decodeMessage(notification(QStringLiteral("data"), {{"data", QJsonObject{{"locations", locations}}}}));
+        decodedSpy.clear();
+
+        QJsonObject patch{{"data", QJsonArray{
+            QJsonObject{{"op", "replace"}, {"path", "/locations/us_west/latency"}, {"value", 75}}
+        }}};
+        decoder.decodeMessage(notification(QStringLiteral("patch"), patch));
+        QJsonArray params = takeParams(decodedSpy);
+        QCOMPARE(params.size(), 2);
+        QCOMPARE(params[0].toObject(), patch);
+        QJsonObject expectedLocations{locations};
+        expectedLocations["us_west"] = QJsonObject{{"name", "US West"}, {"latency", 75}};
+        QCOMPARE(params[1].toObject()["data"].toObject()["locations"].toObject(), expectedLocations);
+
+        // The patched value is remembered - an equal "data" notification has
+        // no changes
+        decoder.decodeMessage(notification(QStringLiteral("data"), {{"data", QJsonObject{{"locations", expectedLocations}}}}));
+        params = takeParams(decodedSpy);
+        QVERIFY(params[0].toObject()["data"].toObject().isEmpty());
+
+        // A patch that can't be applied doesn't provide a value
+        decoder.decodeMessage(notification(QStringLiteral("patch"), {{"data", QJsonArray{
+            QJsonObject{{"op", "replace"}, {"path", "/bogus/a/b"}, {"value", 1}}
+        }}}));
+        params = takeParams(decodedSpy);
+        QVERIFY(!params[1].toObject()["data"].toObject().contains("bogus"));
+    }
+
+    // Columnar locations lists are decoded in "data" and "patch" notifications
+    void locationColumns()
+    {
+        DaemonMessageDecoder decoder;
+        QSignalSpy decodedSpy{&decoder, &DaemonMessageDecoder::messageDecoded};
+
+        const QJsonObject usEast{{"id", "us_east"}, {"name", "US East"}, {"latency", 30}};
+        const QJsonObject usWest{{"id", "us_west"}, {"name", "US West"}, {"latency", QJsonValue::Null}};
+        const QJsonObject caMontreal{{"id", "ca_montreal"}, {"name", "CA Montreal"}, {"latency", 45}};
+        const QJsonObject locations{{"us_east", usEast}, {"us_west", usWest},
+                                    {"ca_montreal", caMontreal}};
+        const QJsonArray groupedLocations{
+            QJsonObject{{"locations", QJsonArray{caMontreal}}},
+            QJsonObject{{"locations", QJsonArray{usEast, usWest}}},
+        };
+
+        const QJsonObject encodedLocations = encodeLocationsColumns(locations);
+        const QJsonObject encodedGrouped = encodeGroupedLocationsColumns(groupedLocations);
+        QVERIFY(isLocationColumns(encodedLocations));
+        QVERIFY(isLocationColumns(encodedGrouped));
+        QVERIFY(!isLocationColumns(locations));
+
+        decoder.decodeMessage(notification(QStringLiteral("data"), {
+            {"data", QJsonObject{{"locations", encodedLocations}}},
+            {"state", QJsonObject{{"groupedLocations", encodedGrouped}}}
+        }));
+        QJsonArray params = takeParams(decodedSpy);
+        QCOMPARE(params[0].toObject()["data"].toObject()["locations"].toObject(), locations);
+        QCOMPARE(params[0].toObject()["state"].toObject()["groupedLocations"].toArray(), groupedLocations);
+
+        // Nested patches apply to the decoded value; replacing the whole value
+        // is decoded
+        const QJsonObject usWestUpdated{{"id", "us_west"}, {"name", "US West"}, {"latency", 80}};
+        QJsonObject updatedLocations{locations};
+        updatedLocations["us_west"] = usWestUpdated;
+        const QJsonArray updatedGrouped{
+            QJsonObject{{"locations", QJsonArray{caMontreal}}},
+            QJsonObject{{"locations", QJsonArray{usEast, usWestUpdated}}},
+        };
+        decoder.decodeMessage(notification(QStringLiteral("patch"), {
+            {"data", QJsonArray{
+                QJsonObject{{"op", "replace"}, {"path", "/locations/us_west/latency"}, {"value", 80}}
+            }},
+            {"state", QJsonArray{
+                QJsonObject{{"op", "replace"}, {"path", "/groupedLocations"},
+                            {"value", encodeGroupedLocationsColumns(updatedGrouped)}}
+            }}
+        }));
+        params = takeParams(decodedSpy);
+        QCOMPARE(params[1].toObject()["data"].toObject()["locations"].toObject(), updatedLocations);
+        QCOMPARE(params[1].toObject()["state"].toObject()["groupedLocations"].toArray(), updatedGrouped);
+
+        // Locations with differing fields can't be encoded
+        QVERIFY(encodeLocationsColumns({{"us_east", usEast},
+                                        {"us_west", QJsonObject{{"id", "us_west"}}}}).isEmpty());
+    }
+
+    // Other messages are just parsed
+    void otherMessages()
+    {
+        DaemonMessageDecoder decoder;
+        QSignalSpy decodedSpy{&decoder, &DaemonMessageDecoder::messageDecoded};
+
+        const QJsonObject response{{"jsonrpc", "2.0"}, {"id", 1}, {"result", 2}};
+        decoder.decodeMessage(encodeJsonRPCMessage(response, JsonRPCEncoding::Binary));
+        QCOMPARE(decodedSpy.count(), 1);
+        QCOMPARE(decodedSpy.takeFirst()[0].value<QJsonDocument>().object(), response);
+
+        // Invalid messages are dropped
+        decoder.decodeMessage(QByteArrayLiteral("{bogus"));
+        QCOMPARE(decodedSpy.count(), 0);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_daemonmessagedecoder)
+#include TEST_MOC
@@ -0,0 +1,86 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#include "eventloopwatchdog.h"
+#include "metrics.h"
+#include <QtTest>
+#include <QThread>
+
+class tst_eventloopwatchdog : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init()
+    {
+        Metrics::setEnabled(false);
+        Metrics::setEnabled(true);
+    }
+
+    void cleanupTestCase()
+    {
+        Metrics::setEnabled(false);
+    }
+
+    // Activities are only named while a watchdog is running, and nested
+    // activities restore the outer activity
+    void activityNesting()
+    {
+        {
+            EventLoopWatchdog::Activity ignored{QStringLiteral("ignored")};
+            QCOMPARE(EventLoopWatchdog::currentActivity(), QString{});
+        }
+
+        EventLoopWatchdog watchdog{std::chrono::milliseconds{1000}};
+        watchdog.start();
+        {
+            EventLoopWatchdog::Activity outer{QStringLiteral("outer")};
+            QCOMPARE(EventLoopWatchdog::currentActivity(), QStringLiteral("outer"));
+            {
+                EventLoopWatchdog::Activity inner{QStringLiteral("inner")};
+                QCOMPARE(EventLoopWatchdog::currentActivity(), QStringLiteral("inner"));
+            }
+            QCOMPARE(EventLoopWatchdog::currentActivity(), QStringLiteral("outer"));
+        }
+        QCOMPARE(EventLoopWatchdog::currentActivity(), QString{});
+    }
+
+    // A stall is attributed to the activity that was running during it
+    void stallRecorded()
+    {
+        EventLoopWatchdog watchdog{std::chrono::milliseconds{100}};
+        watchdog.start();
+        {
+            EventLoopWatchdog::Activity activity{QStringLiteral("blocking")};
+            QThread::msleep(500);
+        }
+        QTRY_VERIFY(Metrics::openMetricsText().contains("pia_event_loop_stalls_total{activity=\"blocking\"} 1"));
+    }
+
+    // No stall is recorded while the event loop keeps running
+    void noStall()
+    {
+        EventLoopWatchdog watchdog{std::chrono::milliseconds{250}};
+        watchdog.start();
+        QTest::qWait(500);
+        QVERIFY(!Metrics::openMetricsText().contains("pia_event_loop_stalls"));
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_eventloopwatchdog)
+#include TEST_MOC
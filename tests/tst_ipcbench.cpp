@@ -0,0 +1,225 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#include "ipc.h"
+#include <QtTest>
+#include <QElapsedTimer>
+#include <functional>
+#include <memory>
+
+// Throughput benchmarks for the local socket IPC framing.  These aren't run
+// with the unit tests; build and run "test: ipcbench" manually to measure the
+// effect of changes to LocalSocketIPCServer/LocalSocketIPCConnection, such as:
+//   <build-dir>/test-ipcbench -o ipcbench.xml,xml
+//
+// Each benchmark runs with both LocalSocketIPCConnection and
+// ThreadedLocalIPCConnection as the client, and reports messages/s and MB/s
+// in addition to the time per iteration:
+// - smallRpcs: many small RPC-sized messages from the client to the server
+// - largeNotifications: large text 'data' notifications from the server to
+//   the client
+// - garbageResync: messages preceded by garbage from the client, so the
+//   server has to resynchronize (through scanForMagic()) before each one
+
+namespace
+{
+    enum : int
+    {
+        // Messages sent per iteration, and their sizes
+        SmallMessageCount = 2000,
+        SmallMessageSize = 120,
+        LargeMessageCount = 20,
+        LargeMessageSize = 1024 * 1024,
+        GarbageMessageCount = 500,
+        GarbageSize = 4096,
+        // Timeout for each iteration
+        IterationTimeoutMs = 60000,
+    };
+
+    // Build a text payload resembling a JSON-RPC message of the given size
+    QByteArray buildPayload(int size)
+    {
+        QByteArray payload{R"({"jsonrpc":"2.0","method":"data","params":[{"state":{"value":")"};
+        const QByteArray suffix{R"("}}]})"};
+        while(payload.size() + suffix.size() < size)
+            payload += 'a' + payload.size() % 26;
+        payload += suffix;
+        return payload;
+    }
+
+    // The resync path logs a warning for each block of garbage; drop those
+    // while the benchmark is running so logging isn't measured
+    QtMessageHandler _prevMessageHandler{nullptr};
+    void dropResyncWarnings(QtMsgType type, const QMessageLogContext &context,
+                            const QString &msg)
+    {
+        if(type == QtWarningMsg && msg.startsWith(QStringLiteral("Invalid message")))
+            return;
+        if(_prevMessageHandler)
+            _prevMessageHandler(type, context, msg);
+    }
+}
+
+class tst_ipcbench : public QObject
+{
+    Q_OBJECT
+
+private:
+    std::unique_ptr<LocalSocketIPCServer> _pServer;
+    std::unique_ptr<ClientIPCConnection> _pClient;
+    QPointer<IPCConnection> _pServerConnection;
+    int _serverReceived, _clientReceived;
+    // Totals over all iterations, for the rates reported
+    qint64 _totalMessages, _totalBytes, _totalNsec;
+
+    // Connect a client of the type given by the current "threaded" data
+    bool connectClient()
+    {
+        QFETCH(bool, threaded);
+
+        _serverReceived = 0;
+        _clientReceived = 0;
+        _totalMessages = 0;
+        _totalBytes = 0;
+        _totalNsec = 0;
+
+        _pServer.reset(new LocalSocketIPCServer{});
+        connect(_pServer.get(), &IPCServer::newConnection, this, [this](IPCConnection *pConnection)
+        {
+            _pServerConnection = pConnection;
+            connect(pConnection, &IPCConnection::messageReceived, this,
+                    [this](){++_serverReceived;});
+        });
+        if(!_pServer->listen())
+            return false;
+
+        if(threaded)
+            _pClient.reset(new ThreadedLocalIPCConnection{nullptr});
+        else
+            _pClient.reset(new LocalSocketIPCConnection{nullptr});
+        connect(_pClient.get(), &IPCConnection::messageReceived, this,
+                [this](){++_clientReceived;});
+        _pClient->connectToServer();
+        return QTest::qWaitFor([this](){return _pServerConnection && _pClient->isConnected();},
+                               IterationTimeoutMs);
+    }
+
+    // Time one iteration, adding to the totals
+    void measure(int messages, qint64 bytes, const std::function<bool()> &iteration)
+    {
+        QElapsedTimer elapsed;
+        elapsed.start();
+        QVERIFY(iteration());
+        _totalNsec += elapsed.nsecsElapsed();
+        _totalMessages += messages;
+        _totalBytes += bytes;
+    }
+
+    void report()
+    {
+        double seconds = std::max<qint64>(_totalNsec, 1) / 1000000000.0;
+        qInfo().nospace() << "Messages: " << _totalMessages / seconds << " /s";
+        qInfo().nospace() << "Throughput: " << _totalBytes / seconds / (1024 * 1024) << " MB/s";
+    }
+
+    void addClientTypes()
+    {
+        QTest::addColumn<bool>("threaded");
+        QTest::newRow("LocalSocketIPCConnection") << false;
+        QTest::newRow("ThreadedLocalIPCConnection") << true;
+    }
+
+private slots:
+    void cleanup()
+    {
+        _pClient.reset();
+        _pServer.reset();
+    }
+
+    void smallRpcs_data() {addClientTypes();}
+    void smallRpcs()
+    {
+        QVERIFY(connectClient());
+        const QByteArray message = buildPayload(SmallMessageSize);
+
+        QBENCHMARK
+        {
+            measure(SmallMessageCount, qint64{SmallMessageCount} * message.size(), [&]()
+            {
+                _serverReceived = 0;
+                for(int i = 0; i < SmallMessageCount; ++i)
+                    _pClient->sendMessage(message);
+                return QTest::qWaitFor([&](){return _serverReceived == SmallMessageCount;},
+                                       IterationTimeoutMs);
+            });
+        }
+        report();
+    }
+
+    void largeNotifications_data() {addClientTypes();}
+    void largeNotifications()
+    {
+        QVERIFY(connectClient());
+        const QByteArray message = buildPayload(LargeMessageSize);
+
+        QBENCHMARK
+        {
+            measure(LargeMessageCount, qint64{LargeMessageCount} * message.size(), [&]()
+            {
+                _clientReceived = 0;
+                for(int i = 0; i < LargeMessageCount; ++i)
+                    _pServerConnection->sendMessage(message);
+                return QTest::qWaitFor([&](){return _clientReceived == LargeMessageCount;},
+                                       IterationTimeoutMs);
+            });
+        }
+        report();
+    }
+
+    void garbageResync_data() {addClientTypes();}
+    void garbageResync()
+    {
+        QVERIFY(connectClient());
+
+        // Garbage (without any 0xFF bytes that could start a magic tag)
+        // followed by a valid message
+        QByteArray raw(GarbageSize, 'g');
+        {
+            QDataStream stream{&raw, QIODevice::WriteOnly | QIODevice::Append};
+            LocalSocketIPCConnection::writeMessage(buildPayload(SmallMessageSize), stream);
+        }
+
+        _prevMessageHandler = qInstallMessageHandler(&dropResyncWarnings);
+        QBENCHMARK
+        {
+            measure(GarbageMessageCount, qint64{GarbageMessageCount} * raw.size(), [&]()
+            {
+                _serverReceived = 0;
+                for(int i = 0; i < GarbageMessageCount; ++i)
+                    _pClient->sendRawMessage(raw);
+                return QTest::qWaitFor([&](){return _serverReceived == GarbageMessageCount;},
+                                       IterationTimeoutMs);
+            });
+        }
+        qInstallMessageHandler(_prevMessageHandler);
+        report();
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_ipcbench)
+#include TEST_MOC
@@ -0,0 +1,307 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#include "ipc.h"
+#include <QtTest>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+// Stress test for the local socket IPC frame parser
+// (LocalSocketIPCConnection::onReadReady()).  This isn't run with the unit
+// tests; build and run "test: ipcstress" manually after changing the framing
+// code.  Set PIA_IPCSTRESS_SEED to reproduce a particular run (the seed used
+// is printed).
+//
+// A client writes a stream of valid messages, each preceded by adversarial
+// input, in randomly sized fragments:
+// - random garbage, including many 0xFF bytes that could start a tag
+// - truncated frames (valid header, but the payload is cut short)
+// - headers with a valid tag but an oversized or undersized length
+// Every valid message must be received intact and in order.
+//
+// - resyncLatency: sends one round at a time and reports how long the server
+//   takes to recover - bytes of adversarial input skipped and microseconds
+//   from the write to receiving the valid message
+// - resyncThroughput: writes all rounds at once and reports MB/s
+
+namespace
+{
+    enum : int
+    {
+        RoundCount = 2000,
+        // Largest amount of random garbage in one round
+        MaxGarbage = 64 * 1024,
+        // Largest fragment written at once
+        MaxFragment = 8192,
+        // Timeout for each wait
+        TimeoutMs = 60000,
+    };
+
+    const quint32 tag = 0xFFACCE55;
+
+    void appendHeader(QByteArray &data, quint32 tagValue, quint32 size)
+    {
+        QDataStream stream{&data, QIODevice::WriteOnly | QIODevice::Append};
+        stream.setByteOrder(QDataStream::BigEndian);
+        stream << tagValue;
+        stream.setByteOrder(QDataStream::LittleEndian);
+        stream << size;
+    }
+
+    // One round of the stream - adversarial input followed by a valid message
+    struct Round
+    {
+        QByteArray data;
+        // Length of the adversarial part
+        int adversarialBytes;
+        QByteArray expectedMessage;
+    };
+
+    class StreamGenerator
+    {
+    public:
+        StreamGenerator(quint32 seed) : _random{seed} {}
+
+    public:
+        Round buildRound(int index)
+        {
+            Round round;
+            switch(randomInt(0, 3))
+            {
+            case 0:
+                appendGarbage(round.data, randomInt(1, MaxGarbage));
+                break;
+            case 1:
+            {
+                // Truncated frame - a text payload shorter than its header
+                // says.  (Binary payloads aren't scanned for truncation, they
+                // can't recover from this.)
+                int size = randomInt(16, 64 * 1024);
+                appendHeader(round.data, tag, static_cast<quint32>(size));
+                appendText(round.data, randomInt(0, size - 1));
+                break;
+            }
+            case 2:
+                // Oversized header followed by garbage
+                appendHeader(round.data, tag, static_cast<quint32>(1024 * 1024 + randomInt(1, 0x7F000000)));
+                appendGarbage(round.data, randomInt(0, 4096));
+                break;
+            default:
+                // Undersized header followed by garbage
+                appendHeader(round.data, tag, static_cast<quint32>(randomInt(0, 1)));
+                appendGarbage(round.data, randomInt(0, 4096));
+                break;
+            }
+            round.adversarialBytes = round.data.size();
+
+            round.expectedMessage = QByteArray::number(index) + ':';
+            appendText(round.expectedMessage, randomInt(2, 2048));
+            QDataStream stream{&round.data, QIODevice::WriteOnly | QIODevice::Append};
+            LocalSocketIPCConnection::writeMessage(round.expectedMessage, stream);
+            return round;
+        }
+
+        // Split data into randomly sized fragments
+        std::vector<QByteArray> fragment(const QByteArray &data)
+        {
+            std::vector<QByteArray> fragments;
+            int pos = 0;
+            while(pos < data.size())
+            {
+                int len = std::min(randomInt(1, MaxFragment), data.size() - pos);
+                fragments.push_back(data.mid(pos, len));
+                pos += len;
+            }
+            return fragments;
+        }
+
+        int randomInt(int min, int max)
+        {
+            return std::uniform_int_distribution<int>{min, max}(_random);
+        }
+
+    private:
+        // Random bytes, about 1/8 of them 0xFF.  A 0xFF is never followed by
+        // the rest of a tag, so the garbage can't contain a frame.
+        void appendGarbage(QByteArray &data, int len)
+        {
+            for(int i = 0; i < len; ++i)
+            {
+                char c = randomInt(0, 7) ? static_cast<char>(randomInt(0, 0xFE)) : '\xFF';
+                if(c == '\xAC' && data.endsWith('\xFF'))
+                    c = 'x';
+                data.append(c);
+            }
+        }
+
+        // Printable text (never contains 0xFF)
+        void appendText(QByteArray &data, int len)
+        {
+            for(int i = 0; i < len; ++i)
+                data.append(static_cast<char>(randomInt(' ', '~')));
+        }
+
+    private:
+        std::mt19937 _random;
+    };
+}
+
+class tst_ipcstress : public QObject
+{
+    Q_OBJECT
+
+private:
+    quint32 _seed;
+    std::unique_ptr<LocalSocketIPCServer> _pServer;
+    std::unique_ptr<LocalSocketIPCConnection> _pClient;
+    std::vector<QByteArray> _received;
+
+    void report(const char *name, double value, const char *unit)
+    {
+        qInfo().nospace() << name << ": " << value << " " << unit;
+    }
+
+    bool waitForReceived(std::size_t count)
+    {
+        return QTest::qWaitFor([&](){return _received.size() >= count || !_pClient->isConnected();},
+                               TimeoutMs);
+    }
+
+    // Resync warnings are expected for every round; drop them so logging
+    // isn't measured
+    static void dropResyncTraces(QtMsgType type, const QMessageLogContext &context,
+                                 const QString &msg)
+    {
+        if(msg.startsWith(QStringLiteral("Invalid message")) ||
+           msg.startsWith(QStringLiteral("Resynchronized after")))
+            return;
+        if(_prevMessageHandler)
+            _prevMessageHandler(type, context, msg);
+    }
+    static QtMessageHandler _prevMessageHandler;
+
+private slots:
+    void initTestCase()
+    {
+        bool seedOk{false};
+        _seed = static_cast<quint32>(qEnvironmentVariableIntValue("PIA_IPCSTRESS_SEED", &seedOk));
+        if(!seedOk)
+            _seed = std::random_device{}();
+        qInfo() << "Seed:" << _seed;
+        _prevMessageHandler = qInstallMessageHandler(&dropResyncTraces);
+    }
+
+    void cleanupTestCase()
+    {
+        qInstallMessageHandler(_prevMessageHandler);
+    }
+
+    void init()
+    {
+        _received.clear();
+        _pServer.reset(new LocalSocketIPCServer{});
+        connect(_pServer.get(), &IPCServer::newConnection, this, [this](IPCConnection *pConnection)
+        {
+            connect(pConnection, &IPCConnection::messageReceived, this,
+                    [this](const QByteArray &msg){_received.push_back(msg);});
+        });
+        QVERIFY(_pServer->listen());
+        _pClient.reset(new LocalSocketIPCConnection{});
+        _pClient->connectToServer();
+        QVERIFY(QTest::qWaitFor([this](){return _pServer->count() && _pClient->isConnected();}, TimeoutMs));
+    }
+
+    void cleanup()
+    {
+        _pClient.reset();
+        _pServer.reset();
+    }
+
+    void resyncLatency()
+    {
+        StreamGenerator generator{_seed};
+        qint64 totalSkipped{0}, totalNsec{0}, maxNsec{0};
+        std::vector<qint64> roundNsec;
+        roundNsec.reserve(RoundCount);
+
+        for(int i = 0; i < RoundCount; ++i)
+        {
+            Round round = generator.buildRound(i);
+            auto fragments = generator.fragment(round.data);
+
+            QElapsedTimer elapsed;
+            elapsed.start();
+            for(const auto &fragment : fragments)
+                _pClient->sendRawMessage(fragment);
+            QVERIFY2(waitForReceived(i + 1), qPrintable(QStringLiteral("round %1 not received").arg(i)));
+            qint64 nsec = elapsed.nsecsElapsed();
+
+            QCOMPARE(_received.size(), static_cast<std::size_t>(i + 1));
+            QCOMPARE(_received.back(), round.expectedMessage);
+            totalSkipped += round.adversarialBytes;
+            totalNsec += nsec;
+            maxNsec = std::max(maxNsec, nsec);
+            roundNsec.push_back(nsec);
+        }
+
+        std::sort(roundNsec.begin(), roundNsec.end());
+        report("Mean bytes skipped per resync", static_cast<double>(totalSkipped) / RoundCount, "B");
+        report("Mean resync time", totalNsec / 1000.0 / RoundCount, "us");
+        report("p99 resync time", roundNsec[(roundNsec.size() * 99 + 99) / 100 - 1] / 1000.0, "us");
+        report("Max resync time", maxNsec / 1000.0, "us");
+    }
+
+    void resyncThroughput()
+    {
+        StreamGenerator generator{_seed + 1};
+        std::vector<QByteArray> expected;
+        std::vector<QByteArray> fragments;
+        qint64 totalBytes{0};
+        for(int i = 0; i < RoundCount; ++i)
+        {
+            Round round = generator.buildRound(i);
+            expected.push_back(round.expectedMessage);
+            totalBytes += round.data.size();
+            for(auto &fragment : generator.fragment(round.data))
+                fragments.push_back(std::move(fragment));
+        }
+
+        QElapsedTimer elapsed;
+        elapsed.start();
+        for(const auto &fragment : fragments)
+            _pClient->sendRawMessage(fragment);
+        QVERIFY(waitForReceived(RoundCount));
+        qint64 elapsedNsec = std::max<qint64>(elapsed.nsecsElapsed(), 1);
+
+        QCOMPARE(_received.size(), expected.size());
+        for(std::size_t i = 0; i < expected.size(); ++i)
+            QCOMPARE(_received[i], expected[i]);
+
+        report("Throughput", totalBytes * 1000000000.0 / elapsedNsec / (1024 * 1024), "MB/s");
+        report("Messages", RoundCount * 1000000000.0 / elapsedNsec, "/s");
+    }
+};
+
+QtMessageHandler tst_ipcstress::_prevMessageHandler{nullptr};
+
+QTEST_GUILESS_MAIN(tst_ipcstress)
+#include TEST_MOC
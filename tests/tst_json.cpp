@@ -18,9 +18,11 @@
 
 #include "common.h"
 #include <QtTest>
+#include <QTemporaryDir>
 #include <QSignalSpy>
 
 #include "json.h"
+#include "path.h"
 
 #include <QJsonArray>
 #include <QJsonObject>
@@ -54,6 +56,56 @@ public:
     JsonField(QJsonArray, validatedArrayField, {}, &TestSettings::arrayValidatorFunc)
 };
 
+class TestNestedItem : public NativeJsonObject
+{
+    Q_OBJECT
+public:
+    TestNestedItem() {}
+    TestNestedItem(const TestNestedItem &other) {*this = other;}
+    TestNestedItem &operator=(const TestNestedItem &other)
+    {
+        value(other.value());
+        return *this;
+    }
+    bool operator==(const TestNestedItem &other) const {return value() == other.value();}
+    bool operator!=(const TestNestedItem &other) const {return !(*this == other);}
+
+    JsonField(int, value, 0)
+};
+
+class TestNestedGroup : public NativeJsonObject
+{
+    Q_OBJECT
+public:
+    TestNestedGroup() {}
+    TestNestedGroup(const TestNestedGroup &other) {*this = other;}
+    TestNestedGroup &operator=(const TestNestedGroup &other)
+    {
+        item(other.item());
+        count(other.count());
+        return *this;
+    }
+    bool operator==(const TestNestedGroup &other) const
+    {
+        return item() == other.item() && count() == other.count();
+    }
+    bool operator!=(const TestNestedGroup &other) const {return !(*this == other);}
+
+    JsonField(QSharedPointer<TestNestedItem>, item, {})
+    JsonField(int, count, 0)
+};
+
+typedef QHash<QString, QSharedPointer<TestNestedItem>> TestNestedItems;
+
+class TestNestedContainer : public NativeJsonObject
+{
+    Q_OBJECT
+public:
+    JsonField(int, intField, 0)
+    JsonField(TestNestedItems, items, {})
+    JsonField(TestNestedGroup, group, {})
+};
+
 class tst_json : public QObject
 {
     Q_OBJECT
@@ -218,6 +270,94 @@ private slots:
         QCOMPARE(settings.arrayField(), (QJsonArray { 1, 2, 3 }));
         QCOMPARE(settings.objectField(), (QJsonObject { { "test", "test" } }));
     }
+    // Test that toJsonObject() includes every field (in addition to unknown
+    // properties), and that reset() restores the defaults
+    void serializeAndReset()
+    {
+        TestSettings settings;
+        settings.intField(5);
+        settings.validatedStringField(QStringLiteral("b"));
+        QVERIFY(settings.set("unknown", 2));
+
+        const auto &json = settings.toJsonObject();
+        QCOMPARE(json.size(), 9);
+        QCOMPARE(json["intField"], 5);
+        QCOMPARE(json["validatedStringField"], "b");
+        QCOMPARE(json["boolField"], false);
+        QCOMPARE(json["unknown"], 2);
+
+        TestSettings copy;
+        QVERIFY(copy.readJsonObject(json));
+        QCOMPARE(copy.toJsonObject(), json);
+
+        settings.reset();
+        QCOMPARE(settings.intField(), 0);
+        QCOMPARE(settings.validatedStringField(), QStringLiteral("test"));
+        QVERIFY(settings.get("unknown").isUndefined());
+        QVERIFY(settings.isKnownProperty("intField"));
+        QVERIFY(!settings.isKnownProperty(QStringLiteral("unknown")));
+    }
+    // Test that JsonChangeSet tracks fields and unknown properties, and
+    // reports each change once
+    void changeSet()
+    {
+        TestSettings settings;
+        QCOMPARE(settings.fieldCount(), 8);
+        QCOMPARE(settings.fieldId(QStringLiteral("intField")), 1);
+        QCOMPARE(settings.fieldName(1), QStringLiteral("intField"));
+        QCOMPARE(settings.fieldId(QStringLiteral("unknown")), -1);
+
+        JsonChangeSet changes{settings};
+        QVERIFY(changes.empty());
+        QVERIFY(changes.add(QStringLiteral("intField")));
+        QVERIFY(!changes.add(QStringLiteral("intField")));
+        QVERIFY(changes.add(QStringLiteral("unknown")));
+        QVERIFY(!changes.empty());
+
+        settings.intField(3);
+        const auto &values = changes.takeValues();
+        QCOMPARE(values.size(), 2);
+        QCOMPARE(values["intField"], 3);
+        QCOMPARE(values["unknown"], QJsonValue{QJsonValue::Null});
+        QVERIFY(changes.empty());
+        QVERIFY(changes.add(QStringLiteral("intField")));
+    }
+
+    // Test that properties round-trip through a binary cache, and that
+    // invalid caches are rejected
+    void propertiesCache()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        Path dirPath{dir.path()};
+
+        TestSettings settings;
+        settings.intField(7);
+        settings.stringField(QStringLiteral("cached"));
+        settings.arrayField(QJsonArray{1, 2, 3});
+        writePropertiesCacheAtomic(settings.toJsonObject(), dirPath, "test.cache");
+
+        TestSettings loaded;
+        QVERIFY(readPropertiesCache(loaded, dirPath, "test.cache"));
+        QCOMPARE(loaded.toJsonObject(), settings.toJsonObject());
+
+        // Missing cache
+        QVERIFY(!readPropertiesCache(loaded, dirPath, "missing.cache"));
+
+        // Truncated cache
+        QFile cacheFile{dir.filePath(QStringLiteral("test.cache"))};
+        QVERIFY(cacheFile.open(QFile::ReadWrite));
+        QVERIFY(cacheFile.resize(cacheFile.size() - 4));
+        cacheFile.close();
+        QVERIFY(!readPropertiesCache(loaded, dirPath, "test.cache"));
+
+        // Not a cache at all
+        QVERIFY(cacheFile.open(QFile::WriteOnly | QFile::Truncate));
+        cacheFile.write("{\"intField\": 1}");
+        cacheFile.close();
+        QVERIFY(!readPropertiesCache(loaded, dirPath, "test.cache"));
+    }
+
     void fieldChangeListener()
     {
         TestSettings settings;
@@ -286,6 +426,157 @@ private slots:
         settings.validatedArrayField({ 1, 2, 3 });
         QVERIFY(!settings.error());
     }
+
+    void jsonPointers()
+    {
+        QCOMPARE(jsonPointerEscape(QStringLiteral("a/b~c")), QStringLiteral("a~1b~0c"));
+        QCOMPARE(jsonPointerSplit(QString{}), QStringList{});
+        QCOMPARE(jsonPointerSplit(QStringLiteral("/a~1b/~01/2")),
+                 (QStringList{QStringLiteral("a/b"), QStringLiteral("~1"), QStringLiteral("2")}));
+    }
+
+    void patchNestedChange()
+    {
+        const QJsonObject oldValue{
+            {"us_east", QJsonObject{{"name", "US East"}, {"latency", 30}}},
+            {"us_west", QJsonObject{{"name", "US West"}, {"latency", 80}}},
+        };
+        QJsonObject newValue{oldValue};
+        newValue["us_west"] = QJsonObject{{"name", "US West"}, {"latency", 75}};
+
+        QJsonArray patch;
+        buildJsonPatch(QStringLiteral("/locations"), oldValue, newValue, patch);
+        // Only the changed field is sent
+        QCOMPARE(patch.size(), 1);
+        QCOMPARE(patch[0].toObject()["op"].toString(), QStringLiteral("replace"));
+        QCOMPARE(patch[0].toObject()["path"].toString(), QStringLiteral("/locations/us_west/latency"));
+
+        QJsonValue target{QJsonObject{{"locations", oldValue}}};
+        QVERIFY(applyJsonPatch(target, patch));
+        QCOMPARE(target.toObject()["locations"].toObject(), newValue);
+    }
+
+    void patchAddRemove()
+    {
+        const QJsonObject oldValue{{"a", 1}, {"b", QJsonArray{1, 2}}, {"c", "x"}};
+        const QJsonObject newValue{{"a", 1}, {"b", QJsonArray{1, 2, 3}}, {"d", true}};
+
+        QJsonArray patch;
+        buildJsonPatch({}, oldValue, newValue, patch);
+        // "b" is replaced since its length changed, "d" is added, and "c" is
+        // removed
+        QCOMPARE(patch.size(), 3);
+
+        QJsonValue target{oldValue};
+        QVERIFY(applyJsonPatch(target, patch));
+        QCOMPARE(target.toObject(), newValue);
+
+        // Applying the patch again has no further effect
+        QVERIFY(applyJsonPatch(target, patch));
+        QCOMPARE(target.toObject(), newValue);
+    }
+
+    void patchSlidingWindow()
+    {
+        const QJsonObject oldValue{{"samples", QJsonArray{1, 2, 3, 4}}};
+        const QJsonObject newValue{{"samples", QJsonArray{3, 4, 5}}};
+
+        QJsonArray patch;
+        buildJsonPatch({}, oldValue, newValue, patch);
+        // Two samples are removed from the front and one is appended
+        QCOMPARE(patch.size(), 3);
+        QCOMPARE(patch[0].toObject()["op"].toString(), QStringLiteral("remove"));
+        QCOMPARE(patch[0].toObject()["path"].toString(), QStringLiteral("/samples/0"));
+        QCOMPARE(patch[2].toObject()["op"].toString(), QStringLiteral("add"));
+        QCOMPARE(patch[2].toObject()["path"].toString(), QStringLiteral("/samples/-"));
+
+        QJsonValue target{oldValue};
+        QVERIFY(applyJsonPatch(target, patch));
+        QCOMPARE(target.toObject(), newValue);
+
+        // A window that moved past all the old samples is replaced
+        patch = QJsonArray{};
+        buildJsonPatch({}, oldValue, QJsonObject{{"samples", QJsonArray{5, 6}}}, patch);
+        QCOMPARE(patch.size(), 1);
+        QCOMPARE(patch[0].toObject()["op"].toString(), QStringLiteral("replace"));
+    }
+
+    void patchEqualValues()
+    {
+        const QJsonObject value{{"a", 1}, {"b", QJsonObject{{"c", 2}}}};
+        QJsonArray patch;
+        buildJsonPatch({}, value, value, patch);
+        QVERIFY(patch.isEmpty());
+    }
+
+    void nestedChangeSignals()
+    {
+        auto pFirst = QSharedPointer<TestNestedItem>::create();
+        auto pSecond = QSharedPointer<TestNestedItem>::create();
+        TestNestedContainer container;
+        container.items({{QStringLiteral("first"), pFirst}, {QStringLiteral("second"), pSecond}});
+
+        QSignalSpy itemsSpy{&container, &TestNestedContainer::itemsChanged};
+        QSignalSpy propertySpy{&container, &NativeJsonObject::propertyChanged};
+        QSignalSpy nestedSpy{&container, &NativeJsonObject::nestedPropertyChanged};
+
+        // Changing one nested object only signals a nested change
+        pSecond->value(5);
+        QCOMPARE(itemsSpy.count(), 0);
+        QCOMPARE(propertySpy.count(), 0);
+        QCOMPARE(nestedSpy.count(), 1);
+        QCOMPARE(nestedSpy.takeFirst()[0].toString(), QStringLiteral("items"));
+        QCOMPARE(container.get("items").toObject()["second"].toObject()["value"].toInt(), 5);
+
+        // Objects nested in value objects are tracked too
+        TestNestedGroup group;
+        group.item(pFirst);
+        container.group(group);
+        pFirst->value(2);
+        // Signaled for both "items" and "group"
+        QCOMPARE(nestedSpy.count(), 2);
+        nestedSpy.clear();
+
+        // Objects that are no longer in the field aren't tracked
+        container.items({{QStringLiteral("second"), pSecond}});
+        container.group({});
+        pFirst->value(3);
+        QCOMPARE(nestedSpy.count(), 0);
+        pSecond->value(6);
+        QCOMPARE(nestedSpy.count(), 1);
+    }
+
+    void findNestedParent()
+    {
+        auto pFirst = QSharedPointer<TestNestedItem>::create();
+        auto pSecond = QSharedPointer<TestNestedItem>::create();
+        TestNestedContainer container;
+        container.items({{QStringLiteral("first"), pFirst}});
+        TestNestedGroup group;
+        group.item(pSecond);
+        container.group(group);
+
+        QCOMPARE(container.findNestedParent({QStringLiteral("intField")}), &container);
+        QCOMPARE(container.findNestedParent({QStringLiteral("items"), QStringLiteral("first"), QStringLiteral("value")}),
+                 pFirst.data());
+        QCOMPARE(container.findNestedParent({QStringLiteral("group"), QStringLiteral("item"), QStringLiteral("value")}),
+                 pSecond.data());
+        // Not a property of a nested object
+        QVERIFY(!container.findNestedParent({QStringLiteral("items"), QStringLiteral("first")}));
+        QVERIFY(!container.findNestedParent({QStringLiteral("items"), QStringLiteral("missing"), QStringLiteral("value")}));
+        QVERIFY(!container.findNestedParent({QStringLiteral("items"), QStringLiteral("first"), QStringLiteral("bogus")}));
+        QVERIFY(!container.findNestedParent({QStringLiteral("intField"), QStringLiteral("value")}));
+        // The group is held by value, so it can't be modified in place
+        QVERIFY(!container.findNestedParent({QStringLiteral("group"), QStringLiteral("count")}));
+    }
+
+    void patchInvalidPath()
+    {
+        QJsonValue target{QJsonObject{{"a", 1}}};
+        QJsonArray patch{QJsonObject{{"op", "replace"}, {"path", "/missing/b"}, {"value", 2}}};
+        QVERIFY(!applyJsonPatch(target, patch));
+        QCOMPARE(target.toObject(), (QJsonObject{{"a", 1}}));
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_json)
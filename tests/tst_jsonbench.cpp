@@ -0,0 +1,224 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+#include "json.h"
+#include "jsonrpc.h"
+#include "settings.h"
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+// Benchmarks for JSON serialization.  These aren't run with the unit tests;
+// build and run "test: jsonbench" manually to measure the effect of
+// serialization changes, such as:
+//   <build-dir>/test-jsonbench -o jsonbench.xml,xml
+// Keep the XML (or -csv) results from a baseline build to compare later runs.
+//
+// The DaemonData/DaemonState payloads are built from a servers list with the
+// same format and roughly the same size as the real regions list, so the
+// results are representative of the daemon's real work:
+// - jsonCastNested: json_cast of nested containers in both directions
+// - dataToJson / dataAssign: DaemonData with the full locations list
+// - stateToJson / stateAssign: DaemonState with grouped locations
+// - notifyPayload: a latency update, building and encoding the "data"
+//   notification as Daemon::notifyChanges() does
+
+namespace
+{
+    enum : int
+    {
+        // Countries in the generated servers list, and regions per country
+        CountryCount = 80,
+        RegionsPerCountry = 2,
+    };
+
+    // Generate a servers list in the legacy regions list format
+    QJsonObject buildServersList()
+    {
+        QJsonObject servers;
+        QJsonArray autoRegions;
+        for(int c = 0; c < CountryCount; ++c)
+        {
+            QString country = QString{QChar{'a' + c / 26}} + QChar{'a' + c % 26};
+            for(int r = 0; r < RegionsPerCountry; ++r)
+            {
+                QString id = QStringLiteral("%1_region_%2").arg(country).arg(r);
+                QString host = QStringLiteral("%1.privacy.network").arg(id);
+                QString ip = QStringLiteral("10.%1.%2.1").arg(c).arg(r);
+                servers.insert(id, QJsonObject{
+                    {QStringLiteral("name"), QStringLiteral("Region %1 %2").arg(country.toUpper()).arg(r)},
+                    {QStringLiteral("country"), country.toUpper()},
+                    {QStringLiteral("dns"), host},
+                    {QStringLiteral("port_forward"), r == 0},
+                    {QStringLiteral("ping"), ip + QStringLiteral(":8888")},
+                    {QStringLiteral("serial"), QStringLiteral("0123456789abcdef%1").arg(c * RegionsPerCountry + r)},
+                    {QStringLiteral("openvpn_udp"), QJsonObject{{QStringLiteral("best"), ip + QStringLiteral(":8080")}}},
+                    {QStringLiteral("openvpn_tcp"), QJsonObject{{QStringLiteral("best"), ip + QStringLiteral(":500")}}}
+                });
+                autoRegions.append(id);
+            }
+        }
+        servers.insert(QStringLiteral("info"), QJsonObject{{QStringLiteral("auto_regions"), autoRegions}});
+        return servers;
+    }
+
+    // Set a latency for every location, varied by 'seed' so each call changes
+    // all of them
+    ServerLocations measureLatencies(const ServerLocations &locations, int seed)
+    {
+        ServerLocations measured;
+        measured.reserve(locations.size());
+        int i = 0;
+        for(auto itLocation = locations.begin(); itLocation != locations.end(); ++itLocation)
+        {
+            QSharedPointer<ServerLocation> pLocation{new ServerLocation{**itLocation}};
+            pLocation->latency(10.0 + (i * 7 + seed) % 300);
+            measured.insert(itLocation.key(), pLocation);
+            ++i;
+        }
+        return measured;
+    }
+}
+
+class tst_jsonbench : public QObject
+{
+    Q_OBJECT
+
+private:
+    ServerLocations _locations;
+
+    // Apply some locations to a DaemonState the way the daemon does
+    void applyLocations(DaemonState &state, const ServerLocations &locations)
+    {
+        auto grouped = buildGroupedLocations(locations);
+        state.groupedLocations(grouped);
+        if(!grouped.isEmpty() && !grouped.front().locations().isEmpty())
+        {
+            state.vpnLocations().bestLocation(grouped.front().locations().front());
+            state.vpnLocations().chosenLocation(grouped.front().locations().front());
+        }
+    }
+
+private slots:
+    void initTestCase()
+    {
+        _locations = measureLatencies(updateServerLocations({}, buildServersList()), 0);
+        QCOMPARE(_locations.size(), CountryCount * RegionsPerCountry);
+    }
+
+    void jsonCastNested()
+    {
+        QHash<QString, QVector<QString>> nested;
+        for(int i = 0; i < CountryCount; ++i)
+        {
+            QVector<QString> &values = nested[QString::number(i)];
+            for(int j = 0; j < 20; ++j)
+                values.push_back(QStringLiteral("value %1").arg(j));
+        }
+
+        QBENCHMARK
+        {
+            QJsonValue json = json_cast<QJsonValue>(nested);
+            auto roundTrip = json_cast<QHash<QString, QVector<QString>>>(json);
+            QCOMPARE(roundTrip.size(), nested.size());
+        }
+    }
+
+    void dataToJson()
+    {
+        DaemonData data;
+        data.locations(_locations);
+
+        QBENCHMARK
+        {
+            // Change a location so the cached JSON isn't just reused
+            data.locations(measureLatencies(_locations, 1));
+            QJsonObject json = data.toJsonObject();
+            QVERIFY(json.contains(QStringLiteral("locations")));
+        }
+    }
+
+    void dataAssign()
+    {
+        DaemonData source;
+        source.locations(_locations);
+        QJsonObject json = source.toJsonObject();
+
+        QBENCHMARK
+        {
+            DaemonData data;
+            QVERIFY(data.assign(json));
+        }
+    }
+
+    void stateToJson()
+    {
+        int seed = 0;
+        DaemonState state;
+
+        QBENCHMARK
+        {
+            applyLocations(state, measureLatencies(_locations, ++seed));
+            QJsonObject json = state.toJsonObject();
+            QVERIFY(json.contains(QStringLiteral("groupedLocations")));
+        }
+    }
+
+    void stateAssign()
+    {
+        DaemonState source;
+        applyLocations(source, _locations);
+        QJsonObject json = source.toJsonObject();
+
+        QBENCHMARK
+        {
+            DaemonState state;
+            QVERIFY(state.assign(json));
+        }
+    }
+
+    void notifyPayload()
+    {
+        int seed = 0;
+        DaemonState state;
+        JsonChangeSet stateChanges{state};
+        connect(&state, &NativeJsonObject::propertyChanged, this,
+                [&](const QString &name){stateChanges.add(name);});
+        connect(&state, &NativeJsonObject::nestedPropertyChanged, this,
+                [&](const QString &name){stateChanges.add(name);});
+
+        QBENCHMARK
+        {
+            applyLocations(state, measureLatencies(_locations, ++seed));
+            QJsonObject all{{QStringLiteral("state"), stateChanges.takeValues()}};
+            QByteArray text = encodeJsonRPCNotification(QStringLiteral("data"),
+                                                        QJsonArray{all},
+                                                        JsonRPCEncoding::Text);
+            QByteArray binary = encodeJsonRPCNotification(QStringLiteral("data"),
+                                                          QJsonArray{all},
+                                                          JsonRPCEncoding::Binary);
+            QVERIFY(!text.isEmpty());
+            QVERIFY(!binary.isEmpty());
+        }
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_jsonbench)
+#include TEST_MOC
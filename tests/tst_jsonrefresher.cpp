@@ -107,6 +107,40 @@ private slots:
         QVERIFY(fetchSpy.empty());
         QVERIFY(!fetchSpy.wait(1000));
     }
+
+    // Test fetching the same payload again after it was loaded successfully -
+    // it's not emitted again.
+    void testUnchangedPayload()
+    {
+        TestRefresher refresher;
+        QSignalSpy fetchSpy{&refresher, &JsonRefresher::contentLoaded};
+        connect(&refresher, &JsonRefresher::contentLoaded, &refresher,
+                &JsonRefresher::loadSucceeded);
+        QSignalSpy consumeSpy{&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal};
+
+        auto pReply = MockNetworkManager::enqueueReply(TestData::successJson);
+        refresher.start();
+        QVERIFY(consumeSpy.wait(100));
+        pReply->finished();
+        QVERIFY(fetchSpy.wait(100));
+        fetchSpy.clear();
+
+        // Refresh and get the same payload, it's not emitted again
+        pReply = MockNetworkManager::enqueueReply(TestData::successJson);
+        refresher.refresh();
+        QVERIFY(consumeSpy.wait(100));
+        pReply->finished();
+        QVERIFY(!fetchSpy.wait(1000));
+
+        // A changed payload is emitted
+        pReply = MockNetworkManager::enqueueReply(R"({"unit_test":false})");
+        refresher.refresh();
+        QVERIFY(consumeSpy.wait(100));
+        pReply->finished();
+        QVERIFY(fetchSpy.wait(100));
+
+        refresher.stop();
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_jsonrefresher)
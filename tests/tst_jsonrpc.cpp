@@ -76,6 +76,150 @@ private slots:
         QCOMPARE(call->result(), 12 + 34);
     }
 
+    // Test a batch of calls and notifications, which should be sent in one
+    // message and answered with one message
+    void batchCall()
+    {
+        int notified = 0, requestMessages = 0, responseMessages = 0;
+        LocalMethodRegistry registry {
+            { QStringLiteral("add"), [&](int a, int b) { return a + b; } },
+            { QStringLiteral("note"), [&]() { ++notified; } },
+        };
+        LocalCallInterface server(&registry);
+        RemoteCallInterface client;
+        connect(&client, &RemoteCallInterface::messageReady, &server,
+                [&](const QByteArray &msg)
+                {
+                    ++requestMessages;
+                    server.processMessage(msg);
+                });
+        connect(&server, &LocalCallInterface::messageReady, &client,
+                [&](const QByteArray &msg)
+                {
+                    ++responseMessages;
+                    client.processMessage(msg);
+                });
+
+        client.beginBatch();
+        auto first = client.call(QStringLiteral("add"), 1, 2);
+        client.post(QStringLiteral("note"));
+        auto second = client.call(QStringLiteral("add"), 10, 20);
+        auto missing = client.call(QStringLiteral("missing"));
+        QCOMPARE(requestMessages, 0);
+        client.sendBatch();
+
+        QTRY_VERIFY(first->isFinished() && second->isFinished() && missing->isFinished());
+        QCOMPARE(requestMessages, 1);
+        QCOMPARE(responseMessages, 1);
+        QCOMPARE(notified, 1);
+        QCOMPARE(first->result(), 3);
+        QCOMPARE(second->result(), 30);
+        QVERIFY(missing->isRejected());
+        QVERIFY(missing->error().code() == Error::Code::JsonRPCMethodNotFound);
+    }
+
+    // Test a call where the server responds with the binary encoding
+    void binaryResponseCall()
+    {
+        bool responded = false;
+        LocalMethodRegistry registry {
+            { QStringLiteral("test"), [&](const QString &param) { return param + QStringLiteral("\xff"); } },
+        };
+        LocalCallInterface server(&registry);
+        server.setEncoding(JsonRPCEncoding::Binary);
+        RemoteCallInterface client;
+        connect(&client, &RemoteCallInterface::messageReady, &server, &LocalCallInterface::processMessage);
+        connect(&server, &LocalCallInterface::messageReady, &client,
+                [&](const QByteArray &msg)
+                {
+                    QVERIFY(msg.startsWith("qbjs"));
+                    client.processMessage(msg);
+                });
+        auto call = client.call(QStringLiteral("test"), QStringLiteral("abc"));
+        call->notify([&](const Error&, const QJsonValue&) { responded = true; });
+        QTRY_VERIFY(responded);
+        QVERIFY(call->isResolved());
+        QCOMPARE(call->result(), QStringLiteral("abc\xff"));
+    }
+
+    // Test that the registry counts calls and errors, and records latencies,
+    // for each method
+    void methodStats()
+    {
+        LocalMethodRegistry registry {
+            { QStringLiteral("add"), [&](int a, int b) { return a + b; } },
+            { QStringLiteral("fail"), [&]() -> int { throw Error{HERE, Error::Code::Unknown}; } },
+        };
+        auto first = registry.invoke(QStringLiteral("add"), QJsonArray{1, 2});
+        auto second = registry.invoke(QStringLiteral("add"), QJsonArray{3, 4});
+        auto failed = registry.invoke(QStringLiteral("fail"), {});
+        auto missing = registry.invoke(QStringLiteral("missing"), {});
+        QTRY_VERIFY(first->isFinished() && second->isFinished() &&
+                    failed->isFinished() && missing->isFinished());
+        QCOMPARE(second->result(), QJsonValue{7});
+        QVERIFY(failed->isRejected());
+
+        const auto &stats = registry.methodStats();
+        // Unknown methods aren't included
+        QCOMPARE(stats.size(), 2);
+        const RpcMethodStats &addStats = stats[QStringLiteral("add")];
+        QCOMPARE(addStats.calls, quint64{2});
+        QCOMPARE(addStats.errors, quint64{0});
+        QCOMPARE(addStats.dispatch.count, quint64{2});
+        QCOMPARE(addStats.completion.count, quint64{2});
+        quint64 bucketTotal = 0;
+        for(quint64 bucketCount : addStats.completion.buckets)
+            bucketTotal += bucketCount;
+        QCOMPARE(bucketTotal, quint64{2});
+        QVERIFY(addStats.completion.maxNs >= addStats.dispatch.maxNs);
+
+        const RpcMethodStats &failStats = stats[QStringLiteral("fail")];
+        QCOMPARE(failStats.calls, quint64{1});
+        QCOMPARE(failStats.errors, quint64{1});
+    }
+
+    // Background methods are deferred, so calls received after them are
+    // dispatched first
+    void backgroundPriority()
+    {
+        QStringList order;
+        LocalMethodRegistry registry {
+            LocalMethod{QStringLiteral("heavy"), [&]() { order.push_back(QStringLiteral("heavy")); return 1; }}
+                .priority(LocalMethod::Priority::Background),
+            { QStringLiteral("light"), [&]() { order.push_back(QStringLiteral("light")); return 2; } },
+        };
+        auto heavy = registry.invoke(QStringLiteral("heavy"), {});
+        auto light = registry.invoke(QStringLiteral("light"), {});
+        QCOMPARE(order, QStringList{QStringLiteral("light")});
+        QTRY_VERIFY(heavy->isFinished());
+        QCOMPARE(order, (QStringList{QStringLiteral("light"), QStringLiteral("heavy")}));
+        QCOMPARE(heavy->result(), QJsonValue{1});
+        QCOMPARE(light->result(), QJsonValue{2});
+        QCOMPARE(registry.methodStats()[QStringLiteral("heavy")].calls, quint64{1});
+    }
+
+    // Latencies are sorted into the correct histogram buckets
+    void latencyHistogram()
+    {
+        RpcLatencyHistogram histogram;
+        histogram.add(500000);      // 0.5 ms -> 1 ms bucket
+        histogram.add(1000000);     // 1 ms -> 1 ms bucket (bounds are inclusive)
+        histogram.add(30000000);    // 30 ms -> 50 ms bucket
+        histogram.add(10000000000); // 10 s -> overflow bucket
+        QCOMPARE(histogram.buckets[0], quint64{2});
+        QCOMPARE(histogram.buckets[4], quint64{1});
+        QCOMPARE(histogram.buckets[RpcLatencyHistogram::bucketBoundsMs.size()], quint64{1});
+        QCOMPARE(histogram.count, quint64{4});
+        QCOMPARE(histogram.maxNs, qint64{10000000000});
+    }
+
+    // Test that an invalid binary message is rejected
+    void invalidBinaryMessage()
+    {
+        QVERIFY_EXCEPTION_THROWN(parseJsonRPCMessage(QByteArrayLiteral("qbjs\x01\x02")),
+                                 JsonRPCParseError);
+    }
+
     // Test that a call() while disconnected is rejected
     void disconnectedCall()
     {
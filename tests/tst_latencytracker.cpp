@@ -18,6 +18,7 @@
 
 #include "daemon/src/latencytracker.h"
 #include <QtTest>
+#include <QTcpServer>
 #include <cassert>
 
 namespace
@@ -230,7 +231,7 @@ MeasurementSplitter::MeasurementSplitter(LatencyBatch &batch)
 void MeasurementSplitter::onNewMeasurements(const LatencyTracker::Latencies &measurements)
 {
     for(const auto &measurement : measurements)
-        emit newMeasurement(measurement.first, measurement.second);
+        emit newMeasurement(measurement.id, measurement.latency);
 }
 
 class tst_latencytracker : public QObject
@@ -410,6 +411,33 @@ private slots:
         QCOMPARE(measurementSpy.size(), MockPingServerCount);
     }
 
+    //Verify that a LatencyBatch in burst mode sends each probe and reports one
+    //measurement per location with no loss
+    void burstMeasurement()
+    {
+        AutoEcho autoEcho{_mockServers};
+
+        QSignalSpy pingSpy{&_mockServers, &MockPingServers::receivedPing};
+        auto pBatch{new LatencyBatch{_mockServers.mockPingLocations(), this, 3}};
+        LatencyTracker::Latencies measurements;
+        connect(pBatch, &LatencyBatch::newMeasurements, this,
+                [&](const LatencyTracker::Latencies &batch){measurements += batch;});
+        QSignalSpy destroySpy{pBatch, &QObject::destroyed};
+
+        //Wait until the object is destroyed; this takes a few seconds since the
+        //probes are spaced out
+        QVERIFY(destroySpy.wait(30000));
+
+        QCOMPARE(pingSpy.size(), MockPingServerCount * 3);
+        QCOMPARE(measurements.size(), static_cast<int>(MockPingServerCount));
+        for(const auto &measurement : measurements)
+        {
+            QCOMPARE(measurement.loss, 0.0);
+            QVERIFY(measurement.latency <= measurement.median);
+            QCOMPARE(measurement.method, LatencyTracker::ProbeMethod::Udp);
+        }
+    }
+
     //Verify that a LatencyBatch destroys itself correctly when none of the
     //addresses given are valid.  (It should be destroyed immediately, not after
     //the measurement timeout.)
@@ -448,6 +476,35 @@ private slots:
         QCOMPARE(measurementSpy.size(), 0);
     }
 
+    //Verify that a LatencyBatch times TCP connections when none of the UDP
+    //pings are answered
+    void tcpFallback()
+    {
+        QTcpServer tcpServer;
+        QVERIFY(tcpServer.listen(localhost));
+        auto locations = _mockServers.mockPingLocations();
+        for(auto &location : locations)
+        {
+            location.tcpAddress = QStringLiteral("%1:%2")
+                .arg(localhost.toString()).arg(tcpServer.serverPort());
+        }
+
+        //The UDP servers don't echo, so the batch falls back after the timeout
+        auto pBatch{new LatencyBatch{locations, this}};
+        LatencyTracker::Latencies measurements;
+        connect(pBatch, &LatencyBatch::newMeasurements, this,
+                [&](const LatencyTracker::Latencies &batch){measurements += batch;});
+        QSignalSpy destroySpy{pBatch, &QObject::destroyed};
+        QVERIFY(destroySpy.wait(30000));
+
+        QCOMPARE(measurements.size(), static_cast<int>(MockPingServerCount));
+        for(const auto &measurement : measurements)
+        {
+            QCOMPARE(measurement.method, LatencyTracker::ProbeMethod::Tcp);
+            QCOMPARE(measurement.loss, 0.0);
+        }
+    }
+
     //Verify that equivalent IP addresses are found correctly
     void equivalentIpAddresses()
     {
@@ -496,6 +553,39 @@ private slots:
         QCOMPARE(parsePingAddress("bogus:8888", host, port), false);
     }
 
+    //Verify the LatencyHistory aggregates, including after the history wraps
+    void historyAggregates()
+    {
+        using ms = std::chrono::milliseconds;
+
+        LatencyHistory mean;
+        QCOMPARE(mean.updateLatency(ms{100}), ms{100});
+        QCOMPARE(mean.jitter(), ms{0});
+        QCOMPARE(mean.updateLatency(ms{200}), ms{150});
+        QCOMPARE(mean.updateLatency(ms{30}), ms{110});
+        QCOMPARE(mean.median(), ms{100});
+        //Fill the history, then replace the first two measurements
+        mean.updateLatency(ms{40});
+        mean.updateLatency(ms{50});
+        QCOMPARE(mean.count(), static_cast<int>(LatencyHistory::HistoryCount));
+        QCOMPARE(mean.updateLatency(ms{60}), ms{(200 + 30 + 40 + 50 + 60) / 5});
+        QCOMPARE(mean.updateLatency(ms{70}), ms{(30 + 40 + 50 + 60 + 70) / 5});
+        QCOMPARE(mean.count(), static_cast<int>(LatencyHistory::HistoryCount));
+        QCOMPARE(mean.median(), ms{50});
+        QVERIFY(mean.jitter() > ms{0});
+
+        //The median ignores a single outlier
+        LatencyHistory median{LatencyHistory::Aggregate::Median};
+        median.updateLatency(ms{40});
+        median.updateLatency(ms{900});
+        QCOMPARE(median.updateLatency(ms{50}), ms{50});
+
+        //The EWMA starts at the first measurement and moves toward new ones
+        LatencyHistory ewma{LatencyHistory::Aggregate::Ewma};
+        QCOMPARE(ewma.updateLatency(ms{100}), ms{100});
+        QCOMPARE(ewma.updateLatency(ms{200}), ms{125});
+    }
+
 private:
     MockPingServers _mockServers;
 };
@@ -0,0 +1,114 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+
+#include "linebuffer.h"
+
+class tst_linebuffer : public QObject
+{
+    Q_OBJECT
+
+private:
+    // Collect the lines emitted by both signals
+    struct LineCollector
+    {
+        QList<QByteArray> views;
+        QList<QByteArray> lines;
+
+        LineCollector(LineBuffer &buffer)
+        {
+            QObject::connect(&buffer, &LineBuffer::lineView,
+                [this](const QByteArray &line){views.push_back(QByteArray{line.constData(), line.size()});});
+            QObject::connect(&buffer, &LineBuffer::lineComplete,
+                [this](const QByteArray &line){lines.push_back(line);});
+        }
+    };
+
+private slots:
+    // Lines split across chunks are emitted once complete, and CRLF line
+    // endings are trimmed
+    void splitLines()
+    {
+        LineBuffer buffer;
+        LineCollector collector{buffer};
+
+        buffer.append("first\r\nsec");
+        QCOMPARE(collector.views, (QList<QByteArray>{"first"}));
+        buffer.append("ond");
+        QCOMPARE(collector.views.size(), 1);
+        buffer.append("\n\nthird\n");
+        QCOMPARE(collector.views, (QList<QByteArray>{"first", "second", "", "third"}));
+        QCOMPARE(collector.lines, collector.views);
+    }
+
+    // Consumed data is compacted while a partial line is retained
+    void compaction()
+    {
+        LineBuffer buffer;
+        LineCollector collector{buffer};
+
+        for(int i=0; i<1000; ++i)
+        {
+            buffer.append(QByteArray::number(i) + "\nabc");
+            buffer.append("def");
+            buffer.append("\n");
+        }
+        QCOMPARE(collector.views.size(), 2000);
+        QCOMPARE(collector.views[998], QByteArray{"499"});
+        QCOMPARE(collector.views[999], QByteArray{"abcdef"});
+        QCOMPARE(collector.lines, collector.views);
+    }
+
+    // reset() returns only the unconsumed partial line
+    void reset()
+    {
+        LineBuffer buffer;
+        LineCollector collector{buffer};
+
+        buffer.append("one\ntwo\npart");
+        QCOMPARE(buffer.reset(), QByteArray{"part"});
+        QCOMPARE(buffer.reset(), QByteArray{});
+        buffer.append("ial\n");
+        QCOMPARE(collector.views, (QList<QByteArray>{"one", "two", "ial"}));
+    }
+
+    // A slot can reset the buffer while lines are being emitted; the rest of
+    // the data is discarded
+    void resetInSlot()
+    {
+        LineBuffer buffer;
+        LineCollector collector{buffer};
+        QByteArray partial;
+        connect(&buffer, &LineBuffer::lineView, this, [&](const QByteArray &line)
+        {
+            if(line == "stop")
+                partial = buffer.reset();
+        });
+
+        buffer.append("a\nstop\nb\nc");
+        QCOMPARE(collector.views, (QList<QByteArray>{"a", "stop"}));
+        QCOMPARE(partial, QByteArray{"b\nc"});
+        buffer.append("d\n");
+        QCOMPARE(collector.views, (QList<QByteArray>{"a", "stop", "d"}));
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_linebuffer)
+#include TEST_MOC
@@ -0,0 +1,135 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#include "metrics.h"
+#include <QtTest>
+
+class tst_metrics : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init()
+    {
+        // Disabling discards all values
+        Metrics::setEnabled(false);
+        Metrics::setEnabled(true);
+    }
+
+    void cleanupTestCase()
+    {
+        Metrics::setEnabled(false);
+    }
+
+    // Counters, gauges, and summaries are rendered in OpenMetrics format
+    void metricFormat()
+    {
+        Metrics::increment(QStringLiteral("test_requests"));
+        Metrics::increment(QStringLiteral("test_requests"), {}, 2);
+        Metrics::setGauge(QStringLiteral("test_temperature"), 20.5);
+        Metrics::observe(QStringLiteral("test_duration_seconds"), 0.25);
+        Metrics::observe(QStringLiteral("test_duration_seconds"), 0.5);
+
+        QCOMPARE(Metrics::openMetricsText(),
+                 QByteArray{"# TYPE test_duration_seconds summary\n"
+                            "test_duration_seconds_count 2\n"
+                            "test_duration_seconds_sum 0.75\n"
+                            "# TYPE test_requests counter\n"
+                            "test_requests_total 3\n"
+                            "# TYPE test_temperature gauge\n"
+                            "test_temperature 20.5\n"
+                            "# EOF\n"});
+    }
+
+    // Samples are identified by their labels, and label values are escaped
+    void labels()
+    {
+        Metrics::increment(QStringLiteral("test_calls"), {{QStringLiteral("method"), QStringLiteral("b")}});
+        Metrics::increment(QStringLiteral("test_calls"), {{QStringLiteral("method"), QStringLiteral("a")}});
+        Metrics::increment(QStringLiteral("test_calls"), {{QStringLiteral("method"), QStringLiteral("a")}});
+        Metrics::setGauge(QStringLiteral("test_info"), 1,
+                          {{QStringLiteral("value"), QStringLiteral("x\"y\\z\n")}});
+
+        QCOMPARE(Metrics::openMetricsText(),
+                 QByteArray{"# TYPE test_calls counter\n"
+                            "test_calls_total{method=\"a\"} 2\n"
+                            "test_calls_total{method=\"b\"} 1\n"
+                            "# TYPE test_info gauge\n"
+                            "test_info{value=\"x\\\"y\\\\z\\n\"} 1\n"
+                            "# EOF\n"});
+    }
+
+    // Histograms render cumulative buckets, then the count and sum
+    void histogram()
+    {
+        Metrics::setHistogram(QStringLiteral("test_latency_seconds"), {0.1, 1},
+                              {2, 1, 1}, 12.5,
+                              {{QStringLiteral("method"), QStringLiteral("a")}});
+        Metrics::setCounter(QStringLiteral("test_calls"), 4);
+
+        QCOMPARE(Metrics::openMetricsText(),
+                 QByteArray{"# TYPE test_calls counter\n"
+                            "test_calls_total 4\n"
+                            "# TYPE test_latency_seconds histogram\n"
+                            "test_latency_seconds_bucket{le=\"0.1\",method=\"a\"} 2\n"
+                            "test_latency_seconds_bucket{le=\"1\",method=\"a\"} 3\n"
+                            "test_latency_seconds_bucket{le=\"+Inf\",method=\"a\"} 4\n"
+                            "test_latency_seconds_count{method=\"a\"} 4\n"
+                            "test_latency_seconds_sum{method=\"a\"} 12.5\n"
+                            "# EOF\n"});
+    }
+
+    // Clearing a gauge removes its stale samples
+    void clearGauge()
+    {
+        Metrics::setGauge(QStringLiteral("test_state"), 1, {{QStringLiteral("state"), QStringLiteral("Connecting")}});
+        Metrics::clearGauge(QStringLiteral("test_state"));
+        Metrics::setGauge(QStringLiteral("test_state"), 1, {{QStringLiteral("state"), QStringLiteral("Connected")}});
+
+        QCOMPARE(Metrics::openMetricsText(),
+                 QByteArray{"# TYPE test_state gauge\n"
+                            "test_state{state=\"Connected\"} 1\n"
+                            "# EOF\n"});
+    }
+
+    // A family keeps the type it was first recorded with
+    void typeMismatch()
+    {
+        Metrics::increment(QStringLiteral("test_value"));
+        Metrics::setGauge(QStringLiteral("test_value"), 5);
+
+        QCOMPARE(Metrics::openMetricsText(),
+                 QByteArray{"# TYPE test_value counter\n"
+                            "test_value_total 1\n"
+                            "# EOF\n"});
+    }
+
+    // Nothing is recorded while metrics are disabled
+    void disabled()
+    {
+        Metrics::setEnabled(false);
+        Metrics::increment(QStringLiteral("test_requests"));
+        Metrics::setGauge(QStringLiteral("test_temperature"), 1);
+        Metrics::observe(QStringLiteral("test_duration_seconds"), 1);
+        QVERIFY(!Metrics::enabled());
+        QCOMPARE(Metrics::openMetricsText(), QByteArray{"# EOF\n"});
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_metrics)
+#include TEST_MOC
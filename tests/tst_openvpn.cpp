@@ -0,0 +1,99 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "daemon/src/openvpn.h"
+#include <QtTest>
+#include <cstring>
+#include <limits>
+
+class tst_openvpn : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void byteCounts()
+    {
+        quint64 received{0}, sent{0};
+        QVERIFY(OpenVPNProcess::parseByteCount(">BYTECOUNT:1024,512", received, sent));
+        QCOMPARE(received, quint64{1024});
+        QCOMPARE(sent, quint64{512});
+
+        QVERIFY(OpenVPNProcess::parseByteCount(">BYTECOUNT:18446744073709551615,0", received, sent));
+        QCOMPARE(received, std::numeric_limits<quint64>::max());
+        QCOMPARE(sent, quint64{0});
+
+        // Malformed or overflowing counts are rejected
+        QVERIFY(!OpenVPNProcess::parseByteCount(">BYTECOUNT:1024", received, sent));
+        QVERIFY(!OpenVPNProcess::parseByteCount(">BYTECOUNT:,512", received, sent));
+        QVERIFY(!OpenVPNProcess::parseByteCount(">BYTECOUNT:10x,512", received, sent));
+        QVERIFY(!OpenVPNProcess::parseByteCount(">BYTECOUNT:18446744073709551616,0", received, sent));
+        QVERIFY(!OpenVPNProcess::parseByteCount(">STATE:1024,512", received, sent));
+    }
+
+    void stateNames()
+    {
+        auto parse = [](const char *name, OpenVPNProcess::State &state)
+        {
+            return OpenVPNProcess::parseStateName(name, static_cast<int>(std::strlen(name)), state);
+        };
+
+        OpenVPNProcess::State state{OpenVPNProcess::Created};
+        QVERIFY(parse("CONNECTING", state));
+        QCOMPARE(state, OpenVPNProcess::Connecting);
+        QVERIFY(parse("TCP_CONNECT", state));
+        QCOMPARE(state, OpenVPNProcess::TCPConnect);
+        QVERIFY(parse("EXITING", state));
+        QCOMPARE(state, OpenVPNProcess::Exiting);
+
+        // Names must match exactly
+        QVERIFY(!parse("CONNECT", state));
+        QVERIFY(!parse("CONNECTEDX", state));
+        QVERIFY(!parse("connected", state));
+        QCOMPARE(state, OpenVPNProcess::Exiting);
+    }
+
+    void outputLines()
+    {
+        using Event = OpenVPNProcess::OutputEvent;
+        auto match = OpenVPNProcess::matchOutputLine(QStringLiteral("Mon Jun 1 12:00:00 2020 TCP: connect to [AF_INET]10.0.0.1:1080 failed: Connection refused"));
+        QCOMPARE(match.event, Event::TcpConnectFailed);
+        QCOMPARE(match.captures, QStringList{QStringLiteral("10.0.0.1")});
+
+        match = OpenVPNProcess::matchOutputLine(QStringLiteral("Using device:tun0 local_address:10.1.2.3 remote_address:10.1.2.1"));
+        QCOMPARE(match.event, Event::UsingDevice);
+        QCOMPARE(match.captures, (QStringList{QStringLiteral("tun0"), QStringLiteral("10.1.2.3"),
+                                              QStringLiteral("10.1.2.1")}));
+
+        QCOMPARE(OpenVPNProcess::matchOutputLine(QStringLiteral("recv_socks_reply: TCP port read failed on recv()")).event,
+                 Event::ProxyReadFailed);
+        QCOMPARE(OpenVPNProcess::matchOutputLine(QStringLiteral("socks_username_password_auth: server refused the authentication")).event,
+                 Event::ProxyAuthFailed);
+
+        // Candidate lines that don't match the full pattern, and lines with
+        // none of the literals, match nothing
+        QCOMPARE(OpenVPNProcess::matchOutputLine(QStringLiteral("TCP port read failed")).event, Event::None);
+        QCOMPARE(OpenVPNProcess::matchOutputLine(QStringLiteral("Using device:tun0")).event, Event::None);
+        // DNS is applied by the daemon now, the old updown script's error
+        // string isn't an event
+        QCOMPARE(OpenVPNProcess::matchOutputLine(QStringLiteral("!!!updown.sh!!!dnsConfigFailure")).event, Event::None);
+        QCOMPARE(OpenVPNProcess::matchOutputLine(QStringLiteral("Initialization Sequence Completed")).event, Event::None);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_openvpn)
+#include TEST_MOC
@@ -254,6 +254,59 @@ private slots:
         QVERIFY(!resultSpy.wait(100));
         QVERIFY(MockNetworkManager::hasNextReply()); // Not consumed
     }
+
+    // Reconnecting to the same region reports the last port right away while
+    // it's revalidated; a different region makes a normal request
+    void testCachedPort()
+    {
+        TestPortForwarder forwarder;
+        const QString region{QStringLiteral("us_east")};
+
+        QSignalSpy resultSpy(&forwarder, &PortForwarder::portForwardUpdated);
+        auto pSuccess1 = MockNetworkManager::enqueueReply(Responses::success);
+
+        forwarder.enablePortForwarding(true);
+        forwarder.updateConnectionState(PortForwarder::State::ConnectedSupported, region);
+        QCOMPARE(resultSpy.takeFirst()[0].value<int>(), DaemonState::PortForwardState::Attempting);
+        pSuccess1->queueFinished();
+        QVERIFY(resultSpy.wait());
+        QCOMPARE(resultSpy.takeFirst()[0].value<int>(), Responses::successPort);
+
+        forwarder.updateConnectionState(PortForwarder::State::Disconnected);
+        QCOMPARE(resultSpy.takeFirst()[0].value<int>(), DaemonState::PortForwardState::Inactive);
+
+        // Same region - the cached port is reported synchronously, and isn't
+        // reported again when it's confirmed
+        auto pSuccess2 = MockNetworkManager::enqueueReply(Responses::success);
+        forwarder.updateConnectionState(PortForwarder::State::ConnectedSupported, region);
+        QCOMPARE(resultSpy.takeFirst()[0].value<int>(), Responses::successPort);
+        pSuccess2->queueFinished();
+        QVERIFY(!resultSpy.wait(100));
+
+        forwarder.updateConnectionState(PortForwarder::State::Disconnected);
+        QCOMPARE(resultSpy.takeFirst()[0].value<int>(), DaemonState::PortForwardState::Inactive);
+
+        // Same region, but the API returns a different port - the new port
+        // replaces the cached one
+        auto pSuccess3 = MockNetworkManager::enqueueReply(Responses::success2);
+        forwarder.updateConnectionState(PortForwarder::State::ConnectedSupported, region);
+        QCOMPARE(resultSpy.takeFirst()[0].value<int>(), Responses::successPort);
+        pSuccess3->queueFinished();
+        QVERIFY(resultSpy.wait());
+        QCOMPARE(resultSpy.takeFirst()[0].value<int>(), Responses::successPort2);
+
+        forwarder.updateConnectionState(PortForwarder::State::Disconnected);
+        QCOMPARE(resultSpy.takeFirst()[0].value<int>(), DaemonState::PortForwardState::Inactive);
+
+        // Different region - nothing cached
+        auto pSuccess4 = MockNetworkManager::enqueueReply(Responses::success);
+        forwarder.updateConnectionState(PortForwarder::State::ConnectedSupported,
+                                        QStringLiteral("de_berlin"));
+        QCOMPARE(resultSpy.takeFirst()[0].value<int>(), DaemonState::PortForwardState::Attempting);
+        pSuccess4->queueFinished();
+        QVERIFY(resultSpy.wait());
+        QCOMPARE(resultSpy.takeFirst()[0].value<int>(), Responses::successPort);
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_portforwarder)
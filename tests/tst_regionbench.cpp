@@ -0,0 +1,217 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+#include "daemon/src/latencytracker.h"
+#include "settings.h"
+#include <vector>
+
+// Scalability benchmarks for the region list.  These aren't run with the unit
+// tests; build and run "test: regionbench" manually to check how location
+// processing scales as the servers list grows, such as:
+//   <build-dir>/test-regionbench -o regionbench.xml,xml
+//
+// Each benchmark runs with 100, 1,000, and 10,000 synthetic locations, so a
+// step that grows faster than linearly shows up in the ratios between rows:
+// - trackerUpdateLocations: LatencyTracker::updateLocations() with an
+//   updated list (all locations retained)
+// - historyUpdate: one new measurement for every location's LatencyHistory
+// - applyMeasurements: applying a latency batch for every location and
+//   rebuilding the grouped locations, as Daemon::newLatencyMeasurements() does
+// - groupedLocations: ::buildGroupedLocations() from scratch
+// - nearestConstruct: building the NearestLocations index
+
+namespace
+{
+    enum : int
+    {
+        // Regions per country in the generated locations
+        RegionsPerCountry = 10,
+    };
+
+    // Three-letter country code for a country index (the codes are only
+    // used for grouping, they don't have to be real)
+    QString countryCode(int index)
+    {
+        QString code;
+        for(int i = 0; i < 3; ++i)
+        {
+            code.prepend(QChar{'a' + index % 26});
+            index /= 26;
+        }
+        return code;
+    }
+
+    ServerLocations buildLocations(int count)
+    {
+        ServerLocations locations;
+        locations.reserve(count);
+        for(int i = 0; i < count; ++i)
+        {
+            int c = i / RegionsPerCountry;
+            QString id = QStringLiteral("%1_region_%2").arg(countryCode(c)).arg(i % RegionsPerCountry);
+            QString ip = QStringLiteral("10.%1.%2.1").arg(c / 256).arg(c % 256);
+            QSharedPointer<ServerLocation> pLocation{new ServerLocation{}};
+            pLocation->id(id);
+            pLocation->name(QStringLiteral("Region %1").arg(i));
+            pLocation->country(countryCode(c).toUpper());
+            pLocation->dns(id + QStringLiteral(".privacy.network"));
+            pLocation->portForward(i % 2 == 0);
+            pLocation->openvpnUDP(ip + QStringLiteral(":8080"));
+            pLocation->openvpnTCP(ip + QStringLiteral(":500"));
+            pLocation->ping(ip + QStringLiteral(":8888"));
+            pLocation->serial(QStringLiteral("%1-serial").arg(id));
+            pLocation->latency(10.0 + (i * 7) % 300);
+            locations.insert(id, pLocation);
+        }
+        return locations;
+    }
+
+    // Build a latency measurement for every location, varied by 'seed' so
+    // each batch changes all of them
+    LatencyTracker::Latencies buildLatencies(const ServerLocations &locations, int seed)
+    {
+        LatencyTracker::Latencies latencies;
+        latencies.reserve(locations.size());
+        int i = 0;
+        for(auto itLocation = locations.begin(); itLocation != locations.end(); ++itLocation)
+        {
+            LatencyTracker::Measurement measurement{};
+            measurement.id = itLocation.key();
+            measurement.latency = std::chrono::milliseconds{10 + (i * 7 + seed) % 300};
+            measurement.median = measurement.latency;
+            measurement.loss = ((i + seed) % 10) / 100.0;
+            measurement.jitter = std::chrono::milliseconds{(i + seed) % 20};
+            measurement.method = LatencyTracker::ProbeMethod::Udp;
+            latencies.push_back(measurement);
+            ++i;
+        }
+        return latencies;
+    }
+}
+
+class tst_regionbench : public QObject
+{
+    Q_OBJECT
+
+private:
+    void addLocationCounts()
+    {
+        QTest::addColumn<int>("count");
+        QTest::newRow("100") << 100;
+        QTest::newRow("1000") << 1000;
+        QTest::newRow("10000") << 10000;
+    }
+
+private slots:
+    void trackerUpdateLocations_data() {addLocationCounts();}
+    void trackerUpdateLocations()
+    {
+        QFETCH(int, count);
+        ServerLocations locations = buildLocations(count);
+        // Measurements aren't started, so this doesn't send any probes
+        LatencyTracker tracker;
+        tracker.updateLocations(locations);
+
+        QBENCHMARK
+        {
+            tracker.updateLocations(locations);
+        }
+    }
+
+    void historyUpdate_data() {addLocationCounts();}
+    void historyUpdate()
+    {
+        QFETCH(int, count);
+        std::vector<LatencyHistory> histories(static_cast<std::size_t>(count));
+        int seed = 0;
+
+        QBENCHMARK
+        {
+            ++seed;
+            for(std::size_t i = 0; i < histories.size(); ++i)
+            {
+                auto measurement = std::chrono::milliseconds{10 + (static_cast<int>(i) * 7 + seed) % 300};
+                QVERIFY(histories[i].updateLatency(measurement).count() > 0);
+            }
+        }
+    }
+
+    void applyMeasurements_data() {addLocationCounts();}
+    void applyMeasurements()
+    {
+        QFETCH(int, count);
+        ServerLocations locations = buildLocations(count);
+        NearestLocations nearest{locations};
+        nearest.buildGroupedLocations();
+        // Batches are built ahead of time; the daemon receives them from
+        // LatencyTracker
+        std::vector<LatencyTracker::Latencies> batches;
+        for(int seed = 0; seed < 8; ++seed)
+            batches.push_back(buildLatencies(locations, seed));
+        std::size_t nextBatch = 0;
+
+        QBENCHMARK
+        {
+            for(const auto &measurement : batches[nextBatch])
+            {
+                const auto &pLocation = locations.value(measurement.id);
+                if(pLocation)
+                {
+                    pLocation->loss(measurement.loss);
+                    pLocation->jitter(static_cast<double>(measurement.jitter.count()));
+                    pLocation->latencyMethod(QStringLiteral("udp"));
+                    nearest.updateLatency(pLocation, static_cast<double>(measurement.latency.count()));
+                }
+            }
+            auto grouped = nearest.buildGroupedLocations();
+            QCOMPARE(grouped.size(), (count + RegionsPerCountry - 1) / RegionsPerCountry);
+            nextBatch = (nextBatch + 1) % batches.size();
+        }
+    }
+
+    void groupedLocations_data() {addLocationCounts();}
+    void groupedLocations()
+    {
+        QFETCH(int, count);
+        ServerLocations locations = buildLocations(count);
+
+        QBENCHMARK
+        {
+            auto grouped = buildGroupedLocations(locations);
+            QCOMPARE(grouped.size(), (count + RegionsPerCountry - 1) / RegionsPerCountry);
+        }
+    }
+
+    void nearestConstruct_data() {addLocationCounts();}
+    void nearestConstruct()
+    {
+        QFETCH(int, count);
+        ServerLocations locations = buildLocations(count);
+
+        QBENCHMARK
+        {
+            NearestLocations nearest{locations};
+            QVERIFY(nearest.getNearestSafeVpnLocation(false));
+        }
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_regionbench)
+#include TEST_MOC
@@ -0,0 +1,78 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#include "servicetimer.h"
+#include <QtTest>
+
+class tst_servicetimer : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // A single-shot timer fires once and then stops
+    void singleShot()
+    {
+        ServiceTimer timer;
+        timer.setSingleShot(true);
+        QSignalSpy timeoutSpy{&timer, &ServiceTimer::timeout};
+        timer.start(std::chrono::milliseconds{50});
+        QVERIFY(timer.isActive());
+        QVERIFY(timeoutSpy.wait(1000));
+        QVERIFY(!timer.isActive());
+        QTest::qWait(200);
+        QCOMPARE(timeoutSpy.size(), 1);
+    }
+
+    // An interval timer keeps firing until it's stopped
+    void interval()
+    {
+        ServiceTimer timer;
+        timer.setInterval(50);
+        QCOMPARE(timer.interval(), 50);
+        QSignalSpy timeoutSpy{&timer, &ServiceTimer::timeout};
+        timer.start();
+        QTRY_VERIFY_WITH_TIMEOUT(timeoutSpy.size() >= 3, 2000);
+        QVERIFY(timer.isActive());
+        timer.stop();
+        int count = timeoutSpy.size();
+        QTest::qWait(200);
+        QCOMPARE(timeoutSpy.size(), count);
+    }
+
+    // Stopping the timer before it elapses prevents the timeout
+    void stopBeforeTimeout()
+    {
+        ServiceTimer timer;
+        QSignalSpy timeoutSpy{&timer, &ServiceTimer::timeout};
+        timer.start(100);
+        timer.stop();
+        QVERIFY(!timer.isActive());
+        QVERIFY(!timeoutSpy.wait(300));
+    }
+
+    // The unbiased clock advances
+    void unbiasedClock()
+    {
+        auto start = TimerService::unbiasedNow();
+        QTest::qWait(100);
+        QVERIFY(TimerService::unbiasedNow() - start >= std::chrono::milliseconds{50});
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_servicetimer)
+#include TEST_MOC
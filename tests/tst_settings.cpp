@@ -19,6 +19,7 @@
 #include "common.h"
 #include "settings.h"
 #include <QtTest>
+#include <cmath>
 
 namespace sample_docs {
 
@@ -289,6 +290,22 @@ private slots:
         QCOMPARE(pUs2->openvpnTCP(), "209.222.23.59:500");
     }
 
+    //Repeated strings like the country codes are shared between locations,
+    //and measureLocationsMemory() counts them once
+    void sharedLocationStrings()
+    {
+        ServerLocations locs{updateServerLocations(emptyLocs, sample_docs::twoLocations)};
+        const auto &pUsCal = locs.value(QStringLiteral("us_california"));
+        const auto &pUs2 = locs.value(QStringLiteral("us2"));
+        QVERIFY(pUsCal);
+        QVERIFY(pUs2);
+        QCOMPARE(pUsCal->country().constData(), pUs2->country().constData());
+
+        const auto &stats = measureLocationsMemory(locs);
+        QCOMPARE(stats.locations, 2);
+        QVERIFY(stats.sharedBytes < stats.stringBytes);
+    }
+
     //Loading JSON data with no valid locations should fail without changing
     //the existing data.
     void testInvalidLoad()
@@ -364,6 +381,149 @@ private slots:
         QVERIFY(pMontrealUpd);
         QCOMPARE(pMontrealUpd->latency().get(), montrealLatency);
     }
+
+    // Unchanged locations are replaced with the existing objects, changed
+    // locations are detected.
+    void reuseUnchanged()
+    {
+        ServerLocations origLocs{updateServerLocations(emptyLocs, sample_docs::twoLocations)};
+        QVERIFY(origLocs.size() == 2);
+
+        // Reloading the same data changes nothing
+        ServerLocations sameLocs{updateServerLocations(origLocs, sample_docs::twoLocations)};
+        bool pingChanged{true};
+        QCOMPARE(reuseUnchangedLocations(origLocs, sameLocs, &pingChanged), 0);
+        QCOMPARE(pingChanged, false);
+        QVERIFY(sameLocs == origLocs);
+
+        // Changing the locations entirely changes all of them, including the
+        // ping addresses
+        ServerLocations newLocs{updateServerLocations(origLocs, sample_docs::oneLocation)};
+        QCOMPARE(reuseUnchangedLocations(origLocs, newLocs, &pingChanged), 3);
+        QCOMPARE(pingChanged, true);
+    }
+
+    // A location's cached JSON is reused until one of its properties changes,
+    // and fields referencing the location serialize it from the cache
+    void cachedLocationJson()
+    {
+        ServerLocations locs{updateServerLocations(emptyLocs, sample_docs::oneLocation)};
+        const auto &pMontreal = locs.value(QStringLiteral("ca"));
+        QVERIFY(pMontreal);
+
+        const QJsonObject &json = pMontreal->cachedJson();
+        QCOMPARE(json, pMontreal->toJsonObject());
+        quint64 revision = pMontreal->revision();
+        QCOMPARE(pMontreal->cachedJson(), json);
+        QCOMPARE(pMontreal->revision(), revision);
+
+        pMontreal->latency(quint64{50});
+        QVERIFY(pMontreal->revision() != revision);
+        QCOMPARE(pMontreal->cachedJson()[QStringLiteral("latency")], 50);
+
+        ServiceLocations service;
+        service.chosenLocation(pMontreal);
+        service.bestLocation(pMontreal);
+        const auto &serviceJson = service.toJsonObject();
+        QCOMPARE(serviceJson[QStringLiteral("chosenLocation")].toObject(), pMontreal->toJsonObject());
+        QCOMPARE(serviceJson[QStringLiteral("bestLocation")].toObject(), pMontreal->toJsonObject());
+    }
+
+    // The weighted ranking penalizes jitter, loss, and connection failures
+    void weightedRanking()
+    {
+        ServerLocations locs{updateServerLocations(emptyLocs, sample_docs::twoLocations)};
+        const auto &pCalifornia = locs.value(QStringLiteral("us_california"));
+        const auto &pEast = locs.value(QStringLiteral("us2"));
+        QVERIFY(pCalifornia);
+        QVERIFY(pEast);
+
+        DaemonData::LocationHistoryMap history;
+        history[QStringLiteral("us2")].connectSuccess(0.5);
+        WeightedLocationRanking ranking{history};
+
+        // Unmeasured locations can't be ranked
+        QVERIFY(!std::isfinite(ranking.score(*pCalifornia)));
+
+        pCalifornia->latency(100.0);
+        QCOMPARE(ranking.score(*pCalifornia), 100.0);
+        pCalifornia->jitter(5.0);
+        pCalifornia->loss(0.25);
+        QCOMPARE(ranking.score(*pCalifornia), 220.0);
+
+        pEast->latency(60.0);
+        QCOMPARE(ranking.score(*pEast), 90.0);
+        // The base ranking only considers latency
+        QCOMPARE(LocationRanking{}.score(*pCalifornia), 100.0);
+    }
+
+    // The best location doesn't change for a marginal improvement
+    void bestLocationHysteresis()
+    {
+        ServerLocations locs{updateServerLocations(emptyLocs, sample_docs::twoLocations)};
+        const auto &pCalifornia = locs.value(QStringLiteral("us_california"));
+        const auto &pEast = locs.value(QStringLiteral("us2"));
+        NearestLocations nearest{locs};
+        nearest.updateLatency(pCalifornia, 100.0);
+        nearest.updateLatency(pEast, 97.0);
+
+        QCOMPARE(nearest.getNearestSafeVpnLocation(false)->id(), QStringLiteral("us2"));
+        QCOMPARE(nearest.getNearestSafeVpnLocation(false, pCalifornia)->id(),
+                 QStringLiteral("us_california"));
+
+        // A significant improvement replaces the previous location
+        nearest.updateLatency(pEast, 60.0);
+        QCOMPARE(nearest.getNearestSafeVpnLocation(false, pCalifornia)->id(),
+                 QStringLiteral("us2"));
+
+        // An unsafe previous location is replaced
+        nearest.updateLatency(pEast, 97.0);
+        pCalifornia->isSafeForAutoConnect(false);
+        QCOMPARE(nearest.getNearestSafeVpnLocation(false, pCalifornia)->id(),
+                 QStringLiteral("us2"));
+    }
+
+    // The grouped locations are updated as locations move, and countries that
+    // didn't change keep the same groups
+    void incrementalGroupedLocations()
+    {
+        ServerLocations locs{updateServerLocations(emptyLocs, sample_docs::twoLocations)};
+        locs.unite(updateServerLocations(emptyLocs, sample_docs::oneLocation));
+        const auto &pCalifornia = locs.value(QStringLiteral("us_california"));
+        const auto &pEast = locs.value(QStringLiteral("us2"));
+        const auto &pMontreal = locs.value(QStringLiteral("ca"));
+        QVERIFY(pCalifornia);
+        QVERIFY(pEast);
+        QVERIFY(pMontreal);
+
+        NearestLocations nearest{locs};
+        nearest.updateLatency(pCalifornia, 100.0);
+        nearest.updateLatency(pEast, 50.0);
+        nearest.updateLatency(pMontreal, 80.0);
+        auto grouped = nearest.buildGroupedLocations();
+        QCOMPARE(grouped.size(), 2);
+        QCOMPARE(grouped[0].locations(), (QVector<QSharedPointer<ServerLocation>>{pEast, pCalifornia}));
+        QCOMPARE(grouped[1].locations(), QVector<QSharedPointer<ServerLocation>>{pMontreal});
+        QVERIFY(grouped == buildGroupedLocations(locs));
+
+        // Moving a location within its country only reorders that country
+        nearest.updateLatency(pCalifornia, 40.0);
+        auto regrouped = nearest.buildGroupedLocations();
+        QCOMPARE(regrouped[0].locations(), (QVector<QSharedPointer<ServerLocation>>{pCalifornia, pEast}));
+        QVERIFY(regrouped[1] == grouped[1]);
+        QVERIFY(regrouped == buildGroupedLocations(locs));
+
+        // The countries are reordered by their nearest location
+        nearest.updateLatency(pMontreal, 10.0);
+        regrouped = nearest.buildGroupedLocations();
+        QCOMPARE(regrouped[0].locations(), QVector<QSharedPointer<ServerLocation>>{pMontreal});
+        QVERIFY(regrouped == buildGroupedLocations(locs));
+
+        // Resetting drops countries that are no longer present
+        locs.remove(QStringLiteral("ca"));
+        nearest.reset(locs);
+        QCOMPARE(nearest.buildGroupedLocations().size(), 1);
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_settings)
@@ -0,0 +1,332 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "daemon/src/socksserver.h"
+#include <QtTest>
+#include <QElapsedTimer>
+#include <QFile>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+// Load benchmark for SocksServer.  This isn't run with the unit tests; build
+// and run "test: socksbench" manually to measure the effect of proxy changes.
+//
+// The benchmark runs SocksServer bound to localhost with a local echo server
+// as the target, then measures:
+// - handshakes: many concurrent CONNECT handshakes, reporting handshakes/s and
+//   the p99 handshake latency
+// - bulkTransfer: a few connections sending data through the proxy to the
+//   echo server and back, reporting MB/s
+// Each result also reports the process RSS (Linux only).
+
+namespace
+{
+    enum : int
+    {
+        // Total handshakes performed, and how many are in progress at once
+        HandshakeCount = 4000,
+        HandshakeConcurrency = 128,
+        // Connections used for the bulk transfer, and the data sent on each
+        TransferConnections = 16,
+        TransferBytes = 32 * 1024 * 1024,
+        // Size of each write during the bulk transfer, and the most data each
+        // client keeps buffered (so the client doesn't just buffer the whole
+        // transfer)
+        TransferChunk = 64 * 1024,
+        TransferMaxBuffered = 256 * 1024,
+        // Timeout for each benchmark
+        BenchmarkTimeoutMs = 120000,
+    };
+
+    const QHostAddress localhost{QHostAddress::SpecialAddress::LocalHost};
+
+    // Get the process's resident set size in KiB, or -1 if it can't be read
+    qint64 residentKiB()
+    {
+#ifdef Q_OS_LINUX
+        QFile status{QStringLiteral("/proc/self/status")};
+        if(!status.open(QIODevice::ReadOnly))
+            return -1;
+        for(const auto &line : status.readAll().split('\n'))
+        {
+            if(line.startsWith("VmRSS:"))
+                return line.mid(6).trimmed().split(' ').value(0).toLongLong();
+        }
+#endif
+        return -1;
+    }
+}
+
+// Echo server used as the proxy's target
+class EchoServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    EchoServer()
+    {
+        _server.listen(localhost);
+        connect(&_server, &QTcpServer::newConnection, this, [this]()
+        {
+            while(QTcpSocket *pSocket = _server.nextPendingConnection())
+            {
+                connect(pSocket, &QTcpSocket::readyRead, pSocket, [pSocket]()
+                {
+                    pSocket->write(pSocket->readAll());
+                });
+                connect(pSocket, &QTcpSocket::disconnected, pSocket, &QObject::deleteLater);
+            }
+        });
+    }
+
+public:
+    quint16 port() const {return _server.serverPort();}
+
+private:
+    QTcpServer _server;
+};
+
+// SOCKS client - performs the handshake, then optionally sends data through
+// the proxy and waits for it to be echoed.  Emits finished() when done (or if
+// it fails).
+class BenchClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    BenchClient(quint16 proxyPort, const QByteArray &password,
+                quint16 targetPort, qint64 transferBytes, QObject *pParent)
+        : QObject{pParent}, _transferBytes{transferBytes}, _sent{0},
+          _received{0}, _handshakeNsec{-1}, _failed{false}, _finished{false}
+    {
+        connect(&_socket, &QTcpSocket::connected, this, [this, password, targetPort]()
+        {
+            // Send the greeting, auth, and connect request at once; the
+            // server processes them in order.
+            QByteArray request;
+            request.append(char(5)).append(char(1)).append(char(2));
+            request.append(char(1)).append(char(SocksConnection::username.size()))
+                .append(SocksConnection::username);
+            request.append(char(1)).append(char(password.size())).append(password);
+            quint32 addr = localhost.toIPv4Address();
+            request.append(char(5)).append(char(1)).append(char(0)).append(char(1))
+                .append(char(addr >> 24)).append(char(addr >> 16))
+                .append(char(addr >> 8)).append(char(addr))
+                .append(char(targetPort >> 8)).append(char(targetPort));
+            _socket.write(request);
+        });
+        connect(&_socket, &QTcpSocket::readyRead, this, &BenchClient::onReadyRead);
+        connect(&_socket, &QTcpSocket::bytesWritten, this, &BenchClient::sendMore);
+        connect(&_socket, QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::error),
+                this, [this](){fail();});
+
+        _timer.start();
+        _socket.connectToHost(localhost, proxyPort);
+    }
+
+public:
+    bool failed() const {return _failed;}
+    qint64 handshakeNsec() const {return _handshakeNsec;}
+
+signals:
+    void finished();
+
+private:
+    // Length of the method, auth, and connect responses
+    enum { HandshakeResponseLength = 2 + 2 + 10 };
+
+    void finish()
+    {
+        if(!_finished)
+        {
+            _finished = true;
+            emit finished();
+        }
+    }
+
+    void fail()
+    {
+        // Errors after finishing (such as the remote side closing) don't
+        // matter
+        if(!_finished)
+        {
+            _failed = true;
+            _socket.abort();
+            finish();
+        }
+    }
+
+    void onReadyRead()
+    {
+        if(_handshakeNsec < 0)
+        {
+            if(_socket.bytesAvailable() < HandshakeResponseLength)
+                return;
+            QByteArray response = _socket.read(HandshakeResponseLength);
+            // Check the method, auth, and connect statuses
+            if(response[1] != 2 || response[3] != 0 || response[5] != 0)
+            {
+                fail();
+                return;
+            }
+            _handshakeNsec = _timer.nsecsElapsed();
+            if(_transferBytes == 0)
+            {
+                _socket.disconnectFromHost();
+                finish();
+                return;
+            }
+            sendMore();
+        }
+
+        _received += _socket.skip(_socket.bytesAvailable());
+        if(_received >= _transferBytes)
+        {
+            _socket.disconnectFromHost();
+            finish();
+        }
+    }
+
+    void sendMore()
+    {
+        static const QByteArray chunk{TransferChunk, 'x'};
+        while(_handshakeNsec >= 0 && _sent < _transferBytes &&
+              _socket.bytesToWrite() < TransferMaxBuffered)
+        {
+            qint64 size = std::min<qint64>(chunk.size(), _transferBytes - _sent);
+            _socket.write(chunk.constData(), size);
+            _sent += size;
+        }
+    }
+
+private:
+    QTcpSocket _socket;
+    QElapsedTimer _timer;
+    qint64 _transferBytes, _sent, _received;
+    qint64 _handshakeNsec;
+    bool _failed, _finished;
+};
+
+class tst_socksbench : public QObject
+{
+    Q_OBJECT
+
+private:
+    // Run count clients with at most concurrency in progress at once, and
+    // store their handshake latencies in latencies.
+    void runClients(int count, int concurrency, qint64 transferBytes,
+                    std::vector<qint64> &latencies)
+    {
+        latencies.reserve(static_cast<std::size_t>(count));
+        int started = 0, finished = 0, failures = 0;
+        std::function<void()> startClient;
+        // Owns the clients; declared last so any unfinished clients are
+        // destroyed before the state they refer to (if this times out)
+        QObject clientOwner;
+
+        startClient = [&]()
+        {
+            ++started;
+            auto pClient = new BenchClient{_pServer->port(), _pServer->password(),
+                                           _echo.port(), transferBytes,
+                                           &clientOwner};
+            connect(pClient, &BenchClient::finished, this, [&, pClient]()
+            {
+                ++finished;
+                if(pClient->failed())
+                    ++failures;
+                else
+                    latencies.push_back(pClient->handshakeNsec());
+                pClient->deleteLater();
+                if(started < count)
+                    startClient();
+            });
+        };
+        while(started < std::min(count, concurrency))
+            startClient();
+
+        QTRY_VERIFY_WITH_TIMEOUT(finished == count, BenchmarkTimeoutMs);
+        QCOMPARE(failures, 0);
+    }
+
+    void report(const char *name, double value, const char *unit)
+    {
+        qInfo().nospace() << name << ": " << value << " " << unit;
+    }
+
+private slots:
+    void initTestCase()
+    {
+        QVERIFY(_echo.port());
+        _pServer.reset(new SocksServer{localhost, QStringLiteral("lo"), {}});
+        QVERIFY(_pServer->port());
+    }
+
+    void cleanupTestCase()
+    {
+        _pServer.reset();
+    }
+
+    void handshakes()
+    {
+        QElapsedTimer elapsed;
+        elapsed.start();
+        std::vector<qint64> latencies;
+        runClients(HandshakeCount, HandshakeConcurrency, 0, latencies);
+        if(QTest::currentTestFailed())
+            return;
+        qint64 elapsedMs = std::max<qint64>(elapsed.elapsed(), 1);
+        QCOMPARE(latencies.size(), static_cast<std::size_t>(HandshakeCount));
+
+        std::sort(latencies.begin(), latencies.end());
+        auto p99Index = (latencies.size() * 99 + 99) / 100 - 1;
+
+        report("Handshakes", HandshakeCount * 1000.0 / elapsedMs, "/s");
+        report("p99 handshake latency", latencies[p99Index] / 1000000.0, "ms");
+        report("RSS", residentKiB(), "KiB");
+    }
+
+    void bulkTransfer()
+    {
+        QElapsedTimer elapsed;
+        elapsed.start();
+        std::vector<qint64> latencies;
+        runClients(TransferConnections, TransferConnections, TransferBytes, latencies);
+        if(QTest::currentTestFailed())
+            return;
+        qint64 elapsedMs = std::max<qint64>(elapsed.elapsed(), 1);
+
+        // Each byte passes through the proxy twice (to the echo server and
+        // back)
+        double relayedMB = 2.0 * TransferConnections * TransferBytes / (1024 * 1024);
+        report("Throughput", relayedMB * 1000.0 / elapsedMs, "MB/s");
+        report("RSS", residentKiB(), "KiB");
+
+        SocksServerStats stats = _pServer->stats();
+        report("Read pauses", stats.readPauses, "");
+        report("Peak buffered", stats.peakBufferedBytes / 1024.0, "KiB");
+    }
+
+private:
+    EchoServer _echo;
+    QScopedPointer<SocksServer> _pServer;
+};
+
+QTEST_GUILESS_MAIN(tst_socksbench)
+#include TEST_MOC
@@ -20,6 +20,7 @@
 #include <QtTest>
 
 #include "async.h"
+#include "thread.h"
 
 class tst_tasks : public QObject
 {
@@ -508,6 +509,43 @@ private slots:
         QVERIFY(result->isResolved());
         QCOMPARE(result->result(), 6);
     }
+    void invokeOnThreadAsync()
+    {
+        RunningWorkerThread worker;
+        QThread *pWorkerThread{};
+        auto result = worker.invokeOnThreadAsync([&]()
+        {
+            pWorkerThread = QThread::currentThread();
+            return 5;
+        });
+        // Resolved on this thread once the worker's result is delivered
+        QTRY_VERIFY(result->isFinished());
+        QVERIFY(result->isResolved());
+        QCOMPARE(result->result(), 5);
+        QVERIFY(pWorkerThread);
+        QVERIFY(pWorkerThread != QThread::currentThread());
+        QCOMPARE(result->thread(), QThread::currentThread());
+    }
+    void invokeOnThreadAsyncVoid()
+    {
+        RunningWorkerThread worker;
+        bool invoked = false;
+        auto result = worker.invokeOnThreadAsync([&](){invoked = true;});
+        QTRY_VERIFY(result->isFinished());
+        QVERIFY(result->isResolved());
+        QVERIFY(invoked);
+    }
+    void invokeOnThreadAsyncThrow()
+    {
+        RunningWorkerThread worker;
+        auto result = worker.invokeOnThreadAsync([]() -> int
+        {
+            throw Error{HERE, Error::Unknown};
+        });
+        QTRY_VERIFY(result->isFinished());
+        QVERIFY(result->isRejected());
+        QCOMPARE(result->error().code(), Error::Unknown);
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_tasks)
@@ -0,0 +1,102 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#include "tracing.h"
+#include <QtTest>
+#include <QJsonArray>
+
+namespace
+{
+    // Get the trace events, skipping metadata events
+    QJsonArray traceEvents()
+    {
+        QJsonArray events;
+        for(const auto &event : Tracer::chromeTrace()[QStringLiteral("traceEvents")].toArray())
+        {
+            if(event.toObject()[QStringLiteral("ph")].toString() != QStringLiteral("M"))
+                events.push_back(event);
+        }
+        return events;
+    }
+}
+
+class tst_tracing : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init()
+    {
+        Tracer::reset();
+    }
+
+    // Spans, instants, and async spans are exported in Chrome trace format
+    void eventFormat()
+    {
+        qint64 start = Tracer::now();
+        {
+            TraceSpan span{"test", QStringLiteral("span")};
+        }
+        Tracer::instant("test", QStringLiteral("instant"));
+        Tracer::asyncBegin("test", QStringLiteral("async"), 5);
+        Tracer::asyncEnd("test", QStringLiteral("async"), 5);
+
+        const auto &events = traceEvents();
+        QCOMPARE(events.size(), 4);
+
+        const auto &span = events[0].toObject();
+        QCOMPARE(span["ph"].toString(), QStringLiteral("X"));
+        QCOMPARE(span["cat"].toString(), QStringLiteral("test"));
+        QCOMPARE(span["name"].toString(), QStringLiteral("span"));
+        QVERIFY(span["ts"].toDouble() >= start);
+        QVERIFY(span["dur"].toDouble() >= 0);
+        QCOMPARE(span["pid"].toDouble(), static_cast<double>(QCoreApplication::applicationPid()));
+
+        QCOMPARE(events[1].toObject()["ph"].toString(), QStringLiteral("i"));
+        QCOMPARE(events[2].toObject()["ph"].toString(), QStringLiteral("b"));
+        QCOMPARE(events[2].toObject()["id"].toString(), QStringLiteral("5"));
+        QCOMPARE(events[3].toObject()["ph"].toString(), QStringLiteral("e"));
+        QCOMPARE(events[3].toObject()["id"].toString(), QStringLiteral("5"));
+
+        // The thread is identified consistently
+        QCOMPARE(events[0].toObject().value("tid"), events[3].toObject().value("tid"));
+    }
+
+    // The oldest events are discarded when the buffer is full
+    void ringBuffer()
+    {
+        Tracer::reset(3);
+        for(int i=0; i<5; ++i)
+            Tracer::instant("test", QString::number(i));
+
+        const auto &events = traceEvents();
+        QCOMPARE(events.size(), 3);
+        QCOMPARE(events[0].toObject()["name"].toString(), QStringLiteral("2"));
+        QCOMPARE(events[1].toObject()["name"].toString(), QStringLiteral("3"));
+        QCOMPARE(events[2].toObject()["name"].toString(), QStringLiteral("4"));
+    }
+
+    void diagnosticsTracePath()
+    {
+        QCOMPARE(Tracer::diagnosticsTracePath(QStringLiteral("/tmp/diag/diag_20200101_000000000.txt")),
+                 QStringLiteral("/tmp/diag/diag_20200101_000000000_trace.json"));
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_tracing)
+#include TEST_MOC
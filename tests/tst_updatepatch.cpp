@@ -0,0 +1,126 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "daemon/src/updatepatch.h"
+#include <QtTest>
+#include <QBuffer>
+#include <QTemporaryFile>
+
+namespace
+{
+    // Encode a bsdiff offset
+    QByteArray encodeOffset(qint64 value)
+    {
+        quint64 magnitude = static_cast<quint64>(value < 0 ? -value : value);
+        QByteArray encoded{8, '\0'};
+        for(int i = 0; i < 8; ++i)
+        {
+            encoded[i] = static_cast<char>(magnitude & 0xFF);
+            magnitude >>= 8;
+        }
+        if(value < 0)
+            encoded[7] = static_cast<char>(encoded[7] | 0x80);
+        return encoded;
+    }
+
+    // Build a patch from a body and the new file size
+    QByteArray buildPatch(const QByteArray &body, qint64 newSize)
+    {
+        return QByteArrayLiteral("ENDSLEY/BSDIFF43") + encodeOffset(newSize) +
+            qCompress(body);
+    }
+
+    // Build a control triple
+    QByteArray control(qint64 diffLen, qint64 extraLen, qint64 baseSeek)
+    {
+        return encodeOffset(diffLen) + encodeOffset(extraLen) + encodeOffset(baseSeek);
+    }
+}
+
+class tst_updatepatch : public QObject
+{
+    Q_OBJECT
+
+private:
+    // Apply a patch to a base, and return the result (or a null QByteArray if
+    // the patch fails)
+    QByteArray applyPatch(const QByteArray &base, const QByteArray &patch)
+    {
+        QTemporaryFile baseFile;
+        if(!baseFile.open())
+            return {};
+        baseFile.write(base);
+        baseFile.close();
+
+        QByteArray output;
+        QBuffer outputBuffer{&output};
+        outputBuffer.open(QIODevice::OpenModeFlag::WriteOnly);
+        QCryptographicHash hash{QCryptographicHash::Algorithm::Sha256};
+        if(!UpdatePatch::apply(baseFile.fileName(), patch, outputBuffer, hash))
+            return {};
+        // The hash must match the output
+        if(hash.result() != QCryptographicHash::hash(output, QCryptographicHash::Algorithm::Sha256))
+            return {};
+        // Make sure the output isn't null when it's empty
+        if(output.isNull())
+            output = QByteArray{""};
+        return output;
+    }
+
+private slots:
+    // Apply a patch with diff and extra data
+    void testApply()
+    {
+        const QByteArray base{"hello world"};
+        // "jello world!!" - diff the first 11 bytes ('h'->'j' is +2), then add
+        // 2 extra bytes
+        QByteArray diff{11, '\0'};
+        diff[0] = 2;
+        const QByteArray body = control(11, 2, 0) + diff + QByteArray{"!!"};
+        QCOMPARE(applyPatch(base, buildPatch(body, 13)), QByteArray{"jello world!!"});
+    }
+
+    // Apply a patch that seeks within the base
+    void testSeek()
+    {
+        const QByteArray base{"abcdefgh"};
+        // Copy "ab", add "-", skip ahead 4 in the base, copy "gh"
+        const QByteArray body = control(2, 1, 4) + QByteArray{2, '\0'} +
+            QByteArray{"-"} + control(2, 0, 0) + QByteArray{2, '\0'};
+        QCOMPARE(applyPatch(base, buildPatch(body, 5)), QByteArray{"ab-gh"});
+    }
+
+    // Invalid patches fail
+    void testInvalid()
+    {
+        const QByteArray base{"hello world"};
+        // Wrong magic
+        QVERIFY(applyPatch(base, QByteArrayLiteral("NOTABSDIFFPATCH!") +
+                                 encodeOffset(1) + qCompress(control(0, 1, 0) + "x")).isNull());
+        // Truncated control data
+        QVERIFY(applyPatch(base, buildPatch(encodeOffset(1), 1)).isNull());
+        // Control data exceeds the new size
+        QVERIFY(applyPatch(base, buildPatch(control(0, 5, 0) + "xxxxx", 2)).isNull());
+        // Control data exceeds the patch body
+        QVERIFY(applyPatch(base, buildPatch(control(0, 5, 0) + "xx", 5)).isNull());
+        // Negative lengths
+        QVERIFY(applyPatch(base, buildPatch(control(-1, 0, 0), 5)).isNull());
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_updatepatch)
+#include TEST_MOC
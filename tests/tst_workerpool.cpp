@@ -0,0 +1,114 @@
+// Copyright (c) 2020 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include "workerpool.h"
+#include <QtTest>
+#include <atomic>
+#include <thread>
+
+class tst_workerpool : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // Items in one queue run in order, never concurrently
+    void serialQueue()
+    {
+        WorkerPool pool{4};
+        QVector<int> order;
+        std::atomic<int> running{0};
+        std::atomic<bool> overlapped{false};
+        {
+            WorkerQueue queue{pool, QStringLiteral("serial"), WorkerPool::Priority::Normal};
+            for(int i=0; i<20; ++i)
+            {
+                queue.queue([&, i]()
+                {
+                    if(running.fetch_add(1) != 0)
+                        overlapped = true;
+                    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+                    order.push_back(i);
+                    running.fetch_sub(1);
+                });
+            }
+            // Destroying the queue waits for all items
+        }
+        QVERIFY(!overlapped);
+        QCOMPARE(order.size(), 20);
+        for(int i=0; i<order.size(); ++i)
+            QCOMPARE(order[i], i);
+    }
+
+    // Separate queues run concurrently, up to the pool's thread limit
+    void concurrentQueues()
+    {
+        WorkerPool pool{2};
+        std::atomic<int> running{0};
+        std::atomic<int> peak{0};
+        auto work = [&]()
+        {
+            int now = running.fetch_add(1) + 1;
+            int prevPeak = peak.load();
+            while(now > prevPeak && !peak.compare_exchange_weak(prevPeak, now));
+            std::this_thread::sleep_for(std::chrono::milliseconds{50});
+            running.fetch_sub(1);
+        };
+        {
+            WorkerQueue first{pool, QStringLiteral("first"), WorkerPool::Priority::Normal};
+            WorkerQueue second{pool, QStringLiteral("second"), WorkerPool::Priority::Normal};
+            WorkerQueue third{pool, QStringLiteral("third"), WorkerPool::Priority::Normal};
+            first.queue(work);
+            second.queue(work);
+            third.queue(work);
+        }
+        QCOMPARE(peak.load(), 2);
+    }
+
+    // run() resolves the task on the calling thread with the result
+    void runResult()
+    {
+        WorkerPool pool{2};
+        WorkerQueue queue{pool, QStringLiteral("result"), WorkerPool::Priority::Normal};
+        QThread *pWorkThread{};
+        auto pResult = queue.run([&]()
+        {
+            pWorkThread = QThread::currentThread();
+            return QStringLiteral("done");
+        });
+        QTRY_VERIFY(pResult->isFinished());
+        QVERIFY(pResult->isResolved());
+        QCOMPARE(pResult->result(), QStringLiteral("done"));
+        QVERIFY(pWorkThread != QThread::currentThread());
+        QCOMPARE(pResult->thread(), QThread::currentThread());
+    }
+
+    // An Error thrown by the functor rejects the task
+    void runError()
+    {
+        WorkerPool pool{2};
+        WorkerQueue queue{pool, QStringLiteral("error"), WorkerPool::Priority::Normal};
+        auto pResult = queue.run([]() -> int {throw Error{HERE, Error::Unknown};});
+        QTRY_VERIFY(pResult->isFinished());
+        QVERIFY(pResult->isRejected());
+        QCOMPARE(pResult->error().code(), Error::Unknown);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_workerpool)
+#include TEST_MOC